@@ -0,0 +1,29 @@
+#
+# Find the native WebP includes and library
+#
+
+# This module defines
+# WebP_INCLUDE_DIRS, where to find webp/encode.h and webp/decode.h
+# WebP_LIBRARIES, the libraries
+# WebP_FOUND, If false, do not try to use WebP.
+
+FIND_PATH(WebP_INCLUDE_DIR webp/decode.h
+  PATHS /usr/include
+  /usr/local/include
+  HINTS ENV WebP_INCLUDE_DIR
+)
+
+FIND_LIBRARY(WebP_LIBRARY
+  NAMES webp libwebp
+  PATHS /usr/lib /usr/local/lib
+  HINTS ENV WebP_LIBDIR
+)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(WebP DEFAULT_MSG WebP_LIBRARY WebP_INCLUDE_DIR)
+
+IF(WEBP_FOUND)
+  SET(WebP_FOUND TRUE)
+  SET(WebP_LIBRARIES ${WebP_LIBRARY})
+  SET(WebP_INCLUDE_DIRS ${WebP_INCLUDE_DIR})
+ENDIF(WEBP_FOUND)
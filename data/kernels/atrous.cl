@@ -85,3 +85,106 @@ eaw_synthesize (__write_only image2d_t out, __read_only image2d_t coarse, __read
   write_imagef (out, (int2)(x, y), sum);
 }
 
+
+
+/* the legacy equalizer. this is not the a-trous transform above but the in-place lifting scheme of
+ * iop/equalizer_eaw.h: per level the coefficients at odd multiples of st are predicted from their
+ * even neighbours, then the even ones are updated, first along rows, then along columns. */
+
+float
+equalizer_weight(global const float *weight, const int wd, const int level,
+                 const int i, const int j, const int ii, const int jj)
+{
+  return 1.0f/(fabs(weight[wd*(j>>(level-1)) + (i>>(level-1))] - weight[wd*(jj>>(level-1)) + (ii>>(level-1))]) + 1.e-5f);
+}
+
+/* luma of the coarse grid at the start of a level, the edges of the transform */
+__kernel void
+equalizer_weights (global const float4 *buf, global float *weight, const int width, const int level,
+     const int wd, const int ht)
+{
+  const int i = get_global_id(0);
+  const int j = get_global_id(1);
+
+  if(i >= wd || j >= ht) return;
+
+  weight[j*wd + i] = (i < wd-1 && j < ht-1) ? buf[width*(j<<(level-1)) + (i<<(level-1))].x : 0.0f;
+}
+
+/* predict step, sign -1 for the forward and +1 for the inverse transform */
+__kernel void
+equalizer_predict (global float4 *buf, global const float *weight, const int width, const int height,
+     const int level, const int wd, const int horizontal, const float sign)
+{
+  const int st = 1<<(level-1);
+  const int step = 1<<level;
+  const int k = st + step*get_global_id(horizontal ? 0 : 1);
+  const int o = get_global_id(horizontal ? 1 : 0);
+  const int len = horizontal ? width : height;
+
+  if(k >= len || o >= (horizontal ? height : width)) return;
+
+  const int idx = horizontal ? o*width + k : k*width + o;
+  const int stride = horizontal ? st : st*width;
+  float4 pixel = buf[idx];
+  if(k < len - st)
+  {
+    const float w0 = horizontal ? equalizer_weight(weight, wd, level, k-st, o, k, o) : equalizer_weight(weight, wd, level, o, k-st, o, k);
+    const float w1 = horizontal ? equalizer_weight(weight, wd, level, k, o, k+st, o) : equalizer_weight(weight, wd, level, o, k, o, k+st);
+    pixel.xyz += sign*(w0*buf[idx - stride].xyz + w1*buf[idx + stride].xyz)/(w0 + w1);
+  }
+  else pixel.xyz += sign*buf[idx - stride].xyz;
+  buf[idx] = pixel;
+}
+
+/* update step, sign +1 for the forward and -1 for the inverse transform */
+__kernel void
+equalizer_update (global float4 *buf, global const float *weight, const int width, const int height,
+     const int level, const int wd, const int horizontal, const float sign)
+{
+  const int st = 1<<(level-1);
+  const int step = 1<<level;
+  const int k = step*get_global_id(horizontal ? 0 : 1);
+  const int o = get_global_id(horizontal ? 1 : 0);
+  const int len = horizontal ? width : height;
+
+  if(k >= len || o >= (horizontal ? height : width)) return;
+
+  const int idx = horizontal ? o*width + k : k*width + o;
+  const int stride = horizontal ? st : st*width;
+  float4 pixel = buf[idx];
+  if(k == 0)
+  {
+    if(st < len) pixel.xyz += sign*buf[idx + stride].xyz*0.5f;
+  }
+  else if(k < len - st)
+  {
+    const float w0 = horizontal ? equalizer_weight(weight, wd, level, k-st, o, k, o) : equalizer_weight(weight, wd, level, o, k-st, o, k);
+    const float w1 = horizontal ? equalizer_weight(weight, wd, level, k, o, k+st, o) : equalizer_weight(weight, wd, level, o, k, o, k+st);
+    pixel.xyz += sign*(w0*buf[idx - stride].xyz + w1*buf[idx + stride].xyz)/(2.0f*(w0 + w1));
+  }
+  else pixel.xyz += sign*buf[idx - stride].xyz*0.5f;
+  buf[idx] = pixel;
+}
+
+/* scale the detail coefficients of all levels, coeff holds the factors per level and channel */
+__kernel void
+equalizer_scale (global float4 *buf, constant float4 *coeff, const int width, const int height, const int numl)
+{
+  const int i = get_global_id(0);
+  const int j = get_global_id(1);
+
+  if(i >= width || j >= height) return;
+
+  float4 pixel = buf[j*width + i];
+  for(int l=1; l<numl; l++)
+  {
+    const int step = 1<<l;
+    const int st = step/2;
+    const float4 c = coeff[l];
+    if     (j%step == 0  && i%step == st) pixel.xyz *= c.xyz;
+    else if(j%step == st && i%step == 0)  pixel.xyz *= c.xyz;
+    else if(j%step == st && i%step == st) pixel.xyz *= c.xyz*c.xyz;
+  }
+  buf[j*width + i] = pixel;
+}
@@ -19,6 +19,7 @@
 #include "common.h"
 
 #include "colorspace.cl"
+#include "curve_lut.cl"
 
 kernel void
 whitebalance_1ui(read_only image2d_t in, write_only image2d_t out, const int width, const int height, global float *coeffs,
@@ -129,32 +130,6 @@ highlights_1f (read_only image2d_t in, write_only image2d_t out, const int width
   write_imagef (out, (int2)(x, y), pixel);
 }
 
-float
-lookup_unbounded(read_only image2d_t lut, const float x, global float *a)
-{
-  // in case the tone curve is marked as linear, return the fast
-  // path to linear unbounded (does not clip x at 1)
-  if(a[0] >= 0.0f)
-  {
-    if(x < 1.0f/a[0])
-    {
-      const int xi = clamp(x*65535.0f, 0.0f, 65535.0f);
-      const int2 p = (int2)((xi & 0xff), (xi >> 8));
-      return read_imagef(lut, sampleri, p).x;
-    }
-    else return a[1] * native_powr(x*a[0], a[2]);
-  }
-  else return x;
-}
-
-float
-lookup(read_only image2d_t lut, const float x)
-{
-  int xi = clamp(x*65535.0f, 0.0f, 65535.0f);
-  int2 p = (int2)((xi & 0xff), (xi >> 8));
-  return read_imagef(lut, sampleri, p).x;
-}
-
 /* kernel for the basecurve plugin. */
 kernel void
 basecurve (read_only image2d_t in, write_only image2d_t out, const int width, const int height,
@@ -222,6 +197,55 @@ colorin (read_only image2d_t in, write_only image2d_t out, const int width, cons
   write_imagef (out, (int2)(x, y), pixel);
 }
 
+/* trilinear lookup in a lcms2 transform baked by dt_colorspaces_create_clut() */
+float4
+clut_lookup(global const float4 *clut, const int size, const float4 pixel, const float4 cmin,
+            const float4 cscale, const int sqrt_in)
+{
+  const float4 v = sqrt_in ? sqrt(fmax(pixel, (float4)0.0f)) : pixel;
+  const float4 t = clamp((v - cmin) * cscale, 0.0f, (float)(size - 1));
+  const int r = min((int)t.x, size - 2);
+  const int g = min((int)t.y, size - 2);
+  const int b = min((int)t.z, size - 2);
+  const float fr = t.x - r, fg = t.y - g, fb = t.z - b;
+
+  global const float4 *n = clut + r + size*(g + size*b);
+  const int dy = size, dz = size*size;
+  const float4 c00 = mix(n[0],       n[1],          fr);
+  const float4 c10 = mix(n[dy],      n[dy + 1],     fr);
+  const float4 c01 = mix(n[dz],      n[dz + 1],     fr);
+  const float4 c11 = mix(n[dy + dz], n[dy + dz + 1], fr);
+  return mix(mix(c00, c10, fg), mix(c01, c11, fg), fb);
+}
+
+/* kernel for the plugin colorin, for icc profiles which need lcms2 */
+kernel void
+colorin_clut (read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+              global const float4 *clut, const int size, const float4 cmin, const float4 cscale,
+              const int sqrt_in)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+
+  // same gamut mapping as the cpu path does before the lcms2 transform
+  const float YY = pixel.x+pixel.y+pixel.z;
+  const float zz = pixel.z/YY;
+  const float bound_z = 0.5f, bound_Y = 0.5f;
+  const float amount = 0.11f;
+  if (zz > bound_z)
+  {
+    const float t = (zz - bound_z)/(1.0f-bound_z) * fmin(1.0f, YY/bound_Y);
+    pixel.y += t*amount;
+    pixel.z -= t*amount;
+  }
+  pixel.xyz = clut_lookup(clut, size, pixel, cmin, cscale, sqrt_in).xyz;
+  write_imagef (out, (int2)(x, y), pixel);
+}
+
 /* kernel for the tonecurve plugin version 2 */
 kernel void
 tonecurve (read_only image2d_t in, write_only image2d_t out, const int width, const int height,
@@ -927,6 +951,91 @@ flip(read_only image2d_t in, write_only image2d_t out, const int width, const in
 }
 
 
+/* kernels for the pixelpipe resampling runs of distorting modules in one go: every output pixel is taken
+   from the position in map. pixels outside of the input come out black, like on the cpu. */
+__kernel void
+warp_bilinear(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+              const int in_width, const int in_height, global const float2 *map)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float2 po = map[mad24(y, width, x)];
+  const int ii = (int)po.x;
+  const int jj = (int)po.y;
+
+  float4 o = (po.x > -1.0f && po.y > -1.0f && ii < in_width && jj < in_height) ?
+             read_imagef(in, samplerf, po + 0.5f) : (float4)0.0f;
+
+  write_imagef (out, (int2)(x, y), o);
+}
+
+float4
+warp_sample(read_only image2d_t in, const float2 po, const int kwidth, const int bicubic,
+            const int in_width, const int in_height)
+{
+  const int tx = (int)po.x;
+  const int ty = (int)po.y;
+  if(po.x <= -1.0f || po.y <= -1.0f || tx >= in_width || ty >= in_height) return (float4)0.0f;
+
+  float4 pixel = (float4)0.0f;
+  float weight = 0.0f;
+
+  for(int jj = 1 - kwidth; jj <= kwidth; jj++)
+    for(int ii= 1 - kwidth; ii <= kwidth; ii++)
+  {
+    const float dx = (float)(tx + ii) - po.x;
+    const float dy = (float)(ty + jj) - po.y;
+    float wx = bicubic ? interpolation_func_bicubic(dx) : interpolation_func_lanczos(kwidth, dx);
+    float wy = bicubic ? interpolation_func_bicubic(dy) : interpolation_func_lanczos(kwidth, dy);
+    float w = wx * wy;
+
+    pixel += read_imagef(in, sampleri, (int2)(tx + ii, ty + jj)) * w;
+    weight += w;
+  }
+
+  return pixel / weight;
+}
+
+__kernel void
+warp_bicubic(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+             const int in_width, const int in_height, global const float2 *map)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  write_imagef (out, (int2)(x, y), warp_sample(in, map[mad24(y, width, x)], 2, 1, in_width, in_height));
+}
+
+__kernel void
+warp_lanczos2(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+              const int in_width, const int in_height, global const float2 *map)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  write_imagef (out, (int2)(x, y), warp_sample(in, map[mad24(y, width, x)], 2, 0, in_width, in_height));
+}
+
+__kernel void
+warp_lanczos3(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+              const int in_width, const int in_height, global const float2 *map)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  write_imagef (out, (int2)(x, y), warp_sample(in, map[mad24(y, width, x)], 3, 0, in_width, in_height));
+}
+
+
 /* we use this exp approximation to maintain full identity with cpu path */
 float 
 fast_expf(const float x)
@@ -1045,6 +1154,22 @@ colorout (read_only image2d_t in, write_only image2d_t out, const int width, con
   write_imagef (out, (int2)(x, y), pixel);
 }
 
+/* kernel for the plugin colorout, for icc profiles which need lcms2 */
+kernel void
+colorout_clut (read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+               global const float4 *clut, const int size, const float4 cmin, const float4 cscale,
+               const int sqrt_in)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  pixel.xyz = clut_lookup(clut, size, pixel, cmin, cscale, sqrt_in).xyz;
+  write_imagef (out, (int2)(x, y), pixel);
+}
+
 
 /* kernel for the levels plugin */
 kernel void
@@ -1186,31 +1311,6 @@ borders_fill (write_only image2d_t out, const int left, const int top, const int
 }
 
 
-/* kernel for the overexposed plugin. */
-kernel void
-overexposed (read_only image2d_t in, write_only image2d_t out, const int width, const int height,
-             const float lower, const float upper, const float4 lower_color, const float4 upper_color)
-{
-  const int x = get_global_id(0);
-  const int y = get_global_id(1);
-
-  if(x >= width || y >= height) return;
-
-  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
-
-  if(pixel.x >= upper || pixel.y >= upper || pixel.z >= upper)
-  {
-    pixel.xyz = upper_color.xyz;
-  }
-  else if(pixel.x <= lower && pixel.y <= lower && pixel.z <= lower)
-  {
-    pixel.xyz = lower_color.xyz;
-  }
-
-  write_imagef (out, (int2)(x, y), pixel);
-}
-
-
 /* kernel for the lowlight plugin. */
 kernel void
 lowlight (read_only image2d_t in, write_only image2d_t out, const int width, const int height,
@@ -1257,3 +1357,89 @@ lowlight (read_only image2d_t in, write_only image2d_t out, const int width, con
 }
 
 
+/* kernel for the watermark plugin: composite the rendered svg, a rectangle of cairo ARGB32 pixels
+   (premultiplied b, g, r, a) at (mx, my). */
+kernel void
+watermark (read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+           global const uchar4 *mark, const int mx, const int my, const int mwidth, const int mheight,
+           const float opacity)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+
+  if(x >= mx && x < mx + mwidth && y >= my && y < my + mheight)
+  {
+    const float4 m = convert_float4(mark[mwidth*(y - my) + x - mx]) * (1.0f/255.0f);
+    const float alpha = m.w * opacity;
+    /* svg uses a premultiplied alpha, so only use opacity for the blending */
+    pixel.xyz = (1.0f - alpha) * pixel.xyz + opacity * m.zyx;
+  }
+
+  write_imagef (out, (int2)(x, y), pixel);
+}
+
+
+/* kernels for the invert plugin: raw 16 bit (film color already scaled to integers), raw float and rgb. */
+kernel void
+invert_1ui(read_only image2d_t in, write_only image2d_t out, const int width, const int height, const float4 color,
+           const unsigned int filters, const int rx, const int ry)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+  const float film[3] = { color.x, color.y, color.z };
+  const int pixel = read_imageui(in, sampleri, (int2)(x, y)).x;
+  const int inv = clamp((int)film[FC(rx+y, ry+x, filters)] - pixel, 0, 0xffff);
+  write_imageui(out, (int2)(x, y), (uint4)(inv, 0, 0, 0));
+}
+
+kernel void
+invert_1f(read_only image2d_t in, write_only image2d_t out, const int width, const int height, const float4 color,
+          const unsigned int filters, const int rx, const int ry)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+  const float film[3] = { color.x, color.y, color.z };
+  const float pixel = read_imagef(in, sampleri, (int2)(x, y)).x;
+  write_imagef(out, (int2)(x, y), (float4)(clamp(film[FC(rx+y, ry+x, filters)] - pixel/65535.0f, 0.0f, 1.0f), 0.0f, 0.0f, 0.0f));
+}
+
+kernel void
+invert_4f(read_only image2d_t in, write_only image2d_t out, const int width, const int height, const float4 color,
+          const unsigned int filters, const int rx, const int ry)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  pixel.xyz = color.xyz - pixel.xyz;
+  write_imagef(out, (int2)(x, y), pixel);
+}
+
+
+/* kernel for the unbreak input profile plugin: the table has the index in*0x10000, truncated. */
+float
+profile_gamma_lookup(read_only image2d_t lut, const float v)
+{
+  const int xi = clamp(convert_int_sat_rtz(v * 65536.0f), 0, 0xffff);
+  return read_imagef(lut, sampleri, (int2)((xi & 0xff), (xi >> 8))).x;
+}
+
+kernel void
+profile_gamma(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+              read_only image2d_t lut)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  if(x >= width || y >= height) return;
+  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  pixel.x = profile_gamma_lookup(lut, pixel.x);
+  pixel.y = profile_gamma_lookup(lut, pixel.y);
+  pixel.z = profile_gamma_lookup(lut, pixel.z);
+  write_imagef(out, (int2)(x, y), pixel);
+}
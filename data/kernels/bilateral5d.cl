@@ -0,0 +1,94 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+/* color distance weight of the 5d bilateral filter, isig2col = 1/(2 sigma^2) per channel */
+float
+bilateral5d_range(const float4 a, const float4 b, const float4 isig2col)
+{
+  const float4 d = a - b;
+  return exp(-(d.x*d.x*isig2col.x + d.y*d.y*isig2col.y + d.z*d.z*isig2col.z));
+}
+
+/* brute force version for small radii, the same as the cpu code: m holds the normalized
+   (2 rad + 1)^2 spatial gaussian, pixels closer than rad to the border are passed through. */
+kernel void
+bilateral5d_full(read_only image2d_t in, write_only image2d_t out, global const float *m, const int rad,
+                 const int width, const int height, const float4 isig2col)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+
+  if(x < rad || y < rad || x >= width - rad || y >= height - rad)
+  {
+    write_imagef (out, (int2)(x, y), pixel);
+    return;
+  }
+
+  const int wd = 2*rad + 1;
+  float4 sum = (float4)0.0f;
+  float sumw = 0.0f;
+  for(int l=-rad; l<=rad; l++) for(int k=-rad; k<=rad; k++)
+  {
+    const float4 p = read_imagef(in, sampleri, (int2)(x + k, y + l));
+    const float w = m[mad24(l + rad, wd, k + rad)] * bilateral5d_range(pixel, p, isig2col);
+    sum += w * p;
+    sumw += w;
+  }
+  sum /= sumw;
+  sum.w = pixel.w;
+
+  write_imagef (out, (int2)(x, y), sum);
+}
+
+/* one direction (dx, dy) of the separable approximation for large radii: a 1d bilateral filter
+   with the spatial gaussian in m (2 rad + 1 taps). a horizontal and a vertical pass together
+   come close to the lattice on the cpu, at a cost linear in the radius. */
+kernel void
+bilateral5d_pass(read_only image2d_t in, write_only image2d_t out, global const float *m, const int rad,
+                 const int width, const int height, const float4 isig2col, const int dx, const int dy)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+
+  float4 sum = (float4)0.0f;
+  float sumw = 0.0f;
+  for(int k=-rad; k<=rad; k++)
+  {
+    const int xx = x + k*dx;
+    const int yy = y + k*dy;
+    if(xx < 0 || yy < 0 || xx >= width || yy >= height) continue;
+    const float4 p = read_imagef(in, sampleri, (int2)(xx, yy));
+    const float w = m[k + rad] * bilateral5d_range(pixel, p, isig2col);
+    sum += w * p;
+    sumw += w;
+  }
+  sum /= sumw;
+  sum.w = pixel.w;
+
+  write_imagef (out, (int2)(x, y), sum);
+}
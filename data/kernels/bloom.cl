@@ -0,0 +1,52 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+/* first step for bloom module: get the thresholded lights into a single channel image */
+kernel void
+bloom_threshold(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                const float scale, const float threshold)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float L = read_imagef(in, sampleri, (int2)(x, y)).x * scale;
+
+  write_imagef(out, (int2)(x, y), (float4)(L > threshold ? L : 0.0f, 0.0f, 0.0f, 0.0f));
+}
+
+/* last step for bloom module: screen blend the blurred lights with the lightness of the input */
+kernel void
+bloom_mix(read_only image2d_t in, read_only image2d_t blur, write_only image2d_t out, const int width,
+          const int height)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  const float L = read_imagef(blur, sampleri, (int2)(x, y)).x;
+
+  pixel.x = 100.0f - (((100.0f - pixel.x) * (100.0f - L)) / 100.0f); // Screen blend
+
+  write_imagef(out, (int2)(x, y), pixel);
+}
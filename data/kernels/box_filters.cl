@@ -0,0 +1,78 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+/* box blur with a running sum along a row, one work item per row. the same as dt_box_mean() on
+   the cpu, the box shrinks at the borders. works on images with 1 or 4 channels. */
+kernel void
+box_mean_horizontal(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                    const int radius)
+{
+  const int y = get_global_id(0);
+
+  if(y >= height) return;
+
+  float4 L = (float4)0.0f;
+  int hits = 0;
+  for(int x=-radius; x<width; x++)
+  {
+    const int op = x - radius - 1;
+    const int np = x + radius;
+    if(op >= 0)
+    {
+      L -= read_imagef(in, sampleri, (int2)(op, y));
+      hits--;
+    }
+    if(np < width)
+    {
+      L += read_imagef(in, sampleri, (int2)(np, y));
+      hits++;
+    }
+    if(x >= 0) write_imagef(out, (int2)(x, y), L/(float)hits);
+  }
+}
+
+/* the same along a column, one work item per column */
+kernel void
+box_mean_vertical(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+                  const int radius)
+{
+  const int x = get_global_id(0);
+
+  if(x >= width) return;
+
+  float4 L = (float4)0.0f;
+  int hits = 0;
+  for(int y=-radius; y<height; y++)
+  {
+    const int op = y - radius - 1;
+    const int np = y + radius;
+    if(op >= 0)
+    {
+      L -= read_imagef(in, sampleri, (int2)(x, op));
+      hits--;
+    }
+    if(np < height)
+    {
+      L += read_imagef(in, sampleri, (int2)(x, np));
+      hits++;
+    }
+    if(y >= 0) write_imagef(out, (int2)(x, y), L/(float)hits);
+  }
+}
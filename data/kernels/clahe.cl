@@ -0,0 +1,147 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+#include "colorspace.cl"
+
+#define CLAHE_BINS 256
+
+/* bin the hsl lightness of each pixel */
+kernel void
+clahe_bins(read_only image2d_t in, global int *bins, const int width, const int height)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  const float pmax = clamp(fmax(pixel.x, fmax(pixel.y, pixel.z)), 0.0f, 1.0f);
+  const float pmin = clamp(fmin(pixel.x, fmin(pixel.y, pixel.z)), 0.0f, 1.0f);
+
+  bins[y*width + x] = (int)((pmax + pmin)/2.0f * (float)CLAHE_BINS + 0.5f);
+}
+
+/* clipped and normalized cdf of the window around each grid point of a band of grid rows */
+kernel void
+clahe_tables(global const int *bins, global float *tables, const int width, const int height, const int rad,
+             const int step, const int gy0, const int ngx, const int rows, const float slope)
+{
+  const int gx = get_global_id(0);
+  const int gy = get_global_id(1);
+
+  if(gx >= ngx || gy >= rows) return;
+
+  const int x = min(gx*step, width-1);
+  const int y = min((gy0 + gy)*step, height-1);
+  const int xMin = max(0, x - rad);
+  const int xMax = min(width, x + rad + 1);
+  const int yMin = max(0, y - rad);
+  const int yMax = min(height, y + rad + 1);
+
+  int hist[CLAHE_BINS+1];
+  for(int h = 0; h <= CLAHE_BINS; h++) hist[h] = 0;
+  for(int yi = yMin; yi < yMax; yi++)
+    for(int xi = xMin; xi < xMax; xi++)
+      hist[bins[yi*width + xi]]++;
+
+  const int limit = (int)(slope * (yMax - yMin)*(xMax - xMin) / CLAHE_BINS + 0.5f);
+
+  /* clip histogram and redistribute clipped entries */
+  int ce = 0, ceb = 0;
+  do
+  {
+    ceb = ce;
+    ce = 0;
+    for(int b = 0; b <= CLAHE_BINS; b++)
+    {
+      const int d = hist[b] - limit;
+      if(d > 0)
+      {
+        ce += d;
+        hist[b] = limit;
+      }
+    }
+
+    const int d = (ce / (float)(CLAHE_BINS + 1));
+    const int m = ce % (CLAHE_BINS + 1);
+    for(int h = 0; h <= CLAHE_BINS; h++)
+      hist[h] += d;
+
+    if(m != 0)
+    {
+      const int s = CLAHE_BINS / (float)m;
+      for(int h = 0; h <= CLAHE_BINS; h += s)
+        hist[h]++;
+    }
+  }
+  while(ce != ceb);
+
+  /* cdf of the clipped histogram, for each bin */
+  int hMin = CLAHE_BINS;
+  for(int h = 0; h < hMin; h++)
+    if(hist[h] != 0) hMin = h;
+
+  int cdfMax = 0;
+  for(int h = hMin; h <= CLAHE_BINS; h++)
+    cdfMax += hist[h];
+  const int cdfMin = hist[hMin];
+
+  global float *table = tables + (gy*ngx + gx)*(CLAHE_BINS+1);
+  int cdf = 0;
+  for(int h = 0; h <= CLAHE_BINS; h++)
+  {
+    if(h >= hMin) cdf += hist[h];
+    table[h] = (cdf - cdfMin) / (float)(cdfMax - cdfMin);
+  }
+}
+
+/* interpolate the tables of the four surrounding grid points and replace the lightness */
+kernel void
+clahe_apply(read_only image2d_t in, write_only image2d_t out, global const int *bins, global const float *tables,
+            const int width, const int height, const int ystart, const int yend, const int step, const int gy0,
+            const int ngx, const int rows)
+{
+  const int x = get_global_id(0);
+  const int y = ystart + get_global_id(1);
+
+  if(x >= width || y >= yend) return;
+
+  const int gx0 = x/step;
+  const int gx1 = min(gx0 + 1, ngx - 1);
+  const int x0 = gx0*step;
+  const int x1 = min(gx1*step, width-1);
+  const float fx = x1 > x0 ? (x - x0)/(float)(x1 - x0) : 0.0f;
+
+  const int gy = y/step - gy0;
+  const int gy1 = min(gy + 1, rows - 1);
+  const int y0 = (gy0 + gy)*step;
+  const int y1 = min((gy0 + gy1)*step, height-1);
+  const float fy = y1 > y0 ? (y - y0)/(float)(y1 - y0) : 0.0f;
+
+  const int v = bins[y*width + x];
+  const float L =
+    (1.0f - fy) * ((1.0f - fx) * tables[(gy *ngx + gx0)*(CLAHE_BINS+1) + v] + fx * tables[(gy *ngx + gx1)*(CLAHE_BINS+1) + v]) +
+    (       fy) * ((1.0f - fx) * tables[(gy1*ngx + gx0)*(CLAHE_BINS+1) + v] + fx * tables[(gy1*ngx + gx1)*(CLAHE_BINS+1) + v]);
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  float4 hsl = RGB_2_HSL(pixel);
+  hsl.z = L;
+
+  write_imagef (out, (int2)(x, y), HSL_2_RGB(hsl));
+}
@@ -24,16 +24,25 @@ float4 LCH_2_Lab(float4 LCH)
 }
 
 
+// same constants as dt_lab_f() and dt_XYZ_to_Lab_sse2() in common/colorspaces_inline_conversions.h
+float4 lab_f(float4 x)
+{
+  const float4 epsilon = (float4)(216.0f/24389.0f);
+  const float4 kappa   = (float4)(24389.0f/27.0f);
+  return (x > epsilon) ? cbrt(x) : (kappa*x + (float4)16.0f)/116.0f;
+}
+
+
 float4 XYZ_to_Lab(float4 xyz)
 {
+  const float4 d50_inv = (float4)(1.0f/0.9642f, 1.0f, 1.0f/0.8249f, 0.0f);
   float4 lab;
 
-  xyz.x *= (1.0f/0.9642f);
-  xyz.z *= (1.0f/0.8242f);
-  xyz = (xyz > (float4)0.008856f) ? native_powr(xyz, (float4)1.0f/3.0f) : 7.787f*xyz + (float4)(16.0f/116.0f);
-  lab.x = 116.0f * xyz.y - 16.0f;
-  lab.y = 500.0f * (xyz.x - xyz.y);
-  lab.z = 200.0f * (xyz.y - xyz.z);
+  const float4 f = lab_f(xyz * d50_inv);
+  lab.x = 116.0f * f.y - 16.0f;
+  lab.y = 500.0f * (f.x - f.y);
+  lab.z = 200.0f * (f.y - f.z);
+  lab.w = xyz.w;
 
   return lab;
 }
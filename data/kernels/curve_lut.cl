@@ -0,0 +1,41 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// sampling of the 0x10000 entries curve luts, uploaded as 256x256 images. same rounding as
+// dt_curve_lut_lookup() and friends in src/common/curve_lut.h.
+
+float
+lookup(read_only image2d_t lut, const float x)
+{
+  const int xi = clamp(x*65535.0f, 0.0f, 65535.0f);
+  const int2 p = (int2)((xi & 0xff), (xi >> 8));
+  return read_imagef(lut, sampleri, p).x;
+}
+
+float
+lookup_unbounded(read_only image2d_t lut, const float x, global float *a)
+{
+  // in case the curve is marked as linear, return the fast
+  // path to linear unbounded (does not clip x at 1)
+  if(a[0] >= 0.0f)
+  {
+    if(x < 1.0f/a[0]) return lookup(lut, x);
+    else return a[1] * native_powr(x*a[0], a[2]);
+  }
+  else return x;
+}
@@ -0,0 +1,680 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// AMaZE demosaic (aliasing minimization and zipper elimination), by Emil Martinec,
+// following amaze_demosaic_RT.cc. every pass of the cpu tile loop is a kernel which
+// evaluates one pixel, the intermediate results are full size buffers. instead of the
+// 16 pixel mirrored tile border all reads outside the image are mirrored.
+
+#define AMAZE_EPS     1e-5f
+#define AMAZE_EPSSQ   1e-10f
+// adaptive ratios threshold
+#define AMAZE_ARTHRESH 0.75f
+// nyquist texture test threshold
+#define AMAZE_NYQTHRESH 0.5f
+
+// gaussian on 5x5 quincunx, sigma=1.2
+constant float gaussodd[4] = { 0.14659727707323927f, 0.103592713382435f, 0.0732036125103057f, 0.0365543548389495f };
+// gaussian on 5x5, sigma=1.2
+constant float gaussgrad[6] = { 0.07384411893421103f, 0.06207511968171489f, 0.0521818194747806f,
+                                0.03687419286733595f, 0.03099732204057846f, 0.018413194161458882f };
+// gaussian on 5x5 alt quincunx, sigma=1.5
+constant float gausseven[2] = { 0.13719494435797422f, 0.05640252782101291f };
+// gaussian on quincunx grid
+constant float gquinc[4] = { 0.169917f, 0.108947f, 0.069855f, 0.0287182f };
+
+int
+amaze_mirror(const int i, const int size)
+{
+  const int m = i < 0 ? -i : (i >= size ? 2*size - 2 - i : i);
+  return clamp(m, 0, size - 1);
+}
+
+// raw value and buffer index at offset (dx, dy) of the current pixel, mirrored at the borders
+#define CFA(dx, dy) read_imagef(in, sampleri, (int2)(amaze_mirror(x+(dx), width), amaze_mirror(y+(dy), height))).x
+#define IDX(dx, dy) (amaze_mirror(y+(dy), height)*width + amaze_mirror(x+(dx), width))
+
+#define SQR(a) ((a)*(a))
+
+float
+amaze_ulim(const float v, const float a, const float b)
+{
+  return clamp(v, fmin(a, b), fmax(a, b));
+}
+
+float
+amaze_clampnan(const float v)
+{
+  return isnan(v) ? 0.5f : clamp(v, 0.0f, 1.0f);
+}
+
+float
+amaze_delsq(read_only image2d_t in, const int x, const int y, const int width, const int height)
+{
+  return SQR(CFA(1, 0) - CFA(-1, 0)) + SQR(CFA(0, 1) - CFA(0, -1));
+}
+
+float
+amaze_delp(read_only image2d_t in, const int x, const int y, const int width, const int height)
+{
+  return fabs(CFA(1, -1) - CFA(-1, 1));
+}
+
+float
+amaze_delm(read_only image2d_t in, const int x, const int y, const int width, const int height)
+{
+  return fabs(CFA(1, 1) - CFA(-1, -1));
+}
+
+// squared diagonal color differences of a green pixel, plus (.x) and minus (.y) direction
+float2
+amaze_dgrbsq1(read_only image2d_t in, const int x, const int y, const int width, const int height)
+{
+  const float c = CFA(0, 0);
+  return (float2)(SQR(c - CFA(1, -1)) + SQR(c - CFA(-1, 1)), SQR(c - CFA(-1, -1)) + SQR(c - CFA(1, 1)));
+}
+
+// green site: hamilton-adams interpolation of red/blue along one direction from the
+// neighbours n1 (distance 1) and n2 (distance 2) of the center value c.
+float
+amaze_ratio(const float c, const float n1, const float n2, const float w, const float w2, float *ha)
+{
+  const float cr = n1*(w2 + w)/(w2*(AMAZE_EPS + c) + w*(AMAZE_EPS + n2));
+  *ha = n1 + 0.5f*(c - n2);
+  return fabs(1.0f - cr) < AMAZE_ARTHRESH ? c*cr : *ha;
+}
+
+/* gradient based directional weights, vertical in .x and horizontal in .y. at red and blue
+   sites also the diagonal interpolations of blue/red (.x minus, .y plus) and their weight. */
+kernel void
+amaze_init(read_only image2d_t in, global float2 *dirwts, global float2 *rb, global float *pmwt,
+           const int width, const int height, const unsigned int filters, const float clip_pt)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const int i = y*width + x;
+  const float c = CFA(0, 0);
+
+  dirwts[i] = (float2)(AMAZE_EPS + fabs(CFA(0, 2) - c) + fabs(CFA(0, 1) - CFA(0, -1)) + fabs(c - CFA(0, -2)),
+                       AMAZE_EPS + fabs(CFA(2, 0) - c) + fabs(CFA(1, 0) - CFA(-1, 0)) + fabs(c - CFA(-2, 0)));
+
+  if(FC(y, x, filters) & 1)
+  {
+    rb[i] = (float2)(0.0f, 0.0f);
+    pmwt[i] = 0.0f;
+    return;
+  }
+
+  // diagonal color ratios
+  const float crse = 2.0f*CFA( 1,  1)/(AMAZE_EPS + c + CFA( 2,  2));
+  const float crnw = 2.0f*CFA(-1, -1)/(AMAZE_EPS + c + CFA(-2, -2));
+  const float crne = 2.0f*CFA( 1, -1)/(AMAZE_EPS + c + CFA( 2, -2));
+  const float crsw = 2.0f*CFA(-1,  1)/(AMAZE_EPS + c + CFA(-2,  2));
+
+  // assign B/R at R/B sites
+  const float rbse = fabs(1.0f - crse) < AMAZE_ARTHRESH ? c*crse : CFA( 1,  1) + 0.5f*(c - CFA( 2,  2));
+  const float rbnw = fabs(1.0f - crnw) < AMAZE_ARTHRESH ? c*crnw : CFA(-1, -1) + 0.5f*(c - CFA(-2, -2));
+  const float rbne = fabs(1.0f - crne) < AMAZE_ARTHRESH ? c*crne : CFA( 1, -1) + 0.5f*(c - CFA( 2, -2));
+  const float rbsw = fabs(1.0f - crsw) < AMAZE_ARTHRESH ? c*crsw : CFA(-1,  1) + 0.5f*(c - CFA(-2,  2));
+
+  const float wtse = AMAZE_EPS + amaze_delm(in, x, y, width, height) + amaze_delm(in, x+1, y+1, width, height) + amaze_delm(in, x+2, y+2, width, height);
+  const float wtnw = AMAZE_EPS + amaze_delm(in, x, y, width, height) + amaze_delm(in, x-1, y-1, width, height) + amaze_delm(in, x-2, y-2, width, height);
+  const float wtne = AMAZE_EPS + amaze_delp(in, x, y, width, height) + amaze_delp(in, x+1, y-1, width, height) + amaze_delp(in, x+2, y-2, width, height);
+  const float wtsw = AMAZE_EPS + amaze_delp(in, x, y, width, height) + amaze_delp(in, x-1, y+1, width, height) + amaze_delp(in, x-2, y+2, width, height);
+
+  float rbm = (wtse*rbnw + wtnw*rbse)/(wtse + wtnw);
+  float rbp = (wtne*rbsw + wtsw*rbne)/(wtne + wtsw);
+
+  // variances of the diagonal color differences around the pixel
+  float2 var = gausseven[0]*(amaze_dgrbsq1(in, x, y-1, width, height) + amaze_dgrbsq1(in, x-1, y, width, height) +
+                             amaze_dgrbsq1(in, x+1, y, width, height) + amaze_dgrbsq1(in, x, y+1, width, height));
+  var += gausseven[1]*(amaze_dgrbsq1(in, x-1, y-2, width, height) + amaze_dgrbsq1(in, x+1, y-2, width, height) +
+                       amaze_dgrbsq1(in, x-2, y-1, width, height) + amaze_dgrbsq1(in, x+2, y-1, width, height) +
+                       amaze_dgrbsq1(in, x-2, y+1, width, height) + amaze_dgrbsq1(in, x+2, y+1, width, height) +
+                       amaze_dgrbsq1(in, x-1, y+2, width, height) + amaze_dgrbsq1(in, x+1, y+2, width, height));
+  const float rbvarm = AMAZE_EPSSQ + var.y;
+  pmwt[i] = rbvarm/(AMAZE_EPSSQ + var.x + rbvarm);
+
+  // bound the interpolation in regions of high saturation
+  if(rbp < c)
+  {
+    if(2.0f*rbp < c)
+      rbp = amaze_ulim(rbp, CFA(-1, 1), CFA(1, -1));
+    else
+    {
+      const float pwt = 2.0f*(c - rbp)/(AMAZE_EPS + rbp + c);
+      rbp = pwt*rbp + (1.0f - pwt)*amaze_ulim(rbp, CFA(-1, 1), CFA(1, -1));
+    }
+  }
+  if(rbm < c)
+  {
+    if(2.0f*rbm < c)
+      rbm = amaze_ulim(rbm, CFA(-1, -1), CFA(1, 1));
+    else
+    {
+      const float mwt = 2.0f*(c - rbm)/(AMAZE_EPS + rbm + c);
+      rbm = mwt*rbm + (1.0f - mwt)*amaze_ulim(rbm, CFA(-1, -1), CFA(1, 1));
+    }
+  }
+
+  if(rbp > clip_pt) rbp = amaze_ulim(rbp, CFA(-1, 1), CFA(1, -1));
+  if(rbm > clip_pt) rbm = amaze_ulim(rbm, CFA(-1, -1), CFA(1, 1));
+
+  rb[i] = (float2)(rbm, rbp);
+}
+
+/* R+B interpolated at red and blue sites (.x) and the refined plus/minus weight (.y) */
+kernel void
+amaze_rbint(read_only image2d_t in, global const float2 *rb, global const float *pmwt, global float2 *rbint,
+            const int width, const int height, const unsigned int filters)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const int i = y*width + x;
+
+  if(FC(y, x, filters) & 1)
+  {
+    rbint[i] = (float2)(0.0f, 0.0f);
+    return;
+  }
+
+  // first ask if one gets more directional discrimination from nearby B/R sites
+  const float pmwtalt = 0.25f*(pmwt[IDX(-1, -1)] + pmwt[IDX(1, -1)] + pmwt[IDX(-1, 1)] + pmwt[IDX(1, 1)]);
+  const float wt = fabs(0.5f - pmwt[i]) < fabs(0.5f - pmwtalt) ? pmwtalt : pmwt[i];
+
+  rbint[i] = (float2)(0.5f*(CFA(0, 0) + rb[i].x*(1.0f - wt) + rb[i].y*wt), wt);
+}
+
+/* vertically and horizontally interpolated color differences, adaptive ratios in .xy and
+   hamilton-adams in .zw, and the differences of interpolations from opposite directions */
+kernel void
+amaze_cd(read_only image2d_t in, global const float2 *dirwts, global float4 *cd, global float2 *dgint,
+         const int width, const int height, const unsigned int filters, const float clip_pt)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const int i = y*width + x;
+  const float c = CFA(0, 0);
+  const float2 w = dirwts[i];
+
+  float guha, gdha, glha, grha;
+  float guar = amaze_ratio(c, CFA(0, -1), CFA(0, -2), w.x, dirwts[IDX(0, -2)].x, &guha);
+  float gdar = amaze_ratio(c, CFA(0,  1), CFA(0,  2), w.x, dirwts[IDX(0,  2)].x, &gdha);
+  float glar = amaze_ratio(c, CFA(-1, 0), CFA(-2, 0), w.y, dirwts[IDX(-2, 0)].y, &glha);
+  float grar = amaze_ratio(c, CFA( 1, 0), CFA( 2, 0), w.y, dirwts[IDX( 2, 0)].y, &grha);
+
+  const float hwt = dirwts[IDX(-1, 0)].y/(dirwts[IDX(-1, 0)].y + dirwts[IDX(1, 0)].y);
+  const float vwt = dirwts[IDX(0, -1)].x/(dirwts[IDX(0, 1)].x + dirwts[IDX(0, -1)].x);
+
+  // interpolated G via adaptive weights of cardinal evaluations
+  const float Gintvar = vwt*gdar + (1.0f - vwt)*guar;
+  const float Ginthar = hwt*grar + (1.0f - hwt)*glar;
+  const float Gintvha = vwt*gdha + (1.0f - vwt)*guha;
+  const float Ginthha = hwt*grha + (1.0f - hwt)*glha;
+
+  // interpolated color differences
+  const float sgn = (FC(y, x, filters) & 1) ? -1.0f : 1.0f;
+  float4 d = sgn*((float4)(Gintvar, Ginthar, Gintvha, Ginthha) - c);
+
+  if(c > 0.8f*clip_pt || Gintvha > 0.8f*clip_pt || Ginthha > 0.8f*clip_pt)
+  {
+    // use HA if highlights are (nearly) clipped
+    guar = guha;
+    gdar = gdha;
+    glar = glha;
+    grar = grha;
+    d.xy = d.zw;
+  }
+
+  cd[i] = d;
+  dgint[i] = (float2)(fmin(SQR(guha - gdha), SQR(guar - gdar)), fmin(SQR(glha - grha), SQR(glar - grar)));
+}
+
+/* choose the smoother of both interpolations and bound it in regions of high saturation.
+   final vertical and horizontal color differences in .xy, squared difference of both in .z */
+kernel void
+amaze_cdvar(read_only image2d_t in, global const float4 *cd, global float4 *cdf,
+            const int width, const int height, const unsigned int filters, const float clip_pt)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const int i = y*width + x;
+  const float c = CFA(0, 0);
+  const float4 d = cd[i];
+  const float4 dl = cd[IDX(-2, 0)], dr = cd[IDX(2, 0)];
+  const float4 du = cd[IDX(0, -2)], dd = cd[IDX(0, 2)];
+
+  const float hcdvar    = 3.0f*(SQR(dl.y) + SQR(d.y) + SQR(dr.y)) - SQR(dl.y + d.y + dr.y);
+  const float hcdaltvar = 3.0f*(SQR(dl.w) + SQR(d.w) + SQR(dr.w)) - SQR(dl.w + d.w + dr.w);
+  const float vcdvar    = 3.0f*(SQR(du.x) + SQR(d.x) + SQR(dd.x)) - SQR(du.x + d.x + dd.x);
+  const float vcdaltvar = 3.0f*(SQR(du.z) + SQR(d.z) + SQR(dd.z)) - SQR(du.z + d.z + dd.z);
+
+  // choose the smallest variance; this yields a smoother interpolation
+  float hcd = hcdaltvar < hcdvar ? d.w : d.y;
+  float vcd = vcdaltvar < vcdvar ? d.z : d.x;
+
+  const float cl = CFA(-1, 0), cr = CFA(1, 0), cu = CFA(0, -1), cdn = CFA(0, 1);
+
+  // bound the interpolation in regions of high saturation
+  if(FC(y, x, filters) & 1)
+  {
+    const float Ginth = c - hcd; // R or B
+    const float Gintv = c - vcd; // B or R
+
+    if(hcd > 0.0f)
+    {
+      if(3.0f*hcd > Ginth + c)
+        hcd = c - amaze_ulim(Ginth, cl, cr);
+      else
+      {
+        const float hwt = 1.0f - 3.0f*hcd/(AMAZE_EPS + Ginth + c);
+        hcd = hwt*hcd + (1.0f - hwt)*(c - amaze_ulim(Ginth, cl, cr));
+      }
+    }
+    if(vcd > 0.0f)
+    {
+      if(3.0f*vcd > Gintv + c)
+        vcd = c - amaze_ulim(Gintv, cu, cdn);
+      else
+      {
+        const float vwt = 1.0f - 3.0f*vcd/(AMAZE_EPS + Gintv + c);
+        vcd = vwt*vcd + (1.0f - vwt)*(c - amaze_ulim(Gintv, cu, cdn));
+      }
+    }
+
+    if(Ginth > clip_pt) hcd = c - amaze_ulim(Ginth, cl, cr);
+    if(Gintv > clip_pt) vcd = c - amaze_ulim(Gintv, cu, cdn);
+
+    cdf[i] = (float4)(vcd, hcd, 0.0f, 0.0f);
+  }
+  else
+  {
+    const float Ginth = hcd + c; // interpolated G
+    const float Gintv = vcd + c;
+
+    if(hcd < 0.0f)
+    {
+      if(3.0f*hcd < -(Ginth + c))
+        hcd = amaze_ulim(Ginth, cl, cr) - c;
+      else
+      {
+        const float hwt = 1.0f + 3.0f*hcd/(AMAZE_EPS + Ginth + c);
+        hcd = hwt*hcd + (1.0f - hwt)*(amaze_ulim(Ginth, cl, cr) - c);
+      }
+    }
+    if(vcd < 0.0f)
+    {
+      if(3.0f*vcd < -(Gintv + c))
+        vcd = amaze_ulim(Gintv, cu, cdn) - c;
+      else
+      {
+        const float vwt = 1.0f + 3.0f*vcd/(AMAZE_EPS + Gintv + c);
+        vcd = vwt*vcd + (1.0f - vwt)*(amaze_ulim(Gintv, cu, cdn) - c);
+      }
+    }
+
+    if(Ginth > clip_pt) hcd = amaze_ulim(Ginth, cl, cr) - c;
+    if(Gintv > clip_pt) vcd = amaze_ulim(Gintv, cu, cdn) - c;
+
+    cdf[i] = (float4)(vcd, hcd, SQR(vcd - hcd), 0.0f);
+  }
+}
+
+/* weight of vertical vs horizontal interpolation at red and blue sites, and the nyquist texture test */
+kernel void
+amaze_hvwt(read_only image2d_t in, global const float2 *dirwts, global const float4 *cdf, global const float2 *dgint,
+           global float *hvwt, global uchar *nyquist, const int width, const int height, const unsigned int filters)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const int i = y*width + x;
+
+  if(FC(y, x, filters) & 1)
+  {
+    hvwt[i] = 0.0f;
+    nyquist[i] = 0;
+    return;
+  }
+
+  // compute color difference variances in cardinal directions
+  const float v0 = cdf[i].x, vu1 = cdf[IDX(0, -1)].x, vu2 = cdf[IDX(0, -2)].x, vu3 = cdf[IDX(0, -3)].x;
+  const float vd1 = cdf[IDX(0, 1)].x, vd2 = cdf[IDX(0, 2)].x, vd3 = cdf[IDX(0, 3)].x;
+  const float h0 = cdf[i].y, hl1 = cdf[IDX(-1, 0)].y, hl2 = cdf[IDX(-2, 0)].y, hl3 = cdf[IDX(-3, 0)].y;
+  const float hr1 = cdf[IDX(1, 0)].y, hr2 = cdf[IDX(2, 0)].y, hr3 = cdf[IDX(3, 0)].y;
+
+  const float uave = v0 + vu1 + vu2 + vu3;
+  const float dave = v0 + vd1 + vd2 + vd3;
+  const float lave = h0 + hl1 + hl2 + hl3;
+  const float rave = h0 + hr1 + hr2 + hr3;
+
+  float Dgrbvvaru = SQR(v0 - uave) + SQR(vu1 - uave) + SQR(vu2 - uave) + SQR(vu3 - uave);
+  float Dgrbvvard = SQR(v0 - dave) + SQR(vd1 - dave) + SQR(vd2 - dave) + SQR(vd3 - dave);
+  float Dgrbhvarl = SQR(h0 - lave) + SQR(hl1 - lave) + SQR(hl2 - lave) + SQR(hl3 - lave);
+  float Dgrbhvarr = SQR(h0 - rave) + SQR(hr1 - rave) + SQR(hr2 - rave) + SQR(hr3 - rave);
+
+  const float hwt = dirwts[IDX(-1, 0)].y/(dirwts[IDX(-1, 0)].y + dirwts[IDX(1, 0)].y);
+  const float vwt = dirwts[IDX(0, -1)].x/(dirwts[IDX(0, 1)].x + dirwts[IDX(0, -1)].x);
+
+  const float vcdvar = AMAZE_EPSSQ + vwt*Dgrbvvard + (1.0f - vwt)*Dgrbvvaru;
+  const float hcdvar = AMAZE_EPSSQ + hwt*Dgrbhvarr + (1.0f - hwt)*Dgrbhvarl;
+
+  // compute fluctuations in up/down and left/right interpolations of colors
+  Dgrbvvaru = dgint[i].x + dgint[IDX(0, -1)].x + dgint[IDX(0, -2)].x;
+  Dgrbvvard = dgint[i].x + dgint[IDX(0,  1)].x + dgint[IDX(0,  2)].x;
+  Dgrbhvarl = dgint[i].y + dgint[IDX(-1, 0)].y + dgint[IDX(-2, 0)].y;
+  Dgrbhvarr = dgint[i].y + dgint[IDX( 1, 0)].y + dgint[IDX( 2, 0)].y;
+
+  const float vcdvar1 = AMAZE_EPSSQ + vwt*Dgrbvvard + (1.0f - vwt)*Dgrbvvaru;
+  const float hcdvar1 = AMAZE_EPSSQ + hwt*Dgrbhvarr + (1.0f - hwt)*Dgrbhvarl;
+
+  // determine adaptive weights for G interpolation
+  const float varwt = hcdvar/(vcdvar + hcdvar);
+  const float diffwt = hcdvar1/(vcdvar1 + hcdvar1);
+
+  // if both agree on interpolation direction, choose the one with strongest directional discrimination;
+  // otherwise, choose the u/d and l/r difference fluctuation weights
+  if((0.5f - varwt)*(0.5f - diffwt) > 0.0f && fabs(0.5f - diffwt) < fabs(0.5f - varwt))
+    hvwt[i] = varwt;
+  else
+    hvwt[i] = diffwt;
+
+  // nyquist texture test: ask if difference of vcd compared to hcd is larger or smaller than RGGB gradients
+  float nyqtest = gaussodd[0]*cdf[i].z +
+                  gaussodd[1]*(cdf[IDX(-1, -1)].z + cdf[IDX(1, -1)].z + cdf[IDX(-1, 1)].z + cdf[IDX(1, 1)].z) +
+                  gaussodd[2]*(cdf[IDX(0, -2)].z + cdf[IDX(-2, 0)].z + cdf[IDX(2, 0)].z + cdf[IDX(0, 2)].z) +
+                  gaussodd[3]*(cdf[IDX(-2, -2)].z + cdf[IDX(2, -2)].z + cdf[IDX(-2, 2)].z + cdf[IDX(2, 2)].z);
+
+  nyqtest -= AMAZE_NYQTHRESH*(
+    gaussgrad[0]*amaze_delsq(in, x, y, width, height) +
+    gaussgrad[1]*(amaze_delsq(in, x, y-1, width, height) + amaze_delsq(in, x+1, y, width, height) +
+                  amaze_delsq(in, x-1, y, width, height) + amaze_delsq(in, x, y+1, width, height)) +
+    gaussgrad[2]*(amaze_delsq(in, x-1, y-1, width, height) + amaze_delsq(in, x+1, y-1, width, height) +
+                  amaze_delsq(in, x-1, y+1, width, height) + amaze_delsq(in, x+1, y+1, width, height)) +
+    gaussgrad[3]*(amaze_delsq(in, x, y-2, width, height) + amaze_delsq(in, x-2, y, width, height) +
+                  amaze_delsq(in, x+2, y, width, height) + amaze_delsq(in, x, y+2, width, height)) +
+    gaussgrad[4]*(amaze_delsq(in, x-1, y-2, width, height) + amaze_delsq(in, x+1, y-2, width, height) +
+                  amaze_delsq(in, x-2, y-1, width, height) + amaze_delsq(in, x+2, y-1, width, height) +
+                  amaze_delsq(in, x-2, y+1, width, height) + amaze_delsq(in, x+2, y+1, width, height) +
+                  amaze_delsq(in, x-1, y+2, width, height) + amaze_delsq(in, x+1, y+2, width, height)) +
+    gaussgrad[5]*(amaze_delsq(in, x-2, y-2, width, height) + amaze_delsq(in, x+2, y-2, width, height) +
+                  amaze_delsq(in, x-2, y+2, width, height) + amaze_delsq(in, x+2, y+2, width, height)));
+
+  nyquist[i] = nyqtest > 0.0f ? 1 : 0;
+}
+
+/* if most of your neighbors are named nyquist, it's likely that you're one too */
+kernel void
+amaze_nyquist(global const uchar *nyquist, global uchar *nyquist2,
+              const int width, const int height, const unsigned int filters)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const int i = y*width + x;
+
+  if(FC(y, x, filters) & 1)
+  {
+    nyquist2[i] = 0;
+    return;
+  }
+
+  const int sum = nyquist[IDX(0, -2)] + nyquist[IDX(-1, -1)] + nyquist[IDX(1, -1)] +
+                  nyquist[IDX(-2, 0)] + nyquist[i] + nyquist[IDX(2, 0)] +
+                  nyquist[IDX(-1, 1)] + nyquist[IDX(1, 1)] + nyquist[IDX(0, 2)];
+
+  nyquist2[i] = sum > 4 ? 1 : (sum < 4 ? 0 : nyquist[i]);
+}
+
+/* in areas of nyquist texture, do area interpolation */
+kernel void
+amaze_area(read_only image2d_t in, global const uchar *nyquist, global float *hvwt,
+           const int width, const int height, const unsigned int filters)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const int i = y*width + x;
+
+  if((FC(y, x, filters) & 1) || !nyquist[i]) return;
+
+  float sumh = 0.0f, sumv = 0.0f, sumsqh = 0.0f, sumsqv = 0.0f, areawt = 0.0f;
+  for(int jj = -6; jj < 7; jj += 2)
+    for(int ii = -6; ii < 7; ii += 2)
+    {
+      if(!nyquist[IDX(ii, jj)]) continue;
+      const float c = CFA(ii, jj);
+      const float cl = CFA(ii-1, jj), cr = CFA(ii+1, jj), cu = CFA(ii, jj-1), cd = CFA(ii, jj+1);
+      sumh += c - 0.5f*(cl + cr);
+      sumv += c - 0.5f*(cu + cd);
+      sumsqh += 0.5f*(SQR(c - cl) + SQR(c - cr));
+      sumsqv += 0.5f*(SQR(c - cu) + SQR(c - cd));
+      areawt += 1.0f;
+    }
+
+  // horizontal and vertical color differences, and adaptive weight
+  const float hcdvar = AMAZE_EPSSQ + fabs(areawt*sumsqh - sumh*sumh);
+  const float vcdvar = AMAZE_EPSSQ + fabs(areawt*sumsqv - sumv*sumv);
+  hvwt[i] = hcdvar/(vcdvar + hcdvar);
+}
+
+/* populate G at R/B sites: the refined weight in hvwt2, G-R or G-B in dgrb0 and the local
+   curvatures of G in nyquist areas in dgrb2 */
+kernel void
+amaze_green(read_only image2d_t in, global const float4 *cdf, global const uchar *nyquist, global const float *hvwt,
+            global float *hvwt2, global float *dgrb0, global float2 *dgrb2,
+            const int width, const int height, const unsigned int filters)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const int i = y*width + x;
+
+  if(FC(y, x, filters) & 1)
+  {
+    hvwt2[i] = 0.0f;
+    dgrb0[i] = 0.0f;
+    dgrb2[i] = (float2)(0.0f, 0.0f);
+    return;
+  }
+
+  // first ask if one gets more directional discrimination from nearby B/R sites
+  const float hvwtalt = 0.25f*(hvwt[IDX(-1, -1)] + hvwt[IDX(1, -1)] + hvwt[IDX(-1, 1)] + hvwt[IDX(1, 1)]);
+  const float wt = fabs(0.5f - hvwt[i]) < fabs(0.5f - hvwtalt) ? hvwtalt : hvwt[i];
+  hvwt2[i] = wt;
+
+  const float dg = cdf[i].y*(1.0f - wt) + cdf[i].x*wt;
+  dgrb0[i] = dg;
+
+  if(nyquist[i])
+  {
+    const float g = CFA(0, 0) + dg;
+    dgrb2[i] = (float2)(SQR(g - 0.5f*(CFA(-1, 0) + CFA(1, 0))), SQR(g - 0.5f*(CFA(0, -1) + CFA(0, 1))));
+  }
+  else dgrb2[i] = (float2)(0.0f, 0.0f);
+}
+
+/* refine nyquist areas using G curvatures, then correct G along the diagonal interpolation
+   wherever that discriminates better than the vertical/horizontal one */
+kernel void
+amaze_refine(read_only image2d_t in, global const float2 *dirwts, global const float4 *cdf, global const uchar *nyquist,
+             global const float *hvwt2, global const float2 *rbint, global const float2 *dgrb2, global float *dgrb0,
+             const int width, const int height, const unsigned int filters, const float clip_pt)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const int i = y*width + x;
+
+  if(FC(y, x, filters) & 1) return;
+
+  const float wt = hvwt2[i];
+
+  if(fabs(0.5f - rbint[i].y) < fabs(0.5f - wt))
+  {
+    if(!nyquist[i]) return;
+
+    // local averages (over nyquist pixels only) of G curvature squared
+    const float2 gvar = AMAZE_EPSSQ + gquinc[0]*dgrb2[i] +
+                        gquinc[1]*(dgrb2[IDX(-1, -1)] + dgrb2[IDX(1, -1)] + dgrb2[IDX(-1, 1)] + dgrb2[IDX(1, 1)]) +
+                        gquinc[2]*(dgrb2[IDX(0, -2)] + dgrb2[IDX(-2, 0)] + dgrb2[IDX(2, 0)] + dgrb2[IDX(0, 2)]) +
+                        gquinc[3]*(dgrb2[IDX(-2, -2)] + dgrb2[IDX(2, -2)] + dgrb2[IDX(-2, 2)] + dgrb2[IDX(2, 2)]);
+    // use the results as weights for refined G interpolation
+    dgrb0[i] = (cdf[i].y*gvar.y + cdf[i].x*gvar.x)/(gvar.y + gvar.x);
+    return;
+  }
+
+  // now interpolate G vertically/horizontally using R+B values
+  // unfortunately, since G interpolation cannot be done diagonally this may lead to color shifts
+  const float rbc = rbint[i].x;
+  const float rbu = rbint[IDX(0, -2)].x, rbd = rbint[IDX(0, 2)].x, rbl = rbint[IDX(-2, 0)].x, rbr = rbint[IDX(2, 0)].x;
+  const float cu = CFA(0, -1), cd = CFA(0, 1), cl = CFA(-1, 0), cr = CFA(1, 0);
+
+  // color ratios for G interpolation
+  const float cru = cu*2.0f/(AMAZE_EPS + rbc + rbu);
+  const float crd = cd*2.0f/(AMAZE_EPS + rbc + rbd);
+  const float crl = cl*2.0f/(AMAZE_EPS + rbc + rbl);
+  const float crr = cr*2.0f/(AMAZE_EPS + rbc + rbr);
+
+  // interpolated G via adaptive ratios or hamilton-adams in each cardinal direction
+  const float gu = fabs(1.0f - cru) < AMAZE_ARTHRESH ? rbc*cru : cu + 0.5f*(rbc - rbu);
+  const float gd = fabs(1.0f - crd) < AMAZE_ARTHRESH ? rbc*crd : cd + 0.5f*(rbc - rbd);
+  const float gl = fabs(1.0f - crl) < AMAZE_ARTHRESH ? rbc*crl : cl + 0.5f*(rbc - rbl);
+  const float gr = fabs(1.0f - crr) < AMAZE_ARTHRESH ? rbc*crr : cr + 0.5f*(rbc - rbr);
+
+  // interpolated G via adaptive weights of cardinal evaluations
+  const float wu = dirwts[IDX(0, -1)].x, wd = dirwts[IDX(0, 1)].x, wl = dirwts[IDX(-1, 0)].y, wr = dirwts[IDX(1, 0)].y;
+  float Gintv = (wu*gd + wd*gu)/(wd + wu);
+  float Ginth = (wl*gr + wr*gl)/(wl + wr);
+
+  // bound the interpolation in regions of high saturation
+  if(Gintv < rbc)
+  {
+    if(2.0f*Gintv < rbc)
+      Gintv = amaze_ulim(Gintv, cu, cd);
+    else
+    {
+      const float vwt = 2.0f*(rbc - Gintv)/(AMAZE_EPS + Gintv + rbc);
+      Gintv = vwt*Gintv + (1.0f - vwt)*amaze_ulim(Gintv, cu, cd);
+    }
+  }
+  if(Ginth < rbc)
+  {
+    if(2.0f*Ginth < rbc)
+      Ginth = amaze_ulim(Ginth, cl, cr);
+    else
+    {
+      const float hwt = 2.0f*(rbc - Ginth)/(AMAZE_EPS + Ginth + rbc);
+      Ginth = hwt*Ginth + (1.0f - hwt)*amaze_ulim(Ginth, cl, cr);
+    }
+  }
+
+  if(Ginth > clip_pt) Ginth = amaze_ulim(Ginth, cl, cr);
+  if(Gintv > clip_pt) Gintv = amaze_ulim(Gintv, cu, cd);
+
+  dgrb0[i] = Ginth*(1.0f - wt) + Gintv*wt - CFA(0, 0);
+}
+
+/* fancy chrominance interpolation: G-R (.x) and G-B (.y) at red and blue sites, the missing
+   one from the diagonal neighbours */
+kernel void
+amaze_chroma(global const float *dgrb0, global float2 *dgrb, const int width, const int height, const unsigned int filters)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const int i = y*width + x;
+  const int f = FC(y, x, filters);
+
+  if(f & 1) return;
+
+#define D(dx, dy) dgrb0[IDX(dx, dy)]
+  const float wtnw = 1.0f/(AMAZE_EPS + fabs(D(-1, -1) - D( 1,  1)) + fabs(D(-1, -1) - D(-3, -3)) + fabs(D( 1,  1) - D(-3, -3)));
+  const float wtne = 1.0f/(AMAZE_EPS + fabs(D( 1, -1) - D(-1,  1)) + fabs(D( 1, -1) - D( 3, -3)) + fabs(D(-1,  1) - D( 3, -3)));
+  const float wtsw = 1.0f/(AMAZE_EPS + fabs(D(-1,  1) - D( 1, -1)) + fabs(D(-1,  1) - D( 3,  3)) + fabs(D( 1, -1) - D(-3,  3)));
+  const float wtse = 1.0f/(AMAZE_EPS + fabs(D( 1,  1) - D(-1, -1)) + fabs(D( 1,  1) - D(-3,  3)) + fabs(D(-1, -1) - D( 3,  3)));
+
+  const float other = (wtnw*(1.325f*D(-1, -1) - 0.175f*D(-3, -3) - 0.075f*D(-3, -1) - 0.075f*D(-1, -3)) +
+                       wtne*(1.325f*D( 1, -1) - 0.175f*D( 3, -3) - 0.075f*D( 3, -1) - 0.075f*D( 1,  1)) +
+                       wtsw*(1.325f*D(-1,  1) - 0.175f*D(-3,  3) - 0.075f*D(-3,  1) - 0.075f*D(-1, -1)) +
+                       wtse*(1.325f*D( 1,  1) - 0.175f*D( 3,  3) - 0.075f*D( 3,  1) - 0.075f*D( 1,  3)))/(wtnw + wtne + wtsw + wtse);
+#undef D
+
+  dgrb[i] = f == 0 ? (float2)(dgrb0[i], other) : (float2)(other, dgrb0[i]);
+}
+
+/* color differences at green sites from the cardinal neighbours, and the final rgb */
+kernel void
+amaze_output(read_only image2d_t in, write_only image2d_t out, global const float *hvwt2, global const float *dgrb0,
+             global const float2 *dgrb, const int width, const int height, const unsigned int filters)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const int i = y*width + x;
+  const float c = CFA(0, 0);
+  float g;
+  float2 d;
+
+  if(FC(y, x, filters) & 1)
+  {
+    const float wu = hvwt2[IDX(0, -1)], wd = hvwt2[IDX(0, 1)];
+    const float wl = 1.0f - hvwt2[IDX(-1, 0)], wr = 1.0f - hvwt2[IDX(1, 0)];
+    g = c;
+    d = (wu*dgrb[IDX(0, -1)] + wr*dgrb[IDX(1, 0)] + wl*dgrb[IDX(-1, 0)] + wd*dgrb[IDX(0, 1)])/(wu + wr + wl + wd);
+  }
+  else
+  {
+    g = c + dgrb0[i];
+    d = dgrb[i];
+  }
+
+  write_imagef (out, (int2)(x, y), (float4)(amaze_clampnan(g - d.x), amaze_clampnan(g), amaze_clampnan(g - d.y), 0.0f));
+}
+
+#undef SQR
+#undef IDX
+#undef CFA
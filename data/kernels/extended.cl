@@ -574,6 +574,86 @@ colormapping_mapping (read_only image2d_t in, read_only image2d_t tmp, write_onl
   write_imagef (out, (int2)(x, y), opixel);
 }
 
+/* kernel for the colortransfer module, the same as the cpu path */
+static void
+get_clusters_linear(const float4 col, const int n, global float2 *mean, float *weight)
+{
+  float Mdist = 0.0f, mdist = FLT_MAX;
+  for(int k=0; k<n; k++)
+  {
+    const float dist = (col.y-mean[k].x)*(col.y-mean[k].x) + (col.z-mean[k].y)*(col.z-mean[k].y);
+    weight[k] = dist;
+    if(dist < mdist) mdist = dist;
+    if(dist > Mdist) Mdist = dist;
+  }
+  if(Mdist-mdist > 0.0f) for(int k=0; k<n; k++) weight[k] = (weight[k] - mdist)/(Mdist-mdist);
+  float sum = 0.0f;
+  for(int k=0; k<n; k++) sum += weight[k];
+  if(sum > 0.0f) for(int k=0; k<n; k++) weight[k] /= sum;
+}
+
+kernel void
+colortransfer_mapping (read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+            const int clusters, global float *lut, global float2 *mean, global float2 *target_mean,
+            global float2 *var_ratio, global int *mapio)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float4 ipixel = read_imagef(in, sampleri, (int2)(x, y));
+  float weight[MAXN];
+  float4 opixel = (float4)0.0f;
+
+  opixel.x = lut[(int)clamp(HISTN*ipixel.x/100.0f, 0.0f, (float)HISTN-1.0f)];
+
+  get_clusters_linear(ipixel, clusters, mean, weight);
+
+  for(int c=0; c < clusters; c++)
+  {
+    opixel.y += weight[c] * ((ipixel.y - mean[c].x)*var_ratio[c].x + target_mean[mapio[c]].x);
+    opixel.z += weight[c] * ((ipixel.z - mean[c].y)*var_ratio[c].y + target_mean[mapio[c]].y);
+  }
+  opixel.w = ipixel.w;
+
+  write_imagef (out, (int2)(x, y), opixel);
+}
+
 #undef HISTN
 #undef MAXN
 
+
+/* kernels for the dither plugin, with the random numbers of vignette: seeded per pixel instead
+   of per row and thread as on the cpu. */
+kernel void
+dither_random(read_only image2d_t in, write_only image2d_t out, const int width, const int height, const float dither)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  unsigned int tea_state[2] = { mad24(y, width, x), 0 };
+  encrypt_tea(tea_state);
+
+  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  pixel.xyz = clamp(pixel.xyz + dither * tpdf(tea_state[0]), 0.0f, 1.0f);
+  write_imagef(out, (int2)(x, y), pixel);
+}
+
+/* floyd-steinberg where it doesn't dither: clip, and replace nans by 0.5 */
+kernel void
+dither_clip(read_only image2d_t in, write_only image2d_t out, const int width, const int height)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  pixel.x = isnan(pixel.x) ? 0.5f : clamp(pixel.x, 0.0f, 1.0f);
+  pixel.y = isnan(pixel.y) ? 0.5f : clamp(pixel.y, 0.0f, 1.0f);
+  pixel.z = isnan(pixel.z) ? 0.5f : clamp(pixel.z, 0.0f, 1.0f);
+  write_imagef(out, (int2)(x, y), pixel);
+}
@@ -17,6 +17,7 @@
 */
 
 #include "common.h"
+#include "curve_lut.cl"
 
 
 /* This is gaussian blur in Lab space. Please mind: in contrast to most of DT's other openCL kernels,
@@ -206,25 +207,6 @@ gaussian_column_1c(global float *in, global float *out, unsigned int width, unsi
 
 
 
-float
-lookup_unbounded(read_only image2d_t lut, const float x, global float *a)
-{
-  // in case the curve is marked as linear, return the fast
-  // path to linear unbounded (does not clip x at 1)
-  if(a[0] >= 0.0f)
-  {
-    if(x < 1.0f/a[0])
-    {
-      const int xi = clamp(x*65535.0f, 0.0f, 65535.0f);
-      const int2 p = (int2)((xi & 0xff), (xi >> 8));
-      return read_imagef(lut, sampleri, p).x;
-    }
-    else return a[1] * native_powr(x*a[0], a[2]);
-  }
-  else return x;
-}
-
-
 kernel void 
 lowpass_mix(read_only image2d_t in, write_only image2d_t out, unsigned int width, unsigned int height, const float saturation, 
             read_only image2d_t table, global float *a)
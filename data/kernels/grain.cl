@@ -0,0 +1,73 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// has to match src/iop/grain.c
+#define GRAIN_TEXTURE_SIZE 1024
+
+/* bilinear lookup in the tileable grain texture, wrapping around. same as _grain_sample() on the cpu. */
+float
+grain_sample(read_only image2d_t tex, const float tx, const float ty)
+{
+  const int x0 = tx, y0 = ty;
+  const float fx = tx - x0, fy = ty - y0;
+  const int xa = x0 & (GRAIN_TEXTURE_SIZE-1), xb = (x0+1) & (GRAIN_TEXTURE_SIZE-1);
+  const int ya = y0 & (GRAIN_TEXTURE_SIZE-1), yb = (y0+1) & (GRAIN_TEXTURE_SIZE-1);
+  const float v00 = read_imagef(tex, sampleri, (int2)(xa, ya)).x;
+  const float v10 = read_imagef(tex, sampleri, (int2)(xb, ya)).x;
+  const float v01 = read_imagef(tex, sampleri, (int2)(xa, yb)).x;
+  const float v11 = read_imagef(tex, sampleri, (int2)(xb, yb)).x;
+  const float top = v00 + fx*(v10 - v00);
+  const float bot = v01 + fx*(v11 - v01);
+  return top + fy*(bot - top);
+}
+
+/* adds the grain to the lightness. tx0, ty0 and step map pixels to texels, fm is the width of the
+   downsampling filter in texels. */
+kernel void
+grain (read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+       read_only image2d_t tex, const float tx0, const float ty0, const float step,
+       const int filter, const float fm, const float strength)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+
+  const float tx = x*step + tx0;
+  const float ty = ty0 + y*step;
+  float noise = 0.0f;
+  if(filter)
+  {
+    // rank-1 lattice downsampling
+    const float fib1 = 34.0f, fib2 = 21.0f;
+    for(int l=0; l<fib2; l++)
+    {
+      float px = l/fib2, py = l*(fib1/fib2);
+      py -= (int)py;
+      noise += (1.0f/fib2) * grain_sample(tex, tx + px*fm, ty + py*fm);
+    }
+  }
+  else noise = grain_sample(tex, tx, ty);
+
+  pixel.x += noise*strength;
+  write_imagef (out, (int2)(x, y), pixel);
+}
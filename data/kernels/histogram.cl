@@ -0,0 +1,148 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma OPENCL EXTENSION cl_khr_global_int32_base_atomics : enable
+
+#include "common.h"
+
+#define BINS 64
+
+int
+bin(const float v)
+{
+  // fmax first, so nan ends up in bin 0:
+  return (int)fmin(fmax(v, 0.0f), BINS-1.0f);
+}
+
+/* per module histogram, see common/histogram.c. one work item per sampled pixel,
+   mode 0: raw, 1: rgb plus max(r,g,b), 2: Lab */
+kernel void
+histogram_collect(read_only image2d_t in, global unsigned int *bins, const int width, const int height,
+                  const int stride, const int mode)
+{
+  const int x = get_global_id(0) * stride;
+  const int y = get_global_id(1) * stride;
+
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+
+  if(mode == 0)
+  {
+    atomic_inc(bins + 4*bin(BINS*pixel.x));
+  }
+  else if(mode == 1)
+  {
+    atomic_inc(bins + 4*bin(BINS*pixel.x));
+    atomic_inc(bins + 4*bin(BINS*pixel.y) + 1);
+    atomic_inc(bins + 4*bin(BINS*pixel.z) + 2);
+    atomic_inc(bins + 4*bin(BINS*fmax(pixel.x, fmax(pixel.y, pixel.z))) + 3);
+  }
+  else
+  {
+    atomic_inc(bins + 4*bin(BINS/100.0f*pixel.x));
+    atomic_inc(bins + 4*bin(BINS/256.0f*pixel.y + BINS/2.0f) + 1);
+    atomic_inc(bins + 4*bin(BINS/256.0f*pixel.z + BINS/2.0f) + 2);
+  }
+}
+
+/* gathers the sampled pixels into a dense buffer, for devices where atomics are slow */
+kernel void
+histogram_sample(read_only image2d_t in, global float4 *out, const int width, const int height,
+                 const int stride, const int swidth, const int sheight)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= swidth || y >= sheight) return;
+
+  out[y*swidth + x] = read_imagef(in, sampleri, (int2)(min(x*stride, width-1), min(y*stride, height-1)));
+}
+
+/* color picker, first pass: sum, min and max of each row of the box */
+kernel void
+picker_rows(read_only image2d_t in, global float4 *partial, const int x, const int y, const int width,
+            const int height)
+{
+  const int j = get_global_id(0);
+
+  if(j >= height) return;
+
+  float4 sum = (float4)0.0f;
+  float4 mn = (float4)MAXFLOAT;
+  float4 mx = (float4)-MAXFLOAT;
+  for(int i = 0; i < width; i++)
+  {
+    const float4 pixel = read_imagef(in, sampleri, (int2)(x + i, y + j));
+    sum += pixel;
+    mn = fmin(mn, pixel);
+    mx = fmax(mx, pixel);
+  }
+  partial[3*j]     = sum;
+  partial[3*j + 1] = mn;
+  partial[3*j + 2] = mx;
+}
+
+/* second pass, a single work item: mean, min and max of the box go to the start of the buffer */
+kernel void
+picker_reduce(global float4 *partial, const int height, const float weight)
+{
+  if(get_global_id(0) != 0 || get_global_id(1) != 0) return;
+
+  float4 sum = partial[0];
+  float4 mn = partial[1];
+  float4 mx = partial[2];
+  for(int j = 1; j < height; j++)
+  {
+    sum += partial[3*j];
+    mn = fmin(mn, partial[3*j + 1]);
+    mx = fmax(mx, partial[3*j + 2]);
+  }
+  partial[0] = weight * sum;
+  partial[1] = mn;
+  partial[2] = mx;
+}
+
+/* scopes of the histogram widget, see common/histogram.c. one work item per pixel, the waveform
+   has bwidth x bheight bins of b, g and r, the vectorscope follows with size x size bins of CbCr. */
+kernel void
+scopes_collect(read_only image2d_t in, global unsigned int *bins, const int width, const int height,
+               const int bwidth, const int bheight)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  // fmax first, so nan ends up as 0:
+  const float4 pixel = fmin(fmax(read_imagef(in, sampleri, (int2)(x, y)), (float4)0.0f), (float4)1.0f);
+
+  const int col = min((int)(((long)x * bwidth) / width), bwidth - 1);
+  const int4 row = convert_int4_rtz(((float4)1.0f - pixel) * (bheight - 1));
+  atomic_inc(bins + 3*(row.x*bwidth + col) + 2);
+  atomic_inc(bins + 3*(row.y*bwidth + col) + 1);
+  atomic_inc(bins + 3*(row.z*bwidth + col));
+
+  const int size = min(bwidth, bheight);
+  global unsigned int *vectorscope = bins + 3*bwidth*bheight;
+  const float Y = 0.2126f*pixel.x + 0.7152f*pixel.y + 0.0722f*pixel.z;
+  const float cb = (pixel.z - Y)/1.8556f, cr = (pixel.x - Y)/1.5748f;
+  const int vx = clamp((int)((cb + 0.5f)*(size-1)), 0, size-1);
+  const int vy = clamp((int)((0.5f - cr)*(size-1)), 0, size-1);
+  atomic_inc(vectorscope + vy*size + vx);
+}
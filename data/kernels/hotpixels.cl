@@ -0,0 +1,75 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+/* true if the pixel is brighter than enough of its neighbours of the same color, maxin is the brightest of those */
+int
+hotpixels_test(read_only image2d_t in, const int x, const int y, const int width, const int height,
+               const float threshold, const float multiplier, const int min_neighbours, float *maxin)
+{
+  if(x < 2 || x >= width-1 || y < 2 || y >= height-2) return 0;
+  const float pixel = read_imagef(in, sampleri, (int2)(x, y)).x;
+  if(pixel <= threshold) return 0;
+
+  const float mid = pixel * multiplier;
+  const float other[4] = { read_imagef(in, sampleri, (int2)(x-2, y)).x, read_imagef(in, sampleri, (int2)(x, y-2)).x,
+                           read_imagef(in, sampleri, (int2)(x+2, y)).x, read_imagef(in, sampleri, (int2)(x, y+2)).x };
+  int count = 0;
+  *maxin = 0.0f;
+  for(int k=0; k<4; k++)
+  {
+    if(mid > other[k])
+    {
+      count++;
+      *maxin = fmax(*maxin, other[k]);
+    }
+  }
+  return count >= min_neighbours;
+}
+
+/* the cpu marks fixed pixels by writing to the neighbours in the row, in order of increasing x.
+ * here each pixel looks for the rightmost fixed pixel which would have marked it. fixed is
+ * only counted if it's not NULL. */
+kernel void
+hotpixels(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+          const float threshold, const float multiplier, const int min_neighbours, const int markfixed,
+          global int *fixed)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float pixel = read_imagef(in, sampleri, (int2)(x, y)).x;
+  float maxin;
+
+  const int reach = markfixed ? 10 : 0;
+  for(int k=reach; k>=-reach; k-=2)
+  {
+    if(hotpixels_test(in, x+k, y, width, height, threshold, multiplier, min_neighbours, &maxin))
+    {
+      pixel = k ? read_imagef(in, sampleri, (int2)(x+k, y)).x : maxin;
+      break;
+    }
+  }
+  if(fixed && hotpixels_test(in, x, y, width, height, threshold, multiplier, min_neighbours, &maxin))
+    atomic_inc(fixed);
+
+  write_imagef (out, (int2)(x, y), (float4)(pixel, 0.0f, 0.0f, 0.0f));
+}
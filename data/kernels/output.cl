@@ -0,0 +1,59 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+/* final stage of the display pipe, see iop/gamma.c: maps rgb through the 8-bit gamma table and packs it
+   to the bgr byte order of the display, so only 4 bytes per pixel need to be copied back. */
+kernel void
+gamma_bgra(read_only image2d_t in, global uchar4 *out, global const uchar *table, const int width,
+           const int height, const int mask_display)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+
+  if(mask_display)
+  {
+    // gray image, mask in yellow on top:
+    const float gray = 0.3f*pixel.x + 0.59f*pixel.y + 0.11f*pixel.z;
+    const float alpha = pixel.w;
+    pixel.x = pixel.y = gray * (1.0f - alpha) + alpha;
+    pixel.z = gray * (1.0f - alpha);
+  }
+
+  const int4 idx = clamp(convert_int4_sat_rtz(65535.0f * pixel), 0, 0xffff);
+  out[mad24(y, width, x)] = (uchar4)(table[idx.z], table[idx.y], table[idx.x], 0);
+}
+
+/* export at 16 bits per channel, see dt_dev_pixelpipe_process(): packs the float output like the
+   conversion on the host would, to copy back half the bytes. */
+kernel void
+pack_ui16(read_only image2d_t in, global ushort4 *out, const int width, const int height)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  out[mad24(y, width, x)] = convert_ushort4_sat_rtz(pixel * 65536.0f);
+}
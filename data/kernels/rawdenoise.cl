@@ -0,0 +1,86 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+/* wavelet denoising of the four bayer channels, each one as a half size plane. */
+
+/* square root of one of the channels, (ox, oy) is its offset in the 2x2 block. also clears the sum. */
+kernel void
+rawdenoise_extract(read_only image2d_t in, global float *plane, global float *sum, const int halfwidth,
+                   const int halfheight, const int ox, const int oy)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= halfwidth || y >= halfheight) return;
+
+  const float pixel = read_imagef(in, sampleri, (int2)(2*x + ox, 2*y + oy)).x;
+  plane[y*halfwidth + x] = sqrt(fmax(0.0f, pixel));
+  sum[y*halfwidth + x] = 0.0f;
+}
+
+/* one pass of the hat filter, at the borders the plane is mirrored */
+kernel void
+rawdenoise_hat(global const float *src, global float *dst, const int halfwidth, const int halfheight,
+               const int scale, const int horizontal)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= halfwidth || y >= halfheight) return;
+
+  const int size = horizontal ? halfwidth : halfheight;
+  const int i = horizontal ? x : y;
+  const int stride = horizontal ? 1 : halfwidth;
+  int i0 = i - scale, i1 = i + scale;
+  if(i0 < 0) i0 = -i0;
+  if(i1 >= size) i1 = 2*(size-1) - i1;
+
+  const int idx = y*halfwidth + x;
+  dst[idx] = (2.0f*src[idx] + src[idx + (i0 - i)*stride] + src[idx + (i1 - i)*stride])*0.25f;
+}
+
+/* add the soft thresholded detail of this level to the sum */
+kernel void
+rawdenoise_threshold(global float *sum, global const float *fine, global const float *coarse, const int halfwidth,
+                     const int halfheight, const float thold)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= halfwidth || y >= halfheight) return;
+
+  const int i = y*halfwidth + x;
+  const float diff = fine[i] - coarse[i];
+  sum[i] += copysign(fmax(fabs(diff) - thold, 0.0f), diff);
+}
+
+/* write the channel back, adding the residual */
+kernel void
+rawdenoise_combine(write_only image2d_t out, global const float *sum, global const float *coarse,
+                   const int halfwidth, const int halfheight, const int ox, const int oy)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= halfwidth || y >= halfheight) return;
+
+  const float d = sum[y*halfwidth + x] + coarse[y*halfwidth + x];
+  write_imagef (out, (int2)(2*x + ox, 2*y + oy), (float4)(d*d, 0.0f, 0.0f, 0.0f));
+}
@@ -0,0 +1,48 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+/* clone all spots in one go. each spot is 8 ints: left, top, width and height of its mask in the
+ * output, the offset dx, dy to its source and the start of its mask in masks. the spots are
+ * applied in order, like on the cpu. */
+kernel void
+spots(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+      const int ox, const int oy, global const int *spots, global const float *masks, const int num)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float4 pixel = read_imagef(in, sampleri, (int2)(x + ox, y + oy));
+
+  for(int k = 0; k < num; k++)
+  {
+    global const int *s = spots + 8*k;
+    const int sx = x - s[0];
+    const int sy = y - s[1];
+    if(sx < 0 || sy < 0 || sx >= s[2] || sy >= s[3]) continue;
+    const float f = masks[s[6] + sy*s[2] + sx];
+    if(f == 0.0f) continue;
+    const float4 source = read_imagef(in, sampleri, (int2)(x + ox - s[4], y + oy - s[5]));
+    pixel = pixel * (1.0f - f) + source * f;
+  }
+
+  write_imagef (out, (int2)(x, y), pixel);
+}
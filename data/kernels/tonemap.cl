@@ -0,0 +1,66 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common.h"
+
+// durand's tone mapping. the base layer is the log luminance, filtered on the bilateral grid.
+// the grid expects values in [0, 100], the log range [lmin, lmin + 100/scale] is mapped there.
+
+float
+tonemap_log_luminance(const float4 pixel)
+{
+  const float L = 0.2126f*pixel.x + 0.7152f*pixel.y + 0.0722f*pixel.z;
+  return log(L > 0.0f ? L : 1e-6f);
+}
+
+/* write the scaled log luminance to a single channel image, as input for the grid */
+kernel void
+tonemap_log(read_only image2d_t in, write_only image2d_t out, const int width, const int height,
+            const float lmin, const float scale)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  const float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  const float L = clamp((tonemap_log_luminance(pixel) - lmin) * scale, 0.0f, 100.0f);
+
+  write_imagef (out, (int2)(x, y), (float4)(L, 0.0f, 0.0f, 0.0f));
+}
+
+/* compress the base layer, which comes back from the grid in the .x channel of base */
+kernel void
+tonemap_apply(read_only image2d_t in, read_only image2d_t base, write_only image2d_t out,
+              const int width, const int height, const float lmin, const float scale, const float contr)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  const float B = read_imagef(base, sampleri, (int2)(x, y)).x / scale + lmin;
+  const float L = tonemap_log_luminance(pixel);
+  const float detail = L - B;
+  const float Ln = exp(B*(contr - 1.0f) + detail - 1.0f);
+
+  pixel.xyz *= Ln;
+
+  write_imagef (out, (int2)(x, y), pixel);
+}
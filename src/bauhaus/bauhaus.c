@@ -1916,6 +1916,8 @@ dt_bauhaus_slider_button_press(GtkWidget *widget, GdkEventButton *event, gpointe
     if(event->type == GDK_2BUTTON_PRESS)
     {
       dt_bauhaus_slider_data_t *d = &w->data.slider;
+      // the press before this one started a drag:
+      if(d->is_dragging) dt_dev_interactive_end(darktable.develop);
       d->is_dragging = 0;
       dt_bauhaus_slider_set_normalized(w, d->defpos);
     }
@@ -1925,6 +1927,7 @@ dt_bauhaus_slider_button_press(GtkWidget *widget, GdkEventButton *event, gpointe
       const float r = 1.0f-(tmp.height+4.0f)/tmp.width;
       dt_bauhaus_slider_set_normalized(w, (event->x/tmp.width - l)/(r-l));
       dt_bauhaus_slider_data_t *d = &w->data.slider;
+      if(!d->is_dragging) dt_dev_interactive_begin(darktable.develop);
       d->is_dragging = 1;
       int delay = CLAMP(darktable.develop->average_delay*3/2, DT_BAUHAUS_SLIDER_VALUE_CHANGED_DELAY_MIN, DT_BAUHAUS_SLIDER_VALUE_CHANGED_DELAY_MAX);
       // timeout_handle should always be zero here, but check just in case
@@ -1953,6 +1956,7 @@ dt_bauhaus_slider_button_release(GtkWidget *widget, GdkEventButton *event, gpoin
     const float l = 4.0f/tmp.width;
     const float r = 1.0f-(tmp.height+4.0f)/tmp.width;
     dt_bauhaus_slider_set_normalized(w, (event->x/tmp.width - l)/(r-l));
+    dt_dev_interactive_end(darktable.develop);
 
     return TRUE;
   }
@@ -0,0 +1,441 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * headless benchmark of the export pixelpipe.
+ *
+ * imports all images of a directory (including their xmp duplicates), runs
+ * the export pipe a number of times per image on the cpu and on each opencl
+ * device, and prints median and 95th percentile times per module and for the
+ * whole pipe as tab separated values on stdout, with a checksum of the output
+ * image of the whole pipe. nothing is written to disk.
+ *
+ * with --compare, these are checked against a baseline written by an earlier
+ * run: a median more than the tolerance slower or a different checksum is
+ * reported on stderr and makes the exit status non-zero. make perf-test does
+ * this on a set of sample images.
+ *
+ * to measure one opencl device, all others are locked for the duration of the
+ * runs. a device which is not in the export entry of opencl_device_priority
+ * can't be selected and the pipe runs on the cpu instead.
+ */
+
+#include "common/darktable.h"
+#include "common/database.h"
+#include "common/debug.h"
+#include "common/film.h"
+#include "common/image.h"
+#include "common/image_cache.h"
+#include "common/imageio.h"
+#include "common/mipmap_cache.h"
+#include "common/opencl.h"
+#include "develop/develop.h"
+#include "develop/imageop.h"
+#include "develop/pixelpipe.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <libintl.h>
+
+static void
+usage(const char* progname)
+{
+  fprintf(stderr, "usage: %s <directory> [--runs <n>,--width <max width>,--height <max height>,--cpu-only,"
+                  "--compare <baseline>,--tolerance <fraction>] [--core <darktable options>]\n", progname);
+}
+
+typedef struct _baseline_t
+{
+  float median;     // ms
+  char checksum[17];
+}
+_baseline_t;
+
+// image, device and module of the baseline row -> _baseline_t, NULL without --compare
+static GHashTable *_baseline = NULL;
+static float _tolerance = 0.25f;
+// below this, timer noise dominates:
+#define BENCH_SLACK_MS 2.0f
+
+static gchar *
+_baseline_key(const char *image, const char *device, const char *module)
+{
+  return g_strdup_printf("%s\t%s\t%s", image, device, module);
+}
+
+// reads a file in the format printed on stdout.
+static int
+_baseline_read(const char *filename)
+{
+  FILE *f = fopen(filename, "rb");
+  if(!f)
+  {
+    fprintf(stderr, "[bench] can't open baseline `%s'\n", filename);
+    return 1;
+  }
+  _baseline = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  char line[4096];
+  while(fgets(line, sizeof(line), f))
+  {
+    gchar **col = g_strsplit(g_strchomp(line), "\t", -1);
+    if(g_strv_length(col) >= 7 && strcmp(col[0], "image"))
+    {
+      _baseline_t *b = (_baseline_t *)g_malloc(sizeof(_baseline_t));
+      b->median = g_ascii_strtod(col[3], NULL);
+      g_strlcpy(b->checksum, col[6], sizeof(b->checksum));
+      g_hash_table_insert(_baseline, _baseline_key(col[0], col[1], col[2]), b);
+    }
+    g_strfreev(col);
+  }
+  fclose(f);
+  return 0;
+}
+
+// 1 if the row regressed against the baseline.
+static int
+_baseline_check(const char *image, const char *device, const char *module, const float median, const char *checksum)
+{
+  if(!_baseline) return 0;
+  gchar *key = _baseline_key(image, device, module);
+  const _baseline_t *b = (const _baseline_t *)g_hash_table_lookup(_baseline, key);
+  g_free(key);
+  if(!b)
+  {
+    fprintf(stderr, "[bench] no baseline for `%s' %s %s\n", image, device, module);
+    return 0;
+  }
+  int regressed = 0;
+  if(median > b->median*(1.0f + _tolerance) + BENCH_SLACK_MS)
+  {
+    fprintf(stderr, "[bench] slower: `%s' %s %s takes %.3f ms, baseline %.3f ms\n", image, device, module,
+            median, b->median);
+    regressed = 1;
+  }
+  else if(median < b->median*(1.0f - _tolerance) - BENCH_SLACK_MS)
+  {
+    fprintf(stderr, "[bench] faster: `%s' %s %s takes %.3f ms, baseline %.3f ms, consider updating it\n",
+            image, device, module, median, b->median);
+  }
+  if(strcmp(checksum, b->checksum))
+  {
+    fprintf(stderr, "[bench] different output: `%s' %s %s has checksum %s, baseline %s\n", image, device,
+            module, checksum, b->checksum);
+    regressed = 1;
+  }
+  return regressed;
+}
+
+static int
+_compare_float(const void *a, const void *b)
+{
+  const float fa = *(const float *)a, fb = *(const float *)b;
+  return (fa > fb) - (fa < fb);
+}
+
+// sorts the times in place and returns the p-quantile, nearest rank.
+static float
+_quantile(float *times, const int runs, const float p)
+{
+  qsort(times, runs, sizeof(float), _compare_float);
+  const int rank = CLAMPS((int)(p*runs + 0.5f) - 1, 0, runs-1);
+  return times[rank];
+}
+
+// checksum is "-" for single modules. returns 1 if the row regressed against the baseline.
+static int
+_print_row(const char *image, const char *device, const char *module, float *times, const int runs, const double mpix,
+           const char *checksum)
+{
+  const float median = _quantile(times, runs, 0.5f);
+  const float p95 = _quantile(times, runs, 0.95f);
+  printf("%s\t%s\t%s\t%.3f\t%.3f\t%.2f\t%s\n", image, device, module, 1e3f*median, 1e3f*p95,
+         median > 0.0f ? mpix/median : 0.0, checksum);
+  return _baseline_check(image, device, module, 1e3f*median, checksum);
+}
+
+// bernstein hash (djb2) of the output in 8 bits, small differences in rounding between runs don't count.
+static void
+_checksum(const float *buf, const int width, const int height, char *checksum, const size_t size)
+{
+  uint64_t hash = 5381;
+  for(size_t k=0; k<(size_t)width*height; k++)
+    for(int c=0; c<3; c++)
+      hash = ((hash << 5) + hash) ^ (uint8_t)(CLAMPS(buf[4*k+c], 0.0f, 1.0f)*255.0f + 0.5f);
+  snprintf(checksum, size, "%016" PRIx64, hash);
+}
+
+#ifdef HAVE_OPENCL
+// locks all opencl devices except the one to measure, so the pipe can only get that one. -1 locks all.
+static void
+_lock_devices(const int devid, const int lock)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited) return;
+  for(int k=0; k<cl->num_devs; k++)
+  {
+    if(k == devid) continue;
+    if(lock) dt_pthread_mutex_lock(&cl->dev[k].lock);
+    else     dt_pthread_mutex_unlock(&cl->dev[k].lock);
+  }
+}
+#endif
+
+static int
+_bench_image(const uint32_t imgid, const int devid, const char *device, const int runs, const int width, const int height)
+{
+  dt_develop_t dev;
+  dt_dev_init(&dev, 0);
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING);
+  dt_dev_load_image(&dev, imgid);
+  const dt_image_t *img = &dev.image_storage;
+  char image[DT_MAX_PATH_LEN];
+  snprintf(image, sizeof(image), "%s#%d", img->filename, img->version);
+
+  dt_dev_pixelpipe_t pipe;
+  if(!buf.buf || !dt_dev_pixelpipe_init_export(&pipe, img->width, img->height, IMAGEIO_RGB | IMAGEIO_FLOAT))
+  {
+    fprintf(stderr, "[bench] could not load image `%s'\n", image);
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    dt_dev_cleanup(&dev);
+    return 1;
+  }
+  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, 1.0);
+  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
+  dt_dev_pixelpipe_synch_all(&pipe, &dev);
+  dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width, &pipe.processed_height);
+
+  const double scalex = width  > 0 ? fminf(width /(double)pipe.processed_width,  1.0) : 1.0;
+  const double scaley = height > 0 ? fminf(height/(double)pipe.processed_height, 1.0) : 1.0;
+  const double scale = fminf(scalex, scaley);
+  const int processed_width  = scale*pipe.processed_width  + .5f;
+  const int processed_height = scale*pipe.processed_height + .5f;
+  const double mpix = processed_width*(double)processed_height*1e-6;
+
+  const int num_nodes = g_list_length(pipe.nodes);
+  float *times = (float *)malloc(sizeof(float)*runs*(num_nodes+1));
+  int res = 0;
+#ifdef HAVE_OPENCL
+  _lock_devices(devid, 1);
+#endif
+  for(int r=0; r<runs && !res; r++)
+  {
+    // start from scratch every time, nothing should come from the cache:
+    pipe.cache_obsolete = 1;
+    const double start = dt_get_wtime();
+    res = dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+    times[r] = dt_get_wtime() - start;
+    int k = 1;
+    for(GList *nodes = pipe.nodes; nodes; nodes = g_list_next(nodes), k++)
+      times[k*runs + r] = ((dt_dev_pixelpipe_iop_t *)nodes->data)->process_time;
+    if(devid >= 0 && !pipe.opencl_enabled)
+      fprintf(stderr, "[bench] `%s' fell back to the cpu in run %d\n", image, r);
+  }
+#ifdef HAVE_OPENCL
+  _lock_devices(devid, 0);
+#endif
+
+  if(res)
+  {
+    fprintf(stderr, "[bench] processing `%s' failed\n", image);
+  }
+  else
+  {
+    char checksum[17];
+    dt_pthread_mutex_lock(&pipe.backbuf_mutex);
+    _checksum((const float *)pipe.backbuf, processed_width, processed_height, checksum, sizeof(checksum));
+    dt_pthread_mutex_unlock(&pipe.backbuf_mutex);
+    int k = 1;
+    for(GList *nodes = pipe.nodes; nodes; nodes = g_list_next(nodes), k++)
+    {
+      dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+      if(!piece->enabled) continue;
+      char module[128];
+      if(piece->module->multi_name[0])
+        snprintf(module, sizeof(module), "%s %s", piece->module->op, piece->module->multi_name);
+      else
+        snprintf(module, sizeof(module), "%s", piece->module->op);
+      res |= _print_row(image, device, module, times + k*runs, runs, mpix, "-");
+    }
+    res |= _print_row(image, device, "total", times, runs, mpix, checksum);
+  }
+  fflush(stdout);
+
+  free(times);
+  dt_dev_pixelpipe_cleanup(&pipe);
+  dt_dev_cleanup(&dev);
+  dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+  return res;
+}
+
+int main(int argc, char *arg[])
+{
+  bindtextdomain (GETTEXT_PACKAGE, DARKTABLE_LOCALEDIR);
+  bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
+  textdomain (GETTEXT_PACKAGE);
+
+  gtk_init (&argc, &arg);
+
+  // parse command line arguments
+  char *directory = NULL;
+  int runs = 5, width = 0, height = 0;
+  gboolean cpu_only = FALSE;
+  const char *baseline = NULL;
+
+  int k;
+  for(k=1; k<argc; k++)
+  {
+    if(arg[k][0] == '-')
+    {
+      if(!strcmp(arg[k], "--help"))
+      {
+        usage(arg[0]);
+        exit(1);
+      }
+      else if(!strcmp(arg[k], "--runs") && k+1 < argc)
+      {
+        k++;
+        runs = MAX(atoi(arg[k]), 1);
+      }
+      else if(!strcmp(arg[k], "--width") && k+1 < argc)
+      {
+        k++;
+        width = MAX(atoi(arg[k]), 0);
+      }
+      else if(!strcmp(arg[k], "--height") && k+1 < argc)
+      {
+        k++;
+        height = MAX(atoi(arg[k]), 0);
+      }
+      else if(!strcmp(arg[k], "--cpu-only"))
+      {
+        cpu_only = TRUE;
+      }
+      else if(!strcmp(arg[k], "--compare") && k+1 < argc)
+      {
+        k++;
+        baseline = arg[k];
+      }
+      else if(!strcmp(arg[k], "--tolerance") && k+1 < argc)
+      {
+        k++;
+        _tolerance = MAX(g_ascii_strtod(arg[k], NULL), 0.0);
+      }
+      else if(!strcmp(arg[k], "--core"))
+      {
+        // everything from here on should be passed to the core
+        k++;
+        break;
+      }
+    }
+    else if(!directory)
+    {
+      directory = arg[k];
+    }
+  }
+
+  if(!directory || !g_file_test(directory, G_FILE_TEST_IS_DIR))
+  {
+    usage(arg[0]);
+    exit(1);
+  }
+  if(baseline && _baseline_read(baseline)) exit(1);
+
+  int m_argc = 0;
+  char *m_arg[3 + argc - k];
+  m_arg[m_argc++] = "darktable-bench";
+  m_arg[m_argc++] = "--headless";
+  for(; k < argc; k++) m_arg[m_argc++] = arg[k];
+  m_arg[m_argc] = NULL;
+
+  // init dt without gui:
+  if(dt_init(m_argc, m_arg, 0)) exit(1);
+  // measure the devices, not the cpu fallback while their kernels are built:
+  dt_opencl_wait_for_programs();
+
+  // import the directory, this picks up the xmp stacks of the images as duplicates:
+  dt_film_t film;
+  const int filmid = dt_film_new(&film, directory);
+  GDir *dir = g_dir_open(directory, 0, NULL);
+  if(!filmid || !dir)
+  {
+    fprintf(stderr, "[bench] can't open directory `%s'\n", directory);
+    exit(1);
+  }
+  const gchar *d_name;
+  while((d_name = g_dir_read_name(dir)))
+  {
+    gchar *filename = g_build_filename(directory, d_name, NULL);
+    (void)dt_image_import(filmid, filename, TRUE);
+    g_free(filename);
+  }
+  g_dir_close(dir);
+
+  GList *images = NULL;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select id from images where film_id = ?1 order by filename, version", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, filmid);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    images = g_list_append(images, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+  if(!images)
+  {
+    fprintf(stderr, "[bench] no images found in `%s'\n", directory);
+    exit(1);
+  }
+
+  int num_devs = 0;
+#ifdef HAVE_OPENCL
+  if(!cpu_only && dt_opencl_is_inited()) num_devs = darktable.opencl->num_devs;
+#endif
+
+  int failed = 0;
+  printf("image\tdevice\tmodule\tmedian_ms\tp95_ms\tmpix_per_s\tchecksum\n");
+  for(GList *i = images; i; i = g_list_next(i))
+  {
+    const uint32_t imgid = GPOINTER_TO_INT(i->data);
+    for(int devid=-1; devid<num_devs; devid++)
+    {
+#ifdef HAVE_OPENCL
+      // further queues of a device measure the same hardware:
+      if(devid >= 0 && darktable.opencl->dev[devid].queue) continue;
+#endif
+      char device[256];
+      if(devid < 0)
+        snprintf(device, sizeof(device), "cpu");
+#ifdef HAVE_OPENCL
+      else
+        snprintf(device, sizeof(device), "opencl %d %s", devid, darktable.opencl->dev[devid].name);
+#endif
+      failed |= _bench_image(imgid, devid, device, runs, width, height);
+    }
+  }
+  g_list_free(images);
+  if(_baseline) g_hash_table_destroy(_baseline);
+
+  dt_cleanup();
+  return failed;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -36,17 +36,473 @@
 #include "common/imageio_module.h"
 #include "common/exif.h"
 #include "common/history.h"
+#include "common/opencl.h"
+#include "control/conf.h"
 
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <pthread.h>
 #include <unistd.h>
 int usleep(useconds_t usec);
 #include <inttypes.h>
 #include <libintl.h>
 
+/* one image to process: the input file, an optional xmp file and the output file */
+typedef struct dt_cli_item_t
+{
+  gchar *image_filename;
+  gchar *xmp_filename;
+  gchar *output_filename;
+  int id;
+  double time;
+}
+dt_cli_item_t;
+
 static void
 usage(const char* progname)
 {
   fprintf(stderr, "usage: %s <input file> [<xmp file>] <output file> [--width <max width>,--height <max height>,--bpp <bpp>,--hq <0|1|true|false>,--verbose] [--core <darktable options>]\n", progname);
+  fprintf(stderr, "       %s --batch <list file|-> [--jobs <n>,--width <max width>,--height <max height>,--hq <0|1|true|false>,--verbose] [--core <darktable options>]\n", progname);
+  fprintf(stderr, "       %s --serve <socket> [--jobs <n>,--width <max width>,--height <max height>,--hq <0|1|true|false>,--verbose] [--core <darktable options>]\n", progname);
+  fprintf(stderr, "       every line of the list holds <input file>[\\t<xmp file>]\\t<output file>\n");
+  fprintf(stderr, "       the socket takes the lines render\\t<input file>\\t[<xmp file>]\\t<output file>[\\t<max width>\\t<max height>], stats and quit\n");
+}
+
+/* reads the tab separated lines of a batch list, skipping empty lines and comments */
+static GList *
+_cli_read_batch(const char *list_filename)
+{
+  FILE *f = strcmp(list_filename, "-") ? fopen(list_filename, "rb") : stdin;
+  if(!f)
+  {
+    fprintf(stderr, _("error: can't open file %s"), list_filename);
+    fprintf(stderr, "\n");
+    return NULL;
+  }
+
+  GList *items = NULL;
+  char line[3*DT_MAX_PATH_LEN];
+  int line_number = 0;
+  while(fgets(line, sizeof(line), f))
+  {
+    line_number++;
+    g_strchomp(line);
+    if(line[0] == '\0' || line[0] == '#') continue;
+    gchar **fields = g_strsplit(line, "\t", 0);
+    const guint num_fields = g_strv_length(fields);
+    if(num_fields < 2 || num_fields > 3)
+    {
+      fprintf(stderr, "%s:%d: %s\n", list_filename, line_number, _("expected <input file>[\\t<xmp file>]\\t<output file>"));
+      g_strfreev(fields);
+      continue;
+    }
+    dt_cli_item_t *item = (dt_cli_item_t *)g_malloc0(sizeof(dt_cli_item_t));
+    item->image_filename = g_strdup(fields[0]);
+    item->xmp_filename = num_fields == 3 ? g_strdup(fields[1]) : NULL;
+    item->output_filename = g_strdup(fields[num_fields - 1]);
+    items = g_list_prepend(items, item);
+    g_strfreev(fields);
+  }
+  if(f != stdin) fclose(f);
+  return g_list_reverse(items);
+}
+
+static void
+_cli_item_free(dt_cli_item_t *item)
+{
+  g_free(item->image_filename);
+  g_free(item->xmp_filename);
+  g_free(item->output_filename);
+  g_free(item);
+}
+
+/* imports the input file and attaches the xmp. this touches the database and runs before the exports. */
+static int
+_cli_import(dt_cli_item_t *item, gboolean verbose)
+{
+  // the output file already exists, so there will be a sequence number added
+  if(g_file_test(item->output_filename, G_FILE_TEST_EXISTS))
+  {
+    fprintf(stderr, "%s: %s\n", item->output_filename, _("output file already exists, it will get renamed"));
+  }
+
+  dt_film_t film;
+  gchar *directory = g_path_get_dirname(item->image_filename);
+  const int filmid = dt_film_new(&film, directory);
+  g_free(directory);
+  item->id = dt_image_import(filmid, item->image_filename, TRUE);
+  if(!item->id)
+  {
+    fprintf(stderr, _("error: can't open file %s"), item->image_filename);
+    fprintf(stderr, "\n");
+    return 1;
+  }
+
+  // attach xmp, if requested:
+  if(item->xmp_filename)
+  {
+    const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, item->id);
+    dt_image_t *image = dt_image_cache_write_get(darktable.image_cache, cimg);
+    dt_exif_xmp_read(image, item->xmp_filename, 1);
+    // don't write new xmp:
+    dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+    dt_image_cache_read_release(darktable.image_cache, image);
+  }
+
+  // print the history stack
+  if(verbose)
+  {
+    gchar *history = dt_history_get_items_as_string(item->id);
+    if(history)
+      printf("%s\n", history);
+    else
+      printf("[%s]\n", _("empty history stack"));
+    g_free(history);
+  }
+  return 0;
+}
+
+/* exports an imported image to its output file. safe to run for several images at once. */
+static int
+_cli_export(const dt_cli_item_t *item, int width, int height, gboolean high_quality)
+{
+  // try to find out the export format from the output_filename
+  gchar *output_filename = g_strdup(item->output_filename);
+  char *ext = output_filename + strlen(output_filename);
+  while(ext > output_filename && *ext != '.') ext--;
+  *ext = '\0';
+  ext++;
+
+  if(!strcmp(ext, "jpg"))
+    ext = "jpeg";
+
+  // init the export data structures
+  dt_imageio_module_format_t *format;
+  dt_imageio_module_storage_t *storage;
+  dt_imageio_module_data_t *sdata, *fdata;
+
+  storage = dt_imageio_get_storage_by_name("disk"); // only exporting to disk makes sense
+  if(storage == NULL)
+  {
+    fprintf(stderr, "%s\n", _("cannot find disk storage module. please check your installation, something seems to be broken."));
+    g_free(output_filename);
+    return 1;
+  }
+
+  format = dt_imageio_get_format_by_name(ext);
+  if(format == NULL)
+  {
+    fprintf(stderr, _("unknown extension '.%s'"), ext);
+    fprintf(stderr, "\n");
+    g_free(output_filename);
+    return 1;
+  }
+
+  sdata = storage->get_params(storage);
+  if(sdata == NULL)
+  {
+    fprintf(stderr, "%s\n", _("failed to get parameters from storage module, aborting export ..."));
+    g_free(output_filename);
+    return 1;
+  }
+
+  // and now for the really ugly hacks. don't tell your children about this one or they won't sleep at night any longer ...
+  g_strlcpy((char*)sdata, output_filename, DT_MAX_PATH_LEN);
+  // all is good now, the last line didn't happen.
+  g_free(output_filename);
+
+  fdata = format->get_params(format);
+  if(fdata == NULL)
+  {
+    fprintf(stderr, "%s\n", _("failed to get parameters from format module, aborting export ..."));
+    storage->free_params(storage, sdata);
+    return 1;
+  }
+
+  uint32_t w,h,fw,fh,sw,sh;
+  fw=fh=sw=sh=0;
+  storage->dimension(storage, &sw, &sh);
+  format->dimension(format, &fw, &fh);
+
+  if( sw==0 || fw==0) w=sw>fw?sw:fw;
+  else w=sw<fw?sw:fw;
+
+  if( sh==0 || fh==0) h=sh>fh?sh:fh;
+  else h=sh<fh?sh:fh;
+
+  fdata->max_width  = width;
+  fdata->max_height = height;
+  fdata->max_width = (w!=0 && fdata->max_width >w)?w:fdata->max_width;
+  fdata->max_height = (h!=0 && fdata->max_height >h)?h:fdata->max_height;
+  fdata->style[0] = '\0';
+
+  //TODO: add a callback to set the bpp without going through the config
+
+  int res = storage->store(storage,sdata, item->id, format, fdata, 1, 1, high_quality);
+  // an up to date export from an earlier run is as good as a new one:
+  if(res == DT_IMAGEIO_STORE_UNCHANGED) res = 0;
+
+  // cleanup time
+  if(storage->finalize_store) storage->finalize_store(storage, sdata);
+  storage->free_params(storage, sdata);
+  format->free_params(format, fdata);
+  return res;
+}
+
+/* state of the render server, see _cli_serve() */
+typedef struct dt_cli_server_t
+{
+  dt_pthread_mutex_t mutex;  // protects all of the below, and serializes the imports
+  pthread_cond_t cond;       // signalled when a connection is queued or an image is done
+  GQueue *connections;       // accepted sockets waiting for a worker
+  GHashTable *busy;          // ids of the images being rendered right now
+  int listen_fd;
+  int quit;
+  int width, height;
+  gboolean high_quality, verbose;
+  // metrics reported by the stats request
+  uint64_t served, failed;
+  int running;
+  double latency_sum, latency_max;
+}
+dt_cli_server_t;
+
+static void
+_cli_serve_reply(int fd, const char *reply)
+{
+  send(fd, reply, strlen(reply), MSG_NOSIGNAL);
+}
+
+/* without an xmp a request gets the history of the image's sidecar, or none, but never the one of an earlier request */
+static void
+_cli_serve_reset_history(const int imgid)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from history where imgid = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from mask where imgid = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+}
+
+/* render\t<input file>\t[<xmp file>]\t<output file>[\t<max width>\t<max height>] */
+static void
+_cli_serve_render(dt_cli_server_t *server, int fd, gchar **fields, const guint num_fields)
+{
+  if(num_fields != 4 && num_fields != 6)
+  {
+    _cli_serve_reply(fd, "error expected render\\t<input file>\\t[<xmp file>]\\t<output file>[\\t<max width>\\t<max height>]\n");
+    return;
+  }
+  const double start = dt_get_wtime();
+  dt_cli_item_t item = { 0 };
+  item.image_filename = fields[1];
+  item.output_filename = fields[3];
+  // the xmp is attached below, the import only reads it for images new to the library
+  gchar *sidecar = g_strconcat(fields[1], ".xmp", NULL);
+  const gchar *xmp_filename = NULL;
+  if(fields[2][0])
+    xmp_filename = fields[2];
+  else if(g_file_test(sidecar, G_FILE_TEST_IS_REGULAR))
+    xmp_filename = sidecar;
+  const int width = num_fields == 6 ? MAX(atoi(fields[4]), 0) : server->width;
+  const int height = num_fields == 6 ? MAX(atoi(fields[5]), 0) : server->height;
+
+  // the database is shared, and one image can't be set up for two requests at once
+  int res = 0;
+  dt_pthread_mutex_lock(&server->mutex);
+  if(_cli_import(&item, server->verbose))
+    res = 1;
+  else
+  {
+    while(g_hash_table_lookup(server->busy, GINT_TO_POINTER(item.id)))
+    {
+      dt_pthread_cond_wait(&server->cond, &server->mutex);
+    }
+    g_hash_table_insert(server->busy, GINT_TO_POINTER(item.id), GINT_TO_POINTER(1));
+    if(xmp_filename)
+    {
+      const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, item.id);
+      dt_image_t *image = dt_image_cache_write_get(darktable.image_cache, cimg);
+      dt_exif_xmp_read(image, xmp_filename, 1);
+      dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+      dt_image_cache_read_release(darktable.image_cache, image);
+    }
+    else
+      _cli_serve_reset_history(item.id);
+  }
+  dt_pthread_mutex_unlock(&server->mutex);
+
+  if(!res)
+  {
+    res = _cli_export(&item, width, height, server->high_quality);
+    dt_pthread_mutex_lock(&server->mutex);
+    g_hash_table_remove(server->busy, GINT_TO_POINTER(item.id));
+    pthread_cond_broadcast(&server->cond);
+    dt_pthread_mutex_unlock(&server->mutex);
+  }
+  g_free(sidecar);
+
+  const double latency = dt_get_wtime() - start;
+  dt_pthread_mutex_lock(&server->mutex);
+  server->served++;
+  if(res) server->failed++;
+  server->latency_sum += latency;
+  server->latency_max = MAX(server->latency_max, latency);
+  dt_pthread_mutex_unlock(&server->mutex);
+
+  gchar *reply = res ? g_strdup_printf("error %s\n", item.output_filename) : g_strdup_printf("ok %.3f\n", latency);
+  _cli_serve_reply(fd, reply);
+  g_free(reply);
+}
+
+/* answers the requests of one client, one line each, until it hangs up */
+static void
+_cli_serve_connection(dt_cli_server_t *server, int fd)
+{
+  FILE *f = fdopen(fd, "rb");
+  if(!f)
+  {
+    close(fd);
+    return;
+  }
+  char line[4*DT_MAX_PATH_LEN];
+  while(fgets(line, sizeof(line), f))
+  {
+    g_strchomp(line);
+    if(line[0] == '\0') continue;
+    gchar **fields = g_strsplit(line, "\t", 0);
+    const guint num_fields = g_strv_length(fields);
+    if(!strcmp(fields[0], "render"))
+      _cli_serve_render(server, fd, fields, num_fields);
+    else if(!strcmp(fields[0], "stats"))
+    {
+      dt_pthread_mutex_lock(&server->mutex);
+      gchar *reply = g_strdup_printf("served %"PRIu64" failed %"PRIu64" running %d queued %d mean %.3f max %.3f\n",
+                                     server->served, server->failed, server->running, g_queue_get_length(server->connections),
+                                     server->served ? server->latency_sum / server->served : 0.0, server->latency_max);
+      dt_pthread_mutex_unlock(&server->mutex);
+      _cli_serve_reply(fd, reply);
+      g_free(reply);
+    }
+    else if(!strcmp(fields[0], "quit"))
+    {
+      dt_pthread_mutex_lock(&server->mutex);
+      server->quit = 1;
+      pthread_cond_broadcast(&server->cond);
+      dt_pthread_mutex_unlock(&server->mutex);
+      // wakes up the accept() in _cli_serve()
+      shutdown(server->listen_fd, SHUT_RDWR);
+      _cli_serve_reply(fd, "ok\n");
+    }
+    else
+      _cli_serve_reply(fd, "error unknown request\n");
+    g_strfreev(fields);
+  }
+  fclose(f);
+}
+
+static void *
+_cli_serve_worker(void *data)
+{
+  dt_cli_server_t *server = (dt_cli_server_t *)data;
+  dt_pthread_mutex_lock(&server->mutex);
+  while(1)
+  {
+    while(!server->quit && g_queue_is_empty(server->connections))
+      dt_pthread_cond_wait(&server->cond, &server->mutex);
+    if(g_queue_is_empty(server->connections)) break;
+    const int fd = GPOINTER_TO_INT(g_queue_pop_head(server->connections));
+    server->running++;
+    dt_pthread_mutex_unlock(&server->mutex);
+    _cli_serve_connection(server, fd);
+    dt_pthread_mutex_lock(&server->mutex);
+    server->running--;
+  }
+  dt_pthread_mutex_unlock(&server->mutex);
+  return NULL;
+}
+
+/* keeps one initialised instance around and renders the requests coming in over a unix socket,
+   num_workers connections at a time. */
+static int
+_cli_serve(const char *socket_filename, const int num_workers, int width, int height, gboolean high_quality, gboolean verbose)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(strlen(socket_filename) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, "%s: %s\n", socket_filename, _("socket path too long"));
+    return 1;
+  }
+  g_strlcpy(addr.sun_path, socket_filename, sizeof(addr.sun_path));
+  unlink(socket_filename);
+
+  dt_cli_server_t server;
+  memset(&server, 0, sizeof(server));
+  server.width = width;
+  server.height = height;
+  server.high_quality = high_quality;
+  server.verbose = verbose;
+  server.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(server.listen_fd < 0 || bind(server.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(server.listen_fd, 16))
+  {
+    fprintf(stderr, "%s: %s\n", socket_filename, strerror(errno));
+    if(server.listen_fd >= 0) close(server.listen_fd);
+    return 1;
+  }
+  dt_pthread_mutex_init(&server.mutex, NULL);
+  pthread_cond_init(&server.cond, NULL);
+  server.connections = g_queue_new();
+  server.busy = g_hash_table_new(NULL, NULL);
+
+  pthread_t *workers = (pthread_t *)malloc(sizeof(pthread_t)*num_workers);
+  for(int k = 0; k < num_workers; k++)
+    pthread_create(workers + k, NULL, _cli_serve_worker, &server);
+  printf("%s %s\n", _("listening on"), socket_filename);
+  fflush(stdout);
+
+  while(1)
+  {
+    const int fd = accept(server.listen_fd, NULL, NULL);
+    dt_pthread_mutex_lock(&server.mutex);
+    const int quit = server.quit;
+    if(fd >= 0 && !quit)
+    {
+      g_queue_push_tail(server.connections, GINT_TO_POINTER(fd));
+      pthread_cond_signal(&server.cond);
+    }
+    dt_pthread_mutex_unlock(&server.mutex);
+    if(quit)
+    {
+      if(fd >= 0) close(fd);
+      break;
+    }
+    if(fd < 0 && errno != EINTR) break;
+  }
+
+  // let the workers finish what is queued
+  dt_pthread_mutex_lock(&server.mutex);
+  server.quit = 1;
+  pthread_cond_broadcast(&server.cond);
+  dt_pthread_mutex_unlock(&server.mutex);
+  for(int k = 0; k < num_workers; k++)
+    pthread_join(workers[k], NULL);
+  free(workers);
+
+  close(server.listen_fd);
+  unlink(socket_filename);
+  g_queue_free(server.connections);
+  g_hash_table_destroy(server.busy);
+  pthread_cond_destroy(&server.cond);
+  dt_pthread_mutex_destroy(&server.mutex);
+  return 0;
 }
 
 int main(int argc, char *arg[])
@@ -61,14 +517,16 @@ int main(int argc, char *arg[])
   char *image_filename = NULL;
   char *xmp_filename = NULL;
   char *output_filename = NULL;
+  char *batch_filename = NULL;
+  char *serve_filename = NULL;
   int file_counter = 0;
-  int width = 0, height = 0, bpp = 0;
+  int width = 0, height = 0, bpp = 0, jobs = 0;
   gboolean verbose = FALSE, high_quality = TRUE;
 
   int k;
   for(k=1; k<argc; k++)
   {
-    if(arg[k][0] == '-')
+    if(arg[k][0] == '-' && arg[k][1] != '\0')
     {
       if(!strcmp(arg[k], "--help"))
       {
@@ -112,6 +570,21 @@ int main(int argc, char *arg[])
         }
         g_free(str);
       }
+      else if(!strcmp(arg[k], "--batch"))
+      {
+        k++;
+        batch_filename = arg[k];
+      }
+      else if(!strcmp(arg[k], "--serve"))
+      {
+        k++;
+        serve_filename = arg[k];
+      }
+      else if(!strcmp(arg[k], "--jobs"))
+      {
+        k++;
+        jobs = MAX(atoi(arg[k]), 1);
+      }
       else if(!strcmp(arg[k], "-v") || !strcmp(arg[k], "--verbose"))
       {
         verbose = TRUE;
@@ -137,144 +610,119 @@ int main(int argc, char *arg[])
   }
 
   int m_argc = 0;
-  char *m_arg[4 + argc - k];
+  char *m_arg[3 + argc - k];
   m_arg[m_argc++] = "darktable-cli";
-  m_arg[m_argc++] = "--library";
-  m_arg[m_argc++] = ":memory:";
+  // no views, small caches and an in-memory library unless --core --library says otherwise:
+  m_arg[m_argc++] = "--headless";
   for(; k < argc; k++) m_arg[m_argc++] = arg[k];
   m_arg[m_argc] = NULL;
 
-  if(file_counter < 2 || file_counter > 3)
-  {
-    usage(arg[0]);
-    exit(1);
-  }
-  else if(file_counter == 2)
+  GList *items = NULL;
+  if(serve_filename)
   {
-    // no xmp file given
-    output_filename = xmp_filename;
-    xmp_filename = NULL;
+    if(file_counter != 0 || batch_filename)
+    {
+      usage(arg[0]);
+      exit(1);
+    }
   }
-
-  // the output file already exists, so there will be a sequence number added
-  if(g_file_test(output_filename, G_FILE_TEST_EXISTS))
+  else if(batch_filename)
   {
-    fprintf(stderr, "%s\n", _("output file already exists, it will get renamed"));
+    if(file_counter != 0)
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+    items = _cli_read_batch(batch_filename);
+    if(!items) exit(1);
   }
-
-  // init dt without gui:
-  if(dt_init(m_argc, m_arg, 0)) exit(1);
-
-  dt_film_t film;
-  int id = 0;
-  int filmid = 0;
-
-  gchar *directory = g_path_get_dirname(image_filename);
-  filmid = dt_film_new(&film, directory);
-  id = dt_image_import(filmid, image_filename, TRUE);
-  if(!id)
+  else if(file_counter < 2 || file_counter > 3)
   {
-    fprintf(stderr, _("error: can't open file %s"), image_filename);
-    fprintf(stderr, "\n");
+    usage(arg[0]);
     exit(1);
   }
-  g_free(directory);
-
-  // attach xmp, if requested:
-  if(xmp_filename)
-  {
-    const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, id);
-    dt_image_t *image = dt_image_cache_write_get(darktable.image_cache, cimg);
-    dt_exif_xmp_read(image, xmp_filename, 1);
-    // don't write new xmp:
-    dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
-    dt_image_cache_read_release(darktable.image_cache, image);
-  }
-
-  // print the history stack
-  if(verbose)
+  else
   {
-    gchar *history = dt_history_get_items_as_string(id);
-    if(history)
-      printf("%s\n", history);
-    else
-      printf("[%s]\n", _("empty history stack"));
+    if(file_counter == 2)
+    {
+      // no xmp file given
+      output_filename = xmp_filename;
+      xmp_filename = NULL;
+    }
+    dt_cli_item_t *item = (dt_cli_item_t *)g_malloc0(sizeof(dt_cli_item_t));
+    item->image_filename = g_strdup(image_filename);
+    item->xmp_filename = g_strdup(xmp_filename);
+    item->output_filename = g_strdup(output_filename);
+    items = g_list_append(items, item);
   }
 
-  // try to find out the export format from the output_filename
-  char *ext = output_filename + strlen(output_filename);
-  while(ext > output_filename && *ext != '.') ext--;
-  *ext = '\0';
-  ext++;
-
-  if(!strcmp(ext, "jpg"))
-    ext = "jpeg";
-
-  // init the export data structures
-  dt_imageio_module_format_t *format;
-  dt_imageio_module_storage_t *storage;
-  dt_imageio_module_data_t *sdata, *fdata;
-
-  storage = dt_imageio_get_storage_by_name("disk"); // only exporting to disk makes sense
-  if(storage == NULL)
-  {
-    fprintf(stderr, "%s\n", _("cannot find disk storage module. please check your installation, something seems to be broken."));
-    exit(1);
-  }
+  // init dt without gui, once for all images:
+  if(dt_init(m_argc, m_arg, 0)) exit(1);
+  // nobody is waiting for a window, better run the whole export on the device:
+  dt_opencl_wait_for_programs();
 
-  sdata = storage->get_params(storage);
-  if(sdata == NULL)
+  if(serve_filename)
   {
-    fprintf(stderr, "%s\n", _("failed to get parameters from storage module, aborting export ..."));
-    exit(1);
+    if(jobs == 0) jobs = dt_conf_get_int("parallel_export");
+    const int res = _cli_serve(serve_filename, CLAMP(jobs, 1, 64), width, height, high_quality, verbose);
+    dt_imageio_export_cleanup();
+    dt_cleanup();
+    return res;
   }
 
-  // and now for the really ugly hacks. don't tell your children about this one or they won't sleep at night any longer ...
-  g_strlcpy((char*)sdata, output_filename, DT_MAX_PATH_LEN);
-  // all is good now, the last line didn't happen.
-
-  format = dt_imageio_get_format_by_name(ext);
-  if(format == NULL)
+  // import everything first, the exports don't need the database any more and can run side by side
+  int total = g_list_length(items);
+  dt_cli_item_t **todo = (dt_cli_item_t **)g_malloc0(sizeof(dt_cli_item_t *)*total);
+  int num_todo = 0, failed = 0;
+  for(GList *l = items; l; l = g_list_next(l))
   {
-    fprintf(stderr, _("unknown extension '.%s'"), ext);
-    fprintf(stderr, "\n");
-    exit(1);
+    dt_cli_item_t *item = (dt_cli_item_t *)l->data;
+    const double start = dt_get_wtime();
+    if(_cli_import(item, verbose))
+    {
+      if(!batch_filename) exit(1);
+      failed++;
+      continue;
+    }
+    item->time = dt_get_wtime() - start;
+    todo[num_todo++] = item;
   }
 
-  fdata = format->get_params(format);
-  if(fdata == NULL)
+  if(jobs == 0) jobs = dt_conf_get_int("parallel_export");
+  const __attribute__((__unused__)) int num_threads = CLAMP(jobs, 1, MAX(1, num_todo));
+  int next = 0;
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(todo, num_todo, width, height, high_quality, failed, batch_filename, next, total, stdout) schedule(dynamic, 1) num_threads(num_threads) if(num_threads > 1)
+#endif
+  for(int i = 0; i < num_todo; i++)
   {
-    fprintf(stderr, "%s\n", _("failed to get parameters from format module, aborting export ..."));
-    exit(1);
+    dt_cli_item_t *item = todo[i];
+    const double start = dt_get_wtime();
+    const int res = _cli_export(item, width, height, high_quality);
+    item->time += dt_get_wtime() - start;
+#ifdef _OPENMP
+    #pragma omp critical
+#endif
+    {
+      if(res) failed++;
+      // per image timings are only interesting for batches
+      if(batch_filename)
+      {
+        next++;
+        printf("[%d/%d] %s -> %s: %s %.3fs\n", next, total, item->image_filename, item->output_filename,
+               res ? _("failed") : _("done"), item->time);
+        fflush(stdout);
+      }
+    }
   }
 
-  uint32_t w,h,fw,fh,sw,sh;
-  fw=fh=sw=sh=0;
-  storage->dimension(storage, &sw, &sh);
-  format->dimension(format, &fw, &fh);
-
-  if( sw==0 || fw==0) w=sw>fw?sw:fw;
-  else w=sw<fw?sw:fw;
-
-  if( sh==0 || fh==0) h=sh>fh?sh:fh;
-  else h=sh<fh?sh:fh;
-
-  fdata->max_width  = width;
-  fdata->max_height = height;
-  fdata->max_width = (w!=0 && fdata->max_width >w)?w:fdata->max_width;
-  fdata->max_height = (h!=0 && fdata->max_height >h)?h:fdata->max_height;
-  fdata->style[0] = '\0';
-
-  //TODO: add a callback to set the bpp without going through the config
-
-  storage->store(storage,sdata, id, format, fdata, 1, 1, high_quality);
+  g_free(todo);
+  g_list_free_full(items, (GDestroyNotify)_cli_item_free);
 
   // cleanup time
-  if(storage->finalize_store) storage->finalize_store(storage, sdata);
-  storage->free_params(storage, sdata);
-  format->free_params(format, fdata);
-
+  dt_imageio_export_cleanup();
   dt_cleanup();
+  return failed ? 1 : 0;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
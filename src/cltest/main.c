@@ -16,16 +16,367 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+/**
+ * opencl test and micro benchmark.
+ *
+ * initialising opencl is all it takes to make some drivers work for normal
+ * users afterwards, so this can be run as root once. on top of that, it builds
+ * every program of programs.conf on every device, reports the ones which fail,
+ * and measures on synthetic images of a few sizes:
+ *
+ *   - the host <-> device copy helpers of common/opencl.c,
+ *   - a set of kernels with simple signatures from most of the programs.
+ *
+ * median and 95th percentile times, megapixels and gigabytes per second go to
+ * stdout as tab separated values, one row per device, test and size.
+ */
+
 #include "common/darktable.h"
+#include "common/file_location.h"
 #include "common/opencl.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// a kernel which runs on synthetic input. the arguments are given as one character each:
+// r input image, w output image, W width, H height, i int 0, f float 1.0, v float4 of 1.0.
+typedef struct dt_cltest_kernel_t
+{
+  const char *name;
+  int program;
+  const char *args;
+}
+dt_cltest_kernel_t;
+
+static const dt_cltest_kernel_t _kernels[] =
+{
+  { "green_equilibration", 0,  "rwWHif" },
+  { "ppg_demosaic_green",  0,  "rwWHi" },
+  { "eaw_decompose",       1,  "rwwWHif" },
+  { "exposure",            2,  "rwWHff" },
+  { "colorcorrection",     2,  "rwWHfffff" },
+  { "flip",                2,  "rwWHi" },
+  { "blendop_Lab",         3,  "rrrwWHii" },
+  { "highpass_invert",     4,  "rwWH" },
+  { "sharpen_mix",         7,  "rrwWHff" },
+  { "velvia",              8,  "rwWHff" },
+  { "relight",             8,  "rwWHfff" },
+  { "soften_overexposed",  9,  "rwWHff" },
+  { "tonemap_log",         14, "rwWHff" },
+  { "tonemap_apply",       14, "rrwWHfff" },
+};
+#define DT_CLTEST_NUM_KERNELS (sizeof(_kernels)/sizeof(_kernels[0]))
+#define DT_CLTEST_MAX_IMAGES 3
+
+// square test images, from a preview up to a large export:
+static const int _sizes[] = { 512, 1024, 2048, 4096 };
+#define DT_CLTEST_NUM_SIZES (sizeof(_sizes)/sizeof(_sizes[0]))
+
+static void
+usage(const char* progname)
+{
+  fprintf(stderr, "usage: %s [--runs <n>] [--core <darktable options>]\n", progname);
+}
+
+static int
+_compare_float(const void *a, const void *b)
+{
+  const float fa = *(const float *)a, fb = *(const float *)b;
+  return (fa > fb) - (fa < fb);
+}
+
+// sorts the times in place and returns the p-quantile, nearest rank.
+static float
+_quantile(float *times, const int runs, const float p)
+{
+  qsort(times, runs, sizeof(float), _compare_float);
+  const int rank = CLAMPS((int)(p*runs + 0.5f) - 1, 0, runs-1);
+  return times[rank];
+}
+
+static void
+_print_row(const int devid, const char *kind, const char *test, const int size, float *times, const int runs,
+           const double bytes)
+{
+  const float median = _quantile(times, runs, 0.5f);
+  const float p95 = _quantile(times, runs, 0.95f);
+  const double mpix = size*(double)size/1e6;
+  printf("%d %s\t%s\t%s\t%d\t%.3f\t%.3f\t%.2f\t%.2f\n", devid, darktable.opencl->dev[devid].name, kind, test,
+         size, 1e3f*median, 1e3f*p95, median > 0.0f ? mpix/median : 0.0, median > 0.0f ? bytes/median/1e9 : 0.0);
+}
+
+// the programs of programs.conf by number, to name them in the report.
+static void
+_read_programs(char **names)
+{
+  char datadir[DT_MAX_PATH_LEN], filename[DT_MAX_PATH_LEN], line[DT_MAX_PATH_LEN], name[DT_MAX_PATH_LEN];
+  dt_loc_get_datadir(datadir, DT_MAX_PATH_LEN);
+  snprintf(filename, DT_MAX_PATH_LEN, "%s/kernels/programs.conf", datadir);
+  FILE *f = fopen(filename, "rb");
+  if(!f)
+  {
+    fprintf(stderr, "[cltest] could not open `%s'\n", filename);
+    return;
+  }
+  while(fgets(line, sizeof(line), f))
+  {
+    char *comment = strchr(line, '#');
+    if(comment) *comment = '\0';
+    int prog = -1;
+    if(sscanf(line, "%s %d", name, &prog) == 2 && prog >= 0 && prog < DT_OPENCL_MAX_PROGRAMS)
+    {
+      g_free(names[prog]);
+      names[prog] = g_strdup(name);
+    }
+  }
+  fclose(f);
+}
+
+// returns the number of programs which failed to build on the device.
+static int
+_report_programs(const int devid, char **names)
+{
+  dt_opencl_device_t *dev = darktable.opencl->dev + devid;
+  int built = 0, failed = 0;
+  for(int prog=0; prog<DT_OPENCL_MAX_PROGRAMS; prog++)
+  {
+    if(!names[prog]) continue;
+    if(dev->program_ready[prog] == 1) built++;
+    else
+    {
+      fprintf(stderr, "[cltest] device %d `%s': program `%s' failed to build\n", devid, dev->name, names[prog]);
+      failed++;
+    }
+  }
+  fprintf(stderr, "[cltest] device %d `%s': %d of %d programs built\n", devid, dev->name, built, built+failed);
+  return failed;
+}
+
+// times the copy helpers, host buffers are written or read as a whole each run.
+static int
+_bench_transfers(const int devid, const int size, float *host, float *times, const int runs)
+{
+  const int bpp = 4*sizeof(float);
+  const double bytes = (double)size*size*bpp;
+  cl_mem image = dt_opencl_alloc_device(devid, size, size, bpp);
+  cl_mem buffer = dt_opencl_alloc_device_buffer(devid, size*size*bpp);
+  if(!image || !buffer)
+  {
+    dt_opencl_release_mem_object(image);
+    dt_opencl_release_mem_object(buffer);
+    return 1;
+  }
+  int err = 0;
+  size_t origin[] = { 0, 0, 0 };
+  size_t region[] = { size, size, 1 };
+  for(int test=0; test<6; test++)
+  {
+    const char *name = NULL;
+    for(int r=-1; r<runs; r++)
+    {
+      // the first run is not counted, it pays for lazy allocations in the driver:
+      const double start = dt_get_wtime();
+      switch(test)
+      {
+        case 0:
+          name = "write_host_to_device";
+          err |= dt_opencl_write_host_to_device(devid, host, image, size, size, bpp);
+          break;
+        case 1:
+          name = "read_host_from_device";
+          err |= dt_opencl_read_host_from_device(devid, host, image, size, size, bpp);
+          break;
+        case 2:
+        {
+          name = "copy_host_to_device";
+          cl_mem tmp = dt_opencl_copy_host_to_device(devid, host, size, size, bpp);
+          err |= !tmp;
+          dt_opencl_finish(devid);
+          dt_opencl_release_mem_object(tmp);
+          break;
+        }
+        case 3:
+          name = "write_buffer_to_device";
+          err |= dt_opencl_write_buffer_to_device(devid, host, buffer, 0, size*size*bpp, TRUE);
+          break;
+        case 4:
+          name = "read_buffer_from_device";
+          err |= dt_opencl_read_buffer_from_device(devid, host, buffer, 0, size*size*bpp, TRUE);
+          break;
+        default:
+          name = "copy_image_to_buffer";
+          err |= dt_opencl_enqueue_copy_image_to_buffer(devid, image, buffer, origin, region, 0);
+          dt_opencl_finish(devid);
+          break;
+      }
+      if(r >= 0) times[r] = dt_get_wtime() - start;
+    }
+    dt_opencl_events_flush(devid, TRUE);
+    // device to device reads and writes the pixels once each:
+    _print_row(devid, "transfer", name, size, times, runs, test == 5 ? 2.0*bytes : bytes);
+  }
+  dt_opencl_release_mem_object(image);
+  dt_opencl_release_mem_object(buffer);
+  return err != 0;
+}
+
+static int
+_bench_kernel(const int devid, const int kernel, const dt_cltest_kernel_t *k, const int size,
+              cl_mem *in, cl_mem *out, float *times, const int runs)
+{
+  const float one = 1.0f, four[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+  const int zero = 0;
+  int num_in = 0, num_out = 0;
+  int err = 0;
+  for(int a=0; k->args[a]; a++)
+  {
+    switch(k->args[a])
+    {
+      case 'r': err |= dt_opencl_set_kernel_arg(devid, kernel, a, sizeof(cl_mem), in + num_in++); break;
+      case 'w': err |= dt_opencl_set_kernel_arg(devid, kernel, a, sizeof(cl_mem), out + num_out++); break;
+      case 'W':
+      case 'H': err |= dt_opencl_set_kernel_arg(devid, kernel, a, sizeof(int), &size); break;
+      case 'i': err |= dt_opencl_set_kernel_arg(devid, kernel, a, sizeof(int), &zero); break;
+      case 'f': err |= dt_opencl_set_kernel_arg(devid, kernel, a, sizeof(float), &one); break;
+      case 'v': err |= dt_opencl_set_kernel_arg(devid, kernel, a, 4*sizeof(float), four); break;
+    }
+  }
+  if(err) return 1;
+  size_t sizes[] = { ROUNDUPWD(size), ROUNDUPHT(size), 1 };
+  for(int r=-1; r<runs; r++)
+  {
+    const double start = dt_get_wtime();
+    err |= dt_opencl_enqueue_kernel_2d(devid, kernel, sizes);
+    dt_opencl_finish(devid);
+    if(r >= 0) times[r] = dt_get_wtime() - start;
+  }
+  dt_opencl_events_flush(devid, TRUE);
+  if(err) return 1;
+  _print_row(devid, "kernel", k->name, size, times, runs, (double)(num_in + num_out)*size*size*4*sizeof(float));
+  return 0;
+}
+
+static int
+_bench_device(const int devid, int *kernels, const int runs)
+{
+  const int bpp = 4*sizeof(float);
+  float *times = (float *)malloc(sizeof(float)*runs);
+  int failed = 0;
+  for(int s=0; s<DT_CLTEST_NUM_SIZES; s++)
+  {
+    const int size = _sizes[s];
+    if(!dt_opencl_image_fits_device(devid, size, size, bpp, DT_CLTEST_MAX_IMAGES + 2, 0))
+    {
+      fprintf(stderr, "[cltest] device %d `%s': skipping %dx%d, not enough memory\n", devid,
+              darktable.opencl->dev[devid].name, size, size);
+      continue;
+    }
+    // a smooth gradient, so kernels with data dependent branches see something plausible:
+    float *host = (float *)dt_alloc_align(16, (size_t)size*size*bpp);
+    for(int j=0; j<size; j++) for(int i=0; i<size; i++) for(int c=0; c<4; c++)
+      host[4*((size_t)j*size+i)+c] = (i + j + c*size/3)/(float)(2*size);
+
+    if(_bench_transfers(devid, size, host, times, runs))
+    {
+      fprintf(stderr, "[cltest] device %d `%s': transfers of %dx%d failed\n", devid,
+              darktable.opencl->dev[devid].name, size, size);
+      failed = 1;
+    }
+
+    cl_mem in[DT_CLTEST_MAX_IMAGES] = { NULL }, out[DT_CLTEST_MAX_IMAGES] = { NULL };
+    int err = 0;
+    for(int k=0; k<DT_CLTEST_MAX_IMAGES; k++)
+    {
+      in[k] = dt_opencl_copy_host_to_device(devid, host, size, size, bpp);
+      out[k] = dt_opencl_alloc_device(devid, size, size, bpp);
+      err |= !in[k] || !out[k];
+    }
+    for(int k=0; k<DT_CLTEST_NUM_KERNELS && !err; k++)
+    {
+      if(darktable.opencl->dev[devid].program_ready[_kernels[k].program] != 1) continue;
+      if(_bench_kernel(devid, kernels[k], _kernels + k, size, in, out, times, runs))
+      {
+        fprintf(stderr, "[cltest] device %d `%s': kernel `%s' failed at %dx%d\n", devid,
+                darktable.opencl->dev[devid].name, _kernels[k].name, size, size);
+        failed = 1;
+      }
+    }
+    for(int k=0; k<DT_CLTEST_MAX_IMAGES; k++)
+    {
+      dt_opencl_release_mem_object(in[k]);
+      dt_opencl_release_mem_object(out[k]);
+    }
+    free(host);
+  }
+  free(times);
+  return failed;
+}
+
 int main(int argc, char *arg[])
 {
+  int runs = 10;
+  int k;
+  for(k=1; k<argc; k++)
+  {
+    if(!strcmp(arg[k], "--help") || !strcmp(arg[k], "-h"))
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+    else if(!strcmp(arg[k], "--runs") && k+1 < argc)
+    {
+      k++;
+      runs = MAX(atoi(arg[k]), 1);
+    }
+    else if(!strcmp(arg[k], "--core"))
+    {
+      // everything from here on should be passed to the core
+      k++;
+      break;
+    }
+  }
+
   // only used to force-init opencl, so we want these options:
-  const int m_argc = 5;
-  char *m_arg[] = {"darktable-cltest", "-d", "opencl", "--library", ":memory:"};
+  int m_argc = 0;
+  char *m_arg[5 + argc - k];
+  m_arg[m_argc++] = "darktable-cltest";
+  m_arg[m_argc++] = "-d";
+  m_arg[m_argc++] = "opencl";
+  m_arg[m_argc++] = "--headless";
+  for(; k < argc; k++) m_arg[m_argc++] = arg[k];
+  m_arg[m_argc] = NULL;
   if(dt_init(m_argc, m_arg, 0)) exit(1);
-  exit(0);
+  if(!dt_opencl_is_inited())
+  {
+    fprintf(stderr, "[cltest] opencl could not be initialised\n");
+    dt_cleanup();
+    exit(1);
+  }
+
+  // every program of programs.conf is queued for every device by dt_init():
+  dt_opencl_wait_for_programs();
+  char *names[DT_OPENCL_MAX_PROGRAMS] = { NULL };
+  _read_programs(names);
+
+  int kernels[DT_CLTEST_NUM_KERNELS];
+  for(int i=0; i<DT_CLTEST_NUM_KERNELS; i++)
+    kernels[i] = dt_opencl_create_kernel(_kernels[i].program, _kernels[i].name);
+
+  int failed = 0;
+  printf("device\tkind\ttest\tsize\tmedian_ms\tp95_ms\tmpix_per_s\tgb_per_s\n");
+  for(int devid=0; devid<darktable.opencl->num_devs; devid++)
+  {
+    // further queues of a device measure the same hardware:
+    if(darktable.opencl->dev[devid].queue) continue;
+    failed |= _report_programs(devid, names) != 0;
+    failed |= _bench_device(devid, kernels, runs);
+  }
+
+  for(int i=0; i<DT_CLTEST_NUM_KERNELS; i++) dt_opencl_free_kernel(kernels[i]);
+  for(int prog=0; prog<DT_OPENCL_MAX_PROGRAMS; prog++) g_free(names[prog]);
+  dt_cleanup();
+  exit(failed);
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
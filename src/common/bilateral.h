@@ -19,6 +19,8 @@
 #ifndef DT_COMMON_BILATERAL_H
 #define DT_COMMON_BILATERAL_H
 
+#include <xmmintrin.h>
+
 #ifdef HAVE_OPENCL
 // function definition on opencl path takes precedence
 #include "common/bilateralcl.h"
@@ -37,7 +39,8 @@ dt_bilateral_memory_use(
   size_t size_y = CLAMPS((int)_y, 4, 900) + 1;
   size_t size_z = CLAMPS((int)_z, 4, 50) + 1;
 
-  return size_x*size_y*size_z*sizeof(float);
+  // the grid and the per thread slabs of dt_bilateral_splat()
+  return size_x*size_y*size_z*sizeof(float)*2;
 }
 
 
@@ -117,19 +120,21 @@ dt_bilateral_init(
   return b;
 }
 
-void
-dt_bilateral_splat(
-  dt_bilateral_t *b,
-  const float    *const in)
+// splat image rows [j0, j1) into a slab of the grid covering grid rows [y0, y0+ny)
+static void
+splat_rows(
+  const dt_bilateral_t *const b,
+  const float    *const in,
+  float          *slab,
+  const int       y0,
+  const int       ny,
+  const int       j0,
+  const int       j1)
 {
   const int ox = 1;
   const int oy = b->size_x;
-  const int oz = b->size_y*b->size_x;
-  // splat into downsampled grid
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(b)
-#endif
-  for(int j=0; j<b->height; j++)
+  const int oz = ny*b->size_x;
+  for(int j=j0; j<j1; j++)
   {
     int index = 4*j*b->width;
     for(int i=0; i<b->width; i++)
@@ -144,7 +149,7 @@ dt_bilateral_splat(
       const float yf = y - yi;
       const float zf = z - zi;
       // nearest neighbour splatting:
-      const int grid_index = xi + b->size_x*(yi + b->size_y*zi);
+      const int grid_index = xi + b->size_x*(yi - y0 + ny*zi);
       // sum up payload here, doesn't have to be same as edge stopping data
       // for cross bilateral applications.
       // also note that this is not clipped (as L->z is), so potentially hdr/out of gamut
@@ -154,16 +159,85 @@ dt_bilateral_splat(
         const int ii = grid_index + ((k&1)?ox:0) + ((k&2)?oy:0) + ((k&4)?oz:0);
         const float contrib = ((k&1)?xf:(1.0f-xf)) * ((k&2)?yf:(1.0f-yf)) * ((k&4)?zf:(1.0f-zf))
                               *100.0f/(b->sigma_s*b->sigma_s);
-#ifdef _OPENMP
-        #pragma omp atomic
-#endif
-        b->buf[ii] += contrib;
+        slab[ii] += contrib;
       }
       index += 4;
     }
   }
 }
 
+// first grid row touched by image row j
+static int
+grid_row(
+  const dt_bilateral_t *const b,
+  const int j)
+{
+  float x, y, z;
+  image_to_grid(b, 0, j, 0.0f, &x, &y, &z);
+  return MIN((int)y, b->size_y-2);
+}
+
+void
+dt_bilateral_splat(
+  dt_bilateral_t *b,
+  const float    *const in)
+{
+  // every thread splats a band of image rows into a private slab of the grid, which covers
+  // only the grid rows touched by the band. the slabs are summed up into the grid afterwards,
+  // so there is no contention on the grid and the result doesn't depend on the scheduling.
+  const int nbands = CLAMPS(omp_get_max_threads(), 1, MIN(b->height, b->size_y-1));
+  if(nbands == 1)
+  {
+    splat_rows(b, in, b->buf, 0, b->size_y, 0, b->height);
+    return;
+  }
+
+  int j0[nbands+1], y0[nbands], ny[nbands];
+  size_t off[nbands+1];
+  off[0] = 0;
+  for(int t=0; t<=nbands; t++) j0[t] = (int)((size_t)b->height*t/nbands);
+  for(int t=0; t<nbands; t++)
+  {
+    y0[t] = grid_row(b, j0[t]);
+    ny[t] = grid_row(b, j0[t+1]-1) + 2 - y0[t];
+    off[t+1] = off[t] + (size_t)b->size_x*ny[t]*b->size_z;
+  }
+
+  float *slabs = dt_alloc_align(16, off[nbands]*sizeof(float));
+  if(!slabs)
+  {
+    splat_rows(b, in, b->buf, 0, b->size_y, 0, b->height);
+    return;
+  }
+  memset(slabs, 0, off[nbands]*sizeof(float));
+
+#ifdef _OPENMP
+  #pragma omp parallel for shared(b, slabs, j0, y0, ny, off) schedule(static, 1)
+#endif
+  for(int t=0; t<nbands; t++)
+    splat_rows(b, in, slabs + off[t], y0[t], ny[t], j0[t], j0[t+1]);
+
+  // reduction: neighbouring slabs overlap in their boundary rows, so split the work along z
+#ifdef _OPENMP
+  #pragma omp parallel for shared(b, slabs, y0, ny, off) schedule(static)
+#endif
+  for(int z=0; z<b->size_z; z++)
+  {
+    for(int t=0; t<nbands; t++)
+    {
+      const float *slab = slabs + off[t] + (size_t)b->size_x*ny[t]*z;
+      float *grid = b->buf + (size_t)b->size_x*(y0[t] + b->size_y*z);
+      for(int k=0; k<b->size_x*ny[t]; k++) grid[k] += slab[k];
+    }
+  }
+
+  free(slabs);
+}
+
+// the blur passes below run along lines of size3 grid cells, spaced offset3 apart. if neighbouring
+// lines are adjacent in memory (offset2 == 1), four of them are filtered at once with sse, with the
+// same operations as the scalar code.
+
 static void
 blur_line_z(
   float    *buf,
@@ -177,13 +251,43 @@ blur_line_z(
   const float w1 = 4.f/16.f;
   const float w2 = 2.f/16.f;
 #ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(buf)
+  #pragma omp parallel for shared(buf)
 #endif
   for(int k=0; k<size1; k++)
   {
-    int index = k*offset1;
-    for(int j=0; j<size2; j++)
+    int j=0;
+    if(offset2 == 1)
+    {
+      const __m128 W1 = _mm_set1_ps(w1);
+      const __m128 W2 = _mm_set1_ps(w2);
+      for(; j+4<=size2; j+=4)
+      {
+        float *p = buf + k*offset1 + j;
+        __m128 tmp1 = _mm_loadu_ps(p);
+        _mm_storeu_ps(p, _mm_add_ps(_mm_mul_ps(W1, _mm_loadu_ps(p + offset3)), _mm_mul_ps(W2, _mm_loadu_ps(p + 2*offset3))));
+        p += offset3;
+        __m128 tmp2 = _mm_loadu_ps(p);
+        _mm_storeu_ps(p, _mm_add_ps(_mm_mul_ps(W1, _mm_sub_ps(_mm_loadu_ps(p + offset3), tmp1)),
+                                    _mm_mul_ps(W2, _mm_loadu_ps(p + 2*offset3))));
+        p += offset3;
+        for(int i=2; i<size3-2; i++)
+        {
+          const __m128 tmp3 = _mm_loadu_ps(p);
+          _mm_storeu_ps(p, _mm_add_ps(_mm_mul_ps(W1, _mm_sub_ps(_mm_loadu_ps(p + offset3), tmp2)),
+                                      _mm_mul_ps(W2, _mm_sub_ps(_mm_loadu_ps(p + 2*offset3), tmp1))));
+          p += offset3;
+          tmp1 = tmp2;
+          tmp2 = tmp3;
+        }
+        const __m128 tmp3 = _mm_loadu_ps(p);
+        _mm_storeu_ps(p, _mm_sub_ps(_mm_mul_ps(W1, _mm_sub_ps(_mm_loadu_ps(p + offset3), tmp2)), _mm_mul_ps(W2, tmp1)));
+        p += offset3;
+        _mm_storeu_ps(p, _mm_sub_ps(_mm_xor_ps(_mm_mul_ps(W1, tmp3), _mm_set1_ps(-0.0f)), _mm_mul_ps(W2, tmp2)));
+      }
+    }
+    for(; j<size2; j++)
     {
+      int index = k*offset1 + j*offset2;
       float tmp1 = buf[index];
       buf[index] = w1*buf[index + offset3] + w2*buf[index + 2*offset3];
       index += offset3;
@@ -204,8 +308,6 @@ blur_line_z(
       buf[index] = w1*(buf[index + offset3] - tmp2) - w2*tmp1;
       index += offset3;
       buf[index] = - w1*tmp3 - w2*tmp2;
-      index += offset3;
-      index += offset2 - offset3*size3;
     }
   }
 }
@@ -224,13 +326,46 @@ blur_line(
   const float w1 = 4.f/16.f;
   const float w2 = 1.f/16.f;
 #ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(buf)
+  #pragma omp parallel for shared(buf)
 #endif
   for(int k=0; k<size1; k++)
   {
-    int index = k*offset1;
-    for(int j=0; j<size2; j++)
+    int j=0;
+    if(offset2 == 1)
+    {
+      const __m128 W0 = _mm_set1_ps(w0);
+      const __m128 W1 = _mm_set1_ps(w1);
+      const __m128 W2 = _mm_set1_ps(w2);
+      for(; j+4<=size2; j+=4)
+      {
+        float *p = buf + k*offset1 + j;
+        __m128 tmp1 = _mm_loadu_ps(p);
+        _mm_storeu_ps(p, _mm_add_ps(_mm_add_ps(_mm_mul_ps(tmp1, W0), _mm_mul_ps(W1, _mm_loadu_ps(p + offset3))),
+                                    _mm_mul_ps(W2, _mm_loadu_ps(p + 2*offset3))));
+        p += offset3;
+        __m128 tmp2 = _mm_loadu_ps(p);
+        _mm_storeu_ps(p, _mm_add_ps(_mm_add_ps(_mm_mul_ps(tmp2, W0), _mm_mul_ps(W1, _mm_add_ps(_mm_loadu_ps(p + offset3), tmp1))),
+                                    _mm_mul_ps(W2, _mm_loadu_ps(p + 2*offset3))));
+        p += offset3;
+        for(int i=2; i<size3-2; i++)
+        {
+          const __m128 tmp3 = _mm_loadu_ps(p);
+          _mm_storeu_ps(p, _mm_add_ps(_mm_add_ps(_mm_mul_ps(tmp3, W0), _mm_mul_ps(W1, _mm_add_ps(_mm_loadu_ps(p + offset3), tmp2))),
+                                      _mm_mul_ps(W2, _mm_add_ps(_mm_loadu_ps(p + 2*offset3), tmp1))));
+          p += offset3;
+          tmp1 = tmp2;
+          tmp2 = tmp3;
+        }
+        const __m128 tmp3 = _mm_loadu_ps(p);
+        _mm_storeu_ps(p, _mm_add_ps(_mm_add_ps(_mm_mul_ps(tmp3, W0), _mm_mul_ps(W1, _mm_add_ps(_mm_loadu_ps(p + offset3), tmp2))),
+                                    _mm_mul_ps(W2, tmp1)));
+        p += offset3;
+        _mm_storeu_ps(p, _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(p), W0), _mm_mul_ps(W1, tmp3)), _mm_mul_ps(W2, tmp2)));
+      }
+    }
+    for(; j<size2; j++)
     {
+      int index = k*offset1 + j*offset2;
       float tmp1 = buf[index];
       buf[index] = buf[index]*w0 + w1*buf[index + offset3] + w2*buf[index + 2*offset3];
       index += offset3;
@@ -251,8 +386,6 @@ blur_line(
       buf[index] = buf[index]*w0 + w1*(buf[index + offset3] + tmp2) + w2*tmp1;
       index += offset3;
       buf[index] = buf[index]*w0 + w1*tmp3 + w2*tmp2;
-      index += offset3;
-      index += offset2 - offset3*size3;
     }
   }
 }
@@ -269,8 +402,9 @@ dt_bilateral_blur(
   blur_line(b->buf, b->size_x*b->size_y, 1, b->size_x,
             b->size_z, b->size_x, b->size_y);
   // -2 derivative of the gaussian up to 3 sigma: x*exp(-x*x)
-  blur_line_z(b->buf, 1, b->size_x, b->size_x*b->size_y,
-              b->size_x, b->size_y, b->size_z);
+  // (lines of neighbouring x are adjacent, so they go to the inner loop)
+  blur_line_z(b->buf, b->size_x, 1, b->size_x*b->size_y,
+              b->size_y, b->size_x, b->size_z);
 }
 
 
@@ -0,0 +1,231 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/darktable.h"
+#include "common/box_filters.h"
+
+#include <assert.h>
+#include <string.h>
+#include <xmmintrin.h>
+
+// floats per block of the vertical pass, one cache line:
+#define BOX_COLUMN_BLOCK 16
+
+// one row of single floats, through scratch:
+static void
+_box_mean_row_1c(float *const row, float *const scratch, const int width, const int radius)
+{
+  float L = 0.0f;
+  int hits = 0;
+  for(int x=-radius; x<width; x++)
+  {
+    const int op = x - radius - 1;
+    const int np = x + radius;
+    if(op >= 0)
+    {
+      L -= row[op];
+      hits--;
+    }
+    if(np < width)
+    {
+      L += row[np];
+      hits++;
+    }
+    if(x >= 0) scratch[x] = L/hits;
+  }
+  memcpy(row, scratch, sizeof(float)*width);
+}
+
+// one row of four channel pixels, all channels at once:
+static void
+_box_mean_row_4c(float *const row, float *const scratch, const int width, const int radius)
+{
+  __m128 L = _mm_setzero_ps();
+  int hits = 0;
+  for(int x=-radius; x<width; x++)
+  {
+    const int op = x - radius - 1;
+    const int np = x + radius;
+    if(op >= 0)
+    {
+      L = _mm_sub_ps(L, _mm_loadu_ps(row + 4*op));
+      hits--;
+    }
+    if(np < width)
+    {
+      L = _mm_add_ps(L, _mm_loadu_ps(row + 4*np));
+      hits++;
+    }
+    if(x >= 0) _mm_storeu_ps(scratch + 4*x, _mm_div_ps(L, _mm_set1_ps(hits)));
+  }
+  memcpy(row, scratch, sizeof(float)*4*width);
+}
+
+// n floats of every row, starting at buf. the vertical pass doesn't care about channels, and a block
+// of a full cache line keeps the strided walk down the columns cheap.
+static void
+_box_mean_columns(float *const buf, float *const scratch, const int height, const size_t stride,
+                  const int n, const int radius)
+{
+  if(n == BOX_COLUMN_BLOCK)
+  {
+    __m128 L[4] = { _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps() };
+    int hits = 0;
+    for(int y=-radius; y<height; y++)
+    {
+      const int op = y - radius - 1;
+      const int np = y + radius;
+      if(op >= 0)
+      {
+        for(int k=0; k<4; k++) L[k] = _mm_sub_ps(L[k], _mm_loadu_ps(buf + op*stride + 4*k));
+        hits--;
+      }
+      if(np < height)
+      {
+        for(int k=0; k<4; k++) L[k] = _mm_add_ps(L[k], _mm_loadu_ps(buf + np*stride + 4*k));
+        hits++;
+      }
+      if(y >= 0)
+      {
+        const __m128 h = _mm_set1_ps(hits);
+        for(int k=0; k<4; k++) _mm_storeu_ps(scratch + BOX_COLUMN_BLOCK*y + 4*k, _mm_div_ps(L[k], h));
+      }
+    }
+  }
+  else
+  {
+    // the rest of the row:
+    for(int k=0; k<n; k++)
+    {
+      float L = 0.0f;
+      int hits = 0;
+      for(int y=-radius; y<height; y++)
+      {
+        const int op = y - radius - 1;
+        const int np = y + radius;
+        if(op >= 0)
+        {
+          L -= buf[op*stride + k];
+          hits--;
+        }
+        if(np < height)
+        {
+          L += buf[np*stride + k];
+          hits++;
+        }
+        if(y >= 0) scratch[BOX_COLUMN_BLOCK*y + k] = L/hits;
+      }
+    }
+  }
+  for(int y=0; y<height; y++)
+    memcpy(buf + y*stride, scratch + BOX_COLUMN_BLOCK*y, sizeof(float)*n);
+}
+
+void dt_box_mean(float *const buf, const int width, const int height, const int ch,
+                 const int radius, const int iterations)
+{
+  assert(ch == 1 || ch == 4);
+  if(radius <= 0 || width <= 0 || height <= 0) return;
+
+  const size_t stride = (size_t)width*ch;
+  const size_t scratch_size = MAX(stride, (size_t)BOX_COLUMN_BLOCK*height);
+  float *const scratch = dt_alloc_align(64, sizeof(float)*scratch_size*dt_get_num_threads());
+  if(!scratch) return;
+  const int blocks = (stride + BOX_COLUMN_BLOCK - 1)/BOX_COLUMN_BLOCK;
+
+  for(int iteration=0; iteration<iterations; iteration++)
+  {
+#ifdef _OPENMP
+    #pragma omp parallel for default(none) schedule(static)
+#endif
+    for(int y=0; y<height; y++)
+    {
+      float *const s = scratch + scratch_size*dt_get_thread_num();
+      if(ch == 4) _box_mean_row_4c(buf + y*stride, s, width, radius);
+      else        _box_mean_row_1c(buf + y*stride, s, width, radius);
+    }
+
+#ifdef _OPENMP
+    #pragma omp parallel for default(none) schedule(static)
+#endif
+    for(int b=0; b<blocks; b++)
+    {
+      float *const s = scratch + scratch_size*dt_get_thread_num();
+      const size_t x = (size_t)b*BOX_COLUMN_BLOCK;
+      _box_mean_columns(buf + x, s, height, stride, MIN(BOX_COLUMN_BLOCK, stride - x), radius);
+    }
+  }
+  free(scratch);
+}
+
+#ifdef HAVE_OPENCL
+dt_box_mean_cl_global_t *
+dt_box_mean_init_cl_global()
+{
+  dt_box_mean_cl_global_t *g = (dt_box_mean_cl_global_t *)malloc(sizeof(dt_box_mean_cl_global_t));
+
+  const int program = 21;   // box_filters.cl, from programs.conf
+  g->kernel_box_mean_horizontal = dt_opencl_create_kernel(program, "box_mean_horizontal");
+  g->kernel_box_mean_vertical   = dt_opencl_create_kernel(program, "box_mean_vertical");
+  return g;
+}
+
+void
+dt_box_mean_free_cl_global(dt_box_mean_cl_global_t *g)
+{
+  if(!g) return;
+  dt_opencl_free_kernel(g->kernel_box_mean_horizontal);
+  dt_opencl_free_kernel(g->kernel_box_mean_vertical);
+  free(g);
+}
+
+cl_int
+dt_box_mean_cl(const int devid, cl_mem dev_buf, cl_mem dev_tmp, const int width, const int height,
+               const int radius, const int iterations)
+{
+  if(radius <= 0) return CL_SUCCESS;
+  const dt_box_mean_cl_global_t *g = darktable.opencl->box_mean;
+  cl_int err = CL_SUCCESS;
+  // one work item per row or column, each runs its sum along it:
+  size_t rows[] = { ROUNDUPHT(height), 1, 1 };
+  size_t columns[] = { ROUNDUPWD(width), 1, 1 };
+  for(int iteration=0; iteration<iterations; iteration++)
+  {
+    dt_opencl_set_kernel_arg(devid, g->kernel_box_mean_horizontal, 0, sizeof(cl_mem), (void *)&dev_buf);
+    dt_opencl_set_kernel_arg(devid, g->kernel_box_mean_horizontal, 1, sizeof(cl_mem), (void *)&dev_tmp);
+    dt_opencl_set_kernel_arg(devid, g->kernel_box_mean_horizontal, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, g->kernel_box_mean_horizontal, 3, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, g->kernel_box_mean_horizontal, 4, sizeof(int), (void *)&radius);
+    err = dt_opencl_enqueue_kernel_2d(devid, g->kernel_box_mean_horizontal, rows);
+    if(err != CL_SUCCESS) return err;
+
+    dt_opencl_set_kernel_arg(devid, g->kernel_box_mean_vertical, 0, sizeof(cl_mem), (void *)&dev_tmp);
+    dt_opencl_set_kernel_arg(devid, g->kernel_box_mean_vertical, 1, sizeof(cl_mem), (void *)&dev_buf);
+    dt_opencl_set_kernel_arg(devid, g->kernel_box_mean_vertical, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, g->kernel_box_mean_vertical, 3, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, g->kernel_box_mean_vertical, 4, sizeof(int), (void *)&radius);
+    err = dt_opencl_enqueue_kernel_2d(devid, g->kernel_box_mean_vertical, columns);
+    if(err != CL_SUCCESS) return err;
+  }
+  return err;
+}
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,53 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_COMMON_BOX_FILTERS_H
+#define DT_COMMON_BOX_FILTERS_H
+
+#include "common/opencl.h"
+
+/**
+ * blurs buf in place with a box of 2*radius+1 pixels, first along the rows, then along the
+ * columns, iterations times. a few iterations come close to a gaussian. the box shrinks at the
+ * borders of the image. running sums make the cost independent of the radius.
+ * ch is 1 or 4 floats per pixel.
+ */
+void dt_box_mean(float *const buf, const int width, const int height, const int ch,
+                 const int radius, const int iterations);
+
+#ifdef HAVE_OPENCL
+typedef struct dt_box_mean_cl_global_t
+{
+  int kernel_box_mean_horizontal, kernel_box_mean_vertical;
+}
+dt_box_mean_cl_global_t;
+
+dt_box_mean_cl_global_t *dt_box_mean_init_cl_global(void);
+
+void dt_box_mean_free_cl_global(dt_box_mean_cl_global_t *g);
+
+/** the same on an image on the device, of 1 or 4 channels. dev_tmp is an image of the same size and
+ * format, the result ends up in dev_buf. */
+cl_int dt_box_mean_cl(const int devid, cl_mem dev_buf, cl_mem dev_tmp, const int width, const int height,
+                      const int radius, const int iterations);
+#endif
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
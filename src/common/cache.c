@@ -53,7 +53,7 @@ typedef struct dt_cache_bucket_t
   int32_t  cost;   // cost associated with this entry (such as byte size)
   uint32_t hash;   // hash of the element
   uint32_t key;    // key of the element
-  // due to alignment, we waste 32 bits here
+  uint32_t referenced; // clock replacement: set on read hits, cleared by gc
   void*    data;   // actual data
 }
 dt_cache_bucket_t;
@@ -85,6 +85,18 @@ dt_cache_unlock(uint32_t *lock)
   __sync_val_compare_and_swap(lock, 1, 0);
 }
 
+// take the lru lock and keep track of how often we had to spin for it
+static inline void
+dt_cache_lock_lru(dt_cache_t *cache)
+{
+  __sync_fetch_and_add(&cache->lru_lock_acquired, 1);
+  if(dt_cache_testlock(&cache->lru_lock))
+  {
+    __sync_fetch_and_add(&cache->lru_lock_contended, 1);
+    dt_cache_lock(&cache->lru_lock);
+  }
+}
+
 static uint32_t
 nearest_power_of_two(const uint32_t value)
 {
@@ -240,6 +252,7 @@ add_key_to_beginning_of_list(
   free_bucket->key  = key;
   free_bucket->hash = hash;
   free_bucket->cost = cost;
+  free_bucket->referenced = 0;
 
   if(keys_bucket->first_delta == 0)
   {
@@ -279,6 +292,7 @@ add_key_to_end_of_list(
   free_bucket->key  = key;
   free_bucket->hash = hash;
   free_bucket->cost = cost;
+  free_bucket->referenced = 0;
   free_bucket->next_delta = DT_CACHE_NULL_DELTA;
 
   if(last_bucket == NULL)
@@ -374,6 +388,9 @@ dt_cache_init(dt_cache_t *cache, const int32_t capacity, const int32_t num_threa
   cache->cost = 0;
   cache->cost_quota = cost_quota;
   cache->lru_lock = 0;
+  cache->replacement = DT_CACHE_REPLACEMENT_LRU;
+  cache->lru_lock_acquired = 0;
+  cache->lru_lock_contended = 0;
   cache->allocate = NULL;
   cache->allocate_data = NULL;
   cache->cleanup = NULL;
@@ -393,6 +410,7 @@ dt_cache_init(dt_cache_t *cache, const int32_t capacity, const int32_t num_threa
     cache->table[k].data        = DT_CACHE_EMPTY_DATA;
     cache->table[k].read        = 0;
     cache->table[k].write       = 0;
+    cache->table[k].referenced  = 0;
     cache->table[k].lru         = -2;
     cache->table[k].mru         = -2;
   }
@@ -542,7 +560,7 @@ void
 lru_remove_locked(dt_cache_t        *cache,
                   dt_cache_bucket_t *bucket)
 {
-  dt_cache_lock(&cache->lru_lock);
+  dt_cache_lock_lru(cache);
   lru_remove(cache, bucket);
   dt_cache_unlock(&cache->lru_lock);
 }
@@ -551,11 +569,23 @@ void
 lru_insert_locked(dt_cache_t        *cache,
                   dt_cache_bucket_t *bucket)
 {
-  dt_cache_lock(&cache->lru_lock);
+  dt_cache_lock_lru(cache);
   lru_insert(cache, bucket);
   dt_cache_unlock(&cache->lru_lock);
 }
 
+// a read hit: either move to the front of the lru list or,
+// in clock mode, just mark as referenced without any global lock.
+// must not hold the lru lock!
+static inline void
+dt_cache_touch(dt_cache_t *cache, dt_cache_bucket_t *bucket)
+{
+  if(cache->replacement == DT_CACHE_REPLACEMENT_CLOCK)
+    bucket->referenced = 1;
+  else
+    lru_insert_locked(cache, bucket);
+}
+
 int
 dt_cache_for_all(
   dt_cache_t *cache,
@@ -563,7 +593,7 @@ dt_cache_for_all(
   void *user_data)
 {
   // this is not thread safe.
-  //dt_cache_lock(&cache->lru_lock);
+  //dt_cache_lock_lru(cache);
   int32_t curr = cache->mru;
   while(curr >= 0)
   {
@@ -587,7 +617,7 @@ dt_cache_for_all(
 int32_t
 lru_check_consistency(dt_cache_t *cache)
 {
-  dt_cache_lock(&cache->lru_lock);
+  dt_cache_lock_lru(cache);
   int32_t curr = cache->lru;
   int32_t cnt = 1;
   while(curr >= 0 && curr != cache->mru)
@@ -603,7 +633,7 @@ lru_check_consistency(dt_cache_t *cache)
 int32_t
 lru_check_consistency_reverse(dt_cache_t *cache)
 {
-  dt_cache_lock(&cache->lru_lock);
+  dt_cache_lock_lru(cache);
   int32_t curr = cache->mru;
   int32_t cnt = 1;
   while(curr >= 0 && curr != cache->lru)
@@ -645,7 +675,7 @@ dt_cache_read_testget(
       dt_cache_unlock(&segment->lock);
       if(err) return NULL;
       // move this to the  most recently used slot, too:
-      lru_insert_locked(cache, compare_bucket);
+      dt_cache_touch(cache, compare_bucket);
       return rc;
     }
     next_delta = compare_bucket->next_delta;
@@ -695,7 +725,7 @@ retry_cache_full:
         // actually all good, just we couldn't get a lock on the bucket.
         if(err) goto wait;
         // move this to the  most recently used slot, too:
-        lru_insert_locked(cache, compare_bucket);
+        dt_cache_touch(cache, compare_bucket);
         // found and locked:
         return rc;
       }
@@ -755,7 +785,7 @@ wait:
   {
     if(free_max_bucket->hash == DT_CACHE_EMPTY_HASH)
     {
-      dt_cache_lock(&cache->lru_lock);
+      dt_cache_lock_lru(cache);
       if(free_max_bucket->hash == DT_CACHE_EMPTY_HASH)
       {
         // try that again if it's still empty
@@ -784,7 +814,7 @@ wait:
   {
     if(free_min_bucket->hash == DT_CACHE_EMPTY_HASH)
     {
-      dt_cache_lock(&cache->lru_lock);
+      dt_cache_lock_lru(cache);
       if(free_min_bucket->hash == DT_CACHE_EMPTY_HASH)
       {
         dt_cache_bucket_read_lock(free_min_bucket);
@@ -876,7 +906,9 @@ dt_cache_remove_no_lru_lock(dt_cache_t *cache, const uint32_t key)
 {
   const uint32_t hash = key;
   dt_cache_segment_t *segment = cache->segments + ((hash >> cache->segment_shift) & cache->segment_mask);
-  dt_cache_lock(&segment->lock);
+  // we hold the lru lock, and read_get takes it while holding the segment lock.
+  // waiting for the segment here can deadlock, treat the entry as busy instead:
+  if(dt_cache_testlock(&segment->lock)) return 1;
 
   dt_cache_bucket_t *const start_bucket = cache->table + (hash & cache->bucket_mask);
   dt_cache_bucket_t *last_bucket = NULL;
@@ -922,7 +954,8 @@ dt_cache_remove_bucket_no_lru_lock(dt_cache_t *cache, const uint32_t num)
   // dt_cache_remove works on key, not bucket number, so translate that:
   const uint32_t hash = num;
   dt_cache_segment_t *segment = cache->segments + ((hash >> cache->segment_shift) & cache->segment_mask);
-  dt_cache_lock(&segment->lock);
+  // same as above:
+  if(dt_cache_testlock(&segment->lock)) return 1;
 
   dt_cache_bucket_t *const curr_bucket = cache->table + (hash & cache->bucket_mask);
   const uint32_t key = curr_bucket->key;
@@ -951,14 +984,14 @@ dt_cache_gc(dt_cache_t *cache, const float fill_ratio)
 #endif
 #ifdef DT_CACHE_BFL
   // sorry, bfl
-  dt_cache_lock(&cache->lru_lock);
+  dt_cache_lock_lru(cache);
 #endif
   int32_t curr;
   // get least recently used bucket
 #ifdef DT_CACHE_BFL
   curr = cache->lru;
 #else
-  dt_cache_lock(&cache->lru_lock);
+  dt_cache_lock_lru(cache);
   curr = cache->lru;
   dt_cache_unlock(&cache->lru_lock);
 #endif
@@ -995,7 +1028,21 @@ dt_cache_gc(dt_cache_t *cache, const float fill_ratio)
     // and the lru not cleaned up yet, but another image already occupies that slot...
     // it will be read locked and we go on. very worst case we clean up the wrong image.
 #ifdef DT_CACHE_BFL
+    if(cache->replacement == DT_CACHE_REPLACEMENT_CLOCK && cache->table[curr].referenced)
+    {
+      // clock hand passes a recently used entry: clear the bit and give it
+      // a second chance at the most recently used end of the list.
+      const int32_t next = cache->table[curr].mru;
+      cache->table[curr].referenced = 0;
+      lru_insert(cache, cache->table + curr);
+      curr = next;
+      i++;
+      continue;
+    }
+    // removal resets the list pointers of curr, remember where to go next:
+    const int32_t next = cache->table[curr].mru;
     const int err = dt_cache_remove_bucket_no_lru_lock(cache, curr);
+    if(!err) curr = next;
 #else
     const int err = dt_cache_remove_bucket(cache, curr);
 #endif
@@ -1006,7 +1053,7 @@ dt_cache_gc(dt_cache_t *cache, const float fill_ratio)
 #ifdef DT_CACHE_BFL
       curr = cache->table[curr].mru;
 #else
-      dt_cache_lock(&cache->lru_lock);
+      dt_cache_lock_lru(cache);
       curr = cache->table[curr].mru;
       dt_cache_unlock(&cache->lru_lock);
 #endif
@@ -1167,6 +1214,10 @@ dt_cache_write_release(dt_cache_t *cache, const uint32_t key)
 
 void dt_cache_print(dt_cache_t *cache)
 {
+  fprintf(stderr, "[cache] %s replacement, lru lock taken %u times, contended %u times (%.2f%%)\n",
+          cache->replacement == DT_CACHE_REPLACEMENT_CLOCK ? "clock" : "lru",
+          cache->lru_lock_acquired, cache->lru_lock_contended,
+          cache->lru_lock_acquired ? 100.0f*cache->lru_lock_contended/(float)cache->lru_lock_acquired : 0.0f);
   fprintf(stderr, "[cache] full entries:\n");
   for(uint32_t k=0; k<=cache->bucket_mask; k++)
   {
@@ -1178,7 +1229,7 @@ void dt_cache_print(dt_cache_t *cache)
               k, cache->table[k].read, cache->table[k].write);
   }
   fprintf(stderr, "[cache] lru entries:\n");
-  dt_cache_lock(&cache->lru_lock);
+  dt_cache_lock_lru(cache);
   int32_t curr = cache->lru;
   while(curr >= 0)
   {
@@ -1203,7 +1254,7 @@ void dt_cache_print(dt_cache_t *cache)
 void dt_cache_print_locked(dt_cache_t *cache)
 {
   fprintf(stderr, "[cache] locked lru entries:\n");
-  dt_cache_lock(&cache->lru_lock);
+  dt_cache_lock_lru(cache);
   int32_t curr = cache->lru;
   int32_t i = 0;
   while(curr >= 0)
@@ -24,6 +24,15 @@
 struct dt_cache_segment_t;
 struct dt_cache_bucket_t;
 
+typedef enum dt_cache_replacement_t
+{
+  // strict lru: every hit moves the entry to the front of the list (takes the lru lock).
+  DT_CACHE_REPLACEMENT_LRU = 0,
+  // clock/second chance: hits only set a reference bit, gc gives referenced entries another round.
+  DT_CACHE_REPLACEMENT_CLOCK = 1
+}
+dt_cache_replacement_t;
+
 typedef struct dt_cache_t
 {
   uint32_t segment_shift;
@@ -39,6 +48,11 @@ typedef struct dt_cache_t
   int cost_quota;
   // one fat lru lock, no use locking segments and possibly rolling back changes.
   uint32_t lru_lock;
+  // replacement strategy, in clock mode read hits don't touch the lru lock at all.
+  dt_cache_replacement_t replacement;
+  // statistics: how often the lru lock was taken, and how often we had to spin for it.
+  uint32_t lru_lock_acquired;
+  uint32_t lru_lock_contended;
 
   // callback functions for cache misses/garbage collection
   // allocate should return != 0 if a write lock on alloc is needed.
@@ -70,6 +84,13 @@ dt_cache_set_allocate_callback(
   cache->allocate_data = allocate_data;
 }
 static inline void
+dt_cache_set_replacement(
+  dt_cache_t *cache,
+  const dt_cache_replacement_t replacement)
+{
+  cache->replacement = replacement;
+}
+static inline void
 dt_cache_set_cleanup_callback(
   dt_cache_t *cache,
   void (*cleanup)(void*, const uint32_t, void*),
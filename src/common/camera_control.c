@@ -20,6 +20,7 @@
 #include "config.h"
 #endif
 #include "common/camera_control.h"
+#include "common/imageio_jpeg.h"
 #include "control/control.h"
 #include "libraw/libraw.h"
 #include <gphoto2/gphoto2-file.h>
@@ -315,22 +316,27 @@ static void _camera_process_job(const dt_camctl_t *c,const dt_camera_t *camera,
       }
       else
       {
-        // everything worked
-        GdkPixbufLoader *loader = gdk_pixbuf_loader_new();
-        if(gdk_pixbuf_loader_write(loader, (guchar*)data, data_size, NULL) == TRUE)
+        // everything worked, hand the compressed frame over to the decoder thread. a frame the decoder
+        // didn't get to yet is simply overwritten: when decoding or drawing falls behind we drop, never queue.
+        dt_pthread_mutex_lock(&cam->live_view_frame_mutex);
+        if(cam->live_view_jpeg_alloc[0] < data_size)
         {
-          dt_pthread_mutex_lock(&cam->live_view_pixbuf_mutex);
-          if(cam->live_view_pixbuf != NULL)
-            g_object_unref(cam->live_view_pixbuf);
-          cam->live_view_pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
-          dt_pthread_mutex_unlock(&cam->live_view_pixbuf_mutex);
+          g_free(cam->live_view_jpeg[0]);
+          cam->live_view_jpeg[0] = g_malloc(data_size);
+          cam->live_view_jpeg_alloc[0] = data_size;
         }
-        gdk_pixbuf_loader_close(loader, NULL);
+        memcpy(cam->live_view_jpeg[0], data, data_size);
+        cam->live_view_jpeg_size[0] = data_size;
+        if(cam->live_view_frame_waiting)
+          cam->live_view_frames_dropped++;
+        cam->live_view_frame_waiting = TRUE;
+        pthread_cond_signal(&cam->live_view_frame_cond);
+        dt_pthread_mutex_unlock(&cam->live_view_frame_mutex);
       }
       if(fp)
         gp_file_free(fp);
+      // the camera is free for the next capture while the decoder is still busy with this one
       dt_pthread_mutex_unlock(&cam->live_view_synch);
-      dt_control_queue_redraw_center();
     }
     break;
 
@@ -437,6 +443,74 @@ static void *dt_camctl_camera_get_live_view(void* data)
   return NULL;
 }
 
+/** pick the largest dct downscale that still covers the display size */
+static int _camctl_live_view_scale(const dt_camera_t *cam, const int width, const int height)
+{
+  int tw = cam->live_view_target_width, th = cam->live_view_target_height;
+  if(cam->live_view_zoom == TRUE || tw <= 0 || th <= 0) return 1;
+  for(int denom = 8; denom > 1; denom /= 2)
+    if((width+denom-1)/denom >= tw && (height+denom-1)/denom >= th)
+      return denom;
+  return 1;
+}
+
+static void *dt_camctl_camera_decode_live_view(void* data)
+{
+  dt_camera_t *cam = (dt_camera_t*)data;
+  dt_print (DT_DEBUG_CAMCTL,"[camera_control] live view decoder thread started\n");
+
+  while(1)
+  {
+    dt_pthread_mutex_lock(&cam->live_view_frame_mutex);
+    while(cam->live_view_frame_waiting == FALSE && cam->is_live_viewing == TRUE)
+      dt_pthread_cond_wait(&cam->live_view_frame_cond, &cam->live_view_frame_mutex);
+    if(cam->live_view_frame_waiting == FALSE)
+    {
+      dt_pthread_mutex_unlock(&cam->live_view_frame_mutex);
+      break;
+    }
+    // take the newest frame, leaving our old buffer for the camera to fill
+    uint8_t *jpeg = cam->live_view_jpeg[0];
+    cam->live_view_jpeg[0] = cam->live_view_jpeg[1];
+    cam->live_view_jpeg[1] = jpeg;
+    size_t tmp = cam->live_view_jpeg_alloc[0];
+    cam->live_view_jpeg_alloc[0] = cam->live_view_jpeg_alloc[1];
+    cam->live_view_jpeg_alloc[1] = tmp;
+    const size_t size = cam->live_view_jpeg_size[0];
+    cam->live_view_frame_waiting = FALSE;
+    dt_pthread_mutex_unlock(&cam->live_view_frame_mutex);
+
+    dt_imageio_jpeg_t jpg;
+    if(dt_imageio_jpeg_decompress_header(jpeg, size, &jpg))
+    {
+      dt_print(DT_DEBUG_CAMCTL,"[camera_control] live view failed to decode preview header\n");
+      continue;
+    }
+    dt_imageio_jpeg_decompress_scale(&jpg, _camctl_live_view_scale(cam, jpg.width, jpg.height));
+
+    // only the decoder touches the back buffer, so it is filled without holding the pixbuf lock
+    GdkPixbuf *back = cam->live_view_pixbuf_back;
+    if(back == NULL || gdk_pixbuf_get_width(back) != jpg.width || gdk_pixbuf_get_height(back) != jpg.height)
+    {
+      if(back) g_object_unref(back);
+      back = cam->live_view_pixbuf_back = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, jpg.width, jpg.height);
+    }
+    if(dt_imageio_jpeg_decompress_rgb(&jpg, gdk_pixbuf_get_pixels(back), gdk_pixbuf_get_rowstride(back)))
+    {
+      dt_print(DT_DEBUG_CAMCTL,"[camera_control] live view failed to decode preview\n");
+      continue;
+    }
+
+    dt_pthread_mutex_lock(&cam->live_view_pixbuf_mutex);
+    cam->live_view_pixbuf_back = cam->live_view_pixbuf;
+    cam->live_view_pixbuf = back;
+    dt_pthread_mutex_unlock(&cam->live_view_pixbuf_mutex);
+    dt_control_queue_redraw_center();
+  }
+  dt_print (DT_DEBUG_CAMCTL,"[camera_control] live view decoder thread stopped, %u frames dropped\n", cam->live_view_frames_dropped);
+  return NULL;
+}
+
 gboolean dt_camctl_camera_start_live_view(const dt_camctl_t *c)
 {
   dt_camctl_t *camctl = (dt_camctl_t*)c;
@@ -455,7 +529,10 @@ gboolean dt_camctl_camera_start_live_view(const dt_camctl_t *c)
     return FALSE;
   }
   cam->is_live_viewing = TRUE;
+  cam->live_view_frame_waiting = FALSE;
+  cam->live_view_frames_dropped = 0;
   dt_camctl_camera_set_property_int(camctl, NULL, "eosviewfinder", 1);
+  pthread_create(&cam->live_view_decoder_thread, NULL, &dt_camctl_camera_decode_live_view, (void*)cam);
   pthread_create(&cam->live_view_thread, NULL, &dt_camctl_camera_get_live_view, (void*)camctl);
   return TRUE;
 }
@@ -467,6 +544,11 @@ void dt_camctl_camera_stop_live_view(const dt_camctl_t *c)
   dt_print(DT_DEBUG_CAMCTL,"[camera_control] Stopping live view\n");
   cam->is_live_viewing = FALSE;
   pthread_join(cam->live_view_thread, NULL);
+  dt_pthread_mutex_lock(&cam->live_view_frame_mutex);
+  cam->live_view_frame_waiting = FALSE;
+  pthread_cond_signal(&cam->live_view_frame_cond);
+  dt_pthread_mutex_unlock(&cam->live_view_frame_mutex);
+  pthread_join(cam->live_view_decoder_thread, NULL);
   //tell camera to get back to normal state (close mirror)
   dt_camctl_camera_set_property_int(camctl, NULL, "eosviewfinder", 0);
 }
@@ -536,6 +618,10 @@ static void dt_camctl_camera_destroy(dt_camera_t * cam)
     g_object_unref(cam->live_view_pixbuf);
     cam->live_view_pixbuf = NULL; // just in case someone else is using this
   }
+  if(cam->live_view_pixbuf_back != NULL)
+    g_object_unref(cam->live_view_pixbuf_back);
+  g_free(cam->live_view_jpeg[0]);
+  g_free(cam->live_view_jpeg[1]);
   g_free(cam->model);
   g_free(cam->port);
   // TODO: cam->jobqueue
@@ -625,6 +711,8 @@ void dt_camctl_detect_cameras(const dt_camctl_t *c)
     dt_pthread_mutex_init(&camera->config_lock, NULL);
     dt_pthread_mutex_init(&camera->live_view_pixbuf_mutex, NULL);
     dt_pthread_mutex_init(&camera->live_view_synch, NULL);
+    dt_pthread_mutex_init(&camera->live_view_frame_mutex, NULL);
+    pthread_cond_init(&camera->live_view_frame_cond, NULL);
 
     // if(strcmp(camera->port,"usb:")==0) { g_free(camera); continue; }
     GList *citem;
@@ -95,6 +95,23 @@ typedef struct dt_camera_t
   dt_pthread_mutex_t live_view_pixbuf_mutex;
   /** A flag to tell the live view thread that the last job was completed */
   dt_pthread_mutex_t live_view_synch;
+  /** The thread decoding the live view frames */
+  pthread_t live_view_decoder_thread;
+  /** Guards the compressed frame handed from the camera to the decoder thread */
+  dt_pthread_mutex_t live_view_frame_mutex;
+  /** Signalled when a new compressed frame is waiting or live view stops */
+  pthread_cond_t live_view_frame_cond;
+  /** Latest compressed preview waiting to be decoded ([0]) and the one being decoded ([1]), buffers are reused */
+  uint8_t *live_view_jpeg[2];
+  size_t live_view_jpeg_size[2], live_view_jpeg_alloc[2];
+  /** There is an undecoded frame in live_view_jpeg[0] */
+  gboolean live_view_frame_waiting;
+  /** Frames replaced before the decoder got to them */
+  uint32_t live_view_frames_dropped;
+  /** The pixbuf the decoder fills next, swapped with live_view_pixbuf once complete */
+  GdkPixbuf *live_view_pixbuf_back;
+  /** Size the preview is displayed at, the decoder downscales towards it. 0 means full size */
+  gint live_view_target_width, live_view_target_height;
 }
 dt_camera_t;
 
@@ -38,6 +38,38 @@
 /* Stores the collection query, returns 1 if changed.. */
 static int _dt_collection_store (const dt_collection_t *collection, gchar *query);
 
+/* counts the changes to the library which may change a collection */
+static volatile gint _collection_changes = 0;
+
+/* set by changes on the writer connection, which only count once they are committed */
+static volatile gint _collection_writer_pending = 0;
+
+static void _collection_update_hook(void *data, int op, const char *db, const char *table, sqlite3_int64 rowid)
+{
+  // temporary tables and the selection don't change what is collected:
+  if(!strcmp(db, "memory") || !strcmp(db, "temp") || !strcmp(table, "selected_images")) return;
+  if(data)
+    g_atomic_int_set(&_collection_writer_pending, 1);
+  else
+    g_atomic_int_inc(&_collection_changes);
+}
+
+static void _collection_rollback_hook(void *data)
+{
+  g_atomic_int_set(&_collection_writer_pending, 0);
+}
+
+static int _collection_wal_hook(void *data, sqlite3 *db, const char *name, int pages)
+{
+  // unlike the commit hook, this runs once the commit is visible to the other connection. a reader
+  // seeing the new count before that would cache the old collection under it.
+  if(g_atomic_int_compare_and_exchange(&_collection_writer_pending, 1, 0))
+    g_atomic_int_inc(&_collection_changes);
+  // setting the hook replaces sqlite's automatic checkpoint, do what it does by default:
+  if(pages >= 1000) sqlite3_wal_checkpoint(db, name);
+  return SQLITE_OK;
+}
+
 const dt_collection_t *
 dt_collection_new (const dt_collection_t *clone)
 {
@@ -54,7 +86,20 @@ dt_collection_new (const dt_collection_t *clone)
     collection->clone = 1;
   }
   else  /* else we just initialize using the reset */
+  {
+    sqlite3_update_hook(dt_database_get(darktable.db), _collection_update_hook, NULL);
+    // a separate writer connection only exists in wal mode:
+    sqlite3 *writer = dt_database_get_writer(darktable.db);
+    if(writer != dt_database_get(darktable.db))
+    {
+      sqlite3_update_hook(writer, _collection_update_hook, writer);
+      sqlite3_rollback_hook(writer, _collection_rollback_hook, NULL);
+      sqlite3_wal_hook(writer, _collection_wal_hook, NULL);
+    }
+    collection->ids_changes = -1;
+    collection->count_changes = -1;
     dt_collection_reset (collection);
+  }
 
   return collection;
 }
@@ -66,6 +111,8 @@ dt_collection_free (const dt_collection_t *collection)
     g_free (collection->query);
   if (collection->where_ext)
     g_free (collection->where_ext);
+  g_free (collection->ids_query);
+  g_free (collection->count_query);
   g_free ((dt_collection_t *)collection);
 }
 
@@ -171,6 +218,30 @@ dt_collection_reset(const dt_collection_t *collection)
   dt_collection_update_query (collection);
 }
 
+void
+dt_collection_update_ids (const dt_collection_t *collection)
+{
+  dt_collection_t *c = (dt_collection_t *)collection;
+  const gchar *query = dt_collection_get_query(collection);
+  if(!query) return;
+  // read before filling, so changes coming in meanwhile trigger the next refresh:
+  const int changes = g_atomic_int_get(&_collection_changes);
+  if(c->ids_changes == changes && c->ids_query && !strcmp(c->ids_query, query)) return;
+
+  // the whole collection, in order, without the limit part:
+  gchar *full = g_strdup(query);
+  if(g_str_has_suffix(full, " "LIMIT_QUERY)) full[strlen(full) - strlen(" "LIMIT_QUERY)] = '\0';
+  gchar *insert = dt_util_dstrcat(NULL, "insert into memory.collected_images (imgid) %s", full);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "delete from memory.collected_images", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), insert, NULL, NULL, NULL);
+  g_free(insert);
+  g_free(full);
+
+  g_free(c->ids_query);
+  c->ids_query = g_strdup(query);
+  c->ids_changes = changes;
+}
+
 const gchar *
 dt_collection_get_query (const dt_collection_t *collection)
 {
@@ -350,8 +421,14 @@ _dt_collection_store (const dt_collection_t *collection, gchar *query)
   return 1;
 }
 
+int dt_collection_library_changes ()
+{
+  return g_atomic_int_get(&_collection_changes);
+}
+
 uint32_t dt_collection_get_count(const dt_collection_t *collection)
 {
+  dt_collection_t *c = (dt_collection_t *)collection;
   sqlite3_stmt *stmt = NULL;
   uint32_t count=1;
   const gchar *query = dt_collection_get_query(collection);
@@ -363,6 +440,14 @@ uint32_t dt_collection_get_count(const dt_collection_t *collection)
   else
     count_query = dt_util_dstrcat(count_query, "select count(id) %s", fq);
 
+  // this is asked for on every redraw, only count again if the filter or the library changed:
+  const int changes = g_atomic_int_get(&_collection_changes);
+  if(c->count_changes == changes && c->count_query && !strcmp(c->count_query, count_query))
+  {
+    g_free(count_query);
+    return c->count;
+  }
+
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), count_query, -1, &stmt, NULL);
   if ((collection->params.query_flags&COLLECTION_QUERY_USE_LIMIT) &&
       !(collection->params.query_flags&COLLECTION_QUERY_USE_ONLY_WHERE_EXT))
@@ -374,7 +459,11 @@ uint32_t dt_collection_get_count(const dt_collection_t *collection)
   if(sqlite3_step(stmt) == SQLITE_ROW)
     count = sqlite3_column_int(stmt, 0);
   sqlite3_finalize(stmt);
-  g_free(count_query);
+
+  g_free(c->count_query);
+  c->count_query = count_query;
+  c->count_changes = changes;
+  c->count = count;
   return count;
 }
 
@@ -429,9 +518,75 @@ GList *dt_collection_get_selected (const dt_collection_t *collection)
   return list;
 }
 
+/* 1 if the library has the full-text index, -1 before looking */
+static int _collection_fts = -1;
+
+gchar *
+dt_collection_get_fts_match(const dt_collection_properties_t property, const gchar *text)
+{
+  const char *column = NULL;
+  switch(property)
+  {
+    case DT_COLLECTION_PROP_FILENAME:    column = "filename";    break;
+    case DT_COLLECTION_PROP_TITLE:       column = "title";       break;
+    case DT_COLLECTION_PROP_DESCRIPTION: column = "description"; break;
+    case DT_COLLECTION_PROP_CREATOR:     column = "creator";     break;
+    case DT_COLLECTION_PROP_PUBLISHER:   column = "publisher";   break;
+    case DT_COLLECTION_PROP_RIGHTS:      column = "rights";      break;
+    default: return NULL;
+  }
+  // like wildcards can't be expressed as word prefixes:
+  if(!text || strchr(text, '%') || strchr(text, '_')) return NULL;
+
+  if(_collection_fts < 0)
+  {
+    sqlite3_stmt *stmt;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "select 1 from sqlite_master where type = 'table' and name = 'images_fts'", -1, &stmt, NULL);
+    _collection_fts = (sqlite3_step(stmt) == SQLITE_ROW);
+    sqlite3_finalize(stmt);
+  }
+  if(!_collection_fts) return NULL;
+
+  // every word of text has to be the start of a word in the column. only letters and digits
+  // end up in the match, so there's nothing to escape.
+  GString *match = g_string_new("");
+  GString *word = g_string_new("");
+  for(const gchar *c = text; ; c = g_utf8_next_char(c))
+  {
+    const gunichar u = g_utf8_get_char(c);
+    if(u && g_unichar_isalnum(u))
+    {
+      g_string_append_unichar(word, u);
+      continue;
+    }
+    if(word->len)
+    {
+      g_string_append_printf(match, "%s%s:%s*", match->len ? " " : "", column, word->str);
+      g_string_truncate(word, 0);
+    }
+    if(!u) break;
+  }
+  g_string_free(word, TRUE);
+
+  gchar *result = NULL;
+  if(match->len)
+    result = g_strdup_printf("(select docid from images_fts where images_fts match '%s')", match->str);
+  g_string_free(match, TRUE);
+  return result;
+}
+
 static void
 get_query_string(const dt_collection_properties_t property, const gchar *escaped_text, char *query)
 {
+  gchar *fts = dt_collection_get_fts_match(property, escaped_text);
+  if(fts)
+  {
+    snprintf(query, 1024, "(id in %s)", fts);
+    g_free(fts);
+    return;
+  }
+
   switch(property)
   {
     case DT_COLLECTION_PROP_FILMROLL: // film roll
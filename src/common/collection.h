@@ -29,6 +29,10 @@
 
 #define COLLECTION_QUERY_FULL (COLLECTION_QUERY_USE_SORT|COLLECTION_QUERY_USE_LIMIT)
 
+/** binds like the limit of the collection query (?1 offset, ?2 count), but reads the ids
+    materialized by dt_collection_update_ids(), so it costs the same at any offset. */
+#define COLLECTION_IDS_QUERY "select imgid from memory.collected_images where rowid > ?1 order by rowid limit ?2"
+
 
 #define COLLECTION_FILTER_FILM_ID               1             // use film_id in filter
 #define COLLECTION_FILTER_ATLEAST_RATING        2             // show all stars including and above selected star filter
@@ -108,6 +112,13 @@ typedef struct dt_collection_t
   gchar *where_ext;
   dt_collection_params_t params;
   dt_collection_params_t store;
+  /* query and library change count memory.collected_images was filled for */
+  gchar *ids_query;
+  int ids_changes;
+  /* cached result of dt_collection_get_count() and what it was counted for */
+  gchar *count_query;
+  int count_changes;
+  uint32_t count;
 }
 dt_collection_t;
 
@@ -120,6 +131,8 @@ void dt_collection_free (const dt_collection_t *collection);
 const dt_collection_params_t * dt_collection_params (const dt_collection_t *collection);
 /** get the generated query for collection */
 const gchar *dt_collection_get_query (const dt_collection_t *collection);
+/** fills memory.collected_images for COLLECTION_IDS_QUERY, if the query or the library changed since the last time. */
+void dt_collection_update_ids (const dt_collection_t *collection);
 /** updates sql query for a collection. @return 1 if query changed. */
 int dt_collection_update (const dt_collection_t *collection);
 /** reset collection to default dummy selection */
@@ -153,9 +166,17 @@ gboolean dt_collection_get_sort_descending(const dt_collection_t *collection);
 /** get the part of the query for sorting the collection **/
 gchar *dt_collection_get_sort_query(const dt_collection_t *collection);
 
-/** get the count of query */
+/** subselect of the image ids whose filename or metadata property has words starting with the words of text,
+    from the full-text index. NULL if that can't replace like '%text%', because text has wildcards, the property
+    isn't indexed or sqlite has no full-text search. */
+gchar *dt_collection_get_fts_match(const dt_collection_properties_t property, const gchar *text);
+
+/** get the count of query, cached until the query or the library changes */
 uint32_t dt_collection_get_count (const dt_collection_t *collection);
 
+/** number of writes to the library so far, to tell when results cached from it are stale. */
+int dt_collection_library_changes ();
+
 /** get selected image ids order as current selection. */
 GList *dt_collection_get_selected (const dt_collection_t *collection);
 /** get the count of selected images */
@@ -21,9 +21,11 @@
 #include "control/conf.h"
 #include "control/control.h"
 #include "common/colormatrices.c"
+#include "common/colorspaces_inline_conversions.h"
 #include "common/debug.h"
 #include "common/srgb_tone_curve_values.h"
 #include <lcms2.h>
+#include <emmintrin.h>
 
 
 /** inverts the given 3x3 matrix */
@@ -305,55 +307,16 @@ build_linear_gamma(void)
   return cmsBuildParametricToneCurve(0, 1, Parameters);
 }
 
-static float
-cbrt_5f(float f)
-{
-  uint32_t* p = (uint32_t *) &f;
-  *p = *p/3 + 709921077;
-  return f;
-}
-
-static float
-cbrta_halleyf(const float a, const float R)
-{
-  const float a3 = a*a*a;
-  const float b = a * (a3 + R + R) / (a3 + a3 + R);
-  return b;
-}
-
-static float
-lab_f(const float x)
-{
-  const float epsilon = 216.0f/24389.0f;
-  const float kappa   = 24389.0f/27.0f;
-  if(x > epsilon)
-  {
-    // approximate cbrtf(x):
-    const float a = cbrt_5f(x);
-    return cbrta_halleyf(a, x);
-  }
-  else return (kappa*x + 16.0f)/116.0f;
-}
-
 void
 dt_XYZ_to_Lab(const float *XYZ, float *Lab)
 {
   const float d50[3] = { 0.9642, 1.0, 0.8249 };
-  const float f[3] = { lab_f(XYZ[0]/d50[0]), lab_f(XYZ[1]/d50[1]), lab_f(XYZ[2]/d50[2]) };
+  const float f[3] = { dt_lab_f(XYZ[0]/d50[0]), dt_lab_f(XYZ[1]/d50[1]), dt_lab_f(XYZ[2]/d50[2]) };
   Lab[0] = 116.0f * f[1] - 16.0f;
   Lab[1] = 500.0f*(f[0] - f[1]);
   Lab[2] = 200.0f*(f[1] - f[2]);
 }
 
-static float
-lab_f_inv(const float x)
-{
-  const float epsilon = 0.20689655172413796; // cbrtf(216.0f/24389.0f);
-  const float kappa   = 24389.0f/27.0f;
-  if(x > epsilon) return x*x*x;
-  else return (116.0f*x - 16.0f)/kappa;
-}
-
 void
 dt_Lab_to_XYZ(const float *Lab, float *XYZ)
 {
@@ -361,9 +324,9 @@ dt_Lab_to_XYZ(const float *Lab, float *XYZ)
   const float fy = (Lab[0] + 16.0f)/116.0f;
   const float fx = Lab[1]/500.0f + fy;
   const float fz = fy - Lab[2]/200.0f;
-  XYZ[0] = d50[0]*lab_f_inv(fx);
-  XYZ[1] = d50[1]*lab_f_inv(fy);
-  XYZ[2] = d50[2]*lab_f_inv(fz);
+  XYZ[0] = d50[0]*dt_lab_f_inv(fx);
+  XYZ[1] = d50[1]*dt_lab_f_inv(fy);
+  XYZ[2] = d50[2]*dt_lab_f_inv(fz);
 }
 
 
@@ -922,6 +885,107 @@ dt_colorspaces_get_makermodel_split(char *makermodel, const int size, char **mod
   (*modelo)++;
 }
 
+int dt_colorspaces_create_clut(dt_colorspaces_clut_t *clut, cmsHTRANSFORM xform, const float *min, const float *max, const int sqrt_in)
+{
+  const int s = DT_COLORSPACES_CLUT_SIZE;
+  const int n = s*s*s;
+  clut->table = NULL;
+  clut->sqrt_in = sqrt_in;
+  for(int k=0; k<3; k++)
+  {
+    const float lo = sqrt_in ? sqrtf(fmaxf(min[k], 0.0f)) : min[k];
+    const float hi = sqrt_in ? sqrtf(fmaxf(max[k], 0.0f)) : max[k];
+    clut->min[k] = lo;
+    clut->scale[k] = (s - 1)/(hi - lo);
+  }
+  clut->min[3] = 0.0f;
+  clut->scale[3] = 0.0f;
+
+  float *nodes = (float *)malloc(sizeof(float)*3*n);
+  float *res = (float *)malloc(sizeof(float)*3*n);
+  float *table = (float *)dt_alloc_align(16, sizeof(float)*4*n);
+  if(!nodes || !res || !table)
+  {
+    free(nodes);
+    free(res);
+    free(table);
+    return 1;
+  }
+
+  // input of every node, first channel fastest
+  for(int b=0; b<s; b++) for(int g=0; g<s; g++) for(int r=0; r<s; r++)
+      {
+        const int c[3] = { r, g, b };
+        float *node = nodes + 3*(r + s*(g + s*b));
+        for(int k=0; k<3; k++)
+        {
+          const float v = clut->min[k] + c[k]/clut->scale[k];
+          node[k] = sqrt_in ? v*v : v;
+        }
+      }
+
+  cmsDoTransform(xform, nodes, res, n);
+
+  for(int i=0; i<n; i++)
+  {
+    for(int k=0; k<3; k++) table[4*i+k] = res[3*i+k];
+    table[4*i+3] = 0.0f;
+  }
+  free(nodes);
+  free(res);
+  clut->table = table;
+  return 0;
+}
+
+void dt_colorspaces_cleanup_clut(dt_colorspaces_clut_t *clut)
+{
+  free(clut->table);
+  clut->table = NULL;
+}
+
+void dt_colorspaces_apply_clut(const dt_colorspaces_clut_t *clut, const float *in, float *out, const int n)
+{
+  const int s = DT_COLORSPACES_CLUT_SIZE;
+  const __m128 min = _mm_loadu_ps(clut->min);
+  const __m128 scale = _mm_loadu_ps(clut->scale);
+  const __m128 hi = _mm_set1_ps(s - 1);
+  const __m128i last = _mm_set1_epi32(s - 2);
+  const __m128 mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+  const float *const table = clut->table;
+
+  for(int i=0; i<n; i++, in+=4, out+=4)
+  {
+    const __m128 pixel = _mm_load_ps(in);
+    const __m128 v = clut->sqrt_in ? _mm_sqrt_ps(_mm_max_ps(pixel, _mm_setzero_ps())) : pixel;
+    // node coordinates, integer part and weights
+    const __m128 t = _mm_min_ps(hi, _mm_max_ps(_mm_setzero_ps(), _mm_mul_ps(_mm_sub_ps(v, min), scale)));
+    __m128i ti = _mm_cvttps_epi32(t);
+    // min_epi32 is sse4.1, so compare and blend
+    const __m128i over = _mm_cmpgt_epi32(ti, last);
+    ti = _mm_or_si128(_mm_and_si128(over, last), _mm_andnot_si128(over, ti));
+    const __m128 f = _mm_sub_ps(t, _mm_cvtepi32_ps(ti));
+    __attribute__((aligned(16))) int c[4];
+    _mm_store_si128((__m128i *)c, ti);
+
+    const float *n000 = table + 4*(c[0] + s*(c[1] + s*c[2]));
+    const int dy = 4*s, dz = 4*s*s;
+    const __m128 fr = _mm_shuffle_ps(f, f, _MM_SHUFFLE(0, 0, 0, 0));
+    const __m128 fg = _mm_shuffle_ps(f, f, _MM_SHUFFLE(1, 1, 1, 1));
+    const __m128 fb = _mm_shuffle_ps(f, f, _MM_SHUFFLE(2, 2, 2, 2));
+
+#define LERP(a, b, w) _mm_add_ps((a), _mm_mul_ps((w), _mm_sub_ps((b), (a))))
+    const __m128 c00 = LERP(_mm_load_ps(n000),         _mm_load_ps(n000 + 4),         fr);
+    const __m128 c10 = LERP(_mm_load_ps(n000 + dy),    _mm_load_ps(n000 + dy + 4),    fr);
+    const __m128 c01 = LERP(_mm_load_ps(n000 + dz),    _mm_load_ps(n000 + dz + 4),    fr);
+    const __m128 c11 = LERP(_mm_load_ps(n000 + dy+dz), _mm_load_ps(n000 + dy+dz + 4), fr);
+    const __m128 res = LERP(LERP(c00, c10, fg), LERP(c01, c11, fg), fb);
+#undef LERP
+
+    _mm_stream_ps(out, _mm_or_ps(_mm_and_ps(mask, res), _mm_andnot_ps(mask, pixel)));
+  }
+  _mm_sfence();
+}
+
 void rgb2hsl(const float rgb[3],float *h,float *s,float *l)
 {
   const float r=rgb[0], g=rgb[1], b=rgb[2];
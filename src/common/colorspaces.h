@@ -86,6 +86,30 @@ void dt_colorspaces_get_makermodel_split(char *makermodel, const int size, char
 int dt_colorspaces_find_profile(char *filename, const int filename_len, const char *profile, const char *inout);
 
 
+/** nodes per axis of the 3d luts which bake lcms2 transforms. */
+#define DT_COLORSPACES_CLUT_SIZE 33
+
+/** an lcms2 transform between 3-channel float formats, sampled on a regular grid. */
+typedef struct dt_colorspaces_clut_t
+{
+  float *table;     // DT_COLORSPACES_CLUT_SIZE^3 nodes of 4 floats, first channel runs fastest
+  float min[4];     // input mapped to node 0 on each axis
+  float scale[4];   // nodes per unit of input
+  int sqrt_in;      // nodes are spaced evenly on the square root of the input
+}
+dt_colorspaces_clut_t;
+
+/** bakes xform into a clut covering [min, max] per input channel. sqrt_in gives more nodes to
+  * the shadows of linear rgb input. returns 0 on success, table is NULL otherwise. */
+int dt_colorspaces_create_clut(dt_colorspaces_clut_t *clut, cmsHTRANSFORM xform, const float *min, const float *max, const int sqrt_in);
+
+/** frees the table of the clut. */
+void dt_colorspaces_cleanup_clut(dt_colorspaces_clut_t *clut);
+
+/** trilinear lookup of n 4-channel pixels, the input is clamped to the domain of the clut. the
+  * fourth channel is passed through. in and out have to be 16 byte aligned. */
+void dt_colorspaces_apply_clut(const dt_colorspaces_clut_t *clut, const float *in, float *out, const int n);
+
 /** common functions to change between colorspaces, used in iop modules */
 void rgb2hsl(const float rgb[3],float *h,float *s,float *l);
 void hsl2rgb(float rgb[3],float h,float s,float l);
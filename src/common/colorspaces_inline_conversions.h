@@ -0,0 +1,233 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_COLORSPACES_INLINE_CONVERSIONS_H
+#define DT_COLORSPACES_INLINE_CONVERSIONS_H
+
+// per pixel conversions between the color spaces used in the pipe, to be inlined into the
+// loops of the modules. the opencl counterparts live in data/kernels/colorspace.cl.
+
+#include <math.h>
+#include <stdint.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+/** cube root: a bit hack as first guess and one halley step, relative error below 3e-5 for
+  * positive normal x. */
+static inline float
+dt_fast_cbrtf(const float x)
+{
+  union { float f; uint32_t i; } u = { x };
+  u.i = u.i/3 + 709921077;
+  const float a = u.f;
+  const float a3 = a*a*a;
+  return a * (a3 + x + x) / (a3 + a3 + x);
+}
+
+/** the same for four positive floats. */
+static inline __m128
+dt_fast_cbrt_sse2(const __m128 x)
+{
+  const __m128 a = _mm_castsi128_ps(_mm_add_epi32(_mm_cvtps_epi32(_mm_div_ps(_mm_cvtepi32_ps(_mm_castps_si128(x)),_mm_set1_ps(3.0f))),_mm_set1_epi32(709921077)));
+  const __m128 a3 = _mm_mul_ps(_mm_mul_ps(a,a),a);
+  return _mm_div_ps(_mm_mul_ps(a,_mm_add_ps(a3,_mm_add_ps(x,x))),_mm_add_ps(_mm_add_ps(a3,a3),x));
+}
+
+static inline float
+dt_lab_f(const float x)
+{
+  const float epsilon = 216.0f/24389.0f;
+  const float kappa   = 24389.0f/27.0f;
+  if(x > epsilon) return dt_fast_cbrtf(x);
+  else return (kappa*x + 16.0f)/116.0f;
+}
+
+static inline float
+dt_lab_f_inv(const float x)
+{
+  const float epsilon = 0.20689655172413796; // cbrtf(216.0f/24389.0f);
+  const float kappa   = 24389.0f/27.0f;
+  if(x > epsilon) return x*x*x;
+  else return (116.0f*x - 16.0f)/kappa;
+}
+
+static inline __m128
+dt_lab_f_sse2(const __m128 x)
+{
+  const __m128 epsilon = _mm_set1_ps(216.0f/24389.0f);
+  const __m128 kappa   = _mm_set1_ps(24389.0f/27.0f);
+
+  // calculate as if x > epsilon : result = cbrtf(x)
+  const __m128 res_big = dt_fast_cbrt_sse2(x);
+
+  // calculate as if x <= epsilon : result = (kappa*x+16)/116
+  const __m128 res_small = _mm_div_ps(_mm_add_ps(_mm_mul_ps(kappa,x),_mm_set1_ps(16.0f)),_mm_set1_ps(116.0f));
+
+  // blend results according to whether each component is > epsilon or not
+  const __m128 mask = _mm_cmpgt_ps(x,epsilon);
+  return _mm_or_ps(_mm_and_ps(mask,res_big),_mm_andnot_ps(mask,res_small));
+}
+
+static inline __m128
+dt_lab_f_inv_sse2(const __m128 x)
+{
+  const __m128 epsilon = _mm_set1_ps(0.20689655172413796f); // cbrtf(216.0f/24389.0f);
+  const __m128 kappa_rcp_x16   = _mm_set1_ps(16.0f*27.0f/24389.0f);
+  const __m128 kappa_rcp_x116   = _mm_set1_ps(116.0f*27.0f/24389.0f);
+
+  // x > epsilon
+  const __m128 res_big   = _mm_mul_ps(_mm_mul_ps(x,x),x);
+  // x <= epsilon
+  const __m128 res_small = _mm_sub_ps(_mm_mul_ps(kappa_rcp_x116,x),kappa_rcp_x16);
+
+  // blend results according to whether each component is > epsilon or not
+  const __m128 mask = _mm_cmpgt_ps(x,epsilon);
+  return _mm_or_ps(_mm_and_ps(mask,res_big),_mm_andnot_ps(mask,res_small));
+}
+
+/** XYZ (d50) to Lab, the fourth channel of the result is 0. */
+static inline __m128
+dt_XYZ_to_Lab_sse2(const __m128 XYZ)
+{
+  const __m128 d50_inv  = _mm_set_ps(0.0f, 1.0f/0.8249f, 1.0f, 1.0f/0.9642f);
+  const __m128 coef = _mm_set_ps(0.0f,200.0f,500.0f,116.0f);
+  const __m128 f = dt_lab_f_sse2(_mm_mul_ps(XYZ,d50_inv));
+  // because d50_inv.z is 0.0f, lab_f(0) == 16/116, so Lab[0] = 116*f[0] - 16 equal to 116*(f[0]-f[3])
+  return _mm_mul_ps(coef,_mm_sub_ps(_mm_shuffle_ps(f,f,_MM_SHUFFLE(3,1,0,1)),_mm_shuffle_ps(f,f,_MM_SHUFFLE(3,2,1,3))));
+}
+
+/** Lab to XYZ (d50), the fourth channel of the result is 0. */
+static inline __m128
+dt_Lab_to_XYZ_sse2(const __m128 Lab)
+{
+  const __m128 d50    = _mm_set_ps(0.0f, 0.8249f, 1.0f, 0.9642f);
+  const __m128 coef   = _mm_set_ps(0.0f,-1.0f/200.0f,1.0f/116.0f,1.0f/500.0f);
+  const __m128 offset = _mm_set1_ps(0.137931034f);
+
+  // last component ins shuffle taken from 1st component of Lab to make sure it is not nan, so it will become 0.0f in f
+  const __m128 f = _mm_mul_ps(_mm_shuffle_ps(Lab,Lab,_MM_SHUFFLE(0,2,0,1)),coef);
+
+  return _mm_mul_ps(d50,dt_lab_f_inv_sse2(_mm_add_ps(_mm_add_ps(f,_mm_shuffle_ps(f,f,_MM_SHUFFLE(1,1,3,1))),offset)));
+}
+
+/** rgb in [0, 1] to hue, saturation and lightness in [0, 1], as used by blending. */
+static inline void
+dt_RGB_2_HSL(const float *RGB, float *HSL)
+{
+  float H, S, L;
+
+  float R = RGB[0];
+  float G = RGB[1];
+  float B = RGB[2];
+
+  float var_Min = fminf(R, fminf(G, B));
+  float var_Max = fmaxf(R, fmaxf(G, B));
+  float del_Max = var_Max - var_Min;
+
+  L = (var_Max + var_Min) / 2.0f;
+
+  if (del_Max < 1e-6f)
+  {
+    H = 0.0f;
+    S = 0.0f;
+  }
+  else
+  {
+    if (L < 0.5f) S = del_Max / (var_Max + var_Min);
+    else          S = del_Max / (2.0f - var_Max - var_Min);
+
+    float del_R = (((var_Max - R) / 6.0f) + (del_Max / 2.0f)) / del_Max;
+    float del_G = (((var_Max - G) / 6.0f) + (del_Max / 2.0f)) / del_Max;
+    float del_B = (((var_Max - B) / 6.0f) + (del_Max / 2.0f)) / del_Max;
+
+    if      (R == var_Max) H = del_B - del_G;
+    else if (G == var_Max) H = (1.0f / 3.0f) + del_R - del_B;
+    else if (B == var_Max) H = (2.0f / 3.0f) + del_G - del_R;
+    else H = 0.0f;   // make GCC happy
+
+    if (H < 0.0f) H += 1.0f;
+    if (H > 1.0f) H -= 1.0f;
+  }
+
+  HSL[0] = H;
+  HSL[1] = S;
+  HSL[2] = L;
+}
+
+static inline float
+dt_Hue_2_RGB(float v1, float v2, float vH)
+{
+  if (vH < 0.0f) vH += 1.0f;
+  if (vH > 1.0f) vH -= 1.0f;
+  if ((6.0f * vH) < 1.0f) return (v1 + (v2 - v1) * 6.0f * vH);
+  if ((2.0f * vH) < 1.0f) return (v2);
+  if ((3.0f * vH) < 2.0f) return (v1 + (v2 - v1) * ((2.0f / 3.0f) - vH) * 6.0f);
+  return (v1);
+}
+
+static inline void
+dt_HSL_2_RGB(const float *HSL, float *RGB)
+{
+  float H = HSL[0];
+  float S = HSL[1];
+  float L = HSL[2];
+
+  float var_1, var_2;
+
+  if (S < 1e-6f)
+  {
+    RGB[0] = RGB[1] = RGB[2] = L;
+  }
+  else
+  {
+    if (L < 0.5f) var_2 = L * (1.0f + S);
+    else          var_2 = (L + S) - (S * L);
+
+    var_1 = 2.0f * L - var_2;
+
+    RGB[0] = dt_Hue_2_RGB(var_1, var_2, H + (1.0f / 3.0f));
+    RGB[1] = dt_Hue_2_RGB(var_1, var_2, H);
+    RGB[2] = dt_Hue_2_RGB(var_1, var_2, H - (1.0f / 3.0f));
+  }
+}
+
+/** Lab to lightness, chroma and hue in [0, 1]. */
+static inline void
+dt_Lab_2_LCH(const float *Lab, float *LCH)
+{
+  float var_H = atan2f(Lab[2], Lab[1]);
+
+  if (var_H > 0.0f) var_H = var_H / (2.0f*M_PI);
+  else              var_H = 1.0f - fabs(var_H) / (2.0f*M_PI);
+
+  LCH[0] = Lab[0];
+  LCH[1] = sqrtf(Lab[1]*Lab[1] + Lab[2]*Lab[2]);
+  LCH[2] = var_H;
+}
+
+static inline void
+dt_LCH_2_Lab(const float *LCH, float *Lab)
+{
+  Lab[0] = LCH[0];
+  Lab[1] = cosf(2.0f*M_PI*LCH[2]) * LCH[1];
+  Lab[2] = sinf(2.0f*M_PI*LCH[2]) * LCH[1];
+}
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
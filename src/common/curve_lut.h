@@ -0,0 +1,82 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_CURVE_LUT_H
+#define DT_CURVE_LUT_H
+
+// sampling of the curves baked into look-up tables by dt_draw_curve_calc_values(), to be inlined
+// into the loops of the modules. the opencl counterparts live in data/kernels/curve_lut.cl, both
+// round the same way so cpu and gpu pick the same entries.
+
+#include <math.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+#define DT_CURVE_LUT_SIZE 0x10000
+
+/** the entry of the DT_CURVE_LUT_SIZE long lut for x in [0, 1], x outside is clamped. */
+static inline float
+dt_curve_lut_lookup(const float *const lut, const float x)
+{
+  const int xi = fminf(fmaxf(x*(DT_CURVE_LUT_SIZE-1), 0.0f), DT_CURVE_LUT_SIZE-1);
+  return lut[xi];
+}
+
+/** the same, extrapolating with y = coeffs[1]*(x*coeffs[0])^coeffs[2] above the end of the curve at
+  * 1/coeffs[0] (see dt_iop_estimate_exp()). a negative coeffs[0] marks the curve as identity. */
+static inline float
+dt_curve_lut_lookup_unbounded(const float *const lut, const float x, const float *const coeffs)
+{
+  if(coeffs[0] < 0.0f) return x;
+  if(x < 1.0f/coeffs[0]) return dt_curve_lut_lookup(lut, x);
+  return coeffs[1] * powf(x*coeffs[0], coeffs[2]);
+}
+
+/** dt_curve_lut_lookup() for four values at once. */
+static inline __m128
+dt_curve_lut_lookup_sse2(const float *const lut, const __m128 x)
+{
+  const __m128 top = _mm_set1_ps(DT_CURVE_LUT_SIZE-1);
+  // x first, so a nan ends up as 0
+  const __m128i xi = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(x*top, _mm_setzero_ps()), top));
+  int idx[4] __attribute__((aligned(16)));
+  _mm_store_si128((__m128i *)idx, xi);
+  return _mm_set_ps(lut[idx[3]], lut[idx[2]], lut[idx[1]], lut[idx[0]]);
+}
+
+/** dt_curve_lut_lookup_unbounded() for four values at once, all through the same curve. */
+static inline __m128
+dt_curve_lut_lookup_unbounded_sse2(const float *const lut, const __m128 x, const float *const coeffs)
+{
+  if(coeffs[0] < 0.0f) return x;
+  const __m128 res = dt_curve_lut_lookup_sse2(lut, x);
+  const int above = _mm_movemask_ps(_mm_cmpge_ps(x, _mm_set1_ps(1.0f/coeffs[0])));
+  if(!above) return res;
+  // only the few pixels beyond the curve pay for the pow
+  float xs[4] __attribute__((aligned(16)));
+  float r[4] __attribute__((aligned(16)));
+  _mm_store_ps(xs, x);
+  _mm_store_ps(r, res);
+  for(int k=0; k<4; k++)
+    if(above & (1<<k)) r[k] = coeffs[1] * powf(xs[k]*coeffs[0], coeffs[2]);
+  return _mm_load_ps(r);
+}
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -25,6 +25,8 @@
 #include "common/selection.h"
 #include "common/exif.h"
 #include "common/fswatch.h"
+#include "common/grouping.h"
+#include "common/memory_governor.h"
 #include "common/pwstorage/pwstorage.h"
 #ifdef HAVE_GPHOTO2
 #include "common/camera_control.h"
@@ -32,12 +34,20 @@
 #include "common/film.h"
 #include "common/image.h"
 #include "common/image_cache.h"
+#include "common/imageio.h"
+#include "common/styles.h"
 #include "common/imageio_module.h"
+#include "common/imageio_rawspeed.h"
 #include "common/mipmap_cache.h"
 #include "common/opencl.h"
 #include "common/points.h"
+#include "common/presets_cache.h"
+#include "common/trace.h"
+#include "common/profiling.h"
+#include "develop/develop.h"
 #include "develop/imageop.h"
 #include "develop/blend.h"
+#include "develop/pixelpipe_cache.h"
 #include "libs/lib.h"
 #include "views/view.h"
 #include "views/undo.h"
@@ -59,6 +69,7 @@
 #include <unistd.h>
 #include <locale.h>
 #include <xmmintrin.h>
+#include <sys/mman.h>
 #ifdef HAVE_GRAPHICSMAGICK
 #include <magick/api.h>
 #endif
@@ -90,17 +101,19 @@ const char dt_supported_extensions[] = "3fr,arw,bay,bmq,cap,cine,cr2,crw,cs1,dc2
 
 static int usage(const char *argv0)
 {
-  printf("usage: %s [-d {all,cache,camctl,control,dev,fswatch,lighttable,masks,memory,nan,opencl,perf,pwstorage,sql}] [IMG_1234.{RAW,..}|image_folder/]", argv0);
+  printf("usage: %s [-d {all,cache,camctl,control,dev,fswatch,imageio,lighttable,masks,memory,nan,opencl,perf,pwstorage,sql}] [IMG_1234.{RAW,..}|image_folder/]", argv0);
 #ifdef HAVE_OPENCL
   printf(" [--disable-opencl]");
 #endif
   printf(" [--library <library file>]");
+  printf(" [--headless]");
   printf(" [--datadir <data directory>]");
   printf(" [--moduledir <module directory>]");
   printf(" [--tmpdir <tmp directory>]");
   printf(" [--configdir <user config directory>]");
   printf(" [--cachedir <user cache directory>]");
   printf(" [--localedir <locale directory>]");
+  printf(" [--trace <timeline file.json>]");
   printf("\n");
   return 1;
 }
@@ -343,6 +356,108 @@ int dt_load_from_string(const gchar* input, gboolean open_image_in_dr)
   return id;
 }
 
+// a part of dt_init which runs next to the main thread until something depending on it comes up
+typedef struct dt_init_task_t
+{
+  const char *name;
+  void (*run)(void *data);
+  void *data;
+  pthread_t thread;
+  int threaded;
+  dt_times_t start, end;
+}
+dt_init_task_t;
+
+typedef struct dt_init_opencl_t
+{
+  int argc;
+  char **argv;
+}
+dt_init_opencl_t;
+
+static void *_init_task_run(void *data)
+{
+  dt_init_task_t *t = (dt_init_task_t *)data;
+  dt_get_times(&t->start);
+  t->run(t->data);
+  dt_get_times(&t->end);
+  return NULL;
+}
+
+static void _init_task_start(dt_init_task_t *t, const char *name, void (*run)(void *data), void *data)
+{
+  t->name = name;
+  t->run = run;
+  t->data = data;
+  t->threaded = !pthread_create(&t->thread, NULL, _init_task_run, t);
+  // no thread to spare, just do it now:
+  if(!t->threaded) _init_task_run(t);
+}
+
+static void _init_task_wait(dt_init_task_t *t)
+{
+  if(!t->name) return;
+  const double wait = dt_get_wtime();
+  if(t->threaded) pthread_join(t->thread, NULL);
+  t->threaded = 0;
+  dt_print(DT_DEBUG_PERF, "[dt_init] %s took %.3f secs in parallel, waited %.3f secs for it\n",
+           t->name, t->end.clock - t->start.clock, MAX(0.0, t->end.clock - wait));
+  t->name = NULL;
+}
+
+// prints how long the step since the last call took and starts the next one
+static void _init_step(dt_times_t *step, const char *name)
+{
+  char prefix[64];
+  snprintf(prefix, sizeof(prefix), "[dt_init] %s", name);
+  dt_show_times(step, prefix, NULL);
+  dt_get_times(step);
+}
+
+static void _init_opencl(void *data)
+{
+  dt_init_opencl_t *d = (dt_init_opencl_t *)data;
+  darktable.opencl = (dt_opencl_t *)malloc(sizeof(dt_opencl_t));
+  memset(darktable.opencl, 0, sizeof(dt_opencl_t));
+  dt_opencl_init(darktable.opencl, d->argc, d->argv);
+  g_free(d->argv);
+}
+
+static void _init_caches(void *data)
+{
+  // must come before mipmap_cache, because that one will need to access
+  // image dimensions stored in here:
+  darktable.image_cache = (dt_image_cache_t *)malloc(sizeof(dt_image_cache_t));
+  memset(darktable.image_cache, 0, sizeof(dt_image_cache_t));
+  dt_image_cache_init(darktable.image_cache);
+
+  // the lighttable asks for the group of every thumbnail, keep them in memory:
+  dt_grouping_init();
+
+  darktable.mipmap_cache = (dt_mipmap_cache_t *)malloc(sizeof(dt_mipmap_cache_t));
+  memset(darktable.mipmap_cache, 0, sizeof(dt_mipmap_cache_t));
+  dt_mipmap_cache_init(darktable.mipmap_cache);
+
+  // shared by all pixelpipes, needs cache_memory from the config:
+  dt_dev_pixelpipe_cache_pool_init();
+
+  // shrinks the caches above when the system runs low on memory:
+  dt_memory_governor_init();
+}
+
+static void _dt_detect_cpu_features()
+{
+  darktable.cpu_flags = DT_CPU_FLAG_SSE | DT_CPU_FLAG_SSE2;
+#ifdef DT_AVX2_CODEPATH
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("sse3")) darktable.cpu_flags |= DT_CPU_FLAG_SSE3;
+  // these also check that the os saves the ymm registers:
+  if(__builtin_cpu_supports("avx"))  darktable.cpu_flags |= DT_CPU_FLAG_AVX;
+  if(__builtin_cpu_supports("avx2")) darktable.cpu_flags |= DT_CPU_FLAG_AVX2;
+  if(__builtin_cpu_supports("fma"))  darktable.cpu_flags |= DT_CPU_FLAG_FMA;
+#endif
+}
+
 int dt_init(int argc, char *argv[], const int init_gui)
 {
   // make everything go a lot faster.
@@ -350,6 +465,7 @@ int dt_init(int argc, char *argv[], const int init_gui)
 #ifndef __APPLE__
   _dt_sigsegv_old_handler = signal(SIGSEGV,&_dt_sigsegv_handler);
 #endif
+  dt_profiling_init();
 
 #ifndef __SSE2__
   fprintf(stderr, "[dt_init] unfortunately we depend on SSE2 instructions at this time.\n");
@@ -371,6 +487,10 @@ int dt_init(int argc, char *argv[], const int init_gui)
   memset(&darktable, 0, sizeof(darktable_t));
 
   darktable.progname = argv[0];
+  _dt_detect_cpu_features();
+
+  // before anything loads a color profile:
+  dt_memory_stats_init();
 
   // database
   gchar *dbfilename_from_command = NULL;
@@ -385,6 +505,7 @@ int dt_init(int argc, char *argv[], const int init_gui)
   darktable.num_openmp_threads = omp_get_num_procs();
 #endif
   darktable.unmuted = 0;
+  darktable.headless = 0;
   GSList *images_to_load = NULL;
   for(int k=1; k<argc; k++)
   {
@@ -407,6 +528,10 @@ int dt_init(int argc, char *argv[], const int init_gui)
       {
         dbfilename_from_command = argv[++k];
       }
+      else if(!strcmp(argv[k], "--headless"))
+      {
+        darktable.headless = 1;
+      }
       else if(!strcmp(argv[k], "--datadir"))
       {
         datadir_from_command = argv[++k];
@@ -431,6 +556,10 @@ int dt_init(int argc, char *argv[], const int init_gui)
       {
         bindtextdomain (GETTEXT_PACKAGE, argv[++k]);
       }
+      else if(!strcmp(argv[k], "--trace") && argc > k+1)
+      {
+        dt_trace_init(argv[++k]);
+      }
       else if(argv[k][1] == 'd' && argc > k+1)
       {
         if(!strcmp(argv[k+1], "all"))             darktable.unmuted = 0xffffffff;   // enable all debug information
@@ -448,6 +577,7 @@ int dt_init(int argc, char *argv[], const int init_gui)
         else if(!strcmp(argv[k+1], "nan"))        darktable.unmuted |= DT_DEBUG_NAN; // check for NANs when processing the pipe.
         else if(!strcmp(argv[k+1], "masks"))      darktable.unmuted |= DT_DEBUG_MASKS; // masks related stuff.
         else if(!strcmp(argv[k+1], "lua"))        darktable.unmuted |= DT_DEBUG_LUA; // lua errors are reported on console
+        else if(!strcmp(argv[k+1], "imageio"))    darktable.unmuted |= DT_DEBUG_IMAGEIO; // which loaders are tried on an image
         else return usage(argv[0]);
         k ++;
       }
@@ -466,6 +596,12 @@ int dt_init(int argc, char *argv[], const int init_gui)
 #endif
   }
 
+  // command line tools don't want to touch the user's library unless asked to:
+  if(darktable.headless && !init_gui && !dbfilename_from_command)
+    dbfilename_from_command = (gchar *)":memory:";
+  else if(init_gui)
+    darktable.headless = 0;
+
   if(darktable.unmuted & DT_DEBUG_MEMORY)
   {
     fprintf(stderr, "[memory] at startup\n");
@@ -474,6 +610,9 @@ int dt_init(int argc, char *argv[], const int init_gui)
 
 #ifdef _OPENMP
   omp_set_num_threads(darktable.num_openmp_threads);
+  // jobs lease their share of these, see dt_control_lease_threads(). parallel regions
+  // inside parallel regions run on the thread that enters them instead of spawning more.
+  omp_set_nested(0);
 #endif
   dt_loc_init_datadir(datadir_from_command);
   dt_loc_init_plugindir(moduledir_from_command);
@@ -519,6 +658,17 @@ int dt_init(int argc, char *argv[], const int init_gui)
   memset(darktable.conf, 0, sizeof(dt_conf_t));
   dt_conf_init(darktable.conf, filename);
 
+  if(!dt_conf_get_bool("codepaths/avx2"))
+    darktable.cpu_flags &= ~(DT_CPU_FLAG_AVX2 | DT_CPU_FLAG_FMA);
+  dt_print(DT_DEBUG_PERF, "[dt_init] cpu features:%s%s%s%s%s%s, %s code path\n",
+           (darktable.cpu_flags & DT_CPU_FLAG_SSE)  ? " sse"  : "",
+           (darktable.cpu_flags & DT_CPU_FLAG_SSE2) ? " sse2" : "",
+           (darktable.cpu_flags & DT_CPU_FLAG_SSE3) ? " sse3" : "",
+           (darktable.cpu_flags & DT_CPU_FLAG_AVX)  ? " avx"  : "",
+           (darktable.cpu_flags & DT_CPU_FLAG_AVX2) ? " avx2" : "",
+           (darktable.cpu_flags & DT_CPU_FLAG_FMA)  ? " fma"  : "",
+           dt_codepath_avx2() ? "avx2" : "sse2");
+
   // set the interface language
   const gchar* lang = dt_conf_get_string("ui_last/gui_language");
   if(lang != NULL && lang[0] != '\0')
@@ -527,6 +677,10 @@ int dt_init(int argc, char *argv[], const int init_gui)
       gtk_disable_setlocale();
   }
 
+  dt_times_t start, step;
+  dt_get_times(&start);
+  step = start;
+
   // initialize the database
   darktable.db = dt_database_init(dbfilename_from_command);
   if(darktable.db == NULL)
@@ -572,6 +726,8 @@ int dt_init(int argc, char *argv[], const int init_gui)
     return 1;
   }
 
+  _init_step(&step, "database");
+
   // Initialize the signal system
   darktable.signals = dt_control_signal_init();
 
@@ -633,28 +789,27 @@ int dt_init(int argc, char *argv[], const int init_gui)
   InitializeMagick(darktable.progname);
 #endif
 
-  darktable.opencl = (dt_opencl_t *)malloc(sizeof(dt_opencl_t));
-  memset(darktable.opencl, 0, sizeof(dt_opencl_t));
-  dt_opencl_init(darktable.opencl, argc, argv);
-
-  darktable.blendop = (dt_blendop_t *)malloc(sizeof(dt_blendop_t));
-  memset(darktable.blendop, 0, sizeof(dt_blendop_t));
-  dt_develop_blend_init(darktable.blendop);
+  _init_step(&step, "control");
+
+  // startup order, everything else runs on the main thread:
+  //   opencl -----------------------------------> blendop, iop modules
+  //   image cache -> mipmap cache -> pipe cache --> views
+  //   points, gui --------------------------------^
+  // the two tasks don't touch gtk, and nothing but them touches their subsystems until they are done.
+  dt_init_task_t opencl_task = { 0 }, caches_task = { 0 };
+  // gtk_init() shuffles argv while opencl looks at it:
+  dt_init_opencl_t opencl_args = { argc, g_memdup(argv, argc * sizeof(char *)) };
+  _init_task_start(&opencl_task, "opencl", _init_opencl, &opencl_args);
+  _init_task_start(&caches_task, "caches", _init_caches, NULL);
+#ifdef HAVE_RAWSPEED
+  // the camera database, nobody waits for it unless a raw is opened right away:
+  dt_imageio_rawspeed_preload();
+#endif
 
   darktable.points = (dt_points_t *)malloc(sizeof(dt_points_t));
   memset(darktable.points, 0, sizeof(dt_points_t));
   dt_points_init(darktable.points, dt_get_num_threads());
 
-  // must come before mipmap_cache, because that one will need to access
-  // image dimensions stored in here:
-  darktable.image_cache = (dt_image_cache_t *)malloc(sizeof(dt_image_cache_t));
-  memset(darktable.image_cache, 0, sizeof(dt_image_cache_t));
-  dt_image_cache_init(darktable.image_cache);
-
-  darktable.mipmap_cache = (dt_mipmap_cache_t *)malloc(sizeof(dt_mipmap_cache_t));
-  memset(darktable.mipmap_cache, 0, sizeof(dt_mipmap_cache_t));
-  dt_mipmap_cache_init(darktable.mipmap_cache);
-
   // The GUI must be initialized before the views, because the init()
   // functions of the views depend on darktable.control->accels_* to register
   // their keyboard accelerators
@@ -663,17 +818,42 @@ int dt_init(int argc, char *argv[], const int init_gui)
   {
     darktable.gui = (dt_gui_gtk_t *)malloc(sizeof(dt_gui_gtk_t));
     memset(darktable.gui,0,sizeof(dt_gui_gtk_t));
-    if(dt_gui_gtk_init(darktable.gui, argc, argv)) return 1;
+    if(dt_gui_gtk_init(darktable.gui, argc, argv))
+    {
+      _init_task_wait(&opencl_task);
+      _init_task_wait(&caches_task);
+      return 1;
+    }
     dt_bauhaus_init();
   }
   else darktable.gui = NULL;
+  _init_step(&step, "gui");
+
+  _init_task_wait(&caches_task);
+  dt_get_times(&step);
 
   darktable.view_manager = (dt_view_manager_t *)malloc(sizeof(dt_view_manager_t));
   memset(darktable.view_manager, 0, sizeof(dt_view_manager_t));
-  dt_view_manager_init(darktable.view_manager);
+  if(darktable.headless)
+  {
+    // no views to switch to, but the pixelpipes still look at the develop struct:
+    darktable.view_manager->current_view = -1;
+    darktable.develop = (dt_develop_t *)malloc(sizeof(dt_develop_t));
+    dt_dev_init(darktable.develop, 0);
+  }
+  else dt_view_manager_init(darktable.view_manager);
+  _init_step(&step, "views");
+
+  _init_task_wait(&opencl_task);
+  dt_get_times(&step);
+
+  darktable.blendop = (dt_blendop_t *)malloc(sizeof(dt_blendop_t));
+  memset(darktable.blendop, 0, sizeof(dt_blendop_t));
+  dt_develop_blend_init(darktable.blendop);
 
   // load the darkroom mode plugins once:
   dt_iop_load_modules_so();
+  _init_step(&step, "iop modules");
 
   if(init_gui)
   {
@@ -683,10 +863,12 @@ int dt_init(int argc, char *argv[], const int init_gui)
 
     dt_control_load_config(darktable.control);
     g_strlcpy(darktable.control->global_settings.dbname, filename, 512); // overwrite if relocated.
+    _init_step(&step, "lib modules");
   }
   darktable.imageio = (dt_imageio_t *)malloc(sizeof(dt_imageio_t));
   memset(darktable.imageio, 0, sizeof(dt_imageio_t));
   dt_imageio_init(darktable.imageio);
+  _init_step(&step, "imageio");
 
   if(init_gui)
   {
@@ -737,6 +919,14 @@ int dt_init(int argc, char *argv[], const int init_gui)
     }
     else
       dt_ctl_switch_mode_to(DT_LIBRARY);
+
+    // import new images from the watched folders as they show up:
+    gchar *folders = dt_conf_get_string("plugins/lighttable/import/watched_folders");
+    gchar **folder = g_strsplit(folders, G_SEARCHPATH_SEPARATOR_S, 0);
+    for(int k=0; folder[k]; k++)
+      if(folder[k][0]) dt_fswatch_add(darktable.fswatch, DT_FSWATCH_FOLDER, folder[k]);
+    g_strfreev(folder);
+    g_free(folders);
   }
 
   if(darktable.unmuted & DT_DEBUG_MEMORY)
@@ -745,10 +935,14 @@ int dt_init(int argc, char *argv[], const int init_gui)
     dt_print_mem_usage();
   }
 
+  _init_step(&step, "keymap and first view");
+
   /* init lua last, since it's user made stuff it must be in the real environment */
 #ifdef USE_LUA
   dt_lua_init(darktable.lua_state,init_gui);
+  _init_step(&step, "lua");
 #endif
+  dt_show_times(&start, "[dt_init] startup", NULL);
   return 0;
 }
 
@@ -767,7 +961,13 @@ void dt_cleanup()
     dt_lib_cleanup(darktable.lib);
     free(darktable.lib);
   }
-  dt_view_manager_cleanup(darktable.view_manager);
+  if(darktable.headless)
+  {
+    dt_dev_cleanup(darktable.develop);
+    free(darktable.develop);
+    darktable.develop = NULL;
+  }
+  else dt_view_manager_cleanup(darktable.view_manager);
   free(darktable.view_manager);
   if(init_gui)
   {
@@ -776,8 +976,10 @@ void dt_cleanup()
     dt_gui_gtk_cleanup(darktable.gui);
     free(darktable.gui);
   }
+  dt_memory_governor_cleanup();
   dt_image_cache_cleanup(darktable.image_cache);
   free(darktable.image_cache);
+  dt_grouping_cleanup();
   dt_mipmap_cache_cleanup(darktable.mipmap_cache);
   free(darktable.mipmap_cache);
   if(init_gui)
@@ -786,6 +988,10 @@ void dt_cleanup()
     free(darktable.control);
     dt_undo_cleanup(darktable.undo);
   }
+  // all pipes are gone by now, including the ones of export jobs:
+  dt_imageio_export_cleanup();
+  dt_styles_preview_cleanup();
+  dt_dev_pixelpipe_cache_pool_cleanup();
   dt_conf_cleanup(darktable.conf);
   free(darktable.conf);
   dt_points_cleanup(darktable.points);
@@ -798,11 +1004,14 @@ void dt_cleanup()
 #endif
   dt_pwstorage_destroy(darktable.pwstorage);
   dt_fswatch_destroy(darktable.fswatch);
+  dt_trace_cleanup();
+  dt_profiling_cleanup();
 
 #ifdef HAVE_GRAPHICSMAGICK
   DestroyMagick();
 #endif
 
+  dt_presets_cache_cleanup();
   dt_database_destroy(darktable.db);
 
   dt_bauhaus_cleanup();
@@ -854,6 +1063,27 @@ void *dt_alloc_align(size_t alignment, size_t size)
 #endif
 }
 
+// transparent huge pages are 2MB on x86_64, smaller buffers don't gain anything.
+#define DT_HUGEPAGE_SIZE (2u<<20)
+
+void *dt_alloc_align_huge(size_t alignment, size_t size)
+{
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if(size >= 4*DT_HUGEPAGE_SIZE && alignment <= DT_HUGEPAGE_SIZE && dt_conf_get_bool("host_memory_hugepages"))
+  {
+    // whole huge pages, so the kernel can back all of it. the pages are placed on the
+    // numa node of the thread touching them first, usually the one which owns the buffer.
+    size = (size + DT_HUGEPAGE_SIZE - 1) & ~(size_t)(DT_HUGEPAGE_SIZE - 1);
+    void *ptr = NULL;
+    if(posix_memalign(&ptr, DT_HUGEPAGE_SIZE, size)) return NULL;
+    // only a hint, fails harmlessly if the kernel has them disabled:
+    madvise(ptr, size, MADV_HUGEPAGE);
+    return ptr;
+  }
+#endif
+  return dt_alloc_align(alignment, size);
+}
+
 void dt_show_times(const dt_times_t *start, const char *prefix, const char *suffix, ...)
 {
   dt_times_t end;
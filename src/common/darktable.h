@@ -32,6 +32,7 @@
 #endif
 #include "common/dtpthread.h"
 #include "common/database.h"
+#include "common/memory_stats.h"
 #include "common/utility.h"
 #include <time.h>
 #include <sys/resource.h>
@@ -66,6 +67,7 @@ typedef	unsigned int	u_int;
 #else
 #define omp_get_max_threads() 1
 #define omp_get_thread_num() 0
+#define omp_in_parallel() 0
 #endif
 
 #define DT_MODULE_VERSION 8   // version of dt's module interface
@@ -151,12 +153,24 @@ typedef enum dt_debug_thread_t
   DT_DEBUG_NAN = 2048,
   DT_DEBUG_MASKS = 4096,
   DT_DEBUG_LUA = 8192,
+  DT_DEBUG_IMAGEIO = 16384,
 }
 dt_debug_thread_t;
 
 #define DT_CPU_FLAG_SSE    1
 #define DT_CPU_FLAG_SSE2   2
 #define DT_CPU_FLAG_SSE3   4
+#define DT_CPU_FLAG_AVX    8
+#define DT_CPU_FLAG_AVX2   16
+#define DT_CPU_FLAG_FMA    32
+
+// code for newer cpus than the build targets is compiled per function, and only called if
+// dt_init() found the cpu to support it. needs gcc >= 4.9 or clang for intrinsics in such functions.
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define DT_AVX2_CODEPATH 1
+#define DT_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
 
 typedef struct darktable_t
 {
@@ -165,6 +179,8 @@ typedef struct darktable_t
 
   int32_t thumbnail_width, thumbnail_height;
   int32_t unmuted;
+  // started with --headless: no views, small thumbnail caches, in-memory library by default.
+  int32_t headless;
   GList                          *iop;
   GList                          *collection_listeners;
   GList                          *capabilities;
@@ -190,6 +206,7 @@ typedef struct darktable_t
   struct dt_blendop_t            *blendop;
   struct dt_dbus_t               *dbus;
   struct dt_undo_t               *undo;
+  struct dt_trace_t              *trace;
   dt_pthread_mutex_t db_insert;
   dt_pthread_mutex_t plugin_threadsafe;
   dt_pthread_mutex_t capabilities_threadsafe;
@@ -219,6 +236,9 @@ void dt_print(dt_debug_thread_t thread, const char *msg, ...);
 void dt_gettime_t(char *datetime, time_t t);
 void dt_gettime(char *datetime);
 void *dt_alloc_align(size_t alignment, size_t size);
+/** for large image buffers: like dt_alloc_align(), but backed by huge pages if
+ *  `host_memory_hugepages' is set, to cut down on tlb misses. free() it as usual. */
+void *dt_alloc_align_huge(size_t alignment, size_t size);
 int dt_capabilities_check(char *capability);
 void dt_capabilities_add(char *capability);
 void dt_capabilities_remove(char *capability);
@@ -245,6 +265,17 @@ void dt_show_times(const dt_times_t *start, const char *prefix, const char *suff
 /** \brief check if file is a supported image */
 gboolean dt_supported_image(const gchar *filename);
 
+/** true if the variants built with DT_TARGET_AVX2 can be used. */
+static inline int dt_codepath_avx2()
+{
+#ifdef DT_AVX2_CODEPATH
+  const uint32_t avx2 = DT_CPU_FLAG_AVX | DT_CPU_FLAG_AVX2 | DT_CPU_FLAG_FMA;
+  return (darktable.cpu_flags & avx2) == avx2;
+#else
+  return 0;
+#endif
+}
+
 static inline int dt_get_num_threads()
 {
 #ifdef _OPENMP
@@ -347,6 +378,7 @@ static inline void dt_print_mem_usage()
 #else
   fprintf(stderr, "dt_print_mem_usage() currently unsupported on this platform\n");
 #endif
+  dt_memory_stats_print();
 }
 
 static inline int
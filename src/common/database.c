@@ -25,6 +25,7 @@
 
 #include <sqlite3.h>
 #include <glib.h>
+#include <inttypes.h>
 #include <gio/gio.h>
 
 typedef struct dt_database_t
@@ -37,8 +38,35 @@ typedef struct dt_database_t
 
   /* ondisk DB */
   sqlite3 *handle;
+
+  /* idle prepared statements of hot queries, sql text -> GSList of sqlite3_stmt */
+  dt_pthread_mutex_t stmt_cache_mutex;
+  GHashTable *stmt_cache;
+  /* counters for -d sql */
+  uint64_t stmt_cache_hits, stmt_cache_misses;
+  double stmt_cache_prepare_time;
+
+  /* connection of the writer thread, only separate from handle in wal mode */
+  sqlite3 *write_handle;
+  /* queue of dt_database_write_job_t for the writer thread, tickets are counted up per job */
+  dt_pthread_mutex_t write_mutex;
+  pthread_cond_t write_cond;
+  GQueue *write_queue;
+  uint64_t write_queued, write_done;
+  int write_quit, writer_running;
+  pthread_t writer_thread;
 } dt_database_t;
 
+typedef struct dt_database_write_job_t
+{
+  dt_database_write_func_t func;
+  void *data;
+  GDestroyNotify free_func;
+} dt_database_write_job_t;
+
+/* at most this many idle statements are kept per query */
+#define DT_DATABASE_STMT_CACHE_DEPTH 4
+
 
 /* migrates database from old place to new */
 static void _database_migrate_to_xdg_structure();
@@ -46,6 +74,31 @@ static void _database_migrate_to_xdg_structure();
 /* delete old mipmaps files */
 static void _database_delete_mipmaps_files();
 
+static void *_database_writer_thread(void *ptr);
+
+/* -d sql: statements slower than this get their query plan printed, to spot missing indexes */
+#define DT_DATABASE_SLOW_STATEMENT_MS 50
+
+static void _database_profile(void *data, const char *sql, sqlite3_uint64 ns)
+{
+  if(ns < DT_DATABASE_SLOW_STATEMENT_MS * 1000000ull) return;
+  // don't explain ourselves:
+  if(!g_ascii_strncasecmp(sql, "explain", 7)) return;
+  dt_print(DT_DEBUG_SQL, "[sql] slow statement (%.1f ms) \"%s\"\n", ns * 1e-6, sql);
+
+  sqlite3 *handle = (sqlite3 *)data;
+  sqlite3_stmt *stmt;
+  gchar *query = g_strdup_printf("explain query plan %s", sql);
+  if(sqlite3_prepare_v2(handle, query, -1, &stmt, NULL) == SQLITE_OK)
+  {
+    // the last column is the detail, like `SCAN TABLE images' or `SEARCH TABLE images USING INDEX ..'
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+      dt_print(DT_DEBUG_SQL, "[sql]   %s\n", (const char *)sqlite3_column_text(stmt, 3));
+    sqlite3_finalize(stmt);
+  }
+  g_free(query);
+}
+
 gboolean dt_database_is_new(const dt_database_t *db)
 {
   return db->is_new_database;
@@ -123,17 +176,226 @@ dt_database_t *dt_database_init(char *alternative)
   sqlite3_exec(db->handle, "attach database ':memory:' as memory",NULL,NULL,NULL);
 
   sqlite3_exec(db->handle, "PRAGMA synchronous = OFF", NULL, NULL, NULL);
-  sqlite3_exec(db->handle, "PRAGMA journal_mode = MEMORY", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "PRAGMA page_size = 32768", NULL, NULL, NULL);
 
+  /* in wal mode the writer thread gets its own connection, readers on this one don't wait for
+     its transactions. wal needs shared memory, so it may be refused on network filesystems. */
+  gboolean wal = FALSE;
+  if(dt_conf_get_bool("database_wal"))
+  {
+    sqlite3_stmt *stmt;
+    if(sqlite3_prepare_v2(db->handle, "PRAGMA journal_mode = WAL", -1, &stmt, NULL) == SQLITE_OK)
+    {
+      if(sqlite3_step(stmt) == SQLITE_ROW)
+        wal = !g_ascii_strcasecmp((const char *)sqlite3_column_text(stmt, 0), "wal");
+      sqlite3_finalize(stmt);
+    }
+    if(wal && sqlite3_open(db->dbfilename, &db->write_handle) != SQLITE_OK)
+    {
+      sqlite3_close(db->write_handle);
+      db->write_handle = NULL;
+    }
+    if(!db->write_handle) wal = FALSE;
+  }
+  if(!wal)
+  {
+    sqlite3_exec(db->handle, "PRAGMA journal_mode = MEMORY", NULL, NULL, NULL);
+    db->write_handle = db->handle;
+  }
+  else
+  {
+    sqlite3_exec(db->write_handle, "PRAGMA synchronous = OFF", NULL, NULL, NULL);
+    // both connections write, so give the other one time to commit instead of failing:
+    sqlite3_busy_timeout(db->handle, 5000);
+    sqlite3_busy_timeout(db->write_handle, 5000);
+  }
+  dt_print(DT_DEBUG_SQL, "[sql] database journal mode is %s\n", wal ? "wal" : "memory");
+
+  if(darktable.unmuted & DT_DEBUG_SQL)
+  {
+    sqlite3_profile(db->handle, _database_profile, db->handle);
+    if(db->write_handle != db->handle)
+      sqlite3_profile(db->write_handle, _database_profile, db->write_handle);
+  }
+
+  dt_pthread_mutex_init(&db->stmt_cache_mutex, NULL);
+  db->stmt_cache = g_hash_table_new(g_str_hash, g_str_equal);
+
+  dt_pthread_mutex_init(&db->write_mutex, NULL);
+  pthread_cond_init(&db->write_cond, NULL);
+  db->write_queue = g_queue_new();
+  db->writer_running = !pthread_create(&db->writer_thread, NULL, _database_writer_thread, db);
+
   g_free(dbname);
   return db;
 }
 
+static void _database_stmt_cache_free(gpointer key, gpointer value, gpointer data)
+{
+  for(GSList *l = (GSList *)value; l; l = g_slist_next(l))
+    sqlite3_finalize((sqlite3_stmt *)l->data);
+  g_slist_free((GSList *)value);
+  g_free(key);
+}
+
 void dt_database_destroy(const dt_database_t *db)
 {
+  dt_database_t *d = (dt_database_t *)db;
+  if(d->write_queue)
+  {
+    // the writer drains its queue before it quits:
+    dt_pthread_mutex_lock(&d->write_mutex);
+    d->write_quit = 1;
+    pthread_cond_broadcast(&d->write_cond);
+    dt_pthread_mutex_unlock(&d->write_mutex);
+    if(d->writer_running) pthread_join(d->writer_thread, NULL);
+    g_queue_free(d->write_queue);
+    pthread_cond_destroy(&d->write_cond);
+    dt_pthread_mutex_destroy(&d->write_mutex);
+  }
+  if(d->stmt_cache)
+  {
+    dt_print(DT_DEBUG_SQL, "[sql] statement cache: %"PRIu64" hits, %"PRIu64" prepares taking %.3f ms\n",
+             d->stmt_cache_hits, d->stmt_cache_misses, d->stmt_cache_prepare_time * 1000.0);
+    // statements have to be finalized before the connection can be closed:
+    g_hash_table_foreach(d->stmt_cache, _database_stmt_cache_free, NULL);
+    g_hash_table_destroy(d->stmt_cache);
+    dt_pthread_mutex_destroy(&d->stmt_cache_mutex);
+  }
+  if(d->write_handle && d->write_handle != d->handle) sqlite3_close(d->write_handle);
   sqlite3_close(db->handle);
-  g_free((dt_database_t *)db);
+  g_free(d);
+}
+
+sqlite3 *dt_database_get_writer(const dt_database_t *db)
+{
+  return db->write_handle ? db->write_handle : db->handle;
+}
+
+static void *_database_writer_thread(void *ptr)
+{
+  dt_database_t *db = (dt_database_t *)ptr;
+  while(1)
+  {
+    dt_pthread_mutex_lock(&db->write_mutex);
+    while(g_queue_is_empty(db->write_queue) && !db->write_quit)
+      dt_pthread_cond_wait(&db->write_cond, &db->write_mutex);
+    dt_database_write_job_t *job = (dt_database_write_job_t *)g_queue_pop_head(db->write_queue);
+    dt_pthread_mutex_unlock(&db->write_mutex);
+    if(!job) break; // quit with an empty queue
+
+    job->func(db->write_handle, job->data);
+    if(job->free_func) job->free_func(job->data);
+    g_free(job);
+
+    dt_pthread_mutex_lock(&db->write_mutex);
+    db->write_done++;
+    pthread_cond_broadcast(&db->write_cond);
+    dt_pthread_mutex_unlock(&db->write_mutex);
+  }
+  return NULL;
+}
+
+uint64_t dt_database_write_async(const dt_database_t *db, dt_database_write_func_t func, void *data,
+                                 GDestroyNotify free_func)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  if(!d->writer_running)
+  {
+    // no writer thread (database locked by another instance), just do it now:
+    func(dt_database_get_writer(db), data);
+    if(free_func) free_func(data);
+    return 0;
+  }
+  dt_database_write_job_t *job = (dt_database_write_job_t *)g_malloc(sizeof(dt_database_write_job_t));
+  job->func = func;
+  job->data = data;
+  job->free_func = free_func;
+  dt_pthread_mutex_lock(&d->write_mutex);
+  g_queue_push_tail(d->write_queue, job);
+  const uint64_t ticket = ++d->write_queued;
+  pthread_cond_broadcast(&d->write_cond);
+  dt_pthread_mutex_unlock(&d->write_mutex);
+  return ticket;
+}
+
+void dt_database_write_wait(const dt_database_t *db, uint64_t ticket)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  // jobs run in order, so a job waiting for the queue would wait for itself:
+  if(!d->writer_running || pthread_equal(pthread_self(), d->writer_thread)) return;
+  // the writer can't commit while a transaction is open on the main connection, that would deadlock:
+  if(d->write_handle != d->handle && !sqlite3_get_autocommit(d->handle)) return;
+  dt_pthread_mutex_lock(&d->write_mutex);
+  while(d->write_done < ticket)
+    dt_pthread_cond_wait(&d->write_cond, &d->write_mutex);
+  dt_pthread_mutex_unlock(&d->write_mutex);
+}
+
+void dt_database_write_sync(const dt_database_t *db)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  if(!d->writer_running) return;
+  dt_pthread_mutex_lock(&d->write_mutex);
+  const uint64_t ticket = d->write_queued;
+  dt_pthread_mutex_unlock(&d->write_mutex);
+  dt_database_write_wait(db, ticket);
+}
+
+sqlite3_stmt *dt_database_prepare_cached(const dt_database_t *db, const char *query)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  sqlite3_stmt *stmt = NULL;
+
+  // take an idle statement out of the cache, so no other thread can step it meanwhile:
+  dt_pthread_mutex_lock(&d->stmt_cache_mutex);
+  gpointer key = NULL, value = NULL;
+  if(g_hash_table_lookup_extended(d->stmt_cache, query, &key, &value) && value)
+  {
+    GSList *idle = (GSList *)value;
+    stmt = (sqlite3_stmt *)idle->data;
+    g_hash_table_insert(d->stmt_cache, key, g_slist_delete_link(idle, idle));
+    d->stmt_cache_hits++;
+  }
+  dt_pthread_mutex_unlock(&d->stmt_cache_mutex);
+  if(stmt) return stmt;
+
+  const double start = dt_get_wtime();
+  DT_DEBUG_SQLITE3_PREPARE_V2(d->handle, query, -1, &stmt, NULL);
+  const double elapsed = dt_get_wtime() - start;
+  dt_print(DT_DEBUG_SQL, "[sql] prepared \"%s\" for the statement cache in %.3f ms\n", query, elapsed * 1000.0);
+
+  dt_pthread_mutex_lock(&d->stmt_cache_mutex);
+  d->stmt_cache_misses++;
+  d->stmt_cache_prepare_time += elapsed;
+  dt_pthread_mutex_unlock(&d->stmt_cache_mutex);
+  return stmt;
+}
+
+void dt_database_release_cached(const dt_database_t *db, sqlite3_stmt *stmt)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  if(!stmt) return;
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+
+  dt_pthread_mutex_lock(&d->stmt_cache_mutex);
+  const char *query = sqlite3_sql(stmt);
+  gpointer key = NULL, value = NULL;
+  if(!g_hash_table_lookup_extended(d->stmt_cache, query, &key, &value))
+  {
+    g_hash_table_insert(d->stmt_cache, g_strdup(query), g_slist_prepend(NULL, stmt));
+    stmt = NULL;
+  }
+  else if(g_slist_length((GSList *)value) < DT_DATABASE_STMT_CACHE_DEPTH)
+  {
+    g_hash_table_insert(d->stmt_cache, key, g_slist_prepend((GSList *)value, stmt));
+    stmt = NULL;
+  }
+  dt_pthread_mutex_unlock(&d->stmt_cache_mutex);
+
+  // more threads than we keep statements for ran this query at once:
+  if(stmt) sqlite3_finalize(stmt);
 }
 
 sqlite3 *dt_database_get(const dt_database_t *db)
@@ -20,6 +20,7 @@
 #define DATABASE_H
 
 #include <glib.h>
+#include <inttypes.h>
 
 /** allocates and initializes database */
 struct dt_database_t *dt_database_init(char *alternative);
@@ -33,6 +34,24 @@ gboolean dt_database_is_new(const struct dt_database_t *db);
 const gchar *dt_database_get_path(const struct dt_database_t *db);
 /** test if database was already locked by another instance */
 gboolean dt_database_get_already_locked(const struct dt_database_t *db);
+/** get a prepared statement for query, reused from earlier calls if possible. query
+    has to be a constant string, not one with values printed into it. the statement
+    is exclusively the caller's until handed back with dt_database_release_cached(). */
+struct sqlite3_stmt *dt_database_prepare_cached(const struct dt_database_t *db, const char *query);
+/** a write to run on the writer thread, handle is its connection. that one doesn't have the memory database attached. */
+typedef void (*dt_database_write_func_t)(struct sqlite3 *handle, void *data);
+/** queues func to run on the writer thread after all writes queued before, data is freed with
+    free_func afterwards. @return a ticket to wait for with dt_database_write_wait(). */
+uint64_t dt_database_write_async(const struct dt_database_t *db, dt_database_write_func_t func, void *data,
+                                 GDestroyNotify free_func);
+/** blocks until the write with this ticket, and so all before it, is done. */
+void dt_database_write_wait(const struct dt_database_t *db, uint64_t ticket);
+/** blocks until everything queued so far is written, for reads which have to see it. */
+void dt_database_write_sync(const struct dt_database_t *db);
+/** connection the writer thread uses, same as dt_database_get() unless in wal mode. */
+struct sqlite3 *dt_database_get_writer(const struct dt_database_t *db);
+/** resets the statement and keeps it for the next dt_database_prepare_cached(), use instead of sqlite3_finalize(). */
+void dt_database_release_cached(const struct dt_database_t *db, struct sqlite3_stmt *stmt);
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
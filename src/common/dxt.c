@@ -0,0 +1,344 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "common/dxt.h"
+
+#include <emmintrin.h>
+#include <math.h>
+#include <string.h>
+
+// the first three channels of the 16 pixels of a block, one row of four pixels per vector.
+typedef struct _dxt_block_t
+{
+  __m128 c[3][4];
+}
+_dxt_block_t;
+
+static inline float
+_hsum(const __m128 v)
+{
+  __m128 t = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 1));
+  return _mm_cvtss_f32(t);
+}
+
+// expand to 8 bits per channel by replicating the high bits, as every dxt decoder does.
+static inline void
+_unpack565(const int v, int c[3])
+{
+  const int r = (v >> 11) & 0x1f, g = (v >> 5) & 0x3f, b = v & 0x1f;
+  c[0] = (r << 3) | (r >> 2);
+  c[1] = (g << 2) | (g >> 4);
+  c[2] = (b << 3) | (b >> 2);
+}
+
+static inline int
+_quantize(const float v, const int limit)
+{
+  const int i = (int)(v * (limit/255.0f) + 0.5f);
+  return i < 0 ? 0 : (i > limit ? limit : i);
+}
+
+static inline int
+_pack565(const float c[3])
+{
+  return (_quantize(c[0], 31) << 11) | (_quantize(c[1], 63) << 5) | _quantize(c[2], 31);
+}
+
+// the colours a block with endpoints a, b decodes to. a > b selects four colours,
+// otherwise there are three and the transparent black.
+static inline void
+_palette(const int a, const int b, int pal[4][3])
+{
+  _unpack565(a, pal[0]);
+  _unpack565(b, pal[1]);
+  for(int k=0; k<3; k++)
+  {
+    if(a > b)
+    {
+      pal[2][k] = (2*pal[0][k] + pal[1][k])/3;
+      pal[3][k] = (pal[0][k] + 2*pal[1][k])/3;
+    }
+    else
+    {
+      pal[2][k] = (pal[0][k] + pal[1][k])/2;
+      pal[3][k] = 0;
+    }
+  }
+}
+
+static inline void
+_load_block(const uint8_t *in, const int width, const int height, const int bx, const int by, _dxt_block_t *blk)
+{
+  const __m128i mask = _mm_set1_epi32(0xff);
+  for(int y=0; y<4; y++)
+  {
+    // pixels outside the image repeat the last row/column, so they don't pull the fit anywhere new:
+    const int yy = by*4 + y < height ? by*4 + y : height - 1;
+    const uint8_t *row = in + 4*(size_t)yy*width;
+    __m128i px;
+    if(bx*4 + 4 <= width)
+      px = _mm_loadu_si128((const __m128i *)(row + 16*bx));
+    else
+    {
+      uint32_t tmp[4];
+      for(int x=0; x<4; x++)
+      {
+        const int xx = bx*4 + x < width ? bx*4 + x : width - 1;
+        memcpy(tmp + x, row + 4*xx, sizeof(uint32_t));
+      }
+      px = _mm_loadu_si128((const __m128i *)tmp);
+    }
+    blk->c[0][y] = _mm_cvtepi32_ps(_mm_and_si128(px, mask));
+    blk->c[1][y] = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 8), mask));
+    blk->c[2][y] = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, 16), mask));
+  }
+}
+
+// nearest palette entry for every pixel, packed to 2 bits each. returns the squared error.
+static inline float
+_indices(const _dxt_block_t *blk, const int pal[4][3], uint32_t *bits)
+{
+  __m128 err = _mm_setzero_ps();
+  *bits = 0;
+  for(int y=0; y<4; y++)
+  {
+    __m128 best = _mm_set1_ps(1e30f), idx = _mm_setzero_ps();
+    for(int k=0; k<4; k++)
+    {
+      const __m128 d0 = _mm_sub_ps(blk->c[0][y], _mm_set1_ps(pal[k][0]));
+      const __m128 d1 = _mm_sub_ps(blk->c[1][y], _mm_set1_ps(pal[k][1]));
+      const __m128 d2 = _mm_sub_ps(blk->c[2][y], _mm_set1_ps(pal[k][2]));
+      const __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d0, d0), _mm_mul_ps(d1, d1)), _mm_mul_ps(d2, d2));
+      const __m128 closer = _mm_cmplt_ps(dist, best);
+      best = _mm_min_ps(dist, best);
+      idx = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps(k)), _mm_andnot_ps(closer, idx));
+    }
+    err = _mm_add_ps(err, best);
+    int32_t i[4];
+    _mm_storeu_si128((__m128i *)i, _mm_cvttps_epi32(idx));
+    *bits |= (uint32_t)(i[0] | (i[1] << 2) | (i[2] << 4) | (i[3] << 6)) << (8*y);
+  }
+  return _hsum(err);
+}
+
+// endpoints from the two pixels furthest apart along the principal axis of the block.
+// returns 0 if all pixels have the same colour.
+static inline int
+_range_fit(const _dxt_block_t *blk, float start[3], float end[3])
+{
+  float mean[3];
+  for(int k=0; k<3; k++)
+    mean[k] = _hsum(_mm_add_ps(_mm_add_ps(blk->c[k][0], blk->c[k][1]), _mm_add_ps(blk->c[k][2], blk->c[k][3])))/16.0f;
+
+  __m128 d[3][4];
+  for(int k=0; k<3; k++) for(int y=0; y<4; y++)
+      d[k][y] = _mm_sub_ps(blk->c[k][y], _mm_set1_ps(mean[k]));
+  float cov[3][3];
+  for(int i=0; i<3; i++) for(int j=i; j<3; j++)
+    {
+      __m128 s = _mm_setzero_ps();
+      for(int y=0; y<4; y++) s = _mm_add_ps(s, _mm_mul_ps(d[i][y], d[j][y]));
+      cov[i][j] = cov[j][i] = _hsum(s);
+    }
+
+  // power iteration, starting from the channel with the largest variance:
+  int m = 0;
+  if(cov[1][1] > cov[m][m]) m = 1;
+  if(cov[2][2] > cov[m][m]) m = 2;
+  if(cov[m][m] < 1.0f) return 0;
+  float axis[3] = { cov[m][0], cov[m][1], cov[m][2] };
+  for(int it=0; it<8; it++)
+  {
+    float v[3];
+    for(int k=0; k<3; k++) v[k] = cov[k][0]*axis[0] + cov[k][1]*axis[1] + cov[k][2]*axis[2];
+    float norm = fabsf(v[0]) > fabsf(v[1]) ? fabsf(v[0]) : fabsf(v[1]);
+    norm = fabsf(v[2]) > norm ? fabsf(v[2]) : norm;
+    if(norm == 0.0f) break;
+    for(int k=0; k<3; k++) axis[k] = v[k]/norm;
+  }
+
+  float proj[16];
+  for(int y=0; y<4; y++)
+    _mm_storeu_ps(proj + 4*y, _mm_add_ps(_mm_add_ps(
+                    _mm_mul_ps(d[0][y], _mm_set1_ps(axis[0])),
+                    _mm_mul_ps(d[1][y], _mm_set1_ps(axis[1]))),
+                    _mm_mul_ps(d[2][y], _mm_set1_ps(axis[2]))));
+  int imin = 0, imax = 0;
+  for(int i=1; i<16; i++)
+  {
+    if(proj[i] < proj[imin]) imin = i;
+    if(proj[i] > proj[imax]) imax = i;
+  }
+  float px[3][16];
+  for(int k=0; k<3; k++) for(int y=0; y<4; y++) _mm_storeu_ps(px[k] + 4*y, blk->c[k][y]);
+  for(int k=0; k<3; k++)
+  {
+    start[k] = px[k][imax];
+    end[k]   = px[k][imin];
+  }
+  return 1;
+}
+
+// least squares endpoints for the given indices.
+static inline int
+_refit(const _dxt_block_t *blk, const uint32_t bits, float start[3], float end[3])
+{
+  static const float w_start[4] = { 1.0f, 0.0f, 2.0f/3.0f, 1.0f/3.0f };
+  float px[3][16];
+  for(int k=0; k<3; k++) for(int y=0; y<4; y++) _mm_storeu_ps(px[k] + 4*y, blk->c[k][y]);
+  float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[3] = { 0.0f }, bx[3] = { 0.0f };
+  for(int i=0; i<16; i++)
+  {
+    const float a = w_start[(bits >> (2*i)) & 3], b = 1.0f - a;
+    aa += a*a;
+    ab += a*b;
+    bb += b*b;
+    for(int k=0; k<3; k++)
+    {
+      ax[k] += a*px[k][i];
+      bx[k] += b*px[k][i];
+    }
+  }
+  const float det = aa*bb - ab*ab;
+  if(fabsf(det) < 1e-6f) return 0;
+  for(int k=0; k<3; k++)
+  {
+    start[k] = (ax[k]*bb - bx[k]*ab)/det;
+    end[k]   = (bx[k]*aa - ax[k]*ab)/det;
+  }
+  return 1;
+}
+
+// picks the indices for the endpoints, returns the error. fills a > b for four colour
+// blocks, a == b if both quantize to the same colour (then all indices are 0).
+static inline float
+_encode(const _dxt_block_t *blk, const float start[3], const float end[3], int *a, int *b, uint32_t *bits)
+{
+  *a = _pack565(start);
+  *b = _pack565(end);
+  if(*a < *b)
+  {
+    const int t = *a;
+    *a = *b;
+    *b = t;
+  }
+  int pal[4][3];
+  _palette(*a, *b, pal);
+  if(*a == *b)
+  {
+    // three colour mode, index 3 would be transparent: only use the one colour.
+    for(int k=1; k<4; k++) memcpy(pal[k], pal[0], sizeof(pal[0]));
+    const float err = _indices(blk, pal, bits);
+    *bits = 0;
+    return err;
+  }
+  return _indices(blk, pal, bits);
+}
+
+static void
+_compress_block(const _dxt_block_t *blk, uint8_t *out, const dt_dxt_quality_t quality)
+{
+  float start[3], end[3];
+  int a, b;
+  uint32_t bits;
+  if(!_range_fit(blk, start, end))
+  {
+    // one colour: the mean is as good as it gets within the 565 grid.
+    for(int k=0; k<3; k++)
+      start[k] = end[k] = _hsum(_mm_add_ps(_mm_add_ps(blk->c[k][0], blk->c[k][1]), _mm_add_ps(blk->c[k][2], blk->c[k][3])))/16.0f;
+  }
+  float err = _encode(blk, start, end, &a, &b, &bits);
+  if(quality == DT_DXT_REFINE && a != b)
+  {
+    for(int it=0; it<2; it++)
+    {
+      int ra, rb;
+      uint32_t rbits;
+      if(!_refit(blk, bits, start, end)) break;
+      const float rerr = _encode(blk, start, end, &ra, &rb, &rbits);
+      if(rerr >= err) break;
+      err = rerr;
+      a = ra;
+      b = rb;
+      bits = rbits;
+    }
+  }
+  out[0] = a & 0xff;
+  out[1] = a >> 8;
+  out[2] = b & 0xff;
+  out[3] = b >> 8;
+  for(int y=0; y<4; y++) out[4+y] = (bits >> (8*y)) & 0xff;
+}
+
+void
+dt_dxt1_compress(const uint8_t *in, const int width, const int height, uint8_t *blocks, const dt_dxt_quality_t quality)
+{
+  const int nbx = (width + 3)/4, nby = (height + 3)/4;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) if(nby > 16)
+#endif
+  for(int by=0; by<nby; by++)
+  {
+    _dxt_block_t blk;
+    for(int bx=0; bx<nbx; bx++)
+    {
+      _load_block(in, width, height, bx, by, &blk);
+      _compress_block(&blk, blocks + 8*((size_t)by*nbx + bx), quality);
+    }
+  }
+}
+
+void
+dt_dxt1_decompress(uint8_t *out, const int width, const int height, const uint8_t *blocks)
+{
+  const int nbx = (width + 3)/4, nby = (height + 3)/4;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) if(nby > 16)
+#endif
+  for(int by=0; by<nby; by++)
+  {
+    for(int bx=0; bx<nbx; bx++)
+    {
+      const uint8_t *blk = blocks + 8*((size_t)by*nbx + bx);
+      const int a = blk[0] | (blk[1] << 8), b = blk[2] | (blk[3] << 8);
+      int c[4][3];
+      _palette(a, b, c);
+      uint32_t pal[4];
+      for(int k=0; k<4; k++)
+      {
+        const uint32_t alpha = (a <= b && k == 3) ? 0 : 255;
+        pal[k] = c[k][0] | (c[k][1] << 8) | (c[k][2] << 16) | (alpha << 24);
+      }
+      const int full = bx*4 + 4 <= width;
+      for(int y=0; y<4 && by*4 + y < height; y++)
+      {
+        const int i = blk[4+y];
+        uint8_t *row = out + 4*((size_t)(by*4 + y)*width + bx*4);
+        if(full)
+          _mm_storeu_si128((__m128i *)row, _mm_setr_epi32(pal[i & 3], pal[(i >> 2) & 3], pal[(i >> 4) & 3], pal[i >> 6]));
+        else
+          for(int x=0; bx*4 + x < width; x++)
+            memcpy(row + 4*x, pal + ((i >> (2*x)) & 3), sizeof(uint32_t));
+      }
+    }
+  }
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
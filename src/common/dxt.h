@@ -0,0 +1,56 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_DXT_H
+#define DT_DXT_H
+
+#include <inttypes.h>
+
+/**
+ * dxt1 block compression for the 8-bit mipmaps. the blocks are laid out like
+ * libsquish writes them (8 bytes per 4x4 block, rows of blocks, first 565 colour
+ * from the first byte of a pixel), so thumbnails stored by either can be read by
+ * the other. four channel pixels go in and come out, the fourth byte is only
+ * written by the decoder (255, or 0 for the transparent index of three colour blocks).
+ */
+
+typedef enum dt_dxt_quality_t
+{
+  // endpoints from the extremes along the principal axis of each block
+  DT_DXT_RANGE_FIT = 0,
+  // additionally refit the endpoints to the chosen indices by least squares
+  DT_DXT_REFINE = 1
+}
+dt_dxt_quality_t;
+
+/** bytes needed for the compressed image. */
+static inline int32_t
+dt_dxt1_size(const int width, const int height)
+{
+  return ((width + 3)/4) * ((height + 3)/4) * 8;
+}
+
+/** compress a width x height image with 4 bytes per pixel into dt_dxt1_size() bytes of blocks. */
+void dt_dxt1_compress(const uint8_t *in, const int width, const int height, uint8_t *blocks, const dt_dxt_quality_t quality);
+
+/** decompress blocks to a width x height image with 4 bytes per pixel. */
+void dt_dxt1_decompress(uint8_t *out, const int width, const int height, const uint8_t *blocks);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -49,7 +49,9 @@ extern "C"
 #include <sstream>
 #include <cassert>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <string>
+#include <vector>
 
 #define DT_XMP_KEYS_NUM 15 // the number of XmpBag XmpSeq keys that dt uses
 
@@ -757,43 +759,224 @@ int dt_exif_read_from_blob(dt_image_t *img, uint8_t *blob, const int size)
   }
 }
 
+/** everything one pass of exiv2 over a file yields. import, thumbnail creation and the image loaders
+ * all ask for the same file within a short time, so the last few are kept around. entries in the
+ * cache are never changed, and freed when the last reference is gone. */
+typedef struct dt_exif_parsed_t
+{
+  std::string path;
+  int64_t mtime, size;
+  int refs;
+  uint64_t used;
+  Exiv2::ExifData exif;
+  Exiv2::IptcData iptc;
+  Exiv2::XmpData xmp;
+  // the embedded exif thumbnail (a jpeg), and the rows of it which are valid:
+  std::vector<uint8_t> thumb;
+  int thumb_y_beg, thumb_y_end;
+}
+dt_exif_parsed_t;
+
+#define DT_EXIF_CACHE_SIZE 64
+
+static dt_pthread_mutex_t _exif_cache_mutex;
+static dt_exif_parsed_t *_exif_cache[DT_EXIF_CACHE_SIZE];
+static uint64_t _exif_cache_tick = 0;
+
+static dt_exif_parsed_t *_exif_parse(const char *path)
+{
+  Exiv2::Image::AutoPtr image;
+  // exiv2 maps the file and only touches the pages with the metadata directories, not the raw data:
+  image = Exiv2::ImageFactory::open(path);
+  assert(image.get() != 0);
+  image->readMetadata();
+
+  dt_exif_parsed_t *p = new dt_exif_parsed_t;
+  p->exif = image->exifData();
+  p->iptc = image->iptcData();
+  p->xmp = image->xmpData();
+  p->thumb_y_beg = p->thumb_y_end = 0;
+
+  Exiv2::ExifThumbC thumb(p->exif);
+  Exiv2::DataBuf buf = thumb.copy();
+  if(buf.pData_)
+  {
+    p->thumb.assign(buf.pData_, buf.pData_ + buf.size_);
+    // canon crops that thumbnail:
+    Exiv2::ExifData::const_iterator pos;
+    if ( (pos=p->exif.findKey(Exiv2::ExifKey("Exif.Canon.ThumbnailImageValidArea")))
+         != p->exif.end() && pos->size() && pos->count() == 4)
+    {
+      // pos->toLong(0); // x bounds. we ignore those because canon doesn't seem
+      // to set them.
+      p->thumb_y_beg = pos->toLong(2);
+      p->thumb_y_end = pos->toLong(3);
+    }
+  }
+  return p;
+}
+
+static void _exif_parsed_unref_locked(dt_exif_parsed_t *p)
+{
+  if(--p->refs == 0) delete p;
+}
+
+static void _exif_parsed_unref(dt_exif_parsed_t *p)
+{
+  if(!p) return;
+  dt_pthread_mutex_lock(&_exif_cache_mutex);
+  _exif_parsed_unref_locked(p);
+  dt_pthread_mutex_unlock(&_exif_cache_mutex);
+}
+
+/** returns the metadata of the file with a reference held, parses it only if the cache has no
+ * entry for its current size and modification time. throws what exiv2 throws. */
+static dt_exif_parsed_t *_exif_parsed_get(const char *path)
+{
+  GStatBuf st;
+  const int64_t mtime = g_stat(path, &st) ? -1 : st.st_mtime;
+  const int64_t size = mtime == -1 ? -1 : st.st_size;
+
+  dt_pthread_mutex_lock(&_exif_cache_mutex);
+  for(int k=0; k<DT_EXIF_CACHE_SIZE && mtime != -1; k++)
+  {
+    dt_exif_parsed_t *p = _exif_cache[k];
+    if(p && p->mtime == mtime && p->size == size && p->path == path)
+    {
+      p->refs++;
+      p->used = ++_exif_cache_tick;
+      dt_pthread_mutex_unlock(&_exif_cache_mutex);
+      return p;
+    }
+  }
+  dt_pthread_mutex_unlock(&_exif_cache_mutex);
+
+  // parse outside the lock, import runs this in parallel:
+  dt_exif_parsed_t *p = _exif_parse(path);
+  p->path = path;
+  p->mtime = mtime;
+  p->size = size;
+  p->refs = 1;
+  if(mtime == -1) return p;
+
+  dt_pthread_mutex_lock(&_exif_cache_mutex);
+  int slot = 0;
+  for(int k=0; k<DT_EXIF_CACHE_SIZE; k++)
+  {
+    if(!_exif_cache[k] || (_exif_cache[k]->path == p->path))
+    {
+      slot = k;
+      break;
+    }
+    if(_exif_cache[k]->used < _exif_cache[slot]->used) slot = k;
+  }
+  if(_exif_cache[slot]) _exif_parsed_unref_locked(_exif_cache[slot]);
+  p->refs++;
+  p->used = ++_exif_cache_tick;
+  _exif_cache[slot] = p;
+  dt_pthread_mutex_unlock(&_exif_cache_mutex);
+  return p;
+}
+
+/** forget what was parsed from the file, we are about to change it. */
+static void _exif_cache_drop(const char *path)
+{
+  dt_pthread_mutex_lock(&_exif_cache_mutex);
+  for(int k=0; k<DT_EXIF_CACHE_SIZE; k++)
+  {
+    if(_exif_cache[k] && _exif_cache[k]->path == path)
+    {
+      _exif_parsed_unref_locked(_exif_cache[k]);
+      _exif_cache[k] = NULL;
+    }
+  }
+  dt_pthread_mutex_unlock(&_exif_cache_mutex);
+}
+
 /** read the metadata of an image.
  * XMP data trumps IPTC data trumps EXIF data
  */
-int dt_exif_read(dt_image_t *img, const char* path)
+static bool dt_exif_read_metadata(dt_image_t *img, const dt_exif_parsed_t *p)
 {
-  try
-  {
-    Exiv2::Image::AutoPtr image;
-    image = Exiv2::ImageFactory::open(path);
-    assert(image.get() != 0);
-    image->readMetadata();
-    bool res;
+  bool res;
 
-    // EXIF metadata
-    Exiv2::ExifData &exifData = image->exifData();
-    res = dt_exif_read_exif_data(img, exifData);
+  // the parsed data is shared, and the readers below look things up through non-const
+  // references (the xmp one even removes keys), so they get copies:
 
-    // IPTC metadata.
-    Exiv2::IptcData &iptcData = image->iptcData();
-    res = dt_exif_read_iptc_data(img, iptcData) && res;
+  // EXIF metadata
+  Exiv2::ExifData exifData = p->exif;
+  res = dt_exif_read_exif_data(img, exifData);
 
-    // XMP metadata
-    Exiv2::XmpData &xmpData = image->xmpData();
-    res = dt_exif_read_xmp_data(img, xmpData, false, true) && res;
+  // IPTC metadata.
+  Exiv2::IptcData iptcData = p->iptc;
+  res = dt_exif_read_iptc_data(img, iptcData) && res;
 
-    return res?0:1;
+  // XMP metadata
+  Exiv2::XmpData xmpData = p->xmp;
+  res = dt_exif_read_xmp_data(img, xmpData, false, true) && res;
+
+  return res;
+}
+
+int dt_exif_read(dt_image_t *img, const char* path)
+{
+  dt_exif_parsed_t *p = NULL;
+  try
+  {
+    p = _exif_parsed_get(path);
+    const int res = dt_exif_read_metadata(img, p)?0:1;
+    _exif_parsed_unref(p);
+    return res;
   }
   catch (Exiv2::AnyError& e)
   {
+    _exif_parsed_unref(p);
     std::string s(e.what());
     std::cerr << "[exiv2] " << path << ": " << s << std::endl;
     return 1;
   }
 }
 
+void *dt_exif_read_prepare(const char* path)
+{
+  try
+  {
+    return _exif_parsed_get(path);
+  }
+  catch (Exiv2::AnyError& e)
+  {
+    std::string s(e.what());
+    std::cerr << "[exiv2] " << path << ": " << s << std::endl;
+    return NULL;
+  }
+}
+
+int dt_exif_read_prepared(dt_image_t *img, void *prepared)
+{
+  if(!prepared) return 1;
+  dt_exif_parsed_t *p = (dt_exif_parsed_t *)prepared;
+  int res = 1;
+  try
+  {
+    res = dt_exif_read_metadata(img, p)?0:1;
+  }
+  catch (Exiv2::AnyError& e)
+  {
+    std::string s(e.what());
+    std::cerr << "[exiv2] " << s << std::endl;
+  }
+  _exif_parsed_unref(p);
+  return res;
+}
+
+void dt_exif_read_prepared_free(void *prepared)
+{
+  _exif_parsed_unref((dt_exif_parsed_t *)prepared);
+}
+
 int dt_exif_write_blob(uint8_t *blob,uint32_t size, const char* path)
 {
+  _exif_cache_drop(path);
   try
   {
     Exiv2::Image::AutoPtr image = Exiv2::ImageFactory::open(path);
@@ -1227,16 +1410,52 @@ static void _exif_import_tags(dt_image_t *img,Exiv2::XmpData::iterator &pos)
 }
 
 // need a write lock on *img (non-const) to write stars (and soon color labels).
-int dt_exif_xmp_read (dt_image_t *img, const char* filename, const int history_only)
+// a parsed sidecar, what dt_exif_xmp_read_prepare() hands out:
+typedef struct dt_exif_xmp_prepared_t
+{
+  Exiv2::XmpData xmp;
+  bool is_a_dt_xmp;
+}
+dt_exif_xmp_prepared_t;
+
+void *dt_exif_xmp_read_prepare(const char *filename)
 {
   try
   {
-    // read xmp sidecar
     Exiv2::Image::AutoPtr image;
     image = Exiv2::ImageFactory::open(filename);
     assert(image.get() != 0);
     image->readMetadata();
-    Exiv2::XmpData &xmpData = image->xmpData();
+    dt_exif_xmp_prepared_t *p = new dt_exif_xmp_prepared_t;
+    p->xmp = image->xmpData();
+    // otherwise we ignore title, description, ... from non-dt xmp files :(
+    p->is_a_dt_xmp = image->xmpPacket().find("xmlns:darktable=\"http://darktable.sf.net/\"") != std::string::npos;
+    return p;
+  }
+  catch (Exiv2::AnyError& e)
+  {
+    // actually nobody's interested in that if the file doesn't exist:
+    return NULL;
+  }
+}
+
+void dt_exif_xmp_read_prepared_free(void *prepared)
+{
+  delete (dt_exif_xmp_prepared_t *)prepared;
+}
+
+int dt_exif_xmp_read (dt_image_t *img, const char* filename, const int history_only)
+{
+  return dt_exif_xmp_read_prepared(img, dt_exif_xmp_read_prepare(filename), history_only);
+}
+
+int dt_exif_xmp_read_prepared (dt_image_t *img, void *prepared, const int history_only)
+{
+  if(!prepared) return 0;
+  dt_exif_xmp_prepared_t *p = (dt_exif_xmp_prepared_t *)prepared;
+  try
+  {
+    Exiv2::XmpData &xmpData = p->xmp;
 
     sqlite3_stmt *stmt;
 
@@ -1265,12 +1484,7 @@ int dt_exif_xmp_read (dt_image_t *img, const char* filename, const int history_o
     sqlite3_finalize(stmt);
 
     if(!history_only)
-    {
-      // otherwise we ignore title, description, ... from non-dt xmp files :(
-      size_t pos = image->xmpPacket().find("xmlns:darktable=\"http://darktable.sf.net/\"");
-      bool is_a_dt_xmp = (pos != std::string::npos);
-      dt_exif_read_xmp_data(img, xmpData, is_a_dt_xmp, false);
-    }
+      dt_exif_read_xmp_data(img, xmpData, p->is_a_dt_xmp, false);
 
     Exiv2::XmpData::iterator pos;
 
@@ -1499,10 +1713,10 @@ int dt_exif_xmp_read (dt_image_t *img, const char* filename, const int history_o
   }
   catch (Exiv2::AnyError& e)
   {
-    // actually nobody's interested in that if the file doesn't exist:
-    // std::string s(e.what());
-    // std::cerr << "[exiv2] " << s << std::endl;
+    std::string s(e.what());
+    std::cerr << "[exiv2] " << s << std::endl;
   }
+  delete p;
   return 0;
 }
 
@@ -1809,6 +2023,8 @@ dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
 
 int dt_exif_xmp_attach (const int imgid, const char* filename)
 {
+  dt_exif_parsed_t *input = NULL;
+  _exif_cache_drop(filename);
   try
   {
     char input_filename[1024];
@@ -1821,19 +2037,18 @@ int dt_exif_xmp_attach (const int imgid, const char* filename)
     img->readMetadata();
 
     // initialize XMP and IPTC data with the one from the original file
-    Exiv2::Image::AutoPtr input_image = Exiv2::ImageFactory::open(input_filename);
-    if(input_image.get() != 0)
-    {
-      input_image->readMetadata();
-      img->setIptcData(input_image->iptcData());
-      img->setXmpData(input_image->xmpData());
-    }
+    input = _exif_parsed_get(input_filename);
+    img->setIptcData(input->iptc);
+    img->setXmpData(input->xmp);
+    _exif_parsed_unref(input);
+    input = NULL;
     dt_exif_xmp_read_data(img->xmpData(), imgid);
     img->writeMetadata();
     return 0;
   }
   catch (Exiv2::AnyError& e)
   {
+    _exif_parsed_unref(input);
     std::cerr << "[xmp_attach] caught exiv2 exception '" << e << "'\n";
     return -1;
   }
@@ -1895,36 +2110,25 @@ int dt_exif_thumbnail(
   uint32_t   *ht)
 {
   // fprintf(stderr, "[exif] trying to load thumbnail `%s'!\n", filename);
+  dt_exif_parsed_t *p = NULL;
   try
   {
-    Exiv2::Image::AutoPtr image;
-    image = Exiv2::ImageFactory::open(filename);
-    assert(image.get() != 0);
-    image->readMetadata();
-
-    Exiv2::ExifData &exifData = image->exifData();
-    Exiv2::ExifThumbC thumb(exifData);
-    Exiv2::DataBuf buf = thumb.copy();
+    // usually still there from the import:
+    p = _exif_parsed_get(filename);
     int res = 1;
-    if(!buf.pData_) return 1;
-
-    // canon crops that thumbnail:
-    int y_beg = 0, y_end = 0;
-    Exiv2::ExifData::const_iterator pos;
-    if ( (pos=exifData.findKey(Exiv2::ExifKey("Exif.Canon.ThumbnailImageValidArea")))
-         != exifData.end() && pos->size() && pos->count() == 4)
+    if(p->thumb.empty())
     {
-      // pos->toLong(0); // x bounds. we ignore those because canon doesn't seem
-      // to set them.
-      y_beg = pos->toLong(2);
-      y_end = pos->toLong(3);
+      _exif_parsed_unref(p);
+      return 1;
     }
 
+    int y_beg = p->thumb_y_beg, y_end = p->thumb_y_end;
+
     dt_imageio_jpeg_t jpg;
-    if(!dt_imageio_jpeg_decompress_header(buf.pData_, buf.size_, &jpg))
+    if(!dt_imageio_jpeg_decompress_header(&p->thumb[0], p->thumb.size(), &jpg))
     {
       // don't upsample those:
-      if((uint32_t)jpg.width < width || (uint32_t)jpg.height < height) return 1;
+      if((uint32_t)jpg.width < width || (uint32_t)jpg.height < height) goto done;
       if(!y_beg && !y_end)
       {
         // if those weren't set, do it now:
@@ -1932,7 +2136,7 @@ int dt_exif_thumbnail(
         y_end = jpg.height - 1;
       }
       uint8_t *tmp = (uint8_t *)malloc(sizeof(uint8_t)*jpg.width*jpg.height*4);
-      if(!tmp) return 1;
+      if(!tmp) goto done;
       if(!dt_imageio_jpeg_decompress(&jpg, tmp))
       {
         dt_iop_flip_and_zoom_8(tmp + 4*jpg.width*y_beg, jpg.width, y_end - y_beg + 1, out, width, height, orientation, wd, ht);
@@ -1942,11 +2146,13 @@ int dt_exif_thumbnail(
     }
 
     // fprintf(stderr, "[exif] loaded thumbnail %d x %d `%s'!\n", jpg.width, jpg.height, filename);
-
+done:
+    _exif_parsed_unref(p);
     return res;
   }
   catch (Exiv2::AnyError& e)
   {
+    _exif_parsed_unref(p);
     return 1;
   }
 }
@@ -1956,6 +2162,9 @@ void dt_exif_init()
   // mute exiv2:
   // Exiv2::LogMsg::setLevel(Exiv2::LogMsg::error);
 
+  dt_pthread_mutex_init(&_exif_cache_mutex, NULL);
+  memset(_exif_cache, 0, sizeof(_exif_cache));
+
   Exiv2::XmpParser::initialize();
   // this has te stay with the old url (namespace already propagated outside dt)
   Exiv2::XmpProperties::registerNs("http://darktable.sf.net/", "darktable");
@@ -1964,6 +2173,13 @@ void dt_exif_init()
 
 void dt_exif_cleanup()
 {
+  for(int k=0; k<DT_EXIF_CACHE_SIZE; k++)
+  {
+    if(_exif_cache[k]) _exif_parsed_unref_locked(_exif_cache[k]);
+    _exif_cache[k] = NULL;
+  }
+  dt_pthread_mutex_destroy(&_exif_cache_mutex);
+
   Exiv2::XmpParser::terminate();
 }
 
@@ -30,6 +30,16 @@ extern "C"
   /** read metadata from file with full path name, XMP data trumps IPTC data trumps EXIF data, store to image struct. returns 0 on success. */
   int dt_exif_read(dt_image_t *img, const char* path);
 
+  /** open the file and read its metadata, without touching image struct or database. this is the slow part
+   * of dt_exif_read() and may run in parallel. returns NULL on failure. */
+  void *dt_exif_read_prepare(const char* path);
+
+  /** store metadata from dt_exif_read_prepare() to image struct, like dt_exif_read(). frees prepared. */
+  int dt_exif_read_prepared(dt_image_t *img, void *prepared);
+
+  /** free metadata from dt_exif_read_prepare() which is not used. */
+  void dt_exif_read_prepared_free(void *prepared);
+
   /** read exif data to image struct from given data blob, wherever you got it from. */
   int dt_exif_read_from_blob(dt_image_t *img, uint8_t *blob, const int size);
 
@@ -48,6 +58,15 @@ extern "C"
   /** read xmp sidecar file. */
   int dt_exif_xmp_read (dt_image_t * img, const char* filename, const int history_only);
 
+  /** parse xmp sidecar file without touching image struct or database, may run in parallel. returns NULL if there is none. */
+  void *dt_exif_xmp_read_prepare(const char *filename);
+
+  /** apply sidecar from dt_exif_xmp_read_prepare() to image struct and database, like dt_exif_xmp_read(). frees prepared. */
+  int dt_exif_xmp_read_prepared(dt_image_t *img, void *prepared, const int history_only);
+
+  /** free sidecar from dt_exif_xmp_read_prepare() which is not used. */
+  void dt_exif_xmp_read_prepared_free(void *prepared);
+
   /** load exif thumbnail (these are like 160x120) */
   int dt_exif_thumbnail (const char *filename, uint8_t *out, uint32_t width, uint32_t height, int orientation, uint32_t *wd, uint32_t *ht);
 
@@ -0,0 +1,158 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/export_cache.h"
+#include "common/darktable.h"
+#include "common/database.h"
+#include "common/debug.h"
+#include "common/image.h"
+#include "control/conf.h"
+
+#include <glib/gstdio.h>
+#include <sqlite3.h>
+#include <string.h>
+
+static uint64_t
+_hash_bytes(uint64_t hash, const void *data, const size_t size)
+{
+  const char *str = (const char *)data;
+  for(size_t i=0; i<size; i++) hash = ((hash << 5) + hash) ^ str[i];
+  return hash;
+}
+
+// every column of every row of the query, in order:
+static uint64_t
+_hash_query(uint64_t hash, const char *query, const int imgid, const char *text)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  if(text) DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, text, -1, SQLITE_TRANSIENT);
+  else     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    for(int k=0; k<sqlite3_column_count(stmt); k++)
+    {
+      const void *blob = sqlite3_column_blob(stmt, k);
+      const int bytes = sqlite3_column_bytes(stmt, k);
+      hash = _hash_bytes(hash, &bytes, sizeof(int));
+      if(blob) hash = _hash_bytes(hash, blob, bytes);
+    }
+  }
+  sqlite3_finalize(stmt);
+  return hash;
+}
+
+static int64_t
+_file_mtime(const char *filename)
+{
+  GStatBuf st;
+  if(g_stat(filename, &st)) return -1;
+  return st.st_mtime;
+}
+
+uint64_t dt_export_cache_hash(const int imgid, dt_imageio_module_format_t *format,
+                              const dt_imageio_module_data_t *fdata, const gboolean high_quality)
+{
+  uint64_t hash = 5381;
+
+  // the source file, and whether it was replaced since:
+  char filename[DT_MAX_PATH_LEN];
+  dt_image_full_path(imgid, filename, DT_MAX_PATH_LEN);
+  GStatBuf st;
+  int64_t file[2] = { -1, -1 };
+  if(!g_stat(filename, &st))
+  {
+    file[0] = st.st_mtime;
+    file[1] = st.st_size;
+  }
+  hash = _hash_bytes(hash, filename, strlen(filename));
+  hash = _hash_bytes(hash, file, sizeof(file));
+
+  // what the export pipe is built from:
+  hash = _hash_query(hash, "select orientation, flags, raw_parameters, raw_denoise_threshold, "
+                     "raw_auto_bright_threshold, raw_black, raw_maximum, color_matrix, colorspace "
+                     "from images where id = ?1", imgid, NULL);
+  hash = _hash_query(hash, "select * from history where imgid = ?1 order by num", imgid, NULL);
+  hash = _hash_query(hash, "select * from mask where imgid = ?1 order by formid", imgid, NULL);
+  if(fdata->style[0])
+    hash = _hash_query(hash, "select * from style_items where styleid = "
+                       "(select rowid from styles where name = ?1) order by num", 0, fdata->style);
+
+  // what is embedded into the file next to the pixels: rating (in the flags above), color labels, tags,
+  // metadata and the geotag:
+  hash = _hash_query(hash, "select color from color_labels where imgid = ?1 order by color", imgid, NULL);
+  hash = _hash_query(hash, "select b.name from tagged_images as a join tags as b on a.tagid = b.id "
+                     "where a.imgid = ?1 order by b.name", imgid, NULL);
+  hash = _hash_query(hash, "select key, value from meta_data where id = ?1 order by key, value", imgid, NULL);
+  hash = _hash_query(hash, "select longitude, latitude from images where id = ?1", imgid, NULL);
+
+  // the format and its own parameters, which follow the common ones. width and height there are just
+  // left over from the last export:
+  hash = _hash_bytes(hash, format->plugin_name, strlen(format->plugin_name));
+  hash = _hash_bytes(hash, &fdata->max_width, sizeof(int));
+  hash = _hash_bytes(hash, &fdata->max_height, sizeof(int));
+  hash = _hash_bytes(hash, fdata->style, strlen(fdata->style));
+  const size_t size = format->params_size(format);
+  if(size > sizeof(dt_imageio_module_data_t))
+    hash = _hash_bytes(hash, fdata + 1, size - sizeof(dt_imageio_module_data_t));
+
+  // and the global export settings:
+  gchar *profile = dt_conf_get_string("plugins/lighttable/export/iccprofile");
+  const int settings[] = { high_quality, dt_conf_get_int("plugins/lighttable/export/iccintent"),
+                           dt_conf_get_bool("plugins/lighttable/export/force_lcms2") };
+  if(profile) hash = _hash_bytes(hash, profile, strlen(profile));
+  hash = _hash_bytes(hash, settings, sizeof(settings));
+  g_free(profile);
+  return hash;
+}
+
+gboolean dt_export_cache_valid(const int imgid, const char *filename, const uint64_t hash)
+{
+  if(!dt_conf_get_bool("plugins/lighttable/export/skip_unchanged")) return FALSE;
+  const int64_t mtime = _file_mtime(filename);
+  if(mtime < 0) return FALSE;
+
+  gboolean valid = FALSE;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select imgid, hash, mtime from export_cache where filename = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, filename, -1, SQLITE_TRANSIENT);
+  if(sqlite3_step(stmt) == SQLITE_ROW)
+    valid = sqlite3_column_int(stmt, 0) == imgid && (uint64_t)sqlite3_column_int64(stmt, 1) == hash
+            && sqlite3_column_int64(stmt, 2) == mtime;
+  sqlite3_finalize(stmt);
+  return valid;
+}
+
+void dt_export_cache_set(const int imgid, const char *filename, const uint64_t hash)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "insert or replace into export_cache (filename, imgid, hash, mtime) "
+                              "values (?1, ?2, ?3, ?4)", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, filename, -1, SQLITE_TRANSIENT);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
+  sqlite3_bind_int64(stmt, 3, (sqlite3_int64)hash);
+  sqlite3_bind_int64(stmt, 4, _file_mtime(filename));
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,45 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_COMMON_EXPORT_CACHE_H
+#define DT_COMMON_EXPORT_CACHE_H
+
+#include "common/imageio_module.h"
+
+#include <glib.h>
+#include <inttypes.h>
+
+// remembers which exported file came out of which image and settings, so exporting a collection again
+// only renders the images that changed. kept in the export_cache table, one row per exported file.
+
+/** hash over everything an export of the image depends on: the source file, its history and masks, the
+  * style, the rating, color labels, tags, metadata and geotag written into the file, the format with its
+  * parameters and size, and the quality setting. */
+uint64_t dt_export_cache_hash(const int imgid, dt_imageio_module_format_t *format,
+                              const dt_imageio_module_data_t *fdata, const gboolean high_quality);
+
+/** TRUE if filename is still there, untouched since it was exported from imgid with this hash. */
+gboolean dt_export_cache_valid(const int imgid, const char *filename, const uint64_t hash);
+
+/** records that filename was just exported from imgid with this hash. */
+void dt_export_cache_set(const int imgid, const char *filename, const uint64_t hash);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
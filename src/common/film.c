@@ -25,6 +25,8 @@
 #include "common/collection.h"
 #include "common/image_cache.h"
 #include "common/debug.h"
+#include "common/exif.h"
+#include "common/profiling.h"
 #include "views/view.h"
 
 #include <stdio.h>
@@ -297,166 +299,269 @@ int dt_film_import_blocking(const char *dirname)
 }
 
 
-static GList *_film_recursive_get_files(const gchar *path, gboolean recursive,GList **result)
+// a batch of files to import, whose metadata is read ahead by a worker pool.
+typedef struct _film_import_prepare_t
 {
-  gchar *fullname;
+  gchar **files;
+  void **exif;
+  void **xmp;
+  int num;
+  int ignore_jpegs;
+}
+_film_import_prepare_t;
 
-  /* let's try open current dir */
-  GDir *cdir = g_dir_open(path,0,NULL);
-  if(!cdir) return *result;
+// a running import, going through the tree one directory at a time.
+typedef struct _film_import_t
+{
+  dt_film_t *film;  // the film roll the import was started for
+  dt_film_t *cfr;   // the one currently imported to
+  int recursive;
+  int batch;
+  int ignore_jpegs;
+  uint32_t count;
+  const guint *jid;
+}
+_film_import_t;
 
-  /* lets read all files in current dir, recurse
-     into directories if we should import recursive.
-   */
-  do
+static void *_film_import_prepare(void *data)
+{
+  _film_import_prepare_t *p = (_film_import_prepare_t *)data;
+  gchar **files = p->files;
+  void **exif = p->exif;
+  void **xmp = p->xmp;
+  const int num = p->num;
+  const int ignore_jpegs = p->ignore_jpegs;
+  TIMER_START(prof, "metadata");
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(files, exif, xmp) schedule(dynamic)
+#endif
+  for(int k=0; k<num; k++)
   {
-    /* get the current filename */
-    const gchar *filename = g_dir_read_name(cdir);
-
-    /* return if no more files are in current dir */
-    if (!filename) break;
-
-    /* build full path for filename */
-    fullname = g_build_filename(G_DIR_SEPARATOR_S, path, filename, NULL);
-
-    /* recurse into directory if we hit one and we doing a recursive import */
-    if (recursive && g_file_test(fullname, G_FILE_TEST_IS_DIR))
+    const char *ext = strrchr(files[k], '.');
+    // these won't be imported anyways:
+    if(ignore_jpegs && ext && (!g_ascii_strcasecmp(ext, ".jpg") || !g_ascii_strcasecmp(ext, ".jpeg")))
     {
-      *result = _film_recursive_get_files(fullname, recursive, result);
-      g_free(fullname);
+      exif[k] = xmp[k] = NULL;
     }
-    /* or test if we found a support image format to import */
-    else if (!g_file_test(fullname, G_FILE_TEST_IS_DIR) &&
-             dt_supported_image(filename))
-      *result = g_list_append(*result, fullname);
     else
-      g_free(fullname);
-
+    {
+      exif[k] = dt_exif_read_prepare(files[k]);
+      // the sidecar of the first version, as a new image will be:
+      gchar *xmp_filename = g_strconcat(files[k], ".xmp", NULL);
+      xmp[k] = dt_exif_xmp_read_prepare(xmp_filename);
+      g_free(xmp_filename);
+    }
   }
-  while (TRUE);
-
-  /* cleanup and return results */
-  g_dir_close(cdir);
-
-  return *result;
-}
-
-/* compare used for sorting the list of files to import
-   only sort on basename of full path eg. the actually filename.
-*/
-int _film_filename_cmp(gchar *a, gchar *b)
-{
-  return g_strcmp0(g_path_get_basename(a), g_path_get_basename(b));
+  TIMER_STOP(prof);
+  return NULL;
 }
 
-void dt_film_import1(dt_film_t *film)
+#if GLIB_CHECK_VERSION (2, 26, 0)
+/* check if we can find a gpx data file to be auto applied
+   to images in the just imported filmroll */
+static void _film_import_gpx(dt_film_t *cfr)
 {
-  gboolean recursive = dt_conf_get_bool("ui_last/import_recursive");
-
-  /* first of all gather all images to import */
-  GList *images = NULL;
-  images = _film_recursive_get_files(film->dirname, recursive, &images);
-  if(g_list_length(images) == 0)
+  if(!cfr || !cfr->dir) return;
+  g_dir_rewind(cfr->dir);
+  const gchar *dfn = NULL;
+  while ((dfn = g_dir_read_name(cfr->dir)) != NULL)
   {
-    dt_control_log(_("no supported images were found to be imported"));
-    return;
+    /* check if we have a gpx to be auto applied to filmroll */
+    if(strcmp(dfn+strlen(dfn)-4,".gpx") == 0 ||
+        strcmp(dfn+strlen(dfn)-4,".GPX") == 0)
+    {
+      gchar *gpx_file = g_build_path (G_DIR_SEPARATOR_S, cfr->dirname, dfn, NULL);
+      dt_control_gpx_apply(gpx_file, cfr->id, dt_conf_get_string("plugins/lighttable/geotagging/tz"));
+      g_free(gpx_file);
+    }
   }
+}
+#endif
 
-  /* we got ourself a list of images, lets sort and start import */
-  images = g_list_sort(images,(GCompareFunc)_film_filename_cmp);
-
-  /* let's start import of images */
-  gchar message[512] = {0};
-  double fraction = 0;
-  uint32_t total = g_list_length(images);
-  g_snprintf(message, sizeof(message) - 1,
-             ngettext("importing %d image","importing %d images", total), total);
-  const guint *jid = dt_control_backgroundjobs_create(darktable.control, 0, message);
-
-  /* loop thru the images and import to current film roll */
-  dt_film_t *cfr = film;
-  GList *image = g_list_first(images);
-  do
+/* imports the files of one directory. the metadata of the next batch is read in parallel while
+   this one goes into the db in a single transaction, so the import is bound by i/o and not by latency. */
+static void _film_import_files(_film_import_t *imp, const gchar *dirname, gchar **files, const int num)
+{
+  /* check if we need to initialize a new filmroll */
+  if(!imp->cfr || g_strcmp0(imp->cfr->dirname, dirname) != 0)
   {
-    gchar *cdn = g_path_get_dirname((const gchar *)image->data);
+#if GLIB_CHECK_VERSION (2, 26, 0)
+    _film_import_gpx(imp->cfr);
+#endif
 
-    /* check if we need to initialize a new filmroll */
-    if(!cfr || g_strcmp0(cfr->dirname, cdn) != 0)
+    /* cleanup previously imported filmroll*/
+    if(imp->cfr && imp->cfr != imp->film)
     {
+      dt_film_cleanup(imp->cfr);
+      g_free(imp->cfr);
+      imp->cfr = NULL;
+    }
 
-#if GLIB_CHECK_VERSION (2, 26, 0)
-      if(cfr && cfr->dir)
-      {
-        /* check if we can find a gpx data file to be auto applied
-           to images in the jsut imported filmroll */
-        g_dir_rewind(cfr->dir);
-        const gchar *dfn = NULL;
-        while ((dfn = g_dir_read_name(cfr->dir)) != NULL)
-        {
-          /* check if we have a gpx to be auto applied to filmroll */
-          if(strcmp(dfn+strlen(dfn)-4,".gpx") == 0 ||
-              strcmp(dfn+strlen(dfn)-4,".GPX") == 0)
-          {
-            gchar *gpx_file = g_build_path (G_DIR_SEPARATOR_S, cfr->dirname, dfn, NULL);
-            dt_control_gpx_apply(gpx_file, cfr->id, dt_conf_get_string("plugins/lighttable/geotagging/tz"));
-            g_free(gpx_file);
-          }
-        }
-      }
-#endif
+    /* initialize and create a new film to import to */
+    imp->cfr = g_malloc(sizeof(dt_film_t));
+    dt_film_init(imp->cfr);
+    dt_film_new(imp->cfr, dirname);
+  }
+
+  const int batch = imp->batch;
+  void **exif = (void **)calloc(num, sizeof(void *));
+  void **xmp = (void **)calloc(num, sizeof(void *));
+  _film_import_prepare_t prepare = { files, exif, xmp, MIN(batch, num), imp->ignore_jpegs };
+  pthread_t prepare_thread;
+  int prepare_running = !pthread_create(&prepare_thread, NULL, _film_import_prepare, &prepare);
+  if(!prepare_running) _film_import_prepare(&prepare);
 
-      /* cleanup previously imported filmroll*/
-      if(cfr && cfr!=film)
+  for(int k=0; k<num; k++)
+  {
+    if(k % batch == 0)
+    {
+      // wait for this batch and start reading the next one:
+      if(prepare_running) pthread_join(prepare_thread, NULL);
+      prepare_running = 0;
+      if(k > 0) DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "commit", NULL, NULL, NULL);
+      if(k + batch < num)
       {
-        dt_film_cleanup(cfr);
-        g_free(cfr);
-        cfr = NULL;
+        prepare.files = files + k + batch;
+        prepare.exif = exif + k + batch;
+        prepare.xmp = xmp + k + batch;
+        prepare.num = MIN(batch, num - k - batch);
+        prepare_running = !pthread_create(&prepare_thread, NULL, _film_import_prepare, &prepare);
+        if(!prepare_running) _film_import_prepare(&prepare);
       }
-
-      /* initialize and create a new film to import to */
-      cfr = g_malloc(sizeof(dt_film_t));
-      dt_film_init(cfr);
-      dt_film_new(cfr, cdn);
+      DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "begin", NULL, NULL, NULL);
     }
 
     /* import image */
-    dt_image_import(cfr->id, (const gchar *)image->data, FALSE);
+    TIMER_START(prof, "image");
+    dt_image_import_prepared(imp->cfr->id, files[k], FALSE, exif[k], xmp[k]);
+    TIMER_STOP(prof);
+    imp->count++;
+
+    // the total isn't known before the walk is done, show how far we are in this directory:
+    dt_control_backgroundjobs_progress(darktable.control, imp->jid, (k+1.0)/num);
+  }
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "commit", NULL, NULL, NULL);
+  free(exif);
+  free(xmp);
+
+  // a re-scan of a known folder: images which were there already may have been edited elsewhere.
+  const int changed = dt_image_read_changed_xmp(imp->cfr->id);
+  if(changed > 0)
+    dt_control_log(ngettext("read %d changed sidecar file", "read %d changed sidecar files", changed), changed);
+}
+
+static int _film_filename_cmp(gconstpointer a, gconstpointer b)
+{
+  return g_strcmp0(*(const gchar **)a, *(const gchar **)b);
+}
+
+/* lists one directory, imports its images right away, and only then goes on with the
+   subdirectories. this way the first images show up before a large tree is walked. */
+static void _film_import_dir(_film_import_t *imp, const gchar *path)
+{
+  /* let's try open current dir */
+  GDir *cdir = g_dir_open(path,0,NULL);
+  if(!cdir) return;
+
+  GPtrArray *files = g_ptr_array_new_with_free_func(g_free);
+  GPtrArray *dirs = g_ptr_array_new_with_free_func(g_free);
+  const gchar *filename;
+  while((filename = g_dir_read_name(cdir)) != NULL)
+  {
+    /* build full path for filename */
+    gchar *fullname = g_build_filename(G_DIR_SEPARATOR_S, path, filename, NULL);
+    const gboolean is_dir = g_file_test(fullname, G_FILE_TEST_IS_DIR);
+
+    /* remember directories if we are doing a recursive import */
+    if(is_dir && imp->recursive)
+      g_ptr_array_add(dirs, fullname);
+    /* or test if we found a support image format to import */
+    else if(!is_dir && dt_supported_image(filename))
+      g_ptr_array_add(files, fullname);
+    else
+      g_free(fullname);
+  }
+  g_dir_close(cdir);
+
+  if(files->len)
+  {
+    g_ptr_array_sort(files, _film_filename_cmp);
+    _film_import_files(imp, path, (gchar **)files->pdata, files->len);
+    // show what we have so far:
+    dt_control_queue_redraw_center();
+  }
+  g_ptr_array_free(files, TRUE);
 
-    fraction+=1.0/total;
-    dt_control_backgroundjobs_progress(darktable.control, jid, fraction);
+  g_ptr_array_sort(dirs, _film_filename_cmp);
+  for(guint k=0; k<dirs->len; k++)
+    _film_import_dir(imp, (const gchar *)g_ptr_array_index(dirs, k));
+  g_ptr_array_free(dirs, TRUE);
+}
 
+void dt_film_import1(dt_film_t *film)
+{
+  _film_import_t imp;
+  imp.film = imp.cfr = film;
+  imp.recursive = dt_conf_get_bool("ui_last/import_recursive");
+  imp.batch = CLAMP(dt_conf_get_int("plugins/lighttable/import/batch_size"), 1, 10000);
+  imp.ignore_jpegs = dt_conf_get_bool("ui_last/import_ignore_jpegs");
+  imp.count = 0;
+  imp.jid = dt_control_backgroundjobs_create(darktable.control, 0, _("importing images"));
+
+  /* walk the tree and import the images of each directory as it is found */
+  _film_import_dir(&imp, film->dirname);
+
+  dt_control_backgroundjobs_destroy(darktable.control, imp.jid);
+  if(imp.count == 0)
+  {
+    dt_control_log(_("no supported images were found to be imported"));
+    return;
   }
-  while( (image = g_list_next(image)) != NULL);
 
-  // only redraw at the end, to not spam the cpu with exposure events
+  // the directories have been redrawn one by one, this catches the tags:
   dt_control_queue_redraw_center();
   dt_control_signal_raise(darktable.signals,DT_SIGNAL_TAG_CHANGED);
-
-  dt_control_backgroundjobs_destroy(darktable.control, jid);
   //dt_control_signal_raise(darktable.signals , DT_SIGNAL_FILMROLLS_IMPORTED);
 
 #if GLIB_CHECK_VERSION (2, 26, 0)
-  if(cfr && cfr->dir)
+  _film_import_gpx(imp.cfr);
+#endif
+
+  if(imp.cfr != film)
   {
-    /* check if we can find a gpx data file to be auto applied
-       to images in the just imported filmroll */
-    g_dir_rewind(cfr->dir);
-    const gchar *dfn = NULL;
-    while ((dfn = g_dir_read_name(cfr->dir)) != NULL)
-    {
-      /* check if we have a gpx to be auto applied to filmroll */
-      if(strcmp(dfn+strlen(dfn)-4,".gpx") == 0 ||
-          strcmp(dfn+strlen(dfn)-4,".GPX") == 0)
-      {
-        gchar *gpx_file = g_build_path (G_DIR_SEPARATOR_S, cfr->dirname, dfn, NULL);
-        dt_control_gpx_apply(gpx_file, cfr->id, dt_conf_get_string("plugins/lighttable/geotagging/tz"));
-        g_free(gpx_file);
-      }
-    }
+    dt_film_cleanup(imp.cfr);
+    g_free(imp.cfr);
   }
-#endif
 }
 
+void dt_film_import_files(const char *dirname, gchar **files, const int num)
+{
+  if(num <= 0) return;
+
+  _film_import_t imp;
+  memset(&imp, 0, sizeof(imp));
+  imp.batch = CLAMP(dt_conf_get_int("plugins/lighttable/import/batch_size"), 1, 10000);
+  imp.ignore_jpegs = dt_conf_get_bool("ui_last/import_ignore_jpegs");
+  imp.jid = dt_control_backgroundjobs_create(darktable.control, 0, _("importing images"));
+
+  /* images which are in the film roll already are skipped by dt_image_import_prepared() */
+  qsort(files, num, sizeof(gchar *), _film_filename_cmp);
+  _film_import_files(&imp, dirname, files, num);
+
+  dt_control_backgroundjobs_destroy(darktable.control, imp.jid);
+  if(imp.cfr)
+  {
+    dt_film_cleanup(imp.cfr);
+    g_free(imp.cfr);
+  }
+
+  if(imp.count == 0) return;
+
+  /* don't touch the collection rules as an interactive import would, the film roll may be new though */
+  dt_control_queue_redraw_center();
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_TAG_CHANGED);
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_FILMROLLS_CHANGED);
+}
 
 int dt_film_import(const char *dirname)
 {
@@ -500,63 +605,16 @@ int dt_film_is_empty(const int id)
 void dt_film_remove(const int id)
 {
   sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "delete from memory.removed_images", NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "update tagxtag set count = count - 1 where "
-                              "(id2 in (select tagid from tagged_images where imgid in "
-                              "(select id from images where film_id = ?1))) or (id1 in "
-                              "(select tagid from tagged_images where imgid in "
-                              "(select id from images where film_id = ?1)))", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "delete from tagged_images where imgid in "
-                              "(select id from images where film_id = ?1)", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "delete from history where imgid in "
-                              "(select id from images where film_id = ?1)", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "delete from color_labels where imgid in "
-                              "(select id from images where film_id = ?1)", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "delete from meta_data where id in "
-                              "(select id from images where film_id = ?1)", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "delete from selected_images where imgid in "
-                              "(select id from images where film_id = ?1)", -1, &stmt, NULL);
+                              "insert into memory.removed_images select id from images where film_id = ?1",
+                              -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "select id from images where film_id = ?1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    const uint32_t imgid = sqlite3_column_int(stmt, 0);
-    dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
-    dt_image_cache_remove (darktable.image_cache, imgid);
-  }
-  sqlite3_finalize(stmt);
-
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "delete from images where id in "
-                              "(select id from images where film_id = ?1)", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  // all versions of a file are in the same film roll, so there are no sidecars left to synch:
+  g_list_free_full(dt_image_remove_batch(), g_free);
 
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "delete from film_rolls where id = ?1", -1, &stmt, NULL);
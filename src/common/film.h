@@ -55,6 +55,8 @@ int dt_film_import(const char *dirname);
 int dt_film_import_blocking(const char *dirname);
 /** helper for import threads. */
 void dt_film_import1(dt_film_t *film);
+/** imports the given files of one directory into its film roll, without listing the directory. */
+void dt_film_import_files(const char *dirname, gchar **files, const int num);
 /** constructs the lighttable/query setting for this film, respecting stars and filters. */
 void dt_film_set_query(const int32_t id);
 /** removes this film and all its images from db. */
@@ -23,15 +23,21 @@
 #include "common/dtpthread.h"
 #include "common/image.h"
 #include "common/fswatch.h"
+#include "common/mipmap_cache.h"
+#include "control/conf.h"
+#include "control/control.h"
+#include "control/jobs.h"
 #include "develop/develop.h"
 
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
 #include <glib.h>
 #include <strings.h>
-#if 0//def  HAVE_INOTIFY
+#ifdef HAVE_INOTIFY
 #include <sys/inotify.h>
+#include <poll.h>
 #endif
 
 
@@ -41,24 +47,28 @@ typedef struct _watch_t
   dt_fswatch_type_t type;        // DT_FSWATCH_* type
   void *data;				// Assigned data
   int events;				// events occurred..
+  gchar *path;      // watched directory of DT_FSWATCH_FOLDER
 } _watch_t;
 
 
-#if 0// def  HAVE_INOTIFY
+#ifdef HAVE_INOTIFY
 
-typedef struct inotify_event_t
+// the thread wakes up this often to import quiet files and to check for the end
+#define DT_FSWATCH_POLL_MS 250
+
+// a new file in a watched folder, waiting until it is written completely
+typedef struct _pending_t
 {
-  uint32_t wd;       /* Watch descriptor */
-  uint32_t mask;     /* Mask of events */
-  uint32_t cookie;   /* Unique cookie associating related events (for rename(2)) */
-  uint32_t len;      /* Size of 'name' field */
-  char     name[];   /* Optional null-terminated name */
-} inotify_event_t;
+  gchar *dirname;
+  double written;   // time of the last event on it
+  int closed;       // closed after writing or moved in, so it may be complete
+} _pending_t;
 
-// Compare func for GList
-static gint _fswatch_items_by_data(const void* a,const void *b)
+static void _fswatch_pending_free(gpointer data)
 {
-  return (((_watch_t*)a)->data<b)?-1:((((_watch_t*)a)->data==b)?0:1);
+  _pending_t *p = (_pending_t *)data;
+  g_free(p->dirname);
+  g_free(p);
 }
 
 // Compare func for GList
@@ -68,79 +78,167 @@ static gint _fswatch_items_by_descriptor(const void *a,const void *b)
   return result;
 }
 
+// folders are identified by their path, all other watches by the assigned data.
+static GList *_fswatch_find(const dt_fswatch_t *fswatch, dt_fswatch_type_t type, const void *data)
+{
+  for(GList *l = fswatch->items; l; l = g_list_next(l))
+  {
+    const _watch_t *item = (const _watch_t *)l->data;
+    if(item->type != type) continue;
+    if(type == DT_FSWATCH_FOLDER ? !g_strcmp0(item->path, data) : item->data == data) return l;
+  }
+  return NULL;
+}
 
-static void *_fswatch_thread(void *data)
+// keeps track of the files showing up in a watched folder. called with the mutex held.
+static void _fswatch_folder_event(dt_fswatch_t *fswatch, _watch_t *item, const struct inotify_event *event)
 {
-  dt_fswatch_t *fswatch=(dt_fswatch_t *)data;
-  uint32_t res=0;
-  uint32_t event_hdr_size=sizeof(inotify_event_t);
-  inotify_event_t *event_hdr=g_malloc(sizeof(inotify_event_t));
-  memset (event_hdr,0,event_hdr_size);
-  char *name=g_malloc(2048);
-  memset (name,0, 2048);
-  dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Starting thread of context %lx\n",(unsigned long int)data);
-  while(1)
+  if(event->len == 0 || (event->mask & IN_ISDIR) || !dt_supported_image(event->name)) return;
+  gchar *filename = g_build_filename(item->path, event->name, NULL);
+
+  if(event->mask & (IN_DELETE | IN_MOVED_FROM))
   {
-    // Blocking read loop of event fd into event
-    if(read(fswatch->inotify_fd,event_hdr,event_hdr_size) != event_hdr_size)
-    {
-      if(errno == EINTR) continue;
-      perror("[fswatch_thread] read inotify fd");
-      break;
-    }
+    g_hash_table_remove(fswatch->pending, filename);
+    g_free(filename);
+    return;
+  }
+
+  _pending_t *p = (_pending_t *)g_hash_table_lookup(fswatch->pending, filename);
+  if(!p)
+  {
+    p = (_pending_t *)g_malloc0(sizeof(_pending_t));
+    p->dirname = g_strdup(item->path);
+    g_hash_table_insert(fswatch->pending, filename, p);
+  }
+  else g_free(filename);
 
-    // Read name into buffer if any...
-    if( event_hdr->len > 0 )
+  // every write pushes the import back, until the file stays closed for the delay:
+  p->written = dt_get_wtime();
+  if(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) p->closed = 1;
+  else if(event->mask & (IN_CREATE | IN_MODIFY)) p->closed = 0;
+}
+
+// hands the files which have been quiet for long enough to the import, one job per directory.
+static void _fswatch_import_pending(dt_fswatch_t *fswatch)
+{
+  GHashTable *dirs = NULL;
+  GHashTableIter it;
+  gpointer key, value;
+  const double now = dt_get_wtime();
+
+  dt_pthread_mutex_lock(&fswatch->mutex);
+  g_hash_table_iter_init(&it, fswatch->pending);
+  while(g_hash_table_iter_next(&it, &key, &value))
+  {
+    _pending_t *p = (_pending_t *)value;
+    if(!p->closed || now - p->written < fswatch->delay / 1000.0) continue;
+    if(!dirs) dirs = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, NULL);
+    GPtrArray *files = (GPtrArray *)g_hash_table_lookup(dirs, p->dirname);
+    if(!files)
     {
-      res=read(fswatch->inotify_fd,name,event_hdr_size);
-      name[res]='\0';
+      files = g_ptr_array_new_with_free_func(g_free);
+      g_hash_table_insert(dirs, g_strdup(p->dirname), files);
     }
+    g_ptr_array_add(files, g_strdup((const gchar *)key));
+    g_hash_table_iter_remove(&it);
+  }
+  dt_pthread_mutex_unlock(&fswatch->mutex);
+  if(!dirs) return;
 
-    dt_pthread_mutex_lock(&fswatch->mutex);
-    GList *gitem=g_list_find_custom(fswatch->items,&event_hdr->wd,&_fswatch_items_by_descriptor);
-    if( gitem )
-    {
-      _watch_t *item = gitem->data;
-      item->events=item->events|event_hdr->mask;
+  g_hash_table_iter_init(&it, dirs);
+  while(g_hash_table_iter_next(&it, &key, &value))
+  {
+    dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] importing %d new files in %s\n", ((GPtrArray *)value)->len, (const gchar *)key);
+    // the job owns the directory name and the files now:
+    dt_job_t j;
+    dt_film_import_files_init(&j, (gchar *)key, (GPtrArray *)value);
+    dt_control_add_job(darktable.control, &j);
+  }
+  g_hash_table_destroy(dirs);
+}
+
+static void _fswatch_event(dt_fswatch_t *fswatch, const struct inotify_event *event)
+{
+  GList *gitem=g_list_find_custom(fswatch->items,&event->wd,&_fswatch_items_by_descriptor);
+  if( gitem )
+  {
+    _watch_t *item = gitem->data;
+    item->events=item->events|event->mask;
 
-      switch( item->type )
+    switch( item->type )
+    {
+      case DT_FSWATCH_IMAGE:
       {
-        case DT_FSWATCH_IMAGE:
+        if( (event->mask&IN_CLOSE) && (item->events&IN_MODIFY) ) // Check if file modified and closed...
+        {
+          //  Something wrote on image externally and closed it, let the thumbnails be regenerated...
+          dt_image_t *img=(dt_image_t *)item->data;
+          dt_mipmap_cache_remove(darktable.mipmap_cache, img->id);
+          item->events=0;
+        }
+        else if( (event->mask&IN_ATTRIB) && (item->events&IN_DELETE_SELF) && (item->events&IN_IGNORED))
         {
-          if( (event_hdr->mask&IN_CLOSE) && (item->events&IN_MODIFY) ) // Check if file modified and closed...
-          {
-            //  Something wrote on image externally and closed it, lets tag item as dirty...
-            dt_image_t *img=(dt_image_t *)item->data;
-            img->force_reimport = 1;
-            if(darktable.develop->image==img)
-              dt_dev_raw_reload(darktable.develop);
-            item->events=0;
-          }
-          else if( (event_hdr->mask&IN_ATTRIB) && (item->events&IN_DELETE_SELF) && (item->events&IN_IGNORED))
-          {
-            // This pattern showed up when another file is replacing the original...
-            dt_image_t *img=(dt_image_t *)item->data;
-            img->force_reimport = 1;
-            if(darktable.develop->image==img)
-              dt_dev_raw_reload(darktable.develop);
-            item->events=0;
-          }
+          // This pattern showed up when another file is replacing the original...
+          dt_image_t *img=(dt_image_t *)item->data;
+          dt_mipmap_cache_remove(darktable.mipmap_cache, img->id);
+          item->events=0;
         }
+      }
+      break;
+
+      case DT_FSWATCH_FOLDER:
+        _fswatch_folder_event(fswatch, item, event);
+        item->events=0;
         break;
 
-        default:
-          dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Unhandled object type %d for event descriptor %ld\n", item->type, event_hdr->wd );
-          break;
-      }
+      default:
+        dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Unhandled object type %d for event descriptor %d\n", item->type, event->wd );
+        break;
     }
-    else
-      dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Failed to found watch item for descriptor %ld\n", event_hdr->wd );
+  }
+  else
+    dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Failed to found watch item for descriptor %d\n", event->wd );
+}
 
-    dt_pthread_mutex_unlock(&fswatch->mutex);
+static void *_fswatch_thread(void *data)
+{
+  dt_fswatch_t *fswatch=(dt_fswatch_t *)data;
+  // room for lots of events, a burst of new files is read and handled in one go:
+  const size_t buflen = 256 * (sizeof(struct inotify_event) + NAME_MAX + 1);
+  char *buf = g_malloc(buflen);
+  struct pollfd pfd = { .fd = fswatch->inotify_fd, .events = POLLIN };
+  dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Starting thread of context %lx\n",(unsigned long int)data);
+  while(!g_atomic_int_get(&fswatch->done))
+  {
+    const int ready = poll(&pfd, 1, DT_FSWATCH_POLL_MS);
+    if(ready < 0)
+    {
+      if(errno == EINTR) continue;
+      perror("[fswatch_thread] poll inotify fd");
+      break;
+    }
+    if(ready > 0)
+    {
+      const ssize_t len = read(fswatch->inotify_fd, buf, buflen);
+      if(len < 0)
+      {
+        if(errno == EINTR || errno == EAGAIN) continue;
+        perror("[fswatch_thread] read inotify fd");
+        break;
+      }
+      dt_pthread_mutex_lock(&fswatch->mutex);
+      for(ssize_t off = 0; off + (ssize_t)sizeof(struct inotify_event) <= len; )
+      {
+        const struct inotify_event *event = (const struct inotify_event *)(buf + off);
+        _fswatch_event(fswatch, event);
+        off += sizeof(struct inotify_event) + event->len;
+      }
+      dt_pthread_mutex_unlock(&fswatch->mutex);
+    }
+    _fswatch_import_pending(fswatch);
   }
   dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] terminating.\n");
-  g_free(event_hdr);
-  g_free(name);
+  g_free(buf);
   return NULL;
 }
 
@@ -152,12 +250,14 @@ const dt_fswatch_t* dt_fswatch_new()
 {
   dt_fswatch_t *fswatch=g_malloc(sizeof(dt_fswatch_t));
   memset (fswatch, 0, sizeof(dt_fswatch_t));
-  if((fswatch->inotify_fd=inotify_init())==-1)
+  if((int)(fswatch->inotify_fd=inotify_init())==-1)
   {
     g_free(fswatch);
     return NULL;
   }
   fswatch->items=NULL;
+  fswatch->pending=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _fswatch_pending_free);
+  fswatch->delay=MAX(dt_conf_get_int("plugins/lighttable/import/watch_delay"), 0);
   dt_pthread_mutex_init(&fswatch->mutex, NULL);
   pthread_create(&fswatch->thread, NULL, &_fswatch_thread, fswatch);
   dt_print(DT_DEBUG_FSWATCH,"[fswatch_new] Creating new context %lx\n",(unsigned long int)fswatch);
@@ -167,16 +267,22 @@ const dt_fswatch_t* dt_fswatch_new()
 
 void dt_fswatch_destroy(const dt_fswatch_t *fswatch)
 {
+  if(!fswatch) return;
   dt_print(DT_DEBUG_FSWATCH,"[fswatch_destroy] Destroying context %lx\n",(unsigned long int)fswatch);
   dt_fswatch_t *ctx=(dt_fswatch_t *)fswatch;
+  g_atomic_int_set(&ctx->done, 1);
+  pthread_join(ctx->thread, NULL);
+  close(ctx->inotify_fd);
   dt_pthread_mutex_destroy(&ctx->mutex);
   GList *item=g_list_first(fswatch->items);
   while(item)
   {
+    g_free(((_watch_t *)item->data)->path);
     g_free( item->data );
     item=g_list_next(item);
   }
   g_list_free(fswatch->items);
+  g_hash_table_destroy(ctx->pending);
   g_free(ctx);
 }
 
@@ -185,6 +291,7 @@ void dt_fswatch_add(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void *d
   char filename[DT_MAX_PATH_LEN];
   uint32_t mask=0;
   dt_fswatch_t *ctx=(dt_fswatch_t *)fswatch;
+  if(!ctx) return;
   filename[0] = '\0';
 
   switch(type)
@@ -195,6 +302,11 @@ void dt_fswatch_add(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void *d
       break;
     case DT_FSWATCH_CURVE_DIRECTORY:
       break;
+    case DT_FSWATCH_FOLDER:
+      // enough to see files being written, closed, and moved in or away:
+      mask=IN_CREATE|IN_MODIFY|IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVED_FROM|IN_DELETE|IN_ONLYDIR;
+      g_strlcpy(filename, (const char *)data, DT_MAX_PATH_LEN);
+      break;
     default:
       dt_print(DT_DEBUG_FSWATCH,"[fswatch_add] Unhandled object type %d\n",type);
       break;
@@ -203,9 +315,10 @@ void dt_fswatch_add(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void *d
   if(filename[0] != '\0')
   {
     dt_pthread_mutex_lock(&ctx->mutex);
-    _watch_t *item = g_malloc(sizeof(_watch_t));
+    _watch_t *item = g_malloc0(sizeof(_watch_t));
     item->type=type;
     item->data=data;
+    if(type == DT_FSWATCH_FOLDER) item->data=item->path=g_strdup(filename);
     ctx->items=g_list_append(fswatch->items, item);
     item->descriptor=inotify_add_watch(fswatch->inotify_fd,filename,mask);
     dt_pthread_mutex_unlock(&ctx->mutex);
@@ -219,14 +332,16 @@ void dt_fswatch_add(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void *d
 void dt_fswatch_remove(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void *data)
 {
   dt_fswatch_t *ctx=(dt_fswatch_t *)fswatch;
+  if(!ctx) return;
   dt_pthread_mutex_lock(&ctx->mutex);
   dt_print(DT_DEBUG_FSWATCH,"[fswatch_remove] removing watch on object %lx\n",(unsigned long int)data);
-  GList *gitem=g_list_find_custom(fswatch->items,data,&_fswatch_items_by_data);
+  GList *gitem=_fswatch_find(fswatch,type,data);
   if( gitem )
   {
     _watch_t *item=gitem->data;
     ctx->items=g_list_remove(ctx->items,item);
     inotify_rm_watch(fswatch->inotify_fd,item->descriptor);
+    g_free(item->path);
     g_free(item);
   }
   else
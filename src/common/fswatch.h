@@ -29,6 +29,11 @@ typedef struct dt_fswatch_t
   dt_pthread_mutex_t mutex;
   pthread_t thread;
   GList *items;
+  /** files in watched folders waiting to be imported, by full path */
+  GHashTable *pending;
+  /** milliseconds a new file has to stay untouched before it is imported */
+  int delay;
+  int done;
 }
 dt_fswatch_t;
 
@@ -39,6 +44,8 @@ typedef enum dt_fswatch_type_t
   DT_FSWATCH_IMAGE = 0,
   /** watch is on directory for curves files << Just an test  */
   DT_FSWATCH_CURVE_DIRECTORY,
+  /** watch is on a hot folder, data is its path. new images in it are imported */
+  DT_FSWATCH_FOLDER,
 }
 dt_fswatch_type_t;
 
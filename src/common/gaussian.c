@@ -20,12 +20,18 @@
 #include <math.h>
 #include <assert.h>
 #include <xmmintrin.h>
+#include "common/darktable.h"
 #include "common/opencl.h"
 #include "common/gaussian.h"
+#ifdef DT_AVX2_CODEPATH
+#include <immintrin.h>
+#endif
 
 #define CLAMPF(a, mn, mx) ((a) < (mn) ? (mn) : ((a) > (mx) ? (mx) : (a)))
 #define MMCLAMPPS(a, mn, mx) (_mm_min_ps((mx), _mm_max_ps((a), (mn))))
 #define BLOCKSIZE 32
+// columns per block of the vertical pass of dt_gaussian_blur_4c(), two cache lines of float4 pixels
+#define GAUSS_COLUMN_BLOCK 8
 
 static
 void compute_gauss_params(const float sigma, dt_gaussian_order_t order, float *a0, float *a1, float *a2, float *a3,
@@ -317,161 +323,348 @@ dt_gaussian_blur(
 
 
 
-void
-dt_gaussian_blur_4c(
-  dt_gaussian_t *g,
-  float    *in,
-  float    *out)
+// coefficients of the recursive filter, as computed by compute_gauss_params()
+typedef struct gauss_coeffs_t
+{
+  float a0, a1, a2, a3, b1, b2, coefp, coefn;
+}
+gauss_coeffs_t;
+
+// vertical blur of the columns [i0, i0+cols) of a 4 channel buffer into temp. the recursion runs
+// down all columns of the block at once, so every row step consumes whole cache lines instead of
+// one pixel per line.
+static inline void
+gauss_columns_4c(const float *const in, float *const temp, const int width, const int height, const int i0,
+                 const int cols, const gauss_coeffs_t *const c, const __m128 Labmin, const __m128 Labmax)
 {
-
-  const int width = g->width;
-  const int height = g->height;
   const int ch = 4;
+  __m128 xp[GAUSS_COLUMN_BLOCK];
+  __m128 yb[GAUSS_COLUMN_BLOCK];
+  __m128 yp[GAUSS_COLUMN_BLOCK];
+  __m128 xn[GAUSS_COLUMN_BLOCK];
+  __m128 xa[GAUSS_COLUMN_BLOCK];
+  __m128 yn[GAUSS_COLUMN_BLOCK];
+  __m128 ya[GAUSS_COLUMN_BLOCK];
+
+  // forward filter
+  for(int k=0; k<cols; k++)
+  {
+    xp[k] = MMCLAMPPS(_mm_load_ps(in+(i0+k)*ch), Labmin, Labmax);
+    yb[k] = _mm_mul_ps(_mm_set_ps1(c->coefp), xp[k]);
+    yp[k] = yb[k];
+  }
 
-  assert(g->channels == 4);
+  for(int j=0; j<height; j++)
+  {
+    const int offset = (i0 + j * width)*ch;
 
-  float a0, a1, a2, a3, b1, b2, coefp, coefn;
+    for(int k=0; k<cols; k++)
+    {
+      const __m128 xc = MMCLAMPPS(_mm_load_ps(in+offset+k*ch), Labmin, Labmax);
 
-  compute_gauss_params(g->sigma, g->order, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
+      const __m128 yc = _mm_add_ps(_mm_mul_ps(xc, _mm_set_ps1(c->a0)),
+                                   _mm_sub_ps(_mm_mul_ps(xp[k], _mm_set_ps1(c->a1)),
+                                              _mm_add_ps(_mm_mul_ps(yp[k], _mm_set_ps1(c->b1)), _mm_mul_ps(yb[k], _mm_set_ps1(c->b2)))));
 
-  const __m128 Labmax = _mm_set_ps(g->max[3], g->max[2], g->max[1], g->max[0]);
-  const __m128 Labmin = _mm_set_ps(g->min[3], g->min[2], g->min[1], g->min[0]);
+      _mm_store_ps(temp+offset+k*ch, yc);
 
-  float *temp = g->buf;
+      xp[k] = xc;
+      yb[k] = yp[k];
+      yp[k] = yc;
+    }
+  }
+
+  // backward filter
+  for(int k=0; k<cols; k++)
+  {
+    xn[k] = MMCLAMPPS(_mm_load_ps(in+((height - 1) * width + i0 + k)*ch), Labmin, Labmax);
+    xa[k] = xn[k];
+    yn[k] = _mm_mul_ps(_mm_set_ps1(c->coefn), xn[k]);
+    ya[k] = yn[k];
+  }
+
+  for(int j=height - 1; j > -1; j--)
+  {
+    const int offset = (i0 + j * width)*ch;
+
+    for(int k=0; k<cols; k++)
+    {
+      const __m128 xc = MMCLAMPPS(_mm_load_ps(in+offset+k*ch), Labmin, Labmax);
+
+      const __m128 yc = _mm_add_ps(_mm_mul_ps(xn[k], _mm_set_ps1(c->a2)),
+                                   _mm_sub_ps(_mm_mul_ps(xa[k], _mm_set_ps1(c->a3)),
+                                              _mm_add_ps(_mm_mul_ps(yn[k], _mm_set_ps1(c->b1)), _mm_mul_ps(ya[k], _mm_set_ps1(c->b2)))));
+
+      xa[k] = xn[k];
+      xn[k] = xc;
+      ya[k] = yn[k];
+      yn[k] = yc;
+
+      _mm_store_ps(temp+offset+k*ch, _mm_add_ps(_mm_load_ps(temp+offset+k*ch), yc));
+    }
+  }
+}
+
+// horizontal blur of row j of temp into out
+static inline void
+gauss_row_4c(const float *const temp, float *const out, const int width, const int j,
+             const gauss_coeffs_t *const c, const __m128 Labmin, const __m128 Labmax)
+{
+  const int ch = 4;
+  __m128 xp = _mm_setzero_ps();
+  __m128 yb = _mm_setzero_ps();
+  __m128 yp = _mm_setzero_ps();
+  __m128 xc = _mm_setzero_ps();
+  __m128 yc = _mm_setzero_ps();
+  __m128 xn = _mm_setzero_ps();
+  __m128 xa = _mm_setzero_ps();
+  __m128 yn = _mm_setzero_ps();
+  __m128 ya = _mm_setzero_ps();
+
+  // forward filter
+  xp = MMCLAMPPS(_mm_load_ps(temp+j*width*ch), Labmin, Labmax);
+  yb = _mm_mul_ps(_mm_set_ps1(c->coefp), xp);
+  yp = yb;
 
 
-  // vertical blur column by column
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(in,out,temp,a0,a1,a2,a3,b1,b2,coefp,coefn) schedule(static)
-#endif
   for(int i=0; i<width; i++)
   {
-    __m128 xp = _mm_setzero_ps();
-    __m128 yb = _mm_setzero_ps();
-    __m128 yp = _mm_setzero_ps();
-    __m128 xc = _mm_setzero_ps();
-    __m128 yc = _mm_setzero_ps();
-    __m128 xn = _mm_setzero_ps();
-    __m128 xa = _mm_setzero_ps();
-    __m128 yn = _mm_setzero_ps();
-    __m128 ya = _mm_setzero_ps();
+    int offset = (i + j * width)*ch;
 
-    // forward filter
-    xp = MMCLAMPPS(_mm_load_ps(in+i*ch), Labmin, Labmax);
-    yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
-    yp = yb;
+    xc = MMCLAMPPS(_mm_load_ps(temp+offset), Labmin, Labmax);
 
+    yc = _mm_add_ps(_mm_mul_ps(xc, _mm_set_ps1(c->a0)),
+                    _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(c->a1)),
+                               _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(c->b1)), _mm_mul_ps(yb, _mm_set_ps1(c->b2)))));
 
-    for(int j=0; j<height; j++)
-    {
-      int offset = (i + j * width)*ch;
+    _mm_store_ps(out+offset, yc);
+
+    xp = xc;
+    yb = yp;
+    yp = yc;
+  }
 
-      xc = MMCLAMPPS(_mm_load_ps(in+offset), Labmin, Labmax);
+  // backward filter
+  xn = MMCLAMPPS(_mm_load_ps(temp+((j + 1)*width - 1)*ch), Labmin, Labmax);
+  xa = xn;
+  yn = _mm_mul_ps(_mm_set_ps1(c->coefn), xn);
+  ya = yn;
 
 
-      yc = _mm_add_ps(_mm_mul_ps(xc, _mm_set_ps1(a0)),
-                      _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
-                                 _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
+  for(int i=width - 1; i > -1; i--)
+  {
+    int offset = (i + j * width)*ch;
 
-      _mm_store_ps(temp+offset, yc);
+    xc = MMCLAMPPS(_mm_load_ps(temp+offset), Labmin, Labmax);
 
-      xp = xc;
-      yb = yp;
-      yp = yc;
+    yc = _mm_add_ps(_mm_mul_ps(xn, _mm_set_ps1(c->a2)),
+                    _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(c->a3)),
+                               _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(c->b1)), _mm_mul_ps(ya, _mm_set_ps1(c->b2)))));
 
-    }
 
-    // backward filter
-    xn = MMCLAMPPS(_mm_load_ps(in+((height - 1) * width + i)*ch), Labmin, Labmax);
     xa = xn;
-    yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
+    xn = xc;
     ya = yn;
+    yn = yc;
 
-    for(int j=height - 1; j > -1; j--)
-    {
-      int offset = (i + j * width)*ch;
+    _mm_store_ps(out+offset, _mm_add_ps(_mm_load_ps(out+offset), yc));
+  }
+}
 
-      xc = MMCLAMPPS(_mm_load_ps(in+offset), Labmin, Labmax);
+#ifdef DT_AVX2_CODEPATH
+#define MM256CLAMPPS(a, mn, mx) (_mm256_min_ps((mx), _mm256_max_ps((a), (mn))))
 
-      yc = _mm_add_ps(_mm_mul_ps(xn, _mm_set_ps1(a2)),
-                      _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(a3)),
-                                 _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(b1)), _mm_mul_ps(ya, _mm_set_ps1(b2)))));
+// the same on a full block of GAUSS_COLUMN_BLOCK columns, two pixels per register
+DT_TARGET_AVX2 static void
+gauss_columns_4c_avx2(const float *const in, float *const temp, const int width, const int height, const int i0,
+                      const gauss_coeffs_t *const c, const __m256 Labmin, const __m256 Labmax)
+{
+  const int ch = 4;
+  const int n = GAUSS_COLUMN_BLOCK/2;
+  const __m256 a0 = _mm256_set1_ps(c->a0), a1 = _mm256_set1_ps(c->a1);
+  const __m256 a2 = _mm256_set1_ps(c->a2), a3 = _mm256_set1_ps(c->a3);
+  const __m256 b1 = _mm256_set1_ps(c->b1), b2 = _mm256_set1_ps(c->b2);
+  __m256 xp[GAUSS_COLUMN_BLOCK/2];
+  __m256 yb[GAUSS_COLUMN_BLOCK/2];
+  __m256 yp[GAUSS_COLUMN_BLOCK/2];
+
+  // forward filter
+  for(int k=0; k<n; k++)
+  {
+    xp[k] = MM256CLAMPPS(_mm256_loadu_ps(in+(i0+2*k)*ch), Labmin, Labmax);
+    yb[k] = _mm256_mul_ps(_mm256_set1_ps(c->coefp), xp[k]);
+    yp[k] = yb[k];
+  }
 
+  for(int j=0; j<height; j++)
+  {
+    const int offset = (i0 + j * width)*ch;
+    for(int k=0; k<n; k++)
+    {
+      const __m256 xc = MM256CLAMPPS(_mm256_loadu_ps(in+offset+2*k*ch), Labmin, Labmax);
+      const __m256 yc = _mm256_fmadd_ps(xc, a0, _mm256_fmsub_ps(xp[k], a1, _mm256_fmadd_ps(yp[k], b1, _mm256_mul_ps(yb[k], b2))));
+      _mm256_storeu_ps(temp+offset+2*k*ch, yc);
+      xp[k] = xc;
+      yb[k] = yp[k];
+      yp[k] = yc;
+    }
+  }
 
-      xa = xn;
-      xn = xc;
-      ya = yn;
-      yn = yc;
+  // backward filter, xp/yb/yp now hold xn/ya/yn, xa is the previous xn
+  __m256 xa[GAUSS_COLUMN_BLOCK/2];
+  for(int k=0; k<n; k++)
+  {
+    xp[k] = MM256CLAMPPS(_mm256_loadu_ps(in+((height - 1) * width + i0 + 2*k)*ch), Labmin, Labmax);
+    xa[k] = xp[k];
+    yp[k] = _mm256_mul_ps(_mm256_set1_ps(c->coefn), xp[k]);
+    yb[k] = yp[k];
+  }
 
-      _mm_store_ps(temp+offset, _mm_add_ps(_mm_load_ps(temp+offset), yc));
+  for(int j=height - 1; j > -1; j--)
+  {
+    const int offset = (i0 + j * width)*ch;
+    for(int k=0; k<n; k++)
+    {
+      const __m256 xc = MM256CLAMPPS(_mm256_loadu_ps(in+offset+2*k*ch), Labmin, Labmax);
+      const __m256 yc = _mm256_fmadd_ps(xp[k], a2, _mm256_fmsub_ps(xa[k], a3, _mm256_fmadd_ps(yp[k], b1, _mm256_mul_ps(yb[k], b2))));
+      xa[k] = xp[k];
+      xp[k] = xc;
+      yb[k] = yp[k];
+      yp[k] = yc;
+      _mm256_storeu_ps(temp+offset+2*k*ch, _mm256_add_ps(_mm256_loadu_ps(temp+offset+2*k*ch), yc));
     }
   }
+}
 
-  // horizontal blur line by line
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(out,temp,a0,a1,a2,a3,b1,b2,coefp,coefn) schedule(static)
-#endif
-  for(int j=0; j<height; j++)
+// horizontal blur of the rows j and j+1 at once, one in each half of the registers
+DT_TARGET_AVX2 static void
+gauss_rows_4c_avx2(const float *const temp, float *const out, const int width, const int j,
+                   const gauss_coeffs_t *const c, const __m256 Labmin, const __m256 Labmax)
+{
+  const int ch = 4;
+  const __m256 a0 = _mm256_set1_ps(c->a0), a1 = _mm256_set1_ps(c->a1);
+  const __m256 a2 = _mm256_set1_ps(c->a2), a3 = _mm256_set1_ps(c->a3);
+  const __m256 b1 = _mm256_set1_ps(c->b1), b2 = _mm256_set1_ps(c->b2);
+  const float *const t0 = temp + j*width*ch, *const t1 = t0 + width*ch;
+  float *const o0 = out + j*width*ch, *const o1 = o0 + width*ch;
+#define LOAD2(p0, p1, i) _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps((p0)+(i)*ch)), _mm_load_ps((p1)+(i)*ch), 1)
+
+  // forward filter
+  __m256 xp = MM256CLAMPPS(LOAD2(t0, t1, 0), Labmin, Labmax);
+  __m256 yb = _mm256_mul_ps(_mm256_set1_ps(c->coefp), xp);
+  __m256 yp = yb;
+  for(int i=0; i<width; i++)
   {
-    __m128 xp = _mm_setzero_ps();
-    __m128 yb = _mm_setzero_ps();
-    __m128 yp = _mm_setzero_ps();
-    __m128 xc = _mm_setzero_ps();
-    __m128 yc = _mm_setzero_ps();
-    __m128 xn = _mm_setzero_ps();
-    __m128 xa = _mm_setzero_ps();
-    __m128 yn = _mm_setzero_ps();
-    __m128 ya = _mm_setzero_ps();
+    const __m256 xc = MM256CLAMPPS(LOAD2(t0, t1, i), Labmin, Labmax);
+    const __m256 yc = _mm256_fmadd_ps(xc, a0, _mm256_fmsub_ps(xp, a1, _mm256_fmadd_ps(yp, b1, _mm256_mul_ps(yb, b2))));
+    _mm_store_ps(o0+i*ch, _mm256_castps256_ps128(yc));
+    _mm_store_ps(o1+i*ch, _mm256_extractf128_ps(yc, 1));
+    xp = xc;
+    yb = yp;
+    yp = yc;
+  }
 
-    // forward filter
-    xp = MMCLAMPPS(_mm_load_ps(temp+j*width*ch), Labmin, Labmax);
-    yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
-    yp = yb;
+  // backward filter
+  __m256 xn = MM256CLAMPPS(LOAD2(t0, t1, width-1), Labmin, Labmax);
+  __m256 xa = xn;
+  __m256 yn = _mm256_mul_ps(_mm256_set1_ps(c->coefn), xn);
+  __m256 ya = yn;
+  for(int i=width - 1; i > -1; i--)
+  {
+    const __m256 xc = MM256CLAMPPS(LOAD2(t0, t1, i), Labmin, Labmax);
+    const __m256 yc = _mm256_fmadd_ps(xn, a2, _mm256_fmsub_ps(xa, a3, _mm256_fmadd_ps(yn, b1, _mm256_mul_ps(ya, b2))));
+    xa = xn;
+    xn = xc;
+    ya = yn;
+    yn = yc;
+    const __m256 o = _mm256_add_ps(LOAD2(o0, o1, i), yc);
+    _mm_store_ps(o0+i*ch, _mm256_castps256_ps128(o));
+    _mm_store_ps(o1+i*ch, _mm256_extractf128_ps(o, 1));
+  }
+#undef LOAD2
+}
 
+DT_TARGET_AVX2 static void
+gaussian_blur_4c_avx2(dt_gaussian_t *g, const float *const in, float *const out, const gauss_coeffs_t *const c)
+{
+  const int width = g->width;
+  const int height = g->height;
+  const __m128 Labmax = _mm_set_ps(g->max[3], g->max[2], g->max[1], g->max[0]);
+  const __m128 Labmin = _mm_set_ps(g->min[3], g->min[2], g->min[1], g->min[0]);
+  const __m256 Labmax2 = _mm256_insertf128_ps(_mm256_castps128_ps256(Labmax), Labmax, 1);
+  const __m256 Labmin2 = _mm256_insertf128_ps(_mm256_castps128_ps256(Labmin), Labmin, 1);
+  float *temp = g->buf;
 
-    for(int i=0; i<width; i++)
-    {
-      int offset = (i + j * width)*ch;
+#ifdef _OPENMP
+  #pragma omp parallel for shared(temp) schedule(static)
+#endif
+  for(int i0=0; i0<width; i0+=GAUSS_COLUMN_BLOCK)
+  {
+    const int cols = MIN(GAUSS_COLUMN_BLOCK, width - i0);
+    if(cols == GAUSS_COLUMN_BLOCK)
+      gauss_columns_4c_avx2(in, temp, width, height, i0, c, Labmin2, Labmax2);
+    else
+      gauss_columns_4c(in, temp, width, height, i0, cols, c, Labmin, Labmax);
+  }
 
-      xc = MMCLAMPPS(_mm_load_ps(temp+offset), Labmin, Labmax);
+#ifdef _OPENMP
+  #pragma omp parallel for shared(temp) schedule(static)
+#endif
+  for(int j=0; j<height; j+=2)
+  {
+    if(j+1 < height)
+      gauss_rows_4c_avx2(temp, out, width, j, c, Labmin2, Labmax2);
+    else
+      gauss_row_4c(temp, out, width, j, c, Labmin, Labmax);
+  }
+}
+#undef MM256CLAMPPS
+#endif
 
-      yc = _mm_add_ps(_mm_mul_ps(xc, _mm_set_ps1(a0)),
-                      _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
-                                 _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
+void
+dt_gaussian_blur_4c(
+  dt_gaussian_t *g,
+  float    *in,
+  float    *out)
+{
 
-      _mm_store_ps(out+offset, yc);
+  const int width = g->width;
+  const int height = g->height;
 
-      xp = xc;
-      yb = yp;
-      yp = yc;
-    }
+  assert(g->channels == 4);
 
-    // backward filter
-    xn = MMCLAMPPS(_mm_load_ps(temp+((j + 1)*width - 1)*ch), Labmin, Labmax);
-    xa = xn;
-    yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
-    ya = yn;
+  gauss_coeffs_t c;
 
+  compute_gauss_params(g->sigma, g->order, &c.a0, &c.a1, &c.a2, &c.a3, &c.b1, &c.b2, &c.coefp, &c.coefn);
 
-    for(int i=width - 1; i > -1; i--)
-    {
-      int offset = (i + j * width)*ch;
+#ifdef DT_AVX2_CODEPATH
+  if(dt_codepath_avx2())
+  {
+    gaussian_blur_4c_avx2(g, in, out, &c);
+    return;
+  }
+#endif
 
-      xc = MMCLAMPPS(_mm_load_ps(temp+offset), Labmin, Labmax);
+  const __m128 Labmax = _mm_set_ps(g->max[3], g->max[2], g->max[1], g->max[0]);
+  const __m128 Labmin = _mm_set_ps(g->min[3], g->min[2], g->min[1], g->min[0]);
 
-      yc = _mm_add_ps(_mm_mul_ps(xn, _mm_set_ps1(a2)),
-                      _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(a3)),
-                                 _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(b1)), _mm_mul_ps(ya, _mm_set_ps1(b2)))));
+  float *temp = g->buf;
 
 
-      xa = xn;
-      xn = xc;
-      ya = yn;
-      yn = yc;
+  // vertical blur, on blocks of adjacent columns. each column sees the same operations as if it
+  // was done on its own.
+#ifdef _OPENMP
+  #pragma omp parallel for shared(in,temp,c) schedule(static)
+#endif
+  for(int i0=0; i0<width; i0+=GAUSS_COLUMN_BLOCK)
+    gauss_columns_4c(in, temp, width, height, i0, MIN(GAUSS_COLUMN_BLOCK, width - i0), &c, Labmin, Labmax);
 
-      _mm_store_ps(out+offset, _mm_add_ps(_mm_load_ps(out+offset), yc));
-    }
-  }
+  // horizontal blur line by line
+#ifdef _OPENMP
+  #pragma omp parallel for shared(out,temp,c) schedule(static)
+#endif
+  for(int j=0; j<height; j++)
+    gauss_row_4c(temp, out, width, j, &c, Labmin, Labmax);
 }
 
 
@@ -28,8 +28,8 @@ typedef struct _gpx_track_point_t
 
 typedef struct dt_gpx_t
 {
-  /* the list of track records parsed */
-  GList *track;
+  /* the track records parsed, of _gpx_track_point_t sorted by time */
+  GArray *track;
 
   /* currently parsed track point */
   _gpx_track_point_t *current_track_point;
@@ -56,6 +56,23 @@ static void _gpx_parser_text(GMarkupParseContext *context,
                              const gchar *text, gsize text_len,
                              gpointer user_data,GError **error);
 
+static gint _gpx_time_cmp(const GTimeVal *a, const GTimeVal *b)
+{
+  if (a->tv_sec != b->tv_sec)
+    return (a->tv_sec > b->tv_sec) - (a->tv_sec < b->tv_sec);
+  return (a->tv_usec > b->tv_usec) - (a->tv_usec < b->tv_usec);
+}
+
+static gint _gpx_track_point_cmp(gconstpointer a, gconstpointer b)
+{
+  return _gpx_time_cmp(&((const _gpx_track_point_t *)a)->time, &((const _gpx_track_point_t *)b)->time);
+}
+
+static inline gdouble _gpx_time_seconds(const GTimeVal *t)
+{
+  return t->tv_sec + t->tv_usec * 1e-6;
+}
+
 static GMarkupParser _gpx_parser =
 {
   _gpx_parser_start_element,
@@ -89,6 +106,7 @@ dt_gpx_t *dt_gpx_new(const gchar *filename)
   /* allocate new dt_gpx_t context */
   gpx = g_malloc(sizeof(dt_gpx_t));
   memset(gpx, 0, sizeof(dt_gpx_t));
+  gpx->track = g_array_new(FALSE, FALSE, sizeof(_gpx_track_point_t));
 
   /* initialize the parser and start parse gpx xml data */
   ctx = g_markup_parse_context_new(&_gpx_parser, 0, gpx, NULL);
@@ -97,6 +115,9 @@ dt_gpx_t *dt_gpx_new(const gchar *filename)
     goto error;
 
 
+  /* tracks are usually in order already, but lookups rely on it */
+  g_array_sort(gpx->track, _gpx_track_point_cmp);
+
   /* cleanup and return gpx context */
   g_markup_parse_context_free(ctx);
 
@@ -113,7 +134,11 @@ error:
     g_markup_parse_context_free(ctx);
 
   if (gpx)
+  {
+    g_free(gpx->current_track_point);
+    g_array_free(gpx->track, TRUE);
     g_free(gpx);
+  }
 
   return NULL;
 }
@@ -122,8 +147,8 @@ void dt_gpx_destroy(struct dt_gpx_t *gpx)
 {
   g_assert(gpx != NULL);
 
-  if (gpx->track)
-    g_list_foreach(gpx->track, (GFunc)g_free, NULL);
+  g_free(gpx->current_track_point);
+  g_array_free(gpx->track, TRUE);
 
   g_free(gpx);
 }
@@ -132,41 +157,45 @@ gboolean dt_gpx_get_location(struct dt_gpx_t *gpx, GTimeVal *timestamp, gdouble
 {
   g_assert(gpx != NULL);
 
-  GList *item = g_list_first(gpx->track);
+  const _gpx_track_point_t *tp = (const _gpx_track_point_t *)gpx->track->data;
+  const guint n = gpx->track->len;
 
   /* verify that we got at least 2 trackpoints */
-  if (!item || !item->next)
+  if (n < 2)
     return FALSE;
 
-  do
+  /* if timestamp is out of time range return false but fill
+     closest location value start or end point */
+  if (_gpx_time_cmp(timestamp, &tp[0].time) <= 0)
   {
+    *lon = tp[0].longitude;
+    *lat = tp[0].latitude;
+    return FALSE;
+  }
+  if (_gpx_time_cmp(timestamp, &tp[n-1].time) >= 0)
+  {
+    *lon = tp[n-1].longitude;
+    *lat = tp[n-1].latitude;
+    return FALSE;
+  }
 
-    _gpx_track_point_t *tp = (_gpx_track_point_t *)item->data;
-
-    /* if timestamp is out of time range return false but fill
-       closest location value start or end point */
-    if ((!item->next && timestamp->tv_sec >= tp->time.tv_sec)
-        || (timestamp->tv_sec <= tp->time.tv_sec))
-    {
-      *lon = tp->longitude;
-      *lat = tp->latitude;
-      return FALSE;
-    }
-
-    /* check if timestamp is within current and next trackpoint */
-    if (timestamp->tv_sec >= tp->time.tv_sec &&
-        timestamp->tv_sec <= ((_gpx_track_point_t*)item->next->data)->time.tv_sec)
-    {
-      *lon = tp->longitude;
-      *lat = tp->latitude;
-      return TRUE;
-    }
-
+  /* binary search for the last trackpoint not after timestamp, tp[lo] <= timestamp < tp[hi] */
+  guint lo = 0, hi = n-1;
+  while (hi - lo > 1)
+  {
+    const guint mid = lo + (hi - lo) / 2;
+    if (_gpx_time_cmp(&tp[mid].time, timestamp) <= 0)
+      lo = mid;
+    else
+      hi = mid;
   }
-  while ((item = g_list_next(item)) != NULL);
 
-  /* should not reach this point */
-  return FALSE;
+  /* interpolate between the two trackpoints around timestamp */
+  const gdouble t0 = _gpx_time_seconds(&tp[lo].time), t1 = _gpx_time_seconds(&tp[hi].time);
+  const gdouble f = (t1 > t0) ? (_gpx_time_seconds(timestamp) - t0) / (t1 - t0) : 0.0;
+  *lon = tp[lo].longitude + f * (tp[hi].longitude - tp[lo].longitude);
+  *lat = tp[lo].latitude + f * (tp[hi].latitude - tp[lo].latitude);
+  return TRUE;
 }
 
 /*
@@ -258,10 +287,9 @@ void _gpx_parser_end_element (GMarkupParseContext *context, const gchar *element
   /* closing trackpoint lets take care of data parsed */
   if (strcmp(element_name, "trkpt") == 0)
   {
-    if (!gpx->invalid_track_point)
-      gpx->track = g_list_append(gpx->track, gpx->current_track_point);
-    else
-      g_free(gpx->current_track_point);
+    if (gpx->current_track_point && !gpx->invalid_track_point)
+      g_array_append_val(gpx->track, *gpx->current_track_point);
+    g_free(gpx->current_track_point);
 
     gpx->current_track_point = NULL;
   }
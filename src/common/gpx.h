@@ -25,9 +25,9 @@ struct dt_gpx_t;
 struct dt_gpx_t *dt_gpx_new(const gchar *filename);
 void dt_gpx_destroy(struct dt_gpx_t *);
 
-/* fetch the lon,lat coords for time t, if within time range
-  of gpx record return TRUE, FALSE is returned if out of time frame
-  and closest record of lon,lat is filled */
+/* fetch the lon,lat coords for time t, interpolated between the surrounding
+  track points. if within time range of gpx record return TRUE, FALSE is
+  returned if out of time frame and closest record of lon,lat is filled */
 gboolean dt_gpx_get_location(struct dt_gpx_t *, GTimeVal *timestamp, gdouble *lon, gdouble *lat);
 
 #endif
@@ -21,6 +21,144 @@
 #include "common/grouping.h"
 #include "common/image_cache.h"
 
+// image id -> group id, and group id -> number of members, both guarded by the mutex.
+static dt_pthread_mutex_t _map_mutex;
+static GHashTable *_group_of = NULL;
+static GHashTable *_group_size = NULL;
+
+static void
+_map_insert(int image_id, int group_id)
+{
+  g_hash_table_insert(_group_of, GINT_TO_POINTER(image_id), GINT_TO_POINTER(group_id));
+  const int size = GPOINTER_TO_INT(g_hash_table_lookup(_group_size, GINT_TO_POINTER(group_id)));
+  g_hash_table_insert(_group_size, GINT_TO_POINTER(group_id), GINT_TO_POINTER(size + 1));
+}
+
+static void
+_map_erase(int image_id)
+{
+  gpointer old;
+  if(!g_hash_table_lookup_extended(_group_of, GINT_TO_POINTER(image_id), NULL, &old)) return;
+  g_hash_table_remove(_group_of, GINT_TO_POINTER(image_id));
+  const int size = GPOINTER_TO_INT(g_hash_table_lookup(_group_size, old));
+  if(size > 1) g_hash_table_insert(_group_size, old, GINT_TO_POINTER(size - 1));
+  else         g_hash_table_remove(_group_size, old);
+}
+
+static void
+_map_read()
+{
+  sqlite3_stmt *stmt;
+  g_hash_table_remove_all(_group_of);
+  g_hash_table_remove_all(_group_size);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select id, group_id from images", -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    _map_insert(sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1));
+  sqlite3_finalize(stmt);
+}
+
+void
+dt_grouping_init()
+{
+  dt_pthread_mutex_init(&_map_mutex, NULL);
+  _group_of = g_hash_table_new(NULL, NULL);
+  _group_size = g_hash_table_new(NULL, NULL);
+  _map_read();
+}
+
+void
+dt_grouping_cleanup()
+{
+  g_hash_table_destroy(_group_of);
+  g_hash_table_destroy(_group_size);
+  _group_of = _group_size = NULL;
+  dt_pthread_mutex_destroy(&_map_mutex);
+}
+
+void
+dt_grouping_map_set(int image_id, int group_id)
+{
+  if(!_group_of) return;
+  dt_pthread_mutex_lock(&_map_mutex);
+  gpointer old;
+  if(!g_hash_table_lookup_extended(_group_of, GINT_TO_POINTER(image_id), NULL, &old)
+     || GPOINTER_TO_INT(old) != group_id)
+  {
+    _map_erase(image_id);
+    _map_insert(image_id, group_id);
+  }
+  dt_pthread_mutex_unlock(&_map_mutex);
+}
+
+void
+dt_grouping_map_remove(int image_id)
+{
+  if(!_group_of) return;
+  dt_pthread_mutex_lock(&_map_mutex);
+  _map_erase(image_id);
+  dt_pthread_mutex_unlock(&_map_mutex);
+}
+
+void
+dt_grouping_map_reload()
+{
+  if(!_group_of) return;
+  dt_pthread_mutex_lock(&_map_mutex);
+  _map_read();
+  dt_pthread_mutex_unlock(&_map_mutex);
+}
+
+int
+dt_grouping_get_group(int image_id)
+{
+  if(!_group_of) return -1;
+  gpointer group;
+  dt_pthread_mutex_lock(&_map_mutex);
+  const int found = g_hash_table_lookup_extended(_group_of, GINT_TO_POINTER(image_id), NULL, &group);
+  dt_pthread_mutex_unlock(&_map_mutex);
+  return found ? GPOINTER_TO_INT(group) : -1;
+}
+
+int
+dt_grouping_get_group_size(int image_id)
+{
+  if(!_group_of) return 1;
+  gpointer group;
+  int size = 1;
+  dt_pthread_mutex_lock(&_map_mutex);
+  if(g_hash_table_lookup_extended(_group_of, GINT_TO_POINTER(image_id), NULL, &group))
+    size = MAX(1, GPOINTER_TO_INT(g_hash_table_lookup(_group_size, group)));
+  dt_pthread_mutex_unlock(&_map_mutex);
+  return size;
+}
+
+GList *
+dt_grouping_get_members(int group_id)
+{
+  if(!_group_of) return NULL;
+  GList *members = NULL;
+  GHashTableIter it;
+  gpointer key, value;
+  dt_pthread_mutex_lock(&_map_mutex);
+  // most images are alone, don't walk the whole library for them:
+  int left = GPOINTER_TO_INT(g_hash_table_lookup(_group_size, GINT_TO_POINTER(group_id)));
+  if(left == 1 && g_hash_table_lookup_extended(_group_of, GINT_TO_POINTER(group_id), NULL, &value)
+     && GPOINTER_TO_INT(value) == group_id)
+  {
+    members = g_list_prepend(members, GINT_TO_POINTER(group_id));
+    left = 0;
+  }
+  g_hash_table_iter_init(&it, _group_of);
+  while(left > 0 && g_hash_table_iter_next(&it, &key, &value))
+    if(GPOINTER_TO_INT(value) == group_id)
+    {
+      members = g_list_prepend(members, key);
+      left--;
+    }
+  dt_pthread_mutex_unlock(&_map_mutex);
+  return members;
+}
+
 /** add an image to a group */
 void
 dt_grouping_add_to_group(int group_id, int image_id)
@@ -46,12 +184,11 @@ dt_grouping_remove_from_group(int image_id)
   if(img->group_id == image_id)
   {
     // get a new group_id for all the others in the group. also write it to the dt_image_t struct.
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select id from images where group_id = ?1 and id != ?2", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->group_id);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, image_id);
-    while(sqlite3_step(stmt) == SQLITE_ROW)
+    GList *members = dt_grouping_get_members(img->group_id);
+    for(GList *l = members; l; l = g_list_next(l))
     {
-      int other_id = sqlite3_column_int(stmt, 0);
+      int other_id = GPOINTER_TO_INT(l->data);
+      if(other_id == image_id) continue;
       if(new_group_id == -1)
         new_group_id = other_id;
       const dt_image_t *cother_img = dt_image_cache_read_get(darktable.image_cache, other_id);
@@ -60,7 +197,7 @@ dt_grouping_remove_from_group(int image_id)
       dt_image_cache_write_release(darktable.image_cache, other_img, DT_IMAGE_CACHE_SAFE);
       dt_image_cache_read_release(darktable.image_cache, cother_img);
     }
-    sqlite3_finalize(stmt);
+    g_list_free(members);
 
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "update images set group_id = ?1 where group_id = ?2 and id != ?3", -1, &stmt, NULL);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, new_group_id);
@@ -85,26 +222,23 @@ dt_grouping_remove_from_group(int image_id)
 int
 dt_grouping_change_representative(int image_id)
 {
-  sqlite3_stmt *stmt;
-
   const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, image_id);
   dt_image_t *img = dt_image_cache_write_get(darktable.image_cache, cimg);
   int group_id = img->group_id;
   dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_SAFE);
   dt_image_cache_read_release(darktable.image_cache, cimg);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select id from images where group_id = ?1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, group_id);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  GList *members = dt_grouping_get_members(group_id);
+  for(GList *l = members; l; l = g_list_next(l))
   {
-    int other_id = sqlite3_column_int(stmt, 0);
+    int other_id = GPOINTER_TO_INT(l->data);
     const dt_image_t *cother_img = dt_image_cache_read_get(darktable.image_cache, other_id);
     dt_image_t *other_img = dt_image_cache_write_get(darktable.image_cache, cother_img);
     other_img->group_id = image_id;
     dt_image_cache_write_release(darktable.image_cache, other_img, DT_IMAGE_CACHE_SAFE);
     dt_image_cache_read_release(darktable.image_cache, cother_img);
   }
-  sqlite3_finalize(stmt);
+  g_list_free(members);
 
   return image_id;
 }
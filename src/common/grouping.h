@@ -19,6 +19,31 @@
 #ifndef __GROUPING_H__
 #define __GROUPING_H__
 
+#include <glib.h>
+
+/** the group of every image in the library is also kept in memory, so the lighttable doesn't have to ask
+  * the db for every thumbnail. it is read once at startup and follows every write of an image's group_id. */
+void dt_grouping_init();
+void dt_grouping_cleanup();
+
+/** record the group of an image. called whenever its group_id is written. */
+void dt_grouping_map_set(int image_id, int group_id);
+
+/** forget an image which has been removed from the library. */
+void dt_grouping_map_remove(int image_id);
+
+/** read the whole map from the db again, after group ids have been changed in sql directly. */
+void dt_grouping_map_reload();
+
+/** the group of an image, -1 if it is unknown. */
+int dt_grouping_get_group(int image_id);
+
+/** the number of images in the group of an image, 1 if it is alone. */
+int dt_grouping_get_group_size(int image_id);
+
+/** the ids of all images in a group, to be freed with g_list_free(). */
+GList *dt_grouping_get_members(int group_id);
+
 /** add an image to a group */
 void dt_grouping_add_to_group(int group_id, int image_id);
 
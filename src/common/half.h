@@ -0,0 +1,109 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_COMMON_HALF_H
+#define DT_COMMON_HALF_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+// conversion between float and ieee 754 half precision (binary16) storage.
+// finite values beyond the half range are clamped to +-65504, rounding is to nearest even.
+
+#define DT_HALF_MAX 0x7bffu
+
+static inline uint16_t
+dt_float_to_half(const float f)
+{
+  union { float f; uint32_t i; } u = { .f = f };
+  const uint32_t sign = (u.i >> 16) & 0x8000u;
+  const uint32_t a = u.i & 0x7fffffffu;
+  if(a > 0x7f800000u) return sign | 0x7e00u;       // nan
+  if(a == 0x7f800000u) return sign | 0x7c00u;      // inf
+  if(a >= 0x477ff000u) return sign | DT_HALF_MAX;  // would round to inf
+  if(a < 0x38800000u)
+  {
+    // denormal half, or zero:
+    if(a < 0x33000000u) return sign;
+    const uint32_t e = a >> 23;
+    const uint32_t m = (a & 0x7fffffu) | 0x800000u;
+    const uint32_t s = 126 - e;
+    uint32_t h = m >> s;
+    const uint32_t rem = m & ((1u << s) - 1), halfway = 1u << (s - 1);
+    if(rem > halfway || (rem == halfway && (h & 1))) h++;
+    return sign | h;
+  }
+  // rebias the exponent from 127 to 15:
+  uint32_t h = (a - 0x38000000u) >> 13;
+  const uint32_t rem = a & 0x1fffu;
+  if(rem > 0x1000u || (rem == 0x1000u && (h & 1))) h++;
+  return sign | h;
+}
+
+static inline float
+dt_half_to_float(const uint16_t h)
+{
+  const uint32_t sign = (uint32_t)(h & 0x8000u) << 16;
+  const uint32_t e = (h >> 10) & 0x1fu, m = h & 0x3ffu;
+  union { float f; uint32_t i; } u;
+  if(e == 0)
+  {
+    // zero and denormals are exact in float:
+    u.f = m * (1.0f/16777216.0f);
+    u.i |= sign;
+  }
+  else if(e == 31) u.i = sign | 0x7f800000u | (m << 13);
+  else             u.i = sign | ((e + 112) << 23) | (m << 13);
+  return u.f;
+}
+
+// converts n floats to half. uses the f16c instructions if the build targets them.
+static inline void
+dt_float_to_half_buf(uint16_t *out, const float *in, const size_t n)
+{
+  size_t k = 0;
+#ifdef __F16C__
+  const __m128 hmax = _mm_set1_ps(65504.0f), hmin = _mm_set1_ps(-65504.0f);
+  for(; k < (n & ~(size_t)3); k+=4)
+  {
+    // clamp first, the instruction rounds large values to inf:
+    const __m128 v = _mm_max_ps(_mm_min_ps(_mm_loadu_ps(in + k), hmax), hmin);
+    _mm_storel_epi64((__m128i *)(out + k), _mm_cvtps_ph(v, 0));
+  }
+#endif
+  for(; k<n; k++) out[k] = dt_float_to_half(in[k]);
+}
+
+static inline void
+dt_half_to_float_buf(float *out, const uint16_t *in, const size_t n)
+{
+  size_t k = 0;
+#ifdef __F16C__
+  for(; k < (n & ~(size_t)3); k+=4)
+    _mm_storeu_ps(out + k, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)(in + k))));
+#endif
+  for(; k<n; k++) out[k] = dt_half_to_float(in[k]);
+}
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,400 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/darktable.h"
+#include "common/histogram.h"
+
+#include <math.h>
+#include <string.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+int
+dt_histogram_stride(const dt_iop_colorspace_type_t cst, const int width, const int height)
+{
+  // raw: one out of 9 pixels, un-locked with the bayer pattern. else one out of 16.
+  const int base = cst == iop_cs_RAW ? 3 : 4;
+  int stride = MAX(base, (int)ceilf(sqrtf(width*(float)height/DT_HISTOGRAM_MAX_SAMPLES)));
+  if(cst == iop_cs_RAW && !(stride & 1)) stride++;
+  return stride;
+}
+
+static void
+_histogram_max(const dt_iop_colorspace_type_t cst, const float *hist, float *histogram_max)
+{
+  histogram_max[0] = histogram_max[1] = histogram_max[2] = histogram_max[3] = 0;
+  switch(cst)
+  {
+    case iop_cs_RAW:
+      for(int k=0; k<4*DT_HISTOGRAM_BINS; k+=4) histogram_max[0] = fmaxf(histogram_max[0], hist[k]);
+      break;
+
+    case iop_cs_rgb:
+      // don't count <= 0 pixels
+      for(int k=4; k<4*DT_HISTOGRAM_BINS; k+=4)
+        for(int c=0; c<4; c++) histogram_max[c] = fmaxf(histogram_max[c], hist[k+c]);
+      break;
+
+    case iop_cs_Lab:
+    default:
+      // don't count <= 0 pixels in L
+      for(int k=4; k<4*DT_HISTOGRAM_BINS; k+=4) histogram_max[0] = fmaxf(histogram_max[0], hist[k]);
+      // don't count <= -128 and >= +128 pixels in a and b
+      for(int k=4; k<4*(DT_HISTOGRAM_BINS-1); k+=4)
+        for(int c=1; c<3; c++) histogram_max[c] = fmaxf(histogram_max[c], hist[k+c]);
+      break;
+  }
+}
+
+void
+dt_histogram_collect(const dt_iop_colorspace_type_t cst, const float *pixel, const int width, const int height,
+                     const int stride, float *hist, float *histogram_max)
+{
+  memset(hist, 0, 4*DT_HISTOGRAM_BINS*sizeof(float));
+
+  if(cst == iop_cs_RAW)
+  {
+    for(int j=0; j<height; j+=stride) for(int i=0; i<width; i+=stride)
+      {
+        const uint8_t V = CLAMP(DT_HISTOGRAM_BINS*pixel[4*((size_t)j*width+i)], 0, DT_HISTOGRAM_BINS-1);
+        hist[4*V] ++;
+      }
+  }
+  else
+  {
+    // all channels are binned at once: index = clamp(scale*value + offset, 0, 63).
+    const int rgb = cst == iop_cs_rgb;
+    const __m128 scale  = rgb ? _mm_set1_ps(DT_HISTOGRAM_BINS)
+                              : _mm_set_ps(0.0f, DT_HISTOGRAM_BINS/256.0f, DT_HISTOGRAM_BINS/256.0f, DT_HISTOGRAM_BINS/100.0f);
+    const __m128 offset = rgb ? _mm_setzero_ps()
+                              : _mm_set_ps(0.0f, DT_HISTOGRAM_BINS/2.0f, DT_HISTOGRAM_BINS/2.0f, 0.0f);
+    const __m128 zero = _mm_setzero_ps(), top = _mm_set1_ps(DT_HISTOGRAM_BINS-1);
+    const __m128 rgbmask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    const int channels = rgb ? 4 : 3;
+    for(int j=0; j<height; j+=stride) for(int i=0; i<width; i+=stride)
+      {
+        __m128 v = _mm_loadu_ps(pixel + 4*((size_t)j*width+i));
+        // the fourth channel of rgb is the maximum of r, g and b:
+        if(rgb)
+        {
+          const __m128 m = _mm_max_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(0,0,0,0)),
+                                      _mm_max_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(1,1,1,1)),
+                                                 _mm_shuffle_ps(v, v, _MM_SHUFFLE(2,2,2,2))));
+          v = _mm_or_ps(_mm_and_ps(rgbmask, v), _mm_andnot_ps(rgbmask, m));
+        }
+        // max first, so nan ends up in bin 0:
+        const __m128 b = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(v, scale), offset), zero), top);
+        int32_t idx[4] __attribute__((aligned(16)));
+        _mm_store_si128((__m128i *)idx, _mm_cvttps_epi32(b));
+        for(int c=0; c<channels; c++) hist[4*idx[c] + c] ++;
+      }
+  }
+  _histogram_max(cst, hist, histogram_max);
+}
+
+int
+dt_histogram_scope_stride(const int width, const int height)
+{
+  return MAX(1, (int)ceilf(sqrtf(width*(float)height/DT_HISTOGRAM_SCOPE_SAMPLES)));
+}
+
+// bin of a clamped rgb pixel in the vectorscope, by its Rec.709 chroma in -0.5..0.5:
+static inline int
+_vectorscope_bin(const float r, const float g, const float b, const int size)
+{
+  const float Y = 0.2126f*r + 0.7152f*g + 0.0722f*b;
+  const float cb = (b - Y)/1.8556f, cr = (r - Y)/1.5748f;
+  const int x = CLAMP((int)((cb + 0.5f)*(size-1)), 0, size-1);
+  const int y = CLAMP((int)((0.5f - cr)*(size-1)), 0, size-1);
+  return y*size + x;
+}
+
+void
+dt_histogram_scopes_collect(const float *pixel, const int width, const int height, const int stride,
+                            uint32_t *waveform, uint32_t *vectorscope, const int bwidth, const int bheight)
+{
+  const int size = MIN(bwidth, bheight);
+  memset(waveform, 0, sizeof(uint32_t)*3*bwidth*bheight);
+  memset(vectorscope, 0, sizeof(uint32_t)*size*size);
+
+  // the rows of the waveform for r, g and b at once: (1 - clamp(value)) * (bheight-1).
+  const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), rows = _mm_set1_ps(bheight-1);
+  for(int j=0; j<height; j+=stride)
+  {
+    const float *in = pixel + 4*(size_t)j*width;
+    for(int i=0; i<width; i+=stride)
+    {
+      // max first, so nan ends up as 0:
+      const __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + 4*i), zero), one);
+      int32_t row[4] __attribute__((aligned(16)));
+      float c[4] __attribute__((aligned(16)));
+      _mm_store_si128((__m128i *)row, _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(one, v), rows)));
+      _mm_store_ps(c, v);
+      const int col = MIN((int)((int64_t)i*bwidth/width), bwidth-1);
+      for(int k=0; k<3; k++) waveform[3*((size_t)row[k]*bwidth + col) + 2-k] ++;
+      vectorscope[_vectorscope_bin(c[0], c[1], c[2], size)] ++;
+    }
+  }
+}
+
+void
+dt_histogram_scope_image(const uint32_t *bins, const int vectorscope, const int bwidth, const int bheight,
+                         const float weight, const uint8_t mask[3], uint8_t *image, const int stride)
+{
+  for(int j=0; j<bheight; j++) memset(image + (size_t)j*stride, 0, 4*bwidth);
+  // a single pixel is dimly visible, more of them brighten linearly until they clip:
+  const float scale = 0.5f*weight;
+  if(!vectorscope)
+  {
+    for(int j=0; j<bheight; j++) for(int i=0; i<bwidth; i++)
+      {
+        const uint32_t *in = bins + 3*((size_t)j*bwidth + i);
+        uint8_t *out = image + (size_t)j*stride + 4*i;
+        for(int k=0; k<3; k++)
+          if(in[k] && mask[k]) out[k] = CLAMP(in[k]*scale, 5, 255);
+      }
+  }
+  else
+  {
+    // the square is centered in the image, every bin is tinted with the color of its chroma:
+    const int size = MIN(bwidth, bheight);
+    const int ox = (bwidth - size)/2, oy = (bheight - size)/2;
+    for(int j=0; j<size; j++) for(int i=0; i<size; i++)
+      {
+        const uint32_t count = bins[(size_t)j*size + i];
+        if(!count) continue;
+        const float cb = i/(float)(size-1) - 0.5f, cr = 0.5f - j/(float)(size-1);
+        const float r = 0.5f + 1.5748f*cr, b = 0.5f + 1.8556f*cb;
+        const float g = (0.5f - 0.2126f*r - 0.0722f*b)/0.7152f;
+        const float bgr[3] = { CLAMP(b, 0.0f, 1.0f), CLAMP(g, 0.0f, 1.0f), CLAMP(r, 0.0f, 1.0f) };
+        const float v = CLAMP(count*scale, 5, 255);
+        uint8_t *out = image + (size_t)(oy+j)*stride + 4*(ox+i);
+        for(int k=0; k<3; k++)
+          if(mask[k]) out[k] = v*(0.25f + 0.75f*bgr[k]);
+      }
+  }
+}
+
+#ifdef HAVE_OPENCL
+dt_histogram_cl_global_t *
+dt_histogram_init_cl_global()
+{
+  dt_histogram_cl_global_t *g = (dt_histogram_cl_global_t *)malloc(sizeof(dt_histogram_cl_global_t));
+
+  const int program = 12; // histogram.cl, from programs.conf
+  g->kernel_histogram_collect = dt_opencl_create_kernel(program, "histogram_collect");
+  g->kernel_histogram_sample  = dt_opencl_create_kernel(program, "histogram_sample");
+  g->kernel_picker_rows       = dt_opencl_create_kernel(program, "picker_rows");
+  g->kernel_picker_reduce     = dt_opencl_create_kernel(program, "picker_reduce");
+  g->kernel_scopes_collect    = dt_opencl_create_kernel(program, "scopes_collect");
+  return g;
+}
+
+void
+dt_histogram_free_cl_global(dt_histogram_cl_global_t *g)
+{
+  if(!g) return;
+  // destroy kernels
+  dt_opencl_free_kernel(g->kernel_histogram_collect);
+  dt_opencl_free_kernel(g->kernel_histogram_sample);
+  dt_opencl_free_kernel(g->kernel_picker_rows);
+  dt_opencl_free_kernel(g->kernel_picker_reduce);
+  dt_opencl_free_kernel(g->kernel_scopes_collect);
+  free(g);
+}
+
+// without atomics the sampled pixels are gathered into a small buffer on the device and binned on the cpu.
+// returns the swidth x sheight samples, to be freed by the caller, or NULL and the error in err.
+static float *
+_histogram_sample_cl(const int devid, cl_mem img, const int width, const int height, const int stride,
+                     int *swidth, int *sheight, cl_int *err)
+{
+  const int kernel = darktable.opencl->histogram->kernel_histogram_sample;
+  const int sw = (width + stride - 1)/stride, sh = (height + stride - 1)/stride;
+  *err = -999;
+  float *pixel = dt_alloc_align(64, (size_t)sw*sh*4*sizeof(float));
+  cl_mem dev_samples = dt_opencl_alloc_device_buffer(devid, sw*sh*4*sizeof(float));
+  if(pixel == NULL || dev_samples == NULL) goto error;
+
+  size_t sizes[] = { ROUNDUPWD(sw), ROUNDUPHT(sh), 1 };
+  dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), (void *)&img);
+  dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(cl_mem), (void *)&dev_samples);
+  dt_opencl_set_kernel_arg(devid, kernel, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, kernel, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, kernel, 4, sizeof(int), (void *)&stride);
+  dt_opencl_set_kernel_arg(devid, kernel, 5, sizeof(int), (void *)&sw);
+  dt_opencl_set_kernel_arg(devid, kernel, 6, sizeof(int), (void *)&sh);
+  *err = dt_opencl_enqueue_kernel_2d(devid, kernel, sizes);
+  if(*err != CL_SUCCESS) goto error;
+  *err = dt_opencl_read_buffer_from_device(devid, pixel, dev_samples, 0, (size_t)sw*sh*4*sizeof(float), CL_TRUE);
+  if(*err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_samples);
+  *swidth = sw;
+  *sheight = sh;
+  return pixel;
+
+error:
+  if(dev_samples) dt_opencl_release_mem_object(dev_samples);
+  free(pixel);
+  return NULL;
+}
+
+static cl_int
+_histogram_collect_cl_sampled(const int devid, const dt_iop_colorspace_type_t cst, cl_mem img, const int width,
+                              const int height, const int stride, float *hist, float *histogram_max)
+{
+  int swidth, sheight;
+  cl_int err;
+  float *pixel = _histogram_sample_cl(devid, img, width, height, stride, &swidth, &sheight, &err);
+  if(pixel == NULL) return err;
+  dt_histogram_collect(cst, pixel, swidth, sheight, 1, hist, histogram_max);
+  free(pixel);
+  return CL_SUCCESS;
+}
+
+cl_int
+dt_histogram_collect_cl(const int devid, const dt_iop_colorspace_type_t cst, cl_mem img, const int width,
+                        const int height, const int stride, float *hist, float *histogram_max)
+{
+  if(darktable.opencl->avoid_atomics)
+    return _histogram_collect_cl_sampled(devid, cst, img, width, height, stride, hist, histogram_max);
+
+  const int kernel = darktable.opencl->histogram->kernel_histogram_collect;
+  const int swidth = (width + stride - 1)/stride, sheight = (height + stride - 1)/stride;
+  const int mode = cst == iop_cs_RAW ? 0 : (cst == iop_cs_rgb ? 1 : 2);
+  uint32_t bins[4*DT_HISTOGRAM_BINS] = { 0 };
+  cl_int err = -999;
+  cl_mem dev_bins = dt_opencl_alloc_device_buffer(devid, sizeof(bins));
+  if(dev_bins == NULL) goto error;
+  err = dt_opencl_write_buffer_to_device(devid, bins, dev_bins, 0, sizeof(bins), CL_TRUE);
+  if(err != CL_SUCCESS) goto error;
+
+  size_t sizes[] = { ROUNDUPWD(swidth), ROUNDUPHT(sheight), 1 };
+  dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), (void *)&img);
+  dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(cl_mem), (void *)&dev_bins);
+  dt_opencl_set_kernel_arg(devid, kernel, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, kernel, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, kernel, 4, sizeof(int), (void *)&stride);
+  dt_opencl_set_kernel_arg(devid, kernel, 5, sizeof(int), (void *)&mode);
+  err = dt_opencl_enqueue_kernel_2d(devid, kernel, sizes);
+  if(err != CL_SUCCESS) goto error;
+  // only 1k of bins come back, instead of the whole buffer:
+  err = dt_opencl_read_buffer_from_device(devid, bins, dev_bins, 0, sizeof(bins), CL_TRUE);
+  if(err != CL_SUCCESS) goto error;
+
+  for(int k=0; k<4*DT_HISTOGRAM_BINS; k++) hist[k] = bins[k];
+  _histogram_max(cst, hist, histogram_max);
+
+error:
+  if(dev_bins) dt_opencl_release_mem_object(dev_bins);
+  return err;
+}
+
+cl_int
+dt_histogram_scopes_collect_cl(const int devid, cl_mem img, const int width, const int height,
+                               uint32_t *waveform, uint32_t *vectorscope, const int bwidth,
+                               const int bheight, float *weight)
+{
+  cl_int err = -999;
+  if(darktable.opencl->avoid_atomics)
+  {
+    const int stride = dt_histogram_scope_stride(width, height);
+    int swidth, sheight;
+    float *pixel = _histogram_sample_cl(devid, img, width, height, stride, &swidth, &sheight, &err);
+    if(pixel == NULL) return err;
+    dt_histogram_scopes_collect(pixel, swidth, sheight, 1, waveform, vectorscope, bwidth, bheight);
+    free(pixel);
+    *weight = stride*stride;
+    return CL_SUCCESS;
+  }
+
+  const int kernel = darktable.opencl->histogram->kernel_scopes_collect;
+  const int size = MIN(bwidth, bheight);
+  const size_t wsize = sizeof(uint32_t)*3*bwidth*bheight, vsize = sizeof(uint32_t)*size*size;
+  // one buffer, the vectorscope follows the waveform:
+  memset(waveform, 0, wsize);
+  memset(vectorscope, 0, vsize);
+  cl_mem dev_bins = dt_opencl_alloc_device_buffer(devid, wsize + vsize);
+  if(dev_bins == NULL) goto error;
+  err = dt_opencl_write_buffer_to_device(devid, waveform, dev_bins, 0, wsize, CL_FALSE);
+  if(err != CL_SUCCESS) goto error;
+  err = dt_opencl_write_buffer_to_device(devid, vectorscope, dev_bins, wsize, vsize, CL_TRUE);
+  if(err != CL_SUCCESS) goto error;
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), (void *)&img);
+  dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(cl_mem), (void *)&dev_bins);
+  dt_opencl_set_kernel_arg(devid, kernel, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, kernel, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, kernel, 4, sizeof(int), (void *)&bwidth);
+  dt_opencl_set_kernel_arg(devid, kernel, 5, sizeof(int), (void *)&bheight);
+  err = dt_opencl_enqueue_kernel_2d(devid, kernel, sizes);
+  if(err != CL_SUCCESS) goto error;
+  // only the bins come back, instead of the whole buffer:
+  err = dt_opencl_read_buffer_from_device(devid, waveform, dev_bins, 0, wsize, CL_FALSE);
+  if(err != CL_SUCCESS) goto error;
+  err = dt_opencl_read_buffer_from_device(devid, vectorscope, dev_bins, wsize, vsize, CL_TRUE);
+  if(err != CL_SUCCESS) goto error;
+  *weight = 1.0f;
+
+error:
+  if(dev_bins) dt_opencl_release_mem_object(dev_bins);
+  return err;
+}
+
+cl_int
+dt_histogram_picker_cl(const int devid, cl_mem img, const int x, const int y, const int width,
+                       const int height, float *result)
+{
+  const dt_histogram_cl_global_t *g = darktable.opencl->histogram;
+  // first one sum, min and max per row of the box, then one work item combines the rows.
+  cl_mem dev_partial = dt_opencl_alloc_device_buffer(devid, 3*4*sizeof(float)*height);
+  if(dev_partial == NULL) return -999;
+
+  size_t sizes[] = { ROUNDUPWD(height), 1, 1 };
+  dt_opencl_set_kernel_arg(devid, g->kernel_picker_rows, 0, sizeof(cl_mem), (void *)&img);
+  dt_opencl_set_kernel_arg(devid, g->kernel_picker_rows, 1, sizeof(cl_mem), (void *)&dev_partial);
+  dt_opencl_set_kernel_arg(devid, g->kernel_picker_rows, 2, sizeof(int), (void *)&x);
+  dt_opencl_set_kernel_arg(devid, g->kernel_picker_rows, 3, sizeof(int), (void *)&y);
+  dt_opencl_set_kernel_arg(devid, g->kernel_picker_rows, 4, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, g->kernel_picker_rows, 5, sizeof(int), (void *)&height);
+  cl_int err = dt_opencl_enqueue_kernel_2d(devid, g->kernel_picker_rows, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  const float weight = 1.0f/((float)width*height);
+  size_t single[] = { 1, 1, 1 };
+  dt_opencl_set_kernel_arg(devid, g->kernel_picker_reduce, 0, sizeof(cl_mem), (void *)&dev_partial);
+  dt_opencl_set_kernel_arg(devid, g->kernel_picker_reduce, 1, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, g->kernel_picker_reduce, 2, sizeof(float), (void *)&weight);
+  err = dt_opencl_enqueue_kernel_2d(devid, g->kernel_picker_reduce, single);
+  if(err != CL_SUCCESS) goto error;
+
+  // 12 floats, the queue goes on with the next modules meanwhile:
+  err = dt_opencl_read_buffer_from_device(devid, result, dev_partial, 0, 3*4*sizeof(float), CL_FALSE);
+
+error:
+  // opencl keeps the buffer alive until the queued commands using it are done:
+  dt_opencl_release_mem_object(dev_partial);
+  return err;
+}
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,94 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_COMMON_HISTOGRAM_H
+#define DT_COMMON_HISTOGRAM_H
+
+#include "common/opencl.h"
+#include "develop/imageop.h"
+
+// per module histograms, as shown by levels, tone curve and friends.
+// 64 bins of 4 channels, interleaved. only a sparse grid of pixels is visited.
+// also holds the device side reduction for the color picker.
+
+#define DT_HISTOGRAM_BINS 64
+// larger buffers are sampled on a coarser grid, keeping the cost about constant:
+#define DT_HISTOGRAM_MAX_SAMPLES (1<<16)
+
+/** distance of the sampled pixels in x and y for a buffer of the given size. */
+int dt_histogram_stride(const dt_iop_colorspace_type_t cst, const int width, const int height);
+
+/** bins every stride-th pixel of the 4 channel buffer into hist (4*DT_HISTOGRAM_BINS floats)
+  * and computes the maximum per channel. */
+void dt_histogram_collect(const dt_iop_colorspace_type_t cst, const float *pixel, const int width, const int height,
+                          const int stride, float *hist, float *histogram_max);
+
+// scopes of the display referred preview, shown by the histogram widget at its own size.
+// the waveform has width x height bins of blue, green and red (the byte order of the widget),
+// the top row is 1.0. the vectorscope has size x size bins of the Rec.709 CbCr plane,
+// size = MIN(width, height), neutral in the center.
+#define DT_HISTOGRAM_SCOPE_SAMPLES (1<<18)
+
+/** distance of the sampled pixels in x and y for the scopes of a buffer of the given size. */
+int dt_histogram_scope_stride(const int width, const int height);
+
+/** bins every stride-th pixel of the 4 channel rgb buffer into both scopes at once. the bins
+  * are cleared first, waveform needs 3*bwidth*bheight of them, vectorscope size*size. */
+void dt_histogram_scopes_collect(const float *pixel, const int width, const int height, const int stride,
+                                 uint32_t *waveform, uint32_t *vectorscope, const int bwidth, const int bheight);
+
+/** renders the bins of one scope into the ARGB32 image of bwidth x bheight with the given stride.
+  * weight is the number of pixels one count stands for, mask enables blue, green and red. */
+void dt_histogram_scope_image(const uint32_t *bins, const int vectorscope, const int bwidth, const int bheight,
+                              const float weight, const uint8_t mask[3], uint8_t *image, const int stride);
+
+#ifdef HAVE_OPENCL
+typedef struct dt_histogram_cl_global_t
+{
+  int kernel_histogram_collect, kernel_histogram_sample;
+  int kernel_picker_rows, kernel_picker_reduce;
+  int kernel_scopes_collect;
+}
+dt_histogram_cl_global_t;
+
+dt_histogram_cl_global_t *dt_histogram_init_cl_global(void);
+void dt_histogram_free_cl_global(dt_histogram_cl_global_t *g);
+
+/** same for an image on the device. the bins are counted there, only they are copied back.
+  * returns CL_SUCCESS or an error code. */
+cl_int dt_histogram_collect_cl(const int devid, const dt_iop_colorspace_type_t cst, cl_mem img, const int width,
+                               const int height, const int stride, float *hist, float *histogram_max);
+
+/** same as dt_histogram_scopes_collect() for an image on the device. all pixels are binned there
+  * and only the bins come back. weight is set to the number of pixels one count stands for.
+  * returns CL_SUCCESS or an error code. */
+cl_int dt_histogram_scopes_collect_cl(const int devid, cl_mem img, const int width, const int height,
+                                      uint32_t *waveform, uint32_t *vectorscope, const int bwidth,
+                                      const int bheight, float *weight);
+
+/** reduces the box of img starting at x, y to its mean, min and max color, 4 floats each, in result.
+  * the copy back does not block: result is only valid after the queue has finished.
+  * returns CL_SUCCESS or an error code. */
+cl_int dt_histogram_picker_cl(const int devid, cl_mem img, const int x, const int y, const int width,
+                              const int height, float *result);
+#endif
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -134,18 +134,34 @@ dt_history_load_and_apply_on_selection (gchar *filename)
   return res;
 }
 
-int
-dt_history_copy_and_paste_on_image (int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops)
+void
+dt_history_images_changed(GList *imgs)
 {
-  sqlite3_stmt *stmt;
-  if(imgid==dest_imgid) return 1;
-
-  if(imgid==-1)
+  for(GList *l = imgs; l; l = g_list_next(l))
   {
-    dt_control_log(_("you need to copy history from an image before you paste it onto another"));
-    return 1;
+    const int32_t imgid = GPOINTER_TO_INT(l->data);
+
+    /* if current image in develop reload history */
+    if (dt_dev_is_current_image(darktable.develop, imgid))
+    {
+      dt_dev_reload_history_items (darktable.develop);
+      dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
+    }
+
+    /* update xmp file, coalesced with other changes to the same image */
+    dt_image_cache_write_sidecar(darktable.image_cache, imgid);
   }
 
+  /* make sure mipmaps are recomputed */
+  dt_mipmap_cache_remove_list(darktable.mipmap_cache, imgs, 1);
+}
+
+/* the sql part of pasting the history of imgid onto dest_imgid */
+static void
+_history_copy_and_paste_on_image_db(int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops)
+{
+  sqlite3_stmt *stmt;
+
   /* if merge onto history stack, lets find history offest in destination image */
   int32_t offs = 0;
   if (merge)
@@ -224,18 +240,27 @@ dt_history_copy_and_paste_on_image (int32_t imgid, int32_t dest_imgid, gboolean
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
   sqlite3_step (stmt);
   sqlite3_finalize (stmt);
+}
 
-  /* if current image in develop reload history */
-  if (dt_dev_is_current_image(darktable.develop, dest_imgid))
+int
+dt_history_copy_and_paste_on_image (int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops)
+{
+  if(imgid==dest_imgid) return 1;
+
+  if(imgid==-1)
   {
-    dt_dev_reload_history_items (darktable.develop);
-    dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
+    dt_control_log(_("you need to copy history from an image before you paste it onto another"));
+    return 1;
   }
 
-  /* update xmp file */
-  dt_image_synch_xmp(dest_imgid);
+  // the source might have been left in darkroom just now:
+  dt_database_write_sync(darktable.db);
+
+  _history_copy_and_paste_on_image_db(imgid, dest_imgid, merge, ops);
 
-  dt_mipmap_cache_remove(darktable.mipmap_cache, dest_imgid);
+  GList *imgs = g_list_prepend(NULL, GINT_TO_POINTER(dest_imgid));
+  dt_history_images_changed(imgs);
+  g_list_free(imgs);
 
   return 0;
 }
@@ -246,6 +271,7 @@ dt_history_get_items(int32_t imgid, gboolean enabled)
   GList *result=NULL;
   sqlite3_stmt *stmt;
 
+  dt_database_write_sync(darktable.db);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select num, operation, enabled, multi_name from history where imgid=?1 and num in (select MAX(num) from history hst2 where hst2.imgid=?1 and hst2.operation=history.operation group by multi_priority) order by num desc", -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   while (sqlite3_step(stmt) == SQLITE_ROW)
@@ -305,27 +331,30 @@ dt_history_copy_and_paste_on_selection (int32_t imgid, gboolean merge, GList *op
 {
   if (imgid < 0) return 1;
 
-  int res=0;
+  GList *imgs = NULL;
   sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select * from selected_images where imgid != ?1", -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  if (sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    do
-    {
-      /* get imgid of selected image */
-      int32_t dest_imgid = sqlite3_column_int (stmt, 0);
+  while (sqlite3_step (stmt) == SQLITE_ROW)
+    imgs = g_list_prepend(imgs, GINT_TO_POINTER(sqlite3_column_int (stmt, 0)));
+  sqlite3_finalize(stmt);
 
-      /* paste history stack onto image id */
-      dt_history_copy_and_paste_on_image(imgid,dest_imgid,merge,ops);
+  if (!imgs) return 1;
 
-    }
-    while (sqlite3_step (stmt) == SQLITE_ROW);
-  }
-  else res = 1;
+  /* paste all history stacks in one transaction, sidecars are written once the batch ends */
+  dt_image_cache_write_batch_begin(darktable.image_cache);
+  // the source might have been left in darkroom just now:
+  dt_database_write_sync(darktable.db);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "begin", NULL, NULL, NULL);
+  for(GList *l = imgs; l; l = g_list_next(l))
+    _history_copy_and_paste_on_image_db(imgid, GPOINTER_TO_INT(l->data), merge, ops);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "commit", NULL, NULL, NULL);
 
-  sqlite3_finalize(stmt);
-  return res;
+  dt_history_images_changed(imgs);
+  dt_image_cache_write_batch_end(darktable.image_cache);
+
+  g_list_free(imgs);
+  return 0;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
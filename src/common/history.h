@@ -27,6 +27,10 @@ int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboole
 
 void dt_history_delete_on_image(int32_t imgid);
 
+/** after the history of the images in the list (of GINT_TO_POINTER ids) changed in the db: reloads darkroom,
+    queues the sidecar writes and drops the thumbnails, so they are regenerated in the background. */
+void dt_history_images_changed(GList *imgs);
+
 /** copy history from imgid and pasts on selected images, merge or overwrite... */
 int dt_history_copy_and_paste_on_selection(int32_t imgid, gboolean merge,GList *ops);
 
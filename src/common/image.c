@@ -26,10 +26,12 @@
 #include "common/grouping.h"
 #include "common/mipmap_cache.h"
 #include "common/tags.h"
+#include "common/utility.h"
 #include "control/control.h"
 #include "control/conf.h"
 #include "control/jobs.h"
 #include "develop/lightroom.h"
+#include <errno.h>
 #include <math.h>
 #include <sqlite3.h>
 #include <string.h>
@@ -142,20 +144,8 @@ void dt_image_full_path(const int imgid, char *pathname, int len)
   sqlite3_finalize(stmt);
 }
 
-void dt_image_path_append_version(int imgid, char *pathname, const int len)
+static void _image_path_append_version_no(char *pathname, const int len, const int version)
 {
-  // get duplicate suffix
-  int version = 0;
-  sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "select count(id) from images where filename in "
-                              "(select filename from images where id = ?1) and film_id in "
-                              "(select film_id from images where id = ?1) and id < ?1",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
-    version = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
   if(version != 0)
   {
     // add version information:
@@ -171,6 +161,23 @@ void dt_image_path_append_version(int imgid, char *pathname, const int len)
   }
 }
 
+void dt_image_path_append_version(int imgid, char *pathname, const int len)
+{
+  // get duplicate suffix
+  int version = 0;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select count(id) from images where filename in "
+                              "(select filename from images where id = ?1) and film_id in "
+                              "(select film_id from images where id = ?1) and id < ?1",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  if(sqlite3_step(stmt) == SQLITE_ROW)
+    version = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+  _image_path_append_version_no(pathname, len, version);
+}
+
 void dt_image_print_exif(const dt_image_t *img, char *line, int len)
 {
   if(img->exif_exposure >= 0.1f)
@@ -224,7 +231,7 @@ void dt_image_set_flip(const int32_t imgid, const int32_t orientation)
   sqlite3_finalize(stmt);
   dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
   // write that through to xmp:
-  dt_image_write_sidecar_file(imgid);
+  dt_image_cache_write_sidecar(darktable.image_cache, imgid);
 }
 
 void dt_image_flip(const int32_t imgid, const int32_t cw)
@@ -293,6 +300,8 @@ int32_t dt_image_duplicate(const int32_t imgid)
   sqlite3_finalize(stmt);
   if(newid != -1)
   {
+    // the duplicate joins the group of its original:
+    dt_grouping_map_set(newid, dt_grouping_get_group(imgid));
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                                 "insert into color_labels (imgid, color) select ?1, color from "
                                 "color_labels where imgid = ?2", -1, &stmt, NULL);
@@ -352,6 +361,7 @@ void dt_image_remove(const int32_t imgid)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  dt_grouping_map_remove(imgid);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "update tagxtag set count = count - 1 where "
                               "(id2 in (select tagid from tagged_images where imgid = ?1)) or "
@@ -389,6 +399,103 @@ void dt_image_remove(const int32_t imgid)
   dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
 }
 
+GList *dt_image_remove_batch()
+{
+  sqlite3_stmt *stmt;
+  GList *imgs = NULL, *regrouped = NULL, *leftover = NULL;
+  sqlite3 *db = dt_database_get(darktable.db);
+
+  // nothing queued may write the rows back after they are gone:
+  dt_image_cache_write_flush(darktable.image_cache);
+  dt_database_write_sync(darktable.db);
+
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "select imgid from memory.removed_images", -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    imgs = g_list_prepend(imgs, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+  if(!imgs) return NULL;
+
+  // files which keep other versions need their sidecars rewritten afterwards:
+  DT_DEBUG_SQLITE3_PREPARE_V2(db,
+                              "select distinct folder || '/' || filename from images as a, film_rolls "
+                              "where a.film_id = film_rolls.id and a.id in (select imgid from memory.removed_images) "
+                              "and exists (select 1 from images as b where b.film_id = a.film_id and "
+                              "b.filename = a.filename and b.id not in (select imgid from memory.removed_images))",
+                              -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    leftover = g_list_prepend(leftover, g_strdup((const gchar *)sqlite3_column_text(stmt, 0)));
+  sqlite3_finalize(stmt);
+
+  // remaining members of groups losing their leader, they get the smallest id left as new group id:
+  DT_DEBUG_SQLITE3_PREPARE_V2(db,
+                              "select id from images where group_id in (select imgid from memory.removed_images) "
+                              "and id not in (select imgid from memory.removed_images)", -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    regrouped = g_list_prepend(regrouped, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+
+  // the expanded group may lose its leader, follow it to the new one:
+  if(darktable.gui && g_list_find(imgs, GINT_TO_POINTER(darktable.gui->expanded_group_id)))
+  {
+    DT_DEBUG_SQLITE3_PREPARE_V2(db,
+                                "select min(id) from images where group_id = ?1 "
+                                "and id not in (select imgid from memory.removed_images)", -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, darktable.gui->expanded_group_id);
+    darktable.gui->expanded_group_id = -1;
+    if(sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL)
+      darktable.gui->expanded_group_id = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+  }
+
+  DT_DEBUG_SQLITE3_EXEC(db, "begin", NULL, NULL, NULL);
+  if(regrouped)
+    DT_DEBUG_SQLITE3_EXEC(db,
+                          "update images set group_id = (select min(b.id) from images as b where "
+                          "b.group_id = images.group_id and b.id not in (select imgid from memory.removed_images)) "
+                          "where group_id in (select imgid from memory.removed_images) "
+                          "and id not in (select imgid from memory.removed_images)", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db,
+                        "update tagxtag set count = count - 1 where "
+                        "(id2 in (select tagid from tagged_images where imgid in "
+                        "(select imgid from memory.removed_images))) or (id1 in "
+                        "(select tagid from tagged_images where imgid in "
+                        "(select imgid from memory.removed_images)))", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db, "delete from tagged_images where imgid in (select imgid from memory.removed_images)",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db, "delete from history where imgid in (select imgid from memory.removed_images)",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db, "delete from mask where imgid in (select imgid from memory.removed_images)",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db, "delete from color_labels where imgid in (select imgid from memory.removed_images)",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db, "delete from meta_data where id in (select imgid from memory.removed_images)",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db, "delete from selected_images where imgid in (select imgid from memory.removed_images)",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db, "delete from images where id in (select imgid from memory.removed_images)",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db, "commit", NULL, NULL, NULL);
+  dt_grouping_map_reload();
+
+  // the cached structs are stale now, and the regrouped ones are read back from the db:
+  for(GList *l = imgs; l; l = g_list_next(l))
+    dt_image_cache_remove(darktable.image_cache, GPOINTER_TO_INT(l->data));
+  for(GList *l = regrouped; l; l = g_list_next(l))
+  {
+    dt_image_cache_remove(darktable.image_cache, GPOINTER_TO_INT(l->data));
+    dt_image_cache_write_sidecar(darktable.image_cache, GPOINTER_TO_INT(l->data));
+  }
+  dt_mipmap_cache_remove_list(darktable.mipmap_cache, imgs, 0);
+
+  DT_DEBUG_SQLITE3_EXEC(db, "delete from memory.removed_images", NULL, NULL, NULL);
+  dt_print(DT_DEBUG_SQL, "[image_remove_batch] removed %d images, %d files left to synch\n",
+           g_list_length(imgs), g_list_length(leftover));
+
+  g_list_free(regrouped);
+  g_list_free(imgs);
+  return leftover;
+}
+
 int dt_image_altered(const uint32_t imgid)
 {
   int altered = 0;
@@ -416,19 +523,53 @@ int dt_image_altered(const uint32_t imgid)
 }
 
 
+// modification time of the sidecar, or -1 if there is none:
+static int64_t _image_sidecar_mtime(const char *filename)
+{
+  GStatBuf st;
+  if(g_stat(filename, &st)) return -1;
+  return st.st_mtime;
+}
+
+static void _image_xmp_synch_set(sqlite3 *handle, const int32_t imgid, const int64_t mtime)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(handle, "insert or replace into xmp_synch (imgid, mtime) values (?1, ?2)",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_bind_int64(stmt, 2, mtime);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+}
+
 uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs)
+{
+  return dt_image_import_prepared(film_id, filename, override_ignore_jpegs, NULL, NULL);
+}
+
+uint32_t dt_image_import_prepared(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs,
+                                  void *exif, void *xmp)
 {
   if(!g_file_test(filename, G_FILE_TEST_IS_REGULAR))
+  {
+    dt_exif_read_prepared_free(exif);
+    dt_exif_xmp_read_prepared_free(xmp);
     return 0;
+  }
   const char *cc = filename + strlen(filename);
   for(; *cc!='.'&&cc>filename; cc--);
-  if(!strcmp(cc, ".dt")) return 0;
-  if(!strcmp(cc, ".dttags")) return 0;
-  if(!strcmp(cc, ".xmp")) return 0;
+  if(!strcmp(cc, ".dt") || !strcmp(cc, ".dttags") || !strcmp(cc, ".xmp"))
+  {
+    dt_exif_read_prepared_free(exif);
+    dt_exif_xmp_read_prepared_free(xmp);
+    return 0;
+  }
   char *ext = g_ascii_strdown(cc+1, -1);
   if(override_ignore_jpegs == FALSE && (!strcmp(ext, "jpg") ||
                                         !strcmp(ext, "jpeg")) && dt_conf_get_bool("ui_last/import_ignore_jpegs"))
   {
+    dt_exif_read_prepared_free(exif);
+    dt_exif_xmp_read_prepared_free(xmp);
     g_free(ext);
     return 0;
   }
@@ -443,6 +584,8 @@ uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean o
   g_strfreev(extensions);
   if(!supported)
   {
+    dt_exif_read_prepared_free(exif);
+    dt_exif_xmp_read_prepared_free(xmp);
     g_free(ext);
     return 0;
   }
@@ -463,6 +606,8 @@ uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean o
     g_free(imgfname);
     sqlite3_finalize(stmt);
     g_free(ext);
+    dt_exif_read_prepared_free(exif);
+    dt_exif_xmp_read_prepared_free(xmp);
     const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, id);
     dt_image_t *img = dt_image_cache_write_get(darktable.image_cache, cimg);
     img->flags &= ~DT_IMAGE_REMOVE;
@@ -584,13 +729,23 @@ uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean o
   img->group_id = group_id;
 
   // read dttags and exif for database queries!
-  (void) dt_exif_read(img, filename);
+  if(exif) (void) dt_exif_read_prepared(img, exif);
+  else     (void) dt_exif_read(img, filename);
   char dtfilename[DT_MAX_PATH_LEN];
   g_strlcpy(dtfilename, filename, DT_MAX_PATH_LEN);
   dt_image_path_append_version(id, dtfilename, DT_MAX_PATH_LEN);
   char *c = dtfilename + strlen(dtfilename);
   sprintf(c, ".xmp");
-  (void)dt_exif_xmp_read(img, dtfilename, 0);
+  // a new image is the first version of its file, the sidecar was read along with the exif:
+  if(xmp && !strncmp(dtfilename, filename, strlen(filename)) && !strcmp(dtfilename + strlen(filename), ".xmp"))
+    (void)dt_exif_xmp_read_prepared(img, xmp, 0);
+  else
+  {
+    dt_exif_xmp_read_prepared_free(xmp);
+    (void)dt_exif_xmp_read(img, dtfilename, 0);
+  }
+  const int64_t xmp_mtime = _image_sidecar_mtime(dtfilename);
+  if(xmp_mtime >= 0) _image_xmp_synch_set(dt_database_get(darktable.db), id, xmp_mtime);
 
   // write through to db, but not to xmp.
   dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
@@ -628,6 +783,7 @@ uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean o
       const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, newid);
       dt_image_t *img = dt_image_cache_write_get(darktable.image_cache, cimg);
       (void)dt_exif_xmp_read(img, globbuf->gl_pathv[i], 0);
+      _image_xmp_synch_set(dt_database_get(darktable.db), newid, _image_sidecar_mtime(globbuf->gl_pathv[i]));
       dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
       dt_image_cache_read_release(darktable.image_cache, img);
     }
@@ -803,21 +959,16 @@ int32_t dt_image_copy(const int32_t imgid, const int32_t filmid)
     dt_image_full_path(imgid, srcpath, DT_MAX_PATH_LEN);
     gchar *imgbname = g_path_get_basename(srcpath);
     gchar *destpath = g_build_filename(newdir, imgbname, NULL);
-    GFile *src = g_file_new_for_path(srcpath);
-    GFile *dest = g_file_new_for_path(destpath);
     g_free(imgbname);
     imgbname = NULL;
     g_free(newdir);
     newdir = NULL;
-    g_free(destpath);
-    destpath = NULL;
 
     // copy image to new folder
     // if image file already exists, continue
-    GError *gerror = NULL;
-    g_file_copy(src, dest, G_FILE_COPY_NONE, NULL, NULL, NULL, &gerror);
+    const int err = dt_util_copy_file(srcpath, destpath, FALSE);
 
-    if((gerror == NULL) || (gerror != NULL && gerror->code == G_IO_ERROR_EXISTS))
+    if(err == 0 || err == EEXIST)
     {
       // update database
       DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
@@ -852,6 +1003,7 @@ int32_t dt_image_copy(const int32_t imgid, const int32_t filmid)
 
       if(newid != -1)
       {
+        dt_grouping_map_set(newid, dt_grouping_get_group(imgid));
         DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                                     "insert into color_labels (imgid, color) select ?1, color from "
                                     "color_labels where imgid = ?2", -1, &stmt, NULL);
@@ -888,11 +1040,9 @@ int32_t dt_image_copy(const int32_t imgid, const int32_t filmid)
     }
     else
     {
-      fprintf(stderr, "Failed to copy image %s: %s\n", srcpath, gerror->message);
+      fprintf(stderr, "Failed to copy image %s: %s\n", srcpath, g_strerror(err));
     }
-    g_object_unref(dest);
-    g_object_unref(src);
-    g_clear_error(&gerror);
+    g_free(destpath);
   }
 
   return newid;
@@ -902,18 +1052,38 @@ int32_t dt_image_copy(const int32_t imgid, const int32_t filmid)
 // xmp stuff
 // *******************************************************
 
+// runs on the db writer thread, data is imgid and mtime of a sidecar just written.
+static void _image_xmp_synch_write_db(sqlite3 *handle, void *data)
+{
+  const int64_t *synch = (const int64_t *)data;
+  _image_xmp_synch_set(handle, synch[0], synch[1]);
+}
+
 void dt_image_write_sidecar_file(int imgid)
 {
   // TODO: compute hash and don't write if not needed!
   // write .xmp file
   if(imgid > 0 && dt_conf_get_bool("write_sidecar_files"))
   {
+    // the sidecar is read back from the db, which has to have all changes:
+    dt_database_write_sync(darktable.db);
     char filename[DT_MAX_PATH_LEN+8];
     dt_image_full_path(imgid, filename, DT_MAX_PATH_LEN);
     dt_image_path_append_version(imgid, filename, DT_MAX_PATH_LEN);
     char *c = filename + strlen(filename);
     sprintf(c, ".xmp");
-    dt_exif_xmp_write(imgid, filename);
+    if(!dt_exif_xmp_write(imgid, filename))
+    {
+      // so the next re-scan of the folder knows it's ours:
+      const int64_t mtime = _image_sidecar_mtime(filename);
+      if(mtime >= 0)
+      {
+        int64_t *synch = (int64_t *)malloc(2*sizeof(int64_t));
+        synch[0] = imgid;
+        synch[1] = mtime;
+        dt_database_write_async(darktable.db, _image_xmp_synch_write_db, synch, free);
+      }
+    }
   }
 }
 
@@ -931,7 +1101,7 @@ void dt_image_synch_xmp(const int selected)
     while(sqlite3_step(stmt) == SQLITE_ROW)
     {
       const int imgid = sqlite3_column_int(stmt, 0);
-      dt_image_write_sidecar_file(imgid);
+      dt_image_cache_write_sidecar(darktable.image_cache, imgid);
     }
     sqlite3_finalize(stmt);
   }
@@ -986,6 +1156,94 @@ void dt_image_synch_all_xmp(const gchar *pathname)
   }
 }
 
+// a sidecar which changed since darktable last wrote or read it:
+typedef struct _image_xmp_changed_t
+{
+  int32_t imgid;
+  int64_t mtime;
+  gchar *filename;
+  void *xmp;
+}
+_image_xmp_changed_t;
+
+int dt_image_read_changed_xmp(const int32_t film_id)
+{
+  // the mtimes of sidecars just written may still be on their way:
+  dt_database_write_sync(darktable.db);
+
+  GArray *changed = g_array_new(FALSE, FALSE, sizeof(_image_xmp_changed_t));
+  GArray *unknown = g_array_new(FALSE, FALSE, sizeof(_image_xmp_changed_t));
+  sqlite3_stmt *stmt;
+  // the version is what dt_image_path_append_version() would look up one image at a time:
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select i.id, f.folder || '/' || i.filename, "
+                              "(select count(o.id) from images as o where o.film_id = i.film_id and "
+                              "o.filename = i.filename and o.id < i.id), x.mtime "
+                              "from images as i join film_rolls as f on f.id = i.film_id "
+                              "left join xmp_synch as x on x.imgid = i.id where i.film_id = ?1",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, film_id);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    char filename[DT_MAX_PATH_LEN+8];
+    g_strlcpy(filename, (const char *)sqlite3_column_text(stmt, 1), DT_MAX_PATH_LEN);
+    _image_path_append_version_no(filename, DT_MAX_PATH_LEN, sqlite3_column_int(stmt, 2));
+    g_strlcat(filename, ".xmp", sizeof(filename));
+    _image_xmp_changed_t c = { sqlite3_column_int(stmt, 0), _image_sidecar_mtime(filename), NULL, NULL };
+    // a sidecar which went away leaves the image alone:
+    if(c.mtime < 0) continue;
+    if(sqlite3_column_type(stmt, 3) == SQLITE_NULL)
+    {
+      // from before the mtimes were kept, take it as it is:
+      g_array_append_val(unknown, c);
+    }
+    else if(sqlite3_column_int64(stmt, 3) != c.mtime)
+    {
+      c.filename = g_strdup(filename);
+      g_array_append_val(changed, c);
+    }
+  }
+  sqlite3_finalize(stmt);
+
+  _image_xmp_changed_t *c = (_image_xmp_changed_t *)changed->data;
+  const int num = changed->len;
+  // parsing is the slow part and doesn't touch the db:
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(c) schedule(dynamic)
+#endif
+  for(int k=0; k<num; k++)
+    c[k].xmp = dt_exif_xmp_read_prepare(c[k].filename);
+
+  const int batch = CLAMP(dt_conf_get_int("plugins/lighttable/import/batch_size"), 1, 10000);
+  for(int k=0; k<num; k++)
+  {
+    if(k % batch == 0)
+    {
+      if(k > 0) DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "commit", NULL, NULL, NULL);
+      DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "begin", NULL, NULL, NULL);
+    }
+    const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, c[k].imgid);
+    dt_image_t *img = dt_image_cache_write_get(darktable.image_cache, cimg);
+    (void)dt_exif_xmp_read_prepared(img, c[k].xmp, 0);
+    // write through to db, but not back to the xmp we just read.
+    dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
+    dt_image_cache_read_release(darktable.image_cache, img);
+    _image_xmp_synch_set(dt_database_get(darktable.db), c[k].imgid, c[k].mtime);
+    dt_mipmap_cache_remove(darktable.mipmap_cache, c[k].imgid);
+    g_free(c[k].filename);
+  }
+
+  c = (_image_xmp_changed_t *)unknown->data;
+  if(num == 0 && unknown->len) DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "begin", NULL, NULL, NULL);
+  for(guint k=0; k<unknown->len; k++)
+    _image_xmp_synch_set(dt_database_get(darktable.db), c[k].imgid, c[k].mtime);
+  if(num || unknown->len) DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "commit", NULL, NULL, NULL);
+
+  g_array_free(changed, TRUE);
+  g_array_free(unknown, TRUE);
+  return num;
+}
+
 #if GLIB_CHECK_VERSION (2, 26, 0)
 void dt_image_add_time_offset(const int imgid, const long int offset)
 {
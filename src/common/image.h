@@ -137,8 +137,16 @@ void dt_image_path_append_version(int imgid, char *pathname, const int len);
 void dt_image_print_exif(const dt_image_t *img, char *line, int len);
 /** imports a new image from raw/etc file and adds it to the data base and image cache. */
 uint32_t dt_image_import(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs);
+/** same, with the metadata and the sidecar of the file already read by dt_exif_read_prepare() and
+    dt_exif_xmp_read_prepare() (or NULL), which are freed. */
+uint32_t dt_image_import_prepared(const int32_t film_id, const char *filename, gboolean override_ignore_jpegs,
+                                  void *exif, void *xmp);
 /** removes the given image from the database. */
 void dt_image_remove(const int32_t imgid);
+/** removes all images listed in memory.removed_images from the library, in one transaction, and empties it.
+    returns the full paths of files which still have other versions in the library, for which
+    dt_image_synch_all_xmp() is left to the caller. free with g_list_free_full(.., g_free). */
+GList *dt_image_remove_batch();
 /** duplicates the given image in the database. */
 int32_t dt_image_duplicate(const int32_t imgid);
 /** flips the image, clock wise, if given flag. */
@@ -322,6 +330,9 @@ int32_t dt_image_copy(const int32_t imgid, const int32_t filmid);
 void dt_image_write_sidecar_file(int imgid);
 void dt_image_synch_xmp(const int selected);
 void dt_image_synch_all_xmp(const gchar *pathname);
+/** reads the sidecars of the film roll which were changed by someone else since darktable last wrote or read
+    them, parsing in parallel and writing to the db in batches. returns how many there were. */
+int dt_image_read_changed_xmp(const int32_t film_id);
 
 #if GLIB_CHECK_VERSION (2, 26, 0)
 // add an offset to the exif_datetime_taken field
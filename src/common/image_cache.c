@@ -19,6 +19,7 @@
 #include "common/darktable.h"
 #include "common/debug.h"
 #include "common/exif.h"
+#include "common/grouping.h"
 #include "common/image.h"
 #include "common/image_cache.h"
 #include "control/conf.h"
@@ -26,6 +27,75 @@
 
 #include <sqlite3.h>
 
+static void *_image_cache_sidecar_thread(void *ptr);
+
+#define DT_IMAGE_CACHE_COLUMNS "id, group_id, film_id, width, height, filename, maker, model, lens, exposure, aperture, iso, focal_length, datetime_taken, flags, crop, orientation, focus_distance, raw_parameters, longitude, latitude, color_matrix, colorspace"
+
+// fills the struct from a row of DT_IMAGE_CACHE_COLUMNS
+static void
+_image_from_row(dt_image_t *img, sqlite3_stmt *stmt)
+{
+  char *str;
+  img->id      = sqlite3_column_int(stmt, 0);
+  img->group_id = sqlite3_column_int(stmt, 1);
+  img->film_id = sqlite3_column_int(stmt, 2);
+  img->width   = sqlite3_column_int(stmt, 3);
+  img->height  = sqlite3_column_int(stmt, 4);
+  img->filename[0] = img->exif_maker[0] = img->exif_model[0] = img->exif_lens[0] =
+      img->exif_datetime_taken[0] = '\0';
+  str = (char *)sqlite3_column_text(stmt, 5);
+  if(str) g_strlcpy(img->filename,   str, 512);
+  str = (char *)sqlite3_column_text(stmt, 6);
+  if(str) g_strlcpy(img->exif_maker, str, 32);
+  str = (char *)sqlite3_column_text(stmt, 7);
+  if(str) g_strlcpy(img->exif_model, str, 32);
+  str = (char *)sqlite3_column_text(stmt, 8);
+  if(str) g_strlcpy(img->exif_lens,  str, 52);
+  img->exif_exposure = sqlite3_column_double(stmt, 9);
+  img->exif_aperture = sqlite3_column_double(stmt, 10);
+  img->exif_iso = sqlite3_column_double(stmt, 11);
+  img->exif_focal_length = sqlite3_column_double(stmt, 12);
+  str = (char *)sqlite3_column_text(stmt, 13);
+  if(str) g_strlcpy(img->exif_datetime_taken, str, 20);
+  img->flags = sqlite3_column_int(stmt, 14);
+  img->exif_crop = sqlite3_column_double(stmt, 15);
+  img->orientation = sqlite3_column_int(stmt, 16);
+  img->exif_focus_distance = sqlite3_column_double(stmt,17);
+  if(img->exif_focus_distance >= 0 && img->orientation >= 0) img->exif_inited = 1;
+  uint32_t tmp = sqlite3_column_int(stmt, 18);
+  memcpy(&img->legacy_flip, &tmp, sizeof(dt_image_raw_parameters_t));
+  if(sqlite3_column_type(stmt, 19) == SQLITE_FLOAT)
+    img->longitude = sqlite3_column_double(stmt, 19);
+  else
+    img->longitude = NAN;
+  if(sqlite3_column_type(stmt, 20) == SQLITE_FLOAT)
+    img->latitude = sqlite3_column_double(stmt, 20);
+  else
+    img->latitude = NAN;
+  const void *color_matrix = sqlite3_column_blob(stmt, 21);
+  if(color_matrix)
+    memcpy(img->d65_color_matrix, color_matrix, sizeof(img->d65_color_matrix));
+  else
+    img->d65_color_matrix[0] = NAN;
+  g_free(img->profile);
+  img->profile = NULL;
+  img->profile_size = 0;
+  img->colorspace = sqlite3_column_int(stmt, 22);
+
+  // buffer size?
+  if(img->flags & DT_IMAGE_LDR)
+    img->bpp = 4*sizeof(float);
+  else if(img->flags & DT_IMAGE_HDR)
+  {
+    if(img->flags & DT_IMAGE_RAW)
+      img->bpp = sizeof(float);
+    else
+      img->bpp = 4*sizeof(float);
+  }
+  else // raw
+    img->bpp = sizeof(uint16_t);
+}
+
 int32_t
 dt_image_cache_allocate(void *data, const uint32_t key, int32_t *cost, void **buf)
 {
@@ -35,83 +105,94 @@ dt_image_cache_allocate(void *data, const uint32_t key, int32_t *cost, void **bu
   *cost = sizeof(dt_image_t);
 
   dt_image_t *img = c->images + slot;
+  *buf = c->images + slot;
+
+  // read ahead by dt_image_cache_prefetch()?
+  dt_pthread_mutex_lock(&c->prefetch_mutex);
+  dt_image_t *prefetched = (dt_image_t *)g_hash_table_lookup(c->prefetched, GINT_TO_POINTER(key));
+  if(prefetched) g_hash_table_steal(c->prefetched, GINT_TO_POINTER(key));
+  dt_pthread_mutex_unlock(&c->prefetch_mutex);
+  if(prefetched)
+  {
+    g_free(img->profile);
+    memcpy(img, prefetched, sizeof(dt_image_t));
+    g_free(prefetched);
+    return 0;
+  }
+
   // load stuff from db and store in cache:
-  char *str;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select id, group_id, film_id, width, height, filename, maker, model, lens, exposure, aperture, iso, focal_length, datetime_taken, flags, crop, orientation, focus_distance, raw_parameters, longitude, latitude, color_matrix, colorspace from images where id = ?1", -1, &stmt, NULL);
+  stmt = dt_database_prepare_cached(darktable.db, "select " DT_IMAGE_CACHE_COLUMNS " from images where id = ?1");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, key);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    img->id      = sqlite3_column_int(stmt, 0);
-    img->group_id = sqlite3_column_int(stmt, 1);
-    img->film_id = sqlite3_column_int(stmt, 2);
-    img->width   = sqlite3_column_int(stmt, 3);
-    img->height  = sqlite3_column_int(stmt, 4);
-    img->filename[0] = img->exif_maker[0] = img->exif_model[0] = img->exif_lens[0] =
-        img->exif_datetime_taken[0] = '\0';
-    str = (char *)sqlite3_column_text(stmt, 5);
-    if(str) g_strlcpy(img->filename,   str, 512);
-    str = (char *)sqlite3_column_text(stmt, 6);
-    if(str) g_strlcpy(img->exif_maker, str, 32);
-    str = (char *)sqlite3_column_text(stmt, 7);
-    if(str) g_strlcpy(img->exif_model, str, 32);
-    str = (char *)sqlite3_column_text(stmt, 8);
-    if(str) g_strlcpy(img->exif_lens,  str, 52);
-    img->exif_exposure = sqlite3_column_double(stmt, 9);
-    img->exif_aperture = sqlite3_column_double(stmt, 10);
-    img->exif_iso = sqlite3_column_double(stmt, 11);
-    img->exif_focal_length = sqlite3_column_double(stmt, 12);
-    str = (char *)sqlite3_column_text(stmt, 13);
-    if(str) g_strlcpy(img->exif_datetime_taken, str, 20);
-    img->flags = sqlite3_column_int(stmt, 14);
-    img->exif_crop = sqlite3_column_double(stmt, 15);
-    img->orientation = sqlite3_column_int(stmt, 16);
-    img->exif_focus_distance = sqlite3_column_double(stmt,17);
-    if(img->exif_focus_distance >= 0 && img->orientation >= 0) img->exif_inited = 1;
-    uint32_t tmp = sqlite3_column_int(stmt, 18);
-    memcpy(&img->legacy_flip, &tmp, sizeof(dt_image_raw_parameters_t));
-    if(sqlite3_column_type(stmt, 19) == SQLITE_FLOAT)
-      img->longitude = sqlite3_column_double(stmt, 19);
-    else
-      img->longitude = NAN;
-    if(sqlite3_column_type(stmt, 20) == SQLITE_FLOAT)
-      img->latitude = sqlite3_column_double(stmt, 20);
-    else
-      img->latitude = NAN;
-    const void *color_matrix = sqlite3_column_blob(stmt, 21);
-    if(color_matrix)
-      memcpy(img->d65_color_matrix, color_matrix, sizeof(img->d65_color_matrix));
-    else
-      img->d65_color_matrix[0] = NAN;
-    g_free(img->profile);
-    img->profile = NULL;
-    img->profile_size = 0;
-    img->colorspace = sqlite3_column_int(stmt, 22);
-
-    // buffer size?
-    if(img->flags & DT_IMAGE_LDR)
-      img->bpp = 4*sizeof(float);
-    else if(img->flags & DT_IMAGE_HDR)
-    {
-      if(img->flags & DT_IMAGE_RAW)
-        img->bpp = sizeof(float);
-      else
-        img->bpp = 4*sizeof(float);
-    }
-    else // raw
-      img->bpp = sizeof(uint16_t);
+    _image_from_row(img, stmt);
   }
   else
   {
     img->id = -1;
     fprintf(stderr, "[image_cache_allocate] failed to open image %d from database: %s\n", key, sqlite3_errmsg(dt_database_get(darktable.db)));
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
-  *buf = c->images + slot;
   return 0; // no write lock required, we inited it all right here.
 }
 
+void
+dt_image_cache_prefetch(
+  dt_image_cache_t *cache,
+  const int32_t *imgids,
+  const int num)
+{
+  // only ask the database for the ones we don't have:
+  GString *query = g_string_new("select " DT_IMAGE_CACHE_COLUMNS " from images where id in (");
+  int32_t *missing = (int32_t *)malloc(sizeof(int32_t)*MAX(num, 1));
+  int num_missing = 0;
+  for(int k=0; k<num; k++)
+  {
+    if(imgids[k] <= 0) continue;
+    const dt_image_t *img = dt_image_cache_read_testget(cache, imgids[k]);
+    if(img)
+    {
+      dt_image_cache_read_release(cache, img);
+      continue;
+    }
+    g_string_append_printf(query, num_missing ? ",%d" : "%d", imgids[k]);
+    missing[num_missing++] = imgids[k];
+  }
+  g_string_append(query, ")");
+
+  if(num_missing > 1)
+  {
+    sqlite3_stmt *stmt;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query->str, -1, &stmt, NULL);
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      dt_image_t *img = (dt_image_t *)g_malloc(sizeof(dt_image_t));
+      dt_image_init(img);
+      _image_from_row(img, stmt);
+      dt_pthread_mutex_lock(&cache->prefetch_mutex);
+      g_hash_table_replace(cache->prefetched, GINT_TO_POINTER(img->id), img);
+      dt_pthread_mutex_unlock(&cache->prefetch_mutex);
+    }
+    sqlite3_finalize(stmt);
+
+    // now pull them into the cache, allocation picks them up from the table:
+    for(int k=0; k<num_missing; k++)
+    {
+      const dt_image_t *img = dt_image_cache_read_get(cache, missing[k]);
+      dt_image_cache_read_release(cache, img);
+    }
+    // whatever some other thread got to first is stale now:
+    dt_pthread_mutex_lock(&cache->prefetch_mutex);
+    for(int k=0; k<num_missing; k++)
+      g_hash_table_remove(cache->prefetched, GINT_TO_POINTER(missing[k]));
+    dt_pthread_mutex_unlock(&cache->prefetch_mutex);
+  }
+  free(missing);
+  g_string_free(query, TRUE);
+}
+
 void
 dt_image_cache_deallocate(void *data, const uint32_t key, void *payload)
 {
@@ -141,12 +222,26 @@ dt_image_cache_init(dt_image_cache_t *cache)
   const uint32_t max_mem = 50*1024*1024;
   uint32_t num = (uint32_t)(1.5f*max_mem/sizeof(dt_image_t));
   dt_cache_init(&cache->cache, num, 16, 64, max_mem);
+  dt_pthread_mutex_init(&cache->prefetch_mutex, NULL);
+  cache->prefetched = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+  dt_pthread_mutex_init(&cache->write_mutex, NULL);
+  pthread_cond_init(&cache->write_cond, NULL);
+  cache->write_pending = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+  cache->sidecar_pending = g_hash_table_new(NULL, NULL);
+  cache->write_batch = 0;
+  cache->sidecar_done = 0;
+  // without a delay there is nothing to merge, write them right away:
+  cache->sidecar_thread_running = dt_conf_get_int("write_sidecar_files_delay") > 0 &&
+                                  !pthread_create(&cache->sidecar_thread, NULL, _image_cache_sidecar_thread, cache);
   dt_cache_set_allocate_callback(&cache->cache, &dt_image_cache_allocate,   cache);
   dt_cache_set_cleanup_callback (&cache->cache, &dt_image_cache_deallocate, cache);
+  if(dt_conf_get_bool("cache_clock_replacement"))
+    dt_cache_set_replacement(&cache->cache, DT_CACHE_REPLACEMENT_CLOCK);
 
   // might have been rounded to power of two:
   num = dt_cache_capacity(&cache->cache);
   cache->images = dt_alloc_align(64, sizeof(dt_image_t)*num);
+  dt_memory_stats_add(DT_MEMORY_IMAGE_CACHE, sizeof(dt_image_t)*num);
   memset(cache->images, 0, sizeof(dt_image_t)*num);
   dt_print(DT_DEBUG_CACHE, "[image_cache] has %d entries\n", num);
   // initialize first image as empty data:
@@ -161,8 +256,25 @@ dt_image_cache_init(dt_image_cache_t *cache)
 void
 dt_image_cache_cleanup(dt_image_cache_t *cache)
 {
+  if(cache->sidecar_thread_running)
+  {
+    dt_pthread_mutex_lock(&cache->write_mutex);
+    cache->sidecar_done = 1;
+    pthread_cond_broadcast(&cache->write_cond);
+    dt_pthread_mutex_unlock(&cache->write_mutex);
+    pthread_join(cache->sidecar_thread, NULL);
+    cache->sidecar_thread_running = 0;
+  }
+  dt_image_cache_write_flush(cache);
   dt_cache_cleanup(&cache->cache);
+  dt_memory_stats_add(DT_MEMORY_IMAGE_CACHE, -(int64_t)sizeof(dt_image_t)*dt_cache_capacity(&cache->cache));
   free(cache->images);
+  g_hash_table_destroy(cache->prefetched);
+  dt_pthread_mutex_destroy(&cache->prefetch_mutex);
+  g_hash_table_destroy(cache->write_pending);
+  g_hash_table_destroy(cache->sidecar_pending);
+  pthread_cond_destroy(&cache->write_cond);
+  dt_pthread_mutex_destroy(&cache->write_mutex);
 }
 
 void dt_image_cache_print(dt_image_cache_t *cache)
@@ -216,17 +328,11 @@ dt_image_cache_write_get(
 
 
 // drops the write privileges on an image struct.
-// this triggers a write-through to sql, and if the setting
-// is present, also to xmp sidecar files (safe setting).
-void
-dt_image_cache_write_release(
-  dt_image_cache_t *cache,
-  dt_image_t *img,
-  dt_image_cache_write_mode_t mode)
+static void
+_image_cache_write_db(sqlite3 *handle, const dt_image_t *img)
 {
-  if(img->id <= 0) return;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+  DT_DEBUG_SQLITE3_PREPARE_V2(handle,
                               "update images set width = ?1, height = ?2, maker = ?3, model = ?4, "
                               "lens = ?5, exposure = ?6, aperture = ?7, iso = ?8, focal_length = ?9, "
                               "focus_distance = ?10, film_id = ?11, datetime_taken = ?12, flags = ?13, "
@@ -257,13 +363,168 @@ dt_image_cache_write_release(
   int rc = sqlite3_step(stmt);
   if (rc != SQLITE_DONE) fprintf(stderr, "[image_cache_write_release] sqlite3 error %d\n", rc);
   sqlite3_finalize(stmt);
+}
+
+// writes the sidecars of all queued images which are in the db already.
+static void
+_image_cache_write_sidecars(dt_image_cache_t *cache)
+{
+  GList *ids = NULL;
+  GHashTableIter it;
+  gpointer key;
+  dt_pthread_mutex_lock(&cache->write_mutex);
+  g_hash_table_iter_init(&it, cache->sidecar_pending);
+  while(g_hash_table_iter_next(&it, &key, NULL))
+  {
+    // still waiting for the end of its batch:
+    if(g_hash_table_lookup(cache->write_pending, key)) continue;
+    ids = g_list_prepend(ids, key);
+    g_hash_table_iter_remove(&it);
+  }
+  dt_pthread_mutex_unlock(&cache->write_mutex);
+
+  for(GList *l = ids; l; l = g_list_next(l))
+    dt_image_write_sidecar_file(GPOINTER_TO_INT(l->data));
+  g_list_free(ids);
+}
+
+static void *
+_image_cache_sidecar_thread(void *ptr)
+{
+  dt_image_cache_t *cache = (dt_image_cache_t *)ptr;
+  const int delay = dt_conf_get_int("write_sidecar_files_delay");
+  while(1)
+  {
+    dt_pthread_mutex_lock(&cache->write_mutex);
+    while(g_hash_table_size(cache->sidecar_pending) == 0 && !cache->sidecar_done)
+      dt_pthread_cond_wait(&cache->write_cond, &cache->write_mutex);
+    const int done = cache->sidecar_done;
+    dt_pthread_mutex_unlock(&cache->write_mutex);
+    // the rest is written by dt_image_cache_write_flush():
+    if(done) break;
+    // let further changes to the same images come in, they all end up in one write:
+    g_usleep(1000*delay);
+    _image_cache_write_sidecars(cache);
+  }
+  return NULL;
+}
+
+void
+dt_image_cache_write_sidecar(
+  dt_image_cache_t *cache,
+  const uint32_t imgid)
+{
+  if(imgid <= 0) return;
+  dt_pthread_mutex_lock(&cache->write_mutex);
+  g_hash_table_insert(cache->sidecar_pending, GINT_TO_POINTER(imgid), GINT_TO_POINTER(1));
+  const int now = !cache->sidecar_thread_running && cache->write_batch == 0;
+  pthread_cond_broadcast(&cache->write_cond);
+  dt_pthread_mutex_unlock(&cache->write_mutex);
+  if(now) _image_cache_write_sidecars(cache);
+}
+
+void
+dt_image_cache_write_batch_begin(
+  dt_image_cache_t *cache)
+{
+  dt_pthread_mutex_lock(&cache->write_mutex);
+  cache->write_batch++;
+  dt_pthread_mutex_unlock(&cache->write_mutex);
+}
+
+// runs on the db writer thread, data is the write_pending table of a finished batch.
+static void
+_image_cache_write_batch_db(sqlite3 *handle, void *data)
+{
+  GHashTableIter it;
+  gpointer value;
+  DT_DEBUG_SQLITE3_EXEC(handle, "begin", NULL, NULL, NULL);
+  g_hash_table_iter_init(&it, (GHashTable *)data);
+  while(g_hash_table_iter_next(&it, NULL, &value))
+    _image_cache_write_db(handle, (const dt_image_t *)value);
+  DT_DEBUG_SQLITE3_EXEC(handle, "commit", NULL, NULL, NULL);
+}
+
+// hands the merged structs to the db writer thread, to be committed in one transaction.
+// sidecars wait for it in dt_image_write_sidecar_file().
+static void
+_image_cache_write_pending(dt_image_cache_t *cache)
+{
+  GHashTable *batch = NULL;
+  dt_pthread_mutex_lock(&cache->write_mutex);
+  if(g_hash_table_size(cache->write_pending))
+  {
+    batch = cache->write_pending;
+    cache->write_pending = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+  }
+  pthread_cond_broadcast(&cache->write_cond);
+  dt_pthread_mutex_unlock(&cache->write_mutex);
+  if(batch)
+    dt_database_write_async(darktable.db, _image_cache_write_batch_db, batch, (GDestroyNotify)g_hash_table_destroy);
+}
+
+void
+dt_image_cache_write_batch_end(
+  dt_image_cache_t *cache)
+{
+  dt_pthread_mutex_lock(&cache->write_mutex);
+  const int last = (--cache->write_batch == 0);
+  dt_pthread_mutex_unlock(&cache->write_mutex);
+  if(!last) return;
+  _image_cache_write_pending(cache);
+  if(!cache->sidecar_thread_running) _image_cache_write_sidecars(cache);
+}
+
+void
+dt_image_cache_write_flush(
+  dt_image_cache_t *cache)
+{
+  _image_cache_write_pending(cache);
+  _image_cache_write_sidecars(cache);
+}
+
+// this triggers a write-through to sql, and if the setting
+// is present, also to xmp sidecar files (safe setting).
+// inside a batch the sql update waits for its end and is then done
+// by the db writer thread, and the sidecar is written by a background thread unless its delay is 0.
+void
+dt_image_cache_write_release(
+  dt_image_cache_t *cache,
+  dt_image_t *img,
+  dt_image_cache_write_mode_t mode)
+{
+  if(img->id <= 0) return;
+  dt_grouping_map_set(img->id, img->group_id);
+  dt_pthread_mutex_lock(&cache->write_mutex);
+  const int deferred = cache->write_batch > 0;
+  if(deferred)
+  {
+    // later releases of the same image just overwrite the earlier ones:
+    dt_image_t *pending = (dt_image_t *)g_hash_table_lookup(cache->write_pending, GINT_TO_POINTER(img->id));
+    if(!pending)
+    {
+      pending = (dt_image_t *)g_malloc(sizeof(dt_image_t));
+      g_hash_table_insert(cache->write_pending, GINT_TO_POINTER(img->id), pending);
+    }
+    memcpy(pending, img, sizeof(dt_image_t));
+    // not written to the db, and owned by the cacheline:
+    pending->profile = NULL;
+    pending->profile_size = 0;
+  }
+  dt_pthread_mutex_unlock(&cache->write_mutex);
+  if(!deferred)
+  {
+    // a batch still queued for the writer thread must not overwrite this later change:
+    dt_database_write_sync(darktable.db);
+    _image_cache_write_db(dt_database_get(darktable.db), img);
+  }
 
   // TODO: make this work in relaxed mode, too.
   if(mode == DT_IMAGE_CACHE_SAFE)
   {
     // rest about sidecars:
     // also synch dttags file:
-    dt_image_write_sidecar_file(img->id);
+    dt_image_cache_write_sidecar(cache, img->id);
   }
   dt_cache_write_release(&cache->cache, img->id);
 }
@@ -275,6 +536,11 @@ dt_image_cache_remove(
   dt_image_cache_t *cache,
   const uint32_t imgid)
 {
+  // nothing left to write for it:
+  dt_pthread_mutex_lock(&cache->write_mutex);
+  g_hash_table_remove(cache->write_pending, GINT_TO_POINTER(imgid));
+  g_hash_table_remove(cache->sidecar_pending, GINT_TO_POINTER(imgid));
+  dt_pthread_mutex_unlock(&cache->write_mutex);
   dt_cache_remove(&cache->cache, imgid);
 }
 
@@ -26,6 +26,19 @@ typedef struct dt_image_cache_t
   // one fat block of dt_image_t, to assign `dynamic' void* in cache to.
   dt_image_t *images;
   dt_cache_t cache;
+  // rows read ahead by dt_image_cache_prefetch(), by id, taken by the allocation of the cacheline.
+  dt_pthread_mutex_t prefetch_mutex;
+  GHashTable *prefetched;
+  // write-behind: structs released during a batch wait here (by id) for one transaction at its end,
+  // ids whose sidecar needs rewriting wait for the writer thread to do it once per delay.
+  dt_pthread_mutex_t write_mutex;
+  pthread_cond_t write_cond;
+  GHashTable *write_pending;
+  GHashTable *sidecar_pending;
+  int write_batch;
+  int sidecar_thread_running;
+  int sidecar_done;
+  pthread_t sidecar_thread;
 }
 dt_image_cache_t;
 
@@ -56,6 +69,14 @@ dt_image_cache_read_get(
   dt_image_cache_t *cache,
   const uint32_t imgid);
 
+// makes sure the image structs of these ids are in the cache, reading all the missing ones
+// from the database with one query instead of one per image. ids <= 0 are skipped.
+void
+dt_image_cache_prefetch(
+  dt_image_cache_t *cache,
+  const int32_t *imgids,
+  const int num);
+
 // same as read_get, but doesn't block and returns NULL if the image
 // is currently unavailable.
 const dt_image_t*
@@ -86,6 +107,28 @@ dt_image_cache_write_release(
   dt_image_t *img,
   dt_image_cache_write_mode_t mode);
 
+// releases of this thread and all others up to the matching _end are merged per image
+// and written to the db in one transaction at the end. nests.
+void
+dt_image_cache_write_batch_begin(
+  dt_image_cache_t *cache);
+
+void
+dt_image_cache_write_batch_end(
+  dt_image_cache_t *cache);
+
+// queues a rewrite of the xmp sidecar of this image, for changes that don't go through the
+// image struct (history, tags, ..).
+void
+dt_image_cache_write_sidecar(
+  dt_image_cache_t *cache,
+  const uint32_t imgid);
+
+// writes everything still pending to the db and the sidecar files.
+void
+dt_image_cache_write_flush(
+  dt_image_cache_t *cache);
+
 // remove the image from the cache
 void
 dt_image_cache_remove(
@@ -37,8 +37,8 @@
 #include "common/imageio_rgbe.h"
 #include "common/imageio_gm.h"
 #include "common/imageio_rawspeed.h"
-#include "common/image_compression.h"
 #include "common/mipmap_cache.h"
+#include "common/numa.h"
 #include "common/styles.h"
 #include "control/control.h"
 #include "control/conf.h"
@@ -57,6 +57,11 @@
 #include <string.h>
 #include <strings.h>
 #include <glib/gstdio.h>
+#include <emmintrin.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // =================================================
 //   begin libraw wrapper functions:
@@ -116,94 +121,121 @@ dt_imageio_flip_buffers(char *out, const char *in, const size_t bpp, const int w
   }
 }
 
-void
-dt_imageio_flip_buffers_ui16_to_float(float *out, const uint16_t *in, const float black, const float white, const int ch, const int wd, const int ht, const int fwd, const int fht, const int stride, const int orientation)
+// converts one row of wd pixels with ch channels, writing the float pixels si floats apart.
+// channels beyond the fourth are dropped, with three channels the fourth comes out as 0.
+static inline void
+_convert_row_ui8(float *out, const uint8_t *in, const __m128 black, const __m128 scale, const int ch, const int wd, const int si)
 {
-  const float scale = 1.0f/(white - black);
-  if(!orientation)
+  if(ch >= 4)
   {
-#ifdef _OPENMP
-    #pragma omp parallel for schedule(static) default(none) shared(in, out)
-#endif
-    for(int j=0; j<ht; j++) for(int i=0; i<wd; i++) for(int k=0; k<ch; k++) out[4*(j*wd + i)+k] = (in[ch*(j*stride + i)+k]-black)*scale;
-    return;
+    const __m128i zero = _mm_setzero_si128();
+    for(int i=0; i<wd; i++, in += ch, out += si)
+    {
+      int32_t bytes;
+      memcpy(&bytes, in, sizeof(bytes));
+      const __m128i px = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+      _mm_storeu_ps(out, _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(px), black), scale));
+    }
   }
-  int ii = 0, jj = 0;
-  int si = 4, sj = wd*4;
-  if(orientation & 4)
+  else if(ch == 3)
   {
-    sj = 4;
-    si = ht*4;
+    for(int i=0; i<wd; i++, in += ch, out += si)
+    {
+      const __m128 px = _mm_set_ps(_mm_cvtss_f32(black), in[2], in[1], in[0]);
+      _mm_storeu_ps(out, _mm_mul_ps(_mm_sub_ps(px, black), scale));
+    }
   }
-  if(orientation & 2)
+  else
   {
-    jj = (int)fht - jj - 1;
-    sj = -sj;
+    const float b = _mm_cvtss_f32(black), s = _mm_cvtss_f32(scale);
+    for(int i=0; i<wd; i++, in += ch, out += si)
+      for(int k=0; k<ch; k++) out[k] = (in[k] - b)*s;
   }
-  if(orientation & 1)
+}
+
+static inline void
+_convert_row_ui16(float *out, const uint16_t *in, const __m128 black, const __m128 scale, const int ch, const int wd, const int si)
+{
+  if(ch >= 4)
   {
-    ii = (int)fwd - ii - 1;
-    si = -si;
+    const __m128i zero = _mm_setzero_si128();
+    for(int i=0; i<wd; i++, in += ch, out += si)
+    {
+      const __m128i px = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)in), zero);
+      _mm_storeu_ps(out, _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(px), black), scale));
+    }
   }
-#ifdef _OPENMP
-  #pragma omp parallel for schedule(static) default(none) shared(in, out, jj, ii, sj, si)
-#endif
-  for(int j=0; j<ht; j++)
+  else if(ch == 3)
   {
-    float *out2 = out + labs(sj)*jj + labs(si)*ii + sj*j;
-    const uint16_t *in2  = in + stride*j;
-    for(int i=0; i<wd; i++)
+    for(int i=0; i<wd; i++, in += ch, out += si)
     {
-      for(int k=0; k<ch; k++) out2[k] = (in2[k] - black)*scale;
-      in2  += ch;
-      out2 += si;
+      const __m128 px = _mm_set_ps(_mm_cvtss_f32(black), in[2], in[1], in[0]);
+      _mm_storeu_ps(out, _mm_mul_ps(_mm_sub_ps(px, black), scale));
     }
   }
+  else
+  {
+    const float b = _mm_cvtss_f32(black), s = _mm_cvtss_f32(scale);
+    for(int i=0; i<wd; i++, in += ch, out += si)
+      for(int k=0; k<ch; k++) out[k] = (in[k] - b)*s;
+  }
 }
 
-void
-dt_imageio_flip_buffers_ui8_to_float(float *out, const uint8_t *in, const float black, const float white, const int ch, const int wd, const int ht, const int fwd, const int fht, const int stride, const int orientation)
+// where row j of the input and its first pixel go to in the float output, in floats
+static inline void
+_flip_float_steps(const int wd, const int ht, const int fwd, const int fht, const int orientation, ptrdiff_t *offset, int *si, int *sj)
 {
-  const float scale = 1.0f/(white - black);
-  if(!orientation)
-  {
-#ifdef _OPENMP
-    #pragma omp parallel for schedule(static) default(none) shared(in, out)
-#endif
-    for(int j=0; j<ht; j++) for(int i=0; i<wd; i++) for(int k=0; k<ch; k++) out[4*(j*wd + i)+k] = (in[j*stride + ch*i +k]-black)*scale;
-    return;
-  }
   int ii = 0, jj = 0;
-  int si = 4, sj = wd*4;
+  *si = 4;
+  *sj = wd*4;
   if(orientation & 4)
   {
-    sj = 4;
-    si = ht*4;
+    *sj = 4;
+    *si = ht*4;
   }
   if(orientation & 2)
   {
     jj = (int)fht - jj - 1;
-    sj = -sj;
+    *sj = -*sj;
   }
   if(orientation & 1)
   {
     ii = (int)fwd - ii - 1;
-    si = -si;
+    *si = -*si;
   }
+  *offset = (ptrdiff_t)abs(*sj)*jj + (ptrdiff_t)abs(*si)*ii;
+}
+
+// stride is in pixels here
+void
+dt_imageio_flip_buffers_ui16_to_float(float *out, const uint16_t *in, const float black, const float white, const int ch, const int wd, const int ht, const int fwd, const int fht, const int stride, const int orientation)
+{
+  const __m128 scale = _mm_set1_ps(1.0f/(white - black));
+  const __m128 blackv = _mm_set1_ps(black);
+  ptrdiff_t offset = 0;
+  int si = 4, sj = wd*4;
+  if(orientation) _flip_float_steps(wd, ht, fwd, fht, orientation, &offset, &si, &sj);
 #ifdef _OPENMP
-  #pragma omp parallel for schedule(static) default(none) shared(in, out, jj, ii, sj, si)
+  #pragma omp parallel for schedule(static) default(none) shared(in, out, offset, si, sj)
 #endif
   for(int j=0; j<ht; j++)
-  {
-    float *out2 = out + labs(sj)*jj + labs(si)*ii + sj*j;
-    const uint8_t *in2  = in + stride*j;
-    for(int i=0; i<wd; i++)
-    {
-      for(int k=0; k<ch; k++) out2[k] = (in2[k] - black)*scale;
-      in2  += ch;
-      out2 += si;
-    }
-  }
+    _convert_row_ui16(out + offset + (ptrdiff_t)sj*j, in + (size_t)ch*stride*j, blackv, scale, ch, wd, si);
+}
+
+// stride is in bytes here
+void
+dt_imageio_flip_buffers_ui8_to_float(float *out, const uint8_t *in, const float black, const float white, const int ch, const int wd, const int ht, const int fwd, const int fht, const int stride, const int orientation)
+{
+  const __m128 scale = _mm_set1_ps(1.0f/(white - black));
+  const __m128 blackv = _mm_set1_ps(black);
+  ptrdiff_t offset = 0;
+  int si = 4, sj = wd*4;
+  if(orientation) _flip_float_steps(wd, ht, fwd, fht, orientation, &offset, &si, &sj);
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none) shared(in, out, offset, si, sj)
+#endif
+  for(int j=0; j<ht; j++)
+    _convert_row_ui8(out + offset + (ptrdiff_t)sj*j, in + (size_t)stride*j, blackv, scale, ch, wd, si);
 }
 
 int dt_imageio_write_pos(int i, int j, int wd, int ht, float fwd, float fht, int orientation)
@@ -222,6 +254,28 @@ int dt_imageio_write_pos(int i, int j, int wd, int ht, float fwd, float fht, int
   return jj*w + ii;
 }
 
+const uint8_t *dt_imageio_map_file(const char *filename, size_t *size)
+{
+  const int fd = open(filename, O_RDONLY);
+  if(fd < 0) return NULL;
+  struct stat st;
+  void *map = MAP_FAILED;
+  if(!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0)
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping stays valid without the descriptor:
+  close(fd);
+  if(map == MAP_FAILED) return NULL;
+  // the rows are decoded by several threads at once, read ahead all of it:
+  posix_madvise(map, st.st_size, POSIX_MADV_WILLNEED);
+  *size = st.st_size;
+  return (const uint8_t *)map;
+}
+
+void dt_imageio_unmap_file(const uint8_t *map, const size_t size)
+{
+  if(map) munmap((void *)map, size);
+}
+
 dt_imageio_retval_t
 dt_imageio_open_hdr(
   dt_image_t  *img,
@@ -361,74 +415,164 @@ dt_imageio_open_raw(
   return DT_IMAGEIO_OK;
 }
 
-/* magic data: exclusion,offset,length, xx, yy, ...
+// the loaders dt_imageio_open() can dispatch to
+typedef enum dt_imageio_loader_t
+{
+  DT_IMAGEIO_LOADER_TIFF = 0,
+  DT_IMAGEIO_LOADER_PNG,
+  DT_IMAGEIO_LOADER_J2K,
+  DT_IMAGEIO_LOADER_JPEG,
+  DT_IMAGEIO_LOADER_EXR,
+  DT_IMAGEIO_LOADER_RGBE,
+  DT_IMAGEIO_LOADER_PFM,
+  DT_IMAGEIO_LOADER_RAWSPEED,
+  DT_IMAGEIO_LOADER_LIBRAW,
+  DT_IMAGEIO_LOADER_GM,
+  DT_IMAGEIO_LOADER_NONE
+}
+dt_imageio_loader_t;
+
+typedef struct dt_imageio_loader_entry_t
+{
+  const char *name;
+  dt_imageio_retval_t (*open)(dt_image_t *img, const char *filename, dt_mipmap_cache_allocator_t a);
+  // the kind of image the ldr and hdr loaders produce, 0 for the raw loaders which sort that out themselves
+  uint32_t flags;
+}
+dt_imageio_loader_entry_t;
+
+static const dt_imageio_loader_entry_t _imageio_loaders[DT_IMAGEIO_LOADER_NONE] =
+{
+  [DT_IMAGEIO_LOADER_TIFF]     = { "tiff",     dt_imageio_open_tiff,     DT_IMAGE_LDR },
+  [DT_IMAGEIO_LOADER_PNG]      = { "png",      dt_imageio_open_png,      DT_IMAGE_LDR },
+#ifdef HAVE_OPENJPEG
+  [DT_IMAGEIO_LOADER_J2K]      = { "j2k",      dt_imageio_open_j2k,      DT_IMAGE_LDR },
+#endif
+  [DT_IMAGEIO_LOADER_JPEG]     = { "jpeg",     dt_imageio_open_jpeg,     DT_IMAGE_LDR },
+  [DT_IMAGEIO_LOADER_EXR]      = { "exr",      dt_imageio_open_exr,      DT_IMAGE_HDR },
+  [DT_IMAGEIO_LOADER_RGBE]     = { "rgbe",     dt_imageio_open_rgbe,     DT_IMAGE_HDR },
+  [DT_IMAGEIO_LOADER_PFM]      = { "pfm",      dt_imageio_open_pfm,      DT_IMAGE_HDR },
+#ifdef HAVE_RAWSPEED
+  [DT_IMAGEIO_LOADER_RAWSPEED] = { "rawspeed", dt_imageio_open_rawspeed, 0 },
+#endif
+  [DT_IMAGEIO_LOADER_LIBRAW]   = { "libraw",   dt_imageio_open_raw,      0 },
+#ifdef HAVE_GRAPHICSMAGICK
+  [DT_IMAGEIO_LOADER_GM]       = { "gm",       dt_imageio_open_gm,       0 },
+#endif
+};
+
+// the part of the file the magic bytes are looked for in
+#define DT_IMAGEIO_HEADER_SIZE 64
+
+/* magic data: loader,offset,length, xx, yy, ...
     just add magic bytes to match to this struct
-    to extend mathc on ldr formats.
+    to extend match on ldr and hdr formats. the first
+    match wins, DT_IMAGEIO_LOADER_RAWSPEED marks raws
+    looking like one of the formats below.
 */
-static const uint8_t _imageio_ldr_magic[] =
+static const uint8_t _imageio_magic[] =
 {
   /* jpeg magics */
-  0x00, 0x00, 0x02, 0xff, 0xd8,                         // SOI marker
+  DT_IMAGEIO_LOADER_JPEG, 0x00, 0x02, 0xff, 0xd8,        // SOI marker
 
 #ifdef HAVE_OPENJPEG
   /* jpeg 2000, jp2 format */
-  0x00, 0x00, 0x0c, 0x0, 0x0, 0x0, 0x0C, 0x6A, 0x50, 0x20, 0x20, 0x0D, 0x0A, 0x87, 0x0A,
+  DT_IMAGEIO_LOADER_J2K, 0x00, 0x0c, 0x0, 0x0, 0x0, 0x0C, 0x6A, 0x50, 0x20, 0x20, 0x0D, 0x0A, 0x87, 0x0A,
 
   /* jpeg 2000, j2k format */
-  0x00, 0x00, 0x05, 0xFF, 0x4F, 0xFF, 0x51, 0x00,
+  DT_IMAGEIO_LOADER_J2K, 0x00, 0x05, 0xFF, 0x4F, 0xFF, 0x51, 0x00,
 #endif
 
   /* png image */
-  0x00, 0x01, 0x03, 0x50, 0x4E, 0x47,                   // ASCII 'PNG'
+  DT_IMAGEIO_LOADER_PNG, 0x01, 0x03, 0x50, 0x4E, 0x47,   // ASCII 'PNG'
 
   /* canon CR2 */
-  0x01, 0x00, 0x0a, 0x49, 0x49, 0x2a, 0x00, 0x10, 0x00, 0x00, 0x00, 0x43, 0x52,  // Canon CR2 is like TIFF with additional magic number. must come before tiff as an exclusion
+  DT_IMAGEIO_LOADER_RAWSPEED, 0x00, 0x0a, 0x49, 0x49, 0x2a, 0x00, 0x10, 0x00, 0x00, 0x00, 0x43, 0x52,  // Canon CR2 is like TIFF with additional magic number. must come before tiff as an exclusion
 
   /* tiff image, intel */
-  0x00, 0x00, 0x04, 0x4d, 0x4d, 0x00, 0x2a,
+  DT_IMAGEIO_LOADER_TIFF, 0x00, 0x04, 0x4d, 0x4d, 0x00, 0x2a,
 
   /* tiff image, motorola */
-  0x00, 0x00, 0x04, 0x49, 0x49, 0x2a, 0x00
+  DT_IMAGEIO_LOADER_TIFF, 0x00, 0x04, 0x49, 0x49, 0x2a, 0x00,
+
+  /* openexr */
+  DT_IMAGEIO_LOADER_EXR, 0x00, 0x04, 0x76, 0x2f, 0x31, 0x01,
+
+  /* radiance rgbe */
+  DT_IMAGEIO_LOADER_RGBE, 0x00, 0x02, 0x23, 0x3f,        // ASCII '#?'
+
+  /* portable float map, color and grey */
+  DT_IMAGEIO_LOADER_PFM, 0x00, 0x02, 0x50, 0x46,         // ASCII 'PF'
+  DT_IMAGEIO_LOADER_PFM, 0x00, 0x02, 0x50, 0x66          // ASCII 'Pf'
 };
 
-gboolean dt_imageio_is_ldr(const char *filename)
+static dt_imageio_loader_t
+_imageio_loader_from_magic(const uint8_t *block)
+{
+  for(int offset = 0; offset < sizeof(_imageio_magic); offset += 3 + _imageio_magic[offset+2])
+    if(memcmp(_imageio_magic+offset+3, block + _imageio_magic[offset+1], _imageio_magic[offset+2]) == 0)
+      return _imageio_magic[offset];
+  return DT_IMAGEIO_LOADER_NONE;
+}
+
+static int
+_imageio_has_extension(const char *filename, const char *const *extensions)
+{
+  const char *ext = strrchr(filename, '.');
+  if(!ext) return 0;
+  for(; *extensions; extensions++)
+    if(!strcasecmp(ext+1, *extensions)) return 1;
+  return 0;
+}
+
+static void
+_imageio_add_loader(dt_imageio_loader_t *loaders, int *cnt, const dt_imageio_loader_t loader)
+{
+  if(loader == DT_IMAGEIO_LOADER_NONE || !_imageio_loaders[loader].open) return;
+  for(int k=0; k<*cnt; k++) if(loaders[k] == loader) return;
+  loaders[(*cnt)++] = loader;
+}
+
+/** the loaders to try on the file, in order, as told by its header and extension. returns their number. */
+static int
+_imageio_pick_loaders(const char *filename, dt_imageio_loader_t loaders[DT_IMAGEIO_LOADER_NONE])
 {
-  int offset=0;
-  uint8_t block[16]= {0};
-  FILE *fin = fopen(filename,"rb");
-  if (fin)
+  static const char *const tiff_ext[] = { "tif", "tiff", NULL };
+  uint8_t block[DT_IMAGEIO_HEADER_SIZE] = {0};
+  FILE *fin = fopen(filename, "rb");
+  if(fin)
   {
-    /* read block from file */
-    int s = fread(block,16,1,fin);
+    // short files are padded with zeros, they don't match anything
+    if(fread(block, 1, sizeof(block), fin) < 16) memset(block, 0, sizeof(block));
     fclose(fin);
+  }
 
-    /* compare magic's */
-    while (s)
-    {
-      if (memcmp(_imageio_ldr_magic+offset+3, block + _imageio_ldr_magic[offset+1], _imageio_ldr_magic[offset+2]) == 0)
-      {
-        if(_imageio_ldr_magic[offset] == 0x01)
-          return FALSE;
-        else
-          return TRUE;
-      }
-      offset += 3 + (_imageio_ldr_magic+offset)[2];
+  int cnt = 0;
+  const dt_imageio_loader_t magic = _imageio_loader_from_magic(block);
+  // nef, dng, arw, pef, .. all look like tiff, only real tiffs go to libtiff
+  if(magic != DT_IMAGEIO_LOADER_RAWSPEED && (magic != DT_IMAGEIO_LOADER_TIFF || _imageio_has_extension(filename, tiff_ext)))
+    _imageio_add_loader(loaders, &cnt, magic);
 
-      /* check if finished */
-      if(offset >= sizeof(_imageio_ldr_magic))
-        break;
-    }
+  // anything not identified as an ldr or hdr format could be a raw
+  if(magic == DT_IMAGEIO_LOADER_NONE || magic == DT_IMAGEIO_LOADER_TIFF || magic == DT_IMAGEIO_LOADER_RAWSPEED)
+  {
+    _imageio_add_loader(loaders, &cnt, DT_IMAGEIO_LOADER_RAWSPEED);
+    _imageio_add_loader(loaders, &cnt, DT_IMAGEIO_LOADER_LIBRAW);
   }
-  return FALSE;
-}
 
-int dt_imageio_is_hdr(const char *filename)
-{
-  const char *c = filename + strlen(filename);
-  while(c > filename && *c != '.') c--;
-  if(*c == '.')
-    if(!strcasecmp(c, ".pfm") || !strcasecmp(c, ".hdr") || !strcasecmp(c, ".exr")) return 1;
-  return 0;
+#ifdef HAVE_GRAPHICSMAGICK
+  _imageio_add_loader(loaders, &cnt, DT_IMAGEIO_LOADER_GM);
+#else
+  // the ldr loaders only accept their own extensions, so only the one matching it has a chance
+  {
+    static const char *const png_ext[]  = { "png", NULL };
+    static const char *const jpeg_ext[] = { "jpg", "jpeg", NULL };
+    if(_imageio_has_extension(filename, tiff_ext)) _imageio_add_loader(loaders, &cnt, DT_IMAGEIO_LOADER_TIFF);
+    if(_imageio_has_extension(filename, png_ext))  _imageio_add_loader(loaders, &cnt, DT_IMAGEIO_LOADER_PNG);
+    if(_imageio_has_extension(filename, jpeg_ext)) _imageio_add_loader(loaders, &cnt, DT_IMAGEIO_LOADER_JPEG);
+  }
+#endif
+  return cnt;
 }
 
 // transparent read method to load ldr image to dt_raw_image_t with exif and so on.
@@ -500,6 +644,197 @@ void dt_imageio_to_fractional(float in, uint32_t *num, uint32_t *den)
   }
 }
 
+// =================================================
+//   export
+// =================================================
+
+// pixels rendered per band when streaming, rows are rounded to a multiple of 64:
+#define DT_IMAGEIO_EXPORT_BAND_PIXELS (8<<20)
+
+typedef struct dt_imageio_export_stream_t
+{
+  dt_develop_t *dev;
+  dt_dev_pixelpipe_t *pipe;
+  float scale;
+  int display_byteorder;
+}
+dt_imageio_export_stream_t;
+
+// export pipes are kept between the images of a batch instead of being torn down, so every export
+// thread finds one with its cache lines already allocated. the nodes are created per image anyways,
+// the history decides which module instances the pipe consists of.
+G_LOCK_DEFINE_STATIC(export_pipes);
+static GList *_export_pipes = NULL;
+
+// levels < 0 asks for a thumbnail pipe, these are not kept.
+static dt_dev_pixelpipe_t *
+_export_pipe_get(const int wd, const int ht, const int levels)
+{
+  dt_dev_pixelpipe_t *pipe = NULL;
+  if(levels >= 0)
+  {
+    // one set up on the numa node we run on, if there is one:
+    const int node = dt_numa_node();
+    G_LOCK(export_pipes);
+    GList *l = _export_pipes;
+    while(l && ((dt_dev_pixelpipe_t *)l->data)->numa_node != node) l = g_list_next(l);
+    if(!l) l = _export_pipes;
+    if(l)
+    {
+      pipe = (dt_dev_pixelpipe_t *)l->data;
+      _export_pipes = g_list_delete_link(_export_pipes, l);
+    }
+    G_UNLOCK(export_pipes);
+    if(pipe)
+    {
+      // the cache grows its lines on demand if this image is bigger than the last one:
+      dt_dev_pixelpipe_reset_export(pipe, levels);
+      return pipe;
+    }
+  }
+  pipe = (dt_dev_pixelpipe_t *)malloc(sizeof(dt_dev_pixelpipe_t));
+  if(!pipe) return NULL;
+  const int res = levels < 0 ? dt_dev_pixelpipe_init_thumbnail(pipe, wd, ht) : dt_dev_pixelpipe_init_export(pipe, wd, ht, levels);
+  if(!res)
+  {
+    free(pipe);
+    return NULL;
+  }
+  return pipe;
+}
+
+static void
+_export_pipe_put(dt_dev_pixelpipe_t *pipe)
+{
+  if(pipe->type != DT_DEV_PIXELPIPE_EXPORT)
+  {
+    dt_dev_pixelpipe_cleanup(pipe);
+    free(pipe);
+    return;
+  }
+  // the modules the nodes point to go away with the develop struct of this image:
+  dt_dev_pixelpipe_cleanup_nodes(pipe);
+  G_LOCK(export_pipes);
+  _export_pipes = g_list_prepend(_export_pipes, pipe);
+  G_UNLOCK(export_pipes);
+}
+
+void dt_imageio_export_cleanup()
+{
+  G_LOCK(export_pipes);
+  GList *pipes = _export_pipes;
+  _export_pipes = NULL;
+  G_UNLOCK(export_pipes);
+  for(GList *l = pipes; l; l = g_list_next(l))
+  {
+    dt_dev_pixelpipe_cleanup((dt_dev_pixelpipe_t *)l->data);
+    free(l->data);
+  }
+  g_list_free(pipes);
+}
+
+// converts the pipe output in place to the layout the format asked for.
+// packed is set if the pipe did the conversion to uint16 on the device already.
+static void
+_export_convert(uint8_t *buf, int width, int height, const int bpp, const int display_byteorder, const int packed)
+{
+  if(bpp == 8 && !display_byteorder)
+  {
+    // ldr output, the gamma module gave us bgr char
+    uint8_t *const buf8 = buf;
+#ifdef _OPENMP
+    #pragma omp parallel for default(none) shared(width, height) schedule(static)
+#endif
+    // just flip byte order
+    for(int k=0; k<width*height; k++)
+    {
+      uint8_t tmp = buf8[4*k+0];
+      buf8[4*k+0] = buf8[4*k+2];
+      buf8[4*k+2] = tmp;
+    }
+  }
+  else if(bpp == 16 && !packed)
+  {
+    // uint16_t per color channel
+    float    *buff  = (float *)   buf;
+    uint16_t *buf16 = (uint16_t *)buf;
+    for(int y=0; y<height; y++) for(int x=0; x<width ; x++)
+      {
+        // convert in place
+        const int k = x + width*y;
+        for(int i=0; i<3; i++) buf16[4*k+i] = CLAMP(buff[4*k+i]*0x10000, 0, 0xffff);
+      }
+  }
+  // else output float, no further harm done to the pixels :)
+}
+
+void
+dt_imageio_export_bands_init(dt_imageio_export_bands_t *bands, const void *in, const int width, const int height, const int bpp)
+{
+  bands->width = width;
+  bands->height = height;
+  bands->bpp = bpp;
+  bands->band_height = height;
+  bands->y = 0;
+  bands->failed = 0;
+  bands->buf = in;
+  bands->stream = NULL;
+}
+
+const void *
+dt_imageio_export_band(dt_imageio_export_bands_t *bands, int *y, int *rows)
+{
+  if(bands->failed || bands->y >= bands->height) return NULL;
+  *y = bands->y;
+  *rows = MIN(bands->band_height, bands->height - bands->y);
+  bands->y += *rows;
+
+  if(!bands->stream)
+    return (const uint8_t *)bands->buf + (size_t)4*(bands->bpp/8)*bands->width*(*y);
+
+  // render just these rows, the pipe pads the roi for the modules which need context:
+  dt_imageio_export_stream_t *s = bands->stream;
+  const int err = (bands->bpp == 8) ?
+                  dt_dev_pixelpipe_process(s->pipe, s->dev, 0, *y, bands->width, *rows, s->scale) :
+                  dt_dev_pixelpipe_process_no_gamma(s->pipe, s->dev, 0, *y, bands->width, *rows, s->scale);
+  if(err || !s->pipe->backbuf)
+  {
+    bands->failed = 1;
+    return NULL;
+  }
+  _export_convert(s->pipe->backbuf, bands->width, *rows, bands->bpp, s->display_byteorder, s->pipe->output_packed);
+  return s->pipe->backbuf;
+}
+
+int dt_imageio_export_with_flags(
+  const uint32_t              imgid,
+  const char                 *filename,
+  dt_imageio_module_format_t *format,
+  dt_imageio_module_data_t   *format_params,
+  const int32_t               ignore_exif,
+  const int32_t               display_byteorder,
+  const gboolean              high_quality,
+  const int32_t               thumbnail_export,
+  const char                 *filter)
+{
+  return _export_with_flags(imgid, filename, format, format_params, ignore_exif, display_byteorder,
+                            high_quality, thumbnail_export, filter, NULL, 0);
+}
+
+int dt_imageio_export_derived(
+  const uint32_t                     imgid,
+  const char                        *filename,
+  dt_imageio_module_format_t        *format,
+  dt_imageio_module_data_t          *format_params,
+  const gboolean                     high_quality,
+  const dt_imageio_export_derived_t *derived,
+  const int                          num_derived)
+{
+  if (strcmp(format->mime(format_params),"x-copy")==0)
+    return format->write_image(format_params, filename, NULL, NULL, 0, imgid);
+  return _export_with_flags(imgid, filename, format, format_params, 0, 0, high_quality, 0, NULL, derived, num_derived);
+}
+
 int dt_imageio_export(
   const uint32_t              imgid,
   const char                 *filename,
@@ -515,17 +850,50 @@ int dt_imageio_export(
                                         0, 0, high_quality, 0, NULL);
 }
 
+void
+dt_imageio_downscale(uint8_t *out, const uint8_t *in, const int iwd, const int iht, const int wd, const int ht, const int bpp)
+{
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none) shared(out, in)
+#endif
+  for(int j=0; j<ht; j++)
+  {
+    const int y0 = (int64_t)j*iht/ht, y1 = MAX(y0+1, (int)((int64_t)(j+1)*iht/ht));
+    for(int i=0; i<wd; i++)
+    {
+      const int x0 = (int64_t)i*iwd/wd, x1 = MAX(x0+1, (int)((int64_t)(i+1)*iwd/wd));
+      float sum[4] = {0.0f};
+      for(int y=y0; y<y1; y++) for(int x=x0; x<x1; x++) for(int c=0; c<4; c++)
+      {
+        const size_t k = 4*((size_t)y*iwd + x) + c;
+        sum[c] += bpp == 8 ? in[k] : bpp == 16 ? ((const uint16_t *)in)[k] : ((const float *)in)[k];
+      }
+      const float norm = 1.0f/((y1-y0)*(x1-x0));
+      for(int c=0; c<4; c++)
+      {
+        const size_t k = 4*((size_t)j*wd + i) + c;
+        if(bpp == 8) out[k] = sum[c]*norm + .5f;
+        else if(bpp == 16) ((uint16_t *)out)[k] = sum[c]*norm + .5f;
+        else ((float *)out)[k] = sum[c]*norm;
+      }
+    }
+  }
+}
+
 // internal function: to avoid exif blob reading + 8-bit byteorder flag + high-quality override
-int dt_imageio_export_with_flags(
-  const uint32_t              imgid,
-  const char                 *filename,
-  dt_imageio_module_format_t *format,
-  dt_imageio_module_data_t   *format_params,
-  const int32_t               ignore_exif,
-  const int32_t               display_byteorder,
-  const gboolean              high_quality,
-  const int32_t               thumbnail_export,
-  const char                 *filter)
+static int
+_export_with_flags(
+  const uint32_t                      imgid,
+  const char                         *filename,
+  dt_imageio_module_format_t         *format,
+  dt_imageio_module_data_t           *format_params,
+  const int32_t                       ignore_exif,
+  const int32_t                       display_byteorder,
+  const gboolean                      high_quality,
+  const int32_t                       thumbnail_export,
+  const char                         *filter,
+  const dt_imageio_export_derived_t  *derived,
+  const int                           num_derived)
 {
   dt_develop_t dev;
   dt_dev_init(&dev, 0);
@@ -543,9 +911,8 @@ int dt_imageio_export_with_flags(
 
   dt_times_t start;
   dt_get_times(&start);
-  dt_dev_pixelpipe_t pipe;
-  res = thumbnail_export ? dt_dev_pixelpipe_init_thumbnail(&pipe, wd, ht) : dt_dev_pixelpipe_init_export(&pipe, wd, ht, format->levels(format_params));
-  if(!res)
+  dt_dev_pixelpipe_t *pipe = _export_pipe_get(wd, ht, thumbnail_export ? -1 : format->levels(format_params));
+  if(!pipe)
   {
     dt_control_log(_("failed to allocate memory for export, please lower the threads used for export or buy more memory."));
     dt_dev_cleanup(&dev);
@@ -556,68 +923,35 @@ int dt_imageio_export_with_flags(
   if(!buf.buf)
   {
     dt_control_log(_("image `%s' is not available!"), img->filename);
+    _export_pipe_put(pipe);
     dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
     dt_dev_cleanup(&dev);
     return 1;
   }
 
   //  If a style is to be applied during export, add the iop params into the history
-  if (!thumbnail_export && strlen(format_params->style) && strcmp(format_params->style,_("none")))
+  if (!thumbnail_export && strlen(format_params->style) && strcmp(format_params->style,_("none")) &&
+      dt_styles_apply_to_dev(format_params->style, &dev))
   {
-    GList *stls;
-
-    GList *modules = dev.iop;
-    dt_iop_module_t *m = NULL;
-
-    if ((stls=dt_styles_get_item_list(format_params->style, TRUE, -1)) == 0)
-    {
-      dt_control_log(_("cannot find the style '%s' to apply during export."), format_params->style);
-      dt_dev_cleanup(&dev);
-      dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
-      return 1;
-    }
-
-    //  Add each params
-    while (stls)
-    {
-      dt_style_item_t *s = (dt_style_item_t *) stls->data;
-
-      modules = dev.iop;
-      while (modules)
-      {
-        m = (dt_iop_module_t *)modules->data;
-
-        if (strcmp(m->op, s->name) == 0)
-        {
-          dt_dev_history_item_t *h = malloc(sizeof(dt_dev_history_item_t));
-
-          h->params = s->params;
-          h->blend_params = s->blendop_params;
-          h->enabled = 1;
-          h->module = m;
-          h->multi_priority = 1;
-          strcpy(h->multi_name, "");
-
-          dev.history_end++;
-          dev.history = g_list_append(dev.history, h);
-          break;
-        }
-        modules = g_list_next(modules);
-      }
-      stls = g_list_next(stls);
-    }
+    dt_control_log(_("cannot find the style '%s' to apply during export."), format_params->style);
+    _export_pipe_put(pipe);
+    dt_dev_cleanup(&dev);
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    return 1;
   }
 
-  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, 1.0);
-  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
-  dt_dev_pixelpipe_synch_all(&pipe, &dev);
-  dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width, &pipe.processed_height);
+  // a cancelled export job stops its pipe within one module or tile:
+  pipe->job = dt_control_job_get_current();
+  dt_dev_pixelpipe_set_input(pipe, &dev, (float *)buf.buf, buf.width, buf.height, 1.0);
+  dt_dev_pixelpipe_create_nodes(pipe, &dev);
+  dt_dev_pixelpipe_synch_all(pipe, &dev);
+  dt_dev_pixelpipe_get_dimensions(pipe, &dev, pipe->iwidth, pipe->iheight, &pipe->processed_width, &pipe->processed_height);
   if(filter)
   {
     if(!strncmp(filter, "pre:", 4))
-      dt_dev_pixelpipe_disable_after(&pipe, filter+4);
+      dt_dev_pixelpipe_disable_after(pipe, filter+4);
     if(!strncmp(filter, "post:", 5))
-      dt_dev_pixelpipe_disable_before(&pipe, filter+5);
+      dt_dev_pixelpipe_disable_before(pipe, filter+5);
   }
   dt_show_times(&start, "[export] creating pixelpipe", NULL);
 
@@ -651,30 +985,41 @@ int dt_imageio_export_with_flags(
   g_free(overprofile);
 
   // get only once at the beginning, in case the user changes it on the way:
-  const gboolean high_quality_processing = ((format_params->max_width  == 0 || format_params->max_width  >= pipe.processed_width ) &&
-      (format_params->max_height == 0 || format_params->max_height >= pipe.processed_height)) ? FALSE :
+  const gboolean high_quality_processing = ((format_params->max_width  == 0 || format_params->max_width  >= pipe->processed_width ) &&
+      (format_params->max_height == 0 || format_params->max_height >= pipe->processed_height)) ? FALSE :
       high_quality;
   const int width  = high_quality_processing ? 0 : format_params->max_width;
   const int height = high_quality_processing ? 0 : format_params->max_height;
-  const double scalex = width  > 0 ? fminf(width /(double)pipe.processed_width,  1.0) : 1.0;
-  const double scaley = height > 0 ? fminf(height/(double)pipe.processed_height, 1.0) : 1.0;
+  const double scalex = width  > 0 ? fminf(width /(double)pipe->processed_width,  1.0) : 1.0;
+  const double scaley = height > 0 ? fminf(height/(double)pipe->processed_height, 1.0) : 1.0;
   const double scale = fminf(scalex, scaley);
-  int processed_width  = scale*pipe.processed_width  + .5f;
-  int processed_height = scale*pipe.processed_height + .5f;
+  int processed_width  = scale*pipe->processed_width  + .5f;
+  int processed_height = scale*pipe->processed_height + .5f;
   const int bpp = format->bpp(format_params);
 
+  // big images go to formats which can take them band by band without ever holding all of the pixels:
+  const int stream_mp = dt_conf_get_int("plugins/lighttable/export/stream_megapixels");
+  const gboolean stream = format->write_image_bands && !high_quality_processing && !thumbnail_export &&
+                          stream_mp > 0 && (double)processed_width*processed_height > stream_mp*1e6;
+  // the float output can be packed on the device then, unless it is downscaled on the host first:
+  pipe->pack_ui16 = (bpp == 16 && !high_quality_processing);
+
   // downsampling done last, if high quality processing was requested:
-  uint8_t *outbuf = pipe.backbuf;
+  uint8_t *outbuf = pipe->backbuf;
   uint8_t *moutbuf = NULL; // keep track of alloc'ed memory
   dt_get_times(&start);
-  if(high_quality_processing)
+  if(stream)
   {
-    dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
-    const double scalex = format_params->max_width  > 0 ? fminf(format_params->max_width /(double)pipe.processed_width,  1.0) : 1.0;
-    const double scaley = format_params->max_height > 0 ? fminf(format_params->max_height/(double)pipe.processed_height, 1.0) : 1.0;
+    // the bands are rendered while the format writes them, below.
+  }
+  else if(high_quality_processing)
+  {
+    dt_dev_pixelpipe_process_no_gamma(pipe, &dev, 0, 0, processed_width, processed_height, scale);
+    const double scalex = format_params->max_width  > 0 ? fminf(format_params->max_width /(double)pipe->processed_width,  1.0) : 1.0;
+    const double scaley = format_params->max_height > 0 ? fminf(format_params->max_height/(double)pipe->processed_height, 1.0) : 1.0;
     const double scale = fminf(scalex, scaley);
-    processed_width  = scale*pipe.processed_width  + .5f;
-    processed_height = scale*pipe.processed_height + .5f;
+    processed_width  = scale*pipe->processed_width  + .5f;
+    processed_height = scale*pipe->processed_height + .5f;
     moutbuf = (uint8_t *)dt_alloc_align(64, sizeof(float)*processed_width*processed_height*4);
     outbuf = moutbuf;
     // now downscale into the new buffer:
@@ -682,90 +1027,147 @@ int dt_imageio_export_with_flags(
     roi_in.x = roi_in.y = roi_out.x = roi_out.y = 0;
     roi_in.scale = 1.0;
     roi_out.scale = scale;
-    roi_in.width = pipe.processed_width;
-    roi_in.height = pipe.processed_height;
+    roi_in.width = pipe->processed_width;
+    roi_in.height = pipe->processed_height;
     roi_out.width = processed_width;
     roi_out.height = processed_height;
-    dt_iop_clip_and_zoom((float *)outbuf, (float *)pipe.backbuf, &roi_out, &roi_in, processed_width, pipe.processed_width);
+    dt_iop_clip_and_zoom((float *)outbuf, (float *)pipe->backbuf, &roi_out, &roi_in, processed_width, pipe->processed_width);
   }
   else
   {
     // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
     if(bpp == 8)
-      dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+      dt_dev_pixelpipe_process(pipe, &dev, 0, 0, processed_width, processed_height, scale);
     else
-      dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
-    outbuf = pipe.backbuf;
+      dt_dev_pixelpipe_process_no_gamma(pipe, &dev, 0, 0, processed_width, processed_height, scale);
+    outbuf = pipe->backbuf;
+  }
+  if(!stream)
+    dt_show_times(&start, thumbnail_export ? "[dev_process_thumbnail] pixel pipeline processing" : "[dev_process_export] pixel pipeline processing", NULL);
+
+  if(pipe->job && dt_control_job_get_state(pipe->job) == DT_JOB_STATE_CANCELLED)
+  {
+    // don't write a half processed image, and give the memory back right away
+    dt_print(DT_DEBUG_IMAGEIO, "[export] job cancelled, stopped processing image %d\n", imgid);
+    _export_pipe_put(pipe);
+    dt_dev_cleanup(&dev);
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    free(moutbuf);
+    return 1;
   }
-  dt_show_times(&start, thumbnail_export ? "[dev_process_thumbnail] pixel pipeline processing" : "[dev_process_export] pixel pipeline processing", NULL);
 
   // downconversion to low-precision formats:
-  if(bpp == 8 && !display_byteorder)
+  if(stream)
+  {
+    // done per band
+  }
+  else if(bpp == 8 && !display_byteorder && high_quality_processing)
   {
     // ldr output: char
-    if(high_quality_processing)
-    {
-      const float *const inbuf = (float *)outbuf;
-      for(int k=0; k<processed_width*processed_height; k++)
-      {
-        // convert in place, this is unfortunately very serial..
-        const uint8_t r = CLAMP(inbuf[4*k+0]*0xff, 0, 0xff);
-        const uint8_t g = CLAMP(inbuf[4*k+1]*0xff, 0, 0xff);
-        const uint8_t b = CLAMP(inbuf[4*k+2]*0xff, 0, 0xff);
-        outbuf[4*k+0] = r;
-        outbuf[4*k+1] = g;
-        outbuf[4*k+2] = b;
-      }
-    }
-    else
+    const float *const inbuf = (float *)outbuf;
+    for(int k=0; k<processed_width*processed_height; k++)
     {
-      uint8_t *const buf8 = pipe.backbuf;
-#ifdef _OPENMP
-      #pragma omp parallel for default(none) shared(processed_width, processed_height) schedule(static)
-#endif
-      // just flip byte order
-      for(int k=0; k<processed_width*processed_height; k++)
-      {
-        uint8_t tmp = buf8[4*k+0];
-        buf8[4*k+0] = buf8[4*k+2];
-        buf8[4*k+2] = tmp;
-      }
+      // convert in place, this is unfortunately very serial..
+      const uint8_t r = CLAMP(inbuf[4*k+0]*0xff, 0, 0xff);
+      const uint8_t g = CLAMP(inbuf[4*k+1]*0xff, 0, 0xff);
+      const uint8_t b = CLAMP(inbuf[4*k+2]*0xff, 0, 0xff);
+      outbuf[4*k+0] = r;
+      outbuf[4*k+1] = g;
+      outbuf[4*k+2] = b;
     }
   }
-  else if(bpp == 16)
+  else
   {
-    // uint16_t per color channel
-    float    *buff  = (float *)   outbuf;
-    uint16_t *buf16 = (uint16_t *)outbuf;
-    for(int y=0; y<processed_height; y++) for(int x=0; x<processed_width ; x++)
-      {
-        // convert in place
-        const int k = x + processed_width*y;
-        for(int i=0; i<3; i++) buf16[4*k+i] = CLAMP(buff[4*k+i]*0x10000, 0, 0xffff);
-      }
+    _export_convert(outbuf, processed_width, processed_height, bpp, display_byteorder, pipe->output_packed);
   }
-  // else output float, no further harm done to the pixels :)
 
   format_params->width  = processed_width;
   format_params->height = processed_height;
 
+  int length = 0;
+  uint8_t exif_profile[65535]; // C++ alloc'ed buffer is uncool, so we waste some bits here.
   if(!ignore_exif)
   {
-    int length;
-    uint8_t exif_profile[65535]; // C++ alloc'ed buffer is uncool, so we waste some bits here.
     char pathname[1024];
     dt_image_full_path(imgid, pathname, 1024);
     // last param is dng mode, it's false here
     length = dt_exif_read_blob(exif_profile, pathname, imgid, sRGB, processed_width, processed_height, 0);
+  }
 
-    res = format->write_image (format_params, filename, outbuf, exif_profile, length, imgid);
+  if(stream)
+  {
+    dt_imageio_export_stream_t s = { &dev, pipe, scale, display_byteorder };
+    dt_imageio_export_bands_t bands;
+    dt_imageio_export_bands_init(&bands, NULL, processed_width, processed_height, bpp);
+    bands.band_height = MAX(1, DT_IMAGEIO_EXPORT_BAND_PIXELS / processed_width / 64) * 64;
+    bands.stream = &s;
+    dt_print(DT_DEBUG_IMAGEIO, "[export] streaming %dx%d to `%s' in bands of %d rows\n",
+             processed_width, processed_height, filename, bands.band_height);
+    dt_get_times(&start);
+    res = format->write_image_bands(format_params, filename, &bands, ignore_exif ? NULL : exif_profile, length, imgid);
+    dt_show_times(&start, "[dev_process_export] pixel pipeline processing and writing", NULL);
+    if(bands.failed || bands.y < bands.height)
+    {
+      // don't leave a truncated image behind
+      g_unlink(filename);
+      res = 1;
+    }
   }
   else
   {
-    res = format->write_image (format_params, filename, outbuf, NULL, 0, imgid);
+    res = format->write_image (format_params, filename, outbuf, ignore_exif ? NULL : exif_profile, length, imgid);
+  }
+
+  // the smaller copies come from the same pixels, unless these were never all in memory at once:
+  const size_t params_size = num_derived ? format->params_size(format) : 0;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) default(none) shared(format, format_params, derived, filter, outbuf, processed_width, processed_height, sRGB, res, stderr)
+#endif
+  for(int k=0; k<num_derived; k++)
+  {
+    dt_imageio_module_data_t *p = (dt_imageio_module_data_t *)malloc(params_size);
+    memcpy(p, format_params, params_size);
+    p->max_width  = derived[k].max_width;
+    p->max_height = derived[k].max_height;
+    int r = 0;
+    if(stream || res)
+    {
+      r = res ? res : dt_imageio_export_with_flags(imgid, derived[k].filename, format, p, ignore_exif, display_byteorder, FALSE, 0, filter);
+    }
+    else
+    {
+      const double scalex = p->max_width  > 0 ? fminf(p->max_width /(double)processed_width,  1.0) : 1.0;
+      const double scaley = p->max_height > 0 ? fminf(p->max_height/(double)processed_height, 1.0) : 1.0;
+      const double dscale = fminf(scalex, scaley);
+      p->width  = MAX(1, dscale*processed_width  + .5f);
+      p->height = MAX(1, dscale*processed_height + .5f);
+      uint8_t *dbuf = (uint8_t *)dt_alloc_align(64, (size_t)p->width*p->height*4*(bpp/8));
+      dt_imageio_downscale(dbuf, outbuf, processed_width, processed_height, p->width, p->height, bpp);
+      int dlength = 0;
+      uint8_t *dexif = NULL;
+      if(!ignore_exif)
+      {
+        char pathname[1024];
+        dt_image_full_path(imgid, pathname, 1024);
+        dexif = (uint8_t *)malloc(65535);
+        dlength = dt_exif_read_blob(dexif, pathname, imgid, sRGB, p->width, p->height, 0);
+      }
+      r = format->write_image(p, derived[k].filename, dbuf, dexif, dlength, imgid);
+      free(dexif);
+      free(dbuf);
+    }
+    if(r)
+    {
+      fprintf(stderr, "[export] could not write `%s'\n", derived[k].filename);
+#ifdef _OPENMP
+      #pragma omp critical
+#endif
+      res = r;
+    }
+    free(p);
   }
 
-  dt_dev_pixelpipe_cleanup(&pipe);
+  _export_pipe_put(pipe);
   dt_dev_cleanup(&dev);
   dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
   free(moutbuf);
@@ -809,29 +1211,28 @@ dt_imageio_open(
 
   dt_imageio_retval_t ret = DT_IMAGEIO_FILE_CORRUPTED;
 
-  /* check if file is ldr using magic's */
-  if (dt_imageio_is_ldr(filename))
-    ret = dt_imageio_open_ldr(img, filename, a);
-
-  /* silly check using file extensions: */
-  if(ret != DT_IMAGEIO_OK && ret != DT_IMAGEIO_CACHE_FULL && dt_imageio_is_hdr(filename))
-    ret = dt_imageio_open_hdr(img, filename, a);
-
-#ifdef HAVE_RAWSPEED
-  if(ret != DT_IMAGEIO_OK && ret != DT_IMAGEIO_CACHE_FULL)
-    ret = dt_imageio_open_rawspeed(img, filename, a);
-#endif
-
-  if(ret != DT_IMAGEIO_OK && ret != DT_IMAGEIO_CACHE_FULL)
-    ret = dt_imageio_open_raw(img, filename, a);
+  /* one look at the header decides which loaders to try, instead of going through all of them */
+  dt_imageio_loader_t loaders[DT_IMAGEIO_LOADER_NONE];
+  const int cnt = _imageio_pick_loaders(filename, loaders);
 
-#ifdef HAVE_GRAPHICSMAGICK
-  if(ret != DT_IMAGEIO_OK && ret != DT_IMAGEIO_CACHE_FULL)
-    ret = dt_imageio_open_gm(img, filename, a);
-#else
-  if(ret != DT_IMAGEIO_OK && ret != DT_IMAGEIO_CACHE_FULL)
-    ret = dt_imageio_open_ldr(img, filename, a);
-#endif
+  char tried[256] = {0};
+  for(int k=0; k<cnt && ret != DT_IMAGEIO_OK && ret != DT_IMAGEIO_CACHE_FULL; k++)
+  {
+    const dt_imageio_loader_entry_t *loader = _imageio_loaders + loaders[k];
+    // needed to alloc correct buffer size:
+    if(loader->flags == DT_IMAGE_HDR) img->bpp = 4*sizeof(float);
+    ret = loader->open(img, filename, a);
+    if(loader->flags && (ret == DT_IMAGEIO_OK || ret == DT_IMAGEIO_CACHE_FULL))
+    {
+      img->filters = 0;
+      img->flags &= ~(DT_IMAGE_LDR | DT_IMAGE_RAW | DT_IMAGE_HDR);
+      img->flags |= loader->flags;
+    }
+    if(k) g_strlcat(tried, ", ", sizeof(tried));
+    g_strlcat(tried, loader->name, sizeof(tried));
+  }
+  dt_print(DT_DEBUG_IMAGEIO, "[imageio] %s: tried %s, %s\n", filename, cnt ? tried : "nothing",
+           ret == DT_IMAGEIO_OK ? "loaded" : (ret == DT_IMAGEIO_CACHE_FULL ? "cache full" : "failed"));
 
   img->flags &= ~DT_IMAGE_THUMBNAIL;
 
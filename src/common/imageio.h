@@ -60,6 +60,29 @@ dt_imageio_export(
   struct dt_imageio_module_data_t *format_params,
   const gboolean high_quality);
 
+/** a smaller copy of an export, in the same format. */
+typedef struct dt_imageio_export_derived_t
+{
+  const char *filename;
+  int max_width, max_height;
+}
+dt_imageio_export_derived_t;
+
+/** like dt_imageio_export(), and also writes the derived sizes, downscaled from the pixels of the export
+  * instead of running the pixelpipe again for each of them. returns non-zero if any of the files failed. */
+int
+dt_imageio_export_derived(
+  const uint32_t imgid,
+  const char *filename,
+  struct dt_imageio_module_format_t *format,
+  struct dt_imageio_module_data_t *format_params,
+  const gboolean high_quality,
+  const dt_imageio_export_derived_t *derived,
+  const int num_derived);
+
+/** frees the pixelpipes kept for reuse by the exports so far, to be called once a batch is done. */
+void dt_imageio_export_cleanup();
+
 int
 dt_imageio_export_with_flags(
   const uint32_t                     imgid,
@@ -72,8 +95,21 @@ dt_imageio_export_with_flags(
   const int32_t                      thumbnail_export,
   const char                        *filter);
 
+struct dt_imageio_export_bands_t;
+// wraps a fully rendered image into a single band, for formats sharing their writer with write_image_bands().
+void dt_imageio_export_bands_init(struct dt_imageio_export_bands_t *bands, const void *in, const int width, const int height, const int bpp);
+// returns the next band of the exported image with its first row and row count, NULL after the last one or on failure.
+const void *dt_imageio_export_band(struct dt_imageio_export_bands_t *bands, int *y, int *rows);
+
+// box filters a finished image (8, 16 or 32 bits per channel, four channels) down to wd x ht.
+void dt_imageio_downscale(uint8_t *out, const uint8_t *in, const int iwd, const int iht, const int wd, const int ht, const int bpp);
+
 int dt_imageio_write_pos(int i, int j, int wd, int ht, float fwd, float fht, int orientation);
 
+// maps a file read only for the loaders to decode from, NULL if that fails. size is set to its length.
+const uint8_t *dt_imageio_map_file(const char *filename, size_t *size);
+void dt_imageio_unmap_file(const uint8_t *map, const size_t size);
+
 // general, efficient buffer flipping function using memcopies
 void
 dt_imageio_flip_buffers(
@@ -45,8 +45,21 @@ extern "C"
 #include <OpenEXR/ImfTiledInputFile.h>
 #include <OpenEXR/ImfChannelList.h>
 #include <OpenEXR/ImfStandardAttributes.h>
+#include <OpenEXR/ImfThreading.h>
 
 
+void dt_imageio_exr_init_threads()
+{
+  static gsize initialized = 0;
+  if(g_once_init_enter(&initialized))
+  {
+    // openexr decodes and encodes line blocks/tiles on its own pool, which is idle by default:
+    const int threads = dt_conf_get_int("openexr_threads");
+    Imf::setGlobalThreadCount(threads > 0 ? threads : dt_get_num_threads());
+    g_once_init_leave(&initialized, 1);
+  }
+}
+
 dt_imageio_retval_t dt_imageio_open_exr (dt_image_t *img, const char *filename, dt_mipmap_cache_allocator_t a)
 {
   bool isTiled=false;
@@ -58,6 +71,8 @@ dt_imageio_retval_t dt_imageio_open_exr (dt_image_t *img, const char *filename,
   if(!Imf::isOpenExrFile ((const char *)filename,isTiled))
     return DT_IMAGEIO_FILE_CORRUPTED;
 
+  dt_imageio_exr_init_threads();
+
   /* open exr file */
   try
   {
@@ -28,6 +28,8 @@ extern "C"
 #endif
 
   dt_imageio_retval_t dt_imageio_open_exr (dt_image_t *img, const char *filename, dt_mipmap_cache_allocator_t a);
+  // sizes the openexr thread pool shared by all exr reads and writes, once.
+  void dt_imageio_exr_init_threads();
 
 #ifdef __cplusplus
 }
@@ -129,6 +129,50 @@ int dt_imageio_jpeg_decompress(dt_imageio_jpeg_t *jpg, uint8_t *out)
   return 0;
 }
 
+void dt_imageio_jpeg_decompress_scale(dt_imageio_jpeg_t *jpg, const int denom)
+{
+  // libjpeg scales in the dct domain, which skips most of the idct work for the dropped frequencies.
+  jpg->dinfo.scale_num = 1;
+  jpg->dinfo.scale_denom = denom;
+  jpg->dinfo.out_color_space = JCS_RGB;
+  jpeg_calc_output_dimensions(&(jpg->dinfo));
+  jpg->width  = jpg->dinfo.output_width;
+  jpg->height = jpg->dinfo.output_height;
+}
+
+void dt_imageio_jpeg_decompress_fast(dt_imageio_jpeg_t *jpg)
+{
+  // libjpeg-turbo has simd versions of both, and the difference is invisible on thumbnails.
+  jpg->dinfo.dct_method = JDCT_IFAST;
+  jpg->dinfo.do_fancy_upsampling = FALSE;
+}
+
+int dt_imageio_jpeg_decompress_rgb(dt_imageio_jpeg_t *jpg, uint8_t *out, const int stride)
+{
+  struct dt_imageio_jpeg_error_mgr jerr;
+  jpg->dinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = dt_imageio_jpeg_error_exit;
+  if (setjmp(jerr.setjmp_buffer))
+  {
+    jpeg_destroy_decompress(&(jpg->dinfo));
+    return 1;
+  }
+  jpg->dinfo.out_color_space = JCS_RGB;
+  (void)jpeg_start_decompress(&(jpg->dinfo));
+  while(jpg->dinfo.output_scanline < jpg->dinfo.output_height)
+  {
+    // decode straight into the destination rows, no intermediate scanline buffer.
+    JSAMPROW row_pointer[1] = { out + (size_t)stride*jpg->dinfo.output_scanline };
+    if(jpeg_read_scanlines(&(jpg->dinfo), row_pointer, 1) != 1)
+    {
+      jpeg_destroy_decompress(&(jpg->dinfo));
+      return 1;
+    }
+  }
+  jpeg_destroy_decompress(&(jpg->dinfo));
+  return 0;
+}
+
 int dt_imageio_jpeg_compress(const uint8_t *in, uint8_t *out, const int width, const int height, const int quality)
 {
   struct dt_imageio_jpeg_error_mgr jerr;
@@ -46,6 +46,12 @@ dt_imageio_jpeg_t;
 int dt_imageio_jpeg_decompress_header(const void *in, size_t length, dt_imageio_jpeg_t *jpg);
 /** reads the whole image to the out buffer, which has to be large enough. */
 int dt_imageio_jpeg_decompress(dt_imageio_jpeg_t *jpg, uint8_t *out);
+/** let libjpeg downscale by 1/denom (1, 2, 4 or 8) while decoding, updates width/height in jpg struct. call after reading the header. */
+void dt_imageio_jpeg_decompress_scale(dt_imageio_jpeg_t *jpg, const int denom);
+/** trade some precision for speed: integer fast dct and no fancy upsampling of the chroma. call after reading the header. */
+void dt_imageio_jpeg_decompress_fast(dt_imageio_jpeg_t *jpg);
+/** reads the (scaled) image as packed 8-bit rgb into out, rows are stride bytes apart. */
+int dt_imageio_jpeg_decompress_rgb(dt_imageio_jpeg_t *jpg, uint8_t *out, const int stride);
 /** compresses in to out buffer with given quality (0..100). out buffer must be large enough. returns actual data length. */
 int dt_imageio_jpeg_compress(const uint8_t *in, uint8_t *out, const int width, const int height, const int quality);
 
@@ -52,6 +52,24 @@ typedef struct dt_imageio_module_data_t
 }
 dt_imageio_module_data_t;
 
+/*
+ * the final image as a sequence of horizontal bands, top to bottom, 4 channels per
+ * pixel in the layout bpp() asked for. when streaming, every band is rendered by the
+ * pixelpipe on request, otherwise there is one band holding the whole image.
+ * use dt_imageio_export_band() to walk it.
+ */
+typedef struct dt_imageio_export_bands_t
+{
+  int width, height;
+  int bpp;                 // bits per channel, as returned by bpp()
+  int band_height;         // rows per band, a multiple of 64 when streaming. the last one might be shorter
+  int y;                   // first row of the next band
+  int failed;              // set if rendering a band went wrong
+  const void *buf;         // the whole image, if not streaming
+  struct dt_imageio_export_stream_t *stream; // pipe state, if streaming
+}
+dt_imageio_export_bands_t;
+
 struct dt_imageio_module_format_t;
 /* responsible for image encoding, such as jpg,png,etc */
 typedef struct dt_imageio_module_format_t
@@ -100,6 +118,8 @@ typedef struct dt_imageio_module_format_t
   int (*bpp)(dt_imageio_module_data_t *data);
   /* write to file, with exif if not NULL, and icc profile if supported. */
   int (*write_image)(dt_imageio_module_data_t *data, const char *filename, const void *in, void *exif, int exif_len, int imgid);
+  /* optional: same as write_image, but consumes the image band by band as the pipe renders it. */
+  int (*write_image_bands)(dt_imageio_module_data_t *data, const char *filename, dt_imageio_export_bands_t *bands, void *exif, int exif_len, int imgid);
   /* flag that describes the available precision/levels of output format. mainly used for dithering. */
   int (*levels)(dt_imageio_module_data_t *data);
 
@@ -114,6 +134,9 @@ dt_imageio_module_format_t;
 
 
 /* responsible for image storage, such as flickr, harddisk, etc */
+/* returned by store() if it skipped the image, see common/export_cache.h */
+#define DT_IMAGEIO_STORE_UNCHANGED 2
+
 typedef struct dt_imageio_module_storage_t
 {
   // office use only:
@@ -144,7 +167,8 @@ typedef struct dt_imageio_module_storage_t
   /* get storage recommended image dimension, return 0 if no recommendation exists. */
   int (*recommended_dimension)    (struct dt_imageio_module_storage_t *self, uint32_t *width, uint32_t *height);
 
-  /* this actually does the work */
+  /* this actually does the work. returns 0 on success, DT_IMAGEIO_STORE_UNCHANGED if an export of the same
+   * image with the same settings was already there and got kept. */
   int (*store)(struct dt_imageio_module_storage_t *self,struct dt_imageio_module_data_t *self_data, const int imgid, dt_imageio_module_format_t *format, dt_imageio_module_data_t *fdata, const int num, const int total, const gboolean high_quality);
   /* called once at the end (after exporting all images), if implemented. */
   void (*finalize_store) (struct dt_imageio_module_storage_t *self, dt_imageio_module_data_t *data);
@@ -20,72 +20,85 @@
 #endif
 #include "common/darktable.h"
 #include "common/imageio_pfm.h"
+#include "common/imageio.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
+#include <float.h>
 #include <math.h>
 #include <assert.h>
 
+// one sample, which may sit anywhere in the file, byte swapped if the file has the other endianness.
+static inline float _pfm_sample(const uint8_t *in, const int swap)
+{
+  uint32_t v;
+  memcpy(&v, in, sizeof(v));
+  if(swap) v = GUINT32_SWAP_LE_BE(v);
+  float f;
+  memcpy(&f, &v, sizeof(f));
+  return fmaxf(0.0f, fminf(FLT_MAX, f));
+}
+
 dt_imageio_retval_t dt_imageio_open_pfm(dt_image_t *img, const char *filename, dt_mipmap_cache_allocator_t a)
 {
   const char *ext = filename + strlen(filename);
   while(*ext != '.' && ext > filename) ext--;
   if(strcasecmp(ext, ".pfm")) return DT_IMAGEIO_FILE_CORRUPTED;
-  FILE *f = fopen(filename, "rb");
-  if(!f) return DT_IMAGEIO_FILE_CORRUPTED;
-  int ret = 0;
-  int cols = 3;
-  char head[2] = {'X', 'X'};
-  ret = fscanf(f, "%c%c\n", head, head+1);
-  if(ret != 2 || head[0] != 'P') goto error_corrupt;
-  if(head[1] == 'F') cols = 3;
-  else if(head[1] == 'f') cols = 1;
-  else goto error_corrupt;
-  ret = fscanf(f, "%d %d\n%*[^\n]", &img->width, &img->height);
-  if(ret != 2) goto error_corrupt;
-  ret = fread(&ret, sizeof(char), 1, f);
-  if(ret != 1) goto error_corrupt;
-  ret = 0;
+  size_t size = 0;
+  const uint8_t *map = dt_imageio_map_file(filename, &size);
+  if(!map) return DT_IMAGEIO_FILE_CORRUPTED;
+
+  // "PF" or "Pf", width and height, and the scale which is negative for little endian samples.
+  // a single white space separates the header from the samples.
+  char head[128];
+  const size_t head_len = MIN(size, sizeof(head) - 1);
+  memcpy(head, map, head_len);
+  head[head_len] = '\0';
+  char type = 0;
+  int width = 0, height = 0, offset = 0;
+  float scale = 0.0f;
+  if(sscanf(head, "P%c %d %d %f%n", &type, &width, &height, &scale, &offset) != 4 || (type != 'F' && type != 'f') ||
+     width <= 0 || height <= 0 || offset >= head_len)
+  {
+    dt_imageio_unmap_file(map, size);
+    return DT_IMAGEIO_FILE_CORRUPTED;
+  }
+  offset++;
+  int cols = type == 'F' ? 3 : 1;
+  if(size < offset + (size_t)cols*sizeof(float)*width*height)
+  {
+    dt_imageio_unmap_file(map, size);
+    return DT_IMAGEIO_FILE_CORRUPTED;
+  }
+  int swap = (scale < 0.0f) != (G_BYTE_ORDER == G_LITTLE_ENDIAN);
+  img->width = width;
+  img->height = height;
 
   float *buf = (float *)dt_mipmap_cache_alloc(img, DT_MIPMAP_FULL, a);
-  if(!buf) goto error_cache_full;
-  if(cols == 3)
+  if(!buf)
   {
-    ret = fread(buf, 3*sizeof(float), img->width*img->height, f);
-    for(int i=img->width*img->height-1; i>=0; i--) for(int c=0; c<3; c++) buf[4*i+c] = fmaxf(0.0f, fminf(FLT_MAX, buf[3*i+c]));
+    dt_imageio_unmap_file(map, size);
+    return DT_IMAGEIO_CACHE_FULL;
   }
-  else for(int j=0; j < img->height; j++)
-      for(int i=0; i < img->width; i++)
-      {
-        ret = fread(buf + 4*(img->width*j + i), sizeof(float), 1, f);
-        buf[4*(img->width*j + i) + 2] =
-          buf[4*(img->width*j + i) + 1] =
-            buf[4*(img->width*j + i) + 0];
-      }
-  float *line = (float *)malloc(sizeof(float)*4*img->width);
-  for(int j=0; j < img->height/2; j++)
+  const uint8_t *data = map + offset;
+  // straight from the file into the mipmap, the rows are stored bottom up:
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none) shared(buf, data, width, height, cols, swap)
+#endif
+  for(int j=0; j < height; j++)
   {
-    memcpy(line,
-           buf + img->width*j*4,
-           4*sizeof(float)*img->width);
-    memcpy(buf + img->width*j*4,
-           buf + img->width*(img->height-1-j)*4,
-           4*sizeof(float)*img->width);
-    memcpy(buf + img->width*(img->height-1-j)*4,
-           line,
-           4*sizeof(float)*img->width);
+    const uint8_t *in = data + (size_t)cols*sizeof(float)*width*(height-1-j);
+    float *out = buf + (size_t)4*width*j;
+    for(int i=0; i < width; i++, in += cols*sizeof(float), out += 4)
+    {
+      for(int c=0; c<3; c++) out[c] = _pfm_sample(in + (cols == 3 ? c*sizeof(float) : 0), swap);
+      out[3] = 0.0f;
+    }
   }
-  free(line);
-  fclose(f);
+  dt_imageio_unmap_file(map, size);
   return DT_IMAGEIO_OK;
-
-error_corrupt:
-  fclose(f);
-  return DT_IMAGEIO_FILE_CORRUPTED;
-error_cache_full:
-  fclose(f);
-  return DT_IMAGEIO_CACHE_FULL;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -21,6 +21,10 @@
 #endif
 
 #include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+#include <pthread.h>
 
 #include "rawspeed/RawSpeed/StdAfx.h"
 #include "rawspeed/RawSpeed/FileReader.h"
@@ -37,24 +41,329 @@ extern "C"
 #include "common/darktable.h"
 #include "common/colorspaces.h"
 #include "common/file_location.h"
+#include "control/conf.h"
 }
 
+// raws decoding right now, the darkroom and the export jobs can each be running one
+static int _rawspeed_active_decodes = 0;
+
 // define this function, it is only declared in rawspeed:
 int
 rawspeed_get_number_of_processor_cores()
 {
 #ifdef _OPENMP
-  return omp_get_num_procs();
+  // share the cores between the decodes running in parallel, at most one per worker thread,
+  // instead of having each of them start a thread per core.
+  const int active = MAX(1, MIN(_rawspeed_active_decodes, CLAMP(dt_conf_get_int("worker_threads"), 1, 8)));
+  return MAX(1, omp_get_num_procs() / active);
 #else
   return 1;
 #endif
 }
 
+// counts the decodes in flight for rawspeed_get_number_of_processor_cores(), also when decodeRaw() throws.
+class dt_rawspeed_decode_count_t
+{
+public:
+  dt_rawspeed_decode_count_t()  { __sync_fetch_and_add(&_rawspeed_active_decodes, 1); }
+  ~dt_rawspeed_decode_count_t() { __sync_fetch_and_sub(&_rawspeed_active_decodes, 1); }
+};
+
 using namespace RawSpeed;
 
 dt_imageio_retval_t dt_imageio_open_rawspeed_sraw(dt_image_t *img, RawImage r, dt_mipmap_cache_allocator_t a);
 static CameraMetaData *meta = NULL;
 
+// parsing cameras.xml takes a few hundred milliseconds. the cameras are kept in a binary file in the
+// cache directory, which is valid as long as size, mtime and contents of cameras.xml didn't change.
+#define DT_RAWSPEED_CACHE_MAGIC "dtrscam"
+#define DT_RAWSPEED_CACHE_VERSION 1
+
+typedef struct dt_rawspeed_cache_header_t
+{
+  char magic[8];
+  int32_t version;
+  int32_t count;
+  int64_t xml_size, xml_mtime;
+  uint64_t xml_hash;
+  uint64_t payload_size, payload_hash;
+}
+dt_rawspeed_cache_header_t;
+
+// fnv-1a
+static uint64_t
+_rawspeed_hash(const char *data, const size_t size)
+{
+  uint64_t hash = 14695981039346656037ull;
+  for(size_t k=0; k<size; k++) hash = (hash ^ (uint8_t)data[k]) * 1099511628211ull;
+  return hash;
+}
+
+static void
+_rawspeed_put(std::string &buf, const void *data, const size_t size)
+{
+  buf.append((const char *)data, size);
+}
+
+static void
+_rawspeed_put_int(std::string &buf, const int32_t v)
+{
+  _rawspeed_put(buf, &v, sizeof(v));
+}
+
+static void
+_rawspeed_put_string(std::string &buf, const std::string &str)
+{
+  _rawspeed_put_int(buf, str.size());
+  buf.append(str);
+}
+
+// reads from the mapped cache, fails once past its end:
+typedef struct dt_rawspeed_reader_t
+{
+  const char *pos, *end;
+  int failed;
+}
+dt_rawspeed_reader_t;
+
+static int32_t
+_rawspeed_get_int(dt_rawspeed_reader_t *r)
+{
+  int32_t v = 0;
+  if(r->end - r->pos < (ptrdiff_t)sizeof(v)) r->failed = 1;
+  if(r->failed) return 0;
+  memcpy(&v, r->pos, sizeof(v));
+  r->pos += sizeof(v);
+  return v;
+}
+
+static std::string
+_rawspeed_get_string(dt_rawspeed_reader_t *r)
+{
+  const int32_t size = _rawspeed_get_int(r);
+  if(size < 0 || r->end - r->pos < size) r->failed = 1;
+  if(r->failed) return std::string();
+  std::string str(r->pos, size);
+  r->pos += size;
+  return str;
+}
+
+static void
+_rawspeed_write_camera(std::string &buf, Camera *cam)
+{
+  _rawspeed_put_string(buf, cam->make);
+  _rawspeed_put_string(buf, cam->model);
+  _rawspeed_put_string(buf, cam->mode);
+  _rawspeed_put_int(buf, cam->supported);
+  _rawspeed_put_int(buf, cam->decoderVersion);
+  _rawspeed_put_int(buf, cam->cropPos.x);
+  _rawspeed_put_int(buf, cam->cropPos.y);
+  _rawspeed_put_int(buf, cam->cropSize.x);
+  _rawspeed_put_int(buf, cam->cropSize.y);
+  for(int k=0; k<4; k++) _rawspeed_put_int(buf, cam->cfa.getColorAt(k&1, k>>1));
+  _rawspeed_put_int(buf, cam->blackAreas.size());
+  for(size_t k=0; k<cam->blackAreas.size(); k++)
+  {
+    _rawspeed_put_int(buf, cam->blackAreas[k].offset);
+    _rawspeed_put_int(buf, cam->blackAreas[k].size);
+    _rawspeed_put_int(buf, cam->blackAreas[k].isVertical);
+  }
+  _rawspeed_put_int(buf, cam->sensorInfo.size());
+  for(size_t k=0; k<cam->sensorInfo.size(); k++)
+  {
+    _rawspeed_put_int(buf, cam->sensorInfo[k].mBlackLevel);
+    _rawspeed_put_int(buf, cam->sensorInfo[k].mWhiteLevel);
+    _rawspeed_put_int(buf, cam->sensorInfo[k].mMinIso);
+    _rawspeed_put_int(buf, cam->sensorInfo[k].mMaxIso);
+  }
+  _rawspeed_put_int(buf, cam->hints.size());
+  for(map<string, string>::const_iterator i = cam->hints.begin(); i != cam->hints.end(); ++i)
+  {
+    _rawspeed_put_string(buf, i->first);
+    _rawspeed_put_string(buf, i->second);
+  }
+}
+
+static Camera *
+_rawspeed_read_camera(dt_rawspeed_reader_t *r)
+{
+  const std::string make = _rawspeed_get_string(r);
+  const std::string model = _rawspeed_get_string(r);
+  if(r->failed) return NULL;
+  // Camera can only be made from xml. a node with just the attributes costs nothing to parse:
+  xmlNodePtr node = xmlNewNode(NULL, BAD_CAST "Camera");
+  xmlNewProp(node, BAD_CAST "make", BAD_CAST make.c_str());
+  xmlNewProp(node, BAD_CAST "model", BAD_CAST model.c_str());
+  Camera *cam = new Camera(NULL, node);
+  xmlFreeNode(node);
+
+  cam->mode = _rawspeed_get_string(r);
+  cam->supported = _rawspeed_get_int(r);
+  cam->decoderVersion = _rawspeed_get_int(r);
+  cam->cropPos.x = _rawspeed_get_int(r);
+  cam->cropPos.y = _rawspeed_get_int(r);
+  cam->cropSize.x = _rawspeed_get_int(r);
+  cam->cropSize.y = _rawspeed_get_int(r);
+  for(int k=0; k<4; k++) cam->cfa.setColorAt(iPoint2D(k&1, k>>1), (CFAColor)_rawspeed_get_int(r));
+  const int32_t black_areas = _rawspeed_get_int(r);
+  for(int k=0; k<black_areas && !r->failed; k++)
+  {
+    const int32_t offset = _rawspeed_get_int(r);
+    const int32_t size = _rawspeed_get_int(r);
+    cam->blackAreas.push_back(BlackArea(offset, size, _rawspeed_get_int(r)));
+  }
+  const int32_t sensors = _rawspeed_get_int(r);
+  for(int k=0; k<sensors && !r->failed; k++)
+  {
+    const int32_t black = _rawspeed_get_int(r);
+    const int32_t white = _rawspeed_get_int(r);
+    const int32_t min_iso = _rawspeed_get_int(r);
+    cam->sensorInfo.push_back(CameraSensorInfo(black, white, min_iso, _rawspeed_get_int(r)));
+  }
+  const int32_t hints = _rawspeed_get_int(r);
+  for(int k=0; k<hints && !r->failed; k++)
+  {
+    const std::string name = _rawspeed_get_string(r);
+    cam->hints.insert(make_pair(name, _rawspeed_get_string(r)));
+  }
+  if(r->failed)
+  {
+    delete cam;
+    return NULL;
+  }
+  return cam;
+}
+
+static CameraMetaData *
+_rawspeed_read_cache(const char *filename, const dt_rawspeed_cache_header_t *expected)
+{
+  GMappedFile *file = g_mapped_file_new(filename, FALSE, NULL);
+  if(!file) return NULL;
+  const char *data = g_mapped_file_get_contents(file);
+  const size_t size = g_mapped_file_get_length(file);
+  dt_rawspeed_cache_header_t header;
+  CameraMetaData *cache = NULL;
+  if(size < sizeof(header)) goto done;
+  memcpy(&header, data, sizeof(header));
+  if(memcmp(header.magic, expected->magic, sizeof(header.magic)) || header.version != expected->version ||
+     header.xml_size != expected->xml_size || header.xml_mtime != expected->xml_mtime ||
+     header.xml_hash != expected->xml_hash || header.payload_size != size - sizeof(header) ||
+     header.payload_hash != _rawspeed_hash(data + sizeof(header), header.payload_size))
+    goto done;
+  {
+    dt_rawspeed_reader_t r = { data + sizeof(header), data + size, 0 };
+    cache = new CameraMetaData();
+    for(int k=0; k<header.count; k++)
+    {
+      Camera *cam = _rawspeed_read_camera(&r);
+      if(!cam) break;
+      cache->cameras[string(cam->make).append(cam->model).append(cam->mode)] = cam;
+    }
+    if(r.failed || (int)cache->cameras.size() != header.count)
+    {
+      delete cache;
+      cache = NULL;
+    }
+  }
+done:
+  g_mapped_file_unref(file);
+  return cache;
+}
+
+static void
+_rawspeed_write_cache(const char *filename, dt_rawspeed_cache_header_t *header, CameraMetaData *cameras)
+{
+  std::string payload;
+  for(map<string, Camera *>::const_iterator i = cameras->cameras.begin(); i != cameras->cameras.end(); ++i)
+    _rawspeed_write_camera(payload, i->second);
+  header->count = cameras->cameras.size();
+  header->payload_size = payload.size();
+  header->payload_hash = _rawspeed_hash(payload.data(), payload.size());
+  std::string buf;
+  _rawspeed_put(buf, header, sizeof(*header));
+  buf.append(payload);
+  // written to a temporary file and renamed, a concurrent darktable-cli never sees half of it:
+  if(!g_file_set_contents(filename, buf.data(), buf.size(), NULL))
+    dt_print(DT_DEBUG_CONTROL, "[rawspeed] could not write the camera cache `%s'\n", filename);
+}
+
+// parses cameras.xml, or reads it from the cache. the caller holds plugin_threadsafe.
+static CameraMetaData *
+_rawspeed_load_meta()
+{
+  char datadir[1024], camfile[1024], cachedir[1024], cachefile[1024];
+  dt_loc_get_datadir(datadir, sizeof(datadir));
+  snprintf(camfile, sizeof(camfile), "%s/rawspeed/cameras.xml", datadir);
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  snprintf(cachefile, sizeof(cachefile), "%s/rawspeed_cameras.bin", cachedir);
+
+  dt_rawspeed_cache_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, DT_RAWSPEED_CACHE_MAGIC, sizeof(header.magic));
+  header.version = DT_RAWSPEED_CACHE_VERSION;
+  GStatBuf st;
+  GMappedFile *xml = g_stat(camfile, &st) ? NULL : g_mapped_file_new(camfile, FALSE, NULL);
+  if(xml)
+  {
+    header.xml_size = st.st_size;
+    header.xml_mtime = st.st_mtime;
+    header.xml_hash = _rawspeed_hash(g_mapped_file_get_contents(xml), g_mapped_file_get_length(xml));
+    g_mapped_file_unref(xml);
+    CameraMetaData *cached = _rawspeed_read_cache(cachefile, &header);
+    if(cached) return cached;
+  }
+  // never cleaned up (only when dt closes)
+  CameraMetaData *parsed = new CameraMetaData(camfile);
+  if(xml) _rawspeed_write_cache(cachefile, &header, parsed);
+  return parsed;
+}
+
+static CameraMetaData *
+_rawspeed_get_meta()
+{
+  /* Load rawspeed cameras.xml meta file once */
+  if(meta == NULL)
+  {
+    dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+    if(meta == NULL)
+    {
+      try
+      {
+        meta = _rawspeed_load_meta();
+      }
+      catch(...)
+      {
+        dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+        throw;
+      }
+    }
+    dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+  }
+  return meta;
+}
+
+static void *
+_rawspeed_preload(void *data)
+{
+  try
+  {
+    _rawspeed_get_meta();
+  }
+  catch(const std::exception &exc)
+  {
+    // the first raw will run into it again and report it:
+    dt_print(DT_DEBUG_CONTROL, "[rawspeed] %s\n", exc.what());
+  }
+  return NULL;
+}
+
+void
+dt_imageio_rawspeed_preload()
+{
+  pthread_t thread;
+  if(!pthread_create(&thread, NULL, _rawspeed_preload, NULL)) pthread_detach(thread);
+}
+
 #if 0
 static void
 scale_black_white(uint16_t *const buf, const uint16_t black, const uint16_t white, const int width, const int height, const int stride)
@@ -93,22 +402,10 @@ dt_imageio_open_rawspeed(
 
   try
   {
-    /* Load rawspeed cameras.xml meta file once */
-    if(meta == NULL)
-    {
-      dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
-      if(meta == NULL)
-      {
-        char datadir[1024], camfile[1024];
-        dt_loc_get_datadir(datadir, 1024);
-        snprintf(camfile, 1024, "%s/rawspeed/cameras.xml", datadir);
-        // never cleaned up (only when dt closes)
-        meta = new CameraMetaData(camfile);
-      }
-      dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
-    }
+    _rawspeed_get_meta();
 
-    m = auto_ptr<FileMap>(f.readFile());
+    // map the file instead of reading it to the heap, the decoder reads from the page cache
+    m = auto_ptr<FileMap>(f.mapFile());
 
     RawParser t(m.get());
     d = auto_ptr<RawDecoder>(t.getDecoder());
@@ -118,7 +415,10 @@ dt_imageio_open_rawspeed(
 
     d->failOnUnknown = true;
     d->checkSupport(meta);
-    d->decodeRaw();
+    {
+      dt_rawspeed_decode_count_t count;
+      d->decodeRaw();
+    }
     d->decodeMetaData(meta);
     RawImage r = d->mRaw;
 
@@ -212,8 +512,10 @@ dt_imageio_open_rawspeed_sraw(dt_image_t *img, RawImage r, dt_mipmap_cache_alloc
                                         raw_width, raw_height, raw_width + raw_width_extra, orientation);
 #else
 
-  // TODO - OMPize this.
   float scale = 1.0 / (white - black);
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none) shared(buf, raw_img, black, scale, raw_width, raw_height, raw_width_extra)
+#endif
   for( int row = 0; row < raw_height; ++row )
     for( int col = 0; col < raw_width; ++col )
       for( int k = 0; k < 3; ++k )
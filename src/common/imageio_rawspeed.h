@@ -27,6 +27,8 @@ extern "C"
 #include "common/mipmap_cache.h"
 
   dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filename, dt_mipmap_cache_allocator_t a);
+  /** loads the camera database on a thread of its own, so the first raw doesn't wait for it. */
+  void dt_imageio_rawspeed_preload();
 
 #ifdef __cplusplus
 }
@@ -19,6 +19,7 @@
 #include "config.h"
 #endif
 #include "common/imageio_rgbe.h"
+#include "common/imageio.h"
 #include <math.h>
 #include <string.h>
 #include <stdio.h>
@@ -251,22 +252,6 @@ int RGBE_WritePixels(FILE *fp, float *data, int numpixels)
 }
 #endif
 
-/* simple read routine.  will not correctly handle run length encoding */
-int RGBE_ReadPixels(FILE *fp, float *data, int numpixels)
-{
-  unsigned char rgbe[4];
-
-  while(numpixels-- > 0)
-  {
-    if (fread(rgbe, sizeof(rgbe), 1, fp) < 1)
-      return rgbe_error(rgbe_read_error,NULL);
-    rgbe2float(&data[RGBE_DATA_RED],&data[RGBE_DATA_GREEN],
-               &data[RGBE_DATA_BLUE],rgbe);
-    data += RGBE_DATA_SIZE;
-  }
-  return RGBE_RETURN_SUCCESS;
-}
-
 #if 0
 /* The code below is only needed for the run-length encoded files. */
 /* Run length encoding adds considerable complexity but does */
@@ -382,104 +367,142 @@ int RGBE_WritePixels_RLE(FILE *fp, float *data, int scanline_width,
 }
 #endif
 
-int RGBE_ReadPixels_RLE(FILE *fp, float *data, int scanline_width,
-                        int num_scanlines)
+/* the pixels are decoded straight from the mapped file. scanlines are either flat, four bytes
+   per pixel, or run length encoded per channel. once a flat one shows up, the rest is flat. */
+
+/* 1 if the scanline at in is run length encoded, 0 if it is flat, -1 if it is corrupt */
+static int rgbe_scanline_rle(const unsigned char *in, const unsigned char *end, int scanline_width)
 {
-  unsigned char rgbe[4], *scanline_buffer, *ptr, *ptr_end;
-  int i, count;
-  unsigned char buf[2];
+  if ((scanline_width < 8)||(scanline_width > 0x7fff)||(in + 4 > end))
+    return 0;
+  if ((in[0] != 2)||(in[1] != 2)||(in[2] & 0x80))
+    return 0;
+  return ((((int)in[2])<<8 | in[3]) == scanline_width) ? 1 : -1;
+}
 
-  if ((scanline_width < 8)||(scanline_width > 0x7fff))
-    /* run length encoding is not allowed so read flat*/
-    return RGBE_ReadPixels(fp,data,scanline_width*num_scanlines);
-  scanline_buffer = NULL;
-  /* read in each successive scanline */
-  while(num_scanlines > 0)
+/* start of the scanline after the run length encoded one at in, NULL if it is corrupt */
+static const unsigned char *rgbe_skip_scanline_rle(const unsigned char *in, const unsigned char *end, int scanline_width)
+{
+  in += 4;
+  for(int i=0; i<4; i++)
   {
-    if (fread(rgbe,sizeof(rgbe),1,fp) < 1)
-    {
-      free(scanline_buffer);
-      return rgbe_error(rgbe_read_error,NULL);
-    }
-    if ((rgbe[0] != 2)||(rgbe[1] != 2)||(rgbe[2] & 0x80))
-    {
-      /* this file is not run length encoded */
-      rgbe2float(&data[0],&data[1],&data[2],rgbe);
-      data += RGBE_DATA_SIZE;
-      free(scanline_buffer);
-      return RGBE_ReadPixels(fp,data,scanline_width*num_scanlines-1);
-    }
-    if ((((int)rgbe[2])<<8 | rgbe[3]) != scanline_width)
+    int n = 0;
+    while(n < scanline_width)
     {
-      free(scanline_buffer);
-      return rgbe_error(rgbe_format_error,"wrong scanline width");
+      if (in + 2 > end)
+        return NULL;
+      const int count = in[0] > 128 ? in[0]-128 : in[0];
+      if ((count == 0)||(count > scanline_width - n))
+        return NULL;
+      n += count;
+      /* a run of the same value, or count literal values */
+      in += in[0] > 128 ? 2 : 1+count;
     }
-    if (scanline_buffer == NULL)
-      scanline_buffer = (unsigned char *)
-                        malloc(sizeof(unsigned char)*4*scanline_width);
-    if (scanline_buffer == NULL)
-      return rgbe_error(rgbe_memory_error,"unable to allocate buffer space");
-
-    ptr = &scanline_buffer[0];
-    /* read each of the four channels for the scanline into the buffer */
-    for(i=0; i<4; i++)
+  }
+  return in <= end ? in : NULL;
+}
+
+/* decodes the scanline at in into 4 floats per pixel. scratch holds 4*scanline_width bytes. */
+static void rgbe_decode_scanline(const unsigned char *in, int rle, float *data, int scanline_width,
+                                 unsigned char *scratch)
+{
+  const unsigned char *px = in;
+  int stride = 1;
+  if (rle)
+  {
+    unsigned char *ptr = scratch;
+    in += 4;
+    for(int i=0; i<4; i++)
     {
-      ptr_end = &scanline_buffer[(i+1)*scanline_width];
+      unsigned char *ptr_end = &scratch[(i+1)*scanline_width];
       while(ptr < ptr_end)
       {
-        if (fread(buf,sizeof(buf[0])*2,1,fp) < 1)
-        {
-          free(scanline_buffer);
-          return rgbe_error(rgbe_read_error,NULL);
-        }
-        if (buf[0] > 128)
+        int count = in[0] > 128 ? in[0]-128 : in[0];
+        if (in[0] > 128)
         {
-          /* a run of the same value */
-          count = buf[0]-128;
-          if ((count == 0)||(count > ptr_end - ptr))
-          {
-            free(scanline_buffer);
-            return rgbe_error(rgbe_format_error,"bad scanline data");
-          }
-          while(count-- > 0)
-            *ptr++ = buf[1];
+          memset(ptr, in[1], count);
+          in += 2;
         }
         else
         {
-          /* a non-run */
-          count = buf[0];
-          if ((count == 0)||(count > ptr_end - ptr))
-          {
-            free(scanline_buffer);
-            return rgbe_error(rgbe_format_error,"bad scanline data");
-          }
-          *ptr++ = buf[1];
-          if (--count > 0)
-          {
-            if (fread(ptr,sizeof(*ptr)*count,1,fp) < 1)
-            {
-              free(scanline_buffer);
-              return rgbe_error(rgbe_read_error,NULL);
-            }
-            ptr += count;
-          }
+          memcpy(ptr, in+1, count);
+          in += 1+count;
         }
+        ptr += count;
       }
     }
-    /* now convert data from buffer into floats */
-    for(i=0; i<scanline_width; i++)
+    px = scratch;
+    stride = scanline_width;
+  }
+  for(int i=0; i<scanline_width; i++)
+  {
+    unsigned char rgbe[4];
+    if (rle)
     {
-      rgbe[0] = scanline_buffer[i];
-      rgbe[1] = scanline_buffer[i+scanline_width];
-      rgbe[2] = scanline_buffer[i+2*scanline_width];
-      rgbe[3] = scanline_buffer[i+3*scanline_width];
-      rgbe2float(&data[RGBE_DATA_RED],&data[RGBE_DATA_GREEN],
-                 &data[RGBE_DATA_BLUE],rgbe);
-      data += RGBE_DATA_SIZE;
+      rgbe[0] = px[i];
+      rgbe[1] = px[i+stride];
+      rgbe[2] = px[i+2*stride];
+      rgbe[3] = px[i+3*stride];
+    }
+    else memcpy(rgbe, px + 4*i, 4);
+    rgbe2float(&data[RGBE_DATA_RED],&data[RGBE_DATA_GREEN],&data[RGBE_DATA_BLUE],rgbe);
+    /* repair nan/inf etc */
+    for(int c=0; c<3; c++) data[c] = fmaxf(0.0f, fminf(10000.0f, data[c]));
+    data[3] = 0.0f;
+    data += 4;
+  }
+}
+
+/* decodes num_scanlines from the data at in into 4 floats per pixel, several scanlines at a time */
+static int RGBE_ReadPixels_mapped(const unsigned char *in, const unsigned char *end, float *data, int scanline_width,
+                                  int num_scanlines)
+{
+  /* where the scanlines start, a short sequential pass over the run lengths: */
+  const unsigned char **start = (const unsigned char **)malloc(sizeof(unsigned char *)*num_scanlines);
+  unsigned char *rle = (unsigned char *)malloc(num_scanlines);
+  if (!start || !rle)
+  {
+    free(start);
+    free(rle);
+    return rgbe_error(rgbe_memory_error,"unable to allocate buffer space");
+  }
+  int flat = 0;
+  for(int j=0; j<num_scanlines; j++)
+  {
+    const int is_rle = flat ? 0 : rgbe_scanline_rle(in, end, scanline_width);
+    start[j] = in;
+    rle[j] = is_rle > 0;
+    if (is_rle > 0)
+      in = rgbe_skip_scanline_rle(in, end, scanline_width);
+    else if (is_rle == 0 && in + 4*scanline_width <= end)
+    {
+      in += 4*scanline_width;
+      flat = 1;
     }
-    num_scanlines--;
+    else
+      in = NULL;
+    if (!in)
+    {
+      free(start);
+      free(rle);
+      return rgbe_error(is_rle < 0 ? rgbe_format_error : rgbe_read_error, is_rle < 0 ? "wrong scanline width" : NULL);
+    }
+  }
+
+#ifdef _OPENMP
+  #pragma omp parallel default(none) shared(start, rle, data, scanline_width, num_scanlines)
+#endif
+  {
+    unsigned char *scratch = (unsigned char *)malloc(sizeof(unsigned char)*4*scanline_width);
+#ifdef _OPENMP
+    #pragma omp for schedule(static)
+#endif
+    for(int j=0; j<num_scanlines; j++)
+      rgbe_decode_scanline(start[j], rle[j], data + (size_t)4*scanline_width*j, scanline_width, scratch);
+    free(scratch);
   }
-  free(scanline_buffer);
+  free(start);
+  free(rle);
   return RGBE_RETURN_SUCCESS;
 }
 
@@ -503,26 +526,28 @@ dt_imageio_retval_t dt_imageio_open_rgbe(dt_image_t *img, const char *filename,
   if(strncmp(ext, ".hdr", 4) && strncmp(ext, ".HDR", 4) && strncmp(ext, ".Hdr", 4)) return DT_IMAGEIO_FILE_CORRUPTED;
   FILE *f = fopen(filename, "rb");
   if(!f) return DT_IMAGEIO_FILE_CORRUPTED;
+  const int header = RGBE_ReadHeader(f, &img->width, &img->height, NULL);
+  const long offset = ftell(f);
+  fclose(f);
+  if(header || offset < 0) return DT_IMAGEIO_FILE_CORRUPTED;
 
-  if(RGBE_ReadHeader(f, &img->width, &img->height, NULL)) goto error_corrupt;
+  size_t size = 0;
+  const uint8_t *map = dt_imageio_map_file(filename, &size);
+  if(!map || size < (size_t)offset)
+  {
+    dt_imageio_unmap_file(map, size);
+    return DT_IMAGEIO_FILE_CORRUPTED;
+  }
 
   float *buf = (float *)dt_mipmap_cache_alloc(img, DT_MIPMAP_FULL, a);
-  if(!buf) goto error_cache_full;
-  if(RGBE_ReadPixels_RLE(f, buf, img->width, img->height))
+  if(!buf)
   {
-    goto error_corrupt;
+    dt_imageio_unmap_file(map, size);
+    return DT_IMAGEIO_CACHE_FULL;
   }
-  fclose(f);
-  // repair nan/inf etc
-  for(int i=img->width*img->height-1; i>=0; i--) for(int c=0; c<3; c++) buf[4*i+c] = fmaxf(0.0f, fminf(10000.0, buf[3*i+c]));
-  return DT_IMAGEIO_OK;
-
-error_corrupt:
-  fclose(f);
-  return DT_IMAGEIO_FILE_CORRUPTED;
-error_cache_full:
-  fclose(f);
-  return DT_IMAGEIO_CACHE_FULL;
+  const int res = RGBE_ReadPixels_mapped(map + offset, map + size, buf, img->width, img->height);
+  dt_imageio_unmap_file(map, size);
+  return res ? DT_IMAGEIO_FILE_CORRUPTED : DT_IMAGEIO_OK;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
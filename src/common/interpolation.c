@@ -26,6 +26,9 @@
 #include <inttypes.h>
 #include <glib.h>
 #include <assert.h>
+#ifdef DT_AVX2_CODEPATH
+#include <immintrin.h>
+#endif
 
 /** Border extrapolation modes */
 enum border_mode
@@ -47,6 +50,9 @@ enum border_mode
 // Defines minimum alignment requirement for critical SIMD code
 #define SSE_ALIGNMENT 16
 
+// Number of output lines resampled together from one horizontally filtered buffer
+#define RESAMPLING_STRIP 16
+
 // Defines the maximum kernel half length
 // !! Make sure to sync this with the filter array !!
 #define MAX_HALF_FILTER_WIDTH 3
@@ -1268,6 +1274,105 @@ prepare_resampling_plan(
   return 0;
 }
 
+/** Range of input lines needed by an output strip
+ *
+ * @param vlength [in] Vertical plan lengths
+ * @param vindex [in] Vertical plan sample indexes
+ * @param vmeta [in] Vertical plan meta information
+ * @param y0 [in] First output line of the strip
+ * @param y1 [in] One past the last output line of the strip
+ * @param first [out] First input line
+ * @param last [out] Last input line
+ */
+static void
+strip_lines(
+  const int* vlength,
+  const int* vindex,
+  const int* vmeta,
+  const int y0,
+  const int y1,
+  int* first,
+  int* last)
+{
+  *first = INT32_MAX;
+  *last = -1;
+  for (int oy=y0; oy<y1; oy++)
+  {
+    const int vl = vlength[vmeta[3*oy + 0]];
+    const int* idx = vindex + vmeta[3*oy + 2];
+    for (int iy=0; iy<vl; iy++)
+    {
+      *first = MIN(*first, idx[iy]);
+      *last = MAX(*last, idx[iy]);
+    }
+  }
+}
+
+/** Vertical pass of one output line: each pixel is the sum of the pixels of the
+ * contributing lines of the strip buffer h, weighted by the taps. The first
+ * line of h is input line first. */
+static void
+resample_vertical_line(
+  float* o,
+  const float* h,
+  const size_t hstride,
+  const int first,
+  const int width,
+  const int vl,
+  const int* vidx,
+  const float* vtaps)
+{
+  for (int ox=0; ox < width; ox++)
+  {
+    // This will hold the resulting pixel
+    __m128 vs = _mm_setzero_ps();
+
+    for (int iy=0; iy < vl; iy++)
+    {
+      // Accumulate contribution from this line
+      const __m128 vhs = _mm_load_ps(h + hstride*(vidx[iy] - first) + 4*ox);
+      __m128 vvtap = _mm_set_ps1(vtaps[iy]);
+      vs = _mm_add_ps(vs, _mm_mul_ps(vhs, vvtap));
+    }
+
+    // Output pixel is ready
+    _mm_stream_ps(o + 4*ox, vs);
+  }
+}
+
+#ifdef DT_AVX2_CODEPATH
+/** Same, two pixels at once with fused multiply adds. */
+DT_TARGET_AVX2 static void
+resample_vertical_line_avx2(
+  float* o,
+  const float* h,
+  const size_t hstride,
+  const int first,
+  const int width,
+  const int vl,
+  const int* vidx,
+  const float* vtaps)
+{
+  int ox = 0;
+  for (; ox+1 < width; ox+=2)
+  {
+    __m256 vs = _mm256_setzero_ps();
+
+    for (int iy=0; iy < vl; iy++)
+    {
+      const __m256 vhs = _mm256_loadu_ps(h + hstride*(vidx[iy] - first) + 4*ox);
+      vs = _mm256_fmadd_ps(vhs, _mm256_set1_ps(vtaps[iy]), vs);
+    }
+
+    // The output is only 16 byte aligned
+    _mm_stream_ps(o + 4*ox, _mm256_castps256_ps128(vs));
+    _mm_stream_ps(o + 4*ox + 4, _mm256_extractf128_ps(vs, 1));
+  }
+  if (ox < width)
+    resample_vertical_line(o + 4*ox, h + 4*ox, hstride, first, 1, vl, vidx, vtaps);
+}
+#endif
+
 void
 dt_interpolation_resample(
   const struct dt_interpolation* itor,
@@ -1285,6 +1390,7 @@ dt_interpolation_resample(
   int* vlength = NULL;
   float* vkernel = NULL;
   int* vmeta = NULL;
+  float* hbuf = NULL;
 
   int r;
 
@@ -1346,40 +1452,57 @@ dt_interpolation_resample(
   int64_t ts_resampling = getts();
 #endif
 
-  // Process each output line
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta)
-#endif
-  for (int oy=0; oy<roi_out->height; oy++)
+  /* The output is processed in strips of lines. Each input line a strip depends on
+   * is filtered horizontally just once, into a per thread buffer, and the vertical
+   * pass reads from there. This does the same operations in the same order as
+   * filtering the contributing input lines again for each output pixel. */
+  const int nstrips = (roi_out->height + RESAMPLING_STRIP - 1)/RESAMPLING_STRIP;
+  int maxspan = 0;
+  for (int s=0; s<nstrips; s++)
   {
-    // Initialize column resampling indexes
-    int vlidx = vmeta[3*oy + 0]; // V(ertical) L(ength) I(n)d(e)x
-    int vkidx = vmeta[3*oy + 1]; // V(ertical) K(ernel) I(n)d(e)x
-    int viidx = vmeta[3*oy + 2]; // V(ertical) I(ndex) I(n)d(e)x
+    int first, last;
+    strip_lines(vlength, vindex, vmeta, s*RESAMPLING_STRIP, MIN((s+1)*RESAMPLING_STRIP, roi_out->height), &first, &last);
+    maxspan = MAX(maxspan, last - first + 1);
+  }
 
-    // Initialize row resampling indexes
-    int hlidx = 0; // H(orizontal) L(ength) I(n)d(e)x
-    int hkidx = 0; // H(orizontal) K(ernel) I(n)d(e)x
-    int hiidx = 0; // H(orizontal) I(ndex) I(n)d(e)x
+  const size_t hstride = (size_t)roi_out->width*4;
+  const int nthreads = omp_get_max_threads();
+  hbuf = dt_alloc_align(SSE_ALIGNMENT, sizeof(float)*hstride*maxspan*nthreads);
+  if (!hbuf)
+  {
+    goto exit;
+  }
 
-    // Number of lines contributing to the output line
-    int vl = vlength[vlidx++]; // V(ertical) L(ength)
+  void (*vertical)(float*, const float*, const size_t, const int, const int, const int, const int*, const float*) = resample_vertical_line;
+#ifdef DT_AVX2_CODEPATH
+  if (dt_codepath_avx2()) vertical = resample_vertical_line_avx2;
+#endif
 
-    // Process each output column
-    for (int ox=0; ox < roi_out->width; ox++)
-    {
-      debug_extra("output %p [% 4d % 4d]\n", out, ox, oy);
+#ifdef _OPENMP
+  #pragma omp parallel for shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta, hbuf, maxspan, vertical) schedule(static)
+#endif
+  for (int s=0; s<nstrips; s++)
+  {
+    const int y0 = s*RESAMPLING_STRIP;
+    const int y1 = MIN(y0 + RESAMPLING_STRIP, roi_out->height);
+    float* h = hbuf + hstride*maxspan*dt_get_thread_num();
 
-      // This will hold the resulting pixel
-      __m128 vs = _mm_setzero_ps();
+    int first, last;
+    strip_lines(vlength, vindex, vmeta, y0, y1, &first, &last);
 
-      // Number of horizontal samples contributing to the output
-      int hl = hlength[hlidx++]; // H(orizontal) L(ength)
+    // Horizontal pass over the input lines of the strip
+    for (int iy=first; iy<=last; iy++)
+    {
+      // This is our input line
+      const float* i = (float*)((char*)in + in_stride*iy);
+      float* hl_out = h + hstride*(iy - first);
 
-      for (int iy=0; iy < vl; iy++)
+      int hkidx = 0; // H(orizontal) K(ernel) I(n)d(e)x
+      int hiidx = 0; // H(orizontal) I(ndex) I(n)d(e)x
+      for (int ox=0; ox < roi_out->width; ox++)
       {
-        // This is our input line
-        const float* i = (float*)((char*)in + in_stride*vindex[viidx++]);
+        // Number of horizontal samples contributing to the output
+        const int hl = hlength[ox]; // H(orizontal) L(ength)
 
         __m128 vhs = _mm_setzero_ps();
 
@@ -1392,32 +1515,21 @@ dt_interpolation_resample(
           vhs = _mm_add_ps(vhs, _mm_mul_ps(*(__m128*)&i[baseidx], vhtap));
         }
 
-        // Accumulate contribution from this line
-        float vtap = vkernel[vkidx++];
-        __m128 vvtap = _mm_set_ps1(vtap);
-        vs = _mm_add_ps(vs, _mm_mul_ps(vhs, vvtap));
-
-        // Reset horizontal resampling context
-        hkidx -= hl;
-        hiidx -= hl;
+        _mm_store_ps(hl_out + 4*ox, vhs);
       }
+    }
 
-      // Output pixel is ready
-      float* o = (float*)((char*)out + oy*out_stride + ox*4*sizeof(float));
-      _mm_stream_ps(o, vs);
-
-      // Reset vertical resampling context
-      viidx -= vl;
-      vkidx -= vl;
+    // Vertical pass, each output line of the strip
+    for (int oy=y0; oy<y1; oy++)
+    {
+      // Number of lines contributing to the output line
+      const int vl = vlength[vmeta[3*oy + 0]]; // V(ertical) L(ength)
+      const int* vidx = vindex + vmeta[3*oy + 2];
+      const float* vtaps = vkernel + vmeta[3*oy + 1];
+      float* o = (float*)((char*)out + oy*out_stride);
 
-      // Progress in horizontal context
-      hiidx += hl;
-      hkidx += hl;
+      vertical(o, h, hstride, first, roi_out->width, vl, vidx, vtaps);
     }
-
-    // Progress in vertical context
-    viidx += vl;
-    vkidx += vl;
   }
 
   _mm_sfence();
@@ -1433,6 +1545,7 @@ exit:
    * allocated. */
   free(hlength);
   free(vlength);
+  free(hbuf);
 }
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
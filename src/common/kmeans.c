@@ -0,0 +1,172 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/darktable.h"
+#include "common/kmeans.h"
+#include "common/points.h"
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include <xmmintrin.h>
+
+// enough to find a handful of clusters in two dimensions, independent of the size of the buffer:
+#define KMEANS_SAMPLES (1<<14)
+// squared distance in a/b the means have to move at least to go on:
+#define KMEANS_EPSILON 1e-4f
+
+// per cluster: count, sum of a and b, sum of squares of a and b
+#define KMEANS_ACC 5
+
+// nearest mean of four samples, compared with sse:
+static inline void
+_kmeans_assign4(const float *const a, const float *const b, const int n, float mean[n][2], int *const cluster)
+{
+  const __m128 va = _mm_load_ps(a), vb = _mm_load_ps(b);
+  __m128 mdist = _mm_set1_ps(FLT_MAX);
+  __m128 best = _mm_setzero_ps();
+  for(int k=0; k<n; k++)
+  {
+    const __m128 da = _mm_sub_ps(va, _mm_set1_ps(mean[k][0]));
+    const __m128 db = _mm_sub_ps(vb, _mm_set1_ps(mean[k][1]));
+    const __m128 dist = _mm_add_ps(_mm_mul_ps(da, da), _mm_mul_ps(db, db));
+    const __m128 closer = _mm_cmplt_ps(dist, mdist);
+    mdist = _mm_min_ps(dist, mdist);
+    best = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps(k)), _mm_andnot_ps(closer, best));
+  }
+  float c[4] __attribute__((aligned(16)));
+  _mm_store_ps(c, best);
+  for(int i=0; i<4; i++) cluster[i] = c[i];
+}
+
+static inline int
+_kmeans_assign(const float a, const float b, const int n, float mean[n][2])
+{
+  float mdist = FLT_MAX;
+  int cluster = 0;
+  for(int k=0; k<n; k++)
+  {
+    const float dist = (a-mean[k][0])*(a-mean[k][0]) + (b-mean[k][1])*(b-mean[k][1]);
+    if(dist < mdist)
+    {
+      mdist = dist;
+      cluster = k;
+    }
+  }
+  return cluster;
+}
+
+static inline void
+_kmeans_accumulate(double *const acc, const float a, const float b)
+{
+  acc[0] += 1.0;
+  acc[1] += a;
+  acc[2] += b;
+  acc[3] += a*a;
+  acc[4] += b*b;
+}
+
+void dt_kmeans_ab(const float *const col, const int width, const int height, const int ch, const int n,
+                  const int max_iterations, float mean[n][2], float stddev[n][2], float weight[n])
+{
+  for(int k=0; k<n; k++) mean[k][0] = mean[k][1] = stddev[k][0] = stddev[k][1] = weight[k] = 0.0f;
+  const size_t npixels = (size_t)width*height;
+  if(npixels == 0 || n <= 0) return;
+
+  // the same samples for all iterations, or the means would never settle. the channels are kept
+  // apart, four samples make one sse vector:
+  const int samples = MIN(npixels, KMEANS_SAMPLES);
+  float *const sa = dt_alloc_align(16, 2*sizeof(float)*((samples+3) & ~3));
+  if(!sa) return;
+  float *const sb = sa + ((samples+3) & ~3);
+  float a_min = FLT_MAX, b_min = FLT_MAX, a_max = -FLT_MAX, b_max = -FLT_MAX;
+  for(int s=0; s<samples; s++)
+  {
+    const int j = CLAMP(dt_points_get()*height, 0, height-1);
+    const int i = CLAMP(dt_points_get()*width, 0, width-1);
+    sa[s] = col[(size_t)ch*((size_t)width*j + i)+1];
+    sb[s] = col[(size_t)ch*((size_t)width*j + i)+2];
+    a_min = fminf(sa[s], a_min);
+    a_max = fmaxf(sa[s], a_max);
+    b_min = fminf(sb[s], b_min);
+    b_max = fmaxf(sb[s], b_max);
+  }
+
+  // init n clusters at random inside the range of the samples
+  for(int k=0; k<n; k++)
+  {
+    mean[k][0] = 0.9f * (a_min + (a_max - a_min) * dt_points_get());
+    mean[k][1] = 0.9f * (b_min + (b_max - b_min) * dt_points_get());
+  }
+
+  // sums per thread, so the threads don't have to synchronize on every sample:
+  const int nthreads = dt_get_num_threads();
+  double *const acc = (double *)malloc(sizeof(double)*KMEANS_ACC*n*nthreads);
+  if(!acc)
+  {
+    free(sa);
+    return;
+  }
+  double sum[n][KMEANS_ACC];
+  const int vsamples = samples & ~3;
+
+  for(int it=0; it<max_iterations; it++)
+  {
+    memset(acc, 0, sizeof(double)*KMEANS_ACC*n*nthreads);
+#ifdef _OPENMP
+    #pragma omp parallel for default(none) shared(mean) schedule(static)
+#endif
+    for(int s=0; s<vsamples; s+=4)
+    {
+      double *const tacc = acc + (size_t)KMEANS_ACC*n*dt_get_thread_num();
+      int cluster[4];
+      _kmeans_assign4(sa+s, sb+s, n, mean, cluster);
+      for(int i=0; i<4; i++)
+        _kmeans_accumulate(tacc + KMEANS_ACC*cluster[i], sa[s+i], sb[s+i]);
+    }
+    for(int s=vsamples; s<samples; s++)
+      _kmeans_accumulate(acc + KMEANS_ACC*_kmeans_assign(sa[s], sb[s], n, mean), sa[s], sb[s]);
+
+    memset(sum, 0, sizeof(sum));
+    for(int t=0; t<nthreads; t++)
+      for(int k=0; k<n; k++)
+        for(int c=0; c<KMEANS_ACC; c++) sum[k][c] += acc[KMEANS_ACC*(n*t + k) + c];
+
+    // new means, empty clusters stay where they are:
+    float shift = 0.0f;
+    for(int k=0; k<n; k++)
+    {
+      weight[k] = sum[k][0] / samples;
+      if(sum[k][0] == 0.0) continue;
+      const float a = sum[k][1]/sum[k][0], b = sum[k][2]/sum[k][0];
+      shift = fmaxf(shift, (a-mean[k][0])*(a-mean[k][0]) + (b-mean[k][1])*(b-mean[k][1]));
+      mean[k][0] = a;
+      mean[k][1] = b;
+      stddev[k][0] = sqrtf(fmaxf(0.0f, sum[k][3]/sum[k][0] - a*a));
+      stddev[k][1] = sqrtf(fmaxf(0.0f, sum[k][4]/sum[k][0] - b*b));
+    }
+    if(shift < KMEANS_EPSILON) break;
+  }
+
+  free(acc);
+  free(sa);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -1,6 +1,6 @@
 /*
     This file is part of darktable,
-    copyright (c) 2009--2010 johannes hanika.
+    copyright (c) 2014 darktable developers.
 
     darktable is free software: you can redistribute it and/or modify
     it under the terms of the GNU General Public License as published by
@@ -15,12 +15,21 @@
     You should have received a copy of the GNU General Public License
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
-#ifndef DT_IMAGE_COMPRESSION
-#include <inttypes.h>
 
-/** K. Roimela, T. Aarnio and J. Itäranta. High Dynamic Range Texture Compression. Proceedings of SIGGRAPH 2006. */
-void dt_image_compress(const float *in, uint8_t *out, const int32_t width, const int32_t height);
-void dt_image_uncompress(const uint8_t *in, float *out, const int32_t width, const int32_t height);
+#ifndef DT_COMMON_KMEANS_H
+#define DT_COMMON_KMEANS_H
+
+// at most that many clusters:
+#define DT_KMEANS_MAXN 5
+
+/**
+ * clusters the a and b channels of a Lab buffer with ch floats per pixel into n clusters. the
+ * statistics are taken from a fixed random subsample of the buffer, and the iterations stop as soon
+ * as the means don't move any more, or after max_iterations. returns mean, standard deviation and
+ * the fraction of the samples of every cluster.
+ */
+void dt_kmeans_ab(const float *const col, const int width, const int height, const int ch, const int n,
+                  const int max_iterations, float mean[n][2], float stddev[n][2], float weight[n]);
 
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
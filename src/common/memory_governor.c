@@ -0,0 +1,171 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "common/memory_governor.h"
+#include "common/darktable.h"
+#include "common/mipmap_cache.h"
+#include "control/conf.h"
+#include "develop/pixelpipe_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// how often the available memory is checked, and how many checks the system has to stay
+// above the high watermark before we grow one level back:
+#define DT_MEMORY_GOVERNOR_INTERVAL_MS 1000
+#define DT_MEMORY_GOVERNOR_RELAX_TICKS 5
+#define DT_MEMORY_GOVERNOR_LEVELS 2
+
+typedef struct dt_memory_governor_t
+{
+  pthread_t thread;
+  int running;
+  int level;
+  // shrink below low, grow back above high:
+  size_t low, high;
+}
+dt_memory_governor_t;
+
+static dt_memory_governor_t _governor;
+
+size_t dt_memory_governor_available()
+{
+#if defined(__linux__)
+  FILE *f = fopen("/proc/meminfo", "rb");
+  if(!f) return 0;
+  size_t available = 0, free_mem = 0, cached = 0, buffers = 0;
+  int have_available = 0;
+  char line[256];
+  while(fgets(line, sizeof(line), f))
+  {
+    // all in kB:
+    if(!strncmp(line, "MemAvailable:", 13))
+    {
+      available = atol(line + 13);
+      have_available = 1;
+      break;
+    }
+    else if(!strncmp(line, "MemFree:", 8)) free_mem = atol(line + 8);
+    else if(!strncmp(line, "Buffers:", 8)) buffers = atol(line + 8);
+    else if(!strncmp(line, "Cached:", 7))  cached = atol(line + 7);
+  }
+  fclose(f);
+  // older kernels don't estimate it for us:
+  if(!have_available) available = free_mem + buffers + cached;
+  return available * 1024;
+#else
+  return 0;
+#endif
+}
+
+int dt_memory_governor_level()
+{
+  return _governor.level;
+}
+
+static void
+_governor_apply(const int level)
+{
+  const size_t budget = dt_dev_pixelpipe_cache_pool_get_budget();
+  switch(level)
+  {
+    case 0:
+      dt_dev_pixelpipe_cache_pool_set_budget(0);
+      dt_mipmap_cache_limit_dynamic(darktable.mipmap_cache, 0);
+      break;
+    case 1:
+      dt_dev_pixelpipe_cache_pool_set_budget(budget/2);
+      dt_mipmap_cache_limit_dynamic(darktable.mipmap_cache, 0);
+      break;
+    default:
+      dt_dev_pixelpipe_cache_pool_set_budget(budget/8);
+      dt_mipmap_cache_limit_dynamic(darktable.mipmap_cache, 2);
+      break;
+  }
+  _governor.level = level;
+  dt_print(DT_DEBUG_MEMORY, "[memory governor] level %d, %zu MB available, pixelpipe caches hold %zu MB\n",
+           level, dt_memory_governor_available() >> 20, dt_dev_pixelpipe_cache_pool_allocated() >> 20);
+}
+
+static void *
+_governor_thread(void *data)
+{
+  int relaxed = 0;
+  while(_governor.running)
+  {
+    // sleep in small steps, so cleanup doesn't have to wait for a whole interval:
+    for(int t=0; t<DT_MEMORY_GOVERNOR_INTERVAL_MS && _governor.running; t+=100)
+      g_usleep(100000);
+    if(!_governor.running) break;
+
+    const size_t available = dt_memory_governor_available();
+    if(available < _governor.low)
+    {
+      relaxed = 0;
+      if(_governor.level < DT_MEMORY_GOVERNOR_LEVELS)
+        _governor_apply(_governor.level + 1);
+    }
+    else if(available > _governor.high && _governor.level > 0)
+    {
+      // don't oscillate: only grow back after memory stayed free for a while.
+      if(++relaxed >= DT_MEMORY_GOVERNOR_RELAX_TICKS)
+      {
+        relaxed = 0;
+        _governor_apply(_governor.level - 1);
+      }
+    }
+    else relaxed = 0;
+  }
+  return NULL;
+}
+
+void dt_memory_governor_init()
+{
+  memset(&_governor, 0, sizeof(_governor));
+  if(!dt_conf_get_bool("memory_governor")) return;
+  const size_t available = dt_memory_governor_available();
+  if(available == 0)
+  {
+    dt_print(DT_DEBUG_MEMORY, "[memory governor] can't tell available memory on this system, disabled\n");
+    return;
+  }
+  // low watermark: 5% of physical memory, at least 256MB. everything in between is hysteresis.
+  const size_t total = dt_get_total_memory() * 1024;
+  _governor.low  = MAX(total/20, ((size_t)256)<<20);
+  _governor.high = 2*_governor.low;
+  _governor.running = 1;
+  if(pthread_create(&_governor.thread, NULL, _governor_thread, NULL))
+  {
+    _governor.running = 0;
+    return;
+  }
+  dt_print(DT_DEBUG_MEMORY, "[memory governor] shrinking caches below %zu MB available memory\n", _governor.low >> 20);
+}
+
+void dt_memory_governor_cleanup()
+{
+  if(!_governor.running) return;
+  _governor.running = 0;
+  pthread_join(_governor.thread, NULL);
+  if(_governor.level) _governor_apply(0);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,48 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_MEMORY_GOVERNOR_H
+#define DT_MEMORY_GOVERNOR_H
+
+#include <stddef.h>
+
+/**
+ * the memory governor watches the memory available to the system and shrinks
+ * darktable's caches step by step when it runs low, so we don't push the machine
+ * into swap during heavy exports. once memory is free again they grow back to
+ * the sizes configured by `cache_memory'. the order is:
+ *
+ *  1. pixelpipe cache pool: half the budget, unused buffers above that are freed
+ *  2. pixelpipe cache pool: an eighth of the budget, float and full mipmap buffers
+ *     limited to two each
+ *
+ * 8-bit thumbnails live in static memory and are not touched.
+ */
+
+/** starts the governor thread, if enabled by `memory_governor'. needs the caches to be initialized. */
+void dt_memory_governor_init();
+/** stops the thread and restores the cache sizes. */
+void dt_memory_governor_cleanup();
+/** current pressure level, 0 means the caches are at their configured size. */
+int dt_memory_governor_level();
+/** memory available to the system in bytes, 0 if unknown on this platform. */
+size_t dt_memory_governor_available();
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,131 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/memory_stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <lcms2.h>
+#include <lcms2_plugin.h>
+
+static const char *_names[DT_MEMORY_TAG_COUNT] =
+{
+  "image_cache",
+  "mipmap_cache",
+  "pixelpipe_cache",
+  "pixelpipe_arena",
+  "tiling",
+  "opencl",
+  "lcms",
+};
+
+static int64_t _current[DT_MEMORY_TAG_COUNT];
+static int64_t _peak[DT_MEMORY_TAG_COUNT];
+
+void dt_memory_stats_add(const dt_memory_tag_t tag, const int64_t bytes)
+{
+  const int64_t current = __sync_add_and_fetch(_current + tag, bytes);
+  int64_t peak = _peak[tag];
+  while(current > peak)
+  {
+    const int64_t old = __sync_val_compare_and_swap(_peak + tag, peak, current);
+    if(old == peak) break;
+    peak = old;
+  }
+}
+
+size_t dt_memory_stats_current(const dt_memory_tag_t tag)
+{
+  const int64_t current = _current[tag];
+  return current > 0 ? current : 0;
+}
+
+size_t dt_memory_stats_peak(const dt_memory_tag_t tag)
+{
+  return _peak[tag];
+}
+
+const char *dt_memory_stats_name(const dt_memory_tag_t tag)
+{
+  return _names[tag];
+}
+
+void dt_memory_stats_print()
+{
+  size_t sum = 0;
+  for(int k=0; k<DT_MEMORY_TAG_COUNT; k++)
+  {
+    fprintf(stderr, "[memory] %-16s %9.1f MB (peak %9.1f MB)\n", _names[k],
+            dt_memory_stats_current(k)/(1024.0*1024.0), dt_memory_stats_peak(k)/(1024.0*1024.0));
+    sum += dt_memory_stats_current(k);
+  }
+  fprintf(stderr, "[memory] %-16s %9.1f MB\n", "accounted", sum/(1024.0*1024.0));
+}
+
+// lcms allocates through this plugin, with the size stored in front of every block.
+// 16 bytes keep the alignment of malloc for sse.
+#define DT_LCMS_HEADER 16
+
+static void *
+_lcms_malloc(cmsContext context, cmsUInt32Number size)
+{
+  char *block = (char *)malloc(size + DT_LCMS_HEADER);
+  if(!block) return NULL;
+  *(size_t *)block = size;
+  dt_memory_stats_add(DT_MEMORY_LCMS, size);
+  return block + DT_LCMS_HEADER;
+}
+
+static void
+_lcms_free(cmsContext context, void *ptr)
+{
+  if(!ptr) return;
+  char *block = (char *)ptr - DT_LCMS_HEADER;
+  dt_memory_stats_add(DT_MEMORY_LCMS, -(int64_t)*(size_t *)block);
+  free(block);
+}
+
+static void *
+_lcms_realloc(cmsContext context, void *ptr, cmsUInt32Number size)
+{
+  if(!ptr) return _lcms_malloc(context, size);
+  char *block = (char *)ptr - DT_LCMS_HEADER;
+  const size_t old_size = *(size_t *)block;
+  block = (char *)realloc(block, size + DT_LCMS_HEADER);
+  if(!block) return NULL;
+  *(size_t *)block = size;
+  dt_memory_stats_add(DT_MEMORY_LCMS, (int64_t)size - (int64_t)old_size);
+  return block + DT_LCMS_HEADER;
+}
+
+// the other functions default to the ones built on top of these:
+static cmsPluginMemHandler _lcms_plugin =
+{
+  { cmsPluginMagicNumber, 2000, cmsPluginMemHandlerSig, NULL },
+  _lcms_malloc, _lcms_free, _lcms_realloc, NULL, NULL, NULL
+};
+
+void dt_memory_stats_init()
+{
+  if(!cmsPlugin(&_lcms_plugin))
+    fprintf(stderr, "[memory] could not account for the memory of lcms\n");
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,61 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_MEMORY_STATS_H
+#define DT_MEMORY_STATS_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+/**
+ * current and peak bytes held by the big consumers of memory, to size `cache_memory'
+ * and `parallel_export' from numbers. every subsystem reports its own allocations and
+ * frees, the counters are atomic. printed with -d memory, in dt_mipmap_cache_print()
+ * and available to lua as darktable.perf.memory.
+ */
+typedef enum dt_memory_tag_t
+{
+  DT_MEMORY_IMAGE_CACHE = 0,  // dt_image_t structs
+  DT_MEMORY_MIPMAP_CACHE,     // thumbnails, float and full buffers
+  DT_MEMORY_PIXELPIPE_CACHE,  // cache lines of all pipes
+  DT_MEMORY_PIXELPIPE_ARENA,  // temporaries of process()
+  DT_MEMORY_TILING,           // tile buffers
+  DT_MEMORY_OPENCL,           // device memory
+  DT_MEMORY_LCMS,             // color profiles and transforms
+  DT_MEMORY_TAG_COUNT
+}
+dt_memory_tag_t;
+
+/** hooks into the allocators of libraries, call before they are used. */
+void dt_memory_stats_init();
+
+/** adds bytes (or subtracts, if negative) to the tag. */
+void dt_memory_stats_add(const dt_memory_tag_t tag, const int64_t bytes);
+
+size_t dt_memory_stats_current(const dt_memory_tag_t tag);
+size_t dt_memory_stats_peak(const dt_memory_tag_t tag);
+/** short name of the tag, also the key in lua. */
+const char *dt_memory_stats_name(const dt_memory_tag_t tag);
+
+/** prints all tags to stderr. */
+void dt_memory_stats_print();
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
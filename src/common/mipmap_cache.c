@@ -17,18 +17,19 @@
 */
 
 #include "common/darktable.h"
+#include "common/dxt.h"
 #include "common/exif.h"
 #include "common/image_cache.h"
 #include "common/imageio.h"
 #include "common/imageio_module.h"
 #include "common/imageio_jpeg.h"
 #include "common/mipmap_cache.h"
+#include "common/mipmap_codec.h"
+#include "common/mipmap_store.h"
+#include "common/profiling.h"
 #include "control/conf.h"
 #include "control/jobs.h"
 #include "libraw/libraw.h"
-#ifdef HAVE_SQUISH
-#include "squish/csquish.h"
-#endif
 
 #include <assert.h>
 #include <string.h>
@@ -42,11 +43,11 @@
 #include <errno.h>
 #include <xmmintrin.h>
 
-#define DT_MIPMAP_CACHE_FILE_MAGIC 0xD71337
-#define DT_MIPMAP_CACHE_FILE_VERSION 22
 #define DT_MIPMAP_CACHE_DEFAULT_FILE_NAME "mipmaps"
 
 #define DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE (1<<0)
+// best effort requests waiting for the decode thread, older ones are dropped:
+#define DT_MIPMAP_DECODE_QUEUE_MAX 256
 
 struct dt_mipmap_buffer_dsc
 {
@@ -152,63 +153,6 @@ get_size(const uint32_t key)
   return (dt_mipmap_size_t)(key >> 29);
 }
 
-typedef struct _iterate_data_t
-{
-  FILE *f;
-  uint8_t *blob;
-  int compression_type;
-  dt_mipmap_size_t mip;
-}
-_iterate_data_t;
-
-static int
-_write_buffer(const uint32_t key, const void *data, void *user_data)
-{
-  if(!data) return 1;
-  struct dt_mipmap_buffer_dsc* dsc = (struct dt_mipmap_buffer_dsc*)data;
-  // too small to write. no error, but don't write.
-  if(dsc->width <= 8 && dsc->height <= 8) return 0;
-
-  _iterate_data_t *d = (_iterate_data_t *)user_data;
-  int written = fwrite(&(d->mip), sizeof(dt_mipmap_size_t), 1, d->f);
-  if(written != 1) return 1;
-  written = fwrite(&key, sizeof(uint32_t), 1, d->f);
-  if(written != 1) return 1;
-
-  if(d->compression_type)
-  {
-    // write buffer size, wd, ht and the full blob, as it is in memory.
-    const int32_t length = compressed_buffer_size(d->compression_type, dsc->width, dsc->height);
-    written = fwrite(&length, sizeof(int32_t), 1, d->f);
-    if(written != 1) return 1;
-    written = fwrite(&dsc->width, sizeof(int32_t), 1, d->f);
-    if(written != 1) return 1;
-    written = fwrite(&dsc->height, sizeof(int32_t), 1, d->f);
-    if(written != 1) return 1;
-    written = fwrite(dsc+1, sizeof(uint8_t), length, d->f);
-    if(written != length) return 1;
-  }
-  else
-  {
-    dt_mipmap_buffer_t buf;
-    buf.width  = dsc->width;
-    buf.height = dsc->height;
-    buf.imgid  = get_imgid(key);
-    buf.size   = get_size(key);
-    // skip to next 8-byte alignment, for sse buffers.
-    buf.buf    = (uint8_t *)(dsc+1);
-
-    const int cache_quality = dt_conf_get_int("database_cache_quality");
-    const int32_t length = dt_imageio_jpeg_compress(buf.buf, d->blob, buf.width, buf.height, MIN(100, MAX(10, cache_quality)));
-    written = fwrite(&length, sizeof(int32_t), 1, d->f);
-    if(written != 1) return 1;
-    written = fwrite(d->blob, sizeof(uint8_t), length, d->f);
-    if(written != length) return 1;
-  }
-
-  return 0;
-}
-
 static int
 dt_mipmap_cache_get_filename(
   gchar* mipmapfilename, size_t size)
@@ -254,225 +198,242 @@ exit:
   return r;
 }
 
-static int
-dt_mipmap_cache_serialize(dt_mipmap_cache_t *cache)
+static void
+dt_mipmap_cache_store_open(dt_mipmap_cache_t *cache)
 {
+  cache->use_store = 0;
   gchar dbfilename[DT_MAX_PATH_LEN];
   if (dt_mipmap_cache_get_filename(dbfilename, sizeof(dbfilename)))
   {
-    fprintf(stderr, "[mipmap_cache] could not retrieve cache filename; not serializing\n");
-    return 1;
-  }
-  if (!strcmp(dbfilename, ":memory:"))
-  {
-    // fprintf(stderr, "[mipmap_cache] library is in memory; not serializing\n");
-    return 0;
+    fprintf(stderr, "[mipmap_cache] could not retrieve cache filename; not using the thumbnail store\n");
+    return;
   }
+  // library is in memory, no persistent thumbnails either.
+  if (!strcmp(dbfilename, ":memory:")) return;
 
-  // only store smallest thumbs.
-  const dt_mipmap_size_t mip = DT_MIPMAP_2;
+  // drop the monolithic cache file of older versions:
+  if(g_file_test(dbfilename, G_FILE_TEST_IS_REGULAR)) g_unlink(dbfilename);
 
-  _iterate_data_t d;
-  d.f = NULL;
-  d.blob = (uint8_t *)malloc(cache->mip[mip].buffer_size);
-  int written = 0;
-  FILE *f = fopen(dbfilename, "wb");
-  if(!f) goto write_error;
-  d.f = f;
-  // fprintf(stderr, "[mipmap_cache] serializing to `%s'\n", dbfilename);
+  int err = 0;
+  for(int k=DT_MIPMAP_0; k<DT_MIPMAP_F; k++)
+  {
+    gchar prefix[DT_MAX_PATH_LEN];
+    snprintf(prefix, sizeof(prefix), "%s.%d", dbfilename, k);
+    err |= dt_mipmap_store_open(cache->store + k, prefix, cache->mip[k].max_width, cache->mip[k].max_height);
+  }
+  // the codec is stored with every thumbnail, changing it doesn't invalidate the old ones.
+  // compressed levels are always stored as they are, in dxt1.
+  cache->store_codec = dt_mipmap_codec_from_conf();
+  // the stores are harmless to use even if opening failed, they'll just always miss.
+  cache->use_store = 1;
+  if(err) fprintf(stderr, "[mipmap_cache] some levels of the thumbnail store in `%s' are not available\n", dbfilename);
+}
 
-  // write version info:
-  const int32_t magic = DT_MIPMAP_CACHE_FILE_MAGIC + DT_MIPMAP_CACHE_FILE_VERSION;
-  written = fwrite(&magic, sizeof(int32_t), 1, f);
-  if(written != 1) goto write_error;
+static void
+dt_mipmap_cache_store_close(dt_mipmap_cache_t *cache)
+{
+  if(!cache->use_store) return;
+  for(int k=DT_MIPMAP_0; k<DT_MIPMAP_F; k++)
+    dt_mipmap_store_close(cache->store + k);
+  cache->use_store = 0;
+}
 
-  // store compression type
-  written = fwrite(&cache->compression_type, sizeof(int32_t), 1, f);
-  if(written != 1) goto write_error;
+// appends a freshly generated thumbnail to the persistent store.
+static void
+_store_write(
+  dt_mipmap_cache_t *cache,
+  const dt_mipmap_size_t mip,
+  const uint32_t imgid,
+  struct dt_mipmap_buffer_dsc *dsc)
+{
+  // too small (or dead image) to write. no error, but don't write.
+  if(!cache->use_store || (dsc->width <= 8 && dsc->height <= 8)) return;
 
-  for(int i=0; i<=mip; i++)
+  if(cache->compression_type)
   {
-    // print max sizes for this cache
-    written = fwrite(&cache->mip[i].max_width, sizeof(int32_t), 1, f);
-    if(written != 1) goto write_error;
-    written = fwrite(&cache->mip[i].max_height, sizeof(int32_t), 1, f);
-    if(written != 1) goto write_error;
+    // store the dxt1 blocks as they are in memory.
+    const int32_t length = compressed_buffer_size(cache->compression_type, dsc->width, dsc->height);
+    dt_mipmap_store_append(cache->store + mip, imgid, (const uint8_t *)(dsc+1), length, dsc->width, dsc->height,
+                           DT_MIPMAP_CODEC_DXT1);
   }
-
-  for(int i=0; i<=mip; i++)
+  else
   {
-    d.mip = (dt_mipmap_size_t)i;
-    d.compression_type = cache->compression_type;
-    if(dt_cache_for_all(&cache->mip[i].cache, _write_buffer, &d)) goto write_error;
+    // uncompressed in memory, compressed with the configured codec on disk:
+    const uint32_t max_length = 4*dsc->width*dsc->height;
+    uint8_t *blob = (uint8_t *)malloc(max_length);
+    if(!blob) return;
+    const uint32_t length = dt_mipmap_codec_encode(cache->store_codec, (const uint8_t *)(dsc+1), dsc->width, dsc->height,
+                                                   dt_conf_get_int("database_cache_quality"), blob, max_length);
+    if(length > 0)
+      dt_mipmap_store_append(cache->store + mip, imgid, blob, length, dsc->width, dsc->height, cache->store_codec);
+    free(blob);
   }
-
-  free(d.blob);
-  fclose(f);
-  return 0;
-
-write_error:
-  fprintf(stderr, "[mipmap_cache] serialization to `%s' failed!\n", dbfilename);
-  if(f) fclose(f);
-  free(d.blob);
-  return 1;
 }
 
+// tries to fill the buffer from the persistent store. returns 0 on success.
 static int
-dt_mipmap_cache_deserialize(dt_mipmap_cache_t *cache)
+_store_read(
+  dt_mipmap_cache_t *cache,
+  const dt_mipmap_size_t mip,
+  const uint32_t imgid,
+  struct dt_mipmap_buffer_dsc *dsc)
 {
-  int32_t rd = 0;
-  const dt_mipmap_size_t mip = DT_MIPMAP_2;
-  uint8_t *blob = NULL;
-  int file_width[mip+1], file_height[mip+1];
+  if(!cache->use_store) return 1;
+  uint8_t *buf = (uint8_t *)(dsc+1);
+  uint32_t length = 0, wd = 0, ht = 0;
+  int32_t codec = DT_MIPMAP_CODEC_JPEG;
 
-  gchar dbfilename[DT_MAX_PATH_LEN];
-  if (dt_mipmap_cache_get_filename(dbfilename, sizeof(dbfilename)))
-  {
-    fprintf(stderr, "[mipmap_cache] could not retrieve cache filename; not deserializing\n");
-    return 1;
-  }
-  if (!strcmp(dbfilename, ":memory:"))
+  if(cache->compression_type)
   {
-    // fprintf(stderr, "[mipmap_cache] library is in memory; not deserializing\n");
-    return 0;
+    // dxt1 blobs are directly read from disk into the cache:
+    const uint32_t max_length = cache->mip[mip].buffer_size - sizeof(*dsc);
+    if(!dt_mipmap_store_read(cache->store + mip, imgid, buf, max_length, &length, &wd, &ht, &codec) &&
+        codec == DT_MIPMAP_CODEC_DXT1)
+    {
+      if(wd > cache->mip[mip].max_width || ht > cache->mip[mip].max_height ||
+          length != compressed_buffer_size(cache->compression_type, wd, ht)) return 1;
+      dsc->width = wd;
+      dsc->height = ht;
+      return 0;
+    }
+    // nothing there, or written before compression was switched on. then it's decoded below
+    // and compressed again, and only too large for our buffer if it's not a dxt1 blob:
   }
 
-  FILE *f = fopen(dbfilename, "rb");
-  if(!f)
+  // none of the codecs write blobs larger than the raw pixels:
+  const uint32_t max_length = 4*cache->mip[mip].max_width*cache->mip[mip].max_height;
+  uint8_t *blob = (uint8_t *)malloc(max_length);
+  uint8_t *rgba = cache->compression_type ? (uint8_t *)malloc(max_length) : buf;
+  int res = 1;
+  if(blob && rgba &&
+      !dt_mipmap_store_read(cache->store + mip, imgid, blob, max_length, &length, &wd, &ht, &codec) &&
+      wd <= cache->mip[mip].max_width && ht <= cache->mip[mip].max_height &&
+      !dt_mipmap_codec_decode(codec, blob, length, wd, ht, rgba))
   {
-    if (errno == ENOENT)
-    {
-      fprintf(stderr, "[mipmap_cache] cache is empty, file `%s' doesn't exist\n", dbfilename);
-    }
-    else
+    dsc->width = wd;
+    dsc->height = ht;
+    if(cache->compression_type)
     {
-      fprintf(stderr, "[mipmap_cache] failed to open the cache from `%s'\n", dbfilename);
+      dt_dxt1_compress(rgba, wd, ht, buf, cache->compression_type == 1 ? DT_DXT_RANGE_FIT : DT_DXT_REFINE);
+      // replace it by the dxt1 blocks, so the next time it's read directly:
+      _store_write(cache, mip, imgid, dsc);
     }
-    goto read_finalize;
+    res = 0;
   }
+  free(blob);
+  if(rgba != buf) free(rgba);
+  return res;
+}
 
-  // read version info:
-  const int32_t magic = DT_MIPMAP_CACHE_FILE_MAGIC + DT_MIPMAP_CACHE_FILE_VERSION;
-  int32_t magic_file = 0;
-  rd = fread(&magic_file, sizeof(int32_t), 1, f);
-  if(rd != 1) goto read_error;
-  if(magic_file != magic)
+// fills one thumbnail from the persistent store, for the decode thread. tmp has the size
+// of the largest level. the blob is read and decoded before the cache line is taken, so
+// neither the bucket nor anybody waiting for it is blocked for the duration.
+static void
+_decode_one(
+  dt_mipmap_cache_t *cache,
+  const uint32_t key,
+  struct dt_mipmap_buffer_dsc *tmp)
+{
+  const uint32_t imgid = get_imgid(key);
+  const dt_mipmap_size_t mip = get_size(key);
+  // might have been loaded in the meantime:
+  if(dt_cache_contains(&cache->mip[mip].cache, key)) return;
+  if(_store_read(cache, mip, imgid, tmp))
   {
-    if(magic_file > DT_MIPMAP_CACHE_FILE_MAGIC && magic_file < magic)
-      fprintf(stderr, "[mipmap_cache] cache version too old, dropping `%s' cache\n", dbfilename);
-    else
-      fprintf(stderr, "[mipmap_cache] invalid cache file, dropping `%s' cache\n", dbfilename);
-    goto read_finalize;
+    // no usable blob after all, generate it the usual way:
+    dt_mipmap_buffer_t buf;
+    dt_mipmap_cache_read_get(cache, &buf, imgid, mip, DT_MIPMAP_PREFETCH);
+    return;
   }
-
-  // also read compression type and yell out on missmatch.
-  int32_t compression = -1;
-  rd = fread(&compression, sizeof(int32_t), 1, f);
-  if(rd != 1) goto read_error;
-  if(compression != cache->compression_type)
+  struct dt_mipmap_buffer_dsc *dsc = (struct dt_mipmap_buffer_dsc *)dt_cache_read_get(&cache->mip[mip].cache, key);
+  if(!dsc) return;
+  if(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE)
   {
-    fprintf(stderr, "[mipmap_cache] cache is %s, but settings say we should use %s, dropping `%s' cache\n",
-            compression == 0 ? "uncompressed" : (compression == 1 ? "low quality compressed" : "high quality compressed"),
-            cache->compression_type == 0 ? "no compression" : (cache->compression_type == 1 ? "low quality compression" : "high quality compression"),
-            dbfilename);
-    goto read_finalize;
+    // nobody else was faster, we hold the write lock now:
+    __sync_fetch_and_add (&(cache->mip[mip].stats_fetches), 1);
+    dsc->width  = tmp->width;
+    dsc->height = tmp->height;
+    const size_t length = cache->compression_type ?
+      compressed_buffer_size(cache->compression_type, tmp->width, tmp->height) : 4*tmp->width*tmp->height;
+    memcpy(dsc+1, tmp+1, length);
+    dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
+    dt_cache_write_release(&cache->mip[mip].cache, key);
+    __sync_fetch_and_add(&cache->generation, 1);
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED);
   }
+  dt_cache_read_release(&cache->mip[mip].cache, key);
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_DECODED, imgid);
+}
 
-  for (int i=0; i<=mip; i++)
+static void *
+_decode_thread(void *ptr)
+{
+  dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)ptr;
+  struct dt_mipmap_buffer_dsc *tmp = dt_alloc_align(64, cache->mip[DT_MIPMAP_F-1].buffer_size);
+  while(tmp)
   {
-    rd = fread(&file_width[i], sizeof(int32_t), 1, f);
-    if(rd != 1) goto read_error;
-    rd = fread(&file_height[i], sizeof(int32_t), 1, f);
-    if(rd != 1) goto read_error;
-    if(file_width[i]  != cache->mip[i].max_width ||
-        file_height[i] != cache->mip[i].max_height)
+    dt_pthread_mutex_lock(&cache->decode_mutex);
+    while(g_queue_is_empty(cache->decode_queue) && !cache->decode_done)
+      dt_pthread_cond_wait(&cache->decode_cond, &cache->decode_mutex);
+    if(cache->decode_done)
     {
-      fprintf(stderr, "[mipmap_cache] cache settings changed, dropping `%s' cache\n", dbfilename);
-      goto read_finalize;
+      dt_pthread_mutex_unlock(&cache->decode_mutex);
+      break;
     }
-  }
+    const uint32_t key = GPOINTER_TO_UINT(g_queue_pop_head(cache->decode_queue));
+    dt_pthread_mutex_unlock(&cache->decode_mutex);
 
-  if(cache->compression_type) blob = NULL;
-  else blob = malloc(sizeof(uint32_t)*file_width[mip]*file_height[mip]);
+    _decode_one(cache, key, tmp);
 
-  while(!feof(f))
+    dt_pthread_mutex_lock(&cache->decode_mutex);
+    g_hash_table_remove(cache->decode_pending, GUINT_TO_POINTER(key));
+    dt_pthread_mutex_unlock(&cache->decode_mutex);
+  }
+  free(tmp);
+  return NULL;
+}
+
+// queues a thumbnail for the decode thread if the store has it. returns 0 if it has to be
+// generated instead.
+static int
+_decode_enqueue(
+  dt_mipmap_cache_t *cache,
+  const uint32_t imgid,
+  const dt_mipmap_size_t mip)
+{
+  if(!cache->decode_thread_running || mip >= DT_MIPMAP_F ||
+     !dt_mipmap_store_contains(cache->store + mip, imgid)) return 0;
+  const uint32_t key = get_key(imgid, mip);
+  dt_pthread_mutex_lock(&cache->decode_mutex);
+  if(!g_hash_table_contains(cache->decode_pending, GUINT_TO_POINTER(key)))
   {
-    int level = 0;
-    rd = fread(&level, sizeof(int), 1, f);
-    if (level > mip) break;
-
-    int32_t key = 0;
-    rd = fread(&key, sizeof(int32_t), 1, f);
-    if(rd != 1) break; // first value is break only, goes to eof.
-    int32_t length = 0;
-    rd = fread(&length, sizeof(int32_t), 1, f);
-    if(rd != 1) goto read_error;
-
-    uint8_t *data = (uint8_t *)dt_cache_read_get(&cache->mip[level].cache, key);
-    struct dt_mipmap_buffer_dsc* dsc = (struct dt_mipmap_buffer_dsc*)data;
-    if(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE)
+    g_hash_table_insert(cache->decode_pending, GUINT_TO_POINTER(key), GUINT_TO_POINTER(1));
+    // what was requested last is on screen now:
+    g_queue_push_head(cache->decode_queue, GUINT_TO_POINTER(key));
+    // while scrolling fast, drop what has long gone out of view. it will be asked for again:
+    if(g_queue_get_length(cache->decode_queue) > DT_MIPMAP_DECODE_QUEUE_MAX)
     {
-      if(cache->compression_type)
-      {
-        int32_t wd, ht;
-        rd = fread(&wd, sizeof(int32_t), 1, f);
-        if(rd != 1) goto read_error;
-        rd = fread(&ht, sizeof(int32_t), 1, f);
-        if(rd != 1) goto read_error;
-        dsc->width = wd;
-        dsc->height = ht;
-        if(length != compressed_buffer_size(cache->compression_type, wd, ht)) goto read_error;
-        // directly read from disk into cache:
-        rd = fread(data + sizeof(*dsc), 1, length, f);
-        if(rd != length) goto read_error;
-      }
-      else
-      {
-        // jpg too large?
-        if(length > sizeof(uint32_t)*file_width[mip]*file_height[mip]) goto read_error;
-        rd = fread(blob, sizeof(uint8_t), length, f);
-        if(rd != length) goto read_error;
-        // no compression, the image is still compressed on disk, as jpg
-        dt_imageio_jpeg_t jpg;
-        if(dt_imageio_jpeg_decompress_header(blob, length, &jpg) ||
-            (jpg.width > file_width[level] || jpg.height > file_height[level]) ||
-            dt_imageio_jpeg_decompress(&jpg, data+sizeof(*dsc)))
-        {
-          fprintf(stderr, "[mipmap_cache] failed to decompress thumbnail for image %d!\n", get_imgid(key));
-        }
-        dsc->width = jpg.width;
-        dsc->height = jpg.height;
-      }
-      dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
-      // these come write locked in case idata[3] == 1, so release that!
-      dt_cache_write_release(&cache->mip[level].cache, key);
+      const gpointer old = g_queue_pop_tail(cache->decode_queue);
+      g_hash_table_remove(cache->decode_pending, old);
     }
-    dt_cache_read_release(&cache->mip[level].cache, key);
+    pthread_cond_broadcast(&cache->decode_cond);
   }
-
-  fclose(f);
-  free(blob);
-  return 0;
-
-read_error:
-  fprintf(stderr, "[mipmap_cache] failed to recover the cache from `%s'\n", dbfilename);
-read_finalize:
-  if(f) fclose(f);
-  free(blob);
-  g_unlink(dbfilename);
+  dt_pthread_mutex_unlock(&cache->decode_mutex);
   return 1;
 }
 
 static void _init_f(float   *buf, uint32_t *width, uint32_t *height, const uint32_t imgid);
-static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, const uint32_t imgid, const dt_mipmap_size_t size);
+static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, const uint32_t imgid, const dt_mipmap_size_t size,
+                    const int allow_preliminary, int *preliminary);
 
-static int32_t
-scratchmem_allocate(void *data, const uint32_t key, int32_t *cost, void **buf)
+// called when a thread which used dt_mipmap_cache_get_scratchmem() ends:
+static void
+_scratchmem_free(void *buf)
 {
-  dt_mipmap_cache_one_t *c = (dt_mipmap_cache_one_t *)data;
-  // slot is exactly aligned with encapsulated cache's position and already allocated
-  *cost = c->buffer_size;
-  return 0;
+  dt_mipmap_cache_t *cache = darktable.mipmap_cache;
+  dt_memory_stats_add(DT_MEMORY_MIPMAP_CACHE, -(int64_t)cache->scratchmem_size);
+  __sync_fetch_and_sub(&cache->scratchmem_buffers, 1);
+  free(buf);
 }
 
 int32_t
@@ -523,8 +484,11 @@ dt_mipmap_cache_alloc(dt_image_t *img, dt_mipmap_size_t size, dt_mipmap_cache_al
   if(!(*dsc) || ((*dsc)->size < buffer_size) || ((void *)*dsc == (void *)dt_mipmap_cache_static_dead_image))
   {
     if((void *)*dsc != (void *)dt_mipmap_cache_static_dead_image)
+    {
+      if(*dsc) dt_memory_stats_add(DT_MEMORY_MIPMAP_CACHE, -(int64_t)(*dsc)->size);
       free(*dsc);
-    *dsc = dt_alloc_align(64, buffer_size);
+    }
+    *dsc = dt_alloc_align_huge(64, buffer_size);
     // fprintf(stderr, "[mipmap cache] alloc for key %u %lX\n", get_key(img->id, size), (uint64_t)*buf);
     if(!(*dsc))
     {
@@ -535,6 +499,7 @@ dt_mipmap_cache_alloc(dt_image_t *img, dt_mipmap_size_t size, dt_mipmap_cache_al
     }
     // set buffer size only if we're making it larger.
     (*dsc)->size = buffer_size;
+    dt_memory_stats_add(DT_MEMORY_MIPMAP_CACHE, buffer_size);
   }
   (*dsc)->width = wd;
   (*dsc)->height = ht;
@@ -559,7 +524,7 @@ dt_mipmap_cache_allocate_dynamic(void *data, const uint32_t key, int32_t *cost,
     if(cache->size == DT_MIPMAP_F)
     {
       // these are fixed-size:
-      *buf = dt_alloc_align(16, cache->buffer_size);
+      *buf = dt_alloc_align_huge(16, cache->buffer_size);
     }
     else
     {
@@ -584,6 +549,7 @@ dt_mipmap_cache_allocate_dynamic(void *data, const uint32_t key, int32_t *cost,
       dsc->height = 0;
       dsc->size = sizeof(*dsc)+sizeof(float)*4*64;
     }
+    dt_memory_stats_add(DT_MEMORY_MIPMAP_CACHE, dsc->size);
   }
   assert(dsc->size >= sizeof(*dsc));
   dsc->flags = DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
@@ -598,13 +564,11 @@ dt_mipmap_cache_allocate_dynamic(void *data, const uint32_t key, int32_t *cost,
 void
 dt_mipmap_cache_deallocate_dynamic(void *data, const uint32_t key, void *payload)
 {
-  dt_mipmap_cache_one_t *cache = (dt_mipmap_cache_one_t *)data;
-  if(cache->size == DT_MIPMAP_F)
-  {
-    free(payload);
-  }
-  // else:
-  // don't clean up anything, as we are re-allocating.
+  // full buffers only get a cleanup callback while the memory governor wants them freed,
+  // otherwise they are re-allocated in place. failed allocations point to the static dead image:
+  if(payload == (void *)dt_mipmap_cache_static_dead_image) return;
+  dt_memory_stats_add(DT_MEMORY_MIPMAP_CACHE, -(int64_t)((struct dt_mipmap_buffer_dsc *)payload)->size);
+  free(payload);
 }
 
 static uint32_t
@@ -622,6 +586,7 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   dead_image_f((dt_mipmap_buffer_t *)(dsc+1));
 
   cache->compression_type = 0;
+  cache->generation = 0;
   gchar *compression = dt_conf_get_string("cache_compression");
   if(compression)
   {
@@ -637,8 +602,10 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
 
   // adjust numbers to be large enough to hold what mem limit suggests.
   // we want at least 100MB, and consider 2G just still reasonable.
-  uint32_t max_mem = CLAMPS(dt_conf_get_int("cache_memory"), 100u<<20, 2u<<30);
+  // headless tools only ever look at a handful of thumbnails, the minimum per level will do.
+  uint32_t max_mem = darktable.headless ? 0 : CLAMPS(dt_conf_get_int("cache_memory"), 100u<<20, 2u<<30);
   const uint32_t parallel = CLAMP(dt_conf_get_int ("worker_threads")*dt_conf_get_int("parallel_export"), 1, 8);
+  const int clock_replacement = dt_conf_get_bool("cache_clock_replacement");
   const int32_t max_size = 2048, min_size = 32;
   int32_t wd = darktable.thumbnail_width;
   int32_t ht = darktable.thumbnail_height;
@@ -658,25 +625,11 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
     cache->mip[k].max_height = cache->mip[k+1].max_height / 2;
   }
 
-  // initialize some per-thread cached scratchmem for uncompressed buffers during thumb creation:
+  // per-thread scratchmem for uncompressed buffers during thumb creation, allocated when a thread needs it:
+  cache->scratchmem_size = (size_t)wd*ht*sizeof(uint32_t);
+  cache->scratchmem_buffers = 0;
   if(cache->compression_type)
-  {
-    cache->scratchmem.max_width = wd;
-    cache->scratchmem.max_height = ht;
-    cache->scratchmem.buffer_size = wd*ht*sizeof(uint32_t);
-    cache->scratchmem.size = DT_MIPMAP_3; // at max.
-    // TODO: use thread local storage instead (zero performance penalty on linux)
-    dt_cache_init(&cache->scratchmem.cache, parallel, parallel, 64, 0.9f*parallel*wd*ht*sizeof(uint32_t));
-    // might have been rounded to power of two:
-    const int cnt = dt_cache_capacity(&cache->scratchmem.cache);
-    cache->scratchmem.buf = dt_alloc_align(64, cnt * wd*ht*sizeof(uint32_t));
-    dt_cache_static_allocation(&cache->scratchmem.cache, (uint8_t *)cache->scratchmem.buf, wd*ht*sizeof(uint32_t));
-    dt_cache_set_allocate_callback(&cache->scratchmem.cache,
-                                   scratchmem_allocate, &cache->scratchmem);
-    dt_print(DT_DEBUG_CACHE,
-             "[mipmap_cache_init] cache has % 5d entries for temporary compression buffers (% 4.02f MB).\n",
-             cnt, cnt* wd*ht*sizeof(uint32_t)/(1024.0*1024.0));
-  }
+    pthread_key_create(&cache->scratchmem_key, _scratchmem_free);
 
   for(int k=DT_MIPMAP_3; k>=0; k--)
   {
@@ -709,12 +662,15 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
 
     // might have been rounded to power of two:
     thumbnails = dt_cache_capacity(&cache->mip[k].cache);
-    max_mem -= thumbnails * cache->mip[k].buffer_size;
+    max_mem -= MIN(max_mem, thumbnails * cache->mip[k].buffer_size);
     // dt_print(DT_DEBUG_CACHE, "[mipmap mem] %4.02f left\n", max_mem/(1024.0*1024.0));
     cache->mip[k].buf = dt_alloc_align(64, thumbnails * cache->mip[k].buffer_size);
+    dt_memory_stats_add(DT_MEMORY_MIPMAP_CACHE, (int64_t)thumbnails * cache->mip[k].buffer_size);
     dt_cache_static_allocation(&cache->mip[k].cache, (uint8_t *)cache->mip[k].buf, cache->mip[k].buffer_size);
     dt_cache_set_allocate_callback(&cache->mip[k].cache,
                                    dt_mipmap_cache_allocate, &cache->mip[k]);
+    if(clock_replacement)
+      dt_cache_set_replacement(&cache->mip[k].cache, DT_CACHE_REPLACEMENT_CLOCK);
     // dt_cache_set_cleanup_callback(&cache->mip[k].cache,
     // &dt_mipmap_cache_deallocate, &cache->mip[k]);
 
@@ -730,6 +686,7 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   // for this buffer, because it can be very busy during import, we want the minimum
   // number of entries in the hashtable to be 16, but leave the quota as is. the dynamic
   // alloc/free properties of this cache take care that no more memory is required.
+  cache->dynamic_quota = max_mem_bufs;
   dt_cache_init(&cache->mip[DT_MIPMAP_FULL].cache, max_mem_bufs, parallel, 64, max_mem_bufs);
   dt_cache_set_allocate_callback(&cache->mip[DT_MIPMAP_FULL].cache,
                                  dt_mipmap_cache_allocate_dynamic, &cache->mip[DT_MIPMAP_FULL]);
@@ -750,14 +707,38 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   cache->mip[DT_MIPMAP_F].size = DT_MIPMAP_F;
   cache->mip[DT_MIPMAP_F].buf = NULL;
 
-  dt_mipmap_cache_deserialize(cache);
+  dt_mipmap_cache_store_open(cache);
+
+  dt_pthread_mutex_init(&cache->decode_mutex, NULL);
+  pthread_cond_init(&cache->decode_cond, NULL);
+  cache->decode_queue = g_queue_new();
+  cache->decode_pending = g_hash_table_new(NULL, NULL);
+  cache->decode_done = 0;
+  // without a store there is nothing to decode:
+  cache->decode_thread_running = cache->use_store &&
+                                 !pthread_create(&cache->decode_thread, NULL, _decode_thread, cache);
 }
 
 void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache)
 {
-  dt_mipmap_cache_serialize(cache);
+  // what is still queued is dropped, the thread only finishes the thumbnail at hand:
+  if(cache->decode_thread_running)
+  {
+    dt_pthread_mutex_lock(&cache->decode_mutex);
+    cache->decode_done = 1;
+    pthread_cond_broadcast(&cache->decode_cond);
+    dt_pthread_mutex_unlock(&cache->decode_mutex);
+    pthread_join(cache->decode_thread, NULL);
+    cache->decode_thread_running = 0;
+  }
+  g_queue_free(cache->decode_queue);
+  g_hash_table_destroy(cache->decode_pending);
+  pthread_cond_destroy(&cache->decode_cond);
+  dt_pthread_mutex_destroy(&cache->decode_mutex);
+  dt_mipmap_cache_store_close(cache);
   for(int k=0; k<DT_MIPMAP_F; k++)
   {
+    dt_memory_stats_add(DT_MEMORY_MIPMAP_CACHE, -(int64_t)dt_cache_capacity(&cache->mip[k].cache) * cache->mip[k].buffer_size);
     dt_cache_cleanup(&cache->mip[k].cache);
     // now mem is actually freed, not during cache cleanup
     free(cache->mip[k].buf);
@@ -765,11 +746,12 @@ void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache)
   dt_cache_cleanup(&cache->mip[DT_MIPMAP_FULL].cache);
   dt_cache_cleanup(&cache->mip[DT_MIPMAP_F].cache);
 
-  // clean up temporary buffers for decompressed images, if any:
+  // clean up temporary buffers for decompressed images, if any. the other threads have ended already:
   if(cache->compression_type)
   {
-    dt_cache_cleanup(&cache->scratchmem.cache);
-    free(cache->scratchmem.buf);
+    uint8_t *scratchmem = (uint8_t *)pthread_getspecific(cache->scratchmem_key);
+    if(scratchmem) _scratchmem_free(scratchmem);
+    pthread_key_delete(cache->scratchmem_key);
   }
 }
 
@@ -794,11 +776,8 @@ void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
   }
   if(cache->compression_type)
   {
-    printf("[mipmap_cache] scratch fill %.2f/%.2f MB (%.2f%% in %u/%u buffers)\n", cache->scratchmem.cache.cost/(1024.0*1024.0),
-           cache->scratchmem.cache.cost_quota/(1024.0*1024.0),
-           100.0f*(float)cache->scratchmem.cache.cost/(float)cache->scratchmem.cache.cost_quota,
-           dt_cache_size(&cache->scratchmem.cache),
-           dt_cache_capacity(&cache->scratchmem.cache));
+    printf("[mipmap_cache] scratch %.2f MB in %d per-thread buffers\n",
+           cache->scratchmem_buffers*cache->scratchmem_size/(1024.0*1024.0), cache->scratchmem_buffers);
   }
   uint64_t sum = 0;
   uint64_t sum_fetches = 0;
@@ -817,6 +796,11 @@ void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
         100.0*cache->mip[k].stats_standin/(float)sum_standins,
         100.0*cache->mip[k].stats_fetches/(float)sum_fetches,
         100.0*cache->mip[k].stats_requests/(float)sum);
+  printf("\n");
+  // where the rest of the memory went:
+  for(int k=0; k<DT_MEMORY_TAG_COUNT; k++)
+    printf("[memory] %-16s %9.1f MB (peak %9.1f MB)\n", dt_memory_stats_name(k),
+           dt_memory_stats_current(k)/(1024.0*1024.0), dt_memory_stats_peak(k)/(1024.0*1024.0));
   printf("\n\n");
   // very verbose stats about locks/users
   //dt_cache_print(&cache->mip[DT_MIPMAP_3].cache);
@@ -861,7 +845,11 @@ dt_mipmap_cache_read_get(
     dt_image_load_job_init(&j, imgid, mip);
     // if the job already exists, make it high-priority, if not, add it:
     if(dt_control_revive_job(darktable.control, &j) < 0)
+    {
+      // someone is waiting for this one to show up on screen:
+      dt_control_job_set_queue(&j, DT_JOB_QUEUE_INTERACTIVE);
       dt_control_add_job(darktable.control, &j);
+    }
   }
   else if(flags == DT_MIPMAP_BLOCKING)
   {
@@ -935,36 +923,53 @@ dt_mipmap_cache_read_get(
         }
         else if(mip == DT_MIPMAP_F)
         {
+          TIMER_START(prof, "float");
           _init_f((float *)(dsc+1), &dsc->width, &dsc->height, imgid);
+          TIMER_STOP(prof);
+        }
+        else if(!_store_read(cache, mip, imgid, dsc))
+        {
+          // 8-bit thumb was found in the persistent store.
         }
         else
         {
-          // 8-bit thumbs, possibly need to be compressed:
+          // set if we only got the embedded jpg as a stand-in for the processed thumbnail:
+          int preliminary = 0;
+          TIMER_START(prof, "8 bit");
+          // 8-bit thumbs, possibly need to be compressed. per-thread temporary storage, without malloc or locks:
+          uint8_t *out = cache->compression_type ? dt_mipmap_cache_get_scratchmem(cache) : (uint8_t *)(dsc+1);
+          const uint32_t max_width = dsc->width, max_height = dsc->height;
+          _init_8(out, &dsc->width, &dsc->height, imgid, mip, 1, &preliminary);
+          if(preliminary)
+          {
+            // swap in the processed version later on, at low priority (i.e. at the end of the queue):
+            dt_job_t j;
+            dt_image_thumbnail_refine_job_init(&j, imgid, mip);
+            if(dt_control_add_job(darktable.control, &j))
+            {
+              // nothing would ever replace the stand-in, so process it right away:
+              dsc->width = max_width;
+              dsc->height = max_height;
+              _init_8(out, &dsc->width, &dsc->height, imgid, mip, 0, &preliminary);
+            }
+          }
           if(cache->compression_type)
           {
-            // get per-thread temporary storage without malloc from a separate cache:
-            const int key = dt_control_get_threadid();
-            // const void *cbuf =
-            dt_cache_read_get(&cache->scratchmem.cache, key);
-            uint8_t *scratchmem = (uint8_t *)dt_cache_write_get(&cache->scratchmem.cache, key);
-            _init_8(scratchmem, &dsc->width, &dsc->height, imgid, mip);
             buf->width  = dsc->width;
             buf->height = dsc->height;
             buf->imgid  = imgid;
             buf->size   = mip;
             buf->buf = (uint8_t *)(dsc+1);
-            dt_mipmap_cache_compress(buf, scratchmem);
-            dt_cache_write_release(&cache->scratchmem.cache, key);
-            dt_cache_read_release(&cache->scratchmem.cache, key);
-          }
-          else
-          {
-            _init_8((uint8_t *)(dsc+1), &dsc->width, &dsc->height, imgid, mip);
+            dt_mipmap_cache_compress(buf, out);
           }
+          TIMER_STOP(prof);
+          // remember for next time:
+          if(!preliminary) _store_write(cache, mip, imgid, dsc);
         }
         dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
         // drop the write lock
         dt_cache_write_release(&cache->mip[mip].cache, key);
+        __sync_fetch_and_add(&cache->generation, 1);
         /* raise signal that mipmaps has been flushed to cache */
         dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED);
       }
@@ -998,10 +1003,12 @@ dt_mipmap_cache_read_get(
         return;
       }
       // didn't succeed the first time? prefetch for later!
+      // if it's in the store, only decoding is left to do, which doesn't wait behind the jobs:
       if(mip == k)
       {
         __sync_fetch_and_add (&(cache->mip[mip].stats_near_match), 1);
-        dt_mipmap_cache_read_get(cache, buf, imgid, mip, DT_MIPMAP_PREFETCH);
+        if(!_decode_enqueue(cache, imgid, mip))
+          dt_mipmap_cache_read_get(cache, buf, imgid, mip, DT_MIPMAP_PREFETCH);
       }
     }
     __sync_fetch_and_add (&(cache->mip[mip].stats_misses), 1);
@@ -1014,6 +1021,204 @@ dt_mipmap_cache_read_get(
   }
 }
 
+void
+dt_mipmap_cache_prefetch(
+  dt_mipmap_cache_t *cache,
+  const uint32_t imgid,
+  const dt_mipmap_size_t mip)
+{
+  if(mip > DT_MIPMAP_FULL || mip < DT_MIPMAP_0) return;
+  // nothing to do if it's there already:
+  if(dt_cache_contains(&cache->mip[mip].cache, get_key(imgid, mip))) return;
+  dt_job_t j;
+  dt_image_load_job_init(&j, imgid, mip);
+  // queue behind everything that is already waiting, don't revive:
+  dt_control_add_job(darktable.control, &j);
+}
+
+void
+dt_mipmap_cache_cancel_prefetch(
+  dt_mipmap_cache_t *cache,
+  const uint32_t imgid,
+  const dt_mipmap_size_t mip)
+{
+  if(mip > DT_MIPMAP_FULL || mip < DT_MIPMAP_0) return;
+  dt_job_t j;
+  dt_image_load_job_init(&j, imgid, mip);
+  dt_control_remove_job(darktable.control, &j);
+}
+
+void
+dt_mipmap_cache_limit_dynamic(
+  dt_mipmap_cache_t *cache,
+  const int32_t limit)
+{
+  dt_cache_t *full = &cache->mip[DT_MIPMAP_FULL].cache, *f = &cache->mip[DT_MIPMAP_F].cache;
+  if(limit > 0)
+  {
+    full->cost_quota = f->cost_quota = MIN(limit, cache->dynamic_quota);
+    // full buffers are usually kept for re-allocation when they are evicted, free them
+    // instead while we are short on memory:
+    dt_cache_set_cleanup_callback(full, dt_mipmap_cache_deallocate_dynamic, &cache->mip[DT_MIPMAP_FULL]);
+    dt_cache_gc(full, 1.0f);
+    dt_cache_gc(f, 1.0f);
+  }
+  else
+  {
+    dt_cache_set_cleanup_callback(full, NULL, NULL);
+    full->cost_quota = f->cost_quota = cache->dynamic_quota;
+  }
+}
+
+// copy a finished 8-bit thumbnail into its cache slot. overwrite replaces what is
+// there already, otherwise only a slot which still waits to be generated is filled.
+static void
+_fill_slot(
+  dt_mipmap_cache_t *cache,
+  const uint32_t imgid,
+  const dt_mipmap_size_t mip,
+  uint8_t *tmp,
+  const uint32_t wd,
+  const uint32_t ht,
+  const int overwrite,
+  const int store)
+{
+  const uint32_t key = get_key(imgid, mip);
+  struct dt_mipmap_buffer_dsc* dsc = (struct dt_mipmap_buffer_dsc*)dt_cache_read_get(&cache->mip[mip].cache, key);
+  if(!dsc) return;
+  // freshly allocated slots come write locked already:
+  if(!(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE))
+  {
+    if(!overwrite)
+    {
+      // someone else was faster.
+      dt_cache_read_release(&cache->mip[mip].cache, key);
+      return;
+    }
+    dsc = (struct dt_mipmap_buffer_dsc*)dt_cache_write_get(&cache->mip[mip].cache, key);
+  }
+  dsc->width = wd;
+  dsc->height = ht;
+  if(cache->compression_type)
+  {
+    dt_mipmap_buffer_t buf;
+    buf.width  = wd;
+    buf.height = ht;
+    buf.imgid  = imgid;
+    buf.size   = mip;
+    buf.buf    = (uint8_t *)(dsc+1);
+    dt_mipmap_cache_compress(&buf, tmp);
+  }
+  else
+  {
+    memcpy(dsc+1, tmp, wd*ht*sizeof(uint32_t));
+  }
+  dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
+  if(store) _store_write(cache, mip, imgid, dsc);
+  dt_cache_write_release(&cache->mip[mip].cache, key);
+  dt_cache_read_release(&cache->mip[mip].cache, key);
+  __sync_fetch_and_add(&cache->generation, 1);
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED);
+}
+
+void
+dt_mipmap_cache_refine(
+  dt_mipmap_cache_t *cache,
+  const uint32_t imgid,
+  const dt_mipmap_size_t mip)
+{
+  if(mip < DT_MIPMAP_0 || mip >= DT_MIPMAP_F) return;
+  // process into temporary memory first, so we don't hold the lock for the
+  // duration of the pixelpipe run and the stand-in can be drawn meanwhile:
+  uint32_t wd = cache->mip[mip].max_width, ht = cache->mip[mip].max_height;
+  uint8_t *tmp = (uint8_t *)dt_alloc_align(64, wd*ht*sizeof(uint32_t));
+  if(!tmp) return;
+  int preliminary = 0;
+  _init_8(tmp, &wd, &ht, imgid, mip, 0, &preliminary);
+  if(wd == 0 || ht == 0)
+  {
+    // failed, keep the stand-in.
+    free(tmp);
+    return;
+  }
+
+  _fill_slot(cache, imgid, mip, tmp, wd, ht, 1, 1);
+  free(tmp);
+}
+
+void
+dt_mipmap_cache_fill_preliminary(
+  dt_mipmap_cache_t *cache,
+  const uint32_t imgid,
+  const dt_mipmap_size_t mip)
+{
+  if(mip < DT_MIPMAP_0 || mip >= DT_MIPMAP_F) return;
+  // nothing to do if it's there already:
+  if(dt_cache_contains(&cache->mip[mip].cache, get_key(imgid, mip))) return;
+  uint32_t wd = cache->mip[mip].max_width, ht = cache->mip[mip].max_height;
+  uint8_t *tmp = (uint8_t *)dt_alloc_align(64, wd*ht*sizeof(uint32_t));
+  if(!tmp) return;
+  int preliminary = 0;
+  // 2: take the embedded jpg even if the user prefers processed thumbnails.
+  _init_8(tmp, &wd, &ht, imgid, mip, 2, &preliminary);
+  if(wd == 0 || ht == 0)
+  {
+    free(tmp);
+    return;
+  }
+  if(preliminary)
+  {
+    dt_job_t j;
+    dt_image_thumbnail_refine_job_init(&j, imgid, mip);
+    // a stand-in nothing would ever replace is worse than none, that one gets processed on demand:
+    if(dt_control_add_job(darktable.control, &j))
+    {
+      free(tmp);
+      return;
+    }
+  }
+  // only the processed version goes to the persistent store:
+  _fill_slot(cache, imgid, mip, tmp, wd, ht, 0, !preliminary);
+  free(tmp);
+}
+
+void
+dt_mipmap_cache_fill_from_buffer(
+  dt_mipmap_cache_t *cache,
+  const uint32_t imgid,
+  const uint8_t *in,
+  const uint32_t wd,
+  const uint32_t ht)
+{
+  if(wd == 0 || ht == 0) return;
+  uint8_t *tmp = NULL;
+  // largest level first, so the scratch buffer fits all the others:
+  for(int k=DT_MIPMAP_F-1; k>=DT_MIPMAP_0; k--)
+  {
+    const float scale = fminf(cache->mip[k].max_width/(float)wd, cache->mip[k].max_height/(float)ht);
+    // allow for rounding of the pipe's output size:
+    if(scale > 1.01f)
+    {
+      dt_cache_remove(&cache->mip[k].cache, get_key(imgid, k));
+      if(cache->use_store) dt_mipmap_store_remove(cache->store + k, imgid);
+      continue;
+    }
+    const uint32_t w = MIN(cache->mip[k].max_width,  MAX(1, scale*wd + .5f));
+    const uint32_t h = MIN(cache->mip[k].max_height, MAX(1, scale*ht + .5f));
+    if(!tmp) tmp = (uint8_t *)dt_alloc_align(64, (size_t)w*h*sizeof(uint32_t));
+    if(!tmp)
+    {
+      // don't leave the old thumbnails behind:
+      dt_mipmap_cache_remove(cache, imgid);
+      return;
+    }
+    dt_imageio_downscale(tmp, in, wd, ht, w, h, 8);
+    _fill_slot(cache, imgid, k, tmp, w, h, 1, 1);
+  }
+  free(tmp);
+  __sync_fetch_and_add(&cache->generation, 1);
+}
+
 void
 dt_mipmap_cache_write_get(
   dt_mipmap_cache_t *cache,
@@ -1057,6 +1262,7 @@ dt_mipmap_cache_write_release(
   assert(buf->size >= DT_MIPMAP_0);
   assert(buf->size <  DT_MIPMAP_NONE);
   dt_cache_write_release(&cache->mip[buf->size].cache, get_key(buf->imgid, buf->size));
+  if(buf->size < DT_MIPMAP_F) __sync_fetch_and_add(&cache->generation, 1);
   buf->size = DT_MIPMAP_NONE;
   buf->buf  = NULL;
 }
@@ -1098,7 +1304,37 @@ dt_mipmap_cache_remove(
   {
     const uint32_t key = get_key(imgid, k);
     dt_cache_remove(&cache->mip[k].cache, key);
+    if(cache->use_store) dt_mipmap_store_remove(cache->store + k, imgid);
   }
+  __sync_fetch_and_add(&cache->generation, 1);
+}
+
+void
+dt_mipmap_cache_remove_list(
+  dt_mipmap_cache_t *cache,
+  GList *imgs,
+  const int regenerate)
+{
+  const int num = g_list_length(imgs);
+  if(num == 0) return;
+  uint32_t *ids = (uint32_t *)g_malloc(sizeof(uint32_t)*num);
+  int i = 0;
+  for(GList *l = imgs; l; l = g_list_next(l)) ids[i++] = GPOINTER_TO_INT(l->data);
+
+  for(int k=DT_MIPMAP_0; k<DT_MIPMAP_F; k++)
+  {
+    // drop the store entries first, so the prefetch below can't read them back:
+    if(cache->use_store) dt_mipmap_store_remove_list(cache->store + k, ids, num);
+    for(i=0; i<num; i++)
+    {
+      const uint32_t key = get_key(ids[i], k);
+      const int cached = regenerate && dt_cache_contains(&cache->mip[k].cache, key);
+      dt_cache_remove(&cache->mip[k].cache, key);
+      // only regenerate what was in use, identical jobs are queued once:
+      if(cached) dt_mipmap_cache_prefetch(cache, ids[i], k);
+    }
+  }
+  g_free(ids);
 }
 
 static void
@@ -1215,7 +1451,9 @@ _init_8(
   uint32_t               *width,
   uint32_t               *height,
   const uint32_t          imgid,
-  const dt_mipmap_size_t  size)
+  const dt_mipmap_size_t  size,
+  const int               allow_preliminary,
+  int                    *preliminary)
 {
   const uint32_t wd = *width, ht = *height;
   char filename[DT_MAX_PATH_LEN] = {0};
@@ -1239,12 +1477,23 @@ _init_8(
   dt_image_cache_read_release(darktable.image_cache, cimg);
 
 
+  *preliminary = 0;
+  const int use_embedded = !altered && !dt_conf_get_bool("never_use_embedded_thumb");
+
   // first try exif thumbnail, that's smaller and thus faster to load:
-  if(!altered && !dt_conf_get_bool("never_use_embedded_thumb") &&
+  if(use_embedded &&
       !dt_exif_thumbnail(filename, buf, wd, ht, orientation, width, height))
   {
     res = 0;
   }
+  else if(!use_embedded && allow_preliminary &&
+          (allow_preliminary > 1 || dt_conf_get_bool("plugins/lighttable/embedded_thumbnail_first")) &&
+          !dt_exif_thumbnail(filename, buf, wd, ht, orientation, width, height))
+  {
+    // we want a processed thumbnail, but show the embedded jpg until that's done:
+    *preliminary = 1;
+    res = 0;
+  }
   else if(!altered && !dt_conf_get_bool("never_use_embedded_thumb") && !incompatible)
   {
     // try to load the embedded thumbnail in raw
@@ -1370,6 +1619,22 @@ dt_mipmap_cache_alloc_scratchmem(
     return NULL;
 }
 
+uint8_t*
+dt_mipmap_cache_get_scratchmem(
+  dt_mipmap_cache_t *cache)
+{
+  if(!cache->compression_type) return NULL;
+  uint8_t *scratchmem = (uint8_t *)pthread_getspecific(cache->scratchmem_key);
+  if(scratchmem) return scratchmem;
+
+  scratchmem = dt_alloc_align(64, cache->scratchmem_size);
+  if(!scratchmem) return NULL;
+  pthread_setspecific(cache->scratchmem_key, scratchmem);
+  dt_memory_stats_add(DT_MEMORY_MIPMAP_CACHE, cache->scratchmem_size);
+  __sync_fetch_and_add(&cache->scratchmem_buffers, 1);
+  return scratchmem;
+}
+
 // decompress the raw mipmapm buffer into the scratchmemory.
 // returns a pointer to the decompressed memory block. that's because
 // for uncompressed settings, it will point directly to the mipmap
@@ -1379,14 +1644,12 @@ dt_mipmap_cache_decompress(
   const dt_mipmap_buffer_t *buf,
   uint8_t *scratchmem)
 {
-#ifdef HAVE_SQUISH
   if(darktable.mipmap_cache->compression_type && buf->width > 8 && buf->height > 8)
   {
-    squish_decompress_image(scratchmem, buf->width, buf->height, buf->buf, squish_dxt1);
+    dt_dxt1_decompress(scratchmem, buf->width, buf->height, buf->buf);
     return scratchmem;
   }
   else
-#endif
   {
     return buf->buf;
   }
@@ -1400,16 +1663,13 @@ dt_mipmap_cache_compress(
   dt_mipmap_buffer_t *buf,
   uint8_t *const scratchmem)
 {
-#ifdef HAVE_SQUISH
   // only do something if compression is on, don't compress skulls:
   if(darktable.mipmap_cache->compression_type && buf->width > 8 && buf->height > 8)
   {
-    int flags = squish_dxt1;
-    // low quality:
-    if(darktable.mipmap_cache->compression_type == 1) flags |= squish_colour_range_fit;
-    squish_compress_image(scratchmem, buf->width, buf->height, buf->buf, squish_dxt1);
+    // low quality is the plain range fit, high quality refits the endpoints:
+    dt_dxt1_compress(scratchmem, buf->width, buf->height, buf->buf,
+                     darktable.mipmap_cache->compression_type == 1 ? DT_DXT_RANGE_FIT : DT_DXT_REFINE);
   }
-#endif
 }
 
 
@@ -20,6 +20,7 @@
 
 #include "common/cache.h"
 #include "common/image.h"
+#include "common/mipmap_store.h"
 
 
 // sizes stored in the mipmap cache.
@@ -107,8 +108,33 @@ typedef struct dt_mipmap_cache_t
   dt_mipmap_cache_one_t mip[DT_MIPMAP_NONE];
   // global setting: which compression type are we using?
   int compression_type; // 0 - none, 1 - low quality, 2 - slow
-  // per-thread cache of uncompressed buffers, in case compression is requested.
-  dt_mipmap_cache_one_t scratchmem;
+  // per-thread buffers for uncompressed thumbnails, in case compression is requested.
+  // see dt_mipmap_cache_get_scratchmem(), the buffers belong to the threads and are never shared.
+  pthread_key_t scratchmem_key;
+  size_t scratchmem_size;
+  int32_t scratchmem_buffers;
+  // persistent per-level thumbnail store on disk, thumbnails are appended
+  // when they are created and read back lazily on cache misses.
+  int use_store;
+  dt_mipmap_store_t store[DT_MIPMAP_F];
+  // dt_mipmap_codec_t for the store of uncompressed levels, from the config.
+  int32_t store_codec;
+  // thumbnails found in the store are decoded by a thread of their own, outside of the
+  // cache locks and the job queue. keys wait in the queue, most recent request first,
+  // and stay in the pending table until they are done, to merge repeated requests.
+  dt_pthread_mutex_t decode_mutex;
+  pthread_cond_t decode_cond;
+  GQueue *decode_queue;
+  GHashTable *decode_pending;
+  int decode_thread_running;
+  int decode_done;
+  pthread_t decode_thread;
+  // bumped whenever the pixels of any thumbnail change, so copies derived
+  // from them (such as the lighttable surfaces) can tell they went stale.
+  uint32_t generation;
+  // number of full and float buffers set up at init, the memory governor
+  // lowers the quota of these two levels temporarily.
+  int32_t dynamic_quota;
 }
 dt_mipmap_cache_t;
 
@@ -130,6 +156,9 @@ void dt_mipmap_cache_print  (dt_mipmap_cache_t *cache);
 // get a buffer for reading.
 // see dt_mipmap_get_flags_t for explanation on the exact
 // behaviour. pass 0 as flags for the default (best effort)
+// a best effort miss never decodes: thumbnails from the persistent store are queued for
+// the decode thread, which raises DT_SIGNAL_DEVELOP_MIPMAP_DECODED with the image id
+// when they are in, all others are generated by a load job.
 void
 dt_mipmap_cache_read_get(
   dt_mipmap_cache_t *cache,
@@ -138,6 +167,55 @@ dt_mipmap_cache_read_get(
   const dt_mipmap_size_t mip,
   const dt_mipmap_get_flags_t flags);
 
+// queue a low priority load job for the given buffer, behind all jobs already
+// waiting. unlike DT_MIPMAP_PREFETCH this never moves an existing job to the top.
+void
+dt_mipmap_cache_prefetch(
+  dt_mipmap_cache_t *cache,
+  const uint32_t imgid,
+  const dt_mipmap_size_t mip);
+
+// drop a prefetch job again, if it is still waiting in the queue.
+void
+dt_mipmap_cache_cancel_prefetch(
+  dt_mipmap_cache_t *cache,
+  const uint32_t imgid,
+  const dt_mipmap_size_t mip);
+
+// replace a thumbnail which was filled from the embedded jpg by the processed
+// version. blocks for the duration of the pixelpipe run.
+void
+dt_mipmap_cache_refine(
+  dt_mipmap_cache_t *cache,
+  const uint32_t imgid,
+  const dt_mipmap_size_t mip);
+
+// fill a thumbnail from the embedded jpg right away and queue the processed
+// version at low priority. does nothing if the thumbnail exists already.
+void
+dt_mipmap_cache_fill_preliminary(
+  dt_mipmap_cache_t *cache,
+  const uint32_t imgid,
+  const dt_mipmap_size_t mip);
+
+// replace the thumbnails of imgid by downscaled copies of a processed image of
+// the whole frame, in the byte order the pixelpipe hands out. levels the buffer
+// would have to be upscaled for are dropped and regenerated as usual.
+void
+dt_mipmap_cache_fill_from_buffer(
+  dt_mipmap_cache_t *cache,
+  const uint32_t imgid,
+  const uint8_t *in,
+  const uint32_t wd,
+  const uint32_t ht);
+
+// under memory pressure: keep at most `limit' full and float buffers around and free
+// the memory of all others which are not locked. 0 restores the sizes from init.
+void
+dt_mipmap_cache_limit_dynamic(
+  dt_mipmap_cache_t *cache,
+  const int32_t limit);
+
 // lock it for writing. this is always blocking.
 // requires you already hold a read lock.
 void
@@ -163,6 +241,15 @@ dt_mipmap_cache_remove(
   dt_mipmap_cache_t *cache,
   const uint32_t imgid);
 
+// same for a list of GINT_TO_POINTER image ids, in one pass over the levels.
+// if regenerate is set, thumbnails which were cached are queued to be
+// regenerated in the background.
+void
+dt_mipmap_cache_remove_list(
+  dt_mipmap_cache_t *cache,
+  GList *imgs,
+  const int regenerate);
+
 // return the closest mipmap size
 // for the given window you wish to draw.
 // a dt_mipmap_size_t has always a fixed resolution associated with it,
@@ -182,6 +269,14 @@ uint8_t*
 dt_mipmap_cache_alloc_scratchmem(
   const dt_mipmap_cache_t *cache);
 
+// the buffer of the calling thread for an uncompressed thumbnail image, of any compressed level.
+// allocated on first use and kept until the thread ends: don't free it, and be done with it before
+// the next call. lock-free, so threads decompressing in parallel don't wait for each other.
+// returns NULL if the cache is set to not use compression.
+uint8_t*
+dt_mipmap_cache_get_scratchmem(
+  dt_mipmap_cache_t *cache);
+
 // decompress the raw mipmapm buffer into the scratchmemory.
 // returns a pointer to the decompressed memory block. that's because
 // for uncompressed settings, it will point directly to the mipmap
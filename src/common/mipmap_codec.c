@@ -0,0 +1,169 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/darktable.h"
+#include "common/mipmap_codec.h"
+#include "common/dxt.h"
+#include "common/imageio_jpeg.h"
+#include "control/conf.h"
+
+#include <string.h>
+#include <stdlib.h>
+#ifdef HAVE_WEBP
+#include <webp/decode.h>
+#include <webp/encode.h>
+#endif
+
+typedef struct dt_mipmap_codec_ops_t
+{
+  const char *name; // as in the config
+  uint32_t (*encode)(const uint8_t *in, const int width, const int height, const int quality,
+                     uint8_t *out, const uint32_t max_length);
+  int (*decode)(const uint8_t *blob, const uint32_t length, const int width, const int height, uint8_t *out);
+}
+dt_mipmap_codec_ops_t;
+
+static uint32_t
+_jpeg_encode(const uint8_t *in, const int width, const int height, const int quality,
+             uint8_t *out, const uint32_t max_length)
+{
+  // libjpeg doesn't know when to stop writing, but it never needs more than the raw pixels:
+  if(max_length < 4*width*height) return 0;
+  const int length = dt_imageio_jpeg_compress(in, out, width, height, quality);
+  return length > 0 ? length : 0;
+}
+
+static int
+_jpeg_decode(const uint8_t *blob, const uint32_t length, const int width, const int height, uint8_t *out)
+{
+  dt_imageio_jpeg_t jpg;
+  if(dt_imageio_jpeg_decompress_header(blob, length, &jpg)) return 1;
+  if(jpg.width != width || jpg.height != height)
+  {
+    jpeg_destroy_decompress(&jpg.dinfo);
+    return 1;
+  }
+  dt_imageio_jpeg_decompress_fast(&jpg);
+  return dt_imageio_jpeg_decompress(&jpg, out);
+}
+
+static uint32_t
+_dxt1_encode(const uint8_t *in, const int width, const int height, const int quality,
+             uint8_t *out, const uint32_t max_length)
+{
+  const uint32_t length = dt_dxt1_size(width, height);
+  if(length > max_length) return 0;
+  // written once, read many times: spend the extra time on the refit.
+  dt_dxt1_compress(in, width, height, out, DT_DXT_REFINE);
+  return length;
+}
+
+static int
+_dxt1_decode(const uint8_t *blob, const uint32_t length, const int width, const int height, uint8_t *out)
+{
+  if(length != dt_dxt1_size(width, height)) return 1;
+  dt_dxt1_decompress(out, width, height, blob);
+  return 0;
+}
+
+#ifdef HAVE_WEBP
+static uint32_t
+_webp_encode(const uint8_t *in, const int width, const int height, const int quality,
+             uint8_t *out, const uint32_t max_length)
+{
+  uint8_t *blob = NULL;
+  const size_t length = WebPEncodeRGBA(in, width, height, 4*width, quality, &blob);
+  const uint32_t res = (length > 0 && length <= max_length) ? length : 0;
+  if(res) memcpy(out, blob, length);
+  free(blob);
+  return res;
+}
+
+static int
+_webp_decode(const uint8_t *blob, const uint32_t length, const int width, const int height, uint8_t *out)
+{
+  int wd = 0, ht = 0;
+  if(!WebPGetInfo(blob, length, &wd, &ht) || wd != width || ht != height) return 1;
+  return WebPDecodeRGBAInto(blob, length, out, 4*width*height, 4*width) ? 0 : 1;
+}
+#endif
+
+static const dt_mipmap_codec_ops_t _codecs[DT_MIPMAP_CODEC_COUNT] =
+{
+  [DT_MIPMAP_CODEC_JPEG] = { "jpeg", _jpeg_encode, _jpeg_decode },
+  [DT_MIPMAP_CODEC_DXT1] = { "dxt", _dxt1_encode, _dxt1_decode },
+#ifdef HAVE_WEBP
+  [DT_MIPMAP_CODEC_WEBP] = { "webp", _webp_encode, _webp_decode },
+#else
+  [DT_MIPMAP_CODEC_WEBP] = { "webp", NULL, NULL },
+#endif
+};
+
+int
+dt_mipmap_codec_available(const dt_mipmap_codec_t codec)
+{
+  return (int)codec >= 0 && codec < DT_MIPMAP_CODEC_COUNT && _codecs[codec].encode;
+}
+
+dt_mipmap_codec_t
+dt_mipmap_codec_from_conf(void)
+{
+  dt_mipmap_codec_t codec = DT_MIPMAP_CODEC_JPEG;
+  gchar *name = dt_conf_get_string("cache_disk_codec");
+  for(int k=0; name && k<DT_MIPMAP_CODEC_COUNT; k++)
+    if(!strcmp(name, _codecs[k].name)) codec = k;
+  g_free(name);
+  if(!dt_mipmap_codec_available(codec))
+  {
+    fprintf(stderr, "[mipmap_codec] `%s' is not available in this build, using jpeg\n", _codecs[codec].name);
+    codec = DT_MIPMAP_CODEC_JPEG;
+  }
+  return codec;
+}
+
+uint32_t
+dt_mipmap_codec_encode(
+  const dt_mipmap_codec_t codec,
+  const uint8_t *in,
+  const int width,
+  const int height,
+  const int quality,
+  uint8_t *out,
+  const uint32_t max_length)
+{
+  if(!dt_mipmap_codec_available(codec)) return 0;
+  return _codecs[codec].encode(in, width, height, MIN(100, MAX(10, quality)), out, max_length);
+}
+
+int
+dt_mipmap_codec_decode(
+  const dt_mipmap_codec_t codec,
+  const uint8_t *blob,
+  const uint32_t length,
+  const int width,
+  const int height,
+  uint8_t *out)
+{
+  // written by a build with more codecs:
+  if(!dt_mipmap_codec_available(codec)) return 1;
+  return _codecs[codec].decode(blob, length, width, height, out);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,57 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_COMMON_MIPMAP_CODEC_H
+#define DT_COMMON_MIPMAP_CODEC_H
+
+#include <inttypes.h>
+
+// codecs for the thumbnails in the on-disk store (common/mipmap_store.h).
+// the codec is recorded with every entry, so changing it only affects thumbnails
+// written from then on, the old ones are still read back.
+// the numbers end up on disk, don't change them, only append.
+typedef enum dt_mipmap_codec_t
+{
+  DT_MIPMAP_CODEC_JPEG = 0, // lossy, small. decoded with the fast integer dct
+  DT_MIPMAP_CODEC_DXT1 = 1, // the dxt1 blocks of the in-memory cache as they are
+  DT_MIPMAP_CODEC_WEBP = 2, // lossy, smaller than jpeg at the same quality. only with libwebp
+  DT_MIPMAP_CODEC_COUNT
+}
+dt_mipmap_codec_t;
+
+// the codec for newly written thumbnails of uncompressed mip levels, from the config.
+// falls back to jpeg if the chosen one isn't compiled in.
+dt_mipmap_codec_t dt_mipmap_codec_from_conf(void);
+
+// returns non zero if this build can read and write the codec.
+int dt_mipmap_codec_available(const dt_mipmap_codec_t codec);
+
+// compresses a width x height image with 4 bytes per pixel into out, which holds max_length bytes.
+// quality (10..100) is ignored by dxt1. returns the blob length, 0 if it failed or didn't fit.
+uint32_t dt_mipmap_codec_encode(const dt_mipmap_codec_t codec, const uint8_t *in, const int width, const int height,
+                                const int quality, uint8_t *out, const uint32_t max_length);
+
+// decompresses a blob to a width x height image with 4 bytes per pixel.
+// fails (returns non zero) if the blob isn't an image of exactly that size.
+int dt_mipmap_codec_decode(const dt_mipmap_codec_t codec, const uint8_t *blob, const uint32_t length,
+                           const int width, const int height, uint8_t *out);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,320 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/darktable.h"
+#include "common/mipmap_codec.h"
+#include "common/mipmap_store.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define DT_MIPMAP_STORE_MAGIC   0xD71338
+// 2: dxt1 rows of blocks are (width+3)/4 blocks apart, squish overlapped the last block of a row with the next one
+// 3: the codec is stored per entry, version 2 indices are converted on open
+#define DT_MIPMAP_STORE_VERSION 3
+// grow the index in steps of this many entries:
+#define DT_MIPMAP_STORE_INDEX_CHUNK 4096
+// drop the whole store on open if more than this fraction of the data file is garbage
+// and it's larger than a few megabytes. thumbnails will be regenerated on demand.
+#define DT_MIPMAP_STORE_GARBAGE_RATIO 0.5
+#define DT_MIPMAP_STORE_GARBAGE_MIN (16u<<20)
+
+static int
+_map_index(dt_mipmap_store_t *store, const uint32_t capacity)
+{
+  const size_t size = sizeof(dt_mipmap_store_header_t) + (size_t)capacity * sizeof(dt_mipmap_store_entry_t);
+  if(store->header)
+  {
+    munmap(store->header, store->map_size);
+    store->header = NULL;
+    store->entries = NULL;
+  }
+  struct stat st;
+  if(fstat(store->index_fd, &st)) return 1;
+  // new entries are zero filled by the file system, i.e. empty.
+  if(st.st_size < size && ftruncate(store->index_fd, size)) return 1;
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, store->index_fd, 0);
+  if(map == MAP_FAILED) return 1;
+  store->map_size = size;
+  store->header = (dt_mipmap_store_header_t *)map;
+  store->entries = (dt_mipmap_store_entry_t *)(store->header + 1);
+  store->header->capacity = capacity;
+  return 0;
+}
+
+typedef struct dt_mipmap_store_entry_v2_t
+{
+  uint64_t offset;
+  uint32_t length;
+  uint16_t width, height;
+}
+dt_mipmap_store_entry_v2_t;
+
+// version 2 had one codec for all entries, given by the compression type of the cache.
+// rewrite the index with the codec in every entry, the data file stays as it is.
+static int
+_upgrade_v2(dt_mipmap_store_t *store, const dt_mipmap_store_header_t *header)
+{
+  const size_t size = (size_t)header->capacity * sizeof(dt_mipmap_store_entry_v2_t);
+  dt_mipmap_store_entry_v2_t *old = (dt_mipmap_store_entry_v2_t *)malloc(size);
+  if(!old) return 1;
+  if(pread(store->index_fd, old, size, sizeof(*header)) != size || _map_index(store, header->capacity))
+  {
+    free(old);
+    return 1;
+  }
+  // if we crash half way through, the index will be dropped on the next start:
+  store->header->magic = 0;
+  const uint8_t codec = header->compression_type ? DT_MIPMAP_CODEC_DXT1 : DT_MIPMAP_CODEC_JPEG;
+  for(uint32_t k=0; k<header->capacity; k++)
+  {
+    dt_mipmap_store_entry_t *entry = store->entries + k;
+    memset(entry, 0, sizeof(*entry));
+    entry->offset = old[k].offset;
+    entry->length = old[k].length;
+    entry->width  = old[k].width;
+    entry->height = old[k].height;
+    entry->codec  = codec;
+  }
+  free(old);
+  store->header->magic = DT_MIPMAP_STORE_MAGIC + DT_MIPMAP_STORE_VERSION;
+  return 0;
+}
+
+static int
+_reset(dt_mipmap_store_t *store, const int32_t max_width, const int32_t max_height)
+{
+  if(store->header)
+  {
+    munmap(store->header, store->map_size);
+    store->header = NULL;
+    store->entries = NULL;
+  }
+  if(ftruncate(store->index_fd, 0) || ftruncate(store->data_fd, 0)) return 1;
+  if(_map_index(store, DT_MIPMAP_STORE_INDEX_CHUNK)) return 1;
+  store->header->magic = DT_MIPMAP_STORE_MAGIC + DT_MIPMAP_STORE_VERSION;
+  store->header->compression_type = 0;
+  store->header->max_width = max_width;
+  store->header->max_height = max_height;
+  store->header->garbage = 0;
+  store->data_end = 0;
+  return 0;
+}
+
+int
+dt_mipmap_store_open(
+  dt_mipmap_store_t *store,
+  const char *prefix,
+  const int32_t max_width,
+  const int32_t max_height)
+{
+  char filename[DT_MAX_PATH_LEN];
+  memset(store, 0, sizeof(*store));
+  store->index_fd = store->data_fd = -1;
+  dt_pthread_mutex_init(&store->lock, NULL);
+
+  snprintf(filename, sizeof(filename), "%s.index", prefix);
+  store->index_fd = open(filename, O_RDWR | O_CREAT, 0644);
+  snprintf(filename, sizeof(filename), "%s.data", prefix);
+  store->data_fd = open(filename, O_RDWR | O_CREAT, 0644);
+  if(store->index_fd < 0 || store->data_fd < 0) goto error;
+
+  struct stat st;
+  if(fstat(store->index_fd, &st)) goto error;
+  const off_t data_end = lseek(store->data_fd, 0, SEEK_END);
+  if(data_end < 0) goto error;
+  store->data_end = data_end;
+
+  int valid = 0;
+  if(st.st_size >= sizeof(dt_mipmap_store_header_t))
+  {
+    dt_mipmap_store_header_t header;
+    if(pread(store->index_fd, &header, sizeof(header), 0) == sizeof(header) &&
+        header.max_width == max_width && header.max_height == max_height &&
+        !(store->data_end > DT_MIPMAP_STORE_GARBAGE_MIN &&
+          header.garbage > DT_MIPMAP_STORE_GARBAGE_RATIO * store->data_end))
+    {
+      if(header.magic == DT_MIPMAP_STORE_MAGIC + DT_MIPMAP_STORE_VERSION &&
+          st.st_size >= sizeof(header) + (size_t)header.capacity * sizeof(dt_mipmap_store_entry_t))
+        valid = !_map_index(store, header.capacity);
+      else if(header.magic == DT_MIPMAP_STORE_MAGIC + 2 &&
+          st.st_size >= sizeof(header) + (size_t)header.capacity * sizeof(dt_mipmap_store_entry_v2_t))
+      {
+        dt_print(DT_DEBUG_CACHE, "[mipmap_store] converting the index of `%s'\n", prefix);
+        valid = !_upgrade_v2(store, &header);
+      }
+    }
+  }
+  if(!valid)
+  {
+    dt_print(DT_DEBUG_CACHE, "[mipmap_store] starting new thumbnail store `%s'\n", prefix);
+    if(_reset(store, max_width, max_height)) goto error;
+  }
+  return 0;
+
+error:
+  fprintf(stderr, "[mipmap_store] failed to open thumbnail store `%s'\n", prefix);
+  // leave the store in an unusable, but safe to close state:
+  if(store->header) munmap(store->header, store->map_size);
+  if(store->index_fd >= 0) close(store->index_fd);
+  if(store->data_fd >= 0) close(store->data_fd);
+  store->header = NULL;
+  store->entries = NULL;
+  store->index_fd = store->data_fd = -1;
+  return 1;
+}
+
+void
+dt_mipmap_store_close(dt_mipmap_store_t *store)
+{
+  if(store->header) munmap(store->header, store->map_size);
+  if(store->index_fd >= 0) close(store->index_fd);
+  if(store->data_fd >= 0) close(store->data_fd);
+  store->header = NULL;
+  store->entries = NULL;
+  store->index_fd = store->data_fd = -1;
+  dt_pthread_mutex_destroy(&store->lock);
+}
+
+int
+dt_mipmap_store_read(
+  dt_mipmap_store_t *store,
+  const uint32_t imgid,
+  uint8_t *blob,
+  const uint32_t max_length,
+  uint32_t *length,
+  uint32_t *width,
+  uint32_t *height,
+  int32_t *codec)
+{
+  if(!store->header) return 1;
+  dt_mipmap_store_entry_t entry = {0};
+  dt_pthread_mutex_lock(&store->lock);
+  // the mapping might have gone away in a failed resize:
+  if(store->header && imgid < store->header->capacity) entry = store->entries[imgid];
+  const uint64_t data_end = store->data_end;
+  dt_pthread_mutex_unlock(&store->lock);
+
+  // empty, or index pointing past the data (after a crash):
+  if(entry.length == 0 || entry.length > max_length || entry.offset + entry.length > data_end) return 1;
+  if(pread(store->data_fd, blob, entry.length, entry.offset) != entry.length) return 1;
+  *length = entry.length;
+  *width  = entry.width;
+  *height = entry.height;
+  *codec  = entry.codec;
+  return 0;
+}
+
+int
+dt_mipmap_store_contains(
+  dt_mipmap_store_t *store,
+  const uint32_t imgid)
+{
+  if(!store->header) return 0;
+  int res = 0;
+  dt_pthread_mutex_lock(&store->lock);
+  if(store->header && imgid < store->header->capacity)
+  {
+    const dt_mipmap_store_entry_t *entry = store->entries + imgid;
+    res = entry->length > 0 && entry->offset + entry->length <= store->data_end;
+  }
+  dt_pthread_mutex_unlock(&store->lock);
+  return res;
+}
+
+int
+dt_mipmap_store_append(
+  dt_mipmap_store_t *store,
+  const uint32_t imgid,
+  const uint8_t *blob,
+  const uint32_t length,
+  const uint32_t width,
+  const uint32_t height,
+  const int32_t codec)
+{
+  if(!store->header || length == 0) return 1;
+  // reserve space at the end of the data file:
+  dt_pthread_mutex_lock(&store->lock);
+  const uint64_t offset = store->data_end;
+  store->data_end += length;
+  dt_pthread_mutex_unlock(&store->lock);
+
+  // write the blob before the index entry points to it, so a crash in between
+  // only leaves some garbage in the data file.
+  if(pwrite(store->data_fd, blob, length, offset) != length) return 1;
+
+  dt_pthread_mutex_lock(&store->lock);
+  if(!store->header)
+  {
+    dt_pthread_mutex_unlock(&store->lock);
+    return 1;
+  }
+  if(imgid >= store->header->capacity)
+  {
+    const uint32_t capacity = (imgid / DT_MIPMAP_STORE_INDEX_CHUNK + 1) * DT_MIPMAP_STORE_INDEX_CHUNK;
+    if(_map_index(store, capacity))
+    {
+      dt_pthread_mutex_unlock(&store->lock);
+      return 1;
+    }
+  }
+  dt_mipmap_store_entry_t *entry = store->entries + imgid;
+  store->header->garbage += entry->length;
+  entry->offset = offset;
+  entry->width  = width;
+  entry->height = height;
+  entry->codec  = codec;
+  entry->length = length;
+  dt_pthread_mutex_unlock(&store->lock);
+  return 0;
+}
+
+void
+dt_mipmap_store_remove(dt_mipmap_store_t *store, const uint32_t imgid)
+{
+  if(!store->header) return;
+  dt_pthread_mutex_lock(&store->lock);
+  if(store->header && imgid < store->header->capacity)
+  {
+    store->header->garbage += store->entries[imgid].length;
+    store->entries[imgid].length = 0;
+  }
+  dt_pthread_mutex_unlock(&store->lock);
+}
+
+void
+dt_mipmap_store_remove_list(dt_mipmap_store_t *store, const uint32_t *imgids, const int num)
+{
+  if(!store->header) return;
+  dt_pthread_mutex_lock(&store->lock);
+  for(int i=0; store->header && i<num; i++)
+  {
+    if(imgids[i] >= store->header->capacity) continue;
+    store->header->garbage += store->entries[imgids[i]].length;
+    store->entries[imgids[i]].length = 0;
+  }
+  dt_pthread_mutex_unlock(&store->lock);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
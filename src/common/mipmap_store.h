@@ -0,0 +1,98 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_COMMON_MIPMAP_STORE_H
+#define DT_COMMON_MIPMAP_STORE_H
+
+#include "common/dtpthread.h"
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// persistent on-disk store for one mip level of the thumbnail cache.
+// consists of two files:
+// - an append-only data file holding the compressed blobs (see common/mipmap_codec.h),
+// - a small index, directly addressed by image id, which is memory mapped.
+//   every entry records the codec of its blob.
+// thumbnails are appended as they are created and read back lazily on cache misses,
+// so opening the store does not depend on the number of images in the library.
+
+typedef struct dt_mipmap_store_header_t
+{
+  int32_t  magic;
+  int32_t  compression_type; // only used by version 2, where all entries had one codec
+  int32_t  max_width, max_height;
+  uint32_t capacity; // number of index entries following the header
+  uint32_t padding;
+  uint64_t garbage;  // bytes in the data file no longer referenced by the index
+}
+dt_mipmap_store_header_t;
+
+typedef struct dt_mipmap_store_entry_t
+{
+  uint64_t offset;   // position of the blob in the data file
+  uint32_t length;   // blob length in bytes, 0 means empty slot
+  uint16_t width, height;
+  uint8_t  codec;    // dt_mipmap_codec_t
+  uint8_t  padding[7];
+}
+dt_mipmap_store_entry_t;
+
+typedef struct dt_mipmap_store_t
+{
+  int index_fd, data_fd;
+  size_t map_size;
+  // mmapped index file, entries follow the header
+  dt_mipmap_store_header_t *header;
+  dt_mipmap_store_entry_t *entries;
+  uint64_t data_end;
+  // protects the index mapping (it moves when it grows) and data_end.
+  dt_pthread_mutex_t lock;
+}
+dt_mipmap_store_t;
+
+// opens or creates the store for the given file name prefix. if the size of the mip
+// level doesn't match the one in the index, the store is dropped and started from scratch.
+// returns non zero if the store could not be opened, it is unusable in that case.
+int dt_mipmap_store_open(dt_mipmap_store_t *store, const char *prefix, const int32_t max_width, const int32_t max_height);
+void dt_mipmap_store_close(dt_mipmap_store_t *store);
+
+// reads the blob for imgid into the given buffer of max_length bytes.
+// returns 0 on success and sets length, width, height and the codec of the blob.
+int dt_mipmap_store_read(dt_mipmap_store_t *store, const uint32_t imgid, uint8_t *blob,
+                         const uint32_t max_length, uint32_t *length, uint32_t *width, uint32_t *height,
+                         int32_t *codec);
+
+// returns non zero if there is a blob for imgid, without reading it.
+int dt_mipmap_store_contains(dt_mipmap_store_t *store, const uint32_t imgid);
+
+// appends a new blob for imgid, replacing any previous one. returns 0 on success.
+int dt_mipmap_store_append(dt_mipmap_store_t *store, const uint32_t imgid, const uint8_t *blob,
+                           const uint32_t length, const uint32_t width, const uint32_t height,
+                           const int32_t codec);
+
+// invalidates the entry for imgid, so it will be regenerated.
+void dt_mipmap_store_remove(dt_mipmap_store_t *store, const uint32_t imgid);
+
+// invalidates the entries of num images at once.
+void dt_mipmap_store_remove_list(dt_mipmap_store_t *store, const uint32_t *imgids, const int num);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,157 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if defined(__linux__)
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+#include "common/numa.h"
+#include "common/darktable.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__linux__)
+// cpus beyond that are treated as being on node 0:
+#define DT_NUMA_MAX_CPUS CPU_SETSIZE
+
+typedef struct dt_numa_t
+{
+  int nodes;
+  cpu_set_t cpus[DT_NUMA_MAX_NODES];
+  cpu_set_t all;
+  signed char node_of_cpu[DT_NUMA_MAX_CPUS];
+}
+dt_numa_t;
+
+static dt_numa_t _numa;
+static pthread_once_t _once = PTHREAD_ONCE_INIT;
+
+// reads a cpulist like "0-7,16-23" into set, returns the number of cpus.
+static int _parse_cpulist(const char *list, cpu_set_t *set)
+{
+  CPU_ZERO(set);
+  const char *c = list;
+  while(*c >= '0' && *c <= '9')
+  {
+    char *end;
+    const long first = strtol(c, &end, 10);
+    long last = first;
+    if(*end == '-') last = strtol(end + 1, &end, 10);
+    for(long k = first; k <= last && k < DT_NUMA_MAX_CPUS; k++) CPU_SET(k, set);
+    c = *end == ',' ? end + 1 : end;
+  }
+  return CPU_COUNT(set);
+}
+
+static void _init_once()
+{
+  memset(&_numa, 0, sizeof(_numa));
+  // node directories may have gaps, nodes without cpus (memory only) are left out:
+  for(int k = 0; k < 1024 && _numa.nodes < DT_NUMA_MAX_NODES; k++)
+  {
+    char path[64], list[4096];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", k);
+    FILE *f = fopen(path, "rb");
+    if(!f) continue;
+    const int read = fgets(list, sizeof(list), f) != NULL;
+    fclose(f);
+    if(!read || !_parse_cpulist(list, _numa.cpus + _numa.nodes)) continue;
+    CPU_OR(&_numa.all, &_numa.all, _numa.cpus + _numa.nodes);
+    for(int c = 0; c < DT_NUMA_MAX_CPUS; c++)
+      if(CPU_ISSET(c, _numa.cpus + _numa.nodes)) _numa.node_of_cpu[c] = _numa.nodes;
+    _numa.nodes++;
+  }
+  if(!_numa.nodes)
+  {
+    // no sysfs, one node with whatever we may run on now:
+    sched_getaffinity(0, sizeof(cpu_set_t), &_numa.all);
+    _numa.cpus[0] = _numa.all;
+    _numa.nodes = 1;
+  }
+}
+
+int dt_numa_nodes()
+{
+  pthread_once(&_once, _init_once);
+  return _numa.nodes;
+}
+
+int dt_numa_node_cpus(const int node)
+{
+  pthread_once(&_once, _init_once);
+  if(node < 0 || node >= _numa.nodes) return 0;
+  return CPU_COUNT(_numa.cpus + node);
+}
+
+int dt_numa_node()
+{
+  pthread_once(&_once, _init_once);
+  if(_numa.nodes < 2) return -1;
+  const int cpu = sched_getcpu();
+  if(cpu < 0 || cpu >= DT_NUMA_MAX_CPUS) return -1;
+  return _numa.node_of_cpu[cpu];
+}
+
+int dt_numa_bind(const int node)
+{
+  pthread_once(&_once, _init_once);
+  if(_numa.nodes < 2) return 0;
+  if(node < 0 || node >= _numa.nodes) return 1;
+  return sched_setaffinity(0, sizeof(cpu_set_t), _numa.cpus + node) != 0;
+}
+
+void dt_numa_unbind()
+{
+  pthread_once(&_once, _init_once);
+  if(_numa.nodes < 2) return;
+  sched_setaffinity(0, sizeof(cpu_set_t), &_numa.all);
+}
+
+#else
+
+int dt_numa_nodes()
+{
+  return 1;
+}
+
+int dt_numa_node_cpus(const int node)
+{
+  return node == 0 ? dt_get_num_threads() : 0;
+}
+
+int dt_numa_node()
+{
+  return -1;
+}
+
+int dt_numa_bind(const int node)
+{
+  return 0;
+}
+
+void dt_numa_unbind()
+{
+}
+
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,44 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_NUMA_H
+#define DT_NUMA_H
+
+/**
+ * numa nodes of the machine, read from sysfs on linux. elsewhere, and on machines with
+ * a single node, there is one node holding all cpus and binding does nothing.
+ *
+ * there is no explicit placement of memory: linux puts a page on the node of the thread
+ * touching it first, so buffers allocated and written by a bound thread stay local.
+ */
+#define DT_NUMA_MAX_NODES 16
+
+/** number of nodes with cpus, at least 1. */
+int dt_numa_nodes();
+/** number of cpus on node. */
+int dt_numa_node_cpus(const int node);
+/** the node of the cpu the calling thread runs on, -1 with a single node. */
+int dt_numa_node();
+/** restricts the calling thread to the cpus of node, returns 0 on success. threads it creates inherit that. */
+int dt_numa_bind(const int node);
+/** lets the calling thread run on all cpus again. */
+void dt_numa_unbind();
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
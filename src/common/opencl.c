@@ -21,8 +21,13 @@
 
 #include "common/darktable.h"
 #include "common/opencl.h"
+#include "common/trace.h"
 #include "common/bilateralcl.h"
+#include "common/box_filters.h"
 #include "common/gaussian.h"
+#include "common/histogram.h"
+#include "common/file_location.h"
+#include "common/opencl_placement.h"
 #include "common/dlopencl.h"
 #include "common/nvidia_gpus.h"
 #include "develop/pixelpipe.h"
@@ -31,6 +36,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <float.h>
 
 #include <sys/stat.h>
 #include <errno.h>
@@ -41,6 +47,92 @@
 
 static const char *dt_opencl_get_vendor_by_id(unsigned int id);
 static char *_ascii_str_canonical(const char *in, char *out, int maxlen);
+static void _opencl_pool_flush(const int devid);
+static void _opencl_pool_statistics(const int devid, const char *tag);
+
+// a loaded program waiting to be built in the background:
+typedef struct dt_opencl_build_job_t
+{
+  int prog;
+  int loaded_cached;
+  int urgent;
+  char md5sum[33];
+  char programname[DT_MAX_PATH_LEN];
+  char binname[DT_MAX_PATH_LEN];
+  char cachedir[DT_MAX_PATH_LEN];
+  char kerneldir[DT_MAX_PATH_LEN];
+}
+dt_opencl_build_job_t;
+
+static void *_opencl_build_thread(void *data);
+static int _opencl_core_ready(const int dev);
+static void _opencl_stats_write(dt_opencl_t *cl);
+static void _opencl_events_bytes(const int devid, cl_event *eventp, const size_t bytes);
+
+static cl_command_queue_properties
+_opencl_queue_properties(dt_opencl_t *cl)
+{
+  return ((darktable.unmuted & DT_DEBUG_PERF) || dt_trace_enabled() || cl->kernel_statistics) ? CL_QUEUE_PROFILING_ENABLE : 0;
+}
+
+/**
+ * gives devices with enough memory for it more command queues, appended as entries after the num_devs
+ * devices found, so preview and full pipe can run at the same time instead of one waiting for the other's
+ * lock. a queue is given at least twice the memory darktable requires of a device at all, and each queue
+ * of a device gets its share of the memory as max_global_mem, which sizes the tiles. returns the number
+ * of entries.
+ */
+static int
+_opencl_add_queues(dt_opencl_t *cl, const int num_devs, const int memory_requirement)
+{
+  const int max_queues = CLAMP(dt_conf_get_int("opencl_device_queues"), 1, 8);
+  int queues[num_devs];
+  int total = 0;
+  for(int dev=0; dev<num_devs; dev++)
+  {
+    queues[dev] = CLAMP(cl->dev[dev].max_global_mem / ((cl_ulong)2*memory_requirement*1024*1024), 1, max_queues);
+    total += queues[dev];
+  }
+  if(total == num_devs) return num_devs;
+  dt_opencl_device_t *devs = (dt_opencl_device_t *)realloc(cl->dev, sizeof(dt_opencl_device_t)*total);
+  if(!devs) return num_devs;
+  cl->dev = devs;
+
+  int n = num_devs;
+  for(int dev=0; dev<num_devs; dev++)
+  {
+    int created = 1;
+    for(int q=1; q<queues[dev]; q++)
+    {
+      dt_opencl_device_t *d = cl->dev + n;
+      *d = cl->dev[dev];
+      cl_int err;
+      d->cmd_queue = (cl->dlocl->symbols->dt_clCreateCommandQueue)(d->context, d->devid, _opencl_queue_properties(cl), &err);
+      if(err != CL_SUCCESS)
+      {
+        dt_print(DT_DEBUG_OPENCL, "[opencl_init] could not create command queue %d for device %d: %d\n", q, dev, err);
+        break;
+      }
+      d->queue = q;
+      // programs are released with the first queue, its build thread sets up the kernels of this one:
+      memset(d->program_used, 0x0, sizeof(int)*DT_OPENCL_MAX_PROGRAMS);
+      memset(d->kernel,  0x0, sizeof(cl_kernel)*DT_OPENCL_MAX_KERNELS);
+      memset(d->kernel_used,  0x0, sizeof(int)*DT_OPENCL_MAX_KERNELS);
+      d->build_queue = NULL;
+      d->build_started = 0;
+      dt_pthread_mutex_init(&d->lock, NULL);
+      created++;
+      n++;
+    }
+    if(created == 1) continue;
+    cl->dev[dev].max_global_mem /= created;
+    for(int k=num_devs; k<n; k++)
+      if(cl->dev[k].physical == dev) cl->dev[k].max_global_mem = cl->dev[dev].max_global_mem;
+    dt_print(DT_DEBUG_OPENCL, "[opencl_init] device %d `%s' has %d command queues with %luMB each\n", dev,
+             cl->dev[dev].name, created, cl->dev[dev].max_global_mem/1024/1024);
+  }
+  return n;
+}
 
 void dt_opencl_init(dt_opencl_t *cl, const int argc, char *argv[])
 {
@@ -58,7 +150,14 @@ void dt_opencl_init(dt_opencl_t *cl, const int argc, char *argv[])
   cl->avoid_atomics = dt_conf_get_bool("opencl_avoid_atomics");
   cl->async_pixelpipe = dt_conf_get_bool("opencl_async_pixelpipe");
   cl->synch_cache = dt_conf_get_bool("opencl_synch_cache");
+  cl->gpu_cache = dt_conf_get_bool("opencl_gpu_cache");
   cl->micro_nap = dt_conf_get_int("opencl_micro_nap");
+  cl->pool_max_size = (size_t)MAX(dt_conf_get_int("opencl_memory_pool"), 0)*1024*1024;
+  dt_pthread_mutex_init(&cl->pool_lock, NULL);
+  cl->pool_used = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, free);
+  cl->kernel_statistics = dt_conf_get_bool("opencl_kernel_statistics");
+  const int host_memory = dt_conf_get_bool("opencl_host_memory");
+  dt_pthread_mutex_init(&cl->stats_lock, NULL);
   cl->dlocl = NULL;
   cl->dev_priority_image = NULL;
   cl->dev_priority_preview = NULL;
@@ -93,9 +192,16 @@ void dt_opencl_init(dt_opencl_t *cl, const int argc, char *argv[])
   dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_size_roundup: %d\n", dt_conf_get_int("opencl_size_roundup"));
   dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_async_pixelpipe: %d\n", dt_conf_get_bool("opencl_async_pixelpipe"));
   dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_synch_cache: %d\n", dt_conf_get_bool("opencl_synch_cache"));
+  dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_gpu_cache: %d\n", dt_conf_get_bool("opencl_gpu_cache"));
   dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_number_event_handles: %d\n", dt_conf_get_int("opencl_number_event_handles"));
   dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_micro_nap: %d\n", dt_conf_get_int("opencl_micro_nap"));
   dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_use_pinned_memory: %d\n", dt_conf_get_bool("opencl_use_pinned_memory"));
+  dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_pipelined_tiling: %d\n", dt_conf_get_bool("opencl_pipelined_tiling"));
+  dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_export_multiple_devices: %d\n", dt_conf_get_bool("opencl_export_multiple_devices"));
+  dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_memory_pool: %d\n", dt_conf_get_int("opencl_memory_pool"));
+  dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_auto_placement: %d\n", dt_conf_get_bool("opencl_auto_placement"));
+  dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_kernel_statistics: %d\n", dt_conf_get_bool("opencl_kernel_statistics"));
+  dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_host_memory: %d\n", dt_conf_get_bool("opencl_host_memory"));
 
   dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_avoid_atomics: %d\n", dt_conf_get_bool("opencl_avoid_atomics"));
   dt_print(DT_DEBUG_OPENCL, "[opencl_init] opencl_omit_whitebalance: %d\n", dt_conf_get_bool("opencl_omit_whitebalance"));
@@ -176,6 +282,10 @@ void dt_opencl_init(dt_opencl_t *cl, const int argc, char *argv[])
     memset(cl->dev[dev].program_used, 0x0, sizeof(int)*DT_OPENCL_MAX_PROGRAMS);
     memset(cl->dev[dev].kernel,  0x0, sizeof(cl_kernel)*DT_OPENCL_MAX_KERNELS);
     memset(cl->dev[dev].kernel_used,  0x0, sizeof(int)*DT_OPENCL_MAX_KERNELS);
+    memset(cl->dev[dev].program_ready, 0x0, sizeof(int)*DT_OPENCL_MAX_PROGRAMS);
+    cl->dev[dev].build_queue = NULL;
+    cl->dev[dev].build_started = 0;
+    cl->dev[dev].stats = NULL;
     cl->dev[dev].eventlist = NULL;
     cl->dev[dev].eventtags = NULL;
     cl->dev[dev].numevents = 0;
@@ -186,11 +296,17 @@ void dt_opencl_init(dt_opencl_t *cl, const int argc, char *argv[])
     cl->dev[dev].totalsuccess = 0;
     cl->dev[dev].totallost = 0;
     cl->dev[dev].summary=CL_COMPLETE;
+    cl->dev[dev].pool = NULL;
+    cl->dev[dev].pool_size = 0;
+    cl->dev[dev].pool_hits = 0;
+    cl->dev[dev].pool_misses = 0;
     cl->dev[dev].used_global_mem = 0;
     cl->dev[dev].nvidia_sm_20 = 0;
     cl->dev[dev].vendor = "";
     cl->dev[dev].name = "";
     cl->dev[dev].cname = "";
+    cl->dev[dev].physical = dev;
+    cl->dev[dev].queue = 0;
     cl_device_id devid = cl->dev[dev].devid = devices[k];
 
     char infostr[1024];
@@ -255,6 +371,13 @@ void dt_opencl_init(dt_opencl_t *cl, const int argc, char *argv[])
     cl->dev[dev].name = strdup(infostr);
     cl->dev[dev].cname = _ascii_str_canonical(infostr, NULL, 0);
 
+    cl_bool unified_memory = 0;
+    (cl->dlocl->symbols->dt_clGetDeviceInfo)(devid, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &unified_memory, NULL);
+    cl->dev[dev].host_memory = host_memory && unified_memory;
+    if(unified_memory)
+      dt_print(DT_DEBUG_OPENCL, "[opencl_init] device %d `%s' shares memory with the host%s\n", k, infostr,
+               host_memory ? ", pixelpipe images are allocated in host buffers" : "");
+
     dt_print(DT_DEBUG_OPENCL, "[opencl_init] device %d `%s' supports image sizes of %zd x %zd\n", k, infostr, cl->dev[dev].max_image_width, cl->dev[dev].max_image_height);
     dt_print(DT_DEBUG_OPENCL, "[opencl_init] device %d `%s' allows GPU memory allocations of up to %luMB\n", k, infostr, cl->dev[dev].max_mem_alloc/1024/1024);
 
@@ -282,7 +405,7 @@ void dt_opencl_init(dt_opencl_t *cl, const int argc, char *argv[])
       goto finally;
     }
     // create a command queue for first device the context reported
-    cl->dev[dev].cmd_queue = (cl->dlocl->symbols->dt_clCreateCommandQueue)(cl->dev[dev].context, devid, (darktable.unmuted & DT_DEBUG_PERF) ? CL_QUEUE_PROFILING_ENABLE : 0, &err);
+    cl->dev[dev].cmd_queue = (cl->dlocl->symbols->dt_clCreateCommandQueue)(cl->dev[dev].context, devid, _opencl_queue_properties(cl), &err);
     if(err != CL_SUCCESS)
     {
       dt_print(DT_DEBUG_OPENCL, "[opencl_init] could not create command queue for device %d: %d\n", k, err);
@@ -317,8 +440,8 @@ void dt_opencl_init(dt_opencl_t *cl, const int argc, char *argv[])
     snprintf(kerneldir, DT_MAX_PATH_LEN, "%s/kernels", dtpath);
 
 
-    // now load all darktable cl kernels.
-    // TODO: compile as a job?
+    // now load all darktable cl kernels. building them can take minutes after a driver update,
+    // so that's left to a thread per device, see _opencl_build_thread().
     tstart = dt_get_wtime();
     FILE *f = fopen(filename, "rb");
     if(f)
@@ -359,14 +482,23 @@ void dt_opencl_init(dt_opencl_t *cl, const int argc, char *argv[])
 
         snprintf(filename, DT_MAX_PATH_LEN, "%s/kernels/%s", dtpath, programname);
         snprintf(binname, DT_MAX_PATH_LEN, "%s/%s.bin", cachedir, programname);
-        dt_print(DT_DEBUG_OPENCL, "[opencl_init] compiling program `%s' ..\n", programname);
-        int loaded_cached;
-        char md5sum[33];
-        if(dt_opencl_load_program(dev, prog, filename, binname, cachedir, md5sum, &loaded_cached) &&
-            dt_opencl_build_program(dev, prog, binname, cachedir, md5sum, loaded_cached, kerneldir) != CL_SUCCESS)
+        dt_print(DT_DEBUG_OPENCL, "[opencl_init] loading program `%s' ..\n", programname);
+        dt_opencl_build_job_t *job = (dt_opencl_build_job_t *)malloc(sizeof(dt_opencl_build_job_t));
+        job->prog = prog;
+        job->urgent = 0;
+        g_strlcpy(job->programname, programname, DT_MAX_PATH_LEN);
+        g_strlcpy(job->binname, binname, DT_MAX_PATH_LEN);
+        g_strlcpy(job->cachedir, cachedir, DT_MAX_PATH_LEN);
+        g_strlcpy(job->kerneldir, kerneldir, DT_MAX_PATH_LEN);
+        if(dt_opencl_load_program(dev, prog, filename, binname, cachedir, job->md5sum, &job->loaded_cached))
+        {
+          cl->dev[dev].build_queue = g_list_append(cl->dev[dev].build_queue, job);
+        }
+        else
         {
-          dt_print(DT_DEBUG_OPENCL, "[opencl_init] failed to compile program `%s'!\n", programname);
-          goto finally;
+          dt_print(DT_DEBUG_OPENCL, "[opencl_init] failed to load program `%s'!\n", programname);
+          cl->dev[dev].program_ready[prog] = -1;
+          free(job);
         }
 
       }
@@ -374,7 +506,7 @@ void dt_opencl_init(dt_opencl_t *cl, const int argc, char *argv[])
       fclose(f);
       tend = dt_get_wtime();
       tdiff = tend - tstart;
-      dt_print(DT_DEBUG_OPENCL, "[opencl_init] kernel loading time: %2.4lf \n", tdiff);
+      dt_print(DT_DEBUG_OPENCL, "[opencl_init] program loading time: %2.4lf \n", tdiff);
     }
     else
     {
@@ -386,6 +518,8 @@ void dt_opencl_init(dt_opencl_t *cl, const int argc, char *argv[])
   free(devices);
   if(dev > 0)
   {
+    // more queues on large devices, so the pipes don't wait for each other:
+    dev = _opencl_add_queues(cl, dev, opencl_memory_requirement);
     cl->num_devs = dev;
     cl->inited = 1;
     cl->enabled = dt_conf_get_bool("opencl");
@@ -397,13 +531,22 @@ void dt_opencl_init(dt_opencl_t *cl, const int argc, char *argv[])
     // only check successful malloc in debug mode; darktable will crash anyhow sooner or later if mallocs that small would fail
     assert(cl->dev_priority_image != NULL && cl->dev_priority_preview != NULL && cl->dev_priority_export != NULL && cl->dev_priority_thumbnail != NULL);
 
+    // the measured speeds of earlier sessions order the devices given as `+':
+    dt_opencl_placement_init(cl);
+
     // apply config settings for device priority
     dt_opencl_priorities_parse(dt_conf_get_string("opencl_device_priority"));
 
     dt_print(DT_DEBUG_OPENCL, "[opencl_init] OpenCL successfully initialized.\n");
     dt_print(DT_DEBUG_OPENCL, "[opencl_init] here are the internal numbers and names of OpenCL devices available to darktable:\n");
     for(int i=0; i<dev; i++)
-      dt_print(DT_DEBUG_OPENCL,"[opencl_init]\t\t%d\t'%s'\n", i, cl->dev[i].name);
+    {
+      if(cl->dev[i].queue)
+        dt_print(DT_DEBUG_OPENCL,"[opencl_init]\t\t%d\t'%s', queue %d of device %d\n", i, cl->dev[i].name,
+                 cl->dev[i].queue, cl->dev[i].physical);
+      else
+        dt_print(DT_DEBUG_OPENCL,"[opencl_init]\t\t%d\t'%s'\n", i, cl->dev[i].name);
+    }
 
     dt_print(DT_DEBUG_OPENCL, "[opencl_init] these are your device priorities:\n");
     dt_print(DT_DEBUG_OPENCL, "[opencl_init] \t\timage\tpreview\texport\tthumbnail\n");
@@ -425,6 +568,21 @@ finally:
     dt_capabilities_add("opencl");
     cl->bilateral = dt_bilateral_init_cl_global();
     cl->gaussian = dt_gaussian_init_cl_global();
+    cl->box_mean = dt_box_mean_init_cl_global();
+    cl->histogram = dt_histogram_init_cl_global();
+    cl->pixelpipe = dt_dev_pixelpipe_init_cl_global();
+    cl->build_stop = 0;
+    for(int i=0; i<cl->num_devs; i++)
+    {
+      if(!cl->dev[i].build_queue) continue;
+      cl->dev[i].build_started = !pthread_create(&cl->dev[i].build_thread, NULL, _opencl_build_thread, (void *)(size_t)i);
+      if(!cl->dev[i].build_started)
+      {
+        // can't do it in the background, the user has to wait then:
+        dt_print(DT_DEBUG_OPENCL, "[opencl_init] could not start build thread for device %d, building now\n", i);
+        _opencl_build_thread((void *)(size_t)i);
+      }
+    }
   }
   return;
 }
@@ -433,15 +591,29 @@ void dt_opencl_cleanup(dt_opencl_t *cl)
 {
   if(cl->inited)
   {
+    dt_opencl_placement_cleanup(cl);
+    _opencl_stats_write(cl);
     dt_bilateral_free_cl_global(cl->bilateral);
     dt_gaussian_free_cl_global(cl->gaussian);
+    dt_box_mean_free_cl_global(cl->box_mean);
+    dt_histogram_free_cl_global(cl->histogram);
+    dt_dev_pixelpipe_free_cl_global(cl->pixelpipe);
+    dt_pthread_mutex_lock(&cl->lock);
+    cl->build_stop = 1;
+    dt_pthread_mutex_unlock(&cl->lock);
+    dt_opencl_wait_for_programs();
+    for(int k=0; k<DT_OPENCL_MAX_KERNELS; k++) free(cl->kernel_name[k]);
     for(int i=0; i<cl->num_devs; i++)
     {
+      g_list_free_full(cl->dev[i].build_queue, free);
+      if(cl->dev[i].stats) g_hash_table_destroy(cl->dev[i].stats);
+      _opencl_pool_statistics(i, "opencl_summary_statistics");
+      _opencl_pool_flush(i);
       dt_pthread_mutex_destroy(&cl->dev[i].lock);
-      for(int k=0; k<DT_OPENCL_MAX_KERNELS; k++) if(cl->dev[i].kernel_used [k]) (cl->dlocl->symbols->dt_clReleaseKernel) (cl->dev[i].kernel [k]);
+      for(int k=0; k<DT_OPENCL_MAX_KERNELS; k++) if(cl->dev[i].kernel_used [k] && cl->dev[i].kernel[k]) (cl->dlocl->symbols->dt_clReleaseKernel) (cl->dev[i].kernel [k]);
       for(int k=0; k<DT_OPENCL_MAX_PROGRAMS; k++) if(cl->dev[i].program_used[k]) (cl->dlocl->symbols->dt_clReleaseProgram)(cl->dev[i].program[k]);
       (cl->dlocl->symbols->dt_clReleaseCommandQueue)(cl->dev[i].cmd_queue);
-      (cl->dlocl->symbols->dt_clReleaseContext)(cl->dev[i].context);
+      if(!cl->dev[i].queue) (cl->dlocl->symbols->dt_clReleaseContext)(cl->dev[i].context);
       if(cl->use_events)
       {
         if(cl->dev[i].totalevents)
@@ -465,6 +637,10 @@ void dt_opencl_cleanup(dt_opencl_t *cl)
     free(cl->dev_priority_thumbnail);
   }
 
+  g_hash_table_destroy(cl->pool_used);
+  dt_pthread_mutex_destroy(&cl->pool_lock);
+  dt_pthread_mutex_destroy(&cl->stats_lock);
+
   if(cl->dlocl)
   {
     free(cl->dlocl->symbols);
@@ -518,6 +694,29 @@ int dt_opencl_enqueue_barrier(const int devid)
   return (cl->dlocl->symbols->dt_clEnqueueBarrier)(cl->dev[devid].cmd_queue);
 }
 
+void *dt_opencl_enqueue_marker(const int devid)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || devid < 0) return NULL;
+  cl_event marker = NULL;
+  if((cl->dlocl->symbols->dt_clEnqueueMarker)(cl->dev[devid].cmd_queue, &marker) != CL_SUCCESS) return NULL;
+  // make sure the device starts on what we have so far, the caller is going to wait for it eventually:
+  (cl->dlocl->symbols->dt_clFlush)(cl->dev[devid].cmd_queue);
+  return marker;
+}
+
+int dt_opencl_wait_for_marker(const int devid, void *marker)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || devid < 0) return FALSE;
+  // without a marker all we can do is wait for everything:
+  if(marker == NULL) return dt_opencl_finish(devid);
+  cl_event event = (cl_event)marker;
+  const cl_int err = (cl->dlocl->symbols->dt_clWaitForEvents)(1, &event);
+  (cl->dlocl->symbols->dt_clReleaseEvent)(event);
+  return err == CL_SUCCESS;
+}
+
 static int _take_from_list(int *list, int value)
 {
   int result = -1;
@@ -622,6 +821,28 @@ static char *_strsep(char **stringp, const char *delim)
 }
 
 
+// stable sort of the devices by their measured speed, unknown ones last.
+static void
+_sort_by_placement(int *list, const int cnt)
+{
+  float score[cnt];
+  for(int i = 0; i < cnt; i++)
+  {
+    score[i] = dt_opencl_placement_device_score(list[i]);
+    if(score[i] < 0.0f) score[i] = FLT_MAX;
+  }
+  for(int i = 1; i < cnt; i++)
+    for(int j = i; j > 0 && score[j] < score[j-1]; j--)
+    {
+      const float s = score[j];
+      score[j] = score[j-1];
+      score[j-1] = s;
+      const int d = list[j];
+      list[j] = list[j-1];
+      list[j-1] = d;
+    }
+}
+
 // parse a single token of priority string and store priorities in priority_list
 void dt_opencl_priority_parse(char *configstr, int *priority_list)
 {
@@ -638,10 +859,14 @@ void dt_opencl_priority_parse(char *configstr, int *priority_list)
     return;
   }
 
+  // the first queues of the devices, the others are added behind:
+  int physical = 0;
+  while(physical < devs && !cl->dev[physical].queue) physical++;
+
   // first start with a full list of devices to take from
-  for(int i = 0; i < devs; i++)
+  for(int i = 0; i < physical; i++)
     full[i] = i;
-  full[devs] = -1;
+  full[physical] = -1;
 
   char *str = strtok_r(configstr, ",", &saveptr);
 
@@ -649,12 +874,16 @@ void dt_opencl_priority_parse(char *configstr, int *priority_list)
   {
     int not = 0;
     int all = 0;
+    int fastest = 0;
 
     switch(*str)
     {
       case '*':
         all = 1;
         break;
+      case '+':
+        all = fastest = 1;
+        break;
       case '!':
         not = 1;
         while(*str == '!') str++;
@@ -664,12 +893,14 @@ void dt_opencl_priority_parse(char *configstr, int *priority_list)
     if(all)
     {
       // copy all remaining device numbers from full to priority list
-      for(int i = 0; i < devs && full[i] != -1; i++)
+      const int first = count;
+      for(int i = 0; i < physical && full[i] != -1; i++)
       {
         priority_list[count] = full[i];
         count++;
       }
       full[0] = -1;   // mark full list as empty
+      if(fastest) _sort_by_placement(priority_list + first, count - first);
     }
     else if(*str != '\0')
     {
@@ -697,6 +928,12 @@ void dt_opencl_priority_parse(char *configstr, int *priority_list)
     str = strtok_r(NULL, ",", &saveptr);
   }
 
+  // the further queues of these devices come after all first ones, in the same order:
+  const int first_queues = count;
+  for(int i = 0; i < first_queues; i++)
+    for(int d = physical; d < devs; d++)
+      if(cl->dev[d].physical == priority_list[i]) priority_list[count++] = d;
+
   // terminate priority list with -1
   while(count < devs+1) priority_list[count++] = -1;
 }
@@ -736,6 +973,16 @@ void dt_opencl_priorities_parse(const char *configstr)
   dt_opencl_priority_parse(prio, cl->dev_priority_thumbnail);
 }
 
+// locks the device if it's free and its build thread got far enough.
+static int
+_opencl_device_available(const int dev)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  dt_pthread_mutex_lock(&cl->lock);
+  const int ready = _opencl_core_ready(dev);
+  dt_pthread_mutex_unlock(&cl->lock);
+  return ready && !dt_pthread_mutex_trylock(&cl->dev[dev].lock);
+}
 
 int dt_opencl_lock_device(const int pipetype)
 {
@@ -766,7 +1013,7 @@ int dt_opencl_lock_device(const int pipetype)
   {
     while(*priority != -1)
     {
-      if(!dt_pthread_mutex_trylock(&cl->dev[*priority].lock)) return *priority;
+      if(_opencl_device_available(*priority)) return *priority;
       priority++;
     }
   }
@@ -776,7 +1023,7 @@ int dt_opencl_lock_device(const int pipetype)
     for(int try_dev=0; try_dev < cl->num_devs; try_dev++)
     {
       // get first currently unused processor
-      if(!dt_pthread_mutex_trylock(&cl->dev[try_dev].lock)) return try_dev;
+      if(_opencl_device_available(try_dev)) return try_dev;
     }
   }
 
@@ -790,6 +1037,7 @@ void dt_opencl_unlock_device(const int dev)
   dt_opencl_t *cl = darktable.opencl;
   if(!cl->inited) return;
   if(dev < 0 || dev >= cl->num_devs) return;
+  _opencl_pool_statistics(dev, "opencl_pool");
   dt_pthread_mutex_unlock(&cl->dev[dev].lock);
 }
 
@@ -1030,15 +1278,9 @@ int dt_opencl_build_program(const int dev, const int prog, const char* binname,
           if(bytes_written != binary_sizes[i]) goto ret;
           fclose(f);
 
-          // create link (e.g. basic.cl.bin -> f1430102c53867c162bb60af6c163328)
-          char cwd[1024];
-          if (!getcwd(cwd, 1024)) goto ret;
-          if (chdir(cachedir)!=0) goto ret;
-          char dup[1024];
-          strncpy(dup, binname, 1024);
-          char* bname = basename(dup);
-          if (symlink(md5sum, bname)!=0) goto ret;
-          if (chdir(cwd)!=0) goto ret;
+          // create link (e.g. basic.cl.bin -> f1430102c53867c162bb60af6c163328). binname is in cachedir
+          // and the target relative to it. no chdir(), this runs in the build threads.
+          if (symlink(md5sum, binname)!=0) goto ret;
         }
 
 ret:
@@ -1048,6 +1290,87 @@ ret:
   }
 }
 
+// creates the kernels of slot k on the device, if the program is there. needs cl->lock.
+static void
+_opencl_create_kernel(const int dev, const int k)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  const int prog = cl->kernel_program[k];
+  if(cl->dev[dev].program_ready[prog] != 1) return;
+  cl_int err;
+  cl->dev[dev].kernel[k] = (cl->dlocl->symbols->dt_clCreateKernel)(cl->dev[dev].program[prog], cl->kernel_name[k], &err);
+  if(err != CL_SUCCESS)
+  {
+    dt_print(DT_DEBUG_OPENCL, "[opencl_create_kernel] could not create kernel `%s'! (%d)\n", cl->kernel_name[k], err);
+    cl->dev[dev].kernel[k] = NULL;
+  }
+  else
+    dt_print(DT_DEBUG_OPENCL, "[opencl_create_kernel] successfully loaded kernel `%s' (%d) for device %d\n", cl->kernel_name[k], k, dev);
+}
+
+// moves the job of the program to the front of the queue, behind the other urgent ones. needs cl->lock.
+static void
+_opencl_build_promote(const int devid, const int prog)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  // the first queue builds for all of them:
+  const int dev = cl->dev[devid].physical;
+  GList *l = cl->dev[dev].build_queue;
+  for(; l; l = g_list_next(l)) if(((dt_opencl_build_job_t *)l->data)->prog == prog) break;
+  if(!l || ((dt_opencl_build_job_t *)l->data)->urgent) return;
+  dt_opencl_build_job_t *job = (dt_opencl_build_job_t *)l->data;
+  job->urgent = 1;
+  cl->dev[dev].build_queue = g_list_delete_link(cl->dev[dev].build_queue, l);
+  int pos = 0;
+  for(l = cl->dev[dev].build_queue; l && ((dt_opencl_build_job_t *)l->data)->urgent; l = g_list_next(l)) pos++;
+  cl->dev[dev].build_queue = g_list_insert(cl->dev[dev].build_queue, job, pos);
+}
+
+/**
+ * the build thread of a device. takes the programs from the front of its queue, which
+ * dt_opencl_programs_ready() keeps sorted by the order the pixelpipes asked for them,
+ * and creates their kernels once built.
+ */
+static void *
+_opencl_build_thread(void *data)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  const int dev = (int)(size_t)data;
+  double tstart = dt_get_wtime();
+  while(1)
+  {
+    dt_pthread_mutex_lock(&cl->lock);
+    dt_opencl_build_job_t *job = NULL;
+    if(!cl->build_stop && cl->dev[dev].build_queue)
+    {
+      job = (dt_opencl_build_job_t *)cl->dev[dev].build_queue->data;
+      cl->dev[dev].build_queue = g_list_delete_link(cl->dev[dev].build_queue, cl->dev[dev].build_queue);
+    }
+    dt_pthread_mutex_unlock(&cl->lock);
+    if(!job) break;
+
+    dt_print(DT_DEBUG_OPENCL, "[opencl_build] compiling program `%s' for device %d ..\n", job->programname, dev);
+    const int err = dt_opencl_build_program(dev, job->prog, job->binname, job->cachedir, job->md5sum, job->loaded_cached, job->kerneldir);
+    if(err != CL_SUCCESS) dt_print(DT_DEBUG_OPENCL, "[opencl_build] failed to compile program `%s'!\n", job->programname);
+
+    dt_pthread_mutex_lock(&cl->lock);
+    // the other queues of the device get the program as well:
+    for(int d=0; d<cl->num_devs; d++)
+    {
+      if(cl->dev[d].physical != dev) continue;
+      cl->dev[d].program[job->prog] = cl->dev[dev].program[job->prog];
+      cl->dev[d].program_ready[job->prog] = (err == CL_SUCCESS) ? 1 : -1;
+      for(int k=0; k<DT_OPENCL_MAX_KERNELS; k++)
+        if(cl->dev[d].kernel_used[k] && cl->kernel_name[k] && cl->kernel_program[k] == job->prog)
+          _opencl_create_kernel(d, k);
+    }
+    dt_pthread_mutex_unlock(&cl->lock);
+    free(job);
+  }
+  dt_print(DT_DEBUG_OPENCL, "[opencl_build] program building time for device %d: %2.4lf \n", dev, dt_get_wtime() - tstart);
+  return NULL;
+}
+
 int dt_opencl_create_kernel(const int prog, const char *name)
 {
   dt_opencl_t *cl = darktable.opencl;
@@ -1057,34 +1380,33 @@ int dt_opencl_create_kernel(const int prog, const char *name)
   int k = 0;
   for(int dev=0; dev<cl->num_devs; dev++)
   {
-    cl_int err;
-    for(; k<DT_OPENCL_MAX_KERNELS; k++) if(!cl->dev[dev].kernel_used[k])
-      {
-        cl->dev[dev].kernel_used[k] = 1;
-        cl->dev[dev].kernel[k] = (cl->dlocl->symbols->dt_clCreateKernel)(cl->dev[dev].program[prog], name, &err);
-        if(err != CL_SUCCESS)
-        {
-          dt_print(DT_DEBUG_OPENCL, "[opencl_create_kernel] could not create kernel `%s'! (%d)\n", name, err);
-          cl->dev[dev].kernel_used[k] = 0;
-          goto error;
-        }
-        else break;
-      }
-    if(k < DT_OPENCL_MAX_KERNELS)
-    {
-      dt_print(DT_DEBUG_OPENCL, "[opencl_create_kernel] successfully loaded kernel `%s' (%d) for device %d\n", name, k, dev);
-    }
-    else
+    for(; k<DT_OPENCL_MAX_KERNELS; k++) if(!cl->dev[dev].kernel_used[k]) break;
+    if(k >= DT_OPENCL_MAX_KERNELS)
     {
       dt_print(DT_DEBUG_OPENCL, "[opencl_create_kernel] too many kernels! can't create kernel `%s'\n", name);
-      goto error;
+      dt_pthread_mutex_unlock(&cl->lock);
+      return -1;
     }
   }
+  free(cl->kernel_name[k]);
+  cl->kernel_name[k] = strdup(name);
+  cl->kernel_program[k] = prog;
+  for(int dev=0; dev<cl->num_devs; dev++)
+  {
+    cl->dev[dev].kernel_used[k] = 1;
+    cl->dev[dev].kernel[k] = NULL;
+    // right away if the program is already built, else by the build thread:
+    _opencl_create_kernel(dev, k);
+    if(!cl->record_programs) _opencl_build_promote(dev, prog);
+  }
+  if(cl->record_programs)
+  {
+    if(!g_list_find(*cl->record_programs, GINT_TO_POINTER(prog)))
+      *cl->record_programs = g_list_append(*cl->record_programs, GINT_TO_POINTER(prog));
+  }
+  else cl->program_core[prog] = 1;
   dt_pthread_mutex_unlock(&cl->lock);
   return k;
-error:
-  dt_pthread_mutex_unlock(&cl->lock);
-  return -1;
 }
 
 void dt_opencl_free_kernel(const int kernel)
@@ -1096,11 +1418,61 @@ void dt_opencl_free_kernel(const int kernel)
   for(int dev=0; dev<cl->num_devs; dev++)
   {
     cl->dev[dev].kernel_used [kernel] = 0;
-    (cl->dlocl->symbols->dt_clReleaseKernel) (cl->dev[dev].kernel [kernel]);
+    if(cl->dev[dev].kernel[kernel]) (cl->dlocl->symbols->dt_clReleaseKernel) (cl->dev[dev].kernel [kernel]);
+    cl->dev[dev].kernel[kernel] = NULL;
   }
+  free(cl->kernel_name[kernel]);
+  cl->kernel_name[kernel] = NULL;
+  dt_pthread_mutex_unlock(&cl->lock);
+}
+
+void dt_opencl_record_programs(GList **programs)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  dt_pthread_mutex_lock(&cl->lock);
+  cl->record_programs = programs;
   dt_pthread_mutex_unlock(&cl->lock);
 }
 
+int dt_opencl_programs_ready(const int dev, GList *programs)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || dev < 0) return FALSE;
+  int ready = TRUE;
+  dt_pthread_mutex_lock(&cl->lock);
+  for(; programs; programs = g_list_next(programs))
+  {
+    const int prog = GPOINTER_TO_INT(programs->data);
+    if(cl->dev[dev].program_ready[prog] == 1) continue;
+    ready = FALSE;
+    _opencl_build_promote(dev, prog);
+  }
+  dt_pthread_mutex_unlock(&cl->lock);
+  return ready;
+}
+
+// true if the device has all programs used outside the modules. needs cl->lock.
+static int
+_opencl_core_ready(const int dev)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  for(int prog=0; prog<DT_OPENCL_MAX_PROGRAMS; prog++)
+    if(cl->program_core[prog] && cl->dev[dev].program_ready[prog] != 1) return FALSE;
+  return TRUE;
+}
+
+void dt_opencl_wait_for_programs(void)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited) return;
+  for(int dev=0; dev<cl->num_devs; dev++)
+  {
+    if(!cl->dev[dev].build_started) continue;
+    pthread_join(cl->dev[dev].build_thread, NULL);
+    cl->dev[dev].build_started = 0;
+  }
+}
+
 int dt_opencl_get_max_work_item_sizes(const int dev, size_t *sizes)
 {
   dt_opencl_t *cl = darktable.opencl;
@@ -1131,7 +1503,7 @@ int dt_opencl_get_kernel_work_group_size(const int dev, const int kernel, size_t
 {
   dt_opencl_t *cl = darktable.opencl;
   if(!cl->inited || dev < 0) return -1;
-  if(kernel < 0 || kernel >= DT_OPENCL_MAX_KERNELS) return -1;
+  if(kernel < 0 || kernel >= DT_OPENCL_MAX_KERNELS || !cl->dev[dev].kernel[kernel]) return -1;
 
   return (cl->dlocl->symbols->dt_clGetKernelWorkGroupInfo)(cl->dev[dev].kernel[kernel], cl->dev[dev].devid, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), kernelworkgroupsize, NULL);
 }
@@ -1141,7 +1513,7 @@ int dt_opencl_set_kernel_arg(const int dev, const int kernel, const int num, con
 {
   dt_opencl_t *cl = darktable.opencl;
   if(!cl->inited || dev < 0) return -1;
-  if(kernel < 0 || kernel >= DT_OPENCL_MAX_KERNELS) return -1;
+  if(kernel < 0 || kernel >= DT_OPENCL_MAX_KERNELS || !cl->dev[dev].kernel[kernel]) return -1;
   return (cl->dlocl->symbols->dt_clSetKernelArg)(cl->dev[dev].kernel[kernel], num, size, arg);
 }
 
@@ -1155,7 +1527,7 @@ int dt_opencl_enqueue_kernel_2d_with_local(const int dev, const int kernel, cons
 {
   dt_opencl_t *cl = darktable.opencl;
   if(!cl->inited || dev < 0) return -1;
-  if(kernel < 0 || kernel >= DT_OPENCL_MAX_KERNELS) return -1;
+  if(kernel < 0 || kernel >= DT_OPENCL_MAX_KERNELS || !cl->dev[dev].kernel[kernel]) return -1;
   int err;
   char buf[256];
   buf[0]='\0';
@@ -1166,8 +1538,38 @@ int dt_opencl_enqueue_kernel_2d_with_local(const int dev, const int kernel, cons
   return err;
 }
 
+int dt_opencl_use_host_memory(const int devid)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || devid < 0) return FALSE;
+  return cl->dev[devid].host_memory;
+}
+
 int dt_opencl_copy_device_to_host(const int devid, void *host, void *device, const int width, const int height, const int bpp)
 {
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || devid < 0) return -1;
+  void *host_ptr = NULL;
+  if(cl->dev[devid].host_memory)
+    (cl->dlocl->symbols->dt_clGetMemObjectInfo)(device, CL_MEM_HOST_PTR, sizeof(host_ptr), &host_ptr, NULL);
+  if(host && host_ptr == host)
+  {
+    // the image lives in the host buffer already, reading it onto itself is undefined. a blocking
+    // map synchronizes host and device, which costs nothing on shared memory:
+    const size_t origin[] = {0, 0, 0};
+    const size_t region[] = {width, height, 1};
+    size_t rowpitch;
+    cl_int err;
+    cl_event *eventp = dt_opencl_events_get_slot(devid, "[Map Image (host memory)]");
+    void *mapped = (cl->dlocl->symbols->dt_clEnqueueMapImage)(cl->dev[devid].cmd_queue, device, CL_TRUE, CL_MAP_READ,
+                   origin, region, &rowpitch, NULL, 0, NULL, eventp, &err);
+    if(err != CL_SUCCESS)
+    {
+      dt_print(DT_DEBUG_OPENCL, "[opencl copy_device_to_host] could not map image in host memory on device %d: %d\n", devid, err);
+      return err;
+    }
+    return dt_opencl_unmap_mem_object(devid, device, mapped);
+  }
   return dt_opencl_read_host_from_device(devid, host, device, width, height, bpp);
 }
 
@@ -1205,6 +1607,7 @@ int dt_opencl_read_host_from_device_raw(const int devid, void *host, void *devic
   if(!darktable.opencl->inited) return -1;
 
   cl_event *eventp = dt_opencl_events_get_slot(devid, "[Read Image (from device to host)]");
+  _opencl_events_bytes(devid, eventp, (size_t)rowpitch*region[1]);
 
   return (darktable.opencl->dlocl->symbols->dt_clEnqueueReadImage)(darktable.opencl->dev[devid].cmd_queue, device, blocking, origin, region, rowpitch, 0, host, 0, NULL, eventp);
 }
@@ -1242,6 +1645,7 @@ int dt_opencl_write_host_to_device_raw(const int devid, void *host, void *device
   if(!darktable.opencl->inited) return -1;
 
   cl_event *eventp = dt_opencl_events_get_slot(devid, "[Write Image (from host to device)]");
+  _opencl_events_bytes(devid, eventp, (size_t)rowpitch*region[1]);
 
   return (darktable.opencl->dlocl->symbols->dt_clEnqueueWriteImage)(darktable.opencl->dev[devid].cmd_queue, device, blocking, origin, region, rowpitch, 0, host, 0, NULL, eventp);
 }
@@ -1291,6 +1695,7 @@ int dt_opencl_read_buffer_from_device(const int devid, void *host, void *device,
   if(!darktable.opencl->inited) return -1;
 
   cl_event *eventp = dt_opencl_events_get_slot(devid, "[Read Buffer (from device to host)]");
+  _opencl_events_bytes(devid, eventp, size);
 
   return (darktable.opencl->dlocl->symbols->dt_clEnqueueReadBuffer)(darktable.opencl->dev[devid].cmd_queue, device, blocking, offset, size, host, 0, NULL, eventp);
 }
@@ -1300,11 +1705,40 @@ int dt_opencl_write_buffer_to_device(const int devid, void *host, void *device,
   if(!darktable.opencl->inited) return -1;
 
   cl_event *eventp = dt_opencl_events_get_slot(devid, "[Write Buffer (from host to device)]");
+  _opencl_events_bytes(devid, eventp, size);
 
   return (darktable.opencl->dlocl->symbols->dt_clEnqueueWriteBuffer)(darktable.opencl->dev[devid].cmd_queue, device, blocking, offset, size, host, 0, NULL, eventp);
 }
 
 
+// device memory for the statistics. mem objects can be retained outside the pool,
+// only the release of the last reference gives the memory back. images using host
+// memory in place don't count.
+static void
+_opencl_account(cl_mem mem, const int release)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  size_t size = 0;
+  cl_mem_flags flags = 0;
+  cl_uint refs = 1;
+  if((cl->dlocl->symbols->dt_clGetMemObjectInfo)(mem, CL_MEM_FLAGS, sizeof(flags), &flags, NULL) != CL_SUCCESS ||
+     (flags & CL_MEM_USE_HOST_PTR) ||
+     (cl->dlocl->symbols->dt_clGetMemObjectInfo)(mem, CL_MEM_SIZE, sizeof(size), &size, NULL) != CL_SUCCESS)
+    return;
+  if(release &&
+     ((cl->dlocl->symbols->dt_clGetMemObjectInfo)(mem, CL_MEM_REFERENCE_COUNT, sizeof(refs), &refs, NULL) != CL_SUCCESS ||
+      refs != 1))
+    return;
+  dt_memory_stats_add(DT_MEMORY_OPENCL, release ? -(int64_t)size : (int64_t)size);
+}
+
+static void
+_opencl_release(cl_mem mem)
+{
+  _opencl_account(mem, 1);
+  (darktable.opencl->dlocl->symbols->dt_clReleaseMemObject)(mem);
+}
+
 void* dt_opencl_copy_host_to_device_constant(const int devid, const int size, void *host)
 {
   if(!darktable.opencl->inited || devid < 0) return NULL;
@@ -1314,6 +1748,7 @@ void* dt_opencl_copy_host_to_device_constant(const int devid, const int size, vo
                size,
                host, &err);
   if(err != CL_SUCCESS) dt_print(DT_DEBUG_OPENCL, "[opencl copy_host_to_device_constant] could not alloc buffer on device %d: %d\n", devid, err);
+  else _opencl_account(dev, 0);
   return dev;
 }
 
@@ -1352,14 +1787,155 @@ void* dt_opencl_copy_host_to_device_rowpitch(const int devid, void *host, const
                width, height, rowpitch,
                host, &err);
   if(err != CL_SUCCESS) dt_print(DT_DEBUG_OPENCL, "[opencl copy_host_to_device] could not alloc/copy img buffer on device %d: %d\n", devid, err);
+  else _opencl_account(dev, 0);
   return dev;
 }
 
 
+/**
+ * the memory pool. images from dt_opencl_alloc_device() are not released when the last
+ * reference goes away, but kept on a free list of their device to be handed out again for
+ * the same width, height and bpp. each pooled image holds exactly one opencl reference,
+ * retains and releases while it's in use are counted in its entry instead. the free list is
+ * ordered by last use, the oldest images are released first once the pool grows beyond the
+ * opencl_memory_pool high-water mark. commands still queued on an image when it's returned
+ * to the pool are fine: the queue is in order, so the next user can only run after them.
+ */
+typedef struct dt_opencl_pool_entry_t
+{
+  cl_mem mem;
+  int devid, width, height, bpp;
+  int refs;
+}
+dt_opencl_pool_entry_t;
+
+static size_t
+_opencl_pool_entry_size(const dt_opencl_pool_entry_t *e)
+{
+  return (size_t)e->width*e->height*e->bpp;
+}
+
+// takes an idle image of that size from the pool, or returns NULL.
+static cl_mem
+_opencl_pool_get(const int devid, const int width, const int height, const int bpp)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(cl->pool_max_size == 0) return NULL;
+  cl_mem mem = NULL;
+  dt_pthread_mutex_lock(&cl->pool_lock);
+  for(GList *l = cl->dev[devid].pool; l; l = g_list_next(l))
+  {
+    dt_opencl_pool_entry_t *e = (dt_opencl_pool_entry_t *)l->data;
+    if(e->width != width || e->height != height || e->bpp != bpp) continue;
+    cl->dev[devid].pool = g_list_delete_link(cl->dev[devid].pool, l);
+    cl->dev[devid].pool_size -= _opencl_pool_entry_size(e);
+    e->refs = 1;
+    g_hash_table_insert(cl->pool_used, e->mem, e);
+    mem = e->mem;
+    break;
+  }
+  if(mem) cl->dev[devid].pool_hits++;
+  else    cl->dev[devid].pool_misses++;
+  dt_pthread_mutex_unlock(&cl->pool_lock);
+  return mem;
+}
+
+// starts tracking a freshly allocated image.
+static void
+_opencl_pool_track(cl_mem mem, const int devid, const int width, const int height, const int bpp)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(cl->pool_max_size == 0) return;
+  dt_opencl_pool_entry_t *e = (dt_opencl_pool_entry_t *)malloc(sizeof(dt_opencl_pool_entry_t));
+  e->mem = mem;
+  e->devid = devid;
+  e->width = width;
+  e->height = height;
+  e->bpp = bpp;
+  e->refs = 1;
+  dt_pthread_mutex_lock(&cl->pool_lock);
+  g_hash_table_insert(cl->pool_used, mem, e);
+  dt_pthread_mutex_unlock(&cl->pool_lock);
+}
+
+// releases the idle images at the end of the list until the pool fits max_size.
+// needs the pool lock.
+static void
+_opencl_pool_shrink(const int devid, const size_t max_size)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  GList *l = g_list_last(cl->dev[devid].pool);
+  while(l && cl->dev[devid].pool_size > max_size)
+  {
+    GList *prev = g_list_previous(l);
+    dt_opencl_pool_entry_t *e = (dt_opencl_pool_entry_t *)l->data;
+    cl->dev[devid].pool_size -= _opencl_pool_entry_size(e);
+    _opencl_release(e->mem);
+    free(e);
+    cl->dev[devid].pool = g_list_delete_link(cl->dev[devid].pool, l);
+    l = prev;
+  }
+}
+
+static void
+_opencl_pool_flush(const int devid)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  dt_pthread_mutex_lock(&cl->pool_lock);
+  _opencl_pool_shrink(devid, 0);
+  dt_pthread_mutex_unlock(&cl->pool_lock);
+}
+
+static void
+_opencl_pool_statistics(const int devid, const char *tag)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!(darktable.unmuted & DT_DEBUG_OPENCL) || cl->pool_max_size == 0) return;
+  dt_pthread_mutex_lock(&cl->pool_lock);
+  const int hits = cl->dev[devid].pool_hits, total = hits + cl->dev[devid].pool_misses;
+  const size_t size = cl->dev[devid].pool_size;
+  dt_pthread_mutex_unlock(&cl->pool_lock);
+  if(total == 0) return;
+  dt_print(DT_DEBUG_OPENCL, "[%s] device '%s': memory pool served %d out of %d images (%.1f%%), %.1f MB idle\n", tag,
+           cl->dev[devid].name, hits, total, 100.0f*hits/total, size/(1024.0f*1024.0f));
+}
+
+void dt_opencl_retain_mem_object(void *mem)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if (!cl->inited) return;
+  dt_pthread_mutex_lock(&cl->pool_lock);
+  dt_opencl_pool_entry_t *e = (dt_opencl_pool_entry_t *)g_hash_table_lookup(cl->pool_used, mem);
+  if(e) e->refs++;
+  dt_pthread_mutex_unlock(&cl->pool_lock);
+  if(!e) (cl->dlocl->symbols->dt_clRetainMemObject)(mem);
+}
+
 void dt_opencl_release_mem_object(void *mem)
 {
-  if (!darktable.opencl->inited) return;
-  (darktable.opencl->dlocl->symbols->dt_clReleaseMemObject)(mem);
+  dt_opencl_t *cl = darktable.opencl;
+  if (!cl->inited) return;
+  dt_pthread_mutex_lock(&cl->pool_lock);
+  dt_opencl_pool_entry_t *e = (dt_opencl_pool_entry_t *)g_hash_table_lookup(cl->pool_used, mem);
+  if(e && --e->refs == 0)
+  {
+    // last user gone, back to the free list of its device:
+    g_hash_table_steal(cl->pool_used, mem);
+    const size_t size = _opencl_pool_entry_size(e);
+    if(size > cl->pool_max_size)
+    {
+      _opencl_release(mem);
+      free(e);
+    }
+    else
+    {
+      _opencl_pool_shrink(e->devid, cl->pool_max_size - size);
+      cl->dev[e->devid].pool = g_list_prepend(cl->dev[e->devid].pool, e);
+      cl->dev[e->devid].pool_size += size;
+    }
+  }
+  dt_pthread_mutex_unlock(&cl->pool_lock);
+  if(!e) _opencl_release(mem);
 }
 
 void* dt_opencl_map_buffer(const int devid, cl_mem buffer, const int blocking, const int flags, size_t offset, size_t size)
@@ -1406,12 +1982,30 @@ void* dt_opencl_alloc_device(const int devid, const int width, const int height,
   };
   else return NULL;
 
-  cl_mem dev = (darktable.opencl->dlocl->symbols->dt_clCreateImage2D) (darktable.opencl->dev[devid].context,
-               CL_MEM_READ_WRITE,
-               &fmt,
-               width, height, 0,
-               NULL, &err);
+  cl_mem dev = _opencl_pool_get(devid, width, height, bpp);
+  if(dev) return dev;
+
+  dev = (darktable.opencl->dlocl->symbols->dt_clCreateImage2D) (darktable.opencl->dev[devid].context,
+        CL_MEM_READ_WRITE,
+        &fmt,
+        width, height, 0,
+        NULL, &err);
+  if(err != CL_SUCCESS && darktable.opencl->dev[devid].pool)
+  {
+    // the idle images of the pool might be in the way, try again without them:
+    _opencl_pool_flush(devid);
+    dev = (darktable.opencl->dlocl->symbols->dt_clCreateImage2D) (darktable.opencl->dev[devid].context,
+          CL_MEM_READ_WRITE,
+          &fmt,
+          width, height, 0,
+          NULL, &err);
+  }
   if(err != CL_SUCCESS) dt_print(DT_DEBUG_OPENCL, "[opencl alloc_device] could not alloc img buffer on device %d: %d\n", devid, err);
+  else
+  {
+    _opencl_account(dev, 0);
+    _opencl_pool_track(dev, devid, width, height, bpp);
+  }
   return dev;
 }
 
@@ -1445,6 +2039,7 @@ void* dt_opencl_alloc_device_use_host_pointer(const int devid, const int width,
                width, height, rowpitch,
                host, &err);
   if(err != CL_SUCCESS) dt_print(DT_DEBUG_OPENCL, "[opencl alloc_device_use_host_pointer] could not alloc img buffer on device %d: %d\n", devid, err);
+  else _opencl_account(dev, 0);
   return dev;
 }
 
@@ -1459,6 +2054,7 @@ void* dt_opencl_alloc_device_buffer(const int devid, const int size)
                size,
                NULL, &err);
   if(err != CL_SUCCESS) dt_print(DT_DEBUG_OPENCL, "[opencl alloc_device_buffer] could not alloc buffer on device %d: %d\n", devid, err);
+  else _opencl_account(buf, 0);
   return buf;
 }
 
@@ -1472,6 +2068,7 @@ void* dt_opencl_alloc_device_buffer_with_flags(const int devid, const int size,
                size,
                NULL, &err);
   if(err != CL_SUCCESS) dt_print(DT_DEBUG_OPENCL, "[opencl alloc_device_buffer] could not alloc buffer on device %d: %d\n", devid, err);
+  else _opencl_account(buf, 0);
   return buf;
 }
 
@@ -1619,6 +2216,7 @@ cl_event *dt_opencl_events_get_slot(const int devid, const char *tag)
   {
     (*lostevents)++;
     (*totallost)++;
+    (*eventtags)[*numevents-1].bytes = 0;
     if (tag != NULL)
     {
       strncpy((*eventtags)[*numevents-1].tag, tag, DT_OPENCL_EVENTNAMELENGTH);
@@ -1662,6 +2260,7 @@ cl_event *dt_opencl_events_get_slot(const int devid, const char *tag)
   // init next event slot and return it
   (*numevents)++;
   memcpy((*eventlist)+*numevents-1, zeroevent, sizeof(cl_event));
+  (*eventtags)[*numevents-1].bytes = 0;
   if (tag != NULL)
   {
     strncpy((*eventtags)[*numevents-1].tag, tag, DT_OPENCL_EVENTNAMELENGTH);
@@ -1746,6 +2345,128 @@ void dt_opencl_events_wait_for(const int devid)
 }
 
 
+/** puts the newly terminated events first to last on the timeline. the device clock is not
+the host's, we assume the queue has just finished and place the last event at the current time. */
+static void _opencl_events_trace(const int devid, const int first, const int last)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  dt_opencl_eventtag_t *eventtags = cl->dev[devid].eventtags;
+  cl_ulong latest = 0;
+  for(int k = first; k < last; k++) latest = MAX(latest, eventtags[k].timeend);
+  if(!latest) return;
+  const double now = dt_get_wtime();
+  char track[128];
+  snprintf(track, sizeof(track), "opencl device %d: %s", devid, cl->dev[devid].name ? cl->dev[devid].name : "");
+  for(int k = first; k < last; k++)
+  {
+    if(!eventtags[k].timeend) continue;
+    const double end = now - (latest - eventtags[k].timeend) * 1e-9;
+    const double duration = eventtags[k].timelapsed * 1e-9;
+    dt_trace_complete_track("opencl", eventtags[k].tag[0] == '\0' ? "<?>" : eventtags[k].tag,
+                            end - duration, duration, devid, track);
+  }
+}
+
+/** remembers the bytes copied by the command of the event, for the statistics. */
+static void _opencl_events_bytes(const int devid, cl_event *eventp, const size_t bytes)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!eventp) return;
+  cl->dev[devid].eventtags[eventp - cl->dev[devid].eventlist].bytes = bytes;
+}
+
+static void _opencl_stats_add(const int devid, const char *tag, const double seconds, const size_t bytes)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  dt_pthread_mutex_lock(&cl->stats_lock);
+  if(!cl->dev[devid].stats) cl->dev[devid].stats = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free);
+  dt_opencl_kernel_stats_t *s = (dt_opencl_kernel_stats_t *)g_hash_table_lookup(cl->dev[devid].stats, tag);
+  if(!s)
+  {
+    s = (dt_opencl_kernel_stats_t *)malloc(sizeof(dt_opencl_kernel_stats_t));
+    memset(s, 0, sizeof(*s));
+    g_hash_table_insert(cl->dev[devid].stats, g_strdup(tag), s);
+  }
+  s->samples[s->count % DT_OPENCL_STATS_SAMPLES] = seconds;
+  s->count++;
+  s->total += seconds;
+  s->bytes += bytes;
+  dt_pthread_mutex_unlock(&cl->stats_lock);
+}
+
+static int _compare_float(const void *a, const void *b)
+{
+  const float fa = *(const float *)a, fb = *(const float *)b;
+  return (fa > fb) - (fa < fb);
+}
+
+void dt_opencl_kernel_statistics(const int devid, dt_opencl_kernel_stats_func_t func, void *data)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  if(!cl->inited || devid < 0 || devid >= cl->num_devs) return;
+  dt_pthread_mutex_lock(&cl->stats_lock);
+  if(cl->dev[devid].stats)
+  {
+    GHashTableIter it;
+    gpointer key, value;
+    g_hash_table_iter_init(&it, cl->dev[devid].stats);
+    while(g_hash_table_iter_next(&it, &key, &value))
+    {
+      const dt_opencl_kernel_stats_t *s = (const dt_opencl_kernel_stats_t *)value;
+      // quantiles over the recent runs only, nearest rank:
+      const int n = MIN(s->count, DT_OPENCL_STATS_SAMPLES);
+      float sorted[DT_OPENCL_STATS_SAMPLES];
+      memcpy(sorted, s->samples, sizeof(float)*n);
+      qsort(sorted, n, sizeof(float), _compare_float);
+      const double p50 = sorted[CLAMPS((int)(0.50f*n + 0.5f) - 1, 0, n-1)];
+      const double p95 = sorted[CLAMPS((int)(0.95f*n + 0.5f) - 1, 0, n-1)];
+      func((const char *)key, s->count, s->total, p50, p95, s->bytes, data);
+    }
+  }
+  dt_pthread_mutex_unlock(&cl->stats_lock);
+}
+
+typedef struct _opencl_stats_file_t
+{
+  FILE *f;
+  const char *device;
+  const char *driver;
+}
+_opencl_stats_file_t;
+
+static void _opencl_stats_write_line(const char *tag, const int count, const double total, const double p50,
+                                     const double p95, const uint64_t bytes, void *data)
+{
+  _opencl_stats_file_t *d = (_opencl_stats_file_t *)data;
+  fprintf(d->f, "%s\t%s\t%s\t%d\t%.3f\t%.4f\t%.4f\t%" PRIu64 "\n", d->device, d->driver, tag, count,
+          1e3*total, 1e3*p50, 1e3*p95, bytes);
+}
+
+/** writes the statistics of this session to opencl_statistics.txt in the cache dir, tab separated. */
+static void _opencl_stats_write(dt_opencl_t *cl)
+{
+  if(!cl->kernel_statistics) return;
+  char cachedir[DT_MAX_PATH_LEN], filename[DT_MAX_PATH_LEN];
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  snprintf(filename, sizeof(filename), "%s/opencl_statistics.txt", cachedir);
+  FILE *f = fopen(filename, "wb");
+  if(!f)
+  {
+    dt_print(DT_DEBUG_OPENCL, "[opencl_summary_statistics] could not write `%s'\n", filename);
+    return;
+  }
+  fprintf(f, "device\tdriver\tkernel\tcount\ttotal_ms\tp50_ms\tp95_ms\tbytes\n");
+  for(int i=0; i<cl->num_devs; i++)
+  {
+    char driver[256] = "";
+    (cl->dlocl->symbols->dt_clGetDeviceInfo)(cl->dev[i].devid, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+    _opencl_stats_file_t d = { f, cl->dev[i].cname, driver };
+    dt_opencl_kernel_statistics(i, _opencl_stats_write_line, &d);
+  }
+  fclose(f);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_summary_statistics] kernel statistics written to `%s'\n", filename);
+}
+
 /** Wait for events in eventlist to terminate, check for return status and profiling
 info of events.
 If "reset" is TRUE report summary info (would be CL_COMPLETE or last error code) and
@@ -1771,6 +2492,7 @@ cl_int dt_opencl_events_flush(const int devid, const int reset)
 
   // Wait for command queue to terminate (side effect: might adjust *numevents)
   dt_opencl_events_wait_for(devid);
+  const int first = *eventsconsolidated;
 
   // now check return status and profiling data of all newly terminated events
   for (int k = *eventsconsolidated; k < *numevents; k++)
@@ -1801,18 +2523,25 @@ cl_int dt_opencl_events_flush(const int devid, const int reset)
     if (errs == CL_SUCCESS && erre == CL_SUCCESS)
     {
       (*eventtags)[k].timelapsed = end - start;
+      (*eventtags)[k].timeend = end;
     }
     else
     {
       (*eventtags)[k].timelapsed = 0;
+      (*eventtags)[k].timeend = 0;
       (*lostevents)++;
     }
 
+    if(cl->kernel_statistics && errs == CL_SUCCESS && erre == CL_SUCCESS)
+      _opencl_stats_add(devid, tag[0] == '\0' ? "<?>" : tag, (*eventtags)[k].timelapsed * 1e-9, (*eventtags)[k].bytes);
+
     // finally release event to be re-used by driver
     (cl->dlocl->symbols->dt_clReleaseEvent)((*eventlist)[k]);
     (*eventsconsolidated)++;
   }
 
+  if(dt_trace_enabled()) _opencl_events_trace(devid, first, *eventsconsolidated);
+
   cl_int result = *summary;
 
   // do we want to get rid of all stored info?
@@ -22,6 +22,8 @@
 #include "config.h"
 #endif
 
+#include <stdint.h>
+
 #define DT_OPENCL_MAX_PLATFORMS 5
 #define DT_OPENCL_MAX_PROGRAMS 256
 #define DT_OPENCL_MAX_KERNELS 512
@@ -30,6 +32,10 @@
 #define DT_OPENCL_MAX_EVENTS 256
 #define DT_OPENCL_MAX_ERRORS 5
 
+/** callback of dt_opencl_kernel_statistics(). */
+typedef void (*dt_opencl_kernel_stats_func_t)(const char *tag, const int count, const double total, const double p50,
+                                              const double p95, const uint64_t bytes, void *data);
+
 #ifdef HAVE_OPENCL
 
 #include "common/darktable.h"
@@ -54,10 +60,27 @@ typedef struct dt_opencl_eventtag_t
 {
   cl_int retval;
   cl_ulong timelapsed;
+  cl_ulong timeend; // device clock, for the timeline
+  size_t bytes;     // copied between host and device
   char tag[DT_OPENCL_EVENTNAMELENGTH];
 }
 dt_opencl_eventtag_t;
 
+/** run times of the last DT_OPENCL_STATS_SAMPLES events are kept for the quantiles. */
+#define DT_OPENCL_STATS_SAMPLES 256
+
+/**
+ * rolling statistics of all events with the same tag (mostly kernel names) on one device.
+ */
+typedef struct dt_opencl_kernel_stats_t
+{
+  int count;
+  double total;    // seconds
+  uint64_t bytes;
+  float samples[DT_OPENCL_STATS_SAMPLES];
+}
+dt_opencl_kernel_stats_t;
+
 
 /**
  * to support multi-gpu and mixed systems with cpu support,
@@ -69,15 +92,27 @@ typedef struct dt_opencl_device_t
   cl_device_id devid;
   cl_context context;
   cl_command_queue cmd_queue;
+  // large devices have more than one command queue, each as an entry of its own after all the first ones.
+  // they share context and programs of the first, which is dev[physical], and have kernels of their own.
+  int physical;
+  int queue;
   size_t max_image_width;
   size_t max_image_height;
   cl_ulong max_mem_alloc;
-  cl_ulong max_global_mem;
+  cl_ulong max_global_mem;    // the share of this queue
   cl_ulong used_global_mem;
   cl_program program[DT_OPENCL_MAX_PROGRAMS];
   cl_kernel  kernel [DT_OPENCL_MAX_KERNELS];
   int program_used[DT_OPENCL_MAX_PROGRAMS];
   int kernel_used [DT_OPENCL_MAX_KERNELS];
+  // 1 once the program is built and its kernels are created, -1 if the build failed:
+  int program_ready[DT_OPENCL_MAX_PROGRAMS];
+  // programs waiting for the build thread of this device, in build order:
+  GList *build_queue;
+  pthread_t build_thread;
+  int build_started;
+  // tag -> dt_opencl_kernel_stats_t, if opencl_kernel_statistics is set:
+  GHashTable *stats;
   cl_event *eventlist;
   dt_opencl_eventtag_t *eventtags;
   int numevents;
@@ -92,10 +127,18 @@ typedef struct dt_opencl_device_t
   const char *name;
   const char *cname;
   cl_int summary;
+  // device and host share memory, images can live in host buffers without copies:
+  int host_memory;
+  // idle images of the memory pool, most recently released first, and their total size:
+  GList *pool;
+  size_t pool_size;
+  int pool_hits;
+  int pool_misses;
 }
 dt_opencl_device_t;
 
 struct dt_bilateral_cl_global_t;
+struct dt_opencl_placement_t;
 /**
  * main struct, stored in darktable.opencl.
  * holds pointers to all
@@ -109,7 +152,22 @@ typedef struct dt_opencl_t
   int async_pixelpipe;
   int number_event_handles;
   int synch_cache;
+  int gpu_cache;
   int micro_nap;
+  // kernels are created by the build threads, these remember what to create:
+  char *kernel_name[DT_OPENCL_MAX_KERNELS];
+  int kernel_program[DT_OPENCL_MAX_KERNELS];
+  // programs with kernels used outside of the modules, needed before a device can be handed out:
+  int program_core[DT_OPENCL_MAX_PROGRAMS];
+  // where dt_opencl_create_kernel() records the programs of a module, if set:
+  GList **record_programs;
+  int build_stop;
+  int kernel_statistics;
+  dt_pthread_mutex_t stats_lock;
+  size_t pool_max_size;
+  dt_pthread_mutex_t pool_lock;
+  // images handed out by the pool, cl_mem -> entry:
+  GHashTable *pool_used;
   int enabled;
   int stopped;
   int num_devs;
@@ -126,6 +184,18 @@ typedef struct dt_opencl_t
 
   // global kernels for gaussian filtering, to be reused by a few plugins.
   struct dt_gaussian_cl_global_t *gaussian;
+
+  // global kernels for box blurs, to be reused by a few plugins.
+  struct dt_box_mean_cl_global_t *box_mean;
+
+  // global kernels for the per module histograms of the pixelpipe.
+  struct dt_histogram_cl_global_t *histogram;
+
+  // kernels of the pixelpipe itself, like the packing of its output.
+  struct dt_dev_pixelpipe_cl_global_t *pixelpipe;
+
+  // measured speed of the cpu and opencl paths per module and device.
+  struct dt_opencl_placement_t *placement;
 }
 dt_opencl_t;
 
@@ -141,6 +211,12 @@ int dt_opencl_finish(const int devid);
 /** enqueues a synchronization point. */
 int dt_opencl_enqueue_barrier(const int devid);
 
+/** enqueues a marker for all commands so far and returns it, or NULL on failure. */
+void *dt_opencl_enqueue_marker(const int devid);
+
+/** waits for the commands before the marker to finish and releases it. returns TRUE on success. */
+int dt_opencl_wait_for_marker(const int devid, void *marker);
+
 /** parse a single token of priority string and store priorities in priority_list */
 void dt_opencl_priority_parse(char *configstr, int *priority_list);
 
@@ -159,9 +235,25 @@ int dt_opencl_load_program(const int dev, const int prog, const char *filename,
 /** builds the given program. */
 int dt_opencl_build_program(const int dev, const int prog, const char* binname, const char* cachedir, char* md5sum, int loaded_cached, const char* kerneldir);
 
-/** inits a kernel. returns the index or -1 if fail. */
+/** inits a kernel. returns the index or -1 if fail. the kernel can only be used once its program
+  * is built in the background, see dt_opencl_programs_ready(). */
 int dt_opencl_create_kernel(const int program, const char *name);
 
+/** records the programs of all kernels created from now on into the list, until called with NULL. */
+void dt_opencl_record_programs(GList **programs);
+
+/** true if all programs of the list are built for the device. if not, moves them to the front of
+  * its build queue, the caller should fall back to the cpu for now. */
+int dt_opencl_programs_ready(const int dev, GList *programs);
+
+/** blocks until all programs are built. for batch tools which don't want to start on the cpu. */
+void dt_opencl_wait_for_programs(void);
+
+/** calls func for each tag with events on the device so far, with the number of events, their total,
+  * median and 95th percentile time in seconds and the bytes copied between host and device. only
+  * collected if opencl_kernel_statistics is set. */
+void dt_opencl_kernel_statistics(const int devid, dt_opencl_kernel_stats_func_t func, void *data);
+
 /** releases kernel resources again. */
 void dt_opencl_free_kernel(const int kernel);
 
@@ -195,7 +287,12 @@ void dt_opencl_disable(void);
 /** update enabled flag with value from preferences */
 int dt_opencl_update_enabled(void);
 
-/** HAVE_OPENCL mode only: copy and alloc buffers. */
+/** true if images of the device should be allocated in the host buffers they belong to,
+  * with dt_opencl_alloc_device_use_host_pointer(). */
+int dt_opencl_use_host_memory(const int devid);
+
+/** HAVE_OPENCL mode only: copy and alloc buffers. if device is an image allocated in host, it is
+  * only mapped and unmapped to make the host buffer coherent. */
 int dt_opencl_copy_device_to_host(const int devid, void *host, void *device, const int width, const int height, const int bpp);
 
 int dt_opencl_read_host_from_device(const int devid, void *host, void *device, const int width, const int height, const int bpp);
@@ -244,6 +341,8 @@ void* dt_opencl_alloc_device_buffer(const int devid, const int size);
 
 void* dt_opencl_alloc_device_buffer_with_flags(const int devid, const int size, const int flags);
 
+void dt_opencl_retain_mem_object(void *mem);
+
 void dt_opencl_release_mem_object(void *mem);
 
 void* dt_opencl_map_buffer(const int devid, cl_mem buffer, const int blocking, const int flags, size_t offset, size_t size);
@@ -321,6 +420,17 @@ static inline int dt_opencl_create_kernel(const int program, const char *name)
   return -1;
 }
 static inline void dt_opencl_free_kernel(const int kernel) {}
+static inline void dt_opencl_record_programs(GList **programs) {}
+static inline int dt_opencl_programs_ready(const int dev, GList *programs)
+{
+  return 0;
+}
+static inline void dt_opencl_wait_for_programs(void) {}
+static inline int dt_opencl_use_host_memory(const int devid)
+{
+  return 0;
+}
+static inline void dt_opencl_kernel_statistics(const int devid, dt_opencl_kernel_stats_func_t func, void *data) {}
 static inline int  dt_opencl_get_max_work_item_sizes(const int dev, size_t *sizes)
 {
   return -1;
@@ -366,6 +476,7 @@ static inline int dt_opencl_get_max_global_mem(const int devid)
 {
   return 0;
 }
+static inline void dt_opencl_retain_mem_object(void *mem) {}
 static inline void dt_opencl_release_mem_object(void *mem) {}
 static inline void *dt_opencl_events_get_slot(const int devid, const char *tag)
 {
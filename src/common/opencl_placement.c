@@ -0,0 +1,237 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef HAVE_OPENCL
+
+#include "common/darktable.h"
+#include "common/file_location.h"
+#include "common/opencl_placement.h"
+#include "control/conf.h"
+#include "develop/pixelpipe.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define DT_OPENCL_PLACEMENT_VERSION 2
+
+typedef struct dt_opencl_placement_entry_t
+{
+  // fastest run so far of the cpu [0] and opencl [1] path, in seconds per megapixel:
+  float time[2];
+  int runs[2];
+}
+dt_opencl_placement_entry_t;
+
+typedef struct dt_opencl_placement_t
+{
+  dt_pthread_mutex_t lock;
+  int enabled;
+  // "canonical device name/op/pipe type/size bucket" -> entry
+  GHashTable *entries;
+}
+dt_opencl_placement_t;
+
+static void
+_placement_filename(char *filename, const size_t size)
+{
+  char cachedir[DT_MAX_PATH_LEN];
+  dt_loc_get_user_cache_dir(cachedir, sizeof(cachedir));
+  snprintf(filename, size, "%s/opencl_placement.txt", cachedir);
+}
+
+// buffers up to 0.25, 1, 4 and 16 megapixels, and larger ones:
+static int
+_placement_bucket(const double mpix)
+{
+  int bucket = 0;
+  for(double m = 0.25; mpix > m && bucket < 4; m *= 4.0) bucket++;
+  return bucket;
+}
+
+static gchar *
+_placement_key(const int devid, const char *op, const int pipetype, const double mpix)
+{
+  return g_strdup_printf("%s/%s/%d/%d", darktable.opencl->dev[devid].cname, op, pipetype, _placement_bucket(mpix));
+}
+
+// copies between host and device are kept like a module which only has a cpu path:
+#define DT_OPENCL_PLACEMENT_TRANSFER ":transfer"
+
+void dt_opencl_placement_init(dt_opencl_t *cl)
+{
+  dt_opencl_placement_t *p = (dt_opencl_placement_t *)malloc(sizeof(dt_opencl_placement_t));
+  dt_pthread_mutex_init(&p->lock, NULL);
+  p->enabled = dt_conf_get_bool("opencl_auto_placement");
+  p->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free);
+  cl->placement = p;
+
+  char filename[DT_MAX_PATH_LEN];
+  _placement_filename(filename, sizeof(filename));
+  FILE *f = fopen(filename, "rb");
+  if(!f) return;
+  int version = 0;
+  if(fscanf(f, "darktable opencl placement %d\n", &version) == 1 && version == DT_OPENCL_PLACEMENT_VERSION)
+  {
+    char key[512];
+    dt_opencl_placement_entry_t e;
+    while(fscanf(f, "%511s %f %f %d %d\n", key, e.time, e.time+1, e.runs, e.runs+1) == 5)
+    {
+      dt_opencl_placement_entry_t *entry = (dt_opencl_placement_entry_t *)malloc(sizeof(dt_opencl_placement_entry_t));
+      *entry = e;
+      g_hash_table_insert(p->entries, g_strdup(key), entry);
+    }
+  }
+  fclose(f);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_placement] read %d module timings from `%s'\n", g_hash_table_size(p->entries), filename);
+}
+
+void dt_opencl_placement_cleanup(dt_opencl_t *cl)
+{
+  dt_opencl_placement_t *p = cl->placement;
+  if(!p) return;
+  if(g_hash_table_size(p->entries) > 0)
+  {
+    char filename[DT_MAX_PATH_LEN];
+    _placement_filename(filename, sizeof(filename));
+    FILE *f = fopen(filename, "wb");
+    if(f)
+    {
+      fprintf(f, "darktable opencl placement %d\n", DT_OPENCL_PLACEMENT_VERSION);
+      GHashTableIter it;
+      gpointer key, value;
+      g_hash_table_iter_init(&it, p->entries);
+      while(g_hash_table_iter_next(&it, &key, &value))
+      {
+        const dt_opencl_placement_entry_t *e = (const dt_opencl_placement_entry_t *)value;
+        fprintf(f, "%s %g %g %d %d\n", (const char *)key, e->time[0], e->time[1], e->runs[0], e->runs[1]);
+      }
+      fclose(f);
+    }
+    else dt_print(DT_DEBUG_OPENCL, "[opencl_placement] could not write `%s'\n", filename);
+  }
+  g_hash_table_destroy(p->entries);
+  dt_pthread_mutex_destroy(&p->lock);
+  free(p);
+  cl->placement = NULL;
+}
+
+int dt_opencl_placement_use_cl(const int devid, const char *op, const int pipetype, const double mpix, int *calibrate)
+{
+  dt_opencl_placement_t *p = darktable.opencl->placement;
+  if(calibrate) *calibrate = 0;
+  if(!p || !p->enabled || devid < 0) return TRUE;
+
+  dt_opencl_placement_entry_t e = { { 0.0f, 0.0f }, { 0, 0 } };
+  dt_opencl_placement_entry_t t = { { 0.0f, 0.0f }, { 0, 0 } };
+  gchar *key = _placement_key(devid, op, pipetype, mpix);
+  gchar *tkey = _placement_key(devid, DT_OPENCL_PLACEMENT_TRANSFER, pipetype, mpix);
+  dt_pthread_mutex_lock(&p->lock);
+  const dt_opencl_placement_entry_t *entry = (const dt_opencl_placement_entry_t *)g_hash_table_lookup(p->entries, key);
+  if(entry) e = *entry;
+  entry = (const dt_opencl_placement_entry_t *)g_hash_table_lookup(p->entries, tkey);
+  if(entry) t = *entry;
+  dt_pthread_mutex_unlock(&p->lock);
+  g_free(key);
+  g_free(tkey);
+
+  // only the run itself is timed, the callers which just want to know where it will go stay on the device meanwhile:
+  if(e.runs[1] < DT_OPENCL_PLACEMENT_RUNS)
+  {
+    if(calibrate) *calibrate = 1;
+    return TRUE;
+  }
+  if(e.runs[0] < DT_OPENCL_PLACEMENT_RUNS)
+  {
+    if(calibrate) *calibrate = 1;
+    return !calibrate;
+  }
+  // on the cpu, the input comes back from the device and the output goes up again for the next module:
+  if(t.runs[0] > 0)
+    return !(e.time[0] + 2.0f * t.time[0] < DT_OPENCL_PLACEMENT_MARGIN * e.time[1]);
+  return !(e.time[0] < DT_OPENCL_PLACEMENT_COPY_MARGIN * DT_OPENCL_PLACEMENT_MARGIN * e.time[1]);
+}
+
+static void
+_placement_record(const int devid, const char *op, const int pipetype, const int cl, const double seconds,
+                  const double mpix)
+{
+  dt_opencl_placement_t *p = darktable.opencl->placement;
+  if(!p || devid < 0 || mpix <= 0.0) return;
+  const float time = seconds / mpix;
+  gchar *key = _placement_key(devid, op, pipetype, mpix);
+  dt_pthread_mutex_lock(&p->lock);
+  dt_opencl_placement_entry_t *e = (dt_opencl_placement_entry_t *)g_hash_table_lookup(p->entries, key);
+  if(!e)
+  {
+    e = (dt_opencl_placement_entry_t *)malloc(sizeof(dt_opencl_placement_entry_t));
+    memset(e, 0, sizeof(*e));
+    g_hash_table_insert(p->entries, key, e);
+    key = NULL;
+  }
+  // the fastest run is the one least disturbed by everything else going on:
+  e->time[cl] = e->runs[cl] ? MIN(e->time[cl], time) : time;
+  e->runs[cl]++;
+  if(e->runs[0] == DT_OPENCL_PLACEMENT_RUNS && e->runs[1] >= DT_OPENCL_PLACEMENT_RUNS && !cl)
+    dt_print(DT_DEBUG_OPENCL, "[opencl_placement] module `%s' on device %d, pipe type %d, %.1f MP: cpu %.2f ms/MP, opencl %.2f ms/MP\n",
+             op, devid, pipetype, mpix, 1e3f*e->time[0], 1e3f*e->time[1]);
+  dt_pthread_mutex_unlock(&p->lock);
+  g_free(key);
+}
+
+void dt_opencl_placement_record(const int devid, const char *op, const int pipetype, const int cl,
+                                const double seconds, const double mpix)
+{
+  _placement_record(devid, op, pipetype, cl, seconds, mpix);
+}
+
+void dt_opencl_placement_record_transfer(const int devid, const int pipetype, const double seconds, const double mpix,
+                                         const int bpp)
+{
+  // as if the pixels were four floats, like most module outputs:
+  _placement_record(devid, DT_OPENCL_PLACEMENT_TRANSFER, pipetype, 0, seconds * (4*sizeof(float)) / bpp, mpix);
+}
+
+float dt_opencl_placement_device_score(const int devid)
+{
+  dt_opencl_placement_t *p = darktable.opencl->placement;
+  if(!p || devid < 0) return -1.0f;
+  gchar *prefix = g_strdup_printf("%s/", darktable.opencl->dev[devid].cname);
+  const size_t len = strlen(prefix);
+  double sum = 0.0;
+  int cnt = 0;
+  dt_pthread_mutex_lock(&p->lock);
+  GHashTableIter it;
+  gpointer key, value;
+  g_hash_table_iter_init(&it, p->entries);
+  while(g_hash_table_iter_next(&it, &key, &value))
+  {
+    const dt_opencl_placement_entry_t *e = (const dt_opencl_placement_entry_t *)value;
+    if(strncmp((const char *)key, prefix, len) || e->runs[0] < DT_OPENCL_PLACEMENT_RUNS ||
+        e->runs[1] < DT_OPENCL_PLACEMENT_RUNS || e->time[0] <= 0.0f) continue;
+    sum += e->time[1] / e->time[0];
+    cnt++;
+  }
+  dt_pthread_mutex_unlock(&p->lock);
+  g_free(prefix);
+  return cnt ? sum / cnt : -1.0f;
+}
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
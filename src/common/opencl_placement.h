@@ -0,0 +1,79 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_COMMON_OPENCL_PLACEMENT_H
+#define DT_COMMON_OPENCL_PLACEMENT_H
+
+#include "common/opencl.h"
+
+// per module and device choice between the cpu and the opencl path.
+//
+// the first runs of a module are timed on both paths and the results are kept in the cache dir, per
+// canonical device name, pipe type and buffer size. launch latency dominates the small buffers of
+// previews and thumbnails, so their timings don't say much about a full size export. a module put on
+// the cpu between modules on the device also pays for copying its input back and its output up again,
+// which is measured along and added to the cpu time. the same numbers order the devices which are given
+// as `+' in opencl_device_priority.
+
+// timed runs per path before a decision is made:
+#define DT_OPENCL_PLACEMENT_RUNS 3
+// the cpu path has to be this much faster, timings are noisy:
+#define DT_OPENCL_PLACEMENT_MARGIN 0.9f
+// as long as the copies between host and device are not measured, this much more stands in for them:
+#define DT_OPENCL_PLACEMENT_COPY_MARGIN 0.8f
+
+#ifdef HAVE_OPENCL
+/** reads the timings of earlier sessions. */
+void dt_opencl_placement_init(dt_opencl_t *cl);
+
+/** writes the timings back and frees them. */
+void dt_opencl_placement_cleanup(dt_opencl_t *cl);
+
+/** true if the module should run its opencl path on the device, over an output of mpix megapixels in a
+  * pipe of pipetype. if calibrate is given, it's set for runs which should be timed and passed to
+  * dt_opencl_placement_record(). */
+int dt_opencl_placement_use_cl(const int devid, const char *op, const int pipetype, const double mpix, int *calibrate);
+
+/** adds the time of one run of the cpu (cl = 0) or opencl path over mpix megapixels. */
+void dt_opencl_placement_record(const int devid, const char *op, const int pipetype, const int cl,
+                                const double seconds, const double mpix);
+
+/** adds the time of copying mpix megapixels of bpp bytes each from the device to the host. */
+void dt_opencl_placement_record_transfer(const int devid, const int pipetype, const double seconds, const double mpix,
+                                         const int bpp);
+
+/** mean ratio of opencl to cpu time over all modules calibrated on the device, smaller is
+  * better. -1 if nothing is known yet. */
+float dt_opencl_placement_device_score(const int devid);
+#else
+static inline int dt_opencl_placement_use_cl(const int devid, const char *op, const int pipetype, const double mpix,
+                                             int *calibrate)
+{
+  if(calibrate) *calibrate = 0;
+  return 0;
+}
+static inline void dt_opencl_placement_record(const int devid, const char *op, const int pipetype, const int cl,
+                                              const double seconds, const double mpix) {}
+static inline void dt_opencl_placement_record_transfer(const int devid, const int pipetype, const double seconds,
+                                                       const double mpix, const int bpp) {}
+#endif
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,130 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/darktable.h"
+#include "common/database.h"
+#include "common/file_location.h"
+#include "common/plugin_manifest.h"
+
+#include <string.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+
+// bump to throw away all manifests written by older code
+#define DT_PLUGIN_MANIFEST_VERSION 1
+
+// identifies one build of the .so file
+static gchar *
+_plugin_manifest_stamp(const char *libname)
+{
+  struct stat statbuf;
+  if(g_stat(libname, &statbuf)) return NULL;
+  return g_strdup_printf("%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT, (gint64)statbuf.st_mtime, (gint64)statbuf.st_size);
+}
+
+static const char *
+_plugin_manifest_database()
+{
+  const char *path = dt_database_get_path(darktable.db);
+  // presets of an in-memory library are gone on every start
+  if(!path || !strcmp(path, ":memory:")) return NULL;
+  return path;
+}
+
+dt_plugin_manifest_t *
+dt_plugin_manifest_load(const char *kind)
+{
+  char cachedir[1024];
+  dt_loc_get_user_cache_dir(cachedir, 1024);
+
+  dt_plugin_manifest_t *m = (dt_plugin_manifest_t *)malloc(sizeof(dt_plugin_manifest_t));
+  m->keyfile = g_key_file_new();
+  m->filename = g_strdup_printf("%s/plugins-%s.manifest", cachedir, kind);
+  m->dirty = FALSE;
+
+  const char *database = _plugin_manifest_database();
+  gchar *db = NULL, *package = NULL;
+  if(g_key_file_load_from_file(m->keyfile, m->filename, G_KEY_FILE_NONE, NULL))
+  {
+    db = g_key_file_get_string(m->keyfile, "manifest", "database", NULL);
+    package = g_key_file_get_string(m->keyfile, "manifest", "darktable", NULL);
+  }
+  if(!database || dt_database_is_new(darktable.db) || !db || !package || strcmp(db, database) || strcmp(package, PACKAGE_VERSION)
+      || g_key_file_get_integer(m->keyfile, "manifest", "version", NULL) != DT_PLUGIN_MANIFEST_VERSION)
+  {
+    // start over, every plugin does its full registration once
+    g_key_file_free(m->keyfile);
+    m->keyfile = g_key_file_new();
+    g_key_file_set_integer(m->keyfile, "manifest", "version", DT_PLUGIN_MANIFEST_VERSION);
+    g_key_file_set_string(m->keyfile, "manifest", "darktable", PACKAGE_VERSION);
+    g_key_file_set_string(m->keyfile, "manifest", "database", database ? database : "");
+    m->dirty = (database != NULL);
+  }
+  g_free(db);
+  g_free(package);
+  return m;
+}
+
+gboolean
+dt_plugin_manifest_current(dt_plugin_manifest_t *m, const char *name, const char *libname, int version)
+{
+  if(!_plugin_manifest_database() || !g_key_file_has_group(m->keyfile, name)) return FALSE;
+  gchar *stamp = _plugin_manifest_stamp(libname);
+  gchar *recorded = g_key_file_get_string(m->keyfile, name, "stamp", NULL);
+  const gboolean current = stamp && recorded && !strcmp(stamp, recorded)
+                           && g_key_file_get_integer(m->keyfile, name, "version", NULL) == version;
+  g_free(stamp);
+  g_free(recorded);
+  return current;
+}
+
+void
+dt_plugin_manifest_set(dt_plugin_manifest_t *m, const char *name, const char *libname, int version)
+{
+  if(!_plugin_manifest_database()) return;
+  gchar *stamp = _plugin_manifest_stamp(libname);
+  if(!stamp) return;
+  g_key_file_set_integer(m->keyfile, name, "version", version);
+  g_key_file_set_string(m->keyfile, name, "stamp", stamp);
+  g_free(stamp);
+  m->dirty = TRUE;
+}
+
+void
+dt_plugin_manifest_save(dt_plugin_manifest_t *m)
+{
+  if(m->dirty)
+  {
+    gsize length;
+    gchar *data = g_key_file_to_data(m->keyfile, &length, NULL);
+    GError *error = NULL;
+    if(!g_file_set_contents(m->filename, data, length, &error))
+    {
+      fprintf(stderr, "[plugin_manifest] could not write `%s': %s\n", m->filename, error->message);
+      g_error_free(error);
+    }
+    g_free(data);
+  }
+  g_key_file_free(m->keyfile);
+  g_free(m->filename);
+  free(m);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,49 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_COMMON_PLUGIN_MANIFEST_H
+#define DT_COMMON_PLUGIN_MANIFEST_H
+
+#include <glib.h>
+
+// what we learnt about the plugins on the last start, kept in the user cache dir.
+// an entry is valid as long as the .so file, darktable and the library database
+// are the same, and lets the loaders skip the per-start registration work
+// (presets, legacy preset upgrades) of plugins which did not change.
+
+typedef struct dt_plugin_manifest_t
+{
+  GKeyFile *keyfile;
+  gchar *filename;
+  gboolean dirty;
+}
+dt_plugin_manifest_t;
+
+/** reads the manifest of one plugin class ("iop", "lib"), empty if there is none yet. */
+dt_plugin_manifest_t *dt_plugin_manifest_load(const char *kind);
+/** true if the plugin at libname is recorded with this version and unchanged since. */
+gboolean dt_plugin_manifest_current(dt_plugin_manifest_t *m, const char *name, const char *libname, int version);
+/** records the plugin at libname after it has been loaded and registered. */
+void dt_plugin_manifest_set(dt_plugin_manifest_t *m, const char *name, const char *libname, int version);
+/** writes the manifest back if it changed, and frees it. */
+void dt_plugin_manifest_save(dt_plugin_manifest_t *m);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
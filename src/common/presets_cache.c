@@ -0,0 +1,285 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/darktable.h"
+#include "common/database.h"
+#include "common/debug.h"
+#include "common/presets_cache.h"
+
+#include <math.h>
+#include <string.h>
+#include <sqlite3.h>
+
+static GStaticMutex _presets_cache_mutex = G_STATIC_MUTEX_INIT;
+static GHashTable *_presets_cache = NULL; // operation -> GPtrArray of dt_presets_cache_entry_t
+static GPtrArray *_presets_cache_all = NULL;
+// bumped by the triggers on every write to the presets table
+static volatile gint _presets_cache_changes = 0;
+static gint _presets_cache_loaded = -1;
+static gboolean _presets_cache_triggers = FALSE;
+
+static void _presets_cache_entry_free(gpointer data)
+{
+  dt_presets_cache_entry_t *e = (dt_presets_cache_entry_t *)data;
+  g_free(e->name);
+  g_free(e->operation);
+  g_free(e->multi_name);
+  g_free(e->op_params);
+  g_free(e->blendop_params);
+  g_free(e->model);
+  g_free(e->maker);
+  g_free(e->lens);
+  g_free(e);
+}
+
+static void _presets_cache_changed(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+  __sync_fetch_and_add(&_presets_cache_changes, 1);
+  sqlite3_result_null(context);
+}
+
+// call with the mutex locked. the temp triggers only see this connection, the writer thread's
+// one never touches presets.
+static gboolean _presets_cache_create_triggers()
+{
+  if(_presets_cache_triggers) return TRUE;
+  sqlite3 *db = dt_database_get(darktable.db);
+  sqlite3_create_function(db, "dt_presets_changed", 0, SQLITE_UTF8, NULL, _presets_cache_changed, NULL, NULL);
+  const char *events[3] = { "insert", "update", "delete" };
+  for(int k = 0; k < 3; k++)
+  {
+    char query[256];
+    snprintf(query, sizeof(query), "create temp trigger if not exists presets_cache_%s after %s on presets "
+             "begin select dt_presets_changed(); end", events[k], events[k]);
+    // fails as long as there is no presets table yet
+    if(sqlite3_exec(db, query, NULL, NULL, NULL) != SQLITE_OK) return FALSE;
+  }
+  _presets_cache_triggers = TRUE;
+  return TRUE;
+}
+
+static void _presets_cache_clear()
+{
+  if(!_presets_cache) return;
+  g_hash_table_destroy(_presets_cache);
+  g_ptr_array_free(_presets_cache_all, TRUE);
+  _presets_cache = NULL;
+  _presets_cache_all = NULL;
+}
+
+static char *_presets_cache_column_text(sqlite3_stmt *stmt, int col)
+{
+  if(sqlite3_column_type(stmt, col) == SQLITE_NULL) return NULL;
+  return g_strdup((const char *)sqlite3_column_text(stmt, col));
+}
+
+static double _presets_cache_column_double(sqlite3_stmt *stmt, int col)
+{
+  if(sqlite3_column_type(stmt, col) == SQLITE_NULL) return NAN;
+  return sqlite3_column_double(stmt, col);
+}
+
+// call with the mutex locked. reads the table again if it changed since the last time.
+static void _presets_cache_load()
+{
+  if(!_presets_cache_create_triggers())
+  {
+    _presets_cache_clear();
+    return;
+  }
+  const gint changes = g_atomic_int_get(&_presets_cache_changes);
+  if(_presets_cache && changes == _presets_cache_loaded) return;
+  _presets_cache_clear();
+
+  _presets_cache = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)g_ptr_array_unref);
+  _presets_cache_all = g_ptr_array_new_with_free_func(_presets_cache_entry_free);
+
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select rowid, name, operation, op_version, op_params, enabled, blendop_params, "
+                              "blendop_version, multi_priority, multi_name, model, maker, lens, iso_min, iso_max, "
+                              "exposure_min, exposure_max, aperture_min, aperture_max, focal_length_min, "
+                              "focal_length_max, writeprotect, autoapply, isldr from presets "
+                              "order by writeprotect desc, rowid", -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    if(sqlite3_column_type(stmt, 2) == SQLITE_NULL) continue;
+    dt_presets_cache_entry_t *e = (dt_presets_cache_entry_t *)g_malloc0(sizeof(dt_presets_cache_entry_t));
+    e->rowid = sqlite3_column_int64(stmt, 0);
+    e->name = _presets_cache_column_text(stmt, 1);
+    e->operation = _presets_cache_column_text(stmt, 2);
+    e->op_version = sqlite3_column_int(stmt, 3);
+    e->op_params_size = sqlite3_column_bytes(stmt, 4);
+    e->op_params = g_memdup(sqlite3_column_blob(stmt, 4), e->op_params_size);
+    e->enabled = sqlite3_column_int(stmt, 5);
+    e->blendop_params_size = sqlite3_column_bytes(stmt, 6);
+    e->blendop_params = g_memdup(sqlite3_column_blob(stmt, 6), e->blendop_params_size);
+    e->blendop_version = sqlite3_column_int(stmt, 7);
+    e->multi_priority = sqlite3_column_int(stmt, 8);
+    e->multi_name = _presets_cache_column_text(stmt, 9);
+    e->model = _presets_cache_column_text(stmt, 10);
+    e->maker = _presets_cache_column_text(stmt, 11);
+    e->lens = _presets_cache_column_text(stmt, 12);
+    e->iso_min = _presets_cache_column_double(stmt, 13);
+    e->iso_max = _presets_cache_column_double(stmt, 14);
+    e->exposure_min = _presets_cache_column_double(stmt, 15);
+    e->exposure_max = _presets_cache_column_double(stmt, 16);
+    e->aperture_min = _presets_cache_column_double(stmt, 17);
+    e->aperture_max = _presets_cache_column_double(stmt, 18);
+    e->focal_length_min = _presets_cache_column_double(stmt, 19);
+    e->focal_length_max = _presets_cache_column_double(stmt, 20);
+    e->writeprotect = sqlite3_column_int(stmt, 21);
+    e->autoapply = sqlite3_column_int(stmt, 22);
+    // null never equals anything in (isldr = 0 or isldr = ?)
+    e->isldr = sqlite3_column_type(stmt, 23) == SQLITE_NULL ? -1 : sqlite3_column_int(stmt, 23);
+
+    g_ptr_array_add(_presets_cache_all, e);
+    GPtrArray *op = (GPtrArray *)g_hash_table_lookup(_presets_cache, e->operation);
+    if(!op)
+    {
+      op = g_ptr_array_new();
+      g_hash_table_insert(_presets_cache, e->operation, op);
+    }
+    g_ptr_array_add(op, e);
+  }
+  sqlite3_finalize(stmt);
+  _presets_cache_loaded = changes;
+  dt_print(DT_DEBUG_SQL, "[presets_cache] loaded %d presets\n", _presets_cache_all->len);
+}
+
+// sql's `value like pattern': % and _ wildcards, ascii case insensitive, no escapes.
+static gboolean _presets_cache_like(const char *pattern, const char *value)
+{
+  if(!pattern) return FALSE;
+  while(*pattern)
+  {
+    if(*pattern == '%')
+    {
+      while(*pattern == '%') pattern++;
+      if(!*pattern) return TRUE;
+      for(; *value; value = g_utf8_next_char(value))
+        if(_presets_cache_like(pattern, value)) return TRUE;
+      return FALSE;
+    }
+    if(!*value) return FALSE;
+    if(*pattern == '_')
+    {
+      pattern++;
+      value = g_utf8_next_char(value);
+      continue;
+    }
+    if(g_ascii_tolower(*pattern) != g_ascii_tolower(*value)) return FALSE;
+    pattern++;
+    value++;
+  }
+  return !*value;
+}
+
+static inline gboolean _presets_cache_between(const double value, const double min, const double max)
+{
+  return value >= min && value <= max;
+}
+
+static gboolean _presets_cache_matches(const dt_presets_cache_entry_t *e, const dt_image_t *img,
+                                       const dt_presets_cache_match_t match, const int isldr)
+{
+  if((match & DT_PRESETS_CACHE_MATCH_AUTOAPPLY) && e->autoapply != 1) return FALSE;
+  if(e->isldr != 0 && e->isldr != isldr) return FALSE;
+  if(!(match & DT_PRESETS_CACHE_MATCH_ANY_ISO)
+      && !_presets_cache_between(fmaxf(0.0f, fminf(1000000, img->exif_iso)), e->iso_min, e->iso_max))
+    return FALSE;
+  if(!_presets_cache_between(fmaxf(0.0f, fminf(1000000, img->exif_exposure)), e->exposure_min, e->exposure_max)
+      || !_presets_cache_between(fmaxf(0.0f, fminf(1000000, img->exif_aperture)), e->aperture_min, e->aperture_max)
+      || !_presets_cache_between(fmaxf(0.0f, fminf(1000000, img->exif_focal_length)), e->focal_length_min,
+                                 e->focal_length_max))
+    return FALSE;
+  return _presets_cache_like(e->model, img->exif_model) && _presets_cache_like(e->maker, img->exif_maker)
+         && _presets_cache_like(e->lens, img->exif_lens);
+}
+
+static glong _presets_cache_length(const char *s)
+{
+  return s ? g_utf8_strlen(s, -1) : 0;
+}
+
+// least specific first, like `order by length(model), length(maker), length(lens)'
+static gint _presets_cache_cmp_specific(gconstpointer a, gconstpointer b)
+{
+  const dt_presets_cache_entry_t *ea = *(const dt_presets_cache_entry_t **)a;
+  const dt_presets_cache_entry_t *eb = *(const dt_presets_cache_entry_t **)b;
+  glong d = _presets_cache_length(ea->model) - _presets_cache_length(eb->model);
+  if(!d) d = _presets_cache_length(ea->maker) - _presets_cache_length(eb->maker);
+  if(!d) d = _presets_cache_length(ea->lens) - _presets_cache_length(eb->lens);
+  if(!d) return ea->rowid < eb->rowid ? -1 : ea->rowid > eb->rowid;
+  return d < 0 ? -1 : 1;
+}
+
+static gint _presets_cache_cmp_autoapply(gconstpointer a, gconstpointer b)
+{
+  const dt_presets_cache_entry_t *ea = *(const dt_presets_cache_entry_t **)a;
+  const dt_presets_cache_entry_t *eb = *(const dt_presets_cache_entry_t **)b;
+  if(ea->writeprotect != eb->writeprotect) return eb->writeprotect - ea->writeprotect;
+  return _presets_cache_cmp_specific(a, b);
+}
+
+void dt_presets_cache_foreach(const char *operation, dt_presets_cache_func_t *func, void *data)
+{
+  g_static_mutex_lock(&_presets_cache_mutex);
+  _presets_cache_load();
+  GPtrArray *op = _presets_cache ? (GPtrArray *)g_hash_table_lookup(_presets_cache, operation) : NULL;
+  if(op)
+    for(guint k = 0; k < op->len; k++) func((const dt_presets_cache_entry_t *)g_ptr_array_index(op, k), data);
+  g_static_mutex_unlock(&_presets_cache_mutex);
+}
+
+void dt_presets_cache_foreach_match(const char *operation, const dt_image_t *img, dt_presets_cache_match_t match,
+                                    dt_presets_cache_func_t *func, void *data)
+{
+  g_static_mutex_lock(&_presets_cache_mutex);
+  _presets_cache_load();
+  GPtrArray *presets = NULL;
+  if(_presets_cache)
+    presets = operation ? (GPtrArray *)g_hash_table_lookup(_presets_cache, operation) : _presets_cache_all;
+  if(presets)
+  {
+    // 0: dontcare, 1: ldr, 2: raw
+    const int isldr = 2 - dt_image_is_ldr(img);
+    GPtrArray *matches = g_ptr_array_new();
+    for(guint k = 0; k < presets->len; k++)
+    {
+      dt_presets_cache_entry_t *e = (dt_presets_cache_entry_t *)g_ptr_array_index(presets, k);
+      if(_presets_cache_matches(e, img, match, isldr)) g_ptr_array_add(matches, e);
+    }
+    g_ptr_array_sort(matches, (match & DT_PRESETS_CACHE_MATCH_AUTOAPPLY) ? _presets_cache_cmp_autoapply
+                     : _presets_cache_cmp_specific);
+    for(guint k = 0; k < matches->len; k++) func((const dt_presets_cache_entry_t *)g_ptr_array_index(matches, k), data);
+    g_ptr_array_free(matches, TRUE);
+  }
+  g_static_mutex_unlock(&_presets_cache_mutex);
+}
+
+void dt_presets_cache_cleanup()
+{
+  g_static_mutex_lock(&_presets_cache_mutex);
+  _presets_cache_clear();
+  g_static_mutex_unlock(&_presets_cache_mutex);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,72 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_COMMON_PRESETS_CACHE_H
+#define DT_COMMON_PRESETS_CACHE_H
+
+#include "common/image.h"
+
+#include <glib.h>
+#include <inttypes.h>
+
+// in-memory copy of the presets table, indexed by operation. it is reloaded lazily
+// after anything wrote to the table (temp triggers on the main connection tell us),
+// so the callers which run for every image don't have to go through sql.
+
+typedef struct dt_presets_cache_entry_t
+{
+  int64_t rowid;
+  char *name, *operation, *multi_name;
+  int32_t op_version, blendop_version, multi_priority;
+  void *op_params, *blendop_params;
+  int32_t op_params_size, blendop_params_size;
+  int enabled, writeprotect, autoapply, isldr;
+  // sql like patterns, NULL matches nothing
+  char *model, *maker, *lens;
+  // NAN if not set, matches nothing
+  double iso_min, iso_max, exposure_min, exposure_max;
+  double aperture_min, aperture_max, focal_length_min, focal_length_max;
+}
+dt_presets_cache_entry_t;
+
+typedef enum dt_presets_cache_match_t
+{
+  DT_PRESETS_CACHE_MATCH_ALL = 0,
+  // only presets with autoapply set, write protected ones first
+  DT_PRESETS_CACHE_MATCH_AUTOAPPLY = 1 << 0,
+  // don't filter by iso, for interpolating between presets
+  DT_PRESETS_CACHE_MATCH_ANY_ISO = 1 << 1
+}
+dt_presets_cache_match_t;
+
+/** called with the cache locked, must not write to the presets table. */
+typedef void (dt_presets_cache_func_t)(const dt_presets_cache_entry_t *preset, void *data);
+
+/** calls func for all presets of operation, write protected ones first, then by rowid. */
+void dt_presets_cache_foreach(const char *operation, dt_presets_cache_func_t *func, void *data);
+/** calls func for the presets of operation (all operations if NULL) whose maker, model, lens,
+    exposure settings and ldr flag match img, ordered like the old sql: least specific first. */
+void dt_presets_cache_foreach_match(const char *operation, const dt_image_t *img, dt_presets_cache_match_t match,
+                                    dt_presets_cache_func_t *func, void *data);
+/** frees the cache, on shutdown. */
+void dt_presets_cache_cleanup();
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -15,28 +15,322 @@
     You should have received a copy of the GNU General Public License
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
-
 #include "common/profiling.h"
+#include "common/dtpthread.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// scopes deeper than this are not timed:
+#define DT_PROFILING_DEPTH 32
+// records per thread before they are summed up:
+#define DT_PROFILING_RING 1024
+// nodes of the call tree, further ones are not timed:
+#define DT_PROFILING_NODES 4096
+#define DT_PROFILING_SLOTS (2*DT_PROFILING_NODES)
+
+/* one scope at one place of the call tree. node 0 is the root. */
+typedef struct dt_profiling_node_t
+{
+  uint32_t parent;
+  const char *file, *function;
+  char *description;
+  uint64_t count, total, self, min, max;  // times in ns
+}
+dt_profiling_node_t;
+
+typedef struct dt_profiling_record_t
+{
+  uint32_t node;
+  uint64_t total, self;
+}
+dt_profiling_record_t;
 
-dt_timer_t *dt_timer_start_with_name (const char *file,const char *function,const char *description)
+typedef struct dt_profiling_thread_t
 {
-  dt_timer_t *t=g_malloc (sizeof(dt_timer_t));
-  t->file = file;
-  t->function = function;
-  t->timer = g_timer_new ();
-  t->description = description;
+  int depth;
+  struct
+  {
+    uint32_t node;
+    uint64_t start, children;
+  }
+  stack[DT_PROFILING_DEPTH];
+  // written by the thread at head, summed up under the lock from tail:
+  dt_profiling_record_t ring[DT_PROFILING_RING];
+  volatile uint32_t head, tail;
+  struct dt_profiling_thread_t *next;
+}
+dt_profiling_thread_t;
+
+static dt_profiling_node_t _nodes[DT_PROFILING_NODES];
+static volatile uint32_t _num_nodes = 1;
+// open addressing on (parent, file, function, description), node+1 or 0 if free:
+static volatile uint32_t _slots[DT_PROFILING_SLOTS];
+static dt_pthread_mutex_t _lock;
+static pthread_key_t _thread_key;
+static pthread_once_t _once = PTHREAD_ONCE_INIT;
+static dt_profiling_thread_t *_threads = NULL;
+static volatile sig_atomic_t _report_requested = 0;
+
+static inline uint64_t _now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// sums up the records of a thread. needs the lock.
+static void _flush(dt_profiling_thread_t *t)
+{
+  const uint32_t head = t->head;
+  __sync_synchronize();
+  for(uint32_t i = t->tail; i != head; i++)
+  {
+    const dt_profiling_record_t *r = t->ring + i % DT_PROFILING_RING;
+    dt_profiling_node_t *n = _nodes + r->node;
+    if(!n->count || r->total < n->min) n->min = r->total;
+    if(r->total > n->max) n->max = r->total;
+    n->count++;
+    n->total += r->total;
+    n->self += r->self;
+  }
+  t->tail = head;
+}
+
+static void _thread_free(void *data)
+{
+  dt_profiling_thread_t *t = (dt_profiling_thread_t *)data;
+  dt_pthread_mutex_lock(&_lock);
+  _flush(t);
+  for(dt_profiling_thread_t **p = &_threads; *p; p = &(*p)->next)
+    if(*p == t)
+    {
+      *p = t->next;
+      break;
+    }
+  dt_pthread_mutex_unlock(&_lock);
+  free(t);
+}
+
+static void _init_once()
+{
+  dt_pthread_mutex_init(&_lock, NULL);
+  pthread_key_create(&_thread_key, _thread_free);
+  memset(_nodes, 0, sizeof(_nodes));
+  _nodes[0].description = "";
+}
+
+static dt_profiling_thread_t *_thread()
+{
+  pthread_once(&_once, _init_once);
+  dt_profiling_thread_t *t = (dt_profiling_thread_t *)pthread_getspecific(_thread_key);
+  if(t) return t;
+  t = (dt_profiling_thread_t *)calloc(1, sizeof(dt_profiling_thread_t));
+  if(!t) return NULL;
+  pthread_setspecific(_thread_key, t);
+  dt_pthread_mutex_lock(&_lock);
+  t->next = _threads;
+  _threads = t;
+  dt_pthread_mutex_unlock(&_lock);
   return t;
 }
 
-void dt_timer_stop_with_name (dt_timer_t *t)
+static inline int _node_is(const dt_profiling_node_t *n, const uint32_t parent, const char *file,
+                           const char *function, const char *description)
+{
+  return n->parent == parent && n->file == file && n->function == function && !strcmp(n->description, description);
+}
+
+// the node of the scope below parent, created if new. only creation takes the lock.
+static uint32_t _node(const uint32_t parent, const char *file, const char *function, const char *description)
+{
+  // bernstein hash (djb2):
+  uint64_t hash = 5381 + parent;
+  hash = ((hash << 5) + hash) ^ (uintptr_t)file;
+  hash = ((hash << 5) + hash) ^ (uintptr_t)function;
+  for(const char *c = description; *c; c++) hash = ((hash << 5) + hash) ^ *c;
+
+  uint32_t i = hash % DT_PROFILING_SLOTS;
+  for(; _slots[i]; i = (i + 1) % DT_PROFILING_SLOTS)
+    if(_node_is(_nodes + _slots[i] - 1, parent, file, function, description)) return _slots[i] - 1;
+
+  dt_pthread_mutex_lock(&_lock);
+  // someone else may have been faster:
+  for(; _slots[i]; i = (i + 1) % DT_PROFILING_SLOTS)
+    if(_node_is(_nodes + _slots[i] - 1, parent, file, function, description)) break;
+  uint32_t n = 0;
+  if(_slots[i])
+    n = _slots[i] - 1;
+  else if(_num_nodes < DT_PROFILING_NODES)
+  {
+    n = _num_nodes++;
+    _nodes[n].parent = parent;
+    _nodes[n].file = file;
+    _nodes[n].function = function;
+    _nodes[n].description = strdup(description);
+    __sync_synchronize();
+    _slots[i] = n + 1;
+  }
+  dt_pthread_mutex_unlock(&_lock);
+  return n;
+}
+
+int dt_profiling_enter(const char *file, const char *function, const char *description)
 {
-  g_assert ( t != NULL );
-  g_timer_stop (t->timer);
-  gulong ms=0;
-  fprintf (stderr,"Timer %s in function %s took %.3f seconds to execute.\n",t->description,t->function,g_timer_elapsed (t->timer,&ms));
-  g_timer_destroy (t->timer);
-  g_free (t);
+  dt_profiling_thread_t *t = _thread();
+  if(!t) return DT_PROFILING_DEPTH;
+  const int depth = t->depth++;
+  if(depth >= DT_PROFILING_DEPTH) return depth;
+  const uint32_t parent = depth ? t->stack[depth - 1].node : 0;
+  // below a scope which isn't timed nothing is:
+  t->stack[depth].node = (depth && !parent) ? 0 : _node(parent, file, function, description ? description : "");
+  t->stack[depth].children = 0;
+  t->stack[depth].start = _now();
+  return depth;
 }
+
+void dt_profiling_leave(const int depth)
+{
+  dt_profiling_thread_t *t = (dt_profiling_thread_t *)pthread_getspecific(_thread_key);
+  if(!t || depth >= t->depth) return;
+  t->depth = depth;
+  if(depth >= DT_PROFILING_DEPTH || !t->stack[depth].node) return;
+  const uint64_t total = _now() - t->stack[depth].start;
+  if(depth) t->stack[depth - 1].children += total;
+  if(t->head - t->tail >= DT_PROFILING_RING)
+  {
+    dt_pthread_mutex_lock(&_lock);
+    _flush(t);
+    dt_pthread_mutex_unlock(&_lock);
+  }
+  const uint64_t children = t->stack[depth].children;
+  t->ring[t->head % DT_PROFILING_RING] = (dt_profiling_record_t){ t->stack[depth].node, total,
+                                                                   children < total ? total - children : 0 };
+  __sync_synchronize();
+  t->head++;
+
+  // asked for by the signal handler, which can't do it itself:
+  if(_report_requested && __sync_bool_compare_and_swap(&_report_requested, 1, 0)) dt_profiling_report(stderr);
+}
+
+static void _signal_handler(int signum)
+{
+  _report_requested = 1;
+}
+
+void dt_profiling_init()
+{
+  pthread_once(&_once, _init_once);
+  signal(SIGUSR1, _signal_handler);
+}
+
+void dt_profiling_cleanup()
+{
+  dt_profiling_report(stderr);
+}
+
+static int _sort_total(const void *a, const void *b)
+{
+  const uint64_t ta = _nodes[*(const uint32_t *)a].total, tb = _nodes[*(const uint32_t *)b].total;
+  return (ta < tb) - (ta > tb);
+}
+
+static void _print_line(FILE *f, const uint64_t total, const uint64_t self, const uint64_t count, const uint64_t min,
+                        const uint64_t max, const int indent, const char *file, const char *function,
+                        const char *description)
+{
+  const char *base = strrchr(file, '/');
+  fprintf(f, "%10.3f %10.3f %8" PRIu64 " %9.3f %9.3f %9.3f  %*s%s:%s %s\n", total * 1e-6, self * 1e-6, count,
+          count ? total * 1e-6 / count : 0.0, min * 1e-6, max * 1e-6, 2 * indent, "", base ? base + 1 : file,
+          function, description);
+}
+
+static void _print_tree(FILE *f, const uint32_t parent, const int indent, uint32_t *order, const uint32_t num)
+{
+  // the children of the children go after these:
+  uint32_t cnt = 0;
+  for(uint32_t n = 1; n < num; n++)
+    if(_nodes[n].parent == parent && _nodes[n].count) order[cnt++] = n;
+  qsort(order, cnt, sizeof(uint32_t), _sort_total);
+  for(uint32_t k = 0; k < cnt; k++)
+  {
+    const dt_profiling_node_t *n = _nodes + order[k];
+    _print_line(f, n->total, n->self, n->count, n->min, n->max, indent, n->file, n->function, n->description);
+    _print_tree(f, order[k], indent + 1, order + cnt, num);
+  }
+}
+
+// true if an enclosing scope of n is at the same place, its time is counted there already.
+static int _recursive(const uint32_t n)
+{
+  for(uint32_t p = _nodes[n].parent; p; p = _nodes[p].parent)
+    if(_nodes[p].file == _nodes[n].file && _nodes[p].function == _nodes[n].function
+       && !strcmp(_nodes[p].description, _nodes[n].description))
+      return 1;
+  return 0;
+}
+
+void dt_profiling_report(FILE *f)
+{
+  pthread_once(&_once, _init_once);
+  dt_pthread_mutex_lock(&_lock);
+  for(dt_profiling_thread_t *t = _threads; t; t = t->next) _flush(t);
+  const uint32_t num = _num_nodes;
+
+  fprintf(f, "[profiling] call tree, times in ms:\n");
+  fprintf(f, "%10s %10s %8s %9s %9s %9s  %s\n", "total", "self", "calls", "avg", "min", "max", "scope");
+  // the sorted children of all levels:
+  uint32_t *order = (uint32_t *)malloc(sizeof(uint32_t) * num);
+  if(order) _print_tree(f, 0, 0, order, num);
+
+  // the same summed up by place, whichever scope was around it:
+  fprintf(f, "[profiling] by file, function and description, times in ms:\n");
+  fprintf(f, "%10s %10s %8s %9s %9s %9s  %s\n", "total", "self", "calls", "avg", "min", "max", "scope");
+  dt_profiling_node_t *sum = (dt_profiling_node_t *)calloc(num, sizeof(dt_profiling_node_t));
+  uint32_t num_sum = 0;
+  for(uint32_t n = 1; sum && order && n < num; n++)
+  {
+    const dt_profiling_node_t *node = _nodes + n;
+    if(!node->count) continue;
+    uint32_t s = 0;
+    for(; s < num_sum; s++)
+      if(sum[s].file == node->file && sum[s].function == node->function
+         && !strcmp(sum[s].description, node->description))
+        break;
+    if(s == num_sum)
+    {
+      sum[num_sum++] = (dt_profiling_node_t){ 0, node->file, node->function, node->description, 0, 0, 0,
+                                              node->min, node->max };
+    }
+    if(!_recursive(n)) sum[s].total += node->total;
+    sum[s].self += node->self;
+    sum[s].count += node->count;
+    sum[s].min = node->min < sum[s].min ? node->min : sum[s].min;
+    sum[s].max = node->max > sum[s].max ? node->max : sum[s].max;
+  }
+  dt_pthread_mutex_unlock(&_lock);
+
+  // by self time, where the time actually goes:
+  for(uint32_t k = 0; k < num_sum; k++)
+  {
+    uint32_t best = k;
+    for(uint32_t j = k + 1; j < num_sum; j++)
+      if(sum[j].self > sum[best].self) best = j;
+    const dt_profiling_node_t tmp = sum[k];
+    sum[k] = sum[best];
+    sum[best] = tmp;
+    _print_line(f, sum[k].total, sum[k].self, sum[k].count, sum[k].min, sum[k].max, 0, sum[k].file,
+                sum[k].function, sum[k].description);
+  }
+  free(sum);
+  free(order);
+  fflush(f);
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
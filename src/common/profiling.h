@@ -19,33 +19,42 @@
 #ifndef __PROFILING_H
 #define __PROFILING_H
 
-#include "gui/gtk.h"
-
-
-#ifdef USE_DARKTABLE_PROFILING
-#define TIMER_START(name,description) dt_timer_t * name = dt_timer_start_with_name(__FILE__,__FUNCTION__,description)
-#else
-#define TIMER_START(name,description) {}
-#endif
+#include <stdio.h>
+
+/**
+ * hierarchical profiler, compiled in with -DUSE_DARKTABLE_PROFILING=ON and to nothing otherwise.
+ *
+ * TIMER_START(name, description) opens a scope in the calling thread, TIMER_STOP(name) closes it.
+ * scopes nest: the time of a scope is accounted under the scope open around it in the same thread,
+ * which makes a call tree of file, function and description. closing a scope only writes a record
+ * into a ring buffer of the thread, the records are summed up in the tree when that is full, the
+ * thread ends or a report is asked for. a scope left open (an early return) is closed together with
+ * the one around it, its time is dropped.
+ *
+ * the report goes to stderr when darktable quits, and whenever it gets SIGUSR1.
+ */
 
 #ifdef USE_DARKTABLE_PROFILING
-#define TIMER_STOP(name) dt_timer_stop_with_name(name)
+#define TIMER_START(name,description) const int name = dt_profiling_enter(__FILE__,__FUNCTION__,description)
+#define TIMER_STOP(name) dt_profiling_leave(name)
+
+/** installs the signal handler. scopes may be used before already. */
+void dt_profiling_init();
+/** prints the report. */
+void dt_profiling_cleanup();
+/** prints the call tree and the time per file, function and description to f. */
+void dt_profiling_report(FILE *f);
+
+/** opens a scope, returns its depth. description is copied, the other strings have to be static. */
+int dt_profiling_enter(const char *file, const char *function, const char *description);
+/** closes the scope at depth, and any left open inside it. */
+void dt_profiling_leave(const int depth);
 #else
-#define TIMER_STOP(name) {}
-#endif
-
-#ifdef USE_DARKTABLE_PROFILING
-typedef struct dt_timer_t
-{
-  const char *file;
-  const char *function;
-  const char *description;
-  GTimer *timer;
-}
-dt_timer_t;
-
-dt_timer_t *dt_timer_start_with_name(const char *file,const char *function,const char *description);
-void dt_timer_stop_with_name(dt_timer_t *);
+#define TIMER_START(name,description) ((void)0)
+#define TIMER_STOP(name) ((void)0)
+#define dt_profiling_init() ((void)0)
+#define dt_profiling_cleanup() ((void)0)
+#define dt_profiling_report(f) ((void)0)
 #endif
 
 #endif
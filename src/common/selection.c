@@ -53,6 +53,26 @@ void _selection_update_collection(gpointer instance, gpointer user_data)
   dt_collection_update (selection->collection);
 }
 
+/* updates the hint message whenever the selection changed */
+static void _selection_changed(gpointer instance, gpointer user_data)
+{
+  dt_collection_hint_message(darktable.collection);
+}
+
+/* raises the selection changed signal once, if the statements since the last call changed anything */
+static void _selection_raise_changed(int changes)
+{
+  if(changes > 0)
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_SELECTION_CHANGED);
+}
+
+/* runs a set-based statement on the selection and returns the number of rows it changed */
+static int _selection_exec(const char *query)
+{
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query, NULL, NULL, NULL);
+  return sqlite3_changes(dt_database_get(darktable.db));
+}
+
 const dt_selection_t * dt_selection_new()
 {
   dt_selection_t *s = g_malloc(sizeof(dt_selection_t));
@@ -69,6 +89,11 @@ const dt_selection_t * dt_selection_new()
                             G_CALLBACK(_selection_update_collection),
                             (gpointer) s);
 
+  /* keep the hint message up to date with the selection */
+  dt_control_signal_connect(darktable.signals,
+                            DT_SIGNAL_SELECTION_CHANGED,
+                            G_CALLBACK(_selection_changed),
+                            NULL);
 
   return s;
 }
@@ -80,192 +105,130 @@ void dt_selection_free (dt_selection_t *selection)
 
 void dt_selection_invert(dt_selection_t *selection)
 {
-  gchar *fullq = NULL;
+  int changes = 0;
 
   if (!selection->collection)
     return;
 
-  fullq = dt_util_dstrcat(fullq, "%s", "insert or ignore into selected_images ");
-  fullq = dt_util_dstrcat(fullq, "%s", dt_collection_get_query(selection->collection));
-
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
-                        "insert into memory.tmp_selection select imgid from selected_images",
-                        NULL, NULL, NULL);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
-                        "delete from selected_images",
-                        NULL, NULL, NULL);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), fullq,
-                        NULL, NULL, NULL);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
-                        "delete from selected_images where imgid in (select imgid from memory.tmp_selection)",
-                        NULL, NULL, NULL);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
-                        "delete from memory.tmp_selection",
-                        NULL, NULL, NULL);
+  /* the collected images not selected yet become the new selection */
+  dt_collection_update_ids(darktable.collection);
+  _selection_exec("delete from memory.tmp_selection");
+  _selection_exec("insert into memory.tmp_selection select imgid from memory.collected_images "
+                  "where imgid not in (select imgid from selected_images)");
+  changes += _selection_exec("delete from selected_images");
+  changes += _selection_exec("insert or ignore into selected_images select imgid from memory.tmp_selection");
+  _selection_exec("delete from memory.tmp_selection");
 
-  g_free(fullq);
+  selection->last_single_id = -1;
 
-  /* update hint message */
-  dt_collection_hint_message(darktable.collection);
+  _selection_raise_changed(changes);
 }
 
 void dt_selection_clear(const dt_selection_t *selection)
 {
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "delete from selected_images", NULL, NULL, NULL);
-
-  /* update hint message */
-  dt_collection_hint_message(darktable.collection);
+  _selection_raise_changed(_selection_exec("delete from selected_images"));
 }
 
 void dt_selection_select_single(dt_selection_t *selection, uint32_t imgid)
 {
-  gchar *query = NULL;
   selection->last_single_id = imgid;
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "delete from selected_images", NULL, NULL, NULL);
+  int changes = _selection_exec("delete from selected_images");
 
   if (imgid != -1)
   {
-    query = dt_util_dstrcat(query,"insert or ignore into selected_images values(%d)", imgid);
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query, NULL, NULL, NULL);
-    g_free(query);
+    sqlite3_stmt *stmt = dt_database_prepare_cached(darktable.db, "insert or ignore into selected_images values(?1)");
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+    sqlite3_step(stmt);
+    changes += sqlite3_changes(dt_database_get(darktable.db));
+    dt_database_release_cached(darktable.db, stmt);
   }
 
-  /* update hint message */
-  dt_collection_hint_message(darktable.collection);
+  _selection_raise_changed(changes);
 }
 
 void dt_selection_toggle(dt_selection_t *selection, uint32_t imgid)
 {
-  gchar *query = NULL;
   sqlite3_stmt *stmt;
   gboolean exists = FALSE;
 
   if (imgid == -1) return;
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "select imgid from selected_images where imgid=?1",-1,&stmt,NULL);
+  stmt = dt_database_prepare_cached(darktable.db, "select imgid from selected_images where imgid=?1");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
 
   if(sqlite3_step(stmt) == SQLITE_ROW)
     exists = TRUE;
 
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   if (exists)
   {
     selection->last_single_id = -1;
-    query = dt_util_dstrcat(query,"delete from selected_images where imgid = %d", imgid);
+    stmt = dt_database_prepare_cached(darktable.db, "delete from selected_images where imgid = ?1");
   }
   else
   {
     selection->last_single_id = imgid;
-    query = dt_util_dstrcat(query,"insert or ignore into selected_images values(%d)", imgid);
+    stmt = dt_database_prepare_cached(darktable.db, "insert or ignore into selected_images values(?1)");
   }
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
-  sqlite3_exec(dt_database_get(darktable.db), query, NULL, NULL, NULL);
-
-  g_free(query);
-
-  /* update hint message */
-  dt_collection_hint_message(darktable.collection);
+  _selection_raise_changed(1);
 }
 
 void dt_selection_select_all(dt_selection_t *selection)
 {
-  gchar *fullq = NULL;
+  int changes = 0;
 
   if (!selection->collection)
     return;
 
-  fullq = dt_util_dstrcat(fullq, "%s", "insert or ignore into selected_images ");
-  fullq = dt_util_dstrcat(fullq, "%s", dt_collection_get_query(selection->collection));
-
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "delete from selected_images", NULL, NULL, NULL);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), fullq, NULL, NULL, NULL);
+  dt_collection_update_ids(darktable.collection);
+  changes += _selection_exec("delete from selected_images where imgid not in "
+                             "(select imgid from memory.collected_images)");
+  changes += _selection_exec("insert or ignore into selected_images select imgid from memory.collected_images");
 
   selection->last_single_id = -1;
 
-  g_free(fullq);
-
-  /* update hint message */
-  dt_collection_hint_message(darktable.collection);
+  _selection_raise_changed(changes);
 }
 
 void dt_selection_select_range(dt_selection_t *selection, uint32_t imgid)
 {
-  gchar *fullq = NULL;
   sqlite3_stmt *stmt;
   if (!selection->collection || selection->last_single_id == -1)
     return;
 
-  /* get start and end rows for range selection */
-  int rc=0;
-  uint32_t sr=-1,er=-1;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              dt_collection_get_query(selection->collection), -1, &stmt, NULL);
-
-  while(sqlite3_step(stmt)==SQLITE_ROW)
-  {
-    int id = sqlite3_column_int(stmt, 0);
-    if (id == selection->last_single_id)
-      sr = rc;
-
-    if (id == imgid)
-      er = rc;
-
-    if (sr != -1 && er != -1 )
-      break;
-
-    rc++;
-  }
-
-  sqlite3_finalize(stmt);
-
-  /* select the images in range from start to end */
-  uint32_t old_flags = dt_collection_get_query_flags(selection->collection);
-
-  /* use the limit to select range of images */
-  dt_collection_set_query_flags(selection->collection,
-                                (old_flags |COLLECTION_QUERY_USE_LIMIT));
-
-  dt_collection_update(selection->collection);
-
-  fullq = dt_util_dstrcat(fullq, "%s", "insert or ignore into selected_images ");
-  fullq = dt_util_dstrcat(fullq, "%s", dt_collection_get_query(selection->collection));
-
+  /* everything between the positions of both ends in the collection order, in one go */
+  dt_collection_update_ids(darktable.collection);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              fullq, -1, &stmt, NULL);
-
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, MIN(sr,er));
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, (MAX(sr,er)-MIN(sr,er))+1);
-
+                              "insert or ignore into selected_images select imgid from memory.collected_images "
+                              "where rowid between "
+                              "(select min(rowid) from memory.collected_images where imgid in (?1, ?2)) and "
+                              "(select max(rowid) from memory.collected_images where imgid in (?1, ?2))",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, selection->last_single_id);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
   sqlite3_step(stmt);
+  const int changes = sqlite3_changes(dt_database_get(darktable.db));
+  sqlite3_finalize(stmt);
 
-  /* reset filter */
-  dt_collection_set_query_flags(selection->collection,
-                                old_flags);
-  dt_collection_update(selection->collection);
   selection->last_single_id = -1;
+
+  _selection_raise_changed(changes);
 }
 
 void dt_selection_select_filmroll(dt_selection_t *selection)
 {
-  // clear at start, too, just to be sure:
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
-                        "delete from memory.tmp_selection", NULL, NULL, NULL);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
-                        "insert into memory.tmp_selection select imgid from selected_images",
-                        NULL, NULL, NULL);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
-                        "delete from selected_images", NULL, NULL, NULL);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
-                        "insert or ignore into selected_images select id from images where film_id in "
-                        "(select film_id from images as a join memory.tmp_selection as "
-                        "b on a.id = b.imgid)",
-                        NULL, NULL, NULL);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
-                        "delete from memory.tmp_selection", NULL, NULL, NULL);
+  /* selected_images is only read in the subquery, so the insert can work on it directly */
+  const int changes = _selection_exec("insert or ignore into selected_images select id from images where film_id in "
+                                      "(select distinct film_id from images as a join selected_images as "
+                                      "b on a.id = b.imgid)");
   selection->last_single_id = -1;
+
+  _selection_raise_changed(changes);
 }
 
 void dt_selection_select_unaltered(dt_selection_t *selection)
@@ -300,6 +263,8 @@ void dt_selection_select_unaltered(dt_selection_t *selection)
   g_free(fullq);
 
   selection->last_single_id = -1;
+
+  _selection_raise_changed(1);
 }
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -27,6 +27,8 @@
 #include "common/tags.h"
 #include "common/debug.h"
 #include "common/exif.h"
+#include "common/mipmap_cache.h"
+#include "develop/pixelpipe.h"
 
 #include <libxml/encoding.h>
 #include <libxml/xmlwriter.h>
@@ -35,6 +37,7 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
 #include <glib.h>
 
 typedef struct
@@ -370,23 +373,88 @@ dt_styles_create_from_image (const char *name,const char *description,int32_t im
   return FALSE;
 }
 
+/* appends the items of style id to the history of imgid or a duplicate of it, returns the changed image */
+static int32_t
+_styles_apply_to_image_db(const char *name, int id, gboolean duplicate, int32_t imgid)
+{
+  sqlite3_stmt *stmt;
+  int32_t newimgid;
+
+  /* check if we should make a duplicate before applying style */
+  if (duplicate)
+  {
+    newimgid = dt_image_duplicate (imgid);
+    if(newimgid == -1) return -1;
+    dt_history_copy_and_paste_on_image(imgid, newimgid, FALSE, NULL);
+  }
+  else
+    newimgid = imgid;
+
+  /* merge onto history stack, let's find history offest in destination image */
+  int32_t offs = 0;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT MAX(num)+1 FROM history WHERE imgid = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newimgid);
+  if (sqlite3_step (stmt) == SQLITE_ROW) offs = sqlite3_column_int (stmt, 0);
+  sqlite3_finalize (stmt);
+
+  /* copy history items from styles onto image */
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "insert into history (imgid,num,module,operation,op_params,enabled,blendop_params,blendop_version,multi_priority,multi_name) select ?1, num+?2,module,operation,op_params,enabled,blendop_params,blendop_version,multi_priority,multi_name from style_items where styleid=?3", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newimgid);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, offs);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, id);
+  sqlite3_step (stmt);
+  sqlite3_finalize (stmt);
+
+  /* add tag */
+  guint tagid=0;
+  gchar ntag[512]= {0};
+  g_snprintf(ntag,512,"darktable|style|%s",name);
+  if (dt_tag_new(ntag,&tagid))
+    dt_tag_attach(tagid,newimgid);
+
+  return newimgid;
+}
+
 void
 dt_styles_apply_to_selection(const char *name,gboolean duplicate)
 {
-  gboolean selected = FALSE;
-  /* for each selected image apply style */
+  GList *imgs = NULL, *changed = NULL;
+  int id = 0;
+  /* collect the selected images first, duplicates get added to the selection */
   sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select * from selected_images", -1, &stmt, NULL);
   while(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    int imgid = sqlite3_column_int (stmt, 0);
-    dt_styles_apply_to_image (name,duplicate,imgid);
-    selected = TRUE;
-  }
+    imgs = g_list_prepend(imgs, GINT_TO_POINTER(sqlite3_column_int (stmt, 0)));
   sqlite3_finalize(stmt);
 
-  if (!selected)
+  if (!imgs)
+  {
     dt_control_log(_("no image selected!"));
+    return;
+  }
+
+  if ((id=dt_styles_get_id_by_name(name)) != 0)
+  {
+    /* for each selected image apply style, all in one transaction */
+    dt_image_cache_write_batch_begin(darktable.image_cache);
+    dt_database_write_sync(darktable.db);
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "begin", NULL, NULL, NULL);
+    for(GList *l = imgs; l; l = g_list_next(l))
+    {
+      const int32_t newimgid = _styles_apply_to_image_db(name, id, duplicate, GPOINTER_TO_INT(l->data));
+      if(newimgid != -1) changed = g_list_prepend(changed, GINT_TO_POINTER(newimgid));
+    }
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "commit", NULL, NULL, NULL);
+
+    dt_history_images_changed(changed);
+    dt_image_cache_write_batch_end(darktable.image_cache);
+
+    /* redraw center view to update visible mipmaps */
+    dt_control_queue_redraw_center();
+  }
+
+  g_list_free(changed);
+  g_list_free(imgs);
 }
 
 void
@@ -412,54 +480,15 @@ void
 dt_styles_apply_to_image(const char *name,gboolean duplicate, int32_t imgid)
 {
   int id=0;
-  sqlite3_stmt *stmt;
-  int32_t newimgid;
 
   if ((id=dt_styles_get_id_by_name(name)) != 0)
   {
-    /* check if we should make a duplicate before applying style */
-    if (duplicate)
-    {
-      newimgid = dt_image_duplicate (imgid);
-      if(newimgid != -1) dt_history_copy_and_paste_on_image(imgid, newimgid, FALSE, NULL);
-    }
-    else
-      newimgid = imgid;
-
-    /* merge onto history stack, let's find history offest in destination image */
-    int32_t offs = 0;
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT MAX(num)+1 FROM history WHERE imgid = ?1", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newimgid);
-    if (sqlite3_step (stmt) == SQLITE_ROW) offs = sqlite3_column_int (stmt, 0);
-    sqlite3_finalize (stmt);
-
-    /* copy history items from styles onto image */
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "insert into history (imgid,num,module,operation,op_params,enabled,blendop_params,blendop_version,multi_priority,multi_name) select ?1, num+?2,module,operation,op_params,enabled,blendop_params,blendop_version,multi_priority,multi_name from style_items where styleid=?3", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newimgid);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, offs);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, id);
-    sqlite3_step (stmt);
-    sqlite3_finalize (stmt);
+    const int32_t newimgid = _styles_apply_to_image_db(name, id, duplicate, imgid);
+    if(newimgid == -1) return;
 
-    /* add tag */
-    guint tagid=0;
-    gchar ntag[512]= {0};
-    g_snprintf(ntag,512,"darktable|style|%s",name);
-    if (dt_tag_new(ntag,&tagid))
-      dt_tag_attach(tagid,newimgid);
-
-    /* if current image in develop reload history */
-    if (dt_dev_is_current_image(darktable.develop, newimgid))
-    {
-      dt_dev_reload_history_items (darktable.develop);
-      dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
-    }
-
-    /* update xmp file */
-    dt_image_synch_xmp(newimgid);
-
-    /* remove old obsolete thumbnails */
-    dt_mipmap_cache_remove(darktable.mipmap_cache, newimgid);
+    GList *imgs = g_list_prepend(NULL, GINT_TO_POINTER(newimgid));
+    dt_history_images_changed(imgs);
+    g_list_free(imgs);
 
     /* redraw center view to update visible mipmaps */
     dt_control_queue_redraw_center();
@@ -1051,6 +1080,266 @@ dt_style_t *dt_styles_get_by_name (const char *name)
     return NULL;
   }
 }
+int dt_styles_apply_to_dev(const char *name, dt_develop_t *dev)
+{
+  GList *items = dt_styles_get_item_list(name, TRUE, -1);
+  if(!items) return 1;
+
+  for(GList *l = items; l; l = g_list_next(l))
+  {
+    dt_style_item_t *s = (dt_style_item_t *)l->data;
+    dt_dev_history_item_t *h = NULL;
+    for(GList *modules = dev->iop; modules; modules = g_list_next(modules))
+    {
+      dt_iop_module_t *m = (dt_iop_module_t *)modules->data;
+      if(strcmp(m->op, s->name)) continue;
+      // the history item takes over the params:
+      h = malloc(sizeof(dt_dev_history_item_t));
+      h->params = s->params;
+      h->blend_params = s->blendop_params;
+      h->enabled = 1;
+      h->module = m;
+      h->multi_priority = 1;
+      strcpy(h->multi_name, "");
+      dev->history_end++;
+      dev->history = g_list_append(dev->history, h);
+      break;
+    }
+    if(!h)
+    {
+      free(s->params);
+      free(s->blendop_params);
+    }
+    g_free(s->name);
+    g_free(s);
+  }
+  g_list_free(items);
+  return 0;
+}
+
+// style previews, enough for a popup full of styles:
+#define DT_STYLES_PREVIEW_ENTRIES 64
+
+typedef struct dt_styles_preview_entry_t
+{
+  uint64_t key;      // 0 if unused
+  GdkPixbuf *pixbuf;
+  uint32_t used;     // last use, the oldest entry is replaced
+}
+dt_styles_preview_entry_t;
+
+G_LOCK_DEFINE_STATIC(styles_preview);
+static dt_styles_preview_entry_t _preview[DT_STYLES_PREVIEW_ENTRIES];
+static uint32_t _preview_clock = 0;
+
+// bernstein hash (djb2) of all columns of all rows of stmt, which is finalized.
+static uint64_t _styles_preview_hash_rows(uint64_t hash, sqlite3_stmt *stmt)
+{
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    for(int c = 0; c < sqlite3_column_count(stmt); c++)
+    {
+      const unsigned char *str = (const unsigned char *)sqlite3_column_blob(stmt, c);
+      const int len = sqlite3_column_bytes(stmt, c);
+      for(int i = 0; i < len; i++) hash = ((hash << 5) + hash) ^ str[i];
+      hash = ((hash << 5) + hash) ^ len;
+    }
+  sqlite3_finalize(stmt);
+  return hash;
+}
+
+// the preview changes with the history of the image and the items of the style. 0 if there is no such style.
+static uint64_t _styles_preview_key(const char *name, const int32_t imgid, const int size)
+{
+  const int id = dt_styles_get_id_by_name(name);
+  if(!id) return 0;
+  sqlite3_stmt *stmt;
+  uint64_t hash = 5381;
+  hash = ((hash << 5) + hash) ^ imgid;
+  hash = ((hash << 5) + hash) ^ size;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select operation, op_params, enabled, blendop_params, multi_priority from history "
+                              "where imgid = ?1 order by num", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  hash = _styles_preview_hash_rows(hash, stmt);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select operation, op_params, enabled, blendop_params, multi_priority from style_items "
+                              "where styleid = ?1 order by num", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+  hash = _styles_preview_hash_rows(hash, stmt);
+  return hash ? hash : 1;
+}
+
+static GdkPixbuf *_styles_preview_get(const uint64_t key)
+{
+  GdkPixbuf *pixbuf = NULL;
+  G_LOCK(styles_preview);
+  for(int k = 0; k < DT_STYLES_PREVIEW_ENTRIES; k++)
+    if(_preview[k].key == key)
+    {
+      _preview[k].used = ++_preview_clock;
+      pixbuf = g_object_ref(_preview[k].pixbuf);
+      break;
+    }
+  G_UNLOCK(styles_preview);
+  return pixbuf;
+}
+
+static void _styles_preview_put(const uint64_t key, GdkPixbuf *pixbuf)
+{
+  G_LOCK(styles_preview);
+  dt_styles_preview_entry_t *victim = _preview;
+  for(int k = 0; k < DT_STYLES_PREVIEW_ENTRIES; k++)
+  {
+    // rendered twice at the same time:
+    if(_preview[k].key == key)
+    {
+      victim = _preview + k;
+      break;
+    }
+    if(_preview[k].used < victim->used) victim = _preview + k;
+  }
+  if(victim->pixbuf) g_object_unref(victim->pixbuf);
+  victim->key = key;
+  victim->pixbuf = g_object_ref(pixbuf);
+  victim->used = ++_preview_clock;
+  G_UNLOCK(styles_preview);
+}
+
+// renders the style on top of the history of imgid in a thumbnail pipe, from the downscaled input of the preview pipe.
+static GdkPixbuf *_styles_preview_render(const char *name, const int32_t imgid, const int size)
+{
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_F, DT_MIPMAP_BLOCKING);
+  if(!buf.buf)
+  {
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    return NULL;
+  }
+  dt_develop_t dev;
+  dt_dev_init(&dev, 0);
+  dt_dev_load_image(&dev, imgid);
+
+  GdkPixbuf *pixbuf = NULL;
+  dt_dev_pixelpipe_t pipe;
+  if(!dt_styles_apply_to_dev(name, &dev) && dt_dev_pixelpipe_init_thumbnail(&pipe, buf.width, buf.height))
+  {
+    dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, 1.0);
+    dt_dev_pixelpipe_create_nodes(&pipe, &dev);
+    dt_dev_pixelpipe_synch_all(&pipe, &dev);
+    dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width, &pipe.processed_height);
+    const double scale = fmin(fmin(size/(double)pipe.processed_width, size/(double)pipe.processed_height), 1.0);
+    const int wd = MAX(1, scale*pipe.processed_width + .5);
+    const int ht = MAX(1, scale*pipe.processed_height + .5);
+    if(!dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, wd, ht, scale) && pipe.backbuf)
+    {
+      pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, wd, ht);
+      const int stride = gdk_pixbuf_get_rowstride(pixbuf);
+      guchar *out = gdk_pixbuf_get_pixels(pixbuf);
+      // the pipe writes bgra for cairo:
+      for(int j = 0; j < ht; j++)
+        for(int i = 0; i < wd; i++)
+        {
+          const uint8_t *in = pipe.backbuf + 4*((size_t)wd*j + i);
+          guchar *o = out + (size_t)stride*j + 3*i;
+          o[0] = in[2];
+          o[1] = in[1];
+          o[2] = in[0];
+        }
+    }
+    dt_dev_pixelpipe_cleanup(&pipe);
+  }
+  dt_dev_cleanup(&dev);
+  dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+  return pixbuf;
+}
+
+GdkPixbuf *dt_styles_preview(const char *name, int32_t imgid, int size)
+{
+  const uint64_t key = _styles_preview_key(name, imgid, size);
+  if(!key) return NULL;
+  GdkPixbuf *pixbuf = _styles_preview_get(key);
+  if(pixbuf) return pixbuf;
+  pixbuf = _styles_preview_render(name, imgid, size);
+  if(pixbuf) _styles_preview_put(key, pixbuf);
+  return pixbuf;
+}
+
+typedef struct dt_styles_preview_job_t
+{
+  int32_t imgid;
+  int32_t size;
+}
+dt_styles_preview_job_t;
+
+static int32_t _styles_preview_job_run(dt_job_t *job)
+{
+  const dt_styles_preview_job_t *t = (const dt_styles_preview_job_t *)job->param;
+  // the styles which are not cached yet, looked up before the threads fight over the database:
+  GList *styles = dt_styles_get_list("");
+  const int num = g_list_length(styles);
+  gchar **names = (gchar **)calloc(num, sizeof(gchar *));
+  uint64_t *keys = (uint64_t *)calloc(num, sizeof(uint64_t));
+  int missing = 0;
+  for(GList *l = styles; l; l = g_list_next(l))
+  {
+    dt_style_t *style = (dt_style_t *)l->data;
+    const uint64_t key = _styles_preview_key(style->name, t->imgid, t->size);
+    GdkPixbuf *cached = key ? _styles_preview_get(key) : NULL;
+    if(key && !cached)
+    {
+      names[missing] = style->name;
+      keys[missing++] = key;
+    }
+    else g_free(style->name);
+    if(cached) g_object_unref(cached);
+    g_free(style->description);
+    g_free(style);
+  }
+  g_list_free(styles);
+
+  // the pipes are small, one per thread leased to this job:
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) default(none) shared(names, keys, missing, t, job)
+#endif
+  for(int k = 0; k < missing; k++)
+  {
+    if(dt_control_job_get_state(job) == DT_JOB_STATE_CANCELLED) continue;
+    GdkPixbuf *pixbuf = _styles_preview_render(names[k], t->imgid, t->size);
+    if(!pixbuf) continue;
+    _styles_preview_put(keys[k], pixbuf);
+    g_object_unref(pixbuf);
+  }
+  dt_print(DT_DEBUG_PERF, "[styles_preview] rendered %d of %d styles for image %d\n", missing, num, t->imgid);
+
+  for(int k = 0; k < missing; k++) g_free(names[k]);
+  free(names);
+  free(keys);
+  return 0;
+}
+
+void dt_styles_preview_prefetch(int32_t imgid, int size)
+{
+  dt_job_t job;
+  dt_control_job_init(&job, "render style previews of %d", imgid);
+  job.execute = &_styles_preview_job_run;
+  dt_styles_preview_job_t *t = (dt_styles_preview_job_t *)job.param;
+  t->imgid = imgid;
+  t->size = size;
+  dt_control_add_job(darktable.control, &job);
+}
+
+void dt_styles_preview_cleanup()
+{
+  G_LOCK(styles_preview);
+  for(int k = 0; k < DT_STYLES_PREVIEW_ENTRIES; k++)
+  {
+    if(_preview[k].pixbuf) g_object_unref(_preview[k].pixbuf);
+    _preview[k].pixbuf = NULL;
+    _preview[k].key = 0;
+  }
+  G_UNLOCK(styles_preview);
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -25,6 +25,7 @@
 
 #include <sqlite3.h>
 #include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
 #include <inttypes.h>
 
 /** The definition of styles are copied historystack to
@@ -93,6 +94,21 @@ void dt_styles_save_to_file(const char *style_name,const char *filedir,gboolean
 /** load style from file */
 void dt_styles_import_from_file(const char *style_path);
 
+/** adds the items of the style to the history of dev, without touching the database. returns 1 if there is no such style. */
+int dt_styles_apply_to_dev(const char *name, struct dt_develop_t *dev);
+
+/** edge of the style previews in tooltips and dialogs */
+#define DT_STYLES_PREVIEW_SIZE 256
+
+/** the style applied on top of the history of imgid, at most size pixels wide and high. rendered from the
+    DT_MIPMAP_F buffer in a thumbnail pipe and cached per history of the image and items of the style.
+    NULL if that fails, else a reference the caller has to drop. */
+GdkPixbuf *dt_styles_preview(const char *name, int32_t imgid, int size);
+/** renders the previews of all styles for imgid in a background job, several at a time. */
+void dt_styles_preview_prefetch(int32_t imgid, int size);
+/** drops all cached previews. */
+void dt_styles_preview_cleanup();
+
 /** register global style accelerators at start time */
 void init_styles_key_accels();
 /** connect global style accelerators at start time */
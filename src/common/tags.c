@@ -23,6 +23,141 @@
 #include "control/conf.h"
 #include "control/control.h"
 
+/* in-memory prefix index over the tag names, with the number of images per tag, so the
+   tagging module doesn't go through sql on every keystroke. every word of a name gets a
+   key, kept sorted, so all names with a word starting with some text are adjacent. */
+typedef struct dt_tag_index_entry_t
+{
+  guint id;
+  gchar *name;
+  gchar *lname; // lower case, the keys point into it
+  int count;    // images tagged with it
+}
+dt_tag_index_entry_t;
+
+typedef struct dt_tag_index_key_t
+{
+  const char *word;
+  dt_tag_index_entry_t *entry;
+}
+dt_tag_index_key_t;
+
+static GStaticMutex _tag_index_mutex = G_STATIC_MUTEX_INIT;
+static GHashTable *_tag_index = NULL; // id -> dt_tag_index_entry_t
+static GArray *_tag_index_keys = NULL;
+
+static void _tag_index_entry_free(gpointer data)
+{
+  dt_tag_index_entry_t *e = (dt_tag_index_entry_t *)data;
+  g_free(e->name);
+  g_free(e->lname);
+  g_free(e);
+}
+
+static gint _tag_index_key_cmp(gconstpointer a, gconstpointer b)
+{
+  return strcmp(((const dt_tag_index_key_t *)a)->word, ((const dt_tag_index_key_t *)b)->word);
+}
+
+// index of the first key >= word
+static guint _tag_index_lower_bound(const char *word)
+{
+  guint lo = 0, hi = _tag_index_keys->len;
+  while(lo < hi)
+  {
+    const guint mid = (lo + hi) / 2;
+    if(strcmp(g_array_index(_tag_index_keys, dt_tag_index_key_t, mid).word, word) < 0) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// adds a tag, keeping the keys sorted unless they are sorted all at once afterwards.
+static void _tag_index_insert(guint id, const char *name, int count, gboolean sorted)
+{
+  dt_tag_index_entry_t *e = (dt_tag_index_entry_t *)g_malloc(sizeof(dt_tag_index_entry_t));
+  e->id = id;
+  e->name = g_strdup(name);
+  e->lname = g_utf8_strdown(name, -1);
+  e->count = count;
+  g_hash_table_insert(_tag_index, GUINT_TO_POINTER(id), e);
+  // a word starts after every ascii separator, like the | of the hierarchy:
+  for(const char *c = e->lname; *c; c++)
+  {
+    if(c != e->lname && ((c[-1] & 0x80) || g_ascii_isalnum(c[-1]))) continue;
+    if(!g_ascii_isalnum(*c) && !(*c & 0x80)) continue;
+    dt_tag_index_key_t key = { c, e };
+    if(sorted) g_array_insert_val(_tag_index_keys, _tag_index_lower_bound(c), key);
+    else g_array_append_val(_tag_index_keys, key);
+  }
+}
+
+static void _tag_index_remove(guint id)
+{
+  dt_tag_index_entry_t *e = (dt_tag_index_entry_t *)g_hash_table_lookup(_tag_index, GUINT_TO_POINTER(id));
+  if(!e) return;
+  for(guint k = 0; k < _tag_index_keys->len;)
+  {
+    if(g_array_index(_tag_index_keys, dt_tag_index_key_t, k).entry == e) g_array_remove_index(_tag_index_keys, k);
+    else k++;
+  }
+  g_hash_table_remove(_tag_index, GUINT_TO_POINTER(id));
+}
+
+// call with the mutex locked. reads the index from the db if it isn't there.
+static void _tag_index_load()
+{
+  if(_tag_index) return;
+  _tag_index = g_hash_table_new_full(NULL, NULL, NULL, _tag_index_entry_free);
+  _tag_index_keys = g_array_new(FALSE, FALSE, sizeof(dt_tag_index_key_t));
+
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT id, name, (SELECT count(*) FROM tagged_images WHERE tagid = tags.id) FROM tags",
+                              -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const char *name = (const char *)sqlite3_column_text(stmt, 1);
+    if(name) _tag_index_insert(sqlite3_column_int(stmt, 0), name, sqlite3_column_int(stmt, 2), FALSE);
+  }
+  sqlite3_finalize(stmt);
+  // sort once instead of inserting in order:
+  g_array_sort(_tag_index_keys, _tag_index_key_cmp);
+}
+
+// for changes the index can't follow, it's read again on next use.
+static void _tag_index_invalidate()
+{
+  g_static_mutex_lock(&_tag_index_mutex);
+  if(_tag_index)
+  {
+    g_array_free(_tag_index_keys, TRUE);
+    g_hash_table_destroy(_tag_index);
+    _tag_index_keys = NULL;
+    _tag_index = NULL;
+  }
+  g_static_mutex_unlock(&_tag_index_mutex);
+}
+
+static void _tag_index_count(guint id, int delta)
+{
+  if(delta == 0) return;
+  g_static_mutex_lock(&_tag_index_mutex);
+  if(_tag_index)
+  {
+    dt_tag_index_entry_t *e = (dt_tag_index_entry_t *)g_hash_table_lookup(_tag_index, GUINT_TO_POINTER(id));
+    if(e) e->count = MAX(0, e->count + delta);
+  }
+  g_static_mutex_unlock(&_tag_index_mutex);
+}
+
+static gint _tag_index_usage_cmp(gconstpointer a, gconstpointer b)
+{
+  const dt_tag_index_entry_t *ea = (const dt_tag_index_entry_t *)a, *eb = (const dt_tag_index_entry_t *)b;
+  if(ea->count != eb->count) return eb->count - ea->count;
+  return strcmp(ea->lname, eb->lname);
+}
+
 gboolean dt_tag_new(const char *name,guint *tagid)
 {
   int rt;
@@ -32,8 +167,7 @@ gboolean dt_tag_new(const char *name,guint *tagid)
   if (!name || name[0] == '\0')
     return FALSE; // no tagid name.
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT id FROM tags WHERE name = ?1", -1, &stmt, NULL);
+  stmt = dt_database_prepare_cached(darktable.db, "SELECT id FROM tags WHERE name = ?1");
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, strlen(name), SQLITE_TRANSIENT);
   rt = sqlite3_step(stmt);
   if(rt == SQLITE_ROW)
@@ -41,35 +175,34 @@ gboolean dt_tag_new(const char *name,guint *tagid)
     // tagid already exists.
     if( tagid != NULL)
       *tagid=sqlite3_column_int64(stmt, 0);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
     return  TRUE;
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO tags (id, name) VALUES (null, ?1)", -1, &stmt, NULL);
+  stmt = dt_database_prepare_cached(darktable.db, "INSERT INTO tags (id, name) VALUES (null, ?1)");
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, strlen(name), SQLITE_TRANSIENT);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT id FROM tags WHERE name = ?1", -1, &stmt, NULL);
+  stmt = dt_database_prepare_cached(darktable.db, "SELECT id FROM tags WHERE name = ?1");
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, strlen(name), SQLITE_TRANSIENT);
   if (sqlite3_step(stmt) == SQLITE_ROW)
     id = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO tagxtag SELECT id, ?1, 0 FROM tags", -1, &stmt, NULL);
+  g_static_mutex_lock(&_tag_index_mutex);
+  if(_tag_index && id) _tag_index_insert(id, name, 0, TRUE);
+  g_static_mutex_unlock(&_tag_index_mutex);
+
+  stmt = dt_database_prepare_cached(darktable.db, "INSERT INTO tagxtag SELECT id, ?1, 0 FROM tags");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "UPDATE tagxtag SET count = 1000000 WHERE id1 = ?1 AND id2 = ?1",
-                              -1, &stmt, NULL);
+  dt_database_release_cached(darktable.db, stmt);
+  stmt = dt_database_prepare_cached(darktable.db, "UPDATE tagxtag SET count = 1000000 WHERE id1 = ?1 AND id2 = ?1");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   if( tagid != NULL)
     *tagid=id;
@@ -118,6 +251,10 @@ guint dt_tag_remove(const guint tagid, gboolean final)
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
 
+    g_static_mutex_lock(&_tag_index_mutex);
+    if(_tag_index) _tag_index_remove(tagid);
+    g_static_mutex_unlock(&_tag_index_mutex);
+
     /* raise signal of tags change to refresh keywords module */
     dt_control_signal_raise(darktable.signals, DT_SIGNAL_TAG_CHANGED);
 
@@ -131,13 +268,12 @@ gchar *dt_tag_get_name(const guint tagid)
   int rt;
   char *name=NULL;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT name FROM tags WHERE id= ?1", -1, &stmt, NULL);
+  stmt = dt_database_prepare_cached(darktable.db, "SELECT name FROM tags WHERE id= ?1");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1,tagid);
   rt = sqlite3_step(stmt);
   if( rt== SQLITE_ROW )
     name=g_strdup((const char *)sqlite3_column_text(stmt, 0));
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
 
   return name;
 }
@@ -164,6 +300,7 @@ void dt_tag_reorganize(const gchar *source, const gchar *dest)
              source, dest, tag, source);
 
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query, NULL, NULL, NULL);
+  _tag_index_invalidate();
 
   /* raise signal of tags change to refresh keywords module */
   //dt_control_signal_raise(darktable.signals, DT_SIGNAL_TAG_CHANGED);
@@ -173,8 +310,7 @@ gboolean dt_tag_exists(const char *name,guint *tagid)
 {
   int rt;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT id FROM tags WHERE name = ?1", -1, &stmt, NULL);
+  stmt = dt_database_prepare_cached(darktable.db, "SELECT id FROM tags WHERE name = ?1");
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, strlen(name), SQLITE_TRANSIENT);
   rt = sqlite3_step(stmt);
 
@@ -182,12 +318,12 @@ gboolean dt_tag_exists(const char *name,guint *tagid)
   {
     if( tagid != NULL)
       *tagid = sqlite3_column_int64(stmt, 0);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
     return  TRUE;
   }
 
   *tagid = -1;
-  sqlite3_finalize(stmt);
+  dt_database_release_cached(darktable.db, stmt);
   return FALSE;
 }
 
@@ -197,44 +333,39 @@ void dt_tag_attach(guint tagid,gint imgid)
   sqlite3_stmt *stmt;
   if(imgid > 0)
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT OR REPLACE INTO tagged_images (imgid, tagid) VALUES (?1, ?2)",
-                                -1, &stmt, NULL);
+    stmt = dt_database_prepare_cached(darktable.db, "INSERT OR IGNORE INTO tagged_images (imgid, tagid) VALUES (?1, ?2)");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, tagid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    _tag_index_count(tagid, sqlite3_changes(dt_database_get(darktable.db)));
+    dt_database_release_cached(darktable.db, stmt);
 
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "UPDATE tagxtag SET count = count + 1 WHERE "
-                                "(id1 = ?1 AND id2 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2)) "
-                                "OR "
-                                "(id2 = ?1 AND id1 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2))",
-                                -1, &stmt, NULL);
+    stmt = dt_database_prepare_cached(darktable.db, "UPDATE tagxtag SET count = count + 1 WHERE "
+                                                    "(id1 = ?1 AND id2 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2)) "
+                                                    "OR "
+                                                    "(id2 = ?1 AND id1 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2))");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
   }
   else
   {
     // insert into tagged_images if not there already.
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT OR REPLACE INTO tagged_images SELECT imgid, ?1 "
-                                "FROM selected_images", -1, &stmt, NULL);
+    stmt = dt_database_prepare_cached(darktable.db, "INSERT OR IGNORE INTO tagged_images SELECT imgid, ?1 "
+                                                    "FROM selected_images");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    _tag_index_count(tagid, sqlite3_changes(dt_database_get(darktable.db)));
+    dt_database_release_cached(darktable.db, stmt);
 
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "UPDATE tagxtag SET count = count + 1 WHERE (id1 = ?1 AND id2 IN "
-                                "(SELECT tagid FROM selected_images JOIN tagged_images)) OR "
-                                "(id2 = ?1 AND id1 IN (SELECT tagid FROM selected_images "
-                                "JOIN tagged_images))",
-                                -1, &stmt, NULL);
+    stmt = dt_database_prepare_cached(darktable.db, "UPDATE tagxtag SET count = count + 1 WHERE (id1 = ?1 AND id2 IN "
+                                                    "(SELECT tagid FROM selected_images JOIN tagged_images)) OR "
+                                                    "(id2 = ?1 AND id1 IN (SELECT tagid FROM selected_images "
+                                                    "JOIN tagged_images))");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
   }
 }
 
@@ -281,44 +412,39 @@ void dt_tag_detach(guint tagid,gint imgid)
   if(imgid > 0)
   {
     // remove from specified image by id
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "UPDATE tagxtag SET count = count - 1 WHERE (id1 = ?1 AND id2 IN "
-                                "(SELECT tagid FROM tagged_images WHERE imgid = ?2)) OR (id2 = ?1 "
-                                "AND id1 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2))",
-                                -1, &stmt, NULL);
+    stmt = dt_database_prepare_cached(darktable.db, "UPDATE tagxtag SET count = count - 1 WHERE (id1 = ?1 AND id2 IN "
+                                                    "(SELECT tagid FROM tagged_images WHERE imgid = ?2)) OR (id2 = ?1 "
+                                                    "AND id1 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2))");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
 
     // remove from tagged_images
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "DELETE FROM tagged_images WHERE tagid = ?1 AND imgid = ?2",
-                                -1, &stmt, NULL);
+    stmt = dt_database_prepare_cached(darktable.db, "DELETE FROM tagged_images WHERE tagid = ?1 AND imgid = ?2");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    _tag_index_count(tagid, -sqlite3_changes(dt_database_get(darktable.db)));
+    dt_database_release_cached(darktable.db, stmt);
   }
   else
   {
     // remove from all selected images
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "update tagxtag set count = count - 1 where (id1 = ?1 and id2 in "
-                                "(select tagid from selected_images join tagged_images)) or (id2 = ?1 "
-                                "and id1 in (select tagid from selected_images join tagged_images))",
-                                -1, &stmt, NULL);
+    stmt = dt_database_prepare_cached(darktable.db, "update tagxtag set count = count - 1 where (id1 = ?1 and id2 in "
+                                                    "(select tagid from selected_images join tagged_images)) or (id2 = ?1 "
+                                                    "and id1 in (select tagid from selected_images join tagged_images))");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_database_release_cached(darktable.db, stmt);
 
     // remove from tagged_images
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "delete from tagged_images where tagid = ?1 and imgid in "
-                                "(select imgid from selected_images)", -1, &stmt, NULL);
+    stmt = dt_database_prepare_cached(darktable.db, "delete from tagged_images where tagid = ?1 and imgid in "
+                                                    "(select imgid from selected_images)");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    _tag_index_count(tagid, -sqlite3_changes(dt_database_get(darktable.db)));
+    dt_database_release_cached(darktable.db, stmt);
   }
 }
 
@@ -330,6 +456,7 @@ void dt_tag_detach_by_string(const char *name, gint imgid)
              "tags WHERE name LIKE '%s') AND imgid = %d;", name, imgid);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query,
                         NULL, NULL, NULL);
+  _tag_index_invalidate();
 }
 
 
@@ -368,81 +495,49 @@ uint32_t dt_tag_get_attached(gint imgid,GList **result)
   return count;
 }
 
-gchar* dt_tag_get_list(gint imgid, const gchar *separator)
+// names of the tags attached to an image, from the index. the internal darktable| tags are left out.
+static GList *_tag_get_attached_names(gint imgid)
 {
-  gchar *result = NULL;
-  GList *taglist = NULL;
-  GList *tags = NULL;
-  dt_tag_t *t;
-  gchar *value = NULL;
-  gchar **pch;
-
-  int count = dt_tag_get_attached (imgid, &taglist);
-
-  if (count < 1)
-    return NULL;
-
-  for (guint i = 0; i < g_list_length(taglist); i++)
+  GList *names = NULL;
+  sqlite3_stmt *stmt = dt_database_prepare_cached(darktable.db, "SELECT tagid FROM tagged_images WHERE imgid = ?1");
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  g_static_mutex_lock(&_tag_index_mutex);
+  _tag_index_load();
+  while(sqlite3_step(stmt) == SQLITE_ROW)
   {
-
-    t = g_list_nth_data (taglist, i);
-    value = g_strdup(t->tag);
-    if (g_strrstr(value, "|") && !g_str_has_prefix(value, "darktable|"))
-    {
-      size_t j = 0;
-      pch = g_strsplit(value, "|", -1);
-
-      if (pch != NULL)
-      {
-        while (pch[j] != NULL)
-        {
-          tags = g_list_prepend(tags, g_strdup(pch[j]));
-          j++;
-        }
-        g_strfreev(pch);
-      }
-    }
-    else if (!g_str_has_prefix(value, "darktable|"))
-      tags = g_list_prepend(tags, g_strdup(value));
-    g_free (t);
+    const dt_tag_index_entry_t *e = (const dt_tag_index_entry_t *)
+      g_hash_table_lookup(_tag_index, GUINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+    if(e && !g_str_has_prefix(e->name, "darktable|"))
+      names = g_list_prepend(names, g_strdup(e->name));
   }
-
-  g_list_free (taglist);
-
-  result = dt_util_glist_to_str (separator, tags, g_list_length(tags));
-
-  return result;
+  g_static_mutex_unlock(&_tag_index_mutex);
+  dt_database_release_cached(darktable.db, stmt);
+  return names;
 }
 
-gchar *dt_tag_get_hierarchical(gint imgid, const gchar *separator)
+gchar* dt_tag_get_list(gint imgid, const gchar *separator)
 {
-  GList *taglist = NULL;
+  GList *taglist = _tag_get_attached_names(imgid);
   GList *tags = NULL;
-  gchar *result = NULL;
 
-  int count = dt_tag_get_attached (imgid, &taglist);
-
-  if (count < 1)
-    return NULL;
-
-  for (guint i=0; i<g_list_length(taglist); i++)
+  // every level of a hierarchical tag on its own:
+  for(GList *t = taglist; t; t = g_list_next(t))
   {
-    dt_tag_t *t;
-    gchar *value = NULL;
-
-    t = g_list_nth_data (taglist, i);
-    value = g_strdup(t->tag);
-
-    /* return all tags, but omit the internal darktable ones: */
-    if (!g_str_has_prefix(value, "darktable|"))
-      tags = g_list_prepend(tags, value);
-
-    g_free (t);
+    gchar **pch = g_strsplit((gchar *)t->data, "|", -1);
+    for(int j = 0; pch[j] != NULL; j++)
+      tags = g_list_prepend(tags, g_strdup(pch[j]));
+    g_strfreev(pch);
+    g_free(t->data);
   }
+  g_list_free(taglist);
 
-  result = dt_util_glist_to_str (separator, tags, g_list_length(tags));
+  return dt_util_glist_to_str(separator, tags, g_list_length(tags));
+}
 
-  return result;
+gchar *dt_tag_get_hierarchical(gint imgid, const gchar *separator)
+{
+  GList *tags = _tag_get_attached_names(imgid);
+  return dt_util_glist_to_str(separator, tags, g_list_length(tags));
 }
 
 /*
@@ -450,10 +545,9 @@ gchar *dt_tag_get_hierarchical(gint imgid, const gchar *separator)
  * tagxtags table for possibly-related tags. The list we construct at
  * the end of the function is made up as follows:
  *
- * * Tags which appear as tagxtag.id2, where (keyword's name = tagxtag.id1)
- *   are listed first, ordered by count of times seen already.
- * * Tags which appear as tagxtag.id1, where (keyword's name = tagxtag.id2)
- *   are listed second, ordered as before.
+ * * Tags which appear as tagxtag.id2 or tagxtag.id1, where the other one
+ *   is a tag with a word starting with keyword, ordered by the number of
+ *   images they are attached to.
  *
  * We do not suggest tags which have not yet been matched up in tagxtag,
  * because it is up to the user to add new tags to the list and thereby
@@ -463,19 +557,18 @@ gchar *dt_tag_get_hierarchical(gint imgid, const gchar *separator)
  * do a large number of operations and thus makes the user experience
  * snappy.
  *
- * SELECT T.id FROM tags T WHERE T.name LIKE '?1';  --> into temp table
+ * tags with a word starting with keyword, from the in-memory index  --> into temp table
  * SELECT TXT.id2 FROM tagxtag TXT WHERE TXT.id1 IN (temp table)
  *   AND TXT.count > 0 ORDER BY TXT.count DESC;
  * SELECT TXT.id1 FROM tagxtag TXT WHERE TXT.id2 IN (temp table)
  *   AND TXT.count > 0 ORDER BY TXT.count DESC;
  *
- * SELECT DISTINCT(T.name) FROM tags T JOIN memoryquery MQ on MQ.id = T.id;
+ * SELECT DISTINCT id FROM memory.taglist;  --> names and counts from the index
  *
  */
 uint32_t dt_tag_get_suggestions(const gchar *keyword, GList **result)
 {
   sqlite3_stmt *stmt;
-  char query[1024];
   /*
    * Earlier versions of this function used a large collation of selects
    * and joins, resulting in multi-*second* timings for sqlite3_exec().
@@ -490,13 +583,32 @@ uint32_t dt_tag_get_suggestions(const gchar *keyword, GList **result)
   if (keyword == 0)
     return 0;
 
-  /* SELECT T.id FROM tags T WHERE T.name LIKE '%%%s%%';  --> into temp table */
-  memset(query, 0, sizeof(query));
-  snprintf(query, sizeof(query),
-           "INSERT INTO memory.tagq (id) SELECT id FROM tags T WHERE "
-           "T.name LIKE '%%%s%%' ", keyword);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query,
-                        NULL, NULL, NULL);
+  /* tags with a word starting with keyword, from the index --> into temp table */
+  gchar *lkeyword = g_utf8_strdown(keyword, -1);
+  const size_t len = strlen(lkeyword);
+  GHashTable *matched = g_hash_table_new(NULL, NULL);
+  g_static_mutex_lock(&_tag_index_mutex);
+  _tag_index_load();
+  for(guint k = _tag_index_lower_bound(lkeyword); k < _tag_index_keys->len; k++)
+  {
+    const dt_tag_index_key_t *key = &g_array_index(_tag_index_keys, dt_tag_index_key_t, k);
+    if(strncmp(key->word, lkeyword, len)) break;
+    g_hash_table_insert(matched, GUINT_TO_POINTER(key->entry->id), key->entry);
+  }
+  g_static_mutex_unlock(&_tag_index_mutex);
+  g_free(lkeyword);
+
+  GHashTableIter it;
+  gpointer id;
+  g_hash_table_iter_init(&it, matched);
+  while(g_hash_table_iter_next(&it, &id, NULL))
+  {
+    stmt = dt_database_prepare_cached(darktable.db, "INSERT INTO memory.tagq (id) VALUES (?1)");
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, GPOINTER_TO_UINT(id));
+    sqlite3_step(stmt);
+    dt_database_release_cached(darktable.db, stmt);
+  }
+  g_hash_table_destroy(matched);
 
   /*
    * SELECT TXT.id2 FROM tagxtag TXT WHERE TXT.id1 IN (temp table)
@@ -522,27 +634,36 @@ uint32_t dt_tag_get_suggestions(const gchar *keyword, GList **result)
                         "ORDER BY TXT.count DESC",
                         NULL, NULL, NULL);
 
-  /* Now put all the bits together */
+  /* Now put all the bits together, names from the index, most used first */
+  GList *entries = NULL;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT T.name, T.id, MT.count FROM tags T JOIN memory.taglist MT ON "
-                              "MT.id = T.id WHERE T.id in "
-                              "(SELECT DISTINCT(MT.id) FROM memory.taglist MT) "
-                              "AND T.name NOT LIKE 'darktable|%%' ORDER BY T.id ASC",
-                              -1, &stmt, NULL);
+                              "SELECT DISTINCT id FROM memory.taglist", -1, &stmt, NULL);
+  g_static_mutex_lock(&_tag_index_mutex);
+  _tag_index_load();
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    dt_tag_index_entry_t *e = (dt_tag_index_entry_t *)
+      g_hash_table_lookup(_tag_index, GUINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+    if(e && !g_str_has_prefix(e->name, "darktable|")) entries = g_list_prepend(entries, e);
+  }
+  sqlite3_finalize(stmt);
+  entries = g_list_sort(entries, _tag_index_usage_cmp);
 
   /* ... and create the result list to send upwards */
   uint32_t count=0;
-  dt_tag_t *t;
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  for(GList *l = entries; l; l = g_list_next(l))
   {
-    t = g_malloc(sizeof(dt_tag_t));
-    t->tag = g_strdup((char *)sqlite3_column_text(stmt, 0));
-    t->id = sqlite3_column_int(stmt, 1);
-    *result = g_list_append((*result),t);
+    const dt_tag_index_entry_t *e = (const dt_tag_index_entry_t *)l->data;
+    dt_tag_t *t = g_malloc(sizeof(dt_tag_t));
+    t->tag = g_strdup(e->name);
+    t->id = e->id;
+    *result = g_list_prepend((*result),t);
     count++;
   }
+  g_static_mutex_unlock(&_tag_index_mutex);
+  g_list_free(entries);
+  *result = g_list_reverse(*result);
 
-  sqlite3_finalize(stmt);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
                         "DELETE from memory.taglist", NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
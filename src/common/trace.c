@@ -0,0 +1,178 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/trace.h"
+#include "control/control.h"
+#include "develop/pixelpipe.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+// first track id for events which don't belong to a host thread:
+#define DT_TRACE_TRACK_OFFSET 1000
+
+typedef struct dt_trace_t
+{
+  FILE *f;
+  dt_pthread_mutex_t lock;
+  double start;      // wall time all timestamps are relative to
+  int num_events;
+  int num_threads;   // ids handed out to threads so far
+  pthread_key_t tid; // per thread id, stored +1 so 0 means unassigned
+  uint64_t tracks;   // bit mask of tracks which got their name already
+}
+dt_trace_t;
+
+// escapes quotes and backslashes for json strings:
+static void
+_write_string(FILE *f, const char *str)
+{
+  fputc('"', f);
+  for(const char *c = str; *c; c++)
+  {
+    if(*c == '"' || *c == '\\') fputc('\\', f);
+    if((unsigned char)*c >= 0x20) fputc(*c, f);
+  }
+  fputc('"', f);
+}
+
+// needs the lock.
+static void
+_begin_event(dt_trace_t *t)
+{
+  fputs(t->num_events++ ? ",\n" : "[\n", t->f);
+}
+
+// needs the lock.
+static void
+_name_track(dt_trace_t *t, const int tid, const char *name)
+{
+  _begin_event(t);
+  fprintf(t->f, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": ", tid);
+  _write_string(t->f, name);
+  fputs("}}", t->f);
+}
+
+// needs the lock.
+static int
+_thread_id(dt_trace_t *t)
+{
+  intptr_t id = (intptr_t)pthread_getspecific(t->tid);
+  if(!id)
+  {
+    id = ++t->num_threads;
+    pthread_setspecific(t->tid, (void *)id);
+    char name[64];
+    snprintf(name, sizeof(name), "thread %d", (int)id);
+    if(darktable.control)
+    {
+      const int worker = dt_control_get_threadid(), reserved = dt_control_get_threadid_res();
+      if(pthread_equal(pthread_self(), darktable.control->gui_thread)) snprintf(name, sizeof(name), "gui");
+      else if(worker < darktable.control->num_threads) snprintf(name, sizeof(name), "worker %d", worker);
+      else if(reserved < DT_CTL_WORKER_RESERVED) snprintf(name, sizeof(name), "reserved worker %d", reserved);
+    }
+    _name_track(t, id, name);
+  }
+  return id;
+}
+
+void dt_trace_init(const char *filename)
+{
+  dt_trace_t *t = (dt_trace_t *)malloc(sizeof(dt_trace_t));
+  if(!t) return;
+  memset(t, 0, sizeof(*t));
+  t->f = fopen(filename, "wb");
+  if(!t->f)
+  {
+    fprintf(stderr, "[trace] could not open `%s' for writing\n", filename);
+    free(t);
+    return;
+  }
+  dt_pthread_mutex_init(&t->lock, NULL);
+  pthread_key_create(&t->tid, NULL);
+  t->start = dt_get_wtime();
+  darktable.trace = t;
+  fprintf(stderr, "[trace] writing timeline to `%s'\n", filename);
+}
+
+void dt_trace_cleanup()
+{
+  dt_trace_t *t = darktable.trace;
+  if(!t) return;
+  dt_pthread_mutex_lock(&t->lock);
+  darktable.trace = NULL;
+  fputs(t->num_events ? "\n]\n" : "[]\n", t->f);
+  fclose(t->f);
+  dt_pthread_mutex_unlock(&t->lock);
+  dt_pthread_mutex_destroy(&t->lock);
+  pthread_key_delete(t->tid);
+  free(t);
+}
+
+void dt_trace_complete(const char *category, const char *name, const double start, const char *args)
+{
+  dt_trace_t *t = darktable.trace;
+  if(!t) return;
+  const double end = dt_get_wtime();
+  dt_pthread_mutex_lock(&t->lock);
+  const int tid = _thread_id(t);
+  _begin_event(t);
+  fputs("{\"name\": ", t->f);
+  _write_string(t->f, name);
+  fputs(", \"cat\": ", t->f);
+  _write_string(t->f, category);
+  fprintf(t->f, ", \"ph\": \"X\", \"ts\": %.1f, \"dur\": %.1f, \"pid\": 1, \"tid\": %d",
+          1e6*(start - t->start), 1e6*(end - start), tid);
+  if(args) fprintf(t->f, ", \"args\": {%s}", args);
+  fputc('}', t->f);
+  dt_pthread_mutex_unlock(&t->lock);
+}
+
+void dt_trace_complete_track(const char *category, const char *name, const double start, const double duration,
+                             const int track, const char *track_name)
+{
+  dt_trace_t *t = darktable.trace;
+  if(!t) return;
+  const int tid = DT_TRACE_TRACK_OFFSET + track;
+  dt_pthread_mutex_lock(&t->lock);
+  if(track >= 0 && track < 64 && !(t->tracks & (1ull << track)))
+  {
+    t->tracks |= 1ull << track;
+    _name_track(t, tid, track_name);
+  }
+  _begin_event(t);
+  fputs("{\"name\": ", t->f);
+  _write_string(t->f, name);
+  fputs(", \"cat\": ", t->f);
+  _write_string(t->f, category);
+  fprintf(t->f, ", \"ph\": \"X\", \"ts\": %.1f, \"dur\": %.1f, \"pid\": 1, \"tid\": %d}",
+          1e6*(start - t->start), 1e6*duration, tid);
+  dt_pthread_mutex_unlock(&t->lock);
+}
+
+void dt_trace_roi_args(char *buf, const size_t size, const char *pipe, const struct dt_iop_roi_t *roi)
+{
+  snprintf(buf, size, "\"pipe\": \"%s\", \"roi\": \"%d %d %dx%d\", \"scale\": %f",
+           pipe, roi->x, roi->y, roi->width, roi->height, roi->scale);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
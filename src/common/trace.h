@@ -0,0 +1,54 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_COMMON_TRACE_H
+#define DT_COMMON_TRACE_H
+
+#include "common/darktable.h"
+
+// timeline recorder, enabled by --trace <file>. writes events in the chrome trace
+// event format (json), which can be loaded into chrome://tracing or perfetto to see
+// pixelpipe nodes, tiles, opencl kernels and control jobs of all threads in one view.
+
+struct dt_iop_roi_t;
+
+/** opens the trace file, sets darktable.trace. */
+void dt_trace_init(const char *filename);
+/** finishes and closes the trace file. */
+void dt_trace_cleanup();
+
+static inline int dt_trace_enabled()
+{
+  return darktable.trace != NULL;
+}
+
+/** records an event of the calling thread which started at the given wall time (dt_get_wtime()) and lasted
+  * until now. args is an optional json object body, like "\"pipe\": \"full\"", and may be NULL. */
+void dt_trace_complete(const char *category, const char *name, const double start, const char *args);
+/** records an event with explicit start and duration in seconds, as a separate track with given id and name,
+  * for work not done by a host thread (opencl devices). */
+void dt_trace_complete_track(const char *category, const char *name, const double start, const double duration,
+                             const int track, const char *track_name);
+
+/** formats the usual args for a pixelpipe event into buf. */
+void dt_trace_roi_args(char *buf, const size_t size, const char *pipe, const struct dt_iop_roi_t *roi);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -16,6 +16,11 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#ifdef __linux__
+// for copy_file_range(), has to come before any system header
+#define _GNU_SOURCE
+#endif
+
 /* getpwnam_r availibility check */
 #if defined __APPLE__ || defined _POSIX_C_SOURCE >= 1 || defined _XOPEN_SOURCE || defined _BSD_SOURCE || defined _SVID_SOURCE || defined _POSIX_SOURCE
 #include <pwd.h>
@@ -30,6 +35,17 @@
 #include "utility.h"
 #include "file_location.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#endif
+
 gchar *dt_util_dstrcat(gchar *str,const gchar *format, ... )
 {
   va_list args;
@@ -193,6 +209,75 @@ gchar* dt_util_fix_path(const gchar* path)
 
   return rpath;
 }
+int dt_util_copy_file(const gchar *src, const gchar *dest, const gboolean overwrite)
+{
+  int err = 0;
+  const int fin = g_open(src, O_RDONLY, 0);
+  if(fin < 0) return errno;
+  struct stat st;
+  if(fstat(fin, &st))
+  {
+    err = errno;
+    close(fin);
+    return err;
+  }
+  const int fout = g_open(dest, O_WRONLY | O_CREAT | (overwrite ? O_TRUNC : O_EXCL), st.st_mode & 0777);
+  if(fout < 0)
+  {
+    err = errno;
+    close(fin);
+    return err;
+  }
+
+  off_t done = 0;
+#ifdef __linux__
+#ifdef FICLONE
+  // btrfs, xfs and friends can share the blocks instead of copying them:
+  if(ioctl(fout, FICLONE, fin) == 0) done = st.st_size;
+#endif
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+  // in kernel copy, server side on nfs and smb:
+  while(done < st.st_size)
+  {
+    const ssize_t n = copy_file_range(fin, NULL, fout, NULL, st.st_size - done, 0);
+    if(n <= 0) break;
+    done += n;
+  }
+#endif
+  // still in kernel, but through the page cache:
+  while(done < st.st_size)
+  {
+    const ssize_t n = sendfile(fout, fin, &done, st.st_size - done);
+    if(n <= 0) break;
+  }
+#endif
+  if(done < st.st_size)
+  {
+    // whatever the kernel didn't do for us goes through a buffer:
+    const size_t bufsize = 1<<20;
+    char *buf = (char *)g_malloc(bufsize);
+    if(lseek(fin, done, SEEK_SET) < 0 || lseek(fout, done, SEEK_SET) < 0) err = errno;
+    while(!err)
+    {
+      const ssize_t n = read(fin, buf, bufsize);
+      if(n < 0 && errno == EINTR) continue;
+      if(n < 0) err = errno;
+      if(n <= 0) break;
+      for(ssize_t w = 0; w < n && !err;)
+      {
+        const ssize_t m = write(fout, buf + w, n - w);
+        if(m < 0 && errno != EINTR) err = errno;
+        else if(m > 0) w += m;
+      }
+    }
+    g_free(buf);
+  }
+  close(fin);
+  if(close(fout) && !err) err = errno;
+  if(err) g_unlink(dest);
+  return err;
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
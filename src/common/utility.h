@@ -33,6 +33,9 @@ guint dt_util_str_occurence(const gchar *haystack,const gchar *needle);
 gchar* dt_util_glist_to_str(const gchar* separator, GList * items, const unsigned int count);
 /** fixes the given path by replacing a possible tilde with the correct home directory */
 gchar* dt_util_fix_path(const gchar* path);
+/** copies the file src to dest, letting the kernel move the data (or share the blocks where the filesystem can).
+  * with overwrite unset an existing dest is left alone and reported as EEXIST. returns 0 or an errno value. */
+int dt_util_copy_file(const gchar *src, const gchar *dest, const gboolean overwrite);
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
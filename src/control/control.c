@@ -27,6 +27,8 @@
 #include "common/image_cache.h"
 #include "common/imageio.h"
 #include "common/debug.h"
+#include "common/metadata.h"
+#include "common/trace.h"
 #include "bauhaus/bauhaus.h"
 #include "views/view.h"
 #include "gui/gtk.h"
@@ -61,6 +63,17 @@
     on timed interval.
 */
 static void * _control_worker_kicker(void *ptr);
+static void _control_job_stats_print(const char *name, const int queued, const dt_control_job_stats_t *stats,
+                                     const double wait_p50, const double wait_p95,
+                                     const double run_p50, const double run_p95, void *data);
+
+/* the queued jobs of one worker, one fifo per job class. */
+typedef struct dt_control_worker_t
+{
+  dt_pthread_mutex_t mutex;
+  GQueue queue[DT_JOB_QUEUE_MAX];
+}
+dt_control_worker_t;
 
 /* redraw mutex to synchronize redraws */
 static dt_pthread_mutex_t _control_gdk_lock_threads_mutex;
@@ -176,6 +189,13 @@ static void dt_control_sanitize_database()
                         NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
                         "CREATE TABLE memory.tmp_selection (imgid INTEGER)", NULL, NULL, NULL);
+  // images to be removed from the library at once by dt_image_remove_batch():
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "CREATE TABLE memory.removed_images (imgid INTEGER PRIMARY KEY)", NULL, NULL, NULL);
+  // the current collection in order, the rowid being the position:
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "CREATE TABLE memory.collected_images (rowid INTEGER PRIMARY KEY, imgid INTEGER)",
+                        NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
                         "CREATE TABLE memory.tagq (tmpid INTEGER PRIMARY KEY, id INTEGER)",
                         NULL, NULL, NULL);
@@ -392,8 +412,156 @@ void dt_ctl_set_display_profile()
   g_free(profile_source);
 }
 
+// version of the secondary indexes below, kept in the user_version pragma of the library.
+// bump it when adding one, existing databases get them once at the next start.
+#define DT_CONTROL_DATABASE_INDEX_VERSION 5
+
+// the metadata columns of images_fts, refreshed from meta_data for the image with the given id:
+static gchar *_control_fts_metadata_update(const char *id)
+{
+  return g_strdup_printf("update images_fts set "
+                         "title = (select group_concat(value, ' ') from meta_data where id = %s and key = %d), "
+                         "description = (select group_concat(value, ' ') from meta_data where id = %s and key = %d), "
+                         "creator = (select group_concat(value, ' ') from meta_data where id = %s and key = %d), "
+                         "publisher = (select group_concat(value, ' ') from meta_data where id = %s and key = %d), "
+                         "rights = (select group_concat(value, ' ') from meta_data where id = %s and key = %d) "
+                         "where docid = %s",
+                         id, DT_METADATA_XMP_DC_TITLE, id, DT_METADATA_XMP_DC_DESCRIPTION,
+                         id, DT_METADATA_XMP_DC_CREATOR, id, DT_METADATA_XMP_DC_PUBLISHER,
+                         id, DT_METADATA_XMP_DC_RIGHTS, id);
+}
+
+// full-text index over filename and metadata for the text rules of the collection, kept up to
+// date by triggers. sqlite may be built without fts, then the collection keeps using like.
+static void _control_create_database_fts()
+{
+  sqlite3 *db = dt_database_get(darktable.db);
+  if(sqlite3_exec(db, "create virtual table images_fts using fts4 "
+                  "(filename, title, description, creator, publisher, rights, tokenize=unicode61)",
+                  NULL, NULL, NULL) != SQLITE_OK)
+  {
+    dt_print(DT_DEBUG_SQL, "[sql] no full-text index: %s\n", sqlite3_errmsg(db));
+    return;
+  }
+  DT_DEBUG_SQLITE3_EXEC(db, "insert into images_fts (docid, filename) select id, filename from images", NULL, NULL, NULL);
+  gchar *update = _control_fts_metadata_update("images_fts.docid");
+  DT_DEBUG_SQLITE3_EXEC(db, update, NULL, NULL, NULL);
+  g_free(update);
+
+  DT_DEBUG_SQLITE3_EXEC(db, "create trigger images_fts_insert after insert on images begin "
+                        "insert into images_fts (docid, filename) values (new.id, new.filename); end",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db, "create trigger images_fts_update after update of filename on images begin "
+                        "update images_fts set filename = new.filename where docid = new.id; end",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db, "create trigger images_fts_delete after delete on images begin "
+                        "delete from images_fts where docid = old.id; end",
+                        NULL, NULL, NULL);
+  const char *events[] = {"insert", "update", "delete"};
+  for(int k=0; k<3; k++)
+  {
+    update = _control_fts_metadata_update(k == 2 ? "old.id" : "new.id");
+    gchar *trigger = g_strdup_printf("create trigger meta_data_fts_%s after %s on meta_data begin %s; end",
+                                     events[k], events[k], update);
+    DT_DEBUG_SQLITE3_EXEC(db, trigger, NULL, NULL, NULL);
+    g_free(trigger);
+    g_free(update);
+  }
+}
+
+// the last history item of every module instance, which is all a pipe needs. written along with the
+// history by dt_dev_write_history(), any other change of the history drops it until the next read.
+static void _control_create_database_history_effective()
+{
+  sqlite3 *db = dt_database_get(darktable.db);
+  DT_DEBUG_SQLITE3_EXEC(db, "create table if not exists history_effective (imgid integer, num integer, module integer, "
+                        "operation varchar(256), op_params blob, enabled integer, "
+                        "blendop_params blob, blendop_version integer, multi_priority integer, multi_name varchar(256))",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db, "create index if not exists history_effective_imgid_index on history_effective (imgid, num)",
+                        NULL, NULL, NULL);
+  const char *events[] = {"insert", "update", "delete"};
+  for(int k=0; k<3; k++)
+  {
+    gchar *trigger = g_strdup_printf("create trigger if not exists history_effective_%s after %s on history begin "
+                                     "delete from history_effective where imgid = %s.imgid; end",
+                                     events[k], events[k], k == 2 ? "old" : "new");
+    DT_DEBUG_SQLITE3_EXEC(db, trigger, NULL, NULL, NULL);
+    g_free(trigger);
+  }
+}
+
+// modification time of the sidecar of each image as darktable last wrote or read it, so a re-scan of
+// the folder only parses the sidecars which were changed by someone else.
+static void _control_create_database_xmp_synch()
+{
+  sqlite3 *db = dt_database_get(darktable.db);
+  DT_DEBUG_SQLITE3_EXEC(db, "create table if not exists xmp_synch (imgid integer primary key, mtime integer)",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db, "create trigger if not exists xmp_synch_delete after delete on images begin "
+                        "delete from xmp_synch where imgid = old.id; end",
+                        NULL, NULL, NULL);
+}
+
+// the settings each exported file was written with, see common/export_cache.h.
+static void _control_create_database_export_cache()
+{
+  sqlite3 *db = dt_database_get(darktable.db);
+  DT_DEBUG_SQLITE3_EXEC(db, "create table if not exists export_cache (filename varchar primary key, imgid integer, "
+                        "hash integer, mtime integer)", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db, "create index if not exists export_cache_imgid_index on export_cache (imgid)",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db, "create trigger if not exists export_cache_delete after delete on images begin "
+                        "delete from export_cache where imgid = old.id; end",
+                        NULL, NULL, NULL);
+}
+
+// indexes for the collection, import and history queries. each version only adds what
+// the ones before didn't have.
+static void _control_create_database_indexes()
+{
+  sqlite3 *db = dt_database_get(darktable.db);
+  sqlite3_stmt *stmt;
+  int version = 0;
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "pragma user_version", -1, &stmt, NULL);
+  if(sqlite3_step(stmt) == SQLITE_ROW) version = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+  if(version >= DT_CONTROL_DATABASE_INDEX_VERSION) return;
+
+  dt_print(DT_DEBUG_SQL, "[sql] creating indexes, version %d -> %d\n", version, DT_CONTROL_DATABASE_INDEX_VERSION);
+  if(version < 1)
+  {
+    // film rolls, sorting by filename and the lookup on import:
+    DT_DEBUG_SQLITE3_EXEC(db, "create index if not exists images_film_id_index on images (film_id, filename)", NULL, NULL, NULL);
+    DT_DEBUG_SQLITE3_EXEC(db, "create index if not exists images_datetime_taken_index on images (datetime_taken)", NULL, NULL, NULL);
+    // the primary key only helps going from images to tags, the filters go the other way:
+    DT_DEBUG_SQLITE3_EXEC(db, "create index if not exists tagged_images_tagid_index on tagged_images (tagid, imgid)", NULL, NULL, NULL);
+    DT_DEBUG_SQLITE3_EXEC(db, "create index if not exists color_labels_color_index on color_labels (color, imgid)", NULL, NULL, NULL);
+    DT_DEBUG_SQLITE3_EXEC(db, "create index if not exists history_imgid_num_index on history (imgid, num)", NULL, NULL, NULL);
+    DT_DEBUG_SQLITE3_EXEC(db, "create index if not exists mask_imgid_index on mask (imgid, formid)", NULL, NULL, NULL);
+    DT_DEBUG_SQLITE3_EXEC(db, "create index if not exists meta_data_index on meta_data (id, key)", NULL, NULL, NULL);
+  }
+  if(version < 2)
+    _control_create_database_fts();
+  if(version < 3)
+    _control_create_database_history_effective();
+  if(version < 4)
+    _control_create_database_xmp_synch();
+  if(version < 5)
+    _control_create_database_export_cache();
+  // and let the query planner know about them:
+  DT_DEBUG_SQLITE3_EXEC(db, "analyze", NULL, NULL, NULL);
+
+  char query[64];
+  snprintf(query, sizeof(query), "pragma user_version = %d", DT_CONTROL_DATABASE_INDEX_VERSION);
+  DT_DEBUG_SQLITE3_EXEC(db, query, NULL, NULL, NULL);
+}
+
 void dt_control_create_database_schema()
 {
+  // a new library has none of the indexes, even if the old one had:
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "pragma user_version = 0", NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
                         "create table settings (settings blob)", NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
@@ -468,6 +636,11 @@ void dt_control_init(dt_control_t *s)
   dt_pthread_mutex_init(&_control_gdk_lock_threads_mutex, NULL);
 
   // s->last_expose_time = dt_get_wtime();
+  dt_pthread_mutex_init(&s->redraw_mutex, NULL);
+  s->redraw_pending = 0;
+  s->redraw_timeout = 0;
+  s->redraw_last_flush = 0.0;
+  s->expose_duration = 0.0;
   s->key_accelerators_on = 1;
   s->log_pos = s->log_ack = 0;
   s->log_busy = 0;
@@ -484,12 +657,25 @@ void dt_control_init(dt_control_t *s)
   pthread_cond_init(&s->cond, NULL);
   dt_pthread_mutex_init(&s->cond_mutex, NULL);
   dt_pthread_mutex_init(&s->queue_mutex, NULL);
+  dt_pthread_mutex_init(&s->threads_mutex, NULL);
+  pthread_key_create(&s->job_key, NULL);
+  dt_pthread_mutex_init(&s->stats_mutex, NULL);
+  memset(s->stats, 0, sizeof(s->stats));
+  s->threads_free = darktable.num_openmp_threads;
+  s->threads_leases = 0;
   dt_pthread_mutex_init(&s->run_mutex, NULL);
   pthread_rwlock_init(&s->xprofile_lock, NULL);
 
   // start threads
   s->num_threads = CLAMP(dt_conf_get_int ("worker_threads"), 1, 8);
   s->thread = (pthread_t *)malloc(sizeof(pthread_t)*s->num_threads);
+  s->worker = (dt_control_worker_t *)malloc(sizeof(dt_control_worker_t)*s->num_threads);
+  for(int k=0; k<s->num_threads; k++)
+  {
+    dt_pthread_mutex_init(&s->worker[k].mutex, NULL);
+    for(int q=0; q<DT_JOB_QUEUE_MAX; q++) g_queue_init(&s->worker[k].queue[q]);
+  }
+  s->queued = s->next_worker = s->blocked = 0;
   dt_pthread_mutex_lock(&s->run_mutex);
   s->running = 1;
   dt_pthread_mutex_unlock(&s->run_mutex);
@@ -757,6 +943,7 @@ create_tables:
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
   }
+  _control_create_database_indexes();
 }
 
 void dt_control_key_accelerators_on(struct dt_control_t *s)
@@ -848,6 +1035,8 @@ void dt_control_shutdown(dt_control_t *s)
     // pthread_kill(s->thread_res[k], 9);
     pthread_join(s->thread_res[k], NULL);
 
+  if(darktable.unmuted & DT_DEBUG_CONTROL)
+    dt_control_job_statistics(s, _control_job_stats_print, NULL);
 
   // gdk_threads_enter();
 }
@@ -862,9 +1051,24 @@ void dt_control_cleanup(dt_control_t *s)
   // vacuum TODO: optional?
   // DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "PRAGMA incremental_vacuum(0)", NULL, NULL, NULL);
   // DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "vacuum", NULL, NULL, NULL);
+  for(int k=0; k<s->num_threads; k++)
+  {
+    for(int q=0; q<DT_JOB_QUEUE_MAX; q++)
+    {
+      g_list_foreach(s->worker[k].queue[q].head, _free_element, NULL);
+      g_queue_clear(&s->worker[k].queue[q]);
+    }
+    dt_pthread_mutex_destroy(&s->worker[k].mutex);
+  }
+  free(s->worker);
   dt_pthread_mutex_destroy(&s->queue_mutex);
+  dt_pthread_mutex_destroy(&s->threads_mutex);
+  pthread_key_delete(s->job_key);
+  dt_pthread_mutex_destroy(&s->stats_mutex);
   dt_pthread_mutex_destroy(&s->cond_mutex);
   dt_pthread_mutex_destroy(&s->log_mutex);
+  if(s->redraw_timeout) g_source_remove(s->redraw_timeout);
+  dt_pthread_mutex_destroy(&s->redraw_mutex);
   dt_pthread_mutex_destroy(&s->run_mutex);
   pthread_rwlock_destroy(&s->xprofile_lock);
 //   g_slist_free_full(s->accelerator_list, g_free); // FIXME: requires glib >= 2.28
@@ -896,6 +1100,28 @@ void dt_control_job_set_state_callback(dt_job_t *j,dt_job_state_change_callback
 }
 
 
+void dt_control_job_set_queue(dt_job_t *j, dt_job_queue_t queue)
+{
+  j->queue = CLAMP(queue, DT_JOB_QUEUE_INTERACTIVE, DT_JOB_QUEUE_MAX-1);
+}
+
+void dt_control_job_set_key(dt_job_t *j, uint64_t key, dt_job_coalesce_t coalesce, dt_job_merge_callback merge)
+{
+  j->key = key;
+  j->coalesce = coalesce;
+  j->merge = merge;
+}
+
+dt_job_t *dt_control_job_get_current()
+{
+  return (dt_job_t *)pthread_getspecific(darktable.control->job_key);
+}
+
+void dt_control_job_set_current(dt_job_t *j)
+{
+  pthread_setspecific(darktable.control->job_key, j);
+}
+
 void dt_control_job_print(dt_job_t *j)
 {
 #ifdef DT_CONTROL_JOB_DEBUG
@@ -940,6 +1166,80 @@ void dt_control_job_wait(dt_job_t *j)
 
 }
 
+static const char *_control_job_queue_name[DT_JOB_QUEUE_MAX] =
+{
+  "interactive", "prefetch", "background", "export"
+};
+
+static void _control_job_stats_add(dt_control_t *s, const dt_job_t *j, const double start)
+{
+  const double end = dt_get_wtime();
+  dt_control_job_stats_t *st = s->stats + j->queue;
+  dt_pthread_mutex_lock(&s->stats_mutex);
+  st->wait_samples[st->count % DT_CONTROL_STATS_SAMPLES] = start - j->ts_queued;
+  st->run_samples[st->count % DT_CONTROL_STATS_SAMPLES] = end - start;
+  st->count++;
+  st->wait += start - j->ts_queued;
+  st->run += end - start;
+  dt_pthread_mutex_unlock(&s->stats_mutex);
+}
+
+static void _control_job_stats_count(dt_control_t *s, const dt_job_queue_t queue, const int coalesced, const int blocked)
+{
+  dt_pthread_mutex_lock(&s->stats_mutex);
+  s->stats[queue].coalesced += coalesced;
+  s->stats[queue].blocked += blocked;
+  dt_pthread_mutex_unlock(&s->stats_mutex);
+}
+
+static int _compare_float(const void *a, const void *b)
+{
+  const float fa = *(const float *)a, fb = *(const float *)b;
+  return (fa > fb) - (fa < fb);
+}
+
+void dt_control_job_statistics(dt_control_t *s, dt_control_job_stats_func_t func, void *data)
+{
+  int queued[DT_JOB_QUEUE_MAX] = {0};
+  for(int k=0; k<s->num_threads; k++)
+  {
+    dt_pthread_mutex_lock(&s->worker[k].mutex);
+    for(int q=0; q<DT_JOB_QUEUE_MAX; q++) queued[q] += g_queue_get_length(&s->worker[k].queue[q]);
+    dt_pthread_mutex_unlock(&s->worker[k].mutex);
+  }
+  dt_pthread_mutex_lock(&s->stats_mutex);
+  for(int q=0; q<DT_JOB_QUEUE_MAX; q++)
+  {
+    const dt_control_job_stats_t *st = s->stats + q;
+    // quantiles over the recent jobs only, nearest rank:
+    const int n = MIN(st->count, DT_CONTROL_STATS_SAMPLES);
+    double p[4] = {0.0};
+    if(n > 0)
+    {
+      float sorted[DT_CONTROL_STATS_SAMPLES];
+      for(int i=0; i<2; i++)
+      {
+        memcpy(sorted, i ? st->run_samples : st->wait_samples, sizeof(float)*n);
+        qsort(sorted, n, sizeof(float), _compare_float);
+        p[2*i]   = sorted[CLAMPS((int)(0.50f*n + 0.5f) - 1, 0, n-1)];
+        p[2*i+1] = sorted[CLAMPS((int)(0.95f*n + 0.5f) - 1, 0, n-1)];
+      }
+    }
+    func(_control_job_queue_name[q], queued[q], st, p[0], p[1], p[2], p[3], data);
+  }
+  dt_pthread_mutex_unlock(&s->stats_mutex);
+}
+
+static void _control_job_stats_print(const char *name, const int queued, const dt_control_job_stats_t *stats,
+                                     const double wait_p50, const double wait_p95,
+                                     const double run_p50, const double run_p95, void *data)
+{
+  dt_print(DT_DEBUG_CONTROL, "[control_summary_statistics] %-11s %6d jobs, %5d coalesced, %4d times blocked, "
+           "%4d left, wait p50 %.3fs p95 %.3fs, run p50 %.3fs p95 %.3fs, total run %.3fs\n",
+           name, stats->count, stats->coalesced, stats->blocked, queued,
+           wait_p50, wait_p95, run_p50, run_p95, stats->run);
+}
+
 int32_t dt_control_run_job_res(dt_control_t *s, int32_t res)
 {
   assert(res < DT_CTL_WORKER_RESERVED && res >= 0);
@@ -961,10 +1261,18 @@ int32_t dt_control_run_job_res(dt_control_t *s, int32_t res)
     _control_job_set_state (j,DT_JOB_STATE_RUNNING);
 
     /* execute job */
+    const double start = dt_get_wtime();
+    const int32_t threads = dt_control_lease_threads(s, j->queue);
+    dt_control_job_set_current(j);
     j->result = j->execute (j);
+    dt_control_job_set_current(NULL);
+    dt_control_release_threads(s, threads);
+    dt_trace_complete("job", j->description, start, NULL);
 
     _control_job_set_state (j,DT_JOB_STATE_FINISHED);
-    dt_print(DT_DEBUG_CONTROL, "[run_job-] %02d %f ", res, dt_get_wtime());
+    _control_job_stats_add(s, j, start);
+    dt_print(DT_DEBUG_CONTROL, "[run_job-] %02d %f class %d waited %.3fs ran %.3fs ", res, dt_get_wtime(),
+             j->queue, start - j->ts_queued, dt_get_wtime() - start);
     dt_control_job_print(j);
     dt_print(DT_DEBUG_CONTROL, "\n");
 
@@ -974,47 +1282,182 @@ int32_t dt_control_run_job_res(dt_control_t *s, int32_t res)
 }
 
 
-int32_t dt_control_run_job(dt_control_t *s)
+/* compares only what the job does, queued copies have their own state, timestamps and mutexes. */
+static inline int _control_job_equal(const dt_job_t *a, const dt_job_t *b)
 {
-  dt_job_t *j=NULL,*bj=NULL;
-  dt_pthread_mutex_lock(&s->queue_mutex);
+  if(a->execute != b->execute) return 0;
+  if(a->key || b->key) return a->key == b->key;
+  return !memcmp(a->param, b->param, sizeof(a->param));
+}
 
-  /* check if queue is empty */
-  if(g_list_length(s->queue) == 0)
+/* the lower the more urgent. jobs age into the next more urgent class every DT_CONTROL_JOB_AGING seconds. */
+static inline int64_t _control_job_urgency(const dt_job_t *j, const time_t now)
+{
+  return (int64_t)j->queue * DT_CONTROL_JOB_AGING - (int64_t)(now - j->ts_added);
+}
+
+/* the most urgent job of a worker deque. the owner takes the oldest job of each class, thieves
+   the newest, which the owner would get to last. call with the deque locked. */
+static GList *_control_worker_best(dt_control_worker_t *w, const int own, const time_t now,
+                                   int64_t *urgency, int *queue)
+{
+  GList *best = NULL;
+  for(int q=0; q<DT_JOB_QUEUE_MAX; q++)
   {
-    dt_pthread_mutex_unlock(&s->queue_mutex);
-    return -1;
+    GList *l = own ? w->queue[q].head : w->queue[q].tail;
+    if(!l) continue;
+    const int64_t u = _control_job_urgency((const dt_job_t *)l->data, now);
+    if(!best || u < *urgency)
+    {
+      best = l;
+      *urgency = u;
+      *queue = q;
+    }
   }
+  return best;
+}
 
-  /* go thru the queue and find one normal job and a background job
-      that is up for execution.*/
-  time_t ts_now = time(NULL);
-  GList *jobitem=g_list_first(s->queue);
-  if(jobitem)
-    do
+/* takes the most urgent job for worker k, from its own deque if it has one as urgent as any
+   other, otherwise stolen from the worker which has the most urgent one. */
+static dt_job_t *_control_take_job(dt_control_t *s, const int32_t k)
+{
+  if(__sync_fetch_and_add(&s->queued, 0) <= 0) return NULL;
+  const time_t now = time(NULL);
+  int64_t best = 0, u = 0;
+  int victim = -1, q = 0;
+  for(int i=0; i<s->num_threads; i++)
+  {
+    const int v = (k + i) % s->num_threads;
+    dt_control_worker_t *w = s->worker + v;
+    dt_pthread_mutex_lock(&w->mutex);
+    const GList *l = _control_worker_best(w, v == k, now, &u, &q);
+    dt_pthread_mutex_unlock(&w->mutex);
+    if(l && (victim < 0 || u < best))
     {
-      dt_job_t *tj = jobitem->data;
+      victim = v;
+      best = u;
+    }
+  }
+  if(victim < 0) return NULL;
 
-      /* check if it's a scheduled job and is waiting to be executed */
-      if(!bj && (tj->ts_execute > tj->ts_added) && tj->ts_execute <= ts_now)
-        bj = tj;
-      else if ((tj->ts_execute < tj->ts_added) && !j)
-        j = tj;
+  // someone may have been quicker, then the next best job of that deque is fine, too:
+  dt_job_t *j = NULL;
+  dt_control_worker_t *w = s->worker + victim;
+  dt_pthread_mutex_lock(&w->mutex);
+  GList *l = _control_worker_best(w, victim == k, now, &u, &q);
+  if(l)
+  {
+    j = (dt_job_t *)l->data;
+    g_queue_delete_link(&w->queue[q], l);
+    __sync_fetch_and_sub(&s->queued, 1);
+  }
+  dt_pthread_mutex_unlock(&w->mutex);
+  if(j && victim != k)
+    dt_print(DT_DEBUG_CONTROL, "[run_job] worker %d stole a job of worker %d\n", k, victim);
+  return j;
+}
 
-      /* if we got a normal job, and a background job, we are finished */
-      if(bj && j) break;
+/* looks for a queued job doing the same work as job. if remove is set it is dropped,
+   if revive is set it is moved to the front of the interactive queue of its deque.
+   returns 1 if there was one. */
+static int _control_find_job(dt_control_t *s, const dt_job_t *job, const int remove, const int revive)
+{
+  for(int k=0; k<s->num_threads; k++)
+  {
+    dt_control_worker_t *w = s->worker + k;
+    dt_pthread_mutex_lock(&w->mutex);
+    for(int q=0; q<DT_JOB_QUEUE_MAX; q++)
+    {
+      for(GList *l = w->queue[q].head; l; l = g_list_next(l))
+      {
+        dt_job_t *tj = (dt_job_t *)l->data;
+        if(!_control_job_equal(tj, job)) continue;
+        if(remove)
+        {
+          g_queue_delete_link(&w->queue[q], l);
+          __sync_fetch_and_sub(&s->queued, 1);
+          _control_job_set_state(tj, DT_JOB_STATE_DISCARDED);
+          g_free(tj);
+        }
+        else if(revive)
+        {
+          g_queue_delete_link(&w->queue[q], l);
+          tj->queue = DT_JOB_QUEUE_INTERACTIVE;
+          g_queue_push_head(&w->queue[DT_JOB_QUEUE_INTERACTIVE], tj);
+        }
+        dt_pthread_mutex_unlock(&w->mutex);
+        return 1;
+      }
+    }
+    dt_pthread_mutex_unlock(&w->mutex);
+  }
+  return 0;
+}
 
+/* folds a keyed job into a queued one with the same key, see dt_job_coalesce_t.
+   returns 1 if there was one, the incoming job is discarded then. */
+static int _control_coalesce_job(dt_control_t *s, dt_job_t *job)
+{
+  for(int k=0; k<s->num_threads; k++)
+  {
+    dt_control_worker_t *w = s->worker + k;
+    dt_pthread_mutex_lock(&w->mutex);
+    for(int q=0; q<DT_JOB_QUEUE_MAX; q++)
+    {
+      for(GList *l = w->queue[q].head; l; l = g_list_next(l))
+      {
+        dt_job_t *tj = (dt_job_t *)l->data;
+        if(!_control_job_equal(tj, job)) continue;
+        dt_job_t *kept = tj;
+        if(job->coalesce == DT_JOB_COALESCE_SUPERSEDE)
+        {
+          // the newer job takes over, but keeps the age of the one it replaces
+          kept = g_malloc(sizeof(dt_job_t));
+          memcpy(kept, job, sizeof(dt_job_t));
+          kept->ts_added = tj->ts_added;
+          _control_job_set_state(kept, DT_JOB_STATE_QUEUED);
+          if(job->merge) job->merge(kept, tj);
+          _control_job_set_state(tj, DT_JOB_STATE_DISCARDED);
+          g_free(tj);
+          l->data = kept;
+          kept->queue = q;
+        }
+        else if(tj->merge) tj->merge(tj, job);
+        _control_job_set_state(job, DT_JOB_STATE_DISCARDED);
+        // more urgent now that someone asked for it again:
+        if(job->queue < kept->queue)
+        {
+          g_queue_delete_link(&w->queue[q], l);
+          kept->queue = job->queue;
+          g_queue_push_head(&w->queue[kept->queue], kept);
+        }
+        dt_pthread_mutex_unlock(&w->mutex);
+        return 1;
+      }
     }
-    while ((jobitem = g_list_next(jobitem)));
+    dt_pthread_mutex_unlock(&w->mutex);
+  }
+  return 0;
+}
 
-  /* remove the found jobs from queue */
+int32_t dt_control_run_job(dt_control_t *s)
+{
+  dt_job_t *j=NULL,*bj=NULL;
+
+  /* find a scheduled background job that is up for execution */
+  dt_pthread_mutex_lock(&s->queue_mutex);
+  time_t ts_now = time(NULL);
+  for(GList *jobitem = s->queue; jobitem; jobitem = g_list_next(jobitem))
+  {
+    dt_job_t *tj = jobitem->data;
+    if(tj->ts_execute <= ts_now)
+    {
+      bj = tj;
+      break;
+    }
+  }
   if (bj)
     s->queue = g_list_remove(s->queue, bj);
-
-  if (j)
-    s->queue = g_list_remove(s->queue, j);
-
-  /* unlock the queue */
   dt_pthread_mutex_unlock(&s->queue_mutex);
 
   /* push background job on reserved background worker */
@@ -1023,10 +1466,20 @@ int32_t dt_control_run_job(dt_control_t *s)
     dt_control_add_job_res(s,bj,DT_CTL_WORKER_7);
     g_free (bj);
   }
+
+  j = _control_take_job(s, dt_control_get_threadid());
   /* don't continue if we don't have have a job to execute */
   if(!j)
     return -1;
 
+  /* there is room in the queue again, let waiting producers go on */
+  if(__sync_fetch_and_add(&s->blocked, 0) > 0)
+  {
+    dt_pthread_mutex_lock(&s->cond_mutex);
+    pthread_cond_broadcast(&s->cond);
+    dt_pthread_mutex_unlock(&s->cond_mutex);
+  }
+
   /* change state to running */
   dt_pthread_mutex_lock (&j->wait_mutex);
   if (dt_control_job_get_state (j) == DT_JOB_STATE_QUEUED)
@@ -1039,12 +1492,20 @@ int32_t dt_control_run_job(dt_control_t *s)
     _control_job_set_state (j,DT_JOB_STATE_RUNNING);
 
     /* execute job */
+    const double start = dt_get_wtime();
+    const int32_t threads = dt_control_lease_threads(s, j->queue);
+    dt_control_job_set_current(j);
     j->result = j->execute (j);
+    dt_control_job_set_current(NULL);
+    dt_control_release_threads(s, threads);
+    dt_trace_complete("job", j->description, start, NULL);
 
     _control_job_set_state (j,DT_JOB_STATE_FINISHED);
+    _control_job_stats_add(s, j, start);
 
-    dt_print(DT_DEBUG_CONTROL, "[run_job-] %02d %f ",
-             DT_CTL_WORKER_RESERVED+dt_control_get_threadid(), dt_get_wtime());
+    dt_print(DT_DEBUG_CONTROL, "[run_job-] %02d %f class %d waited %.3fs ran %.3fs ",
+             DT_CTL_WORKER_RESERVED+dt_control_get_threadid(), dt_get_wtime(),
+             j->queue, start - j->ts_queued, dt_get_wtime() - start);
     dt_control_job_print(j);
     dt_print(DT_DEBUG_CONTROL, "\n");
 
@@ -1066,6 +1527,7 @@ int32_t dt_control_add_job_res(dt_control_t *s, dt_job_t *job, int32_t res)
   dt_control_job_print(job);
   dt_print(DT_DEBUG_CONTROL, "\n");
   _control_job_set_state (job,DT_JOB_STATE_QUEUED);
+  job->ts_queued = dt_get_wtime();
   s->job_res[res] = *job;
   s->new_res[res] = 1;
   dt_pthread_mutex_unlock(&s->queue_mutex);
@@ -1094,45 +1556,77 @@ int32_t dt_control_add_job(dt_control_t *s, dt_job_t *job)
   /* set ts_added if unset */
   if (job->ts_added == 0)
     job->ts_added = time(NULL);
+  const int scheduled = job->ts_execute > job->ts_added;
 
-  dt_pthread_mutex_lock(&s->queue_mutex);
+  if(job->key && !scheduled && _control_coalesce_job(s, job))
+  {
+    dt_print(DT_DEBUG_CONTROL, "[add_job] coalesced with queued job %" G_GUINT64_FORMAT "\n", (guint64)job->key);
+    _control_job_stats_count(s, job->queue, 1, 0);
+    return -1;
+  }
 
   /* check if equivalent job exist in queue, and discard job
       if duplicate found .*/
-  GList *jobitem = g_list_first(s->queue);
-  if(jobitem)
-    do
-    {
-      if(!memcmp(job, jobitem->data, sizeof(dt_job_t)))
-      {
-        dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in queue\n");
-        _control_job_set_state (job,DT_JOB_STATE_DISCARDED);
-        dt_pthread_mutex_unlock(&s->queue_mutex);
-        return -1;
-      }
-    }
-    while((jobitem=g_list_next(jobitem)));
+  int found = _control_find_job(s, job, 0, 0);
+  dt_pthread_mutex_lock(&s->queue_mutex);
+  for(GList *jobitem = s->queue; jobitem && !found; jobitem = g_list_next(jobitem))
+    found = _control_job_equal(job, (dt_job_t *)jobitem->data);
+  if(found)
+  {
+    dt_print(DT_DEBUG_CONTROL, "[add_job] found job already in queue\n");
+    _control_job_set_state (job,DT_JOB_STATE_DISCARDED);
+    dt_pthread_mutex_unlock(&s->queue_mutex);
+    _control_job_stats_count(s, job->queue, 1, 0);
+    return -1;
+  }
 
-  dt_print(DT_DEBUG_CONTROL, "[add_job] %d ", g_list_length(s->queue));
+  dt_print(DT_DEBUG_CONTROL, "[add_job] %d %d ", job->queue, __sync_fetch_and_add(&s->queued, 0));
   dt_control_job_print(job);
   dt_print(DT_DEBUG_CONTROL, "\n");
 
-  /* add job to queue if not full, otherwise discard the job */
-  if( g_list_length(s->queue) < DT_CONTROL_MAX_JOBS)
+  /* allocate storage for the job, and set job state */
+  dt_job_t *thejob = g_malloc(sizeof(dt_job_t));
+  memcpy(thejob,job,sizeof(dt_job_t));
+  _control_job_set_state (thejob,DT_JOB_STATE_QUEUED);
+
+  if(scheduled)
   {
-    /* allocate storage for the job, and set job state */
-    dt_job_t *thejob = g_malloc(sizeof(dt_job_t));
-    memcpy(thejob,job,sizeof(dt_job_t));
-    _control_job_set_state (thejob,DT_JOB_STATE_QUEUED);
+    /* kept aside until it's time, then it goes to the reserved background worker */
     s->queue = g_list_append(s->queue, thejob);
     dt_pthread_mutex_unlock(&s->queue_mutex);
   }
   else
   {
-    dt_print(DT_DEBUG_CONTROL, "[add_job] too many jobs in queue!\n");
-    _control_job_set_state (job,DT_JOB_STATE_DISCARDED);
     dt_pthread_mutex_unlock(&s->queue_mutex);
-    return -1;
+
+    /* jobs added by a worker stay with it, the others are spread over all workers */
+    const int32_t threadid = dt_control_get_threadid();
+    const int32_t k = threadid < s->num_threads ? threadid
+                      : (int32_t)((uint32_t)__sync_fetch_and_add(&s->next_worker, 1) % s->num_threads);
+
+    /* back-pressure: threads producing lots of jobs wait for the queue to drain. not the gui,
+       and not the workers, they are the ones draining it. */
+    if(threadid >= s->num_threads && !pthread_equal(pthread_self(), s->gui_thread))
+    {
+      dt_pthread_mutex_lock(&s->cond_mutex);
+      __sync_fetch_and_add(&s->blocked, 1);
+      if(__sync_fetch_and_add(&s->queued, 0) >= DT_CONTROL_MAX_JOBS)
+      {
+        dt_print(DT_DEBUG_CONTROL, "[add_job] too many jobs in queue, waiting\n");
+        _control_job_stats_count(s, thejob->queue, 0, 1);
+      }
+      while(__sync_fetch_and_add(&s->queued, 0) >= DT_CONTROL_MAX_JOBS && dt_control_running())
+        dt_pthread_cond_wait(&s->cond, &s->cond_mutex);
+      __sync_fetch_and_sub(&s->blocked, 1);
+      dt_pthread_mutex_unlock(&s->cond_mutex);
+    }
+
+    thejob->ts_queued = dt_get_wtime();
+    dt_control_worker_t *w = s->worker + k;
+    dt_pthread_mutex_lock(&w->mutex);
+    g_queue_push_tail(&w->queue[thejob->queue], thejob);
+    __sync_fetch_and_add(&s->queued, 1);
+    dt_pthread_mutex_unlock(&w->mutex);
   }
 
   // notify workers
@@ -1142,32 +1636,29 @@ int32_t dt_control_add_job(dt_control_t *s, dt_job_t *job)
   return 0;
 }
 
+int32_t dt_control_remove_job(dt_control_t *s, dt_job_t *job)
+{
+  dt_print(DT_DEBUG_CONTROL, "[remove_job] ");
+  dt_control_job_print(job);
+  dt_print(DT_DEBUG_CONTROL, "\n");
+
+  /* find a queued job doing the same work and drop it. */
+  return _control_find_job(s, job, 1, 0) ? 1 : -1;
+}
+
+int32_t dt_control_jobs_queued(dt_control_t *s)
+{
+  return __sync_fetch_and_add(&s->queued, 0);
+}
+
 int32_t dt_control_revive_job(dt_control_t *s, dt_job_t *job)
 {
-  int32_t found_j = -1;
-  dt_pthread_mutex_lock(&s->queue_mutex);
   dt_print(DT_DEBUG_CONTROL, "[revive_job] ");
   dt_control_job_print(job);
   dt_print(DT_DEBUG_CONTROL, "\n");
 
-  /* find equivalent job and move it to top of the stack */
-  GList *jobitem = g_list_first(s->queue);
-  if (jobitem)
-    do
-    {
-      if(!memcmp(job, jobitem->data, sizeof(dt_job_t)))
-      {
-        s->queue = g_list_remove_link(s->queue, jobitem);
-        s->queue = g_list_insert(s->queue, jobitem->data, 0);
-        g_free(jobitem);
-        found_j = 1;
-        break;
-      }
-    }
-    while((jobitem=g_list_next(jobitem)));
-
-  /* unlock the queue */
-  dt_pthread_mutex_unlock(&s->queue_mutex);
+  /* find equivalent job and move it to the top, it is needed right now */
+  const int32_t found_j = _control_find_job(s, job, 0, 1) ? 1 : -1;
 
   /* notify workers */
   dt_pthread_mutex_lock(&s->cond_mutex);
@@ -1176,6 +1667,29 @@ int32_t dt_control_revive_job(dt_control_t *s, dt_job_t *job)
   return found_j;
 }
 
+int32_t dt_control_lease_threads(dt_control_t *s, const dt_job_queue_t queue)
+{
+  dt_pthread_mutex_lock(&s->threads_mutex);
+  const int32_t fair = MAX(1, darktable.num_openmp_threads / (s->threads_leases + 1));
+  const int32_t leased = queue == DT_JOB_QUEUE_INTERACTIVE ? fair : CLAMP(s->threads_free, 1, fair);
+  // may go below zero, by the interactive jobs and one thread per other job at most
+  s->threads_free -= leased;
+  s->threads_leases++;
+  dt_pthread_mutex_unlock(&s->threads_mutex);
+#ifdef _OPENMP
+  omp_set_num_threads(leased);
+#endif
+  return leased;
+}
+
+void dt_control_release_threads(dt_control_t *s, const int32_t leased)
+{
+  dt_pthread_mutex_lock(&s->threads_mutex);
+  s->threads_free += leased;
+  s->threads_leases--;
+  dt_pthread_mutex_unlock(&s->threads_mutex);
+}
+
 int32_t dt_control_get_threadid()
 {
   for(int k=0; k<darktable.control->num_threads; k++)
@@ -1266,6 +1780,7 @@ void *dt_control_expose(void *voidptr)
 {
   int width, height, pointerx, pointery;
   if(!darktable.gui->pixmap) return NULL;
+  const double start = dt_get_wtime();
   gdk_drawable_get_size(darktable.gui->pixmap, &width, &height);
   GtkWidget *widget = dt_ui_center(darktable.gui->ui);
   gtk_widget_get_pointer(widget, &pointerx, &pointery);
@@ -1389,6 +1904,9 @@ void *dt_control_expose(void *voidptr)
   cairo_destroy(cr_pixmap);
 
   cairo_surface_destroy(cst);
+
+  // remembered so the redraw throttle never asks for more than the gui can draw
+  darktable.control->expose_duration = dt_get_wtime() - start;
   return NULL;
 }
 
@@ -1609,14 +2127,49 @@ void dt_control_gdk_unlock()
   dt_pthread_mutex_unlock(&_control_gdk_lock_threads_mutex);
 }
 
+static gboolean _control_redraw_flush(gpointer data)
+{
+  dt_control_t *s = (dt_control_t *)data;
+  dt_pthread_mutex_lock(&s->redraw_mutex);
+  const int pending = s->redraw_pending;
+  s->redraw_pending = 0;
+  s->redraw_timeout = 0;
+  s->redraw_last_flush = dt_get_wtime();
+  dt_pthread_mutex_unlock(&s->redraw_mutex);
+
+  // a full redraw includes the center view
+  if(pending & DT_CONTROL_REDRAW_ALL)
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_CONTROL_REDRAW_ALL);
+  else if(pending & DT_CONTROL_REDRAW_CENTER)
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_CONTROL_REDRAW_CENTER);
+  return FALSE;
+}
+
+static void _control_queue_redraw(dt_control_t *s, int what)
+{
+  if(!dt_control_running()) return;
+  dt_pthread_mutex_lock(&s->redraw_mutex);
+  s->redraw_pending |= what;
+  if(!s->redraw_timeout)
+  {
+    // one flush per frame at most. if drawing the center takes longer than a frame,
+    // leave the gui thread as much time for events as it spends on exposing.
+    const double interval = MAX(DT_CONTROL_REDRAW_INTERVAL, 2.0 * s->expose_duration);
+    const double wait = s->redraw_last_flush + interval - dt_get_wtime();
+    const guint ms = wait > 0.0 ? (guint)(1000.0 * wait) : 0;
+    s->redraw_timeout = g_timeout_add_full(G_PRIORITY_HIGH_IDLE, ms, _control_redraw_flush, s, NULL);
+  }
+  dt_pthread_mutex_unlock(&s->redraw_mutex);
+}
+
 void dt_control_queue_redraw()
 {
-  dt_control_signal_raise(darktable.signals, DT_SIGNAL_CONTROL_REDRAW_ALL);
+  _control_queue_redraw(darktable.control, DT_CONTROL_REDRAW_ALL);
 }
 
 void dt_control_queue_redraw_center()
 {
-  dt_control_signal_raise(darktable.signals, DT_SIGNAL_CONTROL_REDRAW_CENTER);
+  _control_queue_redraw(darktable.control, DT_CONTROL_REDRAW_CENTER);
 }
 
 void dt_control_queue_redraw_widget(GtkWidget *widget)
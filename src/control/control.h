@@ -33,9 +33,16 @@
 #include "libs/lib.h"
 // #include "control/job.def"
 
-#define DT_CONTROL_MAX_JOBS 30
+// threads other than the gui and the workers wait while this many jobs are queued
+#define DT_CONTROL_MAX_JOBS 1000
+// seconds of waiting which make a job count as one class more urgent, so nothing starves
+#define DT_CONTROL_JOB_AGING 10
 #define DT_CONTROL_JOB_DEBUG
 #define DT_CONTROL_DESCRIPTION_LEN 256
+// minimum seconds between two flushes of queued redraws, i.e. the display refresh
+#define DT_CONTROL_REDRAW_INTERVAL (1.0/60.0)
+#define DT_CONTROL_REDRAW_CENTER 1
+#define DT_CONTROL_REDRAW_ALL 2
 // reserved workers
 #define DT_CTL_WORKER_RESERVED 8
 #define DT_CTL_WORKER_1 0 // dev load raw
@@ -74,13 +81,15 @@ void dt_ctl_set_display_profile();
 /** \brief request redraw of the workspace.
     This redraws the whole workspace within a gdk critical
     section to prevent several threads to carry out a redraw
-    which will end up in crashes.
+    which will end up in crashes. Requests are merged and
+    flushed at most once per frame, see DT_CONTROL_REDRAW_INTERVAL.
  */
 void dt_control_queue_redraw();
 
 /** \brief request redraw of center window.
     This redraws the center view within a gdk critical section
-    to prevent several threads to carry out the redraw.
+    to prevent several threads to carry out the redraw. Merged
+    with other pending requests like dt_control_queue_redraw().
 */
 void dt_control_queue_redraw_center();
 
@@ -148,6 +157,39 @@ typedef void (*dt_job_state_change_callback)(struct dt_job_t*,int state);
 #define DT_JOB_STATE_FINISHED		3
 #define DT_JOB_STATE_CANCELLED		4
 #define DT_JOB_STATE_DISCARDED		5
+/** job classes, in order of priority */
+typedef enum dt_job_queue_t
+{
+  DT_JOB_QUEUE_INTERACTIVE = 0, // the user is waiting for it
+  DT_JOB_QUEUE_PREFETCH,        // thumbnails which will be needed soon
+  DT_JOB_QUEUE_BACKGROUND,      // imports, sidecars and other bulk work
+  DT_JOB_QUEUE_EXPORT,          // exports, few but long running
+  DT_JOB_QUEUE_MAX
+}
+dt_job_queue_t;
+#define DT_CONTROL_STATS_SAMPLES 256
+/** rolling statistics of the jobs of one class, times in seconds. */
+typedef struct dt_control_job_stats_t
+{
+  int count;      // jobs run
+  int coalesced;  // jobs folded into an equivalent queued one
+  int blocked;    // producers which had to wait for the DT_CONTROL_MAX_JOBS queued jobs to drain
+  double wait, run;
+  float wait_samples[DT_CONTROL_STATS_SAMPLES], run_samples[DT_CONTROL_STATS_SAMPLES];
+}
+dt_control_job_stats_t;
+/** callback of dt_control_job_statistics(), called once per job class with its current queue depth. */
+typedef void (*dt_control_job_stats_func_t)(const char *name, const int queued, const dt_control_job_stats_t *stats,
+    const double wait_p50, const double wait_p95, const double run_p50, const double run_p95, void *data);
+/** what happens when a job is added while one with the same key is queued */
+typedef enum dt_job_coalesce_t
+{
+  DT_JOB_COALESCE_MERGE = 0, // the queued job stays, the new one is merged into it
+  DT_JOB_COALESCE_SUPERSEDE  // the new job takes the place of the queued one
+}
+dt_job_coalesce_t;
+/** hands the work of the dropped job over to the kept one, dropped is discarded afterwards. */
+typedef void (*dt_job_merge_callback)(struct dt_job_t *kept, struct dt_job_t *dropped);
 typedef struct dt_job_t
 {
   int32_t (*execute) (struct dt_job_t *job);
@@ -158,6 +200,8 @@ typedef struct dt_job_t
   /* if job is a delayed job it will be run as a backgroundjob
       and ts_execute will be the timestamp of when to start job */
   time_t ts_execute;
+  /* dt_get_wtime() when the job was queued, for the statistics */
+  double ts_queued;
 
   dt_pthread_mutex_t state_mutex;
   dt_pthread_mutex_t wait_mutex;
@@ -166,6 +210,11 @@ typedef struct dt_job_t
   dt_job_state_change_callback state_changed_cb;
   void *user_data;
 
+  dt_job_queue_t queue;
+  uint64_t key;
+  dt_job_coalesce_t coalesce;
+  dt_job_merge_callback merge;
+
   int32_t param[32];
 #ifdef DT_CONTROL_JOB_DEBUG
   char description[DT_CONTROL_DESCRIPTION_LEN];
@@ -177,7 +226,16 @@ dt_job_t;
 void dt_control_job_init(dt_job_t *j, const char *msg, ...);
 /** setup a state callback for job. */
 void dt_control_job_set_state_callback(dt_job_t *j,dt_job_state_change_callback cb,void *user_data);
+/** sets the class of a job, it is DT_JOB_QUEUE_INTERACTIVE after init. */
+void dt_control_job_set_queue(dt_job_t *j, dt_job_queue_t queue);
+/** jobs of the same kind with the same key do the same work and are coalesced in the queue.
+    merge may be NULL if the parameters don't own anything. key 0 compares the parameters. */
+void dt_control_job_set_key(dt_job_t *j, uint64_t key, dt_job_coalesce_t coalesce, dt_job_merge_callback merge);
 void dt_control_job_print(dt_job_t *j);
+/** the job the calling thread works for, NULL outside of jobs. */
+dt_job_t *dt_control_job_get_current();
+/** to be called by threads a job hands parts of its work to, such as openmp threads. */
+void dt_control_job_set_current(dt_job_t *j);
 /** cancel a job, running or in queue. */
 void dt_control_job_cancel(dt_job_t *j);
 int dt_control_job_get_state(dt_job_t *j);
@@ -241,6 +299,13 @@ typedef struct dt_control_t
   dt_ctl_settings_t global_settings, global_defaults;
   dt_pthread_mutex_t global_mutex, image_mutex;
   double last_expose_time;
+
+  // redraw throttle: pending DT_CONTROL_REDRAW_* bits, flushed once per frame
+  dt_pthread_mutex_t redraw_mutex;
+  int redraw_pending;
+  guint redraw_timeout;
+  double redraw_last_flush;
+  double expose_duration;
   int key_accelerators_on;
 
   // xatom color profile:
@@ -255,10 +320,23 @@ typedef struct dt_control_t
   pthread_cond_t cond;
   int32_t num_threads;
   pthread_t *thread,kick_on_workers_thread;
+  // jobs scheduled for later, see dt_control_add_background_job()
   GList *queue;
+  // one deque per worker with a queue per job class. jobs added by a worker stay
+  // with it, idle workers steal from the others.
+  struct dt_control_worker_t *worker;
+  int32_t queued, next_worker, blocked;
   dt_job_t job_res[DT_CTL_WORKER_RESERVED];
   uint8_t new_res[DT_CTL_WORKER_RESERVED];
   pthread_t thread_res[DT_CTL_WORKER_RESERVED];
+  // the job the calling thread works for
+  pthread_key_t job_key;
+  // openmp threads not leased to a running job, out of darktable.num_openmp_threads
+  dt_pthread_mutex_t threads_mutex;
+  int32_t threads_free, threads_leases;
+  // per job class, protected by stats_mutex
+  dt_pthread_mutex_t stats_mutex;
+  dt_control_job_stats_t stats[DT_JOB_QUEUE_MAX];
 
   /* proxy */
   struct
@@ -301,6 +379,10 @@ int32_t dt_control_add_job(dt_control_t *s, dt_job_t *job);
 /** adds a job to queue tagged as background job and with a delay */
 int32_t dt_control_add_background_job(dt_control_t *s, dt_job_t *job, time_t delay);
 int32_t dt_control_revive_job(dt_control_t *s, dt_job_t *job);
+/** removes a queued job doing the same work as the given one, returns -1 if there was none. */
+int32_t dt_control_remove_job(dt_control_t *s, dt_job_t *job);
+/** number of jobs waiting in the queues of the workers. */
+int32_t dt_control_jobs_queued(dt_control_t *s);
 int32_t dt_control_run_job_res(dt_control_t *s, int32_t res);
 int32_t dt_control_add_job_res(dt_control_t *s, dt_job_t *job, int32_t res);
 
@@ -310,6 +392,14 @@ void *dt_control_work(void *ptr);
 void *dt_control_work_res(void *ptr);
 int32_t dt_control_get_threadid();
 int32_t dt_control_get_threadid_res();
+/** leases openmp threads out of the global budget for the job running in the calling thread,
+    and sets them for its parallel regions. interactive jobs get their fair share even if
+    that oversubscribes, all others what is left. returns the number of threads. */
+int32_t dt_control_lease_threads(dt_control_t *s, const dt_job_queue_t queue);
+/** gives leased threads back to the budget. */
+void dt_control_release_threads(dt_control_t *s, const int32_t leased);
+/** reports queue depth, wait and run time quantiles over the recent jobs of each class. */
+void dt_control_job_statistics(dt_control_t *s, dt_control_job_stats_func_t func, void *data);
 
 static inline int32_t dt_ctl_get_num_procs()
 {
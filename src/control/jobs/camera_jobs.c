@@ -17,6 +17,8 @@
 */
 #include "common/darktable.h"
 #include "common/camera_control.h"
+#include "common/mipmap_cache.h"
+#include "common/styles.h"
 #include "common/utility.h"
 #include "views/view.h"
 #include "control/conf.h"
@@ -38,6 +40,21 @@ int32_t dt_captured_image_import_job_run(dt_job_t *job)
   int id = dt_image_import(t->film_id, t->filename, TRUE);
   if(id)
   {
+    // the tethering style goes onto the history before any thumbnail exists, so nothing
+    // is rendered twice.
+    gchar *style = dt_conf_get_string("plugins/capture/tethering_style");
+    if(style && *style && dt_styles_exists(style))
+      dt_styles_apply_to_image(style, FALSE, id);
+    g_free(style);
+
+    // fast path: show the embedded jpg at the size the capture view draws right away. the
+    // processed thumbnail (reduced resolution pipe, with the style) replaces it from the
+    // background queue, and the full raw is loaded after that for the darkroom.
+    const dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache,
+                                 .97f*darktable.thumbnail_width, .97f*darktable.thumbnail_height);
+    dt_mipmap_cache_fill_preliminary(darktable.mipmap_cache, id, mip);
+    dt_mipmap_cache_prefetch(darktable.mipmap_cache, id, DT_MIPMAP_FULL);
+
     //dt_film_open(1);
     dt_view_filmstrip_set_active_image(darktable.view_manager,id);
     dt_control_queue_redraw();
@@ -282,13 +299,73 @@ void dt_camera_import_job_init(dt_job_t *job,char *jobcode, char *path,char *fil
   t->import_count=0;
 }
 
+/** downloaded files waiting to be imported. the import thread takes all of them at once and hands
+    them to the batched film import, while the next files come off the camera. */
+typedef struct dt_camera_import_queue_t
+{
+  dt_pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  GPtrArray *files;
+  gboolean done;
+}
+dt_camera_import_queue_t;
+
+static int _camera_import_filename_cmp(gconstpointer a, gconstpointer b)
+{
+  return g_strcmp0(*(const gchar **)a, *(const gchar **)b);
+}
+
+static void _camera_import_files(GPtrArray *files)
+{
+  // one batch per directory, the variables in the import path might spread the files over a few:
+  g_ptr_array_sort(files, _camera_import_filename_cmp);
+  guint start = 0;
+  while(start < files->len)
+  {
+    gchar *dirname = g_path_get_dirname(g_ptr_array_index(files, start));
+    guint end = start + 1;
+    while(end < files->len)
+    {
+      gchar *d = g_path_get_dirname(g_ptr_array_index(files, end));
+      const int same = !strcmp(d, dirname);
+      g_free(d);
+      if(!same) break;
+      end++;
+    }
+    dt_film_import_files(dirname, (gchar **)files->pdata + start, end - start);
+    g_free(dirname);
+    start = end;
+  }
+}
+
+static void *_camera_import_thread(void *data)
+{
+  dt_camera_import_queue_t *q = (dt_camera_import_queue_t *)data;
+  dt_pthread_mutex_lock(&q->mutex);
+  while(TRUE)
+  {
+    while(!q->files->len && !q->done) dt_pthread_cond_wait(&q->cond, &q->mutex);
+    if(!q->files->len) break;
+    GPtrArray *files = q->files;
+    q->files = g_ptr_array_new_with_free_func(g_free);
+    dt_pthread_mutex_unlock(&q->mutex);
+    _camera_import_files(files);
+    g_ptr_array_free(files, TRUE);
+    dt_pthread_mutex_lock(&q->mutex);
+  }
+  dt_pthread_mutex_unlock(&q->mutex);
+  return NULL;
+}
+
 /** Listener interface for import job */
 void _camera_image_downloaded(const dt_camera_t *camera,const char *filename,void *data)
 {
-  // Import downloaded image to import filmroll
+  // queue the downloaded image for the import thread, and go on with the next one
   dt_camera_import_t *t = (dt_camera_import_t *)data;
-  dt_image_import(t->film->id, filename, FALSE);
-  dt_control_queue_redraw_center();
+  dt_pthread_mutex_lock(&t->queue->mutex);
+  g_ptr_array_add(t->queue->files, g_strdup(filename));
+  pthread_cond_signal(&t->queue->cond);
+  dt_pthread_mutex_unlock(&t->queue->mutex);
   dt_control_log(_("%d/%d imported to %s"), t->import_count+1,g_list_length(t->images), g_path_get_basename(filename));
 
   t->fraction+=1.0/g_list_length(t->images);
@@ -426,10 +503,32 @@ int32_t dt_camera_import_job_run(dt_job_t *job)
     listener.request_image_path=_camera_import_request_image_path;
     listener.request_image_filename=_camera_import_request_image_filename;
 
+    // the import runs on its own thread, so it doesn't hold up the transfer:
+    dt_camera_import_queue_t queue;
+    dt_pthread_mutex_init(&queue.mutex, NULL);
+    pthread_cond_init(&queue.cond, NULL);
+    queue.files = g_ptr_array_new_with_free_func(g_free);
+    queue.done = FALSE;
+    t->queue = &queue;
+    pthread_t import_thread;
+    const int import_running = !pthread_create(&import_thread, NULL, _camera_import_thread, &queue);
+
     //  start download of images
     dt_camctl_register_listener(darktable.camctl,&listener);
     dt_camctl_import(darktable.camctl,t->camera,t->images,dt_conf_get_bool("plugins/capture/camera/import/delete_originals"));
     dt_camctl_unregister_listener(darktable.camctl,&listener);
+
+    // let the import catch up with the last files:
+    dt_pthread_mutex_lock(&queue.mutex);
+    queue.done = TRUE;
+    pthread_cond_signal(&queue.cond);
+    dt_pthread_mutex_unlock(&queue.mutex);
+    if(import_running) pthread_join(import_thread, NULL);
+    else _camera_import_thread(&queue);
+    g_ptr_array_free(queue.files, TRUE);
+    pthread_cond_destroy(&queue.cond);
+    dt_pthread_mutex_destroy(&queue.mutex);
+    t->queue = NULL;
     dt_control_backgroundjobs_destroy(darktable.control, t->bgj);
     dt_variables_params_destroy(t->vp);
   }
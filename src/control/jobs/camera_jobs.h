@@ -76,6 +76,7 @@ typedef struct dt_camera_import_t
   gchar *path;
   gchar *filename;
   uint32_t import_count;
+  struct dt_camera_import_queue_t *queue;
 }
 dt_camera_import_t;
 int32_t dt_camera_import_job_run(dt_job_t *job);
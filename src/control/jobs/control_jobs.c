@@ -21,6 +21,7 @@
 #include "common/image.h"
 #include "common/image_cache.h"
 #include "common/mipmap_cache.h"
+#include "common/numa.h"
 #include "common/imageio.h"
 #include "common/imageio_dng.h"
 #include "common/exif.h"
@@ -31,11 +32,14 @@
 #include "common/tags.h"
 #include "common/debug.h"
 #include "common/gpx.h"
+#include "common/utility.h"
 #include "control/conf.h"
 #include "control/jobs/control_jobs.h"
+#include "develop/lightroom.h"
 
 #include "gui/gtk.h"
 
+#include <errno.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 
@@ -59,10 +63,34 @@ void dt_control_write_sidecar_files()
   dt_control_add_job(darktable.control, &j);
 }
 
+/* a queued enumerator job takes over the images of another one it is coalesced with. */
+static void _control_image_enumerator_merge(dt_job_t *kept, dt_job_t *dropped)
+{
+  dt_control_image_enumerator_t *k = (dt_control_image_enumerator_t *)kept->param;
+  dt_control_image_enumerator_t *d = (dt_control_image_enumerator_t *)dropped->param;
+  GHashTable *ids = g_hash_table_new(NULL, NULL);
+  for(GList *l = k->index; l; l = g_list_next(l))
+    g_hash_table_insert(ids, l->data, l->data);
+  GList *added = NULL;
+  for(GList *l = d->index; l; l = g_list_next(l))
+  {
+    if(g_hash_table_lookup(ids, l->data)) continue;
+    g_hash_table_insert(ids, l->data, l->data);
+    added = g_list_prepend(added, l->data);
+  }
+  k->index = g_list_concat(k->index, g_list_reverse(added));
+  g_list_free(d->index);
+  d->index = NULL;
+  g_hash_table_destroy(ids);
+}
+
 void dt_control_write_sidecar_files_job_init(dt_job_t *job)
 {
   dt_control_job_init(job, "write sidecar files");
   job->execute = &dt_control_write_sidecar_files_job_run;
+  dt_control_job_set_queue(job, DT_JOB_QUEUE_BACKGROUND);
+  // bursts of requests write each sidecar once
+  dt_control_job_set_key(job, 1, DT_JOB_COALESCE_MERGE, _control_image_enumerator_merge);
   dt_control_image_enumerator_t *t = (dt_control_image_enumerator_t *)job->param;
   dt_control_image_enumerator_job_selected_init(t);
 }
@@ -130,6 +158,9 @@ int32_t dt_control_merge_hdr_job_run(dt_job_t *job)
   while(t)
   {
     imgid = (long int)t->data;
+    // have the next bracket decoded by a worker while this one is merged:
+    if(t->next)
+      dt_mipmap_cache_read_get(darktable.mipmap_cache, NULL, (long int)t->next->data, DT_MIPMAP_FULL, DT_MIPMAP_PREFETCH);
     dt_mipmap_buffer_t buf;
     dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING);
     // just take a copy. also do it after blocking read, so filters and bpp will make sense.
@@ -184,8 +215,21 @@ int32_t dt_control_merge_hdr_job_run(dt_job_t *job)
     const float photoncnt = 100.0f*aperture*exp/iso;
     // stupid, but we don't know the real sensor saturation level:
     uint16_t saturation = 0;
-    for(int k=0; k<wd*ht; k++)
-      saturation = MAX(saturation, ((uint16_t *)buf.buf)[k]);
+#ifdef _OPENMP
+    #pragma omp parallel default(none) shared(buf, wd, ht, saturation)
+#endif
+    {
+      uint16_t sat = 0;
+#ifdef _OPENMP
+      #pragma omp for schedule(static) nowait
+#endif
+      for(int k=0; k<wd*ht; k++)
+        sat = MAX(sat, ((uint16_t *)buf.buf)[k]);
+#ifdef _OPENMP
+      #pragma omp critical
+#endif
+      saturation = MAX(saturation, sat);
+    }
     // seems to be around 64500--64700 for 5dm2
     // fprintf(stderr, "saturation: %u\n", saturation);
     whitelevel = fmaxf(whitelevel, saturation*cal);
@@ -294,6 +338,7 @@ int32_t dt_control_flip_images_job_run(dt_job_t *job)
   char message[512]= {0};
   snprintf(message, 512, ngettext ("flipping %d image", "flipping %d images", total), total );
   const guint *jid = dt_control_backgroundjobs_create(darktable.control, 0, message);
+  dt_image_cache_write_batch_begin(darktable.image_cache);
   while(t)
   {
     imgid = (long int)t->data;
@@ -302,19 +347,51 @@ int32_t dt_control_flip_images_job_run(dt_job_t *job)
     fraction=1.0/total;
     dt_control_backgroundjobs_progress(darktable.control, jid, fraction);
   }
+  dt_image_cache_write_batch_end(darktable.image_cache);
   dt_control_backgroundjobs_destroy(darktable.control, jid);
   dt_control_queue_redraw_center();
   return 0;
 }
 
+// images imported per transaction, their xmps are parsed in parallel:
+#define DT_CONTROL_LIGHTROOM_BATCH 64
+
+int32_t dt_control_lightroom_import_job_run(dt_job_t *job)
+{
+  dt_control_image_enumerator_t *t1 = (dt_control_image_enumerator_t *)job->param;
+  GList *t = t1->index;
+  const int total = g_list_length(t);
+  int done = 0, imported = 0;
+  char message[512]= {0};
+  snprintf(message, 512, ngettext ("importing lightroom xmp of %d image", "importing lightroom xmps of %d images", total), total );
+  const guint *jid = dt_control_backgroundjobs_create(darktable.control, 0, message);
+  dt_control_backgroundjobs_set_cancellable(darktable.control, jid, job);
+  int32_t imgid[DT_CONTROL_LIGHTROOM_BATCH];
+  while(t && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
+  {
+    int n = 0;
+    while(t && n < DT_CONTROL_LIGHTROOM_BATCH)
+    {
+      imgid[n++] = (long int)t->data;
+      t = g_list_delete_link(t, t);
+    }
+    imported += dt_lightroom_import_batch(imgid, n);
+    done += n;
+    dt_control_backgroundjobs_progress(darktable.control, jid, done/(double)total);
+  }
+  g_list_free(t);
+  dt_control_backgroundjobs_destroy(darktable.control, jid);
+  dt_control_log(ngettext("imported lightroom xmp of %d image", "imported lightroom xmps of %d images", imported), imported);
+  dt_control_queue_redraw_center();
+  return 0;
+}
+
 int32_t dt_control_remove_images_job_run(dt_job_t *job)
 {
-  long int imgid = -1;
   dt_control_image_enumerator_t *t1 = (dt_control_image_enumerator_t *)job->param;
   GList *t = t1->index;
   int total = g_list_length(t);
   char message[512]= {0};
-  double fraction=0;
   snprintf(message, 512, ngettext ("removing %d image", "removing %d images", total), total );
   const guint *jid = dt_control_backgroundjobs_create(darktable.control, 0, message);
 
@@ -324,33 +401,39 @@ int32_t dt_control_remove_images_job_run(dt_job_t *job)
 
   dt_collection_update(darktable.collection);
 
-  // We need a list of files to regenerate .xmp files if there are duplicates
-  GList *list = NULL;
+  // list the images once, the rest is done for all of them at once:
   sqlite3_stmt *stmt = NULL;
-
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select distinct folder || '/' || filename from images, film_rolls where images.film_id = film_rolls.id and images.id in (select imgid from selected_images)", -1, &stmt, NULL);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    list = g_list_append(list, g_strdup((const gchar *)sqlite3_column_text(stmt, 0)));
-  }
-  sqlite3_finalize(stmt);
-
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "delete from memory.removed_images", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "begin", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "insert or ignore into memory.removed_images values (?1)", -1, &stmt, NULL);
   while(t)
   {
-    imgid = (long int)t->data;
-    dt_image_remove(imgid);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, (long int)t->data);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
     t = g_list_delete_link(t, t);
-    fraction=1.0/total;
-    dt_control_backgroundjobs_progress(darktable.control, jid, fraction);
   }
+  sqlite3_finalize(stmt);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "commit", NULL, NULL, NULL);
 
-  char *imgname;
+  // the .xmp files of remaining duplicates have to be regenerated:
+  GList *list = dt_image_remove_batch();
+  dt_control_backgroundjobs_progress(darktable.control, jid, 0.5);
+
+  const int files = g_list_length(list);
+  int k = 0;
   while(list)
   {
-    imgname = (char *)list->data;
-    dt_image_synch_all_xmp(imgname);
+    dt_image_synch_all_xmp((const gchar *)list->data);
+    g_free(list->data);
     list = g_list_delete_link(list, list);
+    dt_control_backgroundjobs_progress(darktable.control, jid, 0.5 + 0.5*(++k)/files);
   }
+  if(files > 0 && dt_conf_get_bool("write_sidecar_files"))
+    dt_control_log(ngettext("updated the sidecars of %d file with remaining duplicates",
+                            "updated the sidecars of %d files with remaining duplicates", files), files);
+
   dt_control_backgroundjobs_destroy(darktable.control, jid);
   dt_film_remove_empty();
   dt_control_queue_redraw_center();
@@ -461,6 +544,7 @@ int32_t dt_control_gpx_apply_job_run(dt_job_t *job)
   GTimeZone *tz_utc = g_time_zone_new_utc();
 
   /* go thru each selected image and lookup location in gpx */
+  dt_image_cache_write_batch_begin(darktable.image_cache);
   do
   {
     GTimeVal timestamp;
@@ -517,6 +601,7 @@ int32_t dt_control_gpx_apply_job_run(dt_job_t *job)
 
   }
   while((t = g_list_next(t)) != NULL);
+  dt_image_cache_write_batch_end(darktable.image_cache);
 
   dt_control_log(_("applied matched gpx location onto %d image(s)"), cntr);
 
@@ -589,6 +674,14 @@ void dt_control_flip_images_job_init(dt_job_t *job, const int32_t cw)
   t->flag = cw;
 }
 
+void dt_control_lightroom_import_job_init(dt_job_t *job)
+{
+  dt_control_job_init(job, "import lightroom xmps");
+  job->execute = &dt_control_lightroom_import_job_run;
+  dt_control_image_enumerator_t *t = (dt_control_image_enumerator_t *)job->param;
+  dt_control_image_enumerator_job_selected_init(t);
+}
+
 void dt_control_remove_images_job_init(dt_job_t *job)
 {
   dt_control_job_init(job, "remove images");
@@ -610,6 +703,7 @@ void dt_control_gpx_apply_job_init(dt_job_t *job, const gchar *filename, int32_t
 {
   dt_control_job_init(job, "gpx apply");
   job->execute = &dt_control_gpx_apply_job_run;
+  dt_control_job_set_queue(job, DT_JOB_QUEUE_BACKGROUND);
   dt_control_image_enumerator_t *t = (dt_control_image_enumerator_t *)job->param;
   if (filmid != -1)
     dt_control_image_enumerator_job_film_init(t, filmid);
@@ -653,6 +747,13 @@ void dt_control_flip_images(const int32_t cw)
   dt_control_add_job(darktable.control, &j);
 }
 
+void dt_control_lightroom_import()
+{
+  dt_job_t j;
+  dt_control_lightroom_import_job_init(&j);
+  dt_control_add_job(darktable.control, &j);
+}
+
 void dt_control_remove_images()
 {
   if(dt_conf_get_bool("ask_before_remove"))
@@ -711,9 +812,50 @@ void dt_control_delete_images()
   dt_control_add_job(darktable.control, &j);
 }
 
+// copies the files of a copy job to newdir on a few threads at a time, before dt_image_copy() adds
+// them to the library one by one. that finds them in place and takes them as they are.
+static void _fileop_copy_files(dt_job_t *job, GList *t, const gchar *newdir, const guint *jid)
+{
+  int total = g_list_length(t);
+  gchar **src = (gchar **)g_malloc0(sizeof(gchar *)*total);
+  int k = 0;
+  for(GList *l = t; l; l = g_list_next(l), k++)
+  {
+    gchar path[DT_MAX_PATH_LEN] = {0};
+    dt_image_full_path(GPOINTER_TO_INT(l->data), path, DT_MAX_PATH_LEN);
+    src[k] = g_strdup(path);
+  }
+
+  int done = 0;
+  const __attribute__((__unused__)) int num_threads = CLAMPS(dt_conf_get_int("plugins/lighttable/copy/parallel_files"), 1, 16);
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) default(none) shared(src, newdir, job, jid, total, done, darktable, stderr) num_threads(num_threads)
+#endif
+  for(int i=0; i<total; i++)
+  {
+    if(dt_control_job_get_state(job) == DT_JOB_STATE_CANCELLED) continue;
+    gchar *imgbname = g_path_get_basename(src[i]);
+    gchar *destpath = g_build_filename(newdir, imgbname, NULL);
+    const int err = dt_util_copy_file(src[i], destpath, FALSE);
+    // dt_image_copy() will complain again, with the image it belongs to:
+    if(err && err != EEXIST) fprintf(stderr, "[copy images] failed to copy `%s': %s\n", src[i], g_strerror(err));
+    g_free(destpath);
+    g_free(imgbname);
+    int d;
+#ifdef _OPENMP
+    #pragma omp atomic capture
+#endif
+    d = ++done;
+    dt_control_backgroundjobs_progress(darktable.control, jid, d/(double)total);
+  }
+
+  for(int i=0; i<total; i++) g_free(src[i]);
+  g_free(src);
+}
+
 static int32_t _generic_dt_control_fileop_images_job_run(dt_job_t *job,
     int32_t (*fileop_callback)(const int32_t, const int32_t),
-    const char *desc, const char *desc_pl)
+    const char *desc, const char *desc_pl, const gboolean copy_first)
 {
   dt_control_image_enumerator_t *t1 = (dt_control_image_enumerator_t *)job->param;
   GList *t = t1->index;
@@ -730,21 +872,25 @@ static int32_t _generic_dt_control_fileop_images_job_run(dt_job_t *job,
   // create new film roll for the destination directory
   dt_film_t new_film;
   const int32_t film_id = dt_film_new(&new_film, newdir);
-  g_free(newdir);
 
   if (film_id <= 0)
   {
     dt_control_log(_("failed to create film roll for destination directory, aborting move.."));
+    g_free(newdir);
     dt_control_backgroundjobs_destroy(darktable.control, jid);
     return -1;
   }
 
+  // the file transfers can overlap, the library updates below can't:
+  if(copy_first) _fileop_copy_files(job, t, newdir, jid);
+  g_free(newdir);
+
   while(t && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
   {
     fileop_callback(GPOINTER_TO_INT(t->data), film_id);
     t = g_list_delete_link(t, t);
-    fraction=1.0/total;
-    dt_control_backgroundjobs_progress(darktable.control, jid, fraction);
+    fraction+=1.0/total;
+    if(!copy_first) dt_control_backgroundjobs_progress(darktable.control, jid, fraction);
   }
 
   char collect[1024];
@@ -888,13 +1034,136 @@ void dt_control_copy_images_job_init(dt_job_t *job)
 int32_t dt_control_move_images_job_run(dt_job_t *job)
 {
   return _generic_dt_control_fileop_images_job_run(job, &dt_image_move,
-         _("moving %d image"), _("moving %d images"));
+         _("moving %d image"), _("moving %d images"), FALSE);
 }
 
 int32_t dt_control_copy_images_job_run(dt_job_t *job)
 {
   return _generic_dt_control_fileop_images_job_run(job, &dt_image_copy,
-         _("copying %d image"), _("copying %d images"));
+         _("copying %d image"), _("copying %d images"), TRUE);
+}
+
+// uploads of a running export job, done by their own thread so the render threads don't wait for
+// the network. the storages keep one connection per export, so there is one upload at a time.
+typedef struct dt_control_export_uploads_t
+{
+  const void *sdata;
+  dt_pthread_mutex_t mutex;
+  pthread_cond_t cond;     // signalled when an upload is queued or taken, and when rendering is done
+  GQueue *pending;
+  int max_pending;
+  int done;
+  int failed;              // uploads which went wrong, only touched by the thread until it is joined
+  pthread_t thread;
+}
+dt_control_export_uploads_t;
+
+typedef struct dt_control_export_upload_t
+{
+  int (*upload)(void *data);
+  void *data;
+}
+dt_control_export_upload_t;
+
+G_LOCK_DEFINE_STATIC(export_uploads);
+static GList *_export_uploads = NULL;
+
+static void *_export_upload_thread(void *ptr)
+{
+  dt_control_export_uploads_t *u = (dt_control_export_uploads_t *)ptr;
+  while(1)
+  {
+    dt_pthread_mutex_lock(&u->mutex);
+    while(g_queue_is_empty(u->pending) && !u->done) dt_pthread_cond_wait(&u->cond, &u->mutex);
+    dt_control_export_upload_t *item = (dt_control_export_upload_t *)g_queue_pop_head(u->pending);
+    pthread_cond_broadcast(&u->cond);
+    dt_pthread_mutex_unlock(&u->mutex);
+    // nothing left and nothing to come:
+    if(!item) break;
+    if(item->upload(item->data)) u->failed++;
+    free(item);
+  }
+  return NULL;
+}
+
+static dt_control_export_uploads_t *_export_uploads_start(const void *sdata)
+{
+  dt_control_export_uploads_t *u = (dt_control_export_uploads_t *)malloc(sizeof(dt_control_export_uploads_t));
+  u->sdata = sdata;
+  dt_pthread_mutex_init(&u->mutex, NULL);
+  pthread_cond_init(&u->cond, NULL);
+  u->pending = g_queue_new();
+  // every pending upload is a temporary file waiting on disk:
+  u->max_pending = MAX(1, dt_conf_get_int("plugins/lighttable/export/pending_uploads"));
+  u->done = 0;
+  u->failed = 0;
+  if(pthread_create(&u->thread, NULL, _export_upload_thread, u))
+  {
+    // uploads will just be done by the render threads
+    g_queue_free(u->pending);
+    pthread_cond_destroy(&u->cond);
+    dt_pthread_mutex_destroy(&u->mutex);
+    free(u);
+    return NULL;
+  }
+  G_LOCK(export_uploads);
+  _export_uploads = g_list_prepend(_export_uploads, u);
+  G_UNLOCK(export_uploads);
+  return u;
+}
+
+// waits for the pending uploads to go out, returns how many of them failed
+static int _export_uploads_finish(dt_control_export_uploads_t *u)
+{
+  if(!u) return 0;
+  dt_pthread_mutex_lock(&u->mutex);
+  u->done = 1;
+  pthread_cond_broadcast(&u->cond);
+  dt_pthread_mutex_unlock(&u->mutex);
+  pthread_join(u->thread, NULL);
+  const int failed = u->failed;
+  G_LOCK(export_uploads);
+  _export_uploads = g_list_remove(_export_uploads, u);
+  G_UNLOCK(export_uploads);
+  g_queue_free(u->pending);
+  pthread_cond_destroy(&u->cond);
+  dt_pthread_mutex_destroy(&u->mutex);
+  free(u);
+  return failed;
+}
+
+int dt_control_export_upload(const void *sdata, int (*upload)(void *data), void *data)
+{
+  dt_control_export_uploads_t *u = NULL;
+  G_LOCK(export_uploads);
+  for(GList *l = _export_uploads; l && !u; l = g_list_next(l))
+    if(((dt_control_export_uploads_t *)l->data)->sdata == sdata) u = (dt_control_export_uploads_t *)l->data;
+  G_UNLOCK(export_uploads);
+  if(!u) return upload(data);
+
+  dt_control_export_upload_t *item = (dt_control_export_upload_t *)malloc(sizeof(dt_control_export_upload_t));
+  item->upload = upload;
+  item->data = data;
+  dt_pthread_mutex_lock(&u->mutex);
+  while(g_queue_get_length(u->pending) >= u->max_pending) dt_pthread_cond_wait(&u->cond, &u->mutex);
+  g_queue_push_tail(u->pending, item);
+  pthread_cond_broadcast(&u->cond);
+  dt_pthread_mutex_unlock(&u->mutex);
+  return 0;
+}
+
+// the next image for a thread on node, taken from the other nodes once its own are done. 0 if there is none left.
+static long int _export_next_image(GList **queue, const int nodes, const int node)
+{
+  for(int k = 0; k < nodes; k++)
+  {
+    GList **q = queue + (node + k) % nodes;
+    if(!*q) continue;
+    const long int imgid = (long int)(*q)->data;
+    *q = g_list_delete_link(*q, *q);
+    return imgid;
+  }
+  return 0;
 }
 
 static int32_t dt_control_export_job_run(dt_job_t *job)
@@ -922,10 +1191,12 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
   else h=sh<fh?sh:fh;
 
   // get shared storage param struct (global sequence counter, one picasa connection etc)
-  dt_imageio_module_data_t *sdata = mstorage->get_params(mstorage);
+  dt_imageio_module_data_t *sdata = settings->sdata ? settings->sdata : mstorage->get_params(mstorage);
   if(sdata == NULL)
   {
     dt_control_log(_("failed to get parameters from storage module `%s', aborting export.."), mstorage->name(mstorage));
+    if(settings->progress) settings->progress(-1, 0, total, settings->progress_data);
+    if(settings->fdata) mformat->free_params(mformat, settings->fdata);
     g_free(t1->data);
     return 1;
   }
@@ -937,24 +1208,65 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
   const guint *jid = dt_control_backgroundjobs_create(darktable.control, 0, message );
   dt_control_backgroundjobs_set_cancellable(darktable.control, jid, job);
   const dt_control_t *control = darktable.control;
+  // storages uploading to the net queue the upload while the next image gets rendered:
+  dt_control_export_uploads_t *uploads = _export_uploads_start(sdata);
 
   double fraction=0;
+  // what became of the images, see the report at the end:
+  int rendered = 0, unchanged = 0, failed = 0;
+  // images handed out to the threads so far:
+  int taken = 0;
+  // with numa binding, every node gets its own round robin share of the images, the
+  // threads bound to it take theirs first and help out the other nodes after:
+  const int nodes = dt_conf_get_bool("parallel_export_numa") ? dt_numa_nodes() : 1;
+  GList *queue[DT_NUMA_MAX_NODES] = { NULL };
+  if(nodes > 1)
+  {
+    int k = 0;
+    for(GList *l = t; l; l = g_list_next(l), k++) queue[k % nodes] = g_list_prepend(queue[k % nodes], l->data);
+    for(k = 0; k < nodes; k++) queue[k] = g_list_reverse(queue[k]);
+    g_list_free(t);
+  }
+  else queue[0] = t;
+  t1->index = NULL;
 #ifdef _OPENMP
   // limit this to num threads = num full buffers - 1 (keep one for darkroom mode)
   // use min of user request and mipmap cache entries
   const int full_entries = dt_conf_get_int ("parallel_export");
   // GCC won't accept that this variable is used in a macro, considers
   // it set but not used, which makes for instance Fedora break.
-  const __attribute__((__unused__)) int num_threads = MAX(1, MIN(full_entries, 8));
+  // and don't go beyond the threads leased to this job
+  // one pipe per node at least, the threads leased to this job are split between their teams:
+  const __attribute__((__unused__)) int num_threads = nodes > 1 ? MAX(MIN(full_entries, 8), nodes)
+                                                              : MAX(1, MIN(MIN(full_entries, 8), omp_get_max_threads()));
+  const __attribute__((__unused__)) int team = MAX(1, omp_get_max_threads() / num_threads);
 #if !defined(__SUNOS__) && !defined(__NetBSD__)
-  #pragma omp parallel default(none) private(imgid) shared(control, fraction, w, h, stderr, mformat, mstorage, t, sdata, job, jid, darktable, settings) num_threads(num_threads) if(num_threads > 1)
+  #pragma omp parallel default(none) private(imgid) shared(control, fraction, w, h, stderr, mformat, mstorage, queue, taken, sdata, job, jid, darktable, settings, uploads, rendered, unchanged, failed) num_threads(num_threads) if(num_threads > 1)
 #else
-  #pragma omp parallel private(imgid) shared(control, fraction, w, h, mformat, mstorage, t, sdata, job, jid, darktable, settings) num_threads(num_threads) if(num_threads > 1)
+  #pragma omp parallel private(imgid) shared(control, fraction, w, h, mformat, mstorage, queue, taken, sdata, job, jid, darktable, settings, uploads, rendered, unchanged, failed) num_threads(num_threads) if(num_threads > 1)
 #endif
   {
 #endif
+    int node = 0;
+    if(nodes > 1)
+    {
+#ifdef _OPENMP
+      node = omp_get_thread_num() % nodes;
+#endif
+      if(dt_numa_bind(node))
+        dt_print(DT_DEBUG_PERF, "[export_job] could not bind thread to numa node %d\n", node);
+#ifdef _OPENMP
+      // the modules of this pipe run on a team of their own, which stays on the node the
+      // threads are created from. these settings only last for this parallel region.
+      omp_set_nested(1);
+      omp_set_num_threads(MIN(team, dt_numa_node_cpus(node)));
+#endif
+    }
+    // the export pipes of all threads stop as soon as the job is cancelled:
+    dt_control_job_set_current(job);
     // get a thread-safe fdata struct (one jpeg struct per thread etc):
     dt_imageio_module_data_t *fdata = mformat->get_params(mformat);
+    if(settings->fdata) memcpy(fdata, settings->fdata, mformat->params_size(mformat));
     fdata->max_width = settings->max_width;
     fdata->max_height = settings->max_height;
     fdata->max_width = (w!=0 && fdata->max_width >w)?w:fdata->max_width;
@@ -967,21 +1279,16 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
     dt_tag_new("darktable|changed",&tagid);
     dt_tag_new("darktable|exported",&etagid);
 
-    while(t && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
+    while(taken < total && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
     {
 #ifdef _OPENMP
       #pragma omp critical
 #endif
       {
-        if(!t)
-          imgid = 0;
-        else
-        {
-          imgid = (long int)t->data;
-          t = g_list_delete_link(t, t);
-          num = total - g_list_length(t);
-        }
+        imgid = _export_next_image(queue, nodes, node);
+        if(imgid) num = ++taken;
       }
+      if(!imgid) break;
       // remove 'changed' tag from image
       dt_tag_detach(tagid, imgid);
       // make sure the 'exported' tag is set on the image
@@ -1002,9 +1309,11 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
         else
         {
           dt_image_cache_read_release(darktable.image_cache, image);
-          mstorage->store(mstorage,sdata, imgid, mformat, fdata, num, total, settings->high_quality);
+          const int res = mstorage->store(mstorage,sdata, imgid, mformat, fdata, num, total, settings->high_quality);
+          __sync_fetch_and_add(res == 0 ? &rendered : res == DT_IMAGEIO_STORE_UNCHANGED ? &unchanged : &failed, 1);
         }
       }
+      if(settings->progress && imgid > 0) settings->progress(imgid, num, total, settings->progress_data);
 #ifdef _OPENMP
       #pragma omp critical
 #endif
@@ -1018,37 +1327,65 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
     #pragma omp master
 #endif
     {
+      // keep the progress bar up until the last upload went out. those were counted as rendered
+      // when they got queued:
+      const int upload_failed = _export_uploads_finish(uploads);
+      rendered -= upload_failed;
+      failed += upload_failed;
       dt_control_backgroundjobs_destroy(control, jid);
       if(mstorage->finalize_store) mstorage->finalize_store(mstorage, sdata);
       mstorage->free_params(mstorage, sdata);
+      // the images which made it, fewer than total if the job got cancelled or some failed:
+      if(settings->progress) settings->progress(-1, taken - failed, total, settings->progress_data);
+      dt_print(DT_DEBUG_PERF, "[export_job] %d rendered, %d unchanged, %d failed\n", rendered, unchanged, failed);
+      if(failed > 0)
+        dt_control_log(ngettext("%d image failed to export", "%d images failed to export", failed), failed);
+      else if(unchanged > 0)
+        dt_control_log(ngettext("%d image exported, %d unchanged kept", "%d images exported, %d unchanged kept", rendered),
+                       rendered, unchanged);
     }
     // all threads free their fdata
     mformat->free_params (mformat, fdata);
+    // pooled threads must not stay bound:
+    if(nodes > 1) dt_numa_unbind();
 #ifdef _OPENMP
+    // the pooled threads go on to work for others:
+    if(omp_get_thread_num() != 0) dt_control_job_set_current(NULL);
   }
 #endif
+  // the pipes kept for the next image of this batch aren't needed anymore:
+  dt_imageio_export_cleanup();
+  // left over if the job got cancelled:
+  for(int k = 0; k < nodes; k++) g_list_free(queue[k]);
+  if(settings->fdata) mformat->free_params(mformat, settings->fdata);
   g_free(t1->data);
   return 0;
 }
 
 
-void dt_control_export(GList *imgid_list,int max_width, int max_height, int format_index, int storage_index, gboolean high_quality,char *style)
+void dt_control_export_settings(GList *imgid_list, dt_control_export_t *settings)
 {
   dt_job_t job;
   dt_control_job_init(&job, "export");
   job.execute = &dt_control_export_job_run;
+  dt_control_job_set_queue(&job, DT_JOB_QUEUE_EXPORT);
   dt_control_image_enumerator_t *t = (dt_control_image_enumerator_t *)job.param;
   t->index = imgid_list;
-  dt_control_export_t *data = (dt_control_export_t*)malloc(sizeof(dt_control_export_t));
+  t->data = settings;
+  dt_control_signal_raise(darktable.signals,DT_SIGNAL_IMAGE_EXPORT_MULTIPLE,t);
+  dt_control_add_job(darktable.control, &job);
+}
+
+void dt_control_export(GList *imgid_list,int max_width, int max_height, int format_index, int storage_index, gboolean high_quality,char *style)
+{
+  dt_control_export_t *data = (dt_control_export_t*)calloc(1, sizeof(dt_control_export_t));
   data->max_width = max_width;
   data->max_height = max_height;
   data->format_index = format_index;
   data->storage_index = storage_index;
   data->high_quality = high_quality;
   strncpy(data->style,style,128);
-  t->data = data;
-  dt_control_signal_raise(darktable.signals,DT_SIGNAL_IMAGE_EXPORT_MULTIPLE,t);
-  dt_control_add_job(darktable.control, &job);
+  dt_control_export_settings(imgid_list, data);
 }
 
 #if GLIB_CHECK_VERSION (2, 26, 0)
@@ -1078,6 +1415,7 @@ int32_t dt_control_time_offset_job_run(dt_job_t *job)
   }
 
   /* go thru each selected image and update datetime_taken */
+  dt_image_cache_write_batch_begin(darktable.image_cache);
   do
   {
     uint32_t imgid = (long int)t->data;
@@ -1092,6 +1430,7 @@ int32_t dt_control_time_offset_job_run(dt_job_t *job)
     }
   }
   while ((t = g_list_next(t)) != NULL);
+  dt_image_cache_write_batch_end(darktable.image_cache);
 
   dt_control_log(_("added time offset to %d image(s)"), cntr);
 
@@ -1106,6 +1445,7 @@ void dt_control_time_offset_job_init(dt_job_t *job, const long int offset, long
 {
   dt_control_job_init(job, "time offset");
   job->execute = &dt_control_time_offset_job_run;
+  dt_control_job_set_queue(job, DT_JOB_QUEUE_BACKGROUND);
   dt_control_image_enumerator_t *t = (dt_control_image_enumerator_t *)job->param;
   if (imgid != -1)
     t->index = g_list_append(t->index, (gpointer)imgid);
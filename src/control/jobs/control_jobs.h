@@ -26,6 +26,13 @@ typedef struct dt_control_export_t
   int max_width, max_height, format_index, storage_index;
   gboolean high_quality;
   char style[128];
+  /** optional, owned by the job: storage params, and format params every export thread starts from,
+      instead of the ones of the export module settings. */
+  struct dt_imageio_module_data_t *sdata, *fdata;
+  /** optional, called from the export threads after every image, and with imgid -1 and the number of
+      images exported or kept unchanged once the job is done. */
+  void (*progress)(const int imgid, const int num, const int total, void *data);
+  void *progress_data;
 } dt_control_export_t;
 
 typedef struct dt_control_image_enumerator_t
@@ -49,6 +56,9 @@ int32_t dt_control_flip_images_job_run(dt_job_t *job);
 void dt_control_image_enumerator_job_film_init(dt_control_image_enumerator_t *t, int32_t filmid);
 void dt_control_image_enumerator_job_selected_init(dt_control_image_enumerator_t *t);
 
+void dt_control_lightroom_import_job_init(dt_job_t *job);
+int32_t dt_control_lightroom_import_job_run(dt_job_t *job);
+
 int32_t dt_control_remove_images_job_run(dt_job_t *job);
 void dt_control_remove_images_job_init(dt_job_t *job);
 
@@ -77,11 +87,22 @@ void dt_control_delete_images();
 void dt_control_duplicate_images();
 void dt_control_flip_images(const int32_t cw);
 void dt_control_remove_images();
+/** imports develop data and metadata of the lightroom xmps of the selected images in the background. */
+void dt_control_lightroom_import();
 void dt_control_move_images();
 void dt_control_copy_images();
 void dt_control_export(GList *imgid_list,int max_width, int max_height, int format_index, int storage_index, gboolean high_quality,char *style);
+/** queues an export job for imgid_list with the given settings, both are owned by the job afterwards. */
+void dt_control_export_settings(GList *imgid_list, dt_control_export_t *settings);
 void dt_control_merge_hdr();
 
+/** hands the network part of exporting one image to the upload thread of the export job owning the
+    storage params `sdata', so the next image gets rendered meanwhile. blocks while too many uploads
+    are pending. upload(data) returns non-zero on failure, which the job counts as a failed image.
+    it is run right away if there is no such job (e.g. for the command line), and its result is
+    returned. queued uploads return 0. */
+int dt_control_export_upload(const void *sdata, int (*upload)(void *data), void *data);
+
 void dt_control_gpx_apply(const gchar *filename, int32_t filmid, const gchar *tz);
 void dt_control_time_offset(const long int offset, long int imgid);
 
@@ -18,6 +18,10 @@
 
 #include "control/jobs/develop_jobs.h"
 #include "control/jobs/control_jobs.h"
+#include "common/darktable.h"
+#include "common/database.h"
+#include "common/debug.h"
+#include "common/mipmap_cache.h"
 
 int32_t dt_dev_process_preview_job_run(dt_job_t *job)
 {
@@ -49,6 +53,51 @@ void dt_dev_process_image_job_init(dt_job_t *job, dt_develop_t *dev)
   t->dev = dev;
 }
 
+int32_t dt_dev_prerender_job_run(dt_job_t *job)
+{
+  const dt_dev_prerender_t *t = (const dt_dev_prerender_t *)job->param;
+  // leave a full buffer for the image in the darkroom, the others may go to the neighbours:
+  const int slots = CLAMP(darktable.mipmap_cache->mip[DT_MIPMAP_FULL].cache.cost_quota - 1, 1, 2);
+
+  // next one first, that's where people usually go:
+  int32_t neighbour[2] = { -1, -1 };
+  int num = 0;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select imgid from memory.collected_images where rowid in "
+                              "((select rowid from memory.collected_images where imgid = ?1) + 1, "
+                              " (select rowid from memory.collected_images where imgid = ?1) - 1) "
+                              "order by rowid desc", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, t->imgid);
+  while(num < slots && sqlite3_step(stmt) == SQLITE_ROW)
+    neighbour[num++] = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+
+  for(int k=0; k<num; k++)
+  {
+    // the raw for the full pipe, and the downscaled input of the preview pipe:
+    for(dt_mipmap_size_t mip = DT_MIPMAP_FULL; mip >= DT_MIPMAP_F; mip--)
+    {
+      // user input cancels us, between the steps:
+      if(dt_control_job_get_state(job) == DT_JOB_STATE_CANCELLED) return 1;
+      dt_mipmap_buffer_t buf;
+      dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, neighbour[k], mip, DT_MIPMAP_BLOCKING);
+      if(buf.buf) dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    }
+    dt_print(DT_DEBUG_DEV, "[dev_prerender] loaded image %d next to %d\n", neighbour[k], t->imgid);
+  }
+  return 0;
+}
+
+void dt_dev_prerender_job_init(dt_job_t *job, const int32_t imgid)
+{
+  dt_control_job_init(job, "develop prerender neighbours of %d", imgid);
+  job->execute = &dt_dev_prerender_job_run;
+  dt_control_job_set_queue(job, DT_JOB_QUEUE_BACKGROUND);
+  dt_dev_prerender_t *t = (dt_dev_prerender_t *)job->param;
+  t->imgid = imgid;
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
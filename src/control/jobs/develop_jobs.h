@@ -37,6 +37,16 @@ void dt_dev_process_preview_job_init(dt_job_t *job, dt_develop_t *dev);
 int32_t dt_dev_process_image_job_run(dt_job_t *job);
 void dt_dev_process_image_job_init(dt_job_t *job, dt_develop_t *dev);
 
+/** loads the filmstrip neighbours of imgid into the cache, for a fast switch to them */
+typedef struct dt_dev_prerender_t
+{
+  int32_t imgid;
+}
+dt_dev_prerender_t;
+
+int32_t dt_dev_prerender_job_run(dt_job_t *job);
+void dt_dev_prerender_job_init(dt_job_t *job, const int32_t imgid);
+
 void dt_dev_export_init(dt_job_t *job);
 
 #endif
@@ -24,6 +24,7 @@ void dt_film_import1_init(dt_job_t *job, dt_film_t *film)
 {
   dt_control_job_init(job, "cache load raw images for preview");
   job->execute = &dt_film_import1_run;
+  dt_control_job_set_queue(job, DT_JOB_QUEUE_BACKGROUND);
   dt_film_import1_t *t = (dt_film_import1_t *)job->param;
   t->film = film;
   dt_pthread_mutex_lock(&film->images_mutex);
@@ -45,6 +46,25 @@ int32_t dt_film_import1_run(dt_job_t *job)
   }
   return 0;
 }
+
+void dt_film_import_files_init(dt_job_t *job, gchar *dirname, GPtrArray *files)
+{
+  dt_control_job_init(job, "import files of watched folder");
+  job->execute = &dt_film_import_files_run;
+  dt_control_job_set_queue(job, DT_JOB_QUEUE_BACKGROUND);
+  dt_film_import_files_t *t = (dt_film_import_files_t *)job->param;
+  t->dirname = dirname;
+  t->files = files;
+}
+
+int32_t dt_film_import_files_run(dt_job_t *job)
+{
+  dt_film_import_files_t *t = (dt_film_import_files_t *)job->param;
+  dt_film_import_files(t->dirname, (gchar **)t->files->pdata, t->files->len);
+  g_ptr_array_free(t->files, TRUE);
+  g_free(t->dirname);
+  return 0;
+}
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
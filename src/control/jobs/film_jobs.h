@@ -30,6 +30,17 @@ dt_film_import1_t;
 int32_t dt_film_import1_run(dt_job_t *job);
 void dt_film_import1_init(dt_job_t *job, dt_film_t *film);
 
+typedef struct dt_film_import_files_t
+{
+  gchar *dirname;
+  GPtrArray *files;
+}
+dt_film_import_files_t;
+
+/** imports the given files of one directory, takes ownership of dirname and files. */
+int32_t dt_film_import_files_run(dt_job_t *job);
+void dt_film_import_files_init(dt_job_t *job, gchar *dirname, GPtrArray *files);
+
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -24,6 +24,8 @@ void dt_image_load_job_init(dt_job_t *job, int32_t id, dt_mipmap_size_t mip)
 {
   dt_control_job_init(job, "load image %d mip %d", id, mip);
   job->execute = &dt_image_load_job_run;
+  dt_control_job_set_key(job, ((uint64_t)mip << 32) | (uint32_t)id, DT_JOB_COALESCE_MERGE, NULL);
+  dt_control_job_set_queue(job, DT_JOB_QUEUE_PREFETCH);
   dt_image_load_t *t = (dt_image_load_t *)job->param;
   t->imgid = id;
   t->mip = mip;
@@ -48,6 +50,24 @@ int32_t dt_image_load_job_run(dt_job_t *job)
   return 0;
 }
 
+void dt_image_thumbnail_refine_job_init(dt_job_t *job, int32_t id, dt_mipmap_size_t mip)
+{
+  dt_control_job_init(job, "refine thumbnail %d mip %d", id, mip);
+  job->execute = &dt_image_thumbnail_refine_job_run;
+  dt_control_job_set_key(job, ((uint64_t)mip << 32) | (uint32_t)id, DT_JOB_COALESCE_MERGE, NULL);
+  dt_control_job_set_queue(job, DT_JOB_QUEUE_BACKGROUND);
+  dt_image_load_t *t = (dt_image_load_t *)job->param;
+  t->imgid = id;
+  t->mip = mip;
+}
+
+int32_t dt_image_thumbnail_refine_job_run(dt_job_t *job)
+{
+  dt_image_load_t *t = (dt_image_load_t *)job->param;
+  dt_mipmap_cache_refine(darktable.mipmap_cache, t->imgid, t->mip);
+  return 0;
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
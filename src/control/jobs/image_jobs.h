@@ -33,6 +33,10 @@ dt_image_load_t;
 int32_t dt_image_load_job_run(dt_job_t *job);
 void dt_image_load_job_init(dt_job_t *job, int32_t imgid, dt_mipmap_size_t mip);
 
+/** replaces an embedded jpg stand-in thumbnail by the processed one */
+int32_t dt_image_thumbnail_refine_job_run(dt_job_t *job);
+void dt_image_thumbnail_refine_job_init(dt_job_t *job, int32_t imgid, dt_mipmap_size_t mip);
+
 
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -69,6 +69,7 @@ static dt_signal_description _signal_description[DT_SIGNAL_COUNT] =
   /* Develop related signals */
   {"dt-develop-initialized",NULL,NULL,G_TYPE_NONE,g_cclosure_marshal_VOID__VOID,0,NULL},                  // DT_SIGNAL_DEVELOP_INITIALIZED
   {"dt-develop-mipmap-updated",NULL,NULL,G_TYPE_NONE,g_cclosure_marshal_VOID__VOID,0,NULL},               // DT_SIGNAL_DEVELOP_MIPMAP_UPDATED
+  {"dt-develop-mipmap-decoded",NULL,NULL,G_TYPE_NONE,g_cclosure_marshal_VOID__UINT,1,uint_arg},          // DT_SIGNAL_DEVELOP_MIPMAP_DECODED
   {"dt-develop-preview-pipe-finished",NULL,NULL,G_TYPE_NONE,g_cclosure_marshal_VOID__VOID,0,NULL},        // DT_SIGNAL_DEVELOP_PREVIEW_PIPE_FINISHED
   {"dt-develop-ui-pipe-finished",NULL,NULL,G_TYPE_NONE,g_cclosure_marshal_VOID__VOID,0,NULL},             // DT_SIGNAL_DEVELOP_UI_PIPE_FINISHED
   {"dt-develop-history-change",NULL,NULL,G_TYPE_NONE,g_cclosure_marshal_VOID__VOID,0,NULL},               // DT_SIGNAL_HISTORY_CHANGE
@@ -78,6 +79,7 @@ static dt_signal_description _signal_description[DT_SIGNAL_COUNT] =
   {"dt-image-export-multiple",NULL,NULL,G_TYPE_NONE,g_cclosure_marshal_VOID__POINTER,1,pointer_arg},               // DT_SIGNAL_IMAGE_EXPORT_MULTIPLE
   {"dt-image-export-tmpfile",NULL,NULL,G_TYPE_NONE,g_cclosure_marshal_generic,2,image_export_arg},               // DT_SIGNAL_IMAGE_EXPORT_TMPFILE
   {"dt-imageio-storage-change",NULL,NULL,G_TYPE_NONE,g_cclosure_marshal_VOID__VOID,0,NULL},               // DT_SIGNAL_IMAGEIO_STORAGE_CHANGE
+  {"dt-selection-changed",NULL,NULL,G_TYPE_NONE,g_cclosure_marshal_VOID__VOID,0,NULL},                    // DT_SIGNAL_SELECTION_CHANGED
 };
 
 static  GType _signal_type;
@@ -87,6 +87,12 @@ typedef enum dt_signal_t
     */
   DT_SIGNAL_DEVELOP_MIPMAP_UPDATED,
 
+  /** \brief This signal is raised when a thumbnail of the persistent store has been decoded into the cache
+  1 : uint the id of the image
+  no returned value
+    */
+  DT_SIGNAL_DEVELOP_MIPMAP_DECODED,
+
   /** \brief This signal is raised when develop preview pipe process is finished
   no param, no returned value
     */
@@ -134,6 +140,11 @@ typedef enum dt_signal_t
     no return
     */
   DT_SIGNAL_IMAGEIO_STORAGE_CHANGE,
+  /** \brief This signal is raised once after an operation changed the selected images
+    no param
+    no return
+    */
+  DT_SIGNAL_SELECTION_CHANGED,
 
   /* do not touch !*/
   DT_SIGNAL_COUNT
@@ -21,113 +21,16 @@
 #include "develop/tiling.h"
 #include "develop/masks.h"
 #include "common/gaussian.h"
+#include "common/colorspaces_inline_conversions.h"
 #include "blend.h"
 
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
 #define CLAMP_RANGE(x,y,z)      (CLAMP(x,y,z))
 
 typedef void (_blend_row_func)(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag);
 
-static inline void _RGB_2_HSL(const float *RGB, float *HSL)
-{
-  float H, S, L;
-
-  float R = RGB[0];
-  float G = RGB[1];
-  float B = RGB[2];
-
-  float var_Min = fminf(R, fminf(G, B));
-  float var_Max = fmaxf(R, fmaxf(G, B));
-  float del_Max = var_Max - var_Min;
-
-  L = (var_Max + var_Min) / 2.0f;
-
-  if (del_Max < 1e-6f)
-  {
-    H = 0.0f;
-    S = 0.0f;
-  }
-  else
-  {
-    if (L < 0.5f) S = del_Max / (var_Max + var_Min);
-    else          S = del_Max / (2.0f - var_Max - var_Min);
-
-    float del_R = (((var_Max - R) / 6.0f) + (del_Max / 2.0f)) / del_Max;
-    float del_G = (((var_Max - G) / 6.0f) + (del_Max / 2.0f)) / del_Max;
-    float del_B = (((var_Max - B) / 6.0f) + (del_Max / 2.0f)) / del_Max;
-
-    if      (R == var_Max) H = del_B - del_G;
-    else if (G == var_Max) H = (1.0f / 3.0f) + del_R - del_B;
-    else if (B == var_Max) H = (2.0f / 3.0f) + del_G - del_R;
-    else H = 0.0f;   // make GCC happy
-
-    if (H < 0.0f) H += 1.0f;
-    if (H > 1.0f) H -= 1.0f;
-  }
-
-  HSL[0] = H;
-  HSL[1] = S;
-  HSL[2] = L;
-}
-
-
-static inline float _Hue_2_RGB(float v1, float v2, float vH)
-{
-  if (vH < 0.0f) vH += 1.0f;
-  if (vH > 1.0f) vH -= 1.0f;
-  if ((6.0f * vH) < 1.0f) return (v1 + (v2 - v1) * 6.0f * vH);
-  if ((2.0f * vH) < 1.0f) return (v2);
-  if ((3.0f * vH) < 2.0f) return (v1 + (v2 - v1) * ((2.0f / 3.0f) - vH) * 6.0f);
-  return (v1);
-}
-
-
-static inline void _HSL_2_RGB(const float *HSL, float *RGB)
-{
-  float H = HSL[0];
-  float S = HSL[1];
-  float L = HSL[2];
-
-  float var_1, var_2;
-
-  if (S < 1e-6f)
-  {
-    RGB[0] = RGB[1] = RGB[2] = L;
-  }
-  else
-  {
-    if (L < 0.5f) var_2 = L * (1.0f + S);
-    else          var_2 = (L + S) - (S * L);
-
-    var_1 = 2.0f * L - var_2;
-
-    RGB[0] = _Hue_2_RGB(var_1, var_2, H + (1.0f / 3.0f));
-    RGB[1] = _Hue_2_RGB(var_1, var_2, H);
-    RGB[2] = _Hue_2_RGB(var_1, var_2, H - (1.0f / 3.0f));
-  }
-}
-
-
-static inline void _Lab_2_LCH(const float *Lab, float *LCH)
-{
-  float var_H = atan2f(Lab[2], Lab[1]);
-
-  if (var_H > 0.0f) var_H = var_H / (2.0f*M_PI);
-  else              var_H = 1.0f - fabs(var_H) / (2.0f*M_PI);
-
-  LCH[0] = Lab[0];
-  LCH[1] = sqrtf(Lab[1]*Lab[1] + Lab[2]*Lab[2]);
-  LCH[2] = var_H;
-}
-
-
-
-static inline void _LCH_2_Lab(const float *LCH, float *Lab)
-{
-  Lab[0] = LCH[0];
-  Lab[1] = cosf(2.0f*M_PI*LCH[2]) * LCH[1];
-  Lab[2] = sinf(2.0f*M_PI*LCH[2]) * LCH[1];
-}
-
 static inline void _CLAMP_XYZ(float *XYZ, const float *min, const float *max)
 {
   XYZ[0] = CLAMP_RANGE(XYZ[0], min[0], max[0]);
@@ -167,8 +70,8 @@ static inline float _blendif_factor(dt_iop_colorspace_type_t cst,const float *in
       {
         float LCH_input[3];
         float LCH_output[3];
-        _Lab_2_LCH(input, LCH_input);
-        _Lab_2_LCH(output, LCH_output);
+        dt_Lab_2_LCH(input, LCH_input);
+        dt_Lab_2_LCH(output, LCH_output);
 
         scaled[DEVELOP_BLENDIF_C_in] = CLAMP_RANGE(LCH_input[1] / (128.0f*sqrtf(2.0f)), 0.0f, 1.0f);			        // C scaled to 0..1
         scaled[DEVELOP_BLENDIF_h_in] = CLAMP_RANGE(LCH_input[2], 0.0f, 1.0f);		          // h scaled to 0..1
@@ -194,8 +97,8 @@ static inline float _blendif_factor(dt_iop_colorspace_type_t cst,const float *in
       {
         float HSL_input[3];
         float HSL_output[3];
-        _RGB_2_HSL(input, HSL_input);
-        _RGB_2_HSL(output, HSL_output);
+        dt_RGB_2_HSL(input, HSL_input);
+        dt_RGB_2_HSL(output, HSL_output);
 
         scaled[DEVELOP_BLENDIF_H_in] = CLAMP_RANGE(HSL_input[0], 0.0f, 1.0f);			        // H scaled to 0..1
         scaled[DEVELOP_BLENDIF_S_in] = CLAMP_RANGE(HSL_input[1], 0.0f, 1.0f);		          // S scaled to 0..1
@@ -312,6 +215,20 @@ static inline void _blend_Lab_rescale(const float *i, float *o)
 static void _blend_make_mask(dt_iop_colorspace_type_t cst, const unsigned int blendif, const float *blendif_parameters, const unsigned int mask_mode, const unsigned int mask_combine,
                              const float gopacity, const float *a, const float *b, float *mask, int stride)
 {
+  if(!(mask_mode & DEVELOP_MASK_CONDITIONAL))
+  {
+    // no parametric mask, the conditional part of the opacity is the same for all pixels
+    const float conditional = (mask_combine & DEVELOP_COMBINE_INCL) ? 0.0f : 1.0f;
+    for(int i=0, j=0; j<stride; i++, j+=4)
+    {
+      float form = mask[i];
+      float opacity = (mask_combine & DEVELOP_COMBINE_INCL) ? 1.0f - (1.0f - form) * (1.0f - conditional) : form * conditional ;
+      opacity = (mask_combine & DEVELOP_COMBINE_INV) ? 1.0f - opacity : opacity;
+      mask[i] = opacity*gopacity;
+    }
+    return;
+  }
+
   for(int i=0, j=0; j<stride; i++, j+=4)
   {
     float form = mask[i];
@@ -324,85 +241,80 @@ static void _blend_make_mask(dt_iop_colorspace_type_t cst, const unsigned int bl
 
 
 
+/* helpers for the sse versions of the most used modes below. they handle a pixel of 4 floats,
+   the range of the channels is taken from _blend_colorspace_channel_range(). */
+static inline __m128 _blend_clamp_sse(const __m128 x, const __m128 min, const __m128 max)
+{
+  return _mm_min_ps(_mm_max_ps(x, min), max);
+}
+
+static inline __m128 _blend_select_sse(const __m128 mask, const __m128 a, const __m128 b)
+{
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+/* lanes which keep the a, b channels of the input when only lightness is blended */
+static inline __m128 _blend_keep_sse(dt_iop_colorspace_type_t cst, int flag)
+{
+  return (cst == iop_cs_Lab && flag) ? _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, 0)) : _mm_setzero_ps();
+}
+
+/* the opacity goes into the 4th channel, except for raw where that is a pixel */
+static inline __m128 _blend_alpha_sse(dt_iop_colorspace_type_t cst)
+{
+  return cst != iop_cs_RAW ? _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0)) : _mm_setzero_ps();
+}
+
 /* normal blend with clamping */
 static void _blend_normal_bounded(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
-  float ta[3], tb[3];
-  int channels = _blend_colorspace_channels(cst);
   float max[4]= {0},min[4]= {0};
 
   _blend_colorspace_channel_range(cst,min,max);
 
+  const int lab = cst == iop_cs_Lab;
+  const __m128 scale = _mm_set_ps(1.0f, 128.0f, 128.0f, 100.0f);
+  const __m128 vmin = _mm_loadu_ps(min), vmax = _mm_loadu_ps(max);
+  const __m128 keep = _blend_keep_sse(cst, flag), alpha = _blend_alpha_sse(cst);
+  const __m128 one = _mm_set1_ps(1.0f);
+
   for(int i=0, j=0; j<stride; i++, j+=4)
   {
-    float local_opacity = mask[i];
-
-    if(cst==iop_cs_Lab)
-    {
-      _blend_Lab_scale(&a[j], ta);
-      _blend_Lab_scale(&b[j], tb);
-
-      tb[0] =  CLAMP_RANGE((ta[0] * (1.0f - local_opacity)) + tb[0] * local_opacity, min[0], max[0]);;
-
-      if (flag == 0)
-      {
-        tb[1] =  CLAMP_RANGE((ta[1] * (1.0f - local_opacity)) + tb[1] * local_opacity, min[1], max[1]);
-        tb[2] =  CLAMP_RANGE((ta[2] * (1.0f - local_opacity)) + tb[2] * local_opacity, min[2], max[2]);
-      }
-      else
-      {
-        tb[1] = ta[1];
-        tb[2] = ta[2];
-      }
+    const __m128 local_opacity = _mm_set1_ps(mask[i]);
+    const __m128 pa = _mm_loadu_ps(&a[j]);
+    const __m128 pb = _mm_loadu_ps(&b[j]);
+    const __m128 ta = lab ? _mm_div_ps(pa, scale) : pa;
+    const __m128 tb = lab ? _mm_div_ps(pb, scale) : pb;
 
-      _blend_Lab_rescale(tb, &b[j]);
-    }
-    else
-      for(int k=0; k<channels; k++)
-        b[j+k] =  CLAMP_RANGE((a[j+k] * (1.0f - local_opacity)) + b[j+k] * local_opacity, min[k], max[k]);
+    __m128 res = _blend_clamp_sse(_mm_add_ps(_mm_mul_ps(ta, _mm_sub_ps(one, local_opacity)), _mm_mul_ps(tb, local_opacity)), vmin, vmax);
+    if(lab) res = _mm_mul_ps(res, scale);
 
-    if(cst != iop_cs_RAW) b[j+3] = local_opacity;
+    res = _blend_select_sse(keep, pa, res);
+    _mm_storeu_ps(&b[j], _blend_select_sse(alpha, local_opacity, res));
   }
 }
 
 /* normal blend without any clamping */
 static void _blend_normal_unbounded(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
-  float ta[3], tb[3];
-  int channels = _blend_colorspace_channels(cst);
-  float max[4]= {0},min[4]= {0};
-
-  _blend_colorspace_channel_range(cst,min,max);
+  const int lab = cst == iop_cs_Lab;
+  const __m128 scale = _mm_set_ps(1.0f, 128.0f, 128.0f, 100.0f);
+  const __m128 keep = _blend_keep_sse(cst, flag), alpha = _blend_alpha_sse(cst);
+  const __m128 one = _mm_set1_ps(1.0f);
 
   for(int i=0, j=0; j<stride; i++, j+=4)
   {
-    float local_opacity = mask[i];
-
-    if(cst==iop_cs_Lab)
-    {
-      _blend_Lab_scale(&a[j], ta);
-      _blend_Lab_scale(&b[j], tb);
-
-      tb[0] =  (ta[0] * (1.0f - local_opacity)) + tb[0] * local_opacity;
-
-      if (flag == 0)
-      {
-        tb[1] =  (ta[1] * (1.0f - local_opacity)) + tb[1] * local_opacity;
-        tb[2] =  (ta[2] * (1.0f - local_opacity)) + tb[2] * local_opacity;
-      }
-      else
-      {
-        tb[1] = ta[1];
-        tb[2] = ta[2];
-      }
+    const __m128 local_opacity = _mm_set1_ps(mask[i]);
+    const __m128 pa = _mm_loadu_ps(&a[j]);
+    const __m128 pb = _mm_loadu_ps(&b[j]);
+    const __m128 ta = lab ? _mm_div_ps(pa, scale) : pa;
+    const __m128 tb = lab ? _mm_div_ps(pb, scale) : pb;
 
-      _blend_Lab_rescale(tb, &b[j]);
-    }
-    else
-      for(int k=0; k<channels; k++)
-        b[j+k] =  (a[j+k] * (1.0f - local_opacity)) + b[j+k] * local_opacity;
+    __m128 res = _mm_add_ps(_mm_mul_ps(ta, _mm_sub_ps(one, local_opacity)), _mm_mul_ps(tb, local_opacity));
+    if(lab) res = _mm_mul_ps(res, scale);
 
-    if(cst != iop_cs_RAW) b[j+3] = local_opacity;
+    res = _blend_select_sse(keep, pa, res);
+    _mm_storeu_ps(&b[j], _blend_select_sse(alpha, local_opacity, res));
   }
 }
 
@@ -497,63 +409,46 @@ static void _blend_darken(dt_iop_colorspace_type_t cst,const float *a, float *b,
 /* multiply */
 static void _blend_multiply(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
-  float ta[3], tb[3];
-  int channels = _blend_colorspace_channels(cst);
   float max[4]= {0},min[4]= {0};
-  float lmin = 0.0, lmax, la, lb;
 
   _blend_colorspace_channel_range(cst,min,max);
 
+  const int lab = cst == iop_cs_Lab;
+  const __m128 scale = _mm_set_ps(1.0f, 128.0f, 128.0f, 100.0f);
+  const __m128 vmin = _mm_loadu_ps(min), vmax = _mm_loadu_ps(max);
+  const __m128 keep = _blend_keep_sse(cst, flag), alpha = _blend_alpha_sse(cst);
+  const __m128 lightness = _mm_castsi128_ps(_mm_set_epi32(0, 0, 0, -1));
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 eps = _mm_set1_ps(0.01f);
+
   for(int i=0, j=0; j<stride; i++, j+=4)
   {
-    float local_opacity = mask[i];
+    const __m128 local_opacity = _mm_set1_ps(mask[i]);
+    const __m128 pa = _mm_loadu_ps(&a[j]);
+    const __m128 pb = _mm_loadu_ps(&b[j]);
+    __m128 res;
 
-    if(cst==iop_cs_Lab)
+    if(lab)
     {
-      _blend_Lab_scale(&a[j], ta);
-      _blend_Lab_scale(&b[j], tb);
-      lmax = max[0]+fabs(min[0]);
-      la = CLAMP_RANGE(ta[0]+fabs(min[0]), lmin, lmax);
-      lb = CLAMP_RANGE(tb[0]+fabs(min[0]), lmin, lmax);
-
-      tb[0] = CLAMP_RANGE( ((la * (1.0f - local_opacity)) + ((la * lb) * local_opacity)), min[0], max[0]) - fabs(min[0]);
-
-      if (flag == 0)
-      {
-        if (ta[0] > 0.01f)
-        {
-          tb[1] = CLAMP_RANGE(ta[1] * (1.0f - local_opacity) + (ta[1] + tb[1]) * tb[0]/ta[0] * local_opacity, min[1], max[1]);
-          tb[2] = CLAMP_RANGE(ta[2] * (1.0f - local_opacity) + (ta[2] + tb[2]) * tb[0]/ta[0] * local_opacity, min[2], max[2]);
-        }
-        else
-        {
-          tb[1] = CLAMP_RANGE(ta[1] * (1.0f - local_opacity) + (ta[1] + tb[1]) * tb[0]/0.01f * local_opacity, min[1], max[1]);
-          tb[2] = CLAMP_RANGE(ta[2] * (1.0f - local_opacity) + (ta[2] + tb[2]) * tb[0]/0.01f * local_opacity, min[2], max[2]);
-        }
-      }
-      else
-      {
-        tb[1] = ta[1];
-        tb[2] = ta[2];
-      }
-
-      _blend_Lab_rescale(tb, &b[j]);
+      // the lightness of both is clamped to [0, 1], a and b follow the change of lightness
+      const __m128 ta = _mm_div_ps(pa, scale);
+      const __m128 tb = _mm_div_ps(pb, scale);
+      const __m128 la = _blend_clamp_sse(ta, vmin, vmax);
+      const __m128 lb = _blend_clamp_sse(tb, vmin, vmax);
+      const __m128 l = _blend_clamp_sse(_mm_add_ps(_mm_mul_ps(la, _mm_sub_ps(one, local_opacity)), _mm_mul_ps(_mm_mul_ps(la, lb), local_opacity)), vmin, vmax);
+      const __m128 tl = _mm_shuffle_ps(l, l, _MM_SHUFFLE(0, 0, 0, 0));
+      const __m128 tal = _mm_shuffle_ps(ta, ta, _MM_SHUFFLE(0, 0, 0, 0));
+      const __m128 div = _blend_select_sse(_mm_cmpgt_ps(tal, eps), tal, eps);
+      const __m128 c = _blend_clamp_sse(_mm_add_ps(_mm_mul_ps(ta, _mm_sub_ps(one, local_opacity)),
+                                                   _mm_mul_ps(_mm_div_ps(_mm_mul_ps(_mm_add_ps(ta, tb), tl), div), local_opacity)), vmin, vmax);
+      res = _mm_mul_ps(_blend_select_sse(lightness, l, c), scale);
     }
     else
-      for(int k=0; k<channels; k++)
-      {
-        lmax = max[k]+fabs(min[k]);
-        la = CLAMP_RANGE(a[j+k]+fabs(min[k]), lmin, lmax);
-        lb = CLAMP_RANGE(b[j+k]+fabs(min[k]), lmin, lmax);
-
-        b[j+k] = CLAMP_RANGE( ((a[j+k] * (1.0f - local_opacity)) + ((a[j+k] * b[j+k]) * local_opacity)), min[k], max[k]);
-      }
+      res = _blend_clamp_sse(_mm_add_ps(_mm_mul_ps(pa, _mm_sub_ps(one, local_opacity)), _mm_mul_ps(_mm_mul_ps(pa, pb), local_opacity)), vmin, vmax);
 
-    if(cst != iop_cs_RAW) b[j+3] = local_opacity;
+    res = _blend_select_sse(keep, pa, res);
+    _mm_storeu_ps(&b[j], _blend_select_sse(alpha, local_opacity, res));
   }
-
-
-  // return (a*b);
 }
 
 
@@ -813,67 +708,48 @@ static void _blend_difference2(dt_iop_colorspace_type_t cst,const float *a, floa
 /* screen */
 static void _blend_screen(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag)
 {
-  float ta[3], tb[3];
-  int channels = _blend_colorspace_channels(cst);
   float max[4]= {0},min[4]= {0};
-  float lmin = 0.0, lmax, la, lb;
 
   _blend_colorspace_channel_range(cst,min,max);
 
+  const int lab = cst == iop_cs_Lab;
+  const __m128 scale = _mm_set_ps(1.0f, 128.0f, 128.0f, 100.0f);
+  const __m128 vmin = _mm_loadu_ps(min), vmax = _mm_loadu_ps(max);
+  const __m128 keep = _blend_keep_sse(cst, flag), alpha = _blend_alpha_sse(cst);
+  const __m128 lightness = _mm_castsi128_ps(_mm_set_epi32(0, 0, 0, -1));
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 eps = _mm_set1_ps(0.01f);
+  const __m128 zero = _mm_setzero_ps();
+
   for(int i=0, j=0; j<stride; i++, j+=4)
   {
-    float local_opacity = mask[i];
-
-    if(cst==iop_cs_Lab)
+    const __m128 local_opacity = _mm_set1_ps(mask[i]);
+    const __m128 pa = _mm_loadu_ps(&a[j]);
+    const __m128 pb = _mm_loadu_ps(&b[j]);
+    const __m128 ta = lab ? _mm_div_ps(pa, scale) : pa;
+    const __m128 tb = lab ? _mm_div_ps(pb, scale) : pb;
+
+    // max - (max-a) * (max-b) of the values clamped to [0, max], the lower bound of all channels is 0 here
+    const __m128 la = _blend_clamp_sse(ta, zero, vmax);
+    const __m128 lb = _blend_clamp_sse(tb, zero, vmax);
+    const __m128 s = _mm_sub_ps(vmax, _mm_mul_ps(_mm_sub_ps(vmax, la), _mm_sub_ps(vmax, lb)));
+    __m128 res = _blend_clamp_sse(_mm_add_ps(_mm_mul_ps(la, _mm_sub_ps(one, local_opacity)), _mm_mul_ps(s, local_opacity)), zero, vmax);
+
+    if(lab)
     {
-      _blend_Lab_scale(&a[j], ta);
-      _blend_Lab_scale(&b[j], tb);
-      lmax = max[0]+fabs(min[0]);
-      la = CLAMP_RANGE(ta[0]+fabs(min[0]), lmin, lmax);
-      lb = CLAMP_RANGE(tb[0]+fabs(min[0]), lmin, lmax);
-
-      tb[0] = CLAMP_RANGE( (la * (1.0 - local_opacity)) + (( (lmax - (lmax-la) * (lmax-lb)) ) * local_opacity), lmin, lmax)-fabs(min[0]);
-
-      if (flag == 0)
-      {
-        if (ta[0] > 0.01f)
-        {
-          tb[1] = CLAMP_RANGE(ta[1] * (1.0f - local_opacity) + 0.5f * (ta[1] + tb[1]) * tb[0]/ta[0] * local_opacity, min[1], max[1]);
-          tb[2] = CLAMP_RANGE(ta[2] * (1.0f - local_opacity) + 0.5f * (ta[2] + tb[2]) * tb[0]/ta[0] * local_opacity, min[2], max[2]);
-        }
-        else
-        {
-          tb[1] = CLAMP_RANGE(ta[1] * (1.0f - local_opacity) + 0.5f * (ta[1] + tb[1]) * tb[0]/0.01f * local_opacity, min[1], max[1]);
-          tb[2] = CLAMP_RANGE(ta[2] * (1.0f - local_opacity) + 0.5f * (ta[2] + tb[2]) * tb[0]/0.01f * local_opacity, min[2], max[2]);
-        }
-      }
-      else
-      {
-        tb[1] = ta[1];
-        tb[2] = ta[2];
-      }
-
-      _blend_Lab_rescale(tb, &b[j]);
-    }
-    else
-    {
-      for(int k=0; k<channels; k++)
-      {
-        lmax = max[k]+fabs(min[k]);
-        la = CLAMP_RANGE(a[j+k]+fabs(min[k]), lmin, lmax);
-        lb = CLAMP_RANGE(b[j+k]+fabs(min[k]), lmin, lmax);
-
-        b[j+k] =  CLAMP_RANGE( (la * (1.0f - local_opacity)) + (( (lmax - (lmax-la) * (lmax-lb)) ) * local_opacity), lmin, lmax)-fabs(min[k]);
-      }
+      // a and b follow the change of lightness
+      const __m128 tl = _mm_shuffle_ps(res, res, _MM_SHUFFLE(0, 0, 0, 0));
+      const __m128 tal = _mm_shuffle_ps(ta, ta, _MM_SHUFFLE(0, 0, 0, 0));
+      const __m128 div = _blend_select_sse(_mm_cmpgt_ps(tal, eps), tal, eps);
+      const __m128 c = _blend_clamp_sse(_mm_add_ps(_mm_mul_ps(ta, _mm_sub_ps(one, local_opacity)),
+                                                   _mm_mul_ps(_mm_div_ps(_mm_mul_ps(_mm_mul_ps(half, _mm_add_ps(ta, tb)), tl), div), local_opacity)), vmin, vmax);
+      res = _mm_mul_ps(_blend_select_sse(lightness, res, c), scale);
     }
 
-    if(cst != iop_cs_RAW) b[j+3] = local_opacity;
+    res = _blend_select_sse(keep, pa, res);
+    _mm_storeu_ps(&b[j], _blend_select_sse(alpha, local_opacity, res));
   }
-  /*
-  float max,min;
-  _blend_colorspace_channel_range(cst,channel,&min,&max);
-  return max - (max-a) * (max-b);
-  */
 }
 
 /* overlay */
@@ -1354,14 +1230,14 @@ static void _blend_lightness(dt_iop_colorspace_type_t cst,const float *a, float
       _CLAMP_XYZ(ta, min, max);
       _CLAMP_XYZ(&b[j], min, max);
 
-      _RGB_2_HSL(ta, tta);
-      _RGB_2_HSL(&b[j], ttb);
+      dt_RGB_2_HSL(ta, tta);
+      dt_RGB_2_HSL(&b[j], ttb);
 
       ttb[0] = tta[0];
       ttb[1] = tta[1];
       ttb[2] = (tta[2] * (1.0f - local_opacity)) + ttb[2] * local_opacity;
 
-      _HSL_2_RGB(ttb, &b[j]);
+      dt_HSL_2_RGB(ttb, &b[j]);
       _CLAMP_XYZ(&b[j], min, max);
     }
     else
@@ -1391,17 +1267,17 @@ static void _blend_chroma(dt_iop_colorspace_type_t cst,const float *a, float *b,
     {
       _blend_Lab_scale(&a[j], ta);
       _CLAMP_XYZ(ta, min, max);
-      _Lab_2_LCH(ta, tta);
+      dt_Lab_2_LCH(ta, tta);
 
       _blend_Lab_scale(&b[j], tb);
       _CLAMP_XYZ(tb, min, max);
-      _Lab_2_LCH(tb, ttb);
+      dt_Lab_2_LCH(tb, ttb);
 
       ttb[0] = tta[0];
       ttb[1] = (tta[1] * (1.0f - local_opacity)) + ttb[1] * local_opacity;
       ttb[2] = tta[2];
 
-      _LCH_2_Lab(ttb, tb);
+      dt_LCH_2_Lab(ttb, tb);
       _CLAMP_XYZ(tb, min, max);
       _blend_Lab_rescale(tb, &b[j]);
     }
@@ -1412,14 +1288,14 @@ static void _blend_chroma(dt_iop_colorspace_type_t cst,const float *a, float *b,
       _CLAMP_XYZ(ta, min, max);
       _CLAMP_XYZ(&b[j], min, max);
 
-      _RGB_2_HSL(ta, tta);
-      _RGB_2_HSL(&b[j], ttb);
+      dt_RGB_2_HSL(ta, tta);
+      dt_RGB_2_HSL(&b[j], ttb);
 
       ttb[0] = tta[0];
       ttb[1] = (tta[1] * (1.0f - local_opacity)) + ttb[1] * local_opacity;
       ttb[2] = tta[2];
 
-      _HSL_2_RGB(ttb, &b[j]);
+      dt_HSL_2_RGB(ttb, &b[j]);
       _CLAMP_XYZ(&b[j], min, max);
     }
     else
@@ -1449,11 +1325,11 @@ static void _blend_hue(dt_iop_colorspace_type_t cst,const float *a, float *b, co
     {
       _blend_Lab_scale(&a[j], ta);
       _CLAMP_XYZ(ta, min, max);
-      _Lab_2_LCH(ta, tta);
+      dt_Lab_2_LCH(ta, tta);
 
       _blend_Lab_scale(&b[j], tb);
       _CLAMP_XYZ(tb, min, max);
-      _Lab_2_LCH(tb, ttb);
+      dt_Lab_2_LCH(tb, ttb);
 
       ttb[0] = tta[0];
       ttb[1] = tta[1];
@@ -1462,7 +1338,7 @@ static void _blend_hue(dt_iop_colorspace_type_t cst,const float *a, float *b, co
       float s = d > 0.5f ? -local_opacity*(1.0f - d) / d : local_opacity;
       ttb[2] = fmod((tta[2] * (1.0f - s)) + ttb[2] * s + 1.0f, 1.0f);
 
-      _LCH_2_Lab(ttb, tb);
+      dt_LCH_2_Lab(ttb, tb);
       _CLAMP_XYZ(tb, min, max);
       _blend_Lab_rescale(tb, &b[j]);
     }
@@ -1473,8 +1349,8 @@ static void _blend_hue(dt_iop_colorspace_type_t cst,const float *a, float *b, co
       _CLAMP_XYZ(ta, min, max);
       _CLAMP_XYZ(&b[j], min, max);
 
-      _RGB_2_HSL(ta, tta);
-      _RGB_2_HSL(&b[j], ttb);
+      dt_RGB_2_HSL(ta, tta);
+      dt_RGB_2_HSL(&b[j], ttb);
 
       /* blend hue along shortest distance on color circle */
       float d = fabs(tta[0] - ttb[0]);
@@ -1483,7 +1359,7 @@ static void _blend_hue(dt_iop_colorspace_type_t cst,const float *a, float *b, co
       ttb[1] = tta[1];
       ttb[2] = tta[2];
 
-      _HSL_2_RGB(ttb, &b[j]);
+      dt_HSL_2_RGB(ttb, &b[j]);
       _CLAMP_XYZ(&b[j], min, max);
     }
     else
@@ -1513,11 +1389,11 @@ static void _blend_color(dt_iop_colorspace_type_t cst,const float *a, float *b,
     {
       _blend_Lab_scale(&a[j], ta);
       _CLAMP_XYZ(ta, min, max);
-      _Lab_2_LCH(ta, tta);
+      dt_Lab_2_LCH(ta, tta);
 
       _blend_Lab_scale(&b[j], tb);
       _CLAMP_XYZ(tb, min, max);
-      _Lab_2_LCH(tb, ttb);
+      dt_Lab_2_LCH(tb, ttb);
 
       ttb[0] = tta[0];
       ttb[1] = (tta[1] * (1.0f - local_opacity)) + ttb[1] * local_opacity;
@@ -1527,7 +1403,7 @@ static void _blend_color(dt_iop_colorspace_type_t cst,const float *a, float *b,
       float s = d > 0.5f ? -local_opacity*(1.0f - d) / d : local_opacity;
       ttb[2] = fmod((tta[2] * (1.0f - s)) + ttb[2] * s + 1.0f, 1.0f);
 
-      _LCH_2_Lab(ttb, tb);
+      dt_LCH_2_Lab(ttb, tb);
       _CLAMP_XYZ(tb, min, max);
       _blend_Lab_rescale(tb, &b[j]);
     }
@@ -1538,8 +1414,8 @@ static void _blend_color(dt_iop_colorspace_type_t cst,const float *a, float *b,
       _CLAMP_XYZ(ta, min, max);
       _CLAMP_XYZ(&b[j], min, max);
 
-      _RGB_2_HSL(ta, tta);
-      _RGB_2_HSL(&b[j], ttb);
+      dt_RGB_2_HSL(ta, tta);
+      dt_RGB_2_HSL(&b[j], ttb);
 
       /* blend hue along shortest distance on color circle */
       float d = fabs(tta[0] - ttb[0]);
@@ -1549,7 +1425,7 @@ static void _blend_color(dt_iop_colorspace_type_t cst,const float *a, float *b,
       ttb[1] = (tta[1] * (1.0f - local_opacity)) + ttb[1] * local_opacity;
       ttb[2] = tta[2];
 
-      _HSL_2_RGB(ttb, &b[j]);
+      dt_HSL_2_RGB(ttb, &b[j]);
       _CLAMP_XYZ(&b[j], min, max);
     }
     else
@@ -1578,11 +1454,11 @@ static void _blend_coloradjust(dt_iop_colorspace_type_t cst,const float *a, floa
     {
       _blend_Lab_scale(&a[j], ta);
       _CLAMP_XYZ(ta, min, max);
-      _Lab_2_LCH(ta, tta);
+      dt_Lab_2_LCH(ta, tta);
 
       _blend_Lab_scale(&b[j], tb);
       _CLAMP_XYZ(tb, min, max);
-      _Lab_2_LCH(tb, ttb);
+      dt_Lab_2_LCH(tb, ttb);
 
       // ttb[0] (output lightness) unchanged
       ttb[1] = (tta[1] * (1.0f - local_opacity)) + ttb[1] * local_opacity;
@@ -1592,7 +1468,7 @@ static void _blend_coloradjust(dt_iop_colorspace_type_t cst,const float *a, floa
       float s = d > 0.5f ? -local_opacity*(1.0f - d) / d : local_opacity;
       ttb[2] = fmod((tta[2] * (1.0f - s)) + ttb[2] * s + 1.0f, 1.0f);
 
-      _LCH_2_Lab(ttb, tb);
+      dt_LCH_2_Lab(ttb, tb);
       _CLAMP_XYZ(tb, min, max);
       _blend_Lab_rescale(tb, &b[j]);
     }
@@ -1603,8 +1479,8 @@ static void _blend_coloradjust(dt_iop_colorspace_type_t cst,const float *a, floa
       _CLAMP_XYZ(ta, min, max);
       _CLAMP_XYZ(&b[j], min, max);
 
-      _RGB_2_HSL(&a[j], tta);
-      _RGB_2_HSL(&b[j], ttb);
+      dt_RGB_2_HSL(&a[j], tta);
+      dt_RGB_2_HSL(&b[j], ttb);
 
       /* blend hue along shortest distance on color circle */
       float d = fabs(tta[0] - ttb[0]);
@@ -1614,7 +1490,7 @@ static void _blend_coloradjust(dt_iop_colorspace_type_t cst,const float *a, floa
       ttb[1] = (tta[1] * (1.0f - local_opacity)) + ttb[1] * local_opacity;
       // ttb[2] (output lightness) unchanged
 
-      _HSL_2_RGB(ttb, &b[j]);
+      dt_HSL_2_RGB(ttb, &b[j]);
       _CLAMP_XYZ(&b[j], min, max);
     }
     else
@@ -1852,18 +1728,16 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
   /* apply masks if there's some */
   dt_masks_form_t *form = dt_masks_get_from_id(self->dev,d->mask_id);
   
+  /* without a drawn mask the buffer is filled with 1.0f or 0.0f depending on mask_combine,
+     row by row when the mask is made */
+  int drawn = 0;
   if (form && (!(self->flags()&IOP_FLAGS_NO_MASKS)) && (d->mask_mode & DEVELOP_MASK_MASK))
   {
     int roi[4] = {roi_out->x,roi_out->y,roi_out->width,roi_out->height};
     dt_masks_group_render(self,piece,form,&mask,roi,roi_in->scale);
+    drawn = 1;
   }
-  else
-  {
-    //we fill the buffer with 1.0f or 0.0f depending on mask_combine
-    const float fill = (d->mask_combine & DEVELOP_COMBINE_INCL) ? 0.0f : 1.0f;
-    const int buffsize = roi_out->width*roi_out->height;
-    for (int i=0; i<buffsize; i++) mask[i] = fill;
-  }
+  const float fill = (d->mask_combine & DEVELOP_COMBINE_INCL) ? 0.0f : 1.0f;
 
   
   if (!(blend_mode & DEVELOP_BLEND_MASK_FLAG))
@@ -1889,11 +1763,18 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
     /* only true if mask_display was set by an _earlier_ module */
     const int mask_display = piece->pipe->mask_display;
 
+    /* check if mask should be suppressed (i.e. just set to global opacity value) */
+    const int suppress = self->suppress_mask && self->dev->gui_attached && (self == self->dev->gui_module) && (piece->pipe == self->dev->pipe) && (mask_mode & DEVELOP_MASK_BOTH);
+
+    /* unless the whole mask is needed first, each row is blended right after its mask is made,
+       while the row is still in the cache */
+    const int fused = !maskblur && !suppress;
+
 #ifdef _OPENMP
 #if !defined(__SUNOS__) && !defined(__NetBSD__)
-    #pragma omp parallel for default(none) shared(i,roi_out,o,mask,blend,d,stderr,ch)
+    #pragma omp parallel for default(none) shared(i,roi_out,o,mask,blend,d,stderr,ch,drawn)
 #else
-    #pragma omp parallel for shared(i,roi_out,o,mask,blend,d,ch)
+    #pragma omp parallel for shared(i,roi_out,o,mask,blend,d,ch,drawn)
 #endif
 
 #endif
@@ -1904,7 +1785,18 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
       float *in = (float *)i + index;
       float *out = (float *)o + index;
       float *m = (float *)mask + y * roi_out->width;
+      if(!drawn)
+        for(int x=0; x<roi_out->width; x++) m[x] = fill;
       _blend_make_mask(cst, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in, out, m, stride);
+
+      if(fused)
+      {
+        blend(cst, in, out, m, stride, blendflag);
+
+        if(mask_display && cst != iop_cs_RAW)
+          for(int j=0; j<stride; j+=4)
+            out[j+3] = in[j+3];
+      }
     }
 
     if(maskblur)
@@ -1930,8 +1822,7 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
     }
 
 
-    /* check if mask should be suppressed (i.e. just set to global opacity value) */
-    if(self->suppress_mask && self->dev->gui_attached && (self == self->dev->gui_module) && (piece->pipe == self->dev->pipe) && (mask_mode & DEVELOP_MASK_BOTH))
+    if(suppress)
     {
 #ifdef _OPENMP
 #if !defined(__SUNOS__)
@@ -1948,26 +1839,29 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
     }
 
 
+    if(!fused)
+    {
 #ifdef _OPENMP
 #if !defined(__SUNOS__)
-    #pragma omp parallel for default(none) shared(i,roi_out,o,mask,blend,stderr,ch)
+      #pragma omp parallel for default(none) shared(i,roi_out,o,mask,blend,stderr,ch)
 #else
-    #pragma omp parallel for shared(i,roi_out,o,mask,blend,ch)
+      #pragma omp parallel for shared(i,roi_out,o,mask,blend,ch)
 #endif
 
 #endif
-    for (int y=0; y<roi_out->height; y++)
-    {
-      int index = ch * y * roi_out->width;
-      int stride = ch * roi_out->width;
-      float *in = (float *)i + index;
-      float *out = (float *)o + index;
-      float *m = (float *)mask + y * roi_out->width;
-      blend(cst, in, out, m, stride, blendflag);
-
-      if(mask_display && cst != iop_cs_RAW)
-        for(int j=0; j<stride; j+=4)
-          out[j+3] = in[j+3];
+      for (int y=0; y<roi_out->height; y++)
+      {
+        int index = ch * y * roi_out->width;
+        int stride = ch * roi_out->width;
+        float *in = (float *)i + index;
+        float *out = (float *)o + index;
+        float *m = (float *)mask + y * roi_out->width;
+        blend(cst, in, out, m, stride, blendflag);
+
+        if(mask_display && cst != iop_cs_RAW)
+          for(int j=0; j<stride; j+=4)
+            out[j+3] = in[j+3];
+      }
     }
 
     /* check if _this_ module should expose mask. */
@@ -21,6 +21,7 @@
 #include "common/opencl.h"
 #include "common/dtpthread.h"
 #include "common/debug.h"
+#include "common/colorspaces_inline_conversions.h"
 #include "control/control.h"
 #include "develop/imageop.h"
 #include "develop/develop.h"
@@ -144,64 +145,6 @@ static const dt_iop_gui_blendif_colorstop_t _gradient_HUE[] =
 };
 
 
-static inline void
-_RGB_2_HSL(const float *RGB, float *HSL)
-{
-  float H, S, L;
-
-  float R = RGB[0];
-  float G = RGB[1];
-  float B = RGB[2];
-
-  float var_Min = fminf(R, fminf(G, B));
-  float var_Max = fmaxf(R, fmaxf(G, B));
-  float del_Max = var_Max - var_Min;
-
-  L = (var_Max + var_Min) / 2.0f;
-
-  if (del_Max == 0.0f)
-  {
-    H = 0.0f;
-    S = 0.0f;
-  }
-  else
-  {
-    if (L < 0.5f) S = del_Max / (var_Max + var_Min);
-    else          S = del_Max / (2.0f - var_Max - var_Min);
-
-    float del_R = (((var_Max - R) / 6.0f) + (del_Max / 2.0f)) / del_Max;
-    float del_G = (((var_Max - G) / 6.0f) + (del_Max / 2.0f)) / del_Max;
-    float del_B = (((var_Max - B) / 6.0f) + (del_Max / 2.0f)) / del_Max;
-
-    if      (R == var_Max) H = del_B - del_G;
-    else if (G == var_Max) H = (1.0f / 3.0f) + del_R - del_B;
-    else if (B == var_Max) H = (2.0f / 3.0f) + del_G - del_R;
-    else H = 0.0f;   // make GCC happy
-
-    if (H < 0.0f) H += 1.0f;
-    if (H > 1.0f) H -= 1.0f;
-  }
-
-  HSL[0] = H;
-  HSL[1] = S;
-  HSL[2] = L;
-}
-
-
-static inline void
-_Lab_2_LCH(const float *Lab, float *LCH)
-{
-  float var_H = atan2f(Lab[2], Lab[1]);
-
-  if (var_H > 0.0f) var_H = var_H / (2.0f*M_PI);
-  else              var_H = 1.0f - fabs(var_H) / (2.0f*M_PI);
-
-  LCH[0] = Lab[0];
-  LCH[1] = sqrtf(Lab[1]*Lab[1] + Lab[2]*Lab[2]);
-  LCH[2] = var_H;
-}
-
-
 static void
 _blendif_scale(dt_iop_colorspace_type_t cst, const float *in, float *out)
 {
@@ -210,7 +153,7 @@ _blendif_scale(dt_iop_colorspace_type_t cst, const float *in, float *out)
   switch(cst)
   {
     case iop_cs_Lab:
-      _Lab_2_LCH(in, temp);
+      dt_Lab_2_LCH(in, temp);
       out[0] = CLAMP_RANGE(in[0] / 100.0f, 0.0f, 1.0f);
       out[1] = CLAMP_RANGE((in[1] + 128.0f)/256.0f, 0.0f, 1.0f);
       out[2] = CLAMP_RANGE((in[2] + 128.0f)/256.0f, 0.0f, 1.0f);
@@ -219,7 +162,7 @@ _blendif_scale(dt_iop_colorspace_type_t cst, const float *in, float *out)
       out[5] = out[6] = out[7] = -1;
       break;
     case iop_cs_rgb:
-      _RGB_2_HSL(in, temp);
+      dt_RGB_2_HSL(in, temp);
       out[0] = CLAMP_RANGE(0.3f*in[0] + 0.59f*in[1] + 0.11f*in[2], 0.0f, 1.0f);
       out[1] = CLAMP_RANGE(in[0], 0.0f, 1.0f);
       out[2] = CLAMP_RANGE(in[1], 0.0f, 1.0f);
@@ -242,7 +185,7 @@ _blendif_cook(dt_iop_colorspace_type_t cst, const float *in, float *out)
   switch(cst)
   {
     case iop_cs_Lab:
-      _Lab_2_LCH(in, temp);
+      dt_Lab_2_LCH(in, temp);
       out[0] = in[0];
       out[1] = in[1];
       out[2] = in[2];
@@ -251,7 +194,7 @@ _blendif_cook(dt_iop_colorspace_type_t cst, const float *in, float *out)
       out[5] = out[6] = out[7] = -1;
       break;
     case iop_cs_rgb:
-      _RGB_2_HSL(in, temp);
+      dt_RGB_2_HSL(in, temp);
       out[0] = (0.3f*in[0] + 0.59f*in[1] + 0.11f*in[2])*255.0f;
       out[1] = in[0]*255.0f;
       out[2] = in[1]*255.0f;
@@ -28,6 +28,7 @@
 #include "common/imageio.h"
 #include "common/tags.h"
 #include "common/debug.h"
+#include "common/presets_cache.h"
 #include "develop/masks.h"
 #include "gui/gtk.h"
 
@@ -38,14 +39,22 @@
 #include <string.h>
 #include <strings.h>
 #include <assert.h>
+#include <emmintrin.h>
 
 
 #define DT_DEV_AVERAGE_DELAY_START            250
 #define DT_DEV_PREVIEW_AVERAGE_DELAY_START     50
 #define DT_DEV_AVERAGE_DELAY_COUNT              5
+// progressive rendering: slower full pipes first show a pass at this fraction of the resolution
+#define DT_DEV_PROGRESSIVE_DELAY              200
+#define DT_DEV_PROGRESSIVE_SCALE              0.25f
+// panning only processes the newly exposed strips, if the modules don't need more border than this
+#define DT_DEV_PAN_MAX_MARGIN                 64
+// smallest side of the downscaled copies of the input in dev->pyramid
+#define DT_DEV_PYRAMID_MIN_SIZE               64
 
 
-const gchar* dt_dev_histogram_type_names[DT_DEV_HISTOGRAM_N] = { "logarithmic", "linear", "waveform" };
+const gchar* dt_dev_histogram_type_names[DT_DEV_HISTOGRAM_N] = { "logarithmic", "linear", "waveform", "vectorscope" };
 
 void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
 {
@@ -76,6 +85,8 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
   dt_pthread_mutex_init(&dev->preview_pipe_mutex, NULL);
 //   dt_pthread_mutex_init(&dev->histogram_waveform_mutex, NULL);
   dev->histogram = NULL;
+  dev->preview_snapshot = NULL;
+  dt_pthread_mutex_init(&dev->preview_snapshot_mutex, NULL);
   dev->histogram_pre_tonecurve = NULL;
   dev->histogram_pre_levels = NULL;
   if(g_strcmp0(dt_conf_get_string("plugins/darkroom/histogram/mode"), "linear") == 0)
@@ -84,6 +95,8 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
     dev->histogram_type = DT_DEV_HISTOGRAM_LOGARITHMIC;
   else if(g_strcmp0(dt_conf_get_string("plugins/darkroom/histogram/mode"), "waveform") == 0)
     dev->histogram_type = DT_DEV_HISTOGRAM_WAVEFORM;
+  else if(g_strcmp0(dt_conf_get_string("plugins/darkroom/histogram/mode"), "vectorscope") == 0)
+    dev->histogram_type = DT_DEV_HISTOGRAM_VECTORSCOPE;
 
   if(dev->gui_attached)
   {
@@ -91,6 +104,8 @@ void dt_dev_init(dt_develop_t *dev, int32_t gui_attached)
     dev->preview_pipe = (dt_dev_pixelpipe_t *)malloc(sizeof(dt_dev_pixelpipe_t));
     dt_dev_pixelpipe_init(dev->pipe);
     dt_dev_pixelpipe_init_preview(dev->preview_pipe);
+    dev->masks_cache = (dt_masks_cache_t *)malloc(sizeof(dt_masks_cache_t));
+    dt_masks_cache_init(dev->masks_cache);
 
     dev->histogram = (float *)malloc(sizeof(float)*4*256);
     dev->histogram_pre_tonecurve = (float *)malloc(sizeof(float)*4*256);
@@ -120,6 +135,11 @@ void dt_dev_cleanup(dt_develop_t *dev)
   dt_pthread_mutex_destroy(&dev->pipe_mutex);
   dt_pthread_mutex_destroy(&dev->preview_pipe_mutex);
 //   dt_pthread_mutex_destroy(&dev->histogram_waveform_mutex);
+  if(dev->masks_cache)
+  {
+    dt_masks_cache_cleanup(dev->masks_cache);
+    free(dev->masks_cache);
+  }
   if(dev->pipe)
   {
     dt_dev_pixelpipe_cleanup(dev->pipe);
@@ -144,9 +164,17 @@ void dt_dev_cleanup(dt_develop_t *dev)
     dev->iop = g_list_delete_link(dev->iop, dev->iop);
   }
   dt_pthread_mutex_destroy(&dev->history_mutex);
+  free(dev->pan.buf[0]);
+  free(dev->pan.buf[1]);
+  dt_dev_pixelpipe_pyramid_cleanup(&dev->pyramid);
+  dt_dev_preview_snapshot_release(dev->preview_snapshot);
+  dev->preview_snapshot = NULL;
+  dt_pthread_mutex_destroy(&dev->preview_snapshot_mutex);
   free(dev->histogram);
   free(dev->histogram_pre_tonecurve);
   free(dev->histogram_pre_levels);
+  free(dev->histogram_waveform);
+  free(dev->histogram_vectorscope);
 
   dt_conf_set_int("darkroom/ui/overexposed/colorscheme", dev->overexposed.colorscheme);
   dt_conf_set_int("darkroom/ui/overexposed/lower", dev->overexposed.lower);
@@ -184,6 +212,130 @@ void dt_dev_invalidate_all(dt_develop_t *dev)
   dev->timestamp++;
 }
 
+// largest side of the downscaled preview kept for the navigation widget.
+#define DT_DEV_PREVIEW_SNAPSHOT_SIZE 400
+
+dt_dev_preview_snapshot_t *dt_dev_preview_snapshot_get(dt_develop_t *dev)
+{
+  dt_pthread_mutex_lock(&dev->preview_snapshot_mutex);
+  dt_dev_preview_snapshot_t *snapshot = dev->preview_snapshot;
+  if(snapshot) __sync_fetch_and_add(&snapshot->refs, 1);
+  dt_pthread_mutex_unlock(&dev->preview_snapshot_mutex);
+  return snapshot;
+}
+
+void dt_dev_preview_snapshot_release(dt_dev_preview_snapshot_t *snapshot)
+{
+  if(!snapshot || __sync_sub_and_fetch(&snapshot->refs, 1) > 0) return;
+  if(snapshot->surface) cairo_surface_destroy(snapshot->surface);
+  free(snapshot->waveform);
+  free(snapshot->vectorscope);
+  free(snapshot);
+}
+
+// copy everything the navigation and histogram widgets need out of the finished
+// preview pipe, so they can draw without locking the pipe or touching its buffers.
+static void
+_dev_preview_snapshot_publish(dt_develop_t *dev)
+{
+  dt_dev_preview_snapshot_t *snapshot = (dt_dev_preview_snapshot_t *)calloc(1, sizeof(dt_dev_preview_snapshot_t));
+  if(!snapshot) return;
+  snapshot->refs = 1;
+  snapshot->imgid = dev->image_storage.id;
+
+  dt_pthread_mutex_lock(&dev->preview_pipe->backbuf_mutex);
+  const int wd = dev->preview_pipe->backbuf_width;
+  const int ht = dev->preview_pipe->backbuf_height;
+  if(dev->preview_pipe->backbuf && wd > 0 && ht > 0)
+  {
+    const float scale = fminf(1.0f, DT_DEV_PREVIEW_SNAPSHOT_SIZE/(float)MAX(wd, ht));
+    const int swd = MAX(1, (int)(wd*scale)), sht = MAX(1, (int)(ht*scale));
+    const int stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, wd);
+    cairo_surface_t *source = cairo_image_surface_create_for_data(dev->preview_pipe->backbuf, CAIRO_FORMAT_RGB24, wd, ht, stride);
+    snapshot->surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, swd, sht);
+    cairo_t *cr = cairo_create(snapshot->surface);
+    cairo_scale(cr, swd/(double)wd, sht/(double)ht);
+    cairo_set_source_surface(cr, source, 0, 0);
+    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    cairo_surface_destroy(source);
+    snapshot->width = wd;
+    snapshot->height = ht;
+  }
+  dt_pthread_mutex_unlock(&dev->preview_pipe->backbuf_mutex);
+
+  // the histograms are only written by the preview pipe, which we are holding.
+  if(dev->histogram)
+  {
+    memcpy(snapshot->histogram, dev->histogram, sizeof(float)*4*64);
+    snapshot->histogram_max = dev->histogram_max;
+  }
+  if(dev->histogram_waveform && dev->histogram_scope_weight > 0.0f)
+  {
+    const int wd = dev->histogram_waveform_width, ht = dev->histogram_waveform_height, size = MIN(wd, ht);
+    snapshot->waveform = (uint32_t *)malloc(sizeof(uint32_t)*3*wd*ht);
+    snapshot->vectorscope = (uint32_t *)malloc(sizeof(uint32_t)*size*size);
+    if(snapshot->waveform && snapshot->vectorscope)
+    {
+      memcpy(snapshot->waveform, dev->histogram_waveform, sizeof(uint32_t)*3*wd*ht);
+      memcpy(snapshot->vectorscope, dev->histogram_vectorscope, sizeof(uint32_t)*size*size);
+      snapshot->scope_width = wd;
+      snapshot->scope_height = ht;
+      snapshot->scope_weight = dev->histogram_scope_weight;
+    }
+    else
+    {
+      free(snapshot->waveform);
+      free(snapshot->vectorscope);
+      snapshot->waveform = snapshot->vectorscope = NULL;
+    }
+  }
+
+  dt_pthread_mutex_lock(&dev->preview_snapshot_mutex);
+  dt_dev_preview_snapshot_t *old = dev->preview_snapshot;
+  dev->preview_snapshot = snapshot;
+  dt_pthread_mutex_unlock(&dev->preview_snapshot_mutex);
+  dt_dev_preview_snapshot_release(old);
+}
+
+// hash of the history the preview pipe is synched with. 0 while a focused module
+// hides part of it, the output then differs from what the thumbnail pipe would give.
+static uint64_t
+_dev_preview_hash(dt_develop_t *dev)
+{
+  if(dev->gui_module && dev->gui_module->operation_tags_filter()) return 0;
+  const dt_iop_roi_t roi = { 0, 0, 0, 0, 1.0f };
+  dt_dev_pixelpipe_cache_prepare_hash(dev->preview_pipe);
+  return dt_dev_pixelpipe_cache_hash(dev->preview_pipe->image.id, &roi, dev->preview_pipe, g_list_length(dev->preview_pipe->nodes));
+}
+
+int dt_dev_write_thumbnails(dt_develop_t *dev)
+{
+  // a preview still being processed is outdated anyways, don't wait for it:
+  if(dt_pthread_mutex_trylock(&dev->preview_pipe_mutex)) return 1;
+  int res = 1;
+  if(!dev->preview_dirty && !dev->preview_loading && dev->preview_hash)
+  {
+    // catch up with history changes the pipe hasn't seen yet, without processing:
+    dt_dev_pixelpipe_change(dev->preview_pipe, dev);
+    dt_dev_pixelpipe_t *pipe = dev->preview_pipe;
+    if(_dev_preview_hash(dev) == dev->preview_hash)
+    {
+      dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+      if(pipe->backbuf && pipe->image.id == dev->image_storage.id)
+      {
+        dt_mipmap_cache_fill_from_buffer(darktable.mipmap_cache, pipe->image.id, pipe->backbuf,
+                                         pipe->backbuf_width, pipe->backbuf_height);
+        res = 0;
+      }
+      dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+    }
+  }
+  dt_pthread_mutex_unlock(&dev->preview_pipe_mutex);
+  return res;
+}
+
 void dt_dev_process_preview_job(dt_develop_t *dev)
 {
   dt_mipmap_buffer_t buf;
@@ -252,6 +404,9 @@ restart:
   dt_show_times(&start, "[dev_process_preview] pixel pipeline processing", NULL);
   dt_dev_average_delay_update(&start, &dev->preview_average_delay);
 
+  if(dev->gui_attached)
+    _dev_preview_snapshot_publish(dev);
+  dev->preview_hash = _dev_preview_hash(dev);
   dev->preview_dirty = 0;
   // redraw the whole thing, to also update color picker values and histograms etc.
   if(dev->gui_attached)
@@ -261,6 +416,123 @@ restart:
   dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
 }
 
+// hash of everything the output of the full pipe depends on, except for the position.
+static uint64_t
+_dev_pan_hash(dt_develop_t *dev, const float scale)
+{
+  const dt_iop_roi_t roi = { 0, 0, 0, 0, scale };
+  dt_dev_pixelpipe_cache_prepare_hash(dev->pipe);
+  return dt_dev_pixelpipe_cache_hash(dev->pipe->image.id, &roi, dev->pipe, g_list_length(dev->pipe->nodes));
+}
+
+// keep a copy of the freshly processed backbuf for partial updates when panning.
+static void
+_dev_pan_store(dt_develop_t *dev, const dt_iop_roi_t *roi, const uint64_t hash)
+{
+  dev->pan.valid = 0;
+  if(!dev->pan.buf[0])
+  {
+    // capwidth and capheight never exceed the thumbnail size:
+    const size_t size = (size_t)darktable.thumbnail_width*darktable.thumbnail_height*4;
+    dev->pan.buf[0] = (uint8_t *)dt_alloc_align(16, size);
+    dev->pan.buf[1] = (uint8_t *)dt_alloc_align(16, size);
+    if(!dev->pan.buf[0] || !dev->pan.buf[1])
+    {
+      free(dev->pan.buf[0]);
+      free(dev->pan.buf[1]);
+      dev->pan.buf[0] = dev->pan.buf[1] = NULL;
+      return;
+    }
+  }
+  dt_pthread_mutex_lock(&dev->pipe->backbuf_mutex);
+  if(dev->pipe->backbuf && dev->pipe->backbuf_width == roi->width && dev->pipe->backbuf_height == roi->height)
+  {
+    memcpy(dev->pan.buf[dev->pan.cur], dev->pipe->backbuf, (size_t)roi->width*roi->height*4);
+    dev->pan.roi = *roi;
+    dev->pan.hash = hash;
+    dev->pan.imgid = dev->pipe->image.id;
+    dev->pan.valid = 1;
+  }
+  dt_pthread_mutex_unlock(&dev->pipe->backbuf_mutex);
+}
+
+// processes the region px, py, pw, ph of the view and copies the part rx, ry, rw, rh of it to dst.
+static int
+_dev_pan_strip(dt_develop_t *dev, uint8_t *dst, const dt_iop_roi_t *roi,
+               const int px, const int py, const int pw, const int ph,
+               const int rx, const int ry, const int rw, const int rh)
+{
+  if(pw <= 0 || ph <= 0) return 0;
+  if(dt_dev_pixelpipe_process(dev->pipe, dev, roi->x+px, roi->y+py, pw, ph, roi->scale)) return 1;
+  dt_pthread_mutex_lock(&dev->pipe->backbuf_mutex);
+  const uint8_t *src = dev->pipe->backbuf;
+  for(int j=0; j<rh; j++)
+    memcpy(dst + 4*((size_t)(ry+j)*roi->width + rx), src + 4*((size_t)(ry-py+j)*pw + rx-px), 4*rw);
+  dt_pthread_mutex_unlock(&dev->pipe->backbuf_mutex);
+  return 0;
+}
+
+// if only the position changed since the last run, move the old output and process the
+// newly exposed strips only. each strip is padded by the border the modules need (as given
+// by modify_roi_in and their tiling requirements), the same amount of old pixels next to it
+// is processed again, as these have seen the old border.
+// returns -1 if the old output can't be used, 1 if processing was interrupted, 0 on success.
+static int
+_dev_pan_process(dt_develop_t *dev, const dt_iop_roi_t *roi, const uint64_t hash)
+{
+  const dt_iop_roi_t *old = &dev->pan.roi;
+  if(!dev->pan.valid || dev->pan.imgid != dev->pipe->image.id || dev->pan.hash != hash) return -1;
+  if(old->width != roi->width || old->height != roi->height || old->scale != roi->scale) return -1;
+  // color pickers and module filters want to see the whole region of interest:
+  if(!dev->pipe->prefix_hash_static) return -1;
+  const int wd = roi->width, ht = roi->height;
+  const int dx = roi->x - old->x, dy = roi->y - old->y;
+  if((dx == 0 && dy == 0) || abs(dx) > wd/2 || abs(dy) > ht/2) return -1;
+  const int margin = dt_dev_pixelpipe_get_roi_margin(dev->pipe, dev, roi);
+  if(margin > DT_DEV_PAN_MAX_MARGIN) return -1;
+
+  // don't show the strips, the preview is drawn until we're done.
+  dev->image_dirty = 1;
+  const uint8_t *src = dev->pan.buf[dev->pan.cur];
+  uint8_t *dst = dev->pan.buf[1-dev->pan.cur];
+
+  // move what's still visible:
+  const int cx0 = MAX(0, -dx), cx1 = MIN(wd, wd-dx);
+  const int cy0 = MAX(0, -dy), cy1 = MIN(ht, ht-dy);
+  for(int j=cy0; j<cy1; j++)
+    memcpy(dst + 4*((size_t)j*wd + cx0), src + 4*((size_t)(j+dy)*wd + cx0+dx), 4*(cx1-cx0));
+
+  // left or right strip, full height:
+  if(dx)
+  {
+    const int r0 = dx > 0 ? MAX(0, cx1 - margin) : 0;
+    const int r1 = dx > 0 ? wd : MIN(wd, cx0 + margin);
+    const int p0 = dx > 0 ? MAX(0, r0 - margin) : 0;
+    const int p1 = dx > 0 ? wd : MIN(wd, r1 + margin);
+    if(_dev_pan_strip(dev, dst, roi, p0, 0, p1-p0, ht, r0, 0, r1-r0, ht)) return 1;
+  }
+  // top or bottom strip, full width:
+  if(dy)
+  {
+    const int r0 = dy > 0 ? MAX(0, cy1 - margin) : 0;
+    const int r1 = dy > 0 ? ht : MIN(ht, cy0 + margin);
+    const int p0 = dy > 0 ? MAX(0, r0 - margin) : 0;
+    const int p1 = dy > 0 ? ht : MIN(ht, r1 + margin);
+    if(_dev_pan_strip(dev, dst, roi, 0, p0, wd, p1-p0, 0, r0, wd, r1-r0)) return 1;
+  }
+
+  dt_pthread_mutex_lock(&dev->pipe->backbuf_mutex);
+  dev->pipe->backbuf_hash = dt_dev_pixelpipe_cache_hash(dev->pipe->image.id, roi, dev->pipe, 0);
+  dev->pipe->backbuf = dst;
+  dev->pipe->backbuf_width  = wd;
+  dev->pipe->backbuf_height = ht;
+  dev->pipe->backbuf_upscale = 1.0f;
+  dev->pan.cur = 1-dev->pan.cur;
+  dev->pan.roi = *roi;
+  dt_pthread_mutex_unlock(&dev->pipe->backbuf_mutex);
+  return 0;
+}
+
 void dt_dev_process_image_job(dt_develop_t *dev)
 {
   dt_pthread_mutex_lock(&dev->pipe_mutex);
@@ -293,6 +565,8 @@ void dt_dev_process_image_job(dt_develop_t *dev)
 
   if(dev->image_loading)
   {
+    // might be a new buffer at the old address:
+    dt_dev_pixelpipe_pyramid_cleanup(&dev->pyramid);
     // init pixel pipeline
     dt_dev_pixelpipe_cleanup_nodes(dev->pipe);
     dt_dev_pixelpipe_create_nodes(dev->pipe, dev);
@@ -318,6 +592,7 @@ void dt_dev_process_image_job(dt_develop_t *dev)
 restart:
   if(dev->gui_leaving)
   {
+    dt_dev_pixelpipe_pyramid_cleanup(&dev->pyramid);
     dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
     dt_control_log_busy_leave();
     dt_pthread_mutex_unlock(&dev->pipe_mutex);
@@ -337,6 +612,69 @@ restart:
   x = MAX(0, scale*dev->pipe->processed_width *(.5+zoom_x)-dev->capwidth/2);
   y = MAX(0, scale*dev->pipe->processed_height*(.5+zoom_y)-dev->capheight/2);
 
+  // at small zoom levels, import four channel input from downscaled copies of it instead of
+  // resampling all of it. the pipe only uses them if they have at least the requested resolution.
+  if(scale < 0.5f && !(dev->pipe->image.flags & DT_IMAGE_RAW) &&
+      !dt_dev_pixelpipe_pyramid_update(&dev->pyramid, (const float *)buf.buf, buf.width, buf.height, DT_DEV_PYRAMID_MIN_SIZE))
+    dt_dev_pixelpipe_set_input_pyramid(dev->pipe, &dev->pyramid);
+
+  const dt_iop_roi_t roi = { x, y, dev->capwidth, dev->capheight, scale };
+  const uint64_t pan_hash = _dev_pan_hash(dev, scale);
+  if(dev->gui_attached && !dev->image_loading)
+  {
+    const int err = _dev_pan_process(dev, &roi, pan_hash);
+    if(err > 0)
+    {
+      if(dev->image_force_reload)
+      {
+        dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+        dt_control_log_busy_leave();
+        dt_pthread_mutex_unlock(&dev->pipe_mutex);
+        return;
+      }
+      goto restart;
+    }
+    if(err == 0) goto processed;
+  }
+
+  const int interactive = dev->gui_attached && dev->interactive > 0 &&
+                          dt_conf_get_bool("plugins/darkroom/interactive_rendering");
+  if(interactive || (dev->gui_attached && dev->average_delay > DT_DEV_PROGRESSIVE_DELAY &&
+      dt_conf_get_bool("plugins/darkroom/progressive_rendering")))
+  {
+    // quick preliminary pass, into the scratch lines of the cache. it's interrupted
+    // like any other run as soon as the parameters change again.
+    const float q = DT_DEV_PROGRESSIVE_SCALE;
+    dev->pipe->preliminary_scale = q;
+    dev->pipe->cache.use_scratch = 1;
+    const int err = dt_dev_pixelpipe_process(dev->pipe, dev, x*q, y*q,
+                                             MAX(1, dev->capwidth*q), MAX(1, dev->capheight*q), scale*q);
+    dev->pipe->cache.use_scratch = 0;
+    dev->pipe->preliminary_scale = 1.0f;
+    if(err && dev->image_force_reload)
+    {
+      dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+      dt_control_log_busy_leave();
+      dt_pthread_mutex_unlock(&dev->pipe_mutex);
+      return;
+    }
+    if(err || dev->pipe->changed != DT_DEV_PIPE_UNCHANGED) goto restart;
+    // show it until the exact pass is done:
+    dev->image_dirty = 0;
+    dt_control_queue_redraw_center();
+    // while dragging that's all we do. the drag may have ended after the check above, in that case
+    // dt_dev_interactive_end() either sees the cleared dirty flag or we see the drag is over:
+    __sync_synchronize();
+    if(interactive && dev->interactive > 0)
+    {
+      dev->image_loading = 0;
+      dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+      dt_control_log_busy_leave();
+      dt_pthread_mutex_unlock(&dev->pipe_mutex);
+      return;
+    }
+  }
+
   dt_get_times(&start);
   if(dt_dev_pixelpipe_process(dev->pipe, dev, x, y, dev->capwidth, dev->capheight, scale))
   {
@@ -353,7 +691,9 @@ restart:
   }
   dt_show_times(&start, "[dev_process_image] pixel pipeline processing", NULL);
   dt_dev_average_delay_update(&start, &dev->average_delay);
+  if(dev->gui_attached) _dev_pan_store(dev, &roi, pan_hash);
 
+processed:
   // maybe we got zoomed/panned in the meantime?
   if(dev->pipe->changed != DT_DEV_PIPE_UNCHANGED) goto restart;
 
@@ -379,6 +719,19 @@ void dt_dev_reload_image(dt_develop_t *dev, const uint32_t imgid)
   dt_dev_invalidate(dev); // only invalidate image, preview will follow once it's loaded.
 }
 
+void dt_dev_interactive_begin(dt_develop_t *dev)
+{
+  __sync_fetch_and_add(&dev->interactive, 1);
+}
+
+void dt_dev_interactive_end(dt_develop_t *dev)
+{
+  if(__sync_sub_and_fetch(&dev->interactive, 1) > 0) return;
+  // the center view only got the quick pass, render the exact one now:
+  dev->image_dirty = 1;
+  if(dev->gui_attached) dt_control_queue_redraw_center();
+}
+
 float dt_dev_get_zoom_scale(dt_develop_t *dev, dt_dev_zoom_t zoom, int closeup_factor, int preview)
 {
   float zoom_scale;
@@ -665,41 +1018,42 @@ void dt_dev_reload_history_items(dt_develop_t *dev)
   dt_dev_pop_history_items(dev, dev->history_end);
 }
 
-void dt_dev_pop_history_items(dt_develop_t *dev, int32_t cnt)
+static void
+_dev_pop_history_items(dt_develop_t *dev, int32_t cnt, const int update_all)
 {
   // printf("dev popping all history items >= %d\n", cnt);
   dt_pthread_mutex_lock(&dev->history_mutex);
   darktable.gui->reset = 1;
   dev->history_end = cnt;
-  // reset gui params for all modules
-  GList *modules = dev->iop;
-  while(modules)
-  {
-    dt_iop_module_t *module = (dt_iop_module_t *)(modules->data);
-    memcpy(module->params, module->default_params, module->params_size);
-    memcpy(module->blend_params, module->default_blendop_params,sizeof(dt_develop_blend_params_t));
-    module->enabled = module->default_enabled;
-    modules = g_list_next(modules);
-  }
-  // go through history and set gui params
+  // only the last history item of every module counts:
+  GHashTable *last = g_hash_table_new(g_direct_hash, g_direct_equal);
   GList *history = dev->history;
   for(int i=0; i<cnt && history; i++)
   {
     dt_dev_history_item_t *hist = (dt_dev_history_item_t *)(history->data);
-    memcpy(hist->module->params, hist->params, hist->module->params_size);
-    memcpy(hist->module->blend_params, hist->blend_params, sizeof(dt_develop_blend_params_t));
-
-    hist->module->enabled = hist->enabled;
+    g_hash_table_insert(last, hist->module, hist);
     history = g_list_next(history);
   }
-  // update all gui modules
-  modules = dev->iop;
+  // set gui params for all modules, and update the ones which changed
+  GList *modules = dev->iop;
   while(modules)
   {
     dt_iop_module_t *module = (dt_iop_module_t *)(modules->data);
-    dt_iop_gui_update(module);
+    dt_dev_history_item_t *hist = (dt_dev_history_item_t *)g_hash_table_lookup(last, module);
+    const dt_iop_params_t *params = hist ? hist->params : module->default_params;
+    const dt_develop_blend_params_t *blend_params = hist ? hist->blend_params : module->default_blendop_params;
+    const int enabled = hist ? hist->enabled : module->default_enabled;
+    if(update_all || module->enabled != enabled || memcmp(module->params, params, module->params_size) ||
+       memcmp(module->blend_params, blend_params, sizeof(dt_develop_blend_params_t)))
+    {
+      memcpy(module->params, params, module->params_size);
+      memcpy(module->blend_params, blend_params, sizeof(dt_develop_blend_params_t));
+      module->enabled = enabled;
+      dt_iop_gui_update(module);
+    }
     modules = g_list_next(modules);
   }
+  g_hash_table_destroy(last);
   dev->pipe->changed |= DT_DEV_PIPE_SYNCH;
   dev->preview_pipe->changed |= DT_DEV_PIPE_SYNCH; // again, fixed topology for now.
   darktable.gui->reset = 0;
@@ -708,23 +1062,141 @@ void dt_dev_pop_history_items(dt_develop_t *dev, int32_t cnt)
   dt_control_queue_redraw_center();
 }
 
-void dt_dev_write_history(dt_develop_t *dev)
+void dt_dev_pop_history_items(dt_develop_t *dev, int32_t cnt)
+{
+  _dev_pop_history_items(dev, cnt, 1);
+}
+
+void dt_dev_pop_history_items_changed(dt_develop_t *dev, int32_t cnt)
+{
+  _dev_pop_history_items(dev, cnt, 0);
+}
+
+// one history item as copied for the db writer thread
+typedef struct dt_dev_history_row_t
+{
+  dt_dev_operation_t op;
+  int32_t version;
+  int32_t enabled;
+  void *params;
+  int32_t params_size;
+  dt_develop_blend_params_t blend_params;
+  int32_t multi_priority;
+  char multi_name[128];
+}
+dt_dev_history_row_t;
+
+typedef struct dt_dev_history_write_t
+{
+  int32_t imgid;
+  int32_t num;
+  int32_t blend_version;
+  dt_dev_history_row_t *rows;
+}
+dt_dev_history_write_t;
+
+static void
+_dev_history_write_free(void *data)
+{
+  dt_dev_history_write_t *w = (dt_dev_history_write_t *)data;
+  for(int i=0; i<w->num; i++) free(w->rows[i].params);
+  free(w->rows);
+  free(w);
+}
+
+// the last row of every module instance, in the order of the history:
+#define DT_DEV_HISTORY_COLUMNS "imgid, num, module, operation, op_params, enabled, blendop_params, blendop_version, multi_priority, multi_name"
+#define DT_DEV_HISTORY_EFFECTIVE_QUERY \
+  "select " DT_DEV_HISTORY_COLUMNS " from history as h where imgid = ?1 and num = " \
+  "(select max(num) from history where imgid = ?1 and operation = h.operation and multi_priority is h.multi_priority) order by num"
+
+// writes the effective history of the image, see history_effective in control.c
+static void
+_dev_history_effective_db(sqlite3 *handle, const int32_t imgid)
 {
   sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(handle, "delete from history_effective where imgid = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  DT_DEBUG_SQLITE3_PREPARE_V2(handle, "insert into history_effective (" DT_DEV_HISTORY_COLUMNS ") "
+                              DT_DEV_HISTORY_EFFECTIVE_QUERY, -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+}
 
-  gboolean changed = FALSE;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from history where imgid = ?1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dev->image_storage.id);
+// runs on the db writer thread, for histories changed by someone else
+static void
+_dev_history_effective_write_db(sqlite3 *handle, void *data)
+{
+  DT_DEBUG_SQLITE3_EXEC(handle, "begin", NULL, NULL, NULL);
+  _dev_history_effective_db(handle, GPOINTER_TO_INT(data));
+  DT_DEBUG_SQLITE3_EXEC(handle, "commit", NULL, NULL, NULL);
+}
+
+// runs on the db writer thread
+static void
+_dev_history_write_db(sqlite3 *handle, void *data)
+{
+  dt_dev_history_write_t *w = (dt_dev_history_write_t *)data;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_EXEC(handle, "begin", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(handle, "delete from history where imgid = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, w->imgid);
   sqlite3_step(stmt);
   sqlite3_finalize (stmt);
+  DT_DEBUG_SQLITE3_PREPARE_V2(handle, "insert into history (imgid, num, module, operation, op_params, enabled, blendop_params, blendop_version, multi_priority, multi_name) values (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10)", -1, &stmt, NULL);
+  for(int i=0; i<w->num; i++)
+  {
+    const dt_dev_history_row_t *r = w->rows + i;
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, w->imgid);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, i);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, r->version);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, r->op, strlen(r->op), SQLITE_STATIC);
+    DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 5, r->params, r->params_size, SQLITE_STATIC);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 6, r->enabled);
+    DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 7, &r->blend_params, sizeof(dt_develop_blend_params_t), SQLITE_STATIC);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 8, w->blend_version);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 9, r->multi_priority);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 10, r->multi_name, strlen(r->multi_name), SQLITE_STATIC);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize (stmt);
+  _dev_history_effective_db(handle, w->imgid);
+  DT_DEBUG_SQLITE3_EXEC(handle, "commit", NULL, NULL, NULL);
+}
+
+uint64_t dt_dev_write_history(dt_develop_t *dev)
+{
+  // copy the stack, the db writer thread commits it while we go on editing:
+  dt_dev_history_write_t *w = (dt_dev_history_write_t *)malloc(sizeof(dt_dev_history_write_t));
+  w->imgid = dev->image_storage.id;
+  w->blend_version = dt_develop_blend_version();
+  dt_pthread_mutex_lock(&dev->history_mutex);
+  w->rows = (dt_dev_history_row_t *)malloc(sizeof(dt_dev_history_row_t) * MAX(1, dev->history_end));
+  w->num = 0;
   GList *history = dev->history;
   for(int i=0; i<dev->history_end && history; i++)
   {
     dt_dev_history_item_t *hist = (dt_dev_history_item_t *)(history->data);
-    (void)dt_dev_write_history_item(&dev->image_storage, hist, i);
+    dt_dev_history_row_t *r = w->rows + w->num++;
+    g_strlcpy(r->op, hist->module->op, sizeof(r->op));
+    r->version = hist->module->version();
+    r->enabled = hist->enabled;
+    r->params_size = hist->module->params_size;
+    r->params = malloc(r->params_size);
+    memcpy(r->params, hist->params, r->params_size);
+    memcpy(&r->blend_params, hist->blend_params, sizeof(dt_develop_blend_params_t));
+    r->multi_priority = hist->multi_priority;
+    g_strlcpy(r->multi_name, hist->multi_name, sizeof(r->multi_name));
     history = g_list_next(history);
-    changed = TRUE;
   }
+  dt_pthread_mutex_unlock(&dev->history_mutex);
+  const gboolean changed = w->num > 0;
+
+  const uint64_t ticket = dt_database_write_async(darktable.db, _dev_history_write_db, w, _dev_history_write_free);
 
   /* attach / detach changed tag reflecting actual change */
   guint tagid = 0;
@@ -734,6 +1206,33 @@ void dt_dev_write_history(dt_develop_t *dev)
   else
     dt_tag_detach(tagid, dev->image_storage.id);
 
+  return ticket;
+}
+
+typedef struct dt_dev_auto_apply_t
+{
+  int imgid, cnt;
+  sqlite3_stmt *stmt;
+}
+dt_dev_auto_apply_t;
+
+static void _dev_auto_apply_preset(const dt_presets_cache_entry_t *preset, void *data)
+{
+  dt_dev_auto_apply_t *aa = (dt_dev_auto_apply_t *)data;
+  DT_DEBUG_SQLITE3_BIND_INT(aa->stmt, 1, aa->imgid);
+  DT_DEBUG_SQLITE3_BIND_INT(aa->stmt, 2, preset->op_version);
+  DT_DEBUG_SQLITE3_BIND_TEXT(aa->stmt, 3, preset->operation, -1, SQLITE_TRANSIENT);
+  DT_DEBUG_SQLITE3_BIND_BLOB(aa->stmt, 4, preset->op_params, preset->op_params_size, SQLITE_TRANSIENT);
+  DT_DEBUG_SQLITE3_BIND_INT(aa->stmt, 5, preset->enabled);
+  DT_DEBUG_SQLITE3_BIND_BLOB(aa->stmt, 6, preset->blendop_params, preset->blendop_params_size, SQLITE_TRANSIENT);
+  DT_DEBUG_SQLITE3_BIND_INT(aa->stmt, 7, preset->blendop_version);
+  DT_DEBUG_SQLITE3_BIND_INT(aa->stmt, 8, preset->multi_priority);
+  // unbound parameters are null, like the column they come from
+  if(preset->multi_name) DT_DEBUG_SQLITE3_BIND_TEXT(aa->stmt, 9, preset->multi_name, -1, SQLITE_TRANSIENT);
+  sqlite3_step(aa->stmt);
+  DT_DEBUG_SQLITE3_RESET(aa->stmt);
+  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(aa->stmt);
+  aa->cnt++;
 }
 
 static void
@@ -767,36 +1266,49 @@ auto_apply_presets(dt_develop_t *dev)
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
                         "delete from memory.history",
                         NULL, NULL, NULL);
-  const char *preset_table[2] = {"presets", "legacy_presets"};
   const int legacy = (image->flags & DT_IMAGE_NO_LEGACY_PRESETS) ? 0 : 1;
-  char query[1024];
-  snprintf(query, 1024,
-           "insert into memory.history select ?1, 0, op_version, operation, op_params, enabled, blendop_params, blendop_version, multi_priority, multi_name "
-           "from %s where autoapply=1 and "
-           "?2 like model and ?3 like maker and ?4 like lens and "
-           "?5 between iso_min and iso_max and "
-           "?6 between exposure_min and exposure_max and "
-           "?7 between aperture_min and aperture_max and "
-           "?8 between focal_length_min and focal_length_max and "
-           "(isldr = 0 or isldr=?9) order by writeprotect desc, "
-           "length(model), length(maker), length(lens)", preset_table[legacy]);
-  // query for all modules at once:
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, cimg->exif_model, strlen(cimg->exif_model), SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, cimg->exif_maker, strlen(cimg->exif_maker), SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, cimg->exif_lens,  strlen(cimg->exif_lens),  SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 5, fmaxf(0.0f, fminf(1000000, cimg->exif_iso)));
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 6, fmaxf(0.0f, fminf(1000000, cimg->exif_exposure)));
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 7, fmaxf(0.0f, fminf(1000000, cimg->exif_aperture)));
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 8, fmaxf(0.0f, fminf(1000000, cimg->exif_focal_length)));
-  // 0: dontcare, 1: ldr, 2: raw
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 9, 2-dt_image_is_ldr(cimg));
-
-  if(sqlite3_step(stmt) == SQLITE_DONE)
+  int found = 0;
+  if(legacy)
   {
+    // only images from pre-auto-apply-cleanup darktable, these aren't in the presets cache:
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "insert into memory.history select ?1, 0, op_version, operation, op_params, enabled, blendop_params, blendop_version, multi_priority, multi_name "
+                                "from legacy_presets where autoapply=1 and "
+                                "?2 like model and ?3 like maker and ?4 like lens and "
+                                "?5 between iso_min and iso_max and "
+                                "?6 between exposure_min and exposure_max and "
+                                "?7 between aperture_min and aperture_max and "
+                                "?8 between focal_length_min and focal_length_max and "
+                                "(isldr = 0 or isldr=?9) order by writeprotect desc, "
+                                "length(model), length(maker), length(lens)", -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, cimg->exif_model, strlen(cimg->exif_model), SQLITE_TRANSIENT);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, cimg->exif_maker, strlen(cimg->exif_maker), SQLITE_TRANSIENT);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, cimg->exif_lens,  strlen(cimg->exif_lens),  SQLITE_TRANSIENT);
+    DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 5, fmaxf(0.0f, fminf(1000000, cimg->exif_iso)));
+    DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 6, fmaxf(0.0f, fminf(1000000, cimg->exif_exposure)));
+    DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 7, fmaxf(0.0f, fminf(1000000, cimg->exif_aperture)));
+    DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 8, fmaxf(0.0f, fminf(1000000, cimg->exif_focal_length)));
+    // 0: dontcare, 1: ldr, 2: raw
+    DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 9, 2-dt_image_is_ldr(cimg));
+    found = (sqlite3_step(stmt) == SQLITE_DONE);
     sqlite3_finalize(stmt);
+  }
+  else
+  {
+    // matching presets of all modules at once, without going through the presets table:
+    dt_dev_auto_apply_t aa = { imgid, 0, NULL };
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "insert into memory.history values (?1, 0, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9)",
+                                -1, &aa.stmt, NULL);
+    dt_presets_cache_foreach_match(NULL, cimg, DT_PRESETS_CACHE_MATCH_AUTOAPPLY, _dev_auto_apply_preset, &aa);
+    sqlite3_finalize(aa.stmt);
+    found = aa.cnt > 0;
+  }
+
+  if(found)
+  {
     int cnt = 0;
     // count what we found:
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
@@ -826,8 +1338,8 @@ auto_apply_presets(dt_develop_t *dev)
         sqlite3_step(stmt);
       }
     }
+    sqlite3_finalize(stmt);
   }
-  sqlite3_finalize(stmt);
 
   //  first time we are loading the image, try to import lightroom .xmp if any
   if (dev->image_loading)
@@ -846,12 +1358,33 @@ void dt_dev_read_history(dt_develop_t *dev)
   if(dev->image_storage.id <= 0) return;
   if(!dev->iop) return;
 
+  // a history written by dt_dev_write_history() might still be queued:
+  dt_database_write_sync(darktable.db);
+
   // maybe prepend auto-presets to history before loading it:
   auto_apply_presets(dev);
 
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "select imgid, num, module, operation, op_params, enabled, blendop_params, blendop_version, multi_priority, multi_name from history where imgid = ?1 order by num", -1, &stmt, NULL);
+  // only the history lib in the darkroom needs every step. pipes without a gui just need the effective
+  // history, from the snapshot if there is one or else collapsed on the fly:
+  int snapshot = 0, collapsed = 0;
+  if(!dev->gui_attached)
+  {
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "select 1 from history_effective where imgid = ?1 limit 1", -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dev->image_storage.id);
+    snapshot = (sqlite3_step(stmt) == SQLITE_ROW);
+    collapsed = !snapshot;
+    sqlite3_finalize(stmt);
+  }
+  if(snapshot)
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "select " DT_DEV_HISTORY_COLUMNS " from history_effective where imgid = ?1 order by num", -1, &stmt, NULL);
+  else if(collapsed)
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), DT_DEV_HISTORY_EFFECTIVE_QUERY, -1, &stmt, NULL);
+  else
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "select " DT_DEV_HISTORY_COLUMNS " from history where imgid = ?1 order by num", -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dev->image_storage.id);
   dev->history_end = 0;
   while(sqlite3_step(stmt) == SQLITE_ROW)
@@ -988,6 +1521,9 @@ void dt_dev_read_history(dt_develop_t *dev)
     dev->history = g_list_append(dev->history, hist);
     dev->history_end ++;
   }
+  // the history was changed without a snapshot, the next reader gets one:
+  if(collapsed && dev->history_end > 0)
+    dt_database_write_async(darktable.db, _dev_history_effective_write_db, GINT_TO_POINTER(dev->image_storage.id), NULL);
 
   if(dev->gui_attached)
   {
@@ -1240,9 +1776,9 @@ void dt_dev_masks_selection_change(dt_develop_t *dev, int selectid, int throw_ev
     dev->proxy.masks.selection_change(dev->proxy.masks.module, selectid, throw_event);
 }
 
-void dt_dev_snapshot_request(dt_develop_t *dev, const char *filename)
+void dt_dev_snapshot_request(dt_develop_t *dev, cairo_surface_t **surface)
 {
-  dev->proxy.snapshot.filename = filename;
+  dev->proxy.snapshot.surface = surface;
   dev->proxy.snapshot.request = TRUE;
   dt_control_queue_redraw_center();
 }
@@ -1452,6 +1988,60 @@ dt_dev_pixelpipe_iop_t *dt_dev_distort_get_iop_pipe(dt_develop_t *dev, struct dt
   return NULL;
 }
 
+// colors of the over and under exposed pixels per color scheme, as bgrx bytes of cairo rgb24:
+static const uint8_t _overexposed_colors[][2][4] =
+{
+  { {   0,   0,   0, 255 }, { 255, 255, 255, 255 } }, // black, white
+  { {   0,   0, 255, 255 }, { 255,   0,   0, 255 } }, // red, blue
+  { { 239, 111,  95, 255 }, {  95, 239, 131, 255 } }  // purple (#5f6fef), green (#83ef5f)
+};
+
+void dt_dev_overexposed_overlay(const dt_develop_t *dev, const uint8_t *in, uint8_t *out, const int width,
+                                const int height)
+{
+  const int scheme = CLAMP(dev->overexposed.colorscheme, 0, 2);
+  const uint8_t *upper_color = _overexposed_colors[scheme][0];
+  const uint8_t *lower_color = _overexposed_colors[scheme][1];
+  // the thresholds in percent of the display values, which are these bytes:
+  const int upper = CLAMP((int)(dev->overexposed.upper * 2.55f + 0.5f), 0, 255);
+  const int lower = CLAMP((int)(dev->overexposed.lower * 2.55f + 0.5f), 0, 255);
+  const size_t npixels = (size_t)width * height;
+
+  // four pixels at a time. a channel is at or above upper if max(v, upper) == v, at or below lower if
+  // min(v, lower) == v; the fourth byte of each pixel is masked out.
+  const __m128i rgb = _mm_set1_epi32(0x00ffffff);
+  const __m128i up = _mm_set1_epi8((char)upper), lo = _mm_set1_epi8((char)lower);
+  const __m128i upc = _mm_set1_epi32(*(const int32_t *)upper_color);
+  const __m128i loc = _mm_set1_epi32(*(const int32_t *)lower_color);
+  const int nvec = npixels / 4;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static)
+#endif
+  for(int k = 0; k < nvec; k++)
+  {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(in + (size_t)16*k));
+    const __m128i ge = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, up), v), rgb);
+    const __m128i le = _mm_and_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, lo), v), rgb);
+    // any channel over, all channels under:
+    const __m128i over = _mm_andnot_si128(_mm_cmpeq_epi32(ge, _mm_setzero_si128()), _mm_set1_epi32(-1));
+    const __m128i under = _mm_andnot_si128(over, _mm_cmpeq_epi32(le, rgb));
+    const __m128i keep = _mm_andnot_si128(_mm_or_si128(over, under), v);
+    const __m128i res = _mm_or_si128(keep, _mm_or_si128(_mm_and_si128(over, upc), _mm_and_si128(under, loc)));
+    _mm_storeu_si128((__m128i *)(out + (size_t)16*k), res);
+  }
+  for(size_t k = (size_t)4*nvec; k < npixels; k++)
+  {
+    const uint8_t *i = in + 4*k;
+    uint8_t *o = out + 4*k;
+    if(i[0] >= upper || i[1] >= upper || i[2] >= upper)
+      memcpy(o, upper_color, 4);
+    else if(i[0] <= lower && i[1] <= lower && i[2] <= lower)
+      memcpy(o, lower_color, 4);
+    else
+      memcpy(o, i, 4);
+  }
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -54,12 +54,52 @@ typedef enum dt_dev_histogram_type_t
   DT_DEV_HISTOGRAM_LOGARITHMIC = 0,
   DT_DEV_HISTOGRAM_LINEAR,
   DT_DEV_HISTOGRAM_WAVEFORM,
+  DT_DEV_HISTOGRAM_VECTORSCOPE,
   DT_DEV_HISTOGRAM_N // needs to be the last one
 } dt_dev_histogram_type_t;
 
 extern const gchar* dt_dev_histogram_type_names[];
 
+/** what the navigation and histogram widgets draw from: published once per finished
+ *  preview pipe run and never modified afterwards, so readers only hold a reference. */
+typedef struct dt_dev_preview_snapshot_t
+{
+  int32_t refs;
+  int32_t imgid;
+  cairo_surface_t *surface;  // downscaled copy of the preview backbuf, RGB24
+  int32_t width, height;     // dimensions of the backbuf the surface was made from
+  float histogram[4*64];
+  float histogram_max;
+  uint32_t *waveform;        // bins of the scopes, see dt_histogram_scope_image(), or NULL
+  uint32_t *vectorscope;
+  int32_t scope_width, scope_height;
+  float scope_weight;
+}
+dt_dev_preview_snapshot_t;
+
 struct dt_dev_pixelpipe_t;
+
+// levels of dt_dev_pixelpipe_pyramid_t, 1/2 down to 1/32
+#define DT_DEV_PIXELPIPE_PYRAMID_LEVELS 5
+
+/**
+ * copies of a four channel float input downscaled by 2, 4, 8, ... so the pipe can
+ * import from the smallest one still at least as large as the requested region of
+ * interest, instead of resampling the whole input at small zoom levels.
+ * see dt_dev_pixelpipe_pyramid_update(), here because dt_develop_t keeps one.
+ */
+typedef struct dt_dev_pixelpipe_pyramid_t
+{
+  // the input the levels were made from
+  const float *input;
+  int iwidth, iheight;
+  int levels;
+  // level k is downscaled by 2^(k+1)
+  float *buf[DT_DEV_PIXELPIPE_PYRAMID_LEVELS];
+  int width[DT_DEV_PIXELPIPE_PYRAMID_LEVELS], height[DT_DEV_PIXELPIPE_PYRAMID_LEVELS];
+}
+dt_dev_pixelpipe_pyramid_t;
+
 typedef struct dt_develop_t
 {
   int32_t gui_attached; // != 0 if the gui should be notified of changes in hist stack and modules should be gui_init'ed.
@@ -71,6 +111,8 @@ typedef struct dt_develop_t
   uint32_t timestamp;
   uint32_t average_delay;
   uint32_t preview_average_delay;
+  int32_t interactive; // number of sliders and curves being dragged right now.
+  uint64_t preview_hash; // history the preview backbuf was processed with, 0 if it can't stand in for a thumbnail.
   struct dt_iop_module_t *gui_module; // this module claims gui expose/event callbacks.
   float preview_downsampling; // < 1.0: optionally downsample preview
 
@@ -82,6 +124,32 @@ typedef struct dt_develop_t
   struct dt_dev_pixelpipe_t *pipe, *preview_pipe;
   dt_pthread_mutex_t pipe_mutex, preview_pipe_mutex; // these are locked while the pipes are still in use
 
+  // copy of the last output of the full pipe, to only process the newly exposed
+  // strips when panning. two buffers, the one displayed and the one being put together.
+  struct
+  {
+    uint8_t *buf[2];
+    int cur;
+    int valid;
+    int32_t imgid;
+    uint64_t hash;    // processing parameters and scale buf[cur] is valid for
+    dt_iop_roi_t roi; // region of interest of buf[cur]
+  }
+  pan;
+
+  // downscaled copies of the full pipe's input, for small zoom levels. only for
+  // images which come in as four floats per pixel, i.e. not for raws.
+  dt_dev_pixelpipe_pyramid_t pyramid;
+
+  // loading the filmstrip neighbours while the user rests on an image, see views/darkroom.c
+  struct
+  {
+    guint timeout;      // polls for idle time
+    double last_input;  // dt_get_wtime() of the last user input
+    int32_t imgid;      // image the neighbours were loaded for
+  }
+  prerender;
+
   // image under consideration, which
   // is copied each time an image is changed. this means we have some information
   // always cached (might be out of sync, so stars are not reliable), but for the iops
@@ -102,15 +170,24 @@ typedef struct dt_develop_t
   // histogram for display.
   float *histogram, *histogram_pre_tonecurve, *histogram_pre_levels;
   float histogram_max, histogram_pre_tonecurve_max, histogram_pre_levels_max;
-  uint32_t *histogram_waveform, histogram_waveform_width, histogram_waveform_height, histogram_waveform_stride;
+  // bins of the waveform and the vectorscope, collected by the preview pipe at the size the histogram
+  // widget sets, see common/histogram.h. weight is the number of pixels one count stands for.
+  uint32_t *histogram_waveform, *histogram_vectorscope, histogram_waveform_width, histogram_waveform_height;
+  float histogram_scope_weight;
   // we should process the waveform histogram in the correct size to make it not look like crap. since this requires gui knowledge we need this mutex
 //   dt_pthread_mutex_t histogram_waveform_mutex;
   dt_dev_histogram_type_t histogram_type;
 
+  // last finished preview, see dt_dev_preview_snapshot_get()
+  dt_dev_preview_snapshot_t *preview_snapshot;
+  dt_pthread_mutex_t preview_snapshot_mutex;
+
   // list of forms iop can use for masks or whatever
   GList *forms;
   struct dt_masks_form_t *form_visible;
   struct dt_masks_form_gui_t *form_gui;
+  // rendered masks, to skip the rasterization when only the modules after them changed
+  struct dt_masks_cache_t *masks_cache;
 
   /* proxy for communication between plugins and develop/darkroom */
   struct
@@ -145,9 +222,9 @@ typedef struct dt_develop_t
     struct
     {
       // this flag is set by snapshot plugin to signal that expose of darkroom
-      // should store cairo surface as snapshot to disk using filename.
+      // should store a copy of its cairo surface in *surface.
       gboolean request;
-      const gchar *filename;
+      cairo_surface_t **surface;
     }
     snapshot;
 
@@ -198,8 +275,12 @@ void dt_dev_reload_image(dt_develop_t *dev, const uint32_t imgid);
 int dt_dev_is_current_image(dt_develop_t *dev, uint32_t imgid);
 void dt_dev_add_history_item(dt_develop_t *dev, struct dt_iop_module_t *module, gboolean enable);
 void dt_dev_reload_history_items(dt_develop_t *dev);
+/** sets all modules to the first cnt history items and updates their gui. */
 void dt_dev_pop_history_items(dt_develop_t *dev, int32_t cnt);
-void dt_dev_write_history(dt_develop_t *dev);
+/** same, but only updates the gui of modules which change. for moving around in the history. */
+void dt_dev_pop_history_items_changed(dt_develop_t *dev, int32_t cnt);
+/** queues the history stack for the db writer thread. @return ticket for dt_database_write_wait(). */
+uint64_t dt_dev_write_history(dt_develop_t *dev);
 void dt_dev_read_history(dt_develop_t *dev);
 
 void dt_dev_invalidate(dt_develop_t *dev);
@@ -207,9 +288,20 @@ void dt_dev_invalidate(dt_develop_t *dev);
 void dt_dev_invalidate_all(dt_develop_t *dev);
 void dt_dev_set_histogram(dt_develop_t *dev);
 void dt_dev_set_histogram_pre(dt_develop_t *dev);
+/** returns a reference to the result of the last preview pipe run, or NULL. */
+dt_dev_preview_snapshot_t *dt_dev_preview_snapshot_get(dt_develop_t *dev);
+/** drops a reference obtained by dt_dev_preview_snapshot_get(). */
+void dt_dev_preview_snapshot_release(dt_dev_preview_snapshot_t *snapshot);
 void dt_dev_get_history_item_label(dt_dev_history_item_t *hist, char *label, const int cnt);
 void dt_dev_reprocess_all(dt_develop_t *dev);
 void dt_dev_reprocess_center(dt_develop_t *dev);
+/** replaces the thumbnails of the current image by the output of the preview pipe, if that was processed with
+ * the current history. returns non-zero if it was not, the thumbnails are left alone then. */
+int dt_dev_write_thumbnails(dt_develop_t *dev);
+/** a slider or curve node is being dragged: until the matching end, the center view only renders the quick
+ * pass at reduced scale. ending the last drag asks for the exact image. */
+void dt_dev_interactive_begin(dt_develop_t *dev);
+void dt_dev_interactive_end(dt_develop_t *dev);
 
 void dt_dev_get_processed_size(const dt_develop_t *dev, int *procw, int *proch);
 void dt_dev_check_zoom_bounds(dt_develop_t *dev, float *zoom_x, float *zoom_y, dt_dev_zoom_t zoom, int closeup, float *boxw, float *boxh);
@@ -252,7 +344,7 @@ uint32_t dt_dev_modulegroups_get(dt_develop_t *dev);
 gboolean dt_dev_modulegroups_test(dt_develop_t *dev, uint32_t group, uint32_t iop_group);
 
 /** request snapshot */
-void dt_dev_snapshot_request(dt_develop_t *dev, const char *filename);
+void dt_dev_snapshot_request(dt_develop_t *dev, cairo_surface_t **surface);
 
 /** update gliding average for pixelpipe delay */
 void dt_dev_average_delay_update(const dt_times_t *start, uint32_t *average_delay);
@@ -290,6 +382,11 @@ int dt_dev_distort_backtransform_plus(dt_develop_t *dev, struct dt_dev_pixelpipe
 /** get the iop_pixelpipe instance corresponding to the iop in the given pipe */
 struct dt_dev_pixelpipe_iop_t *dt_dev_distort_get_iop_pipe(dt_develop_t *dev, struct dt_dev_pixelpipe_t *pipe, struct dt_iop_module_t *module);
 
+/** copies the 8 bit display buffer of a pipe (cairo rgb24) to out, with the over and under exposed pixels
+  * marked as set in dev->overexposed. done when drawing, so toggling it doesn't run the pipe. */
+void dt_dev_overexposed_overlay(const dt_develop_t *dev, const uint8_t *in, uint8_t *out, const int width,
+                                const int height);
+
 /*
  * distort functions
  */
@@ -22,6 +22,8 @@
 #include "common/dtpthread.h"
 #include "common/debug.h"
 #include "common/interpolation.h"
+#include "common/plugin_manifest.h"
+#include "common/presets_cache.h"
 #include "bauhaus/bauhaus.h"
 #include "control/control.h"
 #include "develop/imageop.h"
@@ -46,6 +48,7 @@
 #include <string.h>
 #include <gmodule.h>
 #include <xmmintrin.h>
+#include <emmintrin.h>
 #include <time.h>
 #include <sys/select.h>
 
@@ -65,6 +68,37 @@ static dt_develop_blend_params_t _default_blendop_params= {DEVELOP_MASK_DISABLED
   }
 };
 
+typedef struct dt_iop_preset_interpolate_t
+{
+  const dt_iop_module_t *module;
+  float image_iso;
+  float *params1, *params2;
+  float iso1, iso2;
+}
+dt_iop_preset_interpolate_t;
+
+static void _iop_preset_interpolate(const dt_presets_cache_entry_t *preset, void *data)
+{
+  dt_iop_preset_interpolate_t *d = (dt_iop_preset_interpolate_t *)data;
+  if(preset->op_version != d->module->version()) return;
+  if(!preset->op_params || preset->op_params_size != d->module->params_size) return;
+  // a missing iso range reads as 0 from sql
+  const float iso_min = isnan(preset->iso_min) ? 0.0f : preset->iso_min;
+  const float iso_max = isnan(preset->iso_max) ? 0.0f : preset->iso_max;
+  const float cur_iso = (iso_min + iso_max)*.5f;
+  // remember the preset and interpolate params later on
+  if(cur_iso > d->iso1 && cur_iso <= d->image_iso)
+  {
+    d->iso1 = cur_iso;
+    memcpy(d->params1, preset->op_params, preset->op_params_size);
+  }
+  if(cur_iso < d->iso2 && cur_iso >= d->image_iso)
+  {
+    d->iso2 = cur_iso;
+    memcpy(d->params2, preset->op_params, preset->op_params_size);
+  }
+}
+
 int dt_iop_load_preset_interpolated_iso(
   dt_iop_module_t *module,     // module to set params (via add history item)
   const dt_image_t *cimg,      // const image carrying all the exif data to filter by
@@ -72,62 +106,14 @@ int dt_iop_load_preset_interpolated_iso(
   float *output_iso1,          // if != 0, will contain one iso value
   float *output_iso2)          // if != 0, will contain the other iso value interpolated from.
 {
-  const void *op_params = NULL;
-
   // we'd like to interpolate these:
   float params1[module->params_size/4 + 1];
   float params2[module->params_size/4 + 1];
-  float iso1 = -FLT_MAX, iso2 = FLT_MAX;
-
-  sqlite3_stmt *stmt;
-
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "select op_params, iso_min, iso_max "
-                              "from presets where operation = ?1 and op_version = ?2 and "
-                              "?3 like model and ?4 like maker and ?5 like lens and "
-                              // we interpolate that away:
-                              // "?6 between iso_min and iso_max and "
-                              "?6 between exposure_min and exposure_max and "
-                              "?7 between aperture_min and aperture_max and "
-                              "?8 between focal_length_min and focal_length_max and "
-                              "(isldr = 0 or isldr=?9) order by "
-                              "length(model), length(maker), length(lens)",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, module->op, strlen(module->op), SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, module->version());
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, cimg->exif_model, strlen(cimg->exif_model), SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, cimg->exif_maker, strlen(cimg->exif_maker), SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 5, cimg->exif_lens,  strlen(cimg->exif_lens),  SQLITE_TRANSIENT);
-  // DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 6, fmaxf(0.0f, fminf(1000000, cimg->exif_iso)));
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 6, fmaxf(0.0f, fminf(1000000, cimg->exif_exposure)));
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 7, fmaxf(0.0f, fminf(1000000, cimg->exif_aperture)));
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 8, fmaxf(0.0f, fminf(1000000, cimg->exif_focal_length)));
-  // 0: dontcare, 1: ldr, 2: raw
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 9, 2-dt_image_is_ldr(cimg));
+  dt_iop_preset_interpolate_t d = { module, cimg->exif_iso, params1, params2, -FLT_MAX, FLT_MAX };
 
-  while(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    op_params  = sqlite3_column_blob(stmt, 0);
-    int op_length  = sqlite3_column_bytes(stmt, 0);
-    float iso_min = sqlite3_column_double(stmt, 1);
-    float iso_max = sqlite3_column_double(stmt, 2);
-    const float cur_iso = (iso_min + iso_max)*.5f;
-    if(op_params && (op_length == module->params_size))
-    {
-      // remember the preset and interpolate params later on
-      if(cur_iso > iso1 && cur_iso <= cimg->exif_iso)
-      {
-        iso1 = cur_iso;
-        memcpy(params1, op_params, op_length);
-      }
-      if(cur_iso < iso2 && cur_iso >= cimg->exif_iso)
-      {
-        iso2 = cur_iso;
-        memcpy(params2, op_params, op_length);
-      }
-    }
-  }
-  sqlite3_finalize(stmt);
+  // the iso range is interpolated away, everything else has to match:
+  dt_presets_cache_foreach_match(module->op, cimg, DT_PRESETS_CACHE_MATCH_ANY_ISO, _iop_preset_interpolate, &d);
+  const float iso1 = d.iso1, iso2 = d.iso2;
   if(iso1 == -FLT_MAX || iso2 == FLT_MAX)
   {
     // no presets found around, and we're not doing any extrapolation:
@@ -660,17 +646,31 @@ int dt_iop_load_module_so(dt_iop_module_so_t *module, const char *libname, const
   if(!g_module_symbol(module->module, "init_pipe",              (gpointer)&(module->init_pipe)))              module->init_pipe = default_init_pipe;
   if(!g_module_symbol(module->module, "cleanup_pipe",           (gpointer)&(module->cleanup_pipe)))           module->cleanup_pipe = default_cleanup_pipe;
   if(!g_module_symbol(module->module, "process",                (gpointer)&(module->process)))                goto error;
+  // modules can have variants of process() for newer cpus, used instead if dt_init() found the cpu to support them:
+  gpointer process_avx2 = NULL;
+  if(dt_codepath_avx2() && g_module_symbol(module->module, "process_avx2", &process_avx2))   module->process = process_avx2;
   if(!g_module_symbol(module->module, "process_tiling",         (gpointer)&(module->process_tiling)))         module->process_tiling = default_process_tiling;
   if(!darktable.opencl->inited ||
       !g_module_symbol(module->module, "process_cl",            (gpointer)&(module->process_cl)))             module->process_cl = NULL;
   if(!g_module_symbol(module->module, "process_tiling_cl",      (gpointer)&(module->process_tiling_cl)))      module->process_tiling_cl = darktable.opencl->inited ? default_process_tiling_cl : NULL;
+  if(!darktable.opencl->inited ||
+      !g_module_symbol(module->module, "process_cl_to_host",    (gpointer)&(module->process_cl_to_host)))     module->process_cl_to_host = NULL;
+  if(!g_module_symbol(module->module, "process_pixels",         (gpointer)&(module->process_pixels)))         module->process_pixels = NULL;
   if(!g_module_symbol(module->module, "distort_transform",      (gpointer)&(module->distort_transform)))      module->distort_transform = default_distort_transform;
   if(!g_module_symbol(module->module, "distort_backtransform",  (gpointer)&(module->distort_backtransform)))  module->distort_backtransform = default_distort_backtransform;
+  if(!g_module_symbol(module->module, "warp_backtransform",     (gpointer)&(module->warp_backtransform)))     module->warp_backtransform = NULL;
 
   if(!g_module_symbol(module->module, "modify_roi_in",          (gpointer)&(module->modify_roi_in)))          module->modify_roi_in = dt_iop_modify_roi_in;
   if(!g_module_symbol(module->module, "modify_roi_out",         (gpointer)&(module->modify_roi_out)))         module->modify_roi_out = dt_iop_modify_roi_out;
+  if(!g_module_symbol(module->module, "invert_roi_in",          (gpointer)&(module->invert_roi_in)))          module->invert_roi_in = NULL;
   if(!g_module_symbol(module->module, "legacy_params",          (gpointer)&(module->legacy_params)))          module->legacy_params = NULL;
-  if(module->init_global) module->init_global(module);
+  if(!g_module_symbol(module->module, "is_identity",            (gpointer)&(module->is_identity)))            module->is_identity = NULL;
+  if(module->init_global)
+  {
+    dt_opencl_record_programs(&module->cl_programs);
+    module->init_global(module);
+    dt_opencl_record_programs(NULL);
+  }
   return 0;
 error:
   fprintf(stderr, "[iop_load_module] failed to open operation `%s': %s\n", op, g_module_error());
@@ -744,11 +744,16 @@ dt_iop_load_module_by_so(dt_iop_module_t *module, dt_iop_module_so_t *so, dt_dev
   module->process_tiling  = so->process_tiling;
   module->process_cl      = so->process_cl;
   module->process_tiling_cl = so->process_tiling_cl;
+  module->process_cl_to_host = so->process_cl_to_host;
+  module->process_pixels  = so->process_pixels;
   module->distort_transform = so->distort_transform;
   module->distort_backtransform = so->distort_backtransform;
+  module->warp_backtransform = so->warp_backtransform;
   module->modify_roi_in   = so->modify_roi_in;
   module->modify_roi_out  = so->modify_roi_out;
+  module->invert_roi_in   = so->invert_roi_in;
   module->legacy_params   = so->legacy_params;
+  module->is_identity     = so->is_identity;
 
   module->connect_key_accels = so->connect_key_accels;
   module->disconnect_key_accels = so->disconnect_key_accels;
@@ -1459,6 +1464,7 @@ void dt_iop_load_modules_so()
   g_strlcat(plugindir, "/plugins", 1024);
   GDir *dir = g_dir_open(plugindir, 0, NULL);
   if(!dir) return;
+  dt_plugin_manifest_t *manifest = dt_plugin_manifest_load("iop");
   while((d_name = g_dir_read_name(dir)))
   {
     // get lib*.so
@@ -1474,9 +1480,20 @@ void dt_iop_load_modules_so()
       free(module);
       continue;
     }
-    g_free(libname);
     res = g_list_append(res, module);
-    init_presets(module);
+    // presets of unchanged modules are in the database since the last start
+    if(!dt_plugin_manifest_current(manifest, op, libname, module->version()))
+    {
+      // remove auto generated presets of the old build, not the user included ones.
+      sqlite3_stmt *stmt;
+      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from presets where operation=?1 and writeprotect=1", -1, &stmt, NULL);
+      DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, op, -1, SQLITE_TRANSIENT);
+      sqlite3_step(stmt);
+      sqlite3_finalize(stmt);
+      init_presets(module);
+      dt_plugin_manifest_set(manifest, op, libname, module->version());
+    }
+    g_free(libname);
     // Calling the accelerator initialization callback, if present
     init_key_accels(module);
 
@@ -1497,6 +1514,7 @@ void dt_iop_load_modules_so()
     }
   }
   g_dir_close(dir);
+  dt_plugin_manifest_save(manifest);
   darktable.iop = res;
 }
 
@@ -1578,6 +1596,7 @@ void dt_iop_unload_modules_so()
   {
     dt_iop_module_so_t *module = (dt_iop_module_so_t *)darktable.iop->data;
     if(module->cleanup_global) module->cleanup_global(module);
+    g_list_free(module->cl_programs);
     if(module->module) g_module_close(module->module);
     free(darktable.iop->data);
     darktable.iop = g_list_delete_link(darktable.iop, darktable.iop);
@@ -1588,6 +1607,13 @@ void dt_iop_commit_params(dt_iop_module_t *module, dt_iop_params_t *params, dt_d
 {
   uint64_t hash = 5381;
   piece->hash = 0;
+  // denoising and the like don't show at thumbnail size, don't spend the time:
+  if(piece->enabled && (module->flags() & IOP_FLAGS_THUMBNAIL_INVISIBLE) && dt_dev_pixelpipe_fast_thumbnail(pipe))
+    piece->enabled = 0;
+  // params which do nothing cost nothing. the preview pipe still runs them for their pickers and histograms:
+  if(piece->enabled && module->is_identity && pipe->type != DT_DEV_PIXELPIPE_PREVIEW &&
+     blendop_params->mask_mode == DEVELOP_MASK_DISABLED && module->is_identity(module, params, piece))
+    piece->enabled = 0;
   if(piece->enabled)
   {
     /* construct module params data for hash calc */
@@ -1613,6 +1639,8 @@ void dt_iop_commit_params(dt_iop_module_t *module, dt_iop_params_t *params, dt_d
 
     // assume process_cl is ready, commit_params can overwrite this.
     if(module->process_cl) piece->process_cl_ready = 1;
+    // modules which handle the uint16 mosaic say so in commit_params:
+    piece->process_raw16 = 0;
     module->commit_params(module, params, pipe, piece);
     for(int i=0; i<length; i++) hash = ((hash << 5) + hash) ^ str[i];
     piece->hash = hash;
@@ -2121,12 +2149,43 @@ GtkWidget *dt_iop_gui_get_pluginui(dt_iop_module_t *module)
 
 int dt_iop_breakpoint(struct dt_develop_t *dev, struct dt_dev_pixelpipe_t *pipe)
 {
+  if(pipe->job && dt_control_job_get_state(pipe->job) == DT_JOB_STATE_CANCELLED)
+  {
+    pipe->shutdown = 1;
+    return 1;
+  }
   if(pipe != dev->preview_pipe) sched_yield();
   if(pipe != dev->preview_pipe && pipe->changed == DT_DEV_PIPE_ZOOMED) return 1;
   if((pipe->changed != DT_DEV_PIPE_UNCHANGED && pipe->changed != DT_DEV_PIPE_ZOOMED) || dev->gui_leaving) return 1;
   return 0;
 }
 
+void *dt_iop_scratch_alloc(struct dt_dev_pixelpipe_iop_t *piece, size_t size)
+{
+  return dt_dev_pixelpipe_arena_alloc(&piece->pipe->arena, size);
+}
+
+void dt_iop_scratch_free(struct dt_dev_pixelpipe_iop_t *piece, void *ptr, size_t size)
+{
+  dt_dev_pixelpipe_arena_free(&piece->pipe->arena, ptr, size);
+}
+
+void dt_iop_raw16_unpack(float *out, const uint16_t *in, const size_t n)
+{
+  const __m128 scale = _mm_set1_ps(1.0f/DT_IOP_RAW16_ONE);
+  const __m128i zero = _mm_setzero_si128();
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none) shared(out, in)
+#endif
+  for(size_t j=0; j<n/8; j++)
+  {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(in + 8*j));
+    _mm_storeu_ps(out + 8*j,     _mm_mul_ps(scale, _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero))));
+    _mm_storeu_ps(out + 8*j + 4, _mm_mul_ps(scale, _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero))));
+  }
+  for(size_t k=n&~(size_t)7; k<n; k++) out[k] = in[k] * (1.0f/DT_IOP_RAW16_ONE);
+}
+
 void dt_iop_nap(int32_t usec)
 {
   if(usec <= 0) return;
@@ -2769,6 +2828,11 @@ static gboolean enable_module_callback(GtkAccelGroup *accel_group,
 
 
 
+static void _iop_connect_preset_accel(const dt_presets_cache_entry_t *preset, void *data)
+{
+  if(preset->name) dt_accel_connect_preset_iop((dt_iop_module_t *)data, preset->name);
+}
+
 void dt_iop_connect_common_accels(dt_iop_module_t *module)
 {
 
@@ -2795,15 +2859,8 @@ void dt_iop_connect_common_accels(dt_iop_module_t *module)
   if(module->fusion_slider)
     dt_accel_connect_slider_iop(module, "fusion", module->fusion_slider);
 
-  sqlite3_stmt *stmt;
   // don't know for which image. show all we got:
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select name from presets where operation=?1 order by writeprotect desc, rowid", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, module->op, strlen(module->op), SQLITE_TRANSIENT);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    dt_accel_connect_preset_iop(module,(char *)sqlite3_column_text(stmt, 0));
-  }
-  sqlite3_finalize(stmt);
+  dt_presets_cache_foreach(module->op, _iop_connect_preset_accel, module);
 }
 
 gchar *
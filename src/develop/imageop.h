@@ -64,6 +64,8 @@ struct dt_develop_tiling_t;
 #define IOP_FLAGS_PREVIEW_NON_OPENCL  256                       // Preview pixelpipe of this module must not run on GPU but always on CPU
 #define IOP_FLAGS_NO_HISTORY_STACK    512                       // This iop will never show up in the history stack
 #define IOP_FLAGS_NO_MASKS  1024    // The module doesn't support masks (used with SUPPORT_BLENDING)
+#define IOP_FLAGS_TILING_PARALLEL  2048                       // process() is mostly serial: cpu tiling may run independent tiles in parallel. process() must be reentrant and keep processed_maximum
+#define IOP_FLAGS_THUMBNAIL_INVISIBLE 4096                  // The effect doesn't show at thumbnail size, thumbnail pipes skip it (see dt_dev_pixelpipe_fast_thumbnail)
 /** status of a module*/
 typedef enum dt_iop_module_state_t
 {
@@ -94,6 +96,8 @@ typedef struct dt_iop_module_so_t
   dt_dev_operation_t op;
   /** other stuff that may be needed by the module, not only in gui mode. inited only once, has to be read-only then. */
   dt_iop_global_data_t *data;
+  /** opencl programs of the kernels created in init_global, to know when they are built. */
+  GList *cl_programs;
   /** gui is also only inited once at startup. */
   dt_iop_gui_data_t *gui_data;
   /** which results in this widget here, too. */
@@ -148,15 +152,20 @@ typedef struct dt_iop_module_so_t
   void (*cleanup_pipe)    (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_t *pipe, struct dt_dev_pixelpipe_iop_t *piece);
   void (*modify_roi_in)   (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const struct dt_iop_roi_t *roi_out, struct dt_iop_roi_t *roi_in);
   void (*modify_roi_out)  (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, struct dt_iop_roi_t *roi_out, const struct dt_iop_roi_t *roi_in);
+  int  (*invert_roi_in)   (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const struct dt_iop_roi_t *roi_in, struct dt_iop_roi_t *roi_out);
   int  (*legacy_params)   (struct dt_iop_module_t *self, const void *const old_params, const int old_version, void *new_params, const int new_version);
+  int  (*is_identity)     (struct dt_iop_module_t *self, struct dt_iop_params_t *params, struct dt_dev_pixelpipe_iop_t *piece);
 
   void (*process)         (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const struct dt_iop_roi_t *roi_in, const struct dt_iop_roi_t *roi_out);
   void (*process_tiling)  (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const struct dt_iop_roi_t *roi_in, const struct dt_iop_roi_t *roi_out, const int bpp);
   int  (*process_cl)      (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const struct dt_iop_roi_t *roi_in, const struct dt_iop_roi_t *roi_out);
   int  (*process_tiling_cl)      (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const struct dt_iop_roi_t *roi_in, const struct dt_iop_roi_t *roi_out, const int bpp);
+  int  (*process_cl_to_host)     (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const struct dt_iop_roi_t *roi_in, const struct dt_iop_roi_t *roi_out);
+  void (*process_pixels)  (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const float *in, float *out, const size_t npixels);
 
   int (*distort_transform) (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, float *points, int points_count);
   int (*distort_backtransform) (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, float *points, int points_count);
+  int (*warp_backtransform) (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const struct dt_iop_roi_t *roi_in, const struct dt_iop_roi_t *roi_out, float *points, const int points_count);
 }
 dt_iop_module_so_t;
 
@@ -300,12 +309,20 @@ typedef struct dt_iop_module_t
   void (*cleanup_pipe)    (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_t *pipe, struct dt_dev_pixelpipe_iop_t *piece);
   void (*modify_roi_in)   (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const struct dt_iop_roi_t *roi_out, struct dt_iop_roi_t *roi_in);
   void (*modify_roi_out)  (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, struct dt_iop_roi_t *roi_out, const struct dt_iop_roi_t *roi_in);
+  /** optional inverse of modify_roi_in(): estimates the roi_out which needs about roi_in, roi_out comes with its scale set.
+    * returns 0 if there is no estimate. tiling uses it instead of searching for tile regions. */
+  int  (*invert_roi_in)   (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const struct dt_iop_roi_t *roi_in, struct dt_iop_roi_t *roi_out);
   int  (*legacy_params)   (struct dt_iop_module_t *self, const void *const old_params, const int old_version, void *new_params, const int new_version);
+  /** optional: true if params leave the pixels and the regions of interest unchanged. dt_iop_commit_params()
+    * then takes the piece out of the pipe, unless blending or the preview pipe needs it. */
+  int  (*is_identity)     (struct dt_iop_module_t *self, struct dt_iop_params_t *params, struct dt_dev_pixelpipe_iop_t *piece);
 
   /** this is the temp homebrew callback to operations, as long as gegl is so slow.
     * x,y, and scale are just given for orientation in the framebuffer. i and o are
     * scaled to the same size width*height and contain a max of 3 floats. other color
-    * formats may be filled by this callback, if the pipeline can handle it. */
+    * formats may be filled by this callback, if the pipeline can handle it.
+    * a module may also export process_avx2() with the same signature, using code built with DT_TARGET_AVX2.
+    * it replaces process() when the module is loaded, if dt_codepath_avx2(). */
   void (*process)         (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const struct dt_iop_roi_t *roi_in, const struct dt_iop_roi_t *roi_out);
   /** a tiling variant of process(). */
   void (*process_tiling)  (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const struct dt_iop_roi_t *roi_in, const struct dt_iop_roi_t *roi_out, const int bpp);
@@ -313,6 +330,13 @@ typedef struct dt_iop_module_t
   int (*process_cl)      (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const struct dt_iop_roi_t *roi_in, const struct dt_iop_roi_t *roi_out);
   /** a tiling variant of process_cl(). */
   int (*process_tiling_cl)  (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const struct dt_iop_roi_t *roi_in, const struct dt_iop_roi_t *roi_out, const int bpp);
+  /** optional opencl variant of process() for outputs which do not fit a device image, like the 8-bit one of gamma:
+    * reads i on the device and writes o in host memory. used if the input is on the device already. */
+  int (*process_cl_to_host) (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const struct dt_iop_roi_t *roi_in, const struct dt_iop_roi_t *roi_out);
+  /** optional per pixel variant of process() for modules which map each pixel independently
+    * and keep the region of interest. works on npixels 4-channel float pixels, in may be the same as out.
+    * the pipeline fuses runs of such modules into one cache friendly pass. must not use openmp. */
+  void (*process_pixels)  (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const float *in, float *out, const size_t npixels);
 
   /** this functions are used for distort iop
    * points is an array of float {x1,y1,x2,y2,...}
@@ -321,6 +345,11 @@ typedef struct dt_iop_module_t
   int (*distort_transform) (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, float *points, int points_count);
   /** reverse points after the iop is applied => point before process */
   int (*distort_backtransform) (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, float *points, int points_count);
+  /** optional: as distort_backtransform(), but in the pixel coordinates of process(): moves points relative to
+    * roi_out to the positions relative to roi_in process() would sample them from. the pipeline composes runs of
+    * such modules into one resampling pass. called once with points == NULL before, not in parallel, to prepare
+    * for these rois. returns 0 if process() has to run this time, 2 if only whole pixels move, 1 else. */
+  int (*warp_backtransform) (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const struct dt_iop_roi_t *roi_in, const struct dt_iop_roi_t *roi_out, float *points, const int points_count);
 
   /** Key accelerator registration callbacks */
   void (*connect_key_accels)(struct dt_iop_module_t *self);
@@ -380,6 +409,17 @@ int dt_iop_breakpoint(struct dt_develop_t *dev, struct dt_dev_pixelpipe_t *pipe)
 /** allow plugins to relinquish CPU and go to sleep for some time */
 void dt_iop_nap(int32_t usec);
 
+/** temporary buffers for process(), 64 byte aligned, from an arena kept by the pipe across runs.
+ *  account for them in tiling_callback, and give them back with the same size. */
+void *dt_iop_scratch_alloc(struct dt_dev_pixelpipe_iop_t *piece, size_t size);
+void dt_iop_scratch_free(struct dt_dev_pixelpipe_iop_t *piece, void *ptr, size_t size);
+
+/** the mosaic between the white balance and demosaic, if the pipe runs it as uint16 (see
+ *  dt_dev_pixelpipe_t::raw16): fixed point with this as 1.0, leaving headroom up to 4.0. */
+#define DT_IOP_RAW16_ONE 16384.0f
+/** unpacks n raw16 values to float, 1.0 being DT_IOP_RAW16_ONE. */
+void dt_iop_raw16_unpack(float *out, const uint16_t *in, const size_t n);
+
 /** colorspace enums */
 typedef enum dt_iop_colorspace_type_t
 {
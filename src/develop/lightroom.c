@@ -24,6 +24,8 @@
 #include "common/ratings.h"
 #include "common/colorlabels.h"
 #include "common/debug.h"
+#include "common/image_cache.h"
+#include "common/mipmap_cache.h"
 #include "develop/lightroom.h"
 #include "control/control.h"
 
@@ -360,6 +362,100 @@ static float lr2dt_clarity(float value)
   return get_interpolate (lr2dt_clarity_table, value);
 }
 
+typedef enum lr_curve_kind_t
+{
+  linear = 0,
+  medium_contrast = 1,
+  string_contrast = 2,
+  custom = 3
+} lr_curve_kind_t;
+
+#define MAX_PTS 20
+
+// all that is read from a lightroom xmp, before anything is written to the database
+typedef struct dt_lightroom_t
+{
+  gboolean develop;             // read and import the develop settings
+  gboolean metadata;            // read and import tags, rating, location and color label
+  int image_orientation;        // orientation of the image in darktable
+
+  dt_iop_clipping_params_t pc;
+  gboolean has_crop;
+  dt_iop_flip_params_t pf;
+  gboolean has_flip;
+  dt_iop_exposure_params_t pe;
+  gboolean has_exposure;
+  dt_iop_vignette_params_t pv;
+  gboolean has_vignette;
+  dt_iop_grain_params_t pg;
+  gboolean has_grain;
+  dt_iop_spots_params_t ps;
+  gboolean has_spots;
+
+  dt_iop_tonecurve_params_t ptc;
+  int ptc_value[4];
+  float ptc_split[3];
+  lr_curve_kind_t curve_kind;
+  int curve_pts[MAX_PTS][2];
+  int n_pts;
+
+  dt_iop_colorzones_params_t pcz;
+  gboolean has_colorzones;
+  dt_iop_splittoning_params_t pst;
+  gboolean has_splittoning;
+  dt_iop_bilat_params_t pbl;
+  gboolean has_bilat;
+
+  GList *tags;                  // g_strdup'ed names
+  gboolean has_tags;
+  int rating;
+  gboolean has_rating;
+  gdouble lat, lon;
+  gboolean has_gps;
+  int color;
+  gboolean has_colorlabel;
+
+  float fratio;                 // factor ratio image
+  float crop_roundness;         // from lightroom
+  int iwidth, iheight;          // image width / height
+  int orientation;              // from lightroom
+}
+dt_lightroom_t;
+
+static void _lightroom_init(dt_lightroom_t *lr, const gboolean develop, const gboolean metadata,
+                            const int image_orientation)
+{
+  memset(lr, 0, sizeof(dt_lightroom_t));
+  lr->develop = develop;
+  lr->metadata = metadata;
+  lr->image_orientation = image_orientation;
+  lr->curve_kind = linear;
+  lr->orientation = 1;
+}
+
+static void _lightroom_cleanup(dt_lightroom_t *lr)
+{
+  g_list_free_full(lr->tags, g_free);
+  lr->tags = NULL;
+}
+
+// attached to images whose develop data was imported by dt_lightroom_import_batch()
+#define LRDT_IMPORTED_TAG "darktable|lightroom"
+
+static gboolean _lightroom_imported(const int imgid)
+{
+  guint tagid = 0;
+  if(!dt_tag_exists(LRDT_IMPORTED_TAG, &tagid)) return FALSE;
+  gboolean imported = FALSE;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select 1 from tagged_images where imgid = ?1 and tagid = ?2", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, tagid);
+  if(sqlite3_step(stmt) == SQLITE_ROW) imported = TRUE;
+  sqlite3_finalize(stmt);
+  return imported;
+}
+
 static void dt_add_hist (int imgid, char *operation, dt_iop_params_t *params, int params_size, char *imported, int version, int *import_count)
 {
   int32_t num = 0;
@@ -395,18 +491,17 @@ static void dt_add_hist (int imgid, char *operation, dt_iop_params_t *params, in
   (*import_count)++;
 }
 
-void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
+/* reads the xmp of imgid into lr, touches neither the database nor the gui (besides logging
+   failures when !iauto), so that it can run on many images in parallel. returns 0 on success. */
+static int _lightroom_read(const int imgid, dt_lightroom_t *lr, gboolean iauto)
 {
-  gboolean refresh_needed = FALSE;
-  char imported[256] = {0};
-
   // Get full pathname
   char *pathname = dt_get_lightroom_xmp(imgid);
 
   if (!pathname)
   {
     if (!iauto) dt_control_log(_("cannot find lightroom xmp!"));
-    return;
+    return 1;
   }
 
   // Load LR xmp
@@ -421,7 +516,7 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
   if (doc == NULL)
   {
     g_free(pathname);
-    return;
+    return 1;
   }
 
   // Enter first node, xmpmeta
@@ -432,7 +527,7 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
   {
     if (!iauto) dt_control_log(_("`%s' not a lightroom xmp!"), pathname);
     g_free(pathname);
-    return;
+    return 1;
   }
 
   // Check that this is really a Lightroom document
@@ -443,7 +538,7 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
   {
     g_free(pathname);
     xmlFreeDoc(doc);
-    return;
+    return 1;
   }
 
   xmlXPathRegisterNs(xpathCtx, BAD_CAST "stEvt", BAD_CAST "http://ns.adobe.com/xap/1.0/sType/ResourceEvent#");
@@ -456,7 +551,7 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
     xmlXPathFreeContext(xpathCtx);
     g_free(pathname);
     xmlFreeDoc(doc);
-    return;
+    return 1;
   }
 
   xmlNodeSetPtr xnodes = xpathObj->nodesetval;
@@ -474,7 +569,7 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
       xmlFree(value);
       if (!iauto) dt_control_log(_("`%s' not a lightroom xmp!"), pathname);
       g_free(pathname);
-      return;
+      return 1;
     }
     xmlFree(value);
   }
@@ -484,7 +579,7 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
     xmlXPathFreeContext(xpathCtx);
     if (!iauto) dt_control_log(_("`%s' not a lightroom xmp!"), pathname);
     g_free(pathname);
-    return;
+    return 1;
   }
 
   xmlXPathFreeObject(xpathObj);
@@ -505,83 +600,14 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
   {
     if (!iauto) dt_control_log(_("`%s' not a lightroom xmp!"), pathname);
     g_free(pathname);
-    return;
+    return 1;
   }
   g_free(pathname);
 
   //  Look for attributes in the Description
 
-  dt_iop_clipping_params_t pc;
-  memset(&pc, 0, sizeof(pc));
-  gboolean has_crop = FALSE;
-
-  dt_iop_flip_params_t pf;
-  memset(&pf, 0, sizeof(pf));
-  gboolean has_flip = FALSE;
-
-  dt_iop_exposure_params_t pe;
-  memset(&pe, 0, sizeof(pe));
-  gboolean has_exposure = FALSE;
-
-  dt_iop_vignette_params_t pv;
-  memset(&pv, 0, sizeof(pv));
-  gboolean has_vignette = FALSE;
-
-  dt_iop_grain_params_t pg;
-  memset(&pg, 0, sizeof(pg));
-  gboolean has_grain = FALSE;
-
-  dt_iop_spots_params_t ps;
-  memset(&ps, 0, sizeof(ps));
-  gboolean has_spots = FALSE;
-
-  typedef enum lr_curve_kind_t
-  {
-    linear = 0,
-    medium_contrast = 1,
-    string_contrast = 2,
-    custom = 3
-  } lr_curve_kind_t;
-
-#define MAX_PTS 20
-  dt_iop_tonecurve_params_t ptc;
-  memset(&ptc, 0, sizeof(ptc));
-  int ptc_value[4] = {0, 0, 0, 0};
-  float ptc_split[3] = {0.0, 0.0, 0.0};
-  lr_curve_kind_t curve_kind = linear;
-  int curve_pts[MAX_PTS][2];
-  int n_pts = 0;
-
-  dt_iop_colorzones_params_t pcz;
-  memset(&pcz, 0, sizeof(pcz));
-  gboolean has_colorzones = FALSE;
-
-  dt_iop_splittoning_params_t pst;
-  memset(&pst, 0, sizeof(pst));
-  gboolean has_splittoning = FALSE;
-
-  dt_iop_bilat_params_t pbl;
-  memset(&pbl, 0, sizeof(pbl));
-  gboolean has_bilat = FALSE;
-
-  gboolean has_tags = FALSE;
-
-  int rating = 0;
-  gboolean has_rating = FALSE;
-
-  gdouble lat = 0, lon = 0;
-  gboolean has_gps = FALSE;
-
-  int color = 0;
-  gboolean has_colorlabel = FALSE;
-
-  float fratio = 0;                // factor ratio image
-  float crop_roundness = 0;        // from lightroom
-  int n_import = 0;                // number of iop imported
   const float hfactor = 3.0 / 9.0; // hue factor adjustment (use 3 out of 9 boxes in colorzones)
   const float lfactor = 4.0 / 9.0; // lightness factor adjustment (use 4 out of 9 boxes in colorzones)
-  int iwidth = 0, iheight = 0;     // image width / height
-  int orientation = 1;
 
   xmlAttr* attribute = entryNode->properties;
 
@@ -589,39 +615,39 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
   {
     xmlChar* value = xmlNodeListGetString(entryNode->doc, attribute->children, 1);
     if (!xmlStrcmp(attribute->name, (const xmlChar *) "CropTop"))
-      pc.cy = g_ascii_strtod((char *)value, NULL);
+      lr->pc.cy = g_ascii_strtod((char *)value, NULL);
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "CropRight"))
-      pc.cw = g_ascii_strtod((char *)value, NULL);
+      lr->pc.cw = g_ascii_strtod((char *)value, NULL);
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "CropLeft"))
-      pc.cx = g_ascii_strtod((char *)value, NULL);
+      lr->pc.cx = g_ascii_strtod((char *)value, NULL);
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "CropBottom"))
-      pc.ch = g_ascii_strtod((char *)value, NULL);
+      lr->pc.ch = g_ascii_strtod((char *)value, NULL);
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "CropAngle"))
-      pc.angle = -g_ascii_strtod((char *)value, NULL);
+      lr->pc.angle = -g_ascii_strtod((char *)value, NULL);
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "ImageWidth"))
-      iwidth = atoi((char *)value);
+      lr->iwidth = atoi((char *)value);
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "ImageLength"))
-      iheight = atoi((char *)value);
+      lr->iheight = atoi((char *)value);
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "Orientation"))
     {
-      orientation = atoi((char *)value);
-      if (dev!=NULL &&
-          ((dev->image_storage.orientation == 6 && orientation != 6)
-           || (dev->image_storage.orientation == 5 && orientation != 8)
-           || (dev->image_storage.orientation == 0 && orientation != 1))) has_flip = TRUE;
+      lr->orientation = atoi((char *)value);
+      if (lr->develop &&
+          ((lr->image_orientation == 6 && lr->orientation != 6)
+           || (lr->image_orientation == 5 && lr->orientation != 8)
+           || (lr->image_orientation == 0 && lr->orientation != 1))) lr->has_flip = TRUE;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "HasCrop"))
     {
       if (!xmlStrcmp(value, (const xmlChar *)"True"))
-        has_crop = TRUE;
+        lr->has_crop = TRUE;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "Blacks2012"))
     {
       int v = atoi((char *)value);
       if (v != 0)
       {
-        has_exposure = TRUE;
-        pe.black = lr2dt_blacks((float)v);
+        lr->has_exposure = TRUE;
+        lr->pe.black = lr2dt_blacks((float)v);
       }
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "Exposure2012"))
@@ -629,8 +655,8 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
       float v = g_ascii_strtod((char *)value, NULL);
       if (v != 0.0)
       {
-        has_exposure = TRUE;
-        pe.exposure = lr2dt_exposure(v);
+        lr->has_exposure = TRUE;
+        lr->pe.exposure = lr2dt_exposure(v);
       }
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "PostCropVignetteAmount"))
@@ -638,296 +664,296 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
       int v = atoi((char *)value);
       if (v != 0)
       {
-        has_vignette = TRUE;
-        pv.brightness = lr2dt_vignette_gain((float)v);
+        lr->has_vignette = TRUE;
+        lr->pv.brightness = lr2dt_vignette_gain((float)v);
       }
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "PostCropVignetteMidpoint"))
     {
       int v = atoi((char *)value);
-      pv.scale = lr2dt_vignette_midpoint((float)v);
+      lr->pv.scale = lr2dt_vignette_midpoint((float)v);
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "PostCropVignetteStyle"))
     {
       int v = atoi((char *)value);
       if (v == 1) // Highlight Priority
-        pv.saturation = -0.300;
+        lr->pv.saturation = -0.300;
       else // Color Priority & Paint Overlay
-        pv.saturation = -0.200;
+        lr->pv.saturation = -0.200;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "PostCropVignetteFeather"))
     {
       int v = atoi((char *)value);
       if (v != 0)
-        pv.falloff_scale = (float)v;
+        lr->pv.falloff_scale = (float)v;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "PostCropVignetteRoundness"))
     {
       int v = atoi((char *)value);
-      crop_roundness = (float)v;
+      lr->crop_roundness = (float)v;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "GrainAmount"))
     {
       int v = atoi((char *)value);
       if (v != 0)
       {
-        has_grain = TRUE;
-        pg.strength = lr2dt_grain_amount((float)v);
+        lr->has_grain = TRUE;
+        lr->pg.strength = lr2dt_grain_amount((float)v);
       }
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "GrainFrequency"))
     {
       int v = atoi((char *)value);
       if (v != 0)
-        pg.scale = lr2dt_grain_frequency((float)v);
+        lr->pg.scale = lr2dt_grain_frequency((float)v);
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "ParametricShadows"))
     {
-      ptc_value[0] = atoi((char *)value);
+      lr->ptc_value[0] = atoi((char *)value);
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "ParametricDarks"))
     {
-      ptc_value[1] = atoi((char *)value);
+      lr->ptc_value[1] = atoi((char *)value);
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "ParametricLights"))
     {
-      ptc_value[2] = atoi((char *)value);
+      lr->ptc_value[2] = atoi((char *)value);
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "ParametricHighlights"))
     {
-      ptc_value[3] = atoi((char *)value);
+      lr->ptc_value[3] = atoi((char *)value);
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "ParametricShadowSplit"))
     {
-      ptc_split[0] = g_ascii_strtod((char *)value, NULL) / 100.0;
+      lr->ptc_split[0] = g_ascii_strtod((char *)value, NULL) / 100.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "ParametricMidtoneSplit"))
     {
-      ptc_split[1] = g_ascii_strtod((char *)value, NULL) / 100.0;
+      lr->ptc_split[1] = g_ascii_strtod((char *)value, NULL) / 100.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "ParametricHighlightSplit"))
     {
-      ptc_split[2] = g_ascii_strtod((char *)value, NULL) / 100.0;
+      lr->ptc_split[2] = g_ascii_strtod((char *)value, NULL) / 100.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "ToneCurveName2012"))
     {
       if (!xmlStrcmp(value, (const xmlChar *)"Linear"))
-        curve_kind = linear;
+        lr->curve_kind = linear;
       else if (!xmlStrcmp(value, (const xmlChar *)"Medium Contrast"))
-        curve_kind = medium_contrast;
+        lr->curve_kind = medium_contrast;
       else if (!xmlStrcmp(value, (const xmlChar *)"Strong Contrast"))
-        curve_kind = medium_contrast;
+        lr->curve_kind = medium_contrast;
       else if (!xmlStrcmp(value, (const xmlChar *)"Custom"))
-        curve_kind = custom;
+        lr->curve_kind = custom;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "SaturationAdjustmentRed"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[1][0] = 0.5 + (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[1][0] = 0.5 + (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "SaturationAdjustmentOrange"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[1][1] = 0.5 + (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[1][1] = 0.5 + (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "SaturationAdjustmentYellow"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[1][2] = 0.5 + (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[1][2] = 0.5 + (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "SaturationAdjustmentGreen"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[1][3] = 0.5 + (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[1][3] = 0.5 + (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "SaturationAdjustmentAqua"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[1][4] = 0.5 + (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[1][4] = 0.5 + (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "SaturationAdjustmentBlue"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[1][5] = 0.5 + (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[1][5] = 0.5 + (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "SaturationAdjustmentPurple"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[1][6] = 0.5 + (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[1][6] = 0.5 + (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "SaturationAdjustmentMagenta"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[1][7] = 0.5 + (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[1][7] = 0.5 + (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "LuminanceAdjustmentRed"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[0][0] = 0.5 + lfactor * (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[0][0] = 0.5 + lfactor * (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "LuminanceAdjustmentOrange"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[0][1] = 0.5 + lfactor * (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[0][1] = 0.5 + lfactor * (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "LuminanceAdjustmentYellow"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[0][2] = 0.5 + lfactor * (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[0][2] = 0.5 + lfactor * (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "LuminanceAdjustmentGreen"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[0][3] = 0.5 + lfactor * (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[0][3] = 0.5 + lfactor * (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "LuminanceAdjustmentAqua"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[0][4] = 0.5 + lfactor * (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[0][4] = 0.5 + lfactor * (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "LuminanceAdjustmentBlue"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[0][5] = 0.5 + lfactor * (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[0][5] = 0.5 + lfactor * (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "LuminanceAdjustmentPurple"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[0][6] = 0.5 + lfactor * (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[0][6] = 0.5 + lfactor * (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "LuminanceAdjustmentMagenta"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[0][7] = 0.5 + lfactor * (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[0][7] = 0.5 + lfactor * (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "HueAdjustmentRed"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[2][0] = 0.5 + hfactor * (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[2][0] = 0.5 + hfactor * (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "HueAdjustmentOrange"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[2][1] = 0.5 + hfactor * (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[2][1] = 0.5 + hfactor * (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "HueAdjustmentYellow"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[2][2] = 0.5 + hfactor * (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[2][2] = 0.5 + hfactor * (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "HueAdjustmentGreen"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[2][3] = 0.5 + hfactor * (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[2][3] = 0.5 + hfactor * (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "HueAdjustmentAqua"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[2][4] = 0.5 + hfactor * (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[2][4] = 0.5 + hfactor * (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "HueAdjustmentBlue"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[2][5] = 0.5 + hfactor * (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[2][5] = 0.5 + hfactor * (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "HueAdjustmentPurple"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[2][6] = 0.5 + hfactor * (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[2][6] = 0.5 + hfactor * (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "HueAdjustmentMagenta"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_colorzones = TRUE;
-      pcz.equalizer_y[2][7] = 0.5 + hfactor * (float)v / 200.0;
+        lr->has_colorzones = TRUE;
+      lr->pcz.equalizer_y[2][7] = 0.5 + hfactor * (float)v / 200.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "SplitToningShawowHue"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_splittoning = TRUE;
-      pst.shadow_hue = (float)v / 255.0;
+        lr->has_splittoning = TRUE;
+      lr->pst.shadow_hue = (float)v / 255.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "SplitToningShawowSaturation"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_splittoning = TRUE;
-      pst.shadow_saturation = (float)v / 100.0;
+        lr->has_splittoning = TRUE;
+      lr->pst.shadow_saturation = (float)v / 100.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "SplitToningHighlightHue"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_splittoning = TRUE;
-      pst.highlight_hue = (float)v / 255.0;
+        lr->has_splittoning = TRUE;
+      lr->pst.highlight_hue = (float)v / 255.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "SplitToningHighlightSaturation"))
     {
       int v = atoi((char *)value);
       if (v!=0)
-        has_splittoning = TRUE;
-      pst.highlight_saturation = (float)v / 100.0;
+        lr->has_splittoning = TRUE;
+      lr->pst.highlight_saturation = (float)v / 100.0;
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "SplitToningBalance"))
     {
       float v = g_ascii_strtod((char *)value, NULL);
-      pst.balance = lr2dt_splittoning_balance(v);
+      lr->pst.balance = lr2dt_splittoning_balance(v);
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "Clarity2012"))
     {
       int v = atoi((char *)value);
       if (v!=0)
       {
-        has_bilat = TRUE;
-        pbl.detail = lr2dt_clarity((float)v);
+        lr->has_bilat = TRUE;
+        lr->pbl.detail = lr2dt_clarity((float)v);
       }
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "Rating"))
@@ -935,8 +961,8 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
       int v = atoi((char *)value);
       if (v!=0)
       {
-        rating = v;
-        has_rating = TRUE;
+        lr->rating = v;
+        lr->has_rating = TRUE;
       }
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "GPSLatitude"))
@@ -947,9 +973,9 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
 
       if (sscanf((const char *)value, "%d,%lf%c", &deg, &msec, &d))
       {
-        lat = deg + msec / 60.0;
-        if (d == 'S') lat = -lat;
-        has_gps = TRUE;
+        lr->lat = deg + msec / 60.0;
+        if (d == 'S') lr->lat = -lr->lat;
+        lr->has_gps = TRUE;
       }
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "GPSLongitude"))
@@ -960,9 +986,9 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
 
       if (sscanf((const char *)value, "%d,%lf%c", &deg, &msec, &d))
       {
-        lon = deg + msec / 60.0;
-        if (d == 'W') lon = -lon;
-        has_gps = TRUE;
+        lr->lon = deg + msec / 60.0;
+        if (d == 'W') lr->lon = -lr->lon;
+        lr->has_gps = TRUE;
       }
     }
     else if (!xmlStrcmp(attribute->name, (const xmlChar *) "Label"))
@@ -971,20 +997,20 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
         value[i] = tolower(value[i]);
 
       if (!strcmp((char *)value, _("red")))
-        color = 0;
+        lr->color = 0;
       else if (!strcmp((char *)value, _("yellow")))
-        color = 1;
+        lr->color = 1;
       else if (!strcmp((char *)value, _("green")))
-        color = 2;
+        lr->color = 2;
       else if (!strcmp((char *)value, _("blue")))
-        color = 3;
+        lr->color = 3;
       else
         // just an else here to catch all other cases as on lightroom one can
         // change the names of labels. So purple and the user's defined labels
         // will be mapped to purple on darktable.
-        color = 4;
+        lr->color = 4;
 
-      has_colorlabel = TRUE;
+      lr->has_colorlabel = TRUE;
     }
 
     xmlFree(value);
@@ -998,7 +1024,7 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
 
   while (entryNode)
   {
-    if (dev == NULL
+    if (lr->metadata
         && (!xmlStrcmp(entryNode->name, (const xmlChar *) "subject")
             ||!xmlStrcmp(entryNode->name, (const xmlChar *) "hierarchicalSubject")))
     {
@@ -1014,19 +1040,14 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
         if (!xmlStrcmp(tagNode->name, (const xmlChar *) "li"))
         {
           xmlChar *value= xmlNodeListGetString(doc, tagNode->xmlChildrenNode, 1);
-          guint tagid = 0;
-
-          if (!dt_tag_exists((char *)value, &tagid))
-            dt_tag_new((char *)value, &tagid);
-
-          dt_tag_attach(tagid, imgid);
-          has_tags = TRUE;
+          lr->tags = g_list_prepend(lr->tags, g_strdup((char *)value));
+          lr->has_tags = TRUE;
           xmlFree(value);
         }
         tagNode = tagNode->next;
       }
     }
-    else if (dev != NULL && !xmlStrcmp(entryNode->name, (const xmlChar *) "RetouchInfo"))
+    else if (lr->develop && !xmlStrcmp(entryNode->name, (const xmlChar *) "RetouchInfo"))
     {
       xmlNodePtr riNode = entryNode;
 
@@ -1040,19 +1061,19 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
         if (!xmlStrcmp(riNode->name, (const xmlChar *) "li"))
         {
           xmlChar *value= xmlNodeListGetString(doc, riNode->xmlChildrenNode, 1);
-          spot_t *p = &ps.spot[ps.num_spots];
+          spot_t *p = &lr->ps.spot[lr->ps.num_spots];
           if (sscanf((const char *)value, "centerX = %f, centerY = %f, radius = %f, sourceState = %*[a-zA-Z], sourceX = %f, sourceY = %f", &(p->x), &(p->y), &(p->radius), &(p->xc), &(p->yc)))
           {
-            ps.num_spots++;
-            has_spots = TRUE;
+            lr->ps.num_spots++;
+            lr->has_spots = TRUE;
           }
           xmlFree(value);
         }
-        if (ps.num_spots == MAX_SPOTS) break;
+        if (lr->ps.num_spots == MAX_SPOTS) break;
         riNode = riNode->next;
       }
     }
-    else if (dev != NULL && !xmlStrcmp(entryNode->name, (const xmlChar *) "ToneCurvePV2012"))
+    else if (lr->develop && !xmlStrcmp(entryNode->name, (const xmlChar *) "ToneCurvePV2012"))
     {
       xmlNodePtr tcNode = entryNode;
 
@@ -1067,11 +1088,11 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
         {
           xmlChar *value= xmlNodeListGetString(doc, tcNode->xmlChildrenNode, 1);
 
-          if (sscanf((const char *)value, "%d, %d", &(curve_pts[n_pts][0]), &(curve_pts[n_pts][1])))
-            n_pts++;
+          if (sscanf((const char *)value, "%d, %d", &(lr->curve_pts[lr->n_pts][0]), &(lr->curve_pts[lr->n_pts][1])))
+            lr->n_pts++;
           xmlFree(value);
         }
-        if (n_pts == MAX_PTS) break;
+        if (lr->n_pts == MAX_PTS) break;
         tcNode = tcNode->next;
       }
     }
@@ -1079,10 +1100,19 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
   }
 
   xmlFreeDoc(doc);
+  lr->tags = g_list_reverse(lr->tags);
+  return 0;
+}
+
+/* writes what was read into history, tags and image flags of imgid. returns the number of
+   items imported, their names are appended to imported. */
+static int _lightroom_apply(const int imgid, dt_lightroom_t *lr, char *imported)
+{
+  int n_import = 0;                // number of iop imported
 
   //  Integrates into the history all the imported iop
 
-  if (dev != NULL)
+  if (lr->develop)
   {
     // set colorin to cmatrix which is the default from Adobe (so closer to what Lightroom does)
     dt_iop_colorin_params_t pci = (dt_iop_colorin_params_t)
@@ -1091,356 +1121,374 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
     };
 
     dt_add_hist (imgid, "colorin", (dt_iop_params_t *)&pci, sizeof(dt_iop_colorin_params_t), imported, LRDT_COLORIN_VERSION, &n_import);
-    refresh_needed=TRUE;
   }
 
-  if (dev != NULL && has_crop)
+  if (lr->develop && lr->has_crop)
   {
-    pc.k_sym = 0;
-    pc.k_apply = 0;
-    pc.crop_auto = 0;
-    pc.k_h = pc.k_v = 0;
-    pc.k_type = 0;
-    pc.kxa = pc.kxd = 0.2f;
-    pc.kxc = pc.kxb = 0.8f;
-    pc.kya = pc.kyb = 0.2f;
-    pc.kyc = pc.kyd = 0.8f;
-
-    if (has_crop)
-    {
-      if (pc.angle != 0)
+    lr->pc.k_sym = 0;
+    lr->pc.k_apply = 0;
+    lr->pc.crop_auto = 0;
+    lr->pc.k_h = lr->pc.k_v = 0;
+    lr->pc.k_type = 0;
+    lr->pc.kxa = lr->pc.kxd = 0.2f;
+    lr->pc.kxc = lr->pc.kxb = 0.8f;
+    lr->pc.kya = lr->pc.kyb = 0.2f;
+    lr->pc.kyc = lr->pc.kyd = 0.8f;
+
+    if (lr->has_crop)
+    {
+      if (lr->pc.angle != 0)
       {
-        const float rangle = -pc.angle * (3.141592 / 180);
+        const float rangle = -lr->pc.angle * (3.141592 / 180);
         float x, y;
 
         // do the rotation (rangle) using center of image (0.5, 0.5)
 
-        x = pc.cx - 0.5;
-        y = 0.5 - pc.cy;
-        pc.cx = 0.5 + x * cos(rangle) - y * sin(rangle);
-        pc.cy = 0.5 - (x * sin(rangle) + y * cos(rangle));
+        x = lr->pc.cx - 0.5;
+        y = 0.5 - lr->pc.cy;
+        lr->pc.cx = 0.5 + x * cos(rangle) - y * sin(rangle);
+        lr->pc.cy = 0.5 - (x * sin(rangle) + y * cos(rangle));
 
-        x = pc.cw - 0.5;
-        y = 0.5 - pc.ch;
-        pc.cw = 0.5 + x * cos(rangle) - y * sin(rangle);
-        pc.ch = 0.5 - (x * sin(rangle) + y * cos(rangle));
+        x = lr->pc.cw - 0.5;
+        y = 0.5 - lr->pc.ch;
+        lr->pc.cw = 0.5 + x * cos(rangle) - y * sin(rangle);
+        lr->pc.ch = 0.5 - (x * sin(rangle) + y * cos(rangle));
       }
     }
     else
     {
-      pc.angle = 0;
-      pc.cx = 0;
-      pc.cy = 0;
-      pc.cw = 1;
-      pc.ch = 1;
+      lr->pc.angle = 0;
+      lr->pc.cx = 0;
+      lr->pc.cy = 0;
+      lr->pc.cw = 1;
+      lr->pc.ch = 1;
     }
 
-    fratio = (pc.cw - pc.cx) / (pc.ch - pc.cy);
+    lr->fratio = (lr->pc.cw - lr->pc.cx) / (lr->pc.ch - lr->pc.cy);
 
-    dt_add_hist (imgid, "clipping", (dt_iop_params_t *)&pc, sizeof(dt_iop_clipping_params_t), imported, LRDT_CLIPPING_VERSION, &n_import);
-    refresh_needed=TRUE;
+    dt_add_hist (imgid, "clipping", (dt_iop_params_t *)&lr->pc, sizeof(dt_iop_clipping_params_t), imported, LRDT_CLIPPING_VERSION, &n_import);
   }
 
-  if (dev != NULL && has_flip)
+  if (lr->develop && lr->has_flip)
   {
-    pf.orientation = 0;
+    lr->pf.orientation = 0;
 
-    if (dev->image_storage.orientation == 5)
+    if (lr->image_orientation == 5)
       // portrait
-      switch (orientation)
+      switch (lr->orientation)
       {
         case 8:
-          pf.orientation = 0;
+          lr->pf.orientation = 0;
           break;
         case 3:
-          pf.orientation = 5;
+          lr->pf.orientation = 5;
           break;
         case 6:
-          pf.orientation = 3;
+          lr->pf.orientation = 3;
           break;
         case 1:
-          pf.orientation = 6;
+          lr->pf.orientation = 6;
           break;
 
           // with horizontal flip
         case 7:
-          pf.orientation = 1;
+          lr->pf.orientation = 1;
           break;
         case 2:
-          pf.orientation = 4;
+          lr->pf.orientation = 4;
           break;
         case 5:
-          pf.orientation = 2;
+          lr->pf.orientation = 2;
           break;
         case 4:
-          pf.orientation = 7;
+          lr->pf.orientation = 7;
           break;
       }
 
-    else if (dev->image_storage.orientation == 6)
+    else if (lr->image_orientation == 6)
       // portrait
-      switch (orientation)
+      switch (lr->orientation)
       {
         case 8:
-          pf.orientation = 3;
+          lr->pf.orientation = 3;
           break;
         case 3:
-          pf.orientation = 6;
+          lr->pf.orientation = 6;
           break;
         case 6:
-          pf.orientation = 0;
+          lr->pf.orientation = 0;
           break;
         case 1:
-          pf.orientation = 5;
+          lr->pf.orientation = 5;
           break;
 
           // with horizontal flip
         case 7:
-          pf.orientation = 2;
+          lr->pf.orientation = 2;
           break;
         case 2:
-          pf.orientation = 7;
+          lr->pf.orientation = 7;
           break;
         case 5:
-          pf.orientation = 1;
+          lr->pf.orientation = 1;
           break;
         case 4:
-          pf.orientation = 4;
+          lr->pf.orientation = 4;
           break;
       }
 
     else
       // landscape
-      switch (orientation)
+      switch (lr->orientation)
       {
         case 8:
-          pf.orientation = 5;
+          lr->pf.orientation = 5;
           break;
         case 3:
-          pf.orientation = 3;
+          lr->pf.orientation = 3;
           break;
         case 6:
-          pf.orientation = 6;
+          lr->pf.orientation = 6;
           break;
         case 1:
-          pf.orientation = 0;
+          lr->pf.orientation = 0;
           break;
 
           // with horizontal flip
         case 7:
-          pf.orientation = 7;
+          lr->pf.orientation = 7;
           break;
         case 2:
-          pf.orientation = 1;
+          lr->pf.orientation = 1;
           break;
         case 5:
-          pf.orientation = 4;
+          lr->pf.orientation = 4;
           break;
         case 4:
-          pf.orientation = 2;
+          lr->pf.orientation = 2;
           break;
       }
 
-    dt_add_hist (imgid, "flip", (dt_iop_params_t *)&pf, sizeof(dt_iop_flip_params_t), imported, LRDT_FLIP_VERSION, &n_import);
-    refresh_needed=TRUE;
+    dt_add_hist (imgid, "flip", (dt_iop_params_t *)&lr->pf, sizeof(dt_iop_flip_params_t), imported, LRDT_FLIP_VERSION, &n_import);
   }
 
-  if (dev != NULL && has_exposure)
+  if (lr->develop && lr->has_exposure)
   {
-    dt_add_hist (imgid, "exposure", (dt_iop_params_t *)&pe, sizeof(dt_iop_exposure_params_t), imported, LRDT_EXPOSURE_VERSION, &n_import);
-    refresh_needed=TRUE;
+    dt_add_hist (imgid, "exposure", (dt_iop_params_t *)&lr->pe, sizeof(dt_iop_exposure_params_t), imported, LRDT_EXPOSURE_VERSION, &n_import);
   }
 
-  if (dev != NULL && has_grain)
+  if (lr->develop && lr->has_grain)
   {
-    pg.channel = 0;
+    lr->pg.channel = 0;
 
-    dt_add_hist (imgid, "grain", (dt_iop_params_t *)&pg, sizeof(dt_iop_grain_params_t), imported, LRDT_GRAIN_VERSION, &n_import);
-    refresh_needed=TRUE;
+    dt_add_hist (imgid, "grain", (dt_iop_params_t *)&lr->pg, sizeof(dt_iop_grain_params_t), imported, LRDT_GRAIN_VERSION, &n_import);
   }
 
-  if (dev != NULL && has_vignette)
+  if (lr->develop && lr->has_vignette)
   {
     const float base_ratio = 1.325 / 1.5;
 
-    pv.autoratio = FALSE;
-    pv.dithering = DITHER_8BIT;
-    pv.center.x = 0.0;
-    pv.center.y = 0.0;
-    pv.shape = 1.0;
+    lr->pv.autoratio = FALSE;
+    lr->pv.dithering = DITHER_8BIT;
+    lr->pv.center.x = 0.0;
+    lr->pv.center.y = 0.0;
+    lr->pv.shape = 1.0;
 
     // defensive code, should not happen, but just in case future Lr version
     // has not ImageWidth/ImageLength XML tag.
-    if (iwidth == 0 || iheight == 0)
-      pv.whratio = base_ratio;
+    if (lr->iwidth == 0 || lr->iheight == 0)
+      lr->pv.whratio = base_ratio;
     else
-      pv.whratio = base_ratio * ((float)iwidth / (float)iheight);
+      lr->pv.whratio = base_ratio * ((float)lr->iwidth / (float)lr->iheight);
 
-    if (has_crop)
-      pv.whratio = pv.whratio * fratio;
+    if (lr->has_crop)
+      lr->pv.whratio = lr->pv.whratio * lr->fratio;
 
     //  Adjust scale and ratio based on the roundness. On Lightroom changing
     //  the roundness change the width and the height of the vignette.
 
-    if (crop_roundness > 0)
+    if (lr->crop_roundness > 0)
     {
-      float newratio = pv.whratio - (pv.whratio - 1) * (crop_roundness / 100.0);
-      float dscale = (1 - (newratio / pv.whratio)) / 2.0;
+      float newratio = lr->pv.whratio - (lr->pv.whratio - 1) * (lr->crop_roundness / 100.0);
+      float dscale = (1 - (newratio / lr->pv.whratio)) / 2.0;
 
-      pv.scale -= dscale * 100.0;
-      pv.whratio = newratio;
+      lr->pv.scale -= dscale * 100.0;
+      lr->pv.whratio = newratio;
     }
 
-    dt_add_hist (imgid, "vignette", (dt_iop_params_t *)&pv, sizeof(dt_iop_vignette_params_t), imported, LRDT_VIGNETTE_VERSION, &n_import);
-    refresh_needed=TRUE;
+    dt_add_hist (imgid, "vignette", (dt_iop_params_t *)&lr->pv, sizeof(dt_iop_vignette_params_t), imported, LRDT_VIGNETTE_VERSION, &n_import);
   }
 
-  if (dev != NULL && has_spots)
+  if (lr->develop && lr->has_spots)
   {
-    // Check for orientation, rotate when in portrait mode
-    if (orientation > 4)
-      for (int k=0; k<ps.num_spots; k++)
+    // Check for lr->orientation, rotate when in portrait mode
+    if (lr->orientation > 4)
+      for (int k=0; k<lr->ps.num_spots; k++)
       {
-        float tmp = ps.spot[k].y;
-        ps.spot[k].y  = 1.0 - ps.spot[k].x;
-        ps.spot[k].x = tmp;
-        tmp = ps.spot[k].yc;
-        ps.spot[k].yc  = 1.0 - ps.spot[k].xc;
-        ps.spot[k].xc = tmp;
+        float tmp = lr->ps.spot[k].y;
+        lr->ps.spot[k].y  = 1.0 - lr->ps.spot[k].x;
+        lr->ps.spot[k].x = tmp;
+        tmp = lr->ps.spot[k].yc;
+        lr->ps.spot[k].yc  = 1.0 - lr->ps.spot[k].xc;
+        lr->ps.spot[k].xc = tmp;
       }
 
-    dt_add_hist (imgid, "spots", (dt_iop_params_t *)&ps, sizeof(dt_iop_spots_params_t), imported, LRDT_SPOTS_VERSION, &n_import);
-    refresh_needed=TRUE;
+    dt_add_hist (imgid, "spots", (dt_iop_params_t *)&lr->ps, sizeof(dt_iop_spots_params_t), imported, LRDT_SPOTS_VERSION, &n_import);
   }
 
-  if (curve_kind != linear || ptc_value[0] != 0 || ptc_value[1] != 0 || ptc_value[2] != 0 || ptc_value[3] != 0)
+  if (lr->curve_kind != linear || lr->ptc_value[0] != 0 || lr->ptc_value[1] != 0 || lr->ptc_value[2] != 0 || lr->ptc_value[3] != 0)
   {
-    ptc.tonecurve_nodes[ch_L] = 6;
-    ptc.tonecurve_nodes[ch_a] = 7;
-    ptc.tonecurve_nodes[ch_b] = 7;
-    ptc.tonecurve_type[ch_L] = CUBIC_SPLINE;
-    ptc.tonecurve_type[ch_a] = CUBIC_SPLINE;
-    ptc.tonecurve_type[ch_b] = CUBIC_SPLINE;
-    ptc.tonecurve_autoscale_ab = 1;
-    ptc.tonecurve_preset = 0;
+    lr->ptc.tonecurve_nodes[ch_L] = 6;
+    lr->ptc.tonecurve_nodes[ch_a] = 7;
+    lr->ptc.tonecurve_nodes[ch_b] = 7;
+    lr->ptc.tonecurve_type[ch_L] = CUBIC_SPLINE;
+    lr->ptc.tonecurve_type[ch_a] = CUBIC_SPLINE;
+    lr->ptc.tonecurve_type[ch_b] = CUBIC_SPLINE;
+    lr->ptc.tonecurve_autoscale_ab = 1;
+    lr->ptc.tonecurve_preset = 0;
 
     float linear_ab[7] = {0.0, 0.08, 0.3, 0.5, 0.7, 0.92, 1.0};
 
     // linear a, b curves
-    for(int k=0; k<7; k++) ptc.tonecurve[ch_a][k].x = linear_ab[k];
-    for(int k=0; k<7; k++) ptc.tonecurve[ch_a][k].y = linear_ab[k];
-    for(int k=0; k<7; k++) ptc.tonecurve[ch_b][k].x = linear_ab[k];
-    for(int k=0; k<7; k++) ptc.tonecurve[ch_b][k].y = linear_ab[k];
+    for(int k=0; k<7; k++) lr->ptc.tonecurve[ch_a][k].x = linear_ab[k];
+    for(int k=0; k<7; k++) lr->ptc.tonecurve[ch_a][k].y = linear_ab[k];
+    for(int k=0; k<7; k++) lr->ptc.tonecurve[ch_b][k].x = linear_ab[k];
+    for(int k=0; k<7; k++) lr->ptc.tonecurve[ch_b][k].y = linear_ab[k];
 
     // Set the base tonecurve
 
-    if (curve_kind == linear)
-    {
-      ptc.tonecurve[ch_L][0].x = 0.0;
-      ptc.tonecurve[ch_L][0].y = 0.0;
-      ptc.tonecurve[ch_L][1].x = ptc_split[0] / 2.0;
-      ptc.tonecurve[ch_L][1].y = ptc_split[0] / 2.0;
-      ptc.tonecurve[ch_L][2].x = ptc_split[1] - (ptc_split[1] - ptc_split[0]) / 2.0;
-      ptc.tonecurve[ch_L][2].y = ptc_split[1] - (ptc_split[1] - ptc_split[0]) / 2.0;
-      ptc.tonecurve[ch_L][3].x = ptc_split[1] + (ptc_split[2] - ptc_split[1]) / 2.0;
-      ptc.tonecurve[ch_L][3].y = ptc_split[1] + (ptc_split[2] - ptc_split[1]) / 2.0;
-      ptc.tonecurve[ch_L][4].x = ptc_split[2] + (1.0 - ptc_split[2]) / 2.0;
-      ptc.tonecurve[ch_L][4].y = ptc_split[2] + (1.0 - ptc_split[2]) / 2.0;
-      ptc.tonecurve[ch_L][5].x = 1.0;
-      ptc.tonecurve[ch_L][5].y = 1.0;
+    if (lr->curve_kind == linear)
+    {
+      lr->ptc.tonecurve[ch_L][0].x = 0.0;
+      lr->ptc.tonecurve[ch_L][0].y = 0.0;
+      lr->ptc.tonecurve[ch_L][1].x = lr->ptc_split[0] / 2.0;
+      lr->ptc.tonecurve[ch_L][1].y = lr->ptc_split[0] / 2.0;
+      lr->ptc.tonecurve[ch_L][2].x = lr->ptc_split[1] - (lr->ptc_split[1] - lr->ptc_split[0]) / 2.0;
+      lr->ptc.tonecurve[ch_L][2].y = lr->ptc_split[1] - (lr->ptc_split[1] - lr->ptc_split[0]) / 2.0;
+      lr->ptc.tonecurve[ch_L][3].x = lr->ptc_split[1] + (lr->ptc_split[2] - lr->ptc_split[1]) / 2.0;
+      lr->ptc.tonecurve[ch_L][3].y = lr->ptc_split[1] + (lr->ptc_split[2] - lr->ptc_split[1]) / 2.0;
+      lr->ptc.tonecurve[ch_L][4].x = lr->ptc_split[2] + (1.0 - lr->ptc_split[2]) / 2.0;
+      lr->ptc.tonecurve[ch_L][4].y = lr->ptc_split[2] + (1.0 - lr->ptc_split[2]) / 2.0;
+      lr->ptc.tonecurve[ch_L][5].x = 1.0;
+      lr->ptc.tonecurve[ch_L][5].y = 1.0;
     }
     else
     {
       for (int k=0; k<6; k++)
       {
-        ptc.tonecurve[ch_L][k].x = curve_pts[k][0] / 255.0;
-        ptc.tonecurve[ch_L][k].y = curve_pts[k][1] / 255.0;
+        lr->ptc.tonecurve[ch_L][k].x = lr->curve_pts[k][0] / 255.0;
+        lr->ptc.tonecurve[ch_L][k].y = lr->curve_pts[k][1] / 255.0;
       }
     }
 
-    if (curve_kind != custom)
+    if (lr->curve_kind != custom)
     {
       // set shadows/darks/lights/highlight adjustments
 
-      ptc.tonecurve[ch_L][1].y += ptc.tonecurve[ch_L][1].y * ((float)ptc_value[0] / 100.0);
-      ptc.tonecurve[ch_L][2].y += ptc.tonecurve[ch_L][1].y * ((float)ptc_value[1] / 100.0);
-      ptc.tonecurve[ch_L][3].y += ptc.tonecurve[ch_L][1].y * ((float)ptc_value[2] / 100.0);
-      ptc.tonecurve[ch_L][4].y += ptc.tonecurve[ch_L][1].y * ((float)ptc_value[3] / 100.0);
+      lr->ptc.tonecurve[ch_L][1].y += lr->ptc.tonecurve[ch_L][1].y * ((float)lr->ptc_value[0] / 100.0);
+      lr->ptc.tonecurve[ch_L][2].y += lr->ptc.tonecurve[ch_L][1].y * ((float)lr->ptc_value[1] / 100.0);
+      lr->ptc.tonecurve[ch_L][3].y += lr->ptc.tonecurve[ch_L][1].y * ((float)lr->ptc_value[2] / 100.0);
+      lr->ptc.tonecurve[ch_L][4].y += lr->ptc.tonecurve[ch_L][1].y * ((float)lr->ptc_value[3] / 100.0);
 
-      if (ptc.tonecurve[ch_L][1].y > ptc.tonecurve[ch_L][2].y)
-        ptc.tonecurve[ch_L][1].y = ptc.tonecurve[ch_L][2].y;
-      if (ptc.tonecurve[ch_L][3].y > ptc.tonecurve[ch_L][4].y)
-        ptc.tonecurve[ch_L][4].y = ptc.tonecurve[ch_L][3].y;
+      if (lr->ptc.tonecurve[ch_L][1].y > lr->ptc.tonecurve[ch_L][2].y)
+        lr->ptc.tonecurve[ch_L][1].y = lr->ptc.tonecurve[ch_L][2].y;
+      if (lr->ptc.tonecurve[ch_L][3].y > lr->ptc.tonecurve[ch_L][4].y)
+        lr->ptc.tonecurve[ch_L][4].y = lr->ptc.tonecurve[ch_L][3].y;
     }
 
-    dt_add_hist (imgid, "tonecurve",  (dt_iop_params_t *)&ptc, sizeof(dt_iop_tonecurve_params_t), imported, LRDT_TONECURVE_VERSION, &n_import);
-    refresh_needed=TRUE;
+    dt_add_hist (imgid, "tonecurve",  (dt_iop_params_t *)&lr->ptc, sizeof(dt_iop_tonecurve_params_t), imported, LRDT_TONECURVE_VERSION, &n_import);
   }
 
-  if (dev != NULL && has_colorzones)
+  if (lr->develop && lr->has_colorzones)
   {
-    pcz.channel = DT_IOP_COLORZONES_h;
+    lr->pcz.channel = DT_IOP_COLORZONES_h;
 
     for (int i=0; i<3; i++)
       for (int k=0; k<8; k++)
-        pcz.equalizer_x[i][k] = k/(DT_IOP_COLORZONES_BANDS-1.0);
+        lr->pcz.equalizer_x[i][k] = k/(DT_IOP_COLORZONES_BANDS-1.0);
 
-    dt_add_hist (imgid, "colorzones", (dt_iop_params_t *)&pcz, sizeof(dt_iop_colorzones_params_t), imported, LRDT_COLORZONES_VERSION, &n_import);
-    refresh_needed=TRUE;
+    dt_add_hist (imgid, "colorzones", (dt_iop_params_t *)&lr->pcz, sizeof(dt_iop_colorzones_params_t), imported, LRDT_COLORZONES_VERSION, &n_import);
   }
 
-  if (dev != NULL && has_splittoning)
+  if (lr->develop && lr->has_splittoning)
   {
-    pst.compress = 50.0;
+    lr->pst.compress = 50.0;
 
-    dt_add_hist (imgid, "splittoning", (dt_iop_params_t *)&pst, sizeof(dt_iop_splittoning_params_t), imported, LRDT_SPLITTONING_VERSION, &n_import);
-    refresh_needed=TRUE;
+    dt_add_hist (imgid, "splittoning", (dt_iop_params_t *)&lr->pst, sizeof(dt_iop_splittoning_params_t), imported, LRDT_SPLITTONING_VERSION, &n_import);
   }
 
-  if (dev != NULL && has_bilat)
+  if (lr->develop && lr->has_bilat)
   {
-    pbl.sigma_r = 100.0;
-    pbl.sigma_s = 100.0;
+    lr->pbl.sigma_r = 100.0;
+    lr->pbl.sigma_s = 100.0;
 
-    dt_add_hist (imgid, "bilat", (dt_iop_params_t *)&pbl, sizeof(dt_iop_bilat_params_t), imported, LRDT_BILAT_VERSION, &n_import);
-    refresh_needed=TRUE;
+    dt_add_hist (imgid, "bilat", (dt_iop_params_t *)&lr->pbl, sizeof(dt_iop_bilat_params_t), imported, LRDT_BILAT_VERSION, &n_import);
   }
 
-  if (has_tags)
+  if (lr->has_tags)
   {
+    for(GList *t = lr->tags; t; t = g_list_next(t))
+    {
+      guint tagid = 0;
+      if (!dt_tag_exists((char *)t->data, &tagid))
+        dt_tag_new((char *)t->data, &tagid);
+      dt_tag_attach(tagid, imgid);
+    }
+
     if (imported[0]) strcat(imported, ", ");
     strcat(imported, _("tags"));
     n_import++;
   }
 
-  if (dev == NULL && has_rating)
+  if (lr->metadata && lr->has_rating)
   {
-    dt_ratings_apply_to_image(imgid, rating);
+    dt_ratings_apply_to_image(imgid, lr->rating);
 
     if (imported[0]) strcat(imported, ", ");
     strcat(imported, _("rating"));
     n_import++;
   }
 
-  if (dev == NULL && has_gps)
+  if (lr->metadata && lr->has_gps)
   {
-    dt_image_set_location(imgid, lon, lat);
+    dt_image_set_location(imgid, lr->lon, lr->lat);
 
     if (imported[0]) strcat(imported, ", ");
     strcat(imported, _("geotagging"));
     n_import++;
   }
 
-  if (dev == NULL && has_colorlabel)
+  if (lr->metadata && lr->has_colorlabel)
   {
-    dt_colorlabels_set_label(imgid, color);
+    dt_colorlabels_set_label(imgid, lr->color);
 
     if (imported[0]) strcat(imported, ", ");
     strcat(imported, _("color label"));
     n_import++;
   }
 
-  if(dev != NULL && refresh_needed && dev->gui_attached)
+  return n_import;
+}
+
+void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
+{
+  char imported[256] = {0};
+  dt_lightroom_t lr;
+  _lightroom_init(&lr, dev != NULL, dev == NULL, dev ? dev->image_storage.orientation : 0);
+
+  // the develop settings were imported by dt_lightroom_import_batch() already:
+  if(dev != NULL && iauto && _lightroom_imported(imgid))
+    return;
+
+  if(_lightroom_read(imgid, &lr, iauto))
+  {
+    _lightroom_cleanup(&lr);
+    return;
+  }
+  const int n_import = _lightroom_apply(imgid, &lr, imported);
+  _lightroom_cleanup(&lr);
+
+  if(dev != NULL && dev->gui_attached)
   {
     char message[512];
 
@@ -1460,3 +1508,70 @@ void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto)
     }
   }
 }
+
+int dt_lightroom_import_batch(const int32_t *imgid, const int n)
+{
+  if(n <= 0) return 0;
+  dt_lightroom_t *lr = (dt_lightroom_t *)malloc(sizeof(dt_lightroom_t) * n);
+  int *failed = (int *)malloc(sizeof(int) * n);
+  if(!lr || !failed)
+  {
+    free(lr);
+    free(failed);
+    return 0;
+  }
+
+  for(int k=0; k<n; k++)
+  {
+    int orientation = 0;
+    const dt_image_t *img = dt_image_cache_read_get(darktable.image_cache, imgid[k]);
+    if(img)
+    {
+      orientation = img->orientation;
+      dt_image_cache_read_release(darktable.image_cache, img);
+    }
+    _lightroom_init(lr + k, !_lightroom_imported(imgid[k]), TRUE, orientation);
+  }
+
+  // parsing is most of the work, and needs neither the database nor the gui:
+  xmlInitParser();
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(lr, failed, imgid) schedule(dynamic)
+#endif
+  for(int k=0; k<n; k++)
+    failed[k] = _lightroom_read(imgid[k], lr + k, TRUE);
+
+  guint tagid = 0;
+  dt_tag_new(LRDT_IMPORTED_TAG, &tagid);
+
+  int count = 0;
+  dt_image_cache_write_batch_begin(darktable.image_cache);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "begin", NULL, NULL, NULL);
+  for(int k=0; k<n; k++)
+  {
+    if(failed[k]) continue;
+    // names of the develop and the metadata items, only the count is used:
+    char imported[1024] = {0};
+    if(_lightroom_apply(imgid[k], lr + k, imported) > 0) count++;
+    if(lr[k].develop) dt_tag_attach(tagid, imgid[k]);
+  }
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "commit", NULL, NULL, NULL);
+  dt_image_cache_write_batch_end(darktable.image_cache);
+
+  // the sidecars and thumbnails follow the new history:
+  GList *changed = NULL;
+  for(int k=0; k<n; k++)
+  {
+    if(!failed[k] && lr[k].develop)
+    {
+      dt_image_synch_xmp(imgid[k]);
+      changed = g_list_prepend(changed, GINT_TO_POINTER(imgid[k]));
+    }
+    _lightroom_cleanup(lr + k);
+  }
+  dt_mipmap_cache_remove_list(darktable.mipmap_cache, changed, 1);
+  g_list_free(changed);
+  free(lr);
+  free(failed);
+  return count;
+}
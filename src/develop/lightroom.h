@@ -28,6 +28,12 @@
 */
 void dt_lightroom_import (int imgid, dt_develop_t *dev, gboolean iauto);
 
+/* imports develop data and metadata of the n images imgid at once, for migrating whole catalogs:
+   the xmps are parsed in parallel, the results written in one transaction. images whose develop
+   data was imported that way are not imported again when first opened in darkroom.
+   returns the number of images something was imported for. */
+int dt_lightroom_import_batch(const int32_t *imgid, const int n);
+
 /* returns NULL if not found, or g_strdup'ed pathname, the caller should g_free it. */
 char *dt_get_lightroom_xmp (int imgid);
 
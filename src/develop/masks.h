@@ -27,6 +27,7 @@
 #include "dtgtk/gradientslider.h"
 #include "develop/pixelpipe.h"
 #include "common/opencl.h"
+#include "common/dtpthread.h"
 
 /**forms types */
 typedef enum dt_masks_type_t
@@ -152,6 +153,24 @@ typedef struct dt_masks_form_gui_t
 }
 dt_masks_form_gui_t;
 
+/** number of rendered masks kept per develop, enough for a few masked modules in the full and the preview pipe */
+#define DT_MASKS_CACHE_ENTRIES 4
+
+/** the rendered masks of the last processing runs, keyed by the pipe prefix hash, the roi and the form */
+typedef struct dt_masks_cache_t
+{
+  dt_pthread_mutex_t lock;
+  uint64_t hash[DT_MASKS_CACHE_ENTRIES];
+  float *buf[DT_MASKS_CACHE_ENTRIES];
+  size_t size[DT_MASKS_CACHE_ENTRIES];  // in floats
+  uint64_t used[DT_MASKS_CACHE_ENTRIES];
+  uint64_t clock;
+}
+dt_masks_cache_t;
+
+void dt_masks_cache_init(dt_masks_cache_t *cache);
+void dt_masks_cache_cleanup(dt_masks_cache_t *cache);
+
 /** get points in real space with respect of distortion dx and dy are used to eventually move the center of the circle */
 int dt_masks_get_points_border(dt_develop_t *dev, dt_masks_form_t *form, float **points, int *points_count, float **border, int *border_count, int source);
 
@@ -21,6 +21,7 @@
 #include "control/conf.h"
 #include "develop/masks.h"
 #include "common/debug.h"
+#include "develop/pixelpipe_cache.h"
 
 static int dt_group_events_mouse_scrolled(struct dt_iop_module_t *module, float pzx, float pzy, int up, uint32_t state,
     dt_masks_form_t *form, dt_masks_form_gui_t *gui)
@@ -332,14 +333,96 @@ static int dt_group_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pi
   return 1;
 }
 
+void dt_masks_cache_init(dt_masks_cache_t *cache)
+{
+  memset(cache,0,sizeof(dt_masks_cache_t));
+  dt_pthread_mutex_init(&cache->lock, NULL);
+}
+
+void dt_masks_cache_cleanup(dt_masks_cache_t *cache)
+{
+  for (int k=0; k<DT_MASKS_CACHE_ENTRIES; k++) free(cache->buf[k]);
+  dt_pthread_mutex_destroy(&cache->lock);
+}
+
+/** the rendered mask only depends on the modules before this piece (they distort the forms), on the
+  * piece itself (its blend params and the hash of the forms) and on the region we render. */
+static uint64_t _group_render_hash(dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form, int *roi, float scale)
+{
+  dt_dev_pixelpipe_t *pipe = piece->pipe;
+  const dt_iop_roi_t r = { roi[0], roi[1], roi[2], roi[3], scale };
+  uint64_t hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, &r, pipe, g_list_index(pipe->nodes, piece));
+  hash = ((hash << 5) + hash) ^ piece->hash;
+  hash = ((hash << 5) + hash) ^ form->formid;
+  hash = ((hash << 5) + hash) ^ pipe->iwidth;
+  hash = ((hash << 5) + hash) ^ pipe->iheight;
+  return hash;
+}
+
+static int _group_render_cache_get(dt_masks_cache_t *cache, const uint64_t hash, float *mask, const size_t size)
+{
+  int found = 0;
+  dt_pthread_mutex_lock(&cache->lock);
+  for (int k=0; k<DT_MASKS_CACHE_ENTRIES; k++)
+  {
+    if (cache->buf[k] && cache->hash[k] == hash && cache->size[k] == size)
+    {
+      memcpy(mask,cache->buf[k],size*sizeof(float));
+      cache->used[k] = ++cache->clock;
+      found = 1;
+      break;
+    }
+  }
+  dt_pthread_mutex_unlock(&cache->lock);
+  return found;
+}
+
+static void _group_render_cache_put(dt_masks_cache_t *cache, const uint64_t hash, const float *mask, const size_t size)
+{
+  dt_pthread_mutex_lock(&cache->lock);
+  //we replace the least recently used entry
+  int k = 0;
+  for (int i=1; i<DT_MASKS_CACHE_ENTRIES; i++)
+    if (cache->used[i] < cache->used[k]) k = i;
+  if (cache->size[k] != size)
+  {
+    free(cache->buf[k]);
+    cache->buf[k] = malloc(size*sizeof(float));
+    cache->size[k] = cache->buf[k] ? size : 0;
+  }
+  if (cache->buf[k])
+  {
+    memcpy(cache->buf[k],mask,size*sizeof(float));
+    cache->hash[k] = hash;
+    cache->used[k] = ++cache->clock;
+  }
+  dt_pthread_mutex_unlock(&cache->lock);
+}
+
 int dt_masks_group_render(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form, float **buffer, int *roi, float scale)
 {
   double start2 = dt_get_wtime();
 
   if (!form) return 0;
   float *mask = *buffer;
+  const size_t size = (size_t)roi[2]*roi[3];
+
+  //only the interactive pipes render the same masks over and over again
+  dt_masks_cache_t *cache = NULL;
+  uint64_t hash = 0;
+  if (module->dev->masks_cache && (piece->pipe->type == DT_DEV_PIXELPIPE_FULL || piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW))
+  {
+    cache = module->dev->masks_cache;
+    hash = _group_render_hash(piece,form,roi,scale);
+    if (_group_render_cache_get(cache,hash,mask,size))
+    {
+      if (darktable.unmuted & DT_DEBUG_PERF) dt_print(DT_DEBUG_MASKS, "[masks] cached mask took %0.04f sec\n", dt_get_wtime()-start2);
+      return 1;
+    }
+  }
+
   //we first reset the buffer to 0
-  memset(mask,0,roi[2]*roi[3]*sizeof(float));
+  memset(mask,0,size*sizeof(float));
 
   //we get the mask
   float *fm = NULL;
@@ -354,7 +437,12 @@ int dt_masks_group_render(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece
   int fww = fw*scale;
   int fyy = fy*scale;
   int fhh = fh*scale;
-  if (fxx>roi[0]+roi[2]) return 1;
+  if (fxx>roi[0]+roi[2])
+  {
+    free(fm);
+    if (cache) _group_render_cache_put(cache,hash,mask,size);
+    return 1;
+  }
 
   if (fxx<roi[0]) fww += fxx-roi[0], fxx=roi[0];
   if (fww+fxx>=roi[0]+roi[2]) fww = roi[0]+roi[2]-fxx-1;
@@ -380,6 +468,8 @@ int dt_masks_group_render(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece
   //we free the mask
   free(fm);
 
+  if (cache) _group_render_cache_put(cache,hash,mask,size);
+
   if (darktable.unmuted & DT_DEBUG_PERF) dt_print(DT_DEBUG_MASKS, "[masks] scale all masks took %0.04f sec\n", dt_get_wtime()-start2);
 
   return 1;
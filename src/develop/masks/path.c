@@ -1914,27 +1914,141 @@ static int dt_path_get_area(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pie
   return 1;
 }
 
-/** we write a falloff segment */
-static void _path_falloff(float **buffer, int *p0, int *p1, int posx, int posy, int bw)
+/** an edge of the path for the scanline fill, in buffer coordinates with y0 < y1 */
+typedef struct dt_masks_path_edge_t
 {
-  //segment length
-  int l = sqrt((p1[0]-p0[0])*(p1[0]-p0[0])+(p1[1]-p0[1])*(p1[1]-p0[1]))+1;
+  float x0, y0, x1, y1, dxdy;
+}
+dt_masks_path_edge_t;
 
-  float lx = p1[0]-p0[0];
-  float ly = p1[1]-p0[1];
+static int _path_edge_cmp(const void *a, const void *b)
+{
+  const float ya = ((const dt_masks_path_edge_t *)a)->y0;
+  const float yb = ((const dt_masks_path_edge_t *)b)->y0;
+  return (ya > yb) - (ya < yb);
+}
+
+/** sets the pixels inside the closed polygon pts[first..count-1] to 1.0f (even-odd rule). the
+  * edges are sorted by their top, each scanline keeps the list of edges which cross it. */
+static void _path_fill_polygon(float *buffer, const float *pts, const int first, const int count, const int posx, const int posy, const int bw, const int bh)
+{
+  const int n = count - first;
+  if (n < 3) return;
+  dt_masks_path_edge_t *edges = malloc(sizeof(dt_masks_path_edge_t)*n);
+  int *active = malloc(sizeof(int)*n);
+  float *xs = malloc(sizeof(float)*n);
+  if (!edges || !active || !xs)
+  {
+    free(edges);
+    free(active);
+    free(xs);
+    return;
+  }
+
+  int ne = 0;
+  for (int i=0; i<n; i++)
+  {
+    const float *p = pts + 2*(first+i);
+    const float *q = pts + 2*(first+(i+1)%n);
+    if (p[1] == q[1]) continue; // horizontal edges don't cross any scanline
+    const float *u = p[1] < q[1] ? p : q;
+    const float *v = p[1] < q[1] ? q : p;
+    dt_masks_path_edge_t *e = edges + ne++;
+    e->x0 = u[0]-posx;
+    e->y0 = u[1]-posy;
+    e->x1 = v[0]-posx;
+    e->y1 = v[1]-posy;
+    e->dxdy = (e->x1-e->x0)/(e->y1-e->y0);
+  }
+  qsort(edges, ne, sizeof(dt_masks_path_edge_t), _path_edge_cmp);
 
-  for (int i=0 ; i<l; i++)
+  int next = 0, na = 0;
+  for (int y=0; y<bh; y++)
   {
-    //position
-    int x = (int)((float)i*lx/(float)l) + p0[0] - posx;
-    int y = (int)((float)i*ly/(float)l) + p0[1] - posy;
-    float op = 1.0-(float)i/(float)l;
-    (*buffer)[y*bw+x] = fmaxf((*buffer)[y*bw+x],op);
-    if (x > 0) (*buffer)[y*bw+x-1] = fmaxf((*buffer)[y*bw+x-1],op); //this one is to avoid gap due to int rounding
-    if (y > 0) (*buffer)[(y-1)*bw+x] = fmaxf((*buffer)[(y-1)*bw+x],op); //this one is to avoid gap due to int rounding
+    // an edge covers y0 <= y < y1, so vertices are counted once
+    while (next < ne && edges[next].y0 <= y) active[na++] = next++;
+    int nx = 0;
+    for (int k=0; k<na; k++)
+    {
+      const dt_masks_path_edge_t *e = edges + active[k];
+      if (e->y1 <= y)
+      {
+        active[k--] = active[--na];
+        continue;
+      }
+      xs[nx++] = e->x0 + (y-e->y0)*e->dxdy;
+    }
+    // only a few crossings per scanline, insertion sort them
+    for (int k=1; k<nx; k++)
+    {
+      const float x = xs[k];
+      int l = k-1;
+      for (; l>=0 && xs[l]>x; l--) xs[l+1] = xs[l];
+      xs[l+1] = x;
+    }
+    for (int k=0; k+1<nx; k+=2)
+    {
+      const int xa = MAX(0, (int)ceilf(xs[k]));
+      const int xb = MIN(bw-1, (int)floorf(xs[k+1]));
+      for (int x=xa; x<=xb; x++) buffer[y*bw+x] = 1.0f;
+    }
+  }
+
+  free(edges);
+  free(active);
+  free(xs);
+}
+
+/** rasterizes the triangle p0 p1 p2 (buffer coordinates) with the opacities v0 v1 v2 at its
+  * corners. the opacity is linear in between, the buffer keeps the max. */
+static void _path_fill_triangle(float *buffer, const float *p0, const float *p1, const float *p2, const float v0, const float v1, const float v2, const int bw, const int bh)
+{
+  // plane through the corners, v = a*x + b*y + c
+  const float det = (p1[0]-p0[0])*(p2[1]-p0[1]) - (p2[0]-p0[0])*(p1[1]-p0[1]);
+  if (fabsf(det) < 1e-6f) return;
+  const float a = ((v1-v0)*(p2[1]-p0[1]) - (v2-v0)*(p1[1]-p0[1]))/det;
+  const float b = ((v2-v0)*(p1[0]-p0[0]) - (v1-v0)*(p2[0]-p0[0]))/det;
+  const float c = v0 - a*p0[0] - b*p0[1];
+
+  const float *p[3] = { p0, p1, p2 };
+  const int ya = MAX(0, (int)ceilf(fminf(p0[1], fminf(p1[1], p2[1]))));
+  const int yb = MIN(bh-1, (int)floorf(fmaxf(p0[1], fmaxf(p1[1], p2[1]))));
+  for (int y=ya; y<=yb; y++)
+  {
+    // span of the scanline inside the triangle
+    float xl = FLT_MAX, xr = -FLT_MAX;
+    for (int k=0; k<3; k++)
+    {
+      const float *e0 = p[k], *e1 = p[(k+1)%3];
+      if ((e0[1] > y && e1[1] > y) || (e0[1] < y && e1[1] < y)) continue;
+      if (e0[1] == e1[1])
+      {
+        xl = fminf(xl, fminf(e0[0], e1[0]));
+        xr = fmaxf(xr, fmaxf(e0[0], e1[0]));
+        continue;
+      }
+      const float x = e0[0] + (y-e0[1])*(e1[0]-e0[0])/(e1[1]-e0[1]);
+      xl = fminf(xl, x);
+      xr = fmaxf(xr, x);
+    }
+    const int xa = MAX(0, (int)ceilf(xl));
+    const int xb = MIN(bw-1, (int)floorf(xr));
+    for (int x=xa; x<=xb; x++)
+    {
+      const float v = CLAMPS(a*x + b*y + c, 0.0f, 1.0f);
+      buffer[y*bw+x] = fmaxf(buffer[y*bw+x], v);
+    }
   }
 }
 
+/** the feather between two consecutive pairs of path point a and border point b: opacity 1 at
+  * the path, 0 at the border. */
+static void _path_fill_falloff(float *buffer, const float *a0, const float *b0, const float *a1, const float *b1, const int bw, const int bh)
+{
+  _path_fill_triangle(buffer, a0, b0, b1, 1.0f, 0.0f, 0.0f, bw, bh);
+  _path_fill_triangle(buffer, a0, b1, a1, 1.0f, 0.0f, 1.0f, bw, bh);
+}
+
 static int dt_path_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form, float **buffer, int *width, int *height, int *posx, int *posy)
 {
   if (!module) return 0;
@@ -1993,104 +2107,15 @@ static int dt_path_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pie
   *buffer = malloc((*width)*(*height)*sizeof(float));
   memset(*buffer,0,(*width)*(*height)*sizeof(float));
 
-  //we write all the point around the path into the buffer
-  int nbp = border_count;
-  int lastx,lasty,lasty2,nx;
-  if (nbp>2)
-  {
-    lastx = (int) points[(nbp-1)*2];
-    lasty = (int) points[(nbp-1)*2+1];
-    lasty2 = (int) points[(nbp-2)*2+1];
-
-    int just_change_dir = 0;
-    for (int ii=nb_corner*3; ii < 2*nbp; ii++)
-    {
-      //we are writing more than 1 loop in the case the dir in y change
-      //exactly at start/end point
-      int i = ii;
-      if (ii >= nbp) i = ii - nbp + nb_corner*3;
-      int xx = (int) points[i*2];
-      int yy = (int) points[i*2+1];
-
-      //we don't store the point if it has the same y value as the last one
-      if (yy == lasty) continue;
-
-      //we want to be sure that there is no y jump
-      if (yy-lasty > 1 || yy-lasty < -1)
-      {
-        if (yy<lasty)
-        {
-          for (int j=yy+1; j<lasty; j++)
-          {
-            int nx = (j-yy)*(lastx-xx)/(float)(lasty-yy)+xx;
-            (*buffer)[(j-(*posy))*(*width)+nx-(*posx)] = 1.0f;
-          }
-          lasty2 = yy+2;
-          lasty = yy+1;
-        }
-        else
-        {
-          for (int j=lasty+1; j<yy; j++)
-          {
-            nx = (j-lasty)*(xx-lastx)/(float)(yy-lasty)+lastx;
-            (*buffer)[(j-(*posy))*(*width)+nx-(*posx)] = 1.0f;
-          }
-          lasty2 = yy-2;
-          lasty = yy-1;
-        }
-      }
-      //if we change the direction of the path (in y), then we add a extra point
-      if ((lasty-lasty2)*(lasty-yy)>0)
-      {
-        (*buffer)[(lasty-(*posy))*(*width)+lastx+1-(*posx)] = 1.0f;
-        just_change_dir = 1;
-      }
-      //we add the point
-      if (just_change_dir && ii==i)
-      {
-        //if we have changed the direction, we have to be carefull that point can be at the same place
-        //as the previous one , especially on sharp edges
-        float v = (*buffer)[(yy-(*posy))*(*width)+xx-(*posx)];
-        if (v>0.0)
-        {
-          if (xx-(*posx)>0) (*buffer)[(yy-(*posy))*(*width)+xx-1-(*posx)] = 1.0f;
-          else if (xx-(*posx)<(*width)-1) (*buffer)[(yy-(*posy))*(*width)+xx+1-(*posx)] = 1.0f;
-        }
-        else
-        {
-          (*buffer)[(yy-(*posy))*(*width)+xx-(*posx)] = 1.0f;
-          just_change_dir = 0;
-        }
-      }
-      else (*buffer)[(yy-(*posy))*(*width)+xx-(*posx)] = 1.0f;
-      //we change last values
-      lasty2 = lasty;
-      lasty = yy;
-      lastx = xx;
-      if (ii != i) break;
-    }
-  }
-  if (darktable.unmuted & DT_DEBUG_PERF) dt_print(DT_DEBUG_MASKS, "[masks %s] path_fill draw path took %0.04f sec\n", form->name, dt_get_wtime()-start2);
-  start2 = dt_get_wtime();
-
-  for (int yy=0; yy<hb; yy++)
-  {
-    int state = 0;
-    for (int xx=0; xx<wb; xx++)
-    {
-      float v = (*buffer)[yy*wb+xx];
-      if (v == 1.0f) state = !state;
-      if (state) (*buffer)[yy*wb+xx] = 1.0f;
-    }
-  }
+  //we fill the inside of the path
+  _path_fill_polygon(*buffer, points, nb_corner*3, points_count, *posx, *posy, wb, hb);
 
   if (darktable.unmuted & DT_DEBUG_PERF) dt_print(DT_DEBUG_MASKS, "[masks %s] path_fill fill plain took %0.04f sec\n", form->name, dt_get_wtime()-start2);
   start2 = dt_get_wtime();
 
-  //now we fill the falloff
-  int p0[2], p1[2];
-  int last0[2] = {-100,-100}, last1[2] = {-100,-100};
-  nbp = 0;
+  //now we fill the falloff, between each point of the path and its point on the border
+  float p0[2], p1[2], last0[2] = {0.0f}, last1[2] = {0.0f}, first0[2] = {0.0f}, first1[2] = {0.0f};
+  int have_last = 0;
   int next = 0;
   for (int i=nb_corner*3; i<border_count; i++)
   {
@@ -2107,14 +2132,22 @@ static int dt_path_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *pie
       p1[0] = border[next*2], p1[1] = border[next*2+1];
     }
 
-    //and we draw the falloff
-    if (last0[0] != p0[0] || last0[1] != p0[1] || last1[0] != p1[0] || last1[1] != p1[1])
+    //in buffer coordinates
+    p0[0] -= *posx, p0[1] -= *posy;
+    p1[0] -= *posx, p1[1] -= *posy;
+
+    if (have_last) _path_fill_falloff(*buffer, last0, last1, p0, p1, wb, hb);
+    else
     {
-      _path_falloff(buffer,p0,p1,*posx,*posy,*width);
-      last0[0] = p0[0], last0[1] = p0[1];
-      last1[0] = p1[0], last1[1] = p1[1];
+      first0[0] = p0[0], first0[1] = p0[1];
+      first1[0] = p1[0], first1[1] = p1[1];
+      have_last = 1;
     }
+    last0[0] = p0[0], last0[1] = p0[1];
+    last1[0] = p1[0], last1[1] = p1[1];
   }
+  //and we close the loop
+  if (have_last) _path_fill_falloff(*buffer, last0, last1, first0, first1, wb, hb);
 
   if (darktable.unmuted & DT_DEBUG_PERF) dt_print(DT_DEBUG_MASKS, "[masks %s] path_fill fill falloff took %0.04f sec\n", form->name, dt_get_wtime()-start2);
 
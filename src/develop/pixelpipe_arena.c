@@ -0,0 +1,109 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "develop/pixelpipe_arena.h"
+#include "common/darktable.h"
+#include "common/memory_governor.h"
+
+#include <stdlib.h>
+
+#define DT_ARENA_ALIGN 64
+// round the block up to this, so small changes of the peak don't reallocate it:
+#define DT_ARENA_GRANULARITY (1u<<20)
+
+void dt_dev_pixelpipe_arena_init(dt_dev_pixelpipe_arena_t *arena)
+{
+  arena->base = NULL;
+  arena->size = arena->used = arena->peak = 0;
+}
+
+void dt_dev_pixelpipe_arena_cleanup(dt_dev_pixelpipe_arena_t *arena)
+{
+  dt_memory_stats_add(DT_MEMORY_PIXELPIPE_ARENA, -(int64_t)arena->size);
+  free(arena->base);
+  dt_dev_pixelpipe_arena_init(arena);
+}
+
+void *dt_dev_pixelpipe_arena_alloc(dt_dev_pixelpipe_arena_t *arena, size_t size)
+{
+  size = (size + DT_ARENA_ALIGN - 1) & ~(size_t)(DT_ARENA_ALIGN - 1);
+  const size_t offset = __sync_fetch_and_add(&arena->used, size);
+  const size_t end = offset + size;
+  size_t peak = arena->peak;
+  while(end > peak)
+  {
+    const size_t old = __sync_val_compare_and_swap(&arena->peak, peak, end);
+    if(old == peak) break;
+    peak = old;
+  }
+  if(arena->base && end <= arena->size) return arena->base + offset;
+
+  // doesn't fit this time, the block grows after the run. the offsets stay taken,
+  // so the peak accounts for the heap buffer, too:
+  return dt_alloc_align(DT_ARENA_ALIGN, size);
+}
+
+void dt_dev_pixelpipe_arena_free(dt_dev_pixelpipe_arena_t *arena, void *ptr, size_t size)
+{
+  if(!ptr) return;
+  char *p = (char *)ptr;
+  if(!arena->base || p < arena->base || p >= arena->base + arena->size)
+  {
+    free(ptr);
+    return;
+  }
+  size = (size + DT_ARENA_ALIGN - 1) & ~(size_t)(DT_ARENA_ALIGN - 1);
+  const size_t offset = p - arena->base;
+  // only the topmost buffer can be given back, the rest waits for the release of the module:
+  __sync_bool_compare_and_swap(&arena->used, offset + size, offset);
+}
+
+size_t dt_dev_pixelpipe_arena_mark(dt_dev_pixelpipe_arena_t *arena)
+{
+  return arena->used;
+}
+
+void dt_dev_pixelpipe_arena_release(dt_dev_pixelpipe_arena_t *arena, size_t mark)
+{
+  arena->used = mark;
+}
+
+void dt_dev_pixelpipe_arena_reset(dt_dev_pixelpipe_arena_t *arena)
+{
+  arena->used = 0;
+  if(dt_memory_governor_level() > 0)
+  {
+    dt_dev_pixelpipe_arena_cleanup(arena);
+    return;
+  }
+  // nothing processed, everything came from the pixelpipe cache: keep the block for the next real run.
+  if(arena->peak == 0) return;
+  const size_t size = (arena->peak + DT_ARENA_GRANULARITY - 1) & ~(size_t)(DT_ARENA_GRANULARITY - 1);
+  arena->peak = 0;
+  if(size <= arena->size && size >= arena->size/4) return;
+
+  free(arena->base);
+  dt_memory_stats_add(DT_MEMORY_PIXELPIPE_ARENA, -(int64_t)arena->size);
+  arena->base = (char *)dt_alloc_align_huge(DT_ARENA_ALIGN, size);
+  arena->size = arena->base ? size : 0;
+  dt_memory_stats_add(DT_MEMORY_PIXELPIPE_ARENA, arena->size);
+  dt_print(DT_DEBUG_MEMORY, "[pixelpipe_arena] resized to %zu MB\n", arena->size >> 20);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
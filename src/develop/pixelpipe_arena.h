@@ -0,0 +1,62 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_PIXELPIPE_ARENA_H
+#define DT_PIXELPIPE_ARENA_H
+
+#include <stddef.h>
+/**
+ * per pipe arena for temporary buffers of process(), so the darkroom doesn't map and
+ * unmap hundreds of megabytes on every run. allocation is a bump of an offset into one
+ * block, which is kept across runs. the pipe releases everything a module took after its
+ * process() returned, and after every run the block is resized to what the run needed,
+ * so from the second run on nothing hits the system allocator any more.
+ *
+ * modules get their buffers through dt_iop_scratch_alloc() and have to return them with
+ * dt_iop_scratch_free(): allocations which didn't fit are on the heap, and returning the
+ * last one makes its space available again right away (useful between tiles).
+ */
+typedef struct dt_dev_pixelpipe_arena_t
+{
+  char  *base;
+  size_t size;
+  // bytes handed out, may grow beyond size: the rest came from the heap.
+  size_t used;
+  // the most used during this run, the size of the block for the next one.
+  size_t peak;
+}
+dt_dev_pixelpipe_arena_t;
+
+void dt_dev_pixelpipe_arena_init(dt_dev_pixelpipe_arena_t *arena);
+void dt_dev_pixelpipe_arena_cleanup(dt_dev_pixelpipe_arena_t *arena);
+
+/** returns a 64 byte aligned buffer, or NULL. thread safe, tiles may run in parallel. */
+void *dt_dev_pixelpipe_arena_alloc(dt_dev_pixelpipe_arena_t *arena, size_t size);
+/** gives a buffer back. memory of the arena is only reused once everything after it is free, too. */
+void dt_dev_pixelpipe_arena_free(dt_dev_pixelpipe_arena_t *arena, void *ptr, size_t size);
+
+/** the pipe brackets each module with these, everything allocated in between is released. */
+size_t dt_dev_pixelpipe_arena_mark(dt_dev_pixelpipe_arena_t *arena);
+void dt_dev_pixelpipe_arena_release(dt_dev_pixelpipe_arena_t *arena, size_t mark);
+
+/** called after every run: resizes the block to the peak of the run, or drops it under memory pressure. */
+void dt_dev_pixelpipe_arena_reset(dt_dev_pixelpipe_arena_t *arena);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
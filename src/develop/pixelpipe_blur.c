@@ -0,0 +1,220 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "develop/pixelpipe_blur.h"
+#include "develop/pixelpipe_hb.h"
+#include "common/darktable.h"
+#include "common/memory_governor.h"
+#include "common/memory_stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void
+_blur_entry_clear(dt_dev_pixelpipe_blur_entry_t *e)
+{
+  if(e->buf) dt_memory_stats_add(DT_MEMORY_PIXELPIPE_CACHE, -(int64_t)e->size);
+  free(e->buf);
+  if(e->cl_mem) dt_opencl_release_mem_object(e->cl_mem);
+  e->buf = NULL;
+  e->cl_mem = NULL;
+  e->key = 0;
+  e->size = 0;
+  e->devid = -1;
+  e->used = 0;
+}
+
+void dt_dev_pixelpipe_blur_init(dt_dev_pixelpipe_blur_cache_t *cache)
+{
+  memset(cache->entry, 0, sizeof(cache->entry));
+  for(int k=0; k<DT_DEV_PIXELPIPE_BLUR_ENTRIES; k++) cache->entry[k].devid = -1;
+  cache->clock = 0;
+  dt_pthread_mutex_init(&cache->lock, NULL);
+}
+
+void dt_dev_pixelpipe_blur_flush(dt_dev_pixelpipe_blur_cache_t *cache)
+{
+  dt_pthread_mutex_lock(&cache->lock);
+  for(int k=0; k<DT_DEV_PIXELPIPE_BLUR_ENTRIES; k++) _blur_entry_clear(cache->entry + k);
+  dt_pthread_mutex_unlock(&cache->lock);
+}
+
+void dt_dev_pixelpipe_blur_cleanup(dt_dev_pixelpipe_blur_cache_t *cache)
+{
+  dt_dev_pixelpipe_blur_flush(cache);
+  dt_pthread_mutex_destroy(&cache->lock);
+}
+
+uint64_t dt_dev_pixelpipe_blur_key(const dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in,
+                                   const int channels, const float *max, const float *min, const float sigma,
+                                   const int order)
+{
+  if(!piece->input_hash) return 0;
+  // bernstein hash (djb2), as the pixelpipe cache:
+  uint64_t hash = piece->input_hash;
+  const char *str = (const char *)roi_in;
+  for(size_t i=0; i<sizeof(dt_iop_roi_t); i++) hash = ((hash << 5) + hash) ^ str[i];
+  str = (const char *)max;
+  for(size_t i=0; i<channels*sizeof(float); i++) hash = ((hash << 5) + hash) ^ str[i];
+  str = (const char *)min;
+  for(size_t i=0; i<channels*sizeof(float); i++) hash = ((hash << 5) + hash) ^ str[i];
+  str = (const char *)&sigma;
+  for(size_t i=0; i<sizeof(float); i++) hash = ((hash << 5) + hash) ^ str[i];
+  hash = ((hash << 5) + hash) ^ order;
+  hash = ((hash << 5) + hash) ^ channels;
+  return hash ? hash : 1;
+}
+
+// the entry for key in the given place, devid -1 for the host. needs the lock.
+static dt_dev_pixelpipe_blur_entry_t *
+_blur_find(dt_dev_pixelpipe_blur_cache_t *cache, const uint64_t key, const size_t size, const int devid)
+{
+  for(int k=0; k<DT_DEV_PIXELPIPE_BLUR_ENTRIES; k++)
+  {
+    dt_dev_pixelpipe_blur_entry_t *e = cache->entry + k;
+    if(e->key == key && e->size == size && e->devid == devid && (devid < 0 ? e->buf != NULL : e->cl_mem != NULL))
+    {
+      e->used = ++cache->clock;
+      return e;
+    }
+  }
+  return NULL;
+}
+
+// the entry to store a new blur in: the same key, else an empty or the oldest one. needs the lock.
+static dt_dev_pixelpipe_blur_entry_t *
+_blur_victim(dt_dev_pixelpipe_blur_cache_t *cache, const uint64_t key)
+{
+  dt_dev_pixelpipe_blur_entry_t *victim = cache->entry;
+  for(int k=0; k<DT_DEV_PIXELPIPE_BLUR_ENTRIES; k++)
+  {
+    dt_dev_pixelpipe_blur_entry_t *e = cache->entry + k;
+    if(e->key == key) return e;
+    if(e->used < victim->used) victim = e;
+  }
+  return victim;
+}
+
+int dt_dev_pixelpipe_blur_get(dt_dev_pixelpipe_iop_t *piece, const uint64_t key, float *out, const size_t size)
+{
+  if(!key) return 0;
+  dt_dev_pixelpipe_blur_cache_t *cache = &piece->pipe->blur;
+  dt_pthread_mutex_lock(&cache->lock);
+  const dt_dev_pixelpipe_blur_entry_t *e = _blur_find(cache, key, size, -1);
+  if(e) memcpy(out, e->buf, size);
+  dt_pthread_mutex_unlock(&cache->lock);
+  return e != NULL;
+}
+
+void dt_dev_pixelpipe_blur_put(dt_dev_pixelpipe_iop_t *piece, const uint64_t key, const float *in, const size_t size)
+{
+  if(!key) return;
+  dt_dev_pixelpipe_blur_cache_t *cache = &piece->pipe->blur;
+  // memory is short, the caches are shrinking:
+  if(dt_memory_governor_level() > 0)
+  {
+    dt_dev_pixelpipe_blur_flush(cache);
+    return;
+  }
+  dt_pthread_mutex_lock(&cache->lock);
+  dt_dev_pixelpipe_blur_entry_t *e = _blur_victim(cache, key);
+  if(!e->buf || e->size != size)
+  {
+    _blur_entry_clear(e);
+    e->buf = (float *)dt_alloc_align(64, size);
+    if(!e->buf)
+    {
+      dt_pthread_mutex_unlock(&cache->lock);
+      return;
+    }
+    e->size = size;
+    dt_memory_stats_add(DT_MEMORY_PIXELPIPE_CACHE, size);
+  }
+  else if(e->cl_mem)
+  {
+    dt_opencl_release_mem_object(e->cl_mem);
+    e->cl_mem = NULL;
+  }
+  memcpy(e->buf, in, size);
+  e->key = key;
+  e->devid = -1;
+  e->used = ++cache->clock;
+  dt_pthread_mutex_unlock(&cache->lock);
+}
+
+#ifdef HAVE_OPENCL
+int dt_dev_pixelpipe_blur_get_cl(dt_dev_pixelpipe_iop_t *piece, const uint64_t key, cl_mem dev_out,
+                                 const int width, const int height)
+{
+  if(!key) return 0;
+  dt_dev_pixelpipe_blur_cache_t *cache = &piece->pipe->blur;
+  const size_t size = (size_t)4*sizeof(float)*width*height;
+  dt_pthread_mutex_lock(&cache->lock);
+  const dt_dev_pixelpipe_blur_entry_t *e = _blur_find(cache, key, size, piece->pipe->devid);
+  int hit = 0;
+  if(e)
+  {
+    size_t origin[] = { 0, 0, 0 };
+    size_t region[] = { width, height, 1 };
+    hit = dt_opencl_enqueue_copy_image(piece->pipe->devid, e->cl_mem, dev_out, origin, origin, region) == CL_SUCCESS;
+  }
+  dt_pthread_mutex_unlock(&cache->lock);
+  return hit;
+}
+
+void dt_dev_pixelpipe_blur_put_cl(dt_dev_pixelpipe_iop_t *piece, const uint64_t key, cl_mem dev_in,
+                                  const int width, const int height)
+{
+  if(!key) return;
+  dt_dev_pixelpipe_blur_cache_t *cache = &piece->pipe->blur;
+  const int devid = piece->pipe->devid;
+  const size_t size = (size_t)4*sizeof(float)*width*height;
+  dt_pthread_mutex_lock(&cache->lock);
+  dt_dev_pixelpipe_blur_entry_t *e = _blur_victim(cache, key);
+  if(!e->cl_mem || e->size != size || e->devid != devid)
+  {
+    _blur_entry_clear(e);
+    e->cl_mem = dt_opencl_alloc_device(devid, width, height, 4*sizeof(float));
+    if(!e->cl_mem)
+    {
+      dt_pthread_mutex_unlock(&cache->lock);
+      return;
+    }
+    e->size = size;
+    e->devid = devid;
+  }
+  else if(e->buf)
+  {
+    dt_memory_stats_add(DT_MEMORY_PIXELPIPE_CACHE, -(int64_t)e->size);
+    free(e->buf);
+    e->buf = NULL;
+  }
+  size_t origin[] = { 0, 0, 0 };
+  size_t region[] = { width, height, 1 };
+  if(dt_opencl_enqueue_copy_image(devid, dev_in, e->cl_mem, origin, origin, region) == CL_SUCCESS)
+  {
+    e->key = key;
+    e->used = ++cache->clock;
+  }
+  else _blur_entry_clear(e);
+  dt_pthread_mutex_unlock(&cache->lock);
+}
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,86 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_PIXELPIPE_BLUR_H
+#define DT_PIXELPIPE_BLUR_H
+
+#include "common/dtpthread.h"
+#include "common/opencl.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+/**
+ * per pipe cache of the gaussian blurs modules took of their input. dragging a slider of
+ * shadows and highlights or lowpass in the darkroom runs the module again on the same input
+ * with the same radius, only what is done with the blur afterwards changes. the blur is
+ * copied from here then instead of being computed again.
+ *
+ * the key identifies the input by its hash in the pixelpipe cache, which the pipe keeps in
+ * the piece for process(), together with the region and all parameters of the blur. only
+ * the darkroom pipes cache, the others run every input once.
+ */
+#define DT_DEV_PIXELPIPE_BLUR_ENTRIES 2
+
+struct dt_dev_pixelpipe_iop_t;
+struct dt_iop_roi_t;
+
+typedef struct dt_dev_pixelpipe_blur_entry_t
+{
+  uint64_t key;     // 0 if unused
+  size_t size;      // bytes of the blur
+  float *buf;       // on the host, or
+  void *cl_mem;     // a 4 channel float image on device devid
+  int devid;
+  uint32_t used;    // last use, the oldest entry is replaced
+}
+dt_dev_pixelpipe_blur_entry_t;
+
+typedef struct dt_dev_pixelpipe_blur_cache_t
+{
+  dt_pthread_mutex_t lock;
+  uint32_t clock;
+  dt_dev_pixelpipe_blur_entry_t entry[DT_DEV_PIXELPIPE_BLUR_ENTRIES];
+}
+dt_dev_pixelpipe_blur_cache_t;
+
+void dt_dev_pixelpipe_blur_init(dt_dev_pixelpipe_blur_cache_t *cache);
+void dt_dev_pixelpipe_blur_cleanup(dt_dev_pixelpipe_blur_cache_t *cache);
+/** drops all entries. */
+void dt_dev_pixelpipe_blur_flush(dt_dev_pixelpipe_blur_cache_t *cache);
+
+/** key of a blur of the input of piece in roi_in, with the arguments of dt_gaussian_init(). 0 if not cached. */
+uint64_t dt_dev_pixelpipe_blur_key(const struct dt_dev_pixelpipe_iop_t *piece, const struct dt_iop_roi_t *roi_in,
+                                   const int channels, const float *max, const float *min, const float sigma,
+                                   const int order);
+
+/** copies the blur to out and returns 1 if it is cached. */
+int dt_dev_pixelpipe_blur_get(struct dt_dev_pixelpipe_iop_t *piece, const uint64_t key, float *out, const size_t size);
+/** keeps a copy of the blur in for later runs. */
+void dt_dev_pixelpipe_blur_put(struct dt_dev_pixelpipe_iop_t *piece, const uint64_t key, const float *in, const size_t size);
+
+#ifdef HAVE_OPENCL
+/** the same for 4 channel float images on the device of the pipe. */
+int dt_dev_pixelpipe_blur_get_cl(struct dt_dev_pixelpipe_iop_t *piece, const uint64_t key, cl_mem dev_out,
+                                 const int width, const int height);
+void dt_dev_pixelpipe_blur_put_cl(struct dt_dev_pixelpipe_iop_t *piece, const uint64_t key, cl_mem dev_in,
+                                  const int width, const int height);
+#endif
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -18,18 +18,231 @@
 
 #include "develop/pixelpipe_cache.h"
 #include "develop/pixelpipe_hb.h"
+#include "common/opencl.h"
+#include "control/conf.h"
+#include "common/half.h"
 #include "libs/lib.h"
 #include <stdlib.h>
 
+// all pixelpipes (full, preview, export, thumbnail) draw their cache line buffers
+// from one shared pool. buffers are rounded up to a few size classes per octave, and
+// buffers given back by a pipe are kept in per class free lists, so other pipes
+// (or the next export) can reuse them without going through the allocator.
+// the total amount of memory held by all pixelpipe caches is budgeted by `cache_memory'.
 
-// TODO: make cache global (needs to be thread safe then)
-// plan:
-// - look at mipmap_cache.c, for the full buffer allocs
-// - do that, but for `large' and `regular' buffers (full + export/dr mode), so 2 caches
-//   (in fact, maybe 3, one for preview pipes?)
-// - have at most 3 read locks all the time per pipe, get them at create time
-//   ping, pong, and priority buffer (focused plugin)
-// - drop read by the time another is requested (with priority, drop that, or alternating ping and pong?)
+// 4 classes per octave, starting at 4k, up to 2^(12+96/4) = 64G:
+#define DT_PIXELPIPE_CACHE_POOL_MIN_SHIFT 12
+#define DT_PIXELPIPE_CACHE_POOL_STEPS 4
+#define DT_PIXELPIPE_CACHE_POOL_CLASSES 96
+// opencl devices sharing memory with the host only use buffers in place which are page aligned:
+#define DT_PIXELPIPE_CACHE_POOL_ALIGN 4096
+
+typedef struct dt_dev_pixelpipe_cache_pool_t
+{
+  dt_pthread_mutex_t lock;
+  int initialized;
+  size_t budget;     // max bytes held by all caches, used and free
+  size_t default_budget; // from `cache_memory', the memory governor may lower budget temporarily
+  size_t allocated;  // bytes currently held, used and free
+  size_t free_bytes; // bytes sitting in the free lists
+  // singly linked free lists, the next pointer is stored in the buffer itself:
+  void *free_list[DT_PIXELPIPE_CACHE_POOL_CLASSES];
+  // profiling:
+  uint64_t reused, allocs;
+}
+dt_dev_pixelpipe_cache_pool_t;
+
+static dt_dev_pixelpipe_cache_pool_t _pool;
+
+static inline size_t
+_pool_class_size(const int c)
+{
+  const size_t base = ((size_t)1) << (DT_PIXELPIPE_CACHE_POOL_MIN_SHIFT + c / DT_PIXELPIPE_CACHE_POOL_STEPS);
+  return base + (base / DT_PIXELPIPE_CACHE_POOL_STEPS) * (c % DT_PIXELPIPE_CACHE_POOL_STEPS);
+}
+
+static inline int
+_pool_class(const size_t size)
+{
+  int c = 0;
+  while(c < DT_PIXELPIPE_CACHE_POOL_CLASSES - 1 && _pool_class_size(c) < size) c++;
+  return c;
+}
+
+// frees buffers from the free lists, largest first, until the given amount fits into the budget.
+// needs the pool lock.
+static void
+_pool_shrink_locked(const size_t size)
+{
+  for(int c=DT_PIXELPIPE_CACHE_POOL_CLASSES-1; c>=0 && _pool.allocated + size > _pool.budget; c--)
+  {
+    while(_pool.free_list[c] && _pool.allocated + size > _pool.budget)
+    {
+      void *buf = _pool.free_list[c];
+      _pool.free_list[c] = *(void **)buf;
+      free(buf);
+      dt_memory_stats_add(DT_MEMORY_PIXELPIPE_CACHE, -(int64_t)_pool_class_size(c));
+      _pool.allocated  -= _pool_class_size(c);
+      _pool.free_bytes -= _pool_class_size(c);
+    }
+  }
+}
+
+// returns a buffer of at least size bytes, and its actual size in class_size.
+static void*
+_pool_alloc(const size_t size, size_t *class_size)
+{
+  const int c = _pool_class(size);
+  const size_t csize = MAX(size, _pool_class_size(c));
+  void *buf = NULL;
+  dt_pthread_mutex_lock(&_pool.lock);
+  if(csize == _pool_class_size(c) && _pool.free_list[c])
+  {
+    buf = _pool.free_list[c];
+    _pool.free_list[c] = *(void **)buf;
+    _pool.free_bytes -= csize;
+    _pool.reused++;
+    dt_pthread_mutex_unlock(&_pool.lock);
+    *class_size = csize;
+    return buf;
+  }
+  // make room by dropping idle buffers of other sizes. the pipe needs this
+  // buffer to make progress, so the budget is not enforced beyond that.
+  _pool_shrink_locked(csize);
+  _pool.allocated += csize;
+  _pool.allocs++;
+  dt_pthread_mutex_unlock(&_pool.lock);
+
+  buf = (void *)dt_alloc_align_huge(DT_PIXELPIPE_CACHE_POOL_ALIGN, csize);
+  if(!buf)
+  {
+    dt_pthread_mutex_lock(&_pool.lock);
+    _pool.allocated -= csize;
+    dt_pthread_mutex_unlock(&_pool.lock);
+    *class_size = 0;
+    return NULL;
+  }
+  dt_memory_stats_add(DT_MEMORY_PIXELPIPE_CACHE, csize);
+  *class_size = csize;
+  return buf;
+}
+
+// gives back a buffer obtained from _pool_alloc, with its class size.
+static void
+_pool_free(void *buf, const size_t class_size)
+{
+  if(!buf) return;
+  const int c = _pool_class(class_size);
+  dt_pthread_mutex_lock(&_pool.lock);
+  // keep it around if it is a proper class size and we're within budget:
+  if(_pool.initialized && class_size == _pool_class_size(c) && _pool.allocated <= _pool.budget)
+  {
+    *(void **)buf = _pool.free_list[c];
+    _pool.free_list[c] = buf;
+    _pool.free_bytes += class_size;
+    dt_pthread_mutex_unlock(&_pool.lock);
+    return;
+  }
+  _pool.allocated -= class_size;
+  dt_pthread_mutex_unlock(&_pool.lock);
+  dt_memory_stats_add(DT_MEMORY_PIXELPIPE_CACHE, -(int64_t)class_size);
+  free(buf);
+}
+
+void dt_dev_pixelpipe_cache_pool_init()
+{
+  memset(&_pool, 0, sizeof(_pool));
+  dt_pthread_mutex_init(&_pool.lock, NULL);
+  _pool.budget = _pool.default_budget = CLAMPS(dt_conf_get_int("cache_memory"), 100u<<20, 2u<<30);
+  _pool.initialized = 1;
+}
+
+void dt_dev_pixelpipe_cache_pool_set_budget(const size_t budget)
+{
+  dt_pthread_mutex_lock(&_pool.lock);
+  if(_pool.initialized)
+  {
+    _pool.budget = budget ? MIN(budget, _pool.default_budget) : _pool.default_budget;
+    // buffers in use stay, they are dropped when given back:
+    _pool_shrink_locked(0);
+  }
+  dt_pthread_mutex_unlock(&_pool.lock);
+}
+
+size_t dt_dev_pixelpipe_cache_pool_get_budget()
+{
+  return _pool.default_budget;
+}
+
+size_t dt_dev_pixelpipe_cache_pool_allocated()
+{
+  return _pool.allocated;
+}
+
+void dt_dev_pixelpipe_cache_pool_cleanup()
+{
+  dt_pthread_mutex_lock(&_pool.lock);
+  for(int c=0; c<DT_PIXELPIPE_CACHE_POOL_CLASSES; c++)
+  {
+    while(_pool.free_list[c])
+    {
+      void *buf = _pool.free_list[c];
+      _pool.free_list[c] = *(void **)buf;
+      free(buf);
+      dt_memory_stats_add(DT_MEMORY_PIXELPIPE_CACHE, -(int64_t)_pool_class_size(c));
+    }
+  }
+  _pool.initialized = 0;
+  dt_pthread_mutex_unlock(&_pool.lock);
+  dt_pthread_mutex_destroy(&_pool.lock);
+}
+
+// half float conversion of cache lines, in parallel chunks:
+#define DT_PIXELPIPE_CACHE_HALF_CHUNK (1<<16)
+
+static void
+_pack_half(uint16_t *out, const float *in, const size_t n)
+{
+  const int chunks = (n + DT_PIXELPIPE_CACHE_HALF_CHUNK - 1)/DT_PIXELPIPE_CACHE_HALF_CHUNK;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none) shared(out, in)
+#endif
+  for(int c=0; c<chunks; c++)
+  {
+    const size_t offset = (size_t)c*DT_PIXELPIPE_CACHE_HALF_CHUNK;
+    dt_float_to_half_buf(out + offset, in + offset, MIN(DT_PIXELPIPE_CACHE_HALF_CHUNK, n - offset));
+  }
+}
+
+static void
+_unpack_half(float *out, const uint16_t *in, const size_t n)
+{
+  const int chunks = (n + DT_PIXELPIPE_CACHE_HALF_CHUNK - 1)/DT_PIXELPIPE_CACHE_HALF_CHUNK;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none) shared(out, in)
+#endif
+  for(int c=0; c<chunks; c++)
+  {
+    const size_t offset = (size_t)c*DT_PIXELPIPE_CACHE_HALF_CHUNK;
+    dt_half_to_float_buf(out + offset, in + offset, MIN(DT_PIXELPIPE_CACHE_HALF_CHUNK, n - offset));
+  }
+}
+
+// converts a packed line back to float, in a new buffer. returns non zero if that failed.
+static int
+_unpack_line(dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  size_t class_size;
+  const size_t bytes = cache->packed[k];
+  void *buf = _pool_alloc(bytes, &class_size);
+  if(!buf) return 1;
+  _unpack_half((float *)buf, (const uint16_t *)cache->data[k], bytes/sizeof(float));
+  _pool_free(cache->data[k], cache->size[k]);
+  cache->data[k] = buf;
+  cache->size[k] = class_size;
+  cache->packed[k] = 0;
+  return 0;
+}
 
 int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, int size)
 {
@@ -38,51 +251,132 @@ int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, in
   cache->size = (size_t *)malloc(sizeof(size_t)*entries);
   cache->hash = (uint64_t *)malloc(sizeof(uint64_t)*entries);
   cache->used = (int32_t *)malloc(sizeof(int32_t)*entries);
+  cache->packed = (size_t *)calloc(entries, sizeof(size_t));
   memset(cache->data,0,sizeof(void *)*entries);
+  memset(cache->size,0,sizeof(size_t)*entries);
+#ifdef HAVE_OPENCL
+  cache->gpu_mem = (void **)malloc(sizeof(void *)*entries);
+  cache->gpu_devid = (int32_t *)malloc(sizeof(int32_t)*entries);
+  cache->gpu_only = (int32_t *)malloc(sizeof(int32_t)*entries);
+  memset(cache->gpu_mem,0,sizeof(void *)*entries);
+  for(int k=0; k<entries; k++) cache->gpu_devid[k] = -1;
+  memset(cache->gpu_only,0,sizeof(int32_t)*entries);
+  cache->gpu_enabled = 0;
+#endif
   for(int k=0; k<entries; k++)
   {
-    cache->data[k] = (void *)dt_alloc_align(16, size);
-    if(!cache->data[k])
-      goto alloc_memory_fail;
-    cache->size[k] = size;
+    // only the two ping-pong buffers every pipe needs are allocated up front,
+    // the others are taken from the pool as soon as they are needed, at the size
+    // they are needed at.
+    if(k < 2)
+    {
+      cache->data[k] = _pool_alloc(size, cache->size + k);
+      if(!cache->data[k])
+        goto alloc_memory_fail;
 #ifdef _DEBUG
-    memset(cache->data[k], 0x5d, size);
+      memset(cache->data[k], 0x5d, size);
 #endif
+    }
     cache->hash[k] = -1;
     cache->used[k] = 0;
   }
+  cache->scratch_entries = cache->use_scratch = 0;
+  cache->pack_half = 0;
   cache->queries = cache->misses = 0;
   return 1;
 
 alloc_memory_fail:
   for(int k=0; k<entries; k++)
-  {
-    if(cache->data[k])
-      free(cache->data[k]);
-  }
-
+    _pool_free(cache->data[k], cache->size[k]);
   free(cache->data);
   free(cache->size);
   free(cache->hash);
   free(cache->used);
-
+  free(cache->packed);
+#ifdef HAVE_OPENCL
+  free(cache->gpu_mem);
+  free(cache->gpu_devid);
+  free(cache->gpu_only);
+#endif
   return 0;
+}
 
+#ifdef HAVE_OPENCL
+static void
+_release_cl(dt_dev_pixelpipe_cache_t *cache, const int k)
+{
+  if(cache->gpu_mem[k]) dt_opencl_release_mem_object(cache->gpu_mem[k]);
+  cache->gpu_mem[k] = NULL;
+  cache->gpu_devid[k] = -1;
+  cache->gpu_only[k] = 0;
 }
+#endif
 
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache)
 {
-  for(int k=0; k<cache->entries; k++) free(cache->data[k]);
+#ifdef HAVE_OPENCL
+  for(int k=0; k<cache->entries; k++) _release_cl(cache, k);
+  free(cache->gpu_mem);
+  free(cache->gpu_devid);
+  free(cache->gpu_only);
+#endif
+  for(int k=0; k<cache->entries; k++) _pool_free(cache->data[k], cache->size[k]);
   free(cache->data);
   free(cache->hash);
   free(cache->used);
   free(cache->size);
+  free(cache->packed);
+}
+
+void dt_dev_pixelpipe_cache_synch_hash(dt_dev_pixelpipe_t *pipe)
+{
+  const int len = g_list_length(pipe->nodes) + 1;
+  if(len != pipe->prefix_hash_len)
+  {
+    free(pipe->prefix_hash);
+    pipe->prefix_hash = (uint64_t *)malloc(sizeof(uint64_t)*len);
+    pipe->prefix_hash_len = pipe->prefix_hash ? len : 0;
+    if(!pipe->prefix_hash) return;
+  }
+  // same as the loop in dt_dev_pixelpipe_cache_hash without the gui dependent parts:
+  uint64_t hash = 5381 + pipe->image.id;
+  pipe->prefix_hash[0] = hash;
+  int k = 1;
+  for(GList *pieces = pipe->nodes; pieces; pieces = g_list_next(pieces))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    hash = ((hash << 5) + hash) ^ piece->hash;
+    pipe->prefix_hash[k++] = hash;
+  }
+  pipe->prefix_hash_imgid = pipe->image.id;
+}
+
+void dt_dev_pixelpipe_cache_prepare_hash(dt_dev_pixelpipe_t *pipe)
+{
+  pipe->prefix_hash_static = 1;
+  for(GList *pieces = pipe->nodes; pieces; pieces = g_list_next(pieces))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    dt_develop_t *dev = piece->module->dev;
+    if(piece->module->request_color_pick ||
+        (dev->gui_module && (dev->gui_module->operation_tags_filter() & piece->module->operation_tags())))
+    {
+      pipe->prefix_hash_static = 0;
+      return;
+    }
+  }
 }
 
 uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const dt_iop_roi_t *roi, dt_dev_pixelpipe_t *pipe, int module)
 {
   // bernstein hash (djb2)
   uint64_t hash = 5381 + imgid;
+  // fast path, the prefix is already known:
+  if(pipe->prefix_hash_static && pipe->prefix_hash && imgid == pipe->prefix_hash_imgid)
+  {
+    hash = pipe->prefix_hash[CLAMPS(module, 0, pipe->prefix_hash_len - 1)];
+    module = 0;
+  }
   // go through all modules up to module and compute a weird hash using the operation and params.
   GList *pieces = pipe->nodes;
   for(int k=0; k<module&&pieces; k++)
@@ -111,13 +405,22 @@ uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const dt_iop_roi_t *roi, dt_dev_
   // also add scale, x and y:
   const char *str = (const char *)roi;
   for(size_t i=0; i<sizeof(dt_iop_roi_t); i++) hash = ((hash << 5) + hash) ^ str[i];
+  // the raw stages are stored as uint16 or float, and differ in rounding:
+  hash = ((hash << 5) + hash) ^ pipe->raw16;
   return hash;
 }
 
 int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash)
 {
   // search for hash in cache
-  for(int32_t k=0; k<cache->entries; k++) if(cache->hash[k] == hash) return 1;
+  for(int32_t k=0; k<cache->entries; k++)
+  {
+#ifdef HAVE_OPENCL
+    // only on the device, the caller wants the host buffer:
+    if(cache->gpu_only[k]) continue;
+#endif
+    if(cache->hash[k] == hash) return 1;
+  }
   return 0;
 }
 
@@ -135,12 +438,15 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
 {
   cache->queries ++;
   *data = NULL;
-  int max_used = -1, max = 0;
+  // lines to pick the victim from, scratch lines are kept for preliminary passes:
+  const int first = cache->use_scratch ? cache->entries - cache->scratch_entries : 0;
+  const int last  = cache->use_scratch ? cache->entries : cache->entries - cache->scratch_entries;
+  int max_used = -1, max = first, hit = -1;
   size_t sz = 0;
   for(int k=0; k<cache->entries; k++)
   {
     // search for hash in cache
-    if(cache->used[k] > max_used)
+    if(k >= first && k < last && cache->used[k] > max_used)
     {
       max_used = cache->used[k];
       max = k;
@@ -148,22 +454,37 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
     cache->used[k]++; // age all entries
     if(cache->hash[k] == hash)
     {
-      *data = cache->data[k];
-      sz = cache->size[k];
+      hit = k;
       cache->used[k] = weight; // this is the MRU entry
+#ifdef HAVE_OPENCL
+      // caller is going to fill the host buffer:
+      cache->gpu_only[k] = 0;
+#endif
     }
   }
+  // lines kept as half floats are expanded again on access. if that fails, this is a miss:
+  if(hit >= 0 && cache->packed[hit] && _unpack_line(cache, hit)) cache->hash[hit] = -1;
+  else if(hit >= 0)
+  {
+    *data = cache->data[hit];
+    sz = cache->size[hit];
+  }
 
   if(!*data || sz < size)
   {
     // kill LRU entry
     // printf("[pixelpipe_cache_get] hash not found, returning slot %d/%d age %d\n", max, cache->entries, weight);
+#ifdef HAVE_OPENCL
+    // before the buffer goes, the device copy might live in it:
+    _release_cl(cache, max);
+#endif
     if(cache->size[max] < size)
     {
-      free(cache->data[max]);
-      cache->data[max] = (void *)dt_alloc_align(16, size);
-      cache->size[max] = size;
+      // hand the old buffer to the pool, some other pipe might use it:
+      _pool_free(cache->data[max], cache->size[max]);
+      cache->data[max] = _pool_alloc(size, cache->size + max);
     }
+    cache->packed[max] = 0;
     *data = cache->data[max];
     cache->hash[max] = hash;
     cache->used[max] = weight;
@@ -179,6 +500,33 @@ void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache)
   {
     cache->hash[k] = -1;
     cache->used[k] = 0;
+#ifdef HAVE_OPENCL
+    _release_cl(cache, k);
+#endif
+  }
+}
+
+void dt_dev_pixelpipe_cache_pack(dt_dev_pixelpipe_cache_t *cache, void *data, const size_t size)
+{
+  if(!cache->pack_half || !data) return;
+  for(int k=0; k<cache->entries; k++)
+  {
+    if(cache->data[k] != data) continue;
+    // important lines are needed again soon, and invalid ones are not worth it:
+    if(cache->packed[k] || cache->used[k] < 0 || cache->hash[k] == (uint64_t)-1 || size > cache->size[k]) return;
+#ifdef HAVE_OPENCL
+    // the device copy is used together with the host buffer:
+    if(cache->gpu_mem[k]) return;
+#endif
+    size_t class_size;
+    void *buf = _pool_alloc(size/2, &class_size);
+    if(!buf) return;
+    _pack_half((uint16_t *)buf, (const float *)data, size/sizeof(float));
+    _pool_free(cache->data[k], cache->size[k]);
+    cache->data[k] = buf;
+    cache->size[k] = class_size;
+    cache->packed[k] = size;
+    return;
   }
 }
 
@@ -186,7 +534,7 @@ void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data
 {
   for(int k=0; k<cache->entries; k++)
   {
-    if(cache->data[k] == data)
+    if(cache->data[k] && cache->data[k] == data)
     {
       cache->used[k] = -cache->entries;
     }
@@ -197,22 +545,87 @@ void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *da
 {
   for(int k=0; k<cache->entries; k++)
   {
-    if(cache->data[k] == data)
+    if(cache->data[k] && cache->data[k] == data)
     {
+#ifdef HAVE_OPENCL
+      // the device still has the valid copy:
+      if(cache->gpu_mem[k])
+      {
+        cache->gpu_only[k] = 1;
+        continue;
+      }
+#endif
       cache->hash[k] = -1;
     }
   }
 }
 
+#ifdef HAVE_OPENCL
+void dt_dev_pixelpipe_cache_set_gpu(dt_dev_pixelpipe_cache_t *cache, const int enabled)
+{
+  if(!enabled && cache->gpu_enabled)
+  {
+    for(int k=0; k<cache->entries; k++)
+    {
+      if(cache->gpu_only[k]) cache->hash[k] = -1;
+      _release_cl(cache, k);
+    }
+  }
+  cache->gpu_enabled = enabled;
+}
+
+void *dt_dev_pixelpipe_cache_get_cl(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const int devid, void **data)
+{
+  if(!cache->gpu_enabled) return NULL;
+  int found = -1;
+  for(int k=0; k<cache->entries; k++)
+    if(cache->hash[k] == hash && cache->gpu_mem[k] && cache->gpu_devid[k] == devid) found = k;
+  if(found < 0) return NULL;
+  // same bookkeeping as a hit in dt_dev_pixelpipe_cache_get(), but leave the host state alone:
+  cache->queries++;
+  for(int k=0; k<cache->entries; k++) cache->used[k]++;
+  cache->used[found] = 0;
+  *data = cache->data[found];
+  return cache->gpu_mem[found];
+}
+
+void dt_dev_pixelpipe_cache_set_cl(dt_dev_pixelpipe_cache_t *cache, void *data, void *mem, const int devid)
+{
+  if(!cache->gpu_enabled || !mem) return;
+  for(int k=0; k<cache->entries; k++)
+  {
+    if(cache->data[k] && cache->data[k] == data && cache->hash[k] != (uint64_t)-1)
+    {
+      if(cache->gpu_mem[k] == mem) return;
+      const int gpu_only = cache->gpu_only[k];
+      _release_cl(cache, k);
+      dt_opencl_retain_mem_object(mem);
+      cache->gpu_mem[k] = mem;
+      cache->gpu_devid[k] = devid;
+      cache->gpu_only[k] = gpu_only;
+      return;
+    }
+  }
+}
+#endif
+
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache)
 {
   for(int k=0; k<cache->entries; k++)
   {
     printf("pixelpipe cacheline %d ", k);
     printf("used %d by %"PRIu64"", cache->used[k], cache->hash[k]);
+#ifdef HAVE_OPENCL
+    if(cache->gpu_mem[k]) printf(" on device %d%s", cache->gpu_devid[k], cache->gpu_only[k] ? " only" : "");
+#endif
+    if(cache->packed[k]) printf(" as half floats");
     printf("\n");
   }
   printf("cache hit rate so far: %.3f\n", (cache->queries - cache->misses)/(float)cache->queries);
+  dt_pthread_mutex_lock(&_pool.lock);
+  printf("pixelpipe cache pool: %zu of %zu MB held, %zu MB idle, %"PRIu64" buffers reused, %"PRIu64" allocated\n",
+         _pool.allocated >> 20, _pool.budget >> 20, _pool.free_bytes >> 20, _pool.reused, _pool.allocs);
+  dt_pthread_mutex_unlock(&_pool.lock);
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -32,8 +32,21 @@ typedef struct dt_dev_pixelpipe_cache_t
   size_t   *size;
   uint64_t *hash;
   int32_t  *used;
+  // the last scratch_entries lines are only used (and only evicted) while use_scratch is set,
+  // so preliminary low resolution passes don't push out the lines of the exact ones.
+  int32_t   scratch_entries;
+  int32_t   use_scratch;
+  // lines can be kept as half floats while they are not in use. packed holds the size
+  // of the float data for those, 0 otherwise.
+  size_t   *packed;
+  int32_t   pack_half;
 #ifdef HAVE_OPENCL
+  // cl_mem copies of cache lines, kept on the device they have been processed on.
+  // gpu_only is set if the host buffer of the line is not valid.
   void    **gpu_mem;
+  int32_t  *gpu_devid;
+  int32_t  *gpu_only;
+  int32_t   gpu_enabled;
 #endif
   // profiling:
   uint64_t queries;
@@ -41,7 +54,18 @@ typedef struct dt_dev_pixelpipe_cache_t
 }
 dt_dev_pixelpipe_cache_t;
 
+/** set up the buffer pool shared by all pixelpipe caches, budgeted by `cache_memory'. */
+void dt_dev_pixelpipe_cache_pool_init();
+void dt_dev_pixelpipe_cache_pool_cleanup();
+/** lowers the pool budget below `cache_memory' and frees unused buffers above it, 0 restores the configured budget. */
+void dt_dev_pixelpipe_cache_pool_set_budget(const size_t budget);
+/** the budget configured by `cache_memory'. */
+size_t dt_dev_pixelpipe_cache_pool_get_budget();
+/** bytes currently held by all pixelpipe caches, used and free. */
+size_t dt_dev_pixelpipe_cache_pool_allocated();
+
 /** constructs a new cache with given cache line count (entries) and float buffer entry size in bytes.
+  * only the first two lines are allocated up front, the others are drawn from the pool on demand.
 	\param[out] returns 0 if fail to allocate mem cache.
 */
 int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, int size);
@@ -51,6 +75,11 @@ struct dt_iop_roi_t;
 /** creates a hopefully unique hash from the complete module stack up to the module-th. */
 uint64_t dt_dev_pixelpipe_cache_hash(int imgid, const struct dt_iop_roi_t *roi, struct dt_dev_pixelpipe_t *pipe, int module);
 
+/** recomputes the per piece prefix hashes after params changed in synch. */
+void dt_dev_pixelpipe_cache_synch_hash(struct dt_dev_pixelpipe_t *pipe);
+/** called once per pipe run, checks whether the prefix hashes can be used or the gui state (color
+  * pickers, focused module filtering others out) requires going through the whole stack for every hash. */
+void dt_dev_pixelpipe_cache_prepare_hash(struct dt_dev_pixelpipe_t *pipe);
 /** returns the float data buffer for the given hash from the cache. if the hash does not match any
   * cache line, the least recently used cache line will be cleared and an empty buffer is returned
   * together with a non-zero return value. */
@@ -67,9 +96,23 @@ void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache);
 /** makes this buffer very important after it has been pulled from the cache. */
 void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data);
 
+/** converts the cache line holding the given float buffer of size bytes to half floats, if pack_half
+  * is set. the buffer pointer is invalid afterwards, the next get() of the line expands it again. */
+void dt_dev_pixelpipe_cache_pack(dt_dev_pixelpipe_cache_t *cache, void *data, const size_t size);
+
 /** mark the given cache line pointer as invalid. */
 void dt_dev_pixelpipe_cache_invalidate(dt_dev_pixelpipe_cache_t *cache, void *data);
 
+#ifdef HAVE_OPENCL
+/** enables or disables keeping cache lines on the device. disabling drops all device copies. */
+void dt_dev_pixelpipe_cache_set_gpu(dt_dev_pixelpipe_cache_t *cache, const int enabled);
+/** returns the device copy of the cache line with given hash, if it lives on devid, and the
+  * (possibly invalid) host buffer in data. the cache keeps its own reference of the returned cl_mem. */
+void *dt_dev_pixelpipe_cache_get_cl(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash, const int devid, void **data);
+/** attaches the cl_mem as device copy to the cache line with host buffer data, retaining it. */
+void dt_dev_pixelpipe_cache_set_cl(dt_dev_pixelpipe_cache_t *cache, void *data, void *mem, const int devid);
+#endif
+
 /** print out cache lines/hashes (debug). */
 void dt_dev_pixelpipe_cache_print(dt_dev_pixelpipe_cache_t *cache);
 
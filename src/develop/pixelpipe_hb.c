@@ -18,12 +18,18 @@
 */
 #include "develop/pixelpipe.h"
 #include "develop/blend.h"
+#include "develop/masks.h"
 #include "develop/tiling.h"
 #include "gui/gtk.h"
 #include "control/control.h"
 #include "control/signal.h"
 #include "common/opencl.h"
+#include "common/opencl_placement.h"
+#include "common/trace.h"
+#include "common/histogram.h"
 #include "common/imageio.h"
+#include "common/interpolation.h"
+#include "common/numa.h"
 #include "libs/lib.h"
 #include "libs/colorpicker.h"
 #include "iop/colorout.h"
@@ -34,9 +40,18 @@
 #include <stdlib.h>
 #include <math.h>
 #include <unistd.h>
+#include <xmmintrin.h>
 
 // this is to ensure compatibility with pixelpipe_gegl.c, which does not need to build the other module:
 #include "develop/pixelpipe_cache.c"
+#include "develop/pixelpipe_arena.c"
+#include "develop/pixelpipe_blur.c"
+
+// number of pixels per block when running fused per pixel modules, 64k of float4
+#define DT_DEV_PIXELPIPE_FUSED_BLOCK 4096
+// most distorting modules resampled in one pass, and where the pixels go which leave the image on the way.
+#define DT_DEV_PIXELPIPE_WARP_MAX 8
+#define DT_DEV_PIXELPIPE_WARP_OUTSIDE -1.0e6f
 
 #define max(a,b) ((a) > (b) ? (a) : (b))
 
@@ -64,6 +79,15 @@ static char *_pipe_type_to_str(int pipe_type)
   return r;
 }
 
+static void _pixelpipe_trace(const dt_dev_pixelpipe_t *pipe, const char *name, const dt_times_t *start,
+                             const dt_iop_roi_t *roi)
+{
+  if(!dt_trace_enabled()) return;
+  char args[256];
+  dt_trace_roi_args(args, sizeof(args), _pipe_type_to_str(pipe->type), roi);
+  dt_trace_complete("pixelpipe", name, start->clock, args);
+}
+
 int dt_dev_pixelpipe_init_export(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height, int levels)
 {
   int res = dt_dev_pixelpipe_init_cached(pipe, 4*sizeof(float)*width*height, 2);
@@ -72,6 +96,29 @@ int dt_dev_pixelpipe_init_export(dt_dev_pixelpipe_t *pipe, int32_t width, int32_
   return res;
 }
 
+void dt_dev_pixelpipe_reset_export(dt_dev_pixelpipe_t *pipe, int levels)
+{
+  g_assert(pipe->nodes == NULL);
+  // the lines stay allocated, only their contents are gone:
+  dt_dev_pixelpipe_cache_flush(&(pipe->cache));
+  pipe->devid = -1;
+  pipe->changed = DT_DEV_PIPE_UNCHANGED;
+  pipe->processed_width  = pipe->backbuf_width  = pipe->iwidth = 0;
+  pipe->processed_height = pipe->backbuf_height = pipe->iheight = 0;
+  pipe->backbuf = NULL;
+  pipe->processing = 0;
+  pipe->shutdown = 0;
+  pipe->job = NULL;
+  pipe->opencl_error = 0;
+  pipe->tiling = 0;
+  pipe->mask_display = 0;
+  pipe->input_timestamp = 0;
+  pipe->prefix_hash_imgid = -1;
+  pipe->prefix_hash_static = 0;
+  pipe->levels = levels;
+  pipe->pack_ui16 = pipe->output_packed = 0;
+}
+
 int dt_dev_pixelpipe_init_thumbnail(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height)
 {
   int res = dt_dev_pixelpipe_init_cached(pipe, 4*sizeof(float)*width*height, 2);
@@ -88,7 +135,9 @@ int dt_dev_pixelpipe_init_preview(dt_dev_pixelpipe_t *pipe)
 
 int dt_dev_pixelpipe_init(dt_dev_pixelpipe_t *pipe)
 {
-  int res = dt_dev_pixelpipe_init_cached(pipe, 4*sizeof(float)*darktable.thumbnail_width*darktable.thumbnail_height, 5);
+  // two more lines for the preliminary passes of progressive rendering:
+  int res = dt_dev_pixelpipe_init_cached(pipe, 4*sizeof(float)*darktable.thumbnail_width*darktable.thumbnail_height, 5+2);
+  pipe->cache.scratch_entries = 2;
   pipe->type = DT_DEV_PIXELPIPE_FULL;
   return res;
 }
@@ -96,22 +145,35 @@ int dt_dev_pixelpipe_init(dt_dev_pixelpipe_t *pipe)
 int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, int32_t size, int32_t entries)
 {
   pipe->devid = -1;
+  pipe->numa_node = dt_numa_node();
+  pipe->raw16 = 0;
+  pipe->picker_cl_num = 0;
   pipe->changed = DT_DEV_PIPE_UNCHANGED;
   pipe->processed_width  = pipe->backbuf_width  = pipe->iwidth = 0;
   pipe->processed_height = pipe->backbuf_height = pipe->iheight = 0;
   pipe->nodes = NULL;
   pipe->backbuf_size = size;
+  pipe->preliminary_scale = pipe->backbuf_upscale = 1.0f;
   if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size))
     return 0;
   pipe->cache_obsolete = 0;
+  dt_dev_pixelpipe_arena_init(&pipe->arena);
+  dt_dev_pixelpipe_blur_init(&pipe->blur);
   pipe->backbuf = NULL;
   pipe->processing = 0;
   pipe->shutdown = 0;
+  pipe->job = NULL;
   pipe->opencl_error = 0;
+  pipe->cl_mem_ahead = pipe->cl_ahead_host = NULL;
   pipe->tiling = 0;
   pipe->mask_display = 0;
   pipe->input_timestamp = 0;
   pipe->levels = IMAGEIO_RGB | IMAGEIO_INT8;
+  pipe->pack_ui16 = pipe->output_packed = 0;
+  pipe->prefix_hash = NULL;
+  pipe->prefix_hash_len = 0;
+  pipe->prefix_hash_imgid = -1;
+  pipe->prefix_hash_static = 0;
   dt_pthread_mutex_init(&(pipe->backbuf_mutex), NULL);
   dt_pthread_mutex_init(&(pipe->busy_mutex), NULL);
   return 1;
@@ -124,9 +186,71 @@ void dt_dev_pixelpipe_set_input(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, flo
   pipe->iflipped = 0;
   pipe->iscale = iscale;
   pipe->input = input;
+  pipe->pyramid = NULL;
   pipe->image = dev->image_storage;
 }
 
+void dt_dev_pixelpipe_set_input_pyramid(dt_dev_pixelpipe_t *pipe, const dt_dev_pixelpipe_pyramid_t *pyramid)
+{
+  pipe->pyramid = pyramid;
+}
+
+void dt_dev_pixelpipe_pyramid_cleanup(dt_dev_pixelpipe_pyramid_t *pyramid)
+{
+  for(int k=0; k<pyramid->levels; k++) free(pyramid->buf[k]);
+  memset(pyramid, 0, sizeof(*pyramid));
+}
+
+// box filter 2x2 blocks of four channel pixels, drops the last row/column of odd sizes.
+static void
+_pyramid_halve(float *out, const float *const in, const int width, const int height)
+{
+  const int wd = width/2, ht = height/2;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static)
+#endif
+  for(int j=0; j<ht; j++)
+  {
+    const float *in0 = in + (size_t)4*width*2*j;
+    const float *in1 = in0 + (size_t)4*width;
+    float *o = out + (size_t)4*wd*j;
+    for(int i=0; i<wd; i++, in0+=8, in1+=8, o+=4)
+    {
+      const __m128 sum = _mm_add_ps(_mm_add_ps(_mm_load_ps(in0), _mm_load_ps(in0+4)),
+                                    _mm_add_ps(_mm_load_ps(in1), _mm_load_ps(in1+4)));
+      _mm_store_ps(o, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+    }
+  }
+}
+
+int dt_dev_pixelpipe_pyramid_update(dt_dev_pixelpipe_pyramid_t *pyramid, const float *input, const int width, const int height, const int min_size)
+{
+  if(pyramid->input == input && pyramid->iwidth == width && pyramid->iheight == height) return 0;
+  dt_dev_pixelpipe_pyramid_cleanup(pyramid);
+  const float *in = input;
+  int wd = width, ht = height;
+  while(pyramid->levels < DT_DEV_PIXELPIPE_PYRAMID_LEVELS && wd/2 >= min_size && ht/2 >= min_size)
+  {
+    const int k = pyramid->levels;
+    float *buf = (float *)dt_alloc_align(16, sizeof(float)*4*(wd/2)*(ht/2));
+    if(!buf)
+    {
+      dt_dev_pixelpipe_pyramid_cleanup(pyramid);
+      return 1;
+    }
+    _pyramid_halve(buf, in, wd, ht);
+    pyramid->buf[k] = buf;
+    pyramid->width[k]  = wd = wd/2;
+    pyramid->height[k] = ht = ht/2;
+    pyramid->levels++;
+    in = buf;
+  }
+  pyramid->input = input;
+  pyramid->iwidth = width;
+  pyramid->iheight = height;
+  return 0;
+}
+
 void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
 {
   dt_pthread_mutex_lock(&pipe->backbuf_mutex);
@@ -135,6 +259,8 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
   dt_dev_pixelpipe_cleanup_nodes(pipe);
   // so now it's safe to clean up cache:
   dt_dev_pixelpipe_cache_cleanup(&(pipe->cache));
+  dt_dev_pixelpipe_arena_cleanup(&pipe->arena);
+  dt_dev_pixelpipe_blur_cleanup(&pipe->blur);
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
   dt_pthread_mutex_destroy(&(pipe->backbuf_mutex));
   dt_pthread_mutex_destroy(&(pipe->busy_mutex));
@@ -159,6 +285,9 @@ void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe)
   }
   g_list_free(pipe->nodes);
   pipe->nodes = NULL;
+  free(pipe->prefix_hash);
+  pipe->prefix_hash = NULL;
+  pipe->prefix_hash_len = 0;
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
@@ -185,6 +314,9 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
       piece->data = NULL;
       piece->hash = 0;
       piece->process_cl_ready = 0;
+      piece->process_raw16 = 0;
+      piece->synch_hash = 0;
+      piece->input_hash = 0;
       dt_iop_init_pipe(piece->module, pipe,piece);
       pipe->nodes = g_list_append(pipe->nodes, piece);
     }
@@ -193,10 +325,65 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
+// everything about the pipe commit_params may depend on, besides the params:
+static uint64_t
+_synch_pipe_hash(dt_dev_pixelpipe_t *pipe)
+{
+  uint64_t hash = 5381 + pipe->image.id;
+  const int32_t state[] = { pipe->image.flags, pipe->iwidth, pipe->iheight, pipe->type,
+                            dt_dev_pixelpipe_uses_downsampled_input(pipe), dt_dev_pixelpipe_fast_thumbnail(pipe) };
+  const char *str = (const char *)state;
+  for(size_t i=0; i<sizeof(state); i++) hash = ((hash << 5) + hash) ^ str[i];
+  str = (const char *)&pipe->iscale;
+  for(size_t i=0; i<sizeof(float); i++) hash = ((hash << 5) + hash) ^ str[i];
+  return hash;
+}
+
+// what a piece is committed with: if this didn't change, neither did the piece.
+static uint64_t
+_synch_hash(uint64_t hash, dt_iop_module_t *module, const int enabled, const dt_iop_params_t *params,
+            const dt_develop_blend_params_t *blend_params)
+{
+  hash = ((hash << 5) + hash) ^ enabled;
+  const char *str = (const char *)params;
+  for(int i=0; i<module->params_size; i++) hash = ((hash << 5) + hash) ^ str[i];
+  str = (const char *)blend_params;
+  for(size_t i=0; i<sizeof(dt_develop_blend_params_t); i++) hash = ((hash << 5) + hash) ^ str[i];
+  // the shapes of the mask are not part of the params:
+  dt_masks_form_t *grp = dt_masks_get_from_id(darktable.develop, blend_params->mask_id);
+  const int length = dt_masks_group_get_hash_buffer_length(grp);
+  if(length > 0)
+  {
+    char *buf = malloc(length);
+    dt_masks_group_get_hash_buffer(grp, buf);
+    for(int i=0; i<length; i++) hash = ((hash << 5) + hash) ^ buf[i];
+    free(buf);
+  }
+  // 0 means not committed:
+  return hash ? hash : 1;
+}
+
+static void
+_synch_piece(dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece, const uint64_t pipe_hash, const int enabled,
+             dt_iop_params_t *params, dt_develop_blend_params_t *blend_params)
+{
+  const uint64_t hash = _synch_hash(pipe_hash, piece->module, enabled, params, blend_params);
+  if(hash == piece->synch_hash)
+  {
+    // unchanged. commit_params would have left the blend params in the module, though:
+    if(piece->enabled) memcpy(piece->module->blend_params, blend_params, sizeof(dt_develop_blend_params_t));
+    return;
+  }
+  piece->enabled = enabled;
+  dt_iop_commit_params(piece->module, params, blend_params, pipe, piece);
+  piece->synch_hash = hash;
+}
+
 // helper
 void dt_dev_pixelpipe_synch(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, GList *history)
 {
   dt_dev_history_item_t *hist = (dt_dev_history_item_t *)history->data;
+  const uint64_t pipe_hash = _synch_pipe_hash(pipe);
   // find piece in nodes list
   GList *nodes = pipe->nodes;
   dt_dev_pixelpipe_iop_t *piece = NULL;
@@ -204,10 +391,7 @@ void dt_dev_pixelpipe_synch(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, GList *
   {
     piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
     if(piece->module == hist->module)
-    {
-      piece->enabled = hist->enabled;
-      dt_iop_commit_params(hist->module, hist->params, hist->blend_params, pipe, piece);
-    }
+      _synch_piece(pipe, piece, pipe_hash, hist->enabled, hist->params, hist->blend_params);
     nodes = g_list_next(nodes);
   }
 }
@@ -215,23 +399,31 @@ void dt_dev_pixelpipe_synch(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, GList *
 void dt_dev_pixelpipe_synch_all(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
 {
   dt_pthread_mutex_lock(&pipe->busy_mutex);
-  // call reset_params on all pieces first.
-  GList *nodes = pipe->nodes;
-  while(nodes)
-  {
-    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
-    piece->hash = 0;
-    piece->enabled = piece->module->default_enabled;
-    dt_iop_commit_params(piece->module, piece->module->default_params, piece->module->default_blendop_params, pipe, piece);
-    nodes = g_list_next(nodes);
-  }
-  // go through all history items and adjust params
+  // the last history item of every module is what its piece has to be committed with:
+  GHashTable *last = g_hash_table_new(g_direct_hash, g_direct_equal);
   GList *history = dev->history;
   for(int k=0; k<dev->history_end && history; k++)
   {
-    dt_dev_pixelpipe_synch(pipe, dev, history);
+    dt_dev_history_item_t *hist = (dt_dev_history_item_t *)history->data;
+    g_hash_table_insert(last, hist->module, hist);
     history = g_list_next(history);
   }
+  // ... compare that to what was committed before, and only commit the pieces which changed.
+  // a forced reprocessing (profiles, preferences) commits everything.
+  const uint64_t pipe_hash = _synch_pipe_hash(pipe);
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(pipe->cache_obsolete) piece->synch_hash = 0;
+    dt_dev_history_item_t *hist = (dt_dev_history_item_t *)g_hash_table_lookup(last, piece->module);
+    if(hist)
+      _synch_piece(pipe, piece, pipe_hash, hist->enabled, hist->params, hist->blend_params);
+    else
+      _synch_piece(pipe, piece, pipe_hash, piece->module->default_enabled, piece->module->default_params,
+                   piece->module->default_blendop_params);
+  }
+  g_hash_table_destroy(last);
+  dt_dev_pixelpipe_cache_synch_hash(pipe);
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
@@ -240,6 +432,7 @@ void dt_dev_pixelpipe_synch_top(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
   dt_pthread_mutex_lock(&pipe->busy_mutex);
   GList *history = g_list_nth(dev->history, dev->history_end - 1);
   if(history) dt_dev_pixelpipe_synch(pipe, dev, history);
+  dt_dev_pixelpipe_cache_synch_hash(pipe);
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
@@ -278,6 +471,28 @@ void dt_dev_pixelpipe_remove_node(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, i
 {
 }
 
+// the mosaic can stay uint16 up to demosaic if the white balance converts it and everything
+// running on it until then can handle it. the device path always runs on floats.
+static int
+_pixelpipe_raw16(dt_dev_pixelpipe_t *pipe)
+{
+  if(pipe->devid >= 0 || !pipe->image.filters || pipe->image.bpp != sizeof(uint16_t) ||
+     !(pipe->image.flags & DT_IMAGE_RAW) || dt_dev_pixelpipe_uses_downsampled_input(pipe) ||
+     !dt_conf_get_bool("pixelpipe_raw16"))
+    return 0;
+  int first = 1;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(!piece->enabled) continue;
+    if(!piece->process_raw16) return 0;
+    if(first && strcmp(piece->module->op, "temperature")) return 0;
+    first = 0;
+    if(!strcmp(piece->module->op, "demosaic")) return 1;
+  }
+  return 0;
+}
+
 static int
 get_output_bpp(dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece, dt_develop_t *dev)
 {
@@ -297,289 +512,938 @@ static void
 histogram_collect(dt_iop_module_t *module, const float *pixel, const dt_iop_roi_t *roi,
                   float **histogram, float *histogram_max)
 {
-  if(*histogram == NULL) *histogram = malloc(64*4*sizeof(float));
+  if(*histogram == NULL) *histogram = malloc(4*DT_HISTOGRAM_BINS*sizeof(float));
 
   if(*histogram == NULL) return;
 
   const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(module);
+  const int stride = dt_histogram_stride(cst, roi->width, roi->height);
+  dt_histogram_collect(cst, pixel, roi->width, roi->height, stride, *histogram, histogram_max);
+}
+
+#ifdef HAVE_OPENCL
+// helper to get per module histogram for OpenCL. the bins are counted on the device.
+static void
+histogram_collect_cl(int devid, dt_iop_module_t *module, cl_mem img, const dt_iop_roi_t *roi,
+                     float **histogram, float *histogram_max)
+{
+  if(*histogram == NULL) *histogram = malloc(4*DT_HISTOGRAM_BINS*sizeof(float));
+  if(*histogram == NULL) return;
+
+  const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(module);
+  const int stride = dt_histogram_stride(cst, roi->width, roi->height);
+  cl_int err = dt_histogram_collect_cl(devid, cst, img, roi->width, roi->height, stride, *histogram, histogram_max);
+  if(err != CL_SUCCESS)
+    dt_print(DT_DEBUG_OPENCL, "[histogram_collect_cl] couldn't collect histogram for module '%s': %d\n", module->op, err);
+}
+#endif
 
-  float *hist = *histogram;
+// the bins of the scopes, at the size the histogram widget asked for. returns FALSE if there are none.
+static int
+scopes_alloc(dt_develop_t *dev)
+{
+  const int wd = dev->histogram_waveform_width, ht = dev->histogram_waveform_height;
+  if(wd == 0 || ht == 0) return FALSE;
+  if(dev->histogram_waveform == NULL) dev->histogram_waveform = malloc(sizeof(uint32_t)*3*wd*ht);
+  if(dev->histogram_vectorscope == NULL) dev->histogram_vectorscope = malloc(sizeof(uint32_t)*MIN(wd, ht)*MIN(wd, ht));
+  return dev->histogram_waveform && dev->histogram_vectorscope;
+}
 
-  histogram_max[0] = histogram_max[1] = histogram_max[2] = histogram_max[3] = 0;
-  memset (hist, 0, 64*4*sizeof(float));
+// helper to get the waveform and the vectorscope of the preview, from the float input of gamma.
+static void
+scopes_collect(dt_develop_t *dev, const float *pixel, const dt_iop_roi_t *roi)
+{
+  dev->histogram_scope_weight = 0.0f;
+  if(!scopes_alloc(dev)) return;
+  const int stride = dt_histogram_scope_stride(roi->width, roi->height);
+  dt_histogram_scopes_collect(pixel, roi->width, roi->height, stride, dev->histogram_waveform,
+                              dev->histogram_vectorscope, dev->histogram_waveform_width,
+                              dev->histogram_waveform_height);
+  dev->histogram_scope_weight = stride*stride;
+}
 
-  switch(cst)
-  {
-    case iop_cs_RAW:
-      for(int j=0; j<roi->height; j+=3) for(int i=0; i<roi->width; i+=3)  // sample one out of 9 pixels, un-locked with bayer pattern
-        {
-          uint8_t V = CLAMP(64.0f*pixel[4*(j*roi->width+i)], 0, 63);
-          hist[4*V] ++;
-        }
-      for(int k=0; k<4*64; k+=4) histogram_max[0] = histogram_max[0] > hist[k] ? histogram_max[0] : hist[k];
-      break;
+#ifdef HAVE_OPENCL
+// same for an input on the device, only the bins come back.
+static void
+scopes_collect_cl(dt_develop_t *dev, int devid, cl_mem img, const dt_iop_roi_t *roi)
+{
+  dev->histogram_scope_weight = 0.0f;
+  if(!scopes_alloc(dev)) return;
+  float weight = 0.0f;
+  cl_int err = dt_histogram_scopes_collect_cl(devid, img, roi->width, roi->height, dev->histogram_waveform,
+                                              dev->histogram_vectorscope, dev->histogram_waveform_width,
+                                              dev->histogram_waveform_height, &weight);
+  if(err != CL_SUCCESS)
+    dt_print(DT_DEBUG_OPENCL, "[scopes_collect_cl] couldn't collect the scopes: %d\n", err);
+  else
+    dev->histogram_scope_weight = weight;
+}
+#endif
 
-    case iop_cs_rgb:
-      for(int j=0; j<roi->height; j+=4) for(int i=0; i<roi->width; i+=4)  // sample one out of 16 pixels
-        {
-          float Rv = pixel[4*(j*roi->width+i)];
-          float Gv = pixel[4*(j*roi->width+i)+1];
-          float Bv = pixel[4*(j*roi->width+i)+2];
-          float gv = fmaxf(Rv, fmaxf(Gv, Bv));
-          uint8_t R = CLAMP(64.0f*Rv, 0, 63);
-          uint8_t G = CLAMP(64.0f*Gv, 0, 63);
-          uint8_t B = CLAMP(64.0f*Bv, 0, 63);
-          uint8_t g = CLAMP(64.0f*gv, 0, 63);
-          hist[4*R] ++;
-          hist[4*G + 1] ++;
-          hist[4*B + 2] ++;
-          hist[4*g + 3] ++;
-        }
-      // don't count <= 0 pixels
-      for(int k=4; k<4*64; k+=4) histogram_max[0] = histogram_max[0] > hist[k] ? histogram_max[0] : hist[k];
-      for(int k=5; k<4*64; k+=4) histogram_max[1] = histogram_max[1] > hist[k] ? histogram_max[1] : hist[k];
-      for(int k=6; k<4*64; k+=4) histogram_max[2] = histogram_max[2] > hist[k] ? histogram_max[2] : hist[k];
-      for(int k=7; k<4*64; k+=4) histogram_max[3] = histogram_max[3] > hist[k] ? histogram_max[3] : hist[k];
-      break;
+// helper for color picking
+static void
+pixelpipe_picker(dt_iop_module_t *module, const float *img, const dt_iop_roi_t *roi,
+                 float *picked_color, float *picked_color_min, float *picked_color_max)
+{
+  int box[4];
+  int point[2];
+  float Lab[3];
 
-    case iop_cs_Lab:
-    default:
-      for(int j=0; j<roi->height; j+=4) for(int i=0; i<roi->width; i+=4)   // sample one out of 16 pixels
-        {
-          uint8_t L = CLAMP(64.0f/100.0f*(pixel[4*(j*roi->width+i)]), 0, 63);
-          uint8_t a = CLAMP(64.0f/256.0f*(pixel[4*(j*roi->width+i)+1]+128.0f), 0, 63);
-          uint8_t b = CLAMP(64.0f/256.0f*(pixel[4*(j*roi->width+i)+2]+128.0f), 0, 63);
-          hist[4*L] ++;
-          hist[4*a + 1] ++;
-          hist[4*b + 2] ++;
-        }
-      // don't count <= 0 pixels in L
-      for(int k=4; k<4*64; k+=4) histogram_max[0] = histogram_max[0] > hist[k] ? histogram_max[0] : hist[k];
+  for(int k=0; k<3; k++) picked_color_min[k] =  666.0f;
+  for(int k=0; k<3; k++) picked_color_max[k] = -666.0f;
+  for(int k=0; k<3; k++) Lab[k] = picked_color[k] = 0.0f;
 
-      // don't count <= -128 and >= +128 pixels in a and b
-      for(int k=5; k<4*63; k+=4) histogram_max[1] = histogram_max[1] > hist[k] ? histogram_max[1] : hist[k];
-      for(int k=6; k<4*63; k+=4) histogram_max[2] = histogram_max[2] > hist[k] ? histogram_max[2] : hist[k];
-      break;
+  // do not continue if one of the point coordinates is set to a negative value indicating a not yet defined position
+  if(module->color_picker_point[0] < 0 || module->color_picker_point[1] < 0) return;
+
+  // Initializing bounds of colorpicker box
+  for(int k=0; k<4; k+=2) box[k] = MIN(roi->width -1, MAX(0, module->color_picker_box[k]*roi->width));
+  for(int k=1; k<4; k+=2) box[k] = MIN(roi->height-1, MAX(0, module->color_picker_box[k]*roi->height));
+
+  // Initializing bounds of colorpicker point
+  point[0] = MIN(roi->width - 1, MAX(0, module->color_picker_point[0] * roi->width));
+  point[1] = MIN(roi->height - 1, MAX(0, module->color_picker_point[1] * roi->height));
+
+  if(darktable.lib->proxy.colorpicker.size)
+  {
+    const float w = 1.0/((box[3]-box[1]+1)*(box[2]-box[0]+1));
+    for(int j=box[1]; j<=box[3]; j++) for(int i=box[0]; i<=box[2]; i++)
+      {
+        const float L = img[4*(roi->width*j + i) + 0];
+        const float a = img[4*(roi->width*j + i) + 1];
+        const float b = img[4*(roi->width*j + i) + 2];
+        Lab[0] += w*L;
+        Lab[1] += w*a;
+        Lab[2] += w*b;
+        picked_color_min[0] = fminf(picked_color_min[0], L);
+        picked_color_min[1] = fminf(picked_color_min[1], a);
+        picked_color_min[2] = fminf(picked_color_min[2], b);
+        picked_color_max[0] = fmaxf(picked_color_max[0], L);
+        picked_color_max[1] = fmaxf(picked_color_max[1], a);
+        picked_color_max[2] = fmaxf(picked_color_max[2], b);
+        for(int k=0; k<3; k++) picked_color[k] = Lab[k];
+      }
+  }
+  else
+  {
+    for(int i = 0; i < 3; i++)
+      picked_color[i]
+      = picked_color_min[i]
+        = picked_color_max[i]
+          = img[4*(roi->width*point[1] + point[0]) + i];
   }
 }
 
+
 #ifdef HAVE_OPENCL
-// helper to get per module histogram for OpenCL
-//
-// this algorithm is inefficient as hell when it comes to larger images. it's only acceptable
-// as long as we work on small image sizes like in image preview
+// opencl version of the color picker: the box is reduced on the device and only the
+// result is read back, without blocking. see _pixelpipe_picker_cl_finish().
 static void
-histogram_collect_cl(int devid, dt_iop_module_t *module, cl_mem img, const dt_iop_roi_t *roi,
-                     float **histogram, float *histogram_max)
+pixelpipe_picker_cl(dt_dev_pixelpipe_t *pipe, dt_iop_module_t *module, cl_mem img, const dt_iop_roi_t *roi,
+                    float *picked_color, float *picked_color_min, float *picked_color_max)
 {
-  if(*histogram == NULL) *histogram = malloc(64*4*sizeof(float));
-  if(*histogram == NULL) return;
+  int box[4];
 
-  float *pixel = dt_alloc_align(64, roi->width*roi->height*4*sizeof(float));
-  if(pixel == NULL) return;
+  // do not continue if one of the point coordinates is set to a negative value indicating a not yet defined position
+  if(module->color_picker_point[0] < 0 || module->color_picker_point[1] < 0 ||
+     pipe->picker_cl_num >= DT_DEV_PIXELPIPE_MAX_PICKERS_CL)
+    goto error;
 
-  cl_int err = dt_opencl_copy_device_to_host(devid, pixel, img, roi->width, roi->height, 4*sizeof(float));
-  if(err != CL_SUCCESS)
+  if(darktable.lib->proxy.colorpicker.size)
   {
-    free(pixel);
-    return;
+    for(int k=0; k<4; k+=2) box[k] = MIN(roi->width -1, MAX(0, module->color_picker_box[k]*roi->width));
+    for(int k=1; k<4; k+=2) box[k] = MIN(roi->height-1, MAX(0, module->color_picker_box[k]*roi->height));
+  }
+  else
+  {
+    box[0] = box[2] = MIN(roi->width - 1, MAX(0, module->color_picker_point[0] * roi->width));
+    box[1] = box[3] = MIN(roi->height - 1, MAX(0, module->color_picker_point[1] * roi->height));
   }
 
-  const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(module);
+  dt_dev_pixelpipe_picker_cl_t *p = pipe->picker_cl + pipe->picker_cl_num;
+  cl_int err = dt_histogram_picker_cl(pipe->devid, img, box[0], box[1], box[2] - box[0] + 1, box[3] - box[1] + 1,
+                                      p->result);
+  if(err != CL_SUCCESS) goto error;
+  p->module = module;
+  p->picked_color = picked_color;
+  p->picked_color_min = picked_color_min;
+  p->picked_color_max = picked_color_max;
+  pipe->picker_cl_num++;
+  return;
+
+error:
+  for(int k=0; k<3; k++) picked_color_min[k] =  666.0f;
+  for(int k=0; k<3; k++) picked_color_max[k] = -666.0f;
+  for(int k=0; k<3; k++) picked_color[k] = 0.0f;
+}
 
-  float *hist = *histogram;
+// waits for the color pickers of this run and hands the results to the modules.
+static void
+_pixelpipe_picker_cl_finish(dt_dev_pixelpipe_t *pipe, const int valid)
+{
+  if(!pipe->picker_cl_num) return;
+  // also required if the run failed, the results are written into the pipe:
+  const int ok = dt_opencl_finish(pipe->devid) && valid;
+  for(int i=0; i<pipe->picker_cl_num; i++)
+  {
+    const dt_dev_pixelpipe_picker_cl_t *p = pipe->picker_cl + i;
+    if(!ok) continue;
+    for(int k=0; k<3; k++)
+    {
+      p->picked_color[k]     = p->result[k];
+      p->picked_color_min[k] = p->result[4 + k];
+      p->picked_color_max[k] = p->result[8 + k];
+    }
+    if(p->module->widget) dt_control_queue_redraw_widget(p->module->widget);
+  }
+  pipe->picker_cl_num = 0;
+}
 
-  histogram_max[0] = histogram_max[1] = histogram_max[2] = histogram_max[3] = 0;
-  memset (hist, 0, 64*4*sizeof(float));
+// drops an upload started ahead which no module took over.
+static void
+_pixelpipe_drop_ahead(dt_dev_pixelpipe_t *pipe)
+{
+  if(pipe->cl_mem_ahead) dt_opencl_release_mem_object(pipe->cl_mem_ahead);
+  pipe->cl_mem_ahead = pipe->cl_ahead_host = NULL;
+}
 
+// true if the next enabled module after pieces will probably take the opencl path. same checks as the
+// pixelpipe does before process_cl, short of the memory needed, which depends on its roi. roi is the
+// output of pieces, its size stands in for the one of the next module.
+static int
+_pixelpipe_next_uses_cl(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, GList *pieces, const dt_iop_roi_t *roi)
+{
+  for(GList *nodes = g_list_next(pieces); nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    dt_iop_module_t *module = piece->module;
+    if(!piece->enabled || (dev->gui_module && dev->gui_module->operation_tags_filter() & module->operation_tags()))
+      continue;
+    return module->process_cl && piece->process_cl_ready
+           && !((pipe->type == DT_DEV_PIXELPIPE_PREVIEW) && (module->flags() & IOP_FLAGS_PREVIEW_NON_OPENCL))
+           && dt_opencl_programs_ready(pipe->devid, module->so->cl_programs)
+           && dt_opencl_placement_use_cl(pipe->devid, module->op, pipe->type,
+                                         roi->width*(double)roi->height*1e-6, NULL);
+  }
+  return FALSE;
+}
 
-  switch(cst)
+// starts the upload of a finished cpu output for the next module. it does not block, so the rest of
+// the node (pickers, histograms, packing its input) overlaps with the transfer and with the setup of
+// the next node.
+static void
+_pixelpipe_upload_ahead(dt_dev_pixelpipe_t *pipe, void *host, const dt_iop_roi_t *roi, const int bpp)
+{
+  _pixelpipe_drop_ahead(pipe);
+  if(!dt_opencl_image_fits_device(pipe->devid, roi->width, roi->height, bpp, 1.0f, 0)) return;
+  cl_mem mem = NULL;
+  if(dt_opencl_use_host_memory(pipe->devid))
+    mem = dt_opencl_alloc_device_use_host_pointer(pipe->devid, roi->width, roi->height, bpp, roi->width*bpp, host);
+  if(mem == NULL)
   {
-    case iop_cs_RAW:
-      for(int j=0; j<roi->height; j+=3) for(int i=0; i<roi->width; i+=3)  // sample one out of 9 pixels, un-locked with bayer pattern
-        {
-          uint8_t V = CLAMP(64.0f*pixel[4*(j*roi->width+i)], 0, 63);
-          hist[4*V] ++;
-        }
-      for(int k=0; k<4*64; k+=4) histogram_max[0] = histogram_max[0] > hist[k] ? histogram_max[0] : hist[k];
-      break;
+    mem = dt_opencl_alloc_device(pipe->devid, roi->width, roi->height, bpp);
+    if(mem == NULL) return;
+    if(dt_opencl_write_host_to_device_non_blocking(pipe->devid, host, mem, roi->width, roi->height, bpp) != CL_SUCCESS)
+    {
+      dt_opencl_release_mem_object(mem);
+      return;
+    }
+  }
+  pipe->cl_mem_ahead = mem;
+  pipe->cl_ahead_host = host;
+}
 
-    case iop_cs_rgb:
-      for(int j=0; j<roi->height; j+=4) for(int i=0; i<roi->width; i+=4)  // sample one out of 16 pixels
-        {
-          float Rv = pixel[4*(j*roi->width+i)];
-          float Gv = pixel[4*(j*roi->width+i)+1];
-          float Bv = pixel[4*(j*roi->width+i)+2];
-          float gv = fmaxf(Rv, fmaxf(Gv, Bv));
-          uint8_t R = CLAMP(64.0f*Rv, 0, 63);
-          uint8_t G = CLAMP(64.0f*Gv, 0, 63);
-          uint8_t B = CLAMP(64.0f*Bv, 0, 63);
-          uint8_t g = CLAMP(64.0f*gv, 0, 63);
-          hist[4*R] ++;
-          hist[4*G + 1] ++;
-          hist[4*B + 2] ++;
-          hist[4*g + 3] ++;
-        }
-      // don't count <= 0 pixels
-      for(int k=4; k<4*64; k+=4) histogram_max[0] = histogram_max[0] > hist[k] ? histogram_max[0] : hist[k];
-      for(int k=5; k<4*64; k+=4) histogram_max[1] = histogram_max[1] > hist[k] ? histogram_max[1] : hist[k];
-      for(int k=6; k<4*64; k+=4) histogram_max[2] = histogram_max[2] > hist[k] ? histogram_max[2] : hist[k];
-      for(int k=7; k<4*64; k+=4) histogram_max[3] = histogram_max[3] > hist[k] ? histogram_max[3] : hist[k];
+// modules like gamma, whose output does not fit a device image, can still start from an input on the
+// device and write their output to the host directly. saves copying back the float input. returns TRUE if done.
+static int
+_pixelpipe_process_cl_to_host(dt_dev_pixelpipe_t *pipe, dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece,
+                              cl_mem input, void *output, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  if(!module->process_cl_to_host || !dt_opencl_programs_ready(pipe->devid, module->so->cl_programs)) return FALSE;
+  if(!module->process_cl_to_host(module, piece, input, output, roi_in, roi_out))
+  {
+    dt_print(DT_DEBUG_OPENCL, "[opencl_pixelpipe] failed to run module '%s' to host memory. fall back to cpu path\n", module->op);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+dt_dev_pixelpipe_cl_global_t *
+dt_dev_pixelpipe_init_cl_global()
+{
+  dt_dev_pixelpipe_cl_global_t *g = (dt_dev_pixelpipe_cl_global_t *)malloc(sizeof(dt_dev_pixelpipe_cl_global_t));
+
+  const int program = 23; // output.cl, from programs.conf
+  g->kernel_pack_ui16 = dt_opencl_create_kernel(program, "pack_ui16");
+  const int program_basic = 2; // basic.cl, from programs.conf
+  g->kernel_warp_bilinear = dt_opencl_create_kernel(program_basic, "warp_bilinear");
+  g->kernel_warp_bicubic = dt_opencl_create_kernel(program_basic, "warp_bicubic");
+  g->kernel_warp_lanczos2 = dt_opencl_create_kernel(program_basic, "warp_lanczos2");
+  g->kernel_warp_lanczos3 = dt_opencl_create_kernel(program_basic, "warp_lanczos3");
+  return g;
+}
+
+void
+dt_dev_pixelpipe_free_cl_global(dt_dev_pixelpipe_cl_global_t *g)
+{
+  if(!g) return;
+  // destroy kernels
+  dt_opencl_free_kernel(g->kernel_pack_ui16);
+  dt_opencl_free_kernel(g->kernel_warp_bilinear);
+  dt_opencl_free_kernel(g->kernel_warp_bicubic);
+  dt_opencl_free_kernel(g->kernel_warp_lanczos2);
+  dt_opencl_free_kernel(g->kernel_warp_lanczos3);
+  free(g);
+}
+
+// packs the final float output to uint16 per channel on the device and copies back only these, to the start
+// of host. gives the same layout as the conversion of the floats in place by the export.
+static cl_int
+_pixelpipe_pack_ui16_cl(const int devid, cl_mem img, void *host, const int width, const int height)
+{
+  const dt_dev_pixelpipe_cl_global_t *g = darktable.opencl->pixelpipe;
+  const size_t size = (size_t)4*sizeof(uint16_t)*width*height;
+  cl_mem dev_packed = dt_opencl_alloc_device_buffer(devid, size);
+  if(dev_packed == NULL) return -999;
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, g->kernel_pack_ui16, 0, sizeof(cl_mem), (void *)&img);
+  dt_opencl_set_kernel_arg(devid, g->kernel_pack_ui16, 1, sizeof(cl_mem), (void *)&dev_packed);
+  dt_opencl_set_kernel_arg(devid, g->kernel_pack_ui16, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, g->kernel_pack_ui16, 3, sizeof(int), (void *)&height);
+  cl_int err = dt_opencl_enqueue_kernel_2d(devid, g->kernel_pack_ui16, sizes);
+  if(err == CL_SUCCESS)
+    err = dt_opencl_read_buffer_from_device(devid, host, dev_packed, 0, size, CL_TRUE);
+
+  dt_opencl_release_mem_object(dev_packed);
+  return err;
+}
+#endif
+
+
+// runs process() of a module on the cpu, tiled if it doesn't fit into host memory.
+// the temporaries it took from the arena are released afterwards.
+static void
+_pixelpipe_process_cpu(dt_dev_pixelpipe_t *pipe, dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece,
+                       void *input, void *output, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
+                       const int in_bpp, const int bpp, const dt_develop_tiling_t *tiling)
+{
+  TIMER_START(prof, module->op);
+  const size_t mark = dt_dev_pixelpipe_arena_mark(&pipe->arena);
+  if((module->flags() & IOP_FLAGS_ALLOW_TILING) &&
+      !dt_tiling_piece_fits_host_memory(max(roi_in->width, roi_out->width), max(roi_in->height, roi_out->height),
+                                        max(in_bpp, bpp), tiling->factor, tiling->overhead))
+    module->process_tiling(module, piece, input, output, roi_in, roi_out, in_bpp);
+  else
+    module->process(module, piece, input, output, roi_in, roi_out);
+  dt_dev_pixelpipe_arena_release(&pipe->arena, mark);
+  TIMER_STOP(prof);
+}
+
+// recursive helper for process:
+static int
+dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output, void **cl_mem_output, int *out_bpp,
+                             const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos);
+
+// can this piece be run as part of a fused pass of per pixel modules?
+static int
+_pixelpipe_piece_fusable(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece)
+{
+  if(!module->process_pixels) return 0;
+  // blending needs the module output and the masks on their own:
+  const dt_develop_blend_params_t *b = (const dt_develop_blend_params_t *)piece->blendop_data;
+  if(b && (b->mask_mode & DEVELOP_MASK_ENABLED)) return 0;
+  if(module->request_histogram || module->request_color_pick) return 0;
+  return get_output_bpp(module, pipe, piece, dev) == 4*sizeof(float);
+}
+
+// number of fusable modules in the run ending at modules/pieces (enabled ones only, the others are
+// passed through anyways). sets the first module and piece of the run and its position.
+static int
+_pixelpipe_fused_run(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, GList *modules, GList *pieces, int pos,
+                     GList **first_module, GList **first_piece, int *first_pos)
+{
+  // only for pipes which don't keep intermediate results around for interaction, and on the cpu.
+  // the opencl path keeps its buffers on the device anyways.
+  if(pipe->type != DT_DEV_PIXELPIPE_EXPORT && pipe->type != DT_DEV_PIXELPIPE_THUMBNAIL) return 0;
+  if(pipe->opencl_enabled && pipe->devid >= 0) return 0;
+  if(pipe->mask_display) return 0;
+  int count = 0;
+  for(; modules && pieces; modules = g_list_previous(modules), pieces = g_list_previous(pieces), pos--)
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(!piece->enabled || (dev->gui_module && dev->gui_module->operation_tags_filter() &  module->operation_tags()))
+      continue;
+    if(!_pixelpipe_piece_fusable(pipe, dev, module, piece)) break;
+    *first_module = modules;
+    *first_piece  = pieces;
+    *first_pos    = pos;
+    count++;
+  }
+  return count;
+}
+
+// runs all enabled modules from first_module up to modules block after block on the
+// input of first_module. no intermediate buffers are written, only the final output is cached.
+static int
+_pixelpipe_process_fused(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output, const dt_iop_roi_t *roi_out,
+                         const uint64_t hash, const size_t bufsize, GList *modules,
+                         GList *first_module, GList *first_piece, const int first_pos, const int count)
+{
+  // all fused modules keep the region of interest:
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  int in_bpp;
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &in_bpp, roi_out,
+                                  g_list_previous(first_module), g_list_previous(first_piece), first_pos-1)) return 1;
+  if(cl_mem_input != NULL) dt_opencl_release_mem_object(cl_mem_input);
+  if(dt_iop_breakpoint(dev, pipe)) return 1;
+
+  dt_iop_module_t *run_module[count];
+  dt_dev_pixelpipe_iop_t *run_piece[count];
+  int n = 0;
+  for(GList *m = first_module, *p = first_piece; m && n < count; m = g_list_next(m), p = g_list_next(p))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)m->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)p->data;
+    if(!piece->enabled || (dev->gui_module && dev->gui_module->operation_tags_filter() &  module->operation_tags()))
+      continue;
+    run_module[n] = module;
+    run_piece[n++] = piece;
+    if(m == modules) break;
+  }
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+  (void) dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output);
+
+  dt_times_t start;
+  dt_get_times(&start);
+  const size_t npixels = (size_t)roi_out->width*roi_out->height;
+  const int blocks = (npixels + DT_DEV_PIXELPIPE_FUSED_BLOCK - 1)/DT_DEV_PIXELPIPE_FUSED_BLOCK;
+  const float *const in = (const float *)input;
+  float *const out = (float *)*output;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none) shared(run_module, run_piece, n)
+#endif
+  for(int b=0; b<blocks; b++)
+  {
+    const size_t offset = (size_t)b*DT_DEV_PIXELPIPE_FUSED_BLOCK;
+    const size_t length = MIN(DT_DEV_PIXELPIPE_FUSED_BLOCK, npixels - offset);
+    // the first module reads the input, the others work in place while the block is hot in cache:
+    run_module[0]->process_pixels(run_module[0], run_piece[0], in + 4*offset, out + 4*offset, length);
+    for(int k=1; k<n; k++)
+      run_module[k]->process_pixels(run_module[k], run_piece[k], out + 4*offset, out + 4*offset, length);
+  }
+  dt_show_times(&start, "[dev_pixelpipe]", "processing %d fused modules up to `%s' [%s]", n,
+                run_module[n-1]->name(), _pipe_type_to_str(pipe->type));
+  _pixelpipe_trace(pipe, "fused modules", &start, roi_out);
+  for(int k=0; k<n; k++) run_piece[k]->process_time = (dt_get_wtime() - start.clock)/n;
+
+  for(int k=0; k<n; k++)
+    for(int c=0; c<3; c++) run_piece[k]->processed_maximum[c] = pipe->processed_maximum[c];
+  if(dt_iop_breakpoint(dev, pipe))
+  {
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return 0;
+}
+
+#ifdef HAVE_OPENCL
+// can this piece be tiled on the device together with its neighbours? only pixel to pixel modules which
+// would have to tile on their own anyways, and which use the default tiling.
+static int
+_pixelpipe_piece_chainable(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_iop_module_t *module,
+                           dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_out)
+{
+  if(!module->process_cl || !piece->process_cl_ready) return 0;
+  if(!dt_opencl_programs_ready(pipe->devid, module->so->cl_programs)) return 0;
+  if(!dt_opencl_placement_use_cl(pipe->devid, module->op, pipe->type, roi_out->width*(double)roi_out->height*1e-6, NULL))
+    return 0;
+  if(!(module->flags() & IOP_FLAGS_ALLOW_TILING) || (module->flags() & IOP_FLAGS_TILING_FULL_ROI)) return 0;
+  if(module->process_tiling_cl != default_process_tiling_cl) return 0;
+  if(!strcmp(module->op, "gamma")) return 0;
+  const dt_develop_blend_params_t *b = (const dt_develop_blend_params_t *)piece->blendop_data;
+  if(b && (b->mask_mode & DEVELOP_MASK_ENABLED)) return 0;
+  if(module->request_histogram || module->request_color_pick) return 0;
+  if(get_output_bpp(module, pipe, piece, dev) != 4*sizeof(float)) return 0;
+
+  dt_iop_roi_t roi_in = *roi_out;
+  module->modify_roi_in(module, piece, roi_out, &roi_in);
+  if(memcmp(&roi_in, roi_out, sizeof(dt_iop_roi_t))) return 0;
+
+  dt_develop_tiling_t tiling = { 0 };
+  module->tiling_callback(module, piece, roi_out, roi_out, &tiling);
+  return !dt_opencl_image_fits_device(pipe->devid, roi_out->width, roi_out->height, 4*sizeof(float),
+                                      tiling.factor, tiling.overhead);
+}
+
+// number of modules in the run ending at modules/pieces which can be tiled in one go on the device,
+// as _pixelpipe_fused_run() does for the cpu.
+static int
+_pixelpipe_chain_run(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, GList *modules, GList *pieces, int pos,
+                     const dt_iop_roi_t *roi_out, GList **first_module, GList **first_piece, int *first_pos)
+{
+  // the intermediate results are not cached, which only pays off where nobody interacts with them:
+  if(pipe->type != DT_DEV_PIXELPIPE_EXPORT && pipe->type != DT_DEV_PIXELPIPE_THUMBNAIL) return 0;
+  if(!dt_opencl_is_inited() || !pipe->opencl_enabled || pipe->devid < 0) return 0;
+  if(pipe->mask_display) return 0;
+  int count = 0;
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  for(; modules && pieces; modules = g_list_previous(modules), pieces = g_list_previous(pieces), pos--)
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(!piece->enabled || (dev->gui_module && dev->gui_module->operation_tags_filter() &  module->operation_tags()))
+      continue;
+    if(!_pixelpipe_piece_chainable(pipe, dev, module, piece, roi_out)) break;
+    *first_module = modules;
+    *first_piece  = pieces;
+    *first_pos    = pos;
+    count++;
+  }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return count;
+}
+
+// tiles all enabled modules from first_module up to modules together on the device: the intermediate
+// results stay there, only the input of first_module is uploaded and the final output read back.
+static int
+_pixelpipe_process_chain_cl(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output, const dt_iop_roi_t *roi_out,
+                            const uint64_t hash, const size_t bufsize, GList *modules,
+                            GList *first_module, GList *first_piece, const int first_pos, const int count)
+{
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  int in_bpp;
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &in_bpp, roi_out,
+                                  g_list_previous(first_module), g_list_previous(first_piece), first_pos-1)) return 1;
+  if(cl_mem_input != NULL)
+  {
+    // tiles are uploaded from the host:
+    const cl_int err = dt_opencl_copy_device_to_host(pipe->devid, input, cl_mem_input, roi_out->width, roi_out->height, in_bpp);
+    dt_opencl_release_mem_object(cl_mem_input);
+    if(err != CL_SUCCESS)
+    {
+      dt_print(DT_DEBUG_OPENCL, "[opencl_pixelpipe (c)] late opencl error detected while copying back to cpu buffer: %d\n", err);
+      pipe->opencl_error = 1;
+      return 1;
+    }
+  }
+  if(dt_iop_breakpoint(dev, pipe)) return 1;
+
+  dt_iop_module_t *run_module[count];
+  dt_dev_pixelpipe_iop_t *run_piece[count];
+  int n = 0;
+  for(GList *m = first_module, *p = first_piece; m && n < count; m = g_list_next(m), p = g_list_next(p))
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)m->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)p->data;
+    if(!piece->enabled || (dev->gui_module && dev->gui_module->operation_tags_filter() &  module->operation_tags()))
+      continue;
+    run_module[n] = module;
+    run_piece[n++] = piece;
+    if(m == modules) break;
+  }
+
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+  (void) dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output);
+
+  dt_times_t start;
+  dt_get_times(&start);
+  float processed_maximum_saved[3];
+  for(int c=0; c<3; c++) processed_maximum_saved[c] = pipe->processed_maximum[c];
+
+  dt_iop_nap(darktable.opencl->micro_nap);
+  int success_opencl = dt_tiling_process_chain_cl(run_module, run_piece, n, input, *output, roi_out, 4*sizeof(float));
+  if(!success_opencl && !dt_iop_breakpoint(dev, pipe))
+  {
+    // the halo of the chain might have been too large for the device. tile module by module then,
+    // through a temporary buffer, such that the last one ends up in the output:
+    dt_print(DT_DEBUG_OPENCL, "[opencl_pixelpipe] tiling modules up to `%s' one by one\n", run_module[n-1]->op);
+    for(int c=0; c<3; c++) pipe->processed_maximum[c] = processed_maximum_saved[c];
+    void *tmp = n > 1 ? dt_alloc_align(64, bufsize) : NULL;
+    success_opencl = (n == 1 || tmp != NULL);
+    const void *src = input;
+    for(int k=0; k<n && success_opencl; k++)
+    {
+      void *dst = ((n-1-k) & 1) ? tmp : *output;
+      success_opencl = run_module[k]->process_tiling_cl(run_module[k], run_piece[k], (void *)src, dst, roi_out, roi_out, 4*sizeof(float));
+      for(int c=0; c<3; c++) run_piece[k]->processed_maximum[c] = pipe->processed_maximum[c];
+      src = dst;
+    }
+    free(tmp);
+  }
+  dt_show_times(&start, "[dev_pixelpipe]", "processing %d chained modules up to `%s' on GPU with tiling [%s]", n,
+                run_module[n-1]->name(), _pipe_type_to_str(pipe->type));
+  _pixelpipe_trace(pipe, "chained modules", &start, roi_out);
+  for(int k=0; k<n; k++) run_piece[k]->process_time = (dt_get_wtime() - start.clock)/n;
+
+  if(!success_opencl || dt_iop_breakpoint(dev, pipe))
+  {
+    // don't keep half processed garbage around, and retry on the cpu if it was the device:
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+    if(!success_opencl && !dt_iop_breakpoint(dev, pipe)) pipe->opencl_error = 1;
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return 0;
+}
+#endif
+
+// a run of distorting modules which is resampled in one pass, see _pixelpipe_warp_run().
+typedef struct dt_dev_pixelpipe_warp_t
+{
+  int count;
+  dt_iop_module_t *module[DT_DEV_PIXELPIPE_WARP_MAX];
+  dt_dev_pixelpipe_iop_t *piece[DT_DEV_PIXELPIPE_WARP_MAX];
+  // roi[k] is the input of module[k], roi[count] the output of the run.
+  dt_iop_roi_t roi[DT_DEV_PIXELPIPE_WARP_MAX+1];
+}
+dt_dev_pixelpipe_warp_t;
+
+// can this piece be resampled together with its neighbours?
+static int
+_pixelpipe_piece_warpable(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece)
+{
+  if(!module->warp_backtransform) return 0;
+  // blending needs the module output and the masks on their own:
+  const dt_develop_blend_params_t *b = (const dt_develop_blend_params_t *)piece->blendop_data;
+  if(b && (b->mask_mode & DEVELOP_MASK_ENABLED)) return 0;
+  if(module->request_histogram || module->request_color_pick) return 0;
+  return get_output_bpp(module, pipe, piece, dev) == 4*sizeof(float);
+}
+
+// finds the run of modules with warp_backtransform() ending at modules/pieces (enabled ones only) and prepares
+// them for their regions of interest. a module which has to run its process() this time ends the run. returns
+// the number of modules, if resampling them in one pass saves anything, and sets the first module and piece
+// of the run and its position.
+static int
+_pixelpipe_warp_run(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, GList *modules, GList *pieces, int pos,
+                    const dt_iop_roi_t *roi_out, dt_dev_pixelpipe_warp_t *warp,
+                    GList **first_module, GList **first_piece, int *first_pos)
+{
+  // the run from its end backwards:
+  dt_iop_module_t *module[DT_DEV_PIXELPIPE_WARP_MAX];
+  dt_dev_pixelpipe_iop_t *piece[DT_DEV_PIXELPIPE_WARP_MAX];
+  GList *module_link[DT_DEV_PIXELPIPE_WARP_MAX], *piece_link[DT_DEV_PIXELPIPE_WARP_MAX];
+  int link_pos[DT_DEV_PIXELPIPE_WARP_MAX];
+  dt_iop_roi_t roi[DT_DEV_PIXELPIPE_WARP_MAX+1];
+  int n = 0;
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  for(; modules && pieces && n < DT_DEV_PIXELPIPE_WARP_MAX;
+      modules = g_list_previous(modules), pieces = g_list_previous(pieces), pos--)
+  {
+    dt_iop_module_t *m = (dt_iop_module_t *)modules->data;
+    dt_dev_pixelpipe_iop_t *p = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(!p->enabled || (dev->gui_module && dev->gui_module->operation_tags_filter() &  m->operation_tags()))
+      continue;
+    if(!_pixelpipe_piece_warpable(pipe, dev, m, p)) break;
+    module[n] = m;
+    piece[n] = p;
+    module_link[n] = modules;
+    piece_link[n] = pieces;
+    link_pos[n++] = pos;
+  }
+  if(n < 2)
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 0;
+  }
+  roi[0] = *roi_out;
+  for(int k=0; k<n; k++)
+  {
+    roi[k+1] = roi[k];
+    module[k]->modify_roi_in(module[k], piece[k], &roi[k], &roi[k+1]);
+  }
+  // start from an output still cached, as after changing the last module in the darkroom:
+  for(int k=1; k<n; k++)
+    if(dt_dev_pixelpipe_cache_available(&(pipe->cache), dt_dev_pixelpipe_cache_hash(pipe->image.id, &roi[k], pipe, link_pos[k])))
+    {
+      n = k;
       break;
+    }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
-    case iop_cs_Lab:
-    default:
-      for(int j=0; j<roi->height; j+=4) for(int i=0; i<roi->width; i+=4)   // sample one out of 16 pixels
-        {
-          uint8_t L = CLAMP(64.0f/100.0f*(pixel[4*(j*roi->width+i)]), 0, 63);
-          uint8_t a = CLAMP(64.0f/256.0f*(pixel[4*(j*roi->width+i)+1]+128.0f), 0, 63);
-          uint8_t b = CLAMP(64.0f/256.0f*(pixel[4*(j*roi->width+i)+2]+128.0f), 0, 63);
-          hist[4*L] ++;
-          hist[4*a + 1] ++;
-          hist[4*b + 2] ++;
-        }
-      // don't count <= 0 pixels in L
-      for(int k=4; k<4*64; k+=4) histogram_max[0] = histogram_max[0] > hist[k] ? histogram_max[0] : hist[k];
-
-      // don't count <= -128 and >= +128 pixels in a and b
-      for(int k=5; k<4*63; k+=4) histogram_max[1] = histogram_max[1] > hist[k] ? histogram_max[1] : hist[k];
-      for(int k=6; k<4*63; k+=4) histogram_max[2] = histogram_max[2] > hist[k] ? histogram_max[2] : hist[k];
-      break;
+  // process() would prepare the same, and as it, out of the lock:
+  int count = 0, resamples = 0;
+  for(; count<n; count++)
+  {
+    const int w = module[count]->warp_backtransform(module[count], piece[count], &roi[count+1], &roi[count], NULL, 0);
+    if(!w) break;
+    if(w == 1) resamples++;
   }
+  // modules which only move whole pixels copy faster on their own:
+  if(count < 2 || !resamples) return 0;
 
-  free(pixel);
+  warp->count = count;
+  for(int k=0; k<count; k++)
+  {
+    warp->module[k] = module[count-1-k];
+    warp->piece[k]  = piece[count-1-k];
+    warp->roi[k]    = roi[count-k];
+  }
+  warp->roi[count] = *roi_out;
+  *first_module = module_link[count-1];
+  *first_piece  = piece_link[count-1];
+  *first_pos    = link_pos[count-1];
+  return count;
 }
-#endif
 
-// helper for color picking
+// the positions in the input of the run which row y of its output is resampled from, two floats per pixel
+// in p. points which leave one of the buffers in between would have come out black there, they are moved
+// far outside the input. inside is scratch space of one byte per pixel.
 static void
-pixelpipe_picker(dt_iop_module_t *module, const float *img, const dt_iop_roi_t *roi,
-                 float *picked_color, float *picked_color_min, float *picked_color_max)
+_pixelpipe_warp_row(const dt_dev_pixelpipe_warp_t *warp, const int y, float *p, uint8_t *inside)
 {
-  int box[4];
-  int point[2];
-  float Lab[3];
-
-  for(int k=0; k<3; k++) picked_color_min[k] =  666.0f;
-  for(int k=0; k<3; k++) picked_color_max[k] = -666.0f;
-  for(int k=0; k<3; k++) Lab[k] = picked_color[k] = 0.0f;
-
-  // do not continue if one of the point coordinates is set to a negative value indicating a not yet defined position
-  if(module->color_picker_point[0] < 0 || module->color_picker_point[1] < 0) return;
-
-  // Initializing bounds of colorpicker box
-  for(int k=0; k<4; k+=2) box[k] = MIN(roi->width -1, MAX(0, module->color_picker_box[k]*roi->width));
-  for(int k=1; k<4; k+=2) box[k] = MIN(roi->height-1, MAX(0, module->color_picker_box[k]*roi->height));
-
-  // Initializing bounds of colorpicker point
-  point[0] = MIN(roi->width - 1, MAX(0, module->color_picker_point[0] * roi->width));
-  point[1] = MIN(roi->height - 1, MAX(0, module->color_picker_point[1] * roi->height));
-
-  if(darktable.lib->proxy.colorpicker.size)
+  const int width = warp->roi[warp->count].width;
+  for(int i=0; i<width; i++)
   {
-    const float w = 1.0/((box[3]-box[1]+1)*(box[2]-box[0]+1));
-    for(int j=box[1]; j<=box[3]; j++) for(int i=box[0]; i<=box[2]; i++)
-      {
-        const float L = img[4*(roi->width*j + i) + 0];
-        const float a = img[4*(roi->width*j + i) + 1];
-        const float b = img[4*(roi->width*j + i) + 2];
-        Lab[0] += w*L;
-        Lab[1] += w*a;
-        Lab[2] += w*b;
-        picked_color_min[0] = fminf(picked_color_min[0], L);
-        picked_color_min[1] = fminf(picked_color_min[1], a);
-        picked_color_min[2] = fminf(picked_color_min[2], b);
-        picked_color_max[0] = fmaxf(picked_color_max[0], L);
-        picked_color_max[1] = fmaxf(picked_color_max[1], a);
-        picked_color_max[2] = fmaxf(picked_color_max[2], b);
-        for(int k=0; k<3; k++) picked_color[k] = Lab[k];
-      }
+    p[2*i]   = i;
+    p[2*i+1] = y;
+    inside[i] = 1;
   }
-  else
+  for(int k=warp->count-1; k>=0; k--)
   {
-    for(int i = 0; i < 3; i++)
-      picked_color[i]
-      = picked_color_min[i]
-        = picked_color_max[i]
-          = img[4*(roi->width*point[1] + point[0]) + i];
+    warp->module[k]->warp_backtransform(warp->module[k], warp->piece[k], &warp->roi[k], &warp->roi[k+1], p, width);
+    // the input itself is sampled with its borders as the modules do:
+    if(k == 0) break;
+    const float wd = warp->roi[k].width, ht = warp->roi[k].height;
+    for(int i=0; i<width; i++)
+    {
+      float *pt = p + 2*i;
+      if(inside[i] && !(pt[0] > -1.0f && pt[0] < wd && pt[1] > -1.0f && pt[1] < ht)) inside[i] = 0;
+      if(inside[i])
+      {
+        pt[0] = CLAMP(pt[0], 0.0f, wd - 1.0f);
+        pt[1] = CLAMP(pt[1], 0.0f, ht - 1.0f);
+      }
+      else pt[0] = pt[1] = 0.0f;
+    }
   }
+  for(int i=0; i<width; i++)
+    if(!inside[i]) p[2*i] = p[2*i+1] = DT_DEV_PIXELPIPE_WARP_OUTSIDE;
 }
 
-
 #ifdef HAVE_OPENCL
-// helper for OpenCL color picking
-//
-// this algorithm is inefficient as hell when it comes to larger images. it's only acceptable
-// as long as we work on small image sizes like in image preview
-static void
-pixelpipe_picker_cl(int devid, dt_iop_module_t *module, cl_mem img, const dt_iop_roi_t *roi,
-                    float *picked_color, float *picked_color_min, float *picked_color_max)
+// resamples the run on the device: the positions are computed on the host and uploaded as a map.
+// uploads the input unless it is there already. returns TRUE with the output in *cl_mem_output.
+static int
+_pixelpipe_process_warp_cl(dt_dev_pixelpipe_t *pipe, const dt_dev_pixelpipe_warp_t *warp,
+                           const struct dt_interpolation *itor, void *input, void **cl_mem_input,
+                           void *output, void **cl_mem_output)
 {
-  int box[4];
-  size_t origin[3];
-  size_t region[3];
-  float Lab[3];
-
-  for(int k=0; k<3; k++) picked_color_min[k] =  666.0f;
-  for(int k=0; k<3; k++) picked_color_max[k] = -666.0f;
-  for(int k=0; k<3; k++) Lab[k] = picked_color[k] = 0.0f;
-
-  // do not continue if one of the point coordinates is set to a negative value indicating a not yet defined position
-  if(module->color_picker_point[0] < 0 || module->color_picker_point[1] < 0) return;
+  const dt_dev_pixelpipe_cl_global_t *g = darktable.opencl->pixelpipe;
+  const int devid = pipe->devid;
+  const dt_iop_roi_t *roi_in = &warp->roi[0];
+  const dt_iop_roi_t *roi_out = &warp->roi[warp->count];
+  const int width = roi_out->width, height = roi_out->height;
+  const int in_width = roi_in->width, in_height = roi_in->height;
+  const int bpp = 4*sizeof(float);
+  // input, output and the map of half their size:
+  if(!dt_opencl_image_fits_device(devid, MAX(roi_in->width, width), MAX(roi_in->height, height), bpp, 2.5f, 0))
+    return FALSE;
+
+  int kernel;
+  switch(itor->id)
+  {
+    case DT_INTERPOLATION_BICUBIC:  kernel = g->kernel_warp_bicubic;  break;
+    case DT_INTERPOLATION_LANCZOS2: kernel = g->kernel_warp_lanczos2; break;
+    case DT_INTERPOLATION_LANCZOS3: kernel = g->kernel_warp_lanczos3; break;
+    default:                        kernel = g->kernel_warp_bilinear; break;
+  }
 
-  if(darktable.lib->proxy.colorpicker.size)
+  const size_t map_size = (size_t)2*sizeof(float)*width*height;
+  float *map = (float *)dt_alloc_align(64, map_size + (size_t)width*dt_get_num_threads());
+  if(!map) return FALSE;
+  uint8_t *inside = (uint8_t *)map + map_size;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none) shared(warp, map, inside)
+#endif
+  for(int j=0; j<height; j++)
+    _pixelpipe_warp_row(warp, j, map + (size_t)2*width*j, inside + (size_t)width*dt_get_thread_num());
+
+  cl_mem dev_map = dt_opencl_alloc_device_buffer(devid, map_size);
+  int success = (dev_map != NULL)
+                && dt_opencl_write_buffer_to_device(devid, map, dev_map, 0, map_size, CL_TRUE) == CL_SUCCESS;
+  free(map);
+
+  // an upload started ahead is only of use if it is our input:
+  if(pipe->cl_mem_ahead && (*cl_mem_input != NULL || pipe->cl_ahead_host != input))
+    _pixelpipe_drop_ahead(pipe);
+  if(success && *cl_mem_input == NULL && pipe->cl_mem_ahead)
   {
-    for(int k=0; k<4; k+=2) box[k] = MIN(roi->width -1, MAX(0, module->color_picker_box[k]*roi->width));
-    for(int k=1; k<4; k+=2) box[k] = MIN(roi->height-1, MAX(0, module->color_picker_box[k]*roi->height));
+    *cl_mem_input = pipe->cl_mem_ahead;
+    pipe->cl_mem_ahead = pipe->cl_ahead_host = NULL;
+    dt_dev_pixelpipe_cache_set_cl(&(pipe->cache), input, *cl_mem_input, devid);
   }
-  else
+  if(success && *cl_mem_input == NULL)
   {
-    box[0] = box[2] = MIN(roi->width - 1, MAX(0, module->color_picker_point[0] * roi->width));
-    box[1] = box[3] = MIN(roi->height - 1, MAX(0, module->color_picker_point[1] * roi->height));
+    *cl_mem_input = dt_opencl_alloc_device(devid, roi_in->width, roi_in->height, bpp);
+    success = (*cl_mem_input != NULL)
+              && dt_opencl_write_host_to_device_non_blocking(devid, input, *cl_mem_input, roi_in->width, roi_in->height, bpp) == CL_SUCCESS;
+    if(success) dt_dev_pixelpipe_cache_set_cl(&(pipe->cache), input, *cl_mem_input, devid);
   }
+  if(success)
+  {
+    if(dt_opencl_use_host_memory(devid))
+      *cl_mem_output = dt_opencl_alloc_device_use_host_pointer(devid, width, height, bpp, width*bpp, output);
+    if(*cl_mem_output == NULL)
+      *cl_mem_output = dt_opencl_alloc_device(devid, width, height, bpp);
+    success = (*cl_mem_output != NULL);
+  }
+  if(success)
+  {
+    size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+    dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), (void *)cl_mem_input);
+    dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(cl_mem), (void *)cl_mem_output);
+    dt_opencl_set_kernel_arg(devid, kernel, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, kernel, 3, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, kernel, 4, sizeof(int), (void *)&in_width);
+    dt_opencl_set_kernel_arg(devid, kernel, 5, sizeof(int), (void *)&in_height);
+    dt_opencl_set_kernel_arg(devid, kernel, 6, sizeof(cl_mem), (void *)&dev_map);
+    success = dt_opencl_enqueue_kernel_2d(devid, kernel, sizes) == CL_SUCCESS;
+  }
+  if(success && (!darktable.opencl->async_pixelpipe || pipe->type == DT_DEV_PIXELPIPE_EXPORT))
+    success = dt_opencl_finish(devid);
+  if(dev_map != NULL) dt_opencl_release_mem_object(dev_map);
 
-  // Initializing bounds of colorpicker box
-  origin[0] = box[0];
-  origin[1] = box[1];
-  origin[2] = 0;
-
-  region[0] = box[2] - box[0] + 1;
-  region[1] = box[3] - box[1] + 1;
-  region[2] = 1;
-
-  size_t bufsize = region[0] * region[1];
-  float *buffer = dt_alloc_align(64, bufsize*4*sizeof(float));
-  if(buffer == NULL) return;
+  if(!success)
+  {
+    if(*cl_mem_output != NULL) dt_opencl_release_mem_object(*cl_mem_output);
+    *cl_mem_output = NULL;
+    return FALSE;
+  }
+  // keep the output on the device, the next module can start from there:
+  dt_dev_pixelpipe_cache_set_cl(&(pipe->cache), output, *cl_mem_output, devid);
+  return TRUE;
+}
+#endif
 
-  cl_int err = dt_opencl_read_host_from_device_raw(devid, buffer, img, origin, region, region[0]*4*sizeof(float), CL_TRUE);
+// resamples the input of the run once at the composed positions of all its modules, instead of every
+// module interpolating the output of the one before.
+static int
+_pixelpipe_process_warp(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output, void **cl_mem_output,
+                        const dt_iop_roi_t *roi_out, const uint64_t hash, const size_t bufsize,
+                        GList *first_module, GList *first_piece, const int first_pos, const dt_dev_pixelpipe_warp_t *warp)
+{
+  const dt_iop_roi_t *roi_in = &warp->roi[0];
+  const int n = warp->count;
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  int in_bpp;
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &in_bpp, roi_in,
+                                  g_list_previous(first_module), g_list_previous(first_piece), first_pos-1)) return 1;
+  if(dt_iop_breakpoint(dev, pipe))
+  {
+    if(cl_mem_input != NULL) dt_opencl_release_mem_object(cl_mem_input);
+    return 1;
+  }
 
-  if(err == CL_SUCCESS)
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(pipe->shutdown)
+  {
+    if(cl_mem_input != NULL) dt_opencl_release_mem_object(cl_mem_input);
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+  (void) dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output);
+
+  dt_times_t start;
+  dt_get_times(&start);
+  // as the modules would, lens takes the cheapest one for thumbnails:
+  const struct dt_interpolation *itor =
+    dt_interpolation_new(dt_dev_pixelpipe_fast_thumbnail(pipe) ? DT_INTERPOLATION_BILINEAR : DT_INTERPOLATION_USERPREF);
+  int done = 0;
+#ifdef HAVE_OPENCL
+  if(dt_opencl_is_inited() && pipe->opencl_enabled && pipe->devid >= 0)
   {
-    const float w = 1.0f/(region[0] * region[1]);
-    for(size_t k = 0; k < 4*bufsize; k += 4)
+    const int valid_input_on_gpu_only = (cl_mem_input != NULL);
+    dt_iop_nap(darktable.opencl->micro_nap);
+    done = _pixelpipe_process_warp_cl(pipe, warp, itor, input, &cl_mem_input, *output, cl_mem_output);
+    if(!done && valid_input_on_gpu_only)
     {
-      const float L = buffer[k];
-      const float a = buffer[k + 1];
-      const float b = buffer[k + 2];
-      Lab[0] += w*L;
-      Lab[1] += w*a;
-      Lab[2] += w*b;
-      picked_color_min[0] = fminf(picked_color_min[0], L);
-      picked_color_min[1] = fminf(picked_color_min[1], a);
-      picked_color_min[2] = fminf(picked_color_min[2], b);
-      picked_color_max[0] = fmaxf(picked_color_max[0], L);
-      picked_color_max[1] = fmaxf(picked_color_max[1], a);
-      picked_color_max[2] = fmaxf(picked_color_max[2], b);
-      for(int k=0; k<3; k++) picked_color[k] = Lab[k];
+      // continue on the cpu, from the input copied back:
+      dt_print(DT_DEBUG_OPENCL, "[opencl_pixelpipe] failed to resample modules up to `%s'. fall back to cpu path\n", warp->module[n-1]->op);
+      const cl_int err = dt_opencl_copy_device_to_host(pipe->devid, input, cl_mem_input, roi_in->width, roi_in->height, in_bpp);
+      if(err != CL_SUCCESS)
+      {
+        dt_print(DT_DEBUG_OPENCL, "[opencl_pixelpipe (d)] late opencl error detected while copying back to cpu buffer: %d\n", err);
+        dt_opencl_release_mem_object(cl_mem_input);
+        dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+        pipe->opencl_error = 1;
+        dt_pthread_mutex_unlock(&pipe->busy_mutex);
+        return 1;
+      }
     }
+    else if(done && valid_input_on_gpu_only) dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), input);
   }
-
-  free(buffer);
-}
 #endif
+  if(cl_mem_input != NULL) dt_opencl_release_mem_object(cl_mem_input);
 
+  if(!done)
+  {
+    const int width = roi_out->width;
+    // per thread: the positions of a row and the flags of _pixelpipe_warp_row()
+    const size_t row = ((size_t)width*(2*sizeof(float) + 1) + 63) & ~(size_t)63;
+    const size_t mark = dt_dev_pixelpipe_arena_mark(&pipe->arena);
+    char *scratch = (char *)dt_dev_pixelpipe_arena_alloc(&pipe->arena, row*dt_get_num_threads());
+    if(!scratch)
+    {
+      dt_dev_pixelpipe_arena_release(&pipe->arena, mark);
+      dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      return 1;
+    }
+    const float *const in = (const float *)input;
+    float *const out = (float *)*output;
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) default(none) shared(warp, scratch, itor, roi_in, roi_out)
+#endif
+    for(int j=0; j<roi_out->height; j++)
+    {
+      float *p = (float *)(scratch + row*dt_get_thread_num());
+      uint8_t *inside = (uint8_t *)(p + 2*width);
+      _pixelpipe_warp_row(warp, j, p, inside);
+      float *o = out + (size_t)4*width*j;
+      for(int i=0; i<width; i++, o+=4)
+        dt_interpolation_compute_pixel4c(itor, in, o, p[2*i], p[2*i+1], roi_in->width, roi_in->height, 4*roi_in->width);
+    }
+    dt_dev_pixelpipe_arena_release(&pipe->arena, mark);
+  }
+  dt_show_times(&start, "[dev_pixelpipe]", "resampling %d modules up to `%s'%s [%s]", n,
+                warp->module[n-1]->name(), done ? " on GPU" : "", _pipe_type_to_str(pipe->type));
+  _pixelpipe_trace(pipe, "warped modules", &start, roi_out);
+  for(int k=0; k<n; k++) warp->piece[k]->process_time = (dt_get_wtime() - start.clock)/n;
+
+  for(int k=0; k<n; k++)
+    for(int c=0; c<3; c++) warp->piece[k]->processed_maximum[c] = pipe->processed_maximum[c];
+  if(dt_iop_breakpoint(dev, pipe))
+  {
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+    if(*cl_mem_output != NULL) dt_opencl_release_mem_object(*cl_mem_output);
+    *cl_mem_output = NULL;
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 1;
+  }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return 0;
+}
 
-// recursive helper for process:
 static int
 dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output, void **cl_mem_output, int *out_bpp,
                              const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos)
@@ -588,6 +1452,9 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
 
   void *input = NULL;
   void *cl_mem_input = NULL;
+  int in_bpp = 0;
+  // set if the scopes were collected from the input on the device already:
+  int scopes_done = 0;
   *cl_mem_output = NULL;
   dt_iop_module_t *module = NULL;
   dt_dev_pixelpipe_iop_t *piece = NULL;
@@ -613,19 +1480,40 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
     return 1;
   }
   uint64_t hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, roi_out, pipe, pos);
+#ifdef HAVE_OPENCL
+  // prefer a copy on the device we're running on, it saves the upload.
+  // gamma needs its output on the host for the color pickers.
+  if(modules && pipe->devid >= 0 && strcmp(module->op, "gamma"))
+  {
+    void *cl_mem_cached = dt_dev_pixelpipe_cache_get_cl(&(pipe->cache), hash, pipe->devid, output);
+    if(cl_mem_cached)
+    {
+      for(int k=0; k<3; k++) pipe->processed_maximum[k] = piece->processed_maximum[k];
+      // the cache keeps its reference, the caller releases this one:
+      dt_opencl_retain_mem_object(cl_mem_cached);
+      *cl_mem_output = cl_mem_cached;
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      goto post_process_collect_info;
+    }
+  }
+#endif
   if(dt_dev_pixelpipe_cache_available(&(pipe->cache), hash))
   {
     // if(module) printf("found valid buf pos %d in cache for module %s %s %lu\n", pos, module->op, pipe == dev->preview_pipe ? "[preview]" : "", hash);
-    // copy over cached processed max for clipping:
-    if(piece) for(int k=0; k<3; k++) pipe->processed_maximum[k] = piece->processed_maximum[k];
-    else      for(int k=0; k<3; k++) pipe->processed_maximum[k] = 1.0f;
-    (void) dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output);
-    dt_pthread_mutex_unlock(&pipe->busy_mutex);
-    if(!modules) return 0;
-    // go to post-collect directly:
-    goto post_process_collect_info;
+    if(!dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output))
+    {
+      // copy over cached processed max for clipping:
+      if(piece) for(int k=0; k<3; k++) pipe->processed_maximum[k] = piece->processed_maximum[k];
+      else      for(int k=0; k<3; k++) pipe->processed_maximum[k] = 1.0f;
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      if(!modules) return 0;
+      // go to post-collect directly:
+      goto post_process_collect_info;
+    }
+    // a half float line which couldn't be expanded again: the buffer holds nothing, compute it anew.
+    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
   }
-  else dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
   // 2) if history changed or exit event, abort processing?
   // preview pipe: abort on all but zoom events (same buffer anyways)
@@ -677,12 +1565,33 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
         }
         else
         {
-          roi_in.x /= roi_out->scale;
-          roi_in.y /= roi_out->scale;
+          // start from the smallest downscaled copy of the input which still has enough pixels:
+          const float *in = pipe->input;
+          dt_iop_roi_t roi_zoom = *roi_out;
           roi_in.width = pipe->iwidth;
           roi_in.height = pipe->iheight;
+          const dt_dev_pixelpipe_pyramid_t *pyramid = pipe->pyramid;
+          if(pyramid && pyramid->input == pipe->input &&
+              pyramid->iwidth == pipe->iwidth && pyramid->iheight == pipe->iheight)
+          {
+            for(int k=pyramid->levels-1; k>=0; k--)
+            {
+              const float scale = roi_out->scale * (2 << k);
+              if(scale > 1.0f) continue;
+              // 1:1 is a plain copy, the level might lack the last row or column for that:
+              if(scale == 1.0f && (roi_out->x + roi_out->width > pyramid->width[k] ||
+                                   roi_out->y + roi_out->height > pyramid->height[k])) continue;
+              in = pyramid->buf[k];
+              roi_zoom.scale = scale;
+              roi_in.width = pyramid->width[k];
+              roi_in.height = pyramid->height[k];
+              break;
+            }
+          }
+          roi_in.x = roi_out->x / roi_zoom.scale;
+          roi_in.y = roi_out->y / roi_zoom.scale;
           roi_in.scale = 1.0f;
-          dt_iop_clip_and_zoom(*output, pipe->input, roi_out, &roi_in, roi_out->width, pipe->iwidth);
+          dt_iop_clip_and_zoom(*output, in, &roi_zoom, &roi_in, roi_out->width, roi_in.width);
         }
       }
       // else found in cache.
@@ -705,12 +1614,33 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
       }
     }
     dt_show_times(&start, "[dev_pixelpipe]", "initing base buffer [%s]", _pipe_type_to_str(pipe->type));
+    _pixelpipe_trace(pipe, "base buffer", &start, roi_out);
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
   }
   else
   {
     // 3b) recurse and obtain output array in &input
 
+    // runs of per pixel modules are done in one go:
+    GList *first_module = NULL, *first_piece = NULL;
+    int first_pos = 0;
+#ifdef HAVE_OPENCL
+    // same for runs of modules that would need to tile on the device:
+    const int chained = _pixelpipe_chain_run(pipe, dev, modules, pieces, pos, roi_out, &first_module, &first_piece, &first_pos);
+    if(chained > 1)
+      return _pixelpipe_process_chain_cl(pipe, dev, output, roi_out, hash, bufsize, modules,
+                                         first_module, first_piece, first_pos, chained);
+#endif
+    const int fused = _pixelpipe_fused_run(pipe, dev, modules, pieces, pos, &first_module, &first_piece, &first_pos);
+    if(fused > 1)
+      return _pixelpipe_process_fused(pipe, dev, output, roi_out, hash, bufsize, modules,
+                                      first_module, first_piece, first_pos, fused);
+    // and runs of distorting modules are resampled once:
+    dt_dev_pixelpipe_warp_t warp;
+    if(_pixelpipe_warp_run(pipe, dev, modules, pieces, pos, roi_out, &warp, &first_module, &first_piece, &first_pos))
+      return _pixelpipe_process_warp(pipe, dev, output, cl_mem_output, roi_out, hash, bufsize,
+                                     first_module, first_piece, first_pos, &warp);
+
     // get region of interest which is needed in input
     dt_pthread_mutex_lock(&pipe->busy_mutex);
     if(pipe->shutdown)
@@ -719,13 +1649,22 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
       return 1;
     }
     module->modify_roi_in(module, piece, roi_out, &roi_in);
+    // the darkroom runs modules again on the same input, their blurs of it are kept:
+    piece->input_hash = (pipe->type == DT_DEV_PIXELPIPE_FULL || pipe->type == DT_DEV_PIXELPIPE_PREVIEW)
+                        ? dt_dev_pixelpipe_cache_hash(pipe->image.id, &roi_in, pipe, pos-1) : 0;
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
 
     // recurse to get actual data of input buffer
-    int in_bpp;
     if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &in_bpp, &roi_in, g_list_previous(modules), g_list_previous(pieces), pos-1)) return 1;
     piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
 
+    // the input took a while, check again before processing this module:
+    if(dt_iop_breakpoint(dev, pipe))
+    {
+      if(cl_mem_input != NULL) dt_opencl_release_mem_object(cl_mem_input);
+      return 1;
+    }
+
     // reserve new cache line: output
     dt_pthread_mutex_lock(&pipe->busy_mutex);
     if(pipe->shutdown)
@@ -824,10 +1763,16 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
     if (dt_opencl_is_inited() && pipe->opencl_enabled && pipe->devid >= 0)
     {
       int success_opencl = TRUE;
+      // set if this run of the module is timed to choose between cpu and opencl:
+      int calibrate = 0;
 
       /* if input is on gpu memory only, remember this fact to later take appropriate action */
       int valid_input_on_gpu_only = (cl_mem_input != NULL);
 
+      /* an upload started ahead is only of use if it is our input */
+      if(pipe->cl_mem_ahead && (cl_mem_input != NULL || pipe->cl_ahead_host != input))
+        _pixelpipe_drop_ahead(pipe);
+
       /* general remark: in case of opencl errors within modules or out-of-memory on GPU, we transparently
          fall back to the respective cpu module and continue in pixelpipe. If we encounter errors we set
          pipe->opencl_error=1, return this function with value 1, and leave appropriate action to the calling
@@ -835,8 +1780,13 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
          Late errors are sometimes detected when trying to get back data from device into host memory and
          are treated in the same manner. */
 
-      /* try to enter opencl path after checking some module specific pre-requisites */
-      if(module->process_cl && piece->process_cl_ready && !((pipe->type == DT_DEV_PIXELPIPE_PREVIEW) && (module->flags() & IOP_FLAGS_PREVIEW_NON_OPENCL)))
+      /* try to enter opencl path after checking some module specific pre-requisites. until the kernels
+         of the module are built in the background, it runs on the cpu. same if the cpu path has been
+         measured to be faster on this device. */
+      if(module->process_cl && piece->process_cl_ready && !((pipe->type == DT_DEV_PIXELPIPE_PREVIEW) && (module->flags() & IOP_FLAGS_PREVIEW_NON_OPENCL))
+         && dt_opencl_programs_ready(pipe->devid, module->so->cl_programs)
+         && dt_opencl_placement_use_cl(pipe->devid, module->op, pipe->type,
+                                       roi_out->width*(double)roi_out->height*1e-6, &calibrate))
       {
 
         // fprintf(stderr, "[opencl_pixelpipe 0] factor %f, overhead %d, width %d, height %d, bpp %d\n", (double)tiling.factor, tiling.overhead, roi_in.width, roi_in.height, bpp);
@@ -850,7 +1800,20 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
 
           // fprintf(stderr, "[opencl_pixelpipe 2] module '%s' running directly with process_cl\n", module->op);
 
-          /* input is not on gpu memory -> copy it there */
+          /* the module before us already started the upload */
+          if (cl_mem_input == NULL && pipe->cl_mem_ahead)
+          {
+            cl_mem_input = pipe->cl_mem_ahead;
+            pipe->cl_mem_ahead = pipe->cl_ahead_host = NULL;
+            dt_dev_pixelpipe_cache_set_cl(&(pipe->cache), input, cl_mem_input, pipe->devid);
+          }
+
+          /* input is not on gpu memory -> copy it there. devices sharing memory with the host use the cache line directly. */
+          if (cl_mem_input == NULL && dt_opencl_use_host_memory(pipe->devid))
+          {
+            cl_mem_input = dt_opencl_alloc_device_use_host_pointer(pipe->devid, roi_in.width, roi_in.height, in_bpp, roi_in.width*in_bpp, input);
+            if (cl_mem_input != NULL) dt_dev_pixelpipe_cache_set_cl(&(pipe->cache), input, cl_mem_input, pipe->devid);
+          }
           if (cl_mem_input == NULL)
           {
             cl_mem_input = dt_opencl_alloc_device(pipe->devid, roi_in.width, roi_in.height, in_bpp);
@@ -868,6 +1831,8 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
                 dt_print(DT_DEBUG_OPENCL, "[opencl_pixelpipe] couldn't copy image to opencl device for module %s\n", module->op);
                 success_opencl = FALSE;
               }
+              // only uploaded once while the input cache line lives:
+              else dt_dev_pixelpipe_cache_set_cl(&(pipe->cache), input, cl_mem_input, pipe->devid);
             }
 
           }
@@ -882,7 +1847,11 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
           /* try to allocate GPU memory for output */
           if (success_opencl)
           {
-            *cl_mem_output = dt_opencl_alloc_device(pipe->devid, roi_out->width, roi_out->height, bpp);
+            // in the output cache line, copying it back is just a map then:
+            if(dt_opencl_use_host_memory(pipe->devid))
+              *cl_mem_output = dt_opencl_alloc_device_use_host_pointer(pipe->devid, roi_out->width, roi_out->height, bpp, roi_out->width*bpp, *output);
+            if (*cl_mem_output == NULL)
+              *cl_mem_output = dt_opencl_alloc_device(pipe->devid, roi_out->width, roi_out->height, bpp);
             if (*cl_mem_output == NULL)
             {
               dt_print(DT_DEBUG_OPENCL, "[opencl_pixelpipe] couldn't allocate output buffer for module %s\n", module->op);
@@ -897,7 +1866,18 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
 
           /* now call process_cl of module; module should emit meaningful messages in case of error */
           if (success_opencl)
-            success_opencl = module->process_cl(module, piece, cl_mem_input, *cl_mem_output, &roi_in, roi_out);
+          {
+            // calibration runs are timed without the work queued before:
+            if(calibrate) success_opencl = dt_opencl_finish(pipe->devid);
+            const double cl_start = dt_get_wtime();
+            TIMER_START(prof, module->op);
+            if(success_opencl)
+              success_opencl = module->process_cl(module, piece, cl_mem_input, *cl_mem_output, &roi_in, roi_out);
+            TIMER_STOP(prof);
+            if(success_opencl && calibrate && dt_opencl_finish(pipe->devid))
+              dt_opencl_placement_record(pipe->devid, module->op, pipe->type, 1, dt_get_wtime() - cl_start,
+                                         roi_out->width*(double)roi_out->height*1e-6);
+          }
 
           if(pipe->shutdown)
           {
@@ -911,14 +1891,9 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
               module == dev->gui_module && // only modules with focus can pick
               module->request_color_pick) // and they want to pick ;)
           {
-            pixelpipe_picker_cl(pipe->devid, module, cl_mem_input, &roi_in, module->picked_color, module->picked_color_min, module->picked_color_max);
-            pixelpipe_picker_cl(pipe->devid, module, (*cl_mem_output), roi_out, module->picked_output_color, module->picked_output_color_min, module->picked_output_color_max);
-
-            dt_pthread_mutex_unlock(&pipe->busy_mutex);
-
-            if(module->widget) dt_control_queue_redraw_widget(module->widget);
-
-            dt_pthread_mutex_lock(&pipe->busy_mutex);
+            // the results arrive at the end of the run, which also redraws the module then:
+            pixelpipe_picker_cl(pipe, module, cl_mem_input, &roi_in, module->picked_color, module->picked_color_min, module->picked_color_max);
+            pixelpipe_picker_cl(pipe, module, (*cl_mem_output), roi_out, module->picked_output_color, module->picked_output_color_min, module->picked_output_color_max);
           }
 
           if(pipe->shutdown)
@@ -1000,8 +1975,10 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
           dt_iop_nap(darktable.opencl->micro_nap);
 
           /* now call process_tiling_cl of module; module should emit meaningful messages in case of error */
+          TIMER_START(prof, module->op);
           if (success_opencl)
             success_opencl = module->process_tiling_cl(module, piece, input, *output, &roi_in, roi_out, in_bpp);
+          TIMER_STOP(prof);
 
           if(pipe->shutdown)
           {
@@ -1120,6 +2097,10 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
             }
           }
 
+          /* keep the output on the device, a later run can start from here without going through host memory */
+          if(*cl_mem_output != NULL)
+            dt_dev_pixelpipe_cache_set_cl(&(pipe->cache), *output, *cl_mem_output, pipe->devid);
+
           /* we can now release cl_mem_input */
           if(cl_mem_input != NULL) dt_opencl_release_mem_object(cl_mem_input);
           cl_mem_input = NULL;
@@ -1172,12 +2153,7 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
           }
 
           /* process module on cpu. use tiling if needed and possible. */
-          if((module->flags() & IOP_FLAGS_ALLOW_TILING) &&
-              !dt_tiling_piece_fits_host_memory(max(roi_in.width, roi_out->width), max(roi_in.height, roi_out->height),
-                                                max(in_bpp, bpp), tiling.factor, tiling.overhead))
-            module->process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
-          else
-            module->process(module, piece, input, *output, &roi_in, roi_out);
+          _pixelpipe_process_cpu(pipe, module, piece, input, *output, &roi_in, roi_out, in_bpp, bpp, &tiling);
 
           if(pipe->shutdown)
           {
@@ -1238,6 +2214,28 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
         }
 
       }
+      else if(cl_mem_input != NULL &&
+              _pixelpipe_process_cl_to_host(pipe, module, piece, cl_mem_input, *output, &roi_in, roi_out))
+      {
+        /* the output is on the host already, the float input never needs to come back */
+        *cl_mem_output = NULL;
+        _pixelpipe_drop_ahead(pipe);
+
+        /* so the scopes of the preview have to be binned from it here */
+        if(dev->gui_attached && pipe == dev->preview_pipe && strcmp(module->op, "gamma") == 0)
+        {
+          scopes_collect_cl(dev, pipe->devid, cl_mem_input, &roi_in);
+          scopes_done = 1;
+        }
+        dt_opencl_release_mem_object(cl_mem_input);
+        cl_mem_input = NULL;
+
+        if(pipe->shutdown)
+        {
+          dt_pthread_mutex_unlock(&pipe->busy_mutex);
+          return 1;
+        }
+      }
       else
       {
         /* we are not allowed to use opencl for this module */
@@ -1245,12 +2243,16 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
         // fprintf(stderr, "[opencl_pixelpipe 3] for module `%s', have bufs %lX and %lX \n", module->op, (long int)cl_mem_input, (long int)*cl_mem_output);
 
         *cl_mem_output = NULL;
+        _pixelpipe_drop_ahead(pipe);
 
         /* cleanup unneeded opencl buffer, and copy back to CPU buffer */
         if(cl_mem_input != NULL)
         {
           cl_int err;
 
+          // calibration runs also time the copy, without the work queued before:
+          if(calibrate) (void)dt_opencl_finish(pipe->devid);
+          const double copy_start = dt_get_wtime();
           err = dt_opencl_copy_device_to_host(pipe->devid, input, cl_mem_input, roi_in.width, roi_in.height, in_bpp);
           // if (rand() % 5 == 0) err = !CL_SUCCESS; // Test code: simulate spurious failures
           if (err != CL_SUCCESS)
@@ -1265,6 +2267,9 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
 
           /* this is a good place to release event handles as we anyhow need to move from gpu to cpu here */
           (void)dt_opencl_finish(pipe->devid);
+          if(calibrate)
+            dt_opencl_placement_record_transfer(pipe->devid, pipe->type, dt_get_wtime() - copy_start,
+                                                roi_in.width*(double)roi_in.height*1e-6, in_bpp);
           dt_opencl_release_mem_object(cl_mem_input);
           valid_input_on_gpu_only = FALSE;
         }
@@ -1276,12 +2281,11 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
         }
 
         /* process module on cpu. use tiling if needed and possible. */
-        if((module->flags() & IOP_FLAGS_ALLOW_TILING) &&
-            !dt_tiling_piece_fits_host_memory(max(roi_in.width, roi_out->width), max(roi_in.height, roi_out->height),
-                                              max(in_bpp, bpp), tiling.factor, tiling.overhead))
-          module->process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
-        else
-          module->process(module, piece, input, *output, &roi_in, roi_out);
+        const double cpu_start = dt_get_wtime();
+        _pixelpipe_process_cpu(pipe, module, piece, input, *output, &roi_in, roi_out, in_bpp, bpp, &tiling);
+        if(calibrate)
+          dt_opencl_placement_record(pipe->devid, module->op, pipe->type, 0, dt_get_wtime() - cpu_start,
+                                     roi_out->width*(double)roi_out->height*1e-6);
 
         if(pipe->shutdown)
         {
@@ -1332,6 +2336,10 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
         /* process blending */
         dt_develop_blend_process(module, piece, input, *output, &roi_in, roi_out);
 
+        /* output is final now. if the next module runs on the device, get it there while we finish up */
+        if(_pixelpipe_next_uses_cl(pipe, dev, pieces, roi_out))
+          _pixelpipe_upload_ahead(pipe, *output, roi_out, bpp);
+
         if(pipe->shutdown)
         {
           dt_pthread_mutex_unlock(&pipe->busy_mutex);
@@ -1348,12 +2356,7 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
       /* opencl is not inited or not enabled or we got no resource/device -> everything runs on cpu */
 
       /* process module on cpu. use tiling if needed and possible. */
-      if((module->flags() & IOP_FLAGS_ALLOW_TILING) &&
-          !dt_tiling_piece_fits_host_memory(max(roi_in.width, roi_out->width), max(roi_in.height, roi_out->height),
-                                            max(in_bpp, bpp), tiling.factor, tiling.overhead))
-        module->process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
-      else
-        module->process(module, piece, input, *output, &roi_in, roi_out);
+      _pixelpipe_process_cpu(pipe, module, piece, input, *output, &roi_in, roi_out, in_bpp, bpp, &tiling);
 
       if(pipe->shutdown)
       {
@@ -1406,12 +2409,7 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
     }
 #else
     /* process module on cpu. use tiling if needed and possible. */
-    if((module->flags() & IOP_FLAGS_ALLOW_TILING) &&
-        !dt_tiling_piece_fits_host_memory(max(roi_in.width, roi_out->width), max(roi_in.height, roi_out->height),
-                                          max(in_bpp, bpp), tiling.factor, tiling.overhead))
-      module->process_tiling(module, piece, input, *output, &roi_in, roi_out, in_bpp);
-    else
-      module->process(module, piece, input, *output, &roi_in, roi_out);
+    _pixelpipe_process_cpu(pipe, module, piece, input, *output, &roi_in, roi_out, in_bpp, bpp, &tiling);
 
     if(pipe->shutdown)
     {
@@ -1465,8 +2463,20 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
 
     dt_show_times(&start, "[dev_pixelpipe]", "processing `%s' [%s]", module->name(),
                   _pipe_type_to_str(pipe->type));
+    _pixelpipe_trace(pipe, module->name(), &start, roi_out);
+    piece->process_time = dt_get_wtime() - start.clock;
     // in case we get this buffer from the cache, also get the processed max:
     for(int k=0; k<3; k++) piece->processed_maximum[k] = pipe->processed_maximum[k];
+    // run got obsolete meanwhile? tiled modules stop early then, so the output
+    // might be incomplete. don't leave it in the cache.
+    if(dt_iop_breakpoint(dev, pipe))
+    {
+      dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+      if(*cl_mem_output != NULL) dt_opencl_release_mem_object(*cl_mem_output);
+      *cl_mem_output = NULL;
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      return 1;
+    }
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
     if(module == darktable.develop->gui_module)
     {
@@ -1834,66 +2844,9 @@ post_process_collect_info:
       // don't count <= 0 pixels
       for(int k=19; k<4*64; k+=4) dev->histogram_max = dev->histogram_max > dev->histogram[k] ? dev->histogram_max : dev->histogram[k];
 
-      // calculate the waveform histogram. since this is drawn pixel by pixel we have to do it in the correct size (thus the weird gui stuff :().
-      // this HAS to be done on the float input data, otherwise we get really ugly artefacts due to rounding issues when putting colors into the bins.
-//       dt_pthread_mutex_lock(&dev->histogram_waveform_mutex);
-      if(dev->histogram_waveform_width != 0 && input)
-      {
-        uint32_t *buf = (uint32_t*)calloc(dev->histogram_waveform_height * dev->histogram_waveform_width * 3, sizeof(uint32_t));
-        memset(dev->histogram_waveform, 0, sizeof(uint32_t) * dev->histogram_waveform_height * dev->histogram_waveform_stride / 4);
-
-        const double bin_width = (double)(roi_in.width) / (double)dev->histogram_waveform_width, bin_height = 255.0 / (double)(dev->histogram_waveform_height - 1);
-        float *pixel = (float *)input;
-//         uint32_t mincol[3] = {UINT32_MAX,UINT32_MAX,UINT32_MAX}, maxcol[3] = {0,0,0};
-
-        // count the colors into buf ...
-        for(int y = 0; y < roi_in.height; y ++)
-        {
-          for(int x = 0; x < roi_in.width; x ++)
-          {
-            float rgb[3];
-            for(int k=0; k<3; k++)
-              rgb[k] = pixel[4*y*roi_in.width+4*x+2-k];
-
-            const int out_x = MIN(x / bin_width, dev->histogram_waveform_width - 1);
-            for(int k = 0; k < 3; k++)
-            {
-              const int out_y = 255 * (1.0 - CLAMP(rgb[k], 0.0, 1.0)) / bin_height;
-              uint32_t * const out = buf + (out_y * dev->histogram_waveform_width * 3 + out_x * 3 + k);
-              (*out)++;
-//               mincol[k] = MIN(mincol[k], *out);
-//               maxcol[k] = MAX(maxcol[k], *out);
-            }
-          }
-        }
-
-        // TODO: Find a nicer function to map buf -> image than just clipping
-//         float factor[3];
-//         for(int k = 0; k < 3; k++)
-//           factor[k] = 255.0 / (float)(maxcol[k] - mincol[k]); // leave some clipping
-
-        // ... and scale that into a nice image. putting the pixels into the image directly gets too saturated/clips.
-        for(int y = 0; y < dev->histogram_waveform_height; y++)
-        {
-          for(int x = 0; x < dev->histogram_waveform_width; x++)
-          {
-            uint32_t * const in = buf + (y * dev->histogram_waveform_width + x) * 3;
-            uint8_t * const out = (uint8_t*)(dev->histogram_waveform + (y * dev->histogram_waveform_width + x));
-            for(int k = 0; k < 3; k++)
-            {
-              if(in[k] == 0) continue;
-              out[k] = CLAMP(in[k] * 0.5, 5, 255);
-//               if(in[k] == 0)
-//                 out[k] = 0;
-//               else
-//                 out[k] = (float)(in[k] - mincol[k]) * factor[k];
-            }
-          }
-        }
-
-        free(buf);
-      }
-//       dt_pthread_mutex_unlock(&dev->histogram_waveform_mutex);
+      // the scopes are binned from the float input, otherwise rounding to 8 bits leaves ugly gaps
+      // between the bins. the widget renders them at its size.
+      if(!scopes_done && input) scopes_collect(dev, (const float *)input, &roi_in);
 
 
       dt_pthread_mutex_unlock(&pipe->busy_mutex);
@@ -1913,6 +2866,19 @@ post_process_collect_info:
     }
   }
 
+  // this run is done with the input, keep it at half the size if the cache is set up for it:
+  if(input && in_bpp == 4*sizeof(float))
+  {
+#ifdef HAVE_OPENCL
+    // the buffer goes back to the pool shared by all pipes. non-blocking uploads and images
+    // created on host memory may still read it:
+    if(pipe->devid >= 0) dt_opencl_finish(pipe->devid);
+#endif
+    dt_pthread_mutex_lock(&pipe->busy_mutex);
+    dt_dev_pixelpipe_cache_pack(&(pipe->cache), input, (size_t)in_bpp*roi_in.width*roi_in.height);
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  }
+
   return 0;
 }
 
@@ -1944,13 +2910,14 @@ void dt_dev_pixelpipe_disable_after(
   while(strcmp(piece->module->op, op))
   {
     piece->enabled = 0;
+    piece->synch_hash = 0;
     piece = NULL;
     nodes = g_list_previous(nodes);
     if(!nodes) break;
     piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
   }
   // disable the last (matching one), too
-  if(piece) piece->enabled = 0;
+  if(piece) piece->enabled = piece->synch_hash = 0;
 }
 
 void dt_dev_pixelpipe_disable_before(
@@ -1962,13 +2929,14 @@ void dt_dev_pixelpipe_disable_before(
   while(strcmp(piece->module->op, op))
   {
     piece->enabled = 0;
+    piece->synch_hash = 0;
     piece = NULL;
     nodes = g_list_next(nodes);
     if(!nodes) break;
     piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
   }
   // disable the last (matching one), too
-  if(piece) piece->enabled = 0;
+  if(piece) piece->enabled = piece->synch_hash = 0;
 }
 
 static int
@@ -1991,7 +2959,14 @@ dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, dt_develop_t
     {
       cl_int err;
 
-      err = dt_opencl_copy_device_to_host(pipe->devid, *output, *cl_mem_output, roi_out->width, roi_out->height, *out_bpp);
+      // the export converts to uint16 anyway, on the device only half the bytes need to come back:
+      if(pipe->pack_ui16 && *out_bpp == 4*sizeof(float))
+        pipe->output_packed = (_pixelpipe_pack_ui16_cl(pipe->devid, *cl_mem_output, *output, roi_out->width, roi_out->height) == CL_SUCCESS);
+
+      if(pipe->output_packed)
+        err = CL_SUCCESS;
+      else
+        err = dt_opencl_copy_device_to_host(pipe->devid, *output, *cl_mem_output, roi_out->width, roi_out->height, *out_bpp);
       dt_opencl_release_mem_object(*cl_mem_output);
       *cl_mem_output = NULL;
 
@@ -2045,8 +3020,15 @@ int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x,
   // re-entry point: in case of late opencl errors we start all over again with opencl-support disabled
 restart:
 
+  // an aborted attempt may have left temporaries in the arena:
+  dt_dev_pixelpipe_arena_release(&pipe->arena, 0);
+
   // image max is normalized before
   for(int k=0; k<3; k++) pipe->processed_maximum[k] = 1.0f; // dev->image->maximum;
+  pipe->picker_cl_num = 0;
+  pipe->output_packed = 0;
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+    ((dt_dev_pixelpipe_iop_t *)nodes->data)->process_time = 0.0f;
 
   // check if we should obsolete caches
   if(pipe->cache_obsolete) dt_dev_pixelpipe_cache_flush(&(pipe->cache));
@@ -2055,16 +3037,38 @@ restart:
   // mask display off as a starting point
   pipe->mask_display = 0;
 
+  // color pickers and the focused module can change without a synch:
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  dt_dev_pixelpipe_cache_prepare_hash(pipe);
+  pipe->raw16 = _pixelpipe_raw16(pipe);
+#ifdef HAVE_OPENCL
+  // only the interactive pipes profit from keeping intermediates on the device:
+  dt_dev_pixelpipe_cache_set_gpu(&(pipe->cache), darktable.opencl->gpu_cache && pipe->opencl_enabled &&
+                                 (pipe->type == DT_DEV_PIXELPIPE_FULL || pipe->type == DT_DEV_PIXELPIPE_PREVIEW));
+#endif
+  pipe->cache.pack_half = (pipe->type == DT_DEV_PIXELPIPE_FULL || pipe->type == DT_DEV_PIXELPIPE_PREVIEW) &&
+                         dt_conf_get_bool("pixelpipe_half_float_cache");
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+
   void *buf = NULL;
   void *cl_mem_out = NULL;
   int out_bpp;
 
   // run pixelpipe recursively and get error status
+  TIMER_START(prof_pipe, _pipe_type_to_str(pipe->type));
   int err = dt_dev_pixelpipe_process_rec_and_backcopy(pipe, dev, &buf, &cl_mem_out, &out_bpp, &roi, modules, pieces, pos);
+  TIMER_STOP(prof_pipe);
+#ifdef HAVE_OPENCL
+  _pixelpipe_drop_ahead(pipe);
+#endif
 
   // get status summary of opencl queue by checking the eventlist
   int oclerr = (pipe->devid >= 0) ? (dt_opencl_events_flush(pipe->devid, 1) != 0) : 0;
 
+#ifdef HAVE_OPENCL
+  _pixelpipe_picker_cl_finish(pipe, !err && !oclerr);
+#endif
+
   // Check if we had opencl errors ....
   // remark: opencl errors can come in two ways: pipe->opencl_error is TRUE (and err is TRUE) OR oclerr is TRUE
   if (oclerr || (err && pipe->opencl_error))
@@ -2099,6 +3103,8 @@ restart:
     dt_opencl_unlock_device(pipe->devid);
     pipe->devid = -1;
   }
+  // size the arena for the next run:
+  dt_dev_pixelpipe_arena_reset(&pipe->arena);
   // ... and in case of other errors ...
   if (err)
   {
@@ -2112,6 +3118,7 @@ restart:
   pipe->backbuf = buf;
   pipe->backbuf_width  = width;
   pipe->backbuf_height = height;
+  pipe->backbuf_upscale = 1.0f/pipe->preliminary_scale;
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
 
   // printf("pixelpipe homebrew process end\n");
@@ -2122,6 +3129,7 @@ restart:
 void dt_dev_pixelpipe_flush_caches(dt_dev_pixelpipe_t *pipe)
 {
   dt_dev_pixelpipe_cache_flush(&pipe->cache);
+  dt_dev_pixelpipe_blur_flush(&pipe->blur);
 }
 
 void dt_dev_pixelpipe_get_dimensions(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int width_in, int height_in, int *width, int *height)
@@ -2160,6 +3168,45 @@ void dt_dev_pixelpipe_get_dimensions(dt_dev_pixelpipe_t *pipe, struct dt_develop
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
+int dt_dev_pixelpipe_get_roi_margin(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, const dt_iop_roi_t *roi)
+{
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  // neighbourhoods of chained modules add up, as the overlaps of the tiler do. the sum is kept in
+  // output pixels of roi, each module's part is scaled from its input pixels.
+  float margin = 0.0f;
+  dt_iop_roi_t roi_out = *roi, roi_in;
+  GList *modules = g_list_last(dev->iop);
+  GList *pieces  = g_list_last(pipe->nodes);
+  while(modules && pieces)
+  {
+    dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(piece->enabled && !(dev->gui_module && dev->gui_module->operation_tags_filter() &  module->operation_tags()))
+    {
+      module->modify_roi_in(module, piece, &roi_out, &roi_in);
+      // how far the input reaches beyond the output, in input pixels:
+      const float f = roi_in.scale / roi_out.scale;
+      float m = 0.0f;
+      m = fmaxf(m, roi_out.x * f - roi_in.x);
+      m = fmaxf(m, roi_out.y * f - roi_in.y);
+      m = fmaxf(m, roi_in.x + roi_in.width  - (roi_out.x + roi_out.width) * f);
+      m = fmaxf(m, roi_in.y + roi_in.height - (roi_out.y + roi_out.height) * f);
+      // neighbourhood the module needs when working on parts of the image:
+      dt_develop_tiling_t tiling = { 0 };
+      module->tiling_callback(module, piece, &roi_in, &roi_out, &tiling);
+      m = fmaxf(m, (float)tiling.overlap);
+      margin += m * roi->scale / roi_in.scale;
+      roi_out = roi_in;
+    }
+    modules = g_list_previous(modules);
+    pieces  = g_list_previous(pieces);
+  }
+  // more than the whole region is never needed:
+  margin = fminf(ceilf(margin), (float)MAX(roi->width, roi->height));
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return (int)margin;
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -24,6 +24,8 @@
 #include "develop/imageop.h"
 #include "develop/develop.h"
 #include "develop/pixelpipe_cache.h"
+#include "develop/pixelpipe_arena.h"
+#include "develop/pixelpipe_blur.h"
 
 /**
  * struct used by iop modules to connect to pixelpipe.
@@ -55,7 +57,11 @@ typedef struct dt_dev_pixelpipe_iop_t
   int colors;                      // how many colors per pixel
   dt_iop_roi_t buf_in, buf_out;    // theoretical full buffer regions of interest, as passed through modify_roi_out
   int process_cl_ready;            // set this to 0 in commit_params to temporarily disable the use of process_cl
+  int process_raw16;               // set in commit_params if process() can read and write the mosaic as uint16
   float processed_maximum[3];      // sensor saturation after this iop, used internally for caching
+  float process_time;              // wall time in seconds spent in this node during the last run, 0 if cached
+  uint64_t synch_hash;             // what the piece was last synched with, unchanged pieces are not committed again. 0 forces it
+  uint64_t input_hash;             // cache hash of the input of process(), for dt_dev_pixelpipe_blur_key(). 0 outside the darkroom
 }
 dt_dev_pixelpipe_iop_t;
 
@@ -78,6 +84,18 @@ typedef enum dt_dev_pixelpipe_type_t
 }
 dt_dev_pixelpipe_type_t;
 
+// the focused module picks on its input and output
+#define DT_DEV_PIXELPIPE_MAX_PICKERS_CL 2
+
+/** color picker result on its way back from the opencl device. */
+typedef struct dt_dev_pixelpipe_picker_cl_t
+{
+  struct dt_iop_module_t *module;
+  float *picked_color, *picked_color_min, *picked_color_max;
+  float result[12]; // mean, min and max, 4 floats each
+}
+dt_dev_pixelpipe_picker_cl_t;
+
 /**
  * this encapsulates the gegl pixel pipeline.
  * a develop module will need several of these:
@@ -88,6 +106,10 @@ typedef struct dt_dev_pixelpipe_t
 {
   // store history/zoom caches
   dt_dev_pixelpipe_cache_t cache;
+  // temporaries of process(), see dt_iop_scratch_alloc()
+  dt_dev_pixelpipe_arena_t arena;
+  // blurs of module inputs from earlier runs
+  dt_dev_pixelpipe_blur_cache_t blur;
   // set to non-zero in order to obsolete old cache entries on next pixelpipe run
   int cache_obsolete;
   // input buffer
@@ -98,6 +120,8 @@ typedef struct dt_dev_pixelpipe_t
   int iflipped;
   // input actually just downscaled buffer? iscale*iwidth = actual width
   float iscale;
+  // downscaled copies of the input, if any. only used if made from this input.
+  const dt_dev_pixelpipe_pyramid_t *pyramid;
   // dimensions of processed buffer
   int processed_width, processed_height;
   // sensor saturation, propagated through the operations:
@@ -111,11 +135,19 @@ typedef struct dt_dev_pixelpipe_t
   int backbuf_size;
   int backbuf_width, backbuf_height;
   uint64_t backbuf_hash;
+  // set by the caller for a preliminary pass at reduced resolution (progressive rendering),
+  // the backbuf then needs to be magnified by backbuf_upscale for display.
+  float preliminary_scale;
+  float backbuf_upscale;
   dt_pthread_mutex_t backbuf_mutex, busy_mutex;
   // working?
   int processing;
   // shutting down?
   int shutdown;
+  // the job this pipe renders for, if any. cancelling it shuts the pipe down, see dt_iop_breakpoint().
+  struct dt_job_t *job;
+  // the mosaic stays uint16 up to demosaic during this run, see DT_IOP_RAW16_ONE.
+  int raw16;
   // opencl enabled for this pixelpipe?
   int opencl_enabled;
   // opencl error detected?
@@ -129,8 +161,29 @@ typedef struct dt_dev_pixelpipe_t
   dt_dev_pixelpipe_type_t type;
   // the final output pixel format this pixelpipe will be converted to
   dt_imageio_levels_t levels;
+  // set by the export if the float output is converted to uint16 per channel anyway: if it ends up on the
+  // device, the pipe packs it there and copies back only these. output_packed tells if it did in the last run.
+  int pack_ui16;
+  int output_packed;
   // opencl device that has been locked for this pipe.
   int devid;
+  // numa node of the thread which set up the pipe, -1 if unknown. kept export pipes are handed out
+  // to threads on the same node, so their cache lines stay local.
+  int numa_node;
+  // color pickers enqueued on that device during this run, finished after it.
+  dt_dev_pixelpipe_picker_cl_t picker_cl[DT_DEV_PIXELPIPE_MAX_PICKERS_CL];
+  int picker_cl_num;
+  // upload of the output of a cpu module, started as soon as it was done because the next module
+  // runs on the device, and the host buffer it was started from:
+  void *cl_mem_ahead;
+  void *cl_ahead_host;
+  // hashes of the image id and the params of the first k pieces, for k = 0..prefix_hash_len-1.
+  // kept up to date by synch, so the cache hash costs O(1) per node.
+  uint64_t *prefix_hash;
+  int prefix_hash_len;
+  int32_t prefix_hash_imgid;
+  // set per run if no color picker or focused module filter needs to go into the cache hash:
+  int prefix_hash_static;
   // image struct as it was when the pixelpipe was initialized. copied to avoid race conditions.
   dt_image_t image;
 }
@@ -138,6 +191,22 @@ dt_dev_pixelpipe_t;
 
 struct dt_develop_t;
 
+#ifdef HAVE_OPENCL
+/** kernels the pipe runs itself, not belonging to a module. */
+typedef struct dt_dev_pixelpipe_cl_global_t
+{
+  int kernel_pack_ui16;
+  int kernel_warp_bilinear;
+  int kernel_warp_bicubic;
+  int kernel_warp_lanczos2;
+  int kernel_warp_lanczos3;
+}
+dt_dev_pixelpipe_cl_global_t;
+
+dt_dev_pixelpipe_cl_global_t *dt_dev_pixelpipe_init_cl_global(void);
+void dt_dev_pixelpipe_free_cl_global(dt_dev_pixelpipe_cl_global_t *g);
+#endif
+
 // inits the pixelpipe with plain passthrough input/output and empty input and default caching settings.
 int dt_dev_pixelpipe_init(dt_dev_pixelpipe_t *pipe);
 // inits the preview pixelpipe with plain passthrough input/output and empty input and default caching settings.
@@ -146,14 +215,27 @@ int dt_dev_pixelpipe_init_preview(dt_dev_pixelpipe_t *pipe);
 int dt_dev_pixelpipe_init_export(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height, int levels);
 // inits the pixelpipe with settings optimized for thumbnail export (no history stack cache)
 int dt_dev_pixelpipe_init_thumbnail(dt_dev_pixelpipe_t *pipe, int32_t width, int32_t height);
+// readies a pipe that has exported an image (and had its nodes cleaned up) for the next one, keeping the cache buffers.
+void dt_dev_pixelpipe_reset_export(dt_dev_pixelpipe_t *pipe, int levels);
 // inits the pixelpipe with given cacheline size and number of entries.
 int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, int32_t size, int32_t entries);
 // constructs a new input gegl_buffer from given RGB float array.
 void dt_dev_pixelpipe_set_input(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, float *input, int width, int height, float iscale);
+// lets the pipe import from downscaled copies of its (four channel float) input, reset by set_input.
+void dt_dev_pixelpipe_set_input_pyramid(dt_dev_pixelpipe_t *pipe, const dt_dev_pixelpipe_pyramid_t *pyramid);
+// (re)builds the downscaled copies of input, if they aren't from this input already. levels smaller
+// than min_size on either side are left out. returns non zero if out of memory, the pyramid is empty then.
+int dt_dev_pixelpipe_pyramid_update(dt_dev_pixelpipe_pyramid_t *pyramid, const float *input, const int width, const int height, const int min_size);
+void dt_dev_pixelpipe_pyramid_cleanup(dt_dev_pixelpipe_pyramid_t *pyramid);
 
 // returns the dimensions of the full image after processing.
 void dt_dev_pixelpipe_get_dimensions(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int width_in, int height_in, int *width, int *height);
 
+// returns the border (in output pixels) the modules together need around the given region of
+// interest, their neighbourhoods summed up. used to pad regions which are processed on their
+// own and stitched together.
+int dt_dev_pixelpipe_get_roi_margin(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, const dt_iop_roi_t *roi);
+
 // destroys all allocated data.
 void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe);
 
@@ -199,6 +281,13 @@ static inline int dt_dev_pixelpipe_uses_downsampled_input(dt_dev_pixelpipe_t *pi
            (pipe->type == DT_DEV_PIXELPIPE_THUMBNAIL);
 }
 
+// thumbnail pipes skip modules flagged IOP_FLAGS_THUMBNAIL_INVISIBLE and may use cheaper
+// approximations elsewhere, unless the user asked for thumbnails exactly like the export.
+static inline int dt_dev_pixelpipe_fast_thumbnail(dt_dev_pixelpipe_t *pipe)
+{
+  return pipe->type == DT_DEV_PIXELPIPE_THUMBNAIL && !dt_conf_get_bool("plugins/lighttable/thumbnail_strict");
+}
+
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
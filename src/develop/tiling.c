@@ -21,6 +21,8 @@
 #include "develop/pixelpipe.h"
 #include "develop/blend.h"
 #include "common/opencl.h"
+#include "common/trace.h"
+#include "common/profiling.h"
 #include "control/control.h"
 
 #include <string.h>
@@ -38,6 +40,12 @@
    power of 2. set to 1 for no effect. */
 #define CL_ALIGNMENT 4
 
+/* buffer sets in turn for pipelined opencl tiling */
+#define DT_TILING_CL_SLOTS 2
+
+/* devices to spread the tiles of one export over */
+#define DT_TILING_CL_MAX_DEVICES 8
+
 /* parameter RESERVE for extended roi_in sizes due to inaccuracies when doing
    roi_out -> roi_in estimations.
    Needs to be increased if tiling fails due to insufficient buffer sizes. */
@@ -99,6 +107,27 @@ _print_roi(const dt_iop_roi_t *roi, const char *label)
 }
 
 
+/* checked between tiles: true if the history or zoom changed since this run started, or
+   darkroom is left. the pixelpipe drops the output of such a run anyways. */
+static inline int
+_tiling_cancelled(struct dt_dev_pixelpipe_iop_t *piece)
+{
+  return dt_iop_breakpoint(piece->module->dev, piece->pipe);
+}
+
+/* puts one tile on the timeline, if recording. */
+static void
+_tiling_trace(struct dt_iop_module_t *self, const double start, const dt_iop_roi_t *roi)
+{
+  if(!dt_trace_enabled()) return;
+  char name[128], args[256];
+  snprintf(name, sizeof(name), "%s tile", self->name());
+  snprintf(args, sizeof(args), "\"x\": %d, \"y\": %d, \"width\": %d, \"height\": %d",
+           roi->x, roi->y, roi->width, roi->height);
+  dt_trace_complete("tiling", name, start, args);
+}
+
+
 #if 0
 static void
 _nm_constraints(double x[], int n)
@@ -547,23 +576,42 @@ _nm_fit_output_to_input_roi(struct dt_iop_module_t *self, struct dt_dev_pixelpip
 
 
 
+static inline int
+_roi_matches(const dt_iop_roi_t *a, const dt_iop_roi_t *b, const int delta)
+{
+  return abs(a->x - b->x) <= delta && abs(a->y - b->y) <= delta &&
+         abs(a->width - b->width) <= delta && abs(a->height - b->height) <= delta;
+}
+
+
 /* find a matching oroi_full by probing start value of oroi and get corresponding input roi into iroi_probe.
-   We search in two steps. first by a simplicistic iterative search which will succeed in most cases.
+   If the module can invert modify_roi_in() itself, we take that. Else, or if it's off by more than delta,
+   we search in two steps. first by a simplicistic iterative search which will succeed in most cases.
    If this does not converge, we do a downhill simplex (nelder-mead) fitting */
 static int
-_fit_output_to_input_roi(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *iroi, dt_iop_roi_t *oroi, int delta, int iter)
+_search_output_to_input_roi(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *iroi, dt_iop_roi_t *oroi, int delta, int iter)
 {
   dt_iop_roi_t iroi_probe = *iroi;
   dt_iop_roi_t save_oroi = *oroi;
 
+  // the module knows best. this also is a better start for the search than the caller's guess
+  dt_iop_roi_t oroi_inverse = *oroi;
+  if(self->invert_roi_in && self->invert_roi_in(self, piece, iroi, &oroi_inverse))
+  {
+    oroi_inverse.scale = oroi->scale;
+    self->modify_roi_in(self, piece, &oroi_inverse, &iroi_probe);
+    if(_roi_matches(&iroi_probe, iroi, delta))
+    {
+      *oroi = oroi_inverse;
+      return TRUE;
+    }
+    *oroi = oroi_inverse;
+  }
+
   // try to go the easy way. this works in many cases where output is
   // just like input, only scaled down
   self->modify_roi_in(self, piece, oroi, &iroi_probe);
-  while ((abs((int)iroi_probe.x - (int)iroi->x) > delta ||
-          abs((int)iroi_probe.y - (int)iroi->y) > delta ||
-          abs((int)iroi_probe.width - (int)iroi->width) > delta ||
-          abs((int)iroi_probe.height - (int)iroi->height) > delta) &&
-         iter > 0)
+  while (!_roi_matches(&iroi_probe, iroi, delta) && iter > 0)
   {
     //_print_roi(&iroi_probe, "tile iroi_probe");
     //_print_roi(oroi, "tile oroi old");
@@ -592,12 +640,105 @@ _fit_output_to_input_roi(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_i
 }
 
 
+/* the search above costs many calls to modify_roi_in(), which for distorting modules can be expensive,
+   for every single tile. as modules are deterministic in their geometry, we remember the outcome for
+   the same module with the same parameters and buffer sizes. repeated exports skip the search. */
+#define DT_TILING_ROI_CACHE_SIZE 256
+
+typedef struct _tiling_roi_key_t
+{
+  const dt_iop_module_so_t *so;
+  int multi_priority;
+  uint64_t hash;
+  int pipe_width, pipe_height, iwidth, iheight;
+  dt_iop_roi_t buf_in, buf_out;
+  dt_iop_roi_t iroi, oroi;
+  int delta;
+}
+_tiling_roi_key_t;
+
+typedef struct _tiling_roi_cache_entry_t
+{
+  _tiling_roi_key_t key;
+  dt_iop_roi_t oroi;
+  int fit;
+}
+_tiling_roi_cache_entry_t;
+
+static _tiling_roi_cache_entry_t _tiling_roi_cache[DT_TILING_ROI_CACHE_SIZE];
+static int _tiling_roi_cache_used = 0, _tiling_roi_cache_next = 0;
+static GStaticMutex _tiling_roi_cache_mutex = G_STATIC_MUTEX_INIT;
+
+static int
+_fit_output_to_input_roi(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *iroi, dt_iop_roi_t *oroi, int delta, int iter)
+{
+  _tiling_roi_key_t key;
+  // compared as a whole, so no garbage in the padding:
+  memset(&key, 0, sizeof(key));
+  key.so = self->so;
+  key.multi_priority = self->multi_priority;
+  key.hash = piece->hash;
+  key.pipe_width = piece->pipe->iwidth;
+  key.pipe_height = piece->pipe->iheight;
+  key.iwidth = piece->iwidth;
+  key.iheight = piece->iheight;
+  key.buf_in = piece->buf_in;
+  key.buf_out = piece->buf_out;
+  key.iroi = *iroi;
+  key.oroi = *oroi;
+  key.delta = delta;
+
+  g_static_mutex_lock(&_tiling_roi_cache_mutex);
+  for(int k=0; k<_tiling_roi_cache_used; k++)
+  {
+    const _tiling_roi_cache_entry_t *entry = _tiling_roi_cache + k;
+    if(memcmp(&entry->key, &key, sizeof(key))) continue;
+    *oroi = entry->oroi;
+    const int fit = entry->fit;
+    g_static_mutex_unlock(&_tiling_roi_cache_mutex);
+    return fit;
+  }
+  g_static_mutex_unlock(&_tiling_roi_cache_mutex);
+
+  const int fit = _search_output_to_input_roi(self, piece, iroi, oroi, delta, iter);
+
+  // replace the oldest entry:
+  g_static_mutex_lock(&_tiling_roi_cache_mutex);
+  _tiling_roi_cache_entry_t *entry = _tiling_roi_cache + _tiling_roi_cache_next;
+  entry->key = key;
+  entry->oroi = *oroi;
+  entry->fit = fit;
+  _tiling_roi_cache_next = (_tiling_roi_cache_next + 1) % DT_TILING_ROI_CACHE_SIZE;
+  _tiling_roi_cache_used = _max(_tiling_roi_cache_used, _tiling_roi_cache_next == 0 ? DT_TILING_ROI_CACHE_SIZE : _tiling_roi_cache_next);
+  g_static_mutex_unlock(&_tiling_roi_cache_mutex);
+  return fit;
+}
+
+
+// host buffers for the tiles, accounted for in the memory statistics:
+static void *
+_tiling_alloc(const size_t size)
+{
+  void *buf = dt_alloc_align(64, size);
+  if(buf) dt_memory_stats_add(DT_MEMORY_TILING, size);
+  return buf;
+}
+
+static void
+_tiling_free(void *buf, const size_t size)
+{
+  if(!buf) return;
+  dt_memory_stats_add(DT_MEMORY_TILING, -(int64_t)size);
+  free(buf);
+}
+
 /* simple tiling algorithm for roi_in == roi_out, i.e. for pixel to pixel modules/operations */
 static void
 _default_process_tiling_ptp (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, const int in_bpp)
 {
   void *input = NULL;
   void *output = NULL;
+  size_t input_size = 0, output_size = 0;
 
   const int out_bpp = self->output_bpp(self, piece->pipe, piece);
   const int ipitch = roi_in->width * in_bpp;
@@ -615,17 +756,21 @@ _default_process_tiling_ptp (struct dt_iop_module_t *self, struct dt_dev_pixelpi
     goto fallback;
   }
 
+  /* modules which are serial inside may process several tiles at once. they share the memory budget. */
+  int num_threads = 1;
+  if(self->flags() & IOP_FLAGS_TILING_PARALLEL) num_threads = _max(omp_get_max_threads(), 1);
+
   /* calculate optimal size of tiles */
   float available = (float)dt_conf_get_int("host_memory_limit")*1024.0f*1024.0f;
   assert(available >= 500.0f*1024.0f*1024.0f);
   /* correct for size of ivoid and ovoid which are needed on top of tiling */
-  available = fmax(available - (roi_out->width*roi_out->height*out_bpp) - (roi_in->width*roi_in->height*in_bpp) - tiling.overhead, 0);
+  available = fmax(available - (roi_out->width*roi_out->height*out_bpp) - (roi_in->width*roi_in->height*in_bpp) - num_threads*tiling.overhead, 0) / num_threads;
 
   /* we ignore the above value if singlebuffer_limit (is defined and) is higher than available/tiling.factor.
      this will mainly allow tiling for modules with high and "unpredictable" memory demand which is
      reflected in high values of tiling.factor (take bilateral noise reduction as an example). */
   float singlebuffer = (float)dt_conf_get_int("singlebuffer_limit")*1024.0f*1024.0f;
-  singlebuffer = fmax(singlebuffer, 2.0f*1024.0f*1024.0f);
+  singlebuffer = fmax(singlebuffer / num_threads, 2.0f*1024.0f*1024.0f);
   float factor = fmax(tiling.factor, 1.0f);
   float maxbuf = fmax(tiling.maxbuf, 1.0f);
   singlebuffer = fmax(available / factor, singlebuffer);
@@ -697,14 +842,21 @@ _default_process_tiling_ptp (struct dt_iop_module_t *self, struct dt_dev_pixelpi
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] use tiling on module '%s' for image with full size %d x %d\n", self->op, roi_in->width, roi_in->height);
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] (%d x %d) tiles with max dimensions %d x %d and overlap %d\n", tiles_x, tiles_y, width, height, overlap);
 
-  /* reserve input and output buffers for tiles */
-  input = dt_alloc_align(64, width*height*in_bpp);
+  num_threads = _min(num_threads, tiles_x*tiles_y);
+  if(num_threads > 1)
+    dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] processing %d tiles at once for module '%s'\n", num_threads, self->op);
+
+  /* reserve input and output buffers for tiles, one set per thread */
+  const size_t in_size = (size_t)width*height*in_bpp, out_size = (size_t)width*height*out_bpp;
+  input_size = num_threads*in_size;
+  input = _tiling_alloc(input_size);
   if(input == NULL)
   {
     dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] could not alloc input buffer for module '%s'\n", self->op);
     goto error;
   }
-  output = dt_alloc_align(64, width*height*out_bpp);
+  output_size = num_threads*out_size;
+  output = _tiling_alloc(output_size);
   if(output == NULL)
   {
     dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] could not alloc output buffer for module '%s'\n", self->op);
@@ -718,86 +870,114 @@ _default_process_tiling_ptp (struct dt_iop_module_t *self, struct dt_dev_pixelpi
     processed_maximum_saved[k] = piece->pipe->processed_maximum[k];
 
 
-  /* iterate over tiles */
-  for(int tx=0; tx<tiles_x; tx++)
-    for(int ty=0; ty<tiles_y; ty++)
+  /* iterate over tiles. parallel tiles don't touch processed_maximum, see IOP_FLAGS_TILING_PARALLEL. */
+  int stop = 0;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) num_threads(num_threads) if(num_threads > 1) shared(stop,processed_maximum_new)
+#endif
+  for(int t=0; t<tiles_x*tiles_y; t++)
+  {
+    const int tx = t / tiles_y, ty = t % tiles_y;
+
+    /* stop early if this run became obsolete, the pixelpipe throws away the output */
+    if(stop || _tiling_cancelled(piece))
     {
-      piece->pipe->tiling = 1;
+      stop = 1;
+      continue;
+    }
 
-      size_t wd = tx * tile_wd + width > roi_in->width  ? roi_in->width - tx * tile_wd : width;
-      size_t ht = ty * tile_ht + height > roi_in->height ? roi_in->height- ty * tile_ht : height;
+    piece->pipe->tiling = 1;
 
-      /* no need to process end-tiles that are smaller than overlap */
-      if((wd <= overlap && tx > 0) || (ht <= overlap && ty > 0)) continue;
+    size_t wd = tx * tile_wd + width > roi_in->width  ? roi_in->width - tx * tile_wd : width;
+    size_t ht = ty * tile_ht + height > roi_in->height ? roi_in->height- ty * tile_ht : height;
 
-      /* origin and region of effective part of tile, which we want to store later */
-      size_t origin[] = { 0, 0, 0 };
-      size_t region[] = { wd, ht, 1 };
+    /* no need to process end-tiles that are smaller than overlap */
+    if((wd <= overlap && tx > 0) || (ht <= overlap && ty > 0)) continue;
 
-      /* roi_in and roi_out for process_cl on subbuffer */
-      dt_iop_roi_t iroi = { roi_in->x+tx*tile_wd, roi_in->y+ty*tile_ht, wd, ht, roi_in->scale };
-      dt_iop_roi_t oroi = { roi_out->x+tx*tile_wd, roi_out->y+ty*tile_ht, wd, ht, roi_out->scale };
+    /* this thread's tile buffers */
+    const int thread = omp_get_thread_num();
+    char *tile_input = (char *)input + thread*in_size;
+    char *tile_output = (char *)output + thread*out_size;
 
-      /* offsets of tile into ivoid and ovoid */
-      size_t ioffs = (ty * tile_ht)*ipitch + (tx * tile_wd)*in_bpp;
-      size_t ooffs = (ty * tile_ht)*opitch + (tx * tile_wd)*out_bpp;
+    /* origin and region of effective part of tile, which we want to store later */
+    size_t origin[] = { 0, 0, 0 };
+    size_t region[] = { wd, ht, 1 };
 
+    /* roi_in and roi_out for process_cl on subbuffer */
+    dt_iop_roi_t iroi = { roi_in->x+tx*tile_wd, roi_in->y+ty*tile_ht, wd, ht, roi_in->scale };
+    dt_iop_roi_t oroi = { roi_out->x+tx*tile_wd, roi_out->y+ty*tile_ht, wd, ht, roi_out->scale };
 
-      dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] tile (%d, %d) with %d x %d at origin [%d, %d]\n", tx, ty, wd, ht, tx*tile_wd, ty*tile_ht);
+    /* offsets of tile into ivoid and ovoid */
+    size_t ioffs = (ty * tile_ht)*ipitch + (tx * tile_wd)*in_bpp;
+    size_t ooffs = (ty * tile_ht)*opitch + (tx * tile_wd)*out_bpp;
 
-      /* prepare input tile buffer */
+
+    dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] tile (%d, %d) with %d x %d at origin [%d, %d]\n", tx, ty, wd, ht, tx*tile_wd, ty*tile_ht);
+
+    /* prepare input tile buffer */
 #ifdef _OPENMP
-      #pragma omp parallel for default(none) shared(input,width,ivoid,ioffs,wd,ht) schedule(static)
+    #pragma omp parallel for default(none) shared(tile_input,width,ivoid,ioffs,wd,ht) schedule(static)
 #endif
-      for(size_t j=0; j<ht; j++)
-        memcpy((char *)input+j*wd*in_bpp, (char *)ivoid+ioffs+j*ipitch, wd*in_bpp);
+    for(size_t j=0; j<ht; j++)
+      memcpy(tile_input+j*wd*in_bpp, (char *)ivoid+ioffs+j*ipitch, wd*in_bpp);
 
-      /* take original processed_maximum as starting point */
+    /* take original processed_maximum as starting point */
+    if(num_threads == 1)
       for(int k=0; k<3; k++)
         piece->pipe->processed_maximum[k] = processed_maximum_saved[k];
 
-      /* call process() of module */
-      self->process(self, piece, input, output, &iroi, &oroi);
-
-      /* aggregate resulting processed_maximum */
-      /* TODO: check if there really can be differences between tiles and take
-               appropriate action (calculate minimum, maximum, average, ...?) */
-      for(int k=0; k<3; k++)
-      {
-        if(tx+ty > 0 && fabs(processed_maximum_new[k] - piece->pipe->processed_maximum[k]) > 1.0e-6f)
-          dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] processed_maximum[%d] differs between tiles in module '%s'\n", k, self->op);
-        processed_maximum_new[k] = piece->pipe->processed_maximum[k];
-      }
+    /* call process() of module */
+    TIMER_START(prof_tile, "tile");
+    const double tile_start = dt_get_wtime();
+    self->process(self, piece, tile_input, tile_output, &iroi, &oroi);
+    TIMER_STOP(prof_tile);
+    _tiling_trace(self, tile_start, &oroi);
+
+    /* aggregate resulting processed_maximum */
+    /* TODO: check if there really can be differences between tiles and take
+             appropriate action (calculate minimum, maximum, average, ...?) */
+    for(int k=0; k<3 && num_threads == 1; k++)
+    {
+      if(tx+ty > 0 && fabs(processed_maximum_new[k] - piece->pipe->processed_maximum[k]) > 1.0e-6f)
+        dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] processed_maximum[%d] differs between tiles in module '%s'\n", k, self->op);
+      processed_maximum_new[k] = piece->pipe->processed_maximum[k];
+    }
 
-      /* correct origin and region of tile for overlap.
-         make sure that we only copy back the "good" part. */
-      if(tx > 0)
-      {
-        origin[0] += overlap;
-        region[0] -= overlap;
-        ooffs += overlap*out_bpp;
-      }
-      if(ty > 0)
-      {
-        origin[1] += overlap;
-        region[1] -= overlap;
-        ooffs += overlap*opitch;
-      }
+    /* correct origin and region of tile for overlap.
+       make sure that we only copy back the "good" part. */
+    if(tx > 0)
+    {
+      origin[0] += overlap;
+      region[0] -= overlap;
+      ooffs += overlap*out_bpp;
+    }
+    if(ty > 0)
+    {
+      origin[1] += overlap;
+      region[1] -= overlap;
+      ooffs += overlap*opitch;
+    }
 
-      /* copy "good" part of tile to output buffer */
+    /* copy "good" part of tile to output buffer */
 #ifdef _OPENMP
-      #pragma omp parallel for default(none) shared(ovoid,ooffs,output,width,origin,region,wd) schedule(static)
+    #pragma omp parallel for default(none) shared(ovoid,ooffs,tile_output,width,origin,region,wd) schedule(static)
 #endif
-      for(size_t j=0; j<region[1]; j++)
-        memcpy((char *)ovoid+ooffs+j*opitch, (char *)output+((j+origin[1])*wd+origin[0])*out_bpp, region[0]*out_bpp);
-    }
+    for(size_t j=0; j<region[1]; j++)
+      memcpy((char *)ovoid+ooffs+j*opitch, tile_output+((j+origin[1])*wd+origin[0])*out_bpp, region[0]*out_bpp);
+  }
+
+  /* the module promised to keep it */
+  if(num_threads > 1)
+    for(int k=0; k<3; k++)
+      processed_maximum_new[k] = processed_maximum_saved[k];
 
+cancelled:
   /* copy back final processed_maximum */
   for(int k=0; k<3; k++)
     piece->pipe->processed_maximum[k] = processed_maximum_new[k];
 
-  if(input != NULL) free(input);
-  if(output != NULL) free(output);
+  _tiling_free(input, input_size);
+  _tiling_free(output, output_size);
   piece->pipe->tiling = 0;
   return;
 
@@ -806,8 +986,8 @@ error:
   // fall through
 
 fallback:
-  if(input != NULL) free(input);
-  if(output != NULL) free(output);
+  _tiling_free(input, input_size);
+  _tiling_free(output, output_size);
   piece->pipe->tiling = 0;
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] fall back to standard processing for module '%s'\n", self->op);
   self->process(self, piece, ivoid, ovoid, roi_in, roi_out);
@@ -824,6 +1004,7 @@ _default_process_tiling_roi (struct dt_iop_module_t *self, struct dt_dev_pixelpi
 {
   void *input = NULL;
   void *output = NULL;
+  size_t input_size = 0, output_size = 0;
 
   //_print_roi(roi_in, "module roi_in");
   //_print_roi(roi_out, "module roi_out");
@@ -953,6 +1134,9 @@ _default_process_tiling_roi (struct dt_iop_module_t *self, struct dt_dev_pixelpi
   for(int tx=0; tx<tiles_x; tx++)
     for(int ty=0; ty<tiles_y; ty++)
     {
+      /* stop early if this run became obsolete, the pixelpipe throws away the output */
+      if(_tiling_cancelled(piece)) goto cancelled;
+
       piece->pipe->tiling = 1;
 
       /* the output dimensions of the good part of this specific tile */
@@ -1038,13 +1222,15 @@ _default_process_tiling_roi (struct dt_iop_module_t *self, struct dt_dev_pixelpi
 
 
       /* prepare input tile buffer */
-      input = dt_alloc_align(64, iroi_full.width*iroi_full.height*in_bpp);
+      input_size = (size_t)iroi_full.width*iroi_full.height*in_bpp;
+      input = _tiling_alloc(input_size);
       if(input == NULL)
       {
         dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] could not alloc input buffer for module '%s'\n", self->op);
         goto error;
       }
-      output = dt_alloc_align(64, oroi_full.width*oroi_full.height*out_bpp);
+      output_size = (size_t)oroi_full.width*oroi_full.height*out_bpp;
+      output = _tiling_alloc(output_size);
       if(output == NULL)
       {
         dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] could not alloc output buffer for module '%s'\n", self->op);
@@ -1062,7 +1248,11 @@ _default_process_tiling_roi (struct dt_iop_module_t *self, struct dt_dev_pixelpi
         piece->pipe->processed_maximum[k] = processed_maximum_saved[k];
 
       /* call process() of module */
+      TIMER_START(prof_tile, "tile");
+      const double tile_start = dt_get_wtime();
       self->process(self, piece, input, output, &iroi_full, &oroi_full);
+      TIMER_STOP(prof_tile);
+      _tiling_trace(self, tile_start, &oroi_full);
 
       /* aggregate resulting processed_maximum */
       /* TODO: check if there really can be differences between tiles and take
@@ -1083,17 +1273,18 @@ _default_process_tiling_roi (struct dt_iop_module_t *self, struct dt_dev_pixelpi
       for(int j=0; j<oroi_good.height; j++)
         memcpy((char *)ovoid+ooffs+j*opitch, (char *)output+((j+origin_y)*oroi_full.width+origin_x)*out_bpp, oroi_good.width*out_bpp);
 
-      free(input);
-      free(output);
+      _tiling_free(input, input_size);
+      _tiling_free(output, output_size);
       input = output = NULL;
     }
 
+cancelled:
   /* copy back final processed_maximum */
   for(int k=0; k<3; k++)
     piece->pipe->processed_maximum[k] = processed_maximum_new[k];
 
-  if(input != NULL) free(input);
-  if(output != NULL) free(output);
+  _tiling_free(input, input_size);
+  _tiling_free(output, output_size);
   piece->pipe->tiling = 0;
   return;
 
@@ -1102,8 +1293,8 @@ error:
   // fall through
 
 fallback:
-  if(input != NULL) free(input);
-  if(output != NULL) free(output);
+  _tiling_free(input, input_size);
+  _tiling_free(output, output_size);
   piece->pipe->tiling = 0;
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] fall back to standard processing for module '%s'\n", self->op);
   self->process(self, piece, ivoid, ovoid, roi_in, roi_out);
@@ -1119,27 +1310,82 @@ fallback:
 void
 default_process_tiling (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, const int in_bpp)
 {
+  TIMER_START(prof, self->op);
   if(memcmp(roi_in, roi_out, sizeof(struct dt_iop_roi_t)) || (self->flags() & IOP_FLAGS_TILING_FULL_ROI))
     _default_process_tiling_roi (self, piece, ivoid, ovoid, roi_in, roi_out, in_bpp);
   else
     _default_process_tiling_ptp (self, piece, ivoid, ovoid, roi_in, roi_out, in_bpp);
+  TIMER_STOP(prof);
   return;
 }
 
 
 
 #ifdef HAVE_OPENCL
+/* buffer set for one tile in flight, pipelined opencl tiling takes turns with DT_TILING_CL_SLOTS of them */
+typedef struct _tiling_slot_t
+{
+  cl_mem input, output;                 // device tiles, reused while the size fits
+  size_t wd, ht;
+  cl_mem pinned_input, pinned_output;   // pinned memory and its host mappings, if used
+  void *input_buffer, *output_buffer;
+  int pending;                          // a tile is on its way
+  void *marker;                         // opencl marker behind its last command
+  size_t ooffs, origin[3], region[3];   // where its good part goes in the output
+}
+_tiling_slot_t;
+
+/* waits for the tile in flight in this slot, if any, and copies it out of the pinned buffer. */
+static int
+_tiling_slot_finish(const int devid, _tiling_slot_t *slot, void *ovoid, const int opitch, const int out_bpp,
+                    const int use_pinned_memory)
+{
+  if(!slot->pending) return TRUE;
+  slot->pending = 0;
+  const int ok = dt_opencl_wait_for_marker(devid, slot->marker);
+  slot->marker = NULL;
+  if(!ok) return FALSE;
+
+  if(use_pinned_memory)
+  {
+    /* copy "good" part of tile from pinned output buffer to output image */
+    size_t ooffs = slot->ooffs, wd = slot->wd, pitch = opitch, bpp = out_bpp;
+    size_t *origin = slot->origin, *region = slot->region;
+    void *output_buffer = slot->output_buffer;
+#ifdef _OPENMP
+    #pragma omp parallel for default(none) shared(ovoid,output_buffer,origin,region,ooffs,wd,pitch,bpp) schedule(static)
+#endif
+    for(size_t j=0; j<region[1]; j++)
+      memcpy((char *)ovoid+ooffs+j*pitch, (char *)output_buffer+((j+origin[1])*wd+origin[0])*bpp, region[0]*bpp);
+  }
+  return TRUE;
+}
+
+static void
+_tiling_slots_cleanup(const int devid, _tiling_slot_t *slots, const int num_slots)
+{
+  /* be sure nothing is in flight anymore: */
+  dt_opencl_finish(devid);
+  for(int k=0; k<num_slots; k++)
+  {
+    _tiling_slot_t *slot = slots + k;
+    if(slot->marker != NULL) (void)dt_opencl_wait_for_marker(devid, slot->marker);
+    if(slot->input_buffer != NULL) dt_opencl_unmap_mem_object(devid, slot->pinned_input, slot->input_buffer);
+    if(slot->pinned_input != NULL) dt_opencl_release_mem_object(slot->pinned_input);
+    if(slot->output_buffer != NULL) dt_opencl_unmap_mem_object(devid, slot->pinned_output, slot->output_buffer);
+    if(slot->pinned_output != NULL) dt_opencl_release_mem_object(slot->pinned_output);
+    if(slot->input != NULL) dt_opencl_release_mem_object(slot->input);
+    if(slot->output != NULL) dt_opencl_release_mem_object(slot->output);
+  }
+}
+
 /* simple tiling algorithm for roi_in == roi_out, i.e. for pixel to pixel modules/operations */
 static int
 _default_process_tiling_cl_ptp (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, const int in_bpp)
 {
   cl_int err = -999;
-  cl_mem input = NULL;
-  cl_mem output = NULL;
-  cl_mem pinned_input = NULL;
-  cl_mem pinned_output = NULL;
-  void *input_buffer = NULL;
-  void *output_buffer = NULL;
+  _tiling_slot_t slots[DT_TILING_CL_SLOTS];
+  memset(slots, 0, sizeof(slots));
 
   const int devid = piece->pipe->devid;
   const int out_bpp = self->output_bpp(self, piece->pipe, piece);
@@ -1153,14 +1399,17 @@ _default_process_tiling_cl_ptp (struct dt_iop_module_t *self, struct dt_dev_pixe
 
   /* shall we use pinned memory transfers? */
   int use_pinned_memory = dt_conf_get_bool("opencl_use_pinned_memory");
-  const int pinned_buffer_overhead = use_pinned_memory ? 2 : 0; // add two additional pinned memory buffers which seemingly get allocated not only on host but also on device (why???)
+  /* pipelined: upload and process the next tile while the previous one is still on its way back.
+     costs one more set of input and output buffers on the device. */
+  const int num_slots = dt_conf_get_bool("opencl_pipelined_tiling") ? DT_TILING_CL_SLOTS : 1;
+  const int pinned_buffer_overhead = use_pinned_memory ? 2*num_slots : 0; // add two additional pinned memory buffers which seemingly get allocated not only on host but also on device (why???)
   const float pinned_buffer_slack = use_pinned_memory ? 0.85f : 1.0f; // avoid problems when pinned buffer size gets too close to max_mem_alloc size
 
   /* calculate optimal size of tiles */
   float headroom = (float)dt_conf_get_int("opencl_memory_headroom")*1024.0f*1024.0f;
   headroom = fmin(fmax(headroom, 0.0f), (float)darktable.opencl->dev[devid].max_global_mem);
   const float available = darktable.opencl->dev[devid].max_global_mem - headroom;
-  float factor = fmax(tiling.factor + pinned_buffer_overhead, 1.0f);                     
+  float factor = fmax(tiling.factor + pinned_buffer_overhead + 2*(num_slots-1), 1.0f);
   const float singlebuffer = fmin(fmax((available - tiling.overhead) / factor, 0.0f), pinned_buffer_slack*darktable.opencl->dev[devid].max_mem_alloc);
   float maxbuf = fmax(tiling.maxbuf, 1.0f);
   int width = _min(roi_in->width, darktable.opencl->dev[devid].max_image_width);
@@ -1245,53 +1494,54 @@ _default_process_tiling_cl_ptp (struct dt_iop_module_t *self, struct dt_dev_pixe
     processed_maximum_saved[k] = piece->pipe->processed_maximum[k];
 
   /* reserve pinned input and output memory for host<->device data transfer */
-  if(use_pinned_memory)
+  for(int k=0; k<num_slots && use_pinned_memory; k++)
   {
-    pinned_input = dt_opencl_alloc_device_buffer_with_flags(devid, width*height*in_bpp, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR);
-    if(pinned_input == NULL)
+    _tiling_slot_t *slot = slots + k;
+    slot->pinned_input = dt_opencl_alloc_device_buffer_with_flags(devid, width*height*in_bpp, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR);
+    if(slot->pinned_input == NULL)
     {
       dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_ptp] could not alloc pinned input buffer for module '%s'\n", self->op);
       use_pinned_memory = 0;
+      break;
     }
-  }
-
-  if(use_pinned_memory)
-  {
 
-    input_buffer = dt_opencl_map_buffer(devid, pinned_input, CL_TRUE, CL_MAP_WRITE, 0, width*height*in_bpp);
-    if(input_buffer == NULL)
+    slot->input_buffer = dt_opencl_map_buffer(devid, slot->pinned_input, CL_TRUE, CL_MAP_WRITE, 0, width*height*in_bpp);
+    if(slot->input_buffer == NULL)
     {
       dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_ptp] could not map pinned input buffer to host memory for module '%s'\n", self->op);
       use_pinned_memory = 0;
+      break;
     }
-  }
 
-  if(use_pinned_memory)
-  {
-
-    pinned_output = dt_opencl_alloc_device_buffer_with_flags(devid, width*height*out_bpp, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR);
-    if(pinned_output == NULL)
+    slot->pinned_output = dt_opencl_alloc_device_buffer_with_flags(devid, width*height*out_bpp, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR);
+    if(slot->pinned_output == NULL)
     {
       dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_ptp] could not alloc pinned output buffer for module '%s'\n", self->op);
       use_pinned_memory = 0;
+      break;
     }
-  }
 
-  if(use_pinned_memory)
-  {
-
-    output_buffer = dt_opencl_map_buffer(devid, pinned_output, CL_TRUE, CL_MAP_READ, 0, width*height*out_bpp);
-    if(output_buffer == NULL)
+    slot->output_buffer = dt_opencl_map_buffer(devid, slot->pinned_output, CL_TRUE, CL_MAP_READ, 0, width*height*out_bpp);
+    if(slot->output_buffer == NULL)
     {
       dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_ptp] could not map pinned output buffer to host memory for module '%s'\n", self->op);
       use_pinned_memory = 0;
+      break;
     }
   }
 
+  /* the host has to wait for a tile before it can reuse its pinned buffers. without those, the queue is
+     in order anyways, we only wait to free the event handles (and keep a bound on the queue length). */
+  const int wait_for_tiles = use_pinned_memory || !darktable.opencl->async_pixelpipe || piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT;
+  int num_tiles = 0;
+
   /* iterate over tiles */
   for(int tx=0; tx<tiles_x; tx++)
     for(int ty=0; ty<tiles_y; ty++)
     {
+      /* stop early if this run became obsolete, the pixelpipe throws away the output */
+      if(_tiling_cancelled(piece)) goto cancelled;
+
       piece->pipe->tiling = 1;
 
       size_t wd = tx * tile_wd + width > roi_in->width  ? roi_in->width - tx * tile_wd : width;
@@ -1300,6 +1550,10 @@ _default_process_tiling_cl_ptp (struct dt_iop_module_t *self, struct dt_dev_pixe
       /* no need to process (end)tiles that are smaller than overlap */
       if((wd <= overlap && tx > 0) || (ht <= overlap && ty > 0)) continue;
 
+      /* take turns with the buffer sets, the one we get has to be done with its previous tile */
+      _tiling_slot_t *slot = slots + (num_tiles++ % num_slots);
+      if(!_tiling_slot_finish(devid, slot, ovoid, opitch, out_bpp, use_pinned_memory)) goto error;
+
       /* origin and region of effective part of tile, which we want to store later */
       size_t origin[] = { 0, 0, 0 };
       size_t region[] = { wd, ht, 1 };
@@ -1316,15 +1570,27 @@ _default_process_tiling_cl_ptp (struct dt_iop_module_t *self, struct dt_dev_pixe
 
       dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_ptp] tile (%d, %d) with %d x %d at origin [%d, %d]\n", tx, ty, wd, ht, tx*tile_wd, ty*tile_ht);
 
-      /* get input and output buffers */
-      input = dt_opencl_alloc_device(devid, wd, ht, in_bpp);
-      if(input == NULL) goto error;
-      output = dt_opencl_alloc_device(devid, wd, ht, out_bpp);
-      if(output == NULL) goto error;
+      /* get input and output buffers, unless the slot has some of the right size already.
+         the queue is in order, so they can be released while still in use. */
+      if(slot->input == NULL || slot->wd != wd || slot->ht != ht)
+      {
+        if(slot->input != NULL) dt_opencl_release_mem_object(slot->input);
+        if(slot->output != NULL) dt_opencl_release_mem_object(slot->output);
+        slot->output = NULL;
+        slot->wd = wd;
+        slot->ht = ht;
+        slot->input = dt_opencl_alloc_device(devid, wd, ht, in_bpp);
+        if(slot->input == NULL) goto error;
+        slot->output = dt_opencl_alloc_device(devid, wd, ht, out_bpp);
+        if(slot->output == NULL) goto error;
+      }
+      cl_mem input = slot->input;
+      cl_mem output = slot->output;
 
       if(use_pinned_memory)
       {
         /* prepare pinned input tile buffer: copy part of input image */
+        void *input_buffer = slot->input_buffer;
 #ifdef _OPENMP
         #pragma omp parallel for default(none) shared(input_buffer,width,ivoid,ioffs,wd,ht) schedule(static)
 #endif
@@ -1347,7 +1613,9 @@ _default_process_tiling_cl_ptp (struct dt_iop_module_t *self, struct dt_dev_pixe
         piece->pipe->processed_maximum[k] = processed_maximum_saved[k];
 
       /* call process_cl of module */
+      const double tile_start = dt_get_wtime();
       if(!self->process_cl(self, piece, input, output, &iroi, &oroi)) goto error;
+      _tiling_trace(self, tile_start, &oroi);
 
       /* aggregate resulting processed_maximum */
       /* TODO: check if there really can be differences between tiles and take
@@ -1361,8 +1629,9 @@ _default_process_tiling_cl_ptp (struct dt_iop_module_t *self, struct dt_dev_pixe
 
       if(use_pinned_memory)
       {
-        /* blocking memory transfer: complete opencl/device tile -> pinned host output buffer */
-        err = dt_opencl_read_host_from_device_raw(devid, (char *)output_buffer, output, origin, region, wd*out_bpp, CL_TRUE);
+        /* non-blocking memory transfer: complete opencl/device tile -> pinned host output buffer.
+           the good part is copied to the output image when the slot is finished. */
+        err = dt_opencl_read_host_from_device_raw(devid, (char *)slot->output_buffer, output, origin, region, wd*out_bpp, CL_FALSE);
         if(err != CL_SUCCESS) goto error;
       }
 
@@ -1381,43 +1650,34 @@ _default_process_tiling_cl_ptp (struct dt_iop_module_t *self, struct dt_dev_pixe
         ooffs += overlap*opitch;
       }
 
-      if(use_pinned_memory)
-      {
-        /* copy "good" part of tile from pinned output buffer to output image */
-#ifdef _OPENMP
-        #pragma omp parallel for default(none) shared(ovoid,ooffs,output_buffer,width,origin,region,wd) schedule(static)
-#endif
-        for(size_t j=0; j<region[1]; j++)
-          memcpy((char *)ovoid+ooffs+j*opitch, (char *)output_buffer+((j+origin[1])*wd+origin[0])*out_bpp, region[0]*out_bpp);
-      }
-      else
+      if(!use_pinned_memory)
       {
         /* non-blocking direct memory transfer: good part of opencl/device tile -> host output image */
         err = dt_opencl_read_host_from_device_raw(devid, (char *)ovoid + ooffs, output, origin, region, opitch, CL_FALSE);
         if(err != CL_SUCCESS) goto error;
       }
 
-      /* release input and output buffers */
-      dt_opencl_release_mem_object(input);
-      input = NULL;
-      dt_opencl_release_mem_object(output);
-      output = NULL;
-
-      /* block until opencl queue has finished to free all used event handlers */
-      if(!darktable.opencl->async_pixelpipe || piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT)
-        dt_opencl_finish(devid);
+      /* the tile is in flight now, remember where it goes */
+      if(wait_for_tiles)
+      {
+        slot->ooffs = ooffs;
+        memcpy(slot->origin, origin, sizeof(origin));
+        memcpy(slot->region, region, sizeof(region));
+        slot->pending = 1;
+        slot->marker = dt_opencl_enqueue_marker(devid);
+      }
     }
 
+  /* wait for the last tiles */
+  for(int k=0; k<num_slots; k++)
+    if(!_tiling_slot_finish(devid, slots + ((num_tiles + k) % num_slots), ovoid, opitch, out_bpp, use_pinned_memory)) goto error;
+
+cancelled:
   /* copy back final processed_maximum */
   for(int k=0; k<3; k++)
     piece->pipe->processed_maximum[k] = processed_maximum_new[k];
 
-  if(input_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_input, input_buffer);
-  if(pinned_input != NULL) dt_opencl_release_mem_object(pinned_input);
-  if(output_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_output, output_buffer);
-  if(pinned_output != NULL) dt_opencl_release_mem_object(pinned_output);
-  if(input != NULL) dt_opencl_release_mem_object(input);
-  if(output != NULL) dt_opencl_release_mem_object(output);
+  _tiling_slots_cleanup(devid, slots, num_slots);
   piece->pipe->tiling = 0;
   return TRUE;
 
@@ -1425,18 +1685,292 @@ error:
   /* copy back stored processed_maximum */
   for(int k=0; k<3; k++)
     piece->pipe->processed_maximum[k] = processed_maximum_saved[k];
-  if(input_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_input, input_buffer);
-  if(pinned_input != NULL) dt_opencl_release_mem_object(pinned_input);
-  if(output_buffer != NULL) dt_opencl_unmap_mem_object(devid, pinned_output, output_buffer);
-  if(pinned_output != NULL) dt_opencl_release_mem_object(pinned_output);
-  if(input != NULL) dt_opencl_release_mem_object(input);
-  if(output != NULL) dt_opencl_release_mem_object(output);
+  _tiling_slots_cleanup(devid, slots, num_slots);
   piece->pipe->tiling = 0;
   dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_opencl_ptp] couldn't run process_cl() for module '%s' in tiling mode: %d\n", self->op, err);
   return FALSE;
 }
 
 
+/* tiles of one pixel to pixel module run, spread over all free opencl devices of the export pipe.
+   devices pull tiles from a common counter, so faster ones do more of them. */
+typedef struct _tiling_multi_t
+{
+  dt_pthread_mutex_t lock;
+  struct dt_iop_module_t *self;
+  struct dt_dev_pixelpipe_iop_t *piece;
+  void *ivoid, *ovoid;
+  const dt_iop_roi_t *roi_in, *roi_out;
+  int in_bpp, out_bpp, ipitch, opitch;
+  int width, height, overlap, tile_wd, tile_ht, tiles_x, tiles_y;
+  float processed_maximum_saved[3], processed_maximum_new[3];
+  int next_tile, error;
+  int num_workers;
+  double tile_time[DT_TILING_CL_MAX_DEVICES];  // measured seconds per tile of each worker, 0 until known
+}
+_tiling_multi_t;
+
+typedef struct _tiling_multi_worker_t
+{
+  _tiling_multi_t *m;
+  int worker, devid, tiles;
+  dt_dev_pixelpipe_t *pipe;           // copy of the pipe with our devid, for the module's process_cl()
+  struct dt_dev_pixelpipe_iop_t piece;
+  pthread_t thread;
+}
+_tiling_multi_worker_t;
+
+/* next tile for this worker, or -1. a slow device leaves the last tiles to a faster one if that
+   would finish them earlier than it can do a single one. */
+static int
+_tiling_multi_next(_tiling_multi_t *m, const int worker)
+{
+  int tile = -1;
+  dt_pthread_mutex_lock(&m->lock);
+  const int remaining = m->tiles_x*m->tiles_y - m->next_tile;
+  double fastest = 0.0;
+  for(int k=0; k<m->num_workers; k++)
+    if(m->tile_time[k] > 0.0 && (fastest == 0.0 || m->tile_time[k] < fastest)) fastest = m->tile_time[k];
+  const double mine = m->tile_time[worker];
+  if(!m->error && remaining > 0 && !(mine > 0.0 && fastest > 0.0 && mine > remaining*fastest))
+    tile = m->next_tile++;
+  dt_pthread_mutex_unlock(&m->lock);
+  return tile;
+}
+
+static void *
+_tiling_multi_work(void *data)
+{
+  _tiling_multi_worker_t *w = (_tiling_multi_worker_t *)data;
+  _tiling_multi_t *m = w->m;
+  const int devid = w->devid;
+  cl_mem input = NULL;
+  cl_mem output = NULL;
+  size_t buf_wd = 0, buf_ht = 0;
+  double busy = 0.0;
+  int tile;
+
+  while((tile = _tiling_multi_next(m, w->worker)) >= 0)
+  {
+    const int tx = tile / m->tiles_y, ty = tile % m->tiles_y;
+
+    /* stop early if this run became obsolete, the pixelpipe throws away the output */
+    if(_tiling_cancelled(m->piece)) break;
+
+    size_t wd = tx * m->tile_wd + m->width > m->roi_in->width  ? m->roi_in->width - tx * m->tile_wd : m->width;
+    size_t ht = ty * m->tile_ht + m->height > m->roi_in->height ? m->roi_in->height- ty * m->tile_ht : m->height;
+
+    /* no need to process (end)tiles that are smaller than overlap */
+    if((wd <= m->overlap && tx > 0) || (ht <= m->overlap && ty > 0)) continue;
+
+    const double start = dt_get_wtime();
+    size_t origin[] = { 0, 0, 0 };
+    size_t region[] = { wd, ht, 1 };
+    dt_iop_roi_t iroi = { m->roi_in->x+tx*m->tile_wd, m->roi_in->y+ty*m->tile_ht, wd, ht, m->roi_in->scale };
+    dt_iop_roi_t oroi = { m->roi_out->x+tx*m->tile_wd, m->roi_out->y+ty*m->tile_ht, wd, ht, m->roi_out->scale };
+    size_t ioffs = (ty * m->tile_ht)*m->ipitch + (tx * m->tile_wd)*m->in_bpp;
+    size_t ooffs = (ty * m->tile_ht)*m->opitch + (tx * m->tile_wd)*m->out_bpp;
+
+    dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_multi] tile (%d, %d) with %d x %d at origin [%d, %d] on device %d\n", tx, ty, wd, ht, tx*m->tile_wd, ty*m->tile_ht, devid);
+
+    if(input == NULL || buf_wd != wd || buf_ht != ht)
+    {
+      if(input != NULL) dt_opencl_release_mem_object(input);
+      if(output != NULL) dt_opencl_release_mem_object(output);
+      output = NULL;
+      buf_wd = wd;
+      buf_ht = ht;
+      input = dt_opencl_alloc_device(devid, wd, ht, m->in_bpp);
+      if(input == NULL) goto error;
+      output = dt_opencl_alloc_device(devid, wd, ht, m->out_bpp);
+      if(output == NULL) goto error;
+    }
+
+    if(dt_opencl_write_host_to_device_raw(devid, (char *)m->ivoid + ioffs, input, origin, region, m->ipitch, CL_TRUE) != CL_SUCCESS) goto error;
+
+    for(int k=0; k<3; k++)
+      w->pipe->processed_maximum[k] = m->processed_maximum_saved[k];
+
+    if(!m->self->process_cl(m->self, &w->piece, input, output, &iroi, &oroi)) goto error;
+    _tiling_trace(m->self, start, &oroi);
+
+    if(tx > 0)
+    {
+      origin[0] += m->overlap;
+      region[0] -= m->overlap;
+      ooffs += m->overlap*m->out_bpp;
+    }
+    if(ty > 0)
+    {
+      origin[1] += m->overlap;
+      region[1] -= m->overlap;
+      ooffs += m->overlap*m->opitch;
+    }
+
+    /* blocking direct memory transfer: good part of opencl/device tile -> host output image */
+    if(dt_opencl_read_host_from_device_raw(devid, (char *)m->ovoid + ooffs, output, origin, region, m->opitch, CL_TRUE) != CL_SUCCESS) goto error;
+    if(!dt_opencl_finish(devid)) goto error;
+
+    busy += dt_get_wtime() - start;
+    w->tiles++;
+    dt_pthread_mutex_lock(&m->lock);
+    m->tile_time[w->worker] = busy / w->tiles;
+    for(int k=0; k<3; k++)
+      m->processed_maximum_new[k] = w->pipe->processed_maximum[k];
+    dt_pthread_mutex_unlock(&m->lock);
+  }
+
+  if(input != NULL) dt_opencl_release_mem_object(input);
+  if(output != NULL) dt_opencl_release_mem_object(output);
+  return NULL;
+
+error:
+  dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_multi] couldn't run process_cl() for module '%s' on device %d\n", m->self->op, devid);
+  dt_pthread_mutex_lock(&m->lock);
+  m->error = 1;
+  dt_pthread_mutex_unlock(&m->lock);
+  dt_opencl_finish(devid);
+  if(input != NULL) dt_opencl_release_mem_object(input);
+  if(output != NULL) dt_opencl_release_mem_object(output);
+  return NULL;
+}
+
+/* spreads the tiles over the pipe's device and all other free devices of the export priority list.
+   returns -1 if there is no other device, so the caller can use the single device variant. */
+static int
+_default_process_tiling_cl_multi(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, const int in_bpp)
+{
+  dt_opencl_t *cl = darktable.opencl;
+  int devices[DT_TILING_CL_MAX_DEVICES];
+  int num_devices = 0;
+  devices[num_devices++] = piece->pipe->devid;
+  while(num_devices < MIN(cl->num_devs, DT_TILING_CL_MAX_DEVICES))
+  {
+    const int devid = dt_opencl_lock_device(DT_DEV_PIXELPIPE_EXPORT);
+    if(devid < 0) break;
+    if(!dt_opencl_programs_ready(devid, self->so->cl_programs))
+    {
+      // still building the kernels of this module there, the next free device would be the same one:
+      dt_opencl_unlock_device(devid);
+      break;
+    }
+    devices[num_devices++] = devid;
+  }
+  if(num_devices == 1) return -1;
+
+  _tiling_multi_t m;
+  memset(&m, 0, sizeof(m));
+  m.self = self;
+  m.piece = piece;
+  m.ivoid = ivoid;
+  m.ovoid = ovoid;
+  m.roi_in = roi_in;
+  m.roi_out = roi_out;
+  m.in_bpp = in_bpp;
+  m.out_bpp = self->output_bpp(self, piece->pipe, piece);
+  m.ipitch = roi_in->width * in_bpp;
+  m.opitch = roi_out->width * m.out_bpp;
+  m.num_workers = num_devices;
+  const int max_bpp = _max(m.in_bpp, m.out_bpp);
+
+  dt_develop_tiling_t tiling = { 0 };
+  self->tiling_callback(self, piece, roi_in, roi_out, &tiling);
+
+  /* one tile size for all, it has to fit the smallest device */
+  float headroom = (float)dt_conf_get_int("opencl_memory_headroom")*1024.0f*1024.0f;
+  float singlebuffer = INFINITY;
+  int width = roi_in->width, height = roi_in->height;
+  for(int k=0; k<num_devices; k++)
+  {
+    const dt_opencl_device_t *dev = cl->dev + devices[k];
+    const float room = fmin(fmax(headroom, 0.0f), (float)dev->max_global_mem);
+    const float available = dev->max_global_mem - room;
+    singlebuffer = fmin(singlebuffer, fmin(fmax((available - tiling.overhead) / fmax(tiling.factor, 1.0f), 0.0f), dev->max_mem_alloc));
+    width = _min(width, dev->max_image_width);
+    height = _min(height, dev->max_image_height);
+  }
+  const float maxbuf = fmax(tiling.maxbuf, 1.0f);
+
+  /* shrink tile size in case it would exceed singlebuffer size. keep at least one tile per device. */
+  if((float)width*height*max_bpp*maxbuf > singlebuffer)
+  {
+    const float scale = singlebuffer/(width*height*max_bpp*maxbuf);
+    width = floorf(width * sqrt(scale));
+    height = floorf(height * sqrt(scale));
+  }
+  if(width >= roi_in->width && height >= roi_in->height)
+    height = (roi_in->height + num_devices - 1) / num_devices + 2*tiling.overlap;
+
+  const unsigned int xyalign = _lcm(tiling.xalign, tiling.yalign);
+  const unsigned int walign = _lcm(xyalign, CL_ALIGNMENT);
+  const unsigned int halign = xyalign;
+  assert(xyalign != 0 && walign != 0 && halign != 0);
+  if(width < roi_in->width) width = (width / walign) * walign;
+  if(height < roi_in->height) height = (height / halign) * halign;
+  m.overlap = tiling.overlap % xyalign != 0 ? (tiling.overlap / xyalign + 1) * xyalign : tiling.overlap;
+  m.width = width;
+  m.height = height;
+  m.tile_wd = width - 2*m.overlap > 0 ? width - 2*m.overlap : 1;
+  m.tile_ht = height - 2*m.overlap > 0 ? height - 2*m.overlap : 1;
+  m.tiles_x = width < roi_in->width ? ceilf(roi_in->width /(float)m.tile_wd) : 1;
+  m.tiles_y = height < roi_in->height ? ceilf(roi_in->height/(float)m.tile_ht) : 1;
+
+  int res = TRUE;
+  if(m.tiles_x * m.tiles_y > DT_TILING_MAXTILES || 3*m.overlap > width || 3*m.overlap > height)
+  {
+    dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_multi] aborted tiling for module '%s': %d x %d tiles of %d x %d with overlap %d\n", self->op, m.tiles_x, m.tiles_y, width, height, m.overlap);
+    res = FALSE;
+    goto unlock;
+  }
+
+  dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_multi] use tiling on module '%s' for image with full size %d x %d on %d devices\n", self->op, roi_in->width, roi_in->height, num_devices);
+  dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_multi] (%d x %d) tiles with max dimensions %d x %d and overlap %d\n", m.tiles_x, m.tiles_y, width, height, m.overlap);
+
+  for(int k=0; k<3; k++)
+    m.processed_maximum_saved[k] = m.processed_maximum_new[k] = piece->pipe->processed_maximum[k];
+  dt_pthread_mutex_init(&m.lock, NULL);
+
+  /* each device gets a copy of the pipe and piece, process_cl() takes the device from there */
+  _tiling_multi_worker_t workers[DT_TILING_CL_MAX_DEVICES];
+  memset(workers, 0, sizeof(workers));
+  piece->pipe->tiling = 1;
+  for(int k=0; k<num_devices; k++)
+  {
+    _tiling_multi_worker_t *w = workers + k;
+    w->m = &m;
+    w->worker = k;
+    w->devid = devices[k];
+    w->pipe = (dt_dev_pixelpipe_t *)malloc(sizeof(dt_dev_pixelpipe_t));
+    memcpy(w->pipe, piece->pipe, sizeof(dt_dev_pixelpipe_t));
+    w->pipe->devid = devices[k];
+    w->piece = *piece;
+    w->piece.pipe = w->pipe;
+    if(k > 0) pthread_create(&w->thread, NULL, &_tiling_multi_work, w);
+  }
+  // the pipe's own device is run from this thread:
+  _tiling_multi_work(workers);
+  for(int k=1; k<num_devices; k++)
+    pthread_join(workers[k].thread, NULL);
+
+  for(int k=0; k<num_devices; k++)
+  {
+    dt_print(DT_DEBUG_OPENCL, "[default_process_tiling_cl_multi] device %d: %d tiles, %.3f ms per tile\n", devices[k], workers[k].tiles, 1e3*m.tile_time[k]);
+    free(workers[k].pipe);
+  }
+  piece->pipe->tiling = 0;
+  dt_pthread_mutex_destroy(&m.lock);
+
+  for(int k=0; k<3; k++)
+    piece->pipe->processed_maximum[k] = m.error ? m.processed_maximum_saved[k] : m.processed_maximum_new[k];
+  res = !m.error;
+
+unlock:
+  for(int k=1; k<num_devices; k++)
+    dt_opencl_unlock_device(devices[k]);
+  return res;
+}
+
+
 /* more elaborate tiling algorithm for roi_in != roi_out: slower than the ptp variant,
    more tiles and larger overlap */
 static int
@@ -1617,6 +2151,9 @@ _default_process_tiling_cl_roi (struct dt_iop_module_t *self, struct dt_dev_pixe
   for(int tx=0; tx<tiles_x; tx++)
     for(int ty=0; ty<tiles_y; ty++)
     {
+      /* stop early if this run became obsolete, the pixelpipe throws away the output */
+      if(_tiling_cancelled(piece)) goto cancelled;
+
       piece->pipe->tiling = 1;
 
       /* the output dimensions of the good part of this specific tile */
@@ -1742,7 +2279,9 @@ _default_process_tiling_cl_roi (struct dt_iop_module_t *self, struct dt_dev_pixe
         piece->pipe->processed_maximum[k] = processed_maximum_saved[k];
 
       /* call process_cl of module */
+      const double tile_start = dt_get_wtime();
       if(!self->process_cl(self, piece, input, output, &iroi_full, &oroi_full)) goto error;
+      _tiling_trace(self, tile_start, &oroi_full);
 
       /* aggregate resulting processed_maximum */
       /* TODO: check if there really can be differences between tiles and take
@@ -1785,6 +2324,7 @@ _default_process_tiling_cl_roi (struct dt_iop_module_t *self, struct dt_dev_pixe
         dt_opencl_finish(devid);
     }
 
+cancelled:
   /* copy back final processed_maximum */
   for(int k=0; k<3; k++)
     piece->pipe->processed_maximum[k] = processed_maximum_new[k];
@@ -1815,16 +2355,222 @@ error:
 
 
 
+/* runs a chain of pixel to pixel modules tile by tile on the device: each tile is uploaded once,
+   goes through all modules in turn and only its good part is copied back. the halo around the tiles
+   is the sum of the overlaps of all modules, every module eats its share of it. */
+int
+dt_tiling_process_chain_cl(struct dt_iop_module_t **modules, struct dt_dev_pixelpipe_iop_t **pieces, const int count,
+                           void *ivoid, void *ovoid, const dt_iop_roi_t *roi, const int bpp)
+{
+  cl_int err = -999;
+  cl_mem input = NULL;
+  cl_mem output = NULL;
+  struct dt_dev_pixelpipe_iop_t *piece = pieces[count-1];
+  const int devid = piece->pipe->devid;
+  const int pitch = roi->width * bpp;
+
+  /* aggregate tiling requirements of the chain. buffers are passed on from module to module,
+     so the largest requirement counts for memory, the overlaps add up. */
+  dt_develop_tiling_t tiling = { 0 };
+  tiling.xalign = tiling.yalign = 1;
+  for(int k=0; k<count; k++)
+  {
+    dt_develop_tiling_t t = { 0 };
+    modules[k]->tiling_callback(modules[k], pieces[k], roi, roi, &t);
+    tiling.factor = fmax(tiling.factor, t.factor);
+    tiling.maxbuf = fmax(tiling.maxbuf, t.maxbuf);
+    tiling.overhead = _max(tiling.overhead, t.overhead);
+    tiling.overlap += t.overlap;
+    tiling.xalign = _lcm(tiling.xalign, t.xalign);
+    tiling.yalign = _lcm(tiling.yalign, t.yalign);
+  }
+
+  /* calculate optimal size of tiles */
+  float headroom = (float)dt_conf_get_int("opencl_memory_headroom")*1024.0f*1024.0f;
+  headroom = fmin(fmax(headroom, 0.0f), (float)darktable.opencl->dev[devid].max_global_mem);
+  const float available = darktable.opencl->dev[devid].max_global_mem - headroom;
+  const float factor = fmax(tiling.factor, 1.0f);
+  const float singlebuffer = fmin(fmax((available - tiling.overhead) / factor, 0.0f), darktable.opencl->dev[devid].max_mem_alloc);
+  const float maxbuf = fmax(tiling.maxbuf, 1.0f);
+  int width = _min(roi->width, darktable.opencl->dev[devid].max_image_width);
+  int height = _min(roi->height, darktable.opencl->dev[devid].max_image_height);
+
+  /* shrink tile size in case it would exceed singlebuffer size */
+  if((float)width*height*bpp*maxbuf > singlebuffer)
+  {
+    const float scale = singlebuffer/(width*height*bpp*maxbuf);
+    width = floorf(width * sqrt(scale));
+    height = floorf(height * sqrt(scale));
+  }
+
+  /* alignment rules as in _default_process_tiling_cl_ptp() */
+  const unsigned int xyalign = _lcm(tiling.xalign, tiling.yalign);
+  const unsigned int walign = _lcm(xyalign, CL_ALIGNMENT);
+  const unsigned int halign = xyalign;
+  assert(xyalign != 0 && walign != 0 && halign != 0);
+  if(width < roi->width) width = (width / walign) * walign;
+  if(height < roi->height) height = (height / halign) * halign;
+  const int overlap = tiling.overlap % xyalign != 0 ? (tiling.overlap / xyalign + 1) * xyalign : tiling.overlap;
+
+  /* the halo of a long chain may eat the whole tile, then each module is better off tiling on its own */
+  if(3*overlap > width || 3*overlap > height)
+  {
+    dt_print(DT_DEBUG_OPENCL, "[dt_tiling_process_chain_cl] overlap %d too large for tiles of %d x %d\n", overlap, width, height);
+    return FALSE;
+  }
+
+  const int tile_wd = width - 2*overlap > 0 ? width - 2*overlap : 1;
+  const int tile_ht = height - 2*overlap > 0 ? height - 2*overlap : 1;
+  const int tiles_x = width < roi->width ? ceilf(roi->width /(float)tile_wd) : 1;
+  const int tiles_y = height < roi->height ? ceilf(roi->height/(float)tile_ht) : 1;
+
+  if(tiles_x * tiles_y > DT_TILING_MAXTILES)
+  {
+    dt_print(DT_DEBUG_OPENCL, "[dt_tiling_process_chain_cl] aborted tiling for %d modules up to '%s'. too many tiles: %d x %d\n", count, modules[count-1]->op, tiles_x, tiles_y);
+    return FALSE;
+  }
+
+  dt_print(DT_DEBUG_OPENCL, "[dt_tiling_process_chain_cl] use tiling on %d modules up to '%s' for image with full size %d x %d\n", count, modules[count-1]->op, roi->width, roi->height);
+  dt_print(DT_DEBUG_OPENCL, "[dt_tiling_process_chain_cl] (%d x %d) tiles with max dimensions %d x %d and overlap %d\n", tiles_x, tiles_y, width, height, overlap);
+
+  /* processed_maximum entering each module, the first tile determines them */
+  float processed_maximum[count+1][3];
+  for(int k=0; k<3; k++)
+    processed_maximum[0][k] = piece->pipe->processed_maximum[k];
+
+  size_t buf_wd = 0, buf_ht = 0;
+
+  /* iterate over tiles */
+  for(int tx=0; tx<tiles_x; tx++)
+    for(int ty=0; ty<tiles_y; ty++)
+    {
+      if(_tiling_cancelled(piece)) goto cancelled;
+
+      piece->pipe->tiling = 1;
+
+      size_t wd = tx * tile_wd + width > roi->width  ? roi->width - tx * tile_wd : width;
+      size_t ht = ty * tile_ht + height > roi->height ? roi->height- ty * tile_ht : height;
+
+      /* no need to process (end)tiles that are smaller than overlap */
+      if((wd <= overlap && tx > 0) || (ht <= overlap && ty > 0)) continue;
+
+      size_t origin[] = { 0, 0, 0 };
+      size_t region[] = { wd, ht, 1 };
+      dt_iop_roi_t troi = { roi->x+tx*tile_wd, roi->y+ty*tile_ht, wd, ht, roi->scale };
+      const size_t ioffs = (ty * tile_ht)*pitch + (tx * tile_wd)*bpp;
+      size_t ooffs = ioffs;
+
+      dt_print(DT_DEBUG_OPENCL, "[dt_tiling_process_chain_cl] tile (%d, %d) with %d x %d at origin [%d, %d]\n", tx, ty, wd, ht, tx*tile_wd, ty*tile_ht);
+
+      /* the modules ping pong between two buffers, which are kept while the tile size stays the same */
+      if(input == NULL || buf_wd != wd || buf_ht != ht)
+      {
+        if(input != NULL) dt_opencl_release_mem_object(input);
+        if(output != NULL) dt_opencl_release_mem_object(output);
+        output = NULL;
+        buf_wd = wd;
+        buf_ht = ht;
+        input = dt_opencl_alloc_device(devid, wd, ht, bpp);
+        if(input == NULL) goto error;
+        output = dt_opencl_alloc_device(devid, wd, ht, bpp);
+        if(output == NULL) goto error;
+      }
+
+      /* non-blocking direct memory transfer: host input image -> opencl/device tile */
+      err = dt_opencl_write_host_to_device_raw(devid, (char *)ivoid + ioffs, input, origin, region, pitch, CL_FALSE);
+      if(err != CL_SUCCESS) goto error;
+
+      for(int k=0; k<count; k++)
+      {
+        for(int c=0; c<3; c++)
+          piece->pipe->processed_maximum[c] = processed_maximum[k][c];
+
+        const double tile_start = dt_get_wtime();
+        if(!modules[k]->process_cl(modules[k], pieces[k], input, output, &troi, &troi)) goto error;
+        _tiling_trace(modules[k], tile_start, &troi);
+
+        for(int c=0; c<3; c++)
+          processed_maximum[k+1][c] = piece->pipe->processed_maximum[c];
+
+        cl_mem tmp = input;
+        input = output;
+        output = tmp;
+      }
+
+      /* correct origin and region of tile for overlap.
+         makes sure that we only copy back the "good" part. */
+      if(tx > 0)
+      {
+        origin[0] += overlap;
+        region[0] -= overlap;
+        ooffs += overlap*bpp;
+      }
+      if(ty > 0)
+      {
+        origin[1] += overlap;
+        region[1] -= overlap;
+        ooffs += overlap*pitch;
+      }
+
+      /* the result of the last module is in input after the swap.
+         non-blocking direct memory transfer: good part of opencl/device tile -> host output image */
+      err = dt_opencl_read_host_from_device_raw(devid, (char *)ovoid + ooffs, input, origin, region, pitch, CL_FALSE);
+      if(err != CL_SUCCESS) goto error;
+
+      /* the queue is in order, so the buffers may be used for the next tile right away. we only make
+         sure the device keeps up before we queue more. */
+      if(!darktable.opencl->async_pixelpipe || piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT)
+        if(!dt_opencl_finish(devid)) goto error;
+    }
+
+  /* block until the last tile is back on the host */
+  if(!dt_opencl_finish(devid)) goto error;
+
+  for(int k=0; k<count; k++)
+    for(int c=0; c<3; c++)
+      pieces[k]->processed_maximum[c] = processed_maximum[k+1][c];
+  for(int c=0; c<3; c++)
+    piece->pipe->processed_maximum[c] = processed_maximum[count][c];
+
+cancelled:
+  dt_opencl_finish(devid);
+  if(input != NULL) dt_opencl_release_mem_object(input);
+  if(output != NULL) dt_opencl_release_mem_object(output);
+  piece->pipe->tiling = 0;
+  return TRUE;
+
+error:
+  /* copy back stored processed_maximum */
+  for(int c=0; c<3; c++)
+    piece->pipe->processed_maximum[c] = processed_maximum[0][c];
+  dt_opencl_finish(devid);
+  if(input != NULL) dt_opencl_release_mem_object(input);
+  if(output != NULL) dt_opencl_release_mem_object(output);
+  piece->pipe->tiling = 0;
+  dt_print(DT_DEBUG_OPENCL, "[dt_tiling_process_chain_cl] couldn't run process_cl() for %d modules up to '%s' in tiling mode: %d\n", count, modules[count-1]->op, err);
+  return FALSE;
+}
+
+
 /* if a module does not implement process_tiling_cl() by itself, this function is called instead.
    _default_process_tiling_cl_ptp() is able to handle standard cases where pixels do not change their places.
    _default_process_tiling_cl_roi() takes care of all other cases where image gets distorted. */
 int
 default_process_tiling_cl (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, const int in_bpp)
 {
+  TIMER_START(prof, self->op);
+  int res = -1;
   if(memcmp(roi_in, roi_out, sizeof(struct dt_iop_roi_t)) || (self->flags() & IOP_FLAGS_TILING_FULL_ROI))
-    return _default_process_tiling_cl_roi(self, piece, ivoid, ovoid, roi_in, roi_out, in_bpp);
+    res = _default_process_tiling_cl_roi(self, piece, ivoid, ovoid, roi_in, roi_out, in_bpp);
   else
-    return _default_process_tiling_cl_ptp(self, piece, ivoid, ovoid, roi_in, roi_out, in_bpp);
+  {
+    /* export: let the other devices help if they are free */
+    if(piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT && dt_conf_get_bool("opencl_export_multiple_devices"))
+      res = _default_process_tiling_cl_multi(self, piece, ivoid, ovoid, roi_in, roi_out, in_bpp);
+    if(res < 0) res = _default_process_tiling_cl_ptp(self, piece, ivoid, ovoid, roi_in, roi_out, in_bpp);
+  }
+  TIMER_STOP(prof);
+  return res;
 }
 
 #else
@@ -1833,6 +2579,13 @@ default_process_tiling_cl (struct dt_iop_module_t *self, struct dt_dev_pixelpipe
 {
   return FALSE;
 }
+
+int
+dt_tiling_process_chain_cl(struct dt_iop_module_t **modules, struct dt_dev_pixelpipe_iop_t **pieces, const int count,
+                           void *ivoid, void *ovoid, const dt_iop_roi_t *roi, const int bpp)
+{
+  return FALSE;
+}
 #endif
 
 
@@ -46,6 +46,10 @@ int default_process_tiling_cl (struct dt_iop_module_t *self, struct dt_dev_pixel
 
 int process_tiling_cl (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, const int bpp);
 
+/** processes the pixel to pixel modules one after the other on each tile, on the device of the pipe.
+    returns TRUE on success and sets the processed_maximum of all pieces. */
+int dt_tiling_process_chain_cl(struct dt_iop_module_t **modules, struct dt_dev_pixelpipe_iop_t **pieces, const int count, void *ivoid, void *ovoid, const dt_iop_roi_t *roi, const int bpp);
+
 void default_process_tiling (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, const int bpp);
 
 void process_tiling (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, const int bpp);
@@ -24,12 +24,16 @@
 #include "common/image_cache.h"
 #include "common/imageio.h"
 #include "common/imageio_module.h"
+#include "common/mipmap_cache.h"
 #include "control/conf.h"
 
 #include <GL/gl.h>
 #include <GL/glu.h>
 #include <SDL/SDL.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 double drand48(void);
 void srand48(long int);
 #include <sys/time.h>
@@ -40,11 +44,57 @@ int usleep(useconds_t usec);
 int running;
 int width, height;
 uint32_t random_state;
+uint32_t counter = 0;
 int32_t repeat;
 int use_random;
-float *pixels;
+uint8_t *pixels;
 uint32_t scramble = 0;
 
+// the alpha of every frame, it blends the new image over the old one while fading in.
+#define DTV_ALPHA 51
+
+typedef enum dtv_slot_state_t
+{
+  DTV_SLOT_EMPTY = 0,     // the collection is exhausted
+  DTV_SLOT_QUEUED,        // waiting for a worker
+  DTV_SLOT_RENDERING,
+  DTV_SLOT_READY
+}
+dtv_slot_state_t;
+
+typedef struct dtv_slot_t
+{
+  int32_t id;
+  dtv_slot_state_t state;
+  int thumbnail;          // the mipmap for the fast path is in the cache
+  uint8_t *pixels;        // full screen rgba frame, only touched by the worker while rendering
+}
+dtv_slot_t;
+
+// the next images are rendered ahead by worker threads into a ring of
+// frames, in the order they will be shown. head is the one shown next.
+typedef struct dtv_queue_t
+{
+  dt_pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int quit;
+  int head, num_slots;
+  dtv_slot_t *slots;
+  int num_workers;
+  pthread_t *workers;
+}
+dtv_queue_t;
+
+dtv_queue_t queue;
+
+// format params handed to write_image(), with the frame to write into:
+typedef struct dtv_export_t
+{
+  dt_imageio_module_data_t head;
+  uint8_t *pixels;
+}
+dtv_export_t;
+
 int init(int argc, char *arg[])
 {
   const SDL_VideoInfo* info = NULL;
@@ -71,8 +121,8 @@ int init(int argc, char *arg[])
 
   width  = info->current_w;
   height = info->current_h;
-  pixels = (float *)malloc(sizeof(float)*4*width*height);
-  for(int k=0; k<width*height*4; k++) pixels[k] = 1.0f;
+  pixels = (uint8_t *)malloc(sizeof(uint8_t)*4*width*height);
+  memset(pixels, 0xff, sizeof(uint8_t)*4*width*height);
 
   if( !info )
   {
@@ -111,7 +161,7 @@ int init(int argc, char *arg[])
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 
   glEnable(GL_TEXTURE_2D);
   glBindTexture(GL_TEXTURE_2D, texID);
@@ -165,7 +215,7 @@ update(const int frame)
   glReadBuffer (GL_FRONT);
   glDrawBuffer (GL_BACK);
   glCopyPixels (0, 0, width, height, GL_COLOR);
-  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, pixels);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
   if(frame < 18)
   {
     // glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -190,16 +240,33 @@ update(const int frame)
   SDL_GL_SwapBuffers();
 }
 
+static void
+fade_in()
+{
+  for(int k=0; k<=18; k++)
+  {
+    update(k);
+    usleep(10000);
+  }
+}
+
+static void
+clear_frame(uint8_t *frame)
+{
+  memset(frame, 0, 4*sizeof(uint8_t)*width*height);
+  for(int i=3; i<4*width*height; i+=4) frame[i] = DTV_ALPHA;
+}
+
 static int
 bpp (dt_imageio_module_data_t *data)
 {
-  return 32;
+  return 8;
 }
 
 static int
 levels(dt_imageio_module_data_t *data)
 {
-  return IMAGEIO_RGB | IMAGEIO_FLOAT;
+  return IMAGEIO_RGB | IMAGEIO_INT8;
 }
 
 static const char*
@@ -211,19 +278,18 @@ mime(dt_imageio_module_data_t *data)
 static int
 write_image (dt_imageio_module_data_t *data, const char *filename, const void *in, void *exif, int exif_len, int imgid)
 {
-  const int offx = (width  - data->width )/2;
-  const int offy = (height - data->height)/2;
-  float *out = pixels + (offy * width  + offx )* 4;
-  const float *rd = in;
-  memset(pixels, 0, 4*sizeof(float)*width*height);
-  const float alpha = 0.2f;
-  for(int i=3; i<4*width*height; i+=4) pixels[i] = 0.2f;
+  uint8_t *frame = ((dtv_export_t *)data)->pixels;
+  const int offx = MAX(0, (width  - data->width )/2);
+  const int offy = MAX(0, (height - data->height)/2);
+  uint8_t *out = frame + (offy * width  + offx )* 4;
+  const uint8_t *rd = in;
+  clear_frame(frame);
   for(int j=0; j<MIN(data->height, height); j++)
   {
     for(int i=0; i<MIN(data->width, width); i++)
     {
       for(int c=0; c<3; c++) out[4*i+c] = rd[4*i+c];
-      out[4*i+3] = alpha;
+      out[4*i+3] = DTV_ALPHA;
     }
     out += 4*width;
     rd  += 4*data->width;
@@ -244,26 +310,15 @@ uint32_t next_random()
   return i ^ scramble;
 }
 
-static int
-process_next_image()
+static int32_t
+next_image_id()
 {
-  static int counter = 0;
-  dt_imageio_module_format_t buf;
-  dt_imageio_module_data_t dat;
-  buf.mime = mime;
-  buf.levels = levels;
-  buf.bpp = bpp;
-  buf.write_image = write_image;
-  dat.max_width  = width;
-  dat.max_height = height;
-  strcpy(dat.style, "none");
-
   // get random image id from sql
   int32_t id = 0;
   const uint32_t cnt = dt_collection_get_count (darktable.collection);
   // enumerated all images?
-  if(++counter >= cnt) return 1;
-  uint32_t ran = counter - 1;
+  if(counter >= cnt) return 0;
+  uint32_t ran = counter++;
   if(use_random)
   {
     // get random number up to next power of two greater than cnt:
@@ -274,7 +329,7 @@ process_next_image()
   }
   const int32_t rand = ran % cnt;
   const gchar *query = dt_collection_get_query (darktable.collection);
-  if(!query) return 1;
+  if(!query) return 0;
   sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, rand);
@@ -282,30 +337,203 @@ process_next_image()
   if(sqlite3_step(stmt) == SQLITE_ROW)
     id = sqlite3_column_int(stmt, 0);
   sqlite3_finalize(stmt);
+  return id;
+}
+
+static void
+render_image(const int32_t id, uint8_t *frame)
+{
+  dt_imageio_module_format_t buf;
+  dtv_export_t dat;
+  memset(&buf, 0, sizeof(buf));
+  buf.mime = mime;
+  buf.levels = levels;
+  buf.bpp = bpp;
+  buf.write_image = write_image;
+  dat.head.max_width  = width;
+  dat.head.max_height = height;
+  strcpy(dat.head.style, "none");
+  dat.pixels = frame;
+
+  // stays black if the export fails:
+  clear_frame(frame);
+  dt_imageio_export(id, "unused", &buf, &dat.head, TRUE);
+}
 
-  if(id)
+// fast path while the full render isn't done yet: scale the processed thumbnail
+// (the embedded jpeg, if allowed) up to the screen. returns non-zero if it isn't cached.
+static int
+draw_thumbnail(const int32_t id, uint8_t *frame)
+{
+  const dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, width, height);
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, id, mip, DT_MIPMAP_TESTLOCK);
+  if(!buf.buf || buf.width <= 0 || buf.height <= 0)
   {
-    dt_imageio_export(id, "unused", &buf, &dat, TRUE);
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    return 1;
   }
+  uint8_t *scratchmem = dt_mipmap_cache_alloc_scratchmem(darktable.mipmap_cache);
+  const uint8_t *in = dt_mipmap_cache_decompress(&buf, scratchmem);
+
+  const float scale = fminf(width/(float)buf.width, height/(float)buf.height);
+  const int wd = MIN(width,  (int)(buf.width  * scale));
+  const int ht = MIN(height, (int)(buf.height * scale));
+  uint8_t *out = frame + (((height - ht)/2) * width + (width - wd)/2) * 4;
+  clear_frame(frame);
+  for(int j=0; j<ht; j++)
+  {
+    const uint8_t *rd = in + 4*buf.width*MIN(buf.height-1, (int)(j/scale));
+    for(int i=0; i<wd; i++)
+    {
+      // mipmaps are bgra, like cairo wants them:
+      const uint8_t *px = rd + 4*MIN(buf.width-1, (int)(i/scale));
+      for(int c=0; c<3; c++) out[4*i+c] = px[2-c];
+      out[4*i+3] = DTV_ALPHA;
+    }
+    out += 4*width;
+  }
+
+  free(scratchmem);
+  dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
   return 0;
 }
 
+static void *
+render_worker(void *arg)
+{
+  const dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, width, height);
+  dt_pthread_mutex_lock(&queue.mutex);
+  while(!queue.quit)
+  {
+    // take the queued image which will be shown first:
+    dtv_slot_t *slot = NULL;
+    for(int k=0; k<queue.num_slots && !slot; k++)
+    {
+      dtv_slot_t *s = queue.slots + (queue.head + k) % queue.num_slots;
+      if(s->state == DTV_SLOT_QUEUED) slot = s;
+    }
+    if(!slot)
+    {
+      dt_pthread_cond_wait(&queue.cond, &queue.mutex);
+      continue;
+    }
+    slot->state = DTV_SLOT_RENDERING;
+    const int32_t id = slot->id;
+    dt_pthread_mutex_unlock(&queue.mutex);
+
+    // the thumbnail is cheap and can be shown in case the full render is late:
+    dt_mipmap_buffer_t buf;
+    dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, id, mip, DT_MIPMAP_BLOCKING);
+    const int thumbnail = (buf.buf != NULL);
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    dt_pthread_mutex_lock(&queue.mutex);
+    slot->thumbnail = thumbnail;
+    dt_pthread_mutex_unlock(&queue.mutex);
+
+    render_image(id, slot->pixels);
+
+    dt_pthread_mutex_lock(&queue.mutex);
+    slot->state = DTV_SLOT_READY;
+  }
+  dt_pthread_mutex_unlock(&queue.mutex);
+  return NULL;
+}
+
+// hand the slot the next image of the slideshow, called on the main thread only.
+static void
+queue_next_image(dtv_slot_t *slot)
+{
+  int32_t id = next_image_id();
+  if(!id && repeat >= 0)
+  {
+    // start over
+    random_state = repeat;
+    counter = 0;
+    id = next_image_id();
+  }
+  dt_pthread_mutex_lock(&queue.mutex);
+  slot->id = id;
+  slot->thumbnail = 0;
+  slot->state = id ? DTV_SLOT_QUEUED : DTV_SLOT_EMPTY;
+  pthread_cond_broadcast(&queue.cond);
+  dt_pthread_mutex_unlock(&queue.mutex);
+}
+
+static dtv_slot_state_t
+slot_state(const dtv_slot_t *slot, int *thumbnail)
+{
+  dt_pthread_mutex_lock(&queue.mutex);
+  const dtv_slot_state_t state = slot->state;
+  if(thumbnail) *thumbnail = slot->thumbnail;
+  dt_pthread_mutex_unlock(&queue.mutex);
+  return state;
+}
+
+static void
+queue_init(const int ahead, const int memory)
+{
+  // every slot holds a full screen frame, don't go beyond the memory cap:
+  const size_t frame_size = sizeof(uint8_t)*4*width*height;
+  queue.num_slots = CLAMP(((size_t)memory << 20) / frame_size, 1, ahead);
+  queue.slots = (dtv_slot_t *)malloc(sizeof(dtv_slot_t)*queue.num_slots);
+  for(int k=0; k<queue.num_slots; k++)
+  {
+    queue.slots[k].state = DTV_SLOT_EMPTY;
+    queue.slots[k].pixels = (uint8_t *)malloc(frame_size);
+  }
+  queue.head = queue.quit = 0;
+  dt_pthread_mutex_init(&queue.mutex, NULL);
+  pthread_cond_init(&queue.cond, NULL);
+  for(int k=0; k<queue.num_slots; k++) queue_next_image(queue.slots + k);
+
+  // every worker runs a whole export pipe:
+  queue.num_workers = CLAMP(dt_conf_get_int("parallel_export"), 1, queue.num_slots);
+  queue.workers = (pthread_t *)malloc(sizeof(pthread_t)*queue.num_workers);
+  for(int k=0; k<queue.num_workers; k++)
+    pthread_create(queue.workers + k, NULL, render_worker, NULL);
+}
+
+static void
+queue_cleanup()
+{
+  dt_pthread_mutex_lock(&queue.mutex);
+  queue.quit = 1;
+  pthread_cond_broadcast(&queue.cond);
+  dt_pthread_mutex_unlock(&queue.mutex);
+  // running exports finish first:
+  for(int k=0; k<queue.num_workers; k++) pthread_join(queue.workers[k], NULL);
+  free(queue.workers);
+  for(int k=0; k<queue.num_slots; k++) free(queue.slots[k].pixels);
+  free(queue.slots);
+  pthread_cond_destroy(&queue.cond);
+  dt_pthread_mutex_destroy(&queue.mutex);
+}
+
 int main(int argc, char *arg[])
 {
   gtk_init (&argc, &arg);
   repeat = random_state = use_random = 0;
-  for(int k=1; k<argc; k++)
+  int ahead = 3, memory = 256;
+  // pass everything we don't know on to dt_init:
+  int m_argc = 0;
+  char *m_arg[argc + 1];
+  for(int k=0; k<argc; k++)
   {
     if(!strcmp(arg[k], "--random")) use_random = 1;
     else if(!strcmp(arg[k], "--repeat")) repeat = -1;
+    else if(!strcmp(arg[k], "--ahead") && argc > k+1) ahead = CLAMP(atol(arg[++k]), 1, 32);
+    else if(!strcmp(arg[k], "--memory") && argc > k+1) memory = MAX(atol(arg[++k]), 0);
     else if(!strcmp(arg[k], "-h") || !strcmp(arg[k], "--help"))
     {
-      fprintf(stderr, "usage: %s [--random] [--repeat]\n", arg[0]);
+      fprintf(stderr, "usage: %s [--random] [--repeat] [--ahead <images>] [--memory <MB>]\n", arg[0]);
       exit(0);
     }
+    else m_arg[m_argc++] = arg[k];
   }
+  m_arg[m_argc] = NULL;
   // init dt without gui:
-  if(dt_init(argc, arg, 0)) exit(1);
+  if(dt_init(m_argc, m_arg, 0)) exit(1);
   // use system color profile, if we can:
   gchar *oldprofile = dt_conf_get_string("plugins/lighttable/export/iccprofile");
   const gchar *overprofile = "X profile";
@@ -314,32 +542,52 @@ int main(int argc, char *arg[])
   srand48(SDL_GetTicks());
   if(use_random) random_state = drand48() * INT_MAX;
   if(repeat < 0) repeat = random_state;
+  if(running) queue_init(ahead, memory);
   while(running)
   {
     pump_events();
     if(!running) break;
-    if(process_next_image())
+    dtv_slot_t *slot = queue.slots + queue.head;
+
+    // wait for the full render, or at least for its thumbnail:
+    int full = 0, thumbnail = 0;
+    dtv_slot_state_t state = DTV_SLOT_EMPTY;
+    while(running)
     {
-      if(repeat >= 0)
-      {
-        // start over
-        random_state = repeat;
-        continue;
-      }
-      break;
+      state = slot_state(slot, &thumbnail);
+      if(state == DTV_SLOT_READY || state == DTV_SLOT_EMPTY) break;
+      if(thumbnail && !draw_thumbnail(slot->id, pixels)) break;
+      pump_events();
+      usleep(10000);
     }
-    for(int k=0; k<=18; k++)
+    if(!running || state == DTV_SLOT_EMPTY) break;
+    if(state == DTV_SLOT_READY)
     {
-      update(k);
-      usleep(10000);
+      memcpy(pixels, slot->pixels, sizeof(uint8_t)*4*width*height);
+      full = 1;
     }
-    for(int k=0; k<100; k++)
+    fade_in();
+
+    // show it, and blend in the full render as soon as it's there:
+    for(int k=0; k<100 || !full; k++)
     {
       pump_events();
       if(!running) break;
+      if(!full && slot_state(slot, NULL) == DTV_SLOT_READY)
+      {
+        memcpy(pixels, slot->pixels, sizeof(uint8_t)*4*width*height);
+        fade_in();
+        full = 1;
+      }
       usleep(35000);
     }
+    if(!running) break;
+
+    // the slot now takes the image after the last queued one:
+    queue_next_image(slot);
+    queue.head = (queue.head + 1) % queue.num_slots;
   }
+  if(queue.slots) queue_cleanup();
   if(oldprofile)
   {
     dt_conf_set_string("plugins/lighttable/export/iccprofile", oldprofile);
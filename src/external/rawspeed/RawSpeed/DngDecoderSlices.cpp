@@ -46,9 +46,11 @@ DngDecoderSlices::DngDecoderSlices(FileMap* file, RawImage img, int _compression
     mFile(file), mRaw(img) {
   mFixLjpeg = false;
   compression = _compression;
+  pthread_mutex_init(&mMutex, NULL);
 }
 
 DngDecoderSlices::~DngDecoderSlices(void) {
+  pthread_mutex_destroy(&mMutex);
 }
 
 void DngDecoderSlices::addSlice(DngSliceElement slice) {
@@ -58,9 +60,11 @@ void DngDecoderSlices::addSlice(DngSliceElement slice) {
 void DngDecoderSlices::startDecoding() {
   // Create threads
 
-  nThreads = getThreadCount();
-  int slicesPerThread = ((int)slices.size() + nThreads - 1) / nThreads;
-//  decodedSlices = 0;
+  // Tiles differ in how well they compress, so instead of handing each thread
+  // a fixed share, all threads take the next slice from the queue until it is empty.
+  nThreads = min((uint32)slices.size(), (uint32)getThreadCount());
+  if (nThreads < 1)
+    return;
   pthread_attr_t attr;
   /* Initialize and set thread detached attribute */
   pthread_attr_init(&attr);
@@ -68,12 +72,6 @@ void DngDecoderSlices::startDecoding() {
 
   for (uint32 i = 0; i < nThreads; i++) {
     DngDecoderThread* t = new DngDecoderThread();
-    for (int j = 0; j < slicesPerThread ; j++) {
-      if (!slices.empty()) {
-        t->slices.push(slices.front());
-        slices.pop();
-      }
-    }
     t->parent = this;
     pthread_create(&t->threadid, &attr, DecodeThread, t);
     threads.push_back(t);
@@ -143,12 +141,18 @@ my_error_throw (j_common_ptr cinfo)
 
 void DngDecoderSlices::decodeSlice(DngDecoderThread* t) {
   if (compression == 7) {
-    while (!t->slices.empty()) {
+    while (true) {
+      pthread_mutex_lock(&mMutex);
+      if (slices.empty()) {
+        pthread_mutex_unlock(&mMutex);
+        break;
+      }
+      DngSliceElement e = slices.front();
+      slices.pop();
+      pthread_mutex_unlock(&mMutex);
       LJpegPlain l(mFile, mRaw);
       l.mDNGCompatible = mFixLjpeg;
-      DngSliceElement e = t->slices.front();
       l.mUseBigtable = e.mUseBigtable;
-      t->slices.pop();
       try {
         l.startDecoder(e.byteOffset, e.byteCount, e.offX, e.offY);
       } catch (RawDecoderException &err) {
@@ -162,9 +166,15 @@ void DngDecoderSlices::decodeSlice(DngDecoderThread* t) {
     /* Each slice is a JPEG image */
     struct jpeg_decompress_struct dinfo;
     struct jpeg_error_mgr jerr;
-    while (!t->slices.empty()) {
-      DngSliceElement e = t->slices.front();
-      t->slices.pop();
+    while (true) {
+      pthread_mutex_lock(&mMutex);
+      if (slices.empty()) {
+        pthread_mutex_unlock(&mMutex);
+        break;
+      }
+      DngSliceElement e = slices.front();
+      slices.pop();
+      pthread_mutex_unlock(&mMutex);
       uchar8 *complete_buffer = NULL;
       JSAMPARRAY buffer = (JSAMPARRAY)malloc(sizeof(JSAMPROW));
 
@@ -48,7 +48,6 @@ public:
   DngDecoderThread(void) {}
   ~DngDecoderThread(void) {}
   pthread_t threadid;
-  queue<DngSliceElement> slices;
   DngDecoderSlices* parent;
 };
 
@@ -62,7 +61,9 @@ public:
   void startDecoding();
   void decodeSlice(DngDecoderThread* t);
   int size();
+  // Threads pull the next slice from here, guarded by mMutex
   queue<DngSliceElement> slices;
+  pthread_mutex_t mMutex;
   vector<DngDecoderThread*> threads;
   FileMap *mFile; 
   RawImage mRaw;
@@ -1,5 +1,8 @@
 #include "StdAfx.h"
 #include "FileMap.h"
+#if defined(__unix__) || defined(__APPLE__) 
+#include <sys/mman.h>
+#endif // __unix__
 /*
     RawSpeed - RAW file decoder.
 
@@ -32,10 +35,17 @@ FileMap::FileMap(uint32 _size) : size(_size) {
     throw FileIOException("Not enough memory to open file.");
   }
   mOwnAlloc = true;
+  mMapped = 0;
 }
 
 FileMap::FileMap(uchar8* _data, uint32 _size): data(_data), size(_size) {
   mOwnAlloc = false;
+  mMapped = 0;
+}
+
+FileMap::FileMap(uchar8* _data, uint32 _size, size_t _mapped): data(_data), size(_size) {
+  mOwnAlloc = false;
+  mMapped = _mapped;
 }
 
 
@@ -43,6 +53,11 @@ FileMap::~FileMap(void) {
   if (data && mOwnAlloc) {
     _aligned_free(data);
   }
+#if defined(__unix__) || defined(__APPLE__) 
+  if (data && mMapped) {
+    munmap(data, mMapped);
+  }
+#endif // __unix__
   data = 0;
   size = 0;
 }
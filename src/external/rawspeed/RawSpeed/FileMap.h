@@ -41,6 +41,7 @@ class FileMap
 public:
   FileMap(uint32 _size);                 // Allocates the data array itself
   FileMap(uchar8* _data, uint32 _size);  // Data already allocated, if possible allocate 16 extra bytes.
+  FileMap(uchar8* _data, uint32 _size, size_t _mapped);  // Data mmap'ed by FileReader::mapFile(), _mapped bytes are unmapped again.
   ~FileMap(void);
   const uchar8* getData(uint32 offset);
   uchar8* getDataWrt(uint32 offset) {return &data[offset];}
@@ -54,6 +55,7 @@ private:
  uchar8* data;
  uint32 size;
  bool mOwnAlloc;
+ size_t mMapped;
 };
 
 } // namespace RawSpeed
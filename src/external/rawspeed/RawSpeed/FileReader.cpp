@@ -5,7 +5,10 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
-//#include <sys/mman.h>
+#include <sys/mman.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
 #endif // __unix__
 /*
     RawSpeed - RAW file decoder.
@@ -97,6 +100,52 @@ FileMap* FileReader::readFile() {
   return fileData;
 }
 
+/*
+ * Maps the file into memory copy-on-write, so the decoders read straight from the page cache
+ * and there is no heap copy of the whole file. Like the one of readFile(), the map is followed
+ * by at least 16 readable (zero) bytes: it is put on top of a slightly larger anonymous map.
+ */
+FileMap* FileReader::mapFile() {
+#if defined(__unix__) || defined(__APPLE__) 
+  int fd = open(mFilename, O_RDONLY);
+  if (fd < 0)
+    throw FileIOException("Could not open file.");
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size <= 0) {
+    close(fd);
+    throw FileIOException("File is 0 bytes.");
+  }
+  if ((uint64)st.st_size >= 0xffffffffULL) {
+    close(fd);
+    return readFile();
+  }
+  size_t size = st.st_size;
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t map_size = (size + 16 + page - 1) / page * page;
+
+  uchar8* pa = (uchar8*)mmap(0, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (pa == MAP_FAILED) {
+    close(fd);
+    return readFile();
+  }
+  // Writable, as some tiff entries are byte swapped in place. These pages are then copied.
+  if (mmap(pa, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(pa, map_size);
+    close(fd);
+    return readFile();
+  }
+  close(fd);
+
+  // The image data is mostly read front to back, start reading ahead right away.
+  madvise(pa, size, MADV_SEQUENTIAL);
+  madvise(pa, size, MADV_WILLNEED);
+
+  return new FileMap(pa, (uint32)size, map_size);
+#else // __unix__
+  return readFile();
+#endif // __unix__
+}
+
 FileReader::~FileReader(void) {
 
 }
@@ -33,6 +33,7 @@ public:
 	FileReader(LPCWSTR filename);
 public:
 	FileMap* readFile();
+	FileMap* mapFile();   // Maps the file instead of reading it, falls back to readFile()
 	virtual ~FileReader();
   LPCWSTR Filename() const { return mFilename; }
 //  void Filename(LPCWSTR val) { mFilename = val; }
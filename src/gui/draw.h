@@ -234,6 +234,7 @@ static inline void dt_draw_histogram_8(cairo_t *cr, float *hist, int32_t channel
       dt_draw_histogram_8_linear(cr, hist, channel);
       break;
     case DT_DEV_HISTOGRAM_WAVEFORM:
+    case DT_DEV_HISTOGRAM_VECTORSCOPE:
     default: g_assert_not_reached();
   }
 }
@@ -83,8 +83,8 @@ void dt_gui_presets_init()
 
   // pot. needed addition of blendop_version is done in control.c
 
-  // remove auto generated presets from plugins, not the user included ones.
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "delete from presets where writeprotect=1", NULL, NULL, NULL);
+  // auto generated presets of changed plugins are replaced by the plugin loaders,
+  // see dt_iop_load_modules_so() and dt_lib_load_modules().
 }
 
 void dt_gui_presets_add_generic(const char *name, dt_dev_operation_t op, const int32_t version, const void *params, const int32_t params_size, const int32_t enabled)
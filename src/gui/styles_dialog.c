@@ -342,6 +342,17 @@ _gui_styles_dialog_run (gboolean edit,const char *name,int imgid)
   gtk_box_pack_start (box,sd->name,FALSE,FALSE,0);
   gtk_box_pack_start (box,sd->description,FALSE,FALSE,0);
 
+  /* the style as it is on the selected image */
+  if (edit && imgid != -1)
+  {
+    GdkPixbuf *preview = dt_styles_preview (name, imgid, DT_STYLES_PREVIEW_SIZE);
+    if (preview)
+    {
+      gtk_box_pack_start (box,gtk_image_new_from_pixbuf (preview),FALSE,FALSE,0);
+      g_object_unref (preview);
+    }
+  }
+
   /* create the list of items */
   sd->items = GTK_TREE_VIEW (gtk_tree_view_new ());
   GtkListStore *liststore = gtk_list_store_new (DT_STYLE_ITEMS_NUM_COLS, G_TYPE_BOOLEAN, G_TYPE_BOOLEAN, G_TYPE_STRING, G_TYPE_LONG, G_TYPE_LONG);
@@ -25,6 +25,7 @@
 #include "common/exif.h"
 #include "common/debug.h"
 #include "common/imageio_format.h"
+#include "common/utility.h"
 
 DT_MODULE(1)
 
@@ -35,9 +36,6 @@ int write_image (dt_imageio_module_data_t *ppm, const char *filename, const void
   char *sourcefile = NULL;
   char *targetfile = NULL;
   char *xmpfile = NULL;
-  char *content = NULL;
-  FILE *fin = NULL;
-  FILE *fout = NULL;
   sqlite3_stmt *stmt;
 
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select folder, filename from images, film_rolls where images.id = ?1 and film_id = film_rolls.id;", -1, &stmt, NULL);
@@ -57,21 +55,7 @@ int write_image (dt_imageio_module_data_t *ppm, const char *filename, const void
   if(!strcmp(sourcefile, targetfile))
     goto END;
 
-  fin = fopen(sourcefile, "rb");
-  fout = fopen(targetfile, "wb");
-  if(fin == NULL || fout == NULL)
-    goto END;
-
-  fseek(fin,0,SEEK_END);
-  int end = ftell(fin);
-  rewind(fin);
-
-  content = (char*)g_malloc(sizeof(char)*end);
-  if(content == NULL)
-    goto END;
-  if(fread(content,sizeof(char),end,fin) != end)
-    goto END;
-  if(fwrite(content,sizeof(char),end,fout) != end)
+  if(dt_util_copy_file(sourcefile, targetfile, TRUE) != 0)
     goto END;
 
   // we got a copy of the file, now write the xmp data
@@ -91,12 +75,7 @@ END:
     g_free(targetfile);
   if(xmpfile)
     g_free(xmpfile);
-  if(content)
-    g_free(content);
-  if(fin)
-    fclose(fin);
-  if(fout)
-    fclose(fout);
+  sqlite3_finalize(stmt);
   return status;
 }
 
@@ -25,10 +25,14 @@
 #include "common/imageio_exr.hh"
 #include "common/imageio_format.h"
 
+#include "control/conf.h"
+
 #include <cstdlib>
 #include <cstdio>
 #include <memory>
+#include <OpenEXR/half.h>
 #include <OpenEXR/ImfFrameBuffer.h>
+#include <OpenEXR/ImfOutputFile.h>
 #include <OpenEXR/ImfTiledOutputFile.h>
 #include <OpenEXR/ImfChannelList.h>
 #include <OpenEXR/ImfStandardAttributes.h>
@@ -37,6 +41,9 @@
 #include "config.h"
 #endif
 
+// export bands come in multiples of 64 rows, so the tiles line up with them:
+#define DT_EXR_TILE 64
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -49,66 +56,132 @@ extern "C"
       int max_width, max_height;
       int width, height;
       char style[128];
+      int compression; // Imf::Compression, up to b44
+      int bpp;         // 16 for half, 32 for float
+      int tiled;
     }
   dt_imageio_exr_t;
 
+  typedef struct dt_imageio_exr_gui_t
+  {
+    GtkComboBox *compression;
+    GtkToggleButton *b16, *b32;
+    GtkToggleButton *tiled;
+  }
+  dt_imageio_exr_gui_t;
+
   void init(dt_imageio_module_format_t *self)
   {
     Imf::BlobAttribute::registerAttributeType();
+    dt_imageio_exr_init_threads();
   }
 
   void cleanup(dt_imageio_module_format_t *self) {}
 
-  int write_image (dt_imageio_module_data_t *tmp, const char *filename, const void *in_tmp, void *exif, int exif_len, int imgid)
+  int write_image_bands (dt_imageio_module_data_t *tmp, const char *filename, dt_imageio_export_bands_t *bands, void *exif, int exif_len, int imgid)
   {
     dt_imageio_exr_t * exr = (dt_imageio_exr_t*) tmp;
-    const float * in = (const float *) in_tmp;
+    const Imf::Compression compression = (Imf::Compression)CLAMP(exr->compression, 0, (int)Imf::B44_COMPRESSION);
+    const Imf::PixelType type = exr->bpp == 16 ? Imf::HALF : Imf::FLOAT;
     Imf::Blob exif_blob(exif_len, (uint8_t*)exif);
-    Imf::Header header(exr->width,exr->height,1,Imath::V2f (0, 0),1,Imf::INCREASING_Y,Imf::PIZ_COMPRESSION);
+    Imf::Header header(exr->width,exr->height,1,Imath::V2f (0, 0),1,Imf::INCREASING_Y,compression);
     header.insert("comment",Imf::StringAttribute("Developed using Darktable "PACKAGE_VERSION));
     header.insert("exif", Imf::BlobAttribute(exif_blob));
-    header.channels().insert("R",Imf::Channel(Imf::FLOAT));
-    header.channels().insert("B",Imf::Channel(Imf::FLOAT));
-    header.channels().insert("G",Imf::Channel(Imf::FLOAT));
-    header.setTileDescription(Imf::TileDescription(100, 100, Imf::ONE_LEVEL));
-    Imf::TiledOutputFile file(filename, header);
-    Imf::FrameBuffer data;
-
-    uint32_t channelsize=(exr->width*exr->height);
-    float *red=(float *)malloc(channelsize*sizeof(float));
-    float *green=(float *)malloc(channelsize*sizeof(float));
-    float *blue=(float *)malloc(channelsize*sizeof(float));
-
-    for(uint32_t j=0; j<channelsize; j++)
-    {
-      red[j]=in[j*4+0];
-    }
-    data.insert("R",Imf::Slice(Imf::FLOAT,(char *)red,sizeof(float)*1,sizeof(float)*exr->width));
+    header.channels().insert("R",Imf::Channel(type));
+    header.channels().insert("B",Imf::Channel(type));
+    header.channels().insert("G",Imf::Channel(type));
+    if(exr->tiled)
+      header.setTileDescription(Imf::TileDescription(DT_EXR_TILE, DT_EXR_TILE, Imf::ONE_LEVEL));
 
-    for(uint32_t j=0; j<channelsize; j++)
+    // half floats are converted band by band, floats are taken from the band as they are:
+    half *halfbuf = NULL;
+    if(type == Imf::HALF)
+      halfbuf = (half *)malloc(sizeof(half)*3*exr->width*MIN(bands->band_height, exr->height));
+
+    int err = (type == Imf::HALF && !halfbuf);
+    try
     {
-      blue[j]=in[j*4+2];
-    }
-    data.insert("B",Imf::Slice(Imf::FLOAT,(char *)blue,sizeof(float)*1,sizeof(float)*exr->width));
+      std::auto_ptr<Imf::TiledOutputFile> tiled_file;
+      std::auto_ptr<Imf::OutputFile> file;
+      if(!err && exr->tiled)
+      {
+        std::auto_ptr<Imf::TiledOutputFile> temp(new Imf::TiledOutputFile(filename, header));
+        tiled_file = temp;
+      }
+      else if(!err)
+      {
+        std::auto_ptr<Imf::OutputFile> temp(new Imf::OutputFile(filename, header));
+        file = temp;
+      }
 
-    for(uint32_t j=0; j<channelsize; j++)
+      const float *in;
+      int y, rows;
+      while(!err && (in = (const float *)dt_imageio_export_band(bands, &y, &rows)))
+      {
+        // the slices address pixel (0,0), this band starts at row y:
+        Imf::FrameBuffer data;
+        if(type == Imf::HALF)
+        {
+          const int width = exr->width;
+#ifdef _OPENMP
+          #pragma omp parallel for schedule(static) shared(in, halfbuf, rows)
+#endif
+          for(int j=0; j<rows; j++)
+            for(int i=0; i<width; i++)
+              for(int c=0; c<3; c++) halfbuf[3*(width*j + i) + c] = in[4*(width*j + i) + c];
+          const size_t xstride = sizeof(half)*3, ystride = xstride*exr->width;
+          char *base = (char *)halfbuf - ystride*y;
+          data.insert("R",Imf::Slice(Imf::HALF,base,xstride,ystride));
+          data.insert("G",Imf::Slice(Imf::HALF,base+sizeof(half),xstride,ystride));
+          data.insert("B",Imf::Slice(Imf::HALF,base+2*sizeof(half),xstride,ystride));
+        }
+        else
+        {
+          const size_t xstride = sizeof(float)*4, ystride = xstride*exr->width;
+          char *base = (char *)in - ystride*y;
+          data.insert("R",Imf::Slice(Imf::FLOAT,base,xstride,ystride));
+          data.insert("G",Imf::Slice(Imf::FLOAT,base+sizeof(float),xstride,ystride));
+          data.insert("B",Imf::Slice(Imf::FLOAT,base+2*sizeof(float),xstride,ystride));
+        }
+
+        if(exr->tiled)
+        {
+          // only whole rows of tiles can be written
+          if(y % DT_EXR_TILE || (rows % DT_EXR_TILE && y + rows < exr->height))
+          {
+            err = 1;
+            break;
+          }
+          tiled_file->setFrameBuffer(data);
+          tiled_file->writeTiles(0, tiled_file->numXTiles() - 1, y / DT_EXR_TILE, (y + rows - 1) / DT_EXR_TILE);
+        }
+        else
+        {
+          file->setFrameBuffer(data);
+          file->writePixels(rows);
+        }
+      }
+    }
+    catch (const std::exception &e)
     {
-      green[j]=in[j*4+1];
+      fprintf(stderr, "[exr_write] could not write `%s': %s\n", filename, e.what());
+      err = 1;
     }
-    data.insert("G",Imf::Slice(Imf::FLOAT,(char *)green,sizeof(float)*1,sizeof(float)*exr->width));
-
-    file.setFrameBuffer(data);
-    file.writeTiles (0, file.numXTiles() - 1, 0, file.numYTiles() - 1);
-    free(red);
-    free(green);
-    free(blue);
-    return 0;
+    free(halfbuf);
+    return err || bands->failed || bands->y < exr->height;
+  }
+
+  int write_image (dt_imageio_module_data_t *exr, const char *filename, const void *in, void *exif, int exif_len, int imgid)
+  {
+    dt_imageio_export_bands_t bands;
+    dt_imageio_export_bands_init(&bands, in, exr->width, exr->height, 32);
+    return write_image_bands(exr, filename, &bands, exif, exif_len, imgid);
   }
 
   size_t
     params_size(dt_imageio_module_format_t *self)
     {
-      return sizeof(dt_imageio_module_data_t);
+      return sizeof(dt_imageio_exr_t);
     }
 
   void*
@@ -116,6 +189,9 @@ extern "C"
     {
       dt_imageio_exr_t *d = (dt_imageio_exr_t *)malloc(sizeof(dt_imageio_exr_t));
       memset(d,0,sizeof(dt_imageio_exr_t));
+      d->compression = CLAMP(dt_conf_get_int("plugins/imageio/format/exr/compression"), 0, (int)Imf::B44_COMPRESSION);
+      d->bpp = dt_conf_get_int("plugins/imageio/format/exr/bpp") == 16 ? 16 : 32;
+      d->tiled = dt_conf_get_bool("plugins/imageio/format/exr/tiled");
       return d;
     }
 
@@ -128,7 +204,15 @@ extern "C"
   int
     set_params(dt_imageio_module_format_t *self, const void *params, const int size)
     {
+      // parameters from before the options came along keep the current ones:
+      if(size == (int)sizeof(dt_imageio_module_data_t)) return 0;
       if(size != (int)self->params_size(self)) return 1;
+      const dt_imageio_exr_t *d = (const dt_imageio_exr_t *)params;
+      dt_imageio_exr_gui_t *g = (dt_imageio_exr_gui_t *)self->gui_data;
+      gtk_combo_box_set_active(g->compression, d->compression);
+      if(d->bpp == 16) gtk_toggle_button_set_active(g->b16, TRUE);
+      else             gtk_toggle_button_set_active(g->b32, TRUE);
+      gtk_toggle_button_set_active(g->tiled, d->tiled);
       return 0;
     }
 
@@ -160,9 +244,78 @@ extern "C"
       return _("openexr");
     }
 
-  // TODO: some quality/compression stuff?
-  void gui_init    (dt_imageio_module_format_t *self) {}
-  void gui_cleanup (dt_imageio_module_format_t *self) {}
+  static void
+    compression_changed(GtkComboBox *widget, gpointer user_data)
+    {
+      dt_conf_set_int("plugins/imageio/format/exr/compression", gtk_combo_box_get_active(widget));
+    }
+
+  static void
+    bpp_changed(GtkRadioButton *radiobutton, gpointer user_data)
+    {
+      long int bpp = (long int)user_data;
+      if(gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(radiobutton)))
+        dt_conf_set_int("plugins/imageio/format/exr/bpp", bpp);
+    }
+
+  static void
+    tiled_changed(GtkToggleButton *button, gpointer user_data)
+    {
+      dt_conf_set_bool("plugins/imageio/format/exr/tiled", gtk_toggle_button_get_active(button));
+    }
+
+  void gui_init    (dt_imageio_module_format_t *self)
+  {
+    dt_imageio_exr_gui_t *gui = (dt_imageio_exr_gui_t *)malloc(sizeof(dt_imageio_exr_gui_t));
+    self->gui_data = (void *)gui;
+    const int compression = CLAMP(dt_conf_get_int("plugins/imageio/format/exr/compression"), 0, (int)Imf::B44_COMPRESSION);
+    const int bpp = dt_conf_get_int("plugins/imageio/format/exr/bpp");
+    self->widget = gtk_vbox_new(TRUE, 5);
+
+    GtkWidget *hbox = gtk_hbox_new(TRUE, 5);
+    gtk_box_pack_start(GTK_BOX(self->widget), hbox, TRUE, TRUE, 0);
+    GtkWidget *radiobutton = gtk_radio_button_new_with_label(NULL, _("16-bit (half)"));
+    gui->b16 = GTK_TOGGLE_BUTTON(radiobutton);
+    gtk_box_pack_start(GTK_BOX(hbox), radiobutton, TRUE, TRUE, 0);
+    g_signal_connect(G_OBJECT(radiobutton), "toggled", G_CALLBACK(bpp_changed), (gpointer)16);
+    if(bpp == 16) gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(radiobutton), TRUE);
+    radiobutton = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(radiobutton), _("32-bit (float)"));
+    gui->b32 = GTK_TOGGLE_BUTTON(radiobutton);
+    gtk_box_pack_start(GTK_BOX(hbox), radiobutton, TRUE, TRUE, 0);
+    g_signal_connect(G_OBJECT(radiobutton), "toggled", G_CALLBACK(bpp_changed), (gpointer)32);
+    if(bpp != 16) gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(radiobutton), TRUE);
+
+    hbox = gtk_hbox_new(FALSE, 5);
+    gtk_box_pack_start(GTK_BOX(self->widget), hbox, TRUE, TRUE, 0);
+    GtkWidget *label = gtk_label_new(_("compression"));
+    gtk_misc_set_alignment(GTK_MISC(label), 0.0, 0.5);
+    gtk_box_pack_start(GTK_BOX(hbox), label, TRUE, TRUE, 0);
+    // in the order of Imf::Compression:
+    GtkWidget *combo = gtk_combo_box_new_text();
+    gui->compression = GTK_COMBO_BOX(combo);
+    gtk_combo_box_append_text(GTK_COMBO_BOX(combo), _("uncompressed"));
+    gtk_combo_box_append_text(GTK_COMBO_BOX(combo), _("rle"));
+    gtk_combo_box_append_text(GTK_COMBO_BOX(combo), _("zips"));
+    gtk_combo_box_append_text(GTK_COMBO_BOX(combo), _("zip"));
+    gtk_combo_box_append_text(GTK_COMBO_BOX(combo), _("piz"));
+    gtk_combo_box_append_text(GTK_COMBO_BOX(combo), _("pxr24 (lossy)"));
+    gtk_combo_box_append_text(GTK_COMBO_BOX(combo), _("b44 (lossy, half only)"));
+    gtk_combo_box_set_active(GTK_COMBO_BOX(combo), compression);
+    gtk_box_pack_start(GTK_BOX(hbox), combo, TRUE, TRUE, 0);
+    g_signal_connect(G_OBJECT(combo), "changed", G_CALLBACK(compression_changed), NULL);
+
+    GtkWidget *tiled = gtk_check_button_new_with_label(_("tiled"));
+    gui->tiled = GTK_TOGGLE_BUTTON(tiled);
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(tiled), dt_conf_get_bool("plugins/imageio/format/exr/tiled"));
+    gtk_box_pack_start(GTK_BOX(self->widget), tiled, TRUE, TRUE, 0);
+    g_signal_connect(G_OBJECT(tiled), "toggled", G_CALLBACK(tiled_changed), NULL);
+  }
+
+  void gui_cleanup (dt_imageio_module_format_t *self)
+  {
+    free(self->gui_data);
+  }
+
   void gui_reset   (dt_imageio_module_format_t *self) {}
 
 
@@ -353,6 +353,16 @@ int write_image (dt_imageio_module_data_t *j2k_tmp, const char *filename, const
     cinema_parameters(&parameters);
   }
 
+  /* split big images into tiles, so the wavelet transform and the code blocks of one tile stay in the caches
+   * instead of streaming through the whole image for every pass. dcp profiles don't allow tiles. */
+  const int tile_size = dt_conf_get_int("plugins/imageio/format/j2k/tile_size");
+  if(!parameters.cp_cinema && tile_size > 0 && (j2k->width > tile_size || j2k->height > tile_size))
+  {
+    parameters.tile_size_on = 1;
+    parameters.cp_tx0 = parameters.cp_ty0 = 0;
+    parameters.cp_tdx = parameters.cp_tdy = tile_size;
+  }
+
   /* Create comment for codestream */
   const char comment[] = "Created by "PACKAGE_STRING;
   parameters.cp_comment = g_strdup(comment);
@@ -394,18 +404,27 @@ int write_image (dt_imageio_module_data_t *j2k_tmp, const char *filename, const
     switch(prec)
     {
       case 8:
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(static) default(none) shared(image, in, w, h, numcomps)
+#endif
         for(int i = 0; i < w * h; i++)
         {
           for(int k = 0; k < numcomps; k++) image->comps[k].data[i] = DOWNSAMPLE_FLOAT_TO_8BIT(in[i*4 + k]);
         }
         break;
       case 12:
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(static) default(none) shared(image, in, w, h, numcomps)
+#endif
         for(int i = 0; i < w * h; i++)
         {
           for(int k = 0; k < numcomps; k++) image->comps[k].data[i] = DOWNSAMPLE_FLOAT_TO_12BIT(in[i*4 + k]);
         }
         break;
       case 16:
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(static) default(none) shared(image, in, w, h, numcomps)
+#endif
         for(int i = 0; i < w * h; i++)
         {
           for(int k = 0; k < numcomps; k++) image->comps[k].data[i] = DOWNSAMPLE_FLOAT_TO_16BIT(in[i*4 + k]);
@@ -322,10 +322,9 @@ read_icc_profile (j_decompress_ptr cinfo,
 
 
 int
-write_image (dt_imageio_module_data_t *jpg_tmp, const char *filename, const void *in_tmp, void *exif, int exif_len, int imgid)
+write_image_bands (dt_imageio_module_data_t *jpg_tmp, const char *filename, dt_imageio_export_bands_t *bands, void *exif, int exif_len, int imgid)
 {
   dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t*)jpg_tmp;
-  const uint8_t*in =(const uint8_t*)in_tmp;
   struct dt_imageio_jpeg_error_mgr jerr;
 
   jpg->cinfo.err = jpeg_std_error(&jerr.pub);
@@ -375,14 +374,26 @@ write_image (dt_imageio_module_data_t *jpg_tmp, const char *filename, const void
     jpeg_write_marker(&(jpg->cinfo), JPEG_APP0+1, exif, exif_len);
 
   uint8_t row[3*jpg->width];
-  const uint8_t *buf;
-  while(jpg->cinfo.next_scanline < jpg->cinfo.image_height)
+  const uint8_t *in;
+  int y, rows;
+  while((in = dt_imageio_export_band(bands, &y, &rows)))
   {
-    JSAMPROW tmp[1];
-    buf = in + jpg->cinfo.next_scanline * jpg->cinfo.image_width * 4;
-    for(int i=0; i<jpg->width; i++) for(int k=0; k<3; k++) row[3*i+k] = buf[4*i+k];
-    tmp[0] = row;
-    jpeg_write_scanlines(&(jpg->cinfo), tmp, 1);
+    for(int j=0; j<rows; j++)
+    {
+      JSAMPROW tmp[1];
+      const uint8_t *buf = in + (size_t)4*jpg->width*j;
+      for(int i=0; i<jpg->width; i++) for(int k=0; k<3; k++) row[3*i+k] = buf[4*i+k];
+      tmp[0] = row;
+      jpeg_write_scanlines(&(jpg->cinfo), tmp, 1);
+    }
+  }
+  if(jpg->cinfo.next_scanline < jpg->cinfo.image_height)
+  {
+    // the pipe gave up on us, libjpeg doesn't want to finish a short image
+    jpeg_abort_compress(&(jpg->cinfo));
+    jpeg_destroy_compress(&(jpg->cinfo));
+    fclose(f);
+    return 1;
   }
   jpeg_finish_compress (&(jpg->cinfo));
   jpeg_destroy_compress(&(jpg->cinfo));
@@ -390,6 +401,14 @@ write_image (dt_imageio_module_data_t *jpg_tmp, const char *filename, const void
   return 0;
 }
 
+int
+write_image (dt_imageio_module_data_t *jpg, const char *filename, const void *in, void *exif, int exif_len, int imgid)
+{
+  dt_imageio_export_bands_t bands;
+  dt_imageio_export_bands_init(&bands, in, jpg->width, jpg->height, 8);
+  return write_image_bands(jpg, filename, &bands, exif, exif_len, imgid);
+}
+
 int read_header(const char *filename, dt_imageio_jpeg_t *jpg)
 {
   jpg->f = fopen(filename, "rb");
@@ -27,28 +27,40 @@
 
 DT_MODULE(1)
 
-int write_image (dt_imageio_module_data_t *pfm, const char *filename, const void *in_tmp, void *exif, int exif_len, int imgid)
+int write_image_bands (dt_imageio_module_data_t *pfm, const char *filename, dt_imageio_export_bands_t *bands, void *exif, int exif_len, int imgid)
 {
-  const float *in = (const float*)in_tmp;
   int status = 0;
   FILE *f = fopen(filename, "wb");
   if(f)
   {
-    (void)fprintf(f, "PF\n%d %d\n-1.0\n", pfm->width, pfm->height);
-    for(int j=pfm->height-1; j>=0; j--)
+    // pfm stores the bottom row first, so the rows of each band are put in place behind the header
+    const int header = fprintf(f, "PF\n%d %d\n-1.0\n", pfm->width, pfm->height);
+    const size_t rowsize = sizeof(float)*3*pfm->width;
+    float *row = (float *)malloc(rowsize);
+    const float *in;
+    int y, rows;
+    while(row && header > 0 && (in = dt_imageio_export_band(bands, &y, &rows)))
     {
-      for(int i=0; i<pfm->width; i++)
+      for(int j=0; j<rows; j++)
       {
-        int cnt = fwrite(in + 4*(pfm->width*j + i), sizeof(float)*3, 1, f);
-        if(cnt != 1) status = 1;
-        else status = 0;
+        for(int i=0; i<pfm->width; i++) for(int k=0; k<3; k++) row[3*i+k] = in[4*(pfm->width*j + i) + k];
+        if(fseek(f, header + rowsize*(pfm->height-1-(y+j)), SEEK_SET) || fwrite(row, rowsize, 1, f) != 1) status = 1;
       }
     }
+    if(!row || header <= 0) status = 1;
+    free(row);
     fclose(f);
   }
   return status;
 }
 
+int write_image (dt_imageio_module_data_t *pfm, const char *filename, const void *in, void *exif, int exif_len, int imgid)
+{
+  dt_imageio_export_bands_t bands;
+  dt_imageio_export_bands_init(&bands, in, pfm->width, pfm->height, 32);
+  return write_image_bands(pfm, filename, &bands, exif, exif_len, imgid);
+}
+
 size_t
 params_size(dt_imageio_module_format_t *self)
 {
@@ -41,6 +41,7 @@ typedef struct dt_imageio_png_t
   int width, height;
   char style[128];
   int bpp;
+  int compression; // zlib level
   FILE *f;
   png_structp png_ptr;
   png_infop info_ptr;
@@ -50,6 +51,7 @@ dt_imageio_png_t;
 typedef struct dt_imageio_png_gui_t
 {
   GtkToggleButton *b8, *b16;
+  GtkDarktableSlider *compression;
 }
 dt_imageio_png_gui_t;
 
@@ -122,14 +124,172 @@ static void PNGwriteRawProfile(png_struct *ping,
   png_free(ping, text);
 }
 
+// uncompressed bytes per chunk for the parallel deflate:
+#define DT_PNG_CHUNK_BYTES (256<<10)
+
+/*
+ * parallel deflate, the way pigz does it: the filtered rows are cut into chunks which are
+ * compressed independently into raw deflate streams, each ending on a byte boundary
+ * (Z_SYNC_FLUSH) and the last one with Z_FINISH. behind a zlib header and followed by the
+ * combined adler32 they form a regular zlib stream, which goes to the file as idat chunks.
+ */
+typedef struct dt_imageio_png_deflate_t
+{
+  int level;
+  int threads;
+  int chunk_rows;
+  size_t rowbytes;    // filtered row, including the filter type byte
+  size_t packedsize;  // room for one compressed chunk
+  uint8_t *filtered;  // threads*chunk_rows filtered rows
+  uint8_t *packed;    // threads compressed chunks
+  uLong *len, *adler; // per chunk
+  uLong total_adler;
+  int started;
+}
+dt_imageio_png_deflate_t;
+
+static int
+_deflate_init(dt_imageio_png_deflate_t *z, const int width, const int bpp, const int level)
+{
+  z->level = level;
+  z->threads = dt_get_num_threads();
+  z->rowbytes = 1 + (size_t)3*width*(bpp > 8 ? 2 : 1);
+  z->chunk_rows = MAX(1, DT_PNG_CHUNK_BYTES / z->rowbytes);
+  // stored blocks and the sync flush marker on top of compressBound():
+  z->packedsize = compressBound(z->rowbytes*z->chunk_rows) + 64;
+  z->filtered = (uint8_t *)malloc(z->rowbytes*z->chunk_rows*z->threads);
+  z->packed = (uint8_t *)malloc(z->packedsize*z->threads);
+  z->len = (uLong *)malloc(sizeof(uLong)*z->threads);
+  z->adler = (uLong *)malloc(sizeof(uLong)*z->threads);
+  z->total_adler = adler32(0, NULL, 0);
+  z->started = 0;
+  return !z->filtered || !z->packed || !z->len || !z->adler;
+}
+
+static void
+_deflate_cleanup(dt_imageio_png_deflate_t *z)
+{
+  free(z->filtered);
+  free(z->packed);
+  free(z->len);
+  free(z->adler);
+  z->filtered = z->packed = NULL;
+  z->len = z->adler = NULL;
+}
+
+// filters (sub) and compresses one chunk of rows, in big endian for 16 bit.
+static int
+_deflate_chunk(dt_imageio_png_deflate_t *z, const int k, const uint8_t *in, const int width,
+               const int bpp, const int rows, const int last)
+{
+  const int pixelbytes = bpp > 8 ? 6 : 3;
+  uint8_t *filtered = z->filtered + z->rowbytes*z->chunk_rows*k;
+  for(int j=0; j<rows; j++)
+  {
+    uint8_t *row = filtered + z->rowbytes*j;
+    row[0] = 1; // sub
+    uint8_t *out = row + 1;
+    if(bpp > 8)
+    {
+      const uint16_t *in16 = (const uint16_t *)in + (size_t)4*width*j;
+      for(int x=0; x<width; x++) for(int c=0; c<3; c++)
+        {
+          out[6*x+2*c+0] = in16[4*x+c] >> 8;
+          out[6*x+2*c+1] = in16[4*x+c] & 0xff;
+        }
+    }
+    else
+    {
+      const uint8_t *in8 = in + (size_t)4*width*j;
+      for(int x=0; x<width; x++) for(int c=0; c<3; c++) out[3*x+c] = in8[4*x+c];
+    }
+    for(int i=z->rowbytes-2; i>=pixelbytes; i--) out[i] -= out[i-pixelbytes];
+  }
+
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if(deflateInit2(&strm, z->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) return 1;
+  strm.next_in = filtered;
+  strm.avail_in = z->rowbytes*rows;
+  strm.next_out = z->packed + z->packedsize*k;
+  strm.avail_out = z->packedsize;
+  const int ret = deflate(&strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+  // a sync flush is only complete if there was output space left:
+  const int err = last ? (ret != Z_STREAM_END) : (ret != Z_OK || strm.avail_in || !strm.avail_out);
+  z->len[k] = z->packedsize - strm.avail_out;
+  z->adler[k] = adler32(adler32(0, NULL, 0), filtered, z->rowbytes*rows);
+  deflateEnd(&strm);
+  return err;
+}
+
+// compresses the given rows in parallel and appends them to the idat stream.
+static int
+_deflate_rows(png_structp png_ptr, dt_imageio_png_deflate_t *z, const uint8_t *in, const int width,
+              const int bpp, const int rows, const int last)
+{
+  const size_t stride = (size_t)4*width*(bpp > 8 ? 2 : 1);
+  for(int y=0; y<rows; y+=z->chunk_rows*z->threads)
+  {
+    const int group_rows = MIN(z->chunk_rows*z->threads, rows - y);
+    const int chunks = (group_rows + z->chunk_rows - 1) / z->chunk_rows;
+    int err = 0;
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) shared(z, in, err)
+#endif
+    for(int k=0; k<chunks; k++)
+    {
+      const int first = y + k*z->chunk_rows;
+      const int n = MIN(z->chunk_rows, rows - first);
+      if(_deflate_chunk(z, k, in + stride*first, width, bpp, n, last && first + n == rows)) err = 1;
+    }
+    if(err) return 1;
+
+    for(int k=0; k<chunks; k++)
+    {
+      const int first = y + k*z->chunk_rows;
+      const int n = MIN(z->chunk_rows, rows - first);
+      const int final = last && first + n == rows;
+      z->total_adler = adler32_combine(z->total_adler, z->adler[k], z->rowbytes*n);
+
+      // zlib header, 32k window, level hint, check bits:
+      const int flevel = z->level < 2 ? 0 : (z->level < 6 ? 1 : (z->level == 6 ? 2 : 3));
+      png_byte header[2] = { 0x78, flevel << 6 };
+      header[1] += 31 - (header[0]*256 + header[1]) % 31;
+      png_byte trailer[4] = { z->total_adler >> 24, z->total_adler >> 16, z->total_adler >> 8, z->total_adler };
+
+      png_write_chunk_start(png_ptr, (png_bytep)"IDAT", z->len[k] + (z->started ? 0 : 2) + (final ? 4 : 0));
+      if(!z->started) png_write_chunk_data(png_ptr, header, 2);
+      png_write_chunk_data(png_ptr, z->packed + z->packedsize*k, z->len[k]);
+      if(final) png_write_chunk_data(png_ptr, trailer, 4);
+      png_write_chunk_end(png_ptr);
+      z->started = 1;
+    }
+  }
+  return 0;
+}
+
 int
-write_image (dt_imageio_module_data_t *p_tmp, const char *filename, const void *in_void, void *exif, int exif_len, int imgid)
+write_image_bands (dt_imageio_module_data_t *p_tmp, const char *filename, dt_imageio_export_bands_t *bands, void *exif, int exif_len, int imgid)
 {
   dt_imageio_png_t*p=(dt_imageio_png_t*)p_tmp;
   const int width = p->width, height = p->height;
-  const uint8_t *in = (uint8_t *)in_void;
+  const int level = CLAMP(p->compression, 0, 9);
+  // one core is as fast with libpng, which also picks the filters more carefully:
+  const int parallel = dt_get_num_threads() > 1;
+  dt_imageio_png_deflate_t z;
+  memset(&z, 0, sizeof(z));
+  if(parallel && _deflate_init(&z, width, p->bpp, level))
+  {
+    _deflate_cleanup(&z);
+    return 1;
+  }
+
   FILE *f = fopen(filename, "wb");
-  if (!f) return 1;
+  if (!f)
+  {
+    _deflate_cleanup(&z);
+    return 1;
+  }
 
   png_structp png_ptr;
   png_infop info_ptr;
@@ -138,6 +298,7 @@ write_image (dt_imageio_module_data_t *p_tmp, const char *filename, const void *
   if (!png_ptr)
   {
     fclose(f);
+    _deflate_cleanup(&z);
     return 1;
   }
 
@@ -146,6 +307,7 @@ write_image (dt_imageio_module_data_t *p_tmp, const char *filename, const void *
   {
     fclose(f);
     png_destroy_write_struct(&png_ptr, NULL);
+    _deflate_cleanup(&z);
     return 1;
   }
 
@@ -153,12 +315,13 @@ write_image (dt_imageio_module_data_t *p_tmp, const char *filename, const void *
   {
     fclose(f);
     png_destroy_write_struct(&png_ptr, NULL);
+    _deflate_cleanup(&z);
     return 1;
   }
 
   png_init_io(png_ptr, f);
 
-  png_set_compression_level(png_ptr, Z_BEST_COMPRESSION);
+  png_set_compression_level(png_ptr, level);
   png_set_compression_mem_level(png_ptr, 8);
   png_set_compression_strategy(png_ptr, Z_DEFAULT_STRATEGY);
   png_set_compression_window_bits(png_ptr, 15);
@@ -169,44 +332,74 @@ write_image (dt_imageio_module_data_t *p_tmp, const char *filename, const void *
                p->bpp, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
                PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
 
+  // goes out with the header, the parallel writer doesn't get to png_write_end():
+  PNGwriteRawProfile(png_ptr, info_ptr, "exif", exif, exif_len);
+
+  // TODO: embed icc profile!
+
   png_write_info(png_ptr, info_ptr);
 
   // png_bytep row_pointer = (png_bytep) in;
   png_byte row[6*width];
   // unsigned long rowbytes = png_get_rowbytes(png_ptr, info_ptr);
 
-  if(p->bpp > 8)
+  const uint8_t *in;
+  int y, rows, err = 0;
+  while(!err && (in = dt_imageio_export_band(bands, &y, &rows)))
   {
-    for (int y = 0; y < height; y++)
+    if(parallel)
     {
-      for(int x=0; x<width; x++) for(int k=0; k<3; k++)
-        {
-          uint16_t pix = ((uint16_t *)in)[4*width*y + 4*x + k];
-          uint16_t swapped = (0xff00 & (pix<<8)) | (pix>>8);
-          ((uint16_t *)row)[3*x+k] = swapped;
-        }
-      png_write_row(png_ptr, row);
+      err = _deflate_rows(png_ptr, &z, in, width, p->bpp, rows, y + rows == height);
     }
-  }
-  else
-  {
-    for (int y = 0; y < height; y++)
+    else if(p->bpp > 8)
+    {
+      for (int j = 0; j < rows; j++)
+      {
+        for(int x=0; x<width; x++) for(int k=0; k<3; k++)
+          {
+            uint16_t pix = ((uint16_t *)in)[4*width*j + 4*x + k];
+            uint16_t swapped = (0xff00 & (pix<<8)) | (pix>>8);
+            ((uint16_t *)row)[3*x+k] = swapped;
+          }
+        png_write_row(png_ptr, row);
+      }
+    }
+    else
     {
-      for(int x=0; x<width; x++) for(int k=0; k<3; k++) row[3*x+k] = in[4*width*y + 4*x + k];
-      png_write_row(png_ptr, row);
+      for (int j = 0; j < rows; j++)
+      {
+        for(int x=0; x<width; x++) for(int k=0; k<3; k++) row[3*x+k] = in[4*width*j + 4*x + k];
+        png_write_row(png_ptr, row);
+      }
     }
   }
+  _deflate_cleanup(&z);
+  if(err || bands->failed || bands->y < height)
+  {
+    // the pipe gave up on us, don't write the trailer of a short image
+    fclose(f);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    return 1;
+  }
 
-  PNGwriteRawProfile(png_ptr, info_ptr, "exif", exif, exif_len);
-
-  // TODO: embed icc profile!
-
-  png_write_end(png_ptr, info_ptr);
+  if(parallel)
+    png_write_chunk(png_ptr, (png_bytep)"IEND", NULL, 0);
+  else
+    png_write_end(png_ptr, info_ptr);
   png_destroy_write_struct(&png_ptr, &info_ptr);
   fclose(f);
   return 0;
 }
 
+int
+write_image (dt_imageio_module_data_t *p_tmp, const char *filename, const void *in, void *exif, int exif_len, int imgid)
+{
+  dt_imageio_png_t*p=(dt_imageio_png_t*)p_tmp;
+  dt_imageio_export_bands_t bands;
+  dt_imageio_export_bands_init(&bands, in, p->width, p->height, p->bpp > 8 ? 16 : 8);
+  return write_image_bands(p_tmp, filename, &bands, exif, exif_len, imgid);
+}
+
 int read_header(const char *filename, dt_imageio_module_data_t *p_tmp)
 {
   dt_imageio_png_t*png=(dt_imageio_png_t*)p_tmp;
@@ -333,7 +526,7 @@ int read_image (dt_imageio_module_data_t *p_tmp, uint8_t *out)
 size_t
 params_size(dt_imageio_module_format_t *self)
 {
-  return sizeof(dt_imageio_module_data_t) + sizeof(int);
+  return sizeof(dt_imageio_module_data_t) + 2*sizeof(int);
 }
 
 void*
@@ -344,6 +537,7 @@ get_params(dt_imageio_module_format_t *self)
   d->bpp = dt_conf_get_int("plugins/imageio/format/png/bpp");
   if(d->bpp < 12) d->bpp = 8;
   else            d->bpp = 16;
+  d->compression = CLAMP(dt_conf_get_int("plugins/imageio/format/png/compression"), 0, 9);
   return d;
 }
 
@@ -356,12 +550,15 @@ free_params(dt_imageio_module_format_t *self, dt_imageio_module_data_t *params)
 int
 set_params(dt_imageio_module_format_t *self, const void *params, const int size)
 {
-  if(size != self->params_size(self)) return 1;
+  // parameters from before the compression level keep the current one:
+  const int old = (size == self->params_size(self) - sizeof(int));
+  if(size != self->params_size(self) && !old) return 1;
   dt_imageio_png_t *d = (dt_imageio_png_t *)params;
   dt_imageio_png_gui_t *g = (dt_imageio_png_gui_t *)self->gui_data;
   if(d->bpp < 12) gtk_toggle_button_set_active(g->b8, TRUE);
   else            gtk_toggle_button_set_active(g->b16, TRUE);
   dt_conf_set_int("plugins/imageio/format/png/bpp", d->bpp);
+  if(!old) dtgtk_slider_set_value(g->compression, d->compression);
   return 0;
 }
 
@@ -401,32 +598,50 @@ radiobutton_changed (GtkRadioButton *radiobutton, gpointer user_data)
     dt_conf_set_int("plugins/imageio/format/png/bpp", bpp);
 }
 
+static void
+compression_changed (GtkDarktableSlider *slider, gpointer user_data)
+{
+  int compression = (int)dtgtk_slider_get_value(slider);
+  dt_conf_set_int("plugins/imageio/format/png/compression", compression);
+}
+
 void init(dt_imageio_module_format_t *self)
 {
 #ifdef USE_LUA
   luaA_struct(darktable.lua_state,dt_imageio_png_t);
   dt_lua_register_module_member(darktable.lua_state,self,dt_imageio_png_t,bpp,int);
+  dt_lua_register_module_member(darktable.lua_state,self,dt_imageio_png_t,compression,int);
 #endif
 }
 void cleanup(dt_imageio_module_format_t *self) {}
 
-// TODO: some quality/compression stuff?
 void gui_init (dt_imageio_module_format_t *self)
 {
   dt_imageio_png_gui_t *gui = (dt_imageio_png_gui_t *)malloc(sizeof(dt_imageio_png_gui_t));
   self->gui_data = (void *)gui;
   int bpp = dt_conf_get_int("plugins/imageio/format/png/bpp");
-  self->widget = gtk_hbox_new(TRUE, 5);
+  int compression = dt_conf_get_int("plugins/imageio/format/png/compression");
+  self->widget = gtk_vbox_new(TRUE, 5);
+  GtkWidget *hbox = gtk_hbox_new(TRUE, 5);
+  gtk_box_pack_start(GTK_BOX(self->widget), hbox, TRUE, TRUE, 0);
   GtkWidget *radiobutton = gtk_radio_button_new_with_label(NULL, _("8-bit"));
   gui->b8 = GTK_TOGGLE_BUTTON(radiobutton);
-  gtk_box_pack_start(GTK_BOX(self->widget), radiobutton, TRUE, TRUE, 0);
+  gtk_box_pack_start(GTK_BOX(hbox), radiobutton, TRUE, TRUE, 0);
   g_signal_connect(G_OBJECT(radiobutton), "toggled", G_CALLBACK(radiobutton_changed), (gpointer)8);
   if(bpp < 12) gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(radiobutton), TRUE);
   radiobutton = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(radiobutton), _("16-bit"));
   gui->b16 = GTK_TOGGLE_BUTTON(radiobutton);
-  gtk_box_pack_start(GTK_BOX(self->widget), radiobutton, TRUE, TRUE, 0);
+  gtk_box_pack_start(GTK_BOX(hbox), radiobutton, TRUE, TRUE, 0);
   g_signal_connect(G_OBJECT(radiobutton), "toggled", G_CALLBACK(radiobutton_changed), (gpointer)16);
   if(bpp >= 12) gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(radiobutton), TRUE);
+
+  // zlib level
+  gui->compression = DTGTK_SLIDER(dtgtk_slider_new_with_range(DARKTABLE_SLIDER_BAR, 0, 9, 1, 6, 0));
+  dtgtk_slider_set_label(gui->compression, _("compression"));
+  dtgtk_slider_set_default_value(gui->compression, 6);
+  dtgtk_slider_set_value(gui->compression, CLAMP(compression, 0, 9));
+  gtk_box_pack_start(GTK_BOX(self->widget), GTK_WIDGET(gui->compression), TRUE, TRUE, 0);
+  g_signal_connect(G_OBJECT(gui->compression), "value-changed", G_CALLBACK(compression_changed), NULL);
 }
 
 void gui_cleanup (dt_imageio_module_format_t *self)
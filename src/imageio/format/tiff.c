@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <inttypes.h>
 #include <tiffio.h>
+#include <zlib.h>
 #include "common/darktable.h"
 #include "common/imageio_module.h"
 #include "common/imageio.h"
@@ -27,6 +28,7 @@
 #include "common/colorspaces.h"
 #include "control/conf.h"
 #include "common/imageio_format.h"
+#include "dtgtk/slider.h"
 #define DT_TIFFIO_STRIPE 64
 
 DT_MODULE(1)
@@ -37,6 +39,7 @@ typedef struct dt_imageio_tiff_t
   int width, height;
   char style[128];
   int bpp;
+  int compress; // deflate level, 0 for uncompressed
   TIFF *handle;
 }
 dt_imageio_tiff_t;
@@ -44,11 +47,44 @@ dt_imageio_tiff_t;
 typedef struct dt_imageio_tiff_gui_t
 {
   GtkToggleButton *b8, *b16;
+  GtkDarktableSlider *compress;
 }
 dt_imageio_tiff_gui_t;
 
+// writes the strips starting at `first' covering `rows' rows. compressed strips are deflated
+// in parallel into `packed' (strip k at k*packedsize) and written raw, in order.
+static int
+_write_strips(TIFF *tif, const uint8_t *rowdata, uint8_t *packed, const size_t packedsize,
+              const int level, const uint32_t first, const int rows, const size_t rowsize)
+{
+  const int strips = (rows + DT_TIFFIO_STRIPE - 1) / DT_TIFFIO_STRIPE;
+  const size_t stripesize = rowsize*DT_TIFFIO_STRIPE;
+  int err = 0;
+  if(!level)
+  {
+    for(int k=0; k<strips; k++)
+      if(TIFFWriteEncodedStrip(tif, first+k, (void *)(rowdata + stripesize*k),
+                               rowsize*MIN(DT_TIFFIO_STRIPE, rows - k*DT_TIFFIO_STRIPE)) < 0) err = 1;
+    return err;
+  }
+
+  uLongf len[strips];
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) shared(len, err, packed)
+#endif
+  for(int k=0; k<strips; k++)
+  {
+    len[k] = packedsize;
+    if(compress2(packed + packedsize*k, len + k, rowdata + stripesize*k,
+                 rowsize*MIN(DT_TIFFIO_STRIPE, rows - k*DT_TIFFIO_STRIPE), level) != Z_OK) err = 1;
+  }
+  for(int k=0; k<strips && !err; k++)
+    if(TIFFWriteRawStrip(tif, first+k, packed + packedsize*k, len[k]) < 0) err = 1;
+  return err;
+}
+
 
-int write_image (dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void, void *exif, int exif_len, int imgid)
+int write_image_bands (dt_imageio_module_data_t *d_tmp, const char *filename, dt_imageio_export_bands_t *bands, void *exif, int exif_len, int imgid)
 {
   dt_imageio_tiff_t *d=(dt_imageio_tiff_t*)d_tmp;
   // Fetch colorprofile into buffer if wanted
@@ -72,7 +108,8 @@ int write_image (dt_imageio_module_data_t *d_tmp, const char *filename, const vo
   TIFF *tif=TIFFOpen(filename,"wb");
   if(d->bpp == 8) TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8);
   else            TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 16);
-  TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_DEFLATE);
+  const int level = CLAMP(d->compress, 0, 9);
+  TIFFSetField(tif, TIFFTAG_COMPRESSION, level ? COMPRESSION_ADOBE_DEFLATE : COMPRESSION_NONE);
   TIFFSetField(tif, TIFFTAG_FILLORDER, FILLORDER_MSB2LSB);
   if(profile!=NULL)
     TIFFSetField(tif, TIFFTAG_ICCPROFILE, profile_len, profile);
@@ -86,67 +123,56 @@ int write_image (dt_imageio_module_data_t *d_tmp, const char *filename, const vo
   TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 3);
   TIFFSetField(tif, TIFFTAG_XRESOLUTION, 300.0);
   TIFFSetField(tif, TIFFTAG_YRESOLUTION, 300.0);
-  TIFFSetField(tif, TIFFTAG_ZIPQUALITY, 9);
-
-  const uint8_t  *in8 =(const uint8_t  *)in_void;
-  const uint16_t *in16=(const uint16_t *)in_void;
-  if(d->bpp == 16)
+  if(level) TIFFSetField(tif, TIFFTAG_ZIPQUALITY, level);
+
+  // strips are filled row by row, so they don't have to line up with the bands. when compressing,
+  // one strip per core is collected before they are deflated side by side:
+  const int bytes = d->bpp == 8 ? 1 : 2;
+  const size_t rowsize = (size_t)d->width*3*bytes;
+  const int group = level ? dt_get_num_threads() : 1;
+  const size_t packedsize = compressBound(rowsize*DT_TIFFIO_STRIPE);
+  uint8_t *rowdata = (uint8_t *)malloc(rowsize*DT_TIFFIO_STRIPE*group);
+  uint8_t *packed = level ? (uint8_t *)malloc(packedsize*group) : NULL;
+  uint32_t stripe = 0;
+  int group_rows = 0;
+  int err = !rowdata || (level && !packed);
+  const void *in;
+  int y, rows;
+  while(!err && (in = dt_imageio_export_band(bands, &y, &rows)))
   {
-    uint32_t rowsize=(d->width*3)*sizeof(uint16_t);
-    uint32_t stripesize=rowsize*DT_TIFFIO_STRIPE;
-    uint16_t *rowdata = (uint16_t *)malloc(stripesize);
-    uint16_t *wdata = rowdata;
-    uint32_t stripe=0;
-    // uint32_t insize=((d->width*d->height)*3)*sizeof(uint16_t);
-    // while(stripedata<(in8+insize)-(stripesize)) {
-    // TIFFWriteEncodedStrip(tif,stripe++,stripedata,stripesize);
-    // stripedata+=stripesize;
-    // }
-    for (int y = 0; y < d->height; y++)
+    const uint8_t  *in8 =(const uint8_t  *)in;
+    const uint16_t *in16=(const uint16_t *)in;
+    for(int j = 0; j < rows && !err; j++)
     {
-      for(int x=0; x<d->width; x++)
-        for(int k=0; k<3; k++)
-        {
-          (wdata)[0] = in16[4*d->width*y + 4*x + k];
-          wdata++;
-        }
-      if((wdata-stripesize/sizeof(uint16_t))==rowdata)
+      if(d->bpp == 16)
       {
-        TIFFWriteEncodedStrip(tif,stripe++,rowdata,rowsize*DT_TIFFIO_STRIPE);
-        wdata=rowdata;
+        uint16_t *wdata = (uint16_t *)(rowdata + rowsize*group_rows);
+        for(int x=0; x<d->width; x++) for(int k=0; k<3; k++) wdata[3*x+k] = in16[4*d->width*j + 4*x + k];
       }
-    }
-    if((wdata-stripesize/sizeof(uint16_t))!=rowdata)
-      TIFFWriteEncodedStrip(tif,stripe,rowdata,(wdata-rowdata)*sizeof(uint16_t));
-    TIFFClose(tif);
-    free(rowdata);
-  }
-  else
-  {
-    uint32_t rowsize=(d->width*3)*sizeof(uint8_t);
-    uint32_t stripesize=rowsize*DT_TIFFIO_STRIPE;
-    uint8_t *rowdata = (uint8_t *)malloc(stripesize);
-    uint8_t *wdata = rowdata;
-    uint32_t stripe=0;
-
-    for (int y = 0; y < d->height; y++)
-    {
-      for(int x=0; x<d->width; x++)
-        for(int k=0; k<3; k++)
-        {
-          (wdata)[0] = in8[4*d->width*y + 4*x + k];
-          wdata++;
-        }
-      if((wdata-stripesize)==rowdata)
+      else
+      {
+        uint8_t *wdata = rowdata + rowsize*group_rows;
+        for(int x=0; x<d->width; x++) for(int k=0; k<3; k++) wdata[3*x+k] = in8[4*d->width*j + 4*x + k];
+      }
+      if(++group_rows == DT_TIFFIO_STRIPE*group)
       {
-        TIFFWriteEncodedStrip(tif,stripe++,rowdata,rowsize*DT_TIFFIO_STRIPE);
-        wdata=rowdata;
+        err = _write_strips(tif, rowdata, packed, packedsize, level, stripe, group_rows, rowsize);
+        stripe += group;
+        group_rows = 0;
       }
     }
-    if((wdata-stripesize)!=rowdata)
-      TIFFWriteEncodedStrip(tif,stripe,rowdata,wdata-rowdata);
-    TIFFClose(tif);
-    free(rowdata);
+  }
+  if(!err && group_rows)
+    err = _write_strips(tif, rowdata, packed, packedsize, level, stripe, group_rows, rowsize);
+  TIFFClose(tif);
+  const int complete = !err && !bands->failed && bands->y >= d->height;
+  free(rowdata);
+  free(packed);
+
+  if(!complete)
+  {
+    free(profile);
+    return 1;
   }
 
   if(exif)
@@ -160,6 +186,14 @@ int write_image (dt_imageio_module_data_t *d_tmp, const char *filename, const vo
   return ((rc == 1) ? 0 : 1);
 }
 
+int write_image (dt_imageio_module_data_t *d_tmp, const char *filename, const void *in, void *exif, int exif_len, int imgid)
+{
+  dt_imageio_tiff_t *d=(dt_imageio_tiff_t*)d_tmp;
+  dt_imageio_export_bands_t bands;
+  dt_imageio_export_bands_init(&bands, in, d->width, d->height, d->bpp == 8 ? 8 : 16);
+  return write_image_bands(d_tmp, filename, &bands, exif, exif_len, imgid);
+}
+
 #if 0
 int dt_imageio_tiff_read_header(const char *filename, dt_imageio_tiff_t *tiff)
 {
@@ -193,6 +227,7 @@ get_params(dt_imageio_module_format_t *self)
   d->bpp = dt_conf_get_int("plugins/imageio/format/tiff/bpp");
   if(d->bpp < 12) d->bpp = 8;
   else            d->bpp = 16;
+  d->compress = CLAMP(dt_conf_get_int("plugins/imageio/format/tiff/compress"), 0, 9);
   return d;
 }
 
@@ -211,6 +246,7 @@ set_params(dt_imageio_module_format_t *self, const void *params, const int size)
   if(d->bpp < 12) gtk_toggle_button_set_active(g->b8, TRUE);
   else            gtk_toggle_button_set_active(g->b16, TRUE);
   dt_conf_set_int("plugins/imageio/format/tiff/bpp", d->bpp);
+  dtgtk_slider_set_value(g->compress, d->compress);
   return 0;
 }
 
@@ -250,31 +286,49 @@ radiobutton_changed (GtkRadioButton *radiobutton, gpointer user_data)
     dt_conf_set_int("plugins/imageio/format/tiff/bpp", bpp);
 }
 
+static void
+compress_changed (GtkDarktableSlider *slider, gpointer user_data)
+{
+  int compress = (int)dtgtk_slider_get_value(slider);
+  dt_conf_set_int("plugins/imageio/format/tiff/compress", compress);
+}
+
 void init(dt_imageio_module_format_t *self)
 {
 #ifdef USE_LUA
   dt_lua_register_module_member(darktable.lua_state,self,dt_imageio_tiff_t,bpp,int);
+  dt_lua_register_module_member(darktable.lua_state,self,dt_imageio_tiff_t,compress,int);
 #endif
 }
 void cleanup(dt_imageio_module_format_t *self) {}
 
-// TODO: some quality/compression stuff?
 void gui_init (dt_imageio_module_format_t *self)
 {
   dt_imageio_tiff_gui_t *gui = (dt_imageio_tiff_gui_t *)malloc(sizeof(dt_imageio_tiff_gui_t));
   self->gui_data = (void *)gui;
   int bpp = dt_conf_get_int("plugins/imageio/format/tiff/bpp");
-  self->widget = gtk_hbox_new(TRUE, 5);
+  int compress = dt_conf_get_int("plugins/imageio/format/tiff/compress");
+  self->widget = gtk_vbox_new(TRUE, 5);
+  GtkWidget *hbox = gtk_hbox_new(TRUE, 5);
+  gtk_box_pack_start(GTK_BOX(self->widget), hbox, TRUE, TRUE, 0);
   GtkWidget *radiobutton = gtk_radio_button_new_with_label(NULL, _("8-bit"));
   gui->b8 = GTK_TOGGLE_BUTTON(radiobutton);
-  gtk_box_pack_start(GTK_BOX(self->widget), radiobutton, TRUE, TRUE, 0);
+  gtk_box_pack_start(GTK_BOX(hbox), radiobutton, TRUE, TRUE, 0);
   g_signal_connect(G_OBJECT(radiobutton), "toggled", G_CALLBACK(radiobutton_changed), (gpointer)8);
   if(bpp < 12) gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(radiobutton), TRUE);
   radiobutton = gtk_radio_button_new_with_label_from_widget(GTK_RADIO_BUTTON(radiobutton), _("16-bit"));
   gui->b16 = GTK_TOGGLE_BUTTON(radiobutton);
-  gtk_box_pack_start(GTK_BOX(self->widget), radiobutton, TRUE, TRUE, 0);
+  gtk_box_pack_start(GTK_BOX(hbox), radiobutton, TRUE, TRUE, 0);
   g_signal_connect(G_OBJECT(radiobutton), "toggled", G_CALLBACK(radiobutton_changed), (gpointer)16);
   if(bpp >= 12) gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(radiobutton), TRUE);
+
+  // deflate level, 0 writes uncompressed strips
+  gui->compress = DTGTK_SLIDER(dtgtk_slider_new_with_range(DARKTABLE_SLIDER_BAR, 0, 9, 1, 6, 0));
+  dtgtk_slider_set_label(gui->compress, _("compression"));
+  dtgtk_slider_set_default_value(gui->compress, 6);
+  dtgtk_slider_set_value(gui->compress, CLAMP(compress, 0, 9));
+  gtk_box_pack_start(GTK_BOX(self->widget), GTK_WIDGET(gui->compress), TRUE, TRUE, 0);
+  g_signal_connect(G_OBJECT(gui->compress), "value-changed", G_CALLBACK(compress_changed), NULL);
 }
 
 void gui_cleanup (dt_imageio_module_format_t *self)
@@ -18,6 +18,8 @@
 
 #include "common/darktable.h"
 #include "common/exif.h"
+#include "common/export_cache.h"
+#include "common/file_location.h"
 #include "common/image.h"
 #include "common/image_cache.h"
 #include "common/imageio_module.h"
@@ -26,6 +28,7 @@
 #include "common/variables.h"
 #include "control/control.h"
 #include "control/conf.h"
+#include "control/jobs/control_jobs.h"
 #include "gui/gtk.h"
 #include "gui/gtkentry.h"
 #include "dtgtk/button.h"
@@ -35,6 +38,9 @@
 #include <stdlib.h>
 #include <glib.h>
 #include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 DT_MODULE(1)
 
@@ -53,6 +59,22 @@ typedef struct dt_imageio_disk_t
 }
 dt_imageio_disk_t;
 
+// an exported file on its way from the temporary directory to its destination
+typedef struct dt_imageio_disk_write_t
+{
+  int imgid;
+  uint64_t hash;          // for the export cache, 0 not to record the file there
+  gchar *tmpname;         // the rendered file
+  gchar *filename;        // its destination
+  gboolean sync;          // flush it before it gets its name
+  int num, total;
+}
+dt_imageio_disk_write_t;
+
+// destinations of the files still being written, their names are taken already.
+// protected by darktable.plugin_threadsafe.
+static GHashTable *_disk_pending = NULL;
+
 
 const char*
 name (const struct dt_imageio_module_storage_t *self)
@@ -142,6 +164,102 @@ gui_reset (dt_imageio_module_storage_t *self)
   dt_conf_set_string("plugins/imageio/storage/disk/file_directory", gtk_entry_get_text(d->entry));
 }
 
+static void
+_disk_log_exported(const char *filename, const int num, const int total)
+{
+  printf("[export_job] exported to `%s'\n", filename);
+  const char *trunc = filename + strlen(filename) - 32;
+  if(trunc < filename) trunc = filename;
+  dt_control_log(_("%d/%d exported to `%s%s'"), num, total, trunc != filename ? ".." : "", trunc);
+}
+
+static int
+_disk_fsync(const char *path)
+{
+  const int fd = open(path, O_RDONLY);
+  if(fd == -1) return 1;
+  const int err = fsync(fd);
+  close(fd);
+  return err != 0;
+}
+
+static int
+_disk_copy(const char *src, const char *dst)
+{
+  const int in = open(src, O_RDONLY);
+  if(in == -1) return 1;
+  const int out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(out == -1)
+  {
+    close(in);
+    return 1;
+  }
+  const size_t bufsize = 1<<20;
+  char *buf = (char *)malloc(bufsize);
+  int fail = (buf == NULL);
+  ssize_t n;
+  while(!fail && (n = read(in, buf, bufsize)) != 0)
+  {
+    if(n < 0)
+    {
+      if(errno != EINTR) fail = 1;
+      continue;
+    }
+    for(ssize_t off = 0; off < n && !fail;)
+    {
+      const ssize_t m = write(out, buf + off, n - off);
+      if(m >= 0) off += m;
+      else if(errno != EINTR) fail = 1;
+    }
+  }
+  free(buf);
+  close(in);
+  if(close(out)) fail = 1;
+  return fail;
+}
+
+// runs on the upload thread of the export job: moves the file in under a temporary name, and
+// renames it once complete. nobody sees a half written file under the name of the export.
+static int
+_disk_write(void *data)
+{
+  dt_imageio_disk_write_t *w = (dt_imageio_disk_write_t *)data;
+  gchar *part = g_strdup_printf("%s.part", w->filename);
+  // on the same file system the rendered file just moves, else it is copied:
+  int fail = rename(w->tmpname, part) && _disk_copy(w->tmpname, part);
+  if(!fail && w->sync) fail = _disk_fsync(part);
+  if(!fail) fail = (rename(part, w->filename) != 0);
+  if(!fail && w->sync)
+  {
+    // the new directory entry has to be on the disk, too:
+    gchar *dirname = g_path_get_dirname(w->filename);
+    _disk_fsync(dirname);
+    g_free(dirname);
+  }
+  if(fail) unlink(part);
+  unlink(w->tmpname);
+
+  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+  g_hash_table_remove(_disk_pending, w->filename);
+  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+
+  if(fail)
+  {
+    fprintf(stderr, "[imageio_storage_disk] could not write file: `%s'!\n", w->filename);
+    dt_control_log(_("could not export to file `%s'!"), w->filename);
+  }
+  else
+  {
+    if(w->hash) dt_export_cache_set(w->imgid, w->filename, w->hash);
+    _disk_log_exported(w->filename, w->num, w->total);
+  }
+  g_free(part);
+  g_free(w->tmpname);
+  g_free(w->filename);
+  g_free(w);
+  return fail;
+}
+
 int
 store (dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, const int imgid, dt_imageio_module_format_t *format, dt_imageio_module_data_t *fdata,
        const int num, const int total, const gboolean high_quality)
@@ -151,10 +269,13 @@ store (dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, const
   char filename[DT_MAX_PATH_LEN]= {0};
   char dirname[DT_MAX_PATH_LEN]= {0};
   dt_image_full_path(imgid, dirname, DT_MAX_PATH_LEN);
-  int fail = 0;
+  int fail = 0, unchanged = 0;
+  const uint64_t hash = dt_export_cache_hash(imgid, format, fdata, high_quality);
+  int write_behind = dt_conf_get_bool("plugins/imageio/storage/disk/write_behind");
   // we're potentially called in parallel. have sequence number synchronized:
   dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
   {
+    if(!_disk_pending) _disk_pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 
     // if filenamepattern is a directory just let att ${FILE_NAME} as default..
     if ( g_file_test(d->filename, G_FILE_TEST_IS_DIR) || ((d->filename+strlen(d->filename))[0]=='/' || (d->filename+strlen(d->filename))[0]=='\\') )
@@ -216,44 +337,98 @@ store (dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, const
 
     sprintf(c,".%s",ext);
 
+    /* the same image, exported the same way before: keep that */
+    unchanged = dt_export_cache_valid(imgid, filename, hash);
+
     /* prevent overwrite of files */
     int seq=1;
 failed:
-    if (!fail && g_file_test (filename,G_FILE_TEST_EXISTS))
+    if (!fail && !unchanged && (g_file_test (filename,G_FILE_TEST_EXISTS) || g_hash_table_contains(_disk_pending, filename)))
     {
       do
       {
         sprintf(c,"_%.2d.%s",seq,ext);
         seq++;
+        // an earlier export may have ended up under one of the numbered names:
+        unchanged = dt_export_cache_valid(imgid, filename, hash);
       }
-      while (g_file_test (filename,G_FILE_TEST_EXISTS));
+      while (!unchanged && (g_file_test (filename,G_FILE_TEST_EXISTS) || g_hash_table_contains(_disk_pending, filename)));
     }
+    // the file doesn't exist before it is written in the background, keep others from taking its name:
+    if(!fail && !unchanged && write_behind) g_hash_table_add(_disk_pending, g_strdup(filename));
 
   } // end of critical block
   dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
   if(fail) return 1;
+  if(unchanged)
+  {
+    printf("[export_job] `%s' is up to date\n", filename);
+    return DT_IMAGEIO_STORE_UNCHANGED;
+  }
+
+  /* render into the temporary directory, the file is moved to its destination in the background */
+  char tmpname[DT_MAX_PATH_LEN] = {0};
+  if(write_behind)
+  {
+    dt_loc_get_tmp_dir(tmpname, DT_MAX_PATH_LEN);
+    g_strlcat(tmpname, "/darktable.XXXXXX.", DT_MAX_PATH_LEN);
+    g_strlcat(tmpname, format->extension(fdata), DT_MAX_PATH_LEN);
+    const int fd = g_mkstemp(tmpname);
+    if(fd == -1)
+    {
+      // write it directly then
+      dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+      g_hash_table_remove(_disk_pending, filename);
+      dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+      write_behind = 0;
+    }
+    else close(fd);
+  }
+  const char *target = write_behind ? tmpname : filename;
 
   /* export image to file */
-  if(dt_imageio_export(imgid, filename, format, fdata, high_quality) != 0)
+  if(dt_imageio_export(imgid, target, format, fdata, high_quality) != 0)
   {
     fprintf(stderr, "[imageio_storage_disk] could not export to file: `%s'!\n", filename);
     dt_control_log(_("could not export to file `%s'!"), filename);
+    if(write_behind)
+    {
+      unlink(tmpname);
+      dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+      g_hash_table_remove(_disk_pending, filename);
+      dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+    }
     return 1;
   }
 
   /* now write xmp into that container, if possible */
-  if((format->flags(fdata) & FORMAT_FLAGS_SUPPORT_XMP) && dt_exif_xmp_attach(imgid, filename) != 0)
+  int xmp_failed = 0;
+  if((format->flags(fdata) & FORMAT_FLAGS_SUPPORT_XMP) && dt_exif_xmp_attach(imgid, target) != 0)
   {
     fprintf(stderr, "[imageio_storage_disk] could not attach xmp data to file: `%s'!\n", filename);
     // don't report that one to gui, as some formats (pfm, ppm, exr) just don't support
     // writing xmp via exiv2, so it might not be to worry.
-    return 1;
+    xmp_failed = 1;
   }
 
-  printf("[export_job] exported to `%s'\n", filename);
-  char *trunc = filename + strlen(filename) - 32;
-  if(trunc < filename) trunc = filename;
-  dt_control_log(_("%d/%d exported to `%s%s'"), num, total, trunc != filename ? ".." : "", trunc);
+  if(write_behind)
+  {
+    dt_imageio_disk_write_t *w = (dt_imageio_disk_write_t *)g_malloc(sizeof(dt_imageio_disk_write_t));
+    w->imgid = imgid;
+    w->hash = xmp_failed ? 0 : hash;
+    w->tmpname = g_strdup(tmpname);
+    w->filename = g_strdup(filename);
+    w->sync = dt_conf_get_bool("plugins/imageio/storage/disk/fsync");
+    w->num = num;
+    w->total = total;
+    // on the export job's upload thread, which blocks us once enough files are waiting. a failure
+    // there is counted by the job, without one it happens right here:
+    return dt_control_export_upload(sdata, _disk_write, w) || xmp_failed;
+  }
+  if(xmp_failed) return 1;
+
+  dt_export_cache_set(imgid, filename, hash);
+  _disk_log_exported(filename, num, total);
   return 0;
 }
 
@@ -30,6 +30,7 @@
 #include "common/imageio_storage.h"
 #include "control/conf.h"
 #include "control/control.h"
+#include "control/jobs/control_jobs.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -1138,10 +1139,71 @@ int supported(struct dt_imageio_module_storage_t *self, struct dt_imageio_module
   return 0;
 }
 
+// one exported image waiting for upload
+typedef struct _facebook_upload_t
+{
+  FBContext *ctx;
+  gchar *fname;
+  char *caption;
+  GList *desc;
+  int imgid, num, total;
+}
+_facebook_upload_t;
+
+static int _facebook_upload(void *data)
+{
+  _facebook_upload_t *u = (_facebook_upload_t *)data;
+  FBContext *ctx = u->ctx;
+  gint result = 1;
+
+  if (ctx->album_id == NULL)
+  {
+    if (ctx->album_title == NULL)
+    {
+      dt_control_log(_("unable to create album, no title provided"));
+      result = 0;
+      goto cleanup;
+    }
+    const gchar *album_id = fb_create_album(ctx, ctx->album_title, ctx->album_summary, ctx->album_permission);
+    if (album_id == NULL)
+    {
+      dt_control_log(_("unable to create album"));
+      result = 0;
+      goto cleanup;
+    }
+    ctx->album_id = g_strdup(album_id);
+  }
+
+  const char *photoid = fb_upload_photo_to_album(ctx, ctx->album_id, u->fname, u->caption);
+  if (photoid == NULL)
+  {
+    dt_control_log(_("unable to export photo to webalbum"));
+    result = 0;
+    goto cleanup;
+  }
+
+cleanup:
+  unlink( u->fname );
+  g_free( u->fname );
+  g_free( u->caption );
+  if(u->desc)
+  {
+    //no need to free desc->data as caption points to it
+    g_list_free(u->desc);
+  }
+
+  if (result)
+  {
+    //this makes sense only if the export was successful
+    dt_control_log(_("%d/%d exported to facebook webalbum"), u->num, u->total );
+  }
+  g_free(u);
+  return !result;
+}
+
 /* this actually does the work */
 int store(dt_imageio_module_storage_t *self, struct dt_imageio_module_data_t *sdata, const int imgid, dt_imageio_module_format_t *format, dt_imageio_module_data_t *fdata, const int num, const int total, const gboolean high_quality)
 {
-  gint result = 1;
   dt_storage_facebook_param_t *p = (dt_storage_facebook_param_t*)sdata;
 
   const char *ext = format->extension(fdata);
@@ -1189,51 +1251,22 @@ int store(dt_imageio_module_storage_t *self, struct dt_imageio_module_data_t *sd
   {
     g_printerr("[facebook] could not export to file: `%s'!\n", fname);
     dt_control_log(_("could not export to file `%s'!"), fname);
-    result = 0;
-    goto cleanup;
-  }
-
-  if (p->facebook_ctx->album_id == NULL)
-  {
-    if (p->facebook_ctx->album_title == NULL)
-    {
-      dt_control_log(_("unable to create album, no title provided"));
-      result = 0;
-      goto cleanup;
-    }
-    const gchar *album_id = fb_create_album(p->facebook_ctx, p->facebook_ctx->album_title, p->facebook_ctx->album_summary, p->facebook_ctx->album_permission);
-    if (album_id == NULL)
-    {
-      dt_control_log(_("unable to create album"));
-      result = 0;
-      goto cleanup;
-    }
-    p->facebook_ctx->album_id = g_strdup(album_id);
-  }
-
-  const char *photoid = fb_upload_photo_to_album(p->facebook_ctx, p->facebook_ctx->album_id, fname, caption);
-  if (photoid == NULL)
-  {
-    dt_control_log(_("unable to export photo to webalbum"));
-    result = 0;
-    goto cleanup;
-  }
-
-cleanup:
-  unlink( fname );
-  g_free( caption );
-  if(desc)
-  {
-    //no need to free desc->data as caption points to it
-    g_list_free(desc);
+    unlink( fname );
+    g_free( caption );
+    if(desc) g_list_free(desc);
+    return 1;
   }
 
-  if (result)
-  {
-    //this makes sense only if the export was successful
-    dt_control_log(_("%d/%d exported to facebook webalbum"), num, total );
-  }
-  return 0;
+  // hand the file over to the export job's upload thread and go on rendering the next image
+  _facebook_upload_t *u = (_facebook_upload_t *)g_malloc(sizeof(_facebook_upload_t));
+  u->ctx = p->facebook_ctx;
+  u->fname = g_strdup(fname);
+  u->caption = caption;
+  u->desc = desc;
+  u->imgid = imgid;
+  u->num = num;
+  u->total = total;
+  return dt_control_export_upload(sdata, _facebook_upload, u);
 }
 
 
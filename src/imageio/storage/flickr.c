@@ -30,6 +30,7 @@
 #include "common/imageio_storage.h"
 #include "control/conf.h"
 #include "control/control.h"
+#include "control/jobs/control_jobs.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -612,19 +613,93 @@ gui_reset (dt_imageio_module_storage_t *self)
 {
 }
 
+// one rendered image waiting for upload
+typedef struct _flickr_upload_t
+{
+  dt_storage_flickr_params_t *p;
+  gchar *fname;
+  char *caption, *description;
+  GList *desc;
+  gint tags;
+  int num, total;
+}
+_flickr_upload_t;
+
+static int
+_flickr_upload(void *data)
+{
+  _flickr_upload_t *u = (_flickr_upload_t *)data;
+  dt_storage_flickr_params_t *p = u->p;
+  gint result = 1;
+
+  flickcurl_upload_status *photo_status = _flickr_api_upload_photo( p, u->fname, u->caption, u->description, u->tags );
+  if( !photo_status )
+  {
+    result=0;
+    goto cleanup;
+  }
+
+  // A photoset is only created if we have an album title set
+  if( p->flickr_api->current_album == NULL && p->flickr_api->new_album == TRUE)
+  {
+    char *photoset_id;
+    photoset_id = _flickr_api_create_photoset(p->flickr_api, photo_status->photoid);
+
+    if( photoset_id == NULL)
+    {
+      dt_control_log("failed to create flickr album");
+    }
+    else
+    {
+      p->flickr_api->current_album = flickcurl_photosets_getInfo(p->flickr_api->fc,photoset_id);
+    }
+  }
+
+// TODO: What to do if photoset creation fails?
+
+  // Add to gallery, if needed
+  if (p->flickr_api->current_album != NULL && p->flickr_api->new_album != TRUE)
+  {
+    flickcurl_photosets_addPhoto (p->flickr_api->fc, p->flickr_api->current_album->id, photo_status->photoid);
+    // TODO: Check for errors adding photo to gallery
+  }
+  else
+  {
+    if (p->flickr_api->current_album != NULL && p->flickr_api->new_album == TRUE)
+    {
+      p->flickr_api->new_album = FALSE;
+    }
+  }
+
+cleanup:
+
+  // And remove from filesystem..
+  unlink( u->fname );
+  g_free( u->fname );
+  g_free( u->caption );
+  if(u->desc)
+  {
+    g_free(u->desc->data);
+    g_list_free(u->desc);
+  }
+
+  if (result)
+  {
+    //this makes sense only if the export was successful
+    dt_control_log(_("%d/%d exported to flickr webalbum"), u->num, u->total );
+  }
+  g_free(u);
+  return !result;
+}
+
 int
 store (dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, const int imgid, dt_imageio_module_format_t *format, dt_imageio_module_data_t *fdata,
        const int num, const int total, const gboolean high_quality)
 {
-  gint result=1;
   dt_storage_flickr_params_t *p=(dt_storage_flickr_params_t *)sdata;
-  flickcurl_upload_status *photo_status;
-  gint tags=0;
 
   const char *ext = format->extension(fdata);
 
-  // Let's upload image...
-
   /* construct a temporary file name */
   char fname[4096]= {0};
   dt_loc_get_tmp_dir (fname,4096);
@@ -668,82 +743,28 @@ store (dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, const
   {
     fprintf(stderr, "[imageio_storage_flickr] could not export to file: `%s'!\n", fname);
     dt_control_log(_("could not export to file `%s'!"), fname);
-    result = 0;
-    goto cleanup;
-  }
-
-#ifdef _OPENMP
-  #pragma omp critical
-#endif
-  {
-    //TODO: Check if this could be done in threads, so we enhance export time by using
-    //      upload time for one image to export another image to disk.
-    // Upload image
-    // Do we export tags?
-    if( p->export_tags == TRUE )
-      tags = imgid;
-    photo_status = _flickr_api_upload_photo( p, fname, caption, description, tags );
-  }
-
-  if( !photo_status )
-  {
-    result=0;
-    goto cleanup;
-  }
-
-//  int fail = 0;
-  // A photoset is only created if we have an album title set
-  if( p->flickr_api->current_album == NULL && p->flickr_api->new_album == TRUE)
-  {
-    char *photoset_id;
-    photoset_id = _flickr_api_create_photoset(p->flickr_api, photo_status->photoid);
-
-    if( photoset_id == NULL)
+    unlink( fname );
+    g_free( caption );
+    if(desc)
     {
-      dt_control_log("failed to create flickr album");
-//      fail = 1;
-    }
-    else
-    {
-//      p->flickr_api->new_album = FALSE;
-      p->flickr_api->current_album = flickcurl_photosets_getInfo(p->flickr_api->fc,photoset_id);
+      g_free(desc->data);
+      g_list_free(desc);
     }
+    return 1;
   }
 
-//  if(fail) return 1;
-// TODO: What to do if photoset creation fails?
-
-  // Add to gallery, if needed
-  if (p->flickr_api->current_album != NULL && p->flickr_api->new_album != TRUE)
-  {
-    flickcurl_photosets_addPhoto (p->flickr_api->fc, p->flickr_api->current_album->id, photo_status->photoid);
-    // TODO: Check for errors adding photo to gallery
-  }
-  else
-  {
-    if (p->flickr_api->current_album != NULL && p->flickr_api->new_album == TRUE)
-    {
-      p->flickr_api->new_album = FALSE;
-    }
-  }
-
-cleanup:
-
-  // And remove from filesystem..
-  unlink( fname );
-  g_free( caption );
-  if(desc)
-  {
-    g_free(desc->data);
-    g_list_free(desc);
-  }
-
-  if (result)
-  {
-    //this makes sense only if the export was successful
-    dt_control_log(_("%d/%d exported to flickr webalbum"), num, total );
-  }
-  return result;
+  // upload on the export job's upload thread, which also keeps flickcurl to one thread at a time:
+  _flickr_upload_t *u = (_flickr_upload_t *)g_malloc(sizeof(_flickr_upload_t));
+  u->p = p;
+  u->fname = g_strdup(fname);
+  u->caption = caption;
+  u->description = description;
+  u->desc = desc;
+  // Do we export tags?
+  u->tags = (p->export_tags == TRUE) ? imgid : 0;
+  u->num = num;
+  u->total = total;
+  return dt_control_export_upload(sdata, _flickr_upload, u);
 }
 
 size_t
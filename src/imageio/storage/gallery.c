@@ -320,35 +320,22 @@ store (dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, const
   } // end of critical block
   dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
 
-  /* export image to file */
-  if(dt_imageio_export(imgid, filename, format, fdata, high_quality) != 0)
-  {
-    fprintf(stderr, "[imageio_storage_gallery] could not export to file: `%s'!\n", filename);
-    dt_control_log(_("could not export to file `%s'!"), filename);
-    return 1;
-  }
-
-  /* also export thumbnail: */
-  // write with reduced resolution:
-  const int max_width  = fdata->max_width;
-  const int max_height = fdata->max_height;
-  fdata->max_width  = 200;
-  fdata->max_height = 200;
+  /* export image and its thumbnail (with reduced resolution, from the same pixels) to file */
+  char thumbfilename[DT_MAX_PATH_LEN];
+  g_strlcpy(thumbfilename, filename, DT_MAX_PATH_LEN);
   // alter filename with -thumb:
-  char *c = filename + strlen(filename);
-  for(; c>filename && *c != '.' && *c != '/' ; c--);
-  if(c <= filename || *c=='/') c = filename + strlen(filename);
+  char *c = thumbfilename + strlen(thumbfilename);
+  for(; c>thumbfilename && *c != '.' && *c != '/' ; c--);
+  if(c <= thumbfilename || *c=='/') c = thumbfilename + strlen(thumbfilename);
   const char *ext = format->extension(fdata);
-  sprintf(c,"-thumb.%s",ext);
-  if(dt_imageio_export(imgid, filename, format, fdata, FALSE) != 0)
+  snprintf(c, DT_MAX_PATH_LEN-(c-thumbfilename), "-thumb.%s", ext);
+  const dt_imageio_export_derived_t thumb = { thumbfilename, 200, 200 };
+  if(dt_imageio_export_derived(imgid, filename, format, fdata, high_quality, &thumb, 1) != 0)
   {
     fprintf(stderr, "[imageio_storage_gallery] could not export to file: `%s'!\n", filename);
     dt_control_log(_("could not export to file `%s'!"), filename);
     return 1;
   }
-  // restore for next image:
-  fdata->max_width = max_width;
-  fdata->max_height = max_height;
 
   printf("[export_job] exported to `%s'\n", filename);
   char *trunc = filename + strlen(filename) - 32;
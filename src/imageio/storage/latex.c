@@ -331,7 +331,12 @@ store (dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, const
   dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
 
   /* export image to file */
-  dt_imageio_export(imgid, filename, format, fdata, high_quality);
+  if(dt_imageio_export(imgid, filename, format, fdata, high_quality) != 0)
+  {
+    fprintf(stderr, "[imageio_storage_latex] could not export to file: `%s'!\n", filename);
+    dt_control_log(_("could not export to file `%s'!"), filename);
+    return 1;
+  }
 
   printf("[export_job] exported to `%s'\n", filename);
   char *trunc = filename + strlen(filename) - 32;
@@ -31,6 +31,7 @@
 #include "common/imageio_storage.h"
 #include "control/conf.h"
 #include "control/control.h"
+#include "control/jobs/control_jobs.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -1428,10 +1429,72 @@ int supported(struct dt_imageio_module_storage_t *self, struct dt_imageio_module
   return 0;
 }
 
+// one exported image waiting for upload
+typedef struct _picasa_upload_t
+{
+  PicasaContext *ctx;
+  gchar *fname;
+  char *caption;
+  char *description;
+  GList *desc;
+  int imgid, num, total;
+}
+_picasa_upload_t;
+
+static int _picasa_upload(void *data)
+{
+  _picasa_upload_t *u = (_picasa_upload_t *)data;
+  PicasaContext *ctx = u->ctx;
+  gint result = 1;
+
+  if (strlen(ctx->album_id) == 0)
+  {
+    if (ctx->album_title == NULL)
+    {
+      dt_control_log(_("unable to create album, no title provided"));
+      result = 0;
+      goto cleanup;
+    }
+    const gchar *album_id = picasa_create_album(ctx, ctx->album_title, ctx->album_summary, ctx->album_permission);
+    if (album_id == NULL)
+    {
+      dt_control_log(_("unable to create album"));
+      result = 0;
+      goto cleanup;
+    }
+    g_snprintf (ctx->album_id, 1024, "%s", album_id);
+  }
+
+  const char *photoid = picasa_upload_photo_to_album(ctx, ctx->album_id, u->fname, u->caption, u->description, u->imgid);
+  if (photoid == NULL)
+  {
+    dt_control_log(_("unable to export photo to webalbum"));
+    result = 0;
+    goto cleanup;
+  }
+
+cleanup:
+  unlink( u->fname );
+  g_free( u->fname );
+  g_free( u->caption );
+  if(u->desc)
+  {
+    //no need to free desc->data as caption points to it
+    g_list_free(u->desc);
+  }
+
+  if (result)
+  {
+    //this makes sense only if the export was successful
+    dt_control_log(_("%d/%d exported to picasa webalbum"), u->num, u->total );
+  }
+  g_free(u);
+  return !result;
+}
+
 /* this actually does the work */
 int store(dt_imageio_module_storage_t *self, struct dt_imageio_module_data_t *sdata, const int imgid, dt_imageio_module_format_t *format, dt_imageio_module_data_t *fdata, const int num, const int total, const gboolean high_quality)
 {
-  gint result = 1;
   PicasaContext *ctx = (PicasaContext*)sdata;
 
   const char *ext = format->extension(fdata);
@@ -1482,51 +1545,23 @@ int store(dt_imageio_module_storage_t *self, struct dt_imageio_module_data_t *sd
   {
     g_printerr("[picasa] could not export to file: `%s'!\n", fname);
     dt_control_log(_("could not export to file `%s'!"), fname);
-    result = 0;
-    goto cleanup;
-  }
-
-  if (strlen(ctx->album_id) == 0)
-  {
-    if (ctx->album_title == NULL)
-    {
-      dt_control_log(_("unable to create album, no title provided"));
-      result = 0;
-      goto cleanup;
-    }
-    const gchar *album_id = picasa_create_album(ctx, ctx->album_title, ctx->album_summary, ctx->album_permission);
-    if (album_id == NULL)
-    {
-      dt_control_log(_("unable to create album"));
-      result = 0;
-      goto cleanup;
-    }
-    g_snprintf (ctx->album_id, 1024, "%s", album_id);
-  }
-
-  const char *photoid = picasa_upload_photo_to_album(ctx, ctx->album_id, fname, caption, description, imgid);
-  if (photoid == NULL)
-  {
-    dt_control_log(_("unable to export photo to webalbum"));
-    result = 0;
-    goto cleanup;
-  }
-
-cleanup:
-  unlink( fname );
-  g_free( caption );
-  if(desc)
-  {
-    //no need to free desc->data as caption points to it
-    g_list_free(desc);
+    unlink( fname );
+    g_free( caption );
+    if(desc) g_list_free(desc);
+    return 1;
   }
 
-  if (result)
-  {
-    //this makes sense only if the export was successful
-    dt_control_log(_("%d/%d exported to picasa webalbum"), num, total );
-  }
-  return 0;
+  // hand the file over to the export job's upload thread and go on rendering the next image
+  _picasa_upload_t *u = (_picasa_upload_t *)g_malloc(sizeof(_picasa_upload_t));
+  u->ctx = ctx;
+  u->fname = g_strdup(fname);
+  u->caption = caption;
+  u->description = description;
+  u->desc = desc;
+  u->imgid = imgid;
+  u->num = num;
+  u->total = total;
+  return dt_control_export_upload(sdata, _picasa_upload, u);
 }
 
 
@@ -45,6 +45,53 @@ float clampnan(const float x, const float m, const float M)
   return r;
 }
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+// four wide helpers for the vectorized loops below. they do the same float operations in
+// the same order as the scalar code, so both paths give bit identical results.
+
+static inline __m128
+xdiv2f_ps(const __m128 d)
+{
+  // like xdiv2f(): decrement the exponent of all non-zero lanes
+  const __m128i i = _mm_castps_si128(d);
+  const __m128i zero = _mm_cmpeq_epi32(_mm_and_si128(i, _mm_set1_epi32(0x7FFFFFFF)), _mm_setzero_si128());
+  return _mm_castsi128_ps(_mm_sub_epi32(i, _mm_andnot_si128(zero, _mm_set1_epi32(1 << 23))));
+}
+
+static inline __m128
+fabsf_ps(const __m128 x)
+{
+  return _mm_and_ps(x, _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF)));
+}
+
+static inline __m128
+select_ps(const __m128 mask, const __m128 a, const __m128 b)
+{
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// vertical [0] and horizontal [1] weights of four interleaved dirwts entries
+static inline void
+load_dirwts_ps(const float (*dirwts)[2], const int indx, __m128 *v, __m128 *h)
+{
+  const __m128 lo = _mm_loadu_ps(dirwts[indx]);
+  const __m128 hi = _mm_loadu_ps(dirwts[indx+2]);
+  *v = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2,0,2,0));
+  *h = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3,1,3,1));
+}
+
+// largest float not above d: for float x, x > d in double precision is the same as x > float_below(d)
+static inline float
+float_below(const double d)
+{
+  float f = d;
+  if(f > d) f = nextafterf(f, -INFINITY);
+  return f;
+}
+#endif
+
 /*==================================================================================
  * begin raw therapee code, hg checkout of june 04, 2013 branch master.
  *==================================================================================*/
@@ -127,6 +174,10 @@ amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
 
   //const float clip_pt = 1/initialGain;
   const float clip_pt = fminf(piece->pipe->processed_maximum[0], fminf(piece->pipe->processed_maximum[1], piece->pipe->processed_maximum[2]));
+#ifdef __SSE2__
+  // the scalar highlight test compares against 0.8*clip_pt in double precision
+  const float clip_hl = float_below(0.8*clip_pt);
+#endif
 
 
 #define TS 512	 // Tile size; the image is processed in square tiles to lower memory requirements and facilitate multi-threading
@@ -594,7 +645,21 @@ amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
         // %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
         for (rr=1; rr < rr1-1; rr++)
-          for (cc=1, indx=(rr)*TS+cc; cc < cc1-1; cc++, indx++)
+        {
+          cc=1;
+          indx=(rr)*TS+cc;
+#ifdef __SSE2__
+          for (; cc < cc1-4; cc+=4, indx+=4)
+          {
+            const __m128 dh = fabsf_ps(_mm_sub_ps(_mm_loadu_ps(cfa+indx+1), _mm_loadu_ps(cfa+indx-1)));
+            const __m128 dv = fabsf_ps(_mm_sub_ps(_mm_loadu_ps(cfa+indx+v1), _mm_loadu_ps(cfa+indx-v1)));
+            _mm_storeu_ps(delh+indx, dh);
+            _mm_storeu_ps(delv+indx, dv);
+            _mm_storeu_ps(delhsq+indx, _mm_mul_ps(dh, dh));
+            _mm_storeu_ps(delvsq+indx, _mm_mul_ps(dv, dv));
+          }
+#endif
+          for (; cc < cc1-1; cc++, indx++)
           {
 
             delh[indx] = fabsf(cfa[indx+1]-cfa[indx-1]);
@@ -604,9 +669,23 @@ amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
 //					delp[indx] = fabsf(cfa[indx+p1]-cfa[indx-p1]);
 //					delm[indx] = fabsf(cfa[indx+m1]-cfa[indx-m1]);
           }
+        }
 
         for (rr=2; rr < rr1-2; rr++)
-          for (cc=2,indx=(rr)*TS+cc; cc < cc1-2; cc++, indx++)
+        {
+          cc=2;
+          indx=(rr)*TS+cc;
+#ifdef __SSE2__
+          for (; cc < cc1-5; cc+=4, indx+=4)
+          {
+            const __m128 epsv = _mm_set1_ps(eps);
+            const __m128 wv = _mm_add_ps(_mm_add_ps(_mm_add_ps(epsv, _mm_loadu_ps(delv+indx+v1)), _mm_loadu_ps(delv+indx-v1)), _mm_loadu_ps(delv+indx));
+            const __m128 wh = _mm_add_ps(_mm_add_ps(_mm_add_ps(epsv, _mm_loadu_ps(delh+indx+1)), _mm_loadu_ps(delh+indx-1)), _mm_loadu_ps(delh+indx));
+            _mm_storeu_ps(dirwts[indx], _mm_unpacklo_ps(wv, wh));
+            _mm_storeu_ps(dirwts[indx+2], _mm_unpackhi_ps(wv, wh));
+          }
+#endif
+          for (; cc < cc1-2; cc++, indx++)
           {
             dirwts[indx][0] = eps+delv[indx+v1]+delv[indx-v1]+delv[indx];//+fabsf(cfa[indx+v2]-cfa[indx-v2]);
             //vert directional averaging weights
@@ -614,6 +693,7 @@ amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
             //horizontal weights
 
           }
+        }
 
         for (rr=6; rr < rr1-6; rr++)
           for (cc=6+(FC(rr,2,filters)&1), indx=(rr)*TS+cc; cc < cc1-6; cc+=2, indx+=2)
@@ -639,8 +719,91 @@ amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
         //t1_vcdhcd = clock();
 
         for (rr=4; rr<rr1-4; rr++)
+        {
+          cc=4;
+          indx=rr*TS+cc;
+#ifdef __SSE2__
+          // lanes of green sites, the cfa colors alternate along the row
+          const __m128 gmask = (FC(rr,cc,filters)&1) ? _mm_castsi128_ps(_mm_set_epi32(0, -1, 0, -1))
+                                                     : _mm_castsi128_ps(_mm_set_epi32(-1, 0, -1, 0));
+          const __m128 epsv = _mm_set1_ps(eps);
+          const __m128 onev = _mm_set1_ps(1.0f);
+          const __m128 arthreshv = _mm_set1_ps(arthresh);
+          const __m128 clipv = _mm_set1_ps(clip_hl);
+          for (; cc<cc1-7; cc+=4, indx+=4)
+          {
+            __m128 dwv, dwh, dwvu2, dwvd2, dwhl2, dwhr2, dwvu1, dwvd1, dwhl1, dwhr1, dummy;
+            load_dirwts_ps(dirwts, indx, &dwv, &dwh);
+            load_dirwts_ps(dirwts, indx-v2, &dwvu2, &dummy);
+            load_dirwts_ps(dirwts, indx+v2, &dwvd2, &dummy);
+            load_dirwts_ps(dirwts, indx-v1, &dwvu1, &dummy);
+            load_dirwts_ps(dirwts, indx+v1, &dwvd1, &dummy);
+            load_dirwts_ps(dirwts, indx-2, &dummy, &dwhl2);
+            load_dirwts_ps(dirwts, indx+2, &dummy, &dwhr2);
+            load_dirwts_ps(dirwts, indx-1, &dummy, &dwhl1);
+            load_dirwts_ps(dirwts, indx+1, &dummy, &dwhr1);
+
+            const __m128 c0 = _mm_loadu_ps(cfa+indx);
+            const __m128 cu1 = _mm_loadu_ps(cfa+indx-v1), cu2 = _mm_loadu_ps(cfa+indx-v2);
+            const __m128 cd1 = _mm_loadu_ps(cfa+indx+v1), cd2 = _mm_loadu_ps(cfa+indx+v2);
+            const __m128 cl1 = _mm_loadu_ps(cfa+indx-1), cl2 = _mm_loadu_ps(cfa+indx-2);
+            const __m128 cr1 = _mm_loadu_ps(cfa+indx+1), cr2 = _mm_loadu_ps(cfa+indx+2);
+            const __m128 ec0 = _mm_add_ps(epsv, c0);
+
+            //color ratios in each cardinal direction
+            const __m128 cruv = _mm_div_ps(_mm_mul_ps(cu1, _mm_add_ps(dwvu2, dwv)), _mm_add_ps(_mm_mul_ps(dwvu2, ec0), _mm_mul_ps(dwv, _mm_add_ps(epsv, cu2))));
+            const __m128 crdv = _mm_div_ps(_mm_mul_ps(cd1, _mm_add_ps(dwvd2, dwv)), _mm_add_ps(_mm_mul_ps(dwvd2, ec0), _mm_mul_ps(dwv, _mm_add_ps(epsv, cd2))));
+            const __m128 crlv = _mm_div_ps(_mm_mul_ps(cl1, _mm_add_ps(dwhl2, dwh)), _mm_add_ps(_mm_mul_ps(dwhl2, ec0), _mm_mul_ps(dwh, _mm_add_ps(epsv, cl2))));
+            const __m128 crrv = _mm_div_ps(_mm_mul_ps(cr1, _mm_add_ps(dwhr2, dwh)), _mm_add_ps(_mm_mul_ps(dwhr2, ec0), _mm_mul_ps(dwh, _mm_add_ps(epsv, cr2))));
+
+            const __m128 guhav = _mm_add_ps(cu1, xdiv2f_ps(_mm_sub_ps(c0, cu2)));
+            const __m128 gdhav = _mm_add_ps(cd1, xdiv2f_ps(_mm_sub_ps(c0, cd2)));
+            const __m128 glhav = _mm_add_ps(cl1, xdiv2f_ps(_mm_sub_ps(c0, cl2)));
+            const __m128 grhav = _mm_add_ps(cr1, xdiv2f_ps(_mm_sub_ps(c0, cr2)));
+
+            __m128 guarv = select_ps(_mm_cmplt_ps(fabsf_ps(_mm_sub_ps(onev, cruv)), arthreshv), _mm_mul_ps(c0, cruv), guhav);
+            __m128 gdarv = select_ps(_mm_cmplt_ps(fabsf_ps(_mm_sub_ps(onev, crdv)), arthreshv), _mm_mul_ps(c0, crdv), gdhav);
+            __m128 glarv = select_ps(_mm_cmplt_ps(fabsf_ps(_mm_sub_ps(onev, crlv)), arthreshv), _mm_mul_ps(c0, crlv), glhav);
+            __m128 grarv = select_ps(_mm_cmplt_ps(fabsf_ps(_mm_sub_ps(onev, crrv)), arthreshv), _mm_mul_ps(c0, crrv), grhav);
+
+            const __m128 hwtv = _mm_div_ps(dwhl1, _mm_add_ps(dwhl1, dwhr1));
+            const __m128 vwtv = _mm_div_ps(dwvu1, _mm_add_ps(dwvd1, dwvu1));
+
+            //interpolated G via adaptive weights of cardinal evaluations
+            const __m128 Gintvarv = _mm_add_ps(_mm_mul_ps(vwtv, gdarv), _mm_mul_ps(_mm_sub_ps(onev, vwtv), guarv));
+            const __m128 Gintharv = _mm_add_ps(_mm_mul_ps(hwtv, grarv), _mm_mul_ps(_mm_sub_ps(onev, hwtv), glarv));
+            const __m128 Gintvhav = _mm_add_ps(_mm_mul_ps(vwtv, gdhav), _mm_mul_ps(_mm_sub_ps(onev, vwtv), guhav));
+            const __m128 Ginthhav = _mm_add_ps(_mm_mul_ps(hwtv, grhav), _mm_mul_ps(_mm_sub_ps(onev, hwtv), glhav));
+
+            //interpolated color differences
+            __m128 vcdv = select_ps(gmask, _mm_sub_ps(c0, Gintvarv), _mm_sub_ps(Gintvarv, c0));
+            __m128 hcdv = select_ps(gmask, _mm_sub_ps(c0, Gintharv), _mm_sub_ps(Gintharv, c0));
+            const __m128 vcdaltv = select_ps(gmask, _mm_sub_ps(c0, Gintvhav), _mm_sub_ps(Gintvhav, c0));
+            const __m128 hcdaltv = select_ps(gmask, _mm_sub_ps(c0, Ginthhav), _mm_sub_ps(Ginthhav, c0));
+
+            //use HA if highlights are (nearly) clipped
+            const __m128 hl = _mm_or_ps(_mm_cmpgt_ps(c0, clipv), _mm_or_ps(_mm_cmpgt_ps(Gintvhav, clipv), _mm_cmpgt_ps(Ginthhav, clipv)));
+            guarv = select_ps(hl, guhav, guarv);
+            gdarv = select_ps(hl, gdhav, gdarv);
+            glarv = select_ps(hl, glhav, glarv);
+            grarv = select_ps(hl, grhav, grarv);
+            vcdv = select_ps(hl, vcdaltv, vcdv);
+            hcdv = select_ps(hl, hcdaltv, hcdv);
+
+            _mm_storeu_ps(vcd+indx, vcdv);
+            _mm_storeu_ps(hcd+indx, hcdv);
+            _mm_storeu_ps(vcdalt+indx, vcdaltv);
+            _mm_storeu_ps(hcdalt+indx, hcdaltv);
+
+            //differences of interpolations in opposite directions
+            const __m128 dvha = _mm_sub_ps(guhav, gdhav), dvar = _mm_sub_ps(guarv, gdarv);
+            const __m128 dhha = _mm_sub_ps(glhav, grhav), dhar = _mm_sub_ps(glarv, grarv);
+            _mm_storeu_ps(dgintv+indx, _mm_min_ps(_mm_mul_ps(dvha, dvha), _mm_mul_ps(dvar, dvar)));
+            _mm_storeu_ps(dginth+indx, _mm_min_ps(_mm_mul_ps(dhha, dhha), _mm_mul_ps(dhar, dhar)));
+          }
+#endif
           //for (cc=4+(FC(rr,2,filters)&1),indx=rr*TS+cc,c=FC(rr,cc,filters); cc<cc1-4; cc+=2,indx+=2) {
-          for (cc=4,indx=rr*TS+cc; cc<cc1-4; cc++,indx++)
+          for (; cc<cc1-4; cc++,indx++)
           {
 //					c=FC(rr,cc,filters);
 //					if (c&1) {sgn=-1;} else {sgn=1;}
@@ -745,6 +908,7 @@ amaze_demosaic_RT(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
             dginth[indx]=MIN(SQR(glha-grha),SQR(glar-grar));
 
           }
+        }
         //t2_vcdhcd += clock() - t1_vcdhcd;
 
         //t1_cdvar = clock();
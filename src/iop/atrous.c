@@ -29,6 +29,9 @@
 #include <memory.h>
 #include <stdlib.h>
 #include <xmmintrin.h>
+#ifdef DT_AVX2_CODEPATH
+#include <immintrin.h>
+#endif
 // SSE4 actually not used yet.
 // #include <smmintrin.h>
 
@@ -339,36 +342,152 @@ eaw_decompose (float *const out, const float *const in, float *const detail, con
   _mm_sfence();
 }
 
+#ifdef DT_AVX2_CODEPATH
+/* dt_fast_expf_sse() and weight_sse() on two pixels, one in each half of the register */
+DT_TARGET_AVX2 static inline __m256
+dt_fast_expf_avx2(const __m256 x)
+{
+  const __m256 f = _mm256_add_ps(_mm256_set1_ps(0x3f800000u), _mm256_mul_ps(x, _mm256_set1_ps(0x00adf880u)));
+  __m256i i = _mm256_cvtps_epi32(f);
+  const __m256i mask = _mm256_srai_epi32(i, 31);
+  i = _mm256_andnot_si256(mask, i);
+  return _mm256_castsi256_ps(i);
+}
+
+DT_TARGET_AVX2 static inline __m256
+weight_avx2(const __m256 c1, const __m256 c2, const float sharpen)
+{
+  const __m256 diff = _mm256_sub_ps(c1, c2);
+  const __m256 square = _mm256_mul_ps(diff, diff);                                // (?, d3, d2, d1)
+  const __m256 square2 = _mm256_shuffle_ps(square, square, _MM_SHUFFLE(3, 1, 2, 0)); // (?, d2, d3, d1)
+  __m256 added = _mm256_add_ps(square, square2);                                  // (?, d2+d3, d2+d3, 2*d1)
+  added = _mm256_blend_ps(added, _mm256_sub_ps(added, square), 0x11);             // (?, d2+d3, d2+d3, d1)
+  const __m256 exp = dt_fast_expf_avx2(_mm256_mul_ps(added, _mm256_set1_ps(-sharpen)));
+  return _mm256_blend_ps(exp, _mm256_set1_ps(1.0f), 0x88);                        // (1, wc, wc, wl)
+}
+
+/* eaw_decompose() with the interior pixels done two at a time, the borders are the same code as above. */
+DT_TARGET_AVX2 static void
+eaw_decompose_avx2 (float *const out, const float *const in, float *const detail, const int scale,
+                    const float sharpen, const int32_t width, const int32_t height)
+{
+  const int mult = 1<<scale;
+  static const float filter[5] = {1.0f/16.0f, 4.0f/16.0f, 6.0f/16.0f, 4.0f/16.0f, 1.0f/16.0f};
+
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) schedule(static)
+#endif
+  for(int j=0; j<height; j++)
+  {
+    ROW_PROLOGUE
+
+    const int inner = (j >= 2*mult && j < height-2*mult);
+    int i = 0;
+    for(; i<width; i++)
+    {
+      if(inner && i == 2*mult) break;
+      SUM_PIXEL_PROLOGUE
+      for (int jj=0; jj<5; jj++)
+      {
+        for (int ii=0; ii<5; ii++)
+        {
+          SUM_PIXEL_CONTRIBUTION_WITH_TEST(ii, jj);
+        }
+      }
+      SUM_PIXEL_EPILOGUE
+    }
+    if(!inner) continue;
+
+    for(; i+1<width-2*mult; i+=2)
+    {
+      __m256 sum = _mm256_setzero_ps();
+      __m256 wgt = _mm256_setzero_ps();
+      const __m256 c = _mm256_loadu_ps((const float *)px);
+      const float *p2 = in + 4*(i-2*mult + (j-2*mult)*width);
+      for (int jj=0; jj<5; jj++)
+      {
+        for (int ii=0; ii<5; ii++)
+        {
+          const __m256 c2 = _mm256_loadu_ps(p2);
+          const __m256 w = _mm256_mul_ps(_mm256_set1_ps(filter[ii]*filter[jj]), weight_avx2(c, c2, sharpen));
+          sum = _mm256_fmadd_ps(w, c2, sum);
+          wgt = _mm256_add_ps(wgt, w);
+          p2 += 4*mult;
+        }
+        p2 += 4*(width-5)*mult;
+      }
+      sum = _mm256_mul_ps(sum, _mm256_rcp_ps(wgt));
+      const __m256 d = _mm256_sub_ps(c, sum);
+      // rows are only 16 byte aligned
+      _mm_stream_ps(pdetail,   _mm256_castps256_ps128(d));
+      _mm_stream_ps(pdetail+4, _mm256_extractf128_ps(d, 1));
+      _mm_stream_ps(pcoarse,   _mm256_castps256_ps128(sum));
+      _mm_stream_ps(pcoarse+4, _mm256_extractf128_ps(sum, 1));
+      px += 2;
+      pdetail += 8;
+      pcoarse += 8;
+    }
+
+    for(; i<width; i++)
+    {
+      SUM_PIXEL_PROLOGUE
+      for (int jj=0; jj<5; jj++)
+      {
+        for (int ii=0; ii<5; ii++)
+        {
+          SUM_PIXEL_CONTRIBUTION_WITH_TEST(ii, jj);
+        }
+      }
+      SUM_PIXEL_EPILOGUE
+    }
+  }
+
+  _mm_sfence();
+}
+#endif
+
 #undef SUM_PIXEL_CONTRIBUTION_COMMON
 #undef SUM_PIXEL_CONTRIBUTION_WITH_TEST
 #undef ROW_PROLOGUE
 #undef SUM_PIXEL_PROLOGUE
 #undef SUM_PIXEL_EPILOGUE
 
+/* adds the thresholded and boosted details of all scales, coarsest first, to the coarse
+ * buffer in. this is the same as one synthesis pass per scale, but every pixel is touched
+ * once instead of going through all buffers again for each scale. */
 static void
-eaw_synthesize (float *const out, const float *const in, const float *const detail,
-                const float *thrsf, const float *boostf, const int32_t width, const int32_t height)
+eaw_synthesize (float *const out, const float *const in, float *const *const detail,
+                const float (*thrsf)[4], const float (*boostf)[4], const int max_scale,
+                const int32_t width, const int32_t height)
 {
-  const __m128 threshold = _mm_set_ps(thrsf[3], thrsf[2], thrsf[1], thrsf[0]);
-  const __m128 boost     = _mm_set_ps(boostf[3], boostf[2], boostf[1], boostf[0]);
+  __m128 threshold[MAX_NUM_SCALES];
+  __m128 boost[MAX_NUM_SCALES];
+  for(int scale=0; scale<max_scale; scale++)
+  {
+    threshold[scale] = _mm_set_ps(thrsf[scale][3], thrsf[scale][2], thrsf[scale][1], thrsf[scale][0]);
+    boost[scale]     = _mm_set_ps(boostf[scale][3], boostf[scale][2], boostf[scale][1], boostf[scale][0]);
+  }
 
 #ifdef _OPENMP
-  #pragma omp parallel for default(none) schedule(static)
+  #pragma omp parallel for shared(threshold, boost) schedule(static)
 #endif
   for(int j=0; j<height; j++)
   {
-    // TODO: prefetch? _mm_prefetch()
     const __m128 *pin = (__m128 *)in + j*width;
-    __m128 *pdetail = (__m128 *)detail + j*width;
     float *pout = out + 4*j*width;
     for(int i=0; i<width; i++)
     {
       const __m128i maski = _mm_set1_epi32(0x80000000u);
       const __m128 *mask = (__m128*)&maski;
-      const __m128 absamt = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_andnot_ps(*mask, *pdetail), threshold));
-      const __m128 amount = _mm_or_ps(_mm_and_ps(*pdetail, *mask), absamt);
-      _mm_stream_ps(pout, _mm_add_ps(*pin, _mm_mul_ps(boost, amount)));
-      pdetail ++;
+      __m128 sum = *pin;
+      for(int scale=max_scale-1; scale>=0; scale--)
+      {
+        const __m128 *pdetail = (__m128 *)detail[scale] + j*width + i;
+        const __m128 absamt = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_andnot_ps(*mask, *pdetail), threshold[scale]));
+        const __m128 amount = _mm_or_ps(_mm_and_ps(*pdetail, *mask), absamt);
+        sum = _mm_add_ps(sum, _mm_mul_ps(boost[scale], amount));
+      }
+      _mm_stream_ps(pout, sum);
       pin ++;
       pout += 4;
     }
@@ -376,6 +495,46 @@ eaw_synthesize (float *const out, const float *const in, const float *const deta
   _mm_sfence();
 }
 
+#ifdef DT_AVX2_CODEPATH
+DT_TARGET_AVX2 static void
+eaw_synthesize_avx2 (float *const out, const float *const in, float *const *const detail,
+                     const float (*thrsf)[4], const float (*boostf)[4], const int max_scale,
+                     const int32_t width, const int32_t height)
+{
+  __m256 threshold[MAX_NUM_SCALES];
+  __m256 boost[MAX_NUM_SCALES];
+  for(int scale=0; scale<max_scale; scale++)
+  {
+    const __m128 t = _mm_loadu_ps(thrsf[scale]), b = _mm_loadu_ps(boostf[scale]);
+    threshold[scale] = _mm256_insertf128_ps(_mm256_castps128_ps256(t), t, 1);
+    boost[scale]     = _mm256_insertf128_ps(_mm256_castps128_ps256(b), b, 1);
+  }
+
+  // pixels are independent here, so the buffers are processed as one long row
+  const size_t npixels = (size_t)width*height;
+#ifdef _OPENMP
+  #pragma omp parallel for shared(threshold, boost) schedule(static)
+#endif
+  for(size_t k=0; k<npixels; k+=2)
+  {
+    const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x80000000u));
+    const int n = MIN(2, npixels-k);
+    __m256 sum = n == 2 ? _mm256_loadu_ps(in + 4*k) : _mm256_castps128_ps256(_mm_load_ps(in + 4*k));
+    for(int scale=max_scale-1; scale>=0; scale--)
+    {
+      const float *pdetail = detail[scale] + 4*k;
+      const __m256 d = n == 2 ? _mm256_loadu_ps(pdetail) : _mm256_castps128_ps256(_mm_load_ps(pdetail));
+      const __m256 absamt = _mm256_max_ps(_mm256_setzero_ps(), _mm256_sub_ps(_mm256_andnot_ps(mask, d), threshold[scale]));
+      const __m256 amount = _mm256_or_ps(_mm256_and_ps(d, mask), absamt);
+      sum = _mm256_fmadd_ps(boost[scale], amount, sum);
+    }
+    _mm_stream_ps(out + 4*k, _mm256_castps256_ps128(sum));
+    if(n == 2) _mm_stream_ps(out + 4*k + 4, _mm256_extractf128_ps(sum, 1));
+  }
+  _mm_sfence();
+}
+#endif
+
 static int
 get_samples (float *t, const dt_iop_atrous_data_t *const d, const dt_iop_roi_t *roi_in, const dt_dev_pixelpipe_iop_t *const piece)
 {
@@ -435,9 +594,15 @@ get_scales (float (*thrs)[4], float (*boost)[4], float *sharp, const dt_iop_atro
   return i;
 }
 
-/* just process the supplied image buffer, upstream default_process_tiling() does the rest */
-void
-process (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+typedef void (*eaw_decompose_t)(float *const out, const float *const in, float *const detail, const int scale,
+                                const float sharpen, const int32_t width, const int32_t height);
+typedef void (*eaw_synthesize_t)(float *const out, const float *const in, float *const *const detail,
+                                 const float (*thrsf)[4], const float (*boostf)[4], const int max_scale,
+                                 const int32_t width, const int32_t height);
+
+static void
+process_wavelets (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
+                  const eaw_decompose_t decompose, const eaw_synthesize_t synthesize)
 {
   dt_iop_atrous_data_t *d = (dt_iop_atrous_data_t *)piece->data;
   float thrs [MAX_NUM_SCALES][4];
@@ -461,7 +626,8 @@ process (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, voi
   const int width = roi_out->width;
   const int height = roi_out->height;
 
-  tmp = (float *)dt_alloc_align(64, sizeof(float)*4*width*height);
+  const size_t bufsize = sizeof(float)*4*width*height;
+  tmp = (float *)dt_iop_scratch_alloc(piece, bufsize);
   if(tmp == NULL)
   {
     fprintf(stderr, "[atrous] failed to allocate coarse buffer!\n");
@@ -470,7 +636,7 @@ process (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, voi
 
   for(int k=0; k<max_scale; k++)
   {
-    detail[k] = (float *)dt_alloc_align(64, sizeof(float)*4*width*height);
+    detail[k] = (float *)dt_iop_scratch_alloc(piece, bufsize);
     if(detail[k] == NULL)
     {
       fprintf(stderr, "[atrous] failed to allocate one of the detail buffers!\n");
@@ -483,24 +649,18 @@ process (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, voi
 
   for(int scale=0; scale<max_scale; scale++)
   {
-    eaw_decompose (buf2, buf1, detail[scale], scale, sharp[scale], width, height);
+    decompose (buf2, buf1, detail[scale], scale, sharp[scale], width, height);
     if(scale == 0) buf1 = (float *)o;  // now switch to (float *)o for buffer ping-pong between buf1 and buf2
     float *buf3 = buf2;
     buf2 = buf1;
     buf1 = buf3;
   }
 
-  for(int scale=max_scale-1; scale>=0; scale--)
-  {
-    eaw_synthesize (buf2, buf1, detail[scale], thrs[scale], boost[scale], width, height);
-    float *buf3 = buf2;
-    buf2 = buf1;
-    buf1 = buf3;
-  }
-  /* due to symmetric processing, output will be left in (float *)o */
+  /* the coarsest scale is in buf1, which may be (float *)o, synthesis works per pixel */
+  synthesize ((float *)o, buf1, detail, thrs, boost, max_scale, width, height);
 
-  for(int k=0; k<max_scale; k++) free(detail[k]);
-  free(tmp);
+  for(int k=max_scale-1; k>=0; k--) dt_iop_scratch_free(piece, detail[k], bufsize);
+  dt_iop_scratch_free(piece, tmp, bufsize);
 
   if(piece->pipe->mask_display)
     dt_iop_alpha_copy(i, o, width, height);
@@ -508,11 +668,26 @@ process (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, voi
   return;
 
 error:
-  for(int k=0; k<max_scale; k++) if(detail[k] != NULL) free(detail[k]);
-  if(tmp != NULL) free(tmp);
+  for(int k=max_scale-1; k>=0; k--) dt_iop_scratch_free(piece, detail[k], bufsize);
+  dt_iop_scratch_free(piece, tmp, bufsize);
   return;
 }
 
+/* just process the supplied image buffer, upstream default_process_tiling() does the rest */
+void
+process (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  process_wavelets(self, piece, i, o, roi_in, roi_out, eaw_decompose, eaw_synthesize);
+}
+
+#ifdef DT_AVX2_CODEPATH
+void
+process_avx2 (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  process_wavelets(self, piece, i, o, roi_in, roi_out, eaw_decompose_avx2, eaw_synthesize_avx2);
+}
+#endif
+
 #ifdef HAVE_OPENCL
 /* this version is adapted to the new global tiling mechanism. it no longer does tiling by itself. */
 int
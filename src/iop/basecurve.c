@@ -21,6 +21,7 @@
 #include "develop/develop.h"
 #include "develop/imageop.h"
 #include "control/control.h"
+#include "common/curve_lut.h"
 #include "common/debug.h"
 #include "common/opencl.h"
 #include "gui/gtk.h"
@@ -167,11 +168,11 @@ dt_iop_basecurve_gui_data_t;
 
 typedef struct dt_iop_basecurve_data_t
 {
-  dt_draw_curve_t *curve;      // curve for gegl nodes and pixel processing
+  dt_draw_curve_t *curve;          // curve for gegl nodes and pixel processing
   int basecurve_type;
   int basecurve_nodes;
-  float table[0x10000];        // precomputed look-up table for tone curve
-  float unbounded_coeffs[3];   // approximation for extrapolation
+  float table[DT_CURVE_LUT_SIZE];  // precomputed look-up table for tone curve
+  float unbounded_coeffs[3];       // approximation for extrapolation
 }
 dt_iop_basecurve_data_t;
 
@@ -275,13 +276,8 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   {
     float *inp = in + ch*k;
     float *outp = out + ch*k;
-    for(int i=0; i<3; i++)
-    {
-      // use base curve for values < 1, else use extrapolation.
-      if(inp[i] < 1.0f) outp[i] = d->table[CLAMP((int)(inp[i]*0x10000ul), 0, 0xffff)];
-      else              outp[i] = dt_iop_eval_exp(d->unbounded_coeffs, inp[i]);
-    }
-
+    // use base curve up to its last node, else use extrapolation.
+    _mm_store_ps(outp, dt_curve_lut_lookup_unbounded_sse2(d->table, _mm_load_ps(inp), d->unbounded_coeffs));
     outp[3] = inp[3];
   }
 }
@@ -312,15 +308,15 @@ void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pi
     for(int k=0; k<p->basecurve_nodes[ch]; k++)
       dt_draw_curve_set_point(d->curve, k, p->basecurve[ch][k].x, p->basecurve[ch][k].y);
   }
-  dt_draw_curve_calc_values(d->curve, 0.0f, 1.0f, 0x10000, NULL, d->table);
+  dt_draw_curve_calc_values(d->curve, 0.0f, 1.0f, DT_CURVE_LUT_SIZE, NULL, d->table);
 
   // now the extrapolation stuff:
   const float xm = p->basecurve[0][p->basecurve_nodes[0]-1].x;
   const float x[4] = {0.7f*xm, 0.8f*xm, 0.9f*xm, 1.0f*xm};
-  const float y[4] = {d->table[CLAMP((int)(x[0]*0x10000ul), 0, 0xffff)],
-                      d->table[CLAMP((int)(x[1]*0x10000ul), 0, 0xffff)],
-                      d->table[CLAMP((int)(x[2]*0x10000ul), 0, 0xffff)],
-                      d->table[CLAMP((int)(x[3]*0x10000ul), 0, 0xffff)]
+  const float y[4] = {dt_curve_lut_lookup(d->table, x[0]),
+                      dt_curve_lut_lookup(d->table, x[1]),
+                      dt_curve_lut_lookup(d->table, x[2]),
+                      dt_curve_lut_lookup(d->table, x[3])
                      };
   dt_iop_estimate_exp(x, y, 4, d->unbounded_coeffs);
 }
@@ -30,6 +30,7 @@ extern "C"
 #include "develop/develop.h"
 #include "develop/imageop.h"
 #include "develop/tiling.h"
+#include "common/opencl.h"
 #include "control/control.h"
 #include "bauhaus/bauhaus.h"
 #include "gui/accelerators.h"
@@ -67,6 +68,13 @@ extern "C"
   }
   dt_iop_bilateral_data_t;
 
+  typedef struct dt_iop_bilateral_global_data_t
+  {
+    int kernel_bilateral5d_full;
+    int kernel_bilateral5d_pass;
+  }
+  dt_iop_bilateral_global_data_t;
+
   const char *name()
   {
     return _("denoise (bilateral filter)");
@@ -80,7 +88,8 @@ extern "C"
 
   int flags()
   {
-    return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_SUPPORTS_BLENDING;
+    // blurring the lattice is serial, tiles can go in parallel:
+    return IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_TILING_PARALLEL;
   }
 
   void init_key_accels(dt_iop_module_so_t *self)
@@ -121,7 +130,7 @@ extern "C"
 
     // if rad <= 6 use naive version!
     const int rad = (int)(3.0*fmaxf(sigma[0],sigma[1])+1.0);
-    if(rad <= 6 && (piece->pipe->type == DT_DEV_PIXELPIPE_THUMBNAIL))
+    if(rad <= 6 && dt_dev_pixelpipe_fast_thumbnail(piece->pipe))
     {
       // no use denoising the thumbnail. takes ages without permutohedral
       memcpy(out, in, sizeof(float)*ch*roi_out->width*roi_out->height);
@@ -191,7 +200,8 @@ extern "C"
     else
     {
       for(int k=0; k<5; k++) sigma[k] = 1.0f/sigma[k];
-      PermutohedralLattice<5,4> lattice(roi_in->width*roi_in->height, omp_get_max_threads());
+      // one thread only if we're a tile running in parallel to others:
+      PermutohedralLattice<5,4> lattice(roi_in->width*roi_in->height, omp_in_parallel() ? 1 : omp_get_max_threads());
 
       // splat into the lattice
 #ifdef _OPENMP
@@ -239,6 +249,105 @@ extern "C"
 
   }
 
+#ifdef HAVE_OPENCL
+  /**
+   * there is no lattice on the device. small radii use the same brute force filter as the cpu, larger
+   * ones a horizontal and a vertical pass of a 1d bilateral filter, which is a close approximation.
+   */
+  int process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+  {
+    dt_iop_bilateral_data_t *data = (dt_iop_bilateral_data_t *)piece->data;
+    dt_iop_bilateral_global_data_t *gd = (dt_iop_bilateral_global_data_t *)self->data;
+
+    const int devid = piece->pipe->devid;
+    const int width = roi_in->width;
+    const int height = roi_in->height;
+    size_t sizes[] = { (size_t)ROUNDUPWD(width), (size_t)ROUNDUPHT(height), 1 };
+    size_t origin[] = {0, 0, 0};
+    size_t region[] = {(size_t)width, (size_t)height, 1};
+    cl_mem dev_m = NULL, dev_tmp = NULL;
+    float *mat = NULL;
+    cl_int err = -999;
+
+    const float sigma_s[2] = { data->sigma[0] * roi_in->scale / piece->iscale, data->sigma[1] * roi_in->scale / piece->iscale };
+    const int rad = (int)(3.0*fmaxf(sigma_s[0],sigma_s[1])+1.0);
+    const float isig2col[4] = { 1.f/(2.0f*data->sigma[2]*data->sigma[2]), 1.f/(2.0f*data->sigma[3]*data->sigma[3]),
+                                1.f/(2.0f*data->sigma[4]*data->sigma[4]), 0.0f };
+
+    if(fmaxf(sigma_s[0], sigma_s[1]) < .1 || (rad <= 6 && dt_dev_pixelpipe_fast_thumbnail(piece->pipe)))
+    {
+      // same shortcuts as on the cpu
+      err = dt_opencl_enqueue_copy_image(devid, dev_in, dev_out, origin, origin, region);
+      if(err != CL_SUCCESS) goto error;
+      return TRUE;
+    }
+
+    if(rad <= 6)
+    {
+      const int wd = 2*rad+1;
+      mat = (float *)malloc(sizeof(float)*wd*wd);
+      float weight = 0.0f;
+      for(int l=-rad; l<=rad; l++) for(int k=-rad; k<=rad; k++)
+          weight += mat[(l+rad)*wd + k+rad] = expf(- (l*l + k*k)/(2.f*sigma_s[0]*sigma_s[0]));
+      for(int k=0; k<wd*wd; k++) mat[k] /= weight;
+
+      dev_m = (cl_mem)dt_opencl_copy_host_to_device_constant(devid, sizeof(float)*wd*wd, mat);
+      if(dev_m == NULL) goto error;
+      dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral5d_full, 0, sizeof(cl_mem), (void *)&dev_in);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral5d_full, 1, sizeof(cl_mem), (void *)&dev_out);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral5d_full, 2, sizeof(cl_mem), (void *)&dev_m);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral5d_full, 3, sizeof(int), (void *)&rad);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral5d_full, 4, sizeof(int), (void *)&width);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral5d_full, 5, sizeof(int), (void *)&height);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral5d_full, 6, 4*sizeof(float), (void *)isig2col);
+      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_bilateral5d_full, sizes);
+      if(err != CL_SUCCESS) goto error;
+    }
+    else
+    {
+      const int wd = 2*rad+1;
+      mat = (float *)malloc(sizeof(float)*wd);
+      for(int k=-rad; k<=rad; k++) mat[k+rad] = expf(- (k*k)/(2.f*sigma_s[0]*sigma_s[0]));
+
+      dev_m = (cl_mem)dt_opencl_copy_host_to_device_constant(devid, sizeof(float)*wd, mat);
+      if(dev_m == NULL) goto error;
+      dev_tmp = (cl_mem)dt_opencl_alloc_device(devid, width, height, 4*sizeof(float));
+      if(dev_tmp == NULL) goto error;
+
+      for(int pass=0; pass<2; pass++)
+      {
+        // horizontal from in to tmp, vertical from tmp to out:
+        cl_mem src = pass ? dev_tmp : dev_in;
+        cl_mem dst = pass ? dev_out : dev_tmp;
+        const int dx = !pass, dy = pass;
+        dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral5d_pass, 0, sizeof(cl_mem), (void *)&src);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral5d_pass, 1, sizeof(cl_mem), (void *)&dst);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral5d_pass, 2, sizeof(cl_mem), (void *)&dev_m);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral5d_pass, 3, sizeof(int), (void *)&rad);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral5d_pass, 4, sizeof(int), (void *)&width);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral5d_pass, 5, sizeof(int), (void *)&height);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral5d_pass, 6, 4*sizeof(float), (void *)isig2col);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral5d_pass, 7, sizeof(int), (void *)&dx);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_bilateral5d_pass, 8, sizeof(int), (void *)&dy);
+        err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_bilateral5d_pass, sizes);
+        if(err != CL_SUCCESS) goto error;
+      }
+    }
+
+    if(dev_m != NULL) dt_opencl_release_mem_object(dev_m);
+    if(dev_tmp != NULL) dt_opencl_release_mem_object(dev_tmp);
+    free(mat);
+    return TRUE;
+
+error:
+    if(dev_m != NULL) dt_opencl_release_mem_object(dev_m);
+    if(dev_tmp != NULL) dt_opencl_release_mem_object(dev_tmp);
+    free(mat);
+    dt_print(DT_DEBUG_OPENCL, "[opencl_bilateral] couldn't enqueue kernel! %d\n", err);
+    return FALSE;
+  }
+#endif
+
   static void
   sigma_callback (GtkWidget *slider, dt_iop_module_t *self)
   {
@@ -293,6 +402,8 @@ extern "C"
     sigma[0] = data->sigma[0] * roi_in->scale / piece->iscale;
     sigma[1] = data->sigma[1] * roi_in->scale / piece->iscale;
     const int rad = (int)(3.0*fmaxf(sigma[0],sigma[1])+1.0);
+    // the lattice on the cpu needs a lot of memory, the device only in, out and one temporary buffer.
+    // even with a device the cpu path may run (fallback, placement, kernels not built yet), so size for it:
     tiling->factor = 2 + 50;
     tiling->overhead = 0;
     tiling->overlap = rad;
@@ -320,6 +431,24 @@ extern "C"
     memcpy(module->default_params, &tmp, sizeof(dt_iop_bilateral_params_t));
   }
 
+  void init_global(dt_iop_module_so_t *module)
+  {
+    const int program = 13; // bilateral5d.cl, from programs.conf
+    dt_iop_bilateral_global_data_t *gd = (dt_iop_bilateral_global_data_t *)malloc(sizeof(dt_iop_bilateral_global_data_t));
+    module->data = gd;
+    gd->kernel_bilateral5d_full = dt_opencl_create_kernel(program, "bilateral5d_full");
+    gd->kernel_bilateral5d_pass = dt_opencl_create_kernel(program, "bilateral5d_pass");
+  }
+
+  void cleanup_global(dt_iop_module_so_t *module)
+  {
+    dt_iop_bilateral_global_data_t *gd = (dt_iop_bilateral_global_data_t *)module->data;
+    dt_opencl_free_kernel(gd->kernel_bilateral5d_full);
+    dt_opencl_free_kernel(gd->kernel_bilateral5d_pass);
+    free(module->data);
+    module->data = NULL;
+  }
+
   void cleanup(dt_iop_module_t *module)
   {
     free(module->gui_data);
@@ -19,6 +19,8 @@
 #include "config.h"
 #endif
 #include "bauhaus/bauhaus.h"
+#include "common/box_filters.h"
+#include "common/opencl.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
 #include "control/control.h"
@@ -59,6 +61,15 @@ typedef struct dt_iop_bloom_data_t
 }
 dt_iop_bloom_data_t;
 
+typedef struct dt_iop_bloom_global_data_t
+{
+  int kernel_bloom_threshold;
+  int kernel_bloom_mix;
+}
+dt_iop_bloom_global_data_t;
+
+#define BOX_ITERATIONS 8
+
 const char *name()
 {
   return _("bloom");
@@ -126,77 +137,7 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   }
 
 
-  /* horizontal blur into memchannel lightness */
-  const int range = 2*radius+1;
-  const int hr = range/2;
-
-  const int size = roi_out->width>roi_out->height?roi_out->width:roi_out->height;
-  float *scanline = malloc(size*sizeof(float));
-
-  for(int iteration=0; iteration<8; iteration++)
-  {
-    int index=0;
-    for(int y=0; y<roi_out->height; y++)
-    {
-      float L=0;
-      int hits = 0;
-      for(int x=-hr; x<roi_out->width; x++)
-      {
-        int op = x - hr-1;
-        int np = x+hr;
-        if(op>=0)
-        {
-          L-=blurlightness[index+op];
-          hits--;
-        }
-        if(np < roi_out->width)
-        {
-          L+=blurlightness[index+np];
-          hits++;
-        }
-        if(x>=0)
-          scanline[x] = L/hits;
-      }
-
-      for (int x=0; x<roi_out->width; x++)
-        blurlightness[index+x]=scanline[x];
-
-      index+=roi_out->width;
-    }
-
-    /* vertical pass on blurlightness */
-    const int opoffs = -(hr+1)*roi_out->width;
-    const int npoffs = (hr)*roi_out->width;
-    for(int x=0; x < roi_out->width; x++)
-    {
-      float L=0;
-      int hits=0;
-      int index = -hr*roi_out->width+x;
-      for(int y=-hr; y<roi_out->height; y++)
-      {
-        int op=y-hr-1;
-        int np= y + hr;
-
-        if(op>=0)
-        {
-          L-=blurlightness[index+opoffs];
-          hits--;
-        }
-        if(np < roi_out->height)
-        {
-          L+=blurlightness[index+npoffs];
-          hits++;
-        }
-        if(y>=0)
-          scanline[y] = L/hits;
-        index += roi_out->width;
-      }
-
-      for (int y=0; y<roi_out->height; y++)
-        blurlightness[y*roi_out->width+x]=scanline[y];
-
-    }
-  }
+  dt_box_mean(blurlightness, roi_out->width, roi_out->height, 1, radius, BOX_ITERATIONS);
 
   /* screen blend lightness with original */
 
@@ -215,12 +156,92 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   if(piece->pipe->mask_display)
     dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 
-  if(scanline)
-    free(scanline);
   if(blurlightness)
     free(blurlightness);
 }
 
+#ifdef HAVE_OPENCL
+int
+process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_iop_bloom_data_t *d = (dt_iop_bloom_data_t *)piece->data;
+  dt_iop_bloom_global_data_t *gd = (dt_iop_bloom_global_data_t *)self->data;
+
+  cl_int err = -999;
+  cl_mem dev_blur = NULL;
+  cl_mem dev_tmp = NULL;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+
+  int rad = 256*(fmin(100.0f, d->size+1)/100.0f);
+  const float _r = ceilf(rad * roi_in->scale / piece->iscale);
+  const int radius = MIN(256, _r);
+
+  const float scale = 1.0f / exp2f ( -1.0f*(fmin(100.0f, d->strength+1)/100.0f));
+  const float threshold = d->threshold;
+
+  size_t sizes[3] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+
+  // the lights are a single channel:
+  dev_blur = dt_opencl_alloc_device(devid, width, height, sizeof(float));
+  if (dev_blur == NULL) goto error;
+  dev_tmp = dt_opencl_alloc_device(devid, width, height, sizeof(float));
+  if (dev_tmp == NULL) goto error;
+
+  /* get the thresholded lights into buffer */
+  dt_opencl_set_kernel_arg(devid, gd->kernel_bloom_threshold, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_bloom_threshold, 1, sizeof(cl_mem), (void *)&dev_blur);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_bloom_threshold, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_bloom_threshold, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_bloom_threshold, 4, sizeof(float), (void *)&scale);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_bloom_threshold, 5, sizeof(float), (void *)&threshold);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_bloom_threshold, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  err = dt_box_mean_cl(devid, dev_blur, dev_tmp, width, height, radius, BOX_ITERATIONS);
+  if(err != CL_SUCCESS) goto error;
+
+  /* screen blend lightness with original */
+  dt_opencl_set_kernel_arg(devid, gd->kernel_bloom_mix, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_bloom_mix, 1, sizeof(cl_mem), (void *)&dev_blur);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_bloom_mix, 2, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_bloom_mix, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_bloom_mix, 4, sizeof(int), (void *)&height);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_bloom_mix, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_tmp);
+  dt_opencl_release_mem_object(dev_blur);
+  return TRUE;
+
+error:
+  if (dev_tmp != NULL) dt_opencl_release_mem_object(dev_tmp);
+  if (dev_blur != NULL) dt_opencl_release_mem_object(dev_blur);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_bloom] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 22; // bloom.cl, from programs.conf
+  dt_iop_bloom_global_data_t *gd = (dt_iop_bloom_global_data_t *)malloc(sizeof(dt_iop_bloom_global_data_t));
+  module->data = gd;
+  gd->kernel_bloom_threshold = dt_opencl_create_kernel(program, "bloom_threshold");
+  gd->kernel_bloom_mix = dt_opencl_create_kernel(program, "bloom_mix");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_bloom_global_data_t *gd = (dt_iop_bloom_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_bloom_threshold);
+  dt_opencl_free_kernel(gd->kernel_bloom_mix);
+  free(module->data);
+  module->data = NULL;
+}
+
 static void
 strength_callback (GtkWidget *slider, gpointer user_data)
 {
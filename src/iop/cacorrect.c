@@ -65,7 +65,7 @@ groups ()
 
 int flags ()
 {
-  return IOP_FLAGS_ONE_INSTANCE;
+  return IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_THUMBNAIL_INVISIBLE;
 }
 
 int
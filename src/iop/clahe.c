@@ -20,6 +20,7 @@
 #endif
 #include "common/darktable.h"
 #include "common/colorspaces.h"
+#include "common/opencl.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
 #include "control/control.h"
@@ -37,6 +38,15 @@
 
 #define ROUND_POSISTIVE(f) ((unsigned int)((f)+0.5))
 
+#define RLCE_BINS 256
+// the clipped histogram is evaluated on a grid of this many points per radius and interpolated
+// in between. for small radii this is every pixel.
+#define RLCE_GRID 8
+// grid points along which one thread slides its histogram
+#define RLCE_CHUNK 32
+// bytes of grid tables the device holds at once
+#define RLCE_CL_TABLES (64*1024*1024)
+
 DT_MODULE(1)
 
 typedef struct dt_iop_rlce_params_t
@@ -61,6 +71,14 @@ typedef struct dt_iop_rlce_data_t
 }
 dt_iop_rlce_data_t;
 
+typedef struct dt_iop_rlce_global_data_t
+{
+  int kernel_clahe_bins;
+  int kernel_clahe_tables;
+  int kernel_clahe_apply;
+}
+dt_iop_rlce_global_data_t;
+
 const char *name()
 {
   return _("local contrast");
@@ -77,164 +95,278 @@ int flags()
   return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_DEPRECATED;
 }
 
+// clips the histogram of a window of n pixels, redistributes the clipped entries and stores
+// the normalized cdf for each bin in table.
+static void
+_rlce_table(const int *hist, const int n, const float slope, float *table)
+{
+  const int bins = RLCE_BINS;
+  const int limit = ( int )( slope * n /  bins + 0.5f );
+  int clippedhist[bins+1];
+
+  /* clip histogram and redistribute clipped entries */
+  memcpy(clippedhist,hist,(bins+1)*sizeof(int));
+  int ce = 0, ceb=0;
+  do
+  {
+    ceb = ce;
+    ce = 0;
+    for ( int b = 0; b <= bins; b++ )
+    {
+      int d = clippedhist[ b ] - limit;
+      if ( d > 0 )
+      {
+        ce += d;
+        clippedhist[ b ] = limit;
+      }
+    }
+
+    int d = (ce / (float) ( bins + 1 ));
+    int m = ce % ( bins + 1 );
+    for ( int h = 0; h <= bins; h++)
+      clippedhist[ h ] += d;
+
+    if ( m != 0 )
+    {
+      int s = bins / (float)m;
+      for ( int h = 0; h <= bins; h += s )
+        ++clippedhist[ h ];
+    }
+  }
+  while ( ce != ceb);
+
+  /* build cdf of clipped histogram */
+  int hMin = bins;
+  for ( int h = 0; h < hMin; h++ )
+    if ( clippedhist[ h ] != 0 ) hMin = h;
+
+  int cdfMax = 0;
+  for ( int h = hMin; h <= bins; h++ )
+    cdfMax += clippedhist[ h ];
+
+  int cdfMin = clippedhist[ hMin ];
+
+  int cdf = 0;
+  for ( int h = 0; h <= bins; h++ )
+  {
+    if ( h >= hMin ) cdf += clippedhist[ h ];
+    table[ h ] = ( cdf - cdfMin ) / ( float )( cdfMax - cdfMin );
+  }
+}
+
+// adds inc to the histogram for each pixel in columns [x0, x1) and rows [y0, y1).
+static void
+_rlce_hist_add(int *hist, const uint16_t *bin, const int width, const int x0, const int x1, const int y0, const int y1, const int inc)
+{
+  for ( int yi = y0; yi < y1; ++yi )
+    for ( int xi = x0; xi < x1; ++xi )
+      hist[ bin[yi*width+xi] ] += inc;
+}
+
+// tables of all grid points in row y. each thread slides the window along a chunk of grid points,
+// so every column enters and leaves its histogram only once.
+static void
+_rlce_tables(const uint16_t *bin, const int width, const int height, const int y, const int rad, const int step,
+             const int ngx, const float slope, float *tables)
+{
+  const int yMin = MAX(0, y - rad);
+  const int yMax = MIN(height, y + rad + 1);
+  const int nchunks = (ngx + RLCE_CHUNK - 1) / RLCE_CHUNK;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static)
+#endif
+  for(int c=0; c<nchunks; c++)
+  {
+    int hist[RLCE_BINS+1];
+    memset(hist,0,(RLCE_BINS+1)*sizeof(int));
+    int xMin = 0, xMax = 0;
+    for(int gx=c*RLCE_CHUNK; gx<MIN(ngx, (c+1)*RLCE_CHUNK); gx++)
+    {
+      const int x = MIN(gx*step, width - 1);
+      const int nMin = MAX(0, x - rad);
+      const int nMax = MIN(width, x + rad + 1);
+      if(gx == c*RLCE_CHUNK) xMin = xMax = nMin;
+      /* remove left behind and add newly included values */
+      _rlce_hist_add(hist, bin, width, xMin, nMin, yMin, yMax, -1);
+      _rlce_hist_add(hist, bin, width, xMax, nMax, yMin, yMax, 1);
+      xMin = nMin;
+      xMax = nMax;
+      _rlce_table(hist, (yMax - yMin)*(xMax - xMin), slope, tables + gx*(RLCE_BINS+1));
+    }
+  }
+}
+
 void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
   dt_iop_rlce_data_t *data = (dt_iop_rlce_data_t *)piece->data;
   const int ch = piece->colors;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
 
-  // PASS1: Get a luminance map of image...
-  float *luminance=(float *)malloc((roi_out->width*roi_out->height)*sizeof(float));
-  //double lsmax=0.0,lsmin=1.0;
+  // PASS1: Get a luminance map of image, as histogram bins...
+  uint16_t *bin = (uint16_t *)malloc((size_t)width*height*sizeof(uint16_t));
 #ifdef _OPENMP
-  #pragma omp parallel for default(none) schedule(static) shared(luminance,roi_in,roi_out,ivoid)
+  #pragma omp parallel for schedule(static)
 #endif
-  for(int j=0; j<roi_out->height; j++)
+  for(int j=0; j<height; j++)
   {
-    float *in=(float *)ivoid+j*roi_out->width*ch;
-    float *lm=luminance+j*roi_out->width;
-    for(int i=0; i<roi_out->width; i++)
+    const float *in=(const float *)ivoid+(size_t)j*width*ch;
+    uint16_t *lm=bin+(size_t)j*width;
+    for(int i=0; i<width; i++)
     {
       double pmax=CLIP(fmax(in[0],fmax(in[1],in[2]))); // Max value in RGB set
       double pmin=CLIP(fmin(in[0],fmin(in[1],in[2]))); // Min value in RGB set
-      *lm=(pmax+pmin)/2.0;        // Pixel luminocity
+      float L=(pmax+pmin)/2.0;        // Pixel luminocity
+      *lm=ROUND_POSISTIVE(L * (float)RLCE_BINS);
       in+=ch;
       lm++;
     }
   }
 
-
   // Params
   const int rad=data->radius*roi_in->scale/piece->iscale;
-
-  const int bins=256;
   const float slope=data->slope;
 
-  // CLAHE
+  // CLAHE, with the windows of two grid rows at a time
+  const int step = MAX(1, rad/RLCE_GRID);
+  const int ngx = (width + step - 2)/step + 1;
+  const int ngy = (height + step - 2)/step + 1;
+  float *tables = (float *)malloc(2*(size_t)ngx*(RLCE_BINS+1)*sizeof(float));
+
+  for(int gy=0; gy<ngy; gy++)
+  {
+    const int y1 = MIN(gy*step, height - 1);
+    float *t1 = tables + (gy&1)*(size_t)ngx*(RLCE_BINS+1);
+    _rlce_tables(bin, width, height, y1, rad, step, ngx, slope, t1);
+    if(gy == 0 && ngy > 1) continue;
+
+    // rows from the previous grid row up to this one, the last band includes the bottom row
+    const float *t0 = gy ? tables + ((gy-1)&1)*(size_t)ngx*(RLCE_BINS+1) : t1;
+    const int y0 = gy ? (gy-1)*step : 0;
+    const int jend = (gy == ngy - 1) ? height : y1;
 #ifdef _OPENMP
-  #pragma omp parallel for default(none) schedule(static) shared(luminance,roi_in,roi_out,ivoid,ovoid)
+    #pragma omp parallel for schedule(static)
 #endif
-  for(int j=0; j<roi_out->height; j++)
-  {
-    int yMin = fmax( 0, j - rad );
-    int yMax = fmin( roi_in->height, j + rad + 1 );
-    int h = yMax - yMin;
-
-    int xMin0 = fmax( 0, 0-rad );
-    int xMax0 = fmin( roi_in->width - 1, rad );
-
-    int hist[bins+1];
-    int clippedhist[bins+1];
-    float dest[roi_out->width];
-
-    /* initially fill histogram */
-    memset(hist,0,(bins+1)*sizeof(int));
-    for ( int yi = yMin; yi < yMax; ++yi )
-      for ( int xi = xMin0; xi < xMax0; ++xi )
-        ++hist[ ROUND_POSISTIVE(luminance[yi*roi_in->width+xi] * (float)bins) ];
-
-    // Destination row
-    memset(dest,0,roi_out->width*sizeof(float));
-    float *ld=dest;
-
-    for(int i=0; i<roi_out->width; i++)
+    for(int j=y0; j<jend; j++)
     {
-
-      int v = ROUND_POSISTIVE(luminance[j*roi_in->width+i] * (float)bins);
-
-      int xMin = fmax( 0, i - rad );
-      int xMax = i + rad + 1;
-      int w = fmin( roi_in->width, xMax ) - xMin;
-      int n = h * w;
-
-      int limit = ( int )( slope * n /  bins + 0.5f );
-
-      /* remove left behind values from histogram */
-      if ( xMin > 0 )
+      const float fy = y1 > y0 ? (j - y0)/(float)(y1 - y0) : 0.0f;
+      const float *in = ((float *)ivoid) + (size_t)j*width*ch;
+      float *out = ((float *)ovoid) + (size_t)j*width*ch;
+      const uint16_t *lm = bin + (size_t)j*width;
+      for(int r=0; r<width; r++)
       {
-        int xMin1 = xMin - 1;
-        for ( int yi = yMin; yi < yMax; ++yi )
-          --hist[  ROUND_POSISTIVE(luminance[yi*roi_in->width+xMin1] * (float)bins) ];
+        const int gx0 = r/step;
+        const int gx1 = MIN(gx0 + 1, ngx - 1);
+        const int x0 = gx0*step;
+        const int x1 = MIN(gx1*step, width - 1);
+        const float fx = x1 > x0 ? (r - x0)/(float)(x1 - x0) : 0.0f;
+        const int v = lm[r];
+        const float dest =
+          (1.0f - fy) * ((1.0f - fx) * t0[gx0*(RLCE_BINS+1) + v] + fx * t0[gx1*(RLCE_BINS+1) + v]) +
+          (       fy) * ((1.0f - fx) * t1[gx0*(RLCE_BINS+1) + v] + fx * t1[gx1*(RLCE_BINS+1) + v]);
+
+        float H, S, L;
+        rgb2hsl(in,&H,&S,&L);
+        //hsl2rgb(out,H,S,( L / dest[r] ) * (L-lsmin) + lsmin );
+        hsl2rgb(out,H,S,dest );
+        out += ch;
+        in += ch;
       }
-
-      /* add newly included values to histogram */
-      if ( xMax <= roi_in->width )
-      {
-        int xMax1 = xMax - 1;
-        for ( int yi = yMin; yi < yMax; ++yi )
-          ++hist[  ROUND_POSISTIVE(luminance[yi*roi_in->width+xMax1] * (float)bins) ];
-      }
-
-      /* clip histogram and redistribute clipped entries */
-      memcpy(clippedhist,hist,(bins+1)*sizeof(int));
-      int ce = 0, ceb=0;
-      do
-      {
-        ceb = ce;
-        ce = 0;
-        for ( int b = 0; b <= bins; b++ )
-        {
-          int d = clippedhist[ b ] - limit;
-          if ( d > 0 )
-          {
-            ce += d;
-            clippedhist[ b ] = limit;
-          }
-        }
-
-        int d = (ce / (float) ( bins + 1 ));
-        int m = ce % ( bins + 1 );
-        for ( int h = 0; h <= bins; h++)
-          clippedhist[ h ] += d;
-
-        if ( m != 0 )
-        {
-          int s = bins / (float)m;
-          for ( int h = 0; h <= bins; h += s )
-            ++clippedhist[ h ];
-        }
-      }
-      while ( ce != ceb);
-
-      /* build cdf of clipped histogram */
-      int hMin = bins;
-      for ( int h = 0; h < hMin; h++ )
-        if ( clippedhist[ h ] != 0 ) hMin = h;
-
-      int cdf = 0;
-      for ( int h = hMin; h <= v; h++ )
-        cdf += clippedhist[ h ];
-
-      int cdfMax = cdf;
-      for ( int h = v + 1; h <= bins; h++ )
-        cdfMax += clippedhist[ h ];
-
-      int cdfMin = clippedhist[ hMin ];
-
-      *ld=( cdf - cdfMin ) / ( float )( cdfMax - cdfMin );
-
-      ld++;
     }
+  }
 
-    // Apply row
-    float *in = ((float *)ivoid) + j*roi_out->width*ch;
-    float *out = ((float *)ovoid) + j*roi_out->width*ch;
-    for(int r=0; r<roi_out->width; r++)
-    {
-      float H, S, L;
-      rgb2hsl(in,&H,&S,&L);
-      //hsl2rgb(out,H,S,( L / dest[r] ) * (L-lsmin) + lsmin );
-      hsl2rgb(out,H,S,dest[r] );
-      out += ch;
-      in += ch;
-      ld++;
-    }
+  // Cleanup
+  free(tables);
+  free(bin);
+
+}
 
+#ifdef HAVE_OPENCL
+int
+process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_iop_rlce_data_t *data = (dt_iop_rlce_data_t *)piece->data;
+  dt_iop_rlce_global_data_t *gd = (dt_iop_rlce_global_data_t *)self->data;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+  const int rad = data->radius*roi_in->scale/piece->iscale;
+  const float slope = data->slope;
+  const int step = MAX(1, rad/RLCE_GRID);
+  const int ngx = (width + step - 2)/step + 1;
+  const int ngy = (height + step - 2)/step + 1;
+  // grid rows the device holds at once, consecutive bands share one row
+  const int band = MIN(ngy, MAX(2, RLCE_CL_TABLES/(ngx*(RLCE_BINS+1)*(int)sizeof(float))));
+
+  cl_int err = -999;
+  cl_mem dev_bin = NULL;
+  cl_mem dev_tables = NULL;
+
+  dev_bin = dt_opencl_alloc_device_buffer(devid, (size_t)width*height*sizeof(int));
+  if(dev_bin == NULL) goto error;
+  dev_tables = dt_opencl_alloc_device_buffer(devid, (size_t)band*ngx*(RLCE_BINS+1)*sizeof(float));
+  if(dev_tables == NULL) goto error;
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_bins, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_bins, 1, sizeof(cl_mem), (void *)&dev_bin);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_bins, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_bins, 3, sizeof(int), (void *)&height);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_clahe_bins, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  for(int gy0=0; ; gy0+=band-1)
+  {
+    const int rows = MIN(band, ngy - gy0);
+    const int last = (gy0 + rows >= ngy);
+    const int ystart = MIN(gy0*step, height - 1);
+    const int yend = last ? height : (gy0 + rows - 1)*step;
+
+    size_t tsizes[] = { ROUNDUPWD(ngx), ROUNDUPHT(rows), 1 };
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_tables, 0, sizeof(cl_mem), (void *)&dev_bin);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_tables, 1, sizeof(cl_mem), (void *)&dev_tables);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_tables, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_tables, 3, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_tables, 4, sizeof(int), (void *)&rad);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_tables, 5, sizeof(int), (void *)&step);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_tables, 6, sizeof(int), (void *)&gy0);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_tables, 7, sizeof(int), (void *)&ngx);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_tables, 8, sizeof(int), (void *)&rows);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_tables, 9, sizeof(float), (void *)&slope);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_clahe_tables, tsizes);
+    if(err != CL_SUCCESS) goto error;
+
+    size_t asizes[] = { ROUNDUPWD(width), ROUNDUPHT(yend - ystart), 1 };
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 0, sizeof(cl_mem), (void *)&dev_in);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 1, sizeof(cl_mem), (void *)&dev_out);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 2, sizeof(cl_mem), (void *)&dev_bin);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 3, sizeof(cl_mem), (void *)&dev_tables);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 4, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 5, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 6, sizeof(int), (void *)&ystart);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 7, sizeof(int), (void *)&yend);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 8, sizeof(int), (void *)&step);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 9, sizeof(int), (void *)&gy0);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 10, sizeof(int), (void *)&ngx);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_clahe_apply, 11, sizeof(int), (void *)&rows);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_clahe_apply, asizes);
+    if(err != CL_SUCCESS) goto error;
+
+    if(last) break;
   }
 
-  // Cleanup
-  free(luminance);
+  dt_opencl_release_mem_object(dev_tables);
+  dt_opencl_release_mem_object(dev_bin);
+  return TRUE;
 
+error:
+  if(dev_tables != NULL) dt_opencl_release_mem_object(dev_tables);
+  if(dev_bin != NULL) dt_opencl_release_mem_object(dev_bin);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_clahe] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
 }
+#endif
 
 static void
 radius_callback (GtkDarktableSlider *slider, gpointer user_data)
@@ -319,6 +451,26 @@ void init(dt_iop_module_t *module)
   memcpy(module->default_params, &tmp, sizeof(dt_iop_rlce_params_t));
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 15; // clahe.cl, from programs.conf
+  dt_iop_rlce_global_data_t *gd = (dt_iop_rlce_global_data_t *)malloc(sizeof(dt_iop_rlce_global_data_t));
+  module->data = gd;
+  gd->kernel_clahe_bins = dt_opencl_create_kernel(program, "clahe_bins");
+  gd->kernel_clahe_tables = dt_opencl_create_kernel(program, "clahe_tables");
+  gd->kernel_clahe_apply = dt_opencl_create_kernel(program, "clahe_apply");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_rlce_global_data_t *gd = (dt_iop_rlce_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_clahe_bins);
+  dt_opencl_free_kernel(gd->kernel_clahe_tables);
+  dt_opencl_free_kernel(gd->kernel_clahe_apply);
+  free(module->data);
+  module->data = NULL;
+}
+
 void cleanup(dt_iop_module_t *module)
 {
   free(module->gui_data);
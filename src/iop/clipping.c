@@ -328,7 +328,7 @@ keystone_get_matrix(float *k_space, float kxa, float kxb, float kxc, float kxd,
 }
 
 static void
-keystone_backtransform(float *i, float *k_space, float a, float b, float d, float e, float g, float h, float kxa, float kya)
+keystone_backtransform(float *i, const float *k_space, float a, float b, float d, float e, float g, float h, float kxa, float kya)
 {
   float xx = i[0] - k_space[0];
   float yy = i[1] - k_space[1];
@@ -370,6 +370,64 @@ transform(float *x, float *o, const float *m, const float t_h, const float t_v)
 
 
 
+// the keystone correction in the pixels of roi_in, as process() applies it.
+typedef struct dt_iop_clipping_keystone_t
+{
+  float k_space[4];
+  float kxa, kya;
+  float a, b, d, e, g, h;
+}
+dt_iop_clipping_keystone_t;
+
+static void
+_keystone_init(const dt_iop_clipping_data_t *d, const dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in,
+               dt_iop_clipping_keystone_t *ks)
+{
+  const float rx = piece->buf_in.width*roi_in->scale;
+  const float ry = piece->buf_in.height*roi_in->scale;
+  ks->k_space[0] = d->k_space[0]*rx;
+  ks->k_space[1] = d->k_space[1]*ry;
+  ks->k_space[2] = d->k_space[2]*rx;
+  ks->k_space[3] = d->k_space[3]*ry;
+  ks->kxa = d->kxa*rx;
+  ks->kya = d->kya*ry;
+  keystone_get_matrix(ks->k_space,ks->kxa,d->kxb*rx,d->kxc*rx,d->kxd*rx,ks->kya,d->kyb*ry,d->kyc*ry,d->kyd*ry,
+                      &ks->a,&ks->b,&ks->d,&ks->e,&ks->g,&ks->h);
+}
+
+// position in roi_in process() samples pixel (x, y) of roi_out from.
+static inline void
+_process_backtransform(const dt_iop_clipping_data_t *d, const dt_iop_clipping_keystone_t *ks,
+                       const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, const float x, const float y, float *po)
+{
+  float pi[2];
+
+  pi[0] = roi_out->x - roi_out->scale*d->enlarge_x + roi_out->scale*d->cix + x;
+  pi[1] = roi_out->y - roi_out->scale*d->enlarge_y + roi_out->scale*d->ciy + y;
+
+  // transform this point using matrix m
+  if(d->flip)
+  {
+    pi[1] -= d->tx*roi_out->scale;
+    pi[0] -= d->ty*roi_out->scale;
+  }
+  else
+  {
+    pi[0] -= d->tx*roi_out->scale;
+    pi[1] -= d->ty*roi_out->scale;
+  }
+  pi[0] /= roi_out->scale;
+  pi[1] /= roi_out->scale;
+  backtransform(pi, po, d->m, d->k_h, d->k_v);
+  po[0] *= roi_in->scale;
+  po[1] *= roi_in->scale;
+  po[0] += d->tx*roi_in->scale;
+  po[1] += d->ty*roi_in->scale;
+  if (d->k_apply==1) keystone_backtransform(po,ks->k_space,ks->a,ks->b,ks->d,ks->e,ks->g,ks->h,ks->kxa,ks->kya);
+  po[0] -= roi_in->x;
+  po[1] -= roi_in->y;
+}
+
 int distort_transform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, float *points, int points_count)
 {
   dt_iop_clipping_data_t *d = (dt_iop_clipping_data_t *)piece->data;
@@ -745,6 +803,64 @@ void modify_roi_in(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *
   roi_in->height = CLAMP(roi_in->height, 1, scheight - roi_in->y);
 }
 
+// inverse of the above, for tiling: map the corners of roi_in forward and take their aabb.
+int invert_roi_in(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in, dt_iop_roi_t *roi_out)
+{
+  dt_iop_clipping_data_t *d = (dt_iop_clipping_data_t *)piece->data;
+
+  const float so = roi_out->scale;
+  const float kw = piece->buf_in.width*so, kh = piece->buf_in.height*so;
+  float p[2], o[2], aabb_in[4] = {roi_in->x, roi_in->y, roi_in->x+roi_in->width, roi_in->y+roi_in->height};
+  float aabb[4] = {INFINITY, INFINITY, -INFINITY, -INFINITY};
+  for(int c=0; c<4; c++)
+  {
+    get_corner(aabb_in, c, o);
+    o[0] /= kw;
+    o[1] /= kh;
+    if (d->k_apply==1) keystone_transform(o,d->k_space,d->a,d->b,d->d,d->e,d->g,d->h,d->kxa,d->kya);
+    o[0] *= kw;
+    o[1] *= kh;
+    o[0] -= d->tx*so;
+    o[1] -= d->ty*so;
+    o[0] *= 1.0/so;
+    o[1] *= 1.0/so;
+    transform(o, p, d->m, d->k_h, d->k_v);
+    p[0] *= so;
+    p[1] *= so;
+    if(d->flip)
+    {
+      p[1] += d->tx*so;
+      p[0] += d->ty*so;
+    }
+    else
+    {
+      p[0] += d->tx*so;
+      p[1] += d->ty*so;
+    }
+    p[0] -= (d->cix - d->enlarge_x)*so;
+    p[1] -= (d->ciy - d->enlarge_y)*so;
+    adjust_aabb(p, aabb);
+  }
+
+  // undo the safety margin of modify_roi_in()
+  roi_out->x      = aabb[0]+1;
+  roi_out->y      = aabb[1]+1;
+  roi_out->width  = aabb[2]-aabb[0]-2;
+  roi_out->height = aabb[3]-aabb[1]-2;
+
+  if(d->angle == 0.0f && d->all_off)
+  {
+    // just crop, no margin:
+    roi_out->x      = roundf(aabb[0]);
+    roi_out->y      = roundf(aabb[1]);
+    roi_out->width  = roi_in->width;
+    roi_out->height = roi_in->height;
+  }
+  roi_out->width  = MAX(roi_out->width, 1);
+  roi_out->height = MAX(roi_out->height, 1);
+  return 1;
+}
+
 // 3rd (final) pass: you get this input region (may be different from what was requested above),
 // do your best to fill the output region!
 void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
@@ -777,16 +893,11 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   else
   {
     const struct dt_interpolation* interpolation = dt_interpolation_new(DT_INTERPOLATION_USERPREF);
-    const float rx = piece->buf_in.width*roi_in->scale;
-    const float ry = piece->buf_in.height*roi_in->scale;
-    float k_space[4] = {d->k_space[0]*rx,d->k_space[1]*ry,d->k_space[2]*rx,d->k_space[3]*ry};
-    const float kxa = d->kxa*rx, kxb = d->kxb*rx, kxc = d->kxc*rx, kxd = d->kxd*rx;
-    const float kya = d->kya*ry, kyb = d->kyb*ry, kyc = d->kyc*ry, kyd = d->kyd*ry;
-    float ma,mb,md,me,mg,mh;
-    keystone_get_matrix(k_space,kxa,kxb,kxc,kxd,kya,kyb,kyc,kyd,&ma,&mb,&md,&me,&mg,&mh);
+    dt_iop_clipping_keystone_t ks;
+    _keystone_init(d, piece, roi_in, &ks);
 
 #ifdef _OPENMP
-    #pragma omp parallel for schedule(static) default(none) shared(d,ivoid,ovoid,roi_in,roi_out,interpolation,k_space,ma,mb,md,me,mg,mh)
+    #pragma omp parallel for schedule(static) default(none) shared(d,ivoid,ovoid,roi_in,roi_out,interpolation,ks)
 #endif
     // (slow) point-by-point transformation.
     // TODO: optimize with scanlines and linear steps between?
@@ -795,39 +906,30 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
       float *out = ((float *)ovoid)+ch*j*roi_out->width;
       for(int i=0; i<roi_out->width; i++,out+=ch)
       {
-        float pi[2], po[2];
-
-        pi[0] = roi_out->x - roi_out->scale*d->enlarge_x + roi_out->scale*d->cix + i;
-        pi[1] = roi_out->y - roi_out->scale*d->enlarge_y + roi_out->scale*d->ciy + j;
-
-        // transform this point using matrix m
-        if(d->flip)
-        {
-          pi[1] -= d->tx*roi_out->scale;
-          pi[0] -= d->ty*roi_out->scale;
-        }
-        else
-        {
-          pi[0] -= d->tx*roi_out->scale;
-          pi[1] -= d->ty*roi_out->scale;
-        }
-        pi[0] /= roi_out->scale;
-        pi[1] /= roi_out->scale;
-        backtransform(pi, po, d->m, d->k_h, d->k_v);
-        po[0] *= roi_in->scale;
-        po[1] *= roi_in->scale;
-        po[0] += d->tx*roi_in->scale;
-        po[1] += d->ty*roi_in->scale;
-        if (d->k_apply==1) keystone_backtransform(po,k_space,ma,mb,md,me,mg,mh,kxa,kya);
-        po[0] -= roi_in->x;
-        po[1] -= roi_in->y;
-
+        float po[2];
+        _process_backtransform(d, &ks, roi_in, roi_out, i, j, po);
         dt_interpolation_compute_pixel4c(interpolation, (float *)ivoid, out, po[0], po[1], roi_in->width, roi_in->height, ch_width);
       }
     }
   }
 }
 
+// the same mapping as process(), to resample together with the neighbouring distortions.
+int warp_backtransform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in,
+                       const dt_iop_roi_t *roi_out, float *points, const int points_count)
+{
+  dt_iop_clipping_data_t *d = (dt_iop_clipping_data_t *)piece->data;
+  // only crop, no rot: process() copies the pixels.
+  if(!d->flags && d->angle == 0.0 && d->all_off && roi_in->width == roi_out->width && roi_in->height == roi_out->height)
+    return 2;
+  if(!points) return 1;
+
+  dt_iop_clipping_keystone_t ks;
+  _keystone_init(d, piece, roi_in, &ks);
+  for(int k=0; k<2*points_count; k+=2)
+    _process_backtransform(d, &ks, roi_in, roi_out, points[k], points[k+1], points+k);
+  return 1;
+}
 
 
 #ifdef HAVE_OPENCL
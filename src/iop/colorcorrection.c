@@ -121,23 +121,24 @@ void connect_key_accels(dt_iop_module_t *self)
   dt_accel_connect_slider_iop(self, "saturation", GTK_WIDGET(g->slider));
 }
 
-void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+void process_pixels (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *in, float *out, const size_t npixels)
 {
   dt_iop_colorcorrection_data_t *d = (dt_iop_colorcorrection_data_t *)piece->data;
-  float *in  = (float *)i;
-  float *out = (float *)o;
-  const int ch = piece->colors;
-  for(int k=0; k<roi_out->width*roi_out->height; k++)
+  for(size_t k=0; k<npixels; k++, in+=4, out+=4)
   {
-    out[0] = in[0];
-    out[1] = d->saturation*(in[1] + in[0] * d->a_scale + d->a_base);
-    out[2] = d->saturation*(in[2] + in[0] * d->b_scale + d->b_base);
+    const float L = in[0], a = in[1], b = in[2];
+    out[0] = L;
+    out[1] = d->saturation*(a + L * d->a_scale + d->a_base);
+    out[2] = d->saturation*(b + L * d->b_scale + d->b_base);
     out[3] = in[3];
-    out += ch;
-    in += ch;
   }
 }
 
+void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  process_pixels(self, piece, (const float *)i, (float *)o, (size_t)roi_out->width*roi_out->height);
+}
+
 #ifdef HAVE_OPENCL
 int
 process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
@@ -25,6 +25,7 @@
 #include "gui/gtk.h"
 #include "bauhaus/bauhaus.h"
 #include "common/colorspaces.h"
+#include "common/colorspaces_inline_conversions.h"
 #include "common/colormatrices.c"
 #include "common/opencl.h"
 #include "common/image_cache.h"
@@ -48,6 +49,7 @@ static void update_profile_list(dt_iop_module_t *self);
 typedef struct dt_iop_colorin_global_data_t
 {
   int kernel_colorin;
+  int kernel_colorin_clut;
 }
 dt_iop_colorin_global_data_t;
 
@@ -77,6 +79,7 @@ init_global(dt_iop_module_so_t *module)
   dt_iop_colorin_global_data_t *gd = (dt_iop_colorin_global_data_t *)malloc(sizeof(dt_iop_colorin_global_data_t));
   module->data = gd;
   gd->kernel_colorin = dt_opencl_create_kernel(program, "colorin");
+  gd->kernel_colorin_clut = dt_opencl_create_kernel(program, "colorin_clut");
 }
 
 void
@@ -84,6 +87,7 @@ cleanup_global(dt_iop_module_so_t *module)
 {
   dt_iop_colorin_global_data_t *gd = (dt_iop_colorin_global_data_t *)module->data;
   dt_opencl_free_kernel(gd->kernel_colorin);
+  dt_opencl_free_kernel(gd->kernel_colorin_clut);
   free(module->data);
   module->data = NULL;
 }
@@ -159,6 +163,31 @@ process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem
   const int height = roi_in->height;
 
   size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1};
+
+  if(d->clut.table)
+  {
+    // lcms2 transform, baked into a 3d lut
+    const int size = DT_COLORSPACES_CLUT_SIZE;
+    const int clutsize = sizeof(float)*4*size*size*size;
+    dev_m = dt_opencl_alloc_device_buffer(devid, clutsize);
+    if (dev_m == NULL) goto error;
+    err = dt_opencl_write_buffer_to_device(devid, d->clut.table, dev_m, 0, clutsize, CL_TRUE);
+    if(err != CL_SUCCESS) goto error;
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorin_clut, 0, sizeof(cl_mem), (void *)&dev_in);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorin_clut, 1, sizeof(cl_mem), (void *)&dev_out);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorin_clut, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorin_clut, 3, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorin_clut, 4, sizeof(cl_mem), (void *)&dev_m);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorin_clut, 5, sizeof(int), (void *)&size);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorin_clut, 6, 4*sizeof(float), (void *)d->clut.min);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorin_clut, 7, 4*sizeof(float), (void *)d->clut.scale);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorin_clut, 8, sizeof(int), (void *)&d->clut.sqrt_in);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_colorin_clut, sizes);
+    if(err != CL_SUCCESS) goto error;
+    dt_opencl_release_mem_object(dev_m);
+    return TRUE;
+  }
+
   dev_m = dt_opencl_copy_host_to_device_constant(devid, sizeof(float)*9, d->cmatrix);
   if (dev_m == NULL) goto error;
   dev_r = dt_opencl_copy_host_to_device(devid, d->lut[0], 256, 256, sizeof(float));
@@ -199,36 +228,6 @@ error:
 }
 #endif
 
-static inline __m128
-lab_f_m(const __m128 x)
-{
-  const __m128 epsilon = _mm_set1_ps(216.0f/24389.0f);
-  const __m128 kappa   = _mm_set1_ps(24389.0f/27.0f);
-
-  // calculate as if x > epsilon : result = cbrtf(x)
-  // approximate cbrtf(x):
-  const __m128 a = _mm_castsi128_ps(_mm_add_epi32(_mm_cvtps_epi32(_mm_div_ps(_mm_cvtepi32_ps(_mm_castps_si128(x)),_mm_set1_ps(3.0f))),_mm_set1_epi32(709921077)));
-  const __m128 a3 = _mm_mul_ps(_mm_mul_ps(a,a),a);
-  const __m128 res_big = _mm_div_ps(_mm_mul_ps(a,_mm_add_ps(a3,_mm_add_ps(x,x))),_mm_add_ps(_mm_add_ps(a3,a3),x));
-
-  // calculate as if x <= epsilon : result = (kappa*x+16)/116
-  const __m128 res_small = _mm_div_ps(_mm_add_ps(_mm_mul_ps(kappa,x),_mm_set1_ps(16.0f)),_mm_set1_ps(116.0f));
-
-  // blend results according to whether each component is > epsilon or not
-  const __m128 mask = _mm_cmpgt_ps(x,epsilon);
-  return _mm_or_ps(_mm_and_ps(mask,res_big),_mm_andnot_ps(mask,res_small));
-}
-
-static inline __m128
-dt_XYZ_to_Lab_SSE(const __m128 XYZ)
-{
-  const __m128 d50_inv  = _mm_set_ps(0.0f, 1.0f/0.8249f, 1.0f, 1.0f/0.9642f);
-  const __m128 coef = _mm_set_ps(0.0f,200.0f,500.0f,116.0f);
-  const __m128 f = lab_f_m(_mm_mul_ps(XYZ,d50_inv));
-  // because d50_inv.z is 0.0f, lab_f(0) == 16/116, so Lab[0] = 116*f[0] - 16 equal to 116*(f[0]-f[3])
-  return _mm_mul_ps(coef,_mm_sub_ps(_mm_shuffle_ps(f,f,_MM_SHUFFLE(3,1,0,1)),_mm_shuffle_ps(f,f,_MM_SHUFFLE(3,2,1,3))));
-}
-
 void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
   const dt_iop_colorin_data_t *const d = (dt_iop_colorin_data_t *)piece->data;
@@ -291,11 +290,42 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
         dt_XYZ_to_Lab(XYZ, buf_out);
 #endif
         __m128 xyz = _mm_add_ps(_mm_add_ps( _mm_mul_ps(m0,_mm_set1_ps(cam[0])), _mm_mul_ps(m1,_mm_set1_ps(cam[1]))), _mm_mul_ps(m2,_mm_set1_ps(cam[2])));
-        _mm_stream_ps(buf_out,dt_XYZ_to_Lab_SSE(xyz));
+        _mm_stream_ps(buf_out,dt_XYZ_to_Lab_sse2(xyz));
       }
     }
     _mm_sfence();
   }
+  else if(d->clut.table && ch == 4)
+  {
+    // lcms2 transform, baked into a 3d lut
+#ifdef _OPENMP
+    #pragma omp parallel for shared(roi_out, out, in) schedule(static)
+#endif
+    for(int k=0; k<roi_out->height; k++)
+    {
+      const float *buf_in = in + (size_t)ch*roi_out->width*k;
+      float *buf_out = out + (size_t)ch*roi_out->width*k;
+
+      for (int l=0; l<roi_out->width; l++)
+      {
+        float *cam = buf_out + ch*l;
+        for(int c=0; c<4; c++) cam[c] = buf_in[ch*l+c];
+
+        // same gamut mapping as for the lcms2 fallback below
+        const float YY = cam[0]+cam[1]+cam[2];
+        const float zz = cam[2]/YY;
+        const float bound_z = 0.5f, bound_Y = 0.5f;
+        const float amount = 0.11f;
+        if (zz > bound_z)
+        {
+          const float t = (zz - bound_z)/(1.0f-bound_z) * fminf(1.0, YY/bound_Y);
+          cam[1] += t*amount;
+          cam[2] -= t*amount;
+        }
+      }
+      dt_colorspaces_apply_clut(&d->clut, buf_out, buf_out, roi_out->width);
+    }
+  }
   else
   {
     // use general lcms2 fallback
@@ -360,6 +390,7 @@ void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pi
       cmsDeleteTransform(d->xform[t]);
       d->xform[t] = NULL;
     }
+  dt_colorspaces_cleanup_clut(&d->clut);
   d->cmatrix[0] = -666.0f;
   d->lut[0][0] = -1.0f;
   d->lut[1][0] = -1.0f;
@@ -483,6 +514,15 @@ void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pi
     }
   }
 
+  // bake the lcms2 transform into a 3d lut over the camera rgb cube, this runs on all threads
+  // and on the gpu. lcms2 clips the input of table based profiles to the cube anyways.
+  if(d->xform[0] && d->cmatrix[0] == -666.0f)
+  {
+    const float min[3] = { 0.0f, 0.0f, 0.0f }, max[3] = { 1.0f, 1.0f, 1.0f };
+    if(!dt_colorspaces_create_clut(&d->clut, d->xform[0], min, max, 1))
+      piece->process_cl_ready = 1;
+  }
+
   // now try to initialize unbounded mode:
   // we do a extrapolation for input values above 1.0f.
   // unfortunately we can only do this if we got the computation
@@ -509,6 +549,7 @@ void init_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_p
   piece->data = malloc(sizeof(dt_iop_colorin_data_t));
   dt_iop_colorin_data_t *d = (dt_iop_colorin_data_t *)piece->data;
   d->input = NULL;
+  d->clut.table = NULL;
   d->xform = (cmsHTRANSFORM *)malloc(sizeof(cmsHTRANSFORM)*dt_get_num_threads());
   for(int t=0; t<dt_get_num_threads(); t++) d->xform[t] = NULL;
   d->Lab = dt_colorspaces_create_lab_profile();
@@ -522,6 +563,7 @@ void cleanup_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_de
   dt_colorspaces_cleanup_profile(d->Lab);
   for(int t=0; t<dt_get_num_threads(); t++) if(d->xform[t]) cmsDeleteTransform(d->xform[t]);
   free(d->xform);
+  dt_colorspaces_cleanup_clut(&d->clut);
   free(piece->data);
 }
 
@@ -67,6 +67,7 @@ typedef struct dt_iop_colorin_data_t
   cmsHPROFILE input;
   cmsHPROFILE Lab;
   cmsHTRANSFORM *xform;
+  dt_colorspaces_clut_t clut;         // xform baked into a 3d lut, if there is one
   float lut[3][LUT_SAMPLES];
   float cmatrix[9];
   float unbounded_coeffs[3][3];       // approximation for extrapolation of shaper curves
@@ -27,6 +27,7 @@
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
 #include "common/colorspaces.h"
+#include "common/colorspaces_inline_conversions.h"
 #include "common/opencl.h"
 
 #include <xmmintrin.h>
@@ -155,6 +156,7 @@ init_global(dt_iop_module_so_t *module)
   dt_iop_colorout_global_data_t *gd = (dt_iop_colorout_global_data_t *)malloc(sizeof(dt_iop_colorout_global_data_t));
   module->data = gd;
   gd->kernel_colorout = dt_opencl_create_kernel(program, "colorout");
+  gd->kernel_colorout_clut = dt_opencl_create_kernel(program, "colorout_clut");
 }
 
 void
@@ -162,6 +164,7 @@ cleanup_global(dt_iop_module_so_t *module)
 {
   dt_iop_colorout_global_data_t *gd = (dt_iop_colorout_global_data_t *)module->data;
   dt_opencl_free_kernel(gd->kernel_colorout);
+  dt_opencl_free_kernel(gd->kernel_colorout_clut);
   free(module->data);
   module->data = NULL;
 }
@@ -307,6 +310,30 @@ process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem
 
   size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1};
 
+  if(d->clut.table)
+  {
+    // lcms2 transform, baked into a 3d lut
+    const int size = DT_COLORSPACES_CLUT_SIZE;
+    const int clutsize = sizeof(float)*4*size*size*size;
+    dev_m = dt_opencl_alloc_device_buffer(devid, clutsize);
+    if (dev_m == NULL) goto error;
+    err = dt_opencl_write_buffer_to_device(devid, d->clut.table, dev_m, 0, clutsize, CL_TRUE);
+    if(err != CL_SUCCESS) goto error;
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorout_clut, 0, sizeof(cl_mem), (void *)&dev_in);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorout_clut, 1, sizeof(cl_mem), (void *)&dev_out);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorout_clut, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorout_clut, 3, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorout_clut, 4, sizeof(cl_mem), (void *)&dev_m);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorout_clut, 5, sizeof(int), (void *)&size);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorout_clut, 6, 4*sizeof(float), (void *)d->clut.min);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorout_clut, 7, 4*sizeof(float), (void *)d->clut.scale);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_colorout_clut, 8, sizeof(int), (void *)&d->clut.sqrt_in);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_colorout_clut, sizes);
+    if(err != CL_SUCCESS) goto error;
+    dt_opencl_release_mem_object(dev_m);
+    return TRUE;
+  }
+
   dev_m = dt_opencl_copy_host_to_device_constant(devid, sizeof(float)*9, d->cmatrix);
   if (dev_m == NULL) goto error;
   dev_r = dt_opencl_copy_host_to_device(devid, d->lut[0], 256, 256, sizeof(float));
@@ -346,36 +373,6 @@ error:
 }
 #endif
 
-static inline __m128
-lab_f_inv_m(const __m128 x)
-{
-  const __m128 epsilon = _mm_set1_ps(0.20689655172413796f); // cbrtf(216.0f/24389.0f);
-  const __m128 kappa_rcp_x16   = _mm_set1_ps(16.0f*27.0f/24389.0f);
-  const __m128 kappa_rcp_x116   = _mm_set1_ps(116.0f*27.0f/24389.0f);
-
-  // x > epsilon
-  const __m128 res_big   = _mm_mul_ps(_mm_mul_ps(x,x),x);
-  // x <= epsilon
-  const __m128 res_small = _mm_sub_ps(_mm_mul_ps(kappa_rcp_x116,x),kappa_rcp_x16);
-
-  // blend results according to whether each component is > epsilon or not
-  const __m128 mask = _mm_cmpgt_ps(x,epsilon);
-  return _mm_or_ps(_mm_and_ps(mask,res_big),_mm_andnot_ps(mask,res_small));
-}
-
-static inline __m128
-dt_Lab_to_XYZ_SSE(const __m128 Lab)
-{
-  const __m128 d50    = _mm_set_ps(0.0f, 0.8249f, 1.0f, 0.9642f);
-  const __m128 coef   = _mm_set_ps(0.0f,-1.0f/200.0f,1.0f/116.0f,1.0f/500.0f);
-  const __m128 offset = _mm_set1_ps(0.137931034f);
-
-  // last component ins shuffle taken from 1st component of Lab to make sure it is not nan, so it will become 0.0f in f
-  const __m128 f = _mm_mul_ps(_mm_shuffle_ps(Lab,Lab,_MM_SHUFFLE(0,2,0,1)),coef);
-
-  return _mm_mul_ps(d50,lab_f_inv_m(_mm_add_ps(_mm_add_ps(f,_mm_shuffle_ps(f,f,_MM_SHUFFLE(1,1,3,1))),offset)));
-}
-
 void
 process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
@@ -401,7 +398,7 @@ process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoi
 
       for(int i=0; i<roi_out->width; i++, in+=ch, out+=ch )
       {
-        const __m128 xyz = dt_Lab_to_XYZ_SSE(_mm_load_ps(in));
+        const __m128 xyz = dt_Lab_to_XYZ_sse2(_mm_load_ps(in));
         const __m128 t = _mm_add_ps(_mm_mul_ps(m0,_mm_shuffle_ps(xyz,xyz,_MM_SHUFFLE(0,0,0,0))),_mm_add_ps(_mm_mul_ps(m1,_mm_shuffle_ps(xyz,xyz,_MM_SHUFFLE(1,1,1,1))),_mm_mul_ps(m2,_mm_shuffle_ps(xyz,xyz,_MM_SHUFFLE(2,2,2,2)))));
 
         _mm_stream_ps(out,t);
@@ -428,6 +425,20 @@ process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoi
       }
     }
   }
+  else if(d->clut.table && ch == 4)
+  {
+    // lcms2 transform, baked into a 3d lut
+    const float *const in  = (const float*)ivoid;
+    float *const out = (float*)ovoid;
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) default(none) shared(roi_out, d)
+#endif
+    for (int k=0; k<roi_out->height; k++)
+    {
+      const size_t m = (size_t)k*roi_out->width*ch;
+      dt_colorspaces_apply_clut(&d->clut, in + m, out + m, roi_out->width);
+    }
+  }
   else
   {
     float *in  = (float*)ivoid;
@@ -546,6 +557,7 @@ void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pi
     cmsDeleteTransform(d->xform);
     d->xform = 0;
   }
+  dt_colorspaces_cleanup_clut(&d->clut);
   d->cmatrix[0] = NAN;
   d->lut[0][0] = -1.0f;
   d->lut[1][0] = -1.0f;
@@ -631,6 +643,15 @@ void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pi
     }
   }
 
+  // bake the lcms2 transform into a 3d lut over the Lab range, this runs on all threads and on
+  // the gpu. high quality export and gamut check (which needs the alarm codes) stay exact.
+  if(d->xform && !high_quality_processing && d->softproof_enabled != DT_SOFTPROOF_GAMUTCHECK)
+  {
+    const float min[3] = { 0.0f, -128.0f, -128.0f }, max[3] = { 100.0f, 128.0f, 128.0f };
+    if(!dt_colorspaces_create_clut(&d->clut, d->xform, min, max, 0))
+      piece->process_cl_ready = 1;
+  }
+
   // now try to initialize unbounded mode:
   // we do extrapolation for input values above 1.0f.
   // unfortunately we can only do this if we got the computation
@@ -663,6 +684,7 @@ void init_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_p
   d->softproof_enabled = 0;
   d->softproof = d->output = NULL;
   d->xform = 0;
+  d->clut.table = NULL;
   d->Lab = dt_colorspaces_create_lab_profile();
   self->commit_params(self, self->default_params, pipe, piece);
 }
@@ -677,6 +699,7 @@ void cleanup_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_de
     cmsDeleteTransform(d->xform);
     d->xform = 0;
   }
+  dt_colorspaces_cleanup_clut(&d->clut);
 
   free(piece->data);
 }
@@ -35,6 +35,7 @@ dt_iop_colorout_softproof_t;
 typedef struct dt_iop_colorout_global_data_t
 {
   int kernel_colorout;
+  int kernel_colorout_clut;
 }
 dt_iop_colorout_global_data_t;
 
@@ -70,6 +71,7 @@ typedef struct dt_iop_colorout_data_t
   cmsHPROFILE output;
   cmsHPROFILE Lab;
   cmsHTRANSFORM *xform;
+  dt_colorspaces_clut_t clut;         // xform baked into a 3d lut, if there is one
   float unbounded_coeffs[3][3];       // for extrapolation of shaper curves
 }
 dt_iop_colorout_data_t;
@@ -21,8 +21,10 @@
 #include "common/colorspaces.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
+#include "develop/pixelpipe_cache.h"
 #include "control/control.h"
-#include "common/points.h"
+#include "common/kmeans.h"
+#include "common/opencl.h"
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
 #include "dtgtk/button.h"
@@ -49,7 +51,9 @@
 DT_MODULE(1)
 
 #define HISTN (1<<11)
-#define MAXN 5
+#define MAXN DT_KMEANS_MAXN
+// input statistics kept for the pipes of the same image and history:
+#define STATS_CACHE 4
 
 typedef enum dt_iop_colortransfer_flag_t
 {
@@ -100,6 +104,25 @@ typedef struct dt_iop_colortransfer_data_t
 }
 dt_iop_colortransfer_data_t;
 
+/** histogram and clusters of the input, which the mapping is computed from. */
+typedef struct dt_iop_colortransfer_stats_t
+{
+  uint64_t hash;
+  int hist[HISTN];
+  float mean[MAXN][2];
+  float var [MAXN][2];
+}
+dt_iop_colortransfer_stats_t;
+
+typedef struct dt_iop_colortransfer_global_data_t
+{
+  int kernel_mapping;
+  dt_pthread_mutex_t lock;
+  int next;
+  dt_iop_colortransfer_stats_t stats[STATS_CACHE];
+}
+dt_iop_colortransfer_global_data_t;
+
 const char *name()
 {
   return _("color transfer");
@@ -134,13 +157,13 @@ void connect_key_accels(dt_iop_module_t *self)
 #endif
 
 static void
-capture_histogram(const float *col, const dt_iop_roi_t *roi, int *hist)
+capture_histogram(const float *col, const dt_iop_roi_t *roi, const int ch, int *hist)
 {
   // build separate histogram
   memset(hist,0, HISTN*sizeof(int));
   for(int k=0; k<roi->height; k++) for(int i=0; i<roi->width; i++)
     {
-      const int bin = CLAMP(HISTN*col[3*(k*roi->width+i)+0]/100.0, 0, HISTN-1);
+      const int bin = CLAMP(HISTN*col[ch*(k*roi->width+i)+0]/100.0, 0, HISTN-1);
       hist[bin]++;
     }
 
@@ -217,105 +240,81 @@ get_clusters(const float *col, const int n, float mean[n][2], float *weight)
   if(sum > 0) for(int k=0; k<n; k++) weight[k] /= sum;
 }
 
+static void
+kmeans(const float *col, const dt_iop_roi_t *roi, const int ch, const int n, float mean_out[n][2], float var_out[n][2])
+{
+  const int nit = 10; // number of iterations, at most
+  float weight[n];
+  dt_kmeans_ab(col, roi->width, roi->height, ch, n, nit, mean_out, var_out, weight);
+}
+
+/** the statistics of the input only depend on the image and the history up to this module, the
+  * pipes share them: the full pipe reuses what the preview found on the whole image, and isn't
+  * thrown off by the part of the image it happens to see. */
+static uint64_t
+get_stats_hash(dt_dev_pixelpipe_iop_t *piece, const int n)
+{
+  dt_dev_pixelpipe_t *pipe = piece->pipe;
+  const dt_iop_roi_t roi = { 0, 0, 0, 0, 1.0f };
+  const uint64_t hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, &roi, pipe, g_list_index(pipe->nodes, piece));
+  return ((hash << 5) + hash) ^ n;
+}
+
 static int
-get_cluster(const float *col, const int n, float mean[n][2])
+get_stats_cached(dt_iop_colortransfer_global_data_t *gd, const uint64_t hash, dt_iop_colortransfer_stats_t *stats)
 {
-  float mdist = FLT_MAX;
-  int cluster = 0;
-  for(int k=0; k<n; k++)
+  int found = 0;
+  dt_pthread_mutex_lock(&gd->lock);
+  for(int k=0; k<STATS_CACHE; k++)
   {
-    const float dist = (col[1]-mean[k][0])*(col[1]-mean[k][0]) + (col[2]-mean[k][1])*(col[2]-mean[k][1]);
-    if(dist < mdist)
+    if(gd->stats[k].hash == hash)
     {
-      mdist = dist;
-      cluster = k;
+      memcpy(stats, gd->stats + k, sizeof(dt_iop_colortransfer_stats_t));
+      found = 1;
+      break;
     }
   }
-  return cluster;
+  dt_pthread_mutex_unlock(&gd->lock);
+  return found;
 }
 
 static void
-kmeans(const float *col, const dt_iop_roi_t *roi, const int n, float mean_out[n][2], float var_out[n][2])
+get_stats(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *in, const dt_iop_roi_t *roi_in, dt_iop_colortransfer_stats_t *stats)
 {
-  // TODO: check params here:
-  const int nit = 10; // number of iterations
-  const int samples = roi->width*roi->height * 0.2; // samples: only a fraction of the buffer.
+  dt_iop_colortransfer_data_t *data = (dt_iop_colortransfer_data_t *)piece->data;
+  dt_iop_colortransfer_global_data_t *gd = (dt_iop_colortransfer_global_data_t *)self->data;
+  stats->hash = get_stats_hash(piece, data->n);
+  if(get_stats_cached(gd, stats->hash, stats)) return;
+
+  capture_histogram(in, roi_in, piece->colors, stats->hist);
+  kmeans(in, roi_in, piece->colors, data->n, stats->mean, stats->var);
+
+  // only pipes which see the whole image keep theirs:
+  if(piece->pipe->type == DT_DEV_PIXELPIPE_FULL) return;
+  dt_pthread_mutex_lock(&gd->lock);
+  memcpy(gd->stats + gd->next, stats, sizeof(dt_iop_colortransfer_stats_t));
+  gd->next = (gd->next + 1) % STATS_CACHE;
+  dt_pthread_mutex_unlock(&gd->lock);
+}
 
-  float mean[n][2], var[n][2];
-  int cnt[n];
+/** the transfer as luts and ratios, the same for cpu and gpu. */
+static void
+get_mapping(dt_iop_colortransfer_data_t *data, dt_iop_colortransfer_stats_t *stats, float *lut, int mapio[MAXN], float var_ratio[MAXN][2])
+{
+  // L: match histogram
+  for(int k=0; k<HISTN; k++) lut[k] = CLAMP(data->hist[stats->hist[k]], 0, 100);
 
-  // init n clusters for a, b channels at random
-  for(int k=0; k<n; k++)
-  {
-    mean_out[k][0] = 20.0f-40.0f*dt_points_get();
-    mean_out[k][1] = 20.0f-40.0f*dt_points_get();
-    var_out[k][0] = var_out[k][1] = 0.0f;
-    mean[k][0] = mean[k][1] = var[k][0] = var[k][1] = 0.0f;
-  }
-  for(int it=0; it<nit; it++)
-  {
-    for(int k=0; k<n; k++) cnt[k] = 0;
-    // randomly sample col positions inside roi
-#ifdef _OPENMP
-    #pragma omp parallel for default(none) schedule(static) shared(roi,col,var,mean,mean_out,cnt)
-#endif
-    for(int s=0; s<samples; s++)
-    {
-      const int j = dt_points_get()*roi->height, i = dt_points_get()*roi->width;
-      // for each sample: determine cluster, update new mean, update var
-      for(int k=0; k<n; k++)
-      {
-        const float L = col[3*(roi->width*j+i)];
-        const float Lab[3] = {L, col[3*(roi->width*j + i)+1], col[3*(roi->width*j + i)+2]};
-        // determine dist to mean_out
-        const int c = get_cluster(Lab, n, mean_out);
-#ifdef _OPENMP
-        #pragma omp atomic
-#endif
-        cnt[c]++;
-        // update mean, var
-#ifdef _OPENMP
-        #pragma omp atomic
-#endif
-        var[c][0]  += Lab[1]*Lab[1];
-#ifdef _OPENMP
-        #pragma omp atomic
-#endif
-        var[c][1]  += Lab[2]*Lab[2];
-#ifdef _OPENMP
-        #pragma omp atomic
-#endif
-        mean[c][0] += Lab[1];
-#ifdef _OPENMP
-        #pragma omp atomic
-#endif
-        mean[c][1] += Lab[2];
-      }
-    }
-    // swap old/new means
-    for(int k=0; k<n; k++)
-    {
-      if(cnt [k] == 0) continue;
-      mean_out[k][0] = mean[k][0]/cnt[k];
-      mean_out[k][1] = mean[k][1]/cnt[k];
-      var_out[k][0] = var[k][0]/cnt[k] - mean_out[k][0]*mean_out[k][0];
-      var_out[k][1] = var[k][1]/cnt[k] - mean_out[k][1]*mean_out[k][1];
-      mean[k][0] = mean[k][1] = var[k][0] = var[k][1] = 0.0f;
-    }
-    // printf("it %d  %d means:\n", it, n);
-    // for(int k=0;k<n;k++) printf("%f %f -- var %f %f\n", mean_out[k][0], mean_out[k][1], var_out[k][0], var_out[k][1]);
-  }
-  for(int k=0; k<n; k++)
+  // get mapping from input clusters to target clusters
+  get_cluster_mapping(data->n, stats->mean, data->mean, mapio);
+  for(int c=0; c<data->n; c++)
   {
-    // we actually want the std deviation.
-    var_out[k][0] = sqrtf(var_out[k][0]);
-    var_out[k][1] = sqrtf(var_out[k][1]);
+    var_ratio[c][0] = (stats->var[c][0] > 0.0f) ? data->var[mapio[c]][0]/stats->var[c][0] : 0.0f;
+    var_ratio[c][1] = (stats->var[c][1] > 0.0f) ? data->var[mapio[c]][1]/stats->var[c][1] : 0.0f;
   }
 }
 
 void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
-  // FIXME: this returns nan!!
   dt_iop_colortransfer_data_t *data = (dt_iop_colortransfer_data_t *)piece->data;
   float *in  = (float *)ivoid;
   float *out = (float *)ovoid;
@@ -328,12 +327,12 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
       // only get stuff from the preview pipe, rest stays untouched.
       int hist[HISTN];
       // get histogram of L
-      capture_histogram(in, roi_in, hist);
+      capture_histogram(in, roi_in, ch, hist);
       // invert histogram of L
       invert_histogram(hist, data->hist);
 
       // get n clusters
-      kmeans(in, roi_in, data->n, data->mean, data->var);
+      kmeans(in, roi_in, ch, data->n, data->mean, data->var);
 
       // notify gui that commit_params should let stuff flow back!
       data->flag = ACQUIRED;
@@ -345,34 +344,17 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   else if(data->flag == APPLY)
   {
     // apply histogram of L and clustering of (a,b)
-    int hist[HISTN];
-    capture_histogram(in, roi_in, hist);
-#ifdef _OPENMP
-    #pragma omp parallel for default(none) schedule(static) shared(roi_out,data,in,out,hist)
-#endif
-    for(int k=0; k<roi_out->height; k++)
-    {
-      int j = ch*roi_out->width*k;
-      for(int i=0; i<roi_out->width; i++)
-      {
-        // L: match histogram
-        out[j] = data->hist[hist[(int)CLAMP(HISTN*in[j]/100.0, 0, HISTN-1)]];
-        out[j] = CLAMP(out[j], 0, 100);
-        j+=ch;
-      }
-    }
-
-    // cluster input buffer
-    float mean[data->n][2], var[data->n][2];
-    kmeans(in, roi_in, data->n, mean, var);
+    dt_iop_colortransfer_stats_t stats;
+    get_stats(self, piece, in, roi_in, &stats);
 
-    // get mapping from input clusters to target clusters
-    int mapio[data->n];
-    get_cluster_mapping(data->n, mean, data->mean, mapio);
+    float lut[HISTN];
+    int mapio[MAXN];
+    float var_ratio[MAXN][2];
+    get_mapping(data, &stats, lut, mapio, var_ratio);
 
     // for all pixels: find input cluster, transfer to mapped target cluster
 #ifdef _OPENMP
-    #pragma omp parallel for default(none) schedule(static) shared(roi_out,data,mean,var,mapio,in,out)
+    #pragma omp parallel for default(none) schedule(static) shared(roi_out,data,stats,lut,var_ratio,mapio,in,out)
 #endif
     for(int k=0; k<roi_out->height; k++)
     {
@@ -380,22 +362,16 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
       int j = ch*roi_out->width*k;
       for(int i=0; i<roi_out->width; i++)
       {
-        const float L = in[j];
-        const float Lab[3] = {L, in[j+1], in[j+2]};
-        // a, b: subtract mean, scale nvar/var, add nmean
-#if 0   // single cluster, gives color banding
-        const int ki = get_cluster(in + j, data->n, mean);
-        out[j+1] = 100.0/out[j] * ((Lab[1] - mean[ki][0])*data->var[mapio[ki]][0]/var[ki][0] + data->mean[mapio[ki]][0]);
-        out[j+2] = 100.0/out[j] * ((Lab[2] - mean[ki][1])*data->var[mapio[ki]][1]/var[ki][1] + data->mean[mapio[ki]][1]);
-#else   // fuzzy weighting
-        get_clusters(in+j, data->n, mean, weight);
+        // L: match histogram
+        out[j] = lut[(int)CLAMP(HISTN*in[j]/100.0, 0, HISTN-1)];
+        // a, b: subtract mean, scale nvar/var, add nmean, fuzzy weighting
+        get_clusters(in+j, data->n, stats.mean, weight);
         out[j+1] = out[j+2] = 0.0f;
         for(int c=0; c<data->n; c++)
         {
-          out[j+1] += weight[c] * ((Lab[1] - mean[c][0])*data->var[mapio[c]][0]/var[c][0] + data->mean[mapio[c]][0]);
-          out[j+2] += weight[c] * ((Lab[2] - mean[c][1])*data->var[mapio[c]][1]/var[c][1] + data->mean[mapio[c]][1]);
+          out[j+1] += weight[c] * ((in[j+1] - stats.mean[c][0])*var_ratio[c][0] + data->mean[mapio[c]][0]);
+          out[j+2] += weight[c] * ((in[j+2] - stats.mean[c][1])*var_ratio[c][1] + data->mean[mapio[c]][1]);
         }
-#endif
         out[j+3] = in[j+3];
         j+=ch;
       }
@@ -407,6 +383,97 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   }
 }
 
+#ifdef HAVE_OPENCL
+int
+process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_iop_colortransfer_data_t *data = (dt_iop_colortransfer_data_t *)piece->data;
+  dt_iop_colortransfer_global_data_t *gd = (dt_iop_colortransfer_global_data_t *)self->data;
+
+  cl_int err = -999;
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+
+  float *in = NULL;
+  cl_mem dev_lut = NULL;
+  cl_mem dev_mean = NULL;
+  cl_mem dev_target_mean = NULL;
+  cl_mem dev_var_ratio = NULL;
+  cl_mem dev_mapio = NULL;
+
+  // acquiring is done by the preview pipe, which runs on the cpu.
+  if(data->flag != APPLY)
+  {
+    size_t origin[] = { 0, 0, 0};
+    size_t region[] = { width, height, 1};
+    err = dt_opencl_enqueue_copy_image(devid, dev_in, dev_out, origin, origin, region);
+    if (err != CL_SUCCESS) goto error;
+    return TRUE;
+  }
+
+  // the statistics of the input are computed on the cpu, if no other pipe did so already:
+  dt_iop_colortransfer_stats_t stats;
+  if(!get_stats_cached(gd, get_stats_hash(piece, data->n), &stats))
+  {
+    in = dt_alloc_align(64, (size_t)width*height*4*sizeof(float));
+    if(in == NULL) goto error;
+    err = dt_opencl_copy_device_to_host(devid, in, dev_in, width, height, 4*sizeof(float));
+    if(err != CL_SUCCESS) goto error;
+    get_stats(self, piece, in, roi_in, &stats);
+    free(in);
+    in = NULL;
+  }
+
+  float lut[HISTN];
+  int mapio[MAXN];
+  float var_ratio[MAXN][2];
+  get_mapping(data, &stats, lut, mapio, var_ratio);
+
+  dev_lut = dt_opencl_copy_host_to_device_constant(devid, sizeof(float)*HISTN, lut);
+  if (dev_lut == NULL) goto error;
+  dev_mean = dt_opencl_copy_host_to_device_constant(devid, sizeof(float)*MAXN*2, stats.mean);
+  if (dev_mean == NULL) goto error;
+  dev_target_mean = dt_opencl_copy_host_to_device_constant(devid, sizeof(float)*MAXN*2, data->mean);
+  if (dev_target_mean == NULL) goto error;
+  dev_var_ratio = dt_opencl_copy_host_to_device_constant(devid, sizeof(float)*MAXN*2, var_ratio);
+  if (dev_var_ratio == NULL) goto error;
+  dev_mapio = dt_opencl_copy_host_to_device_constant(devid, sizeof(int)*MAXN, mapio);
+  if (dev_mapio == NULL) goto error;
+
+  size_t sizes[3] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_mapping, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_mapping, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_mapping, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_mapping, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_mapping, 4, sizeof(int), (void *)&data->n);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_mapping, 5, sizeof(cl_mem), (void *)&dev_lut);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_mapping, 6, sizeof(cl_mem), (void *)&dev_mean);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_mapping, 7, sizeof(cl_mem), (void *)&dev_target_mean);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_mapping, 8, sizeof(cl_mem), (void *)&dev_var_ratio);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_mapping, 9, sizeof(cl_mem), (void *)&dev_mapio);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_mapping, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_lut);
+  dt_opencl_release_mem_object(dev_mean);
+  dt_opencl_release_mem_object(dev_target_mean);
+  dt_opencl_release_mem_object(dev_var_ratio);
+  dt_opencl_release_mem_object(dev_mapio);
+  return TRUE;
+
+error:
+  free(in);
+  if (dev_lut != NULL) dt_opencl_release_mem_object(dev_lut);
+  if (dev_mean != NULL) dt_opencl_release_mem_object(dev_mean);
+  if (dev_target_mean != NULL) dt_opencl_release_mem_object(dev_target_mean);
+  if (dev_var_ratio != NULL) dt_opencl_release_mem_object(dev_var_ratio);
+  if (dev_mapio != NULL) dt_opencl_release_mem_object(dev_mapio);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_colortransfer] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
 #if 0
 static void
 spinbutton_changed (GtkSpinButton *button, dt_iop_module_t *self)
@@ -578,6 +645,24 @@ void cleanup(dt_iop_module_t *module)
   module->params = NULL;
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 8; // extended.cl, from programs.conf
+  dt_iop_colortransfer_global_data_t *gd = (dt_iop_colortransfer_global_data_t *)calloc(1, sizeof(dt_iop_colortransfer_global_data_t));
+  module->data = gd;
+  gd->kernel_mapping = dt_opencl_create_kernel(program, "colortransfer_mapping");
+  dt_pthread_mutex_init(&gd->lock, NULL);
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_colortransfer_global_data_t *gd = (dt_iop_colortransfer_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_mapping);
+  dt_pthread_mutex_destroy(&gd->lock);
+  free(module->data);
+  module->data = NULL;
+}
+
 #if 0
 static gboolean
 cluster_preview_expose (GtkWidget *widget, GdkEventExpose *event, dt_iop_module_t *self)
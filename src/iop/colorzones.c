@@ -19,6 +19,7 @@
 #include "config.h"
 #endif
 #include "common/colorspaces.h"
+#include "common/curve_lut.h"
 #include "common/darktable.h"
 #include "common/debug.h"
 #include "common/opencl.h"
@@ -40,7 +41,7 @@ DT_MODULE(3)
 #define DT_IOP_COLORZONES_INSET 5
 #define DT_IOP_COLORZONES_CURVE_INFL .3f
 #define DT_IOP_COLORZONES_RES 64
-#define DT_IOP_COLORZONES_LUT_RES 0x10000
+#define DT_IOP_COLORZONES_LUT_RES DT_CURVE_LUT_SIZE
 
 #define DT_IOP_COLORZONES_BANDS 8
 #define DT_IOP_COLORZONES1_BANDS 6
@@ -190,15 +191,6 @@ legacy_params (dt_iop_module_t *self, const void *const old_params, const int ol
   return 1;
 }
 
-static float
-lookup(const float *lut, const float i)
-{
-  const int bin0 = MIN(0xffff, MAX(0, (int)(DT_IOP_COLORZONES_LUT_RES * i)));
-  const int bin1 = MIN(0xffff, MAX(0, (int)(DT_IOP_COLORZONES_LUT_RES * i) + 1));
-  const float f = DT_IOP_COLORZONES_LUT_RES * i - bin0;
-  return lut[bin1]*f + lut[bin0]*(1.-f);
-}
-
 static float strength(float value, float strength)
 {
   return value + (value-0.5)*(strength/100.0);
@@ -232,15 +224,15 @@ process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, v
       default:
       case DT_IOP_COLORZONES_h:
         select = h;
-        blend = powf(1.0f - C/128.0f, 2.0f);
+        blend = (1.0f - C/128.0f)*(1.0f - C/128.0f);
         break;
     }
-    const float Lm =       (blend*.5f + (1.0f-blend)*lookup(d->lut[0], select)) - .5f;
-    const float hm =       (blend*.5f + (1.0f-blend)*lookup(d->lut[2], select)) - .5f;
+    const float Lm =       (blend*.5f + (1.0f-blend)*dt_curve_lut_lookup(d->lut[0], select)) - .5f;
+    const float hm =       (blend*.5f + (1.0f-blend)*dt_curve_lut_lookup(d->lut[2], select)) - .5f;
     blend *= blend; // saturation isn't as prone to artifacts:
-    // const float Cm = 2.0 * (blend*.5f + (1.0f-blend)*lookup(d->lut[1], select));
-    const float Cm = 2.0 * lookup(d->lut[1], select);
-    const float L = in[0] * powf(2.0f, 4.0f*Lm);
+    // const float Cm = 2.0 * (blend*.5f + (1.0f-blend)*dt_curve_lut_lookup(d->lut[1], select));
+    const float Cm = 2.0 * dt_curve_lut_lookup(d->lut[1], select);
+    const float L = in[0] * exp2f(4.0f*Lm);
     out[0] = L;
     out[1] = cosf(2.0*M_PI*(h + hm)) * Cm * C;
     out[2] = sinf(2.0*M_PI*(h + hm)) * Cm * C;
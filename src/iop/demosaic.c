@@ -31,6 +31,9 @@
 
 // we assume people have -msee support.
 #include <xmmintrin.h>
+#ifdef DT_AVX2_CODEPATH
+#include <immintrin.h>
+#endif
 
 #define BLOCKSIZE  2048		/* maximum blocksize. must be a power of 2 and will be automatically reduced if needed */
 
@@ -67,6 +70,17 @@ typedef struct dt_iop_demosaic_global_data_t
   int kernel_downsample;
   int kernel_border_interpolate;
   int kernel_color_smoothing;
+  int kernel_amaze_init;
+  int kernel_amaze_rbint;
+  int kernel_amaze_cd;
+  int kernel_amaze_cdvar;
+  int kernel_amaze_hvwt;
+  int kernel_amaze_nyquist;
+  int kernel_amaze_area;
+  int kernel_amaze_green;
+  int kernel_amaze_refine;
+  int kernel_amaze_chroma;
+  int kernel_amaze_output;
 }
 dt_iop_demosaic_global_data_t;
 
@@ -407,6 +421,138 @@ green_equilibration_favg(float *out, const float *const in, const int width, con
   }
 }
 
+/** ppg green pass on the pixels [i0, i1) of row j: copies the sample into its channel and
+  * interpolates green for red and blue pixels. buf and buf_in point to pixel i0. */
+static void
+ppg_green_row(float *buf, const float *buf_in, const int in_width, const int j, const int i0, const int i1, const int filters)
+{
+  for (int i=i0; i < i1; i++)
+  {
+    const int c = FC(j,i,filters);
+    // prefetch what we need soon (load to cpu caches)
+    _mm_prefetch((char *)buf_in + 256, _MM_HINT_NTA); // TODO: try HINT_T0-3
+    _mm_prefetch((char *)buf_in +   in_width + 256, _MM_HINT_NTA);
+    _mm_prefetch((char *)buf_in + 2*in_width + 256, _MM_HINT_NTA);
+    _mm_prefetch((char *)buf_in + 3*in_width + 256, _MM_HINT_NTA);
+    _mm_prefetch((char *)buf_in -   in_width + 256, _MM_HINT_NTA);
+    _mm_prefetch((char *)buf_in - 2*in_width + 256, _MM_HINT_NTA);
+    _mm_prefetch((char *)buf_in - 3*in_width + 256, _MM_HINT_NTA);
+    __m128 col = _mm_load_ps(buf);
+    float *color = (float*)&col;
+    const float pc = buf_in[0];
+    // if(__builtin_expect(c == 0 || c == 2, 1))
+    if(c == 0 || c == 2)
+    {
+      color[c] = pc;
+      // get stuff (hopefully from cache)
+      const float pym  = buf_in[ - in_width*1];
+      const float pym2 = buf_in[ - in_width*2];
+      const float pym3 = buf_in[ - in_width*3];
+      const float pyM  = buf_in[ + in_width*1];
+      const float pyM2 = buf_in[ + in_width*2];
+      const float pyM3 = buf_in[ + in_width*3];
+      const float pxm  = buf_in[ - 1];
+      const float pxm2 = buf_in[ - 2];
+      const float pxm3 = buf_in[ - 3];
+      const float pxM  = buf_in[ + 1];
+      const float pxM2 = buf_in[ + 2];
+      const float pxM3 = buf_in[ + 3];
+
+      const float guessx = (pxm + pc + pxM) * 2.0f - pxM2 - pxm2;
+      const float diffx  = (fabsf(pxm2 - pc) +
+                            fabsf(pxM2 - pc) +
+                            fabsf(pxm  - pxM)) * 3.0f +
+                           (fabsf(pxM3 - pxM) + fabsf(pxm3 - pxm)) * 2.0f;
+      const float guessy = (pym + pc + pyM) * 2.0f - pyM2 - pym2;
+      const float diffy  = (fabsf(pym2 - pc) +
+                            fabsf(pyM2 - pc) +
+                            fabsf(pym  - pyM)) * 3.0f +
+                           (fabsf(pyM3 - pyM) + fabsf(pym3 - pym)) * 2.0f;
+      if(diffx > diffy)
+      {
+        // use guessy
+        const float m = fminf(pym, pyM);
+        const float M = fmaxf(pym, pyM);
+        color[1] = fmaxf(fminf(guessy*.25f, M), m);
+      }
+      else
+      {
+        const float m = fminf(pxm, pxM);
+        const float M = fmaxf(pxm, pxM);
+        color[1] = fmaxf(fminf(guessx*.25f, M), m);
+      }
+    }
+    else color[1] = pc;
+
+    // write using MOVNTPS (write combine omitting caches)
+    // _mm_stream_ps(buf, col);
+    memcpy(buf, color, 4*sizeof(float));
+    buf += 4;
+    buf_in ++;
+  }
+}
+
+#ifdef DT_AVX2_CODEPATH
+/** the same on eight pixels at a time: the guesses come out of plain row loads, only the
+  * result is written to the pixels one by one. the operations are the same, and so are the results. */
+DT_TARGET_AVX2 static void
+ppg_green_row_avx2(float *buf, const float *buf_in, const int in_width, const int j, const int i0, const int i1, const int filters)
+{
+  const __m256 two = _mm256_set1_ps(2.0f), three = _mm256_set1_ps(3.0f), quarter = _mm256_set1_ps(.25f);
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+#define ABS(a) _mm256_andnot_ps(sign, (a))
+  int i = i0;
+  for (; i+8 <= i1; i+=8)
+  {
+    const __m256 pc   = _mm256_loadu_ps(buf_in);
+    const __m256 pym  = _mm256_loadu_ps(buf_in - in_width*1);
+    const __m256 pym2 = _mm256_loadu_ps(buf_in - in_width*2);
+    const __m256 pym3 = _mm256_loadu_ps(buf_in - in_width*3);
+    const __m256 pyM  = _mm256_loadu_ps(buf_in + in_width*1);
+    const __m256 pyM2 = _mm256_loadu_ps(buf_in + in_width*2);
+    const __m256 pyM3 = _mm256_loadu_ps(buf_in + in_width*3);
+    const __m256 pxm  = _mm256_loadu_ps(buf_in - 1);
+    const __m256 pxm2 = _mm256_loadu_ps(buf_in - 2);
+    const __m256 pxm3 = _mm256_loadu_ps(buf_in - 3);
+    const __m256 pxM  = _mm256_loadu_ps(buf_in + 1);
+    const __m256 pxM2 = _mm256_loadu_ps(buf_in + 2);
+    const __m256 pxM3 = _mm256_loadu_ps(buf_in + 3);
+
+    const __m256 guessx = _mm256_sub_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(pxm, pc), pxM), two), pxM2), pxm2);
+    const __m256 diffx  = _mm256_add_ps(
+        _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(ABS(_mm256_sub_ps(pxm2, pc)), ABS(_mm256_sub_ps(pxM2, pc))), ABS(_mm256_sub_ps(pxm, pxM))), three),
+        _mm256_mul_ps(_mm256_add_ps(ABS(_mm256_sub_ps(pxM3, pxM)), ABS(_mm256_sub_ps(pxm3, pxm))), two));
+    const __m256 guessy = _mm256_sub_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(pym, pc), pyM), two), pyM2), pym2);
+    const __m256 diffy  = _mm256_add_ps(
+        _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(ABS(_mm256_sub_ps(pym2, pc)), ABS(_mm256_sub_ps(pyM2, pc))), ABS(_mm256_sub_ps(pym, pyM))), three),
+        _mm256_mul_ps(_mm256_add_ps(ABS(_mm256_sub_ps(pyM3, pyM)), ABS(_mm256_sub_ps(pym3, pym))), two));
+
+    const __m256 gy = _mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(guessy, quarter), _mm256_max_ps(pym, pyM)), _mm256_min_ps(pym, pyM));
+    const __m256 gx = _mm256_max_ps(_mm256_min_ps(_mm256_mul_ps(guessx, quarter), _mm256_max_ps(pxm, pxM)), _mm256_min_ps(pxm, pxM));
+    const __m256 green = _mm256_blendv_ps(gx, gy, _mm256_cmp_ps(diffx, diffy, _CMP_GT_OQ));
+
+    float g[8] __attribute__((aligned(32)));
+    float p[8] __attribute__((aligned(32)));
+    _mm256_store_ps(g, green);
+    _mm256_store_ps(p, pc);
+    for (int k=0; k<8; k++)
+    {
+      const int c = FC(j,i+k,filters);
+      if(c == 0 || c == 2)
+      {
+        buf[4*k+c] = p[k];
+        buf[4*k+1] = g[k];
+      }
+      else buf[4*k+1] = p[k];
+    }
+    buf += 32;
+    buf_in += 8;
+  }
+#undef ABS
+  ppg_green_row(buf, buf_in, in_width, j, i, i1, filters);
+}
+#endif
+
 /** 1:1 demosaic from in to out, in is full buf, out is translated/cropped (scale == 1.0!) */
 static void
 demosaic_ppg(float *out, const float *in, dt_iop_roi_t *roi_out, const dt_iop_roi_t *roi_in, const int filters, const float thrs)
@@ -456,77 +602,18 @@ demosaic_ppg(float *out, const float *in, dt_iop_roi_t *roi_out, const dt_iop_ro
     in = med_in;
   }
   // for all pixels: interpolate green into float array, or copy color.
+  void (*green_row)(float *, const float *, const int, const int, const int, const int, const int) = ppg_green_row;
+#ifdef DT_AVX2_CODEPATH
+  if(dt_codepath_avx2()) green_row = ppg_green_row_avx2;
+#endif
 #ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(roi_in, roi_out, in, out) schedule(static)
+  #pragma omp parallel for default(none) shared(roi_in, roi_out, in, out, green_row) schedule(static)
 #endif
   for (int j=offy; j < roi_out->height-offY; j++)
   {
     float *buf = out + 4*roi_out->width*j + 4*offx;
     const float *buf_in = in + roi_in->width*(j + roi_out->y) + offx + roi_out->x;
-    for (int i=offx; i < roi_out->width-offX; i++)
-    {
-      const int c = FC(j,i,filters);
-      // prefetch what we need soon (load to cpu caches)
-      _mm_prefetch((char *)buf_in + 256, _MM_HINT_NTA); // TODO: try HINT_T0-3
-      _mm_prefetch((char *)buf_in +   roi_in->width + 256, _MM_HINT_NTA);
-      _mm_prefetch((char *)buf_in + 2*roi_in->width + 256, _MM_HINT_NTA);
-      _mm_prefetch((char *)buf_in + 3*roi_in->width + 256, _MM_HINT_NTA);
-      _mm_prefetch((char *)buf_in -   roi_in->width + 256, _MM_HINT_NTA);
-      _mm_prefetch((char *)buf_in - 2*roi_in->width + 256, _MM_HINT_NTA);
-      _mm_prefetch((char *)buf_in - 3*roi_in->width + 256, _MM_HINT_NTA);
-      __m128 col = _mm_load_ps(buf);
-      float *color = (float*)&col;
-      const float pc = buf_in[0];
-      // if(__builtin_expect(c == 0 || c == 2, 1))
-      if(c == 0 || c == 2)
-      {
-        color[c] = pc;
-        // get stuff (hopefully from cache)
-        const float pym  = buf_in[ - roi_in->width*1];
-        const float pym2 = buf_in[ - roi_in->width*2];
-        const float pym3 = buf_in[ - roi_in->width*3];
-        const float pyM  = buf_in[ + roi_in->width*1];
-        const float pyM2 = buf_in[ + roi_in->width*2];
-        const float pyM3 = buf_in[ + roi_in->width*3];
-        const float pxm  = buf_in[ - 1];
-        const float pxm2 = buf_in[ - 2];
-        const float pxm3 = buf_in[ - 3];
-        const float pxM  = buf_in[ + 1];
-        const float pxM2 = buf_in[ + 2];
-        const float pxM3 = buf_in[ + 3];
-
-        const float guessx = (pxm + pc + pxM) * 2.0f - pxM2 - pxm2;
-        const float diffx  = (fabsf(pxm2 - pc) +
-                              fabsf(pxM2 - pc) +
-                              fabsf(pxm  - pxM)) * 3.0f +
-                             (fabsf(pxM3 - pxM) + fabsf(pxm3 - pxm)) * 2.0f;
-        const float guessy = (pym + pc + pyM) * 2.0f - pyM2 - pym2;
-        const float diffy  = (fabsf(pym2 - pc) +
-                              fabsf(pyM2 - pc) +
-                              fabsf(pym  - pyM)) * 3.0f +
-                             (fabsf(pyM3 - pyM) + fabsf(pym3 - pym)) * 2.0f;
-        if(diffx > diffy)
-        {
-          // use guessy
-          const float m = fminf(pym, pyM);
-          const float M = fmaxf(pym, pyM);
-          color[1] = fmaxf(fminf(guessy*.25f, M), m);
-        }
-        else
-        {
-          const float m = fminf(pxm, pxM);
-          const float M = fmaxf(pxm, pxM);
-          color[1] = fmaxf(fminf(guessx*.25f, M), m);
-        }
-      }
-      else color[1] = pc;
-
-      // write using MOVNTPS (write combine omitting caches)
-      // _mm_stream_ps(buf, col);
-      memcpy(buf, color, 4*sizeof(float));
-      buf += 4;
-      buf_in ++;
-    }
+    green_row(buf, buf_in, roi_in->width, j, offx, roi_out->width-offX, filters);
   }
   // SFENCE (make sure stuff is stored now)
   // _mm_sfence();
@@ -652,6 +739,22 @@ static int get_quality()
   return qual;
 }
 
+// whether the image has to be demosaiced at full resolution before it is scaled down to roi_out,
+// as opposed to sampling the half size image straight from the mosaic.
+static int _demosaic_full(const dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_out, const int qual)
+{
+  if(roi_out->scale > .5f) return 1;                                           // also covers roi_out->scale >1
+  if(piece->pipe->type == DT_DEV_PIXELPIPE_FULL && qual > 0) return 1;         // or in darkroom mode and quality requested by user settings
+  if(piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT)
+  {
+    // exports that come out much smaller than the sensor won't show the difference,
+    // below the scale set by the user the half size path is used for them too.
+    const float half_size = dt_conf_get_float("plugins/lighttable/export/half_size_demosaic_scale");
+    return roi_out->scale > fminf(half_size, .5f);
+  }
+  return 0;
+}
+
 void
 process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
@@ -671,7 +774,16 @@ process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, v
   if(piece->pipe->type == DT_DEV_PIXELPIPE_FULL && qual < 2) // only overwrite setting if quality << requested and in dr mode
     demosaicing_method = DT_IOP_DEMOSAIC_PPG;
 
-  const float *const pixels = (float *)i;
+  // a uint16 mosaic is unpacked once, the algorithms all work on floats:
+  const size_t raw16_size = piece->pipe->raw16 ? sizeof(float)*roi_in->width*roi_in->height : 0;
+  float *raw16 = NULL;
+  if(raw16_size)
+  {
+    raw16 = (float *)dt_iop_scratch_alloc(piece, raw16_size);
+    if(!raw16) return;
+    dt_iop_raw16_unpack(raw16, (const uint16_t *)i, (size_t)roi_in->width*roi_in->height);
+  }
+  const float *const pixels = raw16 ? raw16 : (float *)i;
   if(roi_out->scale > .99999f && roi_out->scale < 1.00001f)
   {
     // output 1:1
@@ -710,9 +822,7 @@ process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, v
         amaze_demosaic_RT(self, piece, pixels, (float *)o, &roi, &roo, data->filters);
     }
   }
-  else if(roi_out->scale > .5f ||                                      // also covers roi_out->scale >1
-          (piece->pipe->type == DT_DEV_PIXELPIPE_FULL && qual > 0) ||  // or in darkroom mode and quality requested by user settings
-          (piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT))              // we assume you always want that for exports.
+  else if(_demosaic_full(piece, roi_out, qual))
   {
     // demosaic and then clip and zoom
     // roo.x = roi_out->x / global_scale;
@@ -776,10 +886,172 @@ process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, v
     else
       dt_iop_clip_and_zoom_demosaic_half_size_f((float *)o, pixels, &roo, &roi, roo.width, roi.width, data->filters, clip);
   }
+  dt_iop_scratch_free(piece, raw16, raw16_size);
   if(data->color_smoothing) color_smoothing(o, roi_out, data->color_smoothing);
 }
 
 #ifdef HAVE_OPENCL
+// AMaZE on the full resolution mosaic in dev_in, writes the rgb image to dev_out.
+// the passes of amaze_demosaic_RT.cc are kernels on full size intermediate buffers.
+static cl_int
+_amaze_demosaic_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
+                   const int width, const int height)
+{
+  dt_iop_demosaic_data_t *data = (dt_iop_demosaic_data_t *)piece->data;
+  dt_iop_demosaic_global_data_t *gd = (dt_iop_demosaic_global_data_t *)self->data;
+  const int devid = piece->pipe->devid;
+  const float clip_pt = fminf(piece->pipe->processed_maximum[0], fminf(piece->pipe->processed_maximum[1], piece->pipe->processed_maximum[2]));
+  const int npixels = width*height;
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  cl_int err = -999;
+
+  // buffers are reused once their pass is done: rb -> dgrb2, pmwt -> hvwt2, cd -> dgrb, dgint -> dgrb0
+  cl_mem dev_dirwts = dt_opencl_alloc_device_buffer(devid, npixels*2*sizeof(float));
+  cl_mem dev_rb = dt_opencl_alloc_device_buffer(devid, npixels*2*sizeof(float));
+  cl_mem dev_pmwt = dt_opencl_alloc_device_buffer(devid, npixels*sizeof(float));
+  cl_mem dev_rbint = dt_opencl_alloc_device_buffer(devid, npixels*2*sizeof(float));
+  cl_mem dev_cd = dt_opencl_alloc_device_buffer(devid, npixels*4*sizeof(float));
+  cl_mem dev_dgint = dt_opencl_alloc_device_buffer(devid, npixels*2*sizeof(float));
+  cl_mem dev_cdf = dt_opencl_alloc_device_buffer(devid, npixels*4*sizeof(float));
+  cl_mem dev_hvwt = dt_opencl_alloc_device_buffer(devid, npixels*sizeof(float));
+  cl_mem dev_nyquist = dt_opencl_alloc_device_buffer(devid, npixels*sizeof(char));
+  cl_mem dev_nyquist2 = dt_opencl_alloc_device_buffer(devid, npixels*sizeof(char));
+  if(dev_dirwts == NULL || dev_rb == NULL || dev_pmwt == NULL || dev_rbint == NULL || dev_cd == NULL ||
+     dev_dgint == NULL || dev_cdf == NULL || dev_hvwt == NULL || dev_nyquist == NULL || dev_nyquist2 == NULL) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_init, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_init, 1, sizeof(cl_mem), (void *)&dev_dirwts);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_init, 2, sizeof(cl_mem), (void *)&dev_rb);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_init, 3, sizeof(cl_mem), (void *)&dev_pmwt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_init, 4, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_init, 5, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_init, 6, sizeof(uint32_t), (void *)&data->filters);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_init, 7, sizeof(float), (void *)&clip_pt);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_init, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_rbint, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_rbint, 1, sizeof(cl_mem), (void *)&dev_rb);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_rbint, 2, sizeof(cl_mem), (void *)&dev_pmwt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_rbint, 3, sizeof(cl_mem), (void *)&dev_rbint);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_rbint, 4, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_rbint, 5, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_rbint, 6, sizeof(uint32_t), (void *)&data->filters);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_rbint, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_cd, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_cd, 1, sizeof(cl_mem), (void *)&dev_dirwts);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_cd, 2, sizeof(cl_mem), (void *)&dev_cd);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_cd, 3, sizeof(cl_mem), (void *)&dev_dgint);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_cd, 4, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_cd, 5, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_cd, 6, sizeof(uint32_t), (void *)&data->filters);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_cd, 7, sizeof(float), (void *)&clip_pt);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_cd, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_cdvar, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_cdvar, 1, sizeof(cl_mem), (void *)&dev_cd);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_cdvar, 2, sizeof(cl_mem), (void *)&dev_cdf);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_cdvar, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_cdvar, 4, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_cdvar, 5, sizeof(uint32_t), (void *)&data->filters);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_cdvar, 6, sizeof(float), (void *)&clip_pt);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_cdvar, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 1, sizeof(cl_mem), (void *)&dev_dirwts);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 2, sizeof(cl_mem), (void *)&dev_cdf);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 3, sizeof(cl_mem), (void *)&dev_dgint);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 4, sizeof(cl_mem), (void *)&dev_hvwt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 5, sizeof(cl_mem), (void *)&dev_nyquist);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 6, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 7, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_hvwt, 8, sizeof(uint32_t), (void *)&data->filters);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_hvwt, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist, 0, sizeof(cl_mem), (void *)&dev_nyquist);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist, 1, sizeof(cl_mem), (void *)&dev_nyquist2);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_nyquist, 4, sizeof(uint32_t), (void *)&data->filters);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_nyquist, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_area, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_area, 1, sizeof(cl_mem), (void *)&dev_nyquist2);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_area, 2, sizeof(cl_mem), (void *)&dev_hvwt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_area, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_area, 4, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_area, 5, sizeof(uint32_t), (void *)&data->filters);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_area, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  // hvwt2 -> dev_pmwt, dgrb0 -> dev_dgint, dgrb2 -> dev_rb
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_green, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_green, 1, sizeof(cl_mem), (void *)&dev_cdf);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_green, 2, sizeof(cl_mem), (void *)&dev_nyquist2);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_green, 3, sizeof(cl_mem), (void *)&dev_hvwt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_green, 4, sizeof(cl_mem), (void *)&dev_pmwt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_green, 5, sizeof(cl_mem), (void *)&dev_dgint);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_green, 6, sizeof(cl_mem), (void *)&dev_rb);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_green, 7, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_green, 8, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_green, 9, sizeof(uint32_t), (void *)&data->filters);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_green, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_refine, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_refine, 1, sizeof(cl_mem), (void *)&dev_dirwts);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_refine, 2, sizeof(cl_mem), (void *)&dev_cdf);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_refine, 3, sizeof(cl_mem), (void *)&dev_nyquist2);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_refine, 4, sizeof(cl_mem), (void *)&dev_pmwt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_refine, 5, sizeof(cl_mem), (void *)&dev_rbint);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_refine, 6, sizeof(cl_mem), (void *)&dev_rb);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_refine, 7, sizeof(cl_mem), (void *)&dev_dgint);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_refine, 8, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_refine, 9, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_refine, 10, sizeof(uint32_t), (void *)&data->filters);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_refine, 11, sizeof(float), (void *)&clip_pt);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_refine, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  // dgrb -> dev_cd
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_chroma, 0, sizeof(cl_mem), (void *)&dev_dgint);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_chroma, 1, sizeof(cl_mem), (void *)&dev_cd);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_chroma, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_chroma, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_chroma, 4, sizeof(uint32_t), (void *)&data->filters);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_chroma, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_output, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_output, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_output, 2, sizeof(cl_mem), (void *)&dev_pmwt);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_output, 3, sizeof(cl_mem), (void *)&dev_dgint);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_output, 4, sizeof(cl_mem), (void *)&dev_cd);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_output, 5, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_output, 6, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_amaze_output, 7, sizeof(uint32_t), (void *)&data->filters);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_amaze_output, sizes);
+
+error:
+  if(dev_dirwts != NULL) dt_opencl_release_mem_object(dev_dirwts);
+  if(dev_rb != NULL) dt_opencl_release_mem_object(dev_rb);
+  if(dev_pmwt != NULL) dt_opencl_release_mem_object(dev_pmwt);
+  if(dev_rbint != NULL) dt_opencl_release_mem_object(dev_rbint);
+  if(dev_cd != NULL) dt_opencl_release_mem_object(dev_cd);
+  if(dev_dgint != NULL) dt_opencl_release_mem_object(dev_dgint);
+  if(dev_cdf != NULL) dt_opencl_release_mem_object(dev_cdf);
+  if(dev_hvwt != NULL) dt_opencl_release_mem_object(dev_hvwt);
+  if(dev_nyquist != NULL) dt_opencl_release_mem_object(dev_nyquist);
+  if(dev_nyquist2 != NULL) dt_opencl_release_mem_object(dev_nyquist2);
+  return err;
+}
+
 int
 process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
             const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
@@ -790,6 +1062,10 @@ process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem
   const float threshold = 0.0001f * img->exif_iso;
 
   const int qual = get_quality();
+  int demosaicing_method = data->demosaicing_method;
+  if(piece->pipe->type == DT_DEV_PIXELPIPE_FULL && qual < 2) // only overwrite setting if quality << requested and in dr mode
+    demosaicing_method = DT_IOP_DEMOSAIC_PPG;
+
   const struct dt_interpolation* interpolation = dt_interpolation_new(DT_INTERPOLATION_USERPREF);
   if(interpolation->id != DT_INTERPOLATION_BILINEAR && roi_out->scale <= .99999f && roi_out->scale > 0.5f)
   {
@@ -832,59 +1108,65 @@ process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem
       dev_in = dev_green_eq;
     }
 
-    if(data->median_thrs > 0.0f)
+    if(demosaicing_method == DT_IOP_DEMOSAIC_AMAZE)
     {
-      const int one = 1;
-      dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 0, sizeof(cl_mem), &dev_in);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 1, sizeof(cl_mem), &dev_out);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 2, sizeof(int), &width);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 3, sizeof(int), &height);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 4, sizeof(uint32_t), (void*)&data->filters);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 5, sizeof(float), (void*)&data->median_thrs);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 6, sizeof(int), (void*)&one);
-      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_pre_median, sizes);
-      if(err != CL_SUCCESS) goto error;
-
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 0, sizeof(cl_mem), &dev_out);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 1, sizeof(cl_mem), &dev_out);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 2, sizeof(int), &width);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 3, sizeof(int), &height);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 4, sizeof(uint32_t), (void*)&data->filters);
-      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_ppg_green_median, sizes);
+      err = _amaze_demosaic_cl(self, piece, dev_in, dev_out, width, height);
       if(err != CL_SUCCESS) goto error;
     }
     else
     {
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 0, sizeof(cl_mem), &dev_in);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 1, sizeof(cl_mem), &dev_out);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 2, sizeof(int), &width);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 3, sizeof(int), &height);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 4, sizeof(uint32_t), (void*)&data->filters);
-      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_ppg_green, sizes);
-      if(err != CL_SUCCESS) goto error;
-    }
+      if(data->median_thrs > 0.0f)
+      {
+        const int one = 1;
+        dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 0, sizeof(cl_mem), &dev_in);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 1, sizeof(cl_mem), &dev_out);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 2, sizeof(int), &width);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 3, sizeof(int), &height);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 4, sizeof(uint32_t), (void*)&data->filters);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 5, sizeof(float), (void*)&data->median_thrs);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 6, sizeof(int), (void*)&one);
+        err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_pre_median, sizes);
+        if(err != CL_SUCCESS) goto error;
+
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 0, sizeof(cl_mem), &dev_out);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 1, sizeof(cl_mem), &dev_out);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 2, sizeof(int), &width);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 3, sizeof(int), &height);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 4, sizeof(uint32_t), (void*)&data->filters);
+        err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_ppg_green_median, sizes);
+        if(err != CL_SUCCESS) goto error;
+      }
+      else
+      {
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 0, sizeof(cl_mem), &dev_in);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 1, sizeof(cl_mem), &dev_out);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 2, sizeof(int), &width);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 3, sizeof(int), &height);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 4, sizeof(uint32_t), (void*)&data->filters);
+        err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_ppg_green, sizes);
+        if(err != CL_SUCCESS) goto error;
+      }
 
-    dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 0, sizeof(cl_mem), &dev_out);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 1, sizeof(cl_mem), &dev_out);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 2, sizeof(int), &width);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 3, sizeof(int), &height);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 4, sizeof(uint32_t), (void*)&data->filters);
-    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_ppg_redblue, sizes);
-    if(err != CL_SUCCESS) goto error;
+      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 0, sizeof(cl_mem), &dev_out);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 1, sizeof(cl_mem), &dev_out);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 2, sizeof(int), &width);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 3, sizeof(int), &height);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 4, sizeof(uint32_t), (void*)&data->filters);
+      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_ppg_redblue, sizes);
+      if(err != CL_SUCCESS) goto error;
 
-    // manage borders
-    dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 0, sizeof(cl_mem), &dev_in);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 1, sizeof(cl_mem), &dev_out);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 2, sizeof(int), (void*)&width);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 3, sizeof(int), (void*)&height);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 4, sizeof(uint32_t), (void*)&data->filters);
-    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_border_interpolate, sizes);
-    if(err != CL_SUCCESS) goto error;
+      // manage borders
+      dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 0, sizeof(cl_mem), &dev_in);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 1, sizeof(cl_mem), &dev_out);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 2, sizeof(int), (void*)&width);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 3, sizeof(int), (void*)&height);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 4, sizeof(uint32_t), (void*)&data->filters);
+      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_border_interpolate, sizes);
+      if(err != CL_SUCCESS) goto error;
+    }
 
   }
-  else if(roi_out->scale > .5f ||  // full needed because zoomed in enough
-          (piece->pipe->type == DT_DEV_PIXELPIPE_FULL && qual > 0) ||  // or in darkroom mode and quality requested by user settings
-          (piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT))              // we assume you always want that for exports.
+  else if(_demosaic_full(piece, roi_out, qual))
   {
     // need to scale to right res
     dev_tmp = dt_opencl_alloc_device(devid, roi_in->width, roi_in->height, 4*sizeof(float));
@@ -908,54 +1190,62 @@ process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem
       dev_in = dev_green_eq;
     }
 
-    if(data->median_thrs > 0.0f)
+    if(demosaicing_method == DT_IOP_DEMOSAIC_AMAZE)
     {
-      const int one = 1;
-      dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 0, sizeof(cl_mem), &dev_in);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 1, sizeof(cl_mem), &dev_tmp);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 2, sizeof(int), &width);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 3, sizeof(int), &height);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 4, sizeof(uint32_t), (void*)&data->filters);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 5, sizeof(float), (void*)&data->median_thrs);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 6, sizeof(int), (void*)&one);
-      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_pre_median, sizes);
-      if(err != CL_SUCCESS) goto error;
-
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 0, sizeof(cl_mem), &dev_tmp);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 1, sizeof(cl_mem), &dev_tmp);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 2, sizeof(int), &width);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 3, sizeof(int), &height);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 4, sizeof(uint32_t), (void*)&data->filters);
-      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_ppg_green_median, sizes);
+      err = _amaze_demosaic_cl(self, piece, dev_in, dev_tmp, width, height);
       if(err != CL_SUCCESS) goto error;
     }
     else
     {
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 0, sizeof(cl_mem), &dev_in);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 1, sizeof(cl_mem), &dev_tmp);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 2, sizeof(int), &width);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 3, sizeof(int), &height);
-      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 4, sizeof(uint32_t), (void*)&data->filters);
-      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_ppg_green, sizes);
-      if(err != CL_SUCCESS) goto error;
-    }
+      if(data->median_thrs > 0.0f)
+      {
+        const int one = 1;
+        dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 0, sizeof(cl_mem), &dev_in);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 1, sizeof(cl_mem), &dev_tmp);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 2, sizeof(int), &width);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 3, sizeof(int), &height);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 4, sizeof(uint32_t), (void*)&data->filters);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 5, sizeof(float), (void*)&data->median_thrs);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_pre_median, 6, sizeof(int), (void*)&one);
+        err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_pre_median, sizes);
+        if(err != CL_SUCCESS) goto error;
+
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 0, sizeof(cl_mem), &dev_tmp);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 1, sizeof(cl_mem), &dev_tmp);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 2, sizeof(int), &width);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 3, sizeof(int), &height);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green_median, 4, sizeof(uint32_t), (void*)&data->filters);
+        err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_ppg_green_median, sizes);
+        if(err != CL_SUCCESS) goto error;
+      }
+      else
+      {
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 0, sizeof(cl_mem), &dev_in);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 1, sizeof(cl_mem), &dev_tmp);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 2, sizeof(int), &width);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 3, sizeof(int), &height);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_green, 4, sizeof(uint32_t), (void*)&data->filters);
+        err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_ppg_green, sizes);
+        if(err != CL_SUCCESS) goto error;
+      }
 
-    dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 0, sizeof(cl_mem), &dev_tmp);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 1, sizeof(cl_mem), &dev_tmp);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 2, sizeof(int), &width);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 3, sizeof(int), &height);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 4, sizeof(uint32_t), (void*)&data->filters);
-    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_ppg_redblue, sizes);
-    if(err != CL_SUCCESS) goto error;
+      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 0, sizeof(cl_mem), &dev_tmp);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 1, sizeof(cl_mem), &dev_tmp);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 2, sizeof(int), &width);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 3, sizeof(int), &height);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_ppg_redblue, 4, sizeof(uint32_t), (void*)&data->filters);
+      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_ppg_redblue, sizes);
+      if(err != CL_SUCCESS) goto error;
 
-    // manage borders
-    dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 0, sizeof(cl_mem), &dev_in);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 1, sizeof(cl_mem), &dev_tmp);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 2, sizeof(int), (void*)&width);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 3, sizeof(int), (void*)&height);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 4, sizeof(uint32_t), (void*)&data->filters);
-    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_border_interpolate, sizes);
-    if(err != CL_SUCCESS) goto error;
+      // manage borders
+      dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 0, sizeof(cl_mem), &dev_in);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 1, sizeof(cl_mem), &dev_tmp);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 2, sizeof(int), (void*)&width);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 3, sizeof(int), (void*)&height);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_border_interpolate, 4, sizeof(uint32_t), (void*)&data->filters);
+      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_border_interpolate, sizes);
+      if(err != CL_SUCCESS) goto error;
+    }
 
     // scale temp buffer to output buffer
     int zero = 0;
@@ -1124,15 +1414,26 @@ void tiling_callback  (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop
 
   if(roi_out->scale > 0.99999f && roi_out->scale < 1.00001f)
     tiling->factor += fmax(0.25f, smooth);
-  else if(roi_out->scale > 0.5f ||
-          (piece->pipe->type == DT_DEV_PIXELPIPE_FULL && qual > 0) || (piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT))
+  else if(_demosaic_full(piece, roi_out, qual))
     tiling->factor += fmax(1.25f, smooth);
   else
     tiling->factor += fmax(0.25f, smooth);
+  // the float copy of a uint16 mosaic:
+  if(piece->pipe->raw16) tiling->factor += 0.25f;
 
   tiling->maxbuf = 1.0f;
   tiling->overhead = 0;
   tiling->overlap = 5; // take care of border handling
+
+  const int full = _demosaic_full(piece, roi_out, qual);
+  const int amaze = data->demosaicing_method == DT_IOP_DEMOSAIC_AMAZE &&
+                    !(piece->pipe->type == DT_DEV_PIXELPIPE_FULL && qual < 2);
+  if(amaze && full)
+  {
+    // amaze interpolates from a 16 pixel border, on the gpu it keeps 74 bytes of intermediate results per input pixel
+    if(piece->pipe->devid >= 0) tiling->factor += 74.0f/(4*sizeof(float));
+    tiling->overlap = 16;
+  }
   tiling->xalign = 2; // Bayer pattern
   tiling->yalign = 2; // Bayer pattern
   return;
@@ -1170,6 +1471,19 @@ void init_global(dt_iop_module_so_t *module)
   gd->kernel_downsample         = dt_opencl_create_kernel(program, "clip_and_zoom");
   gd->kernel_border_interpolate = dt_opencl_create_kernel(program, "border_interpolate");
   gd->kernel_color_smoothing    = dt_opencl_create_kernel(program, "color_smoothing");
+
+  const int amaze = 18; // demosaic_amaze.cl, from programs.conf
+  gd->kernel_amaze_init         = dt_opencl_create_kernel(amaze, "amaze_init");
+  gd->kernel_amaze_rbint        = dt_opencl_create_kernel(amaze, "amaze_rbint");
+  gd->kernel_amaze_cd           = dt_opencl_create_kernel(amaze, "amaze_cd");
+  gd->kernel_amaze_cdvar        = dt_opencl_create_kernel(amaze, "amaze_cdvar");
+  gd->kernel_amaze_hvwt         = dt_opencl_create_kernel(amaze, "amaze_hvwt");
+  gd->kernel_amaze_nyquist      = dt_opencl_create_kernel(amaze, "amaze_nyquist");
+  gd->kernel_amaze_area         = dt_opencl_create_kernel(amaze, "amaze_area");
+  gd->kernel_amaze_green        = dt_opencl_create_kernel(amaze, "amaze_green");
+  gd->kernel_amaze_refine       = dt_opencl_create_kernel(amaze, "amaze_refine");
+  gd->kernel_amaze_chroma       = dt_opencl_create_kernel(amaze, "amaze_chroma");
+  gd->kernel_amaze_output       = dt_opencl_create_kernel(amaze, "amaze_output");
 }
 
 void cleanup(dt_iop_module_t *module)
@@ -1192,6 +1506,17 @@ void cleanup_global(dt_iop_module_so_t *module)
   dt_opencl_free_kernel(gd->kernel_downsample);
   dt_opencl_free_kernel(gd->kernel_border_interpolate);
   dt_opencl_free_kernel(gd->kernel_color_smoothing);
+  dt_opencl_free_kernel(gd->kernel_amaze_init);
+  dt_opencl_free_kernel(gd->kernel_amaze_rbint);
+  dt_opencl_free_kernel(gd->kernel_amaze_cd);
+  dt_opencl_free_kernel(gd->kernel_amaze_cdvar);
+  dt_opencl_free_kernel(gd->kernel_amaze_hvwt);
+  dt_opencl_free_kernel(gd->kernel_amaze_nyquist);
+  dt_opencl_free_kernel(gd->kernel_amaze_area);
+  dt_opencl_free_kernel(gd->kernel_amaze_green);
+  dt_opencl_free_kernel(gd->kernel_amaze_refine);
+  dt_opencl_free_kernel(gd->kernel_amaze_chroma);
+  dt_opencl_free_kernel(gd->kernel_amaze_output);
   free(module->data);
   module->data = NULL;
 }
@@ -1208,10 +1533,7 @@ void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *params, dt_de
   d->demosaicing_method = p->demosaicing_method;
 
   piece->process_cl_ready = 1;
-
-  // Demosaic mode AMAZE not implemented in OpenCL yet.
-  if(d->demosaicing_method == DT_IOP_DEMOSAIC_AMAZE)
-    piece->process_cl_ready = 0;
+  piece->process_raw16 = 1;
 
   // OpenCL can not (yet) green-equilibrate over full image.
   if(d->green_eq == DT_IOP_GREEN_EQ_FULL || d->green_eq == DT_IOP_GREEN_EQ_BOTH)
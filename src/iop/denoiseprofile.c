@@ -28,6 +28,7 @@
 #include "gui/presets.h"
 #include "gui/gtk.h"
 #include "common/opencl.h"
+#include "iop/nlmeans_core.h"
 #include <gtk/gtk.h>
 #include <stdlib.h>
 #include <xmmintrin.h>
@@ -138,26 +139,7 @@ groups ()
 int
 flags ()
 {
-  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING;
-}
-
-typedef union floatint_t
-{
-  float f;
-  uint32_t i;
-}
-floatint_t;
-
-// very fast approximation for 2^-x (returns 0 for x > 126)
-static inline float
-fast_mexp2f(const float x)
-{
-  const float i1 = (float)0x3f800000u; // 2^0
-  const float i2 = (float)0x3f000000u; // 2^-1
-  const float k0 = i1 + x * (i2 - i1);
-  floatint_t k;
-  k.i = k0 >= (float)0x800000u ? k0 : 0;
-  return k.f;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_THUMBNAIL_INVISIBLE;
 }
 
 void tiling_callback  (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, struct dt_develop_tiling_t *tiling)
@@ -468,39 +450,76 @@ eaw_decompose (float *const out, const float *const in, float *const detail, con
 #undef SUM_PIXEL_PROLOGUE
 #undef SUM_PIXEL_EPILOGUE
 
+/* adds the thresholded details of all scales, coarsest first, to the coarse buffer in. same as one
+ * synthesis pass per scale, but every pixel is touched once instead of once per scale. */
 static void
-eaw_synthesize (float *const out, const float *const in, const float *const detail,
-                const float *thrsf, const float *boostf, const int32_t width, const int32_t height)
+eaw_synthesize (float *const out, const float *const in, float *const *const detail,
+                const float (*thrsf)[4], const float (*boostf)[4], const int max_scale,
+                const int32_t width, const int32_t height)
 {
-  const __m128 threshold = _mm_set_ps(thrsf[3], thrsf[2], thrsf[1], thrsf[0]);
-  const __m128 boost     = _mm_set_ps(boostf[3], boostf[2], boostf[1], boostf[0]);
+  __m128 threshold[MAX(max_scale, 1)];
+  __m128 boost[MAX(max_scale, 1)];
+  for(int scale=0; scale<max_scale; scale++)
+  {
+    threshold[scale] = _mm_set_ps(thrsf[scale][3], thrsf[scale][2], thrsf[scale][1], thrsf[scale][0]);
+    boost[scale]     = _mm_set_ps(boostf[scale][3], boostf[scale][2], boostf[scale][1], boostf[scale][0]);
+  }
 
 #ifdef _OPENMP
-  #pragma omp parallel for default(none) schedule(static)
+  #pragma omp parallel for shared(threshold, boost) schedule(static)
 #endif
   for(int j=0; j<height; j++)
   {
-    // TODO: prefetch? _mm_prefetch()
     const __m128 *pin = (__m128 *)in + j*width;
-    __m128 *pdetail = (__m128 *)detail + j*width;
     float *pout = out + 4*j*width;
     for(int i=0; i<width; i++)
     {
-#if 1
       const __m128i maski = _mm_set1_epi32(0x80000000u);
       const __m128 *mask = (__m128*)&maski;
-      const __m128 absamt = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_andnot_ps(*mask, *pdetail), threshold));
-      const __m128 amount = _mm_or_ps(_mm_and_ps(*pdetail, *mask), absamt);
-      _mm_stream_ps(pout, _mm_add_ps(*pin, _mm_mul_ps(boost, amount)));
-#endif
-      // _mm_stream_ps(pout, _mm_add_ps(*pin, *pdetail));
-      pdetail ++;
+      __m128 sum = *pin;
+      for(int scale=max_scale-1; scale>=0; scale--)
+      {
+        const __m128 *pdetail = (__m128 *)detail[scale] + j*width + i;
+        const __m128 absamt = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_andnot_ps(*mask, *pdetail), threshold[scale]));
+        const __m128 amount = _mm_or_ps(_mm_and_ps(*pdetail, *mask), absamt);
+        sum = _mm_add_ps(sum, _mm_mul_ps(boost[scale], amount));
+      }
+      _mm_stream_ps(pout, sum);
       pin ++;
       pout += 4;
     }
   }
   _mm_sfence();
 }
+
+/* sum of the squared details of one scale per channel, the variance for bayesshrink */
+static void
+eaw_detail_sum_y2 (const float *const detail, float sum_y2[3], const int32_t width, const int32_t height)
+{
+  double s0 = 0.0, s1 = 0.0, s2 = 0.0;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) reduction(+:s0,s1,s2)
+#endif
+  for(int j=0; j<height; j++)
+  {
+    const float *pdetail = detail + 4*j*width;
+    // single precision is fine for one row
+    float r0 = 0.0f, r1 = 0.0f, r2 = 0.0f;
+    for(int i=0; i<width; i++)
+    {
+      r0 += pdetail[0]*pdetail[0];
+      r1 += pdetail[1]*pdetail[1];
+      r2 += pdetail[2]*pdetail[2];
+      pdetail += 4;
+    }
+    s0 += r0;
+    s1 += r1;
+    s2 += r2;
+  }
+  sum_y2[0] = s0;
+  sum_y2[1] = s1;
+  sum_y2[2] = s2;
+}
 // =====================================================================================
 
 void process_wavelets(
@@ -536,9 +555,10 @@ void process_wavelets(
   float *buf[max_max_scale];
   float *tmp = NULL;
   float *buf1 = NULL, *buf2 = NULL;
+  const size_t bufsize = 4*sizeof(float)*roi_in->width*roi_in->height;
   for(int k=0; k<max_scale; k++)
-    buf[k] = dt_alloc_align(64, 4*sizeof(float)*roi_in->width*roi_in->height);
-  tmp = dt_alloc_align(64, 4*sizeof(float)*roi_in->width*roi_in->height);
+    buf[k] = dt_iop_scratch_alloc(piece, bufsize);
+  tmp = dt_iop_scratch_alloc(piece, bufsize);
 
   const float wb[3] =
   {
@@ -610,21 +630,19 @@ void process_wavelets(
   }
 
   // now do everything backwards, so the result will end up in *ovoid
+  float thrs[max_max_scale][4];
+  float boost[max_max_scale][4];
   for(int scale=max_scale-1; scale>=0; scale--)
   {
-#if 1
     // variance stabilizing transform maps sigma to unity.
     const float sigma = 1.0f;
     // it is then transformed by wavelet scales via the 5 tap a-trous filter:
     const float varf = sqrtf(2.0f + 2.0f * 4.0f*4.0f + 6.0f*6.0f)/16.0f; // about 0.5
     const float sigma_band = powf(varf, scale) *sigma;
     // determine thrs as bayesshrink
-    // TODO: parallelize!
-    float sum_y2[3] = {0.0f};
+    float sum_y2[3];
     const int n = width*height;
-    for(int k=0; k<n; k++)
-      for(int c=0; c<3; c++)
-        sum_y2[c] += buf[scale][4*k+c]*buf[scale][4*k+c];
+    eaw_detail_sum_y2 (buf[scale], sum_y2, width, height);
 
     const float sb2 = sigma_band*sigma_band;
     const float var_y[3] =
@@ -641,27 +659,22 @@ void process_wavelets(
     };
     // add 8.0 here because it seemed a little weak
     const float adjt = 8.0f;
-    const float thrs[4] = { adjt * sb2/std_x[0], adjt * sb2/std_x[1], adjt * sb2/std_x[2], 0.0f};
-    // const float std = (std_x[0] + std_x[1] + std_x[2])/3.0f;
-    // const float thrs[4] = { adjt*sigma*sigma/std, adjt*sigma*sigma/std, adjt*sigma*sigma/std, 0.0f};
-    // fprintf(stderr, "scale %d thrs %f %f %f = %f / %f %f %f \n", scale, thrs[0], thrs[1], thrs[2], sb2, std_x[0], std_x[1], std_x[2]);
-#endif
-    const float boost[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    // const float thrs[4] = { 0.0, 0.0, 0.0, 0.0 };
-    eaw_synthesize (buf2, buf1, buf[scale], thrs, boost, width, height);
-    // DEBUG: clean out temporary memory:
-    // memset(buf1, 0, sizeof(float)*4*width*height);
-
-    float *buf3 = buf2;
-    buf2 = buf1;
-    buf1 = buf3;
+    thrs[scale][0] = adjt * sb2/std_x[0];
+    thrs[scale][1] = adjt * sb2/std_x[1];
+    thrs[scale][2] = adjt * sb2/std_x[2];
+    thrs[scale][3] = 0.0f;
+    // fprintf(stderr, "scale %d thrs %f %f %f = %f / %f %f %f \n", scale, thrs[scale][0], thrs[scale][1], thrs[scale][2], sb2, std_x[0], std_x[1], std_x[2]);
+    for(int c=0; c<4; c++) boost[scale][c] = 1.0f;
   }
 
+  // the coarsest scale is in buf1, which may be ovoid. synthesis works per pixel
+  eaw_synthesize ((float *)ovoid, buf1, buf, (const float (*)[4])thrs, (const float (*)[4])boost, max_scale, width, height);
+
   backtransform((float *)ovoid, width, height, aa, bb);
 
-  for(int k=0; k<max_scale; k++)
-    free(buf[k]);
-  free(tmp);
+  dt_iop_scratch_free(piece, tmp, bufsize);
+  for(int k=max_scale-1; k>=0; k--)
+    dt_iop_scratch_free(piece, buf[k], bufsize);
 
   if(piece->pipe->mask_display)
     dt_iop_alpha_copy(ivoid, ovoid, width, height);
@@ -683,14 +696,14 @@ void process_nlmeans(
   // adjust to zoom size:
   const float scale = roi_in->scale / piece->iscale;
   const int P = ceilf(d->radius * scale); // pixel filter size
-  const int K = ceilf(7 * scale);
+  const int K = nlmeans_search_radius(ceilf(7 * scale), piece->pipe->type);
 
   // P == 0 : this will degenerate to a (fast) bilateral filter.
 
-  float *Sa = dt_alloc_align(64, sizeof(float)*roi_out->width*dt_get_num_threads());
   // we want to sum up weights in col[3], so need to init to 0:
   memset(ovoid, 0x0, sizeof(float)*roi_out->width*roi_out->height*4);
-  float *in = dt_alloc_align(64, 4*sizeof(float)*roi_in->width*roi_in->height);
+  const size_t bufsize = 4*sizeof(float)*roi_in->width*roi_in->height;
+  float *in = dt_iop_scratch_alloc(piece, bufsize);
 
   const float wb[3] =
   {
@@ -712,151 +725,13 @@ void process_nlmeans(
   };
   precondition((float *)ivoid, in, roi_in->width, roi_in->height, aa, bb);
 
-  // for each shift vector
-  for(int kj=-K; kj<=K; kj++)
-  {
-    for(int ki=-K; ki<=K; ki++)
-    {
-      // TODO: adaptive K tests here!
-      // TODO: expf eval for real bilateral experience :)
+  // TODO: adaptive K tests here!
+  // TODO: expf eval for real bilateral experience :)
+  // DEBUG XXX bring back to computable range:
+  const float norm = .015f/(2*P+1);
+  const float norm2[3] = { 1.0f, 1.0f, 1.0f };
+  nlmeans_process(in, (float *)ovoid, roi_out->width, roi_out->height, P, K, norm2, norm, 2.0f);
 
-      int inited_slide = 0;
-      // don't construct summed area tables but use sliding window! (applies to cpu version res < 1k only, or else we will add up errors)
-      // do this in parallel with a little threading overhead. could parallelize the outer loops with a bit more memory
-#ifdef _OPENMP
-      #  pragma omp parallel for schedule(static) default(none) firstprivate(inited_slide) shared(kj, ki, roi_out, roi_in, in, ovoid, Sa)
-#endif
-      for(int j=0; j<roi_out->height; j++)
-      {
-        if(j+kj < 0 || j+kj >= roi_out->height) continue;
-        float *S = Sa + dt_get_thread_num() * roi_out->width;
-        const float *ins = in + 4*(roi_in->width *(j+kj) + ki);
-        float *out = ((float *)ovoid) + 4*roi_out->width*j;
-
-        const int Pm = MIN(MIN(P, j+kj), j);
-        const int PM = MIN(MIN(P, roi_out->height-1-j-kj), roi_out->height-1-j);
-        // first line of every thread
-        // TODO: also every once in a while to assert numerical precision!
-        if(!inited_slide)
-        {
-          // sum up a line
-          memset(S, 0x0, sizeof(float)*roi_out->width);
-          for(int jj=-Pm; jj<=PM; jj++)
-          {
-            int i = MAX(0, -ki);
-            float *s = S + i;
-            const float *inp  = in + 4*i + 4* roi_in->width *(j+jj);
-            const float *inps = in + 4*i + 4*(roi_in->width *(j+jj+kj) + ki);
-            const int last = roi_out->width + MIN(0, -ki);
-            for(; i<last; i++, inp+=4, inps+=4, s++)
-            {
-              for(int k=0; k<3; k++)
-                s[0] += (inp[k] - inps[k])*(inp[k] - inps[k]);
-            }
-          }
-          // only reuse this if we had a full stripe
-          if(Pm == P && PM == P) inited_slide = 1;
-        }
-
-        // sliding window for this line:
-        float *s = S;
-        float slide = 0.0f;
-        // sum up the first -P..P
-        for(int i=0; i<2*P+1; i++) slide += s[i];
-        for(int i=0; i<roi_out->width; i++)
-        {
-          // FIXME: the comment above is actually relevant even for 1000 px width already.
-          // XXX    numerical precision will not forgive us:
-          if(i-P > 0 && i+P<roi_out->width)
-            slide += s[P] - s[-P-1];
-          if(i+ki >= 0 && i+ki < roi_out->width)
-          {
-            // TODO: could put that outside the loop.
-            // DEBUG XXX bring back to computable range:
-            const float norm = .015f/(2*P+1);
-            const __m128 iv = { ins[0], ins[1], ins[2], 1.0f };
-            _mm_store_ps(out, _mm_load_ps(out) + iv * _mm_set1_ps(fast_mexp2f(fmaxf(0.0f, slide*norm-2.0f))));
-            // _mm_store_ps(out, _mm_load_ps(out) + iv * _mm_set1_ps(fast_mexp2f(fmaxf(0.0f, slide*norm))));
-          }
-          s   ++;
-          ins += 4;
-          out += 4;
-        }
-        if(inited_slide && j+P+1+MAX(0,kj) < roi_out->height)
-        {
-          // sliding window in j direction:
-          int i = MAX(0, -ki);
-          float *s = S + i;
-          const float *inp  = in + 4*i + 4* roi_in->width *(j+P+1);
-          const float *inps = in + 4*i + 4*(roi_in->width *(j+P+1+kj) + ki);
-          const float *inm  = in + 4*i + 4* roi_in->width *(j-P);
-          const float *inms = in + 4*i + 4*(roi_in->width *(j-P+kj) + ki);
-          const int last = roi_out->width + MIN(0, -ki);
-          for(; ((unsigned long)s & 0xf) != 0 && i<last; i++, inp+=4, inps+=4, inm+=4, inms+=4, s++)
-          {
-            float stmp = s[0];
-            for(int k=0; k<3; k++)
-              stmp += ((inp[k] - inps[k])*(inp[k] - inps[k])
-                       -  (inm[k] - inms[k])*(inm[k] - inms[k]));
-            s[0] = stmp;
-          }
-          /* Process most of the line 4 pixels at a time */
-          for(; i<last-4; i+=4, inp+=16, inps+=16, inm+=16, inms+=16, s+=4)
-          {
-            __m128 sv = _mm_load_ps(s);
-            const __m128 inp1 = _mm_load_ps(inp)    - _mm_load_ps(inps);
-            const __m128 inp2 = _mm_load_ps(inp+4)  - _mm_load_ps(inps+4);
-            const __m128 inp3 = _mm_load_ps(inp+8)  - _mm_load_ps(inps+8);
-            const __m128 inp4 = _mm_load_ps(inp+12) - _mm_load_ps(inps+12);
-
-            const __m128 inp12lo = _mm_unpacklo_ps(inp1,inp2);
-            const __m128 inp34lo = _mm_unpacklo_ps(inp3,inp4);
-            const __m128 inp12hi = _mm_unpackhi_ps(inp1,inp2);
-            const __m128 inp34hi = _mm_unpackhi_ps(inp3,inp4);
-
-            const __m128 inpv0 = _mm_movelh_ps(inp12lo,inp34lo);
-            sv += inpv0*inpv0;
-
-            const __m128 inpv1 = _mm_movehl_ps(inp34lo,inp12lo);
-            sv += inpv1*inpv1;
-
-            const __m128 inpv2 = _mm_movelh_ps(inp12hi,inp34hi);
-            sv += inpv2*inpv2;
-
-            const __m128 inm1 = _mm_load_ps(inm)    - _mm_load_ps(inms);
-            const __m128 inm2 = _mm_load_ps(inm+4)  - _mm_load_ps(inms+4);
-            const __m128 inm3 = _mm_load_ps(inm+8)  - _mm_load_ps(inms+8);
-            const __m128 inm4 = _mm_load_ps(inm+12) - _mm_load_ps(inms+12);
-
-            const __m128 inm12lo = _mm_unpacklo_ps(inm1,inm2);
-            const __m128 inm34lo = _mm_unpacklo_ps(inm3,inm4);
-            const __m128 inm12hi = _mm_unpackhi_ps(inm1,inm2);
-            const __m128 inm34hi = _mm_unpackhi_ps(inm3,inm4);
-
-            const __m128 inmv0 = _mm_movelh_ps(inm12lo,inm34lo);
-            sv -= inmv0*inmv0;
-
-            const __m128 inmv1 = _mm_movehl_ps(inm34lo,inm12lo);
-            sv -= inmv1*inmv1;
-
-            const __m128 inmv2 = _mm_movelh_ps(inm12hi,inm34hi);
-            sv -= inmv2*inmv2;
-
-            _mm_store_ps(s, sv);
-          }
-          for(; i<last; i++, inp+=4, inps+=4, inm+=4, inms+=4, s++)
-          {
-            float stmp = s[0];
-            for(int k=0; k<3; k++)
-              stmp += ((inp[k] - inps[k])*(inp[k] - inps[k])
-                       -  (inm[k] - inms[k])*(inm[k] - inms[k]));
-            s[0] = stmp;
-          }
-        }
-        else inited_slide = 0;
-      }
-    }
-  }
   // normalize
 #ifdef _OPENMP
   #pragma omp parallel for default(none) schedule(static) shared(ovoid,roi_out,d)
@@ -874,8 +749,7 @@ void process_nlmeans(
     }
   }
   // free shared tmp memory:
-  free(Sa);
-  free(in);
+  dt_iop_scratch_free(piece, in, bufsize);
   backtransform((float *)ovoid, roi_in->width, roi_in->height, aa, bb);
 
   if(piece->pipe->mask_display)
@@ -915,7 +789,7 @@ int process_nlmeans_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pi
   cl_int err = -999;
 
   const int P = ceilf(d->radius * roi_in->scale / piece->iscale); // pixel filter size
-  const int K = ceilf(7 * roi_in->scale / piece->iscale); // nbhood
+  const int K = nlmeans_search_radius(ceilf(7 * roi_in->scale / piece->iscale), piece->pipe->type); // nbhood
   const float norm = 0.015f/(2*P+1);
 
 
@@ -1138,9 +1012,10 @@ int process_wavelets_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *p
   cl_mem dev_buf1 = NULL;
   cl_mem dev_buf2 = NULL;
   cl_mem dev_m = NULL;
-  cl_mem dev_r = NULL;
+  cl_mem dev_r[max_max_scale];
   cl_mem dev_detail[max_max_scale];
-  for(int k=0; k<max_scale; k++) dev_detail[k] = NULL;
+  for(int k=0; k<max_scale; k++) dev_detail[k] = dev_r[k] = NULL;
+  float thrs[max_max_scale][4];
 
   // prepare local work group
   size_t maxsizes[3] = { 0 };        // the maximum dimensions for a work group
@@ -1182,8 +1057,11 @@ int process_wavelets_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *p
   dev_m = dt_opencl_alloc_device_buffer(devid, bufsize*2*4*sizeof(float));
   if(dev_m == NULL) goto error;
 
-  dev_r = dt_opencl_alloc_device_buffer(devid, reducesize*2*4*sizeof(float));
-  if(dev_r == NULL) goto error;
+  for(int k=0; k<max_scale; k++)
+  {
+    dev_r[k] = dt_opencl_alloc_device_buffer(devid, reducesize*2*4*sizeof(float));
+    if(dev_r[k] == NULL) goto error;
+  }
 
   dev_tmp = dt_opencl_alloc_device(devid, width, height, 4*sizeof(float));
   if(dev_tmp == NULL) goto error;
@@ -1264,19 +1142,10 @@ int process_wavelets_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *p
     dev_buf1 = dev_buf3;
   }
 
-  /* now synthesize again */
+  /* reduce all detail scales first, so the reads of the sums don't stall the queue between the
+   * synthesis steps */
   for(int scale=max_scale-1; scale>=0; scale--)
   {
-    // variance stabilizing transform maps sigma to unity.
-    const float sigma = 1.0f;
-    // it is then transformed by wavelet scales via the 5 tap a-trous filter:
-    const float varf = sqrtf(2.0f + 2.0f * 4.0f*4.0f + 6.0f*6.0f)/16.0f; // about 0.5
-    const float sigma_band = powf(varf, scale) *sigma;
-
-    // determine thrs as bayesshrink
-    float sum_y[3] = {0.0f};
-    float sum_y2[3] = {0.0f};
-
     size_t lsizes[3];
     size_t llocal[3];
 
@@ -1302,15 +1171,27 @@ int process_wavelets_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *p
     llocal[1] = 1;
     llocal[2] = 1;
     dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_reduce_second, 0, sizeof(cl_mem), &dev_m);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_reduce_second, 1, sizeof(cl_mem), &dev_r);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_reduce_second, 1, sizeof(cl_mem), &dev_r[scale]);
     dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_reduce_second, 2, sizeof(int), &bufsize);
     dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_reduce_second, 3, lsize*2*4*sizeof(float), NULL);
     err = dt_opencl_enqueue_kernel_2d_with_local(devid, gd->kernel_denoiseprofile_reduce_second, lsizes, llocal);
     if(err != CL_SUCCESS) goto error;
+  }
+
+  /* determine thrs as bayesshrink */
+  for(int scale=max_scale-1; scale>=0; scale--)
+  {
+    // variance stabilizing transform maps sigma to unity.
+    const float sigma = 1.0f;
+    // it is then transformed by wavelet scales via the 5 tap a-trous filter:
+    const float varf = sqrtf(2.0f + 2.0f * 4.0f*4.0f + 6.0f*6.0f)/16.0f; // about 0.5
+    const float sigma_band = powf(varf, scale) *sigma;
 
+    float sum_y[3] = {0.0f};
+    float sum_y2[3] = {0.0f};
 
     float sumsum[2*4*reducesize];
-    err = dt_opencl_read_buffer_from_device(devid, (void*)sumsum, dev_r, 0, reducesize*2*4*sizeof(float), CL_TRUE);
+    err = dt_opencl_read_buffer_from_device(devid, (void*)sumsum, dev_r[scale], 0, reducesize*2*4*sizeof(float), CL_TRUE);
     if(err != CL_SUCCESS) goto error;
 
     for(int k = 0; k < reducesize; k++)
@@ -1342,9 +1223,17 @@ int process_wavelets_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *p
     // add 8.0 here because it seemed a little weak
     const float adjt = 8.0f;
 
-    const float thrs[4] = { adjt * sb2/std_x[0], adjt * sb2/std_x[1], adjt * sb2/std_x[2], 0.0f};
-    // fprintf(stderr, "scale %d thrs %f %f %f\n", scale, thrs[0], thrs[1], thrs[2]);
+    thrs[scale][0] = adjt * sb2/std_x[0];
+    thrs[scale][1] = adjt * sb2/std_x[1];
+    thrs[scale][2] = adjt * sb2/std_x[2];
+    thrs[scale][3] = 0.0f;
+    // fprintf(stderr, "scale %d thrs %f %f %f\n", scale, thrs[scale][0], thrs[scale][1], thrs[scale][2]);
+  }
+
 
+  /* now synthesize again */
+  for(int scale=max_scale-1; scale>=0; scale--)
+  {
     const float boost[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
 
     dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_synthesize,  0, sizeof(cl_mem), (void *)&dev_buf2);
@@ -1352,10 +1241,10 @@ int process_wavelets_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *p
     dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_synthesize,  2, sizeof(cl_mem), (void *)&dev_detail[scale]);
     dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_synthesize,  3, sizeof(int), (void *)&width);
     dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_synthesize,  4, sizeof(int), (void *)&height);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_synthesize,  5, sizeof(float), (void *)&thrs[0]);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_synthesize,  6, sizeof(float), (void *)&thrs[1]);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_synthesize,  7, sizeof(float), (void *)&thrs[2]);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_synthesize,  8, sizeof(float), (void *)&thrs[3]);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_synthesize,  5, sizeof(float), (void *)&thrs[scale][0]);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_synthesize,  6, sizeof(float), (void *)&thrs[scale][1]);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_synthesize,  7, sizeof(float), (void *)&thrs[scale][2]);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_synthesize,  8, sizeof(float), (void *)&thrs[scale][3]);
     dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_synthesize,  9, sizeof(float), (void *)&boost[0]);
     dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_synthesize, 10, sizeof(float), (void *)&boost[1]);
     dt_opencl_set_kernel_arg(devid, gd->kernel_denoiseprofile_synthesize, 11, sizeof(float), (void *)&boost[2]);
@@ -1385,19 +1274,23 @@ int process_wavelets_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *p
     dt_opencl_finish(devid);
 
 
-  if(dev_r != NULL) dt_opencl_release_mem_object(dev_r);
   if(dev_m != NULL)  dt_opencl_release_mem_object(dev_m);
   if(dev_tmp != NULL) dt_opencl_release_mem_object(dev_tmp);
   for(int k=0; k<max_scale; k++)
+  {
     if (dev_detail[k] != NULL) dt_opencl_release_mem_object(dev_detail[k]);
+    if (dev_r[k] != NULL) dt_opencl_release_mem_object(dev_r[k]);
+  }
   return TRUE;
 
 error:
-  if(dev_r != NULL) dt_opencl_release_mem_object(dev_r);
   if(dev_m != NULL)  dt_opencl_release_mem_object(dev_m);
   if(dev_tmp != NULL) dt_opencl_release_mem_object(dev_tmp);
   for(int k=0; k<max_scale; k++)
+  {
     if (dev_detail[k] != NULL) dt_opencl_release_mem_object(dev_detail[k]);
+    if (dev_r[k] != NULL) dt_opencl_release_mem_object(dev_r[k]);
+  }
   dt_print(DT_DEBUG_OPENCL, "[opencl_denoiseprofile] couldn't enqueue kernel! %d, devid %d\n", err, devid);
   return FALSE;
 }
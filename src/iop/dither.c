@@ -93,6 +93,13 @@ typedef struct dt_iop_dither_data_t
 }
 dt_iop_dither_data_t;
 
+typedef struct dt_iop_dither_global_data_t
+{
+  int kernel_dither_random;
+  int kernel_dither_clip;
+}
+dt_iop_dither_global_data_t;
+
 const char *name()
 {
   return _("dithering");
@@ -422,6 +429,49 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
     process_floyd_steinberg(self, piece, ivoid, ovoid, roi_in, roi_out);
 }
 
+#ifdef HAVE_OPENCL
+/* random dithering, and floyd-steinberg where it comes down to clipping. the error diffusion
+   itself is sequential, commit_params() keeps those pipes on the cpu. */
+int
+process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_iop_dither_data_t *data = (dt_iop_dither_data_t *)piece->data;
+  dt_iop_dither_global_data_t *gd = (dt_iop_dither_global_data_t *)self->data;
+  cl_int err = -999;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1};
+
+  if(data->dither_type == DITHER_RANDOM)
+  {
+    const float dither = powf(2.0f, data->random.damping/10.0f);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_dither_random, 0, sizeof(cl_mem), (void *)&dev_in);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_dither_random, 1, sizeof(cl_mem), (void *)&dev_out);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_dither_random, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_dither_random, 3, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_dither_random, 4, sizeof(float), (void *)&dither);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_dither_random, sizes);
+  }
+  else
+  {
+    dt_opencl_set_kernel_arg(devid, gd->kernel_dither_clip, 0, sizeof(cl_mem), (void *)&dev_in);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_dither_clip, 1, sizeof(cl_mem), (void *)&dev_out);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_dither_clip, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_dither_clip, 3, sizeof(int), (void *)&height);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_dither_clip, sizes);
+  }
+  if(err != CL_SUCCESS) goto error;
+  return TRUE;
+
+error:
+  dt_print(DT_DEBUG_OPENCL, "[opencl_dither] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
 static void
 method_callback (GtkWidget *widget, gpointer user_data)
 {
@@ -486,6 +536,13 @@ void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pi
   memcpy(&(d->random.range), &(p->random.range), sizeof(p->random.range));
   d->random.radius = p->random.radius;
   d->random.damping = p->random.damping;
+
+  // error diffusion only runs on the cpu. automatic dithering doesn't happen in these pipes,
+  // see process_floyd_steinberg(), so they only clip and can stay on the gpu:
+  const int no_diffusion = p->dither_type == DITHER_FSAUTO &&
+                           (pipe->type == DT_DEV_PIXELPIPE_PREVIEW || pipe->type == DT_DEV_PIXELPIPE_THUMBNAIL ||
+                            (pipe->type == DT_DEV_PIXELPIPE_FULL && !d->dither_center_view));
+  piece->process_cl_ready = piece->process_cl_ready && (p->dither_type == DITHER_RANDOM || no_diffusion);
 }
 
 void init_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -548,6 +605,24 @@ void cleanup(dt_iop_module_t *module)
   module->params = NULL;
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 8; // extended.cl, from programs.conf
+  dt_iop_dither_global_data_t *gd = (dt_iop_dither_global_data_t *)malloc(sizeof(dt_iop_dither_global_data_t));
+  module->data = gd;
+  gd->kernel_dither_random = dt_opencl_create_kernel(program, "dither_random");
+  gd->kernel_dither_clip   = dt_opencl_create_kernel(program, "dither_clip");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_dither_global_data_t *gd = (dt_iop_dither_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_dither_random);
+  dt_opencl_free_kernel(gd->kernel_dither_clip);
+  free(module->data);
+  module->data = NULL;
+}
+
 void gui_init(struct dt_iop_module_t *self)
 {
   self->gui_data = malloc(sizeof(dt_iop_dither_gui_data_t));
@@ -24,8 +24,10 @@
 #include <string.h>
 #include "common/darktable.h"
 #include "common/debug.h"
+#include "common/opencl.h"
 #include "iop/equalizer.h"
 #include "develop/develop.h"
+#include "develop/tiling.h"
 #include "control/control.h"
 #include "gui/gtk.h"
 #include "gui/presets.h"
@@ -37,6 +39,15 @@
 
 DT_MODULE(1)
 
+typedef struct dt_iop_equalizer_global_data_t
+{
+  int kernel_equalizer_weights;
+  int kernel_equalizer_predict;
+  int kernel_equalizer_update;
+  int kernel_equalizer_scale;
+}
+dt_iop_equalizer_global_data_t;
+
 const char *name()
 {
   return _("legacy equalizer");
@@ -51,7 +62,24 @@ groups ()
 
 int flags()
 {
-  return IOP_FLAGS_DEPRECATED;
+  return IOP_FLAGS_DEPRECATED | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_THUMBNAIL_INVISIBLE;
+}
+
+// finest and coarsest level in the full image and the number of levels to transform the buffer with.
+static void
+_equalizer_levels(const dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in, float *l1, float *lm, int *numl_cap)
+{
+  const int width = roi_in->width, height = roi_in->height;
+  const float scale = roi_in->scale;
+  // 1 pixel in this buffer represents 1.0/scale pixels in original image:
+  *l1 = 1.0f + dt_log2f(piece->iscale/scale);                          // finest level
+  *lm = 0;
+  for(int k=MIN(width,height)*piece->iscale/scale; k; k>>=1) (*lm)++; // coarsest level
+  *lm = MIN(DT_IOP_EQUALIZER_MAX_LEVEL, *l1 + *lm);
+  // level 1 => full resolution
+  int numl = 0;
+  for(int k=MIN(width,height); k; k>>=1) numl++;
+  *numl_cap = MIN(DT_IOP_EQUALIZER_MAX_LEVEL-*l1+1.5, numl);
 }
 
 
@@ -62,7 +90,6 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   float *out = (float *)o;
   const int chs = piece->colors;
   const int width = roi_in->width, height = roi_in->height;
-  const float scale = roi_in->scale;
   memcpy(out, in, chs*sizeof(float)*width*height);
 #if 1
   // printf("thread %d starting equalizer", (int)pthread_self());
@@ -71,15 +98,9 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   dt_iop_equalizer_data_t *d = (dt_iop_equalizer_data_t *)(piece->data);
   // dt_iop_equalizer_gui_data_t *c = (dt_iop_equalizer_gui_data_t *)self->gui_data;
 
-  // 1 pixel in this buffer represents 1.0/scale pixels in original image:
-  const float l1 = 1.0f + dt_log2f(piece->iscale/scale);                          // finest level
-  float lm = 0;
-  for(int k=MIN(width,height)*piece->iscale/scale; k; k>>=1) lm++; // coarsest level
-  lm = MIN(DT_IOP_EQUALIZER_MAX_LEVEL, l1 + lm);
-  // level 1 => full resolution
-  int numl = 0;
-  for(int k=MIN(width,height); k; k>>=1) numl++;
-  const int numl_cap = MIN(DT_IOP_EQUALIZER_MAX_LEVEL-l1+1.5, numl);
+  float l1, lm;
+  int numl_cap;
+  _equalizer_levels(piece, roi_in, &l1, &lm, &numl_cap);
   // printf("level range in %d %d: %f %f, cap: %d\n", 1, d->num_levels, l1, lm, numl_cap);
 
   // TODO: fixed alloc for data piece at capped resolution?
@@ -159,6 +180,153 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
 #endif
 }
 
+#ifdef HAVE_OPENCL
+// runs the forward or inverse lifting steps of one level, in the order of iop/equalizer_eaw.h.
+static cl_int
+_equalizer_lift_cl(const int devid, dt_iop_equalizer_global_data_t *gd, cl_mem dev_buf, cl_mem dev_weight,
+                   const int width, const int height, const int level, const int inverse)
+{
+  const int st = 1<<(level-1);
+  const int step = 1<<level;
+  const int wd = 1 + (width>>(level-1));
+  cl_int err = CL_SUCCESS;
+  for(int pass=0; pass<2; pass++)
+  {
+    // forward: rows, then columns. inverse: columns, then rows.
+    const int horizontal = inverse ? pass : !pass;
+    for(int lift=0; lift<2; lift++)
+    {
+      // forward: predict, then update. inverse: the other way round.
+      const int predict = inverse ? lift : !lift;
+      const int len = horizontal ? width : height;
+      const int n = predict ? (len - st + step - 1)/step : (len + step - 1)/step;
+      if(n <= 0) continue;
+      const int kernel = predict ? gd->kernel_equalizer_predict : gd->kernel_equalizer_update;
+      const float sign = (predict ? -1.0f : 1.0f) * (inverse ? -1.0f : 1.0f);
+      size_t sizes[] = { ROUNDUPWD(horizontal ? n : width), ROUNDUPHT(horizontal ? height : n), 1 };
+      dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), (void *)&dev_buf);
+      dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(cl_mem), (void *)&dev_weight);
+      dt_opencl_set_kernel_arg(devid, kernel, 2, sizeof(int), (void *)&width);
+      dt_opencl_set_kernel_arg(devid, kernel, 3, sizeof(int), (void *)&height);
+      dt_opencl_set_kernel_arg(devid, kernel, 4, sizeof(int), (void *)&level);
+      dt_opencl_set_kernel_arg(devid, kernel, 5, sizeof(int), (void *)&wd);
+      dt_opencl_set_kernel_arg(devid, kernel, 6, sizeof(int), (void *)&horizontal);
+      dt_opencl_set_kernel_arg(devid, kernel, 7, sizeof(float), (void *)&sign);
+      err = dt_opencl_enqueue_kernel_2d(devid, kernel, sizes);
+      if(err != CL_SUCCESS) return err;
+    }
+  }
+  return err;
+}
+
+int
+process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_iop_equalizer_data_t *d = (dt_iop_equalizer_data_t *)(piece->data);
+  dt_iop_equalizer_global_data_t *gd = (dt_iop_equalizer_global_data_t *)self->data;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width, height = roi_in->height;
+  size_t origin[] = { 0, 0, 0 };
+  size_t region[] = { width, height, 1 };
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  cl_int err = -999;
+  cl_mem dev_buf = NULL;
+  cl_mem dev_coeff = NULL;
+  cl_mem dev_weight[DT_IOP_EQUALIZER_MAX_LEVEL+1] = { NULL };
+
+  float l1, lm;
+  int numl_cap;
+  _equalizer_levels(piece, roi_in, &l1, &lm, &numl_cap);
+
+  // the transform works in place, on a buffer instead of an image
+  dev_buf = dt_opencl_alloc_device_buffer(devid, (size_t)width*height*4*sizeof(float));
+  if(dev_buf == NULL) goto error;
+  err = dt_opencl_enqueue_copy_image_to_buffer(devid, dev_in, dev_buf, origin, region, 0);
+  if(err != CL_SUCCESS) goto error;
+
+  for(int level=1; level<numl_cap; level++)
+  {
+    const int wd = 1 + (width>>(level-1)), ht = 1 + (height>>(level-1));
+    dev_weight[level] = dt_opencl_alloc_device_buffer(devid, (size_t)wd*ht*sizeof(float));
+    if(dev_weight[level] == NULL) goto error;
+    size_t wsizes[] = { ROUNDUPWD(wd), ROUNDUPHT(ht), 1 };
+    dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_weights, 0, sizeof(cl_mem), (void *)&dev_buf);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_weights, 1, sizeof(cl_mem), (void *)&dev_weight[level]);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_weights, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_weights, 3, sizeof(int), (void *)&level);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_weights, 4, sizeof(int), (void *)&wd);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_weights, 5, sizeof(int), (void *)&ht);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_equalizer_weights, wsizes);
+    if(err != CL_SUCCESS) goto error;
+    err = _equalizer_lift_cl(devid, gd, dev_buf, dev_weight[level], width, height, level, 0);
+    if(err != CL_SUCCESS) goto error;
+  }
+
+  // coefficients in range [0, 2], 1 being neutral, per level for luma and chroma.
+  float coeff[4*(DT_IOP_EQUALIZER_MAX_LEVEL+1)];
+  for(int l=0; l<=DT_IOP_EQUALIZER_MAX_LEVEL; l++)
+  {
+    const float lv = (lm-l1)*(l-1)/(float)(numl_cap-1) + l1; // appr level in real image.
+    const float band = CLAMP((1.0 - lv / d->num_levels), 0, 1.0);
+    const int valid = l >= 1 && l < numl_cap;
+    coeff[4*l+0] = valid ? 2*dt_draw_curve_calc_value(d->curve[0], band) : 1.0f;
+    coeff[4*l+1] = coeff[4*l+2] = valid ? 2*dt_draw_curve_calc_value(d->curve[1], band) : 1.0f;
+    coeff[4*l+3] = 1.0f;
+  }
+  dev_coeff = dt_opencl_copy_host_to_device_constant(devid, sizeof(coeff), coeff);
+  if(dev_coeff == NULL) goto error;
+  dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_scale, 0, sizeof(cl_mem), (void *)&dev_buf);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_scale, 1, sizeof(cl_mem), (void *)&dev_coeff);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_scale, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_scale, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_equalizer_scale, 4, sizeof(int), (void *)&numl_cap);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_equalizer_scale, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  for(int level=numl_cap-1; level>0; level--)
+  {
+    err = _equalizer_lift_cl(devid, gd, dev_buf, dev_weight[level], width, height, level, 1);
+    if(err != CL_SUCCESS) goto error;
+  }
+
+  err = dt_opencl_enqueue_copy_buffer_to_image(devid, dev_buf, dev_out, 0, origin, region);
+  if(err != CL_SUCCESS) goto error;
+
+  for(int level=1; level<numl_cap; level++) dt_opencl_release_mem_object(dev_weight[level]);
+  dt_opencl_release_mem_object(dev_coeff);
+  dt_opencl_release_mem_object(dev_buf);
+  return TRUE;
+
+error:
+  for(int level=1; level<=DT_IOP_EQUALIZER_MAX_LEVEL; level++)
+    if(dev_weight[level] != NULL) dt_opencl_release_mem_object(dev_weight[level]);
+  if(dev_coeff != NULL) dt_opencl_release_mem_object(dev_coeff);
+  if(dev_buf != NULL) dt_opencl_release_mem_object(dev_buf);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_equalizer] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+void tiling_callback  (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, struct dt_develop_tiling_t *tiling)
+{
+  float l1, lm;
+  int numl_cap;
+  _equalizer_levels(piece, roi_in, &l1, &lm, &numl_cap);
+  // the lifting steps of a level reach one step to each side, forward and back. tiles have to
+  // start on the grid of the coarsest level, or the coefficients would land elsewhere.
+  const int coarsest = 1 << MAX(0, numl_cap - 1);
+
+  // in place plus the weights on the cpu, the device also needs its own buffer to work in
+  tiling->factor = (piece->pipe->devid >= 0) ? 3.5f : 2.5f;
+  tiling->maxbuf = 1.0f;
+  tiling->overhead = 0;
+  tiling->overlap = 4*coarsest;
+  tiling->xalign = coarsest;
+  tiling->yalign = coarsest;
+  return;
+}
+
 void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
   // pull in new params to gegl
@@ -233,6 +401,28 @@ void init(dt_iop_module_t *module)
   memcpy(module->default_params, &tmp, sizeof(dt_iop_equalizer_params_t));
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 1; // atrous.cl, from programs.conf
+  dt_iop_equalizer_global_data_t *gd = (dt_iop_equalizer_global_data_t *)malloc(sizeof(dt_iop_equalizer_global_data_t));
+  module->data = gd;
+  gd->kernel_equalizer_weights = dt_opencl_create_kernel(program, "equalizer_weights");
+  gd->kernel_equalizer_predict = dt_opencl_create_kernel(program, "equalizer_predict");
+  gd->kernel_equalizer_update = dt_opencl_create_kernel(program, "equalizer_update");
+  gd->kernel_equalizer_scale = dt_opencl_create_kernel(program, "equalizer_scale");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_equalizer_global_data_t *gd = (dt_iop_equalizer_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_equalizer_weights);
+  dt_opencl_free_kernel(gd->kernel_equalizer_predict);
+  dt_opencl_free_kernel(gd->kernel_equalizer_update);
+  dt_opencl_free_kernel(gd->kernel_equalizer_scale);
+  free(module->data);
+  module->data = NULL;
+}
+
 void cleanup(dt_iop_module_t *module)
 {
   free(module->gui_data);
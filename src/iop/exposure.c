@@ -145,6 +145,13 @@ void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pi
   d->exposure = p->exposure;
 }
 
+int is_identity (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_iop_exposure_params_t *p = (dt_iop_exposure_params_t *)p1;
+  // gain isn't used by process():
+  return p->black == 0.0f && p->exposure == 0.0f;
+}
+
 void init_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
   piece->data = malloc(sizeof(dt_iop_exposure_data_t));
@@ -56,6 +56,7 @@ void cleanup(dt_iop_module_t *module);
 
 void gui_update    (struct dt_iop_module_t *self);
 void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece);
+int  is_identity   (struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev_pixelpipe_iop_t *piece);
 void init_pipe     (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece);
 void reset_params  (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece);
 void cleanup_pipe  (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece);
@@ -242,6 +242,23 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
                           roi_in->width, roi_in->height, roi_in->width, roi_in->height, stride, d->orientation);
 }
 
+// the pixel process() above moves to roi_out, the other way round.
+int warp_backtransform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in,
+                       const dt_iop_roi_t *roi_out, float *points, const int points_count)
+{
+  dt_iop_flip_data_t *d = (dt_iop_flip_data_t *)piece->data;
+  const int orientation = d->orientation;
+  const float wd = roi_in->width, ht = roi_in->height;
+  for(int k=0; points && k<2*points_count; k+=2)
+  {
+    const float x = (orientation & 4) ? points[k+1] : points[k];
+    const float y = (orientation & 4) ? points[k] : points[k+1];
+    points[k]   = (orientation & 1) ? wd - 1.0f - x : x;
+    points[k+1] = (orientation & 2) ? ht - 1.0f - y : y;
+  }
+  return 2;
+}
+
 
 
 #ifdef HAVE_OPENCL
@@ -28,6 +28,7 @@
 #include "iop/gamma.h"
 #include "develop/develop.h"
 #include "control/control.h"
+#include "common/opencl.h"
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
 
@@ -94,6 +95,54 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   }
 }
 
+#ifdef HAVE_OPENCL
+// the last stage of the display pipe on the device: only the packed 8-bit bgr comes back, into o.
+int
+process_cl_to_host (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_iop_gamma_data_t *d = (dt_iop_gamma_data_t *)piece->data;
+  dt_iop_gamma_global_data_t *gd = (dt_iop_gamma_global_data_t *)self->data;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+  const int mask_display = piece->pipe->mask_display;
+  const size_t size = (size_t)4*width*height;
+  cl_mem dev_table = NULL;
+  cl_mem dev_out = NULL;
+  cl_int err = -999;
+
+  dev_table = dt_opencl_copy_host_to_device_constant(devid, sizeof(d->table), d->table);
+  if(dev_table == NULL) goto error;
+  dev_out = dt_opencl_alloc_device_buffer(devid, size);
+  if(dev_out == NULL) goto error;
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1};
+  dt_opencl_set_kernel_arg(devid, gd->kernel_gamma_bgra, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_gamma_bgra, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_gamma_bgra, 2, sizeof(cl_mem), (void *)&dev_table);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_gamma_bgra, 3, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_gamma_bgra, 4, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_gamma_bgra, 5, sizeof(int), (void *)&mask_display);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_gamma_bgra, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  // the color pickers and the histogram read o right after this module:
+  err = dt_opencl_read_buffer_from_device(devid, o, dev_out, 0, size, CL_TRUE);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_table);
+  dt_opencl_release_mem_object(dev_out);
+  return TRUE;
+
+error:
+  if(dev_table != NULL) dt_opencl_release_mem_object(dev_table);
+  if(dev_out != NULL) dt_opencl_release_mem_object(dev_out);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_gamma] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
 void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
   dt_iop_gamma_params_t *p = (dt_iop_gamma_params_t *)p1;
@@ -182,6 +231,22 @@ void cleanup(dt_iop_module_t *module)
   module->params = NULL;
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 23; // output.cl, from programs.conf
+  dt_iop_gamma_global_data_t *gd = (dt_iop_gamma_global_data_t *)malloc(sizeof(dt_iop_gamma_global_data_t));
+  module->data = gd;
+  gd->kernel_gamma_bgra = dt_opencl_create_kernel(program, "gamma_bgra");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_gamma_global_data_t *gd = (dt_iop_gamma_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_gamma_bgra);
+  free(module->data);
+  module->data = NULL;
+}
+
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
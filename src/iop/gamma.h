@@ -36,6 +36,12 @@ typedef struct dt_iop_gamma_data_t
 }
 dt_iop_gamma_data_t;
 
+typedef struct dt_iop_gamma_global_data_t
+{
+  int kernel_gamma_bgra;
+}
+dt_iop_gamma_global_data_t;
+
 void init(dt_iop_module_t *module);
 void cleanup(dt_iop_module_t *module);
 
@@ -29,11 +29,14 @@
 #include "develop/develop.h"
 #include "develop/imageop.h"
 #include "control/control.h"
+#include "common/opencl.h"
 #include "iop/grain.h"
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
 #include <gtk/gtk.h>
 #include <inttypes.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
 
 #define GRAIN_LIGHTNESS_STRENGTH_SCALE 0.15
 // (m_pi/2)/4 = half hue colorspan
@@ -42,14 +45,29 @@
 #define GRAIN_SATURATION_STRENGTH_SCALE 0.25
 #define GRAIN_RGB_STRENGTH_SCALE 0.25
 
+// the precomputed grain: texels per side (a power of two) and texels per unit of noise,
+// so the texture repeats every GRAIN_TEXTURE_SIZE/GRAIN_TEXTURE_RES units.
+// has to match data/kernels/grain.cl
+#define GRAIN_TEXTURE_SIZE 1024
+#define GRAIN_TEXTURE_RES 8
+
 #define CLIP(x) ((x<0)?0.0:(x>1.0)?1.0:x)
-DT_MODULE(1)
+DT_MODULE(2)
+
+typedef struct dt_iop_grain_params1_t
+{
+  _dt_iop_grain_channel_t channel;
+  float scale;
+  float strength;
+}
+dt_iop_grain_params1_t;
 
 typedef struct dt_iop_grain_gui_data_t
 {
   GtkVBox   *vbox;
   GtkWidget  *label1,*label2,*label3;	      // channel, scale, strength
   GtkWidget *scale1,*scale2;       // scale, strength
+  GtkWidget *mode;
 }
 dt_iop_grain_gui_data_t;
 
@@ -58,9 +76,18 @@ typedef struct dt_iop_grain_data_t
   _dt_iop_grain_channel_t channel;
   float scale;
   float strength;
+  _dt_iop_grain_mode_t mode;
 }
 dt_iop_grain_data_t;
 
+typedef struct dt_iop_grain_global_data_t
+{
+  int kernel_grain;
+  dt_pthread_mutex_t lock;
+  float *texture;              // GRAIN_TEXTURE_SIZE^2, made on first use
+}
+dt_iop_grain_global_data_t;
+
 
 static int grad3[12][3] = {{1,1,0},{-1,1,0},{1,-1,0},{-1,-1,0},
   {1,0,1},{-1,0,1},{1,0,-1},{-1,0,-1},
@@ -301,6 +328,80 @@ static double _simplex_2d_noise(double x,double y,uint32_t octaves,double persis
   return total;
 }
 
+// the noise of the whole period, cross faded with its copies one period to the left and up so that
+// it wraps around seamlessly. the fade is normalized to keep the variance of the grain the same.
+static void _grain_make_texture(float *tex)
+{
+  const double period = GRAIN_TEXTURE_SIZE/(double)GRAIN_TEXTURE_RES;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) shared(tex)
+#endif
+  for(int j=0; j<GRAIN_TEXTURE_SIZE; j++)
+  {
+    for(int i=0; i<GRAIN_TEXTURE_SIZE; i++)
+    {
+      const double u = i/(double)GRAIN_TEXTURE_RES, v = j/(double)GRAIN_TEXTURE_RES;
+      const double wu = u/period, wv = v/period;
+      const double w00 = (1.0-wu)*(1.0-wv), w10 = wu*(1.0-wv), w01 = (1.0-wu)*wv, w11 = wu*wv;
+      const double noise =
+        w00 * _simplex_2d_noise(u,        v,        3, 1.0, 1.0) +
+        w10 * _simplex_2d_noise(u-period, v,        3, 1.0, 1.0) +
+        w01 * _simplex_2d_noise(u,        v-period, 3, 1.0, 1.0) +
+        w11 * _simplex_2d_noise(u-period, v-period, 3, 1.0, 1.0);
+      tex[GRAIN_TEXTURE_SIZE*j + i] = noise / sqrt(w00*w00 + w10*w10 + w01*w01 + w11*w11);
+    }
+  }
+}
+
+static const float *_grain_texture(dt_iop_grain_global_data_t *gd)
+{
+  dt_pthread_mutex_lock(&gd->lock);
+  if(!gd->texture)
+  {
+    float *tex = dt_alloc_align(64, sizeof(float)*GRAIN_TEXTURE_SIZE*GRAIN_TEXTURE_SIZE);
+    if(tex) _grain_make_texture(tex);
+    gd->texture = tex;
+  }
+  dt_pthread_mutex_unlock(&gd->lock);
+  return gd->texture;
+}
+
+// bilinear lookup at texel coordinates tx, ty >= 0, wrapping around. same as grain_sample() in grain.cl.
+static inline float _grain_sample(const float *const tex, const float tx, const float ty)
+{
+  const int x0 = tx, y0 = ty;
+  const float fx = tx - x0, fy = ty - y0;
+  const float *r0 = tex + GRAIN_TEXTURE_SIZE*(y0 & (GRAIN_TEXTURE_SIZE-1));
+  const float *r1 = tex + GRAIN_TEXTURE_SIZE*((y0+1) & (GRAIN_TEXTURE_SIZE-1));
+  const int xa = x0 & (GRAIN_TEXTURE_SIZE-1), xb = (x0+1) & (GRAIN_TEXTURE_SIZE-1);
+  const float top = r0[xa] + fx*(r0[xb] - r0[xa]);
+  const float bot = r1[xa] + fx*(r1[xb] - r1[xa]);
+  return top + fy*(bot - top);
+}
+
+// the same for four horizontal positions tx on the line ty
+static inline __m128 _grain_sample_sse2(const float *const tex, const __m128 tx, const float ty)
+{
+  const __m128i x0 = _mm_cvttps_epi32(tx);
+  const __m128 fx = tx - _mm_cvtepi32_ps(x0);
+  const int y0 = ty;
+  const __m128 fy = _mm_set1_ps(ty - y0);
+  const float *r0 = tex + GRAIN_TEXTURE_SIZE*(y0 & (GRAIN_TEXTURE_SIZE-1));
+  const float *r1 = tex + GRAIN_TEXTURE_SIZE*((y0+1) & (GRAIN_TEXTURE_SIZE-1));
+  const __m128i mask = _mm_set1_epi32(GRAIN_TEXTURE_SIZE-1);
+  int xa[4] __attribute__((aligned(16)));
+  int xb[4] __attribute__((aligned(16)));
+  _mm_store_si128((__m128i *)xa, _mm_and_si128(x0, mask));
+  _mm_store_si128((__m128i *)xb, _mm_and_si128(_mm_add_epi32(x0, _mm_set1_epi32(1)), mask));
+  const __m128 v00 = _mm_set_ps(r0[xa[3]], r0[xa[2]], r0[xa[1]], r0[xa[0]]);
+  const __m128 v10 = _mm_set_ps(r0[xb[3]], r0[xb[2]], r0[xb[1]], r0[xb[0]]);
+  const __m128 v01 = _mm_set_ps(r1[xa[3]], r1[xa[2]], r1[xa[1]], r1[xa[0]]);
+  const __m128 v11 = _mm_set_ps(r1[xb[3]], r1[xb[2]], r1[xb[1]], r1[xb[0]]);
+  const __m128 top = v00 + fx*(v10 - v00);
+  const __m128 bot = v01 + fx*(v11 - v01);
+  return top + fy*(bot - top);
+}
+
 
 const char *name()
 {
@@ -318,6 +419,23 @@ groups ()
   return IOP_GROUP_EFFECT;
 }
 
+int
+legacy_params (dt_iop_module_t *self, const void *const old_params, const int old_version, void *new_params, const int new_version)
+{
+  if(old_version == 1 && new_version == 2)
+  {
+    const dt_iop_grain_params1_t *o = (dt_iop_grain_params1_t *)old_params;
+    dt_iop_grain_params_t *n = (dt_iop_grain_params_t *)new_params;
+    n->channel = o->channel;
+    n->scale = o->scale;
+    n->strength = o->strength;
+    // keep the look of old edits
+    n->mode = DT_GRAIN_MODE_SIMPLEX;
+    return 0;
+  }
+  return 1;
+}
+
 #if 0 // BAUHAUS doesn't support keyaccels yet...
 void init_key_accels(dt_iop_module_so_t *self)
 {
@@ -344,6 +462,131 @@ static unsigned int _hash_string(char *s)
   return h;
 }
 
+// where the roi starts in the grain texture and how far one pixel steps, in texels.
+// fm is the extent of the downsampling filter in texels.
+static void _grain_texture_coords(const dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_out, const unsigned int hash,
+                                  float *tx0, float *ty0, float *step, float *fm)
+{
+  const dt_iop_grain_data_t *data = (dt_iop_grain_data_t *)piece->data;
+  const double period = GRAIN_TEXTURE_SIZE/(double)GRAIN_TEXTURE_RES;
+  const double wd = fminf(piece->buf_in.width, piece->buf_in.height);
+  const double zoom = (1.0+8*data->scale/100)/800.0;
+  // same world space mapping as the simplex mode in process(), reduced to one period
+  *tx0 = fmod((roi_out->x/roi_out->scale/wd + hash)/zoom, period) * GRAIN_TEXTURE_RES;
+  *ty0 = fmod(roi_out->y/roi_out->scale/wd/zoom, period) * GRAIN_TEXTURE_RES;
+  *step = GRAIN_TEXTURE_RES/(roi_out->scale*wd*zoom);
+  *fm = piece->iscale/(roi_out->scale*wd) / zoom * GRAIN_TEXTURE_RES;
+}
+
+static void _process_texture(const float *const tex, const float *const in, float *const out, const int width, const int height,
+                             const int ch, const float tx0, const float ty0, const float step, const int filter,
+                             const float fm, const float strength)
+{
+  // rank-1 lattice as in the simplex mode
+  const float fib1 = 34.0, fib2 = 21.0;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static)
+#endif
+  for(int j=0; j<height; j++)
+  {
+    const float *inp = in + (size_t)ch*width*j;
+    float *outp = out + (size_t)ch*width*j;
+    const float ty = ty0 + j*step;
+    int i = 0;
+    for(; i+4<=width; i+=4, inp+=4*ch, outp+=4*ch)
+    {
+      const __m128 tx = (_mm_set1_ps(i) + _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f)) * _mm_set1_ps(step) + _mm_set1_ps(tx0);
+      __m128 noise = _mm_setzero_ps();
+      if(filter)
+      {
+        for(int l=0; l<fib2; l++)
+        {
+          float px = l/fib2, py = l*(fib1/fib2);
+          py -= (int)py;
+          noise += _mm_set1_ps(1.0f/fib2) * _grain_sample_sse2(tex, tx + _mm_set1_ps(px*fm), ty + py*fm);
+        }
+      }
+      else noise = _grain_sample_sse2(tex, tx, ty);
+      float n[4] __attribute__((aligned(16)));
+      _mm_store_ps(n, noise * _mm_set1_ps(strength));
+      for(int k=0; k<4; k++)
+        _mm_store_ps(outp + ch*k, _mm_load_ps(inp + ch*k) + _mm_set_ps(0.0f, 0.0f, 0.0f, n[k]));
+    }
+    for(; i<width; i++, inp+=ch, outp+=ch)
+    {
+      const float tx = i*step + tx0;
+      float noise = 0.0f;
+      if(filter)
+      {
+        for(int l=0; l<fib2; l++)
+        {
+          float px = l/fib2, py = l*(fib1/fib2);
+          py -= (int)py;
+          noise += (1.0f/fib2) * _grain_sample(tex, tx + px*fm, ty + py*fm);
+        }
+      }
+      else noise = _grain_sample(tex, tx, ty);
+      outp[0] = inp[0] + noise*strength;
+      outp[1] = inp[1];
+      outp[2] = inp[2];
+      outp[3] = inp[3];
+    }
+  }
+}
+
+#ifdef HAVE_OPENCL
+int
+process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_iop_grain_data_t *d = (dt_iop_grain_data_t *)piece->data;
+  dt_iop_grain_global_data_t *gd = (dt_iop_grain_global_data_t *)self->data;
+
+  // the per pixel simplex noise stays on the cpu
+  if(d->mode != DT_GRAIN_MODE_TEXTURE) return FALSE;
+
+  cl_mem dev_tex = NULL;
+  cl_int err = -999;
+  const int devid = piece->pipe->devid;
+
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+
+  const float *tex = _grain_texture(gd);
+  if(!tex) goto error;
+  dev_tex = dt_opencl_copy_host_to_device(devid, (void *)tex, GRAIN_TEXTURE_SIZE, GRAIN_TEXTURE_SIZE, sizeof(float));
+  if(dev_tex == NULL) goto error;
+
+  const unsigned int hash = _hash_string(piece->pipe->image.filename) % (int)(roi_out->width * 0.3);
+  float tx0, ty0, step, fm;
+  _grain_texture_coords(piece, roi_out, hash, &tx0, &ty0, &step, &fm);
+  const int filter = fabsf(roi_out->scale - 1.0) > 0.01;
+  const float strength = d->strength * GRAIN_LIGHTNESS_STRENGTH_SCALE;
+
+  size_t sizes[2] = { ROUNDUPWD(width), ROUNDUPHT(height) };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 0, sizeof(cl_mem), &dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 1, sizeof(cl_mem), &dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 2, sizeof(int), &width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 3, sizeof(int), &height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 4, sizeof(cl_mem), &dev_tex);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 5, sizeof(float), &tx0);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 6, sizeof(float), &ty0);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 7, sizeof(float), &step);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 8, sizeof(int), &filter);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 9, sizeof(float), &fm);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_grain, 10, sizeof(float), &strength);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_grain, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_tex);
+  return TRUE;
+
+error:
+  if (dev_tex != NULL) dt_opencl_release_mem_object(dev_tex);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_grain] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
 void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
   dt_iop_grain_data_t *data = (dt_iop_grain_data_t *)piece->data;
@@ -351,13 +594,27 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   unsigned int hash = _hash_string(piece->pipe->image.filename) % (int)(roi_out->width * 0.3);
 
   const int ch = piece->colors;
+  const int filter = fabsf(roi_out->scale - 1.0) > 0.01;
+
+  if(data->mode == DT_GRAIN_MODE_TEXTURE)
+  {
+    const float *tex = _grain_texture((dt_iop_grain_global_data_t *)self->data);
+    if(tex)
+    {
+      float tx0, ty0, step, fm;
+      _grain_texture_coords(piece, roi_out, hash, &tx0, &ty0, &step, &fm);
+      _process_texture(tex, (const float *)ivoid, (float *)ovoid, roi_out->width, roi_out->height, ch,
+                       tx0, ty0, step, filter, fm, data->strength * GRAIN_LIGHTNESS_STRENGTH_SCALE);
+      return;
+    }
+  }
+
   // Apply grain to image
   const double strength=(data->strength/100.0);
   const double octaves=3;
   // double zoom=1.0+(8*(data->scale/100.0));
   const double wd = fminf(piece->buf_in.width, piece->buf_in.height);
   const double zoom=(1.0+8*data->scale/100)/800.0;
-  const int filter = fabsf(roi_out->scale - 1.0) > 0.01;
   // filter width depends on world space (i.e. reverse wd norm and roi->scale, as well as buffer input to pixelpipe iscale)
   const double filtermul = piece->iscale/(roi_out->scale*wd);
 #ifdef _OPENMP
@@ -427,6 +684,16 @@ strength_callback (GtkWidget *slider, gpointer user_data)
   dt_dev_add_history_item(darktable.develop, self, TRUE);
 }
 
+static void
+mode_callback (GtkWidget *combo, gpointer user_data)
+{
+  dt_iop_module_t *self = (dt_iop_module_t *)user_data;
+  if(self->dt->gui->reset) return;
+  dt_iop_grain_params_t *p = (dt_iop_grain_params_t *)self->params;
+  p->mode = dt_bauhaus_combobox_get(combo);
+  dt_dev_add_history_item(darktable.develop, self, TRUE);
+}
+
 
 void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
@@ -439,6 +706,7 @@ void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pi
   d->channel = p->channel;
   d->scale = p->scale;
   d->strength = p->strength;
+  d->mode = p->mode;
 #endif
 }
 
@@ -473,11 +741,32 @@ void gui_update(struct dt_iop_module_t *self)
 
   dt_bauhaus_slider_set(g->scale1, p->scale*53.3);
   dt_bauhaus_slider_set(g->scale2, p->strength);
+  dt_bauhaus_combobox_set(g->mode, p->mode);
 }
 
-void init(dt_iop_module_t *module)
+void init_global(dt_iop_module_so_t *module)
 {
+  const int program = 20; // grain.cl, from programs.conf
+  dt_iop_grain_global_data_t *gd = (dt_iop_grain_global_data_t *)malloc(sizeof(dt_iop_grain_global_data_t));
+  module->data = gd;
+  gd->kernel_grain = dt_opencl_create_kernel(program, "grain");
+  dt_pthread_mutex_init(&gd->lock, NULL);
+  gd->texture = NULL;
   _simplex_noise_init();
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_grain_global_data_t *gd = (dt_iop_grain_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_grain);
+  dt_pthread_mutex_destroy(&gd->lock);
+  free(gd->texture);
+  free(module->data);
+  module->data = NULL;
+}
+
+void init(dt_iop_module_t *module)
+{
   module->params = malloc(sizeof(dt_iop_grain_params_t));
   module->default_params = malloc(sizeof(dt_iop_grain_params_t));
   module->default_enabled = 0;
@@ -486,7 +775,7 @@ void init(dt_iop_module_t *module)
   module->gui_data = NULL;
   dt_iop_grain_params_t tmp = (dt_iop_grain_params_t)
   {
-    DT_GRAIN_CHANNEL_LIGHTNESS, 400.0/53.3, 25.0
+    DT_GRAIN_CHANNEL_LIGHTNESS, 400.0/53.3, 25.0, DT_GRAIN_MODE_TEXTURE
   };
   memcpy(module->params, &tmp, sizeof(dt_iop_grain_params_t));
   memcpy(module->default_params, &tmp, sizeof(dt_iop_grain_params_t));
@@ -526,6 +815,17 @@ void gui_init(struct dt_iop_module_t *self)
   g_signal_connect (G_OBJECT (g->scale2), "value-changed",
                     G_CALLBACK (strength_callback), self);
 
+  /* mode */
+  g->mode = dt_bauhaus_combobox_new(self);
+  dt_bauhaus_widget_set_label(g->mode, _("method"));
+  dt_bauhaus_combobox_add(g->mode, _("noise per pixel"));
+  dt_bauhaus_combobox_add(g->mode, _("precomputed texture"));
+  dt_bauhaus_combobox_set(g->mode, p->mode);
+  gtk_box_pack_start(GTK_BOX(self->widget), g->mode, TRUE, TRUE, 0);
+  g_object_set(G_OBJECT(g->mode), "tooltip-text", _("the precomputed texture is a lot faster and runs on the gpu, but repeats after some hundred pixels"), (char *)NULL);
+  g_signal_connect (G_OBJECT (g->mode), "value-changed",
+                    G_CALLBACK (mode_callback), self);
+
 }
 
 void gui_cleanup(struct dt_iop_module_t *self)
@@ -29,11 +29,19 @@ typedef enum _dt_iop_grain_channel_t
 }
 _dt_iop_grain_channel_t;
 
+typedef enum _dt_iop_grain_mode_t
+{
+  DT_GRAIN_MODE_SIMPLEX=0,  // simplex noise evaluated for every pixel
+  DT_GRAIN_MODE_TEXTURE     // a precomputed tileable texture of the same noise
+}
+_dt_iop_grain_mode_t;
+
 typedef struct dt_iop_grain_params_t
 {
   _dt_iop_grain_channel_t channel;
   float scale;
   float strength;
+  _dt_iop_grain_mode_t mode;
 }
 dt_iop_grain_params_t;
 
@@ -23,6 +23,7 @@
 #include <assert.h>
 #include <string.h>
 #include <xmmintrin.h>
+#include <emmintrin.h>
 #include "develop/develop.h"
 #include "develop/imageop.h"
 #include "control/control.h"
@@ -148,10 +149,151 @@ error:
 int
 output_bpp(dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  if(!dt_dev_pixelpipe_uses_downsampled_input(pipe) && (pipe->image.flags & DT_IMAGE_RAW)) return sizeof(float);
+  if(!dt_dev_pixelpipe_uses_downsampled_input(pipe) && (pipe->image.flags & DT_IMAGE_RAW))
+    return pipe->raw16 ? sizeof(uint16_t) : sizeof(float);
   else return 4*sizeof(float);
 }
 
+// lch reconstruction on the mosaic: every pixel is blended towards the maximum of its 3x3 neighbourhood.
+// the blend weight will be 1 as soon as one pixel is overexposed, 0 below near_clip and grows gradually
+// in between. the maximum over the weights of the neighbours is the weight of their maximum, so this is
+// the same as looking at all of them, without branches, for four pixels at a time.
+static inline __m128
+lch_max9_ps(const float *const p, const int width)
+{
+  const __m128 m0 = _mm_max_ps(_mm_max_ps(_mm_loadu_ps(p-width-1), _mm_loadu_ps(p-width)), _mm_loadu_ps(p-width+1));
+  const __m128 m1 = _mm_max_ps(_mm_max_ps(_mm_loadu_ps(p-1), _mm_loadu_ps(p)), _mm_loadu_ps(p+1));
+  const __m128 m2 = _mm_max_ps(_mm_max_ps(_mm_loadu_ps(p+width-1), _mm_loadu_ps(p+width)), _mm_loadu_ps(p+width+1));
+  return _mm_max_ps(m0, _mm_max_ps(m1, m2));
+}
+
+static inline __m128
+lch_blend_ps(const __m128 max, const __m128 val, const __m128 clip, const __m128 near_clip)
+{
+  const __m128 blend = _mm_max_ps(_mm_setzero_ps(),
+                                  _mm_div_ps(_mm_sub_ps(_mm_min_ps(clip, max), near_clip), _mm_sub_ps(clip, near_clip)));
+  return _mm_add_ps(_mm_mul_ps(blend, max), _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(1.0f), blend), val));
+}
+
+// the pixels at the end of a row which don't fill a vector:
+static inline float
+lch_blend(const float *const p, const int width, const float clip, const float near_clip)
+{
+  float max = 0.0f;
+  for(int jj=-1; jj<=1; jj++)
+    for(int ii=-1; ii<=1; ii++)
+      max = fmaxf(max, p[jj*width + ii]);
+  const float blend = fmaxf(0.0f, (fminf(clip, max) - near_clip)/(clip-near_clip));
+  return blend*max + (1.f-blend)*p[0];
+}
+
+static void
+process_lch_bayer(const float *const in, float *const out, const int width, const int height, const float clip)
+{
+  const float near_clip = 0.9f*clip;
+  const __m128 clipm = _mm_set1_ps(clip);
+  const __m128 nearm = _mm_set1_ps(near_clip);
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none)
+#endif
+  for(int j=0; j<height; j++)
+  {
+    const float *i0 = in + (size_t)width*j;
+    float *o = out + (size_t)width*j;
+    if(j==0 || j==height-1)
+    {
+      // fast path for border
+      memcpy(o, i0, sizeof(float)*width);
+      continue;
+    }
+    o[0] = i0[0];
+    o[width-1] = i0[width-1];
+    int i = 1;
+    for(; i+4<=width-1; i+=4)
+      _mm_storeu_ps(o+i, lch_blend_ps(lch_max9_ps(i0+i, width), _mm_loadu_ps(i0+i), clipm, nearm));
+    for(; i<width-1; i++)
+      o[i] = lch_blend(i0+i, width, clip, near_clip);
+  }
+}
+
+// the same on the uint16 mosaic, see DT_IOP_RAW16_ONE.
+static void
+process_raw16(const dt_iop_highlights_data_t *data, const uint16_t *const in, uint16_t *const out,
+              const dt_iop_roi_t *const roi_out, const float clip)
+{
+  const int width = roi_out->width, height = roi_out->height;
+  const float clipf = fminf(65535.0f, clip*DT_IOP_RAW16_ONE);
+  if(data->mode == DT_IOP_HIGHLIGHTS_LCH)
+  {
+    const float near_clip = 0.9f*clipf;
+    const __m128 clipm = _mm_set1_ps(clipf);
+    const __m128 nearm = _mm_set1_ps(near_clip);
+    // sse2 only compares signed 16 bits, flipping the top bit maps unsigned to signed order:
+    const __m128i bias = _mm_set1_epi16((short)0x8000);
+    const __m128i zero = _mm_setzero_si128();
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) default(none)
+#endif
+    for(int j=0; j<height; j++)
+    {
+      const uint16_t *i0 = in + (size_t)width*j;
+      uint16_t *o = out + (size_t)width*j;
+      if(j==0 || j==height-1)
+      {
+        memcpy(o, i0, sizeof(uint16_t)*width);
+        continue;
+      }
+      o[0] = i0[0];
+      o[width-1] = i0[width-1];
+      int i = 1;
+      for(; i+8<=width-1; i+=8)
+      {
+        __m128i max = zero;
+        for(int jj=-1; jj<=1; jj++)
+          for(int ii=-1; ii<=1; ii++)
+            max = _mm_max_epi16(max, _mm_xor_si128(bias,
+                                    _mm_loadu_si128((const __m128i *)(i0 + jj*width + i + ii))));
+        max = _mm_xor_si128(max, bias);
+        const __m128i val = _mm_loadu_si128((const __m128i *)(i0 + i));
+        // blend in float, four at a time, and round:
+        const __m128 lo = lch_blend_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(max, zero)),
+                                       _mm_cvtepi32_ps(_mm_unpacklo_epi16(val, zero)), clipm, nearm);
+        const __m128 hi = lch_blend_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(max, zero)),
+                                       _mm_cvtepi32_ps(_mm_unpackhi_epi16(val, zero)), clipm, nearm);
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128i offset = _mm_set1_epi32(32768);
+        // and back to unsigned 16 bits through the signed pack:
+        const __m128i res = _mm_packs_epi32(_mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(lo, half)), offset),
+                                            _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(hi, half)), offset));
+        _mm_storeu_si128((__m128i *)(o + i), _mm_xor_si128(res, bias));
+      }
+      for(; i<width-1; i++)
+      {
+        float max = 0.0f;
+        for(int jj=-1; jj<=1; jj++)
+          for(int ii=-1; ii<=1; ii++)
+            max = fmaxf(max, i0[jj*width + i + ii]);
+        const float blend = fmaxf(0.0f, (fminf(clipf, max) - near_clip)/(clipf-near_clip));
+        o[i] = (uint16_t)(blend*max + (1.f-blend)*i0[i] + 0.5f);
+      }
+    }
+    return;
+  }
+  // there's only a signed min for 16 bits in sse2, but a - (a -sat b) is min(a, b):
+  const uint16_t clip16 = clipf + 0.5f;
+  const __m128i clipm = _mm_set1_epi16((short)clip16);
+  const size_t n = (size_t)height*width;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none)
+#endif
+  for(size_t j=0; j<n/8; j++)
+  {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(in + 8*j));
+    _mm_storeu_si128((__m128i *)(out + 8*j), _mm_sub_epi16(v, _mm_subs_epu16(v, clipm)));
+  }
+  for(size_t j=n&~(size_t)7; j<n; j++) out[j] = MIN(clip16, in[j]);
+}
+
 
 void process(
     struct dt_iop_module_t *self,
@@ -165,6 +307,11 @@ void process(
   dt_iop_highlights_data_t *data = (dt_iop_highlights_data_t *)piece->data;
 
   const float clip = data->clip * fminf(piece->pipe->processed_maximum[0], fminf(piece->pipe->processed_maximum[1], piece->pipe->processed_maximum[2]));
+  if(piece->pipe->raw16)
+  {
+    process_raw16(data, (const uint16_t *)ivoid, (uint16_t *)ovoid, roi_out, clip);
+    return;
+  }
   // const int ch = piece->colors;
   if(dt_dev_pixelpipe_uses_downsampled_input(piece->pipe) || !filters)
   {
@@ -178,7 +325,7 @@ void process(
       float *in  = (float *)ivoid + 4*roi_in->width*j;
       for(int i=0; i<roi_out->width; i++)
       {
-        _mm_stream_ps(out, _mm_min_ps(clipm, _mm_set_ps(in[3],in[2],in[1],in[0])));
+        _mm_stream_ps(out, _mm_min_ps(clipm, _mm_load_ps(in)));
         in += 4;
         out += 4;
       }
@@ -190,47 +337,7 @@ void process(
   switch(data->mode)
   {
     case DT_IOP_HIGHLIGHTS_LCH:
-#ifdef _OPENMP
-      #pragma omp parallel for schedule(dynamic) default(none) shared(ovoid, ivoid, roi_in, roi_out, data, piece)
-#endif
-      for(int j=0; j<roi_out->height; j++)
-      {
-        float *out = (float *)ovoid + roi_out->width*j;
-        float *in  = (float *)ivoid + roi_out->width*j;
-        for(int i=0; i<roi_out->width; i++)
-        {
-          if(i==0 || i==roi_out->width-1 || j==0 || j==roi_out->height-1)
-          {
-            // fast path for border
-            out[0] = in[0];
-          }
-          else
-          {
-            // go for all 9 neighbours
-            const float near_clip = 0.9f*clip;
-            float blend = 0.0f;
-            float max = 0.0f;
-            for(int jj=-1; jj<=1; jj++)
-            {
-              for(int ii=-1; ii<=1; ii++)
-              {
-                const float val = in[jj*roi_out->width + ii];
-                blend = fmaxf(blend, (fminf(clip, val) - near_clip)/(clip-near_clip));
-                max = fmaxf(max, val);
-              }
-            }
-            if(blend > 0)
-            {
-              // the computed blend weight will be 1 as soon as one pixel is overexposed.
-              // it'll be 0 below near_clip and grow gradually in between.
-              out[0] = blend*max + (1.f-blend)*in[0];
-            }
-            else out[0] = in[0];
-          }
-          out ++;
-          in ++;
-        }
-      }
+      process_lch_bayer((const float *)ivoid, (float *)ovoid, roi_out->width, roi_out->height, clip);
       break;
     default:
     case DT_IOP_HIGHLIGHTS_CLIP:
@@ -242,7 +349,7 @@ void process(
 #ifdef _OPENMP
       #pragma omp parallel for schedule(static) default(none)
 #endif
-      for(int j=0; j<n; j+=4)
+      for(int j=0; j<(n&~3); j+=4)
         _mm_stream_ps(out+j, _mm_min_ps(clipm, _mm_load_ps(in+j)));
       _mm_sfence();
       // lets see if there's a non-multiple of four rest to process:
@@ -288,6 +395,7 @@ void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pi
   dt_iop_highlights_params_t *p = (dt_iop_highlights_params_t *)p1;
   dt_iop_highlights_data_t *d = (dt_iop_highlights_data_t *)piece->data;
   memcpy(d, p, sizeof(*p));
+  piece->process_raw16 = 1;
 }
 
 void init_global(dt_iop_module_so_t *module)
@@ -24,6 +24,7 @@
 #include "config.h"
 #endif
 #include "bauhaus/bauhaus.h"
+#include "common/opencl.h"
 #include "control/control.h"
 #include "develop/imageop.h"
 #include "dtgtk/resetlabel.h"
@@ -63,6 +64,12 @@ typedef struct dt_iop_hotpixels_data_t
 }
 dt_iop_hotpixels_data_t;
 
+typedef struct dt_iop_hotpixels_global_data_t
+{
+  int kernel_hotpixels;
+}
+dt_iop_hotpixels_global_data_t;
+
 const char *name()
 {
   return _("hot pixels");
@@ -76,7 +83,7 @@ groups ()
 
 int flags ()
 {
-  return IOP_FLAGS_ONE_INSTANCE;
+  return IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_THUMBNAIL_INVISIBLE;
 }
 
 void init_key_accels(dt_iop_module_so_t *self)
@@ -171,6 +178,80 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   }
 }
 
+#ifdef HAVE_OPENCL
+int
+process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_iop_hotpixels_gui_data_t *g = (dt_iop_hotpixels_gui_data_t *)self->gui_data;
+  const dt_iop_hotpixels_data_t *data = (dt_iop_hotpixels_data_t *)piece->data;
+  dt_iop_hotpixels_global_data_t *gd = (dt_iop_hotpixels_global_data_t *)self->data;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+  const float threshold = data->threshold;
+  const float multiplier = data->multiplier;
+  const int min_neighbours = data->permissive ? 3 : 4;
+  const int markfixed = data->markfixed;
+  // only count the fixed pixels if somebody is going to look at the number
+  const int count = g != NULL && self->dev->gui_attached && piece->pipe->type == DT_DEV_PIXELPIPE_FULL
+                    && !darktable.opencl->avoid_atomics;
+
+  cl_int err = -999;
+  cl_mem dev_fixed = NULL;
+  int fixed = 0;
+
+  if(count)
+  {
+    dev_fixed = dt_opencl_copy_host_to_device_constant(devid, sizeof(int), &fixed);
+    if(dev_fixed == NULL) goto error;
+  }
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 4, sizeof(float), (void *)&threshold);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 5, sizeof(float), (void *)&multiplier);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 6, sizeof(int), (void *)&min_neighbours);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 7, sizeof(int), (void *)&markfixed);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_hotpixels, 8, sizeof(cl_mem), (void *)&dev_fixed);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_hotpixels, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  if(count)
+  {
+    err = dt_opencl_read_buffer_from_device(devid, (void *)&fixed, dev_fixed, 0, sizeof(int), CL_TRUE);
+    if(err != CL_SUCCESS) goto error;
+    dt_opencl_release_mem_object(dev_fixed);
+    g->pixels_fixed = fixed;
+  }
+  return TRUE;
+
+error:
+  if(dev_fixed != NULL) dt_opencl_release_mem_object(dev_fixed);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_hotpixels] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 16; // hotpixels.cl, from programs.conf
+  dt_iop_hotpixels_global_data_t *gd = (dt_iop_hotpixels_global_data_t *)malloc(sizeof(dt_iop_hotpixels_global_data_t));
+  module->data = gd;
+  gd->kernel_hotpixels = dt_opencl_create_kernel(program, "hotpixels");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_hotpixels_global_data_t *gd = (dt_iop_hotpixels_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_hotpixels);
+  free(module->data);
+  module->data = NULL;
+}
+
 void init(dt_iop_module_t *module)
 {
   module->data = NULL;
@@ -195,8 +276,6 @@ void cleanup(dt_iop_module_t *module)
   module->gui_data = NULL;
   free(module->params);
   module->params = NULL;
-  free(module->data);
-  module->data = NULL;
 }
 
 void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -24,6 +24,7 @@
 #endif
 #include "control/control.h"
 #include "develop/imageop.h"
+#include "common/opencl.h"
 #include "dtgtk/resetlabel.h"
 #include "dtgtk/button.h"
 #include "gui/accelerators.h"
@@ -49,6 +50,14 @@ dt_iop_invert_gui_data_t;
 
 typedef struct dt_iop_invert_params_t dt_iop_invert_data_t;
 
+typedef struct dt_iop_invert_global_data_t
+{
+  int kernel_invert_1ui;
+  int kernel_invert_1f;
+  int kernel_invert_4f;
+}
+dt_iop_invert_global_data_t;
+
 const char *name()
 {
   return _("invert");
@@ -247,6 +256,63 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   }
 }
 
+#ifdef HAVE_OPENCL
+int
+process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_iop_invert_data_t *d = (dt_iop_invert_data_t *)piece->data;
+  dt_iop_invert_global_data_t *gd = (dt_iop_invert_global_data_t *)self->data;
+
+  const int devid = piece->pipe->devid;
+  const int filters = dt_image_flipped_filter(&piece->pipe->image);
+  float film_rgb[4] = {d->color[0], d->color[1], d->color[2], 0.0f};
+  cl_int err = -999;
+  int kernel = -1;
+  int raw = 1;
+
+  if(!dt_dev_pixelpipe_uses_downsampled_input(piece->pipe) && filters && piece->pipe->image.bpp != 4)
+  {
+    // integer film color, truncated as in process():
+    const float *const m = piece->pipe->processed_maximum;
+    for(int k=0; k<3; k++) film_rgb[k] = (int32_t)(m[k]*film_rgb[k]*65535);
+    kernel = gd->kernel_invert_1ui;
+  }
+  else if(!dt_dev_pixelpipe_uses_downsampled_input(piece->pipe) && filters && piece->pipe->image.bpp == 4)
+  {
+    kernel = gd->kernel_invert_1f;
+  }
+  else
+  {
+    kernel = gd->kernel_invert_4f;
+    raw = 0;
+  }
+
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1};
+  dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, kernel, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, kernel, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, kernel, 4, 4*sizeof(float), (void *)&film_rgb);
+  dt_opencl_set_kernel_arg(devid, kernel, 5, sizeof(uint32_t), (void *)&filters);
+  dt_opencl_set_kernel_arg(devid, kernel, 6, sizeof(uint32_t), (void *)&roi_out->x);
+  dt_opencl_set_kernel_arg(devid, kernel, 7, sizeof(uint32_t), (void *)&roi_out->y);
+  err = dt_opencl_enqueue_kernel_2d(devid, kernel, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  if(raw)
+    for(int k=0; k<3; k++)
+      piece->pipe->processed_maximum[k] = 1.0f;
+  return TRUE;
+
+error:
+  dt_print(DT_DEBUG_OPENCL, "[opencl_invert] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
 void reload_defaults(dt_iop_module_t *self)
 {
   dt_iop_invert_params_t tmp = (dt_iop_invert_params_t)
@@ -280,6 +346,26 @@ void cleanup(dt_iop_module_t *module)
   module->params = NULL;
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 2; // basic.cl, from programs.conf
+  dt_iop_invert_global_data_t *gd = (dt_iop_invert_global_data_t *)malloc(sizeof(dt_iop_invert_global_data_t));
+  module->data = gd;
+  gd->kernel_invert_1ui = dt_opencl_create_kernel(program, "invert_1ui");
+  gd->kernel_invert_1f  = dt_opencl_create_kernel(program, "invert_1f");
+  gd->kernel_invert_4f  = dt_opencl_create_kernel(program, "invert_4f");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_invert_global_data_t *gd = (dt_iop_invert_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_invert_1ui);
+  dt_opencl_free_kernel(gd->kernel_invert_1f);
+  dt_opencl_free_kernel(gd->kernel_invert_4f);
+  free(module->data);
+  module->data = NULL;
+}
+
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
   dt_iop_invert_params_t *p = (dt_iop_invert_params_t *)params;
@@ -125,6 +125,107 @@ _lens_sanitize(const char *orig_lens)
 }
 
 
+// lensfun evaluates the distortion only on a grid of every LENS_MAP_STEP-th output pixel,
+// the coordinates in between are interpolated. the distortion is smooth enough for this to
+// stay far below a hundredth of a pixel.
+#define LENS_MAP_STEP 8
+
+/* evaluates the grid of distorted coordinates for roi_out, unless the one of the last run
+ * is still valid. commit_params() invalidates it. every node holds the r, g and b
+ * coordinate pairs as lensfun returns them, padded to 8 floats. */
+static int
+_lens_map_update(dt_iop_lensfun_data_t *d, lfModifier *modifier, const dt_iop_roi_t *roi_out,
+                 const float orig_w, const float orig_h)
+{
+  if(d->map_valid && d->map_x == roi_out->x && d->map_y == roi_out->y
+     && d->map_width == roi_out->width && d->map_height == roi_out->height
+     && d->map_orig_w == orig_w && d->map_orig_h == orig_h)
+    return 0;
+
+  const int wd = (roi_out->width - 1)/LENS_MAP_STEP + 2;
+  const int ht = (roi_out->height - 1)/LENS_MAP_STEP + 2;
+  const size_t req = (size_t)wd*ht*8*sizeof(float);
+  if(d->map_len < req)
+  {
+    free(d->map);
+    d->map = (float *)dt_alloc_align(16, req);
+    d->map_len = d->map ? req : 0;
+  }
+  d->map_valid = 0;
+  if(!d->map) return 1;
+
+  float *map = d->map;
+#ifdef _OPENMP
+  #pragma omp parallel for shared(map, modifier, roi_out) schedule(static)
+#endif
+  for(int j = 0; j < ht; j++)
+  {
+    for(int i = 0; i < wd; i++)
+    {
+      float *node = map + 8*(j*wd + i);
+      lf_modifier_apply_subpixel_geometry_distortion (
+        modifier, roi_out->x + i*LENS_MAP_STEP, roi_out->y + j*LENS_MAP_STEP, 1, 1, node);
+      node[6] = node[7] = 0.0f;
+    }
+  }
+
+  d->map_x = roi_out->x;
+  d->map_y = roi_out->y;
+  d->map_width = roi_out->width;
+  d->map_height = roi_out->height;
+  d->map_wd = wd;
+  d->map_ht = ht;
+  d->map_orig_w = orig_w;
+  d->map_orig_h = orig_h;
+  d->map_valid = 1;
+  return 0;
+}
+
+/* writes the distorted coordinates of row y of roi_out to pi, 6 floats per pixel, in the
+ * layout of lf_modifier_apply_subpixel_geometry_distortion(). */
+static void
+_lens_map_row(const dt_iop_lensfun_data_t *d, const int y, float *pi)
+{
+  const int wd = d->map_wd;
+  const int gy = y/LENS_MAP_STEP;
+  const __m128 fy = _mm_set1_ps((y - gy*LENS_MAP_STEP)/(float)LENS_MAP_STEP);
+  const float *row0 = d->map + 8*gy*wd;
+  const float *row1 = row0 + 8*wd;
+
+  for(int gx = 0; gx*LENS_MAP_STEP < d->map_width; gx++)
+  {
+    // interpolate the left and right nodes of this segment vertically first
+    const __m128 l0 = _mm_load_ps(row0 + 8*gx), l1 = _mm_load_ps(row0 + 8*gx + 4);
+    const __m128 r0 = _mm_load_ps(row0 + 8*gx + 8), r1 = _mm_load_ps(row0 + 8*gx + 12);
+    const __m128 left0  = _mm_add_ps(l0, _mm_mul_ps(fy, _mm_sub_ps(_mm_load_ps(row1 + 8*gx), l0)));
+    const __m128 left1  = _mm_add_ps(l1, _mm_mul_ps(fy, _mm_sub_ps(_mm_load_ps(row1 + 8*gx + 4), l1)));
+    const __m128 right0 = _mm_add_ps(r0, _mm_mul_ps(fy, _mm_sub_ps(_mm_load_ps(row1 + 8*gx + 8), r0)));
+    const __m128 right1 = _mm_add_ps(r1, _mm_mul_ps(fy, _mm_sub_ps(_mm_load_ps(row1 + 8*gx + 12), r1)));
+    const __m128 delta0 = _mm_sub_ps(right0, left0);
+    const __m128 delta1 = _mm_sub_ps(right1, left1);
+
+    const int x0 = gx*LENS_MAP_STEP;
+    const int x1 = MIN(x0 + LENS_MAP_STEP, d->map_width);
+    for(int x = x0; x < x1; x++)
+    {
+      const __m128 fx = _mm_set1_ps((x - x0)/(float)LENS_MAP_STEP);
+      __attribute__((aligned(16))) float px[8];
+      _mm_store_ps(px,     _mm_add_ps(left0, _mm_mul_ps(fx, delta0)));
+      _mm_store_ps(px + 4, _mm_add_ps(left1, _mm_mul_ps(fx, delta1)));
+      memcpy(pi + 6*x, px, 6*sizeof(float));
+    }
+  }
+}
+
+// the distortion itself can't be skipped for thumbnails, it moves the image,
+// but the interpolation error doesn't show at that size.
+// process() and the roi functions have to agree on the kernel width.
+static const struct dt_interpolation *
+_interpolation(dt_dev_pixelpipe_iop_t *piece)
+{
+  return dt_interpolation_new(dt_dev_pixelpipe_fast_thumbnail(piece->pipe) ? DT_INTERPOLATION_BILINEAR : DT_INTERPOLATION_USERPREF);
+}
+
 void
 process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
@@ -172,7 +273,8 @@ process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoi
         d->tmpbuf2 = (float *)dt_alloc_align(16, d->tmpbuf2_len);
       }
 
-      const struct  dt_interpolation* interpolation = dt_interpolation_new(DT_INTERPOLATION_USERPREF);
+      const struct  dt_interpolation* interpolation = _interpolation(piece);
+      const int use_map = !_lens_map_update(d, modifier, roi_out, orig_w, orig_h);
 
 #ifdef _OPENMP
       #pragma omp parallel for default(none) shared(roi_out, roi_in, in, d, ovoid, modifier, interpolation) schedule(static)
@@ -180,8 +282,9 @@ process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoi
       for (int y = 0; y < roi_out->height; y++)
       {
         float *pi = (float *)(((char *)d->tmpbuf2) + req2*dt_get_thread_num());
-        lf_modifier_apply_subpixel_geometry_distortion (
-          modifier, roi_out->x, roi_out->y+y, roi_out->width, 1, pi);
+        if(use_map) _lens_map_row(d, y, pi);
+        else lf_modifier_apply_subpixel_geometry_distortion (
+            modifier, roi_out->x, roi_out->y+y, roi_out->width, 1, pi);
         // reverse transform the global coords from lf to our buffer
         float *buf = ((float *)ovoid) + y*roi_out->width*ch;
         for (int x = 0; x < roi_out->width; x++,buf+=ch,pi+=6)
@@ -267,7 +370,8 @@ process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoi
         d->tmpbuf2 = (float *)dt_alloc_align(16, d->tmpbuf2_len);
       }
 
-      const struct dt_interpolation* interpolation = dt_interpolation_new(DT_INTERPOLATION_USERPREF);
+      const struct dt_interpolation* interpolation = _interpolation(piece);
+      const int use_map = !_lens_map_update(d, modifier, roi_out, orig_w, orig_h);
 
 #ifdef _OPENMP
       #pragma omp parallel for default(none) shared(roi_in, roi_out, d, ovoid, modifier, interpolation) schedule(static)
@@ -275,8 +379,9 @@ process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoi
       for (int y = 0; y < roi_out->height; y++)
       {
         float *pi = (float *)(((char *)d->tmpbuf2) + dt_get_thread_num()*req2);
-        lf_modifier_apply_subpixel_geometry_distortion (
-          modifier, roi_out->x, roi_out->y+y, roi_out->width, 1, pi);
+        if(use_map) _lens_map_row(d, y, pi);
+        else lf_modifier_apply_subpixel_geometry_distortion (
+            modifier, roi_out->x, roi_out->y+y, roi_out->width, 1, pi);
         // reverse transform the global coords from lf to our buffer
         float *out = ((float *)ovoid) + y*roi_out->width*ch;
         for (int x = 0; x < roi_out->width; x++,pi+=6)
@@ -318,6 +423,71 @@ process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoi
   }
 }
 
+// with the distortion corrected only, the pipeline can resample together with the neighbouring
+// distortions. tca needs a position per channel and the vignetting changes the pixels themselves.
+int warp_backtransform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in,
+                       const dt_iop_roi_t *roi_out, float *points, const int points_count)
+{
+  dt_iop_lensfun_data_t *d = (dt_iop_lensfun_data_t *)piece->data;
+  if(!points)
+  {
+    // process() would copy the pixels as they are:
+    d->warp_identity = 1;
+    if(!d->lens->Maker || d->crop <= 0.0f) return 2;
+
+    const float orig_w = roi_in->scale*piece->iwidth,
+                orig_h = roi_in->scale*piece->iheight;
+    dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+    lfModifier *modifier = lf_modifier_new(d->lens, d->crop, orig_w, orig_h);
+    const int modflags = lf_modifier_initialize(
+                           modifier, d->lens, LF_PF_F32,
+                           d->focal, d->aperture,
+                           d->distance, d->scale,
+                           d->target_geom, d->modify_flags, d->inverse);
+    dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+
+    int warp = 0;
+    if(!(modflags & (LF_MODIFY_TCA | LF_MODIFY_VIGNETTING | LF_MODIFY_CCI)))
+    {
+      if(!(modflags & (LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE)))
+        warp = 2;
+      else if(!_lens_map_update(d, modifier, roi_out, orig_w, orig_h))
+      {
+        d->warp_identity = 0;
+        warp = 1;
+      }
+    }
+    lf_modifier_destroy(modifier);
+
+    dt_iop_lensfun_gui_data_t *g = (dt_iop_lensfun_gui_data_t *)self->gui_data;
+    if(warp && g != NULL && self->dev->gui_attached && piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW)
+      g->corrections_done = (modflags & LENSFUN_MODFLAG_MASK);
+    return warp;
+  }
+  if(d->warp_identity) return 2;
+
+  // interpolate the green coordinates of the grid _lens_map_update() prepared above:
+  const int wd = d->map_wd;
+  for(int k=0; k<2*points_count; k+=2)
+  {
+    const float x = CLAMP(points[k],   0.0f, d->map_width - 1.0f)/LENS_MAP_STEP;
+    const float y = CLAMP(points[k+1], 0.0f, d->map_height - 1.0f)/LENS_MAP_STEP;
+    const int gx = MIN((int)x, wd - 2), gy = MIN((int)y, d->map_ht - 2);
+    const float fx = x - gx, fy = y - gy;
+    const float *n0 = d->map + 8*(gy*wd + gx);
+    const float *n1 = n0 + 8*wd;
+    for(int c=0; c<2; c++)
+    {
+      const float top = n0[2+c] + fx*(n0[8+2+c] - n0[2+c]);
+      const float bot = n1[2+c] + fx*(n1[8+2+c] - n1[2+c]);
+      points[k+c] = top + fy*(bot - top);
+    }
+    points[k]   -= roi_in->x;
+    points[k+1] -= roi_in->y;
+  }
+  return 1;
+}
+
 
 #ifdef HAVE_OPENCL
 int
@@ -364,7 +534,7 @@ process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem
     return TRUE;
   }
 
-  const struct dt_interpolation* interpolation = dt_interpolation_new(DT_INTERPOLATION_USERPREF);
+  const struct dt_interpolation* interpolation = _interpolation(piece);
 
   int ldkernel = -1;
 
@@ -413,14 +583,16 @@ process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem
     if(modflags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION |
                    LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE))
     {
+      const int use_map = !_lens_map_update(d, modifier, roi_out, orig_w, orig_h);
 #ifdef _OPENMP
       #pragma omp parallel for default(none) shared(roi_out, roi_in, tmpbuf, d, modifier) schedule(static)
 #endif
       for (int y = 0; y < roi_out->height; y++)
       {
         float *pi = tmpbuf + y * tmpbufwidth;
-        lf_modifier_apply_subpixel_geometry_distortion (
-          modifier, roi_out->x, roi_out->y+y, roi_out->width, 1, pi);
+        if(use_map) _lens_map_row(d, y, pi);
+        else lf_modifier_apply_subpixel_geometry_distortion (
+            modifier, roi_out->x, roi_out->y+y, roi_out->width, 1, pi);
       }
 
       /* _blocking_ memory transfer: host tmpbuf buffer -> opencl dev_tmpbuf */
@@ -522,14 +694,16 @@ process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem
     if(modflags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION |
                    LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE))
     {
+      const int use_map = !_lens_map_update(d, modifier, roi_out, orig_w, orig_h);
 #ifdef _OPENMP
       #pragma omp parallel for default(none) shared(roi_out, roi_in, tmpbuf, d, modifier) schedule(static)
 #endif
       for (int y = 0; y < roi_out->height; y++)
       {
         float *pi = tmpbuf + y * tmpbufwidth;
-        lf_modifier_apply_subpixel_geometry_distortion (
-          modifier, roi_out->x, roi_out->y+y, roi_out->width, 1, pi);
+        if(use_map) _lens_map_row(d, y, pi);
+        else lf_modifier_apply_subpixel_geometry_distortion (
+            modifier, roi_out->x, roi_out->y+y, roi_out->width, 1, pi);
       }
 
       /* _blocking_ memory transfer: host tmpbuf buffer -> opencl dev_tmpbuf */
@@ -702,7 +876,7 @@ void modify_roi_in(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *
       }
     }
 
-    const struct dt_interpolation* interpolation = dt_interpolation_new(DT_INTERPOLATION_USERPREF);
+    const struct dt_interpolation* interpolation = _interpolation(piece);
     roi_in->x = fmaxf(0.0f, xm-interpolation->width);
     roi_in->y = fmaxf(0.0f, ym-interpolation->width);
     roi_in->width = fminf(orig_w-roi_in->x, xM - roi_in->x + interpolation->width);
@@ -711,6 +885,66 @@ void modify_roi_in(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *
   lf_modifier_destroy(modifier);
 }
 
+// inverse of the above, for tiling: distorting the border of roi_in the other way around
+// is enough for its bounding box, and much cheaper than modify_roi_in() on all pixels.
+int invert_roi_in(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in, dt_iop_roi_t *roi_out)
+{
+  dt_iop_lensfun_data_t *d = (dt_iop_lensfun_data_t *)piece->data;
+  const float scale = roi_out->scale;
+  *roi_out = *roi_in;
+  roi_out->scale = scale;
+
+  if(!d->lens->Maker || d->crop <= 0.0f) return 1;
+
+  const float orig_w = roi_in->scale*piece->iwidth,
+              orig_h = roi_in->scale*piece->iheight;
+  lfModifier *modifier = lf_modifier_new(d->lens, d->crop, orig_w, orig_h);
+
+  int modflags = lf_modifier_initialize(
+                   modifier, d->lens, LF_PF_F32,
+                   d->focal, d->aperture,
+                   d->distance, d->scale,
+                   d->target_geom, d->modify_flags, !d->inverse);
+
+  if (modflags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION |
+                  LF_MODIFY_GEOMETRY | LF_MODIFY_SCALE))
+  {
+    // undo the interpolation margin, except at the image border where it was clamped
+    const struct dt_interpolation* interpolation = _interpolation(piece);
+    const int x0 = roi_in->x > 0 ? roi_in->x + interpolation->width : 0;
+    const int y0 = roi_in->y > 0 ? roi_in->y + interpolation->width : 0;
+    const int x1 = roi_in->x + roi_in->width  < (int)orig_w ? roi_in->x + roi_in->width  - interpolation->width : orig_w;
+    const int y1 = roi_in->y + roi_in->height < (int)orig_h ? roi_in->y + roi_in->height - interpolation->width : orig_h;
+    const int wd = MAX(x1 - x0, 1), ht = MAX(y1 - y0, 1);
+
+    float *buf = (float *)malloc(MAX(wd, ht)*2*3*sizeof(float));
+    float xm = INFINITY, xM = - INFINITY, ym = INFINITY, yM = - INFINITY;
+    // top, bottom, left and right border
+    const int edge[4][4] = { { x0, y0, wd, 1 }, { x0, y0+ht-1, wd, 1 }, { x0, y0, 1, ht }, { x0+wd-1, y0, 1, ht } };
+    for(int e=0; e<4; e++)
+    {
+      lf_modifier_apply_subpixel_geometry_distortion (
+        modifier, edge[e][0], edge[e][1], edge[e][2], edge[e][3], buf);
+      const float *pi = buf;
+      for(int k=0; k<3*edge[e][2]*edge[e][3]; k++, pi+=2)
+      {
+        xm = fminf(xm, pi[0]);
+        xM = fmaxf(xM, pi[0]);
+        ym = fminf(ym, pi[1]);
+        yM = fmaxf(yM, pi[1]);
+      }
+    }
+    free(buf);
+
+    roi_out->x = fmaxf(0.0f, xm);
+    roi_out->y = fmaxf(0.0f, ym);
+    roi_out->width = MAX(1, fminf(orig_w-roi_out->x, xM - roi_out->x));
+    roi_out->height = MAX(1, fminf(orig_h-roi_out->y, yM - roi_out->y));
+  }
+  lf_modifier_destroy(modifier);
+  return 1;
+}
+
 void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
   dt_iop_lensfun_params_t *p = (dt_iop_lensfun_params_t *)p1;
@@ -775,6 +1009,7 @@ void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pi
   d->aperture     = p->aperture;
   d->distance     = p->distance;
   d->target_geom  = p->target_geom;
+  d->map_valid    = 0;
 #endif
 }
 
@@ -790,6 +1025,10 @@ void init_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_p
   d->tmpbuf2 = NULL;
   d->tmpbuf_len = 0;
   d->tmpbuf = NULL;
+  d->map_len = 0;
+  d->map = NULL;
+  d->map_valid = 0;
+  d->warp_identity = 1;
   d->lens = lf_lens_new();
   self->commit_params(self, self->default_params, pipe, piece);
 #endif
@@ -804,6 +1043,7 @@ void cleanup_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_de
   lf_lens_destroy(d->lens);
   free(d->tmpbuf);
   free(d->tmpbuf2);
+  free(d->map);
   free(piece->data);
 #endif
 }
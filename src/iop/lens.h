@@ -108,6 +108,15 @@ typedef struct dt_iop_lensfun_data_t
   float aperture;
   float distance;
   lfLensType target_geom;
+  // distorted coordinates of a grid over the last roi_out, see _lens_map_update()
+  float *map;
+  size_t map_len;
+  int map_valid;
+  int map_x, map_y, map_width, map_height;
+  int map_wd, map_ht;
+  float map_orig_w, map_orig_h;
+  // the last warp_backtransform() found the coordinates unchanged
+  int warp_identity;
 }
 dt_iop_lensfun_data_t;
 
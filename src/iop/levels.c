@@ -29,6 +29,7 @@
 #include "gui/gtk.h"
 #include "dtgtk/button.h"
 #include "common/colorspaces.h"
+#include "common/curve_lut.h"
 #include "common/opencl.h"
 #include "libs/colorpicker.h"
 
@@ -55,56 +56,56 @@ flags ()
   return IOP_FLAGS_SUPPORTS_BLENDING;
 }
 
-void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+void process_pixels (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *in, float *out, const size_t npixels)
 {
-  const int ch = piece->colors;
   dt_iop_levels_data_t *d = (dt_iop_levels_data_t*)(piece->data);
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(roi_out, i, o, d) schedule(static)
-#endif
-  for(int k=0; k<roi_out->height; k++)
+  for(size_t k=0; k<npixels; k++, in+=4, out+=4)
   {
-    float *in = ((float *)i) + k*ch*roi_out->width;
-    float *out = ((float *)o) + k*ch*roi_out->width;
-    for (int j=0; j<roi_out->width; j++,in+=ch,out+=ch)
-    {
-      float L_in = in[0] / 100.0;
-
-      if(L_in <= d->in_low)
-      {
-        // Anything below the lower threshold just clips to zero
-        out[0] = 0;
-      }
-      else if(L_in >= d->in_high)
-      {
-        float percentage = (L_in - d->in_low) / (d->in_high - d->in_low);
-        out[0] = 100.0 * pow(percentage, d->in_inv_gamma);
-      }
-      else
-      {
-        // Within the expected input range we can use the lookup table
-        float percentage = (L_in - d->in_low) / (d->in_high - d->in_low);
-        //out[0] = 100.0 * pow(percentage, d->in_inv_gamma);
-        out[0] = d->lut[CLAMP((int)(percentage * 0xfffful), 0, 0xffff)];
-      }
-
-      // Preserving contrast
-      if(in[0] > 0.01f)
-      {
-        out[1] = in[1] * out[0]/in[0];
-        out[2] = in[2] * out[0]/in[0];
-      }
-      else
-      {
-        out[1] = in[1] * out[0]/0.01f;
-        out[2] = in[2] * out[0]/0.01f;
-      }
+    const float L = in[0], a = in[1], b = in[2];
+    float L_in = L / 100.0;
 
-      out[3] = in[3];
+    if(L_in <= d->in_low)
+    {
+      // Anything below the lower threshold just clips to zero
+      out[0] = 0;
+    }
+    else if(L_in >= d->in_high)
+    {
+      float percentage = (L_in - d->in_low) / (d->in_high - d->in_low);
+      out[0] = 100.0 * pow(percentage, d->in_inv_gamma);
+    }
+    else
+    {
+      // Within the expected input range we can use the lookup table
+      float percentage = (L_in - d->in_low) / (d->in_high - d->in_low);
+      //out[0] = 100.0 * pow(percentage, d->in_inv_gamma);
+      out[0] = dt_curve_lut_lookup(d->lut, percentage);
+    }
 
+    // Preserving contrast
+    if(L > 0.01f)
+    {
+      out[1] = a * out[0]/L;
+      out[2] = b * out[0]/L;
+    }
+    else
+    {
+      out[1] = a * out[0]/0.01f;
+      out[2] = b * out[0]/0.01f;
     }
+
+    out[3] = in[3];
   }
+}
 
+void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(self, piece, roi_out, i, o) schedule(static)
+#endif
+  for(int k=0; k<roi_out->height; k++)
+    process_pixels(self, piece, ((const float *)i) + (size_t)4*k*roi_out->width,
+                   ((float *)o) + (size_t)4*k*roi_out->width, roi_out->width);
 }
 
 #ifdef HAVE_OPENCL
@@ -508,7 +509,7 @@ static gboolean dt_iop_levels_expose(GtkWidget *widget, GdkEventExpose *event, g
       cairo_save(cr);
       cairo_scale(cr, width/63.0, -(height-5)/(float)hist_max);
       cairo_set_source_rgba(cr, .2, .2, .2, 0.5);
-      dt_draw_histogram_8(cr, hist, 0, dev->histogram_type == DT_DEV_HISTOGRAM_WAVEFORM?DT_DEV_HISTOGRAM_LOGARITHMIC:dev->histogram_type); // TODO: make draw handle waveform histograms
+      dt_draw_histogram_8(cr, hist, 0, dev->histogram_type == DT_DEV_HISTOGRAM_LINEAR?DT_DEV_HISTOGRAM_LINEAR:DT_DEV_HISTOGRAM_LOGARITHMIC); // TODO: make draw handle the scopes
       cairo_restore(cr);
     }
   }
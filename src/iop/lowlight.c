@@ -23,6 +23,7 @@
 #include <string.h>
 #include <inttypes.h>
 #include "common/colorspaces.h"
+#include "common/colorspaces_inline_conversions.h"
 #include "common/darktable.h"
 #include "common/debug.h"
 #include "common/opencl.h"
@@ -143,11 +144,11 @@ process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, v
   {
     float *in = (float *)i + ch*k;
     float *out = (float *)o + ch*k;
-    float XYZ[3], XYZ_s[3];
+    float XYZ[4] __attribute__((aligned(16)));
     float V;
     float w;
 
-    dt_Lab_to_XYZ(in, XYZ);
+    _mm_store_ps(XYZ, dt_Lab_to_XYZ_sse2(_mm_load_ps(in)));
 
     // calculate scotopic luminance
     if (XYZ[0] > threshold)
@@ -167,17 +168,14 @@ process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, v
     // blending coefficient from curve
     w = lookup(d->lut,in[0]/100.f);
 
-    XYZ_s[0] = V * XYZ_sw[0];
-    XYZ_s[1] = V * XYZ_sw[1];
-    XYZ_s[2] = V * XYZ_sw[2];
+    // blend with the scotopic white XYZ_s = V * XYZ_sw
+    const __m128 ww = _mm_set1_ps(w);
+    const __m128 XYZ_s = _mm_mul_ps(_mm_set1_ps(V), _mm_set_ps(0.0f, XYZ_sw[2], XYZ_sw[1], XYZ_sw[0]));
+    const __m128 XYZ_b = _mm_add_ps(_mm_mul_ps(ww, _mm_load_ps(XYZ)), _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(1.0f), ww), XYZ_s));
 
-    XYZ[0] = w * XYZ[0] + (1.0f - w) * XYZ_s[0];
-    XYZ[1] = w * XYZ[1] + (1.0f - w) * XYZ_s[1];
-    XYZ[2] = w * XYZ[2] + (1.0f - w) * XYZ_s[2];
-
-    dt_XYZ_to_Lab(XYZ,out);
-
-    out[3] = in[3];
+    const float alpha = in[3];
+    _mm_store_ps(out, dt_XYZ_to_Lab_sse2(XYZ_b));
+    out[3] = alpha;
   }
 }
 
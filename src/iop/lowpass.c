@@ -147,12 +147,17 @@ process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem
 
   if(!use_bilateral)
   {
-    g = dt_gaussian_init_cl(devid, width, height, channels, Labmax, Labmin, sigma, order);
-    if(!g) goto error;
-    err = dt_gaussian_blur_cl(g, dev_in, dev_out);
-    if(err != CL_SUCCESS) goto error;
-    dt_gaussian_free_cl(g);
-    g = NULL;
+    const uint64_t key = dt_dev_pixelpipe_blur_key(piece, roi_in, channels, Labmax, Labmin, sigma, order);
+    if(!dt_dev_pixelpipe_blur_get_cl(piece, key, dev_out, width, height))
+    {
+      g = dt_gaussian_init_cl(devid, width, height, channels, Labmax, Labmin, sigma, order);
+      if(!g) goto error;
+      err = dt_gaussian_blur_cl(g, dev_in, dev_out);
+      if(err != CL_SUCCESS) goto error;
+      dt_gaussian_free_cl(g);
+      g = NULL;
+      dt_dev_pixelpipe_blur_put_cl(piece, key, dev_out, width, height);
+    }
   }
   else
   {
@@ -261,10 +266,17 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
 
   if(!use_bilateral)
   {
-    dt_gaussian_t *g = dt_gaussian_init(width, height, ch, Labmax, Labmin, sigma, order);
-    if(!g) return;
-    dt_gaussian_blur_4c(g, in, out);
-    dt_gaussian_free(g);
+    // the darkroom keeps the blur, for changes of everything but the radius:
+    const uint64_t key = dt_dev_pixelpipe_blur_key(piece, roi_in, ch, Labmax, Labmin, sigma, order);
+    const size_t size = (size_t)ch*sizeof(float)*width*height;
+    if(!dt_dev_pixelpipe_blur_get(piece, key, out, size))
+    {
+      dt_gaussian_t *g = dt_gaussian_init(width, height, ch, Labmax, Labmin, sigma, order);
+      if(!g) return;
+      dt_gaussian_blur_4c(g, in, out);
+      dt_gaussian_free(g);
+      dt_dev_pixelpipe_blur_put(piece, key, out, size);
+    }
   }
   else
   {
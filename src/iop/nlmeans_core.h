@@ -0,0 +1,291 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_IOP_NLMEANS_CORE_H
+#define DT_IOP_NLMEANS_CORE_H
+
+// cpu version of the non-local means, shared by nlmeans and denoiseprofile.
+// the image is walked in tiles small enough that the input rows of all shifts and the output
+// stay in the l2 cache, and all shift vectors are done for one tile before going on to the next.
+// patch distances are sliding sums, vertically per column and horizontally per row.
+
+#include "common/darktable.h"
+#include "control/conf.h"
+#include "develop/pixelpipe.h"
+#include <string.h>
+#include <math.h>
+#include <xmmintrin.h>
+#ifdef DT_AVX2_CODEPATH
+#include <immintrin.h>
+#endif
+
+#define NLMEANS_TILE_WIDTH  128
+#define NLMEANS_TILE_HEIGHT 64
+
+typedef union floatint_t
+{
+  float f;
+  uint32_t i;
+}
+floatint_t;
+
+// very fast approximation for 2^-x (returns 0 for x > 126)
+static inline float
+fast_mexp2f(const float x)
+{
+  const float i1 = (float)0x3f800000u; // 2^0
+  const float i2 = (float)0x3f000000u; // 2^-1
+  const float k0 = i1 + x * (i2 - i1);
+  floatint_t k;
+  k.i = k0 >= (float)0x800000u ? k0 : 0;
+  return k.f;
+}
+
+/** the search radius K for the given pipe. the preview only has to give an impression, so by
+  * default it searches half as far and doesn't hold up the darkroom. */
+static inline int
+nlmeans_search_radius(const int K, const dt_dev_pixelpipe_type_t type)
+{
+  if(type == DT_DEV_PIXELPIPE_PREVIEW && dt_conf_get_bool("plugins/darkroom/denoise/fast_preview"))
+    return (K + 1)/2;
+  return K;
+}
+
+/** moves the vertical window sums s of n columns down by a row: adds the distances of the
+  * pixels inp to inps and subtracts those of inm to inms. */
+static inline void
+nlmeans_slide_columns(float *s, const float *inp, const float *inps, const float *inm, const float *inms,
+                      const int n, const float norm2[3])
+{
+  int i = 0;
+  for(; ((unsigned long)s & 0xf) != 0 && i<n; i++, inp+=4, inps+=4, inm+=4, inms+=4, s++)
+  {
+    float stmp = s[0];
+    for(int k=0; k<3; k++)
+      stmp += ((inp[k] - inps[k])*(inp[k] - inps[k])
+               -  (inm[k] - inms[k])*(inm[k] - inms[k])) * norm2[k];
+    s[0] = stmp;
+  }
+  /* Process most of the line 4 pixels at a time */
+  for(; i<n-4; i+=4, inp+=16, inps+=16, inm+=16, inms+=16, s+=4)
+  {
+    __m128 sv = _mm_load_ps(s);
+    const __m128 inp1 = _mm_load_ps(inp)    - _mm_load_ps(inps);
+    const __m128 inp2 = _mm_load_ps(inp+4)  - _mm_load_ps(inps+4);
+    const __m128 inp3 = _mm_load_ps(inp+8)  - _mm_load_ps(inps+8);
+    const __m128 inp4 = _mm_load_ps(inp+12) - _mm_load_ps(inps+12);
+
+    const __m128 inp12lo = _mm_unpacklo_ps(inp1,inp2);
+    const __m128 inp34lo = _mm_unpacklo_ps(inp3,inp4);
+    const __m128 inp12hi = _mm_unpackhi_ps(inp1,inp2);
+    const __m128 inp34hi = _mm_unpackhi_ps(inp3,inp4);
+
+    const __m128 inpv0 = _mm_movelh_ps(inp12lo,inp34lo);
+    sv += inpv0*inpv0 * _mm_set1_ps(norm2[0]);
+
+    const __m128 inpv1 = _mm_movehl_ps(inp34lo,inp12lo);
+    sv += inpv1*inpv1 * _mm_set1_ps(norm2[1]);
+
+    const __m128 inpv2 = _mm_movelh_ps(inp12hi,inp34hi);
+    sv += inpv2*inpv2 * _mm_set1_ps(norm2[2]);
+
+    const __m128 inm1 = _mm_load_ps(inm)    - _mm_load_ps(inms);
+    const __m128 inm2 = _mm_load_ps(inm+4)  - _mm_load_ps(inms+4);
+    const __m128 inm3 = _mm_load_ps(inm+8)  - _mm_load_ps(inms+8);
+    const __m128 inm4 = _mm_load_ps(inm+12) - _mm_load_ps(inms+12);
+
+    const __m128 inm12lo = _mm_unpacklo_ps(inm1,inm2);
+    const __m128 inm34lo = _mm_unpacklo_ps(inm3,inm4);
+    const __m128 inm12hi = _mm_unpackhi_ps(inm1,inm2);
+    const __m128 inm34hi = _mm_unpackhi_ps(inm3,inm4);
+
+    const __m128 inmv0 = _mm_movelh_ps(inm12lo,inm34lo);
+    sv -= inmv0*inmv0 * _mm_set1_ps(norm2[0]);
+
+    const __m128 inmv1 = _mm_movehl_ps(inm34lo,inm12lo);
+    sv -= inmv1*inmv1 * _mm_set1_ps(norm2[1]);
+
+    const __m128 inmv2 = _mm_movelh_ps(inm12hi,inm34hi);
+    sv -= inmv2*inmv2 * _mm_set1_ps(norm2[2]);
+
+    _mm_store_ps(s, sv);
+  }
+  for(; i<n; i++, inp+=4, inps+=4, inm+=4, inms+=4, s++)
+  {
+    float stmp = s[0];
+    for(int k=0; k<3; k++)
+      stmp += ((inp[k] - inps[k])*(inp[k] - inps[k])
+               -  (inm[k] - inms[k])*(inm[k] - inms[k])) * norm2[k];
+    s[0] = stmp;
+  }
+}
+
+#ifdef DT_AVX2_CODEPATH
+/** the same, eight columns at a time. the channels are gathered within each half of the registers,
+  * so the sums come out in the column order 0 2 4 6 1 3 5 7 and get permuted back before the store. */
+DT_TARGET_AVX2 static void
+nlmeans_slide_columns_avx2(float *s, const float *inp, const float *inps, const float *inm, const float *inms,
+                           const int n, const float norm2[3])
+{
+  const __m256 n0 = _mm256_set1_ps(norm2[0]), n1 = _mm256_set1_ps(norm2[1]), n2 = _mm256_set1_ps(norm2[2]);
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  int i = 0;
+  for(; i<n-8; i+=8, inp+=32, inps+=32, inm+=32, inms+=32, s+=8)
+  {
+#define DIST(a, b, d) do { \
+      const __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a),    _mm256_loadu_ps(b));    \
+      const __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(a+8),  _mm256_loadu_ps(b+8));  \
+      const __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(a+16), _mm256_loadu_ps(b+16)); \
+      const __m256 d4 = _mm256_sub_ps(_mm256_loadu_ps(a+24), _mm256_loadu_ps(b+24)); \
+      const __m256 lo12 = _mm256_unpacklo_ps(d1, d2), lo34 = _mm256_unpacklo_ps(d3, d4); \
+      const __m256 hi12 = _mm256_unpackhi_ps(d1, d2), hi34 = _mm256_unpackhi_ps(d3, d4); \
+      const __m256 c0 = _mm256_shuffle_ps(lo12, lo34, _MM_SHUFFLE(1, 0, 1, 0)); \
+      const __m256 c1 = _mm256_shuffle_ps(lo12, lo34, _MM_SHUFFLE(3, 2, 3, 2)); \
+      const __m256 c2 = _mm256_shuffle_ps(hi12, hi34, _MM_SHUFFLE(1, 0, 1, 0)); \
+      d = _mm256_fmadd_ps(_mm256_mul_ps(c2, c2), n2, _mm256_fmadd_ps(_mm256_mul_ps(c1, c1), n1, _mm256_mul_ps(_mm256_mul_ps(c0, c0), n0))); \
+    } while(0)
+    __m256 dp, dm;
+    DIST(inp, inps, dp);
+    DIST(inm, inms, dm);
+#undef DIST
+    const __m256 sv = _mm256_add_ps(_mm256_loadu_ps(s), _mm256_permutevar8x32_ps(_mm256_sub_ps(dp, dm), order));
+    _mm256_storeu_ps(s, sv);
+  }
+  nlmeans_slide_columns(s, inp, inps, inm, inms, n - i, norm2);
+}
+#endif
+
+typedef void (*nlmeans_slide_columns_t)(float *s, const float *inp, const float *inps, const float *inm,
+                                        const float *inms, const int n, const float norm2[3]);
+
+/** adds the weighted pixels of all shifts in [-K,K]^2 to out for the tile [x0,x1) x [y0,y1).
+  * in and out are width x height, 4 floats per pixel and 16 byte aligned. the patch distance is
+  * the sum of the squared channel differences scaled by norm2 over the (2P+1)^2 patch, its
+  * weight fast_mexp2f(max(0, dist*wscale - woffset)). out[3] collects the weights. S has to hold
+  * a row of the tile plus 2P+1 floats. */
+static inline void
+nlmeans_tile(const float *const in, float *const out, float *const S,
+             const int width, const int height, const int x0, const int x1, const int y0, const int y1,
+             const int P, const int K, const float norm2[3], const float wscale, const float woffset,
+             const nlmeans_slide_columns_t slide_columns)
+{
+  // the horizontal window of column i is centered at c(i) = clamp(i, P, width-1-P),
+  // so the sums of the columns [c(x0)-P, c(x1-1)+P] are needed
+  const int cmax = MAX(P, width-1-P);
+  const int sx0 = MAX(0, MIN(MAX(x0, P), cmax) - P);
+  const int sx1 = MIN(width, MIN(MAX(x1-1, P), cmax) + P + 1);
+
+  for(int kj=-K; kj<=K; kj++)
+  {
+    for(int ki=-K; ki<=K; ki++)
+    {
+      // columns where the shifted pixel is inside the image
+      const int ia = MAX(sx0, -ki);
+      const int ib = MIN(sx1, width + MIN(0, -ki));
+      int inited_slide = 0;
+      for(int j=y0; j<y1; j++)
+      {
+        if(j+kj < 0 || j+kj >= height) continue;
+
+        const int Pm = MIN(MIN(P, j+kj), j);
+        const int PM = MIN(MIN(P, height-1-j-kj), height-1-j);
+        // first line of the tile, and after the image borders
+        if(!inited_slide)
+        {
+          // sum up the columns
+          memset(S, 0x0, sizeof(float)*(sx1-sx0));
+          for(int jj=-Pm; jj<=PM; jj++)
+          {
+            float *s = S + ia - sx0;
+            const float *inp  = in + 4*(width*(j+jj) + ia);
+            const float *inps = in + 4*(width*(j+jj+kj) + ia + ki);
+            for(int i=ia; i<ib; i++, inp+=4, inps+=4, s++)
+            {
+              for(int k=0; k<3; k++)
+                s[0] += (inp[k] - inps[k])*(inp[k] - inps[k]) * norm2[k];
+            }
+          }
+          // only reuse this if we had a full stripe
+          if(Pm == P && PM == P) inited_slide = 1;
+        }
+
+        // sliding window for this line:
+        // only the columns whose shifted pixel is inside the image get a weight
+        const int oa = MAX(x0, -ki), ob = MIN(x1, width - ki);
+        const int c = MIN(MAX(x0, P), cmax);
+        const float *s = S - sx0;
+        float slide = 0.0f;
+        for(int i=MAX(0, c-P); i<=MIN(width-1, c+P); i++) slide += s[i];
+        // move the window up to the first of them
+        int i = x0 + 1;
+        for(; i<=oa && oa<ob; i++)
+          if(i > P && i <= cmax) slide += s[i+P] - s[i-P-1];
+        const float *ins = in + 4*(width*(j+kj) + oa + ki);
+        float *o = out + 4*(width*j + oa);
+        for(i=oa; i<ob; i++, ins+=4, o+=4)
+        {
+          if(i > oa && i > P && i <= cmax) slide += s[i+P] - s[i-P-1];
+          const __m128 iv = { ins[0], ins[1], ins[2], 1.0f };
+          _mm_store_ps(o, _mm_load_ps(o) + iv * _mm_set1_ps(fast_mexp2f(fmaxf(0.0f, slide*wscale - woffset))));
+        }
+
+        if(inited_slide && j+P+1+MAX(0,kj) < height)
+        {
+          // sliding window in j direction:
+          slide_columns(S + ia - sx0, in + 4*(width*(j+P+1) + ia), in + 4*(width*(j+P+1+kj) + ia + ki),
+                        in + 4*(width*(j-P) + ia), in + 4*(width*(j-P+kj) + ia + ki), ib - ia, norm2);
+        }
+        else inited_slide = 0;
+      }
+    }
+  }
+}
+
+/** runs nlmeans_tile() over the whole image, in parallel. out has to be zeroed. */
+static inline void
+nlmeans_process(const float *const in, float *const out, const int width, const int height,
+                const int P, const int K, const float norm2[3], const float wscale, const float woffset)
+{
+  const int tiles_x = (width  + NLMEANS_TILE_WIDTH  - 1)/NLMEANS_TILE_WIDTH;
+  const int tiles_y = (height + NLMEANS_TILE_HEIGHT - 1)/NLMEANS_TILE_HEIGHT;
+  // one row of a tile plus the window, rounded up to keep every thread's buffer aligned
+  const int slen = (MIN(width, NLMEANS_TILE_WIDTH + 2*P + 1) + 3) & ~3;
+  float *Sa = dt_alloc_align(64, sizeof(float)*slen*dt_get_num_threads());
+  nlmeans_slide_columns_t slide_columns = nlmeans_slide_columns;
+#ifdef DT_AVX2_CODEPATH
+  if(dt_codepath_avx2()) slide_columns = nlmeans_slide_columns_avx2;
+#endif
+
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) shared(Sa, slide_columns)
+#endif
+  for(int t=0; t<tiles_x*tiles_y; t++)
+  {
+    float *S = Sa + dt_get_thread_num() * slen;
+    const int x0 = (t % tiles_x) * NLMEANS_TILE_WIDTH;
+    const int y0 = (t / tiles_x) * NLMEANS_TILE_HEIGHT;
+    nlmeans_tile(in, out, S, width, height, x0, MIN(width, x0 + NLMEANS_TILE_WIDTH),
+                 y0, MIN(height, y0 + NLMEANS_TILE_HEIGHT), P, K, norm2, wscale, woffset, slide_columns);
+  }
+
+  free(Sa);
+}
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
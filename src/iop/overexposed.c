@@ -29,36 +29,6 @@
 
 DT_MODULE(3)
 
-typedef enum dt_iop_overexposed_colorscheme_t
-{
-  DT_IOP_OVEREXPOSED_BLACKWHITE = 0,
-  DT_IOP_OVEREXPOSED_REDBLUE = 1,
-  DT_IOP_OVEREXPOSED_PURPLEGREEN = 2
-}
-dt_iop_overexposed_colorscheme_t;
-
-static const float dt_iop_overexposed_colors[][2][4] =
-{
-  {
-    { 0.0f, 0.0f, 0.0f, 1.0f },    // black
-    { 1.0f, 1.0f, 1.0f, 1.0f }     // white
-  },
-  {
-    { 1.0f, 0.0f, 0.0f, 1.0f },    // red
-    { 0.0f, 0.0f, 1.0f, 1.0f }     // blue
-  },
-  {
-    { 0.371f, 0.434f, 0.934f, 1.0f }, // purple (#5f6fef)
-    { 0.512f, 0.934f, 0.371f, 1.0f }  // green  (#83ef5f)
-  }
-};
-
-typedef struct dt_iop_overexposed_global_data_t
-{
-  int kernel_overexposed;
-}
-dt_iop_overexposed_global_data_t;
-
 typedef struct dt_iop_overexposed_t
 {
   int dummy;
@@ -106,129 +76,16 @@ legacy_params (dt_iop_module_t *self, const void *const old_params, const int ol
 //   dt_accel_connect_slider_iop(self, "color scheme", GTK_WIDGET(g->colorscheme));
 // }
 
+// the indicators are drawn over the output of the pipe by the darkroom, see dt_dev_overexposed_overlay().
+// the module stays for the history stacks which have it, and is never part of a pipe.
 void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
-  dt_develop_t *dev = self->dev;
-
-  const int ch = piece->colors;
-
-  // FIXME: turn off the module instead?
-  if(!dev->overexposed.enabled || !dev->gui_attached)
-  {
-    memcpy(o, i, roi_out->width*roi_out->height*sizeof(float)*ch);
-    return;
-  }
-
-  const float lower  = dev->overexposed.lower / 100.0;
-  const float upper  = dev->overexposed.upper / 100.0;
-  const int colorscheme = dev->overexposed.colorscheme;
-
-  const float *upper_color  = dt_iop_overexposed_colors[colorscheme][0];
-  const float *lower_color = dt_iop_overexposed_colors[colorscheme][1];
-
-  float *in    = (float *)i;
-  float *out   = (float *)o;
-
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(roi_out, in, out, upper_color, lower_color) schedule(static)
-#endif
-  for(int k=0; k<roi_out->width*roi_out->height; k++)
-  {
-    float *inp = in + ch*k;
-    float *outp = out + ch*k;
-    if(inp[0] >= upper || inp[1] >= upper || inp[2] >= upper)
-    {
-      outp[0] = upper_color[0];
-      outp[1] = upper_color[1];
-      outp[2] = upper_color[2];
-    }
-    else if(inp[0] <= lower && inp[1] <= lower && inp[2] <= lower)
-    {
-      outp[0] = lower_color[0];
-      outp[1] = lower_color[1];
-      outp[2] = lower_color[2];
-    }
-    else
-    {
-      // TODO: memcpy()?
-      outp[0] = inp[0];
-      outp[1] = inp[1];
-      outp[2] = inp[2];
-    }
-
-    outp[3] = inp[3];
-  }
-}
-
-#ifdef HAVE_OPENCL
-int
-process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
-{
-  dt_develop_t *dev = self->dev;
-  dt_iop_overexposed_global_data_t *gd = (dt_iop_overexposed_global_data_t *)self->data;
-
-  cl_int err = -999;
-  const int devid = piece->pipe->devid;
-
-  const int width = roi_out->width;
-  const int height = roi_out->height;
-
-  const float lower  = dev->overexposed.lower / 100.0f;
-  const float upper  = dev->overexposed.upper / 100.0f;
-  const int colorscheme = dev->overexposed.colorscheme;
-
-  const float *upper_color  = dt_iop_overexposed_colors[colorscheme][0];
-  const float *lower_color = dt_iop_overexposed_colors[colorscheme][1];
-
-  if(!dev->overexposed.enabled || !dev->gui_attached)
-  {
-    size_t origin[] = { 0, 0, 0};
-    size_t region[] = { width, height, 1};
-    err = dt_opencl_enqueue_copy_image(devid, dev_in, dev_out, origin, origin, region);
-    if (err != CL_SUCCESS) goto error;
-    return TRUE;
-  }
-
-  size_t sizes[2] = { ROUNDUPWD(width), ROUNDUPHT(height) };
-  dt_opencl_set_kernel_arg(devid, gd->kernel_overexposed, 0, sizeof(cl_mem), &dev_in);
-  dt_opencl_set_kernel_arg(devid, gd->kernel_overexposed, 1, sizeof(cl_mem), &dev_out);
-  dt_opencl_set_kernel_arg(devid, gd->kernel_overexposed, 2, sizeof(int), &width);
-  dt_opencl_set_kernel_arg(devid, gd->kernel_overexposed, 3, sizeof(int), &height);
-  dt_opencl_set_kernel_arg(devid, gd->kernel_overexposed, 4, sizeof(float), &lower);
-  dt_opencl_set_kernel_arg(devid, gd->kernel_overexposed, 5, sizeof(float), &upper);
-  dt_opencl_set_kernel_arg(devid, gd->kernel_overexposed, 6, 4*sizeof(float), lower_color);
-  dt_opencl_set_kernel_arg(devid, gd->kernel_overexposed, 7, 4*sizeof(float), upper_color);
-  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_overexposed, sizes);
-  if(err != CL_SUCCESS) goto error;
-  return TRUE;
-
-error:
-  dt_print(DT_DEBUG_OPENCL, "[opencl_overexposed] couldn't enqueue kernel! %d\n", err);
-  return FALSE;
-}
-#endif
-
-
-void init_global(dt_iop_module_so_t *module)
-{
-  const int program = 2; // basic.cl from programs.conf
-  dt_iop_overexposed_global_data_t *gd = (dt_iop_overexposed_global_data_t *)malloc(sizeof(dt_iop_overexposed_global_data_t));
-  module->data = gd;
-  gd->kernel_overexposed = dt_opencl_create_kernel(program, "overexposed");
-}
-
-
-void cleanup_global(dt_iop_module_so_t *module)
-{
-  dt_iop_overexposed_global_data_t *gd = (dt_iop_overexposed_global_data_t *)module->data;
-  dt_opencl_free_kernel(gd->kernel_overexposed);
-  free(module->data);
-  module->data = NULL;
+  memcpy(o, i, (size_t)roi_out->width*roi_out->height*sizeof(float)*piece->colors);
 }
 
 void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-//   if(pipe->type != DT_DEV_PIXELPIPE_FULL) piece->enabled = 0;
+  piece->enabled = 0;
 }
 
 void init_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
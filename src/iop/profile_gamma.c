@@ -23,6 +23,7 @@
 #include <assert.h>
 #include <string.h>
 #include "develop/develop.h"
+#include "common/opencl.h"
 #include "control/control.h"
 #include "bauhaus/bauhaus.h"
 #include "gui/accelerators.h"
@@ -47,24 +48,91 @@ int flags ()
   return IOP_FLAGS_ONE_INSTANCE;
 }
 
+typedef struct dt_iop_profile_gamma_data_t
+{
+  float table[0x10000];      // precomputed look-up table
+}
+dt_iop_profile_gamma_data_t;
+
+typedef struct dt_iop_profile_gamma_global_data_t
+{
+  int kernel_profile_gamma;
+}
+dt_iop_profile_gamma_global_data_t;
+
 void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
 {
-  float *d = (float *)piece->data;
-  const float gamma  = d[0];
-  const float linear = d[1];
+  dt_iop_profile_gamma_data_t *d = (dt_iop_profile_gamma_data_t *)piece->data;
+
+  float *in = (float *)i;
+  float *out = (float *)o;
+  const int ch = piece->colors;
+  for(int k=0; k<roi_out->width*roi_out->height; k++)
+  {
+    out[0] = d->table[CLAMP((int)(in[0]*0x10000ul), 0, 0xffff)];
+    out[1] = d->table[CLAMP((int)(in[1]*0x10000ul), 0, 0xffff)];
+    out[2] = d->table[CLAMP((int)(in[2]*0x10000ul), 0, 0xffff)];
+    in += ch;
+    out += ch;
+  }
+
+  if(piece->pipe->mask_display)
+    dt_iop_alpha_copy(i, o, roi_out->width, roi_out->height);
+}
+
+#ifdef HAVE_OPENCL
+int
+process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_iop_profile_gamma_data_t *d = (dt_iop_profile_gamma_data_t *)piece->data;
+  dt_iop_profile_gamma_global_data_t *gd = (dt_iop_profile_gamma_global_data_t *)self->data;
+
+  cl_int err = -999;
+  cl_mem dev_table = NULL;
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+
+  dev_table = dt_opencl_copy_host_to_device(devid, d->table, 256, 256, sizeof(float));
+  if(dev_table == NULL) goto error;
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1};
+  dt_opencl_set_kernel_arg(devid, gd->kernel_profile_gamma, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_profile_gamma, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_profile_gamma, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_profile_gamma, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_profile_gamma, 4, sizeof(cl_mem), (void *)&dev_table);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_profile_gamma, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_table);
+  return TRUE;
+
+error:
+  if(dev_table != NULL) dt_opencl_release_mem_object(dev_table);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_profile_gamma] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
+{
+  const float *p = (const float *)p1;
+  dt_iop_profile_gamma_data_t *d = (dt_iop_profile_gamma_data_t *)piece->data;
+  const float gamma  = p[0];
+  const float linear = p[1];
 
-  float table[0x10000];
   float a, b, c, g;
   if(gamma == 1.0)
   {
-    for(int k=0; k<0x10000; k++) table[k] = 1.0*k/0x10000;
+    for(int k=0; k<0x10000; k++) d->table[k] = 1.0*k/0x10000;
   }
   else
   {
     if(linear == 0.0)
     {
       for(int k=0; k<0x10000; k++)
-        table[k] = powf(1.00*k/0x10000, gamma);
+        d->table[k] = powf(1.00*k/0x10000, gamma);
     }
     else
     {
@@ -85,25 +153,38 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
         float tmp;
         if (k<0x10000*linear) tmp = c*k/0x10000;
         else tmp = powf(a*k/0x10000+b, g);
-        table[k] = tmp;
+        d->table[k] = tmp;
       }
     }
   }
+}
 
-  float *in = (float *)i;
-  float *out = (float *)o;
-  const int ch = piece->colors;
-  for(int k=0; k<roi_out->width*roi_out->height; k++)
-  {
-    out[0] = table[CLAMP((int)(in[0]*0x10000ul), 0, 0xffff)];
-    out[1] = table[CLAMP((int)(in[1]*0x10000ul), 0, 0xffff)];
-    out[2] = table[CLAMP((int)(in[2]*0x10000ul), 0, 0xffff)];
-    in += ch;
-    out += ch;
-  }
+void init_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
+{
+  piece->data = malloc(sizeof(dt_iop_profile_gamma_data_t));
+  self->commit_params(self, self->default_params, pipe, piece);
+}
 
-  if(piece->pipe->mask_display)
-    dt_iop_alpha_copy(i, o, roi_out->width, roi_out->height);
+void cleanup_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
+{
+  free(piece->data);
+  piece->data = NULL;
+}
+
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 2; // basic.cl, from programs.conf
+  dt_iop_profile_gamma_global_data_t *gd = (dt_iop_profile_gamma_global_data_t *)malloc(sizeof(dt_iop_profile_gamma_global_data_t));
+  module->data = gd;
+  gd->kernel_profile_gamma = dt_opencl_create_kernel(program, "profile_gamma");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_profile_gamma_global_data_t *gd = (dt_iop_profile_gamma_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_profile_gamma);
+  free(module->data);
+  module->data = NULL;
 }
 
 void init(dt_iop_module_t *module)
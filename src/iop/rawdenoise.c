@@ -22,6 +22,7 @@
 #endif
 #include "bauhaus/bauhaus.h"
 #include "common/darktable.h"
+#include "common/opencl.h"
 #include "control/control.h"
 #include "develop/imageop.h"
 #include "gui/accelerators.h"
@@ -52,6 +53,10 @@ dt_iop_rawdenoise_data_t;
 
 typedef struct dt_iop_rawdenoise_global_data_t
 {
+  int kernel_rawdenoise_extract;
+  int kernel_rawdenoise_hat;
+  int kernel_rawdenoise_threshold;
+  int kernel_rawdenoise_combine;
 }
 dt_iop_rawdenoise_global_data_t;
 
@@ -62,7 +67,7 @@ const char *name()
 
 int flags()
 {
-  return IOP_FLAGS_SUPPORTS_BLENDING;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_THUMBNAIL_INVISIBLE;
 }
 
 int
@@ -128,11 +133,12 @@ hat_transform(float *temp, const float *const base, int stride, int size, int sc
 
 #define BIT16 65536.0
 
+static const float noise[] =
+{ 0.8002,0.2735,0.1202,0.0585,0.0291,0.0152,0.0080,0.0044 };
+
 static void wavelet_denoise(const float *const in, float *const out, const dt_iop_roi_t *const roi, float threshold, uint32_t filters)
 {
   int lev;
-  static const float noise[] =
-  { 0.8002,0.2735,0.1202,0.0585,0.0291,0.0152,0.0080,0.0044 };
 
   const int size = (roi->width/2+1) * (roi->height/2+1);
 #if 0
@@ -272,6 +278,110 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *
     memcpy(ovoid, ivoid, roi_out->width * roi_out->height * sizeof(float));
 }
 
+#ifdef HAVE_OPENCL
+int
+process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_iop_rawdenoise_data_t *d = (dt_iop_rawdenoise_data_t *)piece->data;
+  dt_iop_rawdenoise_global_data_t *gd = (dt_iop_rawdenoise_global_data_t *)self->data;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_in->width;
+  const int height = roi_in->height;
+  cl_int err = -999;
+  // the sum of the thresholded details and three planes to filter in, as on the cpu
+  cl_mem dev_plane[4] = { NULL };
+
+  if(d->threshold <= 0.0)
+  {
+    size_t origin[] = { 0, 0, 0 };
+    size_t region[] = { width, height, 1 };
+    err = dt_opencl_enqueue_copy_image(devid, dev_in, dev_out, origin, origin, region);
+    if(err != CL_SUCCESS) goto error;
+    return TRUE;
+  }
+
+  const int size = (width/2+1) * (height/2+1);
+  for(int k=0; k<4; k++)
+  {
+    dev_plane[k] = dt_opencl_alloc_device_buffer(devid, size*sizeof(float));
+    if(dev_plane[k] == NULL) goto error;
+  }
+
+  for(int c=0; c<4; c++)	/* denoise R,G1,B,G3 individually */
+  {
+    // adjust for odd width and height
+    const int halfwidth  = width / 2  + (width & (~(c >> 1)) & 1) ;
+    const int halfheight = height / 2 + (height & (~c) & 1) ;
+    const int ox = (c&2)>>1, oy = c&1;
+    size_t sizes[] = { ROUNDUPWD(halfwidth), ROUNDUPHT(halfheight), 1 };
+
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_extract, 0, sizeof(cl_mem), (void *)&dev_in);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_extract, 1, sizeof(cl_mem), (void *)&dev_plane[1]);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_extract, 2, sizeof(cl_mem), (void *)&dev_plane[0]);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_extract, 3, sizeof(int), (void *)&halfwidth);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_extract, 4, sizeof(int), (void *)&halfheight);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_extract, 5, sizeof(int), (void *)&ox);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_extract, 6, sizeof(int), (void *)&oy);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_rawdenoise_extract, sizes);
+    if(err != CL_SUCCESS) goto error;
+
+    int lastpass = 1;
+    for(int lev=0; lev < 5; lev++)
+    {
+      const int pass1 = (lev & 1)*2 + 1;
+      const int pass3 = 4 - pass1;
+      const int scale = 1 << lev;
+      for(int horizontal=0; horizontal<2; horizontal++)
+      {
+        // vertically from pass1 into plane 2, then horizontally into pass3
+        cl_mem src = horizontal ? dev_plane[2] : dev_plane[pass1];
+        cl_mem dst = horizontal ? dev_plane[pass3] : dev_plane[2];
+        dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat, 0, sizeof(cl_mem), (void *)&src);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat, 1, sizeof(cl_mem), (void *)&dst);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat, 2, sizeof(int), (void *)&halfwidth);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat, 3, sizeof(int), (void *)&halfheight);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat, 4, sizeof(int), (void *)&scale);
+        dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_hat, 5, sizeof(int), (void *)&horizontal);
+        err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_rawdenoise_hat, sizes);
+        if(err != CL_SUCCESS) goto error;
+      }
+
+      const float thold = d->threshold * noise[lev];
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_threshold, 0, sizeof(cl_mem), (void *)&dev_plane[0]);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_threshold, 1, sizeof(cl_mem), (void *)&dev_plane[pass1]);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_threshold, 2, sizeof(cl_mem), (void *)&dev_plane[pass3]);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_threshold, 3, sizeof(int), (void *)&halfwidth);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_threshold, 4, sizeof(int), (void *)&halfheight);
+      dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_threshold, 5, sizeof(float), (void *)&thold);
+      err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_rawdenoise_threshold, sizes);
+      if(err != CL_SUCCESS) goto error;
+
+      lastpass = pass3;
+    }
+
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_combine, 0, sizeof(cl_mem), (void *)&dev_out);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_combine, 1, sizeof(cl_mem), (void *)&dev_plane[0]);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_combine, 2, sizeof(cl_mem), (void *)&dev_plane[lastpass]);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_combine, 3, sizeof(int), (void *)&halfwidth);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_combine, 4, sizeof(int), (void *)&halfheight);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_combine, 5, sizeof(int), (void *)&ox);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_rawdenoise_combine, 6, sizeof(int), (void *)&oy);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_rawdenoise_combine, sizes);
+    if(err != CL_SUCCESS) goto error;
+  }
+
+  for(int k=0; k<4; k++) dt_opencl_release_mem_object(dev_plane[k]);
+  return TRUE;
+
+error:
+  for(int k=0; k<4; k++)
+    if(dev_plane[k] != NULL) dt_opencl_release_mem_object(dev_plane[k]);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_rawdenoise] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
 void reload_defaults(dt_iop_module_t *module)
 {
   // init defaults:
@@ -307,6 +417,26 @@ void cleanup(dt_iop_module_t *module)
   module->gui_data = NULL;
   free(module->params);
   module->params = NULL;
+}
+
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 17; // rawdenoise.cl, from programs.conf
+  dt_iop_rawdenoise_global_data_t *gd = (dt_iop_rawdenoise_global_data_t *)malloc(sizeof(dt_iop_rawdenoise_global_data_t));
+  module->data = gd;
+  gd->kernel_rawdenoise_extract = dt_opencl_create_kernel(program, "rawdenoise_extract");
+  gd->kernel_rawdenoise_hat = dt_opencl_create_kernel(program, "rawdenoise_hat");
+  gd->kernel_rawdenoise_threshold = dt_opencl_create_kernel(program, "rawdenoise_threshold");
+  gd->kernel_rawdenoise_combine = dt_opencl_create_kernel(program, "rawdenoise_combine");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_rawdenoise_global_data_t *gd = (dt_iop_rawdenoise_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_rawdenoise_extract);
+  dt_opencl_free_kernel(gd->kernel_rawdenoise_hat);
+  dt_opencl_free_kernel(gd->kernel_rawdenoise_threshold);
+  dt_opencl_free_kernel(gd->kernel_rawdenoise_combine);
   free(module->data);
   module->data = NULL;
 }
@@ -82,7 +82,7 @@ groups ()
 int
 flags ()
 {
-  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_THUMBNAIL_INVISIBLE;
 }
 
 void init_presets (dt_iop_module_so_t *self)
@@ -26,6 +26,7 @@
 #include <gegl.h>
 #endif
 #include "bauhaus/bauhaus.h"
+#include "common/box_filters.h"
 #include "common/colorspaces.h"
 #include "common/opencl.h"
 #include "develop/develop.h"
@@ -40,7 +41,6 @@
 
 #define MAX_RADIUS  32
 #define BOX_ITERATIONS 8
-#define BLOCKSIZE 2048		/* maximum blocksize. must be a power of 2 and will be automatically reduced if needed */
 
 #define CLIP(x) ((x<0)?0.0:(x>1.0)?1.0:x)
 #define LCLIP(x) ((x<0)?0.0:(x>100.0)?100.0:x)
@@ -74,8 +74,6 @@ dt_iop_soften_data_t;
 typedef struct dt_iop_soften_global_data_t
 {
   int kernel_soften_overexposed;
-  int kernel_soften_hblur;
-  int kernel_soften_vblur;
   int kernel_soften_mix;
 }
 dt_iop_soften_global_data_t;
@@ -144,89 +142,7 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   int rad = mrad*(fmin(100.0,data->size+1)/100.0);
   const int radius = MIN(mrad, ceilf(rad * roi_in->scale / piece->iscale));
 
-  /* horizontal blur out into out */
-  const int range = 2*radius+1;
-  const int hr = range/2;
-
-  const int size = roi_out->width > roi_out->height ? roi_out->width : roi_out->height;
-  float *scanline[3]= {0};
-  scanline[0]  = malloc((size*sizeof(float))*ch);
-  scanline[1]  = malloc((size*sizeof(float))*ch);
-  scanline[2]  = malloc((size*sizeof(float))*ch);
-
-  for(int iteration=0; iteration<BOX_ITERATIONS; iteration++)
-  {
-    int index=0;
-    for(int y=0; y<roi_out->height; y++)
-    {
-      for(int k=0; k<3; k++)
-      {
-        float L=0;
-        int hits = 0;
-        for(int x=-hr; x<roi_out->width; x++)
-        {
-          int op = x - hr-1;
-          int np = x+hr;
-          if(op>=0)
-          {
-            L-=out[(index+op)*ch+k];
-            hits--;
-          }
-          if(np < roi_out->width)
-          {
-            L+=out[(index+np)*ch+k];
-            hits++;
-          }
-          if(x>=0)
-            scanline[k][x] = L/hits;
-        }
-      }
-
-      for (int k=0; k<3; k++)
-        for (int x=0; x<roi_out->width; x++)
-          out[(index+x)*ch+k] = scanline[k][x];
-
-      index+=roi_out->width;
-    }
-
-    /* vertical pass on blurlightness */
-    const int opoffs = -(hr+1)*roi_out->width;
-    const int npoffs = (hr)*roi_out->width;
-    for(int x=0; x < roi_out->width; x++)
-    {
-      for(int k=0; k<3; k++)
-      {
-        float L=0;
-        int hits=0;
-        int index = -hr*roi_out->width+x;
-        for(int y=-hr; y<roi_out->height; y++)
-        {
-          int op=y-hr-1;
-          int np= y + hr;
-
-          if(op>=0)
-          {
-            L-=out[(index+opoffs)*ch+k];
-            hits--;
-          }
-          if(np < roi_out->height)
-          {
-            L+=out[(index+npoffs)*ch+k];
-            hits++;
-          }
-          if(y>=0)
-            scanline[k][y] = L/hits;
-          index += roi_out->width;
-        }
-      }
-
-      for(int k=0; k<3; k++)
-        for (int y=0; y<roi_out->height; y++)
-          out[(y*roi_out->width+x)*ch+k] = scanline[k][y];
-
-    }
-  }
-
+  dt_box_mean(out, roi_out->width, roi_out->height, ch, radius, BOX_ITERATIONS);
 
   const float amount = data->amount/100.0;
 #ifdef _OPENMP
@@ -240,10 +156,6 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
     out[index+2] = in[index+2]*(1-amount) + CLIP(out[index+2])*amount;
     out[index+3] = in[index+3];
   }
-
-  for(int i=0; i<3; ++i)
-    if(scanline[i])
-      free(scanline[i]);
 }
 
 #ifdef HAVE_OPENCL
@@ -255,7 +167,6 @@ process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem
 
   cl_int err = -999;
   cl_mem dev_tmp = NULL;
-  cl_mem dev_m = NULL;
 
   const int devid = piece->pipe->devid;
   const int width = roi_in->width;
@@ -272,57 +183,11 @@ process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem
   int rad = mrad*(fmin(100.0f, d->size+1)/100.0f);
   const int radius = MIN(mrad, ceilf(rad * roi_in->scale / piece->iscale));
 
-  /* sigma-radius correlation to match opencl vs. non-opencl. identified by numerical experiments but unproven. ask me if you need details. ulrich */
-  const float sigma = sqrt((radius * (radius + 1) * BOX_ITERATIONS + 2)/3.0f);
-  const int wdh = ceilf(3.0f * sigma);
-  const int wd = 2 * wdh + 1;
-  float mat[wd];
-  float *m = mat + wdh;
-  float weight = 0.0f;
-
-  // init gaussian kernel
-  for(int l=-wdh; l<=wdh; l++) weight += m[l] = expf(- (l*l)/(2.f*sigma*sigma));
-  for(int l=-wdh; l<=wdh; l++) m[l] /= weight;
-
-  // for(int l=-wdh; l<=wdh; l++) printf("%.6f ", (double)m[l]);
-  // printf("\n");
-
-
-  size_t maxsizes[3] = { 0 };        // the maximum dimensions for a work group
-  size_t workgroupsize = 0;          // the maximum number of items in a work group
-  unsigned long localmemsize = 0;    // the maximum amount of local memory we can use
-  size_t kernelworkgroupsize = 0;    // the maximum amount of items in work group for this kernel
-
-  // make sure blocksize is not too large
-  int blocksize = BLOCKSIZE;
-  if(dt_opencl_get_work_group_limits(devid, maxsizes, &workgroupsize, &localmemsize) == CL_SUCCESS &&
-      dt_opencl_get_kernel_work_group_size(devid, gd->kernel_soften_hblur, &kernelworkgroupsize) == CL_SUCCESS)
-  {
-    // reduce blocksize step by step until it fits to limits
-    while(blocksize > maxsizes[0] || blocksize > maxsizes[1] || blocksize > kernelworkgroupsize
-          || blocksize > workgroupsize || (blocksize+2*wdh)*4*sizeof(float) > localmemsize)
-    {
-      if(blocksize == 1) break;
-      blocksize >>= 1;
-    }
-  }
-  else
-  {
-    blocksize = 1;   // slow but safe
-  }
-
-  const size_t bwidth = width % blocksize == 0 ? width : (width / blocksize + 1)*blocksize;
-  const size_t bheight = height % blocksize == 0 ? height : (height / blocksize + 1)*blocksize;
-
   size_t sizes[3];
-  size_t local[3];
 
   dev_tmp = dt_opencl_alloc_device(devid, width, height, 4*sizeof(float));
   if (dev_tmp == NULL) goto error;
 
-  dev_m = dt_opencl_copy_host_to_device_constant(devid, sizeof(float)*wd, mat);
-  if (dev_m == NULL) goto error;
-
   /* overexpose image */
   sizes[0] = ROUNDUPWD(width);
   sizes[1] = ROUNDUPHT(height);
@@ -336,45 +201,9 @@ process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem
   err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_soften_overexposed, sizes);
   if(err != CL_SUCCESS) goto error;
 
-  if(rad != 0)
-  {
-    /* horizontal blur */
-    sizes[0] = bwidth;
-    sizes[1] = ROUNDUPHT(height);
-    sizes[2] = 1;
-    local[0] = blocksize;
-    local[1] = 1;
-    local[2] = 1;
-    dt_opencl_set_kernel_arg(devid, gd->kernel_soften_hblur, 0, sizeof(cl_mem), (void *)&dev_out);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_soften_hblur, 1, sizeof(cl_mem), (void *)&dev_tmp);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_soften_hblur, 2, sizeof(cl_mem), (void *)&dev_m);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_soften_hblur, 3, sizeof(int), (void *)&wdh);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_soften_hblur, 4, sizeof(int), (void *)&width);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_soften_hblur, 5, sizeof(int), (void *)&height);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_soften_hblur, 6, sizeof(int), (void *)&blocksize);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_soften_hblur, 7, (blocksize+2*wdh)*4*sizeof(float), NULL);
-    err = dt_opencl_enqueue_kernel_2d_with_local(devid, gd->kernel_soften_hblur, sizes, local);
-    if(err != CL_SUCCESS) goto error;
-
-
-    /* vertical blur */
-    sizes[0] = ROUNDUPWD(width);
-    sizes[1] = bheight;
-    sizes[2] = 1;
-    local[0] = 1;
-    local[1] = blocksize;
-    local[2] = 1;
-    dt_opencl_set_kernel_arg(devid, gd->kernel_soften_vblur, 0, sizeof(cl_mem), (void *)&dev_tmp);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_soften_vblur, 1, sizeof(cl_mem), (void *)&dev_out);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_soften_vblur, 2, sizeof(cl_mem), (void *)&dev_m);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_soften_vblur, 3, sizeof(int), (void *)&wdh);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_soften_vblur, 4, sizeof(int), (void *)&width);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_soften_vblur, 5, sizeof(int), (void *)&height);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_soften_vblur, 6, sizeof(int), (void *)&blocksize);
-    dt_opencl_set_kernel_arg(devid, gd->kernel_soften_vblur, 7, (blocksize+2*wdh)*4*sizeof(float), NULL);
-    err = dt_opencl_enqueue_kernel_2d_with_local(devid, gd->kernel_soften_vblur, sizes, local);
-    if(err != CL_SUCCESS) goto error;
-  }
+  /* the same box blur as on the cpu */
+  err = dt_box_mean_cl(devid, dev_out, dev_tmp, width, height, radius, BOX_ITERATIONS);
+  if(err != CL_SUCCESS) goto error;
 
   /* mixing out and in -> out */
   sizes[0] = ROUNDUPWD(width);
@@ -389,12 +218,10 @@ process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem
   err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_soften_mix, sizes);
   if(err != CL_SUCCESS) goto error;
 
-  if (dev_m != NULL) dt_opencl_release_mem_object(dev_m);
   if (dev_tmp != NULL) dt_opencl_release_mem_object(dev_tmp);
   return TRUE;
 
 error:
-  if (dev_m != NULL) dt_opencl_release_mem_object(dev_m);
   if (dev_tmp != NULL) dt_opencl_release_mem_object(dev_tmp);
   dt_print(DT_DEBUG_OPENCL, "[opencl_soften] couldn't enqueue kernel! %d\n", err);
   return FALSE;
@@ -412,7 +239,7 @@ void tiling_callback (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_
   int rad = mrad*(fmin(100.0f, d->size+1)/100.0f);
   const int radius = MIN(mrad, ceilf(rad * roi_in->scale / piece->iscale));
 
-  /* sigma-radius correlation to match opencl vs. non-opencl. identified by numerical experiments but unproven. ask me if you need details. ulrich */
+  /* standard deviation of the iterated box blur, it doesn't reach much further than three of it */
   const float sigma = sqrt((radius * (radius + 1) * BOX_ITERATIONS + 2)/3.0f);
   const int wdh = ceilf(3.0f * sigma);
 
@@ -431,8 +258,6 @@ void init_global(dt_iop_module_so_t *module)
   dt_iop_soften_global_data_t *gd = (dt_iop_soften_global_data_t *)malloc(sizeof(dt_iop_soften_global_data_t));
   module->data = gd;
   gd->kernel_soften_overexposed = dt_opencl_create_kernel(program, "soften_overexposed");
-  gd->kernel_soften_hblur = dt_opencl_create_kernel(program, "soften_hblur");
-  gd->kernel_soften_vblur = dt_opencl_create_kernel(program, "soften_vblur");
   gd->kernel_soften_mix = dt_opencl_create_kernel(program, "soften_mix");
 }
 
@@ -440,8 +265,6 @@ void cleanup_global(dt_iop_module_so_t *module)
 {
   dt_iop_soften_global_data_t *gd = (dt_iop_soften_global_data_t *)module->data;
   dt_opencl_free_kernel(gd->kernel_soften_overexposed);
-  dt_opencl_free_kernel(gd->kernel_soften_hblur);
-  dt_opencl_free_kernel(gd->kernel_soften_vblur);
   dt_opencl_free_kernel(gd->kernel_soften_mix);
   free(module->data);
   module->data = NULL;
@@ -21,6 +21,7 @@
 #include "develop/imageop.h"
 #include "develop/masks.h"
 #include "develop/blend.h"
+#include "develop/pixelpipe_cache.h"
 #include "control/control.h"
 #include "control/conf.h"
 #include "gui/gtk.h"
@@ -46,7 +47,35 @@ typedef struct dt_iop_spots_gui_data_t
 }
 dt_iop_spots_gui_data_t;
 
-typedef struct dt_iop_spots_params_t dt_iop_spots_data_t;
+/** one spot rendered for the rois of the last run */
+typedef struct dt_iop_spots_spot_t
+{
+  uint64_t hash;  // form, algorithm, rois and input
+  int x, y;       // top left corner of the mask, in roi_out coordinates
+  int w, h;       // size of the mask, 0 if the spot doesn't touch roi_out
+  int dx, dy;     // the source of (x, y) is (x-dx, y-dy)
+  float *mask;    // w*h opacities, 0 where the source is outside roi_in
+}
+dt_iop_spots_spot_t;
+
+typedef struct dt_iop_spots_data_t
+{
+  int clone_id[64];
+  int clone_algo[64];
+  // the spots and the output of the last run, to redraw only the areas of the spots which changed
+  int num_spots;
+  dt_iop_spots_spot_t spot[64];
+  uint64_t hash;  // input and rois of out
+  float *out;
+  size_t out_size;
+}
+dt_iop_spots_data_t;
+
+typedef struct dt_iop_spots_global_data_t
+{
+  int kernel_spots;
+}
+dt_iop_spots_global_data_t;
 
 // this returns a translatable name
 const char *name()
@@ -265,169 +294,406 @@ void modify_roi_in(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *
   roi_in->height = CLAMP(roib-roi_in->y, 1, piece->pipe->iheight*roi_in->scale-roi_in->y);
 }
 
-void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+/** renders the mask of one spot for the given rois. spot->w is 0 if there is nothing to do. */
+static void _spot_render(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form, const int algo, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, dt_iop_spots_spot_t *spot)
 {
-  dt_iop_spots_params_t *d = (dt_iop_spots_params_t *)piece->data;
-  dt_develop_blend_params_t *bp = self->blend_params;
+  spot->w = spot->h = 0;
+  spot->mask = NULL;
 
-  const int ch = piece->colors;
-  const float *in = (float *)i;
-  float *out = (float *)o;
+  //we get the area for the form
+  int fl,ft,fw,fh;
+  if (!dt_masks_get_area(self,piece,form,&fw,&fh,&fl,&ft)) return;
 
-  // we don't modify most of the image:
-#ifdef _OPENMP
-  #pragma omp parallel for schedule(static) default(none) shared(out,in,roi_in,roi_out)
-#endif
-  for (int k=0; k<roi_out->height; k++)
+  //if the form is outside the roi, we just skip it
+  fw *= roi_in->scale, fh *= roi_in->scale, fl *= roi_in->scale, ft *= roi_in->scale;
+  if (ft>=roi_out->y+roi_out->height || ft+fh<=roi_out->y || fl>=roi_out->x+roi_out->width || fl+fw<=roi_out->x) return;
+
+  if (algo == 1 && (form->type & DT_MASKS_CIRCLE))
   {
-    float *outb = out + ch*k*roi_out->width;
-    const float *inb =  in + ch*roi_in->width*(k+roi_out->y-roi_in->y) + ch*(roi_out->x-roi_in->x);
-    memcpy(outb, inb, sizeof(float)*roi_out->width*ch);
+    dt_masks_point_circle_t *circle = (dt_masks_point_circle_t *)g_list_nth_data(form->points,0);
+    // convert from world space:
+    const int rad = circle->radius* MIN(piece->buf_in.width, piece->buf_in.height)*roi_in->scale;
+    const int posx  = (circle->center[0] * piece->buf_in.width)*roi_in->scale - rad;
+    const int posy  = (circle->center[1] * piece->buf_in.height)*roi_in->scale - rad;
+    const int posx_source = (form->source[0]*piece->buf_in.width)*roi_in->scale - rad;
+    const int posy_source = (form->source[1]*piece->buf_in.height)*roi_in->scale - rad;
+    spot->dx = posx-posx_source;
+    spot->dy = posy-posy_source;
+
+    float filter[2*rad + 1];
+    if(rad > 0)
+    {
+      for(int k=-rad; k<=rad; k++)
+      {
+        const float kk = 1.0f - fabsf(k/(float)rad);
+        filter[rad + k] = kk*kk*(3.0f - 2.0f*kk);
+      }
+    }
+    else
+    {
+      filter[0] = 1.0f;
+    }
+
+    spot->x = MAX(posx, roi_out->x);
+    spot->y = MAX(posy, roi_out->y);
+    spot->w = MIN(posx+2*rad, roi_out->x+roi_out->width) - spot->x;
+    spot->h = MIN(posy+2*rad, roi_out->y+roi_out->height) - spot->y;
+    if (spot->w <= 0 || spot->h <= 0 || !(spot->mask = malloc(sizeof(float)*spot->w*spot->h)))
+    {
+      spot->w = spot->h = 0;
+      return;
+    }
+    for (int yy=spot->y; yy<spot->y+spot->h; yy++)
+    {
+      float *m = spot->mask + (yy-spot->y)*spot->w - spot->x;
+      //we test if the source point is inside roi_in
+      const int sy = yy-spot->dy >= roi_in->y && yy-spot->dy < roi_in->y+roi_in->height;
+      for (int xx=spot->x; xx<spot->x+spot->w; xx++)
+      {
+        const int sx = xx-spot->dx >= roi_in->x && xx-spot->dx < roi_in->x+roi_in->width;
+        m[xx] = (sx && sy) ? filter[xx-posx+1]*filter[yy-posy+1] : 0.0f;
+      }
+    }
   }
+  else
+  {
+    //we get the mask
+    float *mask;
+    int posx,posy,width,height;
+    if (!dt_masks_get_mask(self,piece,form,&mask,&width,&height,&posx,&posy)) return;
+    const int fts = posy*roi_in->scale, fhs = height*roi_in->scale, fls = posx*roi_in->scale, fws = width*roi_in->scale;
+    //now we search the delta with the source
+    spot->dx = spot->dy = 0;
+    if (form->type & DT_MASKS_PATH)
+    {
+      dt_masks_point_path_t *pt = (dt_masks_point_path_t *)g_list_nth_data(form->points,0);
+      spot->dx = pt->corner[0]*roi_in->scale*piece->buf_in.width - form->source[0]*roi_in->scale*piece->buf_in.width;
+      spot->dy = pt->corner[1]*roi_in->scale*piece->buf_in.height - form->source[1]*roi_in->scale*piece->buf_in.height;
+    }
+    else if (form->type & DT_MASKS_CIRCLE)
+    {
+      dt_masks_point_circle_t *pt = (dt_masks_point_circle_t *)g_list_nth_data(form->points,0);
+      spot->dx = pt->center[0]*roi_in->scale*piece->buf_in.width - form->source[0]*roi_in->scale*piece->buf_in.width;
+      spot->dy = pt->center[1]*roi_in->scale*piece->buf_in.height - form->source[1]*roi_in->scale*piece->buf_in.height;
+    }
+    if (spot->dx!=0 || spot->dy!=0)
+    {
+      spot->x = MAX(fls+1, roi_out->x);
+      spot->y = MAX(fts+1, roi_out->y);
+      spot->w = MIN(fls+fws-1, roi_out->x+roi_out->width) - spot->x;
+      spot->h = MIN(fts+fhs-1, roi_out->y+roi_out->height) - spot->y;
+      if (spot->w <= 0 || spot->h <= 0 || !(spot->mask = malloc(sizeof(float)*spot->w*spot->h))) spot->w = spot->h = 0;
+      for (int yy=spot->y; yy<spot->y+spot->h; yy++)
+      {
+        float *m = spot->mask + (yy-spot->y)*spot->w - spot->x;
+        //we test if the source point is inside roi_in
+        const int sy = yy-spot->dy >= roi_in->y && yy-spot->dy < roi_in->y+roi_in->height;
+        for (int xx=spot->x; xx<spot->x+spot->w; xx++)
+        {
+          const int sx = xx-spot->dx >= roi_in->x && xx-spot->dx < roi_in->x+roi_in->width;
+          m[xx] = (sx && sy) ? mask[((int)((yy-fts)/roi_in->scale))*width + (int)((xx-fls)/roi_in->scale)] : 0.0f;  //we can add the opacity here
+        }
+      }
+    }
+    free(mask);
+  }
+}
+
+/** clones the part of the spot inside the rectangle [x0, x1) x [y0, y1). */
+static void _spot_apply(const dt_iop_spots_spot_t *spot, const float *in, float *out, const int ch, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, const int x0, const int y0, const int x1, const int y1)
+{
+  const int xa = MAX(spot->x, x0), xb = MIN(spot->x+spot->w, x1);
+  const int ya = MAX(spot->y, y0), yb = MIN(spot->y+spot->h, y1);
+  for (int yy=ya; yy<yb; yy++)
+  {
+    const float *m = spot->mask + (yy-spot->y)*spot->w - spot->x;
+    float *o = out + ch*(roi_out->width*(yy-roi_out->y) - roi_out->x);
+    const float *i = in + ch*(roi_in->width*(yy-spot->dy-roi_in->y) - spot->dx - roi_in->x);
+    for (int xx=xa; xx<xb; xx++)
+    {
+      const float f = m[xx];
+      if (f == 0.0f) continue;
+      for(int c=0; c<ch; c++)
+        o[ch*xx+c] = o[ch*xx+c] * (1.0f-f) + i[ch*xx+c] * f;
+    }
+  }
+}
+
+/** the input of the module and the rois, the cached output is only valid for those. */
+static uint64_t _spots_input_hash(dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_dev_pixelpipe_t *pipe = piece->pipe;
+  uint64_t hash = dt_dev_pixelpipe_cache_hash(pipe->image.id, roi_in, pipe, g_list_index(pipe->nodes, piece));
+  const char *str = (const char *)roi_out;
+  for(size_t i=0; i<sizeof(dt_iop_roi_t); i++) hash = ((hash << 5) + hash) ^ str[i];
+  return hash;
+}
+
+static uint64_t _spot_hash(dt_masks_form_t *form, const int algo, const uint64_t input)
+{
+  uint64_t hash = ((input << 5) + input) ^ algo;
+  const int length = dt_masks_group_get_hash_buffer_length(form);
+  char *str = malloc(length);
+  if (!str) return 0;
+  dt_masks_group_get_hash_buffer(form,str);
+  for(int i=0; i<length; i++) hash = ((hash << 5) + hash) ^ str[i];
+  free(str);
+  return hash;
+}
+
+static void _spots_free(dt_iop_spots_data_t *d)
+{
+  for (int k=0; k<d->num_spots; k++) free(d->spot[k].mask);
+  d->num_spots = 0;
+}
+
+/** brings the list of spots up to date. the spots which didn't change keep their mask. returns the
+  * number of rectangles which changed since the last run, or -1 if everything has to be redrawn. */
+static int _spots_update(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, const uint64_t input, int dirty[][4])
+{
+  dt_iop_spots_data_t *d = (dt_iop_spots_data_t *)piece->data;
+  dt_develop_blend_params_t *bp = self->blend_params;
+
+  dt_iop_spots_spot_t spot[64];
+  int used[64] = {0};
+  int num = 0, ndirty = 0, order = -1, redraw = 0;
 
   // iterate through all forms
   dt_masks_form_t *grp = dt_masks_get_from_id(self->dev,bp->mask_id);
-  int pos=0;
   if (grp && (grp->type & DT_MASKS_GROUP))
   {
-    GList *forms = g_list_first(grp->points);
-    while(forms)
+    for (GList *forms = g_list_first(grp->points); forms && num<64; forms = g_list_next(forms))
     {
       dt_masks_point_group_t *grpt = (dt_masks_point_group_t *)forms->data;
       //we get the spot
       dt_masks_form_t *form = dt_masks_get_from_id(self->dev,grpt->formid);
-      if (!form)
+      const int pos = num++;
+      spot[pos].w = spot[pos].h = 0;
+      spot[pos].mask = NULL;
+      spot[pos].hash = 0;
+      if (!form) continue;
+      spot[pos].hash = _spot_hash(form,d->clone_algo[pos],input);
+
+      //the same spot as last time?
+      int k = 0;
+      while (k<d->num_spots && (used[k] || d->spot[k].hash != spot[pos].hash)) k++;
+      if (k<d->num_spots)
       {
-        forms = g_list_next(forms);
-        pos++;
+        spot[pos] = d->spot[k];
+        used[k] = 1;
+        //overlapping spots are cloned in order, so the order has to stay the same
+        if (k < order) redraw = 1;
+        order = k;
         continue;
       }
-      //we get the area for the form
-      int fl,ft,fw,fh;
-      if (!dt_masks_get_area(self,piece,form,&fw,&fh,&fl,&ft))
+      _spot_render(self,piece,form,d->clone_algo[pos],roi_in,roi_out,spot+pos);
+      if (spot[pos].w > 0)
       {
-        forms = g_list_next(forms);
-        pos++;
-        continue;
+        dirty[ndirty][0] = spot[pos].x, dirty[ndirty][1] = spot[pos].y;
+        dirty[ndirty][2] = spot[pos].x+spot[pos].w, dirty[ndirty][3] = spot[pos].y+spot[pos].h;
+        ndirty++;
       }
+    }
+  }
 
-      //if the form is outside the roi, we just skip it
-      fw *= roi_in->scale, fh *= roi_in->scale, fl *= roi_in->scale, ft *= roi_in->scale;
-      if (ft>=roi_out->y+roi_out->height || ft+fh<=roi_out->y || fl>=roi_out->x+roi_out->width || fl+fw<=roi_out->x)
-      {
-        forms = g_list_next(forms);
-        pos++;
-        continue;
-      }
-      if (d->clone_algo[pos] == 1 && (form->type & DT_MASKS_CIRCLE))
-      {
-        dt_masks_point_circle_t *circle = (dt_masks_point_circle_t *)g_list_nth_data(form->points,0);
-        // convert from world space:
-        const int rad = circle->radius* MIN(piece->buf_in.width, piece->buf_in.height)*roi_in->scale;
-        const int posx  = (circle->center[0] * piece->buf_in.width)*roi_in->scale - rad;
-        const int posy  = (circle->center[1] * piece->buf_in.height)*roi_in->scale - rad;
-        const int posx_source = (form->source[0]*piece->buf_in.width)*roi_in->scale - rad;
-        const int posy_source = (form->source[1]*piece->buf_in.height)*roi_in->scale - rad;
-        const int dx = posx-posx_source;
-        const int dy = posy-posy_source;
-        fw = fh = 2*rad;
-
-        // convert from world space:
-        float filter[2*rad + 1];
-
-        if(rad > 0)
-        {
-          for(int k=-rad; k<=rad; k++)
-          {
-            const float kk = 1.0f - fabsf(k/(float)rad);
-            filter[rad + k] = kk*kk*(3.0f - 2.0f*kk);
-          }
-        }
-        else
-        {
-          filter[0] = 1.0f;
-        }
-        for (int yy=posy ; yy<posy+fh; yy++)
-        {
-          //we test if we are inside roi_out
-          if (yy<roi_out->y || yy>=roi_out->y+roi_out->height) continue;
-          //we test if the source point is inside roi_in
-          if (yy-dy<roi_in->y || yy-dy>=roi_in->y+roi_in->height) continue;
-          for (int xx=posx ; xx<posx+fw; xx++)
-          {
-            //we test if we are inside roi_out
-            if (xx<roi_out->x || xx>=roi_out->x+roi_out->width) continue;
-            //we test if the source point is inside roi_in
-            if (xx-dx<roi_in->x || xx-dx>=roi_in->x+roi_in->width) continue;
-
-            const float f = filter[xx-posx+1]*filter[yy-posy+1];
-            for(int c=0; c<ch; c++)
-              out[4*(roi_out->width*(yy-roi_out->y) + xx-roi_out->x) + c] =
-                out[4*(roi_out->width*(yy-roi_out->y) + xx-roi_out->x) + c] * (1.0f-f) +
-                in[4*(roi_in->width*(yy-posy+posy_source-roi_in->y) + xx-posx+posx_source-roi_in->x) + c] * f;
-          }
-        }
-      }
-      else
-      {
-        //we get the mask
-        float *mask;
-        int posx,posy,width,height;
-        dt_masks_get_mask(self,piece,form,&mask,&width,&height,&posx,&posy);
-        int fts = posy*roi_in->scale, fhs = height*roi_in->scale, fls = posx*roi_in->scale, fws = width*roi_in->scale;
-        //now we search the delta with the source
-        int dx,dy;
-        dx=dy=0;
-        if (form->type & DT_MASKS_PATH)
-        {
-          dt_masks_point_path_t *pt = (dt_masks_point_path_t *)g_list_nth_data(form->points,0);
-          dx = pt->corner[0]*roi_in->scale*piece->buf_in.width - form->source[0]*roi_in->scale*piece->buf_in.width;
-          dy = pt->corner[1]*roi_in->scale*piece->buf_in.height - form->source[1]*roi_in->scale*piece->buf_in.height;
-        }
-        else if (form->type & DT_MASKS_CIRCLE)
-        {
-          dt_masks_point_circle_t *pt = (dt_masks_point_circle_t *)g_list_nth_data(form->points,0);
-          dx = pt->center[0]*roi_in->scale*piece->buf_in.width - form->source[0]*roi_in->scale*piece->buf_in.width;
-          dy = pt->center[1]*roi_in->scale*piece->buf_in.height - form->source[1]*roi_in->scale*piece->buf_in.height;
-        }
-        if (dx!=0 || dy!=0)
-        {
-          //now we do the pixel clone
-          for (int yy=fts+1 ; yy<fts+fhs-1; yy++)
-          {
-            //we test if we are inside roi_out
-            if (yy<roi_out->y || yy>=roi_out->y+roi_out->height) continue;
-            //we test if the source point is inside roi_in
-            if (yy-dy<roi_in->y || yy-dy>=roi_in->y+roi_in->height) continue;
-            for (int xx=fls+1 ; xx<fls+fws-1; xx++)
-            {
-              //we test if we are inside roi_out
-              if (xx<roi_out->x || xx>=roi_out->x+roi_out->width) continue;
-              //we test if the source point is inside roi_in
-              if (xx-dx<roi_in->x || xx-dx>=roi_in->x+roi_in->width) continue;
-
-              float f = mask[((int)((yy-fts)/roi_in->scale))*width + (int)((xx-fls)/roi_in->scale)];  //we can add the opacity here
-
-              for(int c=0; c<ch; c++)
-                out[4*(roi_out->width*(yy-roi_out->y) + xx-roi_out->x) + c] =
-                  out[4*(roi_out->width*(yy-roi_out->y) + xx-roi_out->x) + c] * (1.0f-f) +
-                  in[4*(roi_in->width*(yy-dy-roi_in->y) + xx-dx-roi_in->x) + c] * f;
-            }
-          }
-        }
-        free(mask);
-      }
-      pos++;
-      forms = g_list_next(forms);
+  //the spots which are gone have to be removed from the output
+  for (int k=0; k<d->num_spots; k++)
+  {
+    if (used[k]) continue;
+    if (d->spot[k].w > 0)
+    {
+      dirty[ndirty][0] = d->spot[k].x, dirty[ndirty][1] = d->spot[k].y;
+      dirty[ndirty][2] = d->spot[k].x+d->spot[k].w, dirty[ndirty][3] = d->spot[k].y+d->spot[k].h;
+      ndirty++;
+    }
+    free(d->spot[k].mask);
+  }
+  memcpy(d->spot,spot,sizeof(dt_iop_spots_spot_t)*num);
+  d->num_spots = num;
+
+  const int valid = d->out && d->hash == input && d->out_size == (size_t)roi_out->width*roi_out->height*piece->colors;
+  return (valid && !redraw) ? ndirty : -1;
+}
+
+void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_iop_spots_data_t *d = (dt_iop_spots_data_t *)piece->data;
+
+  const int ch = piece->colors;
+  const float *in = (float *)i;
+  float *out = (float *)o;
+  const size_t size = (size_t)roi_out->width*roi_out->height*ch;
+
+  // only the interactive pipes keep the last output, the others render all spots once
+  const int keep = piece->pipe->type == DT_DEV_PIXELPIPE_FULL || piece->pipe->type == DT_DEV_PIXELPIPE_PREVIEW;
+  const uint64_t input = _spots_input_hash(piece,roi_in,roi_out);
+  int dirty[128][4];
+  int ndirty = _spots_update(self,piece,roi_in,roi_out,input,dirty);
+  // a lot of changes, like after loading a style, are faster in one go
+  if (ndirty > 16) ndirty = -1;
+
+  if (ndirty < 0)
+  {
+    //we start again from the input
+    ndirty = 1;
+    dirty[0][0] = roi_out->x, dirty[0][1] = roi_out->y;
+    dirty[0][2] = roi_out->x+roi_out->width, dirty[0][3] = roi_out->y+roi_out->height;
+  }
+  else
+  {
+    memcpy(out, d->out, sizeof(float)*size);
+  }
+
+  for (int r=0; r<ndirty; r++)
+  {
+    const int x0 = MAX(dirty[r][0], roi_out->x), x1 = MIN(dirty[r][2], roi_out->x+roi_out->width);
+    const int y0 = MAX(dirty[r][1], roi_out->y), y1 = MIN(dirty[r][3], roi_out->y+roi_out->height);
+    if (x0 >= x1 || y0 >= y1) continue;
+
+    // we don't modify most of the image:
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) shared(out,in,roi_in,roi_out)
+#endif
+    for (int k=y0; k<y1; k++)
+    {
+      float *outb = out + ch*(roi_out->width*(k-roi_out->y) + x0-roi_out->x);
+      const float *inb =  in + ch*(roi_in->width*(k-roi_in->y) + x0-roi_in->x);
+      memcpy(outb, inb, sizeof(float)*(x1-x0)*ch);
     }
+
+    //and we clone all spots which touch this part again
+    for (int k=0; k<d->num_spots; k++)
+      _spot_apply(d->spot+k,in,out,ch,roi_in,roi_out,x0,y0,x1,y1);
   }
+
+  if (keep)
+  {
+    if (d->out_size != size)
+    {
+      free(d->out);
+      d->out = malloc(sizeof(float)*size);
+      d->out_size = d->out ? size : 0;
+    }
+    if (d->out) memcpy(d->out, out, sizeof(float)*size);
+    d->hash = input;
+  }
+  else _spots_free(d);
+}
+
+#ifdef HAVE_OPENCL
+int
+process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_iop_spots_data_t *d = (dt_iop_spots_data_t *)piece->data;
+  dt_iop_spots_global_data_t *gd = (dt_iop_spots_global_data_t *)self->data;
+
+  const int devid = piece->pipe->devid;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+  const int ox = roi_out->x - roi_in->x;
+  const int oy = roi_out->y - roi_in->y;
+
+  cl_int err = -999;
+  cl_mem dev_spots = NULL;
+  cl_mem dev_masks = NULL;
+  int *spots = NULL;
+  float *masks = NULL;
+
+  //the masks of the spots which didn't change are kept, the cloning itself is done all at once
+  int dirty[128][4];
+  _spots_update(self,piece,roi_in,roi_out,_spots_input_hash(piece,roi_in,roi_out),dirty);
+  //the cached output of the cpu path doesn't know about this run
+  d->hash = 0;
+
+  int num = 0;
+  size_t length = 0;
+  for (int k=0; k<d->num_spots; k++)
+    if (d->spot[k].w > 0) length += (size_t)d->spot[k].w*d->spot[k].h;
+
+  spots = malloc(sizeof(int)*8*MAX(d->num_spots,1));
+  masks = malloc(sizeof(float)*MAX(length,1));
+  if (!spots || !masks) goto error;
+
+  length = 0;
+  for (int k=0; k<d->num_spots; k++)
+  {
+    const dt_iop_spots_spot_t *spot = d->spot+k;
+    if (spot->w <= 0) continue;
+    int *s = spots + 8*num++;
+    s[0] = spot->x - roi_out->x;
+    s[1] = spot->y - roi_out->y;
+    s[2] = spot->w;
+    s[3] = spot->h;
+    s[4] = spot->dx;
+    s[5] = spot->dy;
+    s[6] = length;
+    s[7] = 0;
+    memcpy(masks+length, spot->mask, sizeof(float)*spot->w*spot->h);
+    length += (size_t)spot->w*spot->h;
+  }
+
+  dev_spots = dt_opencl_alloc_device_buffer(devid, sizeof(int)*8*MAX(num,1));
+  if (dev_spots == NULL) goto error;
+  dev_masks = dt_opencl_alloc_device_buffer(devid, sizeof(float)*MAX(length,1));
+  if (dev_masks == NULL) goto error;
+  if (num > 0)
+  {
+    err = dt_opencl_write_buffer_to_device(devid, spots, dev_spots, 0, sizeof(int)*8*num, CL_TRUE);
+    if (err != CL_SUCCESS) goto error;
+    err = dt_opencl_write_buffer_to_device(devid, masks, dev_masks, 0, sizeof(float)*length, CL_TRUE);
+    if (err != CL_SUCCESS) goto error;
+  }
+
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 0, sizeof(cl_mem), (void *)&dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 1, sizeof(cl_mem), (void *)&dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 4, sizeof(int), (void *)&ox);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 5, sizeof(int), (void *)&oy);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 6, sizeof(cl_mem), (void *)&dev_spots);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 7, sizeof(cl_mem), (void *)&dev_masks);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_spots, 8, sizeof(int), (void *)&num);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_spots, sizes);
+  if (err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_spots);
+  dt_opencl_release_mem_object(dev_masks);
+  free(spots);
+  free(masks);
+  if (piece->pipe->type != DT_DEV_PIXELPIPE_FULL && piece->pipe->type != DT_DEV_PIXELPIPE_PREVIEW) _spots_free(d);
+  return TRUE;
+
+error:
+  if (dev_spots != NULL) dt_opencl_release_mem_object(dev_spots);
+  if (dev_masks != NULL) dt_opencl_release_mem_object(dev_masks);
+  free(spots);
+  free(masks);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_spots] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 19; // spots.cl, from programs.conf
+  dt_iop_spots_global_data_t *gd = (dt_iop_spots_global_data_t *)malloc(sizeof(dt_iop_spots_global_data_t));
+  module->data = gd;
+  gd->kernel_spots = dt_opencl_create_kernel(program, "spots");
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_spots_global_data_t *gd = (dt_iop_spots_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_spots);
+  free(module->data);
+  module->data = NULL;
 }
 
 /** init, cleanup, commit to pipeline */
 void init(dt_iop_module_t *module)
 {
-  // we don't need global data:
-  module->data = NULL; //malloc(sizeof(dt_iop_spots_global_data_t));
+  module->data = NULL;
   module->params = malloc(sizeof(dt_iop_spots_params_t));
   module->default_params = malloc(sizeof(dt_iop_spots_params_t));
   // our module is disabled by default
@@ -452,8 +718,6 @@ void cleanup(dt_iop_module_t *module)
   module->gui_data = NULL; // just to be sure
   free(module->params);
   module->params = NULL;
-  free(module->data); // just to be sure
-  module->data = NULL;
 }
 
 void gui_focus (struct dt_iop_module_t *self, gboolean in)
@@ -477,18 +741,26 @@ void gui_focus (struct dt_iop_module_t *self, gboolean in)
 /** commit is the synch point between core and gui, so it copies params to pipe data. */
 void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  memcpy(piece->data, params, sizeof(dt_iop_spots_params_t));
+  dt_iop_spots_params_t *p = (dt_iop_spots_params_t *)params;
+  dt_iop_spots_data_t *d = (dt_iop_spots_data_t *)piece->data;
+  // the spots and the output of the last run stay, process finds out what changed
+  memcpy(d->clone_id, p->clone_id, sizeof(p->clone_id));
+  memcpy(d->clone_algo, p->clone_algo, sizeof(p->clone_algo));
 }
 
 void init_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  piece->data = malloc(sizeof(dt_iop_spots_data_t));
+  piece->data = calloc(1, sizeof(dt_iop_spots_data_t));
   self->commit_params(self, self->default_params, pipe, piece);
 }
 
 void cleanup_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
+  dt_iop_spots_data_t *d = (dt_iop_spots_data_t *)piece->data;
+  _spots_free(d);
+  free(d->out);
   free(piece->data);
+  piece->data = NULL;
 }
 
 /** gui callbacks, these are needed. */
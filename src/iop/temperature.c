@@ -19,6 +19,7 @@
 #include "config.h"
 #endif
 #include <xmmintrin.h>
+#include <emmintrin.h>
 #include <stdlib.h>
 #include <math.h>
 #include <assert.h>
@@ -118,7 +119,8 @@ void connect_key_accels(dt_iop_module_t *self)
 int
 output_bpp(dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  if(!dt_dev_pixelpipe_uses_downsampled_input(pipe) && (pipe->image.flags & DT_IMAGE_RAW)) return sizeof(float);
+  if(!dt_dev_pixelpipe_uses_downsampled_input(pipe) && (pipe->image.flags & DT_IMAGE_RAW))
+    return pipe->raw16 ? sizeof(uint16_t) : sizeof(float);
   else return 4*sizeof(float);
 }
 
@@ -211,7 +213,42 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
 {
   const int filters = dt_image_flipped_filter(&piece->pipe->image);
   dt_iop_temperature_data_t *d = (dt_iop_temperature_data_t *)piece->data;
-  if(!dt_dev_pixelpipe_uses_downsampled_input(piece->pipe) && filters && piece->pipe->image.bpp != 4)
+  if(piece->pipe->raw16)
+  {
+    // uint16 -> uint16 fixed point, see DT_IOP_RAW16_ONE. 8 pixels span whole periods of the pattern.
+    const float coeffsi[3] = { d->coeffs[0]*DT_IOP_RAW16_ONE/65535.0f, d->coeffs[1]*DT_IOP_RAW16_ONE/65535.0f,
+                               d->coeffs[2]*DT_IOP_RAW16_ONE/65535.0f };
+#ifdef _OPENMP
+    #pragma omp parallel for default(none) shared(roi_out, ivoid, ovoid, d) schedule(static)
+#endif
+    for(int j=0; j<roi_out->height; j++)
+    {
+      const uint16_t *in = ((uint16_t *)ivoid) + (size_t)j*roi_out->width;
+      uint16_t *out = ((uint16_t *)ovoid) + (size_t)j*roi_out->width;
+      const __m128 coeffs = _mm_set_ps(coeffsi[FC(j+roi_out->y, roi_out->x+3, filters)],
+                                       coeffsi[FC(j+roi_out->y, roi_out->x+2, filters)],
+                                       coeffsi[FC(j+roi_out->y, roi_out->x+1, filters)],
+                                       coeffsi[FC(j+roi_out->y, roi_out->x  , filters)]);
+      const __m128 max = _mm_set1_ps(65535.0f);
+      const __m128i zero = _mm_setzero_si128();
+      // there's no unsigned saturating pack in sse2, shift to signed and back:
+      const __m128i bias32 = _mm_set1_epi32(32768);
+      const __m128i bias16 = _mm_set1_epi16(-32768);
+      int i = 0;
+      for( ; i < roi_out->width - 7; i+=8)
+      {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        const __m128 lo = _mm_min_ps(max, _mm_mul_ps(coeffs, _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero))));
+        const __m128 hi = _mm_min_ps(max, _mm_mul_ps(coeffs, _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero))));
+        const __m128i packed = _mm_packs_epi32(_mm_sub_epi32(_mm_cvtps_epi32(lo), bias32),
+                                               _mm_sub_epi32(_mm_cvtps_epi32(hi), bias32));
+        _mm_storeu_si128((__m128i *)(out + i), _mm_xor_si128(packed, bias16));
+      }
+      for( ; i<roi_out->width; i++)
+        out[i] = CLAMPS(in[i] * coeffsi[FC(j+roi_out->y, i+roi_out->x, filters)] + 0.5f, 0.0f, 65535.0f);
+    }
+  }
+  else if(!dt_dev_pixelpipe_uses_downsampled_input(piece->pipe) && filters && piece->pipe->image.bpp != 4)
   {
     const float coeffsi[3] = {d->coeffs[0]/65535.0f, d->coeffs[1]/65535.0f, d->coeffs[2]/65535.0f};
 #ifdef _OPENMP
@@ -349,6 +386,8 @@ void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pi
   dt_iop_temperature_params_t *p = (dt_iop_temperature_params_t *)p1;
   dt_iop_temperature_data_t *d = (dt_iop_temperature_data_t *)piece->data;
   for(int k=0; k<3; k++) d->coeffs[k]  = p->coeffs[k];
+  // the fixed point mosaic has room for coefficients up to 4:
+  piece->process_raw16 = fmaxf(d->coeffs[0], fmaxf(d->coeffs[1], d->coeffs[2])) < 65535.0f/DT_IOP_RAW16_ONE;
 }
 
 void init_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -28,6 +28,7 @@
 #include "control/control.h"
 #include "bauhaus/bauhaus.h"
 #include "gui/gtk.h"
+#include "common/curve_lut.h"
 #include "common/opencl.h"
 #include "libs/colorpicker.h"
 
@@ -39,6 +40,7 @@ DT_MODULE(3)
 static gboolean dt_iop_tonecurve_expose(GtkWidget *widget, GdkEventExpose *event, gpointer user_data);
 static gboolean dt_iop_tonecurve_motion_notify(GtkWidget *widget, GdkEventMotion *event, gpointer user_data);
 static gboolean dt_iop_tonecurve_button_press(GtkWidget *widget, GdkEventButton *event, gpointer user_data);
+static gboolean dt_iop_tonecurve_button_release(GtkWidget *widget, GdkEventButton *event, gpointer user_data);
 static gboolean dt_iop_tonecurve_leave_notify(GtkWidget *widget, GdkEventCrossing *event, gpointer user_data);
 static gboolean dt_iop_tonecurve_enter_notify(GtkWidget *widget, GdkEventCrossing *event, gpointer user_data);
 
@@ -150,53 +152,52 @@ error:
 }
 #endif
 
-void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+void process_pixels (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *in, float *out, const size_t npixels)
 {
-  const int ch = piece->colors;
   dt_iop_tonecurve_data_t *d = (dt_iop_tonecurve_data_t *)(piece->data);
-  const float xm = 1.0f/d->unbounded_coeffs[0];
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(roi_out, i, o, d) schedule(static)
-#endif
-  for(int k=0; k<roi_out->height; k++)
+  const float low_approximation = dt_curve_lut_lookup(d->table[ch_L], 0.01f);
+
+  for(size_t k=0; k<npixels; k++, in+=4, out+=4)
   {
-    float *in = ((float *)i) + k*ch*roi_out->width;
-    float *out = ((float *)o) + k*ch*roi_out->width;
+    const float L = in[0], a = in[1], b = in[2];
+    const float L_in = L/100.0f;
 
-    const float low_approximation = d->table[0][(int)(0.01f * 0xfffful)];
+    out[0] = dt_curve_lut_lookup_unbounded(d->table[ch_L], L_in, d->unbounded_coeffs);
 
-    for (int j=0; j<roi_out->width; j++,in+=ch,out+=ch)
+    if (d->autoscale_ab == 0)
     {
-      const float L_in = in[0]/100.0f;
-
-      out[0] = (L_in < xm) ? d->table[ch_L][CLAMP((int)(L_in*0xfffful), 0, 0xffff)] :
-               dt_iop_eval_exp(d->unbounded_coeffs, L_in);
-
-      if (d->autoscale_ab == 0)
-      {
-        const float a_in = (in[1] + 128.0f) / 256.0f;
-        const float b_in = (in[2] + 128.0f) / 256.0f;
-        out[1] = d->table[ch_a][CLAMP((int)(a_in*0xfffful), 0, 0xffff)];
-        out[2] = d->table[ch_b][CLAMP((int)(b_in*0xfffful), 0, 0xffff)];
-      }
-      // in Lab: correct compressed Luminance for saturation:
-      else if(L_in > 0.01f)
-      {
-        out[1] = in[1] * out[0]/in[0];
-        out[2] = in[2] * out[0]/in[0];
-      }
-      else
-      {
-        out[0] = in[0] * low_approximation;
-        out[1] = in[1] * low_approximation;
-        out[2] = in[2] * low_approximation;
-      }
-
-      out[3] = in[3];
+      const float a_in = (a + 128.0f) / 256.0f;
+      const float b_in = (b + 128.0f) / 256.0f;
+      out[1] = dt_curve_lut_lookup(d->table[ch_a], a_in);
+      out[2] = dt_curve_lut_lookup(d->table[ch_b], b_in);
+    }
+    // in Lab: correct compressed Luminance for saturation:
+    else if(L_in > 0.01f)
+    {
+      out[1] = a * out[0]/L;
+      out[2] = b * out[0]/L;
+    }
+    else
+    {
+      out[0] = L * low_approximation;
+      out[1] = a * low_approximation;
+      out[2] = b * low_approximation;
     }
+
+    out[3] = in[3];
   }
 }
 
+void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(self, piece, roi_out, i, o) schedule(static)
+#endif
+  for(int k=0; k<roi_out->height; k++)
+    process_pixels(self, piece, ((const float *)i) + (size_t)4*k*roi_out->width,
+                   ((float *)o) + (size_t)4*k*roi_out->width, roi_out->width);
+}
+
 void init_presets (dt_iop_module_so_t *self)
 {
   dt_iop_tonecurve_params_t p;
@@ -294,14 +295,33 @@ void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pi
   // now the extrapolation stuff (for L curve only):
   const float xm = p->tonecurve[ch_L][p->tonecurve_nodes[ch_L]-1].x;
   const float x[4] = {0.7f*xm, 0.8f*xm, 0.9f*xm, 1.0f*xm};
-  const float y[4] = {d->table[ch_L][CLAMP((int)(x[0]*0x10000ul), 0, 0xffff)],
-                      d->table[ch_L][CLAMP((int)(x[1]*0x10000ul), 0, 0xffff)],
-                      d->table[ch_L][CLAMP((int)(x[2]*0x10000ul), 0, 0xffff)],
-                      d->table[ch_L][CLAMP((int)(x[3]*0x10000ul), 0, 0xffff)]
+  const float y[4] = {dt_curve_lut_lookup(d->table[ch_L], x[0]),
+                      dt_curve_lut_lookup(d->table[ch_L], x[1]),
+                      dt_curve_lut_lookup(d->table[ch_L], x[2]),
+                      dt_curve_lut_lookup(d->table[ch_L], x[3])
                      };
   dt_iop_estimate_exp(x, y, 4, d->unbounded_coeffs);
 }
 
+// a curve from (0,0) to (1,1) with all nodes on the diagonal interpolates to the identity.
+static int
+_curve_is_identity(const dt_iop_tonecurve_params_t *p, const int ch)
+{
+  const int nodes = p->tonecurve_nodes[ch];
+  if(nodes < 2 || p->tonecurve[ch][0].x != 0.0f || p->tonecurve[ch][nodes-1].x != 1.0f) return 0;
+  for(int k=0; k<nodes; k++)
+    if(p->tonecurve[ch][k].x != p->tonecurve[ch][k].y) return 0;
+  return 1;
+}
+
+int is_identity (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_iop_tonecurve_params_t *p = (dt_iop_tonecurve_params_t *)p1;
+  // with autoscale_ab, a and b follow the L curve:
+  return _curve_is_identity(p, ch_L) &&
+         (p->tonecurve_autoscale_ab || (_curve_is_identity(p, ch_a) && _curve_is_identity(p, ch_b)));
+}
+
 void init_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
   // create part of the gegl pipeline
@@ -491,6 +511,7 @@ void gui_init(struct dt_iop_module_t *self)
   c->channel = ch_L;
   c->mouse_x = c->mouse_y = -1.0;
   c->selected = -1;
+  c->dragging = 0;
 
   self->widget = gtk_vbox_new(FALSE, DT_BAUHAUS_SPACE);
 
@@ -536,6 +557,8 @@ void gui_init(struct dt_iop_module_t *self)
                     G_CALLBACK (dt_iop_tonecurve_expose), self);
   g_signal_connect (G_OBJECT (c->area), "button-press-event",
                     G_CALLBACK (dt_iop_tonecurve_button_press), self);
+  g_signal_connect (G_OBJECT (c->area), "button-release-event",
+                    G_CALLBACK (dt_iop_tonecurve_button_release), self);
   g_signal_connect (G_OBJECT (c->area), "motion-notify-event",
                     G_CALLBACK (dt_iop_tonecurve_motion_notify), self);
   g_signal_connect (G_OBJECT (c->area), "leave-notify-event",
@@ -565,6 +588,7 @@ void gui_init(struct dt_iop_module_t *self)
 void gui_cleanup(struct dt_iop_module_t *self)
 {
   dt_iop_tonecurve_gui_data_t *c = (dt_iop_tonecurve_gui_data_t *)self->gui_data;
+  if(c->dragging) dt_dev_interactive_end(self->dev);
   // this one we need to unref manually. not so the initially unowned widgets.
   g_object_unref(c->sizegroup);
   dt_draw_curve_destroy(c->minmax_curve[ch_L]);
@@ -749,7 +773,7 @@ static gboolean dt_iop_tonecurve_expose(GtkWidget *widget, GdkEventExpose *event
       cairo_save(cr);
       cairo_scale(cr, width/63.0, -(height-5)/(float)hist_max);
       cairo_set_source_rgba(cr, .2, .2, .2, 0.5);
-      dt_draw_histogram_8(cr, hist, ch, dev->histogram_type == DT_DEV_HISTOGRAM_WAVEFORM?DT_DEV_HISTOGRAM_LOGARITHMIC:dev->histogram_type); // TODO: make draw handle waveform histograms
+      dt_draw_histogram_8(cr, hist, ch, dev->histogram_type == DT_DEV_HISTOGRAM_LINEAR?DT_DEV_HISTOGRAM_LINEAR:DT_DEV_HISTOGRAM_LOGARITHMIC); // TODO: make draw handle the scopes
       cairo_restore(cr);
     }
 
@@ -862,6 +886,11 @@ static gboolean dt_iop_tonecurve_motion_notify(GtkWidget *widget, GdkEventMotion
 
   if(event->state & GDK_BUTTON1_MASK)
   {
+    if(!c->dragging && c->selected >= -1)
+    {
+      c->dragging = 1;
+      dt_dev_interactive_begin(self->dev);
+    }
     // got a vertex selected:
     if(c->selected >= 0)
     {
@@ -975,6 +1004,19 @@ static gboolean dt_iop_tonecurve_button_press(GtkWidget *widget, GdkEventButton
   return FALSE;
 }
 
+static gboolean dt_iop_tonecurve_button_release(GtkWidget *widget, GdkEventButton *event, gpointer user_data)
+{
+  dt_iop_module_t *self = (dt_iop_module_t *)user_data;
+  dt_iop_tonecurve_gui_data_t *c = (dt_iop_tonecurve_gui_data_t *)self->gui_data;
+  if(event->button == 1 && c->dragging)
+  {
+    c->dragging = 0;
+    dt_dev_interactive_end(self->dev);
+    return TRUE;
+  }
+  return FALSE;
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -76,6 +76,7 @@ typedef struct dt_iop_tonecurve_gui_data_t
   tonecurve_channel_t channel;
   double mouse_x, mouse_y;
   int selected;
+  int dragging; // a node is being moved, see dt_dev_interactive_begin()
   float draw_xs[DT_IOP_TONECURVE_RES], draw_ys[DT_IOP_TONECURVE_RES];
   float draw_min_xs[DT_IOP_TONECURVE_RES], draw_min_ys[DT_IOP_TONECURVE_RES];
   float draw_max_xs[DT_IOP_TONECURVE_RES], draw_max_ys[DT_IOP_TONECURVE_RES];
@@ -104,6 +105,7 @@ void cleanup(dt_iop_module_t *module);
 
 void gui_update    (struct dt_iop_module_t *self);
 void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece);
+int  is_identity   (struct dt_iop_module_t *self, dt_iop_params_t *params, dt_dev_pixelpipe_iop_t *piece);
 void init_pipe     (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece);
 void cleanup_pipe  (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece);
 
@@ -43,11 +43,15 @@ extern "C"
 #include "bauhaus/bauhaus.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
+#include "develop/tiling.h"
+#include "common/opencl.h"
+#include "common/bilateralcl.h"
 #include "control/control.h"
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
 #include <gtk/gtk.h>
 #include <inttypes.h>
+#include <xmmintrin.h>
 }
 
 #include "iop/Permutohedral.h"
@@ -74,6 +78,18 @@ extern "C"
   }
   dt_iop_tonemapping_data_t;
 
+  typedef struct dt_iop_tonemapping_global_data_t
+  {
+    int kernel_tonemap_log;
+    int kernel_tonemap_apply;
+  }
+  dt_iop_tonemapping_global_data_t;
+
+  // range of the log luminance which is mapped onto the bilateral grid on the device,
+  // log(1e-4) .. log(1e3). values outside are clamped for the base layer only.
+#define TONEMAP_LOG_MIN -9.21f
+#define TONEMAP_LOG_MAX  6.91f
+
   const char *name()
   {
     return _("tone mapping");
@@ -89,7 +105,7 @@ extern "C"
   int
   flags ()
   {
-    return IOP_FLAGS_SUPPORTS_BLENDING;
+    return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING;
   }
 
   void init_key_accels(dt_iop_module_so_t *self)
@@ -110,26 +126,44 @@ extern "C"
                                 GTK_WIDGET(g->Fsize));
   }
 
+  // spatial sigma in pixels of the roi. it depends on the full buffer only, so tiles agree on it.
+  static float
+  _tonemap_sigma_s(const dt_iop_tonemapping_data_t *data, const dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_out)
+  {
+    const float iw = piece->buf_in.width*roi_out->scale;
+    const float ih = piece->buf_in.height*roi_out->scale;
+    return fmaxf((data->Fsize/100.0f) * fminf(iw, ih), 3.0f);
+  }
+
+  // also process the clipping point, as good as we can without knowing
+  // the local environment (i.e. assuming detail == 0)
+  static void
+  _tonemap_processed_maximum(dt_dev_pixelpipe_iop_t *piece, const float contr)
+  {
+    float *pmax = piece->pipe->processed_maximum;
+    float L = 0.2126*pmax[0]+ 0.7152*pmax[1] + 0.0722*pmax[2];
+    if(L<=0.0) L=1e-6;
+    L = logf(L);
+    const float Ln = expf(L*(contr - 1.0f) - 1.0f);
+    for(int k=0; k<3; k++) pmax[k] *= Ln;
+  }
+
   void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
   {
     dt_iop_tonemapping_data_t *data = (dt_iop_tonemapping_data_t *)piece->data;
     const int ch = piece->colors;
 
     int width,height,size;
-    float inv_sigma_s;
     const float inv_sigma_r=1.0/0.4;
 
     width=roi_in->width;
     height=roi_in->height;
     size=width*height;
-    const float iw=piece->buf_in.width*roi_out->scale;
-    const float ih=piece->buf_in.height*roi_out->scale;
-
-    inv_sigma_s=(data->Fsize/100.0) * fminf(iw,ih);
-    if(inv_sigma_s<3.0) inv_sigma_s=3.0;
-    inv_sigma_s = 1.0/inv_sigma_s;
+    const float inv_sigma_s = 1.0f/_tonemap_sigma_s(data, piece, roi_out);
 
     PermutohedralLattice<3,2> lattice(size, omp_get_max_threads());
+    // keep log(L) for the second pass, it's the most expensive part of it
+    float *logL = (float *)dt_alloc_align(64, sizeof(float)*size);
 
     // Build I=log(L)
     // and splat into the lattice
@@ -145,7 +179,7 @@ extern "C"
       {
         float L = 0.2126*in[0]+ 0.7152*in[1] + 0.0722*in[2];
         if(L<=0.0) L=1e-6;
-        L = logf(L);
+        L = logL[index] = logf(L);
         float pos[3] = {i*inv_sigma_s, j*inv_sigma_s, L*inv_sigma_r};
         float val[2] = {L,  1.0};
         lattice.splat(pos, val, index, thread);
@@ -190,27 +224,122 @@ extern "C"
       {
         float val[2];
         lattice.slice(val, index);
-        float L = 0.2126*in[0]+ 0.7152*in[1] + 0.0722*in[2];
-        if(L<=0.0) L=1e-6;
-        L = logf(L);
+        const float L = logL[index];
         const float B = val[0]/val[1];
         const float detail = L - B;
         const float Ln = expf(B*(contr - 1.0f) + detail - 1.0f);
 
-        out[0]=in[0]*Ln;
-        out[1]=in[1]*Ln;
-        out[2]=in[2]*Ln;
-        out[3]=in[3];
+        // alpha is passed through
+        _mm_store_ps(out, _mm_mul_ps(_mm_load_ps(in), _mm_set_ps(1.0f, Ln, Ln, Ln)));
       }
     }
-    // also process the clipping point, as good as we can without knowing
-    // the local environment (i.e. assuming detail == 0)
-    float *pmax = piece->pipe->processed_maximum;
-    float L = 0.2126*pmax[0]+ 0.7152*pmax[1] + 0.0722*pmax[2];
-    if(L<=0.0) L=1e-6;
-    L = logf(L);
-    const float Ln = expf(L*(contr - 1.0f) - 1.0f);
-    for(int k=0; k<3; k++) pmax[k] *= Ln;
+    free(logL);
+    _tonemap_processed_maximum(piece, contr);
+  }
+
+#ifdef HAVE_OPENCL
+  /**
+   * the device has no permutohedral lattice, the base layer is filtered on the bilateral grid
+   * instead, which is what other modules use for the same purpose. the grid works on values in
+   * [0, 100], so log(L) is scaled into that range first.
+   */
+  int process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+  {
+    dt_iop_tonemapping_data_t *data = (dt_iop_tonemapping_data_t *)piece->data;
+    dt_iop_tonemapping_global_data_t *gd = (dt_iop_tonemapping_global_data_t *)self->data;
+
+    const int devid = piece->pipe->devid;
+    const int width = roi_in->width;
+    const int height = roi_in->height;
+    size_t sizes[] = { (size_t)ROUNDUPWD(width), (size_t)ROUNDUPHT(height), 1 };
+    const float lmin = TONEMAP_LOG_MIN;
+    const float scale = 100.0f/(TONEMAP_LOG_MAX - TONEMAP_LOG_MIN);
+    const float sigma_s = _tonemap_sigma_s(data, piece, roi_out);
+    const float sigma_r = 0.4f*scale;
+    const float contr = 1.0f/data->contrast;
+    dt_bilateral_cl_t *b = NULL;
+    cl_mem dev_L = NULL, dev_B = NULL;
+    cl_int err = -999;
+
+    dev_L = (cl_mem)dt_opencl_alloc_device(devid, width, height, sizeof(float));
+    if(dev_L == NULL) goto error;
+    dev_B = (cl_mem)dt_opencl_alloc_device(devid, width, height, sizeof(float));
+    if(dev_B == NULL) goto error;
+
+    dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_log, 0, sizeof(cl_mem), (void *)&dev_in);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_log, 1, sizeof(cl_mem), (void *)&dev_L);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_log, 2, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_log, 3, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_log, 4, sizeof(float), (void *)&lmin);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_log, 5, sizeof(float), (void *)&scale);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_tonemap_log, sizes);
+    if(err != CL_SUCCESS) goto error;
+
+    b = dt_bilateral_init_cl(devid, width, height, sigma_s, sigma_r);
+    if(!b) goto error;
+    err = dt_bilateral_splat_cl(b, dev_L);
+    if(err != CL_SUCCESS) goto error;
+    err = dt_bilateral_blur_cl(b);
+    if(err != CL_SUCCESS) goto error;
+    // detail -1 leaves the filtered log luminance, which is the base layer
+    err = dt_bilateral_slice_cl(b, dev_L, dev_B, -1.0f);
+    if(err != CL_SUCCESS) goto error;
+    dt_bilateral_free_cl(b);
+    b = NULL;
+
+    dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_apply, 0, sizeof(cl_mem), (void *)&dev_in);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_apply, 1, sizeof(cl_mem), (void *)&dev_B);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_apply, 2, sizeof(cl_mem), (void *)&dev_out);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_apply, 3, sizeof(int), (void *)&width);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_apply, 4, sizeof(int), (void *)&height);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_apply, 5, sizeof(float), (void *)&lmin);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_apply, 6, sizeof(float), (void *)&scale);
+    dt_opencl_set_kernel_arg(devid, gd->kernel_tonemap_apply, 7, sizeof(float), (void *)&contr);
+    err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_tonemap_apply, sizes);
+    if(err != CL_SUCCESS) goto error;
+
+    dt_opencl_release_mem_object(dev_L);
+    dt_opencl_release_mem_object(dev_B);
+    _tonemap_processed_maximum(piece, contr);
+    return TRUE;
+
+error:
+    if(b) dt_bilateral_free_cl(b);
+    if(dev_L != NULL) dt_opencl_release_mem_object(dev_L);
+    if(dev_B != NULL) dt_opencl_release_mem_object(dev_B);
+    dt_print(DT_DEBUG_OPENCL, "[opencl_tonemapping] couldn't enqueue kernel! %d\n", err);
+    return FALSE;
+  }
+#endif
+
+  void tiling_callback  (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, struct dt_develop_tiling_t *tiling)
+  {
+    dt_iop_tonemapping_data_t *data = (dt_iop_tonemapping_data_t *)piece->data;
+    const float sigma_s = _tonemap_sigma_s(data, piece, roi_out);
+
+    // cpu: in, out, log(L), the replay entries of the lattice and its hash tables.
+    // device: in, out, two single channel buffers and the grid.
+    // the cpu path may run even with a device (fallback, placement, kernels not built yet), so cover both:
+    tiling->factor = 5.0f;
+    tiling->maxbuf = 1.0f;
+#ifdef HAVE_OPENCL
+    if(piece->pipe->devid >= 0)
+    {
+      const float sigma_r = 0.4f*100.0f/(TONEMAP_LOG_MAX - TONEMAP_LOG_MIN);
+      const int width = roi_in->width;
+      const int height = roi_in->height;
+      const int channels = piece->colors;
+      const size_t basebuffer = width*height*channels*sizeof(float);
+
+      tiling->factor = fmax(tiling->factor, 2.5f + (float)dt_bilateral_memory_use(width,height,sigma_s,sigma_r)/basebuffer);
+      tiling->maxbuf = fmax(tiling->maxbuf, (float)dt_bilateral_singlebuffer_size(width,height,sigma_s,sigma_r)/basebuffer);
+    }
+#endif
+    tiling->overhead = 0;
+    tiling->overlap = ceilf(4*sigma_s);
+    tiling->xalign = 1;
+    tiling->yalign = 1;
+    return;
   }
 
 
@@ -285,6 +414,24 @@ extern "C"
     module->gui_data = NULL;
   }
 
+  void init_global(dt_iop_module_so_t *module)
+  {
+    const int program = 14; // tonemap.cl, from programs.conf
+    dt_iop_tonemapping_global_data_t *gd = (dt_iop_tonemapping_global_data_t *)malloc(sizeof(dt_iop_tonemapping_global_data_t));
+    module->data = gd;
+    gd->kernel_tonemap_log = dt_opencl_create_kernel(program, "tonemap_log");
+    gd->kernel_tonemap_apply = dt_opencl_create_kernel(program, "tonemap_apply");
+  }
+
+  void cleanup_global(dt_iop_module_so_t *module)
+  {
+    dt_iop_tonemapping_global_data_t *gd = (dt_iop_tonemapping_global_data_t *)module->data;
+    dt_opencl_free_kernel(gd->kernel_tonemap_log);
+    dt_opencl_free_kernel(gd->kernel_tonemap_apply);
+    free(module->data);
+    module->data = NULL;
+  }
+
   void cleanup(dt_iop_module_t *module)
   {
     free(module->gui_data);
@@ -127,57 +127,58 @@ legacy_params (dt_iop_module_t *self, const void *const old_params, const int ol
   return 1;
 }
 
-void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+void process_pixels (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *in, float *out, const size_t npixels)
 {
   dt_iop_velvia_data_t *data = (dt_iop_velvia_data_t *)piece->data;
-  float *in  = (float *)ivoid;
-  float *out = (float *)ovoid;
-  const int ch = piece->colors;
   const float strength = data->strength/100.0f;
 
   // Apply velvia saturation
   if(strength <= 0.0)
-    memcpy(out, in, sizeof(float)*ch*roi_out->width*roi_out->height);
-  else
   {
+    if(in != out) memcpy(out, in, sizeof(float)*4*npixels);
+    return;
+  }
+  const __m128 min_m  = _mm_set1_ps(0.0f);
+  const __m128 max_m  = _mm_set1_ps(1.0f);
+  for(size_t k=0; k<npixels; k++, in+=4, out+=4)
+  {
+    // calculate vibrance, and apply boost velvia saturation at least saturated pixels
+    float pmax=fmaxf(in[0],fmaxf(in[1],in[2]));			// max value in RGB set
+    float pmin=fminf(in[0],fminf(in[1],in[2]));			// min value in RGB set
+    float plum = (pmax+pmin)/2.0f;					        // pixel luminocity
+    float psat =(plum<=0.5f) ? (pmax-pmin)/(1e-5f + pmax+pmin): (pmax-pmin)/(1e-5f + MAX(0.0f, 2.0f-pmax-pmin));
+
+    float pweight=CLAMPS(((1.0f- (1.5f*psat)) + ((1.0f+(fabsf(plum-0.5f)*2.0f))*(1.0f-data->bias))) / (1.0f+(1.0f-data->bias)), 0.0f, 1.0f);		// The weight of pixel
+    float saturation = strength*pweight;			// So lets calculate the final affection of filter on pixel
+
+    // Apply velvia saturation values
+    const __m128 inp_m  = _mm_load_ps(in);
+    const __m128 boost  = _mm_set1_ps(saturation);
+
+    const __m128 inp_shuffled = _mm_mul_ps(_mm_add_ps(_mm_shuffle_ps(inp_m,inp_m,_MM_SHUFFLE(3,0,2,1)),_mm_shuffle_ps(inp_m,inp_m,_MM_SHUFFLE(3,1,0,2))),_mm_set1_ps(0.5f));
+
+    _mm_store_ps( out, _mm_min_ps(max_m,_mm_max_ps(min_m, _mm_add_ps(inp_m, _mm_mul_ps(boost,_mm_sub_ps(inp_m,inp_shuffled))))));
+
+    // equivalent to:
+    /*
+     outp[0]=CLAMPS(inp[0] + saturation*(inp[0]-0.5f*(inp[1]+inp[2])), 0.0f, 1.0f);
+     outp[1]=CLAMPS(inp[1] + saturation*(inp[1]-0.5f*(inp[2]+inp[0])), 0.0f, 1.0f);
+     outp[2]=CLAMPS(inp[2] + saturation*(inp[2]-0.5f*(inp[0]+inp[1])), 0.0f, 1.0f);
+    */
+  }
+}
+
+void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
 #ifdef _OPENMP
-    #pragma omp parallel for default(none) shared(roi_out, in, out, data) schedule(static)
+  #pragma omp parallel for default(none) shared(self, piece, roi_out, i, o) schedule(static)
 #endif
-    for(int k=0; k<roi_out->width*roi_out->height; k++)
-    {
-      float *inp = in + ch*k;
-      float *outp = out + ch*k;
-      // calculate vibrance, and apply boost velvia saturation at least saturated pixels
-      float pmax=fmaxf(inp[0],fmaxf(inp[1],inp[2]));			// max value in RGB set
-      float pmin=fminf(inp[0],fminf(inp[1],inp[2]));			// min value in RGB set
-      float plum = (pmax+pmin)/2.0f;					        // pixel luminocity
-      float psat =(plum<=0.5f) ? (pmax-pmin)/(1e-5f + pmax+pmin): (pmax-pmin)/(1e-5f + MAX(0.0f, 2.0f-pmax-pmin));
-
-      float pweight=CLAMPS(((1.0f- (1.5f*psat)) + ((1.0f+(fabsf(plum-0.5f)*2.0f))*(1.0f-data->bias))) / (1.0f+(1.0f-data->bias)), 0.0f, 1.0f);		// The weight of pixel
-      float saturation = strength*pweight;			// So lets calculate the final affection of filter on pixel
-
-      // Apply velvia saturation values
-      const __m128 inp_m  = _mm_load_ps(inp);
-      const __m128 boost  = _mm_set1_ps(saturation);
-      const __m128 min_m  = _mm_set1_ps(0.0f);
-      const __m128 max_m  = _mm_set1_ps(1.0f);
-
-      const __m128 inp_shuffled = _mm_mul_ps(_mm_add_ps(_mm_shuffle_ps(inp_m,inp_m,_MM_SHUFFLE(3,0,2,1)),_mm_shuffle_ps(inp_m,inp_m,_MM_SHUFFLE(3,1,0,2))),_mm_set1_ps(0.5f));
-
-      _mm_stream_ps( outp, _mm_min_ps(max_m,_mm_max_ps(min_m, _mm_add_ps(inp_m, _mm_mul_ps(boost,_mm_sub_ps(inp_m,inp_shuffled))))));
-
-      // equivalent to:
-      /*
-       outp[0]=CLAMPS(inp[0] + saturation*(inp[0]-0.5f*(inp[1]+inp[2])), 0.0f, 1.0f);
-       outp[1]=CLAMPS(inp[1] + saturation*(inp[1]-0.5f*(inp[2]+inp[0])), 0.0f, 1.0f);
-       outp[2]=CLAMPS(inp[2] + saturation*(inp[2]-0.5f*(inp[0]+inp[1])), 0.0f, 1.0f);
-      */
-    }
-  }
-  _mm_sfence();
+  for(int k=0; k<roi_out->height; k++)
+    process_pixels(self, piece, ((const float *)i) + (size_t)4*k*roi_out->width,
+                   ((float *)o) + (size_t)4*k*roi_out->width, roi_out->width);
 
   if(piece->pipe->mask_display)
-    dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
+    dt_iop_alpha_copy(i, o, roi_out->width, roi_out->height);
 }
 
 
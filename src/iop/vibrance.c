@@ -95,36 +95,31 @@ void connect_key_accels(dt_iop_module_t *self)
 }
 #endif
 
-void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+void process_pixels (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *in, float *out, const size_t npixels)
 {
   dt_iop_vibrance_data_t *d = (dt_iop_vibrance_data_t *)piece->data;
-  const float *in  = (float *)ivoid;
-  float *out = (float *)ovoid;
-  const int ch = piece->colors;
-
   const float amount = (d->amount*0.01);
-
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(roi_out, in, out) schedule(static)
-#endif
-  for (int k=0; k<roi_out->height; k++)
+  for(size_t k=0; k<npixels; k++, in+=4, out+=4)
   {
-    int offs = k*roi_out->width*ch;
-    for(int l=0; l<(roi_out->width*ch); l+=ch)
-    {
-      /* saturation weight 0 - 1 */
-      float sw = sqrt( (in[offs + l + 1]*in[offs + l + 1]) + (in[offs + l + 2]*in[offs + l + 2]) )/256.0;
-      float ls = 1.0 - ((amount * sw)*.25);
-      float ss = 1.0 + (amount * sw);
-      out[offs + l + 0] = in[offs + l + 0] * ls;
-      out[offs + l + 1] = in[offs + l + 1] * ss;
-      out[offs + l + 2] = in[offs + l + 2] * ss;
-      out[offs + l + 3] = in[offs + l + 3];
-    }
+    /* saturation weight 0 - 1 */
+    float sw = sqrt( (in[1]*in[1]) + (in[2]*in[2]) )/256.0;
+    float ls = 1.0 - ((amount * sw)*.25);
+    float ss = 1.0 + (amount * sw);
+    out[0] = in[0] * ls;
+    out[1] = in[1] * ss;
+    out[2] = in[2] * ss;
+    out[3] = in[3];
   }
+}
 
-
-
+void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(self, piece, roi_out, i, o) schedule(static)
+#endif
+  for(int k=0; k<roi_out->height; k++)
+    process_pixels(self, piece, ((const float *)i) + (size_t)4*k*roi_out->width,
+                   ((float *)o) + (size_t)4*k*roi_out->width, roi_out->width);
 }
 
 
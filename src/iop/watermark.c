@@ -44,6 +44,9 @@
 #include "common/metadata.h"
 #include "common/utility.h"
 #include "common/file_location.h"
+#include "common/opencl.h"
+#include <xmmintrin.h>
+#include <emmintrin.h>
 
 #define CLIP(x) ((x<0)?0.0:(x>1.0)?1.0:x)
 DT_MODULE(2)
@@ -87,6 +90,27 @@ typedef struct dt_iop_watermark_data_t
 }
 dt_iop_watermark_data_t;
 
+/** a rendered watermark: the cairo ARGB32 pixels (premultiplied b, g, r, a bytes) of the rectangle
+  * of the roi that it covers, without the stride */
+typedef struct dt_iop_watermark_raster_t
+{
+  uint64_t hash;
+  int x, y, width, height;
+  int refs;
+  guint8 *data;
+}
+dt_iop_watermark_raster_t;
+
+#define DT_IOP_WATERMARK_CACHE 2
+
+typedef struct dt_iop_watermark_global_data_t
+{
+  int kernel_watermark;
+  dt_pthread_mutex_t lock;
+  dt_iop_watermark_raster_t *cache[DT_IOP_WATERMARK_CACHE]; // most recently used first
+}
+dt_iop_watermark_global_data_t;
+
 typedef struct dt_iop_watermark_gui_data_t
 {
   GtkComboBox *combobox1;		                                             // watermark
@@ -585,30 +609,61 @@ static gchar * _watermark_get_svgdoc( dt_iop_module_t *self, dt_iop_watermark_da
 }
 
 
-void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+// rendering the svg is what makes this module slow, so the result is kept across pipe runs and pipes
+// (an export renders the same watermark for every image). it's keyed on the svg after all the
+// variables are substituted, so edits of the file and per image texts render it again, and on
+// everything that goes into its placement and scale.
+static uint64_t
+_watermark_hash(uint64_t hash, const void *data, const size_t size)
 {
-  dt_iop_watermark_data_t *data = (dt_iop_watermark_data_t *)piece->data;
-  float *in  = (float *)ivoid;
-  float *out = (float *)ovoid;
-  const int ch = piece->colors;
+  const char *str = (const char *)data;
+  for(size_t k=0; k<size; k++) hash = ((hash << 5) + hash) ^ str[k];
+  return hash;
+}
 
-  /* Load svg if not loaded */
-  gchar *svgdoc = _watermark_get_svgdoc (self, data, &piece->pipe->image);
-  if (!svgdoc)
-  {
-    memcpy(ovoid, ivoid, sizeof(float)*ch*roi_out->width*roi_out->height);
-    return;
-  }
+static uint64_t
+_watermark_raster_hash(const dt_iop_watermark_data_t *data, const dt_dev_pixelpipe_iop_t *piece, const gchar *svgdoc,
+                       const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  uint64_t hash = 5381;
+  hash = _watermark_hash(hash, svgdoc, strlen(svgdoc));
+  hash = _watermark_hash(hash, &piece->buf_in.width, sizeof(int));
+  hash = _watermark_hash(hash, &piece->buf_in.height, sizeof(int));
+  hash = _watermark_hash(hash, &roi_in->x, sizeof(int));
+  hash = _watermark_hash(hash, &roi_in->y, sizeof(int));
+  hash = _watermark_hash(hash, &roi_out->width, sizeof(int));
+  hash = _watermark_hash(hash, &roi_out->height, sizeof(int));
+  hash = _watermark_hash(hash, &roi_out->scale, sizeof(float));
+  hash = _watermark_hash(hash, &data->scale, sizeof(float));
+  hash = _watermark_hash(hash, &data->xoffset, sizeof(float));
+  hash = _watermark_hash(hash, &data->yoffset, sizeof(float));
+  hash = _watermark_hash(hash, &data->alignment, sizeof(int));
+  hash = _watermark_hash(hash, &data->sizeto, sizeof(int));
+  return hash;
+}
+
+static void
+_watermark_raster_release(dt_iop_watermark_global_data_t *gd, dt_iop_watermark_raster_t *r)
+{
+  dt_pthread_mutex_lock(&gd->lock);
+  const int refs = --r->refs;
+  dt_pthread_mutex_unlock(&gd->lock);
+  if(refs) return;
+  free(r->data);
+  free(r);
+}
 
+/* renders the svg for the roi, keeping only the rectangle with non zero alpha. returns NULL if the svg
+ * can't be rendered. */
+static dt_iop_watermark_raster_t *
+_watermark_render(dt_iop_watermark_data_t *data, dt_dev_pixelpipe_iop_t *piece, const gchar *svgdoc,
+                  const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
   /* create the rsvghandle from parsed svg data */
   GError *error = NULL;
   RsvgHandle *svg = rsvg_handle_new_from_data ((const guint8 *)svgdoc,strlen (svgdoc),&error);
-  g_free (svgdoc);
   if (!svg || error)
-  {
-    memcpy(ovoid, ivoid, sizeof(float)*ch*roi_out->width*roi_out->height);
-    return;
-  }
+    return NULL;
 
   /* setup stride for performance */
   int stride = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32,roi_out->width);
@@ -621,8 +676,8 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   {
 //   fprintf(stderr,"Cairo surface error: %s\n",cairo_status_to_string(cairo_surface_status(surface)));
     g_free (image);
-    memcpy(ovoid, ivoid, sizeof(float)*ch*roi_out->width*roi_out->height);
-    return;
+    g_object_unref (svg);
+    return NULL;
   }
 
   /* create cairo context and setup transformation/scale */
@@ -749,34 +804,191 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   /* ensure that all operations on surface finishing up */
   cairo_surface_flush (surface);
 
-  /* render surface on output */
-  guint8 *sd = image;
-  float opacity = data->opacity/100.0;
-  /*
-  #ifdef _OPENMP
-  	#pragma omp parallel for default(none) shared(roi_out, in, out,sd,opacity) schedule(static)
-  #endif
-  */
-  for(int j=0; j<roi_out->height; j++) for(int i=0; i<roi_out->width; i++)
-    {
-      float alpha = (sd[3]/255.0)*opacity;
-      /* svg uses a premultiplied alpha, so only use opacity for the blending */
-      out[0] = ((1.0-alpha)*in[0]) + (opacity*(sd[2]/255.0));
-      out[1] = ((1.0-alpha)*in[1]) + (opacity*(sd[1]/255.0));
-      out[2] = ((1.0-alpha)*in[2]) + (opacity*(sd[0]/255.0));
-      out[3] = in[3];
-
-      out+=ch;
-      in+=ch;
-      sd+=4;
-    }
+  /* find the rectangle the watermark covers, usually a small part of the image */
+  int x0 = roi_out->width, x1 = 0, y0 = roi_out->height, y1 = 0;
+  for(int j=0; j<roi_out->height; j++)
+  {
+    const guint8 *sd = image + (size_t)stride*j;
+    for(int i=0; i<roi_out->width; i++)
+      if(sd[4*i+3])
+      {
+        x0 = MIN(x0, i);
+        x1 = MAX(x1, i+1);
+        y0 = MIN(y0, j);
+        y1 = MAX(y1, j+1);
+      }
+  }
 
+  dt_iop_watermark_raster_t *r = (dt_iop_watermark_raster_t *)malloc(sizeof(dt_iop_watermark_raster_t));
+  r->x = x0;
+  r->y = y0;
+  r->width = MAX(0, x1-x0);
+  r->height = MAX(0, y1-y0);
+  r->data = NULL;
+  if(r->width > 0 && r->height > 0)
+  {
+    r->data = (guint8 *)malloc((size_t)4*r->width*r->height);
+    for(int j=0; j<r->height; j++)
+      memcpy(r->data + (size_t)4*r->width*j, image + (size_t)stride*(y0+j) + 4*x0, 4*r->width);
+  }
 
   /* clean up */
+  cairo_destroy (cr);
   cairo_surface_destroy (surface);
   g_object_unref (svg);
   g_free (image);
 
+  return r;
+}
+
+/* the rendered watermark for this pipe run, from the cache if possible. release with
+ * _watermark_raster_release(). */
+static dt_iop_watermark_raster_t *
+_watermark_get_raster(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)self->data;
+  dt_iop_watermark_data_t *data = (dt_iop_watermark_data_t *)piece->data;
+
+  /* Load svg if not loaded */
+  gchar *svgdoc = _watermark_get_svgdoc (self, data, &piece->pipe->image);
+  if (!svgdoc) return NULL;
+
+  const uint64_t hash = _watermark_raster_hash(data, piece, svgdoc, roi_in, roi_out);
+
+  dt_pthread_mutex_lock(&gd->lock);
+  for(int k=0; k<DT_IOP_WATERMARK_CACHE; k++)
+  {
+    dt_iop_watermark_raster_t *r = gd->cache[k];
+    if(r && r->hash == hash)
+    {
+      // move to the front
+      for(int l=k; l>0; l--) gd->cache[l] = gd->cache[l-1];
+      gd->cache[0] = r;
+      r->refs++;
+      dt_pthread_mutex_unlock(&gd->lock);
+      g_free(svgdoc);
+      return r;
+    }
+  }
+  dt_pthread_mutex_unlock(&gd->lock);
+
+  dt_iop_watermark_raster_t *r = _watermark_render(data, piece, svgdoc, roi_in, roi_out);
+  g_free(svgdoc);
+  if(!r) return NULL;
+  r->hash = hash;
+  r->refs = 2; // the cache and the caller
+
+  dt_pthread_mutex_lock(&gd->lock);
+  dt_iop_watermark_raster_t *evicted = gd->cache[DT_IOP_WATERMARK_CACHE-1];
+  for(int l=DT_IOP_WATERMARK_CACHE-1; l>0; l--) gd->cache[l] = gd->cache[l-1];
+  gd->cache[0] = r;
+  dt_pthread_mutex_unlock(&gd->lock);
+  if(evicted) _watermark_raster_release(gd, evicted);
+
+  return r;
+}
+
+#ifdef HAVE_OPENCL
+int
+process_cl (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_iop_watermark_data_t *d = (dt_iop_watermark_data_t *)piece->data;
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)self->data;
+
+  cl_mem dev_mark = NULL;
+  cl_int err = -999;
+  const int devid = piece->pipe->devid;
+
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+
+  dt_iop_watermark_raster_t *r = _watermark_get_raster(self, piece, roi_in, roi_out);
+
+  if(!r || !r->data)
+  {
+    // nothing to draw
+    if(r) _watermark_raster_release(gd, r);
+    size_t origin[] = { 0, 0, 0};
+    size_t region[] = { width, height, 1};
+    err = dt_opencl_enqueue_copy_image(devid, dev_in, dev_out, origin, origin, region);
+    if(err != CL_SUCCESS) goto error;
+    return TRUE;
+  }
+
+  dev_mark = dt_opencl_alloc_device_buffer(devid, (size_t)4*r->width*r->height);
+  if(dev_mark == NULL) goto error;
+  err = dt_opencl_write_buffer_to_device(devid, r->data, dev_mark, 0, (size_t)4*r->width*r->height, CL_TRUE);
+  if(err != CL_SUCCESS) goto error;
+
+  const float opacity = d->opacity/100.0f;
+  size_t sizes[2] = { ROUNDUPWD(width), ROUNDUPHT(height) };
+  dt_opencl_set_kernel_arg(devid, gd->kernel_watermark, 0, sizeof(cl_mem), &dev_in);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_watermark, 1, sizeof(cl_mem), &dev_out);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_watermark, 2, sizeof(int), &width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_watermark, 3, sizeof(int), &height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_watermark, 4, sizeof(cl_mem), &dev_mark);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_watermark, 5, sizeof(int), &r->x);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_watermark, 6, sizeof(int), &r->y);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_watermark, 7, sizeof(int), &r->width);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_watermark, 8, sizeof(int), &r->height);
+  dt_opencl_set_kernel_arg(devid, gd->kernel_watermark, 9, sizeof(float), &opacity);
+  err = dt_opencl_enqueue_kernel_2d(devid, gd->kernel_watermark, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  dt_opencl_release_mem_object(dev_mark);
+  _watermark_raster_release(gd, r);
+  return TRUE;
+
+error:
+  if (dev_mark != NULL) dt_opencl_release_mem_object(dev_mark);
+  if (r != NULL) _watermark_raster_release(gd, r);
+  dt_print(DT_DEBUG_OPENCL, "[opencl_watermark] couldn't enqueue kernel! %d\n", err);
+  return FALSE;
+}
+#endif
+
+void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_iop_watermark_data_t *data = (dt_iop_watermark_data_t *)piece->data;
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)self->data;
+  const int ch = piece->colors;
+
+  // everything outside of the watermark stays as it is
+  memcpy(ovoid, ivoid, sizeof(float)*ch*roi_out->width*roi_out->height);
+
+  dt_iop_watermark_raster_t *r = _watermark_get_raster(self, piece, roi_in, roi_out);
+  if(!r) return;
+
+  /* render surface on output */
+  const float opacity = data->opacity/100.0;
+  const __m128 op = _mm_set1_ps(opacity);
+  const __m128 scale = _mm_set1_ps(1.0f/255.0f);
+  const __m128 keep_alpha = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) shared(r)
+#endif
+  for(int j=0; j<r->height; j++)
+  {
+    const float *in = (const float *)ivoid + (size_t)ch*(roi_out->width*(r->y+j) + r->x);
+    float *out = (float *)ovoid + (size_t)ch*(roi_out->width*(r->y+j) + r->x);
+    const guint8 *sd = r->data + (size_t)4*r->width*j;
+    for(int i=0; i<r->width; i++, in+=ch, out+=ch, sd+=4)
+    {
+      if(!sd[3]) continue;
+      // b, g, r, a bytes to floats
+      const __m128i px = _mm_cvtsi32_si128(*(const int *)sd);
+      const __m128i px32 = _mm_unpacklo_epi16(_mm_unpacklo_epi8(px, _mm_setzero_si128()), _mm_setzero_si128());
+      const __m128 bgra = _mm_cvtepi32_ps(px32) * scale;
+      const __m128 rgba = _mm_shuffle_ps(bgra, bgra, _MM_SHUFFLE(3,0,1,2));
+      const __m128 alpha = _mm_shuffle_ps(bgra, bgra, _MM_SHUFFLE(3,3,3,3)) * op;
+      const __m128 pin = _mm_load_ps(in);
+      /* svg uses a premultiplied alpha, so only use opacity for the blending */
+      const __m128 pout = (_mm_set1_ps(1.0f) - alpha) * pin + op * rgba;
+      _mm_store_ps(out, _mm_or_ps(_mm_and_ps(keep_alpha, pin), _mm_andnot_ps(keep_alpha, pout)));
+    }
+  }
+
+  _watermark_raster_release(gd, r);
 }
 
 static void
@@ -996,6 +1208,27 @@ void gui_update(struct dt_iop_module_t *self)
   dt_bauhaus_combobox_set(g->sizeto, p->sizeto);
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  const int program = 2; // basic.cl, from programs.conf
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)malloc(sizeof(dt_iop_watermark_global_data_t));
+  module->data = gd;
+  gd->kernel_watermark = dt_opencl_create_kernel(program, "watermark");
+  dt_pthread_mutex_init(&gd->lock, NULL);
+  for(int k=0; k<DT_IOP_WATERMARK_CACHE; k++) gd->cache[k] = NULL;
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)module->data;
+  dt_opencl_free_kernel(gd->kernel_watermark);
+  for(int k=0; k<DT_IOP_WATERMARK_CACHE; k++)
+    if(gd->cache[k]) _watermark_raster_release(gd, gd->cache[k]);
+  dt_pthread_mutex_destroy(&gd->lock);
+  free(module->data);
+  module->data = NULL;
+}
+
 void init(dt_iop_module_t *module)
 {
   module->params = malloc(sizeof(dt_iop_watermark_params_t));
@@ -53,6 +53,9 @@ typedef struct dt_lib_backgroundjobs_t
 {
   GtkWidget *jobbox;
   GHashTable *jobs;
+  /* live queue depth and latencies of the job scheduler */
+  GtkWidget *queue_label;
+  guint stats_timeout;
 }
 dt_lib_backgroundjobs_t;
 
@@ -66,6 +69,8 @@ static void _lib_backgroundjobs_set_cancellable(dt_lib_module_t *self, const gui
 static void _lib_backgroundjobs_progress(dt_lib_module_t *self, const guint *key, double progress);
 /* callback when cancel job button is pushed  */
 static void _lib_backgroundjobs_cancel_callback(GtkWidget *w, gpointer user_data);
+/* periodically updates the queue label from the scheduler statistics */
+static gboolean _lib_backgroundjobs_stats_update(gpointer user_data);
 
 const char* name()
 {
@@ -106,6 +111,12 @@ void gui_init(dt_lib_module_t *self)
   gtk_widget_set_no_show_all(self->widget, TRUE);
   gtk_container_set_border_width(GTK_CONTAINER(self->widget), 5);
 
+  /* queue depth, details in the tooltip */
+  d->queue_label = gtk_label_new("");
+  gtk_misc_set_alignment(GTK_MISC(d->queue_label), 0.0, 0.5);
+  gtk_box_pack_start(GTK_BOX(d->jobbox), d->queue_label, TRUE, FALSE, 1);
+  d->stats_timeout = g_timeout_add_seconds(1, _lib_backgroundjobs_stats_update, self);
+
   /* setup proxy */
   darktable.control->proxy.backgroundjobs.module = self;
   darktable.control->proxy.backgroundjobs.create = _lib_backgroundjobs_create;
@@ -119,10 +130,75 @@ void gui_cleanup(dt_lib_module_t *self)
   /* lets kill proxy */
   darktable.control->proxy.backgroundjobs.module = NULL;
 
+  dt_lib_backgroundjobs_t *d = (dt_lib_backgroundjobs_t *)self->data;
+  g_source_remove(d->stats_timeout);
+
   g_free(self->data);
   self->data = NULL;
 }
 
+/* true if there is neither a job plate nor the queue label to show */
+static gboolean _lib_backgroundjobs_idle(dt_lib_backgroundjobs_t *d)
+{
+  GList *children = gtk_container_get_children(GTK_CONTAINER(d->jobbox));
+  const int plates = g_list_length(children) - 1;
+  g_list_free(children);
+  return plates <= 0 && !gtk_widget_get_visible(d->queue_label);
+}
+
+typedef struct _lib_backgroundjobs_stats_t
+{
+  int queued;
+  GString *tooltip;
+}
+_lib_backgroundjobs_stats_t;
+
+static void _lib_backgroundjobs_stats_line(const char *name, const int queued, const dt_control_job_stats_t *stats,
+    const double wait_p50, const double wait_p95, const double run_p50, const double run_p95, void *data)
+{
+  _lib_backgroundjobs_stats_t *s = (_lib_backgroundjobs_stats_t *)data;
+  s->queued += queued;
+  if(!stats->count && !queued) return;
+  if(s->tooltip->len) g_string_append_c(s->tooltip, '\n');
+  g_string_append_printf(s->tooltip, _("%s: %d queued, %d done, %d coalesced\n"
+                                       "  waited %.2fs, ran %.2fs (median)\n"
+                                       "  waited %.2fs, ran %.2fs (95%%)"),
+                         name, queued, stats->count, stats->coalesced, wait_p50, run_p50, wait_p95, run_p95);
+  if(stats->blocked)
+    g_string_append_printf(s->tooltip, ngettext("\n  queue was full %d time", "\n  queue was full %d times",
+                           stats->blocked), stats->blocked);
+}
+
+static gboolean _lib_backgroundjobs_stats_update(gpointer user_data)
+{
+  dt_lib_module_t *self = (dt_lib_module_t *)user_data;
+  dt_lib_backgroundjobs_t *d = (dt_lib_backgroundjobs_t *)self->data;
+  if(!darktable.control->running) return TRUE;
+
+  _lib_backgroundjobs_stats_t s = { 0, g_string_new("") };
+  dt_control_job_statistics(darktable.control, _lib_backgroundjobs_stats_line, &s);
+
+  gboolean i_own_lock = dt_control_gdk_lock();
+  if(s.queued > 0)
+  {
+    gchar *text = g_strdup_printf(ngettext("%d job queued", "%d jobs queued", s.queued), s.queued);
+    gtk_label_set_text(GTK_LABEL(d->queue_label), text);
+    g_object_set(G_OBJECT(d->queue_label), "tooltip-text", s.tooltip->str, (char *)NULL);
+    g_free(text);
+    gtk_widget_show(d->queue_label);
+    gtk_widget_show(d->jobbox);
+  }
+  else if(gtk_widget_get_visible(d->queue_label))
+  {
+    gtk_widget_hide(d->queue_label);
+    if(_lib_backgroundjobs_idle(d)) gtk_widget_hide(d->jobbox);
+  }
+  if(i_own_lock) dt_control_gdk_unlock();
+
+  g_string_free(s.tooltip, TRUE);
+  return TRUE;
+}
+
 static const guint * _lib_backgroundjobs_create(dt_lib_module_t *self,int type,const gchar *message)
 {
   dt_lib_backgroundjobs_t *d = (dt_lib_backgroundjobs_t *)self->data;
@@ -193,7 +269,7 @@ static void _lib_backgroundjobs_destroy(dt_lib_module_t *self, const guint *key)
       gtk_container_remove(GTK_CONTAINER(d->jobbox),j->widget);
 
     /* if jobbox is empty lets hide */
-    if(g_list_length(gtk_container_get_children(GTK_CONTAINER(d->jobbox)))==0)
+    if(_lib_backgroundjobs_idle(d))
       gtk_widget_hide(d->jobbox);
 
     /* free allocted mem */
@@ -263,7 +339,7 @@ static void _lib_backgroundjobs_progress(dt_lib_module_t *self, const guint *key
 #endif
 
       /* hide jobbox if there are no jobs left */
-      if (g_list_length(gtk_container_get_children(GTK_CONTAINER(d->jobbox))) == 0 )
+      if (_lib_backgroundjobs_idle(d))
         gtk_widget_hide(d->jobbox);
     }
     else
@@ -59,8 +59,12 @@ typedef struct dt_lib_collect_t
 
   GtkTreeView *view;
   GtkTreeModel *treemodel;
+  GHashTable *folder_nodes; // folder -> GtkTreeIter in treemodel
   gboolean tree_new;
   GtkTreeModel *listmodel;
+  /* what the list shows: property and text of the rule, and the library state it was read at */
+  int list_property, list_changes;
+  gchar *list_text;
   GtkScrolledWindow *scrolledwindow;
 
 //  GVolumeMonitor *gv_monitor;
@@ -609,30 +613,77 @@ view_onPopupMenu (GtkWidget *treeview, gpointer userdata)
   return TRUE; /* we handled this */
 }
 
-static int
-_count_images(const char *path)
+typedef struct _folder_count_t
 {
-  // FIXME: this function is a major performance problem
-  //        if many folders are counted. until it's cached somehow, it's switched off:
-  return 0;
-#if 0
-  sqlite3_stmt *stmt = NULL;
-  gchar query[1024] = {0};
-  int count = 0;
+  gchar *folder;
+  int count;
+}
+_folder_count_t;
 
-  gchar *escaped_text = NULL;
-  escaped_text = dt_util_str_replace(path, "'", "''");
+/* image count per film roll folder, sorted by folder, and the library state it was read at */
+static GArray *_folder_counts = NULL;
+static int _folder_counts_changes = -1;
 
-  snprintf (query, 1024, "select count(id) from images where film_id in (select id from film_rolls where folder like '%s%%')", escaped_text);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-  if (sqlite3_step(stmt) == SQLITE_ROW)
-    count = sqlite3_column_int(stmt, 0);
+static gint
+_folder_count_cmp(gconstpointer a, gconstpointer b)
+{
+  return strcmp(((const _folder_count_t *)a)->folder, ((const _folder_count_t *)b)->folder);
+}
+
+static void
+_folder_counts_update()
+{
+  const int changes = dt_collection_library_changes();
+  if(_folder_counts && _folder_counts_changes == changes) return;
+
+  if(_folder_counts)
+  {
+    for(int k=0; k<_folder_counts->len; k++)
+      g_free(g_array_index(_folder_counts, _folder_count_t, k).folder);
+    g_array_free(_folder_counts, TRUE);
+  }
+  _folder_counts = g_array_new(FALSE, FALSE, sizeof(_folder_count_t));
+
+  // one grouped query for all film rolls instead of one per tree node:
+  sqlite3_stmt *stmt = NULL;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select film_rolls.folder, count(images.id) from film_rolls "
+                              "join images on images.film_id = film_rolls.id group by film_rolls.id",
+                              -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    _folder_count_t fc;
+    fc.folder = g_strdup((const char *)sqlite3_column_text(stmt, 0));
+    fc.count = sqlite3_column_int(stmt, 1);
+    g_array_append_val(_folder_counts, fc);
+  }
   sqlite3_finalize(stmt);
+  g_array_sort(_folder_counts, _folder_count_cmp);
+  _folder_counts_changes = changes;
+}
 
-  g_free(escaped_text);
+static int
+_count_images(const char *path)
+{
+  _folder_counts_update();
+
+  // all folders starting with path are adjacent in the sorted array, find the first one:
+  int lo = 0, hi = _folder_counts->len;
+  while(lo < hi)
+  {
+    const int mid = (lo + hi) / 2;
+    if(strcmp(g_array_index(_folder_counts, _folder_count_t, mid).folder, path) < 0) lo = mid + 1;
+    else hi = mid;
+  }
 
+  int count = 0;
+  for(int k=lo; k<_folder_counts->len; k++)
+  {
+    const _folder_count_t *fc = &g_array_index(_folder_counts, _folder_count_t, k);
+    if(!g_str_has_prefix(fc->folder, path)) break;
+    count += fc->count;
+  }
   return count;
-#endif
 }
 
 static gboolean
@@ -662,110 +713,106 @@ _show_filmroll_present(GtkTreeViewColumn *column,
 }
 
 
-static GtkTreeStore *
-_folder_tree ()
+/* the node of a folder in the folders tree, created with its parents if it isn't there yet */
+static GtkTreeIter *
+_folder_tree_node (GtkTreeStore *store, GHashTable *nodes, const gchar *folder)
 {
-  /* initialize the tree store */
-  sqlite3_stmt *stmt;
-//  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select folder,external_drive from film_rolls order by folder desc", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select folder from film_rolls order by folder desc", -1, &stmt, NULL);
-  GtkTreeStore *store = gtk_tree_store_new(DT_LIB_COLLECT_NUM_COLS, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_INT, G_TYPE_BOOLEAN);
+  GtkTreeIter *node = (GtkTreeIter *)g_hash_table_lookup(nodes, folder);
+  if(node) return node;
 
-  // initialize the model with the paths
+  const gchar *slash = strrchr(folder, '/');
+  GtkTreeIter *parent = NULL;
+  if(slash && slash != folder)
+  {
+    gchar *parent_folder = g_strndup(folder, slash - folder);
+    parent = _folder_tree_node(store, nodes, parent_folder);
+    g_free(parent_folder);
+  }
+  const gchar *name = slash ? slash + 1 : folder;
 
-  while (sqlite3_step(stmt) == SQLITE_ROW)
+  // keep the siblings sorted by name. folders come in descending order, so this mostly stops at the first one:
+  GtkTreeIter sibling, iter;
+  gboolean valid = gtk_tree_model_iter_children(GTK_TREE_MODEL(store), &sibling, parent);
+  while(valid)
   {
-    int level = 0;
-    char *value;
-    GtkTreeIter current, iter;
-    GtkTreePath *root;
-    char **pch = g_strsplit((char *)sqlite3_column_text(stmt, 0), "/", -1);
-#if 0
-    char *external = g_strdup((char *)sqlite3_column_text(stmt, 1));
+    gchar *sibling_name;
+    gtk_tree_model_get(GTK_TREE_MODEL(store), &sibling, DT_LIB_COLLECT_COL_TEXT, &sibling_name, -1);
+    const int behind = strcmp(sibling_name, name) > 0;
+    g_free(sibling_name);
+    if(behind) break;
+    valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(store), &sibling);
+  }
+  gtk_tree_store_insert_before(store, &iter, parent, valid ? &sibling : NULL);
+  gtk_tree_store_set(store, &iter, DT_LIB_COLLECT_COL_TEXT, name,
+                     DT_LIB_COLLECT_COL_PATH, folder,
+                     DT_LIB_COLLECT_COL_COUNT, _count_images(folder),
+                     DT_LIB_COLLECT_COL_VISIBLE, TRUE, -1);
+
+  // tree store iters stay valid as long as their row exists:
+  node = gtk_tree_iter_copy(&iter);
+  g_hash_table_insert(nodes, g_strdup(folder), node);
+  return node;
+}
 
-    if (external == NULL)
-      external = g_strdup("Local");
-#endif
-    gboolean found=FALSE;
+static gboolean
+_folder_tree_is_stale (gpointer key, gpointer value, gpointer user_data)
+{
+  return !g_hash_table_lookup((GHashTable *)user_data, key);
+}
 
-    root = gtk_tree_path_new_first();
-    gtk_tree_model_get_iter (GTK_TREE_MODEL(store), &iter, root);
-    //current = iter; // This needs to be deleted if the following code is enabled
-#if 0
-    int children = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(store),NULL);
-    for (int k=0; k<children; k++)
-    {
-      if (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(store), &iter, NULL, k))
-      {
-        gtk_tree_model_get (GTK_TREE_MODEL(store), &iter, 0, &value, -1);
+/* bring the folders tree in line with the film rolls, touching only the nodes which changed */
+static void
+_folder_tree_update (dt_lib_collect_t *d)
+{
+  GtkTreeStore *store = GTK_TREE_STORE(d->treemodel);
+  GHashTable *needed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 
-        if (strcmp(value, external)==0)
-        {
-          found = TRUE;
-          current = iter;
-          break;
-        }
-      }
-    }
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select folder from film_rolls order by folder desc", -1, &stmt, NULL);
+  while (sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const gchar *folder = (const gchar *)sqlite3_column_text(stmt, 0);
+    _folder_tree_node(store, d->folder_nodes, folder);
 
-    if (!found)
+    // the folder and all its parents stay:
+    gchar *path = g_strdup(folder);
+    while(!g_hash_table_lookup(needed, path))
     {
-      gtk_tree_store_insert(store, &iter, NULL, 0);
-      gtk_tree_store_set(store, &iter, 0, external, -1);
-      current = iter;
+      g_hash_table_insert(needed, g_strdup(path), GINT_TO_POINTER(1));
+      gchar *slash = strrchr(path, '/');
+      if(!slash || slash == path) break;
+      *slash = '\0';
     }
+    g_free(path);
+  }
+  sqlite3_finalize(stmt);
 
-    level=1;
-#endif
-
-    // g_strsplit returns pch[0] always as an empty string ""
-    while (pch[level] != NULL)
-    {
-      found = FALSE;
-      int children = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(store),level>0?&current:NULL);
-      /* find child with name, if not found create and continue */
-      for (int k=0; k<children; k++)
-      {
-        if (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(store), &iter, level>0?&current:NULL, k))
-        {
-          gtk_tree_model_get (GTK_TREE_MODEL(store), &iter, 0, &value, -1);
-
-          if (strcmp(value, pch[level])==0)
-          {
-            current = iter;
-            found = TRUE;
-            break;
-          }
-        }
-      }
-
-      /* lets add new path and assign current */
-      if (!found)
-      {
-        gchar *pth2 = NULL;
-        pth2 = dt_util_dstrcat(pth2, "/");
-
-        for (int i=0; i <= level; i++)
-        {
-          if (level > 0 && i != 0)
-            pth2 = dt_util_dstrcat(pth2, "%s/", pch[i]);
-        }
-
-        snprintf(pth2+strlen(pth2)-1, 1, "%s", "\0");
-
-        int count = _count_images(pth2);
-        gtk_tree_store_insert(store, &iter, level>0?&current:NULL,0);
-        gtk_tree_store_set(store, &iter, DT_LIB_COLLECT_COL_TEXT, pch[level],
-                           DT_LIB_COLLECT_COL_PATH, pth2,
-                           DT_LIB_COLLECT_COL_COUNT, count,
-                           DT_LIB_COLLECT_COL_VISIBLE, TRUE, -1);
-        current = iter;
-      }
+  // drop the nodes of removed film rolls. removing a row takes its children with it, so only remove the topmost:
+  GHashTableIter it;
+  gpointer key, value;
+  g_hash_table_iter_init(&it, d->folder_nodes);
+  while(g_hash_table_iter_next(&it, &key, &value))
+  {
+    if(g_hash_table_lookup(needed, key)) continue;
+    const gchar *slash = strrchr((const gchar *)key, '/');
+    gchar *parent_folder = (slash && slash != key) ? g_strndup(key, slash - (const gchar *)key) : NULL;
+    if(!parent_folder || g_hash_table_lookup(needed, parent_folder))
+      gtk_tree_store_remove(store, (GtkTreeIter *)value);
+    g_free(parent_folder);
+  }
+  g_hash_table_foreach_remove(d->folder_nodes, _folder_tree_is_stale, needed);
+  g_hash_table_destroy(needed);
 
-      level++;
-    }
+  // and update the counts which changed:
+  g_hash_table_iter_init(&it, d->folder_nodes);
+  while(g_hash_table_iter_next(&it, &key, &value))
+  {
+    int count = 0;
+    const int new_count = _count_images((const gchar *)key);
+    gtk_tree_model_get(d->treemodel, (GtkTreeIter *)value, DT_LIB_COLLECT_COL_COUNT, &count, -1);
+    if(count != new_count)
+      gtk_tree_store_set(store, (GtkTreeIter *)value, DT_LIB_COLLECT_COL_COUNT, new_count, -1);
   }
-  return store;
 }
 
 static gboolean
@@ -957,14 +1004,12 @@ _create_treeview_display (GtkTreeModel *model)
 
   gtk_tree_view_column_set_cell_data_func(col1, renderer, _show_filmroll_present, NULL, NULL);
 
-#if 0 // FIXME: count switched off for now, as it is a performance regression (see #8981).
   GtkTreeViewColumn *col2 = gtk_tree_view_column_new();
   gtk_tree_view_append_column(tree,col2);
 
   GtkCellRenderer *renderer2 = gtk_cell_renderer_text_new();
   gtk_tree_view_column_pack_start(col2, renderer2, TRUE);
   gtk_tree_view_column_add_attribute(col2, renderer2, "text", DT_LIB_COLLECT_COL_COUNT);
-#endif
 
   gtk_tree_view_set_model(tree, GTK_TREE_MODEL(model));
 
@@ -1090,11 +1135,6 @@ list_view (dt_lib_collect_rule_t *dr)
 
   view = d->view;
   listmodel = d->listmodel;
-  g_object_ref(listmodel);
-  gtk_tree_view_set_model(GTK_TREE_VIEW(view), NULL);
-  gtk_list_store_clear(GTK_LIST_STORE(listmodel));
-  gtk_widget_hide(GTK_WIDGET(d->scrolledwindow));
-  gtk_widget_hide(GTK_WIDGET(d->sw2));
 
   set_properties (dr);
 
@@ -1104,9 +1144,44 @@ list_view (dt_lib_collect_rule_t *dr)
   text = gtk_entry_get_text(GTK_ENTRY(dr->text));
   gchar *escaped_text = NULL;
 
+  // every collection change ends up here, only query again if the list would look different:
+  const int changes = dt_collection_library_changes();
+  if(d->list_text && property == d->list_property && changes == d->list_changes && !strcmp(text, d->list_text))
+  {
+    gtk_widget_hide(GTK_WIDGET(d->sw2));
+    gtk_widget_set_no_show_all(GTK_WIDGET(d->scrolledwindow), FALSE);
+    gtk_widget_show_all(GTK_WIDGET(d->scrolledwindow));
+    return;
+  }
+  g_free(d->list_text);
+  d->list_text = g_strdup(text);
+  d->list_property = property;
+  d->list_changes = changes;
+
+  g_object_ref(listmodel);
+  gtk_tree_view_set_model(GTK_TREE_VIEW(view), NULL);
+  gtk_list_store_clear(GTK_LIST_STORE(listmodel));
+  gtk_widget_hide(GTK_WIDGET(d->scrolledwindow));
+  gtk_widget_hide(GTK_WIDGET(d->sw2));
+
   escaped_text = dt_util_str_replace(text, "'", "''");
 
-  switch(property)
+  // filename and metadata are looked up in the full-text index if possible:
+  gchar *fts = dt_collection_get_fts_match(property, escaped_text);
+  if(fts)
+  {
+    if(property == DT_COLLECTION_PROP_FILENAME)
+      snprintf(query, 1024, "select distinct filename, 1 from images where id in %s order by filename", fts);
+    else
+      snprintf(query, 1024, "select distinct value, 1 from meta_data where key = %d and id in %s order by value",
+               property == DT_COLLECTION_PROP_TITLE ? DT_METADATA_XMP_DC_TITLE :
+               property == DT_COLLECTION_PROP_DESCRIPTION ? DT_METADATA_XMP_DC_DESCRIPTION :
+               property == DT_COLLECTION_PROP_CREATOR ? DT_METADATA_XMP_DC_CREATOR :
+               property == DT_COLLECTION_PROP_PUBLISHER ? DT_METADATA_XMP_DC_PUBLISHER : DT_METADATA_XMP_DC_RIGHTS,
+               fts);
+    g_free(fts);
+  }
+  else switch(property)
   {
     case DT_COLLECTION_PROP_FILMROLL: // film roll
       snprintf(query, 1024, "select distinct folder, id from film_rolls where folder like '%%%s%%'  order by folder desc", escaped_text);
@@ -1701,12 +1776,11 @@ collection_updated(gpointer instance, gpointer self)
 static void
 filmrolls_updated(gpointer instance, gpointer self)
 {
-//  dt_lib_module_t *dm = (dt_lib_module_t *)self;
-
-//  dt_lib_collect_t *d = (dt_lib_collect_t *)dm->data;
-//  int active = d->active_rule;
+  dt_lib_module_t *dm = (dt_lib_module_t *)self;
+  dt_lib_collect_t *d = (dt_lib_collect_t *)dm->data;
 
-  //TODO: We should update the count of images here
+  // only the rows whose count changed are touched:
+  _folder_tree_update(d);
   _lib_collect_gui_update(self);
 }
 
@@ -1720,7 +1794,7 @@ filmrolls_imported(gpointer instance, gpointer self)
   d->active_rule = active;
 
   // update tree
-  d->treemodel = GTK_TREE_MODEL(_folder_tree());
+  _folder_tree_update(d);
   d->tree_new = TRUE;
   d->rule[active].typing = FALSE;
 
@@ -1740,7 +1814,7 @@ filmrolls_removed(gpointer instance, gpointer self)
   d->active_rule = active;
 
   // update tree
-  d->treemodel = GTK_TREE_MODEL(_folder_tree());
+  _folder_tree_update(d);
   d->tree_new = TRUE;
   d->rule[active].typing = FALSE;
 
@@ -1945,7 +2019,9 @@ gui_init (dt_lib_module_t *self)
 //  g_signal_connect(G_OBJECT(d->gv_monitor), "mount-changed", G_CALLBACK(mount_changed), self);
 
   // TODO: This should be done in a more generic place, not gui_init
-  d->treemodel = GTK_TREE_MODEL(_folder_tree());
+  d->treemodel = GTK_TREE_MODEL(gtk_tree_store_new(DT_LIB_COLLECT_NUM_COLS, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_INT, G_TYPE_BOOLEAN));
+  d->folder_nodes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)gtk_tree_iter_free);
+  _folder_tree_update(d);
   d->tree_new = TRUE;
   _lib_collect_gui_update(self);
 
@@ -1981,6 +2057,7 @@ gui_cleanup (dt_lib_module_t *self)
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(collection_updated), self);
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(filmrolls_updated), self);
   dt_control_signal_disconnect(darktable.signals, G_CALLBACK(filmrolls_imported), self);
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(filmrolls_removed), self);
   darktable.view_manager->proxy.module_collect.module = NULL;
   g_free(((dt_lib_collect_t*)self->data)->params);
 
@@ -1988,6 +2065,9 @@ gui_cleanup (dt_lib_module_t *self)
   //g_ptr_array_free(d->labels, TRUE);
   if (d->trees != NULL)
     g_ptr_array_free(d->trees, TRUE);
+  g_hash_table_destroy(d->folder_nodes);
+  g_object_unref(d->treemodel);
+  g_free(d->list_text);
 
   /* TODO: Make sure we are cleaning up all allocations */
 
@@ -18,6 +18,7 @@
 
 #include "common/darktable.h"
 #include "common/debug.h"
+#include "common/histogram.h"
 #include "control/control.h"
 #include "control/conf.h"
 #include "common/image_cache.h"
@@ -237,6 +238,18 @@ static void _draw_mode_toggle(cairo_t *cr, float x, float y, float width, float
       cairo_pattern_destroy(pattern);
       break;
     }
+    case DT_DEV_HISTOGRAM_VECTORSCOPE:
+    {
+      const float r = 0.5*MIN(width, height) - 2.0*border;
+      cairo_new_sub_path(cr);
+      cairo_arc(cr, 0.5*width, 0.5*height, r, 0.0, 2.0*M_PI);
+      cairo_move_to(cr, 0.5*width, 0.5*height);
+      cairo_line_to(cr, 0.5*width + 0.6*r, 0.5*height - 0.5*r);
+      cairo_move_to(cr, 0.5*width, 0.5*height);
+      cairo_line_to(cr, 0.5*width - 0.7*r, 0.5*height + 0.2*r);
+      cairo_stroke(cr);
+      break;
+    }
   }
  cairo_restore(cr);
 }
@@ -247,8 +260,16 @@ static gboolean _lib_histogram_expose_callback(GtkWidget *widget, GdkEventExpose
   dt_lib_histogram_t *d = (dt_lib_histogram_t *)self->data;
 
   dt_develop_t *dev = darktable.develop;
-  float *hist = dev->histogram;
-  float hist_max = dev->histogram_type == DT_DEV_HISTOGRAM_LINEAR?dev->histogram_max:logf(1.0 + dev->histogram_max);
+  // draw from the last finished preview, the pipe might be busy with the next one
+  dt_dev_preview_snapshot_t *snapshot = dt_dev_preview_snapshot_get(dev);
+  if(snapshot && snapshot->imgid != dev->image_storage.id)
+  {
+    dt_dev_preview_snapshot_release(snapshot);
+    snapshot = NULL;
+  }
+  float *hist = snapshot ? snapshot->histogram : NULL;
+  const float snapshot_max = snapshot ? snapshot->histogram_max : 0.0f;
+  float hist_max = dev->histogram_type == DT_DEV_HISTOGRAM_LINEAR?snapshot_max:logf(1.0 + snapshot_max);
   const int inset = DT_HIST_INSET;
   int width = widget->allocation.width, height = widget->allocation.height;
   cairo_surface_t *cst = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
@@ -279,14 +300,15 @@ static gboolean _lib_histogram_expose_callback(GtkWidget *widget, GdkEventExpose
   const gint stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, width);
 
   // this code assumes that the first expose comes before the first (preview) pipe is processed and that the size of the widget doesn't change!
+  // the preview pipe bins the scopes at this size.
   if(dev->histogram_waveform_width == 0)
   {
-    dev->histogram_waveform = (uint32_t*)calloc(height * stride / 4, sizeof(uint32_t));
-    dev->histogram_waveform_stride = stride;
     dev->histogram_waveform_height = height;
     dev->histogram_waveform_width = width;
 //     return TRUE; // there are enough expose events following ...
   }
+  const int scope = dev->histogram_type == DT_DEV_HISTOGRAM_WAVEFORM
+                    || dev->histogram_type == DT_DEV_HISTOGRAM_VECTORSCOPE;
 
 #if 1
   // draw shadow around
@@ -331,34 +353,48 @@ static gboolean _lib_histogram_expose_callback(GtkWidget *widget, GdkEventExpose
   cairo_set_source_rgb (cr, .1, .1, .1);
   if(dev->histogram_type == DT_DEV_HISTOGRAM_WAVEFORM)
     dt_draw_waveform_lines(cr, 0, 0, width, height);
+  else if(dev->histogram_type == DT_DEV_HISTOGRAM_VECTORSCOPE)
+  {
+    // chroma 0.25 and 0.5 around neutral, and the axes:
+    const float r = 0.5f*MIN(width, height);
+    for(int k=1; k<=2; k++)
+    {
+      cairo_new_sub_path(cr);
+      cairo_arc(cr, 0.5*width, 0.5*height, 0.5*k*r, 0.0, 2.0*M_PI);
+    }
+    cairo_move_to(cr, 0.5*width - r, 0.5*height);
+    cairo_line_to(cr, 0.5*width + r, 0.5*height);
+    cairo_move_to(cr, 0.5*width, 0.5*height - r);
+    cairo_line_to(cr, 0.5*width, 0.5*height + r);
+    cairo_stroke(cr);
+  }
   else
     dt_draw_grid(cr, 4, 0, 0, width, height);
 
   if(hist_max > 0)
   {
     cairo_save(cr);
-    if(dev->histogram_type == DT_DEV_HISTOGRAM_WAVEFORM)
+    if(scope)
     {
-      // make the color channel selector work:
-      uint8_t *buf = (uint8_t*)malloc(sizeof(uint8_t) * height * stride);
-      uint8_t mask[3] = {d->blue, d->green, d->red};
-      memcpy(buf, dev->histogram_waveform, sizeof(uint8_t) * height * stride);
-      for(int y = 0; y < height; y++)
-        for(int x = 0; x < width; x++)
-          for(int k = 0; k < 3; k++)
-          {
-            buf[y * stride + x * 4 + k] *= mask[k];
-          }
-
-      cairo_surface_t *source = cairo_image_surface_create_for_data(buf,
-                                                CAIRO_FORMAT_ARGB32,
-                                                width, height, stride);
-
-      cairo_set_source_surface(cr, source, 0.0, 0.0);
-      cairo_set_operator(cr, CAIRO_OPERATOR_ADD);
-      cairo_paint(cr);
-      cairo_surface_destroy(source);
-      free(buf);
+      // render the bins of the scope into a texture of the widget's size and add it on top:
+      if(snapshot->waveform && snapshot->scope_width == width && snapshot->scope_height == height)
+      {
+        const int vectorscope = dev->histogram_type == DT_DEV_HISTOGRAM_VECTORSCOPE;
+        const uint8_t mask[3] = {d->blue, d->green, d->red};
+        uint8_t *buf = (uint8_t *)malloc(sizeof(uint8_t) * height * stride);
+        if(buf)
+        {
+          dt_histogram_scope_image(vectorscope ? snapshot->vectorscope : snapshot->waveform, vectorscope,
+                                   width, height, snapshot->scope_weight, mask, buf, stride);
+          cairo_surface_t *source = cairo_image_surface_create_for_data(buf, CAIRO_FORMAT_ARGB32,
+                                                                        width, height, stride);
+          cairo_set_source_surface(cr, source, 0.0, 0.0);
+          cairo_set_operator(cr, CAIRO_OPERATOR_ADD);
+          cairo_paint(cr);
+          cairo_surface_destroy(source);
+          free(buf);
+        }
+      }
     }
     else
     {
@@ -388,6 +424,7 @@ static gboolean _lib_histogram_expose_callback(GtkWidget *widget, GdkEventExpose
     }
     cairo_restore(cr);
   }
+  dt_dev_preview_snapshot_release(snapshot);
 
   cairo_set_source_rgb(cr, .25, .25, .25);
   cairo_select_font_face (cr, "sans-serif", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
@@ -471,6 +508,9 @@ static gboolean _lib_histogram_motion_notify_callback(GtkWidget *widget, GdkEven
           g_object_set(G_OBJECT(widget), "tooltip-text", _("set histogram mode to waveform"), (char *)NULL);
           break;
         case DT_DEV_HISTOGRAM_WAVEFORM:
+          g_object_set(G_OBJECT(widget), "tooltip-text", _("set histogram mode to vectorscope"), (char *)NULL);
+          break;
+        case DT_DEV_HISTOGRAM_VECTORSCOPE:
           g_object_set(G_OBJECT(widget), "tooltip-text", _("set histogram mode to logarithmic"), (char *)NULL);
           break;
         case DT_DEV_HISTOGRAM_N:
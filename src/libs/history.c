@@ -219,7 +219,7 @@ static void _lib_history_compress_clicked_callback (GtkWidget *widget, gpointer
   const int imgid = darktable.develop->image_storage.id;
   if(!imgid) return;
   // make sure the right history is in there:
-  dt_dev_write_history(darktable.develop);
+  dt_database_write_wait(darktable.db, dt_dev_write_history(darktable.develop));
   sqlite3_stmt *stmt;
 
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from history where imgid = ?1 and num not in (select MAX(num) from history where imgid = ?1 group by operation,multi_priority)", -1, &stmt, NULL);
@@ -255,7 +255,7 @@ static void _lib_history_button_clicked_callback(GtkWidget *widget, gpointer use
 
   /* revert to given history item. */
   long int num = (long int)g_object_get_data(G_OBJECT(widget),"history-number");
-  dt_dev_pop_history_items (darktable.develop, num);
+  dt_dev_pop_history_items_changed(darktable.develop, num);
   dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
 
 }
@@ -264,7 +264,7 @@ static void _lib_history_create_style_button_clicked_callback (GtkWidget *widget
 {
   if(darktable.develop->image_storage.id)
   {
-    dt_dev_write_history(darktable.develop);
+    dt_database_write_wait(darktable.db, dt_dev_write_history(darktable.develop));
     dt_gui_styles_dialog_new (darktable.develop->image_storage.id);
   }
 }
@@ -24,6 +24,7 @@
 #include "control/conf.h"
 #include "control/control.h"
 #include "common/debug.h"
+#include "common/plugin_manifest.h"
 #include <stdlib.h>
 
 typedef struct dt_lib_module_info_t
@@ -588,6 +589,7 @@ dt_lib_load_modules ()
   g_strlcat(plugindir, "/plugins/lighttable", 1024);
   GDir *dir = g_dir_open(plugindir, 0, NULL);
   if(!dir) return 1;
+  dt_plugin_manifest_t *manifest = dt_plugin_manifest_load("lib");
   while((d_name = g_dir_read_name(dir)))
   {
     // get lib*.so
@@ -602,17 +604,27 @@ dt_lib_load_modules ()
       free(module);
       continue;
     }
-    // TODO: init presets
-    g_free(libname);
     res = g_list_insert_sorted(res, module, dt_lib_sort_plugins);
 
-    init_presets(module);
+    if(!dt_plugin_manifest_current(manifest, plugin_name, libname, module->version()))
+    {
+      // remove auto generated presets of the old build, not the user included ones.
+      sqlite3_stmt *stmt;
+      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from presets where operation=?1 and writeprotect=1", -1, &stmt, NULL);
+      DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, module->plugin_name, -1, SQLITE_TRANSIENT);
+      sqlite3_step(stmt);
+      sqlite3_finalize(stmt);
+      init_presets(module);
+      dt_plugin_manifest_set(manifest, plugin_name, libname, module->version());
+    }
+    g_free(libname);
     // Calling the keyboard shortcut initialization callback if present
     if(module->init_key_accels)
       module->init_key_accels(module);
 
   }
   g_dir_close(dir);
+  dt_plugin_manifest_save(manifest);
 
   darktable.lib->plugins = res;
 
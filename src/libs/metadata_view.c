@@ -105,9 +105,27 @@ static void _lib_metatdata_view_init_labels()
 }
 
 
+// a sweep of the pointer over the lighttable only updates once it rests that long on an image:
+#define DT_METADATA_VIEW_HOVER_MS 40
+// formatted values of the last images shown, they are formatted again when they get older than that:
+#define DT_METADATA_VIEW_CACHE_ENTRIES 16
+#define DT_METADATA_VIEW_CACHE_AGE (2*G_USEC_PER_SEC)
+
+typedef struct dt_lib_metadata_view_cache_t
+{
+  int32_t imgid;          // -1 if unused
+  gint64 time;            // when the values were formatted
+  gchar *value[md_size];
+}
+dt_lib_metadata_view_cache_t;
+
 typedef struct dt_lib_metadata_view_t
 {
   GtkLabel *metadata[md_size];
+  // what the labels show now, they are left alone if that doesn't change:
+  gchar *shown[md_size];
+  dt_lib_metadata_view_cache_t cache[DT_METADATA_VIEW_CACHE_ENTRIES];
+  guint hover_timeout;
 }
 dt_lib_metadata_view_t;
 
@@ -147,129 +165,76 @@ static void _filter_non_printable(char *string, int length)
   }
 }
 
-/* helper function for updating a metadata value */
-static void _metadata_update_value(GtkLabel *label, const char *value)
+/* helper function for updating a metadata value, only if it changed */
+static void _metadata_update_value(dt_lib_metadata_view_t *d, const int k, const char *value)
 {
-  gtk_label_set_text(GTK_LABEL(label), value);
-  gtk_label_set_ellipsize(GTK_LABEL(label), PANGO_ELLIPSIZE_MIDDLE);
-  g_object_set(G_OBJECT(label), "tooltip-text", value, (char *)NULL);
-}
-
-static void _metadata_update_value_end(GtkLabel *label, const char *value)
-{
-  gtk_label_set_text(GTK_LABEL(label), value);
-  gtk_label_set_ellipsize(GTK_LABEL(label), PANGO_ELLIPSIZE_END);
-  g_object_set(G_OBJECT(label), "tooltip-text", value, (char *)NULL);
+  if(d->shown[k] && !strcmp(d->shown[k], value)) return;
+  g_free(d->shown[k]);
+  d->shown[k] = g_strdup(value);
+  gtk_label_set_text(GTK_LABEL(d->metadata[k]), value);
+  if(k == md_internal_filmroll)
+  {
+    gchar *tooltip = g_strdup_printf(_("double click to jump to film roll\n%s"), value);
+    g_object_set(G_OBJECT(d->metadata[k]), "tooltip-text", tooltip, (char *)NULL);
+    g_free(tooltip);
+  }
+  else
+    g_object_set(G_OBJECT(d->metadata[k]), "tooltip-text", value, (char *)NULL);
 }
 
 #define NODATA_STRING "-"
 
-/* update all values to reflect mouse over image id or no data at all */
-static void _metadata_view_update_values(dt_lib_module_t *self)
+/* formats all values of image imgid, returns 1 if there is no such image */
+static int _metadata_view_format_values(const int32_t imgid, gchar *values[md_size])
 {
-  dt_lib_metadata_view_t *d = (dt_lib_metadata_view_t *)self->data;
-  int32_t mouse_over_id = -1;
-  DT_CTL_GET_GLOBAL(mouse_over_id, lib_image_mouse_over_id);
-
-  if (mouse_over_id == -1)
+  const int vl = 512;
+  char value[vl];
+  const dt_image_t *img = dt_image_cache_read_get(darktable.image_cache, imgid);
+  if(!img) return 1;
+  if(img->film_id == -1)
   {
-    const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
-    if(cv->view((dt_view_t*)cv) == DT_VIEW_DARKROOM)
-    {
-      mouse_over_id = darktable.develop->image_storage.id;
-    }
-    else
-    {
-      sqlite3_stmt *stmt;
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select imgid from selected_images limit 1", -1, &stmt, NULL);
-      if(sqlite3_step(stmt) == SQLITE_ROW)
-        mouse_over_id = sqlite3_column_int(stmt, 0);
-      sqlite3_finalize(stmt);
-    }
+    dt_image_cache_read_release(darktable.image_cache, img);
+    return 1;
   }
 
-  if(mouse_over_id >= 0)
-  {
-    const int vl = 512;
-    char value[vl];
-    const dt_image_t *img = dt_image_cache_read_get(darktable.image_cache, mouse_over_id);
-    if(!img) goto fill_minuses;
-    if(img->film_id == -1)
-    {
-      dt_image_cache_read_release(darktable.image_cache, img);
-      goto fill_minuses;
-    }
-
-    /* update all metadata */
-
-    dt_image_film_roll(img, value, vl);
-    _metadata_update_value(d->metadata[md_internal_filmroll], value);
-    const int tp = 512;
-    char tooltip[tp];
-    snprintf(tooltip, tp, _("double click to jump to film roll\n%s"), value);
-    g_object_set(G_OBJECT(d->metadata[md_internal_filmroll]), "tooltip-text", tooltip, (char *)NULL);
+  dt_image_film_roll(img, value, vl);
+  values[md_internal_filmroll] = g_strdup(value);
 
-    snprintf(value,vl,"%d", img->id);
-    _metadata_update_value(d->metadata[md_internal_imgid], value);
+  values[md_internal_imgid] = g_strdup_printf("%d", img->id);
 
-    _metadata_update_value(d->metadata[md_internal_filename], img->filename);
+  values[md_internal_filename] = g_strdup(img->filename);
 
-    dt_image_full_path(img->id, value, MAXPATHLEN);
-    _metadata_update_value(d->metadata[md_internal_fullpath], value);
+  dt_image_full_path(img->id, value, MAXPATHLEN);
+  values[md_internal_fullpath] = g_strdup(value);
 
-    /* EXIF */
-    _metadata_update_value_end(d->metadata[md_exif_model], img->exif_model);
-    _metadata_update_value_end(d->metadata[md_exif_lens], img->exif_lens);
-    _metadata_update_value_end(d->metadata[md_exif_maker], img->exif_maker);
+  /* EXIF */
+  values[md_exif_model] = g_strdup(img->exif_model);
+  values[md_exif_lens] = g_strdup(img->exif_lens);
+  values[md_exif_maker] = g_strdup(img->exif_maker);
 
-    snprintf(value, vl, "F/%.1f", img->exif_aperture);
-    _metadata_update_value(d->metadata[md_exif_aperture], value);
+  values[md_exif_aperture] = g_strdup_printf("F/%.1f", img->exif_aperture);
 
-    if(img->exif_exposure <= 0.5) snprintf(value, vl, "1/%.0f", 1.0/img->exif_exposure);
-    else                          snprintf(value, vl, "%.1f''", img->exif_exposure);
-    _metadata_update_value(d->metadata[md_exif_exposure], value);
+  if(img->exif_exposure <= 0.5) values[md_exif_exposure] = g_strdup_printf("1/%.0f", 1.0/img->exif_exposure);
+  else                          values[md_exif_exposure] = g_strdup_printf("%.1f''", img->exif_exposure);
 
-    snprintf(value, vl, "%.0f", img->exif_focal_length);
-    _metadata_update_value(d->metadata[md_exif_focal_length], value);
+  values[md_exif_focal_length] = g_strdup_printf("%.0f", img->exif_focal_length);
 
-    snprintf(value, vl, "%.2f m", img->exif_focus_distance);
-    _metadata_update_value(d->metadata[md_exif_focus_distance], value);
+  values[md_exif_focus_distance] = g_strdup_printf("%.2f m", img->exif_focus_distance);
 
-    snprintf(value, vl, "%.0f", img->exif_iso);
-    _metadata_update_value(d->metadata[md_exif_iso], value);
+  values[md_exif_iso] = g_strdup_printf("%.0f", img->exif_iso);
 
-    _metadata_update_value(d->metadata[md_exif_datetime], img->exif_datetime_taken);
+  values[md_exif_datetime] = g_strdup(img->exif_datetime_taken);
 
-    snprintf(value, vl, "%d", img->height);
-    _metadata_update_value(d->metadata[md_exif_height], value);
-    snprintf(value, vl, "%d", img->width);
-    _metadata_update_value(d->metadata[md_exif_width], value);
+  values[md_exif_height] = g_strdup_printf("%d", img->height);
+  values[md_exif_width] = g_strdup_printf("%d", img->width);
 
-    /* XMP */
+  /* XMP */
+  const char *xmp_keys[] = { "Xmp.dc.title", "Xmp.dc.creator", "Xmp.dc.rights" };
+  const int xmp_fields[] = { md_xmp_title, md_xmp_creator, md_xmp_rights };
+  for(int k=0; k<3; k++)
+  {
     GList *res;
-    if((res = dt_metadata_get(img->id, "Xmp.dc.title", NULL))!=NULL)
-    {
-      snprintf(value, vl, "%s", (char*)res->data);
-      _filter_non_printable(value, vl);
-      g_free(res->data);
-      g_list_free(res);
-    }
-    else
-      snprintf(value, vl, NODATA_STRING);
-    _metadata_update_value(d->metadata[md_xmp_title], value);
-
-    if((res = dt_metadata_get(img->id, "Xmp.dc.creator", NULL))!=NULL)
-    {
-      snprintf(value, vl, "%s", (char*)res->data);
-      _filter_non_printable(value, vl);
-      g_free(res->data);
-      g_list_free(res);
-    }
-    else
-      snprintf(value, vl, NODATA_STRING);
-    _metadata_update_value(d->metadata[md_xmp_creator], value);
-
-    if((res = dt_metadata_get(img->id, "Xmp.dc.rights", NULL))!=NULL)
+    if((res = dt_metadata_get(img->id, xmp_keys[k], NULL))!=NULL)
     {
       snprintf(value, vl, "%s", (char*)res->data);
       _filter_non_printable(value, vl);
@@ -278,70 +243,102 @@ static void _metadata_view_update_values(dt_lib_module_t *self)
     }
     else
       snprintf(value, vl, NODATA_STRING);
-    _metadata_update_value(d->metadata[md_xmp_rights], value);
+    values[xmp_fields[k]] = g_strdup(value);
+  }
 
-    /* geotagging */
-    /* latitude */
-    if(isnan(img->latitude))
-    {
-      _metadata_update_value(d->metadata[md_geotagging_lat], NODATA_STRING);
-    }
-    else
-    {
+  /* geotagging */
+#ifdef HAVE_MAP
+  const gboolean pretty_location = dt_conf_get_bool("plugins/lighttable/metadata_view/pretty_location");
+#endif
+  /* latitude */
+  if(isnan(img->latitude))
+    values[md_geotagging_lat] = g_strdup(NODATA_STRING);
 #ifdef HAVE_MAP
-      if(dt_conf_get_bool("plugins/lighttable/metadata_view/pretty_location"))
-      {
-        gchar *latitude = osd_latitude_str(img->latitude);
-        _metadata_update_value(d->metadata[md_geotagging_lat], latitude);
-        g_free(latitude);
-      }
-      else
-      {
+  else if(pretty_location)
+    values[md_geotagging_lat] = osd_latitude_str(img->latitude);
 #endif
-        gchar NS = img->latitude<0?'S':'N';
-        snprintf(value, vl, "%c %09.6f", NS, fabs(img->latitude));
-        _metadata_update_value(d->metadata[md_geotagging_lat], value);
+  else
+    values[md_geotagging_lat] = g_strdup_printf("%c %09.6f", img->latitude<0?'S':'N', fabs(img->latitude));
+  /* longitude */
+  if(isnan(img->longitude))
+    values[md_geotagging_lon] = g_strdup(NODATA_STRING);
 #ifdef HAVE_MAP
-      }
+  else if(pretty_location)
+    values[md_geotagging_lon] = osd_longitude_str(img->longitude);
 #endif
+  else
+    values[md_geotagging_lon] = g_strdup_printf("%c %010.6f", img->longitude<0?'W':'E', fabs(img->longitude));
+
+  /* release img */
+  dt_image_cache_read_release(darktable.image_cache, img);
+  return 0;
+}
+
+static void _metadata_view_cache_clear(dt_lib_metadata_view_cache_t *entry)
+{
+  for(int k=0; k<md_size; k++)
+  {
+    g_free(entry->value[k]);
+    entry->value[k] = NULL;
+  }
+  entry->imgid = -1;
+  entry->time = 0;
+}
+
+/* the formatted values of imgid, from the cache if they are recent enough. NULL if there is no such image */
+static gchar **_metadata_view_get_values(dt_lib_metadata_view_t *d, const int32_t imgid)
+{
+  const gint64 now = g_get_monotonic_time();
+  dt_lib_metadata_view_cache_t *entry = d->cache;
+  for(int k=0; k<DT_METADATA_VIEW_CACHE_ENTRIES; k++)
+  {
+    dt_lib_metadata_view_cache_t *e = d->cache + k;
+    if(e->imgid == imgid)
+    {
+      if(now - e->time < DT_METADATA_VIEW_CACHE_AGE) return e->value;
+      entry = e;
+      break;
     }
-    /* longitude */
-    if(isnan(img->longitude))
+    if(e->time < entry->time) entry = e;
+  }
+  _metadata_view_cache_clear(entry);
+  if(_metadata_view_format_values(imgid, entry->value))
+  {
+    _metadata_view_cache_clear(entry);
+    return NULL;
+  }
+  entry->imgid = imgid;
+  entry->time = now;
+  return entry->value;
+}
+
+/* update all values to reflect mouse over image id or no data at all */
+static void _metadata_view_update_values(dt_lib_module_t *self)
+{
+  dt_lib_metadata_view_t *d = (dt_lib_metadata_view_t *)self->data;
+  int32_t mouse_over_id = -1;
+  DT_CTL_GET_GLOBAL(mouse_over_id, lib_image_mouse_over_id);
+
+  if (mouse_over_id == -1)
+  {
+    const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
+    if(cv->view((dt_view_t*)cv) == DT_VIEW_DARKROOM)
     {
-      _metadata_update_value(d->metadata[md_geotagging_lon], NODATA_STRING);
+      mouse_over_id = darktable.develop->image_storage.id;
     }
     else
     {
-#ifdef HAVE_MAP
-      if(dt_conf_get_bool("plugins/lighttable/metadata_view/pretty_location"))
-      {
-        gchar *longitude = osd_longitude_str(img->longitude);
-        _metadata_update_value(d->metadata[md_geotagging_lon], longitude);
-        g_free(longitude);
-      }
-      else
-      {
-#endif
-        gchar EW = img->longitude<0?'W':'E';
-        snprintf(value, vl, "%c %010.6f", EW, fabs(img->longitude));
-        _metadata_update_value(d->metadata[md_geotagging_lon], value);
-#ifdef HAVE_MAP
-      }
-#endif
+      sqlite3_stmt *stmt;
+      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select imgid from selected_images limit 1", -1, &stmt, NULL);
+      if(sqlite3_step(stmt) == SQLITE_ROW)
+        mouse_over_id = sqlite3_column_int(stmt, 0);
+      sqlite3_finalize(stmt);
     }
-
-    /* release img */
-    dt_image_cache_read_release(darktable.image_cache, img);
-
   }
 
-  return;
-
-  /* reset */
-fill_minuses:
+  gchar **values = mouse_over_id >= 0 ? _metadata_view_get_values(d, mouse_over_id) : NULL;
   for(int k=0; k<md_size; k++)
-    _metadata_update_value(d->metadata[k],NODATA_STRING);
-
+    _metadata_update_value(d, k, values && values[k] ? values[k] : NODATA_STRING);
 }
 
 static void
@@ -390,10 +387,32 @@ _jump_to_accel(GtkAccelGroup *accel_group, GObject *acceleratable,
   return TRUE;
 }
 
-/* calback for the mouse over image change signal */
+static gboolean _mouse_over_image_timeout(gpointer user_data)
+{
+  dt_lib_module_t *self = (dt_lib_module_t *)user_data;
+  dt_lib_metadata_view_t *d = (dt_lib_metadata_view_t *)self->data;
+  d->hover_timeout = 0;
+  if(dt_control_running())
+    _metadata_view_update_values(self);
+  return FALSE;
+}
+
+/* calback for the mouse over image change signal, waits for the pointer to rest */
 static void _mouse_over_image_callback(gpointer instance,gpointer user_data)
 {
   dt_lib_module_t *self = (dt_lib_module_t *)user_data;
+  dt_lib_metadata_view_t *d = (dt_lib_metadata_view_t *)self->data;
+  if(!dt_control_running()) return;
+  if(d->hover_timeout) g_source_remove(d->hover_timeout);
+  d->hover_timeout = g_timeout_add(DT_METADATA_VIEW_HOVER_MS, _mouse_over_image_timeout, self);
+}
+
+/* calback for the develop image signals, the values of the image may have changed */
+static void _develop_image_callback(gpointer instance,gpointer user_data)
+{
+  dt_lib_module_t *self = (dt_lib_module_t *)user_data;
+  dt_lib_metadata_view_t *d = (dt_lib_metadata_view_t *)self->data;
+  for(int k=0; k<DT_METADATA_VIEW_CACHE_ENTRIES; k++) _metadata_view_cache_clear(d->cache + k);
   if(dt_control_running())
     _metadata_view_update_values(self);
 }
@@ -413,8 +432,9 @@ void connect_key_accels(dt_lib_module_t *self)
 void gui_init(dt_lib_module_t *self)
 {
   /* initialize ui widgets */
-  dt_lib_metadata_view_t *d = (dt_lib_metadata_view_t *)g_malloc(sizeof(dt_lib_metadata_view_t));
+  dt_lib_metadata_view_t *d = (dt_lib_metadata_view_t *)g_malloc0(sizeof(dt_lib_metadata_view_t));
   self->data = (void *)d;
+  for(int k=0; k<DT_METADATA_VIEW_CACHE_ENTRIES; k++) d->cache[k].imgid = -1;
   _lib_metatdata_view_init_labels();
 
   self->widget = gtk_table_new(md_size, 2, FALSE);
@@ -435,6 +455,8 @@ void gui_init(dt_lib_module_t *self)
     }
     gtk_misc_set_alignment(GTK_MISC(name), 0.0, 0.5);
     gtk_misc_set_alignment(GTK_MISC(d->metadata[k]), 0.0, 0.5);
+    gtk_label_set_ellipsize(d->metadata[k], (k == md_exif_model || k == md_exif_lens || k == md_exif_maker)
+                            ? PANGO_ELLIPSIZE_END : PANGO_ELLIPSIZE_MIDDLE);
     gtk_table_attach(GTK_TABLE(self->widget), GTK_WIDGET(name), 0, 1, k, k+1, GTK_FILL, 0, 5, 0);
     gtk_table_attach(GTK_TABLE(self->widget), evb, 1, 2, k, k+1, GTK_EXPAND|GTK_FILL, 0, 0, 0);
   }
@@ -445,12 +467,12 @@ void gui_init(dt_lib_module_t *self)
 
   /* lets signup for develop image changed signals */
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_DEVELOP_IMAGE_CHANGED,
-                            G_CALLBACK(_mouse_over_image_callback), self);
+                            G_CALLBACK(_develop_image_callback), self);
 
   /* signup for develop initialize to update info of current
      image in darkroom when enter */
   dt_control_signal_connect(darktable.signals, DT_SIGNAL_DEVELOP_INITIALIZE,
-                            G_CALLBACK(_mouse_over_image_callback), self);
+                            G_CALLBACK(_develop_image_callback), self);
 
 }
 
@@ -458,6 +480,12 @@ void gui_cleanup(dt_lib_module_t *self)
 {
   dt_control_signal_disconnect(darktable.signals,
                                G_CALLBACK(_mouse_over_image_callback), self);
+  dt_control_signal_disconnect(darktable.signals,
+                               G_CALLBACK(_develop_image_callback), self);
+  dt_lib_metadata_view_t *d = (dt_lib_metadata_view_t *)self->data;
+  if(d->hover_timeout) g_source_remove(d->hover_timeout);
+  for(int k=0; k<DT_METADATA_VIEW_CACHE_ENTRIES; k++) _metadata_view_cache_clear(d->cache + k);
+  for(int k=0; k<md_size; k++) g_free(d->shown[k]);
   g_free(self->data);
   self->data = NULL;
 }
@@ -144,8 +144,6 @@ static gboolean _lib_navigation_expose_callback(GtkWidget *widget, GdkEventExpos
 
   dt_develop_t *dev = darktable.develop;
 
-  if (dev->preview_dirty) return FALSE;
-
   /* get the current style */
   GtkStyle *style=gtk_rc_get_style_by_paths(gtk_settings_get_default(), NULL,"GtkWidget", GTK_TYPE_WIDGET);
   if(!style) style = gtk_rc_get_style(widget);
@@ -160,17 +158,14 @@ static gboolean _lib_navigation_expose_callback(GtkWidget *widget, GdkEventExpos
   height -= 2*inset;
   cairo_translate(cr, inset, inset);
 
-  /* draw navigation image if available */
-  if(dev->preview_pipe->backbuf && !dev->preview_dirty)
+  /* draw navigation image if available, from the last finished preview */
+  dt_dev_preview_snapshot_t *snapshot = dt_dev_preview_snapshot_get(dev);
+  if(snapshot && snapshot->surface && snapshot->imgid == dev->image_storage.id)
   {
-    dt_pthread_mutex_t *mutex = &dev->preview_pipe->backbuf_mutex;
-    dt_pthread_mutex_lock(mutex);
-    const int wd = dev->preview_pipe->backbuf_width;
-    const int ht = dev->preview_pipe->backbuf_height;
+    const int wd = snapshot->width;
+    const int ht = snapshot->height;
     const float scale = fminf(width/(float)wd, height/(float)ht);
 
-    const int stride = cairo_format_stride_for_width (CAIRO_FORMAT_RGB24, wd);
-    cairo_surface_t *surface = cairo_image_surface_create_for_data (dev->preview_pipe->backbuf, CAIRO_FORMAT_RGB24, wd, ht, stride);
     cairo_translate(cr, width/2.0, height/2.0f);
     cairo_scale(cr, scale, scale);
     cairo_translate(cr, -.5f*wd, -.5f*ht);
@@ -185,13 +180,15 @@ static gboolean _lib_navigation_expose_callback(GtkWidget *widget, GdkEventExpos
       cairo_fill(cr);
     }
 
+    cairo_save(cr);
     cairo_rectangle(cr, 0, 0, wd-2, ht-1);
-    cairo_set_source_surface (cr, surface, 0, 0);
+    cairo_clip(cr);
+    cairo_scale(cr, wd/(double)cairo_image_surface_get_width(snapshot->surface),
+                ht/(double)cairo_image_surface_get_height(snapshot->surface));
+    cairo_set_source_surface (cr, snapshot->surface, 0, 0);
     cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_FAST);
-    cairo_fill(cr);
-    cairo_surface_destroy (surface);
-
-    dt_pthread_mutex_unlock(mutex);
+    cairo_paint(cr);
+    cairo_restore(cr);
 
     // draw box where we are
     dt_dev_zoom_t zoom;
@@ -294,6 +291,7 @@ static gboolean _lib_navigation_expose_callback(GtkWidget *widget, GdkEventExpos
     cairo_line_to(cr, width-0.5*h, -0.1*h);
     cairo_fill(cr);
   }
+  dt_dev_preview_snapshot_release(snapshot);
 
   /* blit memsurface into widget */
   cairo_destroy(cr);
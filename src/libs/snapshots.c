@@ -38,7 +38,8 @@ typedef struct dt_lib_snapshot_t
   GtkWidget *button;
   float zoom_x, zoom_y, zoom_scale;
   int32_t zoom, closeup;
-  char filename[512];
+  /* copy of the center view, filled in by the next darkroom expose */
+  cairo_surface_t *surface;
 }
 dt_lib_snapshot_t;
 
@@ -273,14 +274,51 @@ int mouse_moved(dt_lib_module_t *self, double x, double y, int which)
   return 0;
 }
 
+/* drops the image of a snapshot slot */
+static void _lib_snapshots_free_surface(dt_lib_snapshot_t *s)
+{
+  if(s->surface) cairo_surface_destroy(s->surface);
+  s->surface = NULL;
+}
+
+static size_t _lib_snapshots_surface_size(cairo_surface_t *surface)
+{
+  if(!surface) return 0;
+  return (size_t)cairo_image_surface_get_stride(surface)*cairo_image_surface_get_height(surface);
+}
+
+/* drops the oldest snapshots until the ones kept, plus one more of size new_size, fit the configured memory */
+static void _lib_snapshots_enforce_budget(dt_lib_snapshots_t *d, size_t new_size)
+{
+  const size_t budget = (size_t)MAX(1, dt_conf_get_int("plugins/darkroom/snapshots/memory")) << 20;
+  size_t used = new_size;
+  for(uint32_t k=0; k<d->num_snapshots; k++)
+    used += _lib_snapshots_surface_size(d->snapshot[k].surface);
+
+  while(d->num_snapshots > 0 && used > budget)
+  {
+    dt_lib_snapshot_t *s = d->snapshot + d->num_snapshots - 1;
+    used -= _lib_snapshots_surface_size(s->surface);
+    /* deactivating it also releases the image shown in the center view */
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(s->button), FALSE);
+    gtk_widget_hide(s->button);
+    _lib_snapshots_free_surface(s);
+    d->num_snapshots--;
+  }
+}
+
 void gui_reset(dt_lib_module_t *self)
 {
   dt_lib_snapshots_t *d=(dt_lib_snapshots_t *)self->data;
   d->num_snapshots = 0;
+  if(d->snapshot_image) cairo_surface_destroy(d->snapshot_image);
   d->snapshot_image = NULL;
 
   for(uint32_t k=0; k<d->size; k++)
+  {
     gtk_widget_hide(d->snapshot[k].button);
+    _lib_snapshots_free_surface(d->snapshot + k);
+  }
 
   dt_control_queue_redraw_center();
 }
@@ -316,8 +354,6 @@ void gui_init(dt_lib_module_t *self)
    * initialize snapshots
    */
   char wdname[32]= {0};
-  char localtmpdir[4096]= {0};
-  dt_loc_get_tmp_dir (localtmpdir,4096);
 
   for (long k=0; k<d->size; k++)
   {
@@ -330,9 +366,6 @@ void gui_init(dt_lib_module_t *self)
     /* assign snapshot number to widget */
     g_object_set_data(G_OBJECT(d->snapshot[k].button),"snapshot",(gpointer)(k+1));
 
-    /* setup filename for snapshot */
-    snprintf(d->snapshot[k].filename, 512, "%s/dt_snapshot_%ld.png",localtmpdir,k);
-
     /* add button to snapshot box */
     gtk_box_pack_start(GTK_BOX(d->snapshots_box),d->snapshot[k].button,TRUE,TRUE,0);
 
@@ -350,6 +383,16 @@ void gui_cleanup(dt_lib_module_t *self)
 {
   dt_lib_snapshots_t *d = (dt_lib_snapshots_t *)self->data;
 
+  /* a pending request must not write into freed memory */
+  if(darktable.develop->proxy.snapshot.request)
+  {
+    darktable.develop->proxy.snapshot.request = FALSE;
+    darktable.develop->proxy.snapshot.surface = NULL;
+  }
+
+  if(d->snapshot_image) cairo_surface_destroy(d->snapshot_image);
+  for(uint32_t k=0; k<d->size; k++)
+    _lib_snapshots_free_surface(d->snapshot + k);
   g_free(d->snapshot);
 
   g_free(self->data);
@@ -361,8 +404,14 @@ static void _lib_snapshots_add_button_clicked_callback(GtkWidget *widget, gpoint
   dt_lib_module_t *self = (dt_lib_module_t*)user_data;
   dt_lib_snapshots_t *d = (dt_lib_snapshots_t *)self->data;
 
-  /* backup last snapshot slot */
+  /* make room for the new snapshot, which is about the size of the center view */
+  const size_t new_size = (size_t)cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, darktable.develop->width)
+                          * darktable.develop->height;
+  _lib_snapshots_enforce_budget(d, new_size);
+
+  /* backup last snapshot slot, its image is replaced */
   dt_lib_snapshot_t last = d->snapshot[d->size-1];
+  _lib_snapshots_free_surface(&last);
 
   /* rotate slots down to make room for new one on top */
   for (int k = d->size-1; k > 0; k--)
@@ -408,7 +457,7 @@ static void _lib_snapshots_add_button_clicked_callback(GtkWidget *widget, gpoint
     gtk_widget_show(d->snapshot[k].button);
 
   /* request a new snapshot for top slot */
-  dt_dev_snapshot_request(darktable.develop, (const char *)&d->snapshot[0].filename);
+  dt_dev_snapshot_request(darktable.develop, &d->snapshot[0].surface);
 
 }
 
@@ -445,7 +494,7 @@ static void _lib_snapshots_toggled_callback(GtkToggleButton *widget, gpointer us
 
     dt_dev_invalidate(darktable.develop);
 
-    d->snapshot_image = cairo_image_surface_create_from_png(s->filename);
+    if(s->surface) d->snapshot_image = cairo_surface_reference(s->surface);
 
   }
 
@@ -94,6 +94,58 @@ void connect_key_accels(dt_lib_module_t *self)
   dt_accel_connect_lib(self, "tag", g_cclosure_new(G_CALLBACK(_lib_tagging_tag_show), self, NULL));
 }
 
+/* make the rows of the store match the tags, in order. this runs for every typed letter and every image
+ * under the mouse, and mostly only a few rows change, so leave the others alone instead of filling it anew. */
+static void
+_update_list (GtkListStore *store, GList *tags)
+{
+  GtkTreeModel *model = GTK_TREE_MODEL(store);
+  GHashTable *wanted = g_hash_table_new(NULL, NULL);
+  for(GList *t = tags; t; t = g_list_next(t))
+    g_hash_table_insert(wanted, GUINT_TO_POINTER(((dt_tag_t *)t->data)->id), t);
+
+  // drop the rows of tags which are gone:
+  GtkTreeIter iter;
+  gboolean valid = gtk_tree_model_get_iter_first(model, &iter);
+  while(valid)
+  {
+    guint id;
+    gtk_tree_model_get(model, &iter, DT_LIB_TAGGING_COL_ID, &id, -1);
+    if(g_hash_table_lookup(wanted, GUINT_TO_POINTER(id))) valid = gtk_tree_model_iter_next(model, &iter);
+    else valid = gtk_list_store_remove(store, &iter);
+  }
+  g_hash_table_destroy(wanted);
+
+  // walk both in order, inserting new tags and moving the ones found further down:
+  valid = gtk_tree_model_get_iter_first(model, &iter);
+  for(GList *t = tags; t; t = g_list_next(t))
+  {
+    const dt_tag_t *tag = (const dt_tag_t *)t->data;
+    guint id = 0;
+    if(valid) gtk_tree_model_get(model, &iter, DT_LIB_TAGGING_COL_ID, &id, -1);
+    if(valid && id == tag->id)
+    {
+      valid = gtk_tree_model_iter_next(model, &iter);
+      continue;
+    }
+    GtkTreeIter row, later = iter;
+    for(gboolean more = valid && gtk_tree_model_iter_next(model, &later); more; more = gtk_tree_model_iter_next(model, &later))
+    {
+      gtk_tree_model_get(model, &later, DT_LIB_TAGGING_COL_ID, &id, -1);
+      if(id == tag->id)
+      {
+        gtk_list_store_remove(store, &later);
+        break;
+      }
+    }
+    gtk_list_store_insert_before(store, &row, valid ? &iter : NULL);
+    gtk_list_store_set(store, &row,
+                       DT_LIB_TAGGING_COL_TAG, tag->tag,
+                       DT_LIB_TAGGING_COL_ID, tag->id,
+                       -1);
+  }
+}
+
 static void
 update (dt_lib_module_t *self, int which)
 {
@@ -111,35 +163,13 @@ update (dt_lib_module_t *self, int which)
   else // related tags of typed text
     count = dt_tag_get_suggestions(d->keyword,&tags);
 
-  GtkTreeIter iter;
   GtkTreeView *view;
   if(which == 0) view = d->current;
   else           view = d->related;
-  GtkTreeModel *model = gtk_tree_view_get_model(GTK_TREE_VIEW(view));
-  g_object_ref(model);
-  gtk_tree_view_set_model(GTK_TREE_VIEW(view), NULL);
-  gtk_list_store_clear(GTK_LIST_STORE(model));
-
-  if( count >0 && tags )
-  {
-    do
-    {
-      gtk_list_store_append(GTK_LIST_STORE(model), &iter);
-      gtk_list_store_set (GTK_LIST_STORE(model), &iter,
-                          DT_LIB_TAGGING_COL_TAG, ((dt_tag_t*)tags->data)->tag,
-                          DT_LIB_TAGGING_COL_ID, ((dt_tag_t*)tags->data)->id,
-                          -1);
-    }
-    while( (tags=g_list_next(tags)) !=NULL );
-
-    // Free result...
-    dt_tag_free_result(&tags);
-  }
-
-
+  GtkListStore *store = GTK_LIST_STORE(gtk_tree_view_get_model(GTK_TREE_VIEW(view)));
 
-  gtk_tree_view_set_model(GTK_TREE_VIEW(view), model);
-  g_object_unref(model);
+  _update_list(store, count > 0 ? tags : NULL);
+  dt_tag_free_result(&tags);
 }
 
 static void
@@ -68,6 +68,18 @@ typedef struct dt_lib_filmstrip_t
   int32_t select_id;
 
   dt_gui_hist_dialog_t dg;
+
+  /* the strip as drawn without the mouse over any image, it is composited on expose
+     and only drawn again when what it shows changed. */
+  struct
+  {
+    cairo_surface_t *surface;
+    int32_t width, height, offset;
+    int32_t *ids, num_ids;
+    uint64_t state; // see dt_view_collection_state()
+    uint32_t mipmap_generation, surface_generation;
+    int complete;   // no stand-in thumbnails in there
+  } cache;
 }
 dt_lib_filmstrip_t;
 
@@ -444,6 +456,9 @@ void gui_cleanup(dt_lib_module_t *self)
   darktable.view_manager->proxy.filmstrip.module = NULL;
 
   /* cleanup */
+  dt_lib_filmstrip_t *strip = (dt_lib_filmstrip_t *)self->data;
+  if(strip->cache.surface) cairo_surface_destroy(strip->cache.surface);
+  free(strip->cache.ids);
   g_free(self->data);
   self->data = NULL;
 }
@@ -687,6 +702,77 @@ static gboolean _lib_filmstrip_button_release_callback(GtkWidget *w, GdkEventBut
   return result;
 }
 
+/* draws the images of the strip into its cache, none of them with the mouse over it. */
+static void _lib_filmstrip_render(dt_lib_filmstrip_t *strip, const int32_t width, const int32_t height,
+                                  const int32_t offset, const int max_cols)
+{
+  const float wd = height;
+  const float ht = height;
+  const int col_start = max_cols/2 - offset;
+  const int empty_edge = (width - (max_cols * wd))/2;
+  int step_res = SQLITE_ROW;
+
+  if(!strip->cache.surface || strip->cache.width != width || strip->cache.height != height)
+  {
+    if(strip->cache.surface) cairo_surface_destroy(strip->cache.surface);
+    strip->cache.surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+    strip->cache.width = width;
+    strip->cache.height = height;
+  }
+  strip->cache.offset = offset;
+  strip->cache.mipmap_generation = darktable.mipmap_cache->generation;
+  strip->cache.surface_generation = dt_view_image_surface_generation();
+  strip->cache.complete = 1;
+
+  cairo_t *cr = cairo_create(strip->cache.surface);
+
+  /* fill background */
+  cairo_set_source_rgb (cr, .2, .2, .2);
+  cairo_paint(cr);
+
+  sqlite3_stmt *stmt = NULL;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), COLLECTION_IDS_QUERY, -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, offset - max_cols/2);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_cols);
+
+  // collect the ids first, so the image structs can come from the db in one query:
+  free(strip->cache.ids);
+  int32_t *ids = strip->cache.ids = (int32_t *)calloc(max_cols, sizeof(int32_t));
+  int num_ids = 0;
+  while(ids && num_ids < max_cols - MAX(col_start, 0) && (step_res = sqlite3_step(stmt)) == SQLITE_ROW)
+    ids[num_ids++] = sqlite3_column_int(stmt, 0);
+  strip->cache.num_ids = num_ids;
+  if(ids) dt_image_cache_prefetch(darktable.image_cache, ids, num_ids);
+
+  dt_view_image_over_t image_over = DT_VIEW_DESERT;
+  cairo_translate(cr, empty_edge, 0.0f);
+  for(int col = 0; col < max_cols; col++)
+  {
+    if(col < col_start)
+    {
+      cairo_translate(cr, wd, 0.0f);
+      continue;
+    }
+
+    const int k = col - MAX(col_start, 0);
+    if(k < num_ids)
+    {
+      cairo_save(cr);
+      if(dt_view_image_expose(&image_over, ids[k], cr, wd, ht, max_cols, -1, -1, FALSE))
+        strip->cache.complete = 0;
+      cairo_restore(cr);
+    }
+    else if (step_res == SQLITE_DONE || step_res == SQLITE_ROW)
+    {
+      /* do nothing, just add some empty thumb frames */
+    }
+    else break;
+    cairo_translate(cr, wd, 0.0f);
+  }
+  sqlite3_finalize(stmt);
+  cairo_destroy(cr);
+}
+
 static gboolean _lib_filmstrip_expose_callback(GtkWidget *widget, GdkEventExpose *event, gpointer user_data)
 {
   dt_lib_module_t *self = (dt_lib_module_t *)user_data;
@@ -704,13 +790,6 @@ static gboolean _lib_filmstrip_expose_callback(GtkWidget *widget, GdkEventExpose
   strip->image_over = DT_VIEW_DESERT;
   DT_CTL_SET_GLOBAL(lib_image_mouse_over_id, -1);
 
-  /* create cairo surface */
-  cairo_t *cr = gdk_cairo_create(widget->window);
-
-  /* fill background */
-  cairo_set_source_rgb (cr, .2, .2, .2);
-  cairo_paint(cr);
-
   int offset = strip->offset;
 
   const float wd = height;
@@ -722,9 +801,6 @@ static gboolean _lib_filmstrip_expose_callback(GtkWidget *widget, GdkEventExpose
 
   const int col_start = max_cols/2 - strip->offset;
   const int empty_edge = (width - (max_cols * wd))/2;
-  int step_res = SQLITE_ROW;
-
-  sqlite3_stmt *stmt = NULL;
 
   /* mouse over image position in filmstrip */
   pointerx -= empty_edge;
@@ -748,52 +824,34 @@ static gboolean _lib_filmstrip_expose_callback(GtkWidget *widget, GdkEventExpose
 
   // dt_view_set_scrollbar(self, offset, count, max_cols, 0, 1, 1);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, offset - max_cols/2);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_cols);
-
-
-  cairo_save(cr);
-  cairo_translate(cr, empty_edge, 0.0f);
-  for(int col = 0; col < max_cols; col++)
+  // the materialized ids cost the same at any offset. one query tells if the cached strip is still good,
+  // the darkroom redraws a lot while the user edits:
+  dt_collection_update_ids(darktable.collection);
+  const uint64_t state = dt_view_collection_state(offset - max_cols/2, max_cols);
+  if(!strip->cache.surface || strip->cache.width != width || strip->cache.height != height ||
+      strip->cache.offset != offset || strip->cache.state != state ||
+      strip->cache.mipmap_generation != darktable.mipmap_cache->generation ||
+      (!strip->cache.complete && strip->cache.surface_generation != dt_view_image_surface_generation()))
   {
-    if(col < col_start)
-    {
-      cairo_translate(cr, wd, 0.0f);
-      continue;
-    }
+    _lib_filmstrip_render(strip, width, height, offset, max_cols);
+    strip->cache.state = state;
+  }
 
-    if(step_res != SQLITE_DONE)
-    {
-      step_res = sqlite3_step(stmt);
-    }
+  cairo_t *cr = gdk_cairo_create(widget->window);
+  cairo_set_source_surface(cr, strip->cache.surface, 0, 0);
+  cairo_paint(cr);
 
-    if(step_res == SQLITE_ROW)
-    {
-      int id = sqlite3_column_int(stmt, 0);
-      // set mouse over id
-      if(seli == col)
-      {
-        strip->mouse_over_id = id;
-        DT_CTL_SET_GLOBAL(lib_image_mouse_over_id, strip->mouse_over_id);
-      }
-      cairo_save(cr);
-      // FIXME find out where the y translation is done, how big the value is and use it directly instead of getting it from the matrix ...
-      cairo_matrix_t m;
-      cairo_get_matrix(cr, &m);
-      dt_view_image_expose(&(strip->image_over), id, cr, wd, ht, max_cols, img_pointerx, img_pointery, FALSE);
-      cairo_restore(cr);
-    }
-    else if (step_res == SQLITE_DONE)
-    {
-      /* do nothing, just add some empty thumb frames */
-    }
-    else goto failure;
-    cairo_translate(cr, wd, 0.0f);
+  // the image under the mouse is drawn on top:
+  const int k = seli - MAX(col_start, 0);
+  if(seli >= 0 && seli < max_cols && seli >= col_start && k < strip->cache.num_ids)
+  {
+    strip->mouse_over_id = strip->cache.ids[k];
+    DT_CTL_SET_GLOBAL(lib_image_mouse_over_id, strip->mouse_over_id);
+    cairo_save(cr);
+    cairo_translate(cr, empty_edge + seli * wd, 0.0f);
+    dt_view_image_expose(&(strip->image_over), strip->mouse_over_id, cr, wd, ht, max_cols, img_pointerx, img_pointery, FALSE);
+    cairo_restore(cr);
   }
-failure:
-  cairo_restore(cr);
-  sqlite3_finalize(stmt);
 
   if(darktable.gui->center_tooltip == 1) // set in this round
   {
@@ -1161,7 +1219,7 @@ _lib_filmstrip_dnd_begin_callback(GtkWidget *widget, GdkDragContext *context, gp
 
     if(buf.buf)
     {
-      uint8_t *scratchmem = dt_mipmap_cache_alloc_scratchmem(darktable.mipmap_cache);
+      uint8_t *scratchmem = dt_mipmap_cache_get_scratchmem(darktable.mipmap_cache);
       uint8_t *buf_decompressed = dt_mipmap_cache_decompress(&buf, scratchmem);
 
       uint8_t *rgbbuf = g_malloc((buf.width+2)*(buf.height+2)*3);
@@ -22,6 +22,7 @@
 #include "lua/call.h"
 #include "lua/events.h"
 #include "lua/image.h"
+#include "lua/perf.h"
 #include "gui/accelerators.h"
 #include "common/imageio_module.h"
 typedef struct event_handler{
@@ -306,6 +307,8 @@ static event_handler event_list[] = {
   //{"pre-export",register_chained_event,trigger_chained_event},
   {"shortcut",register_shortcut_event,trigger_keyed_event}, 
   {"post-import-image",register_multiinstance_event,trigger_multiinstance_event},
+  {"export-progress",register_multiinstance_event,trigger_multiinstance_event},
+  {"perf-update",register_multiinstance_event,trigger_multiinstance_event},
   //{"tmp-export-image",register_multiinstance_event,trigger_multiinstance_event},
   //{"test",register_singleton_event,trigger_singleton_event},  // avoid error because of unused function
   {NULL,NULL,NULL}
@@ -428,6 +431,42 @@ static void on_export_image_tmpfile(gpointer instance,
   dt_lua_trigger_event("tmp-export-image",2,0);
 }
 #endif
+void dt_lua_event_export_progress(const int handle,const int imgid,const int num,const int total) {
+#pragma omp critical(running_lua)
+  {
+    lua_State *L = darktable.lua_state;
+    const int top = lua_gettop(L);
+    lua_pushinteger(L,handle);
+    if(imgid > 0)
+      luaA_push(L,dt_lua_image_t,&imgid);
+    else
+      lua_pushnil(L);
+    lua_pushinteger(L,num);
+    lua_pushinteger(L,total);
+    dt_lua_trigger_event_internal("export-progress",4,0);
+    lua_settop(L,top);
+  }
+}
+
+static gboolean on_perf_timeout(gpointer user_data) {
+#pragma omp critical(running_lua)
+  {
+    lua_State *L = darktable.lua_state;
+    const int top = lua_gettop(L);
+    // collecting all numbers isn't free, only do it if someone listens:
+    lua_getfield(L,LUA_REGISTRYINDEX,"dt_lua_event_data");
+    lua_getfield(L,-1,"perf-update");
+    const int registered = !lua_isnil(L,-1);
+    lua_settop(L,top);
+    if(registered) {
+      dt_lua_perf_push(L);
+      dt_lua_trigger_event_internal("perf-update",1,0);
+    }
+    lua_settop(L,top);
+  }
+  return TRUE;
+}
+
 static void on_image_imported(gpointer instance,uint8_t id, gpointer user_data){
   luaA_push(darktable.lua_state,dt_lua_image_t,&id);
   dt_lua_trigger_event("post-import-image",1,0);
@@ -450,6 +489,10 @@ int dt_lua_init_events(lua_State *L) {
   lua_settable(L,-3);
   lua_pop(L,1);
   dt_control_signal_connect(darktable.signals,DT_SIGNAL_IMAGE_IMPORT,G_CALLBACK(on_image_imported),NULL);
+  // periodic numbers for dashboards, from the gui main loop:
+  const int perf_interval = dt_conf_get_int("lua/perf_interval");
+  if(darktable.gui && perf_interval > 0)
+    g_timeout_add_seconds(perf_interval,on_perf_timeout,NULL);
   //dt_control_signal_connect(darktable.signals,DT_SIGNAL_IMAGE_EXPORT_MULTIPLE,G_CALLBACK(on_export_selection),NULL);
   //dt_control_signal_connect(darktable.signals,DT_SIGNAL_IMAGE_EXPORT_TMPFILE,G_CALLBACK(on_export_image_tmpfile),NULL);
   return 0;
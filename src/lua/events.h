@@ -26,6 +26,12 @@
   initialize events, called at DT start
   */
 int dt_lua_init_events(lua_State *L);
+
+/**
+  trigger "export-progress" for the batch export `handle', safe to call from the export threads.
+  imgid is -1 once the job is done, num is the number of images processed so far.
+  */
+void dt_lua_event_export_progress(const int handle,const int imgid,const int num,const int total);
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
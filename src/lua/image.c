@@ -436,22 +436,27 @@ int make_group_leader(lua_State *L) {
 }
 
 
+static gint _compare_ids(gconstpointer a, gconstpointer b)
+{
+  return GPOINTER_TO_INT(a) - GPOINTER_TO_INT(b);
+}
+
 int get_group(lua_State *L) {
   dt_lua_image_t first_image;
   luaA_to(L,dt_lua_image_t,&first_image,1);
   const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, first_image);
   int group_id = cimg->group_id;
   dt_image_cache_read_release(darktable.image_cache, cimg);
-  sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select id from images where group_id = ?1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, group_id);
+  // in id order, like the members come out of the db:
+  GList *members = g_list_sort(dt_grouping_get_members(group_id), _compare_ids);
   lua_newtable(L);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  for(GList *l = members; l; l = g_list_next(l))
   {
-    int imgid = sqlite3_column_int(stmt, 0);
+    int imgid = GPOINTER_TO_INT(l->data);
     luaA_push(L,dt_lua_image_t,&imgid);
     luaL_ref(L,-2);
   }
+  g_list_free(members);
   luaA_push(L,dt_lua_image_t,&group_id);
   lua_setfield(L,-2,"leader");
   return 1;
@@ -30,6 +30,10 @@
 #include "lua/modules.h"
 #include "lua/storage.h"
 #include "lua/events.h"
+#include "lua/opencl.h"
+#include "lua/jobs.h"
+#include "lua/perf.h"
+#include "lua/pixels.h"
 #include "lua/styles.h"
 #include "common/darktable.h"
 #include "common/file_location.h"
@@ -62,6 +66,10 @@ static lua_CFunction init_funcs[] =
   dt_lua_init_storages,
   dt_lua_init_tags,
   dt_lua_init_events,
+  dt_lua_init_opencl,
+  dt_lua_init_jobs,
+  dt_lua_init_pixels,
+  dt_lua_init_perf,
   NULL
 };
 
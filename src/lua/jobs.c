@@ -0,0 +1,174 @@
+/*
+   This file is part of darktable,
+   copyright (c) 2014 darktable developers.
+
+   darktable is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   darktable is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+#include "lua/lua.h"
+#include "lua/jobs.h"
+#include "lua/events.h"
+#include "lua/image.h"
+#include "common/darktable.h"
+#include "common/imageio.h"
+#include "common/imageio_module.h"
+#include "control/conf.h"
+#include "control/control.h"
+#include "control/jobs/control_jobs.h"
+
+static void job_statistics_push(const char *name, const int queued, const dt_control_job_stats_t *stats,
+                                const double wait_p50, const double wait_p95,
+                                const double run_p50, const double run_p95, void *data)
+{
+  lua_State *L = (lua_State *)data;
+  lua_newtable(L);
+  lua_pushinteger(L,queued);
+  lua_setfield(L,-2,"queued");
+  lua_pushinteger(L,stats->count);
+  lua_setfield(L,-2,"count");
+  lua_pushinteger(L,stats->coalesced);
+  lua_setfield(L,-2,"coalesced");
+  lua_pushinteger(L,stats->blocked);
+  lua_setfield(L,-2,"blocked");
+  lua_pushnumber(L,stats->wait);
+  lua_setfield(L,-2,"wait");
+  lua_pushnumber(L,stats->run);
+  lua_setfield(L,-2,"run");
+  lua_pushnumber(L,wait_p50);
+  lua_setfield(L,-2,"wait_p50");
+  lua_pushnumber(L,wait_p95);
+  lua_setfield(L,-2,"wait_p95");
+  lua_pushnumber(L,run_p50);
+  lua_setfield(L,-2,"run_p50");
+  lua_pushnumber(L,run_p95);
+  lua_setfield(L,-2,"run_p95");
+  lua_setfield(L,-2,name);
+}
+
+/** returns a table with one entry per job class: queue depth, counters and wait and run time
+  * totals and quantiles, times in seconds. */
+static int lua_job_statistics(lua_State *L)
+{
+  lua_newtable(L);
+  dt_control_job_statistics(darktable.control,job_statistics_push,L);
+  return 1;
+}
+
+static void export_progress(const int imgid, const int num, const int total, void *data)
+{
+  dt_lua_event_export_progress(GPOINTER_TO_INT(data),imgid,num,total);
+}
+
+/** fetches the module behind the format or storage params at index, checking it is a `type'. */
+static void *module_params_check(lua_State *L, int index, const char *type, luaA_Type *lua_type)
+{
+  if(!luaL_getmetafield(L,index,"__module_type") || strcmp(lua_tostring(L,-1),type))
+    luaL_argerror(L,index,type);
+  lua_pop(L,1);
+  luaL_getmetafield(L,index,"__luaA_Type");
+  *lua_type = luaL_checkint(L,-1);
+  lua_pop(L,1);
+  luaL_getmetafield(L,index,"__associated_object");
+  void *module = lua_touserdata(L,-1);
+  lua_pop(L,1);
+  return module;
+}
+
+/** export_images(images, format, storage [, options]): queues one export job for the table of
+  * images, run on parallel_export threads like the export module. options may hold max_width,
+  * max_height, high_quality and style. returns a handle, passed to the "export-progress" event
+  * after every image, and with image nil and the number of images which made it once the job is done. */
+static int lua_export_images(lua_State *L)
+{
+  static int handles = 0;
+  luaL_checktype(L,1,LUA_TTABLE);
+  luaA_Type format_type, storage_type;
+  dt_imageio_module_format_t *format = module_params_check(L,2,"format",&format_type);
+  dt_imageio_module_storage_t *storage = module_params_check(L,3,"storage",&storage_type);
+  if(!lua_isnoneornil(L,4)) luaL_checktype(L,4,LUA_TTABLE);
+  if(!storage->supported(storage,format))
+    return luaL_error(L,"storage %s doesn't support format %s",storage->plugin_name,format->plugin_name);
+
+  int max_width = dt_conf_get_int("plugins/lighttable/export/width");
+  int max_height = dt_conf_get_int("plugins/lighttable/export/height");
+  gboolean high_quality = dt_conf_get_bool("plugins/lighttable/export/high_quality_processing");
+  const char *style = "";
+  if(!lua_isnoneornil(L,4))
+  {
+    lua_getfield(L,4,"max_width");
+    if(!lua_isnil(L,-1)) max_width = MAX(luaL_checkint(L,-1),0);
+    lua_getfield(L,4,"max_height");
+    if(!lua_isnil(L,-1)) max_height = MAX(luaL_checkint(L,-1),0);
+    lua_getfield(L,4,"high_quality");
+    if(!lua_isnil(L,-1)) high_quality = lua_toboolean(L,-1);
+    lua_getfield(L,4,"style");
+    if(!lua_isnil(L,-1)) style = luaL_checkstring(L,-1);
+  }
+  GList *images = NULL;
+  lua_pushnil(L);
+  while(lua_next(L,1))
+  {
+    dt_lua_image_t imgid;
+    luaA_to(L,dt_lua_image_t,&imgid,-1);
+    images = g_list_prepend(images,GINT_TO_POINTER(imgid));
+    lua_pop(L,1);
+  }
+  images = g_list_reverse(images);
+
+  dt_control_export_t *settings = (dt_control_export_t*)calloc(1,sizeof(dt_control_export_t));
+  settings->format_index = dt_imageio_get_index_of_format(format);
+  settings->storage_index = dt_imageio_get_index_of_storage(storage);
+  settings->max_width = max_width;
+  settings->max_height = max_height;
+  settings->high_quality = high_quality;
+  g_strlcpy(settings->style,style,sizeof(settings->style));
+
+  // the params of the lua objects, the job owns them from now on:
+  settings->fdata = format->get_params(format);
+  luaA_to_typeid(L,format_type,settings->fdata,2);
+  settings->sdata = storage->get_params(storage);
+  if(!settings->sdata)
+  {
+    format->free_params(format,settings->fdata);
+    free(settings);
+    g_list_free(images);
+    return luaL_error(L,"failed to get parameters from storage %s",storage->plugin_name);
+  }
+  luaA_to_typeid(L,storage_type,settings->sdata,3);
+
+  const int handle = ++handles;
+  settings->progress = export_progress;
+  settings->progress_data = GINT_TO_POINTER(handle);
+  dt_control_export_settings(images,settings);
+  lua_pushinteger(L,handle);
+  return 1;
+}
+
+int dt_lua_init_jobs(lua_State*L)
+{
+  dt_lua_push_darktable_lib(L);
+
+  lua_pushstring(L,"export_images");
+  lua_pushcfunction(L,&lua_export_images);
+  lua_settable(L,-3);
+
+  lua_pushstring(L,"job_statistics");
+  lua_pushcfunction(L,&lua_job_statistics);
+  lua_settable(L,-3);
+
+  lua_pop(L,1);
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,76 @@
+/*
+   This file is part of darktable,
+   copyright (c) 2014 darktable developers.
+
+   darktable is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   darktable is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "lua/lua.h"
+#include "lua/opencl.h"
+#include "common/darktable.h"
+#include "common/opencl.h"
+
+static void kernel_statistics_push(const char *tag, const int count, const double total, const double p50,
+                                   const double p95, const uint64_t bytes, void *data)
+{
+  lua_State *L = (lua_State *)data;
+  lua_newtable(L);
+  lua_pushinteger(L,count);
+  lua_setfield(L,-2,"count");
+  lua_pushnumber(L,total);
+  lua_setfield(L,-2,"total");
+  lua_pushnumber(L,p50);
+  lua_setfield(L,-2,"p50");
+  lua_pushnumber(L,p95);
+  lua_setfield(L,-2,"p95");
+  lua_pushnumber(L,bytes);
+  lua_setfield(L,-2,"bytes");
+  lua_setfield(L,-2,tag);
+}
+
+/** returns a table with one entry per opencl device: its name and a table of kernel statistics,
+  * times in seconds. empty without opencl or if opencl_kernel_statistics is off. */
+static int lua_opencl_statistics(lua_State *L)
+{
+  lua_newtable(L);
+#ifdef HAVE_OPENCL
+  if(!dt_opencl_is_inited()) return 1;
+  for(int dev=0; dev<darktable.opencl->num_devs; dev++)
+  {
+    lua_newtable(L);
+    lua_pushstring(L,darktable.opencl->dev[dev].name);
+    lua_setfield(L,-2,"name");
+    lua_newtable(L);
+    dt_opencl_kernel_statistics(dev,kernel_statistics_push,L);
+    lua_setfield(L,-2,"kernels");
+    lua_rawseti(L,-2,dev+1);
+  }
+#endif
+  return 1;
+}
+
+int dt_lua_init_opencl(lua_State*L)
+{
+  dt_lua_push_darktable_lib(L);
+
+  lua_pushstring(L,"opencl_statistics");
+  lua_pushcfunction(L,&lua_opencl_statistics);
+  lua_settable(L,-3);
+
+  lua_pop(L,1);
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
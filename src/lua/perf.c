@@ -0,0 +1,223 @@
+/*
+   This file is part of darktable,
+   copyright (c) 2014 darktable developers.
+
+   darktable is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   darktable is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "lua/perf.h"
+#include "common/darktable.h"
+#include "common/cache.h"
+#include "common/image_cache.h"
+#include "common/memory_stats.h"
+#include "common/mipmap_cache.h"
+#include "develop/develop.h"
+#include "develop/imageop.h"
+#include "develop/pixelpipe.h"
+
+typedef enum
+{
+  PERF_MIPMAP_CACHE,
+  PERF_IMAGE_CACHE,
+  PERF_PIXELPIPE,
+  PERF_OPENCL,
+  PERF_JOBS,
+  PERF_MEMORY,
+  LAST_PERF_FIELD
+} perf_fields;
+static const char *perf_fields_name[] =
+{
+  "mipmap_cache",
+  "image_cache",
+  "pixelpipe",
+  "opencl",
+  "jobs",
+  "memory",
+  NULL
+};
+
+static const char *mip_names[DT_MIPMAP_NONE] = { "mip0", "mip1", "mip2", "mip3", "mipf", "full" };
+
+static void push_hit_ratio(lua_State *L, const uint64_t requests, const uint64_t misses)
+{
+  lua_pushnumber(L,requests ? 1.0 - misses/(double)requests : 1.0);
+  lua_setfield(L,-2,"hit_ratio");
+}
+
+// fills the table on top of the stack with the numbers of the cache:
+static void set_cache_fields(lua_State *L, const dt_cache_t *cache)
+{
+  lua_pushinteger(L,dt_cache_size(cache));
+  lua_setfield(L,-2,"entries");
+  lua_pushinteger(L,cache->cost);
+  lua_setfield(L,-2,"cost");
+  lua_pushinteger(L,cache->cost_quota);
+  lua_setfield(L,-2,"cost_quota");
+  lua_pushinteger(L,cache->lru_lock_acquired);
+  lua_setfield(L,-2,"lru_lock_acquired");
+  lua_pushinteger(L,cache->lru_lock_contended);
+  lua_setfield(L,-2,"lru_lock_contended");
+}
+
+static void push_mipmap_cache(lua_State *L)
+{
+  lua_newtable(L);
+  for(int k=0; k<DT_MIPMAP_NONE; k++)
+  {
+    const dt_mipmap_cache_one_t *mip = darktable.mipmap_cache->mip + k;
+    lua_newtable(L);
+    set_cache_fields(L,&mip->cache);
+    lua_pushnumber(L,mip->stats_requests);
+    lua_setfield(L,-2,"requests");
+    lua_pushnumber(L,mip->stats_near_match);
+    lua_setfield(L,-2,"near_match");
+    lua_pushnumber(L,mip->stats_misses);
+    lua_setfield(L,-2,"misses");
+    lua_pushnumber(L,mip->stats_fetches);
+    lua_setfield(L,-2,"fetches");
+    lua_pushnumber(L,mip->stats_standin);
+    lua_setfield(L,-2,"standin");
+    push_hit_ratio(L,mip->stats_requests,mip->stats_misses);
+    lua_setfield(L,-2,mip_names[k]);
+  }
+}
+
+static void push_image_cache(lua_State *L)
+{
+  lua_newtable(L);
+  set_cache_fields(L,&darktable.image_cache->cache);
+}
+
+static void push_pipe(lua_State *L, dt_dev_pixelpipe_t *pipe)
+{
+  lua_newtable(L);
+  lua_pushnumber(L,pipe->cache.queries);
+  lua_setfield(L,-2,"queries");
+  lua_pushnumber(L,pipe->cache.misses);
+  lua_setfield(L,-2,"misses");
+  push_hit_ratio(L,pipe->cache.queries,pipe->cache.misses);
+  // seconds per module in the last run, skipped while the pipe is running and changes its nodes:
+  if(dt_pthread_mutex_trylock(&pipe->busy_mutex)) return;
+  lua_newtable(L);
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    const dt_dev_pixelpipe_iop_t *piece = (const dt_dev_pixelpipe_iop_t *)nodes->data;
+    if(!piece->enabled) continue;
+    if(piece->module->multi_name[0])
+      lua_pushfstring(L,"%s %s",piece->module->op,piece->module->multi_name);
+    else
+      lua_pushstring(L,piece->module->op);
+    lua_pushnumber(L,piece->process_time);
+    lua_settable(L,-3);
+  }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  lua_setfield(L,-2,"modules");
+}
+
+static void push_pixelpipe(lua_State *L)
+{
+  lua_newtable(L);
+  if(!darktable.develop) return;
+  if(darktable.develop->pipe)
+  {
+    push_pipe(L,darktable.develop->pipe);
+    lua_setfield(L,-2,"full");
+  }
+  if(darktable.develop->preview_pipe)
+  {
+    push_pipe(L,darktable.develop->preview_pipe);
+    lua_setfield(L,-2,"preview");
+  }
+}
+
+// current and peak bytes per subsystem:
+static void push_memory(lua_State *L)
+{
+  lua_newtable(L);
+  for(int k=0; k<DT_MEMORY_TAG_COUNT; k++)
+  {
+    lua_newtable(L);
+    lua_pushnumber(L,dt_memory_stats_current(k));
+    lua_setfield(L,-2,"current");
+    lua_pushnumber(L,dt_memory_stats_peak(k));
+    lua_setfield(L,-2,"peak");
+    lua_setfield(L,-2,dt_memory_stats_name(k));
+  }
+}
+
+// the opencl and job numbers come from darktable.opencl_statistics() and darktable.job_statistics():
+static void push_call(lua_State *L, const char *function)
+{
+  dt_lua_push_darktable_lib(L);
+  lua_getfield(L,-1,function);
+  lua_remove(L,-2);
+  lua_call(L,0,1);
+}
+
+static void push_field(lua_State *L, const int index)
+{
+  switch(index)
+  {
+    case PERF_MIPMAP_CACHE:
+      push_mipmap_cache(L);
+      break;
+    case PERF_IMAGE_CACHE:
+      push_image_cache(L);
+      break;
+    case PERF_PIXELPIPE:
+      push_pixelpipe(L);
+      break;
+    case PERF_OPENCL:
+      push_call(L,"opencl_statistics");
+      break;
+    case PERF_JOBS:
+      push_call(L,"job_statistics");
+      break;
+    case PERF_MEMORY:
+      push_memory(L);
+      break;
+  }
+}
+
+static int perf_index(lua_State *L)
+{
+  push_field(L,luaL_checkoption(L,2,NULL,perf_fields_name));
+  return 1;
+}
+
+void dt_lua_perf_push(lua_State *L)
+{
+  lua_newtable(L);
+  for(int k=0; k<LAST_PERF_FIELD; k++)
+  {
+    push_field(L,k);
+    lua_setfield(L,-2,perf_fields_name[k]);
+  }
+}
+
+int dt_lua_init_perf(lua_State *L)
+{
+  dt_lua_push_darktable_lib(L);
+  lua_newtable(L);
+  lua_newtable(L);
+  lua_pushcfunction(L,perf_index);
+  lua_setfield(L,-2,"__index");
+  lua_setmetatable(L,-2);
+  lua_setfield(L,-2,"perf");
+  lua_pop(L,1);
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
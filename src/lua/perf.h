@@ -0,0 +1,37 @@
+/*
+   This file is part of darktable,
+   copyright (c) 2014 darktable developers.
+
+   darktable is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   darktable is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_LUA_PERF_H
+#define DT_LUA_PERF_H
+#include "lua/lua.h"
+
+/**
+  darktable.perf: counters of the caches, pixelpipes, opencl kernels and job queues,
+  read when they are accessed.
+  */
+int dt_lua_init_perf(lua_State *L);
+
+/**
+  (0,+1)
+  pushes a table with all sections of darktable.perf, as passed to the perf-update event.
+  */
+void dt_lua_perf_push(lua_State *L);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,384 @@
+/*
+   This file is part of darktable,
+   copyright (c) 2014 darktable developers.
+
+   darktable is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   darktable is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "lua/pixels.h"
+#include "lua/image.h"
+#include "lua/types.h"
+#include "common/darktable.h"
+#include "common/imageio.h"
+#include "common/imageio_module.h"
+#include "common/mipmap_cache.h"
+#include <string.h>
+#include <stdlib.h>
+
+typedef struct dt_lua_pixels_t
+{
+  dt_lua_image_t imgid;
+  int level;                  // mipmap level, -1 if rendered by the export pipe
+  int width, height, stride;  // stride in bytes
+  gboolean is_float;          // 4 floats per pixel in rgba order, else 4 bytes in bgra order
+  const uint8_t *data;        // NULL once released
+  dt_mipmap_buffer_t buf;     // holds a read lock as long as we point into the cache
+  uint8_t *copy;              // decompressed or rendered pixels, freed on release
+}
+dt_lua_pixels_t;
+
+typedef enum
+{
+  PIXELS_IMAGE,
+  PIXELS_LEVEL,
+  PIXELS_WIDTH,
+  PIXELS_HEIGHT,
+  PIXELS_STRIDE,
+  PIXELS_CHANNELS,
+  PIXELS_LAYOUT,
+  LAST_PIXELS_FIELD
+} pixels_fields;
+static const char *pixels_fields_name[] =
+{
+  "image",
+  "level",
+  "width",
+  "height",
+  "stride",
+  "channels",
+  "layout",
+  NULL
+};
+
+static dt_lua_pixels_t *checkpixels(lua_State *L, int index)
+{
+  dt_lua_pixels_t *p = luaL_checkudata(L,index,"dt_lua_pixels_t");
+  if(!p->data) luaL_error(L,"pixels of image %d have already been released",p->imgid);
+  return p;
+}
+
+static void pixels_release_data(dt_lua_pixels_t *p)
+{
+  if(p->buf.buf) dt_mipmap_cache_read_release(darktable.mipmap_cache,&p->buf);
+  p->buf.buf = NULL;
+  free(p->copy);
+  p->copy = NULL;
+  p->data = NULL;
+}
+
+static inline void pixel_rgba(const dt_lua_pixels_t *p, const int x, const int y, float *rgba)
+{
+  const uint8_t *row = p->data + (size_t)y*p->stride;
+  if(p->is_float)
+  {
+    const float *in = (const float *)row + 4*x;
+    for(int c=0; c<4; c++) rgba[c] = in[c];
+  }
+  else
+  {
+    const uint8_t *in = row + 4*x;
+    rgba[0] = in[2]/255.0f;
+    rgba[1] = in[1]/255.0f;
+    rgba[2] = in[0]/255.0f;
+    rgba[3] = in[3]/255.0f;
+  }
+}
+
+static inline float pixel_luma(const dt_lua_pixels_t *p, const int x, const int y)
+{
+  float rgba[4];
+  pixel_rgba(p,x,y,rgba);
+  return 0.2126f*rgba[0] + 0.7152f*rgba[1] + 0.0722f*rgba[2];
+}
+
+static int pixels_index(lua_State *L)
+{
+  const int index = luaL_checkoption(L,-1,NULL,pixels_fields_name);
+  dt_lua_pixels_t *p = luaL_checkudata(L,-2,"dt_lua_pixels_t");
+  switch(index)
+  {
+    case PIXELS_IMAGE:
+      luaA_push(L,dt_lua_image_t,&p->imgid);
+      return 1;
+    case PIXELS_LEVEL:
+      lua_pushinteger(L,p->level);
+      return 1;
+    case PIXELS_WIDTH:
+      lua_pushinteger(L,p->width);
+      return 1;
+    case PIXELS_HEIGHT:
+      lua_pushinteger(L,p->height);
+      return 1;
+    case PIXELS_STRIDE:
+      lua_pushinteger(L,p->stride);
+      return 1;
+    case PIXELS_CHANNELS:
+      lua_pushinteger(L,4);
+      return 1;
+    case PIXELS_LAYOUT:
+      lua_pushstring(L,p->is_float ? "rgba float" : "bgra uint8");
+      return 1;
+    default:
+      return luaL_error(L,"should never happen %d",index);
+  }
+}
+
+/** pixels:get(x, y): r, g, b, a of one pixel, in 0..1 for 8-bit buffers. */
+static int pixels_get(lua_State *L)
+{
+  const dt_lua_pixels_t *p = checkpixels(L,1);
+  const int x = luaL_checkint(L,2);
+  const int y = luaL_checkint(L,3);
+  luaL_argcheck(L,x >= 0 && x < p->width,2,"out of bounds");
+  luaL_argcheck(L,y >= 0 && y < p->height,3,"out of bounds");
+  float rgba[4];
+  pixel_rgba(p,x,y,rgba);
+  for(int c=0; c<4; c++) lua_pushnumber(L,rgba[c]);
+  return 4;
+}
+
+/** pixels:mean(): average r, g, b. */
+static int pixels_mean(lua_State *L)
+{
+  const dt_lua_pixels_t *p = checkpixels(L,1);
+  double r = 0.0, g = 0.0, b = 0.0;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none) shared(p) reduction(+:r,g,b)
+#endif
+  for(int j=0; j<p->height; j++)
+  {
+    float rgba[4];
+    for(int i=0; i<p->width; i++)
+    {
+      pixel_rgba(p,i,j,rgba);
+      r += rgba[0];
+      g += rgba[1];
+      b += rgba[2];
+    }
+  }
+  const double n = MAX(1.0, (double)p->width*p->height);
+  lua_pushnumber(L,r/n);
+  lua_pushnumber(L,g/n);
+  lua_pushnumber(L,b/n);
+  return 3;
+}
+
+/** pixels:histogram([bins]): table of pixel counts over luminance 0..1, 256 bins by default. */
+static int pixels_histogram(lua_State *L)
+{
+  const dt_lua_pixels_t *p = checkpixels(L,1);
+  const int bins = luaL_optint(L,2,256);
+  luaL_argcheck(L,bins > 0 && bins <= 65536,2,"between 1 and 65536");
+  uint32_t *hist = calloc(bins,sizeof(uint32_t));
+  for(int j=0; j<p->height; j++)
+    for(int i=0; i<p->width; i++)
+      hist[CLAMP((int)(pixel_luma(p,i,j)*bins), 0, bins-1)]++;
+  lua_createtable(L,bins,0);
+  for(int k=0; k<bins; k++)
+  {
+    lua_pushinteger(L,hist[k]);
+    lua_rawseti(L,-2,k+1);
+  }
+  free(hist);
+  return 1;
+}
+
+/** pixels:sharpness(): variance of the laplacian of the luminance, higher is sharper.
+  * only comparable between buffers of about the same size. */
+static int pixels_sharpness(lua_State *L)
+{
+  const dt_lua_pixels_t *p = checkpixels(L,1);
+  double sum = 0.0, sum2 = 0.0;
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none) shared(p) reduction(+:sum,sum2)
+#endif
+  for(int j=1; j<p->height-1; j++)
+  {
+    for(int i=1; i<p->width-1; i++)
+    {
+      const double lap = pixel_luma(p,i-1,j) + pixel_luma(p,i+1,j) + pixel_luma(p,i,j-1) + pixel_luma(p,i,j+1)
+                         - 4.0*pixel_luma(p,i,j);
+      sum += lap;
+      sum2 += lap*lap;
+    }
+  }
+  const double n = MAX(1.0, (double)(p->width-2)*(p->height-2));
+  lua_pushnumber(L,MAX(0.0, sum2/n - (sum/n)*(sum/n)));
+  return 1;
+}
+
+/** pixels:release(): drop the pixels (and the lock on the mipmap cache) right away instead of on gc. */
+static int pixels_release(lua_State *L)
+{
+  dt_lua_pixels_t *p = luaL_checkudata(L,1,"dt_lua_pixels_t");
+  pixels_release_data(p);
+  return 0;
+}
+
+static int pixels_gc(lua_State *L)
+{
+  dt_lua_pixels_t *p = luaL_checkudata(L,-1,"dt_lua_pixels_t");
+  pixels_release_data(p);
+  return 0;
+}
+
+static int pixels_tostring(lua_State *L)
+{
+  const dt_lua_pixels_t *p = luaL_checkudata(L,-1,"dt_lua_pixels_t");
+  lua_pushfstring(L,"pixels of image %d: %dx%d, level %d",p->imgid,p->width,p->height,p->level);
+  return 1;
+}
+
+/** image:get_pixels([level]): the mipmap level 0..3 (8-bit, processed) or 4 (float, unprocessed),
+  * loaded if it isn't cached. points into the cache, which keeps the level of this image locked
+  * until the pixels are released. nil if it can't be loaded. */
+static int image_get_pixels(lua_State *L)
+{
+  dt_lua_image_t imgid;
+  luaA_to(L,dt_lua_image_t,&imgid,1);
+  const int level = luaL_optint(L,2,DT_MIPMAP_2);
+  luaL_argcheck(L,level >= DT_MIPMAP_0 && level <= DT_MIPMAP_F,2,"mipmap level between 0 and 4");
+
+  dt_lua_pixels_t p;
+  memset(&p,0,sizeof(p));
+  p.imgid = imgid;
+  p.level = level;
+  dt_mipmap_cache_read_get(darktable.mipmap_cache,&p.buf,imgid,level,DT_MIPMAP_BLOCKING);
+  if(!p.buf.buf)
+  {
+    lua_pushnil(L);
+    return 1;
+  }
+  p.width = p.buf.width;
+  p.height = p.buf.height;
+  p.is_float = (level == DT_MIPMAP_F);
+  p.stride = p.width*4*(p.is_float ? sizeof(float) : sizeof(uint8_t));
+  p.copy = p.is_float ? NULL : dt_mipmap_cache_alloc_scratchmem(darktable.mipmap_cache);
+  p.data = p.is_float ? p.buf.buf : dt_mipmap_cache_decompress(&p.buf,p.copy);
+  if(p.data == p.copy)
+  {
+    // compressed thumbnails end up in our own copy, no need to keep the cache locked:
+    dt_mipmap_cache_read_release(darktable.mipmap_cache,&p.buf);
+    p.buf.buf = NULL;
+  }
+  else
+  {
+    free(p.copy);
+    p.copy = NULL;
+  }
+  luaA_push(L,dt_lua_pixels_t,&p);
+  return 1;
+}
+
+// format params for the export into memory
+typedef struct pixels_export_t
+{
+  dt_imageio_module_data_t head;
+  float *pixels;
+}
+pixels_export_t;
+
+static int export_bpp(dt_imageio_module_data_t *data)
+{
+  return 32;
+}
+
+static int export_levels(dt_imageio_module_data_t *data)
+{
+  return IMAGEIO_RGB | IMAGEIO_FLOAT;
+}
+
+static const char *export_mime(dt_imageio_module_data_t *data)
+{
+  return "memory";
+}
+
+static int export_write_image(dt_imageio_module_data_t *data, const char *filename, const void *in, void *exif, int exif_len, int imgid)
+{
+  pixels_export_t *d = (pixels_export_t *)data;
+  const size_t size = (size_t)4*sizeof(float)*data->width*data->height;
+  d->pixels = dt_alloc_align(64,size);
+  if(!d->pixels) return 1;
+  memcpy(d->pixels,in,size);
+  return 0;
+}
+
+/** image:render_pixels([max_width, max_height]): runs the export pipe with the history of the image
+  * and keeps the result in memory, as rgba floats. 0 means unbounded, the default. nil on failure. */
+static int image_render_pixels(lua_State *L)
+{
+  dt_lua_image_t imgid;
+  luaA_to(L,dt_lua_image_t,&imgid,1);
+
+  dt_imageio_module_format_t format;
+  memset(&format,0,sizeof(format));
+  format.mime = export_mime;
+  format.levels = export_levels;
+  format.bpp = export_bpp;
+  format.write_image = export_write_image;
+  pixels_export_t data;
+  memset(&data,0,sizeof(data));
+  data.head.max_width = MAX(luaL_optint(L,2,0),0);
+  data.head.max_height = MAX(luaL_optint(L,3,0),0);
+
+  if(dt_imageio_export(imgid,"memory",&format,&data.head,FALSE) || !data.pixels)
+  {
+    free(data.pixels);
+    lua_pushnil(L);
+    return 1;
+  }
+  dt_lua_pixels_t p;
+  memset(&p,0,sizeof(p));
+  p.imgid = imgid;
+  p.level = -1;
+  p.width = data.head.width;
+  p.height = data.head.height;
+  p.is_float = TRUE;
+  p.stride = p.width*4*sizeof(float);
+  p.copy = (uint8_t *)data.pixels;
+  p.data = p.copy;
+  luaA_push(L,dt_lua_pixels_t,&p);
+  return 1;
+}
+
+int dt_lua_init_pixels(lua_State *L)
+{
+  dt_lua_init_type(L,dt_lua_pixels_t);
+  dt_lua_register_type_callback_list(L,dt_lua_pixels_t,pixels_index,NULL,pixels_fields_name);
+  lua_pushcfunction(L,pixels_get);
+  dt_lua_register_type_callback_stack(L,dt_lua_pixels_t,"get");
+  lua_pushcfunction(L,pixels_mean);
+  dt_lua_register_type_callback_stack(L,dt_lua_pixels_t,"mean");
+  lua_pushcfunction(L,pixels_histogram);
+  dt_lua_register_type_callback_stack(L,dt_lua_pixels_t,"histogram");
+  lua_pushcfunction(L,pixels_sharpness);
+  dt_lua_register_type_callback_stack(L,dt_lua_pixels_t,"sharpness");
+  lua_pushcfunction(L,pixels_release);
+  dt_lua_register_type_callback_stack(L,dt_lua_pixels_t,"release");
+  luaL_getmetatable(L,"dt_lua_pixels_t");
+  lua_pushcfunction(L,pixels_gc);
+  lua_setfield(L,-2,"__gc");
+  lua_pushcfunction(L,pixels_tostring);
+  lua_setfield(L,-2,"__tostring");
+  lua_pop(L,1);
+
+  lua_pushcfunction(L,image_get_pixels);
+  dt_lua_register_type_callback_stack(L,dt_lua_image_t,"get_pixels");
+  lua_pushcfunction(L,image_render_pixels);
+  dt_lua_register_type_callback_stack(L,dt_lua_image_t,"render_pixels");
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -16,115 +16,376 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+// the checks are the test, keep them in release builds:
+#undef NDEBUG
 
 #define DT_UNIT_TEST
 // define dt alloc, so we don't need to include the rest of dt:
 #define dt_alloc_align(A, B) malloc(B)
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 
-// unit test for the concurrent hopscotch hashmap and the LRU cache built on top of it.
+// unit test for the concurrent hopscotch hashmap and the LRU cache built on top of it,
+// and a stress test of read_get/write_get/remove/gc from concurrent reader and writer
+// threads, which reports throughput and latency per operation.
+//
+//   test_cache [--readers <n>] [--writers <n>] [--ops <per thread>]
+//   test_cache --bench    no unit tests, more operations and latency histograms
+//
+// returns non-zero if anything failed, that's what ctest looks at.
 #include "common/cache.h"
 #include "common/cache.c"
 
+#include <inttypes.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 #ifdef _OPENMP
 #  include <omp.h>
 #endif
 
+// counts the misses, for the hit ratio of the stress test.
+static int32_t num_allocs = 0;
+
 int32_t
 alloc_dummy(void *data, const uint32_t key, int32_t *cost, void **buf)
 {
+  __sync_fetch_and_add(&num_allocs, 1);
   *cost = 1; // also the default
   *buf = (void *)(long int)key;
   // request write lock for our buffer?
   return 0;
 }
 
-int main(int argc, char *arg[])
+// every key is new and read twice, from a lot of threads at once. returns non-zero on failure.
+static int
+test_fill(const char *name, const int32_t capacity, const int32_t segments, const int32_t quota,
+          const dt_cache_replacement_t replacement, const int threads)
 {
   dt_cache_t cache;
-  // dt_cache_init(&cache, 110000, 16, 64, 100000);
-  // really hammer it, make quota insanely low:
-  dt_cache_init(&cache, 110000, 16, 64, 100);
+  dt_cache_init(&cache, capacity, segments, 64, quota);
   dt_cache_set_allocate_callback(&cache, alloc_dummy, NULL);
+  dt_cache_set_replacement(&cache, replacement);
+  // with a tiny table, the first read might not have found a free spot:
+  int tiny = capacity < threads;
 
 #ifdef _OPENMP
-  #  pragma omp parallel for default(none) schedule(guided) shared(cache, stderr) num_threads(16)
+  #  pragma omp parallel for default(none) schedule(guided) shared(cache, tiny) num_threads(threads)
 #endif
   for(int k=0; k<100000; k++)
   {
-    void *data = (void *)(long int)k;
-    const int size = 0;//dt_cache_size(&cache);
     const int con1 = dt_cache_contains(&cache, k);
     const int val1 = (int)(long int)dt_cache_read_get(&cache, k);
     const int val2 = (int)(long int)dt_cache_read_get(&cache, k);
-    // fprintf(stderr, "\rinserted number %d, size %d, value %d - %d, contains %d - %d", k, size, val1, val2, con1, con2);
     const int con2 = dt_cache_contains(&cache, k);
     assert (con1 == 0);
     assert (con2 == 1);
+    assert (val1 == k || tiny);
     assert (val2 == k);
     dt_cache_read_release(&cache, k);
     dt_cache_read_release(&cache, k);
   }
   dt_cache_print_locked(&cache);
-  // fprintf(stderr, "\n");
-  fprintf(stderr, "[passed] inserting 100000 entries concurrently\n");
+  fprintf(stderr, "[passed] %s: inserting 100000 entries concurrently\n", name);
 
   const int size = dt_cache_size(&cache);
   const int lru_cnt   = lru_check_consistency(&cache);
   const int lru_cnt_r = lru_check_consistency_reverse(&cache);
-  // fprintf(stderr, "lru list contains %d|%d/%d entries\n", lru_cnt, lru_cnt_r, size);
   assert(size == lru_cnt);
   assert(lru_cnt_r == lru_cnt);
-  fprintf(stderr, "[passed] cache lru consistency after removals, have %d entries left.\n", size);
-
+  fprintf(stderr, "[passed] %s: lru list consistency, have %d entries left, lru lock contended %u/%u times.\n",
+          name, size, cache.lru_lock_contended, cache.lru_lock_acquired);
   dt_cache_cleanup(&cache);
+  return 0;
+}
+
+
+typedef enum dt_cache_op_t
+{
+  DT_CACHE_OP_READ_GET = 0,
+  DT_CACHE_OP_WRITE_GET,
+  DT_CACHE_OP_REMOVE,
+  DT_CACHE_OP_GC,
+  DT_CACHE_OP_COUNT
+}
+dt_cache_op_t;
+
+static const char *op_names[DT_CACHE_OP_COUNT] = { "read_get", "write_get", "remove", "gc" };
+
+// latencies per operation, bucket b counts the ones in [2^(b-1), 2^b) nanoseconds.
+#define DT_CACHE_HIST_BUCKETS 40
 
+typedef struct dt_cache_hist_t
+{
+  uint64_t count[DT_CACHE_OP_COUNT][DT_CACHE_HIST_BUCKETS];
+  uint64_t max[DT_CACHE_OP_COUNT];
+}
+dt_cache_hist_t;
+
+typedef struct dt_cache_stress_t
+{
+  dt_cache_t cache;
+  int readers, writers, ops;
+  // keys 1..hot fit into the cache, hit_ratio of the accesses go there, the rest almost always miss:
+  uint32_t hot;
+  float hit_ratio;
+  int32_t errors;
+}
+dt_cache_stress_t;
 
+typedef struct dt_cache_thread_t
+{
+  pthread_t thread;
+  dt_cache_stress_t *s;
+  int writer;             // index of the writer, -1 for readers
+  uint32_t seed;
+  dt_cache_hist_t hist;
+}
+dt_cache_thread_t;
+
+static inline uint64_t
+now_ns()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
 
+static inline void
+hist_add(dt_cache_hist_t *h, const dt_cache_op_t op, const uint64_t ns)
+{
+  const int b = ns ? 64 - __builtin_clzll(ns) : 0;
+  h->count[op][b < DT_CACHE_HIST_BUCKETS ? b : DT_CACHE_HIST_BUCKETS-1]++;
+  if(ns > h->max[op]) h->max[op] = ns;
+}
+
+// upper end of the bucket holding the p-quantile, in microseconds.
+static double
+hist_quantile(const dt_cache_hist_t *h, const dt_cache_op_t op, const double p)
+{
+  uint64_t total = 0, sum = 0;
+  for(int b=0; b<DT_CACHE_HIST_BUCKETS; b++) total += h->count[op][b];
+  for(int b=0; b<DT_CACHE_HIST_BUCKETS; b++)
   {
-    // now a harder case: a cache with only one entry and a lot of threads fighting over it:
-    dt_cache_t cache2;
-    // really hammer it, make quota insanely low:
-    // capacity 1 num threads 1 cache line size 64 ignored, quota 2 (80% => 1)
-    dt_cache_init(&cache2, 1, 1, 64, 2);
-    dt_cache_set_allocate_callback(&cache2, alloc_dummy, NULL);
+    sum += h->count[op][b];
+    if(sum >= p * total) return (1ull << b) / 1000.0;
+  }
+  return h->max[op] / 1000.0;
+}
 
-#ifdef _OPENMP
-    #  pragma omp parallel for default(none) schedule(guided) shared(cache2, stderr) num_threads(16)
-#endif
-    for(int k=0; k<100000; k++)
+static inline uint32_t
+next_random(uint32_t *seed)
+{
+  // xorshift, good enough to spread keys:
+  uint32_t x = *seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *seed = x;
+}
+
+static inline uint32_t
+pick_key(dt_cache_thread_t *t)
+{
+  const dt_cache_stress_t *s = t->s;
+  const float u = (next_random(&t->seed) & 0xffffff) / (float)0x1000000;
+  const uint32_t key = (u < s->hit_ratio) ? next_random(&t->seed) % s->hot
+                                          : s->hot + next_random(&t->seed) % (1u << 28);
+  // two writers upgrading the same entry would wait for each other forever, so each gets its own keys:
+  if(t->writer >= 0) return (key / s->writers) * s->writers + t->writer + 1;
+  return key + 1;
+}
+
+static void *
+stress_reader(void *data)
+{
+  dt_cache_thread_t *t = (dt_cache_thread_t *)data;
+  dt_cache_stress_t *s = t->s;
+  for(int k=0; k<s->ops; k++)
+  {
+    const uint32_t key = pick_key(t);
+    const uint64_t start = now_ns();
+    void *buf = dt_cache_read_get(&s->cache, key);
+    hist_add(&t->hist, DT_CACHE_OP_READ_GET, now_ns() - start);
+    if(!buf)
     {
-      void *data = (void *)(long int)k;
-      const int size = 0;//dt_cache_size(&cache);
-      const int con1 = dt_cache_contains(&cache2, k);
-      const int val1 = (int)(long int)dt_cache_read_get(&cache2, k);
-      const int val2 = (int)(long int)dt_cache_read_get(&cache2, k);
-      // fprintf(stderr, "\rinserted number %d, size %d, value %d - %d, contains %d - %d", k, size, val1, val2, con1, con2);
-      const int con2 = dt_cache_contains(&cache2, k);
-      assert (con1 == 0);
-      assert (con2 == 1);
-      assert (val2 == k);
-      dt_cache_read_release(&cache2, k);
-      dt_cache_read_release(&cache2, k);
+      __sync_fetch_and_add(&s->errors, 1);
+      continue;
     }
-    dt_cache_print_locked(&cache2);
-    // fprintf(stderr, "\n");
-    fprintf(stderr, "[passed] inserting 100000 entries concurrently\n");
-
-    const int size = dt_cache_size(&cache2);
-    const int lru_cnt   = lru_check_consistency(&cache2);
-    const int lru_cnt_r = lru_check_consistency_reverse(&cache2);
-    // fprintf(stderr, "lru list contains %d|%d/%d entries\n", lru_cnt, lru_cnt_r, size);
-    assert(size == lru_cnt);
-    assert(lru_cnt_r == lru_cnt);
-    fprintf(stderr, "[passed] cache lru consistency after removals, have %d entries left.\n", size);
-    dt_cache_cleanup(&cache2);
+    if((uint32_t)(long int)buf != key) __sync_fetch_and_add(&s->errors, 1);
+    dt_cache_read_release(&s->cache, key);
+  }
+  return NULL;
+}
+
+static void *
+stress_writer(void *data)
+{
+  dt_cache_thread_t *t = (dt_cache_thread_t *)data;
+  dt_cache_stress_t *s = t->s;
+  for(int k=0; k<s->ops; k++)
+  {
+    const uint32_t key = pick_key(t);
+    uint64_t start = now_ns();
+    void *buf = dt_cache_read_get(&s->cache, key);
+    hist_add(&t->hist, DT_CACHE_OP_READ_GET, now_ns() - start);
+    if(!buf)
+    {
+      __sync_fetch_and_add(&s->errors, 1);
+      continue;
+    }
+    // waits for the readers of this entry to go away:
+    start = now_ns();
+    buf = dt_cache_write_get(&s->cache, key);
+    hist_add(&t->hist, DT_CACHE_OP_WRITE_GET, now_ns() - start);
+    if((uint32_t)(long int)buf != key) __sync_fetch_and_add(&s->errors, 1);
+    if(buf) dt_cache_write_release(&s->cache, key);
+    dt_cache_read_release(&s->cache, key);
+
+    if((k & 7) == 7)
+    {
+      // fails if someone holds it, or it's not there:
+      const uint32_t victim = pick_key(t);
+      start = now_ns();
+      dt_cache_remove(&s->cache, victim);
+      hist_add(&t->hist, DT_CACHE_OP_REMOVE, now_ns() - start);
+    }
+    if((k & 63) == 63)
+    {
+      start = now_ns();
+      dt_cache_gc(&s->cache, 0.5f);
+      hist_add(&t->hist, DT_CACHE_OP_GC, now_ns() - start);
+    }
+  }
+  return NULL;
+}
+
+// returns non-zero on failure.
+static int
+test_stress(const char *name, const int readers, const int writers, const float hit_ratio,
+            const dt_cache_replacement_t replacement, const int ops, const int histograms)
+{
+  dt_cache_stress_t s;
+  memset(&s, 0, sizeof(s));
+  s.readers = readers;
+  s.writers = writers;
+  s.ops = ops;
+  s.hit_ratio = hit_ratio;
+  // room for twice the hot keys, gc starts at 80% of the quota:
+  dt_cache_init(&s.cache, 1<<15, MAX(readers + writers, 1), 64, 1<<14);
+  dt_cache_set_allocate_callback(&s.cache, alloc_dummy, NULL);
+  dt_cache_set_replacement(&s.cache, replacement);
+  s.hot = 1<<12;
+  num_allocs = 0;
+
+  const int num_threads = readers + writers;
+  dt_cache_thread_t *threads = (dt_cache_thread_t *)calloc(num_threads, sizeof(dt_cache_thread_t));
+  const uint64_t start = now_ns();
+  for(int k=0; k<num_threads; k++)
+  {
+    threads[k].s = &s;
+    threads[k].writer = k < readers ? -1 : k - readers;
+    threads[k].seed = 0x9e3779b9u * (k + 1);
+    pthread_create(&threads[k].thread, NULL, k < readers ? stress_reader : stress_writer, threads + k);
+  }
+  dt_cache_hist_t hist;
+  memset(&hist, 0, sizeof(hist));
+  for(int k=0; k<num_threads; k++)
+  {
+    pthread_join(threads[k].thread, NULL);
+    for(int op=0; op<DT_CACHE_OP_COUNT; op++)
+    {
+      for(int b=0; b<DT_CACHE_HIST_BUCKETS; b++) hist.count[op][b] += threads[k].hist.count[op][b];
+      hist.max[op] = MAX(hist.max[op], threads[k].hist.max[op]);
+    }
+  }
+  const double seconds = (now_ns() - start) * 1e-9;
+  free(threads);
+
+  // nothing may be left locked, and the lru list has to hold exactly the entries of the table:
+  const int size = dt_cache_size(&s.cache);
+  const int lru_cnt   = lru_check_consistency(&s.cache);
+  const int lru_cnt_r = lru_check_consistency_reverse(&s.cache);
+  int locked = 0;
+  for(int k=0; k<=s.cache.bucket_mask; k++)
+    if(s.cache.table[k].read || s.cache.table[k].write) locked++;
+  const int failed = s.errors || locked || size != lru_cnt || lru_cnt != lru_cnt_r;
+
+  uint64_t gets = 0;
+  for(int b=0; b<DT_CACHE_HIST_BUCKETS; b++) gets += hist.count[DT_CACHE_OP_READ_GET][b];
+  fprintf(stderr, "[%s] %s: %d readers, %d writers, %.0f%% hot keys: %.0f read_get/s, %.1f%% hits, "
+          "lru lock contended %u/%u times\n", failed ? "failed" : "passed", name, readers, writers,
+          100.0f*hit_ratio, gets/seconds, gets ? 100.0*(1.0 - num_allocs/(double)gets) : 0.0,
+          s.cache.lru_lock_contended, s.cache.lru_lock_acquired);
+  if(failed)
+    fprintf(stderr, "  %d bad reads, %d buckets still locked, %d entries, lru list %d/%d\n",
+            s.errors, locked, size, lru_cnt, lru_cnt_r);
+  for(int op=0; op<DT_CACHE_OP_COUNT; op++)
+  {
+    uint64_t count = 0;
+    for(int b=0; b<DT_CACHE_HIST_BUCKETS; b++) count += hist.count[op][b];
+    if(!count) continue;
+    fprintf(stderr, "  %-10s %10"PRIu64" ops  p50 < %9.3fus  p99 < %9.3fus  max %9.3fus\n", op_names[op], count,
+            hist_quantile(&hist, op, 0.5), hist_quantile(&hist, op, 0.99), hist.max[op] / 1000.0);
+    if(!histograms) continue;
+    for(int b=0; b<DT_CACHE_HIST_BUCKETS; b++)
+      if(hist.count[op][b])
+        fprintf(stderr, "    < %12.3fus %10"PRIu64"\n", (1ull << b) / 1000.0, hist.count[op][b]);
+  }
+
+  dt_cache_cleanup(&s.cache);
+  return failed;
+}
+
+int main(int argc, char *arg[])
+{
+  int bench = 0, readers = -1, writers = -1, ops = -1;
+  for(int k=1; k<argc; k++)
+  {
+    if(!strcmp(arg[k], "--bench")) bench = 1;
+    else if(!strcmp(arg[k], "--readers") && k+1 < argc) readers = atoi(arg[++k]);
+    else if(!strcmp(arg[k], "--writers") && k+1 < argc) writers = atoi(arg[++k]);
+    else if(!strcmp(arg[k], "--ops") && k+1 < argc) ops = atoi(arg[++k]);
+    else
+    {
+      fprintf(stderr, "usage: %s [--bench] [--readers <n>] [--writers <n>] [--ops <per thread>]\n", arg[0]);
+      exit(1);
+    }
+  }
+  if(ops == 0) ops = 1;
+  // all locks in the cache spin. with more threads than cores, the one holding a lock
+  // gets preempted and we mostly measure the scheduler, so stay within the machine:
+  const int cores = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+  const int threads = cores < 16 ? cores : 16;
+  if(writers < 0) writers = MAX(threads / 4, 1);
+  if(readers < 0) readers = MAX(threads - writers, 1);
+  if(ops < 0) ops = bench ? 1000000 : 20000;
+
+  int failed = 0;
+  if(!bench)
+  {
+    // really hammer it, make quota insanely low:
+    failed |= test_fill("lru", 110000, 16, 100, DT_CACHE_REPLACEMENT_LRU, MAX(threads, 2));
+    // now a harder case: a cache with only one entry and a lot of threads fighting over it:
+    // capacity 1 num threads 1 cache line size 64 ignored, quota 2 (80% => 1)
+    failed |= test_fill("one entry", 1, 1, 2, DT_CACHE_REPLACEMENT_LRU, MAX(threads, 2));
+    // same thing with clock replacement, read hits don't take the lru lock:
+    failed |= test_fill("clock", 110000, 16, 100, DT_CACHE_REPLACEMENT_CLOCK, MAX(threads, 2));
+  }
+
+  failed |= test_stress("read only, lru", readers + writers, 0, 0.99f, DT_CACHE_REPLACEMENT_LRU, ops, bench);
+  failed |= test_stress("read only, clock", readers + writers, 0, 0.99f, DT_CACHE_REPLACEMENT_CLOCK, ops, bench);
+  const float hit_ratios[] = { 0.99f, 0.8f, 0.5f };
+  for(int k=0; k<3; k++)
+  {
+    failed |= test_stress("mixed, lru", readers, writers, hit_ratios[k], DT_CACHE_REPLACEMENT_LRU, ops, bench);
+    failed |= test_stress("mixed, clock", readers, writers, hit_ratios[k], DT_CACHE_REPLACEMENT_CLOCK, ops, bench);
   }
 
-  exit(0);
+  exit(failed);
 }
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
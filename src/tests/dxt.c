@@ -0,0 +1,182 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// the checks are the test, keep them in release builds:
+#undef NDEBUG
+
+// checks the dxt1 codec of the mipmap cache against libsquish, which wrote the
+// compressed thumbnails before: both decoders have to agree bit by bit on blocks
+// written by either encoder, and the error of our encoder must not be worse than
+// squish's range fit by more than a few percent.
+//
+//   test_dxt            unit test
+//   test_dxt --bench    throughput of both codecs on thumbnail sized images
+#include "common/dxt.h"
+#include "squish/csquish.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#define CLAMP_BYTE(v) ((v) < 0 ? 0 : ((v) > 255 ? 255 : (v)))
+
+static double
+get_time()
+{
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  return time.tv_sec - 1290608000 + (1.0/1000000.0)*time.tv_usec;
+}
+
+// something like a photo: smooth gradients, some texture, a few hard edges.
+static void
+fill_image(uint8_t *buf, const int width, const int height, unsigned int seed)
+{
+  for(int j=0; j<height; j++) for(int i=0; i<width; i++)
+    {
+      uint8_t *px = buf + 4*(j*width + i);
+      const int edge = (i > width/3) ^ (j > height/2);
+      seed = seed*1103515245u + 12345u;
+      const int noise = (seed >> 16) % 24;
+      px[0] = CLAMP_BYTE(40 + 150*i/width + noise);
+      px[1] = CLAMP_BYTE(edge ? 200 - 100*j/height + noise/2 : 30 + noise);
+      px[2] = CLAMP_BYTE(90 + 60*sinf(i*0.21f)*cosf(j*0.13f) + noise);
+      px[3] = 255;
+    }
+}
+
+static double
+rmse(const uint8_t *a, const uint8_t *b, const int width, const int height)
+{
+  double sum = 0.0;
+  for(int k=0; k<width*height; k++) for(int c=0; c<3; c++)
+    {
+      const double d = (double)a[4*k+c] - b[4*k+c];
+      sum += d*d;
+    }
+  return sqrt(sum/(3.0*width*height));
+}
+
+static int
+test_size(const int width, const int height)
+{
+  const int size = dt_dxt1_size(width, height);
+  uint8_t *img = malloc(4*width*height), *out = malloc(4*width*height), *ref = malloc(4*width*height);
+  uint8_t *blocks = malloc(size), *sblocks = malloc(size);
+  fill_image(img, width, height, width*31 + height);
+
+  // squish used a block row stride of width/4, overlapping the last block of a row with the
+  // next row for other widths. only compare to it where the layouts agree.
+  const int compare = (width % 4) == 0;
+  double err_squish = 0.0;
+  if(compare)
+  {
+    // squish's encoder, both decoders:
+    squish_compress_image(img, width, height, sblocks, squish_dxt1 | squish_colour_range_fit);
+    squish_decompress_image(ref, width, height, sblocks, squish_dxt1);
+    memset(out, 0, 4*width*height);
+    dt_dxt1_decompress(out, width, height, sblocks);
+    assert(!memcmp(out, ref, 4*width*height));
+    err_squish = rmse(img, ref, width, height);
+  }
+
+  for(int q=DT_DXT_RANGE_FIT; q<=DT_DXT_REFINE; q++)
+  {
+    dt_dxt1_compress(img, width, height, blocks, q);
+    memset(out, 0, 4*width*height);
+    dt_dxt1_decompress(out, width, height, blocks);
+    const double err = rmse(img, out, width, height);
+    fprintf(stderr, "[dxt] %4dx%-4d quality %d rmse %.3f", width, height, q, err);
+    if(compare)
+    {
+      // our encoder, both decoders:
+      squish_decompress_image(ref, width, height, blocks, squish_dxt1);
+      assert(!memcmp(out, ref, 4*width*height));
+      fprintf(stderr, " (squish range fit %.3f)", err_squish);
+      assert(err <= 1.05*err_squish + 0.1);
+    }
+    fprintf(stderr, "\n");
+    // the test image has 24 levels of noise, dxt1 can't do much better than half that.
+    // tiny images are mostly edge, only check they survive the round trip:
+    assert(err < 12.0 || width < 16 || height < 16);
+  }
+
+  free(img);
+  free(out);
+  free(ref);
+  free(blocks);
+  free(sblocks);
+  return 0;
+}
+
+static void
+bench(const int width, const int height, const int runs)
+{
+  const int size = dt_dxt1_size(width, height);
+  uint8_t *img = malloc(4*width*height), *out = malloc(4*width*height), *blocks = malloc(size);
+  fill_image(img, width, height, 1);
+  double t[6];
+  t[0] = get_time();
+  for(int r=0; r<runs; r++) squish_compress_image(img, width, height, blocks, squish_dxt1 | squish_colour_range_fit);
+  t[1] = get_time();
+  for(int r=0; r<runs; r++) squish_compress_image(img, width, height, blocks, squish_dxt1);
+  t[2] = get_time();
+  for(int r=0; r<runs; r++) squish_decompress_image(out, width, height, blocks, squish_dxt1);
+  t[3] = get_time();
+  for(int r=0; r<runs; r++) dt_dxt1_compress(img, width, height, blocks, DT_DXT_RANGE_FIT);
+  t[4] = get_time();
+  for(int r=0; r<runs; r++) dt_dxt1_compress(img, width, height, blocks, DT_DXT_REFINE);
+  t[5] = get_time();
+  for(int r=0; r<runs; r++) dt_dxt1_decompress(out, width, height, blocks);
+  const double t6 = get_time();
+  const double mpix = runs*width*height/1e6;
+  fprintf(stderr, "[dxt bench] %dx%d, Mpix/s\n", width, height);
+  fprintf(stderr, "  squish range fit   %8.1f\n", mpix/(t[1]-t[0]));
+  fprintf(stderr, "  squish cluster fit %8.1f\n", mpix/(t[2]-t[1]));
+  fprintf(stderr, "  squish decode      %8.1f\n", mpix/(t[3]-t[2]));
+  fprintf(stderr, "  dt range fit       %8.1f\n", mpix/(t[4]-t[3]));
+  fprintf(stderr, "  dt refine          %8.1f\n", mpix/(t[5]-t[4]));
+  fprintf(stderr, "  dt decode          %8.1f\n", mpix/(t6-t[5]));
+  free(img);
+  free(out);
+  free(blocks);
+}
+
+int main(int argc, char *arg[])
+{
+  if(argc > 1 && !strcmp(arg[1], "--bench"))
+  {
+    bench(1024, 768, 10);
+    return 0;
+  }
+  // full blocks, partial blocks at the right and bottom, tiny images:
+  test_size(64, 64);
+  test_size(37, 23);
+  test_size(5, 3);
+  test_size(1, 1);
+  test_size(720, 452);
+  test_size(721, 450);
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
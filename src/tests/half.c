@@ -0,0 +1,78 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// unit test for the half float conversion: all halfs have to survive the round
+// trip, and the buffer versions (f16c if compiled in) have to match the scalar code.
+#include "common/half.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+int main(int argc, char *arg[])
+{
+  // every half converts to float and back exactly, nans stay nans:
+  for(uint32_t h=0; h<0x10000u; h++)
+  {
+    const float f = dt_half_to_float(h);
+    if(isnan(f)) assert((dt_float_to_half(f) & 0x7e00u) == 0x7e00u);
+    else assert(dt_float_to_half(f) == h);
+  }
+  assert(dt_half_to_float(0x3c00u) == 1.0f);
+  assert(dt_half_to_float(0x0001u) == ldexpf(1.0f, -24));
+  // clamping and rounding to nearest even:
+  assert(dt_float_to_half(1e6f) == DT_HALF_MAX);
+  assert(dt_float_to_half(-1e6f) == (0x8000u | DT_HALF_MAX));
+  assert(dt_float_to_half(1.0f + ldexpf(1.0f, -11)) == 0x3c00u);
+  assert(dt_float_to_half(1.0f + 3.0f*ldexpf(1.0f, -11)) == 0x3c02u);
+  assert(dt_float_to_half(ldexpf(1.0f, -26)) == 0);
+
+  // buffer conversion against the scalar code, on random bit patterns of finite floats:
+  const size_t n = 1<<20;
+  float *in = (float *)malloc(sizeof(float)*n);
+  float *out = (float *)malloc(sizeof(float)*n);
+  uint16_t *h = (uint16_t *)malloc(sizeof(uint16_t)*n);
+  srand(1);
+  for(size_t k=0; k<n; k++)
+  {
+    union { float f; uint32_t i; } u;
+    do u.i = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+    while(!isfinite(u.f));
+    // mostly values in the range images have:
+    in[k] = (k & 1) ? u.f : (rand()/(float)RAND_MAX - 0.25f) * 200.0f;
+  }
+  dt_float_to_half_buf(h, in, n);
+  for(size_t k=0; k<n; k++) assert(h[k] == dt_float_to_half(in[k]));
+  dt_half_to_float_buf(out, h, n);
+  for(size_t k=0; k<n; k++) assert(out[k] == dt_half_to_float(h[k]));
+#ifdef __F16C__
+  fprintf(stderr, "[half] f16c path tested\n");
+#else
+  fprintf(stderr, "[half] scalar path tested\n");
+#endif
+  free(in);
+  free(out);
+  free(h);
+  return 0;
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -366,6 +366,11 @@ void _expose_tethered_mode(dt_view_t *self, cairo_t *cr, int32_t width, int32_t
 
   if( cam->is_live_viewing == TRUE) // display the preview
   {
+    // let the decoder know how large the frames end up on screen so it can downscale early
+    const int tw = width-(MARGIN*2.0f), th = height-(MARGIN*2.0f)-BAR_HEIGHT;
+    cam->live_view_target_width  = cam->live_view_rotation%2 == 0 ? tw : th;
+    cam->live_view_target_height = cam->live_view_rotation%2 == 0 ? th : tw;
+
     dt_pthread_mutex_lock(&cam->live_view_pixbuf_mutex);
     if(GDK_IS_PIXBUF(cam->live_view_pixbuf))
     {
@@ -22,6 +22,7 @@
 #include "views/view.h"
 #include "develop/develop.h"
 #include "control/jobs.h"
+#include "control/jobs/develop_jobs.h"
 #include "control/control.h"
 #include "control/conf.h"
 #include "dtgtk/button.h"
@@ -104,6 +105,24 @@ void cleanup(dt_view_t *self)
 }
 
 
+// the backbuf with the over and under exposure indicators drawn in, if they are on. needs the backbuf mutex.
+static uint8_t *_overexposed_backbuf(dt_develop_t *dev, uint8_t *backbuf, const int wd, const int ht)
+{
+  static uint8_t *buf = NULL;
+  static size_t size = 0;
+  if(!dev->overexposed.enabled || !backbuf) return backbuf;
+  const size_t needed = (size_t)4*wd*ht;
+  if(needed > size)
+  {
+    free(buf);
+    buf = (uint8_t *)dt_alloc_align(64, needed);
+    size = buf ? needed : 0;
+  }
+  if(!buf) return backbuf;
+  dt_dev_overexposed_overlay(dev, backbuf, buf, wd, ht);
+  return buf;
+}
+
 void expose(dt_view_t *self, cairo_t *cri, int32_t width_i, int32_t height_i, int32_t pointerx, int32_t pointery)
 {
   // startup-time conf parameter:
@@ -160,7 +179,9 @@ void expose(dt_view_t *self, cairo_t *cri, int32_t width_i, int32_t height_i, in
   static int image_surface_width = 0, image_surface_height = 0, image_surface_imgid = -1;
   static float roi_hash_old = -1.0f;
   // compute patented dreggn hash so we don't need to check all values:
-  const float roi_hash = width + 7.0f*height + 23.0f*zoom + 42.0f*zoom_x + 91.0f*zoom_y + 666.0f*zoom;
+  const float roi_hash = width + 7.0f*height + 23.0f*zoom + 42.0f*zoom_x + 91.0f*zoom_y + 666.0f*zoom
+                         + (dev->overexposed.enabled ? 1234.0f*(1 + dev->overexposed.colorscheme)
+                                                       + 13.0f*dev->overexposed.lower + 17.0f*dev->overexposed.upper : 0.0f);
 
   if(image_surface_width != width || image_surface_height != height || image_surface == NULL)
   {
@@ -189,11 +210,14 @@ void expose(dt_view_t *self, cairo_t *cri, int32_t width_i, int32_t height_i, in
     dt_pthread_mutex_lock(mutex);
     wd = dev->pipe->backbuf_width;
     ht = dev->pipe->backbuf_height;
+    // preliminary passes of progressive rendering come at lower resolution:
+    const float upscale = dev->pipe->backbuf_upscale;
     stride = cairo_format_stride_for_width (CAIRO_FORMAT_RGB24, wd);
-    surface = cairo_image_surface_create_for_data (dev->pipe->backbuf, CAIRO_FORMAT_RGB24, wd, ht, stride);
+    surface = cairo_image_surface_create_for_data (_overexposed_backbuf(dev, dev->pipe->backbuf, wd, ht),
+                                                   CAIRO_FORMAT_RGB24, wd, ht, stride);
     cairo_set_source_rgb (cr, .2, .2, .2);
     cairo_paint(cr);
-    cairo_translate(cr, .5f*(width-wd), .5f*(height-ht));
+    cairo_translate(cr, .5f*(width-wd*upscale), .5f*(height-ht*upscale));
     if(closeup)
     {
       const float closeup_scale = 2.0;
@@ -203,13 +227,14 @@ void expose(dt_view_t *self, cairo_t *cri, int32_t width_i, int32_t height_i, in
       dt_dev_check_zoom_bounds(dev, &zx1, &zy1, zoom, 1, &boxw, &boxh);
       dt_dev_check_zoom_bounds(dev, &zxm, &zym, zoom, 1, &boxw, &boxh);
       const float fx = 1.0 - fmaxf(0.0, (zx0 - zx1)/(zx0 - zxm)), fy = 1.0 - fmaxf(0.0, (zy0 - zy1)/(zy0 - zym));
-      cairo_translate(cr, -wd/(2.0*closeup_scale) * fx, -ht/(2.0*closeup_scale) * fy);
+      cairo_translate(cr, -wd*upscale/(2.0*closeup_scale) * fx, -ht*upscale/(2.0*closeup_scale) * fy);
     }
+    cairo_scale(cr, upscale, upscale);
     cairo_rectangle(cr, 0, 0, wd, ht);
     cairo_set_source_surface (cr, surface, 0, 0);
-    cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_FAST);
+    cairo_pattern_set_filter(cairo_get_source(cr), upscale > 1.0f ? CAIRO_FILTER_GOOD : CAIRO_FILTER_FAST);
     cairo_fill_preserve(cr);
-    cairo_set_line_width(cr, 1.0);
+    cairo_set_line_width(cr, 1.0/upscale);
     cairo_set_source_rgb (cr, .3, .3, .3);
     cairo_stroke(cr);
     cairo_surface_destroy (surface);
@@ -231,7 +256,8 @@ void expose(dt_view_t *self, cairo_t *cri, int32_t width_i, int32_t height_i, in
     cairo_rectangle(cr, 0, 0, width, height);
     cairo_clip(cr);
     stride = cairo_format_stride_for_width (CAIRO_FORMAT_RGB24, wd);
-    surface = cairo_image_surface_create_for_data (dev->preview_pipe->backbuf, CAIRO_FORMAT_RGB24, wd, ht, stride);
+    surface = cairo_image_surface_create_for_data (_overexposed_backbuf(dev, dev->preview_pipe->backbuf, wd, ht),
+                                                   CAIRO_FORMAT_RGB24, wd, ht, stride);
     cairo_translate(cr, width/2.0, height/2.0f);
     cairo_scale(cr, zoom_scale, zoom_scale);
     cairo_translate(cr, -.5f*wd-zoom_x*wd, -.5f*ht-zoom_y*ht);
@@ -259,13 +285,19 @@ void expose(dt_view_t *self, cairo_t *cri, int32_t width_i, int32_t height_i, in
     /* reset the request */
     darktable.develop->proxy.snapshot.request = FALSE;
 
-    /* validation of snapshot filename */
-    g_assert(darktable.develop->proxy.snapshot.filename != NULL);
+    /* validation of snapshot target */
+    g_assert(darktable.develop->proxy.snapshot.surface != NULL);
 
-    /* Store current image surface to snapshot file.
+    /* Store a copy of the current image surface in memory.
        FIXME: add checks so that we dont make snapshots of preview pipe image surface.
     */
-    cairo_surface_write_to_png(image_surface, darktable.develop->proxy.snapshot.filename);
+    cairo_surface_t *snapshot = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+    cairo_t *cr_snapshot = cairo_create(snapshot);
+    cairo_set_source_surface(cr_snapshot, image_surface, 0, 0);
+    cairo_set_operator(cr_snapshot, CAIRO_OPERATOR_SOURCE);
+    cairo_paint(cr_snapshot);
+    cairo_destroy(cr_snapshot);
+    *darktable.develop->proxy.snapshot.surface = snapshot;
   }
 
   // Displaying sample areas if enabled
@@ -507,6 +539,9 @@ dt_dev_change_image(dt_develop_t *dev, const uint32_t imgid)
   // stop crazy users from sleeping on key-repeat spacebar:
   if(dev->image_loading) return;
 
+  // refresh the thumbnails from the preview while we don't hold its pipe yet:
+  const int thumbnails_outdated = dev->history_end == 0 || dt_dev_write_thumbnails(dev);
+
   // make sure we can destroy and re-setup the pixel pipes.
   // we acquire the pipe locks, which will block the processing threads
   // in darkroom mode before they touch the pipes (init buffers etc).
@@ -538,11 +573,13 @@ dt_dev_change_image(dt_develop_t *dev, const uint32_t imgid)
   // commit image ops to db
   dt_dev_write_history(dev);
 
-  // be sure light table will update the thumbnail
+  // be sure light table will update the thumbnail, unless the preview already did.
+  // unaltered images go back to the embedded thumbnail, if that's what the user prefers.
   // TODO: only if image changed!
   // if()
   {
-    dt_mipmap_cache_remove(darktable.mipmap_cache, dev->image_storage.id);
+    if(thumbnails_outdated)
+      dt_mipmap_cache_remove(darktable.mipmap_cache, dev->image_storage.id);
     dt_image_synch_xmp(dev->image_storage.id);
   }
 
@@ -691,9 +728,6 @@ dt_dev_change_image(dt_develop_t *dev, const uint32_t imgid)
   // Signal develop initialize
   dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_IMAGE_CHANGED);
 
-  // prefetch next few from first selected image on.
-  dt_view_filmstrip_prefetch();
-
   // release pixel pipe mutices
   dt_pthread_mutex_unlock(&dev->preview_pipe_mutex);
   dt_pthread_mutex_unlock(&dev->pipe_mutex);
@@ -876,13 +910,27 @@ static void _darkroom_ui_apply_style_activate_callback(gchar *name)
   dt_control_log(_("applied style `%s' on current image"),name);
 
   /* write current history changes so nothing gets lost */
-  dt_dev_write_history(darktable.develop);
+  dt_database_write_wait(darktable.db, dt_dev_write_history(darktable.develop));
 
   /* apply style on image and reload*/
   dt_styles_apply_to_image (name, FALSE, darktable.develop->image_storage.id);
   dt_dev_reload_image(darktable.develop, darktable.develop->image_storage.id);
 }
 
+// the tooltip of a style shows it on the current image, rendered when the menu popped up:
+static gboolean _darkroom_ui_style_query_tooltip(GtkWidget *widget, gint x, gint y, gboolean keyboard_mode,
+                                                 GtkTooltip *tooltip, gpointer user_data)
+{
+  const gchar *name = (const gchar *)user_data;
+  gchar *markup = gtk_widget_get_tooltip_markup(widget);
+  gtk_tooltip_set_markup(tooltip, markup);
+  g_free(markup);
+  GdkPixbuf *preview = dt_styles_preview(name, darktable.develop->image_storage.id, DT_STYLES_PREVIEW_SIZE);
+  gtk_tooltip_set_icon(tooltip, preview);
+  if(preview) g_object_unref(preview);
+  return TRUE;
+}
+
 static void _darkroom_ui_apply_style_popupmenu(GtkWidget *w, gpointer user_data)
 {
   /* show styles popup menu */
@@ -890,6 +938,8 @@ static void _darkroom_ui_apply_style_popupmenu(GtkWidget *w, gpointer user_data)
   GtkWidget *menu = NULL;
   if(styles)
   {
+    // previews for the tooltips, all of them at once while the user looks at the menu:
+    dt_styles_preview_prefetch(darktable.develop->image_storage.id, DT_STYLES_PREVIEW_SIZE);
     menu= gtk_menu_new();
     do
     {
@@ -909,6 +959,8 @@ static void _darkroom_ui_apply_style_popupmenu(GtkWidget *w, gpointer user_data)
       }
 
       gtk_widget_set_tooltip_markup(mi, tooltip);
+      g_signal_connect_data(G_OBJECT(mi), "query-tooltip", G_CALLBACK(_darkroom_ui_style_query_tooltip),
+                            g_strdup(style->name), (GClosureNotify)g_free, 0);
 
       gtk_menu_append (GTK_MENU (menu), mi);
       gtk_signal_connect_object (GTK_OBJECT (mi), "activate",
@@ -938,8 +990,8 @@ static void _overexposed_quickbutton_clicked(GtkWidget *w, gpointer user_data)
 {
   dt_develop_t *d = (dt_develop_t *)user_data;
   d->overexposed.enabled = !d->overexposed.enabled;
-//   dt_dev_reprocess_center(d);
-  dt_dev_reprocess_all(d);
+  // drawn over the output of the pipes, see expose():
+  dt_control_queue_redraw_center();
 }
 
 static gboolean _overexposed_close_popup(GtkWidget *widget, GdkEvent *event, gpointer user_data)
@@ -1005,8 +1057,7 @@ static void colorscheme_callback(GtkWidget *combo, gpointer user_data)
   if(d->overexposed.enabled == FALSE)
     gtk_button_clicked(GTK_BUTTON(d->overexposed.button));
   else
-//     dt_dev_reprocess_center(d);
-    dt_dev_reprocess_all(d);
+    dt_control_queue_redraw_center();
 }
 
 static void lower_callback(GtkWidget *slider, gpointer user_data)
@@ -1016,8 +1067,7 @@ static void lower_callback(GtkWidget *slider, gpointer user_data)
   if(d->overexposed.enabled == FALSE)
     gtk_button_clicked(GTK_BUTTON(d->overexposed.button));
   else
-//     dt_dev_reprocess_center(d);
-    dt_dev_reprocess_all(d);
+    dt_control_queue_redraw_center();
 }
 
 static void upper_callback(GtkWidget *slider, gpointer user_data)
@@ -1027,8 +1077,7 @@ static void upper_callback(GtkWidget *slider, gpointer user_data)
   if(d->overexposed.enabled == FALSE)
     gtk_button_clicked(GTK_BUTTON(d->overexposed.button));
   else
-//     dt_dev_reprocess_center(d);
-    dt_dev_reprocess_all(d);
+    dt_control_queue_redraw_center();
 }
 
 static gboolean _overexposed_toggle_callback(GtkAccelGroup *accel_group,
@@ -1040,6 +1089,46 @@ static gboolean _overexposed_toggle_callback(GtkAccelGroup *accel_group,
   return TRUE;
 }
 
+/* user input: stops loading the neighbours and starts the idle time over. */
+static void
+_darkroom_prerender_input(dt_develop_t *dev)
+{
+  dev->prerender.last_input = dt_get_wtime();
+  dt_job_t *job = darktable.control->job_res + DT_CTL_WORKER_6;
+  const int state = dt_control_job_get_state(job);
+  if(state == DT_JOB_STATE_QUEUED || state == DT_JOB_STATE_RUNNING)
+  {
+    dt_control_job_cancel(job);
+    // try again once the user rests again
+    dev->prerender.imgid = -1;
+  }
+}
+
+/* polls for idle time, then loads the filmstrip neighbours of the current image in the background. */
+static gboolean
+_darkroom_prerender_idle(gpointer user_data)
+{
+  dt_view_t *self = (dt_view_t *)user_data;
+  dt_develop_t *dev = (dt_develop_t *)self->data;
+  const int delay = dt_conf_get_int("plugins/darkroom/prerender_delay");
+  if(delay <= 0 || dev->prerender.imgid == dev->image_storage.id) return TRUE;
+  // the pipes of the image on screen go first:
+  if(dev->image_loading || dev->image_dirty || dev->preview_dirty)
+  {
+    dev->prerender.last_input = dt_get_wtime();
+    return TRUE;
+  }
+  if(dt_get_wtime() - dev->prerender.last_input < delay/1000.0) return TRUE;
+  // a cancelled one still winding down keeps the slot:
+  if(dt_control_job_get_state(darktable.control->job_res + DT_CTL_WORKER_6) == DT_JOB_STATE_RUNNING) return TRUE;
+
+  dt_job_t job;
+  dt_dev_prerender_job_init(&job, dev->image_storage.id);
+  dt_control_add_job_res(darktable.control, &job, DT_CTL_WORKER_6);
+  dev->prerender.imgid = dev->image_storage.id;
+  return TRUE;
+}
+
 void enter(dt_view_t *self)
 {
 
@@ -1257,12 +1346,19 @@ void enter(dt_view_t *self)
                             G_CALLBACK(_view_darkroom_filmstrip_activate_callback),
                             self);
 
-  // prefetch next few from first selected image on.
-  dt_view_filmstrip_prefetch();
+  // load the neighbours once the user rests on an image
+  dev->prerender.imgid = -1;
+  dev->prerender.last_input = dt_get_wtime();
+  dev->prerender.timeout = g_timeout_add(250, _darkroom_prerender_idle, self);
 }
 
 void leave(dt_view_t *self)
 {
+  dt_develop_t *dev = (dt_develop_t *)self->data;
+  g_source_remove(dev->prerender.timeout);
+  dev->prerender.timeout = 0;
+  _darkroom_prerender_input(dev);
+
   /* disconnect from filmstrip image activate */
   dt_control_signal_disconnect(darktable.signals,
                                G_CALLBACK(_view_darkroom_filmstrip_activate_callback),
@@ -1282,7 +1378,6 @@ void leave(dt_view_t *self)
   else
     dt_conf_set_string("plugins/darkroom/active", "");
 
-  dt_develop_t *dev = (dt_develop_t *)self->data;
   // tag image as changed
   // TODO: only tag the image when there was a real change.
   guint tagid = 0;
@@ -1291,11 +1386,13 @@ void leave(dt_view_t *self)
   // commit image ops to db
   dt_dev_write_history(dev);
 
-  // be sure light table will regenerate the thumbnail:
+  // be sure light table will regenerate the thumbnail, from the preview pipe output if that
+  // shows the current history, so no pipe has to run for it:
   // TODO: only if changed!
   // if()
   {
-    dt_mipmap_cache_remove(darktable.mipmap_cache, dev->image_storage.id);
+    if(dev->history_end == 0 || dt_dev_write_thumbnails(dev))
+      dt_mipmap_cache_remove(darktable.mipmap_cache, dev->image_storage.id);
     // dump new xmp data
     dt_image_synch_xmp(dev->image_storage.id);
   }
@@ -1357,6 +1454,7 @@ void mouse_moved(dt_view_t *self, double x, double y, int which)
   const int32_t capwd = darktable.thumbnail_width;
   const int32_t capht = darktable.thumbnail_height;
   dt_develop_t *dev = (dt_develop_t *)self->data;
+  _darkroom_prerender_input(dev);
 
   // if we are not hovering over a thumbnail in the filmstrip -> show metadata of opened image.
   int32_t mouse_over_id = -1;
@@ -1462,6 +1560,7 @@ int button_pressed(dt_view_t *self, double x, double y, int which, int type, uin
   const int32_t capwd = darktable.thumbnail_width;
   const int32_t capht = darktable.thumbnail_height;
   dt_develop_t *dev = (dt_develop_t *)self->data;
+  _darkroom_prerender_input(dev);
   const int32_t width_i  = self->width;
   const int32_t height_i = self->height;
   if(width_i  > capwd) x += (capwd-width_i) *.5f;
@@ -1544,6 +1643,7 @@ void scrolled(dt_view_t *self, double x, double y, int up, int state)
   const int32_t capwd = darktable.thumbnail_width;
   const int32_t capht = darktable.thumbnail_height;
   dt_develop_t *dev = (dt_develop_t *)self->data;
+  _darkroom_prerender_input(dev);
   const int32_t width_i  = self->width;
   const int32_t height_i = self->height;
   if(width_i  > capwd) x += (capwd-width_i) *.5f;
@@ -1653,6 +1753,7 @@ void border_scrolled(dt_view_t *view, double x, double y, int which, int up)
 
 int key_pressed(dt_view_t *self, guint key, guint state)
 {
+  _darkroom_prerender_input((dt_develop_t *)self->data);
   return 1;
 }
 
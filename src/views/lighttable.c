@@ -25,6 +25,7 @@
 #include "common/image_cache.h"
 #include "common/darktable.h"
 #include "common/collection.h"
+#include "common/grouping.h"
 #include "common/colorlabels.h"
 #include "common/selection.h"
 #include "common/debug.h"
@@ -69,6 +70,31 @@ go_pgdown_key_accel_callback(GtkAccelGroup *accel_group, GObject *acceleratable,
                              guint keyval, GdkModifierType modifier,
                              gpointer data);
 
+// maximum number of outstanding thumbnail prefetch requests. the gui doesn't wait for the job queue
+// to drain, so they only take a share of it:
+#define DT_LIBRARY_MAX_PREFETCH MIN(256, DT_CONTROL_MAX_JOBS/4)
+// how many seconds of scrolling at the current speed we try to prefetch
+#define DT_LIBRARY_PREFETCH_LOOKAHEAD 0.5f
+
+// the zoomable lighttable blits pre-composited tiles instead of drawing every cell once cells are
+// this small. tiles span all columns and are kept at a few cell sizes, 16 << level pixels.
+#define DT_LIBRARY_TILE_LEVELS 4
+#define DT_LIBRARY_TILE_HEIGHT 512
+#define DT_LIBRARY_TILE_CACHE_SIZE (64<<20)
+#define DT_LIBRARY_TILE_PENDING 16
+
+/** a band of rows of the zoomable lighttable, drawn ahead of time. */
+typedef struct dt_library_tile_t
+{
+  int level, index;   // rows index*rows .. (index+1)*rows-1 of cells 16 << level pixels wide
+  cairo_surface_t *surface;
+  uint64_t state;     // what the cells show, see _tile_state()
+  uint32_t mipmap_generation, surface_generation;
+  int complete;       // no cell had to be drawn with a stand-in thumbnail
+  GList *lru;
+}
+dt_library_tile_t;
+
 /**
  * this organises the whole library:
  * previously imported film rolls..
@@ -95,6 +121,31 @@ typedef struct dt_library_t
 
   int32_t collection_count;
 
+  /* scroll direction and speed aware thumbnail prefetching */
+  struct
+  {
+    int32_t offset;    // offset at the last update
+    double time;       // and when that was
+    float speed;       // smoothed scroll speed in rows per second
+    int direction;     // 1 scrolling down, -1 scrolling up
+    int iir;
+    dt_mipmap_size_t mip;
+    int num;           // currently queued requests:
+    int32_t imgids[DT_LIBRARY_MAX_PREFETCH];
+  } prefetch;
+
+  /* tiles of the zoomable lighttable */
+  struct
+  {
+    GHashTable *table; // _tile_key(level, index) -> dt_library_tile_t
+    GQueue lru;        // most recently drawn first
+    size_t size;
+    int num_pending;   // tiles to draw when idle, most urgent first
+    int pending[DT_LIBRARY_TILE_PENDING];
+    guint idle;
+    int32_t over_id, over_index; // the image under the mouse and its position in the collection
+  } tiles;
+
   /* prepared and reusable statements */
   struct
   {
@@ -104,13 +155,13 @@ typedef struct dt_library_t
     sqlite3_stmt *select_imgid_in_selection;
     /* delete from selected_images where imgid != ?1 */
     sqlite3_stmt *delete_except_arg;
-    /* check if the group of the image under the mouse has others, too, ?1: group_id, ?2: imgid */
-    sqlite3_stmt *is_grouped;
   } statements;
 
 }
 dt_library_t;
 
+static void _tiles_clear(dt_library_t *lib);
+
 // needed for drag&drop
 static GtkTargetEntry target_list[] = { { "text/uri-list", GTK_TARGET_OTHER_APP, 0 } };
 static guint n_targets = G_N_ELEMENTS (target_list);
@@ -267,8 +318,9 @@ static void _view_lighttable_collection_listener_callback(gpointer instance, gpo
   if(lib->statements.main_query)
     sqlite3_finalize(lib->statements.main_query);
 
-  /* prepare a new main query statement for collection */
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &lib->statements.main_query, NULL);
+  /* prepare a new main query statement for collection. it reads the materialized ids,
+     so scrolling costs the same anywhere in the collection. */
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), COLLECTION_IDS_QUERY, -1, &lib->statements.main_query, NULL);
 
   dt_control_queue_redraw_center();
 }
@@ -344,7 +396,10 @@ void init(dt_view_t *self)
 
   /* initialize reusable sql statements */
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from selected_images where imgid != ?1", -1, &lib->statements.delete_except_arg, NULL);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select id from images where group_id = ?1 and id != ?2", -1, &lib->statements.is_grouped, NULL); //TODO: only check in displayed images?
+
+  lib->tiles.table = g_hash_table_new(g_direct_hash, g_direct_equal);
+  g_queue_init(&lib->tiles.lru);
+  lib->tiles.over_id = -1;
 }
 
 
@@ -353,6 +408,8 @@ void cleanup(dt_view_t *self)
   dt_library_t *lib = (dt_library_t *)self->data;
   dt_conf_set_float("lighttable/ui/zoom_x", lib->zoom_x);
   dt_conf_set_float("lighttable/ui/zoom_y", lib->zoom_y);
+  _tiles_clear(lib);
+  g_hash_table_destroy(lib->tiles.table);
   free(self->data);
 }
 
@@ -374,6 +431,94 @@ grid_to_index (int row, int col, int stride, int offset)
 }
 #endif
 
+/**
+ * queues prefetch jobs for the rows the user is scrolling towards. the number of
+ * rows grows with the scroll speed, requests which left the window (for example
+ * when the scroll direction is reversed) are dropped from the job queue again.
+ * jobs are queued behind the visible thumbnails, nearest rows first.
+ */
+static void
+_prefetch_update(dt_library_t *lib, const int32_t offset, const int max_rows, const int iir, const dt_mipmap_size_t mip)
+{
+  const int32_t delta = offset - lib->prefetch.offset;
+  // didn't move, outstanding requests are still what we want:
+  if(delta == 0 && lib->prefetch.num > 0 && lib->prefetch.mip == mip && lib->prefetch.iir == iir) return;
+
+  const double now = dt_get_wtime();
+  const double dt = now - lib->prefetch.time;
+  // smooth scroll speed in rows per second, longer pauses start over.
+  if(dt > 0.0 && dt < 1.0 && iir > 0)
+    lib->prefetch.speed = 0.5f*lib->prefetch.speed + 0.5f*abs(delta)/(float)iir/dt;
+  else
+    lib->prefetch.speed = 0.0f;
+  if(delta > 0) lib->prefetch.direction = 1;
+  else if(delta < 0) lib->prefetch.direction = -1;
+  else if(lib->prefetch.direction == 0) lib->prefetch.direction = 1;
+  lib->prefetch.offset = offset;
+  lib->prefetch.time = now;
+
+  // at least half a screen, more when scrolling fast:
+  const int rows = CLAMP((int)(.5f*max_rows + 1 + DT_LIBRARY_PREFETCH_LOOKAHEAD*lib->prefetch.speed), 1, 4*max_rows);
+  int32_t count = MIN(rows*iir, DT_LIBRARY_MAX_PREFETCH);
+  // and only as far as the queue has room, counting our own requests still in there:
+  count = MIN(count, MAX(0, DT_CONTROL_MAX_JOBS - dt_control_jobs_queued(darktable.control) + lib->prefetch.num));
+  int32_t start = offset + max_rows*iir;
+  if(lib->prefetch.direction < 0)
+  {
+    start = MAX(0, offset - count);
+    count = offset - start;
+  }
+
+  int32_t imgids[DT_LIBRARY_MAX_PREFETCH];
+  int num = 0;
+  if(count > 0)
+  {
+    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
+    DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
+    dt_collection_update_ids(darktable.collection);
+    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, start);
+    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, count);
+    while(sqlite3_step(lib->statements.main_query) == SQLITE_ROW && num < count)
+      imgids[num++] = sqlite3_column_int(lib->statements.main_query, 0);
+  }
+  // scrolling up, the nearest images are the last ones:
+  if(lib->prefetch.direction < 0)
+    for(int k=0; k<num/2; k++)
+    {
+      const int32_t tmp = imgids[k];
+      imgids[k] = imgids[num-1-k];
+      imgids[num-1-k] = tmp;
+    }
+
+  dt_image_cache_prefetch(darktable.image_cache, imgids, num);
+
+  // cancel what's not in the window any more:
+  for(int k=0; k<lib->prefetch.num; k++)
+  {
+    int keep = 0;
+    if(lib->prefetch.mip == mip)
+      for(int i=0; i<num && !keep; i++)
+        keep = (imgids[i] == lib->prefetch.imgids[k]);
+    if(!keep)
+      dt_mipmap_cache_cancel_prefetch(darktable.mipmap_cache, lib->prefetch.imgids[k], lib->prefetch.mip);
+  }
+
+  // queue new ones, nearest first (the queue is fifo for these):
+  for(int k=0; k<num; k++)
+  {
+    int queued = 0;
+    if(lib->prefetch.mip == mip)
+      for(int i=0; i<lib->prefetch.num && !queued; i++)
+        queued = (lib->prefetch.imgids[i] == imgids[k]);
+    if(!queued)
+      dt_mipmap_cache_prefetch(darktable.mipmap_cache, imgids[k], mip);
+  }
+  memcpy(lib->prefetch.imgids, imgids, sizeof(int32_t)*num);
+  lib->prefetch.num = num;
+  lib->prefetch.mip = mip;
+  lib->prefetch.iir = iir;
+}
+
 static void
 expose_filemanager (dt_view_t *self, cairo_t *cr, int32_t width, int32_t height, int32_t pointerx, int32_t pointery)
 {
@@ -482,6 +627,7 @@ expose_filemanager (dt_view_t *self, cairo_t *cr, int32_t width, int32_t height,
   /* let's reset and reuse the main_query statement */
   DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
   DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
+  dt_collection_update_ids(darktable.collection);
 
   /* setup offset and row for the main query */
   DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, offset);
@@ -489,15 +635,8 @@ expose_filemanager (dt_view_t *self, cairo_t *cr, int32_t width, int32_t height,
 
   if(mouse_over_id != -1)
   {
-    const dt_image_t *mouse_over_image = dt_image_cache_read_get(darktable.image_cache, mouse_over_id);
-    mouse_over_group = mouse_over_image->group_id;
-    dt_image_cache_read_release(darktable.image_cache, mouse_over_image);
-    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.is_grouped);
-    DT_DEBUG_SQLITE3_RESET(lib->statements.is_grouped);
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.is_grouped, 1, mouse_over_group);
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.is_grouped, 2, mouse_over_id);
-    if(sqlite3_step(lib->statements.is_grouped) != SQLITE_ROW)
-      mouse_over_group = -1;
+    // only highlight groups which have others besides the image under the mouse:
+    mouse_over_group = dt_grouping_get_group_size(mouse_over_id) > 1 ? dt_grouping_get_group(mouse_over_id) : -1;
   }
 
   // prefetch the ids so that we can peek into the future to see if there are adjacent images in the same group.
@@ -514,6 +653,8 @@ expose_filemanager (dt_view_t *self, cairo_t *cr, int32_t width, int32_t height,
   }
 
 end_query_cache:
+  // and pull their image structs from the db in one go, instead of one query per thumbnail:
+  dt_image_cache_prefetch(darktable.image_cache, query_ids, max_rows*max_cols);
   mouse_over_id = -1;
   cairo_save(cr);
   int current_image =0;
@@ -594,11 +735,7 @@ escape_image_loop:
 
       if(id > 0)
       {
-        const dt_image_t *image = dt_image_cache_read_get(darktable.image_cache, id);
-        int group_id = -1;
-        if(image)
-          group_id = image->group_id;
-        dt_image_cache_read_release(darktable.image_cache, image);
+        const int group_id = dt_grouping_get_group(id);
 
         if (iir == 1 && row)
           continue;
@@ -630,11 +767,7 @@ escape_image_loop:
           {
             int _id = query_ids[current_image - iir];
             if(_id > 0)
-            {
-              const dt_image_t *_img = dt_image_cache_read_get(darktable.image_cache, _id);
-              neighbour_group = _img->group_id;
-              dt_image_cache_read_release(darktable.image_cache, _img);
-            }
+              neighbour_group = dt_grouping_get_group(_id);
           }
           if(neighbour_group != group_id)
           {
@@ -647,11 +780,7 @@ escape_image_loop:
           {
             int _id = query_ids[current_image-1];
             if(_id > 0)
-            {
-              const dt_image_t *_img = dt_image_cache_read_get(darktable.image_cache, _id);
-              neighbour_group = _img->group_id;
-              dt_image_cache_read_release(darktable.image_cache, _img);
-            }
+              neighbour_group = dt_grouping_get_group(_id);
           }
           if(neighbour_group != group_id)
           {
@@ -664,11 +793,7 @@ escape_image_loop:
           {
             int _id = query_ids[current_image+iir];
             if(_id > 0)
-            {
-              const dt_image_t *_img = dt_image_cache_read_get(darktable.image_cache, _id);
-              neighbour_group = _img->group_id;
-              dt_image_cache_read_release(darktable.image_cache, _img);
-            }
+              neighbour_group = dt_grouping_get_group(_id);
           }
           if(neighbour_group != group_id)
           {
@@ -681,11 +806,7 @@ escape_image_loop:
           {
             int _id = query_ids[current_image+1];
             if(_id > 0)
-            {
-              const dt_image_t *_img = dt_image_cache_read_get(darktable.image_cache, _id);
-              neighbour_group = _img->group_id;
-              dt_image_cache_read_release(darktable.image_cache, _img);
-            }
+              neighbour_group = dt_grouping_get_group(_id);
           }
           if(neighbour_group != group_id)
           {
@@ -712,36 +833,11 @@ after_drawing:
   /* check if offset was changed and we need to prefetch thumbs */
   if (offset_changed)
   {
-    int32_t imgids_num = 0;
-    const int prefetchrows = .5*max_rows+1;
-    int32_t imgids[prefetchrows*iir];
-    /* clear and reset main query */
-    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
-    DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
-
-    /* setup offest and row for prefetch */
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, offset + max_rows*iir);
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, prefetchrows*iir);
-
-    // prefetch jobs in inverse order: supersede previous jobs: most important last
-    while(sqlite3_step(lib->statements.main_query) == SQLITE_ROW && imgids_num < prefetchrows*iir)
-      imgids[imgids_num++] = sqlite3_column_int(lib->statements.main_query, 0);
-
     float imgwd = iir == 1 ? 0.97 : 0.8;
     dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(
                              darktable.mipmap_cache,
                              imgwd*wd, imgwd*(iir==1?height:ht));
-    while(imgids_num > 0)
-    {
-      imgids_num --;
-      dt_mipmap_buffer_t buf;
-      dt_mipmap_cache_read_get(
-        darktable.mipmap_cache,
-        &buf,
-        imgids[imgids_num],
-        mip,
-        DT_MIPMAP_PREFETCH);
-    }
+    _prefetch_update(lib, offset, max_rows, iir, mip);
   }
 
   if(query_ids)
@@ -772,6 +868,234 @@ after_drawing:
 
 #define DT_LIBRARY_MAX_ZOOM 13
 
+static inline int _tile_cell_size(const int level)
+{
+  return 16 << level;
+}
+
+static inline int _tile_rows(const int level)
+{
+  return DT_LIBRARY_TILE_HEIGHT / _tile_cell_size(level);
+}
+
+static inline int _tile_key(const int level, const int index)
+{
+  return index * DT_LIBRARY_TILE_LEVELS + level;
+}
+
+/* everything the cells of a tile show without the mouse on them, so a tile can be checked
+   against the library with one query instead of drawing all its cells again. */
+static inline uint64_t _tile_state(const int level, const int index)
+{
+  const int cells = _tile_rows(level) * DT_LIBRARY_MAX_ZOOM;
+  return dt_view_collection_state(index * cells, cells);
+}
+
+static void _tile_remove(dt_library_t *lib, dt_library_tile_t *tile)
+{
+  g_hash_table_remove(lib->tiles.table, GINT_TO_POINTER(_tile_key(tile->level, tile->index)));
+  g_queue_delete_link(&lib->tiles.lru, tile->lru);
+  lib->tiles.size -= (size_t)cairo_image_surface_get_stride(tile->surface) * cairo_image_surface_get_height(tile->surface);
+  cairo_surface_destroy(tile->surface);
+  free(tile);
+}
+
+static void _tiles_clear(dt_library_t *lib)
+{
+  if(lib->tiles.idle) g_source_remove(lib->tiles.idle);
+  lib->tiles.idle = 0;
+  lib->tiles.num_pending = 0;
+  while(!g_queue_is_empty(&lib->tiles.lru))
+    _tile_remove(lib, (dt_library_tile_t *)g_queue_peek_head(&lib->tiles.lru));
+}
+
+// a tile needs to be drawn again after new thumbnails came in, but can be blitted meanwhile.
+static inline int _tile_outdated(const dt_library_tile_t *tile)
+{
+  return tile->mipmap_generation != darktable.mipmap_cache->generation ||
+         (!tile->complete && tile->surface_generation != dt_view_image_surface_generation());
+}
+
+static dt_library_tile_t *_tile_get(dt_library_t *lib, const int level, const int index)
+{
+  dt_library_tile_t *tile = (dt_library_tile_t *)g_hash_table_lookup(lib->tiles.table, GINT_TO_POINTER(_tile_key(level, index)));
+  if(tile)
+  {
+    g_queue_unlink(&lib->tiles.lru, tile->lru);
+    g_queue_push_head_link(&lib->tiles.lru, tile->lru);
+  }
+  return tile;
+}
+
+static void _tile_render(dt_library_t *lib, const int level, const int index)
+{
+  const int size = _tile_cell_size(level), rows = _tile_rows(level);
+  dt_library_tile_t *tile = (dt_library_tile_t *)malloc(sizeof(dt_library_tile_t));
+  tile->level = level;
+  tile->index = index;
+  tile->mipmap_generation = darktable.mipmap_cache->generation;
+  tile->surface_generation = dt_view_image_surface_generation();
+  tile->complete = 1;
+  dt_collection_update_ids(darktable.collection);
+  tile->state = _tile_state(level, index);
+  tile->surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, DT_LIBRARY_MAX_ZOOM*size, rows*size);
+
+  // the cell under the mouse is drawn on top of the tiles, so draw all of them as if it was elsewhere:
+  int32_t mouse_over_id;
+  DT_CTL_GET_GLOBAL(mouse_over_id, lib_image_mouse_over_id);
+  DT_CTL_SET_GLOBAL(lib_image_mouse_over_id, -1);
+
+  cairo_t *cr = cairo_create(tile->surface);
+  cairo_set_source_rgb(cr, .2, .2, .2);
+  cairo_paint(cr);
+  dt_view_image_over_t image_over = DT_VIEW_DESERT;
+  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
+  DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
+  DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, index * rows * DT_LIBRARY_MAX_ZOOM);
+  DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, rows * DT_LIBRARY_MAX_ZOOM);
+  for(int k = 0; sqlite3_step(lib->statements.main_query) == SQLITE_ROW; k++)
+  {
+    const int32_t id = sqlite3_column_int(lib->statements.main_query, 0);
+    cairo_save(cr);
+    cairo_translate(cr, (k % DT_LIBRARY_MAX_ZOOM) * size, (k / DT_LIBRARY_MAX_ZOOM) * size);
+    // any zoom but 1 draws the same cell.
+    if(dt_view_image_expose(&image_over, id, cr, size, size, DT_LIBRARY_MAX_ZOOM, -1, -1, FALSE))
+      tile->complete = 0;
+    cairo_restore(cr);
+  }
+  cairo_destroy(cr);
+  DT_CTL_SET_GLOBAL(lib_image_mouse_over_id, mouse_over_id);
+
+  dt_library_tile_t *old = (dt_library_tile_t *)g_hash_table_lookup(lib->tiles.table, GINT_TO_POINTER(_tile_key(level, index)));
+  if(old) _tile_remove(lib, old);
+  g_hash_table_insert(lib->tiles.table, GINT_TO_POINTER(_tile_key(level, index)), tile);
+  g_queue_push_head(&lib->tiles.lru, tile);
+  tile->lru = g_queue_peek_head_link(&lib->tiles.lru);
+  lib->tiles.size += (size_t)cairo_image_surface_get_stride(tile->surface) * rows * size;
+  while(lib->tiles.size > DT_LIBRARY_TILE_CACHE_SIZE && g_queue_get_length(&lib->tiles.lru) > 1)
+    _tile_remove(lib, (dt_library_tile_t *)g_queue_peek_tail(&lib->tiles.lru));
+}
+
+// draws one pending tile per main loop iteration, so panning stays responsive while they fill in.
+static gboolean _tile_idle(gpointer user_data)
+{
+  dt_view_t *self = (dt_view_t *)user_data;
+  dt_library_t *lib = (dt_library_t *)self->data;
+  if(lib->tiles.num_pending > 0)
+  {
+    const int key = lib->tiles.pending[0];
+    lib->tiles.num_pending--;
+    memmove(lib->tiles.pending, lib->tiles.pending + 1, sizeof(int) * lib->tiles.num_pending);
+    if(lib->statements.main_query)
+      _tile_render(lib, key % DT_LIBRARY_TILE_LEVELS, key / DT_LIBRARY_TILE_LEVELS);
+    dt_control_queue_redraw_center();
+  }
+  if(lib->tiles.num_pending > 0) return TRUE;
+  lib->tiles.idle = 0;
+  return FALSE;
+}
+
+static void _tile_request(dt_library_t *lib, const int level, const int index)
+{
+  const int key = _tile_key(level, index);
+  for(int k = 0; k < lib->tiles.num_pending; k++)
+    if(lib->tiles.pending[k] == key) return;
+  if(lib->tiles.num_pending < DT_LIBRARY_TILE_PENDING)
+    lib->tiles.pending[lib->tiles.num_pending++] = key;
+}
+
+// copies rows [row0, row1) out of a tile to where they are on screen, given the position of cell 0.
+static void _tile_blit(cairo_t *cr, const dt_library_tile_t *tile, const int row0, const int row1,
+                       const float x0, const float y0, const float wd)
+{
+  const int size = _tile_cell_size(tile->level);
+  const int first = tile->index * _tile_rows(tile->level);
+  cairo_save(cr);
+  cairo_translate(cr, x0, y0 + row0 * wd);
+  cairo_scale(cr, wd / size, wd / size);
+  cairo_set_source_surface(cr, tile->surface, 0, -(row0 - first) * size);
+  cairo_rectangle(cr, 0, 0, DT_LIBRARY_MAX_ZOOM * size, (row1 - row0) * size);
+  cairo_fill(cr);
+  cairo_restore(cr);
+}
+
+// draws the cells of a row one by one, when there's no tile to take them from.
+static void _tile_expose_row(dt_library_t *lib, cairo_t *cr, const int row, const int col0, const int col1,
+                             const float x0, const float y0, const float wd, const int32_t zoom)
+{
+  dt_view_image_over_t image_over = DT_VIEW_DESERT;
+  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
+  DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
+  DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, row * DT_LIBRARY_MAX_ZOOM + col0);
+  DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, col1 - col0);
+  for(int col = col0; col < col1 && sqlite3_step(lib->statements.main_query) == SQLITE_ROW; col++)
+  {
+    const int32_t id = sqlite3_column_int(lib->statements.main_query, 0);
+    cairo_save(cr);
+    cairo_translate(cr, x0 + col * wd, y0 + row * wd);
+    dt_view_image_expose(&image_over, id, cr, wd, wd, zoom, -1, -1, FALSE);
+    cairo_restore(cr);
+  }
+}
+
+/* the zoomable lighttable for small cells: visible rows are blitted from tiles at the cell size
+   closest above the current one. tiles which are missing or outdated are drawn when idle, and
+   meanwhile taken from the other levels, the cells of their rows are only drawn one by one if
+   no level has them. cell (col, row) of the collection is at (x0 + col*wd, y0 + row*wd). */
+static void
+expose_tiles(dt_view_t *self, cairo_t *cr, const int32_t zoom, const float wd, const float x0, const float y0,
+             const int row0, const int row1, const int col0, const int col1)
+{
+  dt_library_t *lib = (dt_library_t *)self->data;
+  int level = 0;
+  while(level < DT_LIBRARY_TILE_LEVELS-1 && _tile_cell_size(level) < wd) level++;
+  const int rows = _tile_rows(level);
+
+  dt_collection_update_ids(darktable.collection);
+  lib->tiles.num_pending = 0;
+  for(int index = row0 / rows; index <= (row1 - 1) / rows; index++)
+  {
+    const int first = MAX(row0, index * rows), last = MIN(row1, (index + 1) * rows);
+    dt_library_tile_t *tile = _tile_get(lib, level, index);
+    if(tile && tile->state == _tile_state(level, index))
+    {
+      _tile_blit(cr, tile, first, last, x0, y0, wd);
+      if(_tile_outdated(tile)) _tile_request(lib, level, index);
+      continue;
+    }
+    _tile_request(lib, level, index);
+    // the other levels, closest first. their tiles have to match the library, too:
+    const dt_library_tile_t *checked[2 * DT_LIBRARY_TILE_LEVELS];
+    int checked_ok[2 * DT_LIBRARY_TILE_LEVELS], num_checked = 0;
+    for(int row = first; row < last; row++)
+    {
+      const dt_library_tile_t *fallback = NULL;
+      for(int d = 1; d < DT_LIBRARY_TILE_LEVELS && !fallback; d++)
+      {
+        for(int l = level - d; l <= level + d && !fallback; l += 2 * d)
+        {
+          if(l < 0 || l >= DT_LIBRARY_TILE_LEVELS) continue;
+          const dt_library_tile_t *other = _tile_get(lib, l, row / _tile_rows(l));
+          if(!other) continue;
+          int k = 0;
+          while(k < num_checked && checked[k] != other) k++;
+          if(k == num_checked)
+          {
+            k = num_checked < 2 * DT_LIBRARY_TILE_LEVELS ? num_checked++ : 0;
+            checked[k] = other;
+            checked_ok[k] = other->state == _tile_state(l, other->index);
+          }
+          if(checked_ok[k]) fallback = other;
+        }
+      }
+      if(fallback) _tile_blit(cr, fallback, row, row + 1, x0, y0, wd);
+      else _tile_expose_row(lib, cr, row, col0, col1, x0, y0, wd, zoom);
+    }
+  }
+  if(lib->tiles.num_pending > 0 && !lib->tiles.idle)
+    lib->tiles.idle = g_idle_add(_tile_idle, self);
+}
+
 static void
 expose_zoomable (dt_view_t *self, cairo_t *cr, int32_t width, int32_t height, int32_t pointerx, int32_t pointery)
 {
@@ -927,6 +1251,47 @@ expose_zoomable (dt_view_t *self, cairo_t *cr, int32_t width, int32_t height, in
   dt_view_set_scrollbar(self, MAX(0, offset_i), DT_LIBRARY_MAX_ZOOM, zoom, DT_LIBRARY_MAX_ZOOM*offset_j,
                         lib->collection_count, DT_LIBRARY_MAX_ZOOM*max_cols);
 
+  if(zoom != 1 && wd <= _tile_cell_size(DT_LIBRARY_TILE_LEVELS-1))
+  {
+    const int col0 = MAX(0, offset_i), col1 = col0 + max_cols;
+    const int row0 = MAX(0, offset_j);
+    const int row1 = MIN(offset_j + max_rows, (lib->collection_count + DT_LIBRARY_MAX_ZOOM - 1) / DT_LIBRARY_MAX_ZOOM);
+    const float x0 = -(offset_i + offset_x) * wd, y0 = -(offset_j + offset_y) * ht;
+    if(row1 <= row0) goto failure;
+
+    // set mouse over id
+    const int over_row = offset_j + selj, over_index = over_row * DT_LIBRARY_MAX_ZOOM + col0 + seli;
+    if((!pan || track) && seli >= 0 && seli < max_cols && selj >= 0 && selj < max_rows &&
+        over_row >= 0 && over_index < lib->collection_count)
+    {
+      dt_collection_update_ids(darktable.collection);
+      DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
+      DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
+      DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, over_index);
+      DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, 1);
+      if(sqlite3_step(lib->statements.main_query) == SQLITE_ROW)
+      {
+        lib->tiles.over_id = sqlite3_column_int(lib->statements.main_query, 0);
+        lib->tiles.over_index = over_index;
+        DT_CTL_SET_GLOBAL(lib_image_mouse_over_id, lib->tiles.over_id);
+      }
+    }
+
+    expose_tiles(self, cr, zoom, wd, x0, y0, row0, row1, col0, col1);
+
+    // the tiles are drawn without mouse over, draw that cell on top:
+    DT_CTL_GET_GLOBAL(mouse_over_id, lib_image_mouse_over_id);
+    if(mouse_over_id >= 0 && mouse_over_id == lib->tiles.over_id)
+    {
+      cairo_save(cr);
+      cairo_translate(cr, x0 + (lib->tiles.over_index % DT_LIBRARY_MAX_ZOOM) * wd,
+                      y0 + (lib->tiles.over_index / DT_LIBRARY_MAX_ZOOM) * ht);
+      dt_view_image_expose(&(lib->image_over), mouse_over_id, cr, wd, ht, zoom, img_pointerx, img_pointery, FALSE);
+      cairo_restore(cr);
+    }
+    goto failure;
+  }
+
   cairo_translate(cr, -offset_x*wd, -offset_y*ht);
   cairo_translate(cr, -MIN(offset_i*wd, 0.0), 0.0);
 
@@ -942,6 +1307,7 @@ expose_zoomable (dt_view_t *self, cairo_t *cr, int32_t width, int32_t height, in
     /* clear and reset main query */
     DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
     DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
+    dt_collection_update_ids(darktable.collection);
 
     DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, offset);
     DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, max_cols);
@@ -1035,6 +1401,8 @@ void expose_full_preview(dt_view_t *self, cairo_t *cr, int32_t width, int32_t he
     {
       /* We need to augment the current main query a bit to fetch the
        * row we need. */
+      DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
+      dt_collection_update_ids(darktable.collection);
       const char *main_query = sqlite3_sql(lib->statements.main_query);
       stmt_string = g_strdup_printf(
                       "select images.id as id from (%s) as s1 %s",
@@ -1267,6 +1635,7 @@ void leave(dt_view_t *self)
   dt_library_t *lib = (dt_library_t *)self->data;
   lib->button = 0;
   lib->pan = 0;
+  _tiles_clear(lib);
 }
 
 void reset(dt_view_t *self)
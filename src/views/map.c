@@ -36,6 +36,25 @@
 
 DT_MODULE(1)
 
+/* the geotag index buckets images into cells of one degree */
+#define DT_MAP_INDEX_COLS 360
+#define DT_MAP_INDEX_ROWS 180
+
+/* a geotagged image as stored in the index */
+typedef struct dt_map_point_t
+{
+  int32_t imgid;
+  float longitude, latitude;
+} dt_map_point_t;
+
+/* images sharing one thumbnail on the map */
+typedef struct dt_map_cluster_t
+{
+  int32_t imgid;  // image shown for the cluster
+  float longitude, latitude;
+  int count;
+  double dist;    // distance of imgid from the center of the cluster cell, in pixels
+} dt_map_cluster_t;
 
 typedef struct dt_map_t
 {
@@ -51,6 +70,17 @@ typedef struct dt_map_t
     sqlite3_stmt *main_query;
   } statements;
   gboolean drop_filmstrip_activated;
+  /* all geotagged images, sorted by cell. cell_start has an offset into points per cell plus the end. */
+  struct
+  {
+    dt_map_point_t *points;
+    int num_points;
+    int *cell_start;
+    gboolean valid;
+  } index;
+  /* thumbnails with pin, keyed by (imgid << 32 | cluster size) */
+  GHashTable *pins;
+  uint32_t pins_generation; // mipmap cache generation the pins were made for
 } dt_map_t;
 
 typedef struct dt_map_image_t
@@ -177,19 +207,12 @@ void init(dt_view_t *self)
     g_signal_connect(GTK_WIDGET(lib->map), "drag-failed", G_CALLBACK(_view_map_dnd_failed_callback), self);
   }
 
-  /* build the query string */
-  int max_images_drawn = dt_conf_get_int("plugins/map/max_images_drawn");
-  if(max_images_drawn == 0)
-    max_images_drawn = 100;
-  char *geo_query = g_strdup_printf("select * from (select id, latitude from images where \
-                              longitude >= ?1 and longitude <= ?2 and latitude <= ?3 and latitude >= ?4 \
-                              and longitude not NULL and latitude not NULL order by abs(latitude - ?5), abs(longitude - ?6) \
-                              limit 0, %d) order by (180 - latitude), id", max_images_drawn);
-
-  /* prepare the main query statement */
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), geo_query, -1, &lib->statements.main_query, NULL);
+  lib->pins = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, g_object_unref);
 
-  g_free(geo_query);
+  /* prepare the main query statement, it loads the geotag index */
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select id, longitude, latitude from images where longitude not NULL and latitude not NULL",
+                              -1, &lib->statements.main_query, NULL);
 }
 
 void cleanup(dt_view_t *self)
@@ -200,6 +223,10 @@ void cleanup(dt_view_t *self)
     g_object_unref(G_OBJECT(lib->pin));
     g_object_unref(G_OBJECT(lib->osd));
   }
+  g_hash_table_destroy(lib->pins);
+  free(lib->index.points);
+  free(lib->index.cell_start);
+  sqlite3_finalize(lib->statements.main_query);
   free(self->data);
 }
 
@@ -221,6 +248,210 @@ static gboolean _view_map_redraw(gpointer user_data)
   return FALSE; // remove the function again
 }
 
+static inline int _view_map_index_col(const float longitude)
+{
+  return CLAMP((int)floorf(longitude + 180.0f), 0, DT_MAP_INDEX_COLS - 1);
+}
+
+static inline int _view_map_index_row(const float latitude)
+{
+  return CLAMP((int)floorf(latitude + 90.0f), 0, DT_MAP_INDEX_ROWS - 1);
+}
+
+static inline int _view_map_index_cell(const dt_map_point_t *p)
+{
+  return _view_map_index_row(p->latitude)*DT_MAP_INDEX_COLS + _view_map_index_col(p->longitude);
+}
+
+/* (re)loads the locations of all geotagged images and buckets them by cell */
+static void _view_map_index_build(dt_map_t *lib)
+{
+  const int num_cells = DT_MAP_INDEX_COLS*DT_MAP_INDEX_ROWS;
+  lib->index.valid = FALSE;
+  if(!lib->index.cell_start) lib->index.cell_start = (int *)malloc(sizeof(int)*(num_cells + 1));
+  if(!lib->index.cell_start) return;
+
+  int allocated = 1024, num_points = 0;
+  dt_map_point_t *points = (dt_map_point_t *)malloc(sizeof(dt_map_point_t)*allocated);
+  if(!points) return;
+  DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
+  while(sqlite3_step(lib->statements.main_query) == SQLITE_ROW)
+  {
+    if(num_points == allocated)
+    {
+      dt_map_point_t *grown = (dt_map_point_t *)realloc(points, sizeof(dt_map_point_t)*allocated*2);
+      if(!grown) break;
+      points = grown;
+      allocated *= 2;
+    }
+    dt_map_point_t *p = points + num_points++;
+    p->imgid = sqlite3_column_int(lib->statements.main_query, 0);
+    p->longitude = sqlite3_column_double(lib->statements.main_query, 1);
+    p->latitude = sqlite3_column_double(lib->statements.main_query, 2);
+  }
+
+  dt_map_point_t *sorted = (dt_map_point_t *)malloc(sizeof(dt_map_point_t)*MAX(num_points, 1));
+  int *fill = (int *)malloc(sizeof(int)*num_cells);
+  if(!sorted || !fill)
+  {
+    free(sorted);
+    free(fill);
+    free(points);
+    return;
+  }
+
+  /* counting sort by cell */
+  int *cell_start = lib->index.cell_start;
+  memset(cell_start, 0, sizeof(int)*(num_cells + 1));
+  for(int k = 0; k < num_points; k++)
+    cell_start[_view_map_index_cell(points + k) + 1]++;
+  for(int c = 0; c < num_cells; c++)
+    cell_start[c + 1] += cell_start[c];
+  memcpy(fill, cell_start, sizeof(int)*num_cells);
+  for(int k = 0; k < num_points; k++)
+    sorted[fill[_view_map_index_cell(points + k)]++] = points[k];
+  free(fill);
+  free(points);
+
+  free(lib->index.points);
+  lib->index.points = sorted;
+  lib->index.num_points = num_points;
+  lib->index.valid = TRUE;
+}
+
+static gint _view_map_cluster_center_cmp(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  const dt_map_cluster_t *ca = (const dt_map_cluster_t *)a, *cb = (const dt_map_cluster_t *)b;
+  const float *center = (const float *)user_data;
+  const float da = fabsf(ca->latitude - center[1]) + fabsf(ca->longitude - center[0]);
+  const float db = fabsf(cb->latitude - center[1]) + fabsf(cb->longitude - center[0]);
+  return (da > db) - (da < db);
+}
+
+static gint _view_map_cluster_latitude_cmp(gconstpointer a, gconstpointer b)
+{
+  const dt_map_cluster_t *ca = (const dt_map_cluster_t *)a, *cb = (const dt_map_cluster_t *)b;
+  if(ca->latitude != cb->latitude) return (ca->latitude < cb->latitude) - (ca->latitude > cb->latitude);
+  return (ca->imgid > cb->imgid) - (ca->imgid < cb->imgid);
+}
+
+/* draws the number of images a cluster stands for into the corner of its thumbnail */
+static GdkPixbuf *_view_map_label_pin(GdkPixbuf *thumb, int count)
+{
+  const int w = gdk_pixbuf_get_width(thumb), h = gdk_pixbuf_get_height(thumb);
+  cairo_surface_t *cst = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+  cairo_t *cr = cairo_create(cst);
+  gdk_cairo_set_source_pixbuf(cr, thumb, 0, 0);
+  cairo_paint(cr);
+
+  char label[16];
+  snprintf(label, sizeof(label), "%d", count);
+  cairo_select_font_face(cr, "sans-serif", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+  cairo_set_font_size(cr, 10);
+  cairo_text_extents_t ext;
+  cairo_text_extents(cr, label, &ext);
+  cairo_rectangle(cr, w - thumb_border - ext.width - 6, thumb_border, ext.width + 6, ext.height + 6);
+  cairo_set_source_rgba(cr, 0, 0, 0, 0.7);
+  cairo_fill(cr);
+  cairo_move_to(cr, w - thumb_border - ext.width - 3 - ext.x_bearing, thumb_border + 3 - ext.y_bearing);
+  cairo_set_source_rgb(cr, 1, 1, 1);
+  cairo_show_text(cr, label);
+  cairo_destroy(cr);
+  cairo_surface_flush(cst);
+
+  GdkPixbuf *labelled = NULL;
+  uint8_t *data = (uint8_t *)malloc((size_t)w*h*4);
+  if(data)
+  {
+    const int stride = cairo_image_surface_get_stride(cst);
+    for(int y=0; y<h; y++)
+      memcpy(data + (size_t)y*w*4, cairo_image_surface_get_data(cst) + (size_t)y*stride, w*4);
+    dt_draw_cairo_to_gdk_pixbuf(data, w, h);
+    labelled = gdk_pixbuf_new_from_data(data, GDK_COLORSPACE_RGB, TRUE, 8, w, h, w*4, (GdkPixbufDestroyNotify) free, NULL);
+    if(!labelled) free(data);
+  }
+  cairo_surface_destroy(cst);
+  return labelled;
+}
+
+/* returns the thumbnail with pin for a cluster of count images shown as imgid, or NULL while the
+   thumbnail is not loaded. the pixbuf is owned by the pin cache. */
+static GdkPixbuf *_view_map_get_pin(dt_map_t *lib, int imgid, int count, gint *width, gint *height)
+{
+  gint64 key = ((gint64)imgid << 32) | (guint32)count;
+  GdkPixbuf *thumb = (GdkPixbuf *)g_hash_table_lookup(lib->pins, &key);
+  if(thumb)
+  {
+    *width = gdk_pixbuf_get_width(thumb) - 2*thumb_border;
+    *height = gdk_pixbuf_get_height(thumb) - 2*thumb_border - pin_size;
+    return thumb;
+  }
+
+  dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, thumb_size, thumb_size);
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, mip, DT_MIPMAP_BEST_EFFORT);
+  if(!buf.buf)
+  {
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    return NULL;
+  }
+
+  GdkPixbuf *source = NULL;
+  uint8_t *scratchmem = dt_mipmap_cache_get_scratchmem(darktable.mipmap_cache);
+  uint8_t *buf_decompressed = dt_mipmap_cache_decompress(&buf, scratchmem);
+
+  // convert image to pixbuf compatible rgb format
+  uint8_t *rgbbuf = (uint8_t*)malloc(buf.width*buf.height*3);
+  if(!rgbbuf) goto pin_failure;
+  for(int i=0; i<buf.height; i++)
+    for(int j=0; j<buf.width; j++)
+      for(int k=0; k<3; k++)
+        rgbbuf[(i*buf.width+j)*3+k] = buf_decompressed[(i*buf.width+j)*4+2-k];
+
+  int w=thumb_size, h=thumb_size;
+  if(buf.width < buf.height) w = (buf.width*thumb_size)/buf.height; // portrait
+  else                       h = (buf.height*thumb_size)/buf.width; // landscape
+
+  // next we get a pixbuf for the image
+  source = gdk_pixbuf_new_from_data(rgbbuf, GDK_COLORSPACE_RGB, FALSE, 8, buf.width, buf.height, buf.width*3, NULL, NULL);
+  if(!source) goto pin_failure;
+
+  // now we want a slightly larger pixbuf that we can put the image on
+  thumb = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, w+2*thumb_border, h+2*thumb_border+pin_size);
+  if(!thumb) goto pin_failure;
+  gdk_pixbuf_fill(thumb, thumb_frame_color);
+
+  // put the image onto the frame
+  gdk_pixbuf_scale(source, thumb, thumb_border, thumb_border, w, h, thumb_border, thumb_border,
+                   (1.0*w) / buf.width, (1.0*h) / buf.height, GDK_INTERP_HYPER);
+
+  // and finally add the pin
+  gdk_pixbuf_copy_area(lib->pin, 0, 0, w+2*thumb_border, pin_size, thumb, 0, h+2*thumb_border);
+
+  if(count > 1)
+  {
+    GdkPixbuf *labelled = _view_map_label_pin(thumb, count);
+    if(labelled)
+    {
+      g_object_unref(thumb);
+      thumb = labelled;
+    }
+  }
+
+  gint64 *k = g_new(gint64, 1);
+  *k = key;
+  g_hash_table_insert(lib->pins, k, thumb);
+  *width = w;
+  *height = h;
+
+pin_failure:
+  if(source)
+    g_object_unref(source);
+  free(rgbbuf);
+  dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+  return thumb;
+}
+
 static void _view_map_changed_callback(OsmGpsMap *map, dt_view_t *self)
 {
   dt_map_t *lib = (dt_map_t *)self->data;
@@ -252,18 +483,6 @@ static void _view_map_changed_callback(OsmGpsMap *map, dt_view_t *self)
   dt_conf_set_float("plugins/map/latitude", center_lat);
   dt_conf_set_int("plugins/map/zoom", zoom);
 
-  /* let's reset and reuse the main_query statement */
-  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
-  DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
-
-  /* bind bounding box coords for the main query */
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 1, bb_0_lon - west_border);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 2, bb_1_lon);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 3, bb_0_lat);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 4, bb_1_lat - south_border);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 5, center_lat);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 6, center_lon);
-
   /* remove the old images */
   osm_gps_map_image_remove_all(map);
   if(lib->images)
@@ -273,75 +492,95 @@ static void _view_map_changed_callback(OsmGpsMap *map, dt_view_t *self)
     lib->images = NULL;
   }
 
-  /* add  all images to the map */
-  gboolean needs_redraw = FALSE;
-  dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, thumb_size, thumb_size);
-  while(sqlite3_step(lib->statements.main_query) == SQLITE_ROW)
+  if(!lib->index.valid) _view_map_index_build(lib);
+
+  /* pins of thumbnails that changed since have to be made again */
+  if(lib->pins_generation != darktable.mipmap_cache->generation)
   {
-    int imgid = sqlite3_column_int(lib->statements.main_query, 0);
-    dt_mipmap_buffer_t buf;
-    dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, mip, DT_MIPMAP_BEST_EFFORT);
+    g_hash_table_remove_all(lib->pins);
+    lib->pins_generation = darktable.mipmap_cache->generation;
+  }
 
-    if(buf.buf)
+  /* only look at the cells overlapping the bounding box, and merge images whose
+     thumbnails would land in the same thumb_size sized patch of the screen */
+  const float lon_min = CLAMP(bb_0_lon - west_border, -180.0f, 180.0f), lon_max = CLAMP(bb_1_lon, -180.0f, 180.0f);
+  const float lat_min = CLAMP(bb_1_lat - south_border, -90.0f, 90.0f), lat_max = CLAMP(bb_0_lat, -90.0f, 90.0f);
+  GArray *clusters = g_array_new(FALSE, FALSE, sizeof(dt_map_cluster_t));
+  GHashTable *cells = g_hash_table_new(g_direct_hash, g_direct_equal);
+  if(lib->index.valid && lon_min <= lon_max && lat_min <= lat_max)
+  {
+    const int col_min = _view_map_index_col(lon_min), col_max = _view_map_index_col(lon_max);
+    const int row_min = _view_map_index_row(lat_min), row_max = _view_map_index_row(lat_max);
+    OsmGpsMapPoint pt;
+    for(int row = row_min; row <= row_max; row++)
     {
-      GdkPixbuf *source = NULL, *thumb = NULL;
-      uint8_t *scratchmem = dt_mipmap_cache_alloc_scratchmem(darktable.mipmap_cache);
-      uint8_t *buf_decompressed = dt_mipmap_cache_decompress(&buf, scratchmem);
-
-      // convert image to pixbuf compatible rgb format
-      uint8_t *rgbbuf = (uint8_t*)malloc(buf.width*buf.height*3);
-      if(!rgbbuf) goto map_changed_failure;
-      for(int i=0; i<buf.height; i++)
-        for(int j=0; j<buf.width; j++)
-          for(int k=0; k<3; k++)
-            rgbbuf[(i*buf.width+j)*3+k] = buf_decompressed[(i*buf.width+j)*4+2-k];
-
-      int w=thumb_size, h=thumb_size;
-      if(buf.width < buf.height) w = (buf.width*thumb_size)/buf.height; // portrait
-      else                       h = (buf.height*thumb_size)/buf.width; // landscape
-
-      // next we get a pixbuf for the image
-      source = gdk_pixbuf_new_from_data(rgbbuf, GDK_COLORSPACE_RGB, FALSE, 8, buf.width, buf.height, buf.width*3, NULL, NULL);
-      if(!source) goto map_changed_failure;
-
-      // now we want a slightly larger pixbuf that we can put the image on
-      thumb = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, w+2*thumb_border, h+2*thumb_border+pin_size);
-      if(!thumb) goto map_changed_failure;
-      gdk_pixbuf_fill(thumb, thumb_frame_color);
-
-      // put the image onto the frame
-      gdk_pixbuf_scale(source, thumb, thumb_border, thumb_border, w, h, thumb_border, thumb_border,
-                       (1.0*w) / buf.width, (1.0*h) / buf.height, GDK_INTERP_HYPER);
-
-      // and finally add the pin
-      gdk_pixbuf_copy_area(lib->pin, 0, 0, w+2*thumb_border, pin_size, thumb, 0, h+2*thumb_border);
-
-      const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, imgid);
-      if(!cimg) goto map_changed_failure;
-      dt_map_image_t *entry = (dt_map_image_t*)malloc(sizeof(dt_map_image_t));
-      if(!entry)
+      const int begin = lib->index.cell_start[row*DT_MAP_INDEX_COLS + col_min];
+      const int end = lib->index.cell_start[row*DT_MAP_INDEX_COLS + col_max + 1];
+      for(int k = begin; k < end; k++)
       {
-        dt_image_cache_read_release(darktable.image_cache, cimg);
-        goto map_changed_failure;
+        const dt_map_point_t *p = lib->index.points + k;
+        if(p->longitude < lon_min || p->longitude > lon_max || p->latitude < lat_min || p->latitude > lat_max) continue;
+        gint x = 0, y = 0;
+        osm_gps_map_point_set_degrees(&pt, p->latitude, p->longitude);
+        osm_gps_map_convert_geographic_to_screen(map, &pt, &x, &y);
+        const int cx = (int)floorf(x/(float)thumb_size), cy = (int)floorf(y/(float)thumb_size);
+        const double dx = x - (cx + .5)*thumb_size, dy = y - (cy + .5)*thumb_size;
+        const double dist = dx*dx + dy*dy;
+        gpointer key = GUINT_TO_POINTER((((guint)(cx + 0x8000) & 0xffff) << 16) | ((guint)(cy + 0x8000) & 0xffff));
+        gpointer value;
+        if(g_hash_table_lookup_extended(cells, key, NULL, &value))
+        {
+          dt_map_cluster_t *c = &g_array_index(clusters, dt_map_cluster_t, GPOINTER_TO_INT(value));
+          c->count++;
+          if(dist < c->dist)
+          {
+            c->imgid = p->imgid;
+            c->longitude = p->longitude;
+            c->latitude = p->latitude;
+            c->dist = dist;
+          }
+        }
+        else
+        {
+          const dt_map_cluster_t c = { p->imgid, p->longitude, p->latitude, 1, dist };
+          g_hash_table_insert(cells, key, GINT_TO_POINTER(clusters->len));
+          g_array_append_val(clusters, c);
+        }
       }
-      entry->imgid = imgid;
-      entry->image = osm_gps_map_image_add_with_alignment(map, cimg->latitude, cimg->longitude, thumb, 0, 1);
-      entry->width = w;
-      entry->height = h;
-      lib->images = g_slist_prepend(lib->images, entry);
-      dt_image_cache_read_release(darktable.image_cache, cimg);
-
-map_changed_failure:
-      if(source)
-        g_object_unref(source);
-      if(thumb)
-        g_object_unref(thumb);
-      free(rgbbuf);
     }
-    else
+  }
+  g_hash_table_destroy(cells);
+
+  /* draw the clusters closest to the center, southern ones last so they end up on top */
+  int max_images_drawn = dt_conf_get_int("plugins/map/max_images_drawn");
+  if(max_images_drawn == 0)
+    max_images_drawn = 100;
+  const float center[2] = { center_lon, center_lat };
+  g_array_sort_with_data(clusters, _view_map_cluster_center_cmp, (gpointer)center);
+  if((int)clusters->len > max_images_drawn) g_array_set_size(clusters, max_images_drawn);
+  g_array_sort(clusters, _view_map_cluster_latitude_cmp);
+
+  /* add the clusters to the map */
+  gboolean needs_redraw = FALSE;
+  for(int k = 0; k < (int)clusters->len; k++)
+  {
+    const dt_map_cluster_t *c = &g_array_index(clusters, dt_map_cluster_t, k);
+    gint w = 0, h = 0;
+    GdkPixbuf *thumb = _view_map_get_pin(lib, c->imgid, c->count, &w, &h);
+    if(!thumb)
+    {
       needs_redraw = TRUE;
-    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+      continue;
+    }
+    dt_map_image_t *entry = (dt_map_image_t*)malloc(sizeof(dt_map_image_t));
+    if(!entry) break;
+    entry->imgid = c->imgid;
+    entry->image = osm_gps_map_image_add_with_alignment(map, c->latitude, c->longitude, thumb, 0, 1);
+    entry->width = w;
+    entry->height = h;
+    lib->images = g_slist_prepend(lib->images, entry);
   }
+  g_array_free(clusters, TRUE);
 
   // not exactly thread safe, but should be good enough for updating the display
   static int timeout_event_source = 0;
@@ -405,7 +644,7 @@ static gboolean _view_map_motion_notify_callback(GtkWidget *w, GdkEventMotion *e
     if(buf.buf)
     {
       GdkPixbuf *source = NULL, *thumb = NULL;
-      uint8_t *scratchmem = dt_mipmap_cache_alloc_scratchmem(darktable.mipmap_cache);
+      uint8_t *scratchmem = dt_mipmap_cache_get_scratchmem(darktable.mipmap_cache);
       uint8_t *buf_decompressed = dt_mipmap_cache_decompress(&buf, scratchmem);
 
       // convert image to pixbuf compatible rgb format
@@ -496,6 +735,8 @@ void enter(dt_view_t *self)
 
   lib->selected_image = 0;
   lib->start_drag = FALSE;
+  /* images might have been geotagged elsewhere in the meantime */
+  lib->index.valid = FALSE;
 
   /* replace center widget */
   GtkWidget *parent = gtk_widget_get_parent(dt_ui_center(darktable.gui->ui));
@@ -536,6 +777,7 @@ void leave(dt_view_t *self)
 
   gtk_widget_hide(GTK_WIDGET(lib->map));
   gtk_widget_show_all(dt_ui_center(darktable.gui->ui));
+  g_hash_table_remove_all(lib->pins);
 
   /* reset proxy */
   darktable.view_manager->proxy.map.view = NULL;
@@ -686,6 +928,9 @@ static void _set_image_location(dt_view_t *self, int imgid, float longitude, flo
   img->latitude = latitude;
   dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_SAFE);
   dt_image_cache_read_release(darktable.image_cache, cimg);
+
+  /* the database is up to date now, reload the index on the next redraw */
+  ((dt_map_t *)self->data)->index.valid = FALSE;
 }
 
 static void
@@ -20,6 +20,7 @@
 
 #include "common/darktable.h"
 #include "common/collection.h"
+#include "common/grouping.h"
 #include "common/image_cache.h"
 #include "common/mipmap_cache.h"
 #include "common/debug.h"
@@ -40,15 +41,237 @@
 #include <strings.h>
 #include <math.h>
 
+// ready to blit thumbnails, prepared on the worker threads at the size of the cell they are drawn to,
+// so expose only has to copy pixels. keyed by image and cell, bounded in memory and dropped lru.
+#define DT_VIEW_SURFACE_CACHE_SIZE (64<<20)
+
+typedef struct dt_view_surface_key_t
+{
+  int32_t imgid, width, height, zoom;
+}
+dt_view_surface_key_t;
+
+typedef struct dt_view_surface_t
+{
+  dt_view_surface_key_t key;
+  // NULL if there was no thumbnail to scale yet
+  cairo_surface_t *surface;
+  // size of the mipmap buffer the surface was scaled from
+  int32_t buf_width, buf_height;
+  // mipmap cache generation the pixels were taken at
+  uint32_t generation;
+  size_t size;
+  GList *lru;
+}
+dt_view_surface_t;
+
+static GStaticMutex _view_surface_mutex = G_STATIC_MUTEX_INIT;
+static GHashTable *_view_surfaces = NULL;         // dt_view_surface_key_t -> dt_view_surface_t
+static GHashTable *_view_surfaces_by_image = NULL; // imgid -> most recently prepared dt_view_surface_t
+static GQueue _view_surfaces_lru = G_QUEUE_INIT;   // most recently used first
+static size_t _view_surfaces_size = 0;
+static volatile uint32_t _view_surfaces_generation = 0;
+
+static guint _view_surface_key_hash(gconstpointer key)
+{
+  const dt_view_surface_key_t *k = (const dt_view_surface_key_t *)key;
+  return (guint)k->imgid ^ ((guint)k->width << 20) ^ ((guint)k->height << 8) ^ ((guint)k->zoom << 31);
+}
+
+static gboolean _view_surface_key_equal(gconstpointer a, gconstpointer b)
+{
+  return !memcmp(a, b, sizeof(dt_view_surface_key_t));
+}
+
+// call with the mutex locked.
+static void _view_surface_remove(dt_view_surface_t *s)
+{
+  if(g_hash_table_lookup(_view_surfaces_by_image, GINT_TO_POINTER(s->key.imgid)) == s)
+    g_hash_table_remove(_view_surfaces_by_image, GINT_TO_POINTER(s->key.imgid));
+  g_hash_table_remove(_view_surfaces, &s->key);
+  g_queue_delete_link(&_view_surfaces_lru, s->lru);
+  _view_surfaces_size -= s->size;
+  if(s->surface) cairo_surface_destroy(s->surface);
+  g_free(s);
+}
+
+static void _view_surface_cache_init()
+{
+  _view_surfaces = g_hash_table_new(_view_surface_key_hash, _view_surface_key_equal);
+  _view_surfaces_by_image = g_hash_table_new(g_direct_hash, g_direct_equal);
+}
+
+static void _view_surface_cache_cleanup()
+{
+  g_static_mutex_lock(&_view_surface_mutex);
+  while(!g_queue_is_empty(&_view_surfaces_lru))
+    _view_surface_remove((dt_view_surface_t *)g_queue_peek_head(&_view_surfaces_lru));
+  g_hash_table_destroy(_view_surfaces);
+  g_hash_table_destroy(_view_surfaces_by_image);
+  _view_surfaces = _view_surfaces_by_image = NULL;
+  g_static_mutex_unlock(&_view_surface_mutex);
+}
+
+// the scale to fit a thumbnail of size wd x ht centered into a cell, as dt_view_image_expose draws it.
+static inline float _view_image_scale(const int32_t zoom, const int32_t width, const int32_t height,
+                                      const int32_t wd, const int32_t ht)
+{
+  if(zoom == 1)
+    return fminf(fminf(darktable.thumbnail_width, width) / (float)wd,
+                 fminf(darktable.thumbnail_height, height) / (float)ht);
+  return fminf(width*0.90f/(float)wd, height*0.90f/(float)ht);
+}
+
+static int32_t _view_surface_job_run(dt_job_t *job)
+{
+  const dt_view_surface_key_t *key = (const dt_view_surface_key_t *)job->param;
+  dt_view_surface_t *s = (dt_view_surface_t *)g_malloc0(sizeof(dt_view_surface_t));
+  s->key = *key;
+  // taken before the pixels: if they change while we scale, the next expose will see the surface is stale.
+  s->generation = darktable.mipmap_cache->generation;
+
+  const float imgwd = key->zoom == 1 ? .97f : .90f;
+  const dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache,
+                                 imgwd*key->width, imgwd*key->height);
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, key->imgid, mip, DT_MIPMAP_BEST_EFFORT);
+  if(buf.buf)
+  {
+    uint8_t *scratchmem = dt_mipmap_cache_get_scratchmem(darktable.mipmap_cache);
+    uint8_t *buf_decompressed = dt_mipmap_cache_decompress(&buf, scratchmem);
+    const int32_t stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, buf.width);
+    cairo_surface_t *source = cairo_image_surface_create_for_data(buf_decompressed, CAIRO_FORMAT_RGB24,
+                              buf.width, buf.height, stride);
+    const float scale = _view_image_scale(key->zoom, key->width, key->height, buf.width, buf.height);
+    const int32_t wd = MAX(1, (int32_t)(scale*buf.width + .5f)), ht = MAX(1, (int32_t)(scale*buf.height + .5f));
+    s->surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, wd, ht);
+    cairo_t *cr = cairo_create(s->surface);
+    cairo_scale(cr, wd/(double)buf.width, ht/(double)buf.height);
+    cairo_set_source_surface(cr, source, 0, 0);
+    // in skull mode, we want to see big pixels.
+    // in 1 iir mode for the right mip, we want to see exactly what the pipe gave us, 1:1 pixel for pixel.
+    // in between, filtering just makes stuff go unsharp.
+    if((buf.width <= 8 && buf.height <= 8) || fabsf(scale - 1.0f) < 0.01f)
+      cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    cairo_surface_destroy(source);
+    s->buf_width = buf.width;
+    s->buf_height = buf.height;
+    s->size = (size_t)cairo_image_surface_get_stride(s->surface) * ht;
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+  }
+
+  g_static_mutex_lock(&_view_surface_mutex);
+  if(!_view_surfaces)
+  {
+    // shutting down
+    g_static_mutex_unlock(&_view_surface_mutex);
+    if(s->surface) cairo_surface_destroy(s->surface);
+    g_free(s);
+    return 0;
+  }
+  dt_view_surface_t *old = (dt_view_surface_t *)g_hash_table_lookup(_view_surfaces, &s->key);
+  if(old) _view_surface_remove(old);
+  g_hash_table_insert(_view_surfaces, &s->key, s);
+  // keep the last surface of this image as a stand-in for cells of other sizes, but only a real one.
+  if(s->surface || !g_hash_table_lookup(_view_surfaces_by_image, GINT_TO_POINTER(s->key.imgid)))
+    g_hash_table_insert(_view_surfaces_by_image, GINT_TO_POINTER(s->key.imgid), s);
+  g_queue_push_head(&_view_surfaces_lru, s);
+  s->lru = g_queue_peek_head_link(&_view_surfaces_lru);
+  _view_surfaces_size += s->size;
+  while(_view_surfaces_size > DT_VIEW_SURFACE_CACHE_SIZE && g_queue_get_length(&_view_surfaces_lru) > 1)
+    _view_surface_remove((dt_view_surface_t *)g_queue_peek_tail(&_view_surfaces_lru));
+  const int ready = s->surface != NULL;
+  if(ready) __sync_fetch_and_add(&_view_surfaces_generation, 1);
+  g_static_mutex_unlock(&_view_surface_mutex);
+
+  // everyone drawing thumbnails redraws on this.
+  if(ready) dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED);
+  return 0;
+}
+
+/* copies the surface to draw for the given cell into out, with its own reference to the cairo surface.
+   if there is none for this cell, or it is stale, a job to prepare it is queued, and the surface of
+   the image last prepared for any cell is returned meanwhile, with *fresh set to 0.
+   returns 0 if there's nothing to draw. */
+static int _view_surface_get(const int32_t imgid, const int32_t width, const int32_t height,
+                             const int32_t zoom, dt_view_surface_t *out, int *fresh)
+{
+  const dt_view_surface_key_t key = { imgid, width, height, zoom == 1 };
+  memset(out, 0, sizeof(*out));
+  *fresh = 0;
+  g_static_mutex_lock(&_view_surface_mutex);
+  dt_view_surface_t *s = (dt_view_surface_t *)g_hash_table_lookup(_view_surfaces, &key);
+  if(s) *fresh = s->generation == darktable.mipmap_cache->generation;
+  if(!s || !s->surface) s = (dt_view_surface_t *)g_hash_table_lookup(_view_surfaces_by_image, GINT_TO_POINTER(imgid));
+  if(s)
+  {
+    *out = *s;
+    if(out->surface) cairo_surface_reference(out->surface);
+    g_queue_unlink(&_view_surfaces_lru, s->lru);
+    g_queue_push_head_link(&_view_surfaces_lru, s->lru);
+  }
+  g_static_mutex_unlock(&_view_surface_mutex);
+
+  if(!*fresh)
+  {
+    dt_job_t job;
+    dt_control_job_init(&job, "prepare thumbnail %d", imgid);
+    job.execute = &_view_surface_job_run;
+    memcpy(job.param, &key, sizeof(key));
+    dt_control_add_job(darktable.control, &job);
+  }
+  return out->surface != NULL;
+}
+
+uint32_t dt_view_image_surface_generation()
+{
+  return _view_surfaces_generation;
+}
+
+static inline uint64_t _view_hash(uint64_t hash, const void *data, const size_t len)
+{
+  // fnv-1a
+  const uint8_t *d = (const uint8_t *)data;
+  for(size_t k = 0; k < len; k++) hash = (hash ^ d[k]) * 1099511628211ull;
+  return hash;
+}
+
+uint64_t dt_view_collection_state(const int32_t offset, const int32_t count)
+{
+  sqlite3_stmt *stmt = darktable.view_manager->statements.collection_state;
+  uint64_t state = 14695981039346656037ull;
+  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(stmt);
+  DT_DEBUG_SQLITE3_RESET(stmt);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, offset);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, count);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int32_t cell[3] = { sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1), sqlite3_column_int(stmt, 2) };
+    state = _view_hash(state, cell, sizeof(cell));
+    const char *labels = (const char *)sqlite3_column_text(stmt, 3);
+    state = _view_hash(state, labels ? labels : "", labels ? strlen(labels) + 1 : 1);
+  }
+  return state;
+}
+
 void dt_view_manager_init(dt_view_manager_t *vm)
 {
+  _view_surface_cache_init();
+
   /* prepare statements */
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select * from selected_images where imgid = ?1", -1, &vm->statements.is_selected, NULL);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from selected_images where imgid = ?1", -1, &vm->statements.delete_from_selected, NULL);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "insert or ignore into selected_images values (?1)", -1, &vm->statements.make_selected, NULL);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select num from history where imgid = ?1", -1, &vm->statements.have_history, NULL);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select color from color_labels where imgid=?1", -1, &vm->statements.get_color, NULL);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select id from images where group_id = (select group_id from images where id=?1) and id != ?2", -1, &vm->statements.get_grouped, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select c.imgid, i.flags, "
+                              "(select count(*) from selected_images as s where s.imgid = c.imgid), "
+                              "(select group_concat(color) from color_labels as l where l.imgid = c.imgid) "
+                              "from memory.collected_images as c join images as i on i.id = c.imgid "
+                              "where c.rowid > ?1 order by c.rowid limit ?2", -1, &vm->statements.collection_state, NULL);
 
   int res=0, midx=0;
   char *modules[] =
@@ -82,6 +305,7 @@ void dt_view_manager_init(dt_view_manager_t *vm)
 void dt_view_manager_cleanup(dt_view_manager_t *vm)
 {
   for(int k=0; k<vm->num_views; k++) dt_view_unload_module(vm->view + k);
+  _view_surface_cache_cleanup();
 }
 
 const dt_view_t *dt_view_manager_get_current_view(dt_view_manager_t *vm)
@@ -673,7 +897,7 @@ dt_view_get_image_to_act_on()
   }
 }
 
-void
+int
 dt_view_image_expose(
   dt_view_image_over_t *image_over,
   uint32_t imgid,
@@ -695,22 +919,9 @@ dt_view_image_expose(
 #define DRAW_SELECTED 1
 #define DRAW_HISTORY 1
 
-#if DRAW_THUMB == 1
-  // this function is not thread-safe (gui-thread only), so we
-  // can safely allocate this leaking bit of memory to decompress thumbnails:
-  static int first_time = 1;
-  static uint8_t *scratchmem = NULL;
-  if(first_time)
-  {
-    // scratchmem might still be NULL after this, if compression is off.
-    scratchmem = dt_mipmap_cache_alloc_scratchmem(darktable.mipmap_cache);
-    first_time = 0;
-  }
-#endif
-
   cairo_save (cr);
   float bgcol = 0.4, fontcol = 0.425, bordercol = 0.1, outlinecol = 0.2;
-  int selected = 0, altered = 0, imgsel = -1, is_grouped = 0;
+  int selected = 0, altered = 0, imgsel = -1, is_grouped = 0, thumb_fresh = 1;
   // this is a gui thread only thing. no mutex required:
   imgsel = darktable.control->global_settings.lib_image_mouse_over_id;
 
@@ -738,15 +949,10 @@ dt_view_image_expose(
   const dt_image_t *img = dt_image_cache_read_testget(darktable.image_cache, imgid);
 
 #if DRAW_GROUPING == 1
-  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.get_grouped);
-  DT_DEBUG_SQLITE3_RESET(darktable.view_manager->statements.get_grouped);
-  DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.get_grouped, 1, imgid);
-  DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.get_grouped, 2, imgid);
-
   /* lets check if imgid is in a group */
-  if(sqlite3_step(darktable.view_manager->statements.get_grouped) == SQLITE_ROW)
+  if(dt_grouping_get_group_size(imgid) > 1)
     is_grouped = 1;
-  else if(img && darktable.gui->expanded_group_id == img->group_id)
+  else if(darktable.gui->expanded_group_id == dt_grouping_get_group(imgid))
     darktable.gui->expanded_group_id = -1;
 #endif
 
@@ -765,13 +971,7 @@ dt_view_image_expose(
     if(!img)
       img = dt_image_cache_read_get(darktable.image_cache, imgid);
   }
-  float imgwd = 0.90f;
-  if(zoom == 1)
-  {
-    imgwd = .97f;
-    // cairo_set_antialias(cr, CAIRO_ANTIALIAS_NONE);
-  }
-  else
+  if(zoom != 1)
   {
     double x0 = 1, y0 = 1, rect_width = width-2, rect_height = height-2, radius = 5;
     double x1, y1, off, off1;
@@ -810,64 +1010,42 @@ dt_view_image_expose(
     }
   }
 
-  dt_mipmap_buffer_t buf;
-  dt_mipmap_size_t mip =
-    dt_mipmap_cache_get_matching_size(
-      darktable.mipmap_cache,
-      imgwd*width, imgwd*height);
-  dt_mipmap_cache_read_get(
-    darktable.mipmap_cache,
-    &buf,
-    imgid,
-    mip,
-    0);
 #if DRAW_THUMB == 1
   float scale = 1.0;
-  // decompress image, if necessary. if compression is off, scratchmem will be == NULL,
-  // so get the real pointer back:
-  uint8_t *buf_decompressed = dt_mipmap_cache_decompress(&buf, scratchmem);
-
-  cairo_surface_t *surface = NULL;
-  if(buf.buf)
-  {
-    const int32_t stride = cairo_format_stride_for_width (CAIRO_FORMAT_RGB24, buf.width);
-    surface = cairo_image_surface_create_for_data (buf_decompressed, CAIRO_FORMAT_RGB24, buf.width, buf.height, stride);
-    if(zoom == 1)
-    {
-      scale = fminf(
-                fminf(darktable.thumbnail_width, width) / (float)buf.width,
-                fminf(darktable.thumbnail_height, height) / (float)buf.height
-              );
-    }
-    else scale = fminf(width*imgwd/(float)buf.width, height*imgwd/(float)buf.height);
-  }
+  // the scaled thumbnail is prepared by a job, this only blits it:
+  dt_view_surface_t thumb;
+  const int have_thumb = _view_surface_get(imgid, width, height, zoom, &thumb, &thumb_fresh);
+  if(have_thumb)
+    scale = _view_image_scale(zoom, width, height, thumb.buf_width, thumb.buf_height);
 
   // draw centered and fitted:
   cairo_save(cr);
   cairo_translate(cr, width/2.0, height/2.0f);
   cairo_scale(cr, scale, scale);
 
-  if(buf.buf)
+  if(have_thumb)
   {
-    cairo_translate(cr, -.5f*buf.width, -.5f*buf.height);
-    cairo_set_source_surface (cr, surface, 0, 0);
-    // set filter no nearest:
-    // in skull mode, we want to see big pixels.
-    // in 1 iir mode for the right mip, we want to see exactly what the pipe gave us, 1:1 pixel for pixel.
-    // in between, filtering just makes stuff go unsharp.
-    if((buf.width <= 8 && buf.height <= 8) || fabsf(scale - 1.0f) < 0.01f)
+    const int32_t surface_wd = cairo_image_surface_get_width(thumb.surface);
+    const int32_t surface_ht = cairo_image_surface_get_height(thumb.surface);
+    cairo_translate(cr, -.5f*thumb.buf_width, -.5f*thumb.buf_height);
+    cairo_save(cr);
+    cairo_scale(cr, thumb.buf_width/(float)surface_wd, thumb.buf_height/(float)surface_ht);
+    cairo_set_source_surface (cr, thumb.surface, 0, 0);
+    // prepared for this very cell, it's a 1:1 copy. only stand-ins of other sizes want filtering.
+    if(thumb.key.width == width && thumb.key.height == height && thumb.key.zoom == (zoom == 1))
       cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_NEAREST);
-    cairo_rectangle(cr, 0, 0, buf.width, buf.height);
+    cairo_rectangle(cr, 0, 0, surface_wd, surface_ht);
     cairo_fill(cr);
-    cairo_surface_destroy (surface);
+    cairo_restore(cr);
+    cairo_surface_destroy (thumb.surface);
 
-    cairo_rectangle(cr, 0, 0, buf.width, buf.height);
+    cairo_rectangle(cr, 0, 0, thumb.buf_width, thumb.buf_height);
   }
 
   // border around image
   const float border = zoom == 1 ? 16/scale : 2/scale;
   cairo_set_source_rgb(cr, bordercol, bordercol, bordercol);
-  if(buf.buf && selected)
+  if(have_thumb && selected)
   {
     cairo_set_line_width(cr, 1./scale);
     if(zoom == 1)
@@ -880,9 +1058,9 @@ dt_view_image_expose(
       float alpha = 1.0f;
       for(int k=0; k<16; k++)
       {
-        cairo_rectangle(cr, 0, 0, buf.width, buf.height);
+        cairo_rectangle(cr, 0, 0, thumb.buf_width, thumb.buf_height);
         cairo_new_sub_path(cr);
-        cairo_rectangle(cr, -k/scale, -k/scale, buf.width+2.*k/scale, buf.height+2.*k/scale);
+        cairo_rectangle(cr, -k/scale, -k/scale, thumb.buf_width+2.*k/scale, thumb.buf_height+2.*k/scale);
         cairo_set_source_rgba(cr, 0, 0, 0, alpha);
         alpha *= 0.6f;
         cairo_fill(cr);
@@ -892,21 +1070,19 @@ dt_view_image_expose(
     {
       cairo_set_fill_rule (cr, CAIRO_FILL_RULE_EVEN_ODD);
       cairo_new_sub_path(cr);
-      cairo_rectangle(cr, -border, -border, buf.width+2.*border, buf.height+2.*border);
+      cairo_rectangle(cr, -border, -border, thumb.buf_width+2.*border, thumb.buf_height+2.*border);
       cairo_stroke_preserve(cr);
       cairo_set_source_rgb(cr, 1.0-bordercol, 1.0-bordercol, 1.0-bordercol);
       cairo_fill(cr);
     }
   }
-  else if(buf.buf)
+  else if(have_thumb)
   {
     cairo_set_line_width(cr, 1);
     cairo_stroke(cr);
   }
   cairo_restore(cr);
 #endif
-  if(buf.buf)
-    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
 
   const float fscale = fminf(width, height);
   if(imgsel == imgid || full_preview)
@@ -1089,6 +1265,7 @@ dt_view_image_expose(
   const double end = dt_get_wtime();
   if (darktable.unmuted & DT_DEBUG_PERF)
     dt_print(DT_DEBUG_LIGHTTABLE, "[lighttable] image expose took %0.04f sec\n", end-start);
+  return !thumb_fresh;
 }
 
 
@@ -107,8 +107,9 @@ dt_view_image_over_t;
     or the imgid otherwise */
 int32_t dt_view_get_image_to_act_on();
 
-/** expose an image, set image over flags. */
-void
+/** expose an image, set image over flags. returns non-zero if the thumbnail drawn is
+    a stand-in, which is replaced once the right one has been prepared. */
+int
 dt_view_image_expose(
   dt_view_image_over_t *image_over,
   uint32_t index,
@@ -120,6 +121,13 @@ dt_view_image_expose(
   int32_t py,
   gboolean full_preview);
 
+/** changes whenever a thumbnail dt_view_image_expose() draws from has been prepared. */
+uint32_t dt_view_image_surface_generation();
+/** hash of what dt_view_image_expose() shows for count images of the collection starting after offset,
+    without the mouse over them, to tell if a pre-drawn copy is still good. needs
+    dt_collection_update_ids(). the thumbnail pixels are not part of it, see the generations. */
+uint64_t dt_view_collection_state(const int32_t offset, const int32_t count);
+
 /** Set the selection bit to a given value for the specified image */
 void dt_view_set_selection(int imgid, int value);
 /** toggle selection of given image. */
@@ -151,8 +159,8 @@ typedef struct dt_view_manager_t
     sqlite3_stmt *make_selected;
     /* select color from color_labels where imgid=?1 */
     sqlite3_stmt *get_color;
-    /* select images in group from images where imgid=?1 (also bind to ?2) */
-    sqlite3_stmt *get_grouped;
+    /* what the cells of collected images ?1+1 .. ?1+?2 show, see dt_view_collection_state() */
+    sqlite3_stmt *collection_state;
   } statements;
 
 